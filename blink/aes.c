@@ -0,0 +1,275 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <string.h>
+
+#include "blink/endian.h"
+#include "blink/intrin.h"
+#include "blink/machine.h"
+#include "blink/modrm.h"
+#include "blink/rde.h"
+#include "blink/types.h"
+
+#if defined(__aarch64__) && defined(__GNUC__) && \
+    (defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO))
+#include <arm_neon.h>
+#define ARM_AES 1
+#else
+#define ARM_AES 0
+#endif
+
+/**
+ * @fileoverview AES-NI instructions.
+ *
+ * Each round is computed by the host's own AES instructions when it has
+ * them, since guest crypto libraries are only fast when cpuid says aes
+ * is available, and a table based software round costs far more in the
+ * interpreter than the handful of host instructions it stands for. The
+ * portable fallback works on the 16 state bytes in the order x86 keeps
+ * them in an xmm register, i.e. byte 4*c+r holds column c and row r.
+ */
+
+static u8 kAesSbox[256];
+static u8 kAesInvSbox[256];
+
+static u8 Rol8(u8 x, int k) {
+  return x << k | x >> (8 - k);
+}
+
+static u8 Xtime(u8 x) {
+  return x << 1 ^ (x & 0x80 ? 0x1b : 0);
+}
+
+static u8 Gmul(u8 a, u8 b) {
+  u8 r;
+  for (r = 0; b; b >>= 1, a = Xtime(a)) {
+    if (b & 1) r ^= a;
+  }
+  return r;
+}
+
+static void InitializeAes(void) {
+  u8 p, q;
+  static int once;
+  if (once) return;
+  // walk p over the multiplicative group via the generator 3, while q
+  // walks over the inverses by dividing by 3, then apply the affine map
+  p = q = 1;
+  do {
+    p = p ^ Xtime(p);
+    q ^= q << 1;
+    q ^= q << 2;
+    q ^= q << 4;
+    if (q & 0x80) q ^= 0x09;
+    kAesSbox[p] = q ^ Rol8(q, 1) ^ Rol8(q, 2) ^ Rol8(q, 3) ^ Rol8(q, 4) ^ 0x63;
+  } while (p != 1);
+  kAesSbox[0] = 0x63;
+  for (p = 0;; ++p) {
+    kAesInvSbox[kAesSbox[p]] = p;
+    if (p == 255) break;
+  }
+  once = 1;
+}
+
+static void SubBytes(u8 s[16], const u8 box[256]) {
+  int i;
+  for (i = 0; i < 16; ++i) {
+    s[i] = box[s[i]];
+  }
+}
+
+static void ShiftRows(u8 s[16], int dir) {
+  int c, r;
+  u8 t[16];
+  memcpy(t, s, 16);
+  for (c = 0; c < 4; ++c) {
+    for (r = 1; r < 4; ++r) {
+      s[c * 4 + r] = t[((c + dir * r) & 3) * 4 + r];
+    }
+  }
+}
+
+static void MixColumns(u8 s[16]) {
+  int c;
+  u8 a0, a1, a2, a3;
+  for (c = 0; c < 16; c += 4) {
+    a0 = s[c + 0], a1 = s[c + 1], a2 = s[c + 2], a3 = s[c + 3];
+    s[c + 0] = Xtime(a0) ^ Xtime(a1) ^ a1 ^ a2 ^ a3;
+    s[c + 1] = a0 ^ Xtime(a1) ^ Xtime(a2) ^ a2 ^ a3;
+    s[c + 2] = a0 ^ a1 ^ Xtime(a2) ^ Xtime(a3) ^ a3;
+    s[c + 3] = Xtime(a0) ^ a0 ^ a1 ^ a2 ^ Xtime(a3);
+  }
+}
+
+static void InvMixColumns(u8 s[16]) {
+  int c;
+  u8 a0, a1, a2, a3;
+  for (c = 0; c < 16; c += 4) {
+    a0 = s[c + 0], a1 = s[c + 1], a2 = s[c + 2], a3 = s[c + 3];
+    s[c + 0] = Gmul(a0, 14) ^ Gmul(a1, 11) ^ Gmul(a2, 13) ^ Gmul(a3, 9);
+    s[c + 1] = Gmul(a0, 9) ^ Gmul(a1, 14) ^ Gmul(a2, 11) ^ Gmul(a3, 13);
+    s[c + 2] = Gmul(a0, 13) ^ Gmul(a1, 9) ^ Gmul(a2, 14) ^ Gmul(a3, 11);
+    s[c + 3] = Gmul(a0, 11) ^ Gmul(a1, 13) ^ Gmul(a2, 9) ^ Gmul(a3, 14);
+  }
+}
+
+static void AddRoundKey(u8 s[16], const u8 k[16]) {
+  int i;
+  for (i = 0; i < 16; ++i) {
+    s[i] ^= k[i];
+  }
+}
+
+static u32 SubWord(u32 x) {
+  return (u32)kAesSbox[x >> 24] << 24 | (u32)kAesSbox[x >> 16 & 255] << 16 |
+         (u32)kAesSbox[x >> 8 & 255] << 8 | kAesSbox[x & 255];
+}
+
+static void AesKeygenAssist(u8 d[16], const u8 s[16], u32 rcon) {
+  u32 x1, x3;
+  x1 = SubWord(Read32(s + 4));
+  x3 = SubWord(Read32(s + 12));
+  Write32(d + 0, x1);
+  Write32(d + 4, (x1 >> 8 | x1 << 24) ^ rcon);
+  Write32(d + 8, x3);
+  Write32(d + 12, (x3 >> 8 | x3 << 24) ^ rcon);
+}
+
+static void AesPortable(int op, u8 x[16], const u8 y[16]) {
+  switch (op) {
+    case 0xDB:  // aesimc
+      memcpy(x, y, 16);
+      InvMixColumns(x);
+      break;
+    case 0xDC:  // aesenc
+    case 0xDD:  // aesenclast
+      ShiftRows(x, +1);
+      SubBytes(x, kAesSbox);
+      if (op == 0xDC) MixColumns(x);
+      AddRoundKey(x, y);
+      break;
+    case 0xDE:  // aesdec
+    case 0xDF:  // aesdeclast
+      ShiftRows(x, -1);
+      SubBytes(x, kAesInvSbox);
+      if (op == 0xDE) InvMixColumns(x);
+      AddRoundKey(x, y);
+      break;
+    default:
+      __builtin_unreachable();
+  }
+}
+
+#if X86_INTRINSICS
+static bool HasHostAes(void) {
+  u32 ax, bx, cx, dx;
+  static int res;  // 1 = no, 2 = yes
+  if (!res) {
+    asm("cpuid" : "=a"(ax), "=b"(bx), "=c"(cx), "=d"(dx) : "0"(1), "2"(0));
+    res = (cx & 1 << 25) ? 2 : 1;
+  }
+  return res == 2;
+}
+
+static bool AesHost(int op, u8 x[16], const u8 y[16]) {
+  char_xmmu_t a, b;
+  if (!HasHostAes()) return false;
+  memcpy(&a, x, 16);
+  memcpy(&b, y, 16);
+  switch (op) {
+    case 0xDB:
+      asm("aesimc\t%1,%0" : "=x"(a) : "x"(b));
+      break;
+    case 0xDC:
+      asm("aesenc\t%1,%0" : "+x"(a) : "x"(b));
+      break;
+    case 0xDD:
+      asm("aesenclast\t%1,%0" : "+x"(a) : "x"(b));
+      break;
+    case 0xDE:
+      asm("aesdec\t%1,%0" : "+x"(a) : "x"(b));
+      break;
+    case 0xDF:
+      asm("aesdeclast\t%1,%0" : "+x"(a) : "x"(b));
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  memcpy(x, &a, 16);
+  return true;
+}
+#elif ARM_AES
+static bool AesHost(int op, u8 x[16], const u8 y[16]) {
+  uint8x16_t a, k, z;
+  a = vld1q_u8(x);
+  k = vld1q_u8(y);
+  z = vdupq_n_u8(0);
+  // arm adds the round key before the substitution, rather than after
+  switch (op) {
+    case 0xDB:
+      a = vaesimcq_u8(k);
+      break;
+    case 0xDC:
+      a = veorq_u8(vaesmcq_u8(vaeseq_u8(a, z)), k);
+      break;
+    case 0xDD:
+      a = veorq_u8(vaeseq_u8(a, z), k);
+      break;
+    case 0xDE:
+      a = veorq_u8(vaesimcq_u8(vaesdq_u8(a, z)), k);
+      break;
+    case 0xDF:
+      a = veorq_u8(vaesdq_u8(a, z), k);
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  vst1q_u8(x, a);
+  return true;
+}
+#else
+static bool AesHost(int op, u8 x[16], const u8 y[16]) {
+  return false;
+}
+#endif
+
+void OpAes(P) {
+  u8 x[16], y[16];
+  if (!Osz(rde)) {
+    OpUdImpl(m);
+    return;
+  }
+  memcpy(x, XmmRexrReg(m, rde), 16);
+  memcpy(y, GetModrmRegisterXmmPointerRead16(A), 16);
+  if (!AesHost(Opcode(rde), x, y)) {
+    InitializeAes();
+    AesPortable(Opcode(rde), x, y);
+  }
+  memcpy(XmmRexrReg(m, rde), x, 16);
+}
+
+void OpAeskeygenassist(P) {
+  u8 x[16];
+  if (!Osz(rde)) {
+    OpUdImpl(m);
+    return;
+  }
+  InitializeAes();
+  AesKeygenAssist(x, GetModrmRegisterXmmPointerRead16(A), uimm0 & 255);
+  memcpy(XmmRexrReg(m, rde), x, 16);
+}
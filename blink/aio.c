@@ -0,0 +1,307 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/aio.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/bus.h"
+#include "blink/dll.h"
+#include "blink/fds.h"
+#include "blink/flag.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/preadv.h"
+#include "blink/stats.h"
+#include "blink/syscall.h"
+#include "blink/thread.h"
+#include "blink/timespec.h"
+#include "blink/util.h"
+#include "blink/vfs.h"
+
+/**
+ * @fileoverview Asynchronous i/o worker pool.
+ *
+ * Reads and writes on regular files can block the host thread in an
+ * uninterruptible sleep, e.g. when the file lives on a network mount,
+ * which means the host kernel won't raise EINTR and our guest thread
+ * can't run its signal handlers until the i/o completes. This module
+ * lets such i/o be handed off to a small pool of host worker threads,
+ * while the guest thread waits on a futex entry that signals interrupt
+ * and the worker wakes on completion.
+ *
+ * Since the transfer happens directly to and from guest memory, and a
+ * regular file read can't be half undone, a job that's been picked up
+ * by a worker is always waited out; signal handlers get to run in the
+ * meantime, and only jobs still sitting in the queue are cancelled by
+ * signals that want the system call to fail with EINTR.
+ */
+
+#define AIO_JOB_CONTAINER(e) DLL_CONTAINER(struct AioJob, elem, e)
+
+struct AioJob {
+  bool write;           // otherwise read
+  bool started;         // guarded by g_aio.lock
+  int fildes;           // host file descriptor
+  int iovcnt;           // number of iov entries
+  int err;              // errno of the transfer
+  off_t offset;         // file offset, or -1 to use the file position
+  ssize_t rc;           // result of the transfer
+  struct Futex *futex;  // woken by the worker upon completion
+  const struct iovec *iov;
+  struct Dll elem;
+};
+
+static struct Aio {
+  int threads;         // number of workers that have been created
+  int idle;            // number of workers waiting for a job
+  struct Dll *queue;   // jobs no worker has picked up yet
+  pthread_once_t_ once;
+  pthread_cond_t_ pending;
+  pthread_mutex_t_ lock;
+} g_aio = {
+    .once = PTHREAD_ONCE_INIT_,
+};
+
+static void InitAio(void) {
+  unassert(!pthread_mutex_init(&g_aio.lock, 0));
+  unassert(!pthread_cond_init(&g_aio.pending, 0));
+}
+
+static ssize_t RunAioJob(struct AioJob *job) {
+  if (job->write) {
+    if (job->offset == -1) {
+      return VfsWritev(job->fildes, job->iov, job->iovcnt);
+    } else {
+      return VfsPwritev(job->fildes, job->iov, job->iovcnt, job->offset);
+    }
+  } else {
+    if (job->offset == -1) {
+      return VfsReadv(job->fildes, job->iov, job->iovcnt);
+    } else {
+      return VfsPreadv(job->fildes, job->iov, job->iovcnt, job->offset);
+    }
+  }
+}
+
+// returns true if i/o on guest fd should go through OffloadIo()
+bool ShouldOffloadIo(struct Machine *m, int fildes) {
+#ifdef HAVE_THREADS
+  i8 aio;
+  struct Fd *fd;
+  struct stat st;
+  if (!FLAG_asyncio) return false;
+  LOCK(&m->system->fds.lock);
+  if ((fd = GetFd(&m->system->fds, fildes)) && fd->cb == &kFdCbHost) {
+    aio = fd->aio;
+  } else {
+    aio = -1;
+  }
+  UNLOCK(&m->system->fds.lock);
+  if (!aio) {
+    // pipes, sockets, and terminals are interruptible by the host, so
+    // only regular files and block devices are worth handing off
+    if (!VfsFstat(fildes, &st) &&
+        (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode))) {
+      aio = 1;
+    } else {
+      aio = -1;
+    }
+    LOCK(&m->system->fds.lock);
+    if ((fd = GetFd(&m->system->fds, fildes))) {
+      fd->aio = aio;
+    }
+    UNLOCK(&m->system->fds.lock);
+  }
+  return aio > 0;
+#else
+  return false;
+#endif
+}
+
+#ifdef HAVE_THREADS
+
+static void *AioWorker(void *arg) {
+  ssize_t rc;
+  struct Dll *e;
+  struct AioJob *job;
+  LOCK(&g_aio.lock);
+  for (;;) {
+    while (!(e = dll_first(g_aio.queue))) {
+      ++g_aio.idle;
+      unassert(!pthread_cond_wait(&g_aio.pending, &g_aio.lock));
+      --g_aio.idle;
+    }
+    dll_remove(&g_aio.queue, e);
+    job = AIO_JOB_CONTAINER(e);
+    job->started = true;
+    UNLOCK(&g_aio.lock);
+    do {
+      rc = RunAioJob(job);
+    } while (rc == -1 && errno == EINTR);
+    LOCK(&g_aio.lock);
+    job->rc = rc;
+    job->err = errno;
+    // the waiter acquires our lock before it releases its futex entry
+    UnparkFutex(job->futex);
+  }
+  return 0;
+}
+
+// @assume g_aio.lock
+static bool SpawnAioWorker(void) {
+  int err;
+  pthread_t th;
+  sigset_t ss, oldss;
+  sigfillset(&ss);
+  unassert(!pthread_sigmask(SIG_SETMASK, &ss, &oldss));
+  err = pthread_create(&th, 0, AioWorker, 0);
+  unassert(!pthread_sigmask(SIG_SETMASK, &oldss, 0));
+  if (err) {
+    LOG_ONCE(LOGF("failed to create aio worker: %s", DescribeHostErrno(err)));
+    return false;
+  }
+  unassert(!pthread_detach(th));
+  ++g_aio.threads;
+  return true;
+}
+
+// submits job to the worker pool
+// returns false if there's no worker that'll ever pick it up
+static bool SubmitAioJob(struct AioJob *job) {
+  bool ok = true;
+  LOCK(&g_aio.lock);
+  dll_make_last(&g_aio.queue, &job->elem);
+  if (g_aio.idle) {
+    unassert(!pthread_cond_signal(&g_aio.pending));
+  } else if (g_aio.threads < FLAG_asyncio && !SpawnAioWorker()) {
+    if (!g_aio.threads) {
+      dll_remove(&g_aio.queue, &job->elem);
+      ok = false;
+    }
+  }
+  UNLOCK(&g_aio.lock);
+  return ok;
+}
+
+#endif /* HAVE_THREADS */
+
+// performs readv(), writev(), preadv(), or pwritev() on worker thread
+// the calling guest thread services signals while the i/o is underway
+ssize_t OffloadIo(struct Machine *m, int fildes, const struct iovec *iov,
+                  int iovcnt, off_t offset, bool write) {
+  ssize_t rc;
+  struct AioJob job;
+  job.write = write;
+  job.started = false;
+  job.fildes = fildes;
+  job.iov = iov;
+  job.iovcnt = iovcnt;
+  job.offset = offset;
+  job.futex = 0;
+  dll_init(&job.elem);
+#ifdef HAVE_THREADS
+  bool cancelled;
+  struct FutexBucket *b;
+  unassert(!pthread_once_(&g_aio.once, InitAio));
+  b = g_bus->futexes.bucket;
+  LOCK(&b->lock);
+  job.futex = AllocateFutex(b);
+  UNLOCK(&b->lock);
+  if (!job.futex) {
+    LOG_ONCE(LOGF("ran out of futexes"));
+  } else if (SubmitAioJob(&job)) {
+    STATISTIC(++aio_offloaded);
+    cancelled = false;
+    for (;;) {
+      // publish our entry so signals and thread kills can interrupt us;
+      // this happens each time since signal handlers may do i/o of their
+      // own, and it must happen before we check for them, to avoid races
+      atomic_store_explicit(&m->futex, job.futex, memory_order_seq_cst);
+      if (atomic_load_explicit(&job.futex->woken, memory_order_acquire)) {
+        break;
+      }
+      if (atomic_load_explicit(&m->killed, memory_order_acquire) ||
+          CheckInterrupt(m, true)) {
+        LOCK(&g_aio.lock);
+        if (!job.started) {
+          dll_remove(&g_aio.queue, &job.elem);
+          cancelled = true;
+        }
+        UNLOCK(&g_aio.lock);
+        if (cancelled) break;
+        // the transfer is underway in the host kernel, so wait it out
+      }
+      ParkFutex(job.futex, GetMaxTime());
+    }
+    atomic_store_explicit(&m->futex, 0, memory_order_release);
+    // make sure the worker is done touching our futex entry
+    LOCK(&g_aio.lock);
+    UNLOCK(&g_aio.lock);
+    LOCK(&b->lock);
+    ReleaseFutex(b, job.futex);
+    UNLOCK(&b->lock);
+    if (cancelled) {
+      STATISTIC(++aio_cancelled);
+      errno = EINTR;
+      return -1;
+    }
+    // any signal that arrived didn't cause the transfer to fail
+    m->interrupted = false;
+    errno = job.err;
+    return job.rc;
+  } else {
+    LOCK(&b->lock);
+    ReleaseFutex(b, job.futex);
+    UNLOCK(&b->lock);
+  }
+#endif
+  RESTARTABLE(rc = RunAioJob(&job));
+  return rc;
+}
+
+// locks the worker pool before fork()
+void LockAio(void) {
+#ifdef HAVE_THREADS
+  unassert(!pthread_once_(&g_aio.once, InitAio));
+  LOCK(&g_aio.lock);
+#endif
+}
+
+// unlocks the worker pool in the parent after fork()
+void UnlockAio(void) {
+#ifdef HAVE_THREADS
+  UNLOCK(&g_aio.lock);
+#endif
+}
+
+// resets the worker pool in the child after fork()
+// workers don't survive fork() so they'll be recreated when needed
+void ResetAio(void) {
+#ifdef HAVE_THREADS
+  g_aio.threads = 0;
+  g_aio.idle = 0;
+  g_aio.queue = 0;
+  unassert(!pthread_mutex_init(&g_aio.lock, 0));
+  unassert(!pthread_cond_init(&g_aio.pending, 0));
+#endif
+}
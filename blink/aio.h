@@ -0,0 +1,16 @@
+#ifndef BLINK_AIO_H_
+#define BLINK_AIO_H_
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "blink/machine.h"
+
+bool ShouldOffloadIo(struct Machine *, int);
+ssize_t OffloadIo(struct Machine *, int, const struct iovec *, int, off_t,
+                  bool);
+void LockAio(void);
+void UnlockAio(void);
+void ResetAio(void);
+
+#endif /* BLINK_AIO_H_ */
@@ -35,6 +35,8 @@
 #define ALU_INT64 3
 
 typedef i64 (*aluop_f)(struct Machine *, u64, u64);
+typedef i64 (*bitop_f)(u64, u64, struct Machine *);
+typedef i64 (*shxop_f)(u64, u64);
 
 extern const aluop_f kAlu[12][4];
 extern const aluop_f kBsu[8][4];
@@ -45,6 +47,15 @@ extern const aluop_f kJustBsu32[8];
 extern const aluop_f kAluFast[8][4];
 extern const aluop_f kJustBsuCl32[8];
 extern const aluop_f kJustBsuCl64[8];
+extern const bitop_f kFastBit[4][3];
+extern const shxop_f kFastShx[4][2];
+extern const shxop_f kFastPbit[2][2];
+
+u64 FastBsf(u64, struct Machine *);
+u64 FastBsr(u64, struct Machine *);
+u64 FastPopcnt(u64, struct Machine *);
+u64 FastLzcnt(u64, struct Machine *, u64);
+u64 FastTzcnt(u64, struct Machine *, u64);
 
 i64 JustDec(u64);
 i64 JustNeg(u64);
@@ -132,6 +143,9 @@ i64 Rcl64(struct Machine *, u64, u64);
 
 u64 BsuDoubleShift(struct Machine *, int, u64, u64, u8, bool);
 
+bool CanFetchAlu(int, int, const u8 *);
+u64 FetchAlu(int, int, u8 *, u64);
+
 i64 Adcx32(u64, u64, struct Machine *);
 i64 Adcx64(u64, u64, struct Machine *);
 i64 Adox32(u64, u64, struct Machine *);
@@ -31,8 +31,28 @@
 #include "blink/swap.h"
 #include "blink/thread.h"
 
+// performs locked inc, dec, or not with one host atomic instruction if
+// possible, in which case flags are computed from the value memory held
+static bool FetchAlu1(struct Machine *m, aluop_f f, int log2, u8 *p) {
+  int t;
+  u64 y;
+  if (f == kAlu[ALU_INC][log2]) {
+    t = ALU_ADD, y = 1;
+  } else if (f == kAlu[ALU_DEC][log2]) {
+    t = ALU_SUB, y = 1;
+  } else if (f == kAlu[ALU_NOT][log2]) {
+    t = ALU_XOR, y = -1;
+  } else {
+    return false;
+  }
+  if (!CanFetchAlu(t, log2, p)) return false;
+  f(m, FetchAlu(t, log2, p, y), 0);
+  return true;
+}
+
 static void AluEb(P, aluop_f op) {
   u8 x, z, *p = GetModrmRegisterBytePointerWrite1(A);
+  if (Lock(rde) && FetchAlu1(m, op, ALU_INT8, p)) return;
   if (Lock(rde)) {
     x = atomic_load_explicit((_Atomic(u8) *)p, memory_order_acquire);
     do {
@@ -71,6 +91,7 @@ static void AluEvqp(P, const aluop_f ops[4]) {
   f = ops[WordLog2(rde)];
   if (Rexw(rde)) {
     p = GetModrmRegisterWordPointerWrite8(A);
+    if (Lock(rde) && FetchAlu1(m, f, ALU_INT64, p)) return;
 #if CAN_64BIT
     if (Lock(rde) && !((uintptr_t)p & 7)) {
       u64 x, z;
@@ -93,6 +114,7 @@ static void AluEvqp(P, const aluop_f ops[4]) {
   } else if (!Osz(rde)) {
     u32 x, z;
     p = GetModrmRegisterWordPointerWrite4(A);
+    if (Lock(rde) && FetchAlu1(m, f, ALU_INT32, p)) return;
     if (Lock(rde) && !((uintptr_t)p & 3)) {
       x = atomic_load_explicit((_Atomic(u32) *)p, memory_order_acquire);
       do {
@@ -110,6 +132,7 @@ static void AluEvqp(P, const aluop_f ops[4]) {
     }
   } else {
     p = GetModrmRegisterWordPointerWrite2(A);
+    if (Lock(rde) && FetchAlu1(m, f, ALU_INT16, p)) return;
     if (Lock(rde) && !((uintptr_t)p & 1)) {
       u16 x, z;
       x = atomic_load_explicit((_Atomic(u16) *)p, memory_order_acquire);
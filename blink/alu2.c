@@ -65,12 +65,24 @@ void LoadAluFlipArgs(P) {
   }
 }
 
+// performs locked op with one host atomic instruction if possible, in
+// which case the flags are computed from the value memory held before
+static bool FetchAluw(struct Machine *m, int t, int log2, aluop_f f, u8 *p,
+                      u64 y) {
+  if (!CanFetchAlu(t, log2, p)) return false;
+  f(m, FetchAlu(t, log2, p, y), y);
+  return true;
+}
+
 void OpAlub(P) {
+  int t;
   u8 x, y, z, *p, *q;
   aluop_f f;
-  f = kAlu[(Opcode(rde) & 070) >> 3][0];
+  t = (Opcode(rde) & 070) >> 3;
+  f = kAlu[t][0];
   p = GetModrmRegisterBytePointerWrite1(A);
   q = ByteRexrReg(m, rde);
+  if (Lock(rde) && FetchAluw(m, t, ALU_INT8, f, p, Get8(q))) return;
   if (Lock(rde)) {
     x = atomic_load_explicit((_Atomic(u8) *)p, memory_order_acquire);
     y = atomic_load_explicit((_Atomic(u8) *)q, memory_order_relaxed);
@@ -96,6 +108,7 @@ void OpAluw(P) {
   f = kAlu[t][RegLog2(rde)];
   if (Rexw(rde)) {
     p = GetModrmRegisterWordPointerWrite8(A);
+    if (Lock(rde) && FetchAluw(m, t, ALU_INT64, f, p, Get64(q))) return;
 #if CAN_64BIT
     if (Lock(rde) && !((uintptr_t)p & 7)) {
       u64 x, y, z;
@@ -132,6 +145,7 @@ void OpAluw(P) {
     if (IsModrmRegister(rde)) {
       Put32(p + 4, 0);
     }
+    if (Lock(rde) && FetchAluw(m, t, ALU_INT32, f, p, Get32(q))) return;
     if (Lock(rde) && !((uintptr_t)p & 3)) {
       x = atomic_load_explicit((_Atomic(u32) *)p, memory_order_acquire);
       y = atomic_load_explicit((_Atomic(u32) *)q, memory_order_relaxed);
@@ -152,6 +166,7 @@ void OpAluw(P) {
   } else {
     u16 x, y, z;
     p = GetModrmRegisterWordPointerWrite2(A);
+    if (Lock(rde) && FetchAluw(m, t, ALU_INT16, f, p, Get16(q))) return;
     if (Lock(rde) && !((uintptr_t)p & 1)) {
       x = atomic_load_explicit((_Atomic(u16) *)p, memory_order_acquire);
       y = atomic_load_explicit((_Atomic(u16) *)q, memory_order_relaxed);
@@ -189,6 +204,9 @@ void OpAluw(P) {
                "m",     // call micro-op
                (u64)0, kPutReg64[RexrReg(rde)]);
       }
+    } else if (!flags && IsModrmRegister(rde) &&
+               JitAluRegs(A, t, RexbRm(rde), RexrReg(rde), 0)) {
+      STATISTIC(++alu_unflagged);
     } else {
       LoadAluArgs(A);
       switch (flags) {
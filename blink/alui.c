@@ -55,15 +55,22 @@ static void AluiRo(P, const aluop_f ops[4], const aluop_f fast[4]) {
 }
 
 static void AluiUnlocked(P, u8 *p, aluop_f op) {
+  int flags;
   WriteRegisterOrMemoryBW(rde, p, op(m, ReadRegisterOrMemoryBW(rde, p), uimm0));
   if (IsMakingPath(m)) {
     STATISTIC(++alu_ops);
+    flags = GetNeededFlags(m, m->ip, CF | ZF | SF | OF | AF | PF);
+    if (!flags && IsModrmRegister(rde) &&
+        JitAluRegs(A, ModrmReg(rde), RexbRm(rde), -1, uimm0)) {
+      STATISTIC(++alu_unflagged);
+      return;
+    }
     Jitter(A,
            "B"      // res0 = GetRegOrMem(RexbRm)
            "r0a1="  // arg1 = res0
            "a2i",   // arg2 = uimm0
            uimm0);
-    switch (GetNeededFlags(m, m->ip, CF | ZF | SF | OF | AF | PF)) {
+    switch (flags) {
       case 0:
         STATISTIC(++alu_unflagged);
         if (GetFlagDeps(rde)) {
@@ -94,6 +101,10 @@ static void AluiUnlocked(P, u8 *p, aluop_f op) {
 }
 
 static void AluiLocked(P, u8 *p, aluop_f op) {
+  if (CanFetchAlu(ModrmReg(rde), RegLog2(rde), p)) {
+    op(m, FetchAlu(ModrmReg(rde), RegLog2(rde), p, uimm0), uimm0);
+    return;
+  }
   switch (RegLog2(rde)) {
     case 3:
 #if CAN_64BIT
@@ -33,8 +33,15 @@
 #include "blink/linux.h"
 #include "blink/machine.h"
 #include "blink/macros.h"
+#include "blink/thread.h"
 #include "blink/util.h"
 #include "blink/vfs.h"
+#include "blink/xlat.h"
+
+#if defined(MSG_ERRQUEUE) && defined(__linux)
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#endif
 
 #ifndef DISABLE_SOCKETS
 #ifndef DISABLE_ANCILLARY
@@ -68,7 +75,7 @@ static int AppendCmsg(struct Machine *m, struct msghdr *msg, int level,
                       int type, const void *data, size_t size) {
   struct cmsghdr *cmsg;
   if (!msg->msg_control &&
-      !(msg->msg_control = AddToFreeList(m, calloc(1, kMaxAncillary)))) {
+      !(msg->msg_control = AllocateScratch(m, kMaxAncillary))) {
     return -1;
   }
   if (msg->msg_controllen + CMSG_SPACE(size) > kMaxAncillary) {
@@ -76,6 +83,7 @@ static int AppendCmsg(struct Machine *m, struct msghdr *msg, int level,
     return enomem();
   }
   cmsg = (struct cmsghdr *)((u8 *)msg->msg_control + msg->msg_controllen);
+  memset(cmsg, 0, CMSG_SPACE(size));
   cmsg->cmsg_len = CMSG_LEN(size);
   cmsg->cmsg_level = level;
   cmsg->cmsg_type = type;
@@ -239,18 +247,27 @@ static i64 CopyCmsg(struct Machine *m, struct msghdr_linux *gm, int level,
   return hdrspace + ROUNDUP(len, 8);
 }
 
-static void TrackScmRightsFd(struct Machine *m, int fildes, int flags) {
-  int oflags;
-  SYS_LOGF("ReceiveScmRights(fd=%d)", fildes);
-  unassert((oflags = VfsFcntl(fildes, F_GETFL, 0)) != -1);
-  InheritFd(AddFd(
-      &m->system->fds, fildes,
-      oflags | O_RDWR | (flags & MSG_CMSG_CLOEXEC_LINUX ? O_CLOEXEC : 0)));
+// registers received descriptors with the fd table in one go, so that
+// processes passing many rights at once only take the table lock once
+static void TrackScmRightsFds(struct Machine *m, const int *fildes, size_t n,
+                              int flags) {
+  size_t i;
+  int oflags[SCM_MAX_FD_LINUX];
+  for (i = 0; i < n; ++i) {
+    SYS_LOGF("ReceiveScmRights(fd=%d)", fildes[i]);
+    unassert((oflags[i] = VfsFcntl(fildes[i], F_GETFL, 0)) != -1);
+    oflags[i] |= O_RDWR | (flags & MSG_CMSG_CLOEXEC_LINUX ? O_CLOEXEC : 0);
 #ifndef MSG_CMSG_CLOEXEC
-  if (flags & MSG_CMSG_CLOEXEC_LINUX) {
-    unassert(!VfsFcntl(fildes, F_SETFD, FD_CLOEXEC));
-  }
+    if (flags & MSG_CMSG_CLOEXEC_LINUX) {
+      unassert(!VfsFcntl(fildes[i], F_SETFD, FD_CLOEXEC));
+    }
 #endif
+  }
+  LOCK(&m->system->fds.lock);
+  for (i = 0; i < n; ++i) {
+    InheritFd(AddFd(&m->system->fds, fildes[i], oflags[i]));
+  }
+  UNLOCK(&m->system->fds.lock);
 }
 
 #ifdef SCM_RIGHTS
@@ -277,8 +294,8 @@ static i64 ReceiveScmRights(struct Machine *m, struct msghdr_linux *gm,
     // serialize fds
     for (i = 0; i < relayable; ++i) {
       Write32(fd[i], p[i]);
-      TrackScmRightsFd(m, p[i], flags);
     }
+    TrackScmRightsFds(m, p, relayable, flags);
     // close excess fds
     for (i = relayable; i < received; ++i) {
       close(p[i]);
@@ -318,6 +335,50 @@ static i64 ReceiveScmCredentials(struct Machine *m, struct msghdr_linux *gm,
 }
 #endif
 
+#if defined(MSG_ERRQUEUE) && defined(__linux)
+// relays MSG_ERRQUEUE reports, e.g. MSG_ZEROCOPY completion notices
+static i64 ReceiveExtendedError(struct Machine *m, struct msghdr_linux *gm,
+                                struct cmsghdr *cmsg, u64 offset, int level,
+                                int type) {
+  int got;
+  size_t len, extra;
+  const struct sockaddr *offender;
+  const struct sock_extended_err *ee;
+  u8 gee[16 + sizeof(struct sockaddr_storage_linux)];
+  ee = (const struct sock_extended_err *)CMSG_DATA(cmsg);
+  if ((len = cmsg->cmsg_len - CMSG_LEN(0)) < sizeof(*ee)) return einval();
+  extra = len - sizeof(*ee);
+  Write32(gee, XlatErrno(ee->ee_errno));
+  gee[4] = ee->ee_origin;
+  gee[5] = ee->ee_type;
+  gee[6] = ee->ee_code;
+  gee[7] = 0;
+  Write32(gee + 8, ee->ee_info);
+  Write32(gee + 12, ee->ee_data);
+  len = 16;
+  offender = SO_EE_OFFENDER(ee);
+  if (extra >= 2 && offender->sa_family) {
+    if ((got = XlatSockaddrToLinux(
+             (struct sockaddr_storage_linux *)(gee + 16), offender, extra)) ==
+        -1) {
+      return -1;
+    }
+    len += got;
+  } else if (extra) {
+    // zerocopy completions have no offender, just an empty address
+    extra = MIN(extra, sizeof(struct sockaddr_storage_linux));
+    memset(gee + 16, 0, extra);
+    len += extra;
+  }
+  if (offset + ROUNDUP(sizeof(struct cmsghdr_linux), 8) + ROUNDUP(len, 8) <=
+      Read64(gm->controllen)) {
+    return CopyCmsg(m, gm, level, type, gee, len, offset);
+  } else {
+    return 0;
+  }
+}
+#endif
+
 static i64 ReceiveControlMessage(struct Machine *m, struct msghdr_linux *gm,
                                  struct cmsghdr *cmsg, u64 offset, int flags) {
   if (cmsg->cmsg_level == SOL_SOCKET) {
@@ -334,6 +395,16 @@ static i64 ReceiveControlMessage(struct Machine *m, struct msghdr_linux *gm,
 #endif
 #endif
   }
+#if defined(MSG_ERRQUEUE) && defined(__linux)
+  if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) {
+    return ReceiveExtendedError(m, gm, cmsg, offset, SOL_IP_LINUX,
+                                IP_RECVERR_LINUX);
+  }
+  if (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR) {
+    return ReceiveExtendedError(m, gm, cmsg, offset, SOL_IPV6_LINUX,
+                                IPV6_RECVERR_LINUX);
+  }
+#endif
   LOGF("%s ancillary level=%d type=%d", "unsupported", cmsg->cmsg_level,
        cmsg->cmsg_type);
   return enotsup();
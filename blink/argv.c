@@ -74,6 +74,9 @@ void LoadArgv(struct Machine *m, char *execfn, char *prog, char **args,
   size_t i, narg, nenv, naux, nall;
   elf = &m->system->elf;
   naux = 10;
+  if (m->system->vdso) {
+    naux += 1;
+  }
   if (elf->at_entry) {
     naux += 4;
     if (elf->at_base != -1) {
@@ -95,6 +98,9 @@ void LoadArgv(struct Machine *m, char *execfn, char *prog, char **args,
   PUSH_AUXV(AT_CLKTCK_LINUX, sysconf(_SC_CLK_TCK));
   PUSH_AUXV(AT_RANDOM_LINUX, PushBuffer(m, rng, 16));
   PUSH_AUXV(AT_EXECFN_LINUX, PushString(m, execfn));
+  if (m->system->vdso) {
+    PUSH_AUXV(AT_SYSINFO_EHDR_LINUX, m->system->vdso);
+  }
   if (elf->at_entry) {
     PUSH_AUXV(AT_PHDR_LINUX, elf->at_phdr);
     PUSH_AUXV(AT_PHENT_LINUX, elf->at_phent);
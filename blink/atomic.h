@@ -37,6 +37,14 @@
    : sizeof(*(ptr)) == 4 ? FetchAdd32((u32 *)(ptr), delta) \
                          : FetchAddAbort())
 
+#define atomic_fetch_sub_explicit(ptr, delta, order) \
+  atomic_fetch_add_explicit(ptr, -(delta), order)
+
+#define atomic_fetch_or_explicit(ptr, bits, order)       \
+  (sizeof(*(ptr)) == 8   ? FetchOr64((u64 *)(ptr), bits) \
+   : sizeof(*(ptr)) == 4 ? FetchOr32((u32 *)(ptr), bits) \
+                         : FetchAddAbort())
+
 static inline u64 Exchange64(u64 *ptr, u64 val) {
   u64 tmp = *ptr;
   *ptr = val;
@@ -73,6 +81,18 @@ static inline u32 FetchAdd32(u32 *ptr, u32 val) {
   return res;
 }
 
+static inline u64 FetchOr64(u64 *ptr, u64 val) {
+  u64 res = *ptr;
+  *ptr |= val;
+  return res;
+}
+
+static inline u32 FetchOr32(u32 *ptr, u32 val) {
+  u32 res = *ptr;
+  *ptr |= val;
+  return res;
+}
+
 static inline u32 FetchAddAbort(void) {
   volatile u32 x = 0;
   return 1 / x;
@@ -0,0 +1,1329 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/avx.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "blink/endian.h"
+#include "blink/flags.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/modrm.h"
+#include "blink/pun.h"
+#include "blink/rde.h"
+#include "blink/types.h"
+
+/**
+ * @fileoverview AVX and AVX2 instructions.
+ *
+ * A ymm register is its xmm register plus an upper half in ymmh. VEX
+ * encoded ops zero the upper half of their destination when VEX.L is
+ * clear, whereas legacy SSE ops leave it alone. Most AVX2 integer and
+ * floating point ops act on each 128-bit lane independently, in which
+ * case VexLanes() hands every lane to the existing SSE implementation
+ * of the same opcode by way of a scratch register, so they're backed
+ * by the same host vector code as their SSE counterparts. The rest,
+ * i.e. moves, broadcasts, permutes, blends and the SSE4 integer ops
+ * which only exist here as VEX encodings, are implemented below.
+ */
+
+#ifndef DISABLE_AVX
+
+#define kModrmModMask 000060000000
+
+void GetYmm(struct Machine *m, int r, u8 y[32]) {
+  memcpy(y, m->xmm[r], 16);
+  memcpy(y + 16, m->ymmh[r], 16);
+}
+
+void PutYmm(struct Machine *m, int r, const u8 y[32], bool wide) {
+  memcpy(m->xmm[r], y, 16);
+  if (wide) {
+    memcpy(m->ymmh[r], y + 16, 16);
+  } else {
+    memset(m->ymmh[r], 0, 16);
+  }
+}
+
+// loads r/m vector register, or n bytes of memory zero extended
+void GetYmmRm(P, u8 y[32], long n, bool aligned) {
+  i64 v;
+  u8 b[32];
+  if (IsModrmRegister(rde)) {
+    GetYmm(m, RexbRm(rde), y);
+  } else {
+    v = ComputeAddress(A);
+    if (aligned && (v & (n - 1))) ThrowSegmentationFault(m, v);
+    memcpy(y, Load(m, v, n, b), n);
+    memset(y + n, 0, 32 - n);
+  }
+}
+
+void PutYmmMem(P, const u8 *y, long n, bool aligned) {
+  i64 v;
+  u8 b[32];
+  void *p[2];
+  v = ComputeAddress(A);
+  if (aligned && (v & (n - 1))) ThrowSegmentationFault(m, v);
+  memcpy(BeginStore(m, v, n, p, b), y, n);
+  EndStore(m, v, n, p, b);
+}
+
+static u64 GetLane(const u8 *p, int k, bool sx) {
+  switch (k) {
+    case 1:
+      return sx ? (u64)(i8)p[0] : p[0];
+    case 2:
+      return sx ? (u64)(i16)Get16(p) : Get16(p);
+    case 4:
+      return sx ? (u64)(i32)Get32(p) : Get32(p);
+    default:
+      return Get64(p);
+  }
+}
+
+static void PutLane(u8 *p, int k, u64 x) {
+  switch (k) {
+    case 1:
+      p[0] = x;
+      break;
+    case 2:
+      Put16(p, x);
+      break;
+    case 4:
+      Put32(p, x);
+      break;
+    default:
+      Put64(p, x);
+      break;
+  }
+}
+
+// runs an sse op on something other than the guest's own registers,
+// which mustn't generate jit code, since that would run the sse op on
+// the guest's registers, so the op is later called as a whole instead
+// and HaltMachine() puts the path back if the sse op happens to fault
+static void RunLegacy(P, nexgen32e_f op) {
+#ifdef HAVE_JIT
+  m->path.held = m->path.jb;
+  m->path.jb = 0;
+  op(A);
+  m->path.jb = m->path.held;
+  m->path.held = 0;
+#else
+  op(A);
+#endif
+}
+
+static bool IsScalar(u64 rde) {
+  switch (Mopcode(rde)) {
+    case 0x151 ... 0x153:  // sqrt, rsqrt, rcp
+    case 0x158 ... 0x15A:  // add, mul, cvt
+    case 0x15C ... 0x15F:  // sub, min, div, max
+    case 0x1C2:            // cmp
+      return Rep(rde) != 0;
+    default:
+      return false;
+  }
+}
+
+// returns bytes of memory read by the vex.128 form of a lane op
+static long GetLaneBytes(u64 rde) {
+  if (IsScalar(rde)) return Rep(rde) == 3 ? 4 : 8;
+  switch (Mopcode(rde)) {
+    case 0x112:  // movlps, movddup, movsldup
+    case 0x116:  // movhps, movshdup
+      return Rep(rde) == 3 ? 16 : 8;
+    case 0x15A:  // cvtps2pd, cvtpd2ps
+      return Osz(rde) ? 16 : 8;
+    case 0x1E6:  // cvtdq2pd, cvttpd2dq, cvtpd2dq
+      return Rep(rde) == 3 ? 8 : 16;
+    default:
+      return 16;
+  }
+}
+
+// returns true if vex.256 form of op is its vex.128 form on each lane
+static bool IsLaneWise(u64 rde) {
+  switch (Mopcode(rde)) {
+    case 0x112:
+    case 0x116:
+      return Rep(rde) != 0;
+    case 0x15A:  // see OpVexCvt()
+    case 0x1E6:
+    case 0x344:
+      return false;
+    default:
+      return true;
+  }
+}
+
+// returns true if op shifts both lanes by the count in the low lane
+static bool IsShiftByXmm(u64 rde) {
+  switch (Mopcode(rde)) {
+    case 0x1D1 ... 0x1D3:  // psrlw, psrld, psrlq
+    case 0x1E1 ... 0x1E2:  // psraw, psrad
+    case 0x1F1 ... 0x1F3:  // psllw, pslld, psllq
+      return true;
+    default:
+      return false;
+  }
+}
+
+// computes `x = op(x, y)` for one lane using the scratch register s
+static void RunLane(P, nexgen32e_f op, int s, u8 x[16], const u8 y[16]) {
+  memcpy(m->xmm[RexrReg(rde)], x, 16);
+  memcpy(m->xmm[s], y, 16);
+  RunLegacy(m, (rde & ~(kRexbRmMask | kModrmModMask)) | (u64)s << 7 | 3 << 22,
+            disp, uimm0, op);
+  memcpy(x, m->xmm[RexrReg(rde)], 16);
+}
+
+/**
+ * Runs vex encoded sse op, e.g. `vpaddb %ymm3,%ymm2,%ymm1`.
+ *
+ * The legacy op only ever sees its destination register, which holds
+ * the vvvv operand, and a scratch register holding the r/m operand. A
+ * memory operand is loaded before anything is changed, so faults stay
+ * precise and the op itself can't fault.
+ */
+void OpVexLanes(P) {
+  long n;
+  bool wide;
+  u8 x[32], y[32], t[16];
+  int r = RexrReg(rde), s = !r;
+  wide = Ymm(rde) && !IsScalar(rde);
+  if (wide && !IsLaneWise(rde)) OpUdImpl(m);
+  if (IsShiftByXmm(rde)) {
+    n = 16;
+  } else if (wide) {
+    n = 32;
+  } else {
+    n = GetLaneBytes(rde);
+  }
+  GetYmm(m, Vreg(rde), x);
+  GetYmmRm(A, y, n, false);
+  if (!IsModrmRegister(rde) && !Rep(rde) &&
+      (Mopcode(rde) == 0x112 || Mopcode(rde) == 0x116)) {
+    memcpy(x + (Opcode(rde) & 4) * 2, y, 8);  // vmovlps, vmovhps, etc.
+    PutYmm(m, r, x, false);
+    return;
+  }
+  if (IsShiftByXmm(rde)) memcpy(y + 16, y, 16);
+  memcpy(t, m->xmm[s], 16);
+  RunLane(A, GetOp(Mopcode(rde)), s, x, y);
+  if (wide) RunLane(A, GetOp(Mopcode(rde)), s, x + 16, y + 16);
+  memcpy(m->xmm[s], t, 16);
+  PutYmm(m, r, x, wide);
+}
+
+/**
+ * Converts between four floats or ints and four doubles, which is the
+ * 256-bit form of `vcvtps2pd`, `vcvtpd2ps`, `vcvtdq2pd` and friends.
+ */
+void OpVexCvt(P) {
+  int i;
+  bool widen;
+  u8 x[32], y[32], t[16];
+  int r = RexrReg(rde), s = !r;
+  if (!Ymm(rde)) {
+    OpVexLanes(A);
+    return;
+  }
+  if (Mopcode(rde) == 0x15A) {
+    widen = !Osz(rde);
+  } else if (Rep(rde) == 3) {
+    widen = true;
+  } else if (Osz(rde) || Rep(rde) == 2) {
+    widen = false;
+  } else {
+    OpUdImpl(m);
+  }
+  GetYmmRm(A, y, widen ? 16 : 32, false);
+  memset(x, 0, 32);
+  memcpy(t, m->xmm[s], 16);
+  for (i = 0; i < 2; ++i) {
+    if (widen) {
+      RunLane(A, GetOp(Mopcode(rde)), s, x + i * 16, y + i * 8);
+    } else {
+      RunLane(A, GetOp(Mopcode(rde)), s, x + 16, y + i * 16);
+      memcpy(x + i * 8, x + 16, 8);
+    }
+  }
+  memcpy(m->xmm[s], t, 16);
+  if (!widen) memset(x + 16, 0, 16);
+  PutYmm(m, r, x, widen);
+}
+
+// returns true if integer op is computed by RunIntKernel()
+static bool IsIntKernel(u64 rde) {
+  switch (Mopcode(rde)) {
+    case 0x164 ... 0x166:  // vpcmpgt
+    case 0x174 ... 0x176:  // vpcmpeq
+    case 0x1D4:            // vpaddq
+    case 0x1DA ... 0x1DB:  // vpminub, vpand
+    case 0x1DE ... 0x1DF:  // vpmaxub, vpandn
+    case 0x1EB:            // vpor
+    case 0x1EF:            // vpxor
+    case 0x1F8 ... 0x1FE:  // vpsub, vpadd
+      return true;
+    default:
+      return false;
+  }
+}
+
+// computes the integer ops that string functions use in their hot
+// loops on the whole vector, rather than going one lane at a time
+static void RunIntKernel(u64 rde, u8 x[32], const u8 y[32], int n) {
+  int i;
+  switch (Mopcode(rde)) {
+    case 0x164:
+      for (i = 0; i < n; ++i) x[i] = -((i8)x[i] > (i8)y[i]);
+      break;
+    case 0x165:
+      for (i = 0; i < n; i += 2) {
+        Put16(x + i, -((i16)Get16(x + i) > (i16)Get16(y + i)));
+      }
+      break;
+    case 0x166:
+      for (i = 0; i < n; i += 4) {
+        Put32(x + i, -((i32)Get32(x + i) > (i32)Get32(y + i)));
+      }
+      break;
+    case 0x174:
+      for (i = 0; i < n; ++i) x[i] = -(x[i] == y[i]);
+      break;
+    case 0x175:
+      for (i = 0; i < n; i += 2) Put16(x + i, -(Get16(x + i) == Get16(y + i)));
+      break;
+    case 0x176:
+      for (i = 0; i < n; i += 4) Put32(x + i, -(Get32(x + i) == Get32(y + i)));
+      break;
+    case 0x1D4:
+      for (i = 0; i < n; i += 8) Put64(x + i, Get64(x + i) + Get64(y + i));
+      break;
+    case 0x1DA:
+      for (i = 0; i < n; ++i) x[i] = MIN(x[i], y[i]);
+      break;
+    case 0x1DB:
+      for (i = 0; i < n; ++i) x[i] &= y[i];
+      break;
+    case 0x1DE:
+      for (i = 0; i < n; ++i) x[i] = MAX(x[i], y[i]);
+      break;
+    case 0x1DF:
+      for (i = 0; i < n; ++i) x[i] = ~x[i] & y[i];
+      break;
+    case 0x1EB:
+      for (i = 0; i < n; ++i) x[i] |= y[i];
+      break;
+    case 0x1EF:
+      for (i = 0; i < n; ++i) x[i] ^= y[i];
+      break;
+    case 0x1F8:
+      for (i = 0; i < n; ++i) x[i] -= y[i];
+      break;
+    case 0x1F9:
+      for (i = 0; i < n; i += 2) Put16(x + i, Get16(x + i) - Get16(y + i));
+      break;
+    case 0x1FA:
+      for (i = 0; i < n; i += 4) Put32(x + i, Get32(x + i) - Get32(y + i));
+      break;
+    case 0x1FB:
+      for (i = 0; i < n; i += 8) Put64(x + i, Get64(x + i) - Get64(y + i));
+      break;
+    case 0x1FC:
+      for (i = 0; i < n; ++i) x[i] += y[i];
+      break;
+    case 0x1FD:
+      for (i = 0; i < n; i += 2) Put16(x + i, Get16(x + i) + Get16(y + i));
+      break;
+    case 0x1FE:
+      for (i = 0; i < n; i += 4) Put32(x + i, Get32(x + i) + Get32(y + i));
+      break;
+    default:
+      __builtin_unreachable();
+  }
+}
+
+void OpVexInt(P) {
+  u8 x[32], y[32];
+  if (!Osz(rde) && !(Mopcode(rde) == 0x170 && Rep(rde))) OpUdImpl(m);
+  if (IsIntKernel(rde)) {
+    GetYmm(m, Vreg(rde), x);
+    GetYmmRm(A, y, 16 << Ymm(rde), false);
+    RunIntKernel(rde, x, y, 16 << Ymm(rde));
+    PutYmm(m, RexrReg(rde), x, Ymm(rde));
+  } else {
+    OpVexLanes(A);
+  }
+}
+
+/**
+ * Runs vex encoded op that only writes flags, memory or gprs, in which
+ * case its legacy implementation has the very same semantics.
+ */
+void OpVexSame(P) {
+  switch (Mopcode(rde)) {
+    case 0x12C ... 0x12F:  // cvtt, cvt, ucomi, comi
+      break;
+    case 0x1AE:  // ldmxcsr, stmxcsr
+      if (ModrmReg(rde) != 2 && ModrmReg(rde) != 3) OpUdImpl(m);
+      if (IsModrmRegister(rde) || Ymm(rde)) OpUdImpl(m);
+      break;
+    default:
+      if (Ymm(rde)) OpUdImpl(m);
+      break;
+  }
+  GetOp(Mopcode(rde))(A);
+}
+
+/**
+ * Runs vex encoded op merging a gpr or memory operand into the vvvv
+ * operand, e.g. `vcvtsi2sd %rax,%xmm2,%xmm1` and `vpinsrw`.
+ */
+void OpVexMerge(P) {
+  u8 b[8];
+  int r = RexrReg(rde);
+  if (Mopcode(rde) == 0x1C4 && (!Osz(rde) || Ymm(rde))) OpUdImpl(m);
+  if (!IsModrmRegister(rde)) {
+    Load(m, ComputeAddress(A), Mopcode(rde) == 0x1C4 ? 2 : 4 << Rexw(rde), b);
+  }
+  memmove(m->xmm[r], m->xmm[Vreg(rde)], 16);
+  RunLegacy(A, GetOp(Mopcode(rde)));
+  memset(m->ymmh[r], 0, 16);
+}
+
+/**
+ * Runs vex encoded shift by immediate, e.g. `vpsrlw $3,%ymm2,%ymm1`
+ * whose destination is the vvvv operand.
+ */
+void OpVexPsb(P) {
+  int i;
+  u8 y[32], t[16];
+  if (!Osz(rde) || !IsModrmRegister(rde)) OpUdImpl(m);
+  switch (Opcode(rde) << 8 | ModrmReg(rde)) {
+    case 0x7102:
+    case 0x7104:
+    case 0x7106:
+    case 0x7202:
+    case 0x7204:
+    case 0x7206:
+    case 0x7302:
+    case 0x7303:
+    case 0x7306:
+    case 0x7307:
+      break;
+    default:
+      OpUdImpl(m);
+  }
+  GetYmm(m, RexbRm(rde), y);
+  memcpy(t, m->xmm[0], 16);
+  for (i = 0; i < 1 + Ymm(rde); ++i) {
+    memcpy(m->xmm[0], y + i * 16, 16);
+    RunLegacy(m, rde & ~kRexbRmMask, disp, uimm0, GetOp(Mopcode(rde)));
+    memcpy(y + i * 16, m->xmm[0], 16);
+  }
+  memcpy(m->xmm[0], t, 16);
+  PutYmm(m, Vreg(rde), y, Ymm(rde));
+}
+
+static void VexMovs(P) {
+  u8 x[32], y[32];
+  long n = Rep(rde) == 3 ? 4 : 8;
+  if (Opcode(rde) == 0x10) {
+    if (IsModrmRegister(rde)) {
+      GetYmm(m, Vreg(rde), x);
+      GetYmm(m, RexbRm(rde), y);
+      memcpy(x, y, n);
+    } else {
+      GetYmmRm(A, x, n, false);
+    }
+    PutYmm(m, RexrReg(rde), x, false);
+  } else {
+    GetYmm(m, RexrReg(rde), y);
+    if (IsModrmRegister(rde)) {
+      GetYmm(m, Vreg(rde), x);
+      memcpy(x, y, n);
+      PutYmm(m, RexbRm(rde), x, false);
+    } else {
+      PutYmmMem(A, y, n, false);
+    }
+  }
+}
+
+/**
+ * Moves vector, e.g. `vmovdqu (%rsi),%ymm0` or `vmovntdq %ymm0,(%rdi)`.
+ */
+void OpVexMov(P) {
+  u8 y[32];
+  bool store, aligned, memonly = false;
+  switch (Mopcode(rde)) {
+    case 0x110:  // vmovups, vmovupd, vmovss, vmovsd
+    case 0x111:
+      if (Rep(rde)) {
+        VexMovs(A);
+        return;
+      }
+      aligned = false;
+      store = Opcode(rde) & 1;
+      break;
+    case 0x128:  // vmovaps, vmovapd
+    case 0x129:
+      if (Rep(rde)) OpUdImpl(m);
+      aligned = true;
+      store = Opcode(rde) & 1;
+      break;
+    case 0x16F:  // vmovdqa, vmovdqu
+    case 0x17F:
+      if (!Osz(rde) && Rep(rde) != 3) OpUdImpl(m);
+      aligned = Osz(rde);
+      store = Opcode(rde) == 0x7F;
+      break;
+    case 0x12B:  // vmovntps, vmovntpd
+    case 0x1E7:  // vmovntdq
+      if (Rep(rde) || (Opcode(rde) == 0xE7 && !Osz(rde))) OpUdImpl(m);
+      aligned = true;
+      store = true;
+      memonly = true;
+      break;
+    case 0x1F0:  // vlddqu
+      if (Rep(rde) != 2) OpUdImpl(m);
+      aligned = false;
+      store = false;
+      memonly = true;
+      break;
+    case 0x22A:  // vmovntdqa
+      if (!Osz(rde)) OpUdImpl(m);
+      aligned = true;
+      store = false;
+      memonly = true;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  if (memonly && IsModrmRegister(rde)) OpUdImpl(m);
+  if (store) {
+    GetYmm(m, RexrReg(rde), y);
+    if (IsModrmRegister(rde)) {
+      PutYmm(m, RexbRm(rde), y, Ymm(rde));
+    } else {
+      PutYmmMem(A, y, 16 << Ymm(rde), aligned);
+    }
+  } else {
+    GetYmmRm(A, y, 16 << Ymm(rde), aligned);
+    PutYmm(m, RexrReg(rde), y, Ymm(rde));
+  }
+}
+
+/**
+ * Moves gpr or memory to vector, i.e. `vmovd` and `vmovq` opcode 6E.
+ */
+void OpVexMovd(P) {
+  u8 y[32] = {0};
+  long n = 4 << Rexw(rde);
+  if (!Osz(rde) || Ymm(rde)) OpUdImpl(m);
+  memcpy(y, GetModrmRegisterWordPointerRead(A, n), n);
+  PutYmm(m, RexrReg(rde), y, false);
+}
+
+/**
+ * Moves quadword, i.e. `vmovq` opcodes F3 7E and 66 D6.
+ */
+void OpVexMovq(P) {
+  u8 y[32] = {0};
+  if (Ymm(rde)) OpUdImpl(m);
+  if (Mopcode(rde) == 0x17E) {
+    if (Osz(rde)) {
+      GetOp(Mopcode(rde))(A);  // vmovd/vmovq to gpr or memory
+    } else if (Rep(rde) == 3) {
+      GetYmmRm(A, y, 8, false);
+      memset(y + 8, 0, 24);
+      PutYmm(m, RexrReg(rde), y, false);
+    } else {
+      OpUdImpl(m);
+    }
+  } else {
+    if (!Osz(rde)) OpUdImpl(m);
+    memcpy(y, m->xmm[RexrReg(rde)], 8);
+    if (IsModrmRegister(rde)) {
+      PutYmm(m, RexbRm(rde), y, false);
+    } else {
+      PutYmmMem(A, y, 8, false);
+    }
+  }
+}
+
+/**
+ * Zeroes upper halves of all ymm registers, or all of them.
+ */
+void OpVexZeroupper(P) {
+  memset(m->ymmh, 0, sizeof(m->ymmh));
+  if (Ymm(rde)) {
+    memset(m->xmm, 0, sizeof(m->xmm));  // vzeroall
+  }
+}
+
+/**
+ * Extracts sign bits, i.e. `vmovmskps`, `vmovmskpd` and `vpmovmskb`.
+ */
+void OpVexMovmsk(P) {
+  u8 y[32];
+  u32 mask = 0;
+  int i, k, n = 16 << Ymm(rde);
+  if (!IsModrmRegister(rde) || Rep(rde)) OpUdImpl(m);
+  if (Mopcode(rde) == 0x1D7) {
+    if (!Osz(rde)) OpUdImpl(m);
+    k = 1;
+  } else {
+    k = Osz(rde) ? 8 : 4;
+  }
+  GetYmm(m, RexbRm(rde), y);
+  for (i = 0; i < n / k; ++i) {
+    mask |= (u32)(y[i * k + k - 1] >> 7) << i;
+  }
+  Put64(RegRexrReg(m, rde), mask);
+}
+
+/**
+ * Sets ZF if `x & y` is zero and CF if `~x & y` is zero.
+ */
+void OpVexPtest(P) {
+  int i, k;
+  u8 x[32], y[32], z = 0, c = 0;
+  if (!Osz(rde)) OpUdImpl(m);
+  if (Opcode(rde) != 0x17 && Rexw(rde)) OpUdImpl(m);
+  GetYmm(m, RexrReg(rde), x);
+  GetYmmRm(A, y, 16 << Ymm(rde), false);
+  for (i = 0; i < 16 << Ymm(rde); ++i) {
+    z |= x[i] & y[i];
+    c |= ~x[i] & y[i];
+  }
+  if (Opcode(rde) != 0x17) {  // vtestps and vtestpd only see sign bits
+    z = c = 0;
+    k = Opcode(rde) & 1 ? 8 : 4;
+    for (i = k - 1; i < 16 << Ymm(rde); i += k) {
+      z |= x[i] & y[i] & 128;
+      c |= ~x[i] & y[i] & 128;
+    }
+  }
+  m->flags = SetFlag(m->flags, FLAGS_ZF, !z);
+  m->flags = SetFlag(m->flags, FLAGS_CF, !c);
+  m->flags = SetFlag(m->flags, FLAGS_AF, false);
+  m->flags = SetFlag(m->flags, FLAGS_PF, false);
+  m->flags = SetFlag(m->flags, FLAGS_SF, false);
+  m->flags = SetFlag(m->flags, FLAGS_OF, false);
+}
+
+/**
+ * Broadcasts element to every element, e.g. `vpbroadcastb %xmm0,%ymm0`.
+ */
+void OpVexBroadcast(P) {
+  int i, k;
+  u8 x[32], y[32];
+  if (!Osz(rde)) OpUdImpl(m);
+  switch (Opcode(rde)) {
+    case 0x78:  // vpbroadcastb
+      k = 1;
+      break;
+    case 0x79:  // vpbroadcastw
+      k = 2;
+      break;
+    case 0x18:  // vbroadcastss
+    case 0x58:  // vpbroadcastd
+      k = 4;
+      break;
+    case 0x19:  // vbroadcastsd
+    case 0x59:  // vpbroadcastq
+      k = 8;
+      if (Opcode(rde) == 0x19 && !Ymm(rde)) OpUdImpl(m);
+      break;
+    case 0x1A:  // vbroadcastf128
+    case 0x5A:  // vbroadcasti128
+      k = 16;
+      if (!Ymm(rde) || IsModrmRegister(rde)) OpUdImpl(m);
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  GetYmmRm(A, y, k, false);
+  for (i = 0; i < 16 << Ymm(rde); i += k) {
+    memcpy(x + i, y, k);
+  }
+  PutYmm(m, RexrReg(rde), x, Ymm(rde));
+}
+
+/**
+ * Sign or zero extends packed integers, i.e. `vpmovsx` and `vpmovzx`.
+ */
+void OpVexPmovx(P) {
+  u8 x[32], y[32];
+  int i, j, n, ss, ds;
+  static const u8 kSrc[6] = {1, 1, 1, 2, 2, 4};
+  static const u8 kDst[6] = {2, 4, 8, 4, 8, 8};
+  if (!Osz(rde)) OpUdImpl(m);
+  j = Opcode(rde) & 15;
+  ss = kSrc[j];
+  ds = kDst[j];
+  n = (16 << Ymm(rde)) / ds;
+  GetYmmRm(A, y, n * ss, false);
+  for (i = 0; i < n; ++i) {
+    PutLane(x + i * ds, ds, GetLane(y + i * ss, ss, !(Opcode(rde) & 0x10)));
+  }
+  PutYmm(m, RexrReg(rde), x, Ymm(rde));
+}
+
+static u16 Packusdw(i32 x) {
+  return MIN(65535, MAX(0, x));
+}
+
+/**
+ * Runs sse4 integer op which blink only offers vex encoded, e.g. the
+ * `vpminud` which glibc string functions use for wide characters.
+ */
+void OpVexInt38(P) {
+  int i, n;
+  u8 x[32], y[32], z[32];
+  if (!Osz(rde)) OpUdImpl(m);
+  n = 16 << Ymm(rde);
+  GetYmm(m, Vreg(rde), x);
+  GetYmmRm(A, y, n, false);
+  switch (Opcode(rde)) {
+    case 0x28:  // vpmuldq
+      for (i = 0; i < n; i += 8) {
+        Put64(z + i, (i64)(i32)Get32(x + i) * (i32)Get32(y + i));
+      }
+      break;
+    case 0x29:  // vpcmpeqq
+      for (i = 0; i < n; i += 8) {
+        Put64(z + i, -(Get64(x + i) == Get64(y + i)));
+      }
+      break;
+    case 0x37:  // vpcmpgtq
+      for (i = 0; i < n; i += 8) {
+        Put64(z + i, -((i64)Get64(x + i) > (i64)Get64(y + i)));
+      }
+      break;
+    case 0x2B:  // vpackusdw
+      for (i = 0; i < n; i += 16) {
+        Put16(z + i + 0, Packusdw(Get32(x + i + 0)));
+        Put16(z + i + 2, Packusdw(Get32(x + i + 4)));
+        Put16(z + i + 4, Packusdw(Get32(x + i + 8)));
+        Put16(z + i + 6, Packusdw(Get32(x + i + 12)));
+        Put16(z + i + 8, Packusdw(Get32(y + i + 0)));
+        Put16(z + i + 10, Packusdw(Get32(y + i + 4)));
+        Put16(z + i + 12, Packusdw(Get32(y + i + 8)));
+        Put16(z + i + 14, Packusdw(Get32(y + i + 12)));
+      }
+      break;
+    case 0x38:  // vpminsb
+      for (i = 0; i < n; ++i) z[i] = MIN((i8)x[i], (i8)y[i]);
+      break;
+    case 0x3C:  // vpmaxsb
+      for (i = 0; i < n; ++i) z[i] = MAX((i8)x[i], (i8)y[i]);
+      break;
+    case 0x3A:  // vpminuw
+      for (i = 0; i < n; i += 2) Put16(z + i, MIN(Get16(x + i), Get16(y + i)));
+      break;
+    case 0x3E:  // vpmaxuw
+      for (i = 0; i < n; i += 2) Put16(z + i, MAX(Get16(x + i), Get16(y + i)));
+      break;
+    case 0x39:  // vpminsd
+      for (i = 0; i < n; i += 4) {
+        Put32(z + i, MIN((i32)Get32(x + i), (i32)Get32(y + i)));
+      }
+      break;
+    case 0x3D:  // vpmaxsd
+      for (i = 0; i < n; i += 4) {
+        Put32(z + i, MAX((i32)Get32(x + i), (i32)Get32(y + i)));
+      }
+      break;
+    case 0x3B:  // vpminud
+      for (i = 0; i < n; i += 4) Put32(z + i, MIN(Get32(x + i), Get32(y + i)));
+      break;
+    case 0x3F:  // vpmaxud
+      for (i = 0; i < n; i += 4) Put32(z + i, MAX(Get32(x + i), Get32(y + i)));
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  PutYmm(m, RexrReg(rde), z, Ymm(rde));
+}
+
+/**
+ * Shifts each element by its own count, e.g. `vpsrlvd` and `vpsllvq`.
+ */
+void OpVexShiftv(P) {
+  u64 x, c;
+  u8 v[32], y[32];
+  int i, k, n, w;
+  if (!Osz(rde) || (Opcode(rde) == 0x46 && Rexw(rde))) OpUdImpl(m);
+  n = 16 << Ymm(rde);
+  k = 4 << Rexw(rde);
+  w = k * 8;
+  GetYmm(m, Vreg(rde), v);
+  GetYmmRm(A, y, n, false);
+  for (i = 0; i < n; i += k) {
+    c = GetLane(y + i, k, false);
+    switch (Opcode(rde)) {
+      case 0x45:  // vpsrlvd, vpsrlvq
+        x = c < w ? GetLane(v + i, k, false) >> c : 0;
+        break;
+      case 0x46:  // vpsravd
+        x = (i64)GetLane(v + i, k, true) >> MIN(c, 63);
+        break;
+      case 0x47:  // vpsllvd, vpsllvq
+        x = c < w ? GetLane(v + i, k, false) << c : 0;
+        break;
+      default:
+        __builtin_unreachable();
+    }
+    PutLane(v + i, k, x);
+  }
+  PutYmm(m, RexrReg(rde), v, Ymm(rde));
+}
+
+double RoundYmm(double x, int mode) {
+  switch (mode) {
+    case 0:
+      return nearbyint(x);
+    case 1:
+      return floor(x);
+    case 2:
+      return ceil(x);
+    default:
+      return trunc(x);
+  }
+}
+
+/**
+ * Rounds floating point numbers to integers, i.e. `vroundps`,
+ * `vroundpd`, `vroundss` and `vroundsd`.
+ */
+void OpVexRound(P) {
+  u8 x[32], y[32];
+  int i, k, n, mode;
+  union FloatPun f;
+  union DoublePun d;
+  if (!Osz(rde)) OpUdImpl(m);
+  k = Opcode(rde) & 1 ? 8 : 4;
+  mode = uimm0 & 4 ? m->mxcsr >> 13 & 3 : uimm0 & 3;
+  if (Opcode(rde) & 2) {
+    n = k;  // scalar
+    GetYmm(m, Vreg(rde), x);
+  } else {
+    n = 16 << Ymm(rde);
+  }
+  GetYmmRm(A, y, n, false);
+  for (i = 0; i < n; i += k) {
+    if (k == 4) {
+      f.i = Get32(y + i);
+      f.f = RoundYmm(f.f, mode);
+      Put32(x + i, f.i);
+    } else {
+      d.i = Get64(y + i);
+      d.f = RoundYmm(d.f, mode);
+      Put64(x + i, d.i);
+    }
+  }
+  PutYmm(m, RexrReg(rde), x, Ymm(rde) && !(Opcode(rde) & 2));
+}
+
+/**
+ * Permutes dwords across lanes, i.e. `vpermd` and `vpermps`.
+ */
+void OpVexPermd(P) {
+  int i;
+  u8 x[32], y[32], z[32];
+  if (!Osz(rde) || !Ymm(rde) || Rexw(rde)) OpUdImpl(m);
+  GetYmm(m, Vreg(rde), x);
+  GetYmmRm(A, y, 32, false);
+  for (i = 0; i < 8; ++i) {
+    memcpy(z + i * 4, y + (x[i * 4] & 7) * 4, 4);
+  }
+  PutYmm(m, RexrReg(rde), z, true);
+}
+
+/**
+ * Permutes floats within lanes, i.e. `vpermilps` and `vpermilpd`,
+ * which are picked by an immediate or by the vvvv operand.
+ */
+void OpVexPermil(P) {
+  u8 c[32], y[32], z[32];
+  int i, j, k, n, sel;
+  if (!Osz(rde) || Rexw(rde)) OpUdImpl(m);
+  n = 16 << Ymm(rde);
+  k = Opcode(rde) & 1 ? 8 : 4;
+  if (Opmap(rde) == XED_ILD_MAP2) GetYmm(m, Vreg(rde), c);
+  GetYmmRm(A, y, n, false);
+  for (i = 0; i < n / k; ++i) {
+    if (Opmap(rde) == XED_ILD_MAP3) {
+      if (k == 4) {
+        sel = uimm0 >> (i & 3) * 2 & 3;
+      } else {
+        sel = uimm0 >> i & 1;
+      }
+    } else if (k == 4) {
+      sel = c[i * 4] & 3;
+    } else {
+      sel = c[i * 8] >> 1 & 1;
+    }
+    j = i / (16 / k) * (16 / k) + sel;
+    memcpy(z + i * k, y + j * k, k);
+  }
+  PutYmm(m, RexrReg(rde), z, Ymm(rde));
+}
+
+/**
+ * Moves elements whose mask has its sign bit set, i.e. `vmaskmovps`,
+ * `vmaskmovpd`, `vpmaskmovd` and `vpmaskmovq`. Masked out elements
+ * are never accessed so they can't fault.
+ */
+void OpVexMaskmov(P) {
+  i64 v;
+  int i, k, n;
+  void *p[2];
+  u8 b[8], c[32], x[32];
+  if (!Osz(rde) || IsModrmRegister(rde)) OpUdImpl(m);
+  if (Opcode(rde) < 0x30 && Rexw(rde)) OpUdImpl(m);
+  n = 16 << Ymm(rde);
+  if (Opcode(rde) < 0x30) {
+    k = Opcode(rde) & 1 ? 8 : 4;
+  } else {
+    k = 4 << Rexw(rde);
+  }
+  v = ComputeAddress(A);
+  GetYmm(m, Vreg(rde), c);
+  if (Opcode(rde) & 2) {
+    GetYmm(m, RexrReg(rde), x);
+    for (i = 0; i < n; i += k) {
+      if (c[i + k - 1] & 128) {
+        memcpy(BeginStore(m, v + i, k, p, b), x + i, k);
+        EndStore(m, v + i, k, p, b);
+      }
+    }
+  } else {
+    memset(x, 0, 32);
+    for (i = 0; i < n; i += k) {
+      if (c[i + k - 1] & 128) {
+        memcpy(x + i, Load(m, v + i, k, b), k);
+      }
+    }
+    PutYmm(m, RexrReg(rde), x, Ymm(rde));
+  }
+}
+
+/**
+ * Permutes qwords across lanes, i.e. `vpermq` and `vpermpd`.
+ */
+void OpVexPermq(P) {
+  int i;
+  u8 y[32], z[32];
+  if (!Osz(rde) || !Ymm(rde) || !Rexw(rde)) OpUdImpl(m);
+  GetYmmRm(A, y, 32, false);
+  for (i = 0; i < 4; ++i) {
+    memcpy(z + i * 8, y + (uimm0 >> (i * 2) & 3) * 8, 8);
+  }
+  PutYmm(m, RexrReg(rde), z, true);
+}
+
+/**
+ * Picks 128-bit halves, i.e. `vperm2i128` and `vperm2f128`.
+ */
+void OpVexPerm2x128(P) {
+  int i, c;
+  u8 x[64], z[32];
+  if (!Osz(rde) || !Ymm(rde) || Rexw(rde)) OpUdImpl(m);
+  GetYmm(m, Vreg(rde), x);
+  GetYmmRm(A, x + 32, 32, false);
+  for (i = 0; i < 2; ++i) {
+    c = uimm0 >> (i * 4);
+    if (c & 8) {
+      memset(z + i * 16, 0, 16);
+    } else {
+      memcpy(z + i * 16, x + (c & 3) * 16, 16);
+    }
+  }
+  PutYmm(m, RexrReg(rde), z, true);
+}
+
+/**
+ * Inserts 128-bit half, i.e. `vinserti128` and `vinsertf128`.
+ */
+void OpVexInsert128(P) {
+  u8 x[32], y[32];
+  if (!Osz(rde) || !Ymm(rde) || Rexw(rde)) OpUdImpl(m);
+  GetYmm(m, Vreg(rde), x);
+  GetYmmRm(A, y, 16, false);
+  memcpy(x + (uimm0 & 1) * 16, y, 16);
+  PutYmm(m, RexrReg(rde), x, true);
+}
+
+/**
+ * Extracts 128-bit half, i.e. `vextracti128` and `vextractf128`.
+ */
+void OpVexExtract128(P) {
+  u8 x[32], y[32] = {0};
+  if (!Osz(rde) || !Ymm(rde) || Rexw(rde)) OpUdImpl(m);
+  GetYmm(m, RexrReg(rde), x);
+  memcpy(y, x + (uimm0 & 1) * 16, 16);
+  if (IsModrmRegister(rde)) {
+    PutYmm(m, RexbRm(rde), y, false);
+  } else {
+    PutYmmMem(A, y, 16, false);
+  }
+}
+
+/**
+ * Extracts element to gpr or memory, e.g. `vpextrq` and `vextractps`.
+ */
+void OpVexExtract(P) {
+  int k;
+  u8 y[32], *e;
+  if (!Osz(rde) || Ymm(rde)) OpUdImpl(m);
+  switch (Opcode(rde)) {
+    case 0x14:
+      k = 1;
+      break;
+    case 0x15:
+      k = 2;
+      break;
+    case 0x16:
+      k = 4 << Rexw(rde);
+      break;
+    default:
+      k = 4;
+      break;
+  }
+  GetYmm(m, RexrReg(rde), y);
+  e = y + (uimm0 & (16 / k - 1)) * k;
+  if (IsModrmRegister(rde)) {
+    Put64(RegRexbRm(m, rde), GetLane(e, k, false));
+  } else {
+    PutYmmMem(A, e, k, false);
+  }
+}
+
+/**
+ * Inserts element from gpr or memory into vvvv operand, i.e. `vpinsrb`,
+ * `vpinsrd`, `vpinsrq` and `vinsertps`.
+ */
+void OpVexInsert(P) {
+  int i, k;
+  u8 x[32], y[32];
+  if (!Osz(rde) || Ymm(rde)) OpUdImpl(m);
+  GetYmm(m, Vreg(rde), x);
+  if (Opcode(rde) == 0x21) {  // vinsertps
+    if (IsModrmRegister(rde)) {
+      GetYmm(m, RexbRm(rde), y);
+      memcpy(y, y + (uimm0 >> 6) * 4, 4);
+    } else {
+      GetYmmRm(A, y, 4, false);
+    }
+    memcpy(x + (uimm0 >> 4 & 3) * 4, y, 4);
+    for (i = 0; i < 4; ++i) {
+      if (uimm0 & 1 << i) memset(x + i * 4, 0, 4);
+    }
+  } else {
+    k = Opcode(rde) == 0x20 ? 1 : 4 << Rexw(rde);
+    if (IsModrmRegister(rde)) {
+      memcpy(y, RegRexbRm(m, rde), 8);
+    } else {
+      GetYmmRm(A, y, k, false);
+    }
+    memcpy(x + (uimm0 & (16 / k - 1)) * k, y, k);
+  }
+  PutYmm(m, RexrReg(rde), x, false);
+}
+
+/**
+ * Blends elements picked by immediate, e.g. `vpblendd` and `vblendps`.
+ */
+void OpVexBlend(P) {
+  int i, k, n;
+  u8 x[32], y[32];
+  if (!Osz(rde)) OpUdImpl(m);
+  n = 16 << Ymm(rde);
+  switch (Opcode(rde)) {
+    case 0x02:  // vpblendd
+    case 0x0C:  // vblendps
+      k = 4;
+      break;
+    case 0x0D:  // vblendpd
+      k = 8;
+      break;
+    case 0x0E:  // vpblendw
+      k = 2;
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  GetYmm(m, Vreg(rde), x);
+  GetYmmRm(A, y, n, false);
+  for (i = 0; i < n / k; ++i) {
+    if (uimm0 >> (k == 2 ? i & 7 : i) & 1) {
+      memcpy(x + i * k, y + i * k, k);
+    }
+  }
+  PutYmm(m, RexrReg(rde), x, Ymm(rde));
+}
+
+/**
+ * Blends elements picked by sign bits of the register in imm8[7:4],
+ * i.e. `vblendvps`, `vblendvpd` and `vpblendvb`.
+ */
+void OpVexBlendv(P) {
+  int i, k, n;
+  u8 x[32], y[32], s[32];
+  if (!Osz(rde) || Rexw(rde)) OpUdImpl(m);
+  n = 16 << Ymm(rde);
+  k = Opcode(rde) == 0x4A ? 4 : Opcode(rde) == 0x4B ? 8 : 1;
+  GetYmm(m, Vreg(rde), x);
+  GetYmmRm(A, y, n, false);
+  GetYmm(m, uimm0 >> 4 & 15, s);
+  for (i = 0; i < n; i += k) {
+    if (s[i + k - 1] & 128) {
+      memcpy(x + i, y + i, k);
+    }
+  }
+  PutYmm(m, RexrReg(rde), x, Ymm(rde));
+}
+
+/**
+ * Runs vex encoded aes op, e.g. `vaesenc %xmm3,%xmm2,%xmm1`, whose
+ * 256-bit forms belong to vaes, which isn't something we advertise.
+ */
+void OpVexAes(P) {
+  if (!Osz(rde) || Ymm(rde)) OpUdImpl(m);
+  switch (Mopcode(rde)) {
+    case 0x2DB:  // vaesimc
+    case 0x3DF:  // vaeskeygenassist
+      if (Vreg(rde)) OpUdImpl(m);
+      break;
+    default:
+      break;
+  }
+  OpVexLanes(A);
+}
+
+/**
+ * Loads elements from memory addressed by a vector of indices, e.g.
+ * `vpgatherdd (%rax,%ymm2,4),%ymm1,%ymm3` and `vgatherqpd`.
+ *
+ * Only elements whose mask element has its sign bit set are loaded,
+ * and that mask element is cleared as soon as it's been gathered, so
+ * an op that faults partway through can be restarted like hardware.
+ */
+void OpVexGather(P) {
+  i64 v;
+  u8 b[8];
+  struct AddrSeg ea;
+  u8 d[32], k[32], q[32];
+  int i, n, es, is, dst, idx, msk;
+  if (!Osz(rde) || IsModrmRegister(rde) || !SibExists(rde)) OpUdImpl(m);
+  es = 4 << Rexw(rde);             // element size
+  is = Opcode(rde) & 1 ? 8 : 4;    // index size
+  n = (16 << Ymm(rde)) / MAX(es, is);
+  dst = RexrReg(rde);
+  idx = Rexx(rde) << 3 | SibIndex(rde);
+  msk = Vreg(rde);
+  if (dst == idx || dst == msk || idx == msk) OpUdImpl(m);
+  // the sib index names a vector register, so it's added separately
+  ea = LoadEffectiveAddress(m, (rde & ~(u64)(00000000003400000000000 |  //
+                                             000000400000)) |
+                                   (u64)4 << 043,
+                            disp, uimm0);
+  GetYmm(m, dst, d);
+  GetYmm(m, msk, k);
+  GetYmm(m, idx, q);
+  for (i = 0; i < n; ++i) {
+    if (!(k[i * es + es - 1] & 128)) continue;
+    v = ea.addr + (GetLane(q + i * is, is, true) << SibScale(rde));
+    if (Eamode(rde) == XED_MODE_LEGACY) v &= 0xffffffff;
+    v = AddSegment(A, v, ea.seg);
+    memcpy(d + i * es, Load(m, v, es, b), es);
+    memset(k + i * es, 0, es);
+    PutYmm(m, dst, d, true);
+    PutYmm(m, msk, k, true);
+  }
+  memset(d + n * es, 0, 32 - n * es);
+  memset(k, 0, 32);
+  PutYmm(m, dst, d, true);
+  PutYmm(m, msk, k, false);
+}
+
+nexgen32e_f GetAvxOp(long op) {
+  switch (op) {
+    case 0x110:  // vmovups, vmovupd, vmovss, vmovsd
+    case 0x111:
+    case 0x128:  // vmovaps, vmovapd
+    case 0x129:
+    case 0x12B:  // vmovntps, vmovntpd
+    case 0x16F:  // vmovdqa, vmovdqu
+    case 0x17F:
+    case 0x1E7:  // vmovntdq
+    case 0x1F0:  // vlddqu
+    case 0x22A:  // vmovntdqa
+      return OpVexMov;
+    case 0x112:  // vmovlps, vmovhlps, vmovddup, vmovsldup
+    case 0x114:  // vunpcklps, vunpcklpd
+    case 0x115:  // vunpckhps, vunpckhpd
+    case 0x116:  // vmovhps, vmovlhps, vmovshdup
+    case 0x151:  // vsqrt
+    case 0x152:  // vrsqrt
+    case 0x153:  // vrcp
+    case 0x154:  // vand
+    case 0x155:  // vandn
+    case 0x156:  // vor
+    case 0x157:  // vxor
+    case 0x158:  // vadd
+    case 0x159:  // vmul
+    case 0x15B:  // vcvtdq2ps, vcvtps2dq, vcvttps2dq
+    case 0x15C:  // vsub
+    case 0x15D:  // vmin
+    case 0x15E:  // vdiv
+    case 0x15F:  // vmax
+    case 0x17C:  // vhadd
+    case 0x17D:  // vhsub
+    case 0x1C2:  // vcmp
+    case 0x1C6:  // vshufps, vshufpd
+    case 0x1D0:  // vaddsub
+      return OpVexLanes;
+    case 0x15A:  // vcvtps2pd, vcvtpd2ps, vcvtss2sd, vcvtsd2ss
+    case 0x1E6:  // vcvtdq2pd, vcvttpd2dq, vcvtpd2dq
+      return OpVexCvt;
+    case 0x160 ... 0x16D:  // vpunpck, vpackss, vpackus, vpcmpgt
+    case 0x170:            // vpshufd, vpshufhw, vpshuflw
+    case 0x174 ... 0x176:  // vpcmpeq
+    case 0x1D1 ... 0x1D5:  // vpsrl, vpaddq, vpmullw
+    case 0x1D8 ... 0x1E5:  // vpsubus, vpminub, vpand, ..., vpmulh
+    case 0x1E8 ... 0x1EF:  // vpsubs, vpminsw, vpor, vpadds, vpmaxsw, vpxor
+    case 0x1F1 ... 0x1F6:  // vpsll, vpmuludq, vpmaddwd, vpsadbw
+    case 0x1F8 ... 0x1FE:  // vpsub, vpadd
+    case 0x200 ... 0x20B:  // vpshufb, vphadd, vpmaddubsw, vphsub, vpsign
+    case 0x21C ... 0x21E:  // vpabs
+    case 0x240:            // vpmulld
+    case 0x30F:            // vpalignr
+    case 0x344:            // vpclmulqdq
+      return OpVexInt;
+    case 0x113:  // vmovlps, vmovlpd store
+    case 0x117:  // vmovhps, vmovhpd store
+    case 0x12C:  // vcvttss2si, vcvttsd2si
+    case 0x12D:  // vcvtss2si, vcvtsd2si
+    case 0x12E:  // vucomiss, vucomisd
+    case 0x12F:  // vcomiss, vcomisd
+    case 0x1AE:  // vldmxcsr, vstmxcsr
+    case 0x1C5:  // vpextrw
+    case 0x1F7:  // vmaskmovdqu
+      return OpVexSame;
+    case 0x12A:  // vcvtsi2ss, vcvtsi2sd
+    case 0x1C4:  // vpinsrw
+      return OpVexMerge;
+    case 0x150:  // vmovmskps, vmovmskpd
+    case 0x1D7:  // vpmovmskb
+      return OpVexMovmsk;
+    case 0x16E:
+      return OpVexMovd;
+    case 0x17E:
+    case 0x1D6:
+      return OpVexMovq;
+    case 0x171 ... 0x173:
+      return OpVexPsb;
+    case 0x177:
+      return OpVexZeroupper;
+    case 0x20E:  // vtestps
+    case 0x20F:  // vtestpd
+    case 0x217:  // vptest
+      return OpVexPtest;
+    case 0x218 ... 0x21A:  // vbroadcastss, vbroadcastsd, vbroadcastf128
+    case 0x258 ... 0x25A:  // vpbroadcastd, vpbroadcastq, vbroadcasti128
+    case 0x278 ... 0x279:  // vpbroadcastb, vpbroadcastw
+      return OpVexBroadcast;
+    case 0x220 ... 0x225:
+    case 0x230 ... 0x235:
+      return OpVexPmovx;
+    case 0x228 ... 0x229:  // vpmuldq, vpcmpeqq
+    case 0x22B:            // vpackusdw
+    case 0x237 ... 0x23F:  // vpcmpgtq, vpmin, vpmax
+      return OpVexInt38;
+    case 0x216:  // vpermps
+    case 0x236:  // vpermd
+      return OpVexPermd;
+    case 0x245 ... 0x247:
+      return OpVexShiftv;
+    case 0x300:  // vpermq
+    case 0x301:  // vpermpd
+      return OpVexPermq;
+    case 0x302:  // vpblendd
+    case 0x30C:  // vblendps
+    case 0x30D:  // vblendpd
+    case 0x30E:  // vpblendw
+      return OpVexBlend;
+    case 0x308 ... 0x30B:
+      return OpVexRound;
+    case 0x304:  // vpermilps
+    case 0x305:  // vpermilpd
+    case 0x20C:
+    case 0x20D:
+      return OpVexPermil;
+    case 0x22C ... 0x22F:  // vmaskmovps, vmaskmovpd
+    case 0x28C:            // vpmaskmovd, vpmaskmovq
+    case 0x28E:
+      return OpVexMaskmov;
+    case 0x290 ... 0x293:  // vpgatherdd, vpgatherqd, vgatherdps, etc.
+      return OpVexGather;
+    case 0x2DB ... 0x2DF:  // vaesimc, vaesenc, vaesenclast, vaesdec, etc.
+    case 0x3DF:            // vaeskeygenassist
+      return OpVexAes;
+    case 0x296 ... 0x29F:  // vfmadd132, vfmsub132, vfnmadd132, etc.
+    case 0x2A6 ... 0x2AF:  // vfmadd213, vfmsub213, vfnmadd213, etc.
+    case 0x2B6 ... 0x2BF:  // vfmadd231, vfmsub231, vfnmadd231, etc.
+      return OpVexFma;
+    case 0x213:
+      return OpVexCvtph2ps;
+    case 0x31D:
+      return OpVexCvtps2ph;
+    case 0x306:  // vperm2f128
+    case 0x346:  // vperm2i128
+      return OpVexPerm2x128;
+    case 0x318:  // vinsertf128
+    case 0x338:  // vinserti128
+      return OpVexInsert128;
+    case 0x319:  // vextractf128
+    case 0x339:  // vextracti128
+      return OpVexExtract128;
+    case 0x34A ... 0x34C:
+      return OpVexBlendv;
+    case 0x314 ... 0x317:  // vpextrb, vpextrw, vpextrd, vextractps
+      return OpVexExtract;
+    case 0x320 ... 0x322:  // vpinsrb, vinsertps, vpinsrd
+      return OpVexInsert;
+    default:
+      return OpUd;
+  }
+}
+
+#else
+
+nexgen32e_f GetAvxOp(long op) {
+  return OpUd;
+}
+
+#endif /* DISABLE_AVX */
@@ -0,0 +1,61 @@
+#ifndef BLINK_AVX_H_
+#define BLINK_AVX_H_
+#include "blink/machine.h"
+
+#define kXcr0X87 1  // x87 state, i.e. xsave component 0
+#define kXcr0Sse 2  // xmm registers and mxcsr, i.e. component 1
+#define kXcr0Avx 4  // upper halves of ymm registers, i.e. component 2
+
+#ifndef DISABLE_AVX
+#define kXcr0Supported (kXcr0X87 | kXcr0Sse | kXcr0Avx)
+#else
+#define kXcr0Supported (kXcr0X87 | kXcr0Sse)
+#endif
+
+#define kXsaveHeader    512  // offset of xstate_bv and xcomp_bv
+#define kXsaveAvxOffset 576  // offset of ymmh[16][16] when compacted too
+#define kXsaveAvxSize   256  // bytes of ymmh[16][16]
+#define kXsaveSize      (kXsaveAvxOffset + kXsaveAvxSize)
+
+void GetYmm(struct Machine *, int, u8[32]);
+void PutYmm(struct Machine *, int, const u8[32], bool);
+void GetYmmRm(P, u8[32], long, bool);
+void PutYmmMem(P, const u8 *, long, bool);
+double RoundYmm(double, int);
+
+void OpVexAes(P);
+void OpVexBlend(P);
+void OpVexBlendv(P);
+void OpVexBroadcast(P);
+void OpVexCvt(P);
+void OpVexCvtph2ps(P);
+void OpVexCvtps2ph(P);
+void OpVexExtract(P);
+void OpVexExtract128(P);
+void OpVexFma(P);
+void OpVexGather(P);
+void OpVexInsert(P);
+void OpVexInsert128(P);
+void OpVexInt(P);
+void OpVexInt38(P);
+void OpVexLanes(P);
+void OpVexMaskmov(P);
+void OpVexMerge(P);
+void OpVexMov(P);
+void OpVexMovd(P);
+void OpVexMovmsk(P);
+void OpVexMovq(P);
+void OpVexPerm2x128(P);
+void OpVexPermd(P);
+void OpVexPermil(P);
+void OpVexPermq(P);
+void OpVexPmovx(P);
+void OpVexPsb(P);
+void OpVexPtest(P);
+void OpVexRound(P);
+void OpVexSame(P);
+void OpVexShiftv(P);
+void OpVexZeroupper(P);
+nexgen32e_f GetAvxOp(long);
+
+#endif /* BLINK_AVX_H_ */
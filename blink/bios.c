@@ -22,6 +22,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include "blink/assert.h"
@@ -31,6 +32,7 @@
 #include "blink/bus.h"
 #include "blink/cga.h"
 #include "blink/endian.h"
+#include "blink/errno.h"
 #include "blink/flags.h"
 #include "blink/loader.h"
 #include "blink/machine.h"
@@ -61,6 +63,9 @@ static int diskcyls = 1023;
 static int diskheads = 16;  // default to 16 heads/cylinder, following QEMU
 static int disksects = 63;
 static bool diskisfloppy = false;
+static bool diskiswritable = false;
+static u8 *diskimage;
+static off_t diskimagemapsize;
 
 static u64 prevday = 0;  // day number of last call to int 0x1A, ah = 0, for
                          // calculating elapsed midnight count
@@ -147,9 +152,57 @@ static void OnDiskServiceGetParams(void) {
   SetCarry(false);
 }
 
-static void OnDiskServiceReadSectors(void) {
+// maps the disk image into memory the first time it's needed, so the
+// file needn't be opened and read again for each request. the mapping
+// is shared, which makes sectors written by the guest go to the image
+static u8 *GetDiskImage(void) {
   int fd;
-  i64 addr, size, rsize, ursize;
+  void *map;
+  struct stat st;
+  if (diskimage) return diskimage;
+  if ((fd = VfsOpen(AT_FDCWD, m->system->elf.prog, O_RDWR, 0)) != -1) {
+    diskiswritable = true;
+  } else if ((fd = VfsOpen(AT_FDCWD, m->system->elf.prog, O_RDONLY, 0)) ==
+             -1) {
+    return 0;
+  }
+  if (!VfsFstat(fd, &st) && st.st_size > 0 &&
+      (map = VfsMmap(0, st.st_size,
+                     PROT_READ | (diskiswritable ? PROT_WRITE : 0),
+                     MAP_SHARED, fd, 0)) != MAP_FAILED) {
+    diskimage = (u8 *)map;
+    diskimagemapsize = st.st_size;
+  }
+  VfsClose(fd);
+  return diskimage;
+}
+
+// copies sectors between the disk image and real memory, returning the
+// number of bytes transferred, which is less than size if the transfer
+// ran past the end of the image, or -1 w/ errno
+static i64 TransferSectors(i64 addr, i64 size, i64 offset, bool writing) {
+  u8 *image;
+  i64 n, un;
+  if (!(image = GetDiskImage())) return -1;
+  if (writing && !diskiswritable) return erofs();
+  if (offset >= diskimagemapsize) return 0;
+  n = MIN(size, diskimagemapsize - offset);
+  if (writing) {
+    SetReadAddr(m, addr, n);
+    memcpy(image + offset, m->system->real + addr, n);
+    return n;
+  }
+  memcpy(m->system->real + addr, image + offset, n);
+  un = ROUNDUP(n, 512);
+  if (un != n) {
+    memset(m->system->real + addr + n, 0, un - n);
+  }
+  SetWriteAddr(m, addr, un);
+  return un;
+}
+
+static void OnDiskServiceSectors(bool writing) {
+  i64 addr, size, rsize;
   i64 sectors, drive, head, cylinder, sector, offset;
   sectors = m->al;
   drive = m->dl;
@@ -163,43 +216,40 @@ static void OnDiskServiceReadSectors(void) {
   size = sectors * 512;
   offset = sector * 512 + head * 512 * disksects +
            cylinder * 512 * disksects * diskheads;
-  ELF_LOGF("bios read sectors %" PRId64 " "
+  ELF_LOGF("bios %s sectors %" PRId64 " "
            "@ sector %" PRId64 " cylinder %" PRId64 " head %" PRId64
            " drive %" PRId64 " offset %#" PRIx64 " from %s",
-           sectors, sector, cylinder, head, drive, offset, m->system->elf.prog);
+           writing ? "write" : "read", sectors, sector, cylinder, head, drive,
+           offset, m->system->elf.prog);
   addr = m->es.base + Get16(m->bx);
   if (addr >= kRealSize || size > kRealSize || addr + size > kRealSize) {
-    LOGF("bios disk read exceeded real memory");
+    LOGF("bios disk transfer exceeded real memory");
     m->al = 0x00;
     m->ah = 0x02;  // cannot find address mark
     SetCarry(true);
     return;
   }
   errno = 0;
-  if ((fd = VfsOpen(AT_FDCWD, m->system->elf.prog, O_RDONLY, 0)) != -1 &&
-      (rsize = VfsPread(fd, m->system->real + addr, size, offset)) >= 0) {
-    ursize = ROUNDUP(rsize, 512);
-    if (ursize != rsize) {
-      memset(m->system->real + addr + rsize, 0, ursize - rsize);
-    }
-    SetWriteAddr(m, addr, ursize);
-    if (ursize == size) {
+  if ((rsize = TransferSectors(addr, size, offset, writing)) != -1) {
+    if (rsize == size) {
       m->ah = 0x00;  // success
       SetCarry(false);
     } else {
-      sectors = ursize / 512;
-      LOGF("bios read sectors: partial read %" PRId64 " sectors", sectors);
+      sectors = rsize / 512;
+      LOGF("bios %s sectors: partial transfer %" PRId64 " sectors",
+           writing ? "write" : "read", sectors);
       m->al = sectors;
       m->ah = 0x04;  // sector not found
       SetCarry(true);
     }
   } else {
-    LOGF("bios read sectors failed: %s", DescribeHostErrno(errno));
+    LOGF("bios %s sectors failed: %s", writing ? "write" : "read",
+         DescribeHostErrno(errno));
     m->al = 0x00;
-    m->ah = 0x0d;  // invalid number of sector
+    m->ah = errno == EROFS ? 0x03   // write protected
+                           : 0x0d;  // invalid number of sectors
     SetCarry(true);
   }
-  VfsClose(fd);
 }
 
 static void OnDiskServiceProbeExtended(void) {
@@ -216,11 +266,10 @@ static void OnDiskServiceProbeExtended(void) {
   }
 }
 
-static void OnDiskServiceReadSectorsExtended(void) {
-  int fd;
+static void OnDiskServiceSectorsExtended(bool writing) {
   u8 drive = m->dl;
   i64 pkt_addr = m->ds.base + Get16(m->si), addr, sectors, size, lba, offset,
-      rsize, ursize;
+      rsize;
   u8 pkt_size, *pkt;
   SetReadAddr(m, pkt_addr, 1);
   pkt = m->system->real + pkt_addr;
@@ -240,17 +289,17 @@ static void OnDiskServiceReadSectorsExtended(void) {
     size = sectors * 512;
     lba = Read32(pkt + 8);
     offset = lba * 512;
-    ELF_LOGF("bios read sector ext "
+    ELF_LOGF("bios %s sector ext "
              "lba=%" PRId64 " "
              "offset=%" PRIx64 " "
              "size=%" PRIx64,
-             lba, offset, size);
+             writing ? "write" : "read", lba, offset, size);
     if (!DetermineChsAndSanityCheck(drive)) {
       Write16(pkt + 2, 0);
       return;
     }
     if (addr >= kRealSize || size > kRealSize || addr + size > kRealSize) {
-      LOGF("bios disk read exceeded real memory");
+      LOGF("bios disk transfer exceeded real memory");
       SetWriteAddr(m, pkt_addr + 2, 2);
       Write16(pkt + 2, 0);
       m->ah = 0x02;  // cannot find address mark
@@ -258,31 +307,28 @@ static void OnDiskServiceReadSectorsExtended(void) {
       return;
     }
     errno = 0;
-    if ((fd = VfsOpen(AT_FDCWD, m->system->elf.prog, O_RDONLY, 0)) != -1 &&
-        (rsize = VfsPread(fd, m->system->real + addr, size, offset)) >= 0) {
-      ursize = ROUNDUP(rsize, 512);
-      if (ursize != rsize) {
-        memset(m->system->real + addr + rsize, 0, ursize - rsize);
-      }
-      SetWriteAddr(m, addr, ursize);
-      if (ursize == size) {
+    if ((rsize = TransferSectors(addr, size, offset, writing)) != -1) {
+      if (rsize == size) {
         m->ah = 0x00;  // success
         SetCarry(false);
       } else {
-        sectors = ursize / 512;
-        LOGF("bios read sectors: partial read %" PRId64 " sectors", sectors);
+        sectors = rsize / 512;
+        LOGF("bios %s sectors: partial transfer %" PRId64 " sectors",
+             writing ? "write" : "read", sectors);
+        SetWriteAddr(m, pkt_addr + 2, 2);
         Write16(pkt + 2, sectors);
         m->ah = 0x04;  // sector not found
         SetCarry(true);
       }
     } else {
-      LOGF("bios read sector failed: %s", DescribeHostErrno(errno));
+      LOGF("bios %s sector failed: %s", writing ? "write" : "read",
+           DescribeHostErrno(errno));
       SetWriteAddr(m, pkt_addr + 2, 2);
       Write16(pkt + 2, 0);
-      m->ah = 0x0d;  // invalid number of sectors
+      m->ah = errno == EROFS ? 0x03   // write protected
+                             : 0x0d;  // invalid number of sectors
       SetCarry(true);
     }
-    VfsClose(fd);
   }
 }
 
@@ -292,7 +338,10 @@ static void OnDiskService(void) {
       OnDiskServiceReset();
       break;
     case 0x02:
-      OnDiskServiceReadSectors();
+      OnDiskServiceSectors(false);
+      break;
+    case 0x03:
+      OnDiskServiceSectors(true);
       break;
     case 0x08:
       OnDiskServiceGetParams();
@@ -301,7 +350,10 @@ static void OnDiskService(void) {
       OnDiskServiceProbeExtended();
       break;
     case 0x42:
-      OnDiskServiceReadSectorsExtended();
+      OnDiskServiceSectorsExtended(false);
+      break;
+    case 0x43:
+      OnDiskServiceSectorsExtended(true);
       break;
     default:
       OnDiskServiceBadCommand();
@@ -344,67 +396,72 @@ static void VidyaServiceClearLine(int x1, int x2, int y, u8 attr) {
   }
 }
 
-/* scroll video ram up from line y1 up to and including line y2 */
-static void VidyaServiceScrollUp(int y1, int y2, u8 attr) {
-  int xn, pitch;
+/* scroll window of video ram from x1,y1 up to and including x2,y2 up
+   by n lines, filling the lines it uncovers with attribute attr */
+static void VidyaServiceScrollUp(int x1, int y1, int x2, int y2, int n,
+                                 u8 attr) {
+  int y, xn, pitch;
   u8 *vid;
-  unassert(y1 >= 0 && y1 < BdaLines);
-  unassert(y2 >= 0 && y2 < BdaLines);
+  unassert(x1 >= 0 && x1 <= x2 && x2 < BdaCols);
+  unassert(y1 >= 0 && y1 <= y2 && y2 < BdaLines);
+  if (n > y2 - y1 + 1) n = y2 - y1 + 1;
   xn = BdaCols;
-  vid = video_ram() + (page_offsetw() + y1 * xn) * 2;
+  vid = video_ram() + (page_offsetw() + y1 * xn + x1) * 2;
   pitch = xn * 2;
-  memcpy(vid, vid + pitch, (BdaLines - y1) * pitch);
-  VidyaServiceClearLine(0, xn - 1, y2, attr);
+  if (x1 == 0 && x2 == xn - 1) {
+    memmove(vid, vid + n * pitch, (y2 - y1 + 1 - n) * pitch);
+  } else {
+    for (y = y1; y + n <= y2; ++y, vid += pitch) {
+      memmove(vid, vid + n * pitch, (x2 - x1 + 1) * 2);
+    }
+  }
+  VidyaServiceClearScreen(x1, y2 + 1 - n, x2 + 1, y2 + 1, attr);
 }
 
-/* scroll adapter RAM down from line y1 up to and including line y2 */
-static void VidyaServiceScrollDown(int y1, int y2, u8 attr) {
+/* scroll window of video ram from x1,y1 up to and including x2,y2 down
+   by n lines, filling the lines it uncovers with attribute attr */
+static void VidyaServiceScrollDown(int x1, int y1, int x2, int y2, int n,
+                                   u8 attr) {
   int y, xn, pitch;
   u8 *vid;
-  unassert(y1 >= 0 && y1 < BdaLines);
-  unassert(y2 >= 0 && y2 < BdaLines);
+  unassert(x1 >= 0 && x1 <= x2 && x2 < BdaCols);
+  unassert(y1 >= 0 && y1 <= y2 && y2 < BdaLines);
+  if (n > y2 - y1 + 1) n = y2 - y1 + 1;
   xn = BdaCols;
-  vid = video_ram() + (page_offsetw() + (BdaLines - 1) * xn) * 2;
+  vid = video_ram() + (page_offsetw() + y1 * xn + x1) * 2;
   pitch = xn * 2;
-  y = y2;
-  while (--y >= y1) {
-    memcpy(vid, vid - pitch, pitch);
-    vid -= pitch;
+  if (x1 == 0 && x2 == xn - 1) {
+    memmove(vid + n * pitch, vid, (y2 - y1 + 1 - n) * pitch);
+  } else {
+    for (y = y2 - n; y >= y1; --y) {
+      memmove(vid + (y - y1 + n) * pitch, vid + (y - y1) * pitch,
+              (x2 - x1 + 1) * 2);
+    }
   }
-  VidyaServiceClearLine(0, xn - 1, y1, attr);
+  VidyaServiceClearScreen(x1, y1, x2 + 1, y1 + n, attr);
 }
 
 static void OnVidyaServiceScrollUp(void) {
-  unsigned i, n;
   unassert(m->cl < BdaCols);
   unassert(m->ch < BdaLines);
   unassert(m->dl < BdaCols);
   unassert(m->dh < BdaLines);
-  n = m->al;
-  if (n > BdaLines) n = BdaLines;
-  if (n == 0) {
+  if (m->al == 0 || m->cl > m->dl || m->ch > m->dh) {
     VidyaServiceClearScreen(m->cl, m->ch, m->dl + 1, m->dh + 1, m->bh);
   } else {
-    for (i = n; i; i--) {
-      VidyaServiceScrollUp(m->ch, m->dh, m->bh);
-    }
+    VidyaServiceScrollUp(m->cl, m->ch, m->dl, m->dh, m->al, m->bh);
   }
 }
 
 static void OnVidyaServiceScrollDown(void) {
-  unsigned i, n;
   unassert(m->cl < BdaCols);
   unassert(m->ch < BdaLines);
   unassert(m->dl < BdaCols);
   unassert(m->dh < BdaLines);
-  n = m->al;
-  if (n > BdaLines) n = BdaLines;
-  if (n == 0) {
+  if (m->al == 0 || m->cl > m->dl || m->ch > m->dh) {
     VidyaServiceClearScreen(m->cl, m->ch, m->dl + 1, m->dh + 1, m->bh);
   } else {
-    for (i = n; i; i--) {
-      VidyaServiceScrollDown(m->ch, m->dh, m->bh);
-    }
+    VidyaServiceScrollDown(m->cl, m->ch, m->dl, m->dh, m->al, m->bh);
   }
 }
 
@@ -464,7 +521,7 @@ static void VidyaServiceWriteTeletype(u8 ch) {
     if (++y >= BdaLines) {
       y = BdaLines - 1;
       attr = vram[page_offsetw() + ((y * xn + BdaCols - 1) * 2) + 1];
-      VidyaServiceScrollUp(0, BdaLines - 1, attr);
+      VidyaServiceScrollUp(0, 0, BdaCols - 1, BdaLines - 1, 1, attr);
     }
   }
 update:
@@ -16,12 +16,15 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/alu.h"
 #include "blink/bus.h"
 #include "blink/flags.h"
 #include "blink/machine.h"
 #include "blink/modrm.h"
 #include "blink/rde.h"
 
+static const u8 kBitAlu[3] = {ALU_OR, ALU_AND, ALU_XOR};
+
 static u64 Bts(u64 x, u64 y) {
   return x | y;
 }
@@ -34,6 +37,34 @@ static u64 Btc(u64 x, u64 y) {
   return (x & ~y) | (~x & y);
 }
 
+static void JitBit(P, int op, unsigned bit, int w) {
+  if (Opcode(rde) == 0xBA) {
+    Jitter(A,
+           "wB"     // res0 = GetRegOrMem[force16+bit](RexbRm)
+           "s0a2="  // arg2 = machine
+           "a1i"    // arg1 = bit
+           "t"      // arg0 = res0
+           "m",     // call micro-op
+           (u64)bit, kFastBit[op - 4][w - 1]);
+  } else if (IsModrmRegister(rde)) {
+    Jitter(A,
+           "wB"     // res0 = GetReg[force16+bit](RexbRm)
+           "r0s1="  // sav1 = res0
+           "wA"     // res0 = GetReg[force16+bit](RexrReg)
+           "s0a2="  // arg2 = machine
+           "r0a1="  // arg1 = res0
+           "s1a0="  // arg0 = sav1
+           "m",     // call micro-op
+           kFastBit[op - 4][w - 1]);
+  } else {
+    // the register operand can index memory outside the word
+    return;
+  }
+  if (op != 4) {
+    Jitter(A, "r0wD");  // PutRegOrMem[force16+bit](RexbRm, res0)
+  }
+}
+
 void OpBit(P) {
   u8 *p;
   int op;
@@ -59,15 +90,23 @@ void OpBit(P) {
     v = MaskAddress(Eamode(rde), ComputeAddress(A) + bitdisp);
     p = ReserveAddress(m, v, 1 << w, op != 4);
   }
-  if (Lock(rde)) LockBus(p);
   y = 1;
   y <<= bit;
+  if (Lock(rde) && op >= 5 && CanFetchAlu(kBitAlu[op - 5], w, p)) {
+    x = FetchAlu(kBitAlu[op - 5], w, p, op == 6 ? ~y : y);
+    m->flags = SetFlag(m->flags, FLAGS_CF, !!(y & x));
+    return;
+  }
+  if (Lock(rde)) LockBus(p);
   if (Lock(rde)) {
     x = ReadMemoryUnlocked(rde, p);
   } else {
     x = ReadMemory(rde, p);
   }
   m->flags = SetFlag(m->flags, FLAGS_CF, !!(y & x));
+  if (IsMakingPath(m) && !Lock(rde) && op >= 4) {
+    JitBit(A, op, bit, w);
+  }
   switch (op) {
     case 4:
       return;
@@ -16,6 +16,7 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
 #include <locale.h>
 #include <signal.h>
 #include <stdio.h>
@@ -25,9 +26,13 @@
 #include <unistd.h>
 
 #include "blink/assert.h"
+#include "blink/btrace.h"
+#include "blink/flight.h"
 #include "blink/builtin.h"
 #include "blink/bus.h"
 #include "blink/case.h"
+#include "blink/coredump.h"
+#include "blink/coverage.h"
 #include "blink/debug.h"
 #include "blink/dll.h"
 #include "blink/endian.h"
@@ -38,10 +43,16 @@
 #include "blink/machine.h"
 #include "blink/macros.h"
 #include "blink/map.h"
+#include "blink/metrics.h"
+#include "blink/native.h"
+#include "blink/perfmap.h"
+#include "blink/profile.h"
+#include "blink/reclaim.h"
 #include "blink/overlays.h"
 #include "blink/pml4t.h"
 #include "blink/signal.h"
 #include "blink/sigwinch.h"
+#include "blink/snapshot.h"
 #include "blink/stats.h"
 #include "blink/syscall.h"
 #include "blink/thread.h"
@@ -52,6 +63,10 @@
 #include "blink/x86.h"
 #include "blink/xlat.h"
 
+#if defined(__linux) && !defined(DISABLE_JIT)
+#include <sys/personality.h>
+#endif
+
 #ifndef BUILD_TIMESTAMP
 #define BUILD_TIMESTAMP __TIMESTAMP__
 #endif
@@ -90,7 +105,7 @@ Toolchain: " BUILD_TOOLCHAIN "\n\
 Revision: #" BLINK_COMMITS " " BLINK_GITSHA "\n\
 Config: ./configure MODE=" BUILD_MODE " " CONFIG_ARGUMENTS "\n"
 
-#define OPTS "hvjemZs0L:C:"
+#define OPTS "hvjemMZs0L:C:"
 
 _Alignas(1) static const char USAGE[] =
     " [-" OPTS "] PROG [ARGS...]\n"
@@ -105,6 +120,7 @@ _Alignas(1) static const char USAGE[] =
 #endif
     "  -0                   to specify argv[0]\n"
     "  -m                   enable memory safety\n"
+    "  -M                   enable memory safety using shadow memory\n"
 #if !defined(DISABLE_STRACE) && !defined(TINY)
     "  -s                   enable system call logging\n"
 #endif
@@ -115,15 +131,23 @@ _Alignas(1) static const char USAGE[] =
 #if !defined(DISABLE_OVERLAYS) || !defined(DISABLE_VFS)
     "  -C PATH              sets chroot dir or overlay spec [default \":o\"]\n"
 #endif
-#if !defined(DISABLE_OVERLAYS) || !defined(NDEBUG)
     "Environment:\n"
-#endif
 #ifndef DISABLE_OVERLAYS
     "  $BLINK_OVERLAYS      file system roots [default \":o\"]\n"
 #endif
 #ifndef DISABLE_VFS
     "  $BLINK_PREFIX        file system root [default \"/\"]\n"
 #endif
+#ifndef DISABLE_JIT
+    "  $BLINK_JIT_CACHE     directory for reusing jit code across runs\n"
+    "  $BLINK_FLIGHT        log jit paths entered before a crash\n"
+    "  $BLINK_ETRACE        trace jit paths to PATH.TID ring files\n"
+    "  $BLINK_ETRACE_REGS   also trace registers changed by each one\n"
+#endif
+    "  $BLINK_HUGEPAGES     back big anonymous mappings with huge pages\n"
+    "  $BLINK_RECLAIM       compress memory idle this many seconds (-m)\n"
+    "  $BLINK_CPU           cpuid features: max, fast, x86-64, host [max]\n"
+    "  $BLINK_NATIVE        run guest memcpy, strlen, etc. natively\n"
 #ifndef NDEBUG
 
     "  $BLINK_LOG_FILENAME  log filename (same as -L flag)\n"
@@ -150,6 +174,8 @@ void TerminateSignal(struct Machine *m, int sig, int code) {
   int syssig;
   struct sigaction sa;
   unassert(!IsSignalIgnoredByDefault(sig));
+  DumpCore(m, sig);
+  UnlockRobustFutexes(m);
   KillOtherThreads(m->system);
 #ifdef HAVE_JIT
   DisableJit(&m->system->jit);  // unmapping exec pages is slow
@@ -161,6 +187,7 @@ void TerminateSignal(struct Machine *m, int sig, int code) {
          "faultaddr=%#" PRIx64 ")",
          DescribeSignal(sig), m->ip, code, m->faultaddr);
     PrintDiagnostics(m);
+    PrintFlight(m);
   }
   if ((syssig = XlatSignal(sig)) == -1) syssig = SIGKILL;
   FreeMachine(m);
@@ -188,6 +215,9 @@ static void OnFatalSystemSignal(int sig, siginfo_t *si, void *ptr) {
            si->si_addr);
 #ifndef DISABLE_JIT
   if (IsSelfModifyingCodeSegfault(m, si)) return;
+#endif
+#ifndef DISABLE_VFS
+  if (IsSoftDirtySegfault(m, si)) return;
 #endif
   g_siginfo = *si;
   unassert(m);
@@ -210,19 +240,38 @@ static int Exec(char *execfn, char *prog, char **argv, char **envp) {
   unassert((g_machine = m = NewMachine(NewSystem(XED_MACHINE_MODE_LONG), 0)));
 #ifdef HAVE_JIT
   if (FLAG_nojit) DisableJit(&m->system->jit);
+  if (FLAG_jitasync && StartJitWorker(&m->system->jit)) {
+    LOGF("failed to start jit worker: %s", DescribeHostErrno(errno));
+  }
 #endif
   m->system->exec = Exec;
+  if (!old) MarkStartup("system");
+  if (FLAG_metrics) StartMetrics(m->system);
+  if (FLAG_profile) StartProfile();
+  if (FLAG_btrace) StartBtrace();
+  if (FLAG_reclaim) StartReclaim(m->system);
   if (!old) {
     // this is the first time a program is being loaded
-    LoadProgram(m, execfn, prog, argv, envp, NULL);
+    if (!RestoreSnapshot(m, prog, argv)) {
+      LoadProgram(m, execfn, prog, argv, envp, NULL);
+    }
+    MarkStartup("loader");
     SetupCod(m);
     for (i = 0; i < 10; ++i) {
-      AddStdFd(&m->system->fds, i);
+      if (!GetFd(&m->system->fds, i)) {
+        AddStdFd(&m->system->fds, i);
+      }
     }
     ProgramLimit(m->system, RLIMIT_NOFILE, RLIMIT_NOFILE_LINUX);
+#ifdef HAVE_JIT
+    ReadJitCacheFile(m);
+#endif
+    MarkStartup("files");
   } else {
 #ifdef HAVE_JIT
     DisableJit(&old->system->jit);  // unmapping exec pages is slow
+    // the old program's files are about to be unmapped
+    FlushCoverage(old->system);
 #endif
     unassert(!m->sysdepth);
     unassert(!m->pagelocks.i);
@@ -234,16 +283,24 @@ static int Exec(char *execfn, char *prog, char **argv, char **envp) {
     }
     memcpy(m->system->rlim, old->system->rlim, sizeof(old->system->rlim));
     LoadProgram(m, execfn, prog, argv, envp, NULL);
-    m->system->fds.list = old->system->fds.list;
-    old->system->fds.list = 0;
+    MoveFds(&m->system->fds, &old->system->fds);
     // releasing the execve() lock must come after unlocking fds
     memcpy(&oldmask, &old->system->exec_sigmask, sizeof(oldmask));
     UNLOCK(&old->system->exec_lock);
     // freeing the last machine in a system will free its system too
     FreeMachine(old);
+#ifdef HAVE_JIT
+    // jit memory of the old program has only now been given back
+    ReadJitCacheFile(m);
+#endif
     // restore the signal mask we had before execve() was called
     unassert(!pthread_sigmask(SIG_SETMASK, &oldmask, 0));
   }
+#ifdef HAVE_JIT
+  if (FLAG_perfmap) StartPerfMap(m->system);
+  if (FLAG_coverage) StartCoverage(m->system);
+#endif
+  if (FLAG_native) StartNatives(m->system);
   Blink(m);
 }
 
@@ -265,6 +322,7 @@ _Noreturn static void PrintVersion(void) {
 
 static void GetOpts(int argc, char *argv[]) {
   int opt;
+  const char *s;
   FLAG_nolinear = !CanHaveLinearMemory();
 #ifndef DISABLE_OVERLAYS
   FLAG_overlays = getenv("BLINK_OVERLAYS");
@@ -273,6 +331,33 @@ static void GetOpts(int argc, char *argv[]) {
 #ifndef DISABLE_VFS
   FLAG_prefix = getenv("BLINK_PREFIX");
 #endif
+#ifndef DISABLE_JIT
+  FLAG_jitcache = getenv("BLINK_JIT_CACHE");
+  FLAG_jitasync = !!getenv("BLINK_JIT_ASYNC");
+  FLAG_perfmap = !!getenv("BLINK_PERFMAP");
+  FLAG_flight = !!getenv("BLINK_FLIGHT");
+  FLAG_coverage = getenv("BLINK_COVERAGE");
+  FLAG_etrace = getenv("BLINK_ETRACE");
+  FLAG_etraceregs = !!getenv("BLINK_ETRACE_REGS");
+#endif
+  FLAG_snapshot = getenv("BLINK_SNAPSHOT");
+  FLAG_core = getenv("BLINK_CORE");
+  FLAG_metrics = getenv("BLINK_METRICS");
+  FLAG_profile = getenv("BLINK_PROFILE");
+  FLAG_btrace = getenv("BLINK_BTRACE");
+  FLAG_hugepages = !!getenv("BLINK_HUGEPAGES");
+  FLAG_dedup = !!getenv("BLINK_DEDUP");
+  FLAG_native = !!getenv("BLINK_NATIVE");
+  if ((s = getenv("BLINK_CPU")) && !SetCpuProfile(s)) {
+    WriteErrorString("error: $BLINK_CPU must be max, fast, x86-64 or host\n");
+    exit(1);
+  }
+  if ((s = getenv("BLINK_RECLAIM"))) {
+    FLAG_reclaim = MAX(0, atoi(s));
+  }
+  if ((s = getenv("BLINK_ASYNC_IO"))) {
+    FLAG_asyncio = MAX(0, MIN(atoi(s), kMaxAioPool));
+  }
 #if LOG_ENABLED
   FLAG_logpath = getenv("BLINK_LOG_FILENAME");
 #endif
@@ -295,6 +380,11 @@ static void GetOpts(int argc, char *argv[]) {
         break;
       case 'm':
         FLAG_nolinear = true;
+        FLAG_shadow = false;
+        break;
+      case 'M':
+        FLAG_nolinear = true;
+        FLAG_shadow = CanHaveShadowMemory();
         break;
       case 'Z':
         FLAG_statistics = true;
@@ -325,6 +415,32 @@ static void GetOpts(int argc, char *argv[]) {
   }
 #if LOG_ENABLED
   LogInit(FLAG_logpath);
+#endif
+  if (FLAG_shadow) {
+    if (InitShadow()) {
+      FLAG_nolinear = false;
+    } else {
+      LOGF("failed to reserve shadow memory: %s", DescribeHostErrno(errno));
+      FLAG_shadow = false;
+    }
+  }
+  if (FLAG_reclaim && !FLAG_nolinear) {
+    // linear memory is mapped by the host, so it can't be taken back
+    LOGF("BLINK_RECLAIM only works with -m");
+    FLAG_reclaim = 0;
+  }
+}
+
+// cached jit code is only usable at the address it was generated at,
+// so we restart ourselves without aslr, if the host let us enable it
+static void DisableAslrForJitCache(char *argv[]) {
+#if defined(__linux) && !defined(DISABLE_JIT)
+  int p;
+  if (!getenv("BLINK_JIT_CACHE")) return;
+  if ((p = personality(0xffffffff)) == -1 || (p & ADDR_NO_RANDOMIZE)) return;
+  if (personality(p | ADDR_NO_RANDOMIZE) == -1) return;
+  execv("/proc/self/exe", argv);
+  personality(p);
 #endif
 }
 
@@ -362,6 +478,8 @@ void exit(int status) {
 #endif
 
 int main(int argc, char *argv[]) {
+  DisableAslrForJitCache(argv);
+  MarkStartup("main");
   SetupWeb();
   GetStartDir();
 #ifndef DISABLE_STRACE
@@ -380,20 +498,24 @@ int main(int argc, char *argv[]) {
   if (optind_ == argc) {
     PrintUsage(argc, argv, 48, 2);
   }
+  MarkStartup("options");
 #ifndef DISABLE_OVERLAYS
   if (SetOverlays(FLAG_overlays, true)) {
     WriteErrorString("bad blink overlays spec; see log for details\n");
     exit(1);
   }
+  MarkStartup("overlays");
 #endif
 #ifndef DISABLE_VFS
   if (VfsInit(FLAG_prefix)) {
     WriteErrorString("error: vfs initialization failed\n");
     exit(1);
   }
+  MarkStartup("vfs");
 #endif
   HandleSigs();
   InitBus();
+  MarkStartup("bus");
   if (!Commandv(argv[optind_], g_pathbuf, sizeof(g_pathbuf))) {
     WriteErrorString(argv[0]);
     WriteErrorString(": command not found: ");
@@ -402,5 +524,6 @@ int main(int argc, char *argv[]) {
     exit(127);
   }
   argv[optind_] = g_pathbuf;
+  MarkStartup("commandv");
   return Exec(g_pathbuf, g_pathbuf, argv + optind_ + FLAG_zero, environ);
 }
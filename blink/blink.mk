@@ -22,6 +22,12 @@ $(BLINK_NEED_BUILDINFO_OBJS): private CPPFLAGS += $(CONFIG_CPPFLAGS)
 # micro-ops need to be compiled with the greatest of care
 o/$(MODE)/blink/uop.o: private CFLAGS += $(UOPFLAGS)
 
+# micro-ops get copied into jit paths, so they can't have counters
+o/$(MODE)/blink/uop.o				\
+o/$(MODE)/blink/fpu.o				\
+o/$(MODE)/blink/time.o				\
+o/$(MODE)/blink/crc32.o: private PGOFLAGS =
+
 # avoid impossible to address errors in ./configure --posix mode
 ifeq ($(HOST_SYSTEM), Darwin)
 o/$(MODE)/blink/jit.o: private CPPFLAGS += -D_DARWIN_C_SOURCE
@@ -37,6 +43,21 @@ o/cosmo/blink/blink.com: o/$(MODE)/blink/blink
 o/cosmo/blink/blinkenlights.com: o/$(MODE)/blink/blinkenlights
 	objcopy -S -O binary $< $@
 
+# Profile Guided Optimization
+# make m=pgo o/pgo/blink/blink
+# builds an instrumented blink, runs the microbenchmarks with it under
+# each of their jit and linear memory flags, and then gives each object
+# in this mode the counters left behind by its o/pgo-train counterpart
+ifeq ($(MODE), pgo)
+$(BLINK_OBJS): o/pgo/blink/profile.ok
+o/pgo/blink/profile.ok: $(BLINK_SRCS) $(BLINK_HDRS)
+	rm -f o/pgo-train/blink/*.gcda
+	$(MAKE) MODE=pgo-train o/pgo-train/test/bench >/dev/null
+	@mkdir -p $(@D)
+	cp o/pgo-train/blink/*.gcda $(@D)
+	touch $@
+endif
+
 # vectorization makes code smaller
 o/$(MODE)/blink/sse2.o: private CFLAGS += -O3
 o/$(MODE)/x86_64/blink/sse2.o: private CFLAGS += -O3
@@ -66,22 +87,23 @@ o/tiny/x86_64/blink/syscall.o: private CFLAGS += -fpie
 o/tiny/x86_64-gcc49/blink/syscall.o: private CFLAGS += -fpie
 o/tiny/aarch64/blink/syscall.o: private CFLAGS += -fpie
 
-o/$(MODE)/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_OBJS)))
-o/$(MODE)/i486/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/i486/%.o)))
-o/$(MODE)/m68k/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/m68k/%.o)))
-o/$(MODE)/x86_64/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/x86_64/%.o)))
-o/$(MODE)/x86_64-gcc49/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/x86_64-gcc49/%.o)))
-o/$(MODE)/arm/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/arm/%.o)))
-o/$(MODE)/aarch64/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/aarch64/%.o)))
-o/$(MODE)/riscv64/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/riscv64/%.o)))
-o/$(MODE)/mips/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/mips/%.o)))
-o/$(MODE)/mipsel/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/mipsel/%.o)))
-o/$(MODE)/mips64/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/mips64/%.o)))
-o/$(MODE)/mips64el/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/mips64el/%.o)))
-o/$(MODE)/s390x/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/s390x/%.o)))
-o/$(MODE)/microblaze/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/microblaze/%.o)))
-o/$(MODE)/powerpc/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/powerpc/%.o)))
-o/$(MODE)/powerpc64le/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o,$(BLINK_SRCS:%.c=o/$(MODE)/powerpc64le/%.o)))
+o/$(MODE)/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_OBJS)))
+o/$(MODE)/i486/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/i486/%.o)))
+o/$(MODE)/m68k/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/m68k/%.o)))
+o/$(MODE)/x86_64/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/x86_64/%.o)))
+o/$(MODE)/x86_64-gcc49/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/x86_64-gcc49/%.o)))
+o/$(MODE)/arm/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/arm/%.o)))
+o/$(MODE)/aarch64/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/aarch64/%.o)))
+o/$(MODE)/riscv64/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/riscv64/%.o)))
+o/$(MODE)/mips/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/mips/%.o)))
+o/$(MODE)/mipsel/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/mipsel/%.o)))
+o/$(MODE)/mips64/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/mips64/%.o)))
+o/$(MODE)/mips64el/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/mips64el/%.o)))
+o/$(MODE)/s390x/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/s390x/%.o)))
+o/$(MODE)/microblaze/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/microblaze/%.o)))
+o/$(MODE)/powerpc/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/powerpc/%.o)))
+o/$(MODE)/powerpc64le/blink/blink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/libblink.o %/blinkdis.o,$(BLINK_SRCS:%.c=o/$(MODE)/powerpc64le/%.o)))
+o/$(MODE)/blink/libblink.a: $(filter-out %/blink.o,$(filter-out %/blinkenlights.o %/blinkdis.o,$(BLINK_OBJS)))
 
 o/$(MODE)/blink/blink: o/$(MODE)/blink/blink.o o/$(MODE)/blink/blink.a
 	$(CC) $(LDFLAGS) $(TARGET_ARCH) $^ $(LOADLIBES) $(LDLIBS) -o $@
@@ -151,10 +173,15 @@ o/$(MODE)/powerpc/blink/blinkenlights: o/$(MODE)/powerpc/blink/blinkenlights.o o
 o/$(MODE)/powerpc64le/blink/blinkenlights: o/$(MODE)/powerpc64le/blink/blinkenlights.o o/$(MODE)/powerpc64le/blink/blink.a o/$(MODE)/powerpc64le/third_party/libz/zlib.a
 	$(VM) o/third_party/gcc/powerpc64le/bin/powerpc64le-linux-musl-gcc $(LDFLAGS_STATIC) $^ -o $@
 
+o/$(MODE)/blink/blinkdis: o/$(MODE)/blink/blinkdis.o o/$(MODE)/blink/blink.a
+	$(CC) $(LDFLAGS) $(TARGET_ARCH) $^ $(LOADLIBES) $(LDLIBS) -o $@
+
 o/$(MODE)/blink/oneoff.com: o/$(MODE)/blink/oneoff.o o/$(MODE)/blink/blink.a
 	$(CC) $(LDFLAGS) $(TARGET_ARCH) $^ $(LOADLIBES) $(LDLIBS) -o $@
 
 o/$(MODE)/blink:				\
 		o/$(MODE)/blink/blinkenlights	\
 		o/$(MODE)/blink/blink		\
+		o/$(MODE)/blink/blinkdis	\
+		o/$(MODE)/blink/libblink.a	\
 		$(BLINK_HDRS:%=o/$(MODE)/%.ok)
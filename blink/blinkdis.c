@@ -0,0 +1,136 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blink/dis.h"
+#include "blink/elf.h"
+#include "blink/endian.h"
+#include "blink/high.h"
+#include "blink/machine.h"
+#include "blink/x86.h"
+
+#define READ32(p) Read32((const u8 *)(p))
+
+// blinkdis prints the executable sections of x86-64 elf files using
+// the same decoder and formatting as the blinkenlights code panel.
+//
+//     make o//blink/blinkdis
+//     o//blink/blinkdis o//blink/blink | less -R
+//
+// Each file's symbol table is loaded once and the sections are handed
+// to DisRange() whole, so nothing needs to be emulated to read them.
+
+static bool g_noraw;
+
+// the decoder links against code that can kill a guest, but there
+// aren't any guests here
+void TerminateSignal(struct Machine *m, int sig, int code) {
+  abort();
+}
+
+static void Emit(void *arg, const char *line) {
+  fputs(line, (FILE *)arg);
+  fputc('\n', (FILE *)arg);
+}
+
+static int Disassemble(struct Dis *d, const char *path) {
+  int i, fd;
+  u8 *code;
+  void *map;
+  const char *name;
+  struct stat st;
+  Elf64_Ehdr_ *ehdr;
+  Elf64_Shdr_ *shdr;
+  if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+    perror(path);
+    if (fd != -1) close(fd);
+    return 1;
+  }
+  if (st.st_size < sizeof(Elf64_Ehdr_) ||
+      (map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
+          MAP_FAILED) {
+    fprintf(stderr, "%s: not an elf file\n", path);
+    close(fd);
+    return 1;
+  }
+  close(fd);
+  ehdr = (Elf64_Ehdr_ *)map;
+  if (READ32(ehdr->ident) != READ32("\177ELF") ||
+      ehdr->ident[EI_CLASS_] != ELFCLASS64_ ||
+      Read16(ehdr->machine) != EM_NEXGEN32E_) {
+    fprintf(stderr, "%s: not an x86-64 elf file\n", path);
+    munmap(map, st.st_size);
+    return 1;
+  }
+  DisLoadElf(d, ehdr, st.st_size, 0);
+  d->noraw = g_noraw;
+  printf("\n%s:\n", path);
+  for (i = 0; i < Read16(ehdr->shnum); ++i) {
+    shdr = GetElfSectionHeaderAddress(ehdr, st.st_size, i);
+    if (!(Read64(shdr->flags) & SHF_EXECINSTR_) ||
+        Read32(shdr->type) == SHT_NOBITS_ || !Read64(shdr->size) ||
+        Read64(shdr->offset) > st.st_size ||
+        Read64(shdr->size) > st.st_size - Read64(shdr->offset)) {
+      continue;
+    }
+    code = (u8 *)map + Read64(shdr->offset);
+    name = GetElfSectionName(ehdr, st.st_size, shdr);
+    printf("\nDisassembly of section %s:\n\n", name ? name : "?");
+    DisRange(d, code, Read64(shdr->size), Read64(shdr->addr), XED_MODE_LONG,
+             Emit, stdout);
+  }
+  DisFree(d);
+  munmap(map, st.st_size);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int i, opt, rc;
+  static struct Dis d;
+  static char buf[65536];
+  while ((opt = getopt(argc, argv, "hn")) != -1) {
+    switch (opt) {
+      case 'n':
+        g_noraw = true;
+        break;
+      case 'h':
+      default:
+        fprintf(opt == 'h' ? stdout : stderr, "Usage: %s [-n] ELF...\n",
+                argv[0]);
+        exit(opt == 'h' ? 0 : 48);
+    }
+  }
+  if (optind == argc) {
+    fprintf(stderr, "%s: missing operand\n", argv[0]);
+    exit(48);
+  }
+  setvbuf(stdout, buf, _IOFBF, sizeof(buf));
+  g_high.enabled = isatty(1);
+  for (rc = 0, i = optind; i < argc; ++i) {
+    rc |= Disassemble(&d, argv[i]);
+  }
+  return rc;
+}
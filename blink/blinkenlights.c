@@ -180,11 +180,14 @@ B       pop breakpoint            -s       system call logging\n\
 p       profiling mode            -C PATH  chroot directory\n\
 ctrl-t  turbo                     -B PATH  alternate BIOS image\n\
 alt-t   slowmo                    -z       zoom\n\
-                                  -h       help"
+S       step backwards            -h       help\n\
+b       continue backwards"
 
 #define FPS        60     // frames per second written to tty
 #define TURBO      true   // to keep executing between frames
 #define HISTORY    65536  // number of rewind renders to ring
+#define UNDOS      4096   // number of instructions reverse step can undo
+#define UNDOMAX    65536  // most bytes one instruction can save for undo
 #define WHEELDELTA 1      // how much impact scroll wheel has
 #define MAXZOOM    16     // lg2 maximum memory panel scaling
 #define DISPWIDTH  80     // size of the embedded tty display
@@ -309,6 +312,21 @@ struct History {
   struct Rendering p[HISTORY];
 };
 
+struct Undo {
+  u64 cycle;
+  u64 flags;
+  struct MachineState ms;
+  struct Buffer mem;  // overwritten bytes, each followed by i64 addr, u32 size
+};
+
+struct Undos {
+  unsigned index;
+  unsigned count;
+  bool recording;
+  bool discard;
+  struct Undo p[UNDOS];
+};
+
 struct ProfSym {
   int sym;  // dis->syms.p[sym]
   unsigned long hits;
@@ -385,6 +403,7 @@ static unsigned long *ophits;
 static struct ProfSyms profsyms;
 
 static struct Panels pan;
+static struct PanelFrame lastframe;
 static struct Keystrokes keystrokes;
 static struct Breakpoints breakpoints;
 static struct Watchpoints watchpoints;
@@ -404,6 +423,7 @@ static char systemfailure[128];
 static struct sigaction oldsig[4];
 static char pathbuf[PATH_MAX];
 struct History g_history;
+static struct Undos undos;
 
 static void SetupDraw(void);
 static void HandleKeyboard(const char *);
@@ -637,8 +657,115 @@ static void CopyMachineState(struct MachineState *ms) {
   ms->gs = m->gs;
   memcpy(ms->weg, m->weg, sizeof(m->weg));
   memcpy(ms->xmm, m->xmm, sizeof(m->xmm));
+  memcpy(ms->ymmh, m->ymmh, sizeof(m->ymmh));
   memcpy(&ms->fpu, &m->fpu, sizeof(m->fpu));
   memcpy(&ms->mxcsr, &m->mxcsr, sizeof(m->mxcsr));
+  ms->xcr0 = m->xcr0;
+}
+
+static void RestoreMachineState(const struct MachineState *ms) {
+  m->ip = ms->ip;
+  m->cs = ms->cs;
+  m->ss = ms->ss;
+  m->es = ms->es;
+  m->ds = ms->ds;
+  m->fs = ms->fs;
+  m->gs = ms->gs;
+  memcpy(m->weg, ms->weg, sizeof(m->weg));
+  memcpy(m->xmm, ms->xmm, sizeof(m->xmm));
+  memcpy(m->ymmh, ms->ymmh, sizeof(m->ymmh));
+  memcpy(&m->fpu, &ms->fpu, sizeof(m->fpu));
+  memcpy(&m->mxcsr, &ms->mxcsr, sizeof(m->mxcsr));
+  m->xcr0 = ms->xcr0;
+}
+
+// forgets the instructions that can be reversed, e.g. because things
+// happened that we don't know how to undo, like making a system call
+static void ClearUndos(void) {
+  undos.count = 0;
+  undos.discard = true;
+}
+
+static bool IsIrreversible(void) {
+  if (!IsJitDisabled(&m->system->jit)) return true;
+  switch (Mopcode(m->xedd->op.rde)) {
+    case 0x0CC:  // int3
+    case 0x0CD:  // int
+    case 0x0CE:  // into
+    case 0x0F4:  // hlt
+    case 0x105:  // syscall
+    case 0x134:  // sysenter
+      return true;
+    default:
+      return false;
+  }
+}
+
+// saves memory an instruction is about to overwrite
+static void OnSetWriteAddr(struct Machine *mm, i64 addr, u32 size) {
+  struct Undo *u;
+  static u8 old[UNDOMAX];
+  if (!undos.recording || mm != m) return;
+  u = undos.p + undos.index % UNDOS;
+  if (size > UNDOMAX || u->mem.i + size > UNDOMAX * 4) {
+    undos.discard = true;
+    return;
+  }
+  if (CopyFromUser(m, old, addr, size) == -1) return;
+  AppendData(&u->mem, (char *)old, size);
+  AppendData(&u->mem, (char *)&addr, sizeof(addr));
+  AppendData(&u->mem, (char *)&size, sizeof(size));
+}
+
+static void BeginUndo(void) {
+  struct Undo *u;
+  if (undos.recording || IsIrreversible()) {
+    undos.recording = false;  // last instruction faulted, or can't undo
+    ClearUndos();
+    return;
+  }
+  u = undos.p + undos.index % UNDOS;
+  u->cycle = cycle;
+  u->flags = m->flags;
+  u->mem.i = 0;
+  CopyMachineState(&u->ms);
+  undos.discard = false;
+  undos.recording = true;
+}
+
+static void EndUndo(void) {
+  if (!undos.recording) return;
+  undos.recording = false;
+  if (undos.discard) {
+    ClearUndos();
+    return;
+  }
+  ++undos.index;
+  undos.count = MIN(undos.count + 1, UNDOS);
+}
+
+// reverts the last instruction executed by the tui
+static bool UndoInstruction(void) {
+  i64 addr;
+  u32 size;
+  struct Undo *u;
+  if (!undos.count) return false;
+  --undos.count;
+  u = undos.p + --undos.index % UNDOS;
+  while (u->mem.i) {
+    u->mem.i -= sizeof(size);
+    memcpy(&size, u->mem.p + u->mem.i, sizeof(size));
+    u->mem.i -= sizeof(addr);
+    memcpy(&addr, u->mem.p + u->mem.i, sizeof(addr));
+    u->mem.i -= size;
+    CopyToUser(m, addr, u->mem.p + u->mem.i, size);
+  }
+  RestoreMachineState(&u->ms);
+  m->flags = u->flags;
+  m->oplen = 0;
+  cycle = u->cycle;
+  ResetInstructionCache(m);
+  return true;
 }
 
 /**
@@ -656,16 +783,19 @@ static bool IsShadow(i64 v) {
 }
 
 /**
- * Returns glyph representing byte at virtual address 𝑣.
+ * Copies 𝑛 bytes at virtual address 𝑣 to 𝑝, without crossing a page.
+ *
+ * @return 0 on success, or glyph to draw instead if unmapped or past eof
  */
-static int VirtualBing(i64 v) {
-  u8 *p;
+static int VirtualBytes(i64 v, u8 *p, int n) {
+  u8 *q;
   int rc;
   jmp_buf busted;
   onbusted = &busted;
-  if ((p = (u8 *)LookupAddress(m, v))) {
+  if ((q = (u8 *)LookupAddress(m, v))) {
     if (!setjmp(busted)) {
-      rc = kCp437[p[0] & 255];
+      memcpy(p, q, n);
+      rc = 0;
     } else {
       rc = L'≀';
     }
@@ -676,6 +806,31 @@ static int VirtualBing(i64 v) {
   return rc;
 }
 
+/**
+ * Appends cp437 glyphs for bytes [𝑝,𝑝+𝑛) where 𝑛 ≤ DUMPWIDTH.
+ */
+static void AppendGlyphs(struct Buffer *b, const u8 *p, int n) {
+  u64 w;
+  int i, k;
+  char s[DUMPWIDTH * 3 + 1], *q;
+  static char utf8[256][4];  // encoded glyph with its length at the end
+  if (!n) return;
+  if (!utf8[0][3]) {
+    for (i = 0; i < 256; ++i) {
+      w = tpenc(kCp437[i]);
+      k = 0;
+      do utf8[i][k++] = w;
+      while ((w >>= 8));
+      utf8[i][3] = k;
+    }
+  }
+  for (q = s, i = 0; i < n; ++i) {
+    memcpy(q, utf8[p[i]], 4);
+    q += utf8[p[i]][3];
+  }
+  AppendData(b, s, q - s);
+}
+
 /**
  * Returns ASAN shadow uint8 concomitant to address 𝑣 or -1.
  */
@@ -709,6 +864,7 @@ static void ScrollOp(struct Panel *p, i64 op) {
 }
 
 static int TtyWriteString(const char *s) {
+  lastframe.full = true;
   return VfsWrite(ttyout, s, strlen(s));
 }
 
@@ -853,6 +1009,25 @@ static void OnSigCont(int sig, siginfo_t *si, void *uc) {
   EnqueueSignal(m, SIGCONT);
 }
 
+// jit paths end before breakpoints, but ones generated before a break
+// was set may run through it, so pages where they could be are reset
+static void ResetBreakpointPage(i64 addr) {
+#ifdef HAVE_JIT
+  if (m && !IsJitDisabled(&m->system->jit)) {
+    ResetJitPage(&m->system->jit, addr);
+  }
+#endif
+}
+
+static void ReindexBreakpoints(void) {
+  long i;
+  IndexBreakpoints(&breakpoints);
+  for (i = 0; i < breakpoints.i; ++i) {
+    if (breakpoints.p[i].disable) continue;
+    ResetBreakpointPage(breakpoints.p[i].addr);
+  }
+}
+
 static void ResolveBreakpoints(void) {
   long i, sym;
   for (i = 0; i < breakpoints.i; ++i) {
@@ -862,6 +1037,7 @@ static void ResolveBreakpoints(void) {
       }
     }
   }
+  ReindexBreakpoints();
 }
 
 static void ResolveWatchpoints(void) {
@@ -881,6 +1057,7 @@ static void BreakAtNextInstruction(void) {
   b.addr = GetPc(m) + m->xedd->length;
   b.oneshot = true;
   PushBreakpoint(&breakpoints, &b);
+  ResetBreakpointPage(b.addr);
 }
 
 static int DrainInput(int fd) {
@@ -1663,11 +1840,17 @@ static void DrawMemoryZoomed(struct Panel *p, struct MemoryView *view,
     AppendFmt(&p->lines[i], "%0*" PRIx64 " ", GetAddrHexWidth(),
               ((view->start + i) * DUMPWIDTH * ((u64)1 << view->zoom)) &
                   0x0000ffffffffffff);
-    for (j = 0; j < DUMPWIDTH; ++j, ++c) {
+    for (n = j = 0; j < DUMPWIDTH; ++j, ++c) {
       a = ((view->start + i) * DUMPWIDTH + j + 0) * ((u64)1 << view->zoom);
       b = ((view->start + i) * DUMPWIDTH + j + 1) * ((u64)1 << view->zoom);
       changed = ((histart >= a && hiend < b) ||
                  (histart && hiend && histart >= a && hiend < b));
+      if (changed == high && !invalid[c]) {
+        ++n;  // batch up glyphs that don't need escape codes
+        continue;
+      }
+      AppendGlyphs(&p->lines[i], canvas + c - n, n);
+      n = 0;
       if (changed && !high) {
         high = true;
         AppendStr(&p->lines[i], "\033[7m");
@@ -1678,9 +1861,10 @@ static void DrawMemoryZoomed(struct Panel *p, struct MemoryView *view,
       if (invalid[c]) {
         AppendWide(&p->lines[i], L'⋅');
       } else {
-        AppendWide(&p->lines[i], kCp437[canvas[c]]);
+        AppendGlyphs(&p->lines[i], canvas + c, 1);
       }
     }
+    AppendGlyphs(&p->lines[i], canvas + c - n, n);
     if (high) {
       AppendStr(&p->lines[i], "\033[27m");
       high = false;
@@ -1690,19 +1874,37 @@ static void DrawMemoryZoomed(struct Panel *p, struct MemoryView *view,
   free(canvas);
 }
 
+static void AppendRow(struct Buffer *b, const u8 *p, int n, int bad) {
+  if (!bad) {
+    AppendGlyphs(b, p, n);
+  } else {
+    while (n--) AppendWide(b, bad);
+  }
+}
+
 static void DrawMemoryUnzoomed(struct Panel *p, struct MemoryView *view,
                                i64 histart, i64 hiend) {
-  int c, s, x, sc;
-  i64 i, j, k;
+  u8 row[DUMPWIDTH];
+  int n, s, x, sc, bad;
+  i64 i, j, k, r;
   bool high, changed;
   high = false;
-  for (i = 0; i < p->bottom - p->top; ++i) {
+  for (s = -1, i = 0; i < p->bottom - p->top; ++i) {
+    r = (view->start + i) * DUMPWIDTH;
     AppendFmt(&p->lines[i], "%0*" PRIx64 " ", GetAddrHexWidth(),
-              ((view->start + i) * DUMPWIDTH) & 0xffffffffffff);
-    for (j = 0; j < DUMPWIDTH; ++j) {
-      k = (view->start + i) * DUMPWIDTH + j;
-      c = VirtualBing(k);
-      s = VirtualShadow(k);
+              r & 0xffffffffffff);
+    // rows are aligned so they're always on a single page
+    bad = VirtualBytes(r, row, DUMPWIDTH);
+    for (n = j = 0; j < DUMPWIDTH; ++j) {
+      k = r + j;
+      if (!(k & 7)) s = VirtualShadow(k);
+      changed = histart <= k && k < hiend;
+      if (s == -1 && changed == high) {
+        ++n;  // batch up glyphs that don't need escape codes
+        continue;
+      }
+      AppendRow(&p->lines[i], row + j - n, n, bad);
+      n = 0;
       if (s != -1) {
         if (s == -2) {
           /* grey for shadow memory */
@@ -1739,11 +1941,12 @@ static void DrawMemoryUnzoomed(struct Panel *p, struct MemoryView *view,
         AppendStr(&p->lines[i], "\033[27m");
         high = false;
       }
-      AppendWide(&p->lines[i], c);
+      AppendRow(&p->lines[i], row + j, 1, bad);
       if (s != -1) {
         AppendStr(&p->lines[i], "\033[39;49m");
       }
     }
+    AppendRow(&p->lines[i], row + j - n, n, bad);
     if (high) {
       AppendStr(&p->lines[i], "\033[27m");
       high = false;
@@ -2033,6 +2236,14 @@ bool PreventBufferbloat(void) {
   return should_write;
 }
 
+// returns true if enough time elapsed since the last redraw that the
+// continue loop should draw a frame, so that it can otherwise execute
+// the program at full speed, rather than rendering every instruction.
+static bool IsFrameDue(void) {
+  return CompareTime(SubtractTime(GetTime(), last_draw),
+                     FromMicroseconds(1. / FPS * 1e6)) >= 0;
+}
+
 static void ClearHistory(void) {
   unsigned i;
   for (i = 0; i < HISTORY; ++i) {
@@ -2114,6 +2325,7 @@ static void ShowHistory(void) {
   unassert(ansi = (char *)malloc(size));
   Inflate(ansi, r->origsize, r->data, r->compsize);
   memcpy(ansi + r->origsize, status, len);
+  lastframe.full = true;
   if (PreventBufferbloat()) {
     HandleEpipe(UninterruptibleWrite(ttyout, ansi, size));
   }
@@ -2122,6 +2334,7 @@ static void ShowHistory(void) {
 
 void Redraw(bool force) {
   int i, j;
+  bool write;
   char *ansi;
   size_t size;
   double execsecs;
@@ -2174,14 +2387,22 @@ void Redraw(bool force) {
   DrawMemory(&pan.writedata, &writeview, writeaddr, writeaddr + writesize);
   DrawMemory(&pan.stack, &stackview, GetSp(), GetSp() + GetPointerWidth());
   DrawStatus(&pan.status);
-  unassert(ansi = RenderPanels(ARRAYLEN(pan.p), pan.p, tyn, txn, &size));
+  if ((write = force || PreventBufferbloat())) {
+    unassert(ansi = RenderPanelsDiff(ARRAYLEN(pan.p), pan.p, tyn, txn,
+                                     &lastframe, &size));
+  } else {
+    unassert(ansi = RenderPanels(ARRAYLEN(pan.p), pan.p, tyn, txn, &size));
+  }
   END_NO_PAGE_FAULTS;
   end_draw = GetTime();
   (void)end_draw;
   STATISTIC(AVERAGE(redraw_latency_us,
                     ToMicroseconds(SubtractTime(end_draw, start_draw))));
-  if (force || PreventBufferbloat()) {
+  if (write) {
+    STATISTIC(AVERAGE(redraw_written_bytes, size));
     HandleEpipe(UninterruptibleWrite(ttyout, ansi, size));
+    free(ansi);
+    unassert(ansi = RenderPanelFrame(&lastframe, &size));
   }
   AddHistory(ansi, size);
   free(ansi);
@@ -2245,6 +2466,7 @@ static void HandleAlarm(void) {
 static void HandleTerminalResize(void) {
   GetTtySize(ttyout);
   ClearHistory();
+  FreePanelFrame(&lastframe);
   dis->ops.i = 0;
 }
 
@@ -2477,6 +2699,7 @@ void DrawDisplayOnly(void) {
     AppendStr(&b, "\033[0m");
     if (displayexec) AppendStr(&b, "\033[K");
   }
+  lastframe.full = true;
   UninterruptibleWrite(ttyout, b.p, b.i);
   free(b.p);
 }
@@ -2738,7 +2961,9 @@ static void OnBinbase(struct Machine *m) {
        GetPc(m));
   for (i = 0; i < dis->syms.i; ++i) dis->syms.p[i].addr += skew;
   for (i = 0; i < dis->loads.i; ++i) dis->loads.p[i].addr += skew;
+  DisFlushCache(dis);
   for (i = 0; i < breakpoints.i; ++i) breakpoints.p[i].addr += skew;
+  ReindexBreakpoints();
   Disassemble();
 }
 
@@ -2861,6 +3086,28 @@ static void OnContinueTui(void) {
   action &= ~MODAL;
 }
 
+static void OnReverseStep(void) {
+  if (action & MODAL) return;
+  action &= ~(STEP | NEXT | FINISH | CONTINUE);
+  if (UndoInstruction()) {
+    ScrollOp(&pan.disassembly, GetDisIndex());
+  } else {
+    SetStatus("can't step back any further");
+  }
+}
+
+static void OnReverseContinue(void) {
+  if (action & MODAL) return;
+  action &= ~(STEP | NEXT | FINISH | CONTINUE);
+  if (UndoInstruction()) {
+    while (IsAtBreakpoint(&breakpoints, m->ip) == -1 && UndoInstruction()) {
+    }
+    ScrollOp(&pan.disassembly, GetDisIndex());
+  } else {
+    SetStatus("can't step back any further");
+  }
+}
+
 static void OnContinueExec(void) {
   tuimode = false;
   action |= CONTINUE;
@@ -3021,9 +3268,11 @@ static void HandleKeyboard(const char *k) {
     CASE('v', OnV());
     CASE('?', OnHelp());
     CASE('s', OnStep());
+    CASE('S', OnReverseStep());
     CASE('n', OnNext());
     CASE('f', OnFinish());
     CASE('c', OnContinueTui());
+    CASE('b', OnReverseContinue());
     CASE('C', displayexec = false; OnContinueExec());
     CASE('D', displayexec = true;  OnContinueExec());
     CASE('R', OnRestart());
@@ -3189,6 +3438,7 @@ static void Execute(void) {
     ProfileOp(m, GetPc(m) - m->oplen);
   }
   if (atomic_load_explicit(&m->attention, memory_order_acquire)) {
+    ClearUndos();
     CheckForSignals(m);
   }
 }
@@ -3198,6 +3448,7 @@ static void Exec(void) {
   int interrupt;
   LOGF("Exec");
   ExecSetup();
+  ClearUndos();
   m->nofault = false;
   if (!(interrupt = sigsetjmp(m->onhalt, 1))) {
     m->canhalt = true;
@@ -3307,7 +3558,7 @@ static void Tui(void) {
           ReactiveDraw();
         }
       } else {
-        m->xedd = (struct XedDecodedInst *)m->opcache->icache[0];
+        m->xedd = (struct XedDecodedInst *)m->opcache->icache[0][0];
         m->xedd->length = 1;
         m->xedd->bytes[0] = 0xCC;
         m->xedd->op.rde &= ~00000077760000000000000;
@@ -3320,6 +3571,8 @@ static void Tui(void) {
       interactive = ++tick >= speed;
       if (interactive && speed < 0) {
         Sleep(-speed);
+      } else if (interactive && (action & CONTINUE) && !IsFrameDue()) {
+        interactive = false;
       }
       if (action & ALARM) {
         HandleAlarm();
@@ -3332,9 +3585,11 @@ static void Tui(void) {
         Redraw(false);
       }
       if (dialog) {
+        lastframe.full = true;
         PrintMessageBox(ttyout, dialog, tyn, txn);
       }
       if (action & MODAL) {
+        lastframe.full = true;
         PrintMessageBox(ttyout, systemfailure, tyn, txn);
         ReadKeyboard();
       } else if (dialog || !IsExecuting() ||
@@ -3393,7 +3648,9 @@ static void Tui(void) {
           UpdateXmmType(m->xedd->op.rde, &xmmtype);
           if (verbose) LogInstruction();
           CopyMachineState(&laststate);
+          BeginUndo();
           Execute();
+          EndUndo();
           ScrollOp(&pan.disassembly, GetDisIndex());
           if (!IsShadow(m->readaddr) && !IsShadow(m->readaddr + m->readsize)) {
             readaddr = m->readaddr;
@@ -3553,6 +3810,12 @@ static void AddPath_StartOp_Tui(P) {
   Jitter(m, rde, 0, 0, "qc", StartOp_Tui);
 }
 
+static bool IsAtBreakpoint_Tui(i64 addr) {
+  // watchpoints are checked after every instruction, so with any of
+  // them set, no new jit paths get made
+  return HasBreakpoint(&breakpoints, addr) || watchpoints.i;
+}
+
 static bool FileExists(const char *path) {
   return !VfsAccess(AT_FDCWD, path, F_OK, 0);
 }
@@ -3619,6 +3882,7 @@ int VirtualMachine(int argc, char *argv[]) {
         }
       }
     }
+    ClearUndos();
     do {
       if (!tuimode) {
         Exec();
@@ -3707,7 +3971,9 @@ int main(int argc, char *argv[]) {
 #endif
 #ifdef HAVE_JIT
   AddPath_StartOp_Hook = AddPath_StartOp_Tui;
+  IsAtBreakpoint_Hook = IsAtBreakpoint_Tui;
 #endif
+  SetWriteAddr_Hook = OnSetWriteAddr;
   unassert((pty = NewPty()));
   unassert((s = NewSystem(wantmetal ? XED_MACHINE_MODE_REAL
                                     : XED_MACHINE_MODE_LONG)));
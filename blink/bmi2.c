@@ -16,6 +16,7 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/alu.h"
 #include "blink/bus.h"
 #include "blink/endian.h"
 #include "blink/flags.h"
@@ -58,6 +59,39 @@ static u64 Pext(u64 x, u64 mask) {
   return r;
 }
 
+// calls fun(rm, vreg) into reg, or fun(vreg, rm) if flip is set
+static void JitVex(P, void *fun, bool flip) {
+  if (Rexw(rde)) {
+    Jitter(A,
+           "z3B"    // res0 = GetRegOrMem[force64bit](RexbRm)
+           "r0s1="  // sav1 = res0
+           "z3V");  // res0 = GetReg[force64bit](Vreg)
+  } else {
+    Jitter(A,
+           "z2B"    // res0 = GetRegOrMem[force32bit](RexbRm)
+           "r0s1="  // sav1 = res0
+           "z2V");  // res0 = GetReg[force32bit](Vreg)
+  }
+  if (!flip) {
+    Jitter(A,
+           "r0a1="  // arg1 = res0
+           "s1a0="  // arg0 = sav1
+           "m",     // call micro-op
+           fun);
+  } else {
+    Jitter(A,
+           "s1a1="  // arg1 = sav1
+           "t"      // arg0 = res0
+           "m",     // call micro-op
+           fun);
+  }
+  if (Rexw(rde)) {
+    Jitter(A, "r0z3C");  // PutReg[force64bit](RexrReg, res0)
+  } else {
+    Jitter(A, "r0z2C");  // PutReg[force32bit](RexrReg, res0)
+  }
+}
+
 static void OpPbit(P, u64 op(u64, u64)) {
   if (Rexw(rde)) {
     Put64(RegRexrReg(m, rde), op(Get64(RegVreg(m, rde)),
@@ -102,8 +136,14 @@ static void OpBzhi(P) {
 void Op2f5(P) {
   if (Rep(rde) == 2) {
     OpPbit(A, Pdep);
+    if (IsMakingPath(m) && kFastPbit[0][Rexw(rde)]) {
+      JitVex(A, kFastPbit[0][Rexw(rde)], true);
+    }
   } else if (Rep(rde) == 3) {
     OpPbit(A, Pext);
+    if (IsMakingPath(m) && kFastPbit[1][Rexw(rde)]) {
+      JitVex(A, kFastPbit[1][Rexw(rde)], true);
+    }
   } else if (!Osz(rde)) {
     OpBzhi(A);
 #ifndef TINY
@@ -133,6 +173,25 @@ void OpRorx(P) {
     z = x;
   }
   Put64(RegRexrReg(m, rde), z);
+  if (IsMakingPath(m)) {
+    if (Rexw(rde)) {
+      Jitter(A,
+             "z3B"     // res0 = GetRegOrMem[force64bit](RexbRm)
+             "a1i"     // arg1 = uimm0
+             "t"       // arg0 = res0
+             "m"       // call micro-op
+             "r0z3C",  // PutReg[force64bit](RexrReg, res0)
+             uimm0 & 63, kFastShx[3][1]);
+    } else {
+      Jitter(A,
+             "z2B"     // res0 = GetRegOrMem[force32bit](RexbRm)
+             "a1i"     // arg1 = uimm0
+             "t"       // arg0 = res0
+             "m"       // call micro-op
+             "r0z2C",  // PutReg[force32bit](RexrReg, res0)
+             uimm0 & 31, kFastShx[3][0]);
+    }
+  }
 }
 
 static void OpShlx(P) {
@@ -195,10 +254,13 @@ void OpShx(P) {
 #endif
   if (Osz(rde)) {
     OpShlx(A);
+    if (IsMakingPath(m)) JitVex(A, kFastShx[0][Rexw(rde)], false);
   } else if (Rep(rde) == 2) {
     OpShrx(A);
+    if (IsMakingPath(m)) JitVex(A, kFastShx[1][Rexw(rde)], false);
   } else if (Rep(rde) == 3) {
     OpSarx(A);
+    if (IsMakingPath(m)) JitVex(A, kFastShx[2][Rexw(rde)], false);
 #ifndef TINY
   } else {
     OpUdImpl(m);
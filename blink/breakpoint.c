@@ -23,6 +23,30 @@
 
 #include "blink/builtin.h"
 
+static unsigned HashBreakpoint(i64 addr) {
+  return ((u64)addr * 0x9e3779b97f4a7c15) >> 54;
+}
+
+static void FilterBreakpoint(struct Breakpoints *bps, i64 addr) {
+  unsigned h = HashBreakpoint(addr);
+  bps->filter[h / 64] |= (u64)1 << (h % 64);
+}
+
+static bool IsBreakpointFiltered(struct Breakpoints *bps, i64 addr) {
+  unsigned h = HashBreakpoint(addr);
+  return !(bps->filter[h / 64] & ((u64)1 << (h % 64)));
+}
+
+// rebuilds the filter, after the addresses of breakpoints were changed
+void IndexBreakpoints(struct Breakpoints *bps) {
+  int i;
+  memset(bps->filter, 0, sizeof(bps->filter));
+  for (i = 0; i < bps->i; ++i) {
+    if (bps->p[i].disable) continue;
+    FilterBreakpoint(bps, bps->p[i].addr);
+  }
+}
+
 void PopBreakpoint(struct Breakpoints *bps) {
   if (bps->i) {
     --bps->i;
@@ -31,6 +55,7 @@ void PopBreakpoint(struct Breakpoints *bps) {
 
 ssize_t PushBreakpoint(struct Breakpoints *bps, struct Breakpoint *b) {
   int i;
+  FilterBreakpoint(bps, b->addr);
   for (i = 0; i < bps->i; ++i) {
     if (bps->p[i].disable) {
       memcpy(&bps->p[i], b, sizeof(*b));
@@ -45,8 +70,21 @@ ssize_t PushBreakpoint(struct Breakpoints *bps, struct Breakpoint *b) {
   return bps->i - 1;
 }
 
+// returns true if enabled breakpoint exists at addr, without firing it
+bool HasBreakpoint(struct Breakpoints *bps, i64 addr) {
+  int i;
+  if (IsBreakpointFiltered(bps, addr)) return false;
+  for (i = bps->i; i--;) {
+    if (!bps->p[i].disable && bps->p[i].addr == addr) {
+      return true;
+    }
+  }
+  return false;
+}
+
 ssize_t IsAtBreakpoint(struct Breakpoints *bps, i64 addr) {
   int i;
+  if (IsBreakpointFiltered(bps, addr)) return -1;
   for (i = bps->i; i--;) {
     if (bps->p[i].disable) continue;
     if (bps->p[i].addr == addr) {
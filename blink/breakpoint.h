@@ -16,9 +16,12 @@ struct Breakpoint {
 struct Breakpoints {
   int i, n;
   struct Breakpoint *p;
+  u64 filter[16];  // bloom filter of addrs, for quickly ruling them out
 };
 
 ssize_t IsAtBreakpoint(struct Breakpoints *, i64);
+bool HasBreakpoint(struct Breakpoints *, i64);
+void IndexBreakpoints(struct Breakpoints *);
 ssize_t PushBreakpoint(struct Breakpoints *, struct Breakpoint *);
 void PopBreakpoint(struct Breakpoints *);
 
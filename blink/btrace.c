@@ -0,0 +1,334 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/btrace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/flag.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/timespec.h"
+#include "blink/tunables.h"
+#include "blink/util.h"
+
+/**
+ * @fileoverview Binary system call tracing.
+ *
+ * When BLINK_BTRACE names a file, each system call the guest makes is
+ * described by a fixed size record, holding its number, arguments, and
+ * return value, along with when it was entered and how long it took.
+ * Rather than formatting text on the guest thread, like the -s flag,
+ * records are put in a ring that belongs to the thread that made the
+ * call, which a host thread drains to the file every kBtraceMs. Rings
+ * have a single producer and consumer, so no locks are taken by guest
+ * threads, except the first time they make a system call. A ring that
+ * becomes half full wakes the writer early, and if it fills up anyway
+ * then records are dropped, and the count of them is written instead.
+ *
+ * Names of system calls are written to the file the first time they
+ * are used, so that tool/btrace can decode it offline. Children that
+ * the guest fork()'s append their records to the same file, since the
+ * records say which thread they came from, but they start off with
+ * empty rings so nothing the parent is yet to write gets duplicated.
+ */
+
+struct BtraceRing {
+  _Atomic(u32) head;       // next record the guest thread will write
+  _Atomic(u32) tail;       // next record the writer thread will drain
+  _Atomic(u32) lost;       // records dropped since the last drain
+  _Atomic(i32) tid;        // thread that owns the ring
+  _Atomic(bool) dead;      // thread is gone, so free once drained
+  struct BtraceRing *next; // guarded by g_btrace.lock
+  struct BtraceRecord recs[kBtraceRecords];
+};
+
+static struct Btrace {
+  bool started;                 // writer thread has been created
+  int fd;                       // trace file, at or above kMinBlinkFd
+  int count;                    // records in buffer that aren't written
+  struct BtraceRing *rings;     // rings of every thread that's traced
+  struct BtraceRecord buf[64];  // records that are about to be written
+  bool named[4096];             // names that have been written to file
+  _Atomic(const char *) names[4096];  // names published by guest
+  pthread_cond_t_ filling;            // some ring is half full
+  pthread_mutex_t_ lock;              // guards everything but names
+} g_btrace = {
+    .fd = -1,
+    .filling = PTHREAD_COND_INITIALIZER_,
+    .lock = PTHREAD_MUTEX_INITIALIZER_,
+};
+
+u64 BtraceNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#if BTRACE
+
+// @assume g_btrace.lock
+static void WriteBtraceBuffer(void) {
+  size_t n;
+  if (!g_btrace.count) return;
+  n = g_btrace.count * sizeof(g_btrace.buf[0]);
+  if (write(g_btrace.fd, g_btrace.buf, n) != n) {
+    LOG_ONCE(LOGF("failed to write %s: %s", FLAG_btrace,
+                  DescribeHostErrno(errno)));
+  }
+  g_btrace.count = 0;
+}
+
+// @assume g_btrace.lock
+static struct BtraceRecord *AppendBtrace(void) {
+  if (g_btrace.count == ARRAYLEN(g_btrace.buf)) {
+    WriteBtraceBuffer();
+  }
+  return memset(g_btrace.buf + g_btrace.count++, 0, sizeof(g_btrace.buf[0]));
+}
+
+// @assume g_btrace.lock
+static void AppendBtraceName(int sysno) {
+  const char *name;
+  struct BtraceRecord *rec;
+  g_btrace.named[sysno] = true;
+  name = atomic_load_explicit(g_btrace.names + sysno, memory_order_relaxed);
+  if (!name) return;
+  rec = AppendBtrace();
+  rec->kind = kBtraceName;
+  rec->sysno = sysno;
+  strncpy((char *)rec->args, name, sizeof(rec->args) - 1);
+}
+
+// returns the most records any one ring had in it
+// @assume g_btrace.lock
+static u32 DrainBtrace(void) {
+  bool dead;
+  u32 head, tail, lost, most = 0;
+  struct BtraceRecord *rec;
+  struct BtraceRing *r, **rp;
+  for (rp = &g_btrace.rings; (r = *rp);) {
+    // reading dead before head ensures a dead ring's last records are
+    // drained, since the thread had published them before it had died
+    dead = atomic_load_explicit(&r->dead, memory_order_acquire);
+    head = atomic_load_explicit(&r->head, memory_order_acquire);
+    tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    most = MAX(most, head - tail);
+    for (; tail != head; ++tail) {
+      rec = r->recs + (tail & (kBtraceRecords - 1));
+      if (!g_btrace.named[rec->sysno]) {
+        AppendBtraceName(rec->sysno);
+      }
+      memcpy(AppendBtrace(), rec, sizeof(*rec));
+    }
+    atomic_store_explicit(&r->tail, tail, memory_order_release);
+    if ((lost = atomic_exchange_explicit(&r->lost, 0, memory_order_relaxed))) {
+      rec = AppendBtrace();
+      rec->kind = kBtraceLost;
+      rec->tid = atomic_load_explicit(&r->tid, memory_order_relaxed);
+      rec->rc = lost;
+    }
+    if (dead) {
+      *rp = r->next;
+      free(r);
+    } else {
+      rp = &r->next;
+    }
+  }
+  WriteBtraceBuffer();
+  return most;
+}
+
+static void *BtraceWorker(void *arg) {
+  struct timespec deadline;
+  LOCK(&g_btrace.lock);
+  for (;;) {
+    // wakeups could be missed while we're draining, so go again right
+    // away if a ring was busy enough that it might have wanted one
+    if (DrainBtrace() < kBtraceRecords / 4) {
+      deadline = AddTime(GetTime(), FromMilliseconds(kBtraceMs));
+      pthread_cond_timedwait(&g_btrace.filling, &g_btrace.lock, &deadline);
+    }
+  }
+  UNLOCK(&g_btrace.lock);
+  return 0;
+}
+
+static void SpawnBtraceWorker(void) {
+  int err;
+  pthread_t th;
+  sigset_t ss, oldss;
+  sigfillset(&ss);
+  unassert(!pthread_sigmask(SIG_SETMASK, &ss, &oldss));
+  err = pthread_create(&th, 0, BtraceWorker, 0);
+  unassert(!pthread_sigmask(SIG_SETMASK, &oldss, 0));
+  if (err) {
+    LOGF("failed to create btrace worker: %s", DescribeHostErrno(err));
+    return;
+  }
+  unassert(!pthread_detach(th));
+}
+
+// @assume g_btrace.lock
+static void OpenBtrace(void) {
+  int fd;
+  struct timespec ts;
+  struct BtraceHeader hdr;
+  if ((fd = open(FLAG_btrace,
+                 O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644)) ==
+      -1) {
+    LOGF("failed to open %s: %s", FLAG_btrace, DescribeHostErrno(errno));
+    return;
+  }
+  unassert((g_btrace.fd = fcntl(fd, F_DUPFD_CLOEXEC, kMinBlinkFd)) != -1);
+  unassert(!close(fd));
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = kBtraceMagic;
+  hdr.recsize = sizeof(struct BtraceRecord);
+  hdr.pid = getpid();
+  clock_gettime(CLOCK_REALTIME, &ts);
+  hdr.realtime = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  hdr.monotonic = BtraceNow();
+  if (write(g_btrace.fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+    LOGF("failed to write %s: %s", FLAG_btrace, DescribeHostErrno(errno));
+  }
+}
+
+static struct BtraceRing *NewBtraceRing(void) {
+  struct BtraceRing *r;
+  if (!(r = (struct BtraceRing *)calloc(1, sizeof(*r)))) return 0;
+  LOCK(&g_btrace.lock);
+  r->next = g_btrace.rings;
+  g_btrace.rings = r;
+  UNLOCK(&g_btrace.lock);
+  return r;
+}
+
+#endif /* BTRACE */
+
+// opens trace file, if a previous program the guest execve()'d hasn't
+void StartBtrace(void) {
+#if BTRACE
+  LOCK(&g_btrace.lock);
+  if (!g_btrace.started) {
+    g_btrace.started = true;
+    OpenBtrace();
+    if (g_btrace.fd != -1) {
+      SpawnBtraceWorker();
+    }
+  }
+  UNLOCK(&g_btrace.lock);
+#else
+  LOG_ONCE(LOGF("BLINK_BTRACE requires a build with threads and strace"));
+#endif
+}
+
+// puts a system call that just returned in the calling thread's ring
+void RecordBtrace(struct Machine *m, const char *name, int arity, int sysno,
+                  u64 start, i64 rc, const u64 args[6]) {
+#if BTRACE
+  u32 head;
+  u64 now;
+  struct BtraceRing *r;
+  struct BtraceRecord *rec;
+  now = BtraceNow();
+  if (g_btrace.fd == -1) return;
+  if (!(r = m->btrace) && !(r = m->btrace = NewBtraceRing())) return;
+  if (name &&
+      !atomic_load_explicit(g_btrace.names + sysno, memory_order_relaxed)) {
+    atomic_store_explicit(g_btrace.names + sysno, name, memory_order_relaxed);
+  }
+  atomic_store_explicit(&r->tid, m->tid, memory_order_relaxed);
+  head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&r->tail, memory_order_acquire) ==
+      kBtraceRecords) {
+    atomic_fetch_add_explicit(&r->lost, 1, memory_order_relaxed);
+    return;
+  }
+  if (head - atomic_load_explicit(&r->tail, memory_order_relaxed) ==
+      kBtraceRecords / 2) {
+    pthread_cond_signal(&g_btrace.filling);
+  }
+  rec = r->recs + (head & (kBtraceRecords - 1));
+  rec->kind = kBtraceSyscall;
+  rec->arity = arity;
+  rec->sysno = sysno;
+  rec->tid = m->tid;
+  rec->start = start;
+  rec->duration = now - start;
+  rec->rc = rc;
+  memcpy(rec->args, args, sizeof(rec->args));
+  // names are published before the record is, by this release
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+#endif
+}
+
+// tells writer that ring of thread won't get any more records
+void ForgetBtrace(struct Machine *m) {
+  if (!m->btrace) return;
+  atomic_store_explicit(&m->btrace->dead, true, memory_order_release);
+  m->btrace = 0;
+}
+
+// writes records that are still in rings, e.g. because we're exiting
+void FlushBtrace(void) {
+#if BTRACE
+  if (g_btrace.fd == -1) return;
+  LOCK(&g_btrace.lock);
+  DrainBtrace();
+  UNLOCK(&g_btrace.lock);
+#endif
+}
+
+// locks the btrace writer before fork()
+void LockBtrace(void) {
+  LOCK(&g_btrace.lock);
+}
+
+// unlocks the btrace writer in the parent after fork()
+void UnlockBtrace(void) {
+  UNLOCK(&g_btrace.lock);
+}
+
+// resets the btrace writer in the child after fork()
+// records already in rings are the parent's to write
+void ResetBtrace(void) {
+#if BTRACE
+  struct BtraceRing *r;
+  for (r = g_btrace.rings; r; r = r->next) {
+    atomic_store_explicit(&r->tail,
+                          atomic_load_explicit(&r->head, memory_order_relaxed),
+                          memory_order_relaxed);
+    atomic_store_explicit(&r->lost, 0, memory_order_relaxed);
+  }
+  unassert(!pthread_mutex_init(&g_btrace.lock, 0));
+  unassert(!pthread_cond_init(&g_btrace.filling, 0));
+  if (g_btrace.fd != -1) {
+    SpawnBtraceWorker();
+  }
+#endif
+}
@@ -0,0 +1,53 @@
+#ifndef BLINK_BTRACE_H_
+#define BLINK_BTRACE_H_
+#include "blink/thread.h"
+#include "blink/types.h"
+
+#if defined(HAVE_THREADS) && !defined(DISABLE_STRACE) && !defined(TINY)
+#define BTRACE 1
+#else
+#define BTRACE 0
+#endif
+
+// BLINK_BTRACE files are an 80-byte header followed by 80-byte records
+// which are written in host byte order, and are decoded by tool/btrace
+#define kBtraceMagic   0x31454341525442ull  // "BTRACE1" when little endian
+#define kBtraceSyscall 0                    // a system call that returned
+#define kBtraceName    1                    // args holds text naming sysno
+#define kBtraceLost    2                    // rc records of tid were dropped
+
+struct BtraceHeader {
+  u64 magic;      // kBtraceMagic
+  u32 recsize;    // sizeof(struct BtraceRecord)
+  i32 pid;        // process blink launched
+  u64 realtime;   // CLOCK_REALTIME nanoseconds when monotonic was taken
+  u64 monotonic;  // CLOCK_MONOTONIC nanoseconds when file was created
+  u64 unused[6];  //
+};
+
+struct BtraceRecord {
+  u8 kind;        // kBtraceSyscall, kBtraceName, or kBtraceLost
+  u8 arity;       // number of args the system call takes
+  u16 sysno;      // linux system call ordinal
+  i32 tid;        // guest thread that made the system call
+  u64 start;      // CLOCK_MONOTONIC nanoseconds when call was entered
+  u64 duration;   // nanoseconds spent inside the system call
+  i64 rc;         // linux return value, which is negative errno on error
+  u64 args[6];    // system call arguments, as passed in registers
+};
+
+struct Machine;
+struct System;
+struct BtraceRing;
+
+u64 BtraceNow(void);
+void StartBtrace(void);
+void RecordBtrace(struct Machine *, const char *, int, int, u64, i64,
+                  const u64[6]);
+void ForgetBtrace(struct Machine *);
+void FlushBtrace(void);
+void LockBtrace(void);
+void UnlockBtrace(void);
+void ResetBtrace(void);
+
+#endif /* BLINK_BTRACE_H_ */
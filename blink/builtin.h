@@ -245,6 +245,13 @@
 #define HAVE_INT128
 #endif
 
+// x87 registers are host long doubles if they're the same 80-bit format
+#if !defined(DISABLE_X87) && !defined(DISABLE_LDBL) && \
+    (defined(__x86_64__) || defined(__i386__)) &&     \
+    defined(__LDBL_MANT_DIG__) && __LDBL_MANT_DIG__ == 64
+#define HAVE_LDBL
+#endif
+
 #if !defined(__SANITIZE_THREAD__) && defined(TSAN)
 #define __SANITIZE_THREAD__
 #endif
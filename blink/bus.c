@@ -18,6 +18,7 @@
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include "blink/bus.h"
 
+#include <errno.h>
 #include <limits.h>
 
 #include "blink/assert.h"
@@ -31,6 +32,7 @@
 #include "blink/rde.h"
 #include "blink/swap.h"
 #include "blink/thread.h"
+#include "blink/timespec.h"
 #include "blink/tsan.h"
 
 #ifdef HAVE_PTHREAD_PROCESS_SHARED
@@ -43,7 +45,6 @@ struct Bus *g_bus;
 
 void InitBus(void) {
   unsigned i;
-  pthread_condattr_t_ cattr;
   pthread_mutexattr_t_ mattr;
 #ifndef HAVE_PTHREAD_PROCESS_SHARED
   if (g_bus) FreeBig(g_bus, sizeof(*g_bus));
@@ -51,21 +52,175 @@ void InitBus(void) {
   unassert(g_bus =
                (struct Bus *)AllocateBig(sizeof(*g_bus), PROT_READ | PROT_WRITE,
                                          BUS_MEMORY | MAP_ANONYMOUS_, -1, 0));
-  unassert(!pthread_condattr_init(&cattr));
   unassert(!pthread_mutexattr_init(&mattr));
 #ifdef HAVE_PTHREAD_PROCESS_SHARED
-  unassert(!pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED));
   unassert(!pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED));
 #endif
   unassert(!pthread_mutex_init(&g_bus->futexes.lock, &mattr));
-  for (i = 0; i < kFutexMax; ++i) {
-    unassert(!pthread_cond_init(&g_bus->futexes.mem[i].cond, &cattr));
-    unassert(!pthread_mutex_init(&g_bus->futexes.mem[i].lock, &mattr));
-    dll_init(&g_bus->futexes.mem[i].elem);
-    dll_make_last(&g_bus->futexes.free, &g_bus->futexes.mem[i].elem);
+  for (i = 0; i < kFutexBuckets; ++i) {
+    unassert(!pthread_mutex_init(&g_bus->futexes.bucket[i].lock, &mattr));
   }
   unassert(!pthread_mutexattr_destroy(&mattr));
+}
+
+// returns new futex entry, lazily growing the pool
+// the futex table is in shared memory, so we can't realloc() it; so
+// we instead reserve kFutexMax entries up front and only touch pages
+// as we need them, which the host kernel won't commit until then.
+static struct Futex *GrowFutexes(void) {
+  struct Futex *f;
+#ifndef HAVE_FUTEX_SEMAPHORES
+  pthread_condattr_t_ cattr;
+  pthread_mutexattr_t_ mattr;
+#endif
+  if (g_bus->futexes.used == kFutexMax) return 0;
+  f = g_bus->futexes.mem + g_bus->futexes.used++;
+#ifdef HAVE_FUTEX_SEMAPHORES
+#ifdef HAVE_PTHREAD_PROCESS_SHARED
+  unassert(!sem_init(&f->sem, 1, 0));
+#else
+  unassert(!sem_init(&f->sem, 0, 0));
+#endif
+#else
+  unassert(!pthread_condattr_init(&cattr));
+  unassert(!pthread_mutexattr_init(&mattr));
+#ifdef HAVE_PTHREAD_PROCESS_SHARED
+  unassert(!pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED));
+  unassert(!pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED));
+#endif
+  unassert(!pthread_cond_init(&f->cond, &cattr));
+  unassert(!pthread_mutex_init(&f->lock, &mattr));
+  unassert(!pthread_mutexattr_destroy(&mattr));
   unassert(!pthread_condattr_destroy(&cattr));
+#endif
+  dll_init(&f->elem);
+  return f;
+}
+
+// allocates futex waiter entry
+// the caller must hold the lock of bucket b
+struct Futex *AllocateFutex(struct FutexBucket *b) {
+  struct Dll *e;
+  struct Futex *f;
+  if ((e = dll_first(b->free))) {
+    dll_remove(&b->free, e);
+    f = FUTEX_CONTAINER(e);
+  } else {
+    LOCK(&g_bus->futexes.lock);
+    if ((e = dll_first(g_bus->futexes.free))) {
+      dll_remove(&g_bus->futexes.free, e);
+      f = FUTEX_CONTAINER(e);
+    } else {
+      f = GrowFutexes();
+    }
+    UNLOCK(&g_bus->futexes.lock);
+    if (!f) return 0;
+  }
+#ifdef HAVE_FUTEX_SEMAPHORES
+  // discard stale interrupts left over from the previous owner
+  while (!sem_trywait(&f->sem)) {
+  }
+#endif
+  atomic_store_explicit(&f->woken, false, memory_order_relaxed);
+  return f;
+}
+
+// releases futex waiter entry
+// the caller must hold the lock of bucket b
+void ReleaseFutex(struct FutexBucket *b, struct Futex *f) {
+  if (dll_is_empty(b->free)) {
+    dll_make_first(&b->free, &f->elem);
+  } else {
+    LOCK(&g_bus->futexes.lock);
+    dll_make_first(&g_bus->futexes.free, &f->elem);
+    UNLOCK(&g_bus->futexes.lock);
+  }
+}
+
+// blocks until futex is woken, interrupted, or the deadline elapses
+// returns ETIMEDOUT once the deadline has passed, otherwise zero, in
+// which case the caller should recheck its wakeup conditions.
+int ParkFutex(struct Futex *f, struct timespec deadline) {
+  int rc;
+#ifdef HAVE_FUTEX_SEMAPHORES
+  if (deadline.tv_sec == NUMERIC_MAX(time_t)) {
+    rc = sem_wait(&f->sem);
+  } else {
+    rc = sem_timedwait(&f->sem, &deadline);
+  }
+  if (rc && errno == ETIMEDOUT) return ETIMEDOUT;
+  unassert(!rc || errno == EINTR);
+  return 0;
+#else
+  // host signal handlers can't safely notify a condition variable, so
+  // we need to wake up periodically to check if a signal has arrived.
+  struct timespec tick;
+  tick = AddTime(GetTime(), FromMilliseconds(kPollingMs));
+  if (CompareTime(tick, deadline) > 0) tick = deadline;
+  LOCK(&f->lock);
+  if (!atomic_load_explicit(&f->woken, memory_order_acquire)) {
+    rc = pthread_cond_timedwait(&f->cond, &f->lock, &tick);
+    unassert(!rc || rc == ETIMEDOUT);
+  }
+  UNLOCK(&f->lock);
+  if (CompareTime(tick, deadline) >= 0 &&
+      !atomic_load_explicit(&f->woken, memory_order_acquire)) {
+    return ETIMEDOUT;
+  }
+  return 0;
+#endif
+}
+
+// wakes thread blocked in ParkFutex()
+// the caller must hold the lock of the bucket containing f
+void UnparkFutex(struct Futex *f) {
+  atomic_store_explicit(&f->woken, true, memory_order_release);
+#ifdef HAVE_FUTEX_SEMAPHORES
+  unassert(!sem_post(&f->sem));
+#else
+  LOCK(&f->lock);
+  unassert(!pthread_cond_signal(&f->cond));
+  UNLOCK(&f->lock);
+#endif
+}
+
+// causes ParkFutex() to return early so its caller rechecks signals
+// this function is asynchronous signal safe
+void InterruptFutex(struct Futex *f) {
+#ifdef HAVE_FUTEX_SEMAPHORES
+  if (f) sem_post(&f->sem);
+#endif
+}
+
+// returns number of threads blocked in futex(FUTEX_WAIT) on the bus
+long CountFutexWaiters(void) {
+  long n;
+  unsigned i;
+  struct Dll *e;
+  struct FutexBucket *b;
+  for (n = i = 0; i < kFutexBuckets; ++i) {
+    b = g_bus->futexes.bucket + i;
+    LOCK(&b->lock);
+    for (e = dll_first(b->active); e; e = dll_next(b->active, e)) ++n;
+    UNLOCK(&b->lock);
+  }
+  return n;
+}
+
+void LockFutexes(void) {
+  unsigned i;
+  for (i = 0; i < kFutexBuckets; ++i) {
+    LOCK(&g_bus->futexes.bucket[i].lock);
+  }
+  LOCK(&g_bus->futexes.lock);
+}
+
+void UnlockFutexes(void) {
+  unsigned i;
+  UNLOCK(&g_bus->futexes.lock);
+  for (i = kFutexBuckets; i--;) {
+    UNLOCK(&g_bus->futexes.bucket[i].lock);
+  }
 }
 
 void LockBus(const u8 *locality) {
@@ -2,6 +2,7 @@
 #define BLINK_MOP_H_
 #include <limits.h>
 #include <stdbool.h>
+#include <time.h>
 
 #include "blink/assert.h"
 #include "blink/atomic.h"
@@ -14,21 +15,40 @@
 #include "blink/tunables.h"
 #include "blink/types.h"
 
+#if defined(HAVE_THREADS) && defined(HAVE_SEM_TIMEDWAIT)
+#include <semaphore.h>
+#define HAVE_FUTEX_SEMAPHORES
+#endif
+
 #define FUTEX_CONTAINER(e) DLL_CONTAINER(struct Futex, elem, e)
 
+// each thread blocked in futex(FUTEX_WAIT) owns one of these
 struct Futex {
-  i64 addr;
-  int waiters;
-  struct Dll elem;
+  i64 addr;               // guest address being waited upon
+  int pid;                // process of a private futex, or zero if shared
+  int tid;                // tid of FUTEX_LOCK_PI waiter, otherwise zero
+  _Atomic(bool) woken;    // set by FUTEX_WAKE under the bucket lock
+  struct Dll elem;        // see FutexBucket::active or FutexBucket::free
+#ifdef HAVE_FUTEX_SEMAPHORES
+  sem_t sem;              // posted to wake, or to interrupt, the waiter
+#else
   pthread_cond_t_ cond;
   pthread_mutex_t_ lock;
+#endif
 };
 
-struct Futexes {
+struct FutexBucket {
   struct Dll *active;
-  struct Dll *free;
+  struct Dll *free;  // recently released entries, to avoid the pool lock
   pthread_mutex_t_ lock;
-  struct Futex mem[kFutexMax];
+};
+
+struct Futexes {
+  struct Dll *free;
+  unsigned used;          // entries of mem[] initialized so far
+  pthread_mutex_t_ lock;  // guards free and used
+  struct FutexBucket bucket[kFutexBuckets];
+  struct Futex mem[kFutexMax];  // grows lazily; untouched pages stay free
 };
 
 struct Bus {
@@ -48,6 +68,14 @@ struct Bus {
 extern struct Bus *g_bus;
 
 void InitBus(void);
+void LockFutexes(void);
+void UnlockFutexes(void);
+struct Futex *AllocateFutex(struct FutexBucket *);
+void ReleaseFutex(struct FutexBucket *, struct Futex *);
+int ParkFutex(struct Futex *, struct timespec);
+void UnparkFutex(struct Futex *);
+void InterruptFutex(struct Futex *);
+long CountFutexWaiters(void);
 void LockBus(const u8 *);
 void UnlockBus(const u8 *);
 
@@ -43,7 +43,9 @@ size_t FormatCga(u8 bgfg, char buf[11]) {
 #endif
 
 void DrawCga(struct Panel *p, u8 *vram) {
-  unsigned y, x, ny, nx, a, ch, attr, curx, cury;
+  static struct PanelRowCache cache[50];
+  unsigned y, x, ny, nx, a, ch, attr, curx, cury, start;
+  int cx;
   u8 *v;
   wint_t wch;
   char buf[11];
@@ -54,6 +56,12 @@ void DrawCga(struct Panel *p, u8 *vram) {
   for (y = 0; y < ny; ++y) {
     a = -1;
     v = vram + y * nx * 2;
+    cx = !BdaCurhidden && y == cury ? (int)curx : -1;
+    if (y < ARRAYLEN(cache) &&
+        AppendCachedPanelRow(cache + y, &p->lines[y], cx, v, nx * 2)) {
+      continue;
+    }
+    start = p->lines[y].i;
     for (x = 0; x < nx; ++x) {
       ch = *v++;
       attr = *v++;
@@ -74,5 +82,9 @@ void DrawCga(struct Panel *p, u8 *vram) {
       AppendWide(&p->lines[y], wch);
     }
     AppendStr(&p->lines[y], "\033[0m");
+    if (y < ARRAYLEN(cache)) {
+      CachePanelRow(cache + y, &p->lines[y], start, cx, vram + y * nx * 2,
+                    nx * 2);
+    }
   }
 }
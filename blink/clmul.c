@@ -16,18 +16,61 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include <string.h>
+
 #include "blink/bitscan.h"
 #include "blink/endian.h"
+#include "blink/intrin.h"
 #include "blink/machine.h"
 #include "blink/modrm.h"
 #include "blink/rde.h"
 
+#if defined(__aarch64__) && defined(__GNUC__) && \
+    (defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO))
+#include <arm_neon.h>
+#define ARM_PMULL 1
+#else
+#define ARM_PMULL 0
+#endif
+
 struct clmul {
   u64 x, y;
 };
 
+#if X86_INTRINSICS
+bool HasHostClmul(void) {
+  u32 ax, bx, cx, dx;
+  static int res;  // 1 = no, 2 = yes
+  if (!res) {
+    asm("cpuid" : "=a"(ax), "=b"(bx), "=c"(cx), "=d"(dx) : "0"(1), "2"(0));
+    res = (cx & 1 << 1) ? 2 : 1;
+  }
+  return res == 2;
+}
+#else
+bool HasHostClmul(void) {
+  return ARM_PMULL;
+}
+#endif
+
 static struct clmul clmul(u64 a, u64 b) {
   u64 t, x = 0, y = 0;
+#if X86_INTRINSICS
+  if (HasHostClmul()) {
+    char_xmmu_t u, v;
+    u64 w[2] = {a, b};
+    memcpy(&u, w + 0, 8);
+    memcpy(&v, w + 1, 8);
+    asm("pclmulqdq\t$0,%1,%0" : "+x"(u) : "x"(v));
+    memcpy(w, &u, 16);
+    return (struct clmul){w[0], w[1]};
+  }
+#elif ARM_PMULL
+  poly128_t r = vmull_p64(a, b);
+  memcpy(&x, (char *)&r + 0, 8);
+  memcpy(&y, (char *)&r + 8, 8);
+  return (struct clmul){x, y};
+#endif
   if (a && b) {
     if (bsr(a) < bsr(b)) t = a, a = b, b = t;
     for (t = 0; b; a <<= 1, b >>= 1) {
@@ -46,6 +89,7 @@ void OpSsePclmulqdq(P) {
         Read64(GetModrmRegisterXmmPointerRead16(A) + ((uimm0 & 0x10) >> 1)));
     Put64(XmmRexrReg(m, rde) + 0, res.x);
     Put64(XmmRexrReg(m, rde) + 8, res.y);
+    if (IsMakingPath(m)) JitSseOp(A);
   } else {
     OpUdImpl(m);
   }
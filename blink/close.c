@@ -65,7 +65,7 @@ int SysClose(struct Machine *m, i32 fildes) {
   struct Fd *fd;
   LOCK(&m->system->fds.lock);
   if ((fd = GetFd(&m->system->fds, fildes))) {
-    dll_remove(&m->system->fds.list, &fd->elem);
+    RemoveFd(&m->system->fds, fd);
   }
   UNLOCK(&m->system->fds.lock);
   if (!fd) return -1;
@@ -80,7 +80,7 @@ void SysCloseExec(struct System *s) {
     fd = FD_CONTAINER(e);
     e2 = dll_next(s->fds.list, e);
     if (fd->oflags & O_CLOEXEC) {
-      dll_remove(&s->fds.list, e);
+      RemoveFd(&s->fds, fd);
       dll_make_last(&fds, e);
     }
   }
@@ -124,7 +124,7 @@ int SysCloseRange(struct Machine *m, u32 first, u32 last, u32 flags) {
     fd = FD_CONTAINER(e);
     e2 = dll_next(m->system->fds.list, e);
     if (first <= (u32)fd->fildes && (u32)fd->fildes <= last) {
-      dll_remove(&m->system->fds.list, e);
+      RemoveFd(&m->system->fds, fd);
       dll_make_last(&fds, e);
     }
   }
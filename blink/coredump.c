@@ -0,0 +1,566 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/coredump.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/bus.h"
+#include "blink/dll.h"
+#include "blink/elf.h"
+#include "blink/endian.h"
+#include "blink/flag.h"
+#include "blink/ldbl.h"
+#include "blink/linux.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/preadv.h"
+#include "blink/thread.h"
+#include "blink/timespec.h"
+#include "blink/tunables.h"
+#include "blink/util.h"
+
+/**
+ * @fileoverview Core dumps of crashed guests.
+ *
+ * When BLINK_CORE names a file, a guest that's terminated by a signal
+ * whose default action dumps core, e.g. SIGSEGV or SIGABRT, has an ELF
+ * core file written there, which gdb can load alongside the program.
+ * It has an NT_PRSTATUS and NT_FPREGSET note for each thread, with the
+ * thread that crashed going first, and a PT_LOAD segment for each run
+ * of guest pages having the same protection.
+ *
+ * The page table is walked once to gather intervals of guest memory
+ * that are contiguous on the host, which are then written with pwritev
+ * straight out of guest memory. Pages that were reserved but never
+ * touched are left as holes, so sparse address spaces produce sparse
+ * files. Other threads are asked to park first so their registers are
+ * consistent, although a thread that's blocked in a system call will
+ * have its registers saved as they were when it entered the kernel.
+ */
+
+#define kCoreNoteName  "CORE"
+#define kCorePrstatus  336
+#define kCorePrpsinfo  136
+#define kCoreFpregset  512
+#define kCoreRegisters 112  // offset of pr_reg in struct elf_prstatus
+#define kCoreFpvalid   328  // offset of pr_fpvalid in struct elf_prstatus
+
+// interval of guest memory that's contiguous on the host too
+struct CoreExtent {
+  i64 virt;
+  i64 size;
+  u64 key;   // PAGE_U, PAGE_RW, and PAGE_XD bits
+  u8 *host;  // null if there's no content, which leaves a hole
+};
+
+struct CoreExtents {
+  size_t i, n;
+  struct CoreExtent *p;
+};
+
+// interval of guest memory that becomes a PT_LOAD segment
+struct CoreSegment {
+  i64 virt;
+  i64 size;
+  u64 key;
+  i64 offset;
+};
+
+static _Atomic(bool) g_dumping;
+
+static bool IsCoreDumpingSignal(int sig) {
+  switch (sig) {
+    case SIGQUIT_LINUX:
+    case SIGILL_LINUX:
+    case SIGTRAP_LINUX:
+    case SIGABRT_LINUX:
+    case SIGBUS_LINUX:
+    case SIGFPE_LINUX:
+    case SIGSEGV_LINUX:
+    case SIGXCPU_LINUX:
+    case SIGXFSZ_LINUX:
+    case SIGSYS_LINUX:
+      return true;
+    default:
+      return false;
+  }
+}
+
+#ifdef HAVE_THREADS
+static bool AreOtherMachinesStopped(struct Machine *m) {
+  bool ok = true;
+  struct Dll *e;
+  struct Machine *o;
+  LOCK(&m->system->machines_lock);
+  for (e = dll_first(m->system->machines); e;
+       e = dll_next(m->system->machines, e)) {
+    o = MACHINE_CONTAINER(e);
+    if (o != m && !o->parked &&
+        !atomic_load_explicit(&o->insyscall, memory_order_seq_cst)) {
+      ok = false;
+      break;
+    }
+  }
+  UNLOCK(&m->system->machines_lock);
+  return ok;
+}
+#endif
+
+// parks the other threads, which stay that way until they're killed,
+// and acquires the memory lock. we only wait for so long, because the
+// thread that crashed might be the one holding the lock
+static bool StopOtherThreads(struct Machine *m) {
+  struct System *s = m->system;
+#ifdef HAVE_THREADS
+  struct Dll *e;
+  struct timespec deadline;
+  LOCK(&s->machines_lock);
+  atomic_store_explicit(&s->paused, true, memory_order_seq_cst);
+  for (e = dll_first(s->machines); e; e = dll_next(s->machines, e)) {
+    if (MACHINE_CONTAINER(e) != m) {
+      atomic_store_explicit(&MACHINE_CONTAINER(e)->attention, true,
+                            memory_order_seq_cst);
+    }
+  }
+  UNLOCK(&s->machines_lock);
+  deadline = AddTime(GetTime(), FromMilliseconds(kCoreWaitMs));
+  while (!AreOtherMachinesStopped(m) &&
+         CompareTime(GetTime(), deadline) < 0) {
+    SleepTime(FromMilliseconds(1));
+  }
+  for (;;) {
+    if (!pthread_mutex_trylock(&s->mmap_lock)) return true;
+    if (CompareTime(GetTime(), deadline) >= 0) return false;
+    SleepTime(FromMilliseconds(1));
+  }
+#else
+  (void)s;
+  return true;
+#endif
+}
+
+static u8 *GetCoreData(struct System *s, u64 entry) {
+  if (entry & PAGE_RSRV) return 0;
+  if ((entry & (PAGE_U | PAGE_MAP)) == PAGE_MAP) return 0;
+  return GetPageAddress(s, entry, false);
+}
+
+static bool AppendCoreExtent(struct CoreExtents *xs, i64 virt, u64 key,
+                             u8 *host) {
+  size_t n;
+  struct CoreExtent *x;
+  if (xs->i) {
+    x = xs->p + xs->i - 1;
+    if (x->virt + x->size == virt && x->key == key &&
+        (x->host ? host && x->host + x->size == host : !host)) {
+      x->size += 4096;
+      return true;
+    }
+  }
+  if (xs->i == xs->n) {
+    n = xs->n ? xs->n * 2 : 64;
+    if (!(x = (struct CoreExtent *)realloc(xs->p, n * sizeof(*x)))) {
+      return false;
+    }
+    xs->p = x;
+    xs->n = n;
+  }
+  x = xs->p + xs->i++;
+  x->virt = virt;
+  x->size = 4096;
+  x->key = key;
+  x->host = host;
+  return true;
+}
+
+static bool FindCoreExtents(struct System *s, struct CoreExtents *xs,
+                            i64 addr, unsigned level, u64 pt, i64 a, i64 b) {
+  u64 entry, pte;
+  i64 i, j, page;
+  for (i = a; i < b; ++i) {
+    entry = Load64(GetPageAddress(s, pt, level == 39) + i * 8);
+    if (!(entry & PAGE_V)) continue;
+    page = (addr | i << level) << 16 >> 16;
+    if (level == 21 && IsLazyChunk(entry)) {
+      for (j = 0; j < 0x200000; j += 4096) {
+        pte = GetLazyEntry(entry, j);
+        if (!AppendCoreExtent(xs, page + j, pte & (PAGE_U | PAGE_RW | PAGE_XD),
+                              GetCoreData(s, pte))) {
+          return false;
+        }
+      }
+    } else if (level == 12) {
+      // pages BLINK_RECLAIM compressed have content
+      if ((entry & PAGE_ZIP) &&
+          !(entry = CommitReservedPage(
+                s, GetPageAddress(s, pt, level == 39) + i * 8, entry))) {
+        return false;
+      }
+      if (!AppendCoreExtent(xs, page, entry & (PAGE_U | PAGE_RW | PAGE_XD),
+                            GetCoreData(s, entry))) {
+        return false;
+      }
+    } else if (!FindCoreExtents(s, xs, page, level - 9, entry, 0, 512)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static u8 *AppendCoreNote(u8 *p, int type, size_t size) {
+  Write32(p + 0, sizeof(kCoreNoteName));
+  Write32(p + 4, size);
+  Write32(p + 8, type);
+  memcpy(p + 12, kCoreNoteName, sizeof(kCoreNoteName));
+  return p + 12 + ROUNDUP(sizeof(kCoreNoteName), 4);
+}
+
+static size_t GetCoreNoteSize(size_t size) {
+  return 12 + ROUNDUP(sizeof(kCoreNoteName), 4) + ROUNDUP(size, 4);
+}
+
+// creates struct elf_prstatus, whose pr_reg is a user_regs_struct
+static u8 *AppendCorePrstatus(u8 *p, struct Machine *m, int sig) {
+  u8 *r;
+  p = AppendCoreNote(p, NT_PRSTATUS_, kCorePrstatus);
+  Write32(p + 0, sig);
+  Write16(p + 12, sig);
+  Write64(p + 16, m->signals);
+  Write64(p + 24, m->sigmask);
+  Write32(p + 32, m->tid);
+  Write32(p + 36, getppid());
+  Write32(p + 40, getpgrp());
+  Write32(p + 44, getsid(0));
+  r = p + kCoreRegisters;
+  memcpy(r + 0 * 8, m->r15, 8);
+  memcpy(r + 1 * 8, m->r14, 8);
+  memcpy(r + 2 * 8, m->r13, 8);
+  memcpy(r + 3 * 8, m->r12, 8);
+  memcpy(r + 4 * 8, m->bp, 8);
+  memcpy(r + 5 * 8, m->bx, 8);
+  memcpy(r + 6 * 8, m->r11, 8);
+  memcpy(r + 7 * 8, m->r10, 8);
+  memcpy(r + 8 * 8, m->r9, 8);
+  memcpy(r + 9 * 8, m->r8, 8);
+  memcpy(r + 10 * 8, m->ax, 8);
+  memcpy(r + 11 * 8, m->cx, 8);
+  memcpy(r + 12 * 8, m->dx, 8);
+  memcpy(r + 13 * 8, m->si, 8);
+  memcpy(r + 14 * 8, m->di, 8);
+  Write64(r + 15 * 8, -1);  // orig_rax
+  Write64(r + 16 * 8, m->ip);
+  Write64(r + 17 * 8, m->cs.sel);
+  Write64(r + 18 * 8, m->flags);
+  memcpy(r + 19 * 8, m->sp, 8);
+  Write64(r + 20 * 8, m->ss.sel);
+  Write64(r + 21 * 8, m->fs.base);
+  Write64(r + 22 * 8, m->gs.base);
+  Write64(r + 23 * 8, m->ds.sel);
+  Write64(r + 24 * 8, m->es.sel);
+  Write64(r + 25 * 8, m->fs.sel);
+  Write64(r + 26 * 8, m->gs.sel);
+  Write32(p + kCoreFpvalid, 1);
+  return p + kCorePrstatus;
+}
+
+// creates struct user_fpregs_struct, which is the fxsave layout
+static u8 *AppendCoreFpregset(u8 *p, struct Machine *m) {
+  struct fpstate_linux fp;
+  p = AppendCoreNote(p, NT_FPREGSET_, kCoreFpregset);
+  _Static_assert(sizeof(fp) == kCoreFpregset, "");
+  memset(&fp, 0, sizeof(fp));
+  Write16(fp.cwd, m->fpu.cw);
+#ifndef DISABLE_X87
+  Write16(fp.swd, m->fpu.sw);
+  Write16(fp.ftw, m->fpu.tw);
+  Write16(fp.fop, m->fpu.op);
+  Write64(fp.rip, m->fpu.ip);
+  Write64(fp.rdp, m->fpu.dp);
+  {
+    int i;
+    for (i = 0; i < 8; ++i) {
+      SerializeLdbl(fp.st[i], m->fpu.st[i]);
+    }
+  }
+#endif
+  Write32(fp.mxcsr, m->mxcsr);
+  Write32(fp.mxcr_mask, 0xffff);
+  memcpy(fp.xmm, m->xmm, sizeof(fp.xmm));
+  memcpy(p, &fp, sizeof(fp));
+  return p + kCoreFpregset;
+}
+
+// creates struct elf_prpsinfo
+static u8 *AppendCorePrpsinfo(u8 *p, struct System *s) {
+  const char *prog, *name;
+  p = AppendCoreNote(p, NT_PRPSINFO_, kCorePrpsinfo);
+  prog = s->elf.prog ? s->elf.prog : "";
+  name = (name = strrchr(prog, '/')) ? name + 1 : prog;
+  p[1] = 'R';
+  Write32(p + 16, getuid());
+  Write32(p + 20, getgid());
+  Write32(p + 24, s->pid);
+  Write32(p + 28, getppid());
+  Write32(p + 32, getpgrp());
+  Write32(p + 36, getsid(0));
+  strncpy((char *)p + 40, name, 15);
+  strncpy((char *)p + 56, prog, 79);
+  return p + kCorePrpsinfo;
+}
+
+// serializes thread state with the one that crashed going first, the
+// way gdb expects. machines can't be freed while their list is locked
+static u8 *CreateCoreNotes(struct Machine *m, int sig, size_t *size) {
+  u8 *p, *q;
+  size_t n = 1;
+  struct Dll *e;
+  struct Machine *o;
+  struct System *s = m->system;
+  LOCK(&s->machines_lock);
+  for (e = dll_first(s->machines); e; e = dll_next(s->machines, e)) {
+    if (MACHINE_CONTAINER(e) != m) ++n;
+  }
+  *size = GetCoreNoteSize(kCorePrpsinfo) +
+          n * (GetCoreNoteSize(kCorePrstatus) + GetCoreNoteSize(kCoreFpregset));
+  if ((p = q = (u8 *)calloc(1, *size))) {
+    q = AppendCorePrstatus(q, m, sig);
+    q = AppendCorePrpsinfo(q, s);
+    q = AppendCoreFpregset(q, m);
+    for (e = dll_first(s->machines); e; e = dll_next(s->machines, e)) {
+      if ((o = MACHINE_CONTAINER(e)) != m) {
+        q = AppendCorePrstatus(q, o, sig);
+        q = AppendCoreFpregset(q, o);
+      }
+    }
+    unassert(q == p + *size);
+  }
+  UNLOCK(&s->machines_lock);
+  return p;
+}
+
+static size_t FindCoreSegments(const struct CoreExtents *xs,
+                               struct CoreSegment *g) {
+  size_t i, n;
+  const struct CoreExtent *x;
+  for (n = i = 0; i < xs->i; ++i) {
+    x = xs->p + i;
+    if (n && g[n - 1].virt + g[n - 1].size == x->virt &&
+        g[n - 1].key == x->key) {
+      g[n - 1].size += x->size;
+    } else {
+      g[n].virt = x->virt;
+      g[n].size = x->size;
+      g[n].key = x->key;
+      ++n;
+    }
+  }
+  return n;
+}
+
+// the guest can't read pages that aren't user accessible, so the
+// kernel wouldn't put their content in the file, and neither do we
+static i64 GetCoreFileSize(const struct CoreSegment *g) {
+  return (g->key & PAGE_U) ? g->size : 0;
+}
+
+static bool WriteCore(int fd, struct iovec *iov, int n, i64 off) {
+  int i;
+  ssize_t rc;
+  while (n) {
+    if ((rc = pwritev(fd, iov, n, off)) == -1) {
+      if (errno == EINTR) continue;
+      if (errno == EFAULT && n > 1) {
+        // write extents one at a time so only the bad one gets skipped
+        for (i = 0; i < n; off += iov[i++].iov_len) {
+          if (!WriteCore(fd, iov + i, 1, off)) return false;
+        }
+        return true;
+      }
+      if (errno == EFAULT) {
+        // e.g. file mapping that extends past the end of its file
+        LOG_ONCE(LOGF("core dump skipped memory the host couldn't read"));
+        return true;
+      }
+      return false;
+    }
+    if (!rc) {
+      errno = EIO;
+      return false;
+    }
+    off += rc;
+    for (; n && (size_t)rc >= iov->iov_len; ++iov, --n) {
+      rc -= iov->iov_len;
+    }
+    if (n) {
+      iov->iov_base = (u8 *)iov->iov_base + rc;
+      iov->iov_len -= rc;
+    }
+  }
+  return true;
+}
+
+// writes guest memory to the file, gathering extents that are adjacent
+// in the file into a single system call
+static bool WriteCoreMemory(int fd, const struct CoreExtents *xs,
+                            const struct CoreSegment *g) {
+  int n = 0;
+  size_t i;
+  i64 off, beg = 0, end = 0;
+  const struct CoreExtent *x;
+  struct iovec iov[kCoreIovs];
+  for (i = 0; i < xs->i; ++i) {
+    x = xs->p + i;
+    while (x->virt >= g->virt + g->size) ++g;
+    if (!x->host || !GetCoreFileSize(g)) continue;
+    off = g->offset + (x->virt - g->virt);
+    if (n && (off != end || n == kCoreIovs)) {
+      if (!WriteCore(fd, iov, n, beg)) return false;
+      n = 0;
+    }
+    if (!n) beg = end = off;
+    iov[n].iov_base = x->host;
+    iov[n].iov_len = x->size;
+    end += x->size;
+    ++n;
+  }
+  return !n || WriteCore(fd, iov, n, beg);
+}
+
+static bool WriteCoreFile(int fd, const u8 *notes, size_t notesize,
+                          const struct CoreExtents *xs, struct CoreSegment *g,
+                          size_t n) {
+  u8 *hdr;
+  bool ok;
+  size_t i;
+  i64 off, hdrsize;
+  Elf64_Ehdr_ *eh;
+  Elf64_Phdr_ *ph;
+  hdrsize = sizeof(*eh) + (n + 1) * sizeof(*ph);
+  if (!(hdr = (u8 *)calloc(1, hdrsize))) return false;
+  eh = (Elf64_Ehdr_ *)hdr;
+  ph = (Elf64_Phdr_ *)(hdr + sizeof(*eh));
+  memcpy(eh->ident, ELFMAG_, SELFMAG_);
+  eh->ident[EI_CLASS_] = ELFCLASS64_;
+  eh->ident[EI_DATA_] = ELFDATA2LSB_;
+  eh->ident[EI_VERSION_] = EV_CURRENT_;
+  eh->ident[EI_OSABI_] = ELFOSABI_NONE_;
+  Write16(eh->type, ET_CORE_);
+  Write16(eh->machine, EM_NEXGEN32E_);
+  Write32(eh->version, EV_CURRENT_);
+  Write64(eh->phoff, sizeof(*eh));
+  Write16(eh->ehsize, sizeof(*eh));
+  Write16(eh->phentsize, sizeof(*ph));
+  Write16(eh->phnum, MIN(n + 1, 0xffff));
+  Write32(ph->type, PT_NOTE_);
+  Write64(ph->offset, hdrsize);
+  Write64(ph->filesz, notesize);
+  Write64(ph->align, 4);
+  off = ROUNDUP(hdrsize + (i64)notesize, 4096);
+  for (i = 0; i < n; ++i) {
+    ++ph;
+    g[i].offset = off;
+    Write32(ph->type, PT_LOAD_);
+    Write32(ph->flags, ((g[i].key & PAGE_U) ? PF_R_ : 0) |
+                           ((g[i].key & PAGE_RW) ? PF_W_ : 0) |
+                           ((g[i].key & PAGE_XD) ? 0 : PF_X_));
+    Write64(ph->offset, off);
+    Write64(ph->vaddr, g[i].virt);
+    Write64(ph->filesz, GetCoreFileSize(g + i));
+    Write64(ph->memsz, g[i].size);
+    Write64(ph->align, 4096);
+    off += GetCoreFileSize(g + i);
+  }
+  ok = WriteCore(fd, (struct iovec[]){{hdr, hdrsize}, {(u8 *)notes, notesize}},
+                 2, 0) &&
+       WriteCoreMemory(fd, xs, g) &&
+       // trailing pages that weren't written still need to be in the file
+       !ftruncate(fd, off);
+  free(hdr);
+  return ok;
+}
+
+/**
+ * Writes core file of guest to BLINK_CORE if `sig` calls for it.
+ *
+ * This must be called before the other threads are killed, since they
+ * get parked here so their registers can be saved.
+ */
+void DumpCore(struct Machine *m, int sig) {
+  int fd;
+  bool ok;
+  u8 *notes;
+  size_t n, notesize;
+  char temp[PATH_MAX];
+  struct CoreExtents xs;
+  struct CoreSegment *g;
+  struct System *s = m->system;
+  struct rlimit rlim = {0, 0};
+  if (!FLAG_core || !IsCoreDumpingSignal(sig) || s->real || !s->cr3) return;
+  if (atomic_exchange(&g_dumping, true)) return;
+  if (snprintf(temp, sizeof(temp), "%s.%d.tmp", FLAG_core, getpid()) >=
+      sizeof(temp)) {
+    return;
+  }
+  if (!StopOtherThreads(m)) {
+    LOGF("%s: core dump skipped since memory is locked", FLAG_core);
+    return;
+  }
+  memset(&xs, 0, sizeof(xs));
+  g = 0;
+  ok = (notes = CreateCoreNotes(m, sig, &notesize)) &&
+       FindCoreExtents(s, &xs, 0, 39, s->cr3, 0, 256) &&
+       FindCoreExtents(s, &xs, 0, 39, s->cr3, 256, 512) &&
+       (g = (struct CoreSegment *)malloc((xs.i + 1) * sizeof(*g)));
+  if (ok) {
+    n = FindCoreSegments(&xs, g);
+    if ((fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) !=
+        -1) {
+      ok = WriteCoreFile(fd, notes, notesize, &xs, g, n);
+      if (close(fd)) ok = false;
+      if (!ok) unlink(temp);
+    } else {
+      ok = false;
+    }
+  }
+  UNLOCK(&s->mmap_lock);
+  if (!ok) {
+    LOGF("%s: couldn't write core dump: %s", temp, DescribeHostErrno(errno));
+  } else if (rename(temp, FLAG_core)) {
+    LOGF("%s: rename failed: %s", FLAG_core, DescribeHostErrno(errno));
+    unlink(temp);
+  } else {
+    SYS_LOGF("wrote core dump %s", FLAG_core);
+    // we kill ourself with the same signal later, and whatever core the
+    // host would write for that would only be of blink, not the guest
+    setrlimit(RLIMIT_CORE, &rlim);
+  }
+  free(g);
+  free(xs.p);
+  free(notes);
+}
@@ -0,0 +1,7 @@
+#ifndef BLINK_COREDUMP_H_
+#define BLINK_COREDUMP_H_
+#include "blink/machine.h"
+
+void DumpCore(struct Machine *, int);
+
+#endif /* BLINK_COREDUMP_H_ */
@@ -0,0 +1,330 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/coverage.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/buffer.h"
+#include "blink/dll.h"
+#include "blink/endian.h"
+#include "blink/flag.h"
+#include "blink/log.h"
+#include "blink/macros.h"
+#include "blink/thread.h"
+#include "blink/tunables.h"
+#include "blink/util.h"
+
+/**
+ * @fileoverview Guest code coverage from jit paths.
+ *
+ * When BLINK_COVERAGE names a file, each jit path calls CountCoverage()
+ * where it begins, and after each direct branch it follows, so that the
+ * basic blocks of guest code which ran are counted, along with the edges
+ * between them, in the order the guest thread ran them. Blocks are also
+ * counted when their path is generated, since the interpreter runs its
+ * ops as it goes, but code that's never made part of a path isn't seen.
+ *
+ * When the program exits, or execve()'s, blocks are written in drcov
+ * format, so tools like lighthouse can show them, where modules are the
+ * files the guest mapped. Blocks and edges are written again with their
+ * hit counts, as text, to the same file name with .counts appended, and
+ * these use absolute guest addresses so blocks outside modules are kept.
+ *
+ * Hit counts aren't bumped atomically, since a locked instruction would
+ * cost more than the rest of CountCoverage(), so threads running the
+ * same block at the same time may lose a few counts.
+ */
+
+struct CoverageEdge {
+  _Atomic(u64) key;   // id of source block << 32 | id of destination
+  _Atomic(u64) hits;  // number of times destination was entered from src
+};
+
+struct Coverage {
+  bool flushed;                                // file was written already
+  u32 count;                                   // number of blocks created
+  _Atomic(long) lost;                          // edges table had no room
+  struct CoverageBlock *slots[kCoverageSlots]; // blocks hashed by pc
+  struct CoverageEdge edges[kCoverageEdges];   // hits hashed by key
+};
+
+struct CoverageModule {
+  i64 base;
+  i64 end;
+  const char *path;
+};
+
+static struct Coverages {
+  bool disabled;          // we're a fork() child, which is silent
+  pthread_mutex_t_ lock;  // guards blocks being created and written
+} g_coverage = {
+    .lock = PTHREAD_MUTEX_INITIALIZER_,
+};
+
+static void Bump(_Atomic(u64) *x) {
+  atomic_store_explicit(x, atomic_load_explicit(x, memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+}
+
+// starts counting blocks of s, once its program is loaded
+void StartCoverage(struct System *s) {
+  struct Coverage *c;
+  if (s->coverage) return;
+  if (!(c = (struct Coverage *)calloc(1, sizeof(*c)))) {
+    LOGF("failed to allocate coverage: %s", DescribeHostErrno(errno));
+    return;
+  }
+  s->coverage = c;
+}
+
+// returns block of guest code beginning at pc, creating it if needed
+struct CoverageBlock *GetCoverageBlock(struct System *s, i64 pc) {
+  struct Coverage *c;
+  struct CoverageBlock *b, **slot;
+  if (!(c = s->coverage)) return 0;
+  LOCK(&g_coverage.lock);
+  slot = c->slots + ((pc ^ pc >> 12) & (kCoverageSlots - 1));
+  for (b = *slot; b; b = b->next) {
+    if (b->pc == pc) break;
+  }
+  if (!b && (b = (struct CoverageBlock *)calloc(1, sizeof(*b)))) {
+    b->pc = pc;
+    b->id = ++c->count;
+    b->next = *slot;
+    *slot = b;
+  }
+  UNLOCK(&g_coverage.lock);
+  return b;
+}
+
+// notes that block b contains guest code up to end
+void ExtendCoverageBlock(struct CoverageBlock *b, i64 end) {
+  u32 size;
+  if (end <= b->pc || end - b->pc > 0xffff) return;
+  size = end - b->pc;
+  if (size > atomic_load_explicit(&b->size, memory_order_relaxed)) {
+    atomic_store_explicit(&b->size, size, memory_order_relaxed);
+  }
+}
+
+static void CountCoverageEdge(struct Coverage *c, u32 src, u32 dst) {
+  int n;
+  u32 i;
+  u64 k, key;
+  struct CoverageEdge *e;
+  key = (u64)src << 32 | dst;
+  i = (key * 0x9e3779b97f4a7c15) >> 32;
+  for (n = 0; n < 16; ++n, ++i) {
+    e = c->edges + (i & (kCoverageEdges - 1));
+    if ((k = atomic_load_explicit(&e->key, memory_order_relaxed)) == key ||
+        (!k && (atomic_compare_exchange_strong_explicit(
+                    &e->key, &k, key, memory_order_relaxed,
+                    memory_order_relaxed) ||
+                k == key))) {
+      Bump(&e->hits);
+      return;
+    }
+  }
+  atomic_fetch_add_explicit(&c->lost, 1, memory_order_relaxed);
+}
+
+// called by jit paths at the start of each block of guest code
+void CountCoverage(struct Machine *m, struct CoverageBlock *b) {
+  struct CoverageBlock *a;
+  Bump(&b->hits);
+  if ((a = m->coverblock) && m->system->coverage) {
+    CountCoverageEdge(m->system->coverage, a->id, b->id);
+  }
+  m->coverblock = b;
+}
+
+static int GetCoverageModules(struct System *s, struct CoverageModule **out) {
+  int i, n = 0;
+  struct Dll *e;
+  struct FileMap *fm;
+  struct CoverageModule *p = 0, *q;
+  for (e = dll_first(s->filemaps); e; e = dll_next(s->filemaps, e)) {
+    fm = FILEMAP_CONTAINER(e);
+    if (fm->offset == -1) continue;
+    for (i = 0; i < n; ++i) {
+      if (!strcmp(p[i].path, fm->path)) break;
+    }
+    if (i < n) {
+      p[i].base = MIN(p[i].base, fm->virt);
+      p[i].end = MAX(p[i].end, fm->virt + fm->size);
+    } else if ((q = (struct CoverageModule *)realloc(p, (n + 1) * sizeof(*p)))) {
+      p = q;
+      p[n].base = fm->virt;
+      p[n].end = fm->virt + fm->size;
+      p[n].path = fm->path;
+      ++n;
+    }
+  }
+  *out = p;
+  return n;
+}
+
+static void WriteCoverageFile(const char *path, struct Buffer *b) {
+  int fd;
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) ==
+      -1) {
+    LOGF("failed to open %s: %s", path, DescribeHostErrno(errno));
+    return;
+  }
+  if (write(fd, b->p, b->i) != b->i) {
+    LOGF("failed to write %s: %s", path, DescribeHostErrno(errno));
+  }
+  unassert(!close(fd));
+}
+
+// @assume g_coverage.lock
+static void WriteDrcov(struct System *s, struct Coverage *c) {
+  u8 bb[8];
+  long blocks;
+  int i, j, n;
+  struct Buffer b = {0};
+  struct CoverageBlock *cb;
+  struct CoverageModule *mods;
+  n = GetCoverageModules(s, &mods);
+  AppendStr(&b, "DRCOV VERSION: 2\n");
+  AppendStr(&b, "DRCOV FLAVOR: drcov\n");
+  AppendFmt(&b, "Module Table: version 2, count %d\n", n);
+  AppendStr(&b, "Columns: id, base, end, entry, path\n");
+  for (i = 0; i < n; ++i) {
+    AppendFmt(&b, "%3d, %#018" PRIx64 ", %#018" PRIx64 ", 0x%016x, %s\n", i,
+              mods[i].base, mods[i].end, 0, mods[i].path);
+  }
+  for (blocks = i = 0; i < kCoverageSlots; ++i) {
+    for (cb = c->slots[i]; cb; cb = cb->next) {
+      for (j = 0; j < n; ++j) {
+        if (mods[j].base <= cb->pc && cb->pc < mods[j].end) break;
+      }
+      blocks += j < n;
+    }
+  }
+  AppendFmt(&b, "BB Table: %ld bbs\n", blocks);
+  for (i = 0; i < kCoverageSlots; ++i) {
+    for (cb = c->slots[i]; cb; cb = cb->next) {
+      for (j = 0; j < n; ++j) {
+        if (mods[j].base <= cb->pc && cb->pc < mods[j].end) break;
+      }
+      if (j == n) continue;
+      Write32(bb, cb->pc - mods[j].base);
+      Write16(bb + 4, atomic_load_explicit(&cb->size, memory_order_relaxed));
+      Write16(bb + 6, j);
+      AppendData(&b, (char *)bb, sizeof(bb));
+    }
+  }
+  WriteCoverageFile(FLAG_coverage, &b);
+  free(mods);
+  free(b.p);
+}
+
+// @assume g_coverage.lock
+static void WriteCoverageCounts(struct Coverage *c) {
+  int i;
+  u64 key;
+  char *path;
+  struct Buffer b = {0};
+  struct CoverageBlock *cb, **blocks;
+  if (!(path = (char *)malloc(strlen(FLAG_coverage) + 8))) return;
+  stpcpy(stpcpy(path, FLAG_coverage), ".counts");
+  if (!(blocks = (struct CoverageBlock **)calloc(c->count + 1,
+                                                 sizeof(*blocks)))) {
+    free(path);
+    return;
+  }
+  for (i = 0; i < kCoverageSlots; ++i) {
+    for (cb = c->slots[i]; cb; cb = cb->next) {
+      blocks[cb->id] = cb;
+      AppendFmt(&b, "block %#" PRIx64 " %u %" PRIu64 "\n", cb->pc,
+                (unsigned)atomic_load_explicit(&cb->size, memory_order_relaxed),
+                atomic_load_explicit(&cb->hits, memory_order_relaxed));
+    }
+  }
+  for (i = 0; i < kCoverageEdges; ++i) {
+    if (!(key = atomic_load_explicit(&c->edges[i].key, memory_order_relaxed))) {
+      continue;
+    }
+    AppendFmt(&b, "edge %#" PRIx64 " %#" PRIx64 " %" PRIu64 "\n",
+              blocks[key >> 32]->pc, blocks[(u32)key]->pc,
+              atomic_load_explicit(&c->edges[i].hits, memory_order_relaxed));
+  }
+  if (atomic_load_explicit(&c->lost, memory_order_relaxed)) {
+    AppendFmt(&b, "lost %ld\n",
+              atomic_load_explicit(&c->lost, memory_order_relaxed));
+  }
+  WriteCoverageFile(path, &b);
+  free(blocks);
+  free(path);
+  free(b.p);
+}
+
+// writes blocks of s that ran, since it's exiting or execve()'ing
+void FlushCoverage(struct System *s) {
+  struct Coverage *c;
+  if (!FLAG_coverage || !(c = s->coverage)) return;
+  LOCK(&g_coverage.lock);
+  if (!g_coverage.disabled && !c->flushed) {
+    c->flushed = true;
+    WriteDrcov(s, c);
+    WriteCoverageCounts(c);
+  }
+  UNLOCK(&g_coverage.lock);
+}
+
+// frees blocks of s, whose jit paths have been destroyed
+void ForgetCoverage(struct System *s) {
+  int i;
+  struct Coverage *c;
+  struct CoverageBlock *b, *next;
+  if (!(c = s->coverage)) return;
+  for (i = 0; i < kCoverageSlots; ++i) {
+    for (b = c->slots[i]; b; b = next) {
+      next = b->next;
+      free(b);
+    }
+  }
+  free(c);
+  s->coverage = 0;
+}
+
+// locks coverage before fork()
+void LockCoverage(void) {
+  LOCK(&g_coverage.lock);
+}
+
+// unlocks coverage in the parent after fork()
+void UnlockCoverage(void) {
+  UNLOCK(&g_coverage.lock);
+}
+
+// resets coverage in the child after fork()
+// children keep counting but never write, since the parent does that
+void ResetCoverage(void) {
+  g_coverage.disabled = true;
+  unassert(!pthread_mutex_init(&g_coverage.lock, 0));
+}
@@ -0,0 +1,24 @@
+#ifndef BLINK_COVERAGE_H_
+#define BLINK_COVERAGE_H_
+#include "blink/machine.h"
+#include "blink/types.h"
+
+struct CoverageBlock {
+  i64 pc;                      // guest address at which block begins
+  _Atomic(u32) size;           // bytes of guest code in block
+  u32 id;                      // one plus index of block in creation order
+  _Atomic(u64) hits;           // number of times block was entered
+  struct CoverageBlock *next;  // next block in same hash slot
+};
+
+void StartCoverage(struct System *);
+void FlushCoverage(struct System *);
+void ForgetCoverage(struct System *);
+struct CoverageBlock *GetCoverageBlock(struct System *, i64);
+void ExtendCoverageBlock(struct CoverageBlock *, i64);
+void CountCoverage(struct Machine *, struct CoverageBlock *);
+void LockCoverage(void);
+void UnlockCoverage(void);
+void ResetCoverage(void);
+
+#endif /* BLINK_COVERAGE_H_ */
@@ -16,9 +16,14 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include <string.h>
+
 #include "blink/assert.h"
+#include "blink/avx.h"
 #include "blink/endian.h"
 #include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/time.h"
 
 #define INTEL    "GenuineIntel"
 #define BLINK    "GenuineBlink"
@@ -59,18 +64,88 @@
 #define OS UNKNOWN_
 #endif
 
+#define kCpuBlinkC1  (1u << 31)  // hypervisor
+#define kCpuBlinkC81 (1u << 31)  // jit
+
+// feature bits a cpu profile lets guests see
+struct CpuProfile {
+  const char *name;
+  u32 c1, d1;    // leaf 1
+  u32 b7, c7;    // leaf 7
+  u32 c81, d81;  // leaf 0x80000001
+};
+
+static const struct CpuProfile kCpuProfiles[] = {
+    {"max", -1u, -1u, -1u, -1u, -1u, -1u},
+    // hides what makes glibc pick string functions blink runs slower
+    // when jitting, i.e. avx, avx2, fma and bmi2, since vex ops aren't
+    // jitted natively, as well as ssse3, since glibc's palignr memcpy
+    // is 40x slower than the rep movsb it uses instead for big copies
+    {"fast",                                            //
+     ~(1u << 9 | 1u << 12 | 1u << 28 | 1u << 29), -1u,  //
+     ~(1u << 5 | 1u << 8), -1u,                         //
+     -1u, -1u},
+    // baseline x86-64 without even sse3
+    {"x86-64",                    //
+     kCpuBlinkC1, -1u,            //
+     0, 0,                        //
+     kCpuBlinkC81, ~(1u << 27)},  //
+};
+
+static struct CpuProfile g_cpu = {"max", -1u, -1u, -1u, -1u, -1u, -1u};
+
+static void GetHostCpuid(u32 leaf, u32 sub, u32 r[4]) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  asm("cpuid" : "=a"(r[0]), "=b"(r[1]), "=c"(r[2]), "=d"(r[3])
+      : "0"(leaf), "2"(sub));
+#else
+  r[0] = r[1] = r[2] = r[3] = -1;
+#endif
+}
+
+/**
+ * Chooses which features cpuid reports, e.g. "max", "fast", "x86-64"
+ * or "host", where host hides what the host cpu doesn't have.
+ *
+ * @return true on success, or false if name isn't a known profile
+ */
+bool SetCpuProfile(const char *name) {
+  int i;
+  u32 r[4];
+  if (!strcmp(name, "host")) {
+    g_cpu.name = "host";
+    GetHostCpuid(1, 0, r);
+    g_cpu.c1 = r[2] | kCpuBlinkC1;
+    g_cpu.d1 = r[3];
+    GetHostCpuid(7, 0, r);
+    g_cpu.b7 = r[1];
+    g_cpu.c7 = r[2];
+    GetHostCpuid(0x80000001, 0, r);
+    g_cpu.c81 = r[2] | kCpuBlinkC81;
+    g_cpu.d81 = r[3];
+    return true;
+  }
+  for (i = 0; i < ARRAYLEN(kCpuProfiles); ++i) {
+    if (!strcmp(name, kCpuProfiles[i].name)) {
+      g_cpu = kCpuProfiles[i];
+      return true;
+    }
+  }
+  return false;
+}
+
 void OpCpuid(P) {
-  u32 ax, bx, cx, dx, jit;
+  u32 leaf, ax, bx, cx, dx, jit;
   if (m->trapcpuid) {
     ThrowSegmentationFault(m, 0);
   }
   ax = bx = cx = dx = 0;
-  switch (Get32(m->ax)) {
+  switch ((leaf = Get32(m->ax))) {
     case 0:
-      ax = 7;
+      ax = 0x16;
       goto vendor;
     case 0x80000000:
-      ax = 0x80000001;
+      ax = 0x80000007;
     vendor:
       // glibc binaries won't run unless we report blink as a
       // modern linux kernel on top of genuine intel hardware
@@ -94,8 +169,15 @@ void OpCpuid(P) {
       cx |= 1 << 9;    // ssse3
       cx |= 1 << 23;   // popcnt
       cx |= 1 << 30;   // rdrnd
-      cx |= 0 << 25;   // aes
+      cx |= 1 << 25;   // aes
       cx |= 1 << 13;   // cmpxchg16b
+      cx |= 1 << 26;   // xsave
+      cx |= 1 << 27;   // osxsave
+#ifndef DISABLE_AVX
+      cx |= 1 << 28;   // avx
+      cx |= 1 << 12;   // fma
+      cx |= 1 << 29;   // f16c
+#endif
       cx |= 1u << 31;  // hypervisor
       dx |= 1 << 4;    // tsc
       dx |= 1 << 6;    // pae
@@ -124,10 +206,14 @@ void OpCpuid(P) {
           bx |= 1 << 0;   // fsgsbase
           bx |= 1 << 9;   // erms
           bx |= 1 << 18;  // rdseed
+          bx |= 1 << 29;  // sha
           cx |= 1 << 22;  // rdpid
 #ifndef DISABLE_BMI2
           bx |= 1 << 8;   // bmi2
           bx |= 1 << 19;  // adx
+#endif
+#ifndef DISABLE_AVX
+          bx |= 1 << 5;   // avx2
 #endif
           break;
         default:
@@ -151,6 +237,16 @@ void OpCpuid(P) {
     case 0x80000007:
       dx |= 1 << 8;  // invtsc
       break;
+    case 0x15:  // time stamp counter and crystal clock
+      ax = 1000;                      // denominator
+      bx = GetTscFrequency() / 1000;  // numerator
+      cx = 1000000;                   // crystal hertz
+      break;
+    case 0x16:  // processor frequency in megahertz
+      ax = GetTscFrequency() / 1000000;  // base
+      bx = GetTscFrequency() / 1000000;  // maximum
+      cx = 100;                          // bus
+      break;
     case 4:  // cpu cache information
       // - Level 1 data 8-way 32,768 byte cache w/ 64 sets of 64 byte
       //   lines shared across 2 threads
@@ -189,6 +285,28 @@ void OpCpuid(P) {
           break;
       }
       break;
+    case 0xd:  // processor extended state enumeration
+      switch (Get32(m->cx)) {
+        case 0:
+          ax = kXcr0Supported;
+          bx = m->xcr0 & kXcr0Avx ? kXsaveSize : kXsaveAvxOffset;
+          cx = kXsaveSize;
+          break;
+        case 1:
+          ax |= 1 << 0;  // xsaveopt
+          ax |= 1 << 1;  // xsavec
+          ax |= 1 << 2;  // xgetbv with ecx=1
+          break;
+#ifndef DISABLE_AVX
+        case 2:
+          ax = kXsaveAvxSize;
+          bx = kXsaveAvxOffset;
+          break;
+#endif
+        default:
+          break;
+      }
+      break;
     case 6:  // thermal and power management leaf
       ax = 0x00000077;
       bx = 0x00000002;
@@ -198,6 +316,24 @@ void OpCpuid(P) {
     default:
       break;
   }
+  switch (leaf) {
+    case 1:
+      cx &= g_cpu.c1;
+      dx &= g_cpu.d1;
+      break;
+    case 7:
+      if (!Get32(m->cx)) {
+        bx &= g_cpu.b7;
+        cx &= g_cpu.c7;
+      }
+      break;
+    case 0x80000001:
+      cx &= g_cpu.c81;
+      dx &= g_cpu.d81;
+      break;
+    default:
+      break;
+  }
   Put64(m->ax, ax);
   Put64(m->bx, bx);
   Put64(m->cx, cx);
@@ -16,13 +16,23 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/bitscan.h"
+#include "blink/builtin.h"
 #include "blink/bus.h"
 #include "blink/endian.h"
+#include "blink/intrin.h"
 #include "blink/machine.h"
 #include "blink/modrm.h"
 #include "blink/swap.h"
 #include "blink/types.h"
 
+#if defined(__aarch64__) && defined(__GNUC__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define ARM_CRC32 1
+#else
+#define ARM_CRC32 0
+#endif
+
 static u32 kCastagnoli[256];
 
 static void InitializeCrc32(u32 table[256], u32 polynomial) {
@@ -44,9 +54,72 @@ static u32 ReverseBits32(u32 x) {
   return x;
 }
 
+#if X86_INTRINSICS
+static bool HasHostCrc32(void) {
+  u32 ax, bx, cx, dx;
+  static int res;  // 1 = no, 2 = yes
+  if (!res) {
+    asm("cpuid" : "=a"(ax), "=b"(bx), "=c"(cx), "=d"(dx) : "0"(1), "2"(0));
+    res = (cx & 1 << 20) ? 2 : 1;  // sse4.2
+  }
+  return res == 2;
+}
+MICRO_OP static u32 HostCrc32b(u32 h, u64 w) {
+  asm("crc32b\t%1,%0" : "+r"(h) : "r"((u8)w));
+  return h;
+}
+MICRO_OP static u32 HostCrc32w(u32 h, u64 w) {
+  asm("crc32w\t%1,%0" : "+r"(h) : "r"((u16)w));
+  return h;
+}
+MICRO_OP static u32 HostCrc32l(u32 h, u64 w) {
+  asm("crc32l\t%1,%0" : "+r"(h) : "r"((u32)w));
+  return h;
+}
+MICRO_OP static u32 HostCrc32q(u32 h, u64 w) {
+  u64 r = h;
+  asm("crc32q\t%1,%0" : "+r"(r) : "r"(w));
+  return r;
+}
+#elif ARM_CRC32
+static bool HasHostCrc32(void) {
+  return true;
+}
+MICRO_OP static u32 HostCrc32b(u32 h, u64 w) {
+  return __crc32cb(h, w);
+}
+MICRO_OP static u32 HostCrc32w(u32 h, u64 w) {
+  return __crc32ch(h, w);
+}
+MICRO_OP static u32 HostCrc32l(u32 h, u64 w) {
+  return __crc32cw(h, w);
+}
+MICRO_OP static u32 HostCrc32q(u32 h, u64 w) {
+  return __crc32cd(h, w);
+}
+#else
+static bool HasHostCrc32(void) {
+  return false;
+}
+#endif
+
+#if X86_INTRINSICS || ARM_CRC32
+static u32 (*const kHostCrc32[4])(u32, u64) = {
+    HostCrc32b,
+    HostCrc32w,
+    HostCrc32l,
+    HostCrc32q,
+};
+#endif
+
 static u32 Castagnoli(u32 h, u64 w, long n) {
   long i;
   static int once;
+#if X86_INTRINSICS || ARM_CRC32
+  if (HasHostCrc32()) {
+    return kHostCrc32[bsr(n)](h, w);
+  }
+#endif
   if (!once) {
     InitializeCrc32(kCastagnoli, ReverseBits32(0x1edc6f41));
     once = 1;
@@ -63,12 +136,25 @@ static void OpCrc32(P) {
         Castagnoli(Get32(RegRexrReg(m, rde)),
                    ReadRegisterOrMemoryBW(rde, GetModrmReadBW(A)),
                    1 << RegLog2(rde)));
+#if X86_INTRINSICS || ARM_CRC32
+  if (IsMakingPath(m) && HasHostCrc32()) {
+    Jitter(A,
+           "B"       // res0 = GetRegOrMem(RexbRm)
+           "r0s1="   // sav1 = res0
+           "z2A"     // res0 = GetReg[force32bit](RexrReg)
+           "s1a1="   // arg1 = sav1
+           "t"       // arg0 = res0
+           "m"       // res0 = HostCrc32(arg0, arg1)
+           "r0z2C",  // PutReg[force32bit](RexrReg, res0)
+           kHostCrc32[RegLog2(rde)]);
+  }
+#endif
 }
 
 void Op2f01(P) {
   if (!Rep(rde) && !Osz(rde)) {
     OpUdImpl(m);  // TODO: movbe
-  } else if (Rep(rde) == 2 && !Osz(rde)) {
+  } else if (Rep(rde) == 2) {
     OpCrc32(A);
   } else {
     OpUdImpl(m);
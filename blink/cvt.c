@@ -51,40 +51,38 @@ static double SseRoundDouble(struct Machine *m, double x) {
   }
 }
 
+// converts integral value to gpr the way the host would, where values
+// that are out of range or nan become the "integer indefinite" value
+static u64 SseToInt(u64 rde, double x) {
+  if (Rexw(rde)) {
+    return x >= -0x1p63 && x < 0x1p63 ? (i64)x : 0x8000000000000000;
+  } else {
+    return x >= -0x1p31 && x < 0x1p31 ? (u32)(i32)x : 0x80000000;
+  }
+}
+
 static void OpGdqpWssCvttss2si(P) {
-  i64 n;
   union FloatPun f;
   f.i = Read32(GetModrmRegisterXmmPointerRead4(A));
-  n = f.f;
-  if (!Rexw(rde)) n &= 0xffffffff;
-  Put64(RegRexrReg(m, rde), n);
+  Put64(RegRexrReg(m, rde), SseToInt(rde, truncf(f.f)));
 }
 
 static void OpGdqpWsdCvttsd2si(P) {
-  i64 n;
   union DoublePun d;
   d.i = Read64(GetModrmRegisterXmmPointerRead8(A));
-  n = d.f;
-  if (!Rexw(rde)) n &= 0xffffffff;
-  Put64(RegRexrReg(m, rde), n);
+  Put64(RegRexrReg(m, rde), SseToInt(rde, trunc(d.f)));
 }
 
 static void OpGdqpWssCvtss2si(P) {
-  i64 n;
   union FloatPun f;
   f.i = Read32(GetModrmRegisterXmmPointerRead4(A));
-  n = rintf(f.f);
-  if (!Rexw(rde)) n &= 0xffffffff;
-  Put64(RegRexrReg(m, rde), n);
+  Put64(RegRexrReg(m, rde), SseToInt(rde, SseRoundDouble(m, f.f)));
 }
 
 static void OpGdqpWsdCvtsd2si(P) {
-  i64 n;
   union DoublePun d;
   d.i = Read64(GetModrmRegisterXmmPointerRead8(A));
-  n = SseRoundDouble(m, d.f);
-  if (!Rexw(rde)) n &= 0xffffffff;
-  Put64(RegRexrReg(m, rde), n);
+  Put64(RegRexrReg(m, rde), SseToInt(rde, SseRoundDouble(m, d.f)));
 }
 
 static void OpVssEdqpCvtsi2ss(P) {
@@ -93,7 +91,7 @@ static void OpVssEdqpCvtsi2ss(P) {
     i64 n = Read64(GetModrmRegisterWordPointerRead8(A));
     f.f = n;
     Put32(XmmRexrReg(m, rde), f.i);
-    if (IsMakingPath(m)) {
+    if (IsMakingPath(m) && !JitSseCvt(A)) {
       Jitter(A,
              "z3B"    // res0 = GetRegOrMem[force64bit](RexbRm)
              "a2i"    // arg2 = RexrReg(rde)
@@ -106,7 +104,7 @@ static void OpVssEdqpCvtsi2ss(P) {
     i32 n = Read32(GetModrmRegisterWordPointerRead4(A));
     f.f = n;
     Put32(XmmRexrReg(m, rde), f.i);
-    if (IsMakingPath(m)) {
+    if (IsMakingPath(m) && !JitSseCvt(A)) {
       Jitter(A,
              "z2B"    // res0 = GetRegOrMem[force32bit](RexbRm)
              "a2i"    // arg2 = RexrReg(rde)
@@ -123,7 +121,7 @@ static void OpVsdEdqpCvtsi2sd(P) {
   if (Rexw(rde)) {
     d.f = (i64)Read64(GetModrmRegisterWordPointerRead8(A));
     Put64(XmmRexrReg(m, rde), d.i);
-    if (IsMakingPath(m)) {
+    if (IsMakingPath(m) && !JitSseCvt(A)) {
       Jitter(A,
              "z3B"    // res0 = GetRegOrMem[force64bit](RexbRm)
              "a2i"    // arg2 = RexrReg(rde)
@@ -135,7 +133,7 @@ static void OpVsdEdqpCvtsi2sd(P) {
   } else {
     d.f = (i32)Read32(GetModrmRegisterWordPointerRead4(A));
     Put64(XmmRexrReg(m, rde), d.i);
-    if (IsMakingPath(m)) {
+    if (IsMakingPath(m) && !JitSseCvt(A)) {
       Jitter(A,
              "z2B"    // res0 = GetRegOrMem[force32bit](RexbRm)
              "a2i"    // arg2 = RexrReg(rde)
@@ -264,6 +262,7 @@ static void OpVpsWpdCvtpd2ps(P) {
   f[1].f = d[1].f;
   Put32(XmmRexrReg(m, rde) + 0, f[0].i);
   Put32(XmmRexrReg(m, rde) + 4, f[1].i);
+  Put64(XmmRexrReg(m, rde) + 8, 0);
 }
 
 static void OpVssWsdCvtsd2ss(P) {
@@ -376,6 +375,7 @@ static void OpVdqWpdCvttpd2dq(P) {
   n[1] = d[1].f;
   Put32(XmmRexrReg(m, rde) + 0, n[0]);
   Put32(XmmRexrReg(m, rde) + 4, n[1]);
+  Put64(XmmRexrReg(m, rde) + 8, 0);
 }
 
 static void OpVdqWpdCvtpd2dq(P) {
@@ -389,6 +389,7 @@ static void OpVdqWpdCvtpd2dq(P) {
   for (i = 0; i < 2; ++i) n[i] = SseRoundDouble(m, d[i].f);
   Put32(XmmRexrReg(m, rde) + 0, n[0]);
   Put32(XmmRexrReg(m, rde) + 4, n[1]);
+  Put64(XmmRexrReg(m, rde) + 8, 0);
 }
 
 static void OpCvt(P, unsigned long op) {
@@ -452,10 +453,10 @@ static void OpCvt(P, unsigned long op) {
       OpVdqWpsCvttps2dq(A);
       break;
     case kOpCvt0fE6 + 1:
-      OpVdqWpdCvtpd2dq(A);
+      OpVdqWpdCvttpd2dq(A);
       break;
     case kOpCvt0fE6 + 2:
-      OpVdqWpdCvttpd2dq(A);
+      OpVdqWpdCvtpd2dq(A);
       break;
     case kOpCvt0fE6 + 3:
       OpVpdWdqCvtdq2pd(A);
@@ -464,6 +465,9 @@ static void OpCvt(P, unsigned long op) {
       OpUdImpl(m);
   }
   IGNORE_RACES_END();
+  if (op != kOpCvt0f2a && IsMakingPath(m)) {
+    JitSseCvt(A);
+  }
 }
 
 void OpCvt0f2a(P) {
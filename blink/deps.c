@@ -146,12 +146,8 @@ int GetFlagClobbers(u64 rde) {
     case 0x083:  // aluwireg
     case 0x084:  // alubtest
     case 0x085:  // aluwtest
-    case 0x0A6:  // cmps
-    case 0x0A7:  // cmps
     case 0x0A8:  // test %al  $ib
     case 0x0A9:  // test %rax $ivds
-    case 0x0AE:  // scas
-    case 0x0AF:  // scas
     case 0x069:  // imul
     case 0x06B:  // Imul
     case 0x1AF:  // imul
@@ -172,6 +168,16 @@ int GetFlagClobbers(u64 rde) {
     case 0x03F:  // aas
     case 0x0D5:  // aad
       return CF | ZF | SF | OF | AF | PF;
+    case 0x0A6:  // cmps
+    case 0x0A7:  // cmps
+    case 0x0AE:  // scas
+    case 0x0AF:  // scas
+      // a repeated string op with a zero count leaves flags untouched
+      if (Rep(rde)) {
+        return 0;
+      } else {
+        return CF | ZF | SF | OF | AF | PF;
+      }
     case 0x0C0:  // bsu $ib byte
     case 0x0C1:  // bsu $ib word
     case 0x0D0:  // bsu $1  byte
@@ -228,7 +234,16 @@ int GetFlagClobbers(u64 rde) {
         case 2:  // call *Ev
         case 3:  // callf *Ev
           return -1;
-        default:  // call, jmp, jmpf, push
+        case 4:  // jmp *Ev
+          // indirect jumps are tail calls, plt stubs, and switch or
+          // computed goto dispatch; flags aren't live across them in
+          // compiled code, so treat them like the call and ret above
+          if (Rep(rde)) {
+            return 0;
+          } else {
+            return -1;
+          }
+        default:  // jmpf, push
           return 0;
       }
     case 0x1A3:  // bit bt
@@ -392,8 +407,10 @@ int GetFlagDeps(u64 rde) {
       }
     case 0x09F:  // lahf
       return CF | ZF | SF | AF | PF;
+    case 0x027:  // daa
     case 0x02F:  // das
     case 0x037:  // aaa
+    case 0x03F:  // aas
       return CF | AF;
     case 0x09C:  // pushf
       return 0x00ffffff;
@@ -458,6 +475,7 @@ int ClassifyOp(u64 rde) {
     case 0x18D:  // OpJge
     case 0x18E:  // OpJle
     case 0x18F:  // OpJg
+    case 0x700:  // OpNative
       return kOpBranching;
     case 0x0FF:  // Op0ff
       switch (ModrmReg(rde)) {
@@ -469,25 +487,19 @@ int ClassifyOp(u64 rde) {
         default:
           return kOpNormal;
       }
+    case 0x105:  // OpSyscall
+      // system calls end their path, which is completed before they're
+      // performed, so clone() can't fork a jit path under construction.
+      // see CompleteSyscallPath()
+      return kOpBranching;
     case 0x0F1:  // OpInterrupt1
     case 0x0CC:  // OpInterrupt3
     case 0x0CD:  // OpInterruptImm
-    case 0x105:  // OpSyscall
       // precious ops are excluded from jit pathmaking entirely. not
-      // doing this would be inviting disaster, since system calls and
-      // longjmp could do anything. for example, we don't want clone()
-      // to fork a jit path under construction.
+      // doing this would be inviting disaster, since interrupts and
+      // longjmp could do anything.
       return kOpPrecious;
     case 0x130:  // OpWrmsr
-    case 0x1A2:  // OpCpuid
       return kOpSerializing;
-    case 0x1AE:
-      switch (ModrmReg(rde)) {
-        case 5:  // lfence
-        case 6:  // mfence
-          return kOpSerializing;
-        default:
-          return kOpNormal;
-      }
   }
 }
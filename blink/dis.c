@@ -136,16 +136,7 @@ static char *DisCode(struct Dis *d, char *p, int err) {
   }
 }
 
-static char *DisLineCode(struct Dis *d, char *p, int err) {
-  int blen, plen;
-  if (0 <= d->addr && d->addr < 0x10fff0) {
-    plen = 2;
-    blen = 6;
-  } else {
-    blen = BYTELEN;
-    plen = PFIXLEN;
-  }
-  p = DisColumn(DisAddr(d, p), p, ADDRLEN);
+static char *DisHook(struct Dis *d, char *p) {
 #ifdef HAVE_JIT
   if (d->m && !IsJitDisabled(&d->m->system->jit)) {
     uintptr_t hook;
@@ -162,6 +153,18 @@ static char *DisLineCode(struct Dis *d, char *p, int err) {
 #else
   *p++ = ' ';  // no hook
 #endif
+  return p;
+}
+
+static char *DisLineCode(struct Dis *d, char *p, int err) {
+  int blen, plen;
+  if (0 <= d->addr && d->addr < 0x10fff0) {
+    plen = 2;
+    blen = 6;
+  } else {
+    blen = BYTELEN;
+    plen = PFIXLEN;
+  }
   if (!d->noraw) {
     p = DisColumn(DisRaw(d, p), p, plen * 2 + 1 + blen * 2);
   } else {
@@ -172,10 +175,10 @@ static char *DisLineCode(struct Dis *d, char *p, int err) {
   return p;
 }
 
-static char *DisLabel(struct Dis *d, char *p, const char *name) {
+static char *DisLabel(struct Dis *d, char *p, long sym) {
   p = DisColumn(DisAddr(d, p), p, ADDRLEN);
   p = HighStart(p, g_high.label);
-  p = Demangle(p, name, DIS_MAX_SYMBOL_LENGTH);
+  p = DisSymName(d, p, sym);
   p = HighEnd(p);
   *p++ = ':';
   *p = '\0';
@@ -218,7 +221,7 @@ static long DisAppendOpLines(struct Dis *d, struct Machine *m, i64 addr) {
       op.size = 0;
       op.active = true;
       d->addr = addr;
-      DisLabel(d, d->buf, d->syms.p[symbol].name);
+      DisLabel(d, d->buf, symbol);
       if (!(op.s = strdup(d->buf))) return -1;
       if (d->ops.i++ == d->ops.n) {
         d->ops.n = d->ops.i + (d->ops.i >> 1);
@@ -272,14 +275,135 @@ long Dis(struct Dis *d, struct Machine *m, i64 addr, i64 ip, int lines) {
   return 0;
 }
 
+// copies the instruction bytes at addr, returning how many are mapped
+static int DisReadCode(struct Machine *m, i64 addr, u8 b[15], int n) {
+  u8 *r;
+  int k;
+  if (!(r = LookupAddress(m, addr))) return 0;
+  k = MIN(n, 0x1000 - (addr & 0xfff));
+  memcpy(b, r, k);
+  if (k < n) {
+    if (!(r = LookupAddress(m, addr + k))) return k;
+    memcpy(b + k, r, n - k);
+  }
+  return n;
+}
+
+static struct DisCache *DisCacheSlot(struct Dis *d, i64 addr) {
+  return d->cache + ((u64)addr * 0x9e3779b97f4a7c15 >> 32) % kDisCacheSize;
+}
+
+// returns cached formatting of instruction at address if its bytes and
+// the way it'd be decoded still match what was there when it was made
+static struct DisCache *DisGetCache(struct Dis *d, struct Machine *m,
+                                    i64 addr) {
+  u8 b[15];
+  struct DisCache *c;
+  if (!d->cache) return 0;
+  c = DisCacheSlot(d, addr);
+  if (c->code && c->addr == addr && c->noraw == d->noraw &&
+      c->mode == m->mode.omode &&
+      DisReadCode(m, addr, b, c->size) == c->size &&
+      !memcmp(b, c->bytes, c->size)) {
+    return c;
+  }
+  return 0;
+}
+
+static void DisPutCache(struct Dis *d, struct Machine *m, i64 addr,
+                        const char *code) {
+  struct DisCache *c;
+  if (!d->cache &&
+      !(d->cache = (struct DisCache *)calloc(kDisCacheSize, sizeof(*c)))) {
+    return;
+  }
+  c = DisCacheSlot(d, addr);
+  free(c->code);
+  if (!(c->code = strdup(code))) return;
+  c->addr = addr;
+  c->noraw = d->noraw;
+  c->mode = m->mode.omode;
+  c->size = MIN(15, d->xedd->length);
+  memcpy(c->bytes, d->xedd->bytes, c->size);
+}
+
 const char *DisGetLine(struct Dis *d, struct Machine *m, int i) {
   int err;
+  char *p;
+  struct DisCache *c;
   if (i >= d->ops.i) return "";
   if (d->ops.p[i].s) return d->ops.p[i].s;
   unassert(d->ops.p[i].size <= 15);
-  err = GetInstruction(m, d->ops.p[i].addr, d->xedd);
   d->m = m;
   d->addr = d->ops.p[i].addr;
-  if (DisLineCode(d, d->buf, err) - d->buf >= (int)sizeof(d->buf)) Abort();
+  p = DisColumn(DisAddr(d, d->buf), d->buf, ADDRLEN);
+  p = DisHook(d, p);
+  if ((c = DisGetCache(d, m, d->addr))) {
+    if (p - d->buf + strlen(c->code) >= sizeof(d->buf)) Abort();
+    strcpy(p, c->code);
+    return d->buf;
+  }
+  err = GetInstruction(m, d->addr, d->xedd);
+  if (DisLineCode(d, p, err) - d->buf >= (int)sizeof(d->buf)) Abort();
+  if (!err) DisPutCache(d, m, d->addr, p);
   return d->buf;
 }
+
+/**
+ * Disassembles a whole range of code that's already in host memory.
+ *
+ * This is intended for tools that want to print entire sections, so
+ * rather than each instruction being fetched through a machine and
+ * formatted by itself, like Dis() does for the panel, instructions are
+ * decoded straight out of `code` while the symbol table is walked in
+ * step with them. Lines are formatted the same as DisGetLine(), with
+ * a label line preceding each instruction that begins a symbol.
+ *
+ * @param code points to the bytes which are loaded at `addr`
+ * @param mode is XED_MODE_LONG, XED_MODE_LEGACY, or XED_MODE_REAL
+ * @param emit is called with each line, which is only valid until it
+ *     returns; its first argument is `arg`
+ * @return number of instructions that were decoded
+ */
+long DisRange(struct Dis *d, const u8 *code, size_t size, i64 addr, int mode,
+              void emit(void *, const char *), void *arg) {
+  char *p;
+  int err;
+  i64 end;
+  size_t i, n;
+  long l, r, k, count;
+  // find the first symbol that's at or after the start of the range
+  for (l = 0, r = d->syms.i; l < r;) {
+    k = (l + r) >> 1;
+    if (d->syms.p[k].addr < addr) {
+      l = k + 1;
+    } else {
+      r = k;
+    }
+  }
+  d->m = 0;
+  for (k = l, count = 0, i = 0; i < size; i += n, ++count) {
+    d->addr = addr + i;
+    end = addr + size;
+    while (k < d->syms.i && d->syms.p[k].addr < d->addr) ++k;
+    if (k < d->syms.i && d->syms.p[k].addr == d->addr) {
+      if (d->syms.p[k].name && *d->syms.p[k].name) {
+        DisLabel(d, d->buf, k);
+        emit(arg, d->buf);
+      }
+      // don't let an instruction run into whatever symbol comes next
+      if (d->syms.p[k].size && d->addr + d->syms.p[k].size < end) {
+        end = d->addr + d->syms.p[k].size;
+      }
+    }
+    n = MIN(15, end - d->addr);
+    err = DecodeInstruction(d->xedd, code + i, n, mode);
+    if (err) d->xedd->length = 1;
+    p = DisColumn(DisAddr(d, d->buf), d->buf, ADDRLEN);
+    *p++ = ' ';
+    if (DisLineCode(d, p, err) - d->buf >= (int)sizeof(d->buf)) Abort();
+    emit(arg, d->buf);
+    n = d->xedd->length;
+  }
+  return count;
+}
@@ -9,6 +9,8 @@
 
 #define DIS_MAX_SYMBOL_LENGTH 128
 
+#define kDisCacheSize 512
+
 struct DisOp {
   i64 addr;
   u8 size;
@@ -35,11 +37,13 @@ struct DisLoads {
 struct DisSym {
   i64 addr;
   char *name;
+  char *pretty; /* demangled name, computed on first use */
   int unique;
   int size;
   char rank;
   bool iscode;
   bool isabs;
+  bool isifunc;
 };
 
 struct DisSyms {
@@ -57,10 +61,20 @@ struct DisEdges {
   struct DisEdge *p;
 };
 
+struct DisCache {
+  i64 addr;
+  u8 size;
+  u8 mode;
+  bool noraw;
+  u8 bytes[15];
+  char *code;
+};
+
 struct Dis {
   bool notab;
   bool noraw;
   struct DisOps ops;
+  struct DisCache *cache; /* formatted instructions by address */
   struct DisLoads loads;
   struct DisSyms syms;
   struct DisEdges edges;
@@ -73,11 +87,15 @@ struct Dis {
 long Dis(struct Dis *, struct Machine *, i64, i64, int);
 long DisFind(struct Dis *, i64);
 void DisFree(struct Dis *);
+void DisFlushCache(struct Dis *);
 void DisFreeOp(struct DisOp *);
 void DisFreeOps(struct DisOps *);
 void DisLoadElf(struct Dis *, Elf64_Ehdr_ *, size_t, i64);
 long DisFindSym(struct Dis *, i64);
 long DisFindSymByName(struct Dis *, const char *);
+char *DisSymName(struct Dis *, char *, long);
+long DisRange(struct Dis *, const u8 *, size_t, i64, int,
+              void (*)(void *, const char *), void *);
 bool DisIsText(struct Dis *, i64);
 bool DisIsProg(struct Dis *, i64);
 char *DisInst(struct Dis *, char *, const char *);
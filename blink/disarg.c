@@ -117,10 +117,8 @@ static char *DisInt(char *p, i64 x) {
 
 static char *DisSymImpl(struct Dis *d, char *p, i64 x, long sym) {
   i64 addend;
-  const char *name;
   addend = x - d->syms.p[sym].addr;
-  name = d->syms.p[sym].name;
-  p = Demangle(p, name, DIS_MAX_SYMBOL_LENGTH);
+  p = DisSymName(d, p, sym);
   if (addend) {
     *p++ = '+';
     p = DisInt(p, addend);
@@ -503,6 +501,7 @@ static char *DisBBb(struct Dis *d, u64 rde, char *p) {
 static char *DisXmm(struct Dis *d, u64 rde, char *p, const char *s, int reg) {
   p = HighStart(p, g_high.reg);
   *p++ = '%';
+  if (*s == 'x' && Vex(rde) && Ymm(rde)) *p++ = 'y', ++s;
   p = stpcpy(p, s);
   p += snprintf(p, 32, "%u", reg);
   p = HighEnd(p);
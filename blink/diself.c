@@ -71,7 +71,7 @@ static void DisLoadElfSyms(struct Dis *d, Elf64_Ehdr_ *ehdr, size_t esize,
   char *stab;
   i64 stablen;
   const Elf64_Sym_ *st;
-  bool isabs, isweak, islocal, isprotected, isfunc, isobject;
+  bool isabs, isweak, islocal, isprotected, isfunc, isifunc, isobject;
   if ((stab = GetElfStringTable(ehdr, esize))) {
     if ((st = GetElfSymbolTable(ehdr, esize, &n))) {
       stablen = (uintptr_t)ehdr + esize - (uintptr_t)stab;
@@ -89,7 +89,8 @@ static void DisLoadElfSyms(struct Dis *d, Elf64_Ehdr_ *ehdr, size_t esize,
         isweak = ELF64_ST_BIND_(st[i].info) == STB_WEAK_;
         islocal = ELF64_ST_BIND_(st[i].info) == STB_LOCAL_;
         isprotected = st[i].other == STV_PROTECTED_;
-        isfunc = ELF64_ST_TYPE_(st[i].info) == STT_FUNC_;
+        isifunc = ELF64_ST_TYPE_(st[i].info) == STT_GNU_IFUNC_;
+        isfunc = ELF64_ST_TYPE_(st[i].info) == STT_FUNC_ || isifunc;
         isobject = ELF64_ST_TYPE_(st[i].info) == STT_OBJECT_;
         if (d->syms.i == d->syms.n) {
           d->syms.n += 2;
@@ -100,12 +101,14 @@ static void DisLoadElfSyms(struct Dis *d, Elf64_Ehdr_ *ehdr, size_t esize,
         d->syms.p[d->syms.i].unique = i;
         d->syms.p[d->syms.i].size = Read64(st[i].size);
         unassert(d->syms.p[d->syms.i].name = strdup(stab + Read32(st[i].name)));
+        d->syms.p[d->syms.i].pretty = 0;
         d->syms.p[d->syms.i].addr = Read64(st[i].value) + eskew;
         d->syms.p[d->syms.i].rank =
             -islocal + -isweak + -isabs + isprotected + isobject + isfunc;
         d->syms.p[d->syms.i].iscode =
             DisIsText(d, Read64(st[i].value)) ? !isobject : isfunc;
         d->syms.p[d->syms.i].isabs = isabs;
+        d->syms.p[d->syms.i].isifunc = isifunc;
         ++d->syms.i;
       }
     } else {
@@ -180,7 +183,31 @@ long DisFindSymByName(struct Dis *d, const char *s) {
   return -1;
 }
 
+/**
+ * Copies demangled name of symbol.
+ *
+ * Demangling a C++ symbol means a round trip through a c++filt pipe,
+ * so the result is remembered for as long as the symbol table lives,
+ * since disassembling a large program names the same callees often.
+ *
+ * @param p is output buffer having at least DIS_MAX_SYMBOL_LENGTH bytes
+ * @param i is index of symbol in `d->syms`
+ * @return pointer to NUL byte, cf. stpcpy()
+ */
+char *DisSymName(struct Dis *d, char *p, long i) {
+  char buf[DIS_MAX_SYMBOL_LENGTH];
+  struct DisSym *s = d->syms.p + i;
+  if (!s->pretty) {
+    Demangle(buf, s->name, sizeof(buf));
+    if (!(s->pretty = strdup(buf))) {
+      return Demangle(p, s->name, DIS_MAX_SYMBOL_LENGTH);
+    }
+  }
+  return stpcpy(p, s->pretty);
+}
+
 void DisLoadElf(struct Dis *d, Elf64_Ehdr_ *ehdr, size_t esize, i64 eskew) {
+  DisFlushCache(d);
   DisLoadElfLoads(d, ehdr, esize, eskew);
   DisLoadElfSyms(d, ehdr, esize, eskew);
   DisSortSyms(d);
@@ -38,12 +38,24 @@ void DisFreeSyms(struct DisSyms *syms) {
   long i;
   for (i = 0; i < syms->i; ++i) {
     free(syms->p[i].name);
+    free(syms->p[i].pretty);
   }
   free(syms->p);
   memset(syms, 0, sizeof(*syms));
 }
 
+void DisFlushCache(struct Dis *d) {
+  long i;
+  if (!d->cache) return;
+  for (i = 0; i < kDisCacheSize; ++i) {
+    free(d->cache[i].code);
+  }
+  free(d->cache);
+  d->cache = 0;
+}
+
 void DisFree(struct Dis *d) {
+  DisFlushCache(d);
   DisFreeOps(&d->ops);
   DisFreeSyms(&d->syms);
   free(d->edges.p);
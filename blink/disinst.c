@@ -88,6 +88,7 @@ static char *DisName(struct Dis *d, char *bp, const char *name,
   rde = d->xedd->op.rde;
   if (Lock(d->xedd->op.rde)) p = stpcpy(p, "lock ");
   p = DisRepPrefix(d, p);
+  if (Vex(rde) && Mopcode(rde) < 0x2F0) *p++ = 'v';  // avx
   if (strcmp(name, "BIT") == 0) {
     p = stpcpy(p, kBitOp[ModrmReg(rde)]);
   } else if (strcmp(name, "nop") == 0 && Rep(d->xedd->op.rde)) {
@@ -84,6 +84,21 @@ char *DisOpVpsWpsVssWssVpdWpdVsdWsd(struct XedDecodedInst *x, char *p,
   return p;
 }
 
+char *DisOpVfma(struct XedDecodedInst *x, char *p) {
+  static const char kName[][9] = {"fmaddsub", "fmsubadd", "fmadd", "fmadd",
+                                  "fmsub",    "fmsub",    "fnmadd", "fnmadd",
+                                  "fnmsub",   "fnmsub"};
+  static const char kOrder[][4] = {"132", "213", "231"};
+  int op = Opcode(x->op.rde);
+  char *q = stpcpy(stpcpy(p, kName[(op & 15) - 6]), kOrder[(op >> 4) - 9]);
+  if ((op & 15) >= 9 && (op & 1)) {
+    stpcpy(q, Rexw(x->op.rde) ? "sd %Vsd Wsd" : "ss %Vss Wss");
+  } else {
+    stpcpy(q, Rexw(x->op.rde) ? "pd %Vpd Wpd" : "ps %Vps Wps");
+  }
+  return p;
+}
+
 const char *DisSpecFpu0(struct XedDecodedInst *x, int group) {
   const char *s;
   s = kFpuName[group][ModrmRm(x->op.rde)];
@@ -1209,6 +1224,7 @@ const char *DisSpecMap2(struct XedDecodedInst *x, char *p) {
     RCASE(0x0A, DisOpPqQqVdqWdq(x, p, "psignd"));
     RCASE(0x0B, DisOpPqQqVdqWdq(x, p, "pmulhrsw"));
     RCASE(0x10, "pblendvb %Vdq Wdq");
+    RCASE(0x13, "cvtph2ps %Vps Wq");
     RCASE(0x14, "blendvps Vps Wps");
     RCASE(0x15, "blendvpd Vpd Wpd");
     RCASE(0x17, "ptest %Vdq Wdq");
@@ -1244,6 +1260,21 @@ const char *DisSpecMap2(struct XedDecodedInst *x, char *p) {
     RCASE(0x41, "phminposuw %Vdq Wdq");
     RCASE(0x80, "invept %Gq Mdq");
     RCASE(0x81, "invvpid %Gq Mdq");
+    case 0x96 ... 0x9F:
+    case 0xA6 ... 0xAF:
+    case 0xB6 ... 0xBF:
+      return DisOpVfma(x, p);
+    RCASE(0xC8, "sha1nexte %Vdq Wdq");
+    RCASE(0xC9, "sha1msg1 %Vdq Wdq");
+    RCASE(0xCA, "sha1msg2 %Vdq Wdq");
+    RCASE(0xCB, "sha256rnds2 %Vdq Wdq");
+    RCASE(0xCC, "sha256msg1 %Vdq Wdq");
+    RCASE(0xCD, "sha256msg2 %Vdq Wdq");
+    RCASE(0xDB, "aesimc %Vdq Wdq");
+    RCASE(0xDC, "aesenc %Vdq Wdq");
+    RCASE(0xDD, "aesenclast %Vdq Wdq");
+    RCASE(0xDE, "aesdec %Vdq Wdq");
+    RCASE(0xDF, "aesdeclast %Vdq Wdq");
     case 0xF0:
       if (Rep(x->op.rde) == 2) {
         return "crc32 %Gvqp Eb";
@@ -1296,6 +1327,9 @@ const char *DisSpecMap2(struct XedDecodedInst *x, char *p) {
 const char *DisSpecMap3(struct XedDecodedInst *x, char *p) {
   switch (Opcode(x->op.rde)) {
     RCASE(0x0F, DisOpPqQqIbVdqWdqIb(x, p, "palignr"));
+    RCASE(0x1D, "cvtps2ph Wq %Vps Ib");
+    RCASE(0xCC, "sha1rnds4 %Vdq Wdq Ib");
+    RCASE(0xDF, "aeskeygenassist %Vdq Wdq Ib");
     RCASE(0xF0, "rorx %Gdqp Edqp Ib");
     case 0x44:  // pclmulqdq
       if (Osz(x->op.rde)) {
@@ -17,9 +17,11 @@
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include <limits.h>
+#include <stdbool.h>
 
 #include "blink/alu.h"
 #include "blink/assert.h"
+#include "blink/bitscan.h"
 #include "blink/builtin.h"
 #include "blink/bus.h"
 #include "blink/endian.h"
@@ -39,24 +41,6 @@ static inline struct Dubble DubbleNeg(struct Dubble x) {
   return d;
 }
 
-static inline struct Dubble DubbleShl(struct Dubble x) {
-  struct Dubble d;
-  d.lo = x.lo << 1;
-  d.hi = x.hi << 1 | x.lo >> 63;
-  return d;
-}
-
-static inline struct Dubble DubbleShr(struct Dubble x) {
-  struct Dubble d;
-  d.lo = x.lo >> 1 | x.hi << 63;
-  d.hi = x.hi >> 1;
-  return d;
-}
-
-static inline unsigned DubbleLte(struct Dubble a, struct Dubble b) {
-  return a.hi == b.hi ? a.lo <= b.lo : a.hi <= b.hi;
-}
-
 static struct Dubble DubbleMul(u64 a, u64 b) {
   u64 x, y, t;
   struct Dubble d;
@@ -86,40 +70,46 @@ static struct Dubble DubbleImul(u64 a, u64 b) {
   return s ^ t ? DubbleNeg(p) : p;
 }
 
-static struct Dubble DubbleDiv(struct Dubble a, u64 b, u64 *r) {
-  u64 s;
-  int n, c;
-  struct Dubble d, q, t;
-  d.lo = b, d.hi = 0;
-  q.lo = 0, q.hi = 0;
-  for (n = 0; DubbleLte(d, a) && n < 128; ++n) {
-    d = DubbleShl(d);
+// divides hi:lo by y, where hi < y so the quotient fits in 64 bits
+static u64 Udiv128(u64 hi, u64 lo, u64 y, u64 *r) {
+#if defined(__x86_64__) && defined(__GNUC__)
+  u64 q;
+  asm("divq\t%4" : "=a"(q), "=d"(*r) : "0"(lo), "1"(hi), "rm"(y));
+  return q;
+#else
+  // hacker's delight divlu(), which uses two 64-by-32 divisions rather
+  // than the 128-by-128 library routine a compiler would otherwise call
+  int s;
+  u64 b = (u64)1 << 32;
+  u64 yn1, yn0, un32, un21, un10, un1, un0, q1, q0, rhat;
+  if (!hi) {
+    *r = lo % y;
+    return lo / y;
   }
-  for (; n > 0; --n) {
-    t = a;
-    d = DubbleShr(d);
-    q = DubbleShl(q);
-    s = a.lo, a.lo -= d.lo + 0, c = a.lo > s;
-    s = a.hi, a.hi -= d.hi + c, c = a.hi > s;
-    if (c) {
-      a = t;
-    } else {
-      q.lo++;
-    }
+  s = bsr(y) ^ 63;
+  y <<= s;
+  yn1 = y >> 32;
+  yn0 = y & 0xffffffff;
+  un32 = s ? hi << s | lo >> (64 - s) : hi;
+  un10 = lo << s;
+  un1 = un10 >> 32;
+  un0 = un10 & 0xffffffff;
+  q1 = un32 / yn1;
+  rhat = un32 - q1 * yn1;
+  while (q1 >= b || q1 * yn0 > b * rhat + un1) {
+    --q1;
+    if ((rhat += yn1) >= b) break;
   }
-  *r = a.lo;
-  return q;
-}
-
-static struct Dubble DubbleIdiv(struct Dubble a, u64 b, u64 *r) {
-  unsigned s, t;
-  struct Dubble q;
-  if ((s = a.hi >> 63)) a = DubbleNeg(a);
-  if ((t = b >> 63)) b = -b;
-  q = DubbleDiv(a, b, r);
-  if (s ^ t) q = DubbleNeg(q);
-  if (s) *r = -*r;
-  return q;
+  un21 = un32 * b + un1 - q1 * y;
+  q0 = un21 / yn1;
+  rhat = un21 - q0 * yn1;
+  while (q0 >= b || q0 * yn0 > b * rhat + un0) {
+    --q0;
+    if ((rhat += yn1) >= b) break;
+  }
+  *r = (un21 * b + un0 - q0 * y) >> s;
+  return q1 * b + q0;
+#endif
 }
 
 void OpDivAlAhAxEbSigned(P) {
@@ -149,46 +139,37 @@ void OpDivAlAhAxEbUnsigned(P) {
   m->ah = r & 0xff;
 }
 
-static void OpDivRdxRaxEvqpSigned64(P, u8 *p) {
-#ifdef HAVE_INT128
-  i64 y, r;
-  __int128 x, q;
-  x = (unsigned __int128)Get64(m->dx) << 64 | Get64(m->ax);
-  y = Load64(p);
+static void OpDivRdxRaxEvqpSigned64(struct Machine *m, u64 y) {
+  bool neg;
+  u64 hi, lo, q, r;
+  lo = Get64(m->ax);
+  hi = Get64(m->dx);
   if (!y) RaiseDivideError(m);
-  if (x == (unsigned __int128)UINT64_C(0x8000000000000000) << 64) {
-    RaiseDivideError(m);
+  if (hi == (u64)((i64)lo >> 63)) {
+    // dividend is just rax sign extended, e.g. by cqo
+    if ((i64)lo == INT64_MIN && (i64)y == -1) RaiseDivideError(m);
+    Put64(m->ax, (i64)lo / (i64)y);
+    Put64(m->dx, (i64)lo % (i64)y);
+    return;
   }
-  q = x / y;
-  r = x % y;
-  if (q != (i64)q) RaiseDivideError(m);
-  Put64(m->ax, q);
-  Put64(m->dx, r);
-#else
-  u64 d, r;
-  struct Dubble q;
-  q.lo = Get64(m->ax);
-  q.hi = Get64(m->dx);
-  d = Load64(p);
-  if (!d) RaiseDivideError(m);
-  if (!q.lo && q.hi == 0x8000000000000000) RaiseDivideError(m);
-  q = DubbleIdiv(q, d, &r);
-  if ((i64)q.lo < 0 && (i64)q.hi != -1) RaiseDivideError(m);
-  if ((i64)q.lo >= 0 && q.hi) RaiseDivideError(m);
-  Put64(m->ax, q.lo);
-  Put64(m->dx, r);
-#endif
+  neg = (hi ^ y) >> 63;
+  if ((i64)hi < 0) hi = ~hi + !(lo = -lo);
+  if ((i64)y < 0) y = -y;
+  if (hi >= y) RaiseDivideError(m);
+  q = Udiv128(hi, lo, y, &r);
+  if (q > (u64)INT64_MAX + neg) RaiseDivideError(m);
+  Put64(m->ax, neg ? -q : q);
+  Put64(m->dx, (i64)Get64(m->dx) < 0 ? -r : r);
 }
 
-static void OpDivRdxRaxEvqpSigned32(P, u8 *p) {
-  i32 y, r;
+static void OpDivRdxRaxEvqpSigned32(struct Machine *m, u64 y) {
+  i32 d, r;
   i64 x, q;
   x = (u64)Get32(m->dx) << 32 | Get32(m->ax);
-  y = Load32(p);
-  if (!y) RaiseDivideError(m);
+  if (!(d = y)) RaiseDivideError(m);
   if (x == INT64_MIN) RaiseDivideError(m);
-  q = x / y;
-  r = x % y;
+  q = x / d;
+  r = x % d;
   if (q != (i32)q) RaiseDivideError(m);
   Put64(m->ax, (u32)q);
   Put64(m->dx, (u32)r);
@@ -221,65 +202,65 @@ static void OpDivRdxRaxEvqpUnsigned16(P, u8 *p) {
   Put16(m->dx, r);
 }
 
-static void OpDivRdxRaxEvqpUnsigned32(P, u8 *p) {
-  u32 y, r;
+static void OpDivRdxRaxEvqpUnsigned32(struct Machine *m, u64 y) {
+  u32 d;
   u64 x, q;
   x = (u64)Get32(m->dx) << 32 | Get32(m->ax);
-  y = Load32(p);
-  if (!y) RaiseDivideError(m);
-  q = x / y;
-  r = x % y;
+  if (!(d = y)) RaiseDivideError(m);
+  q = x / d;
   if (q > UINT32_MAX) RaiseDivideError(m);
   Put64(m->ax, (u32)q);
-  Put64(m->dx, (u32)r);
+  Put64(m->dx, (u32)(x % d));
 }
 
-static void OpDivRdxRaxEvqpUnsigned64(P, u8 *p) {
-#ifdef HAVE_INT128
-  u64 y, r;
-  unsigned __int128 x, q;
-  x = (unsigned __int128)Get64(m->dx) << 64 | Get64(m->ax);
-  y = Load64(p);
-  if (!y) RaiseDivideError(m);
-  q = x / y;
-  r = x % y;
-  if (q > UINT64_MAX) RaiseDivideError(m);
+static void OpDivRdxRaxEvqpUnsigned64(struct Machine *m, u64 y) {
+  u64 q, r, hi = Get64(m->dx);
+  // also catches division by zero
+  if (hi >= y) RaiseDivideError(m);
+  q = Udiv128(hi, Get64(m->ax), y, &r);
   Put64(m->ax, q);
   Put64(m->dx, r);
-#else
-  u64 d, r;
-  struct Dubble q;
-  q.lo = Get64(m->ax);
-  q.hi = Get64(m->dx);
-  d = Load64(p);
-  if (!d) RaiseDivideError(m);
-  q = DubbleDiv(q, d, &r);
-  if (q.hi) RaiseDivideError(m);
-  Put64(m->ax, q.lo);
-  Put64(m->dx, r);
-#endif
 }
 
-void OpDivRdxRaxEvqpSigned(P) {
+// 64-bit and 32-bit divisions are compiled into direct calls, so paths
+// needn't decode their operand again through the generic op function
+static void OpDivRdxRaxEvqp(P, void div64(struct Machine *, u64),
+                            void div32(struct Machine *, u64),
+                            void div16(P, u8 *)) {
   u8 *p = GetModrmRegisterWordPointerReadOszRexw(A);
   if (Rexw(rde)) {
-    OpDivRdxRaxEvqpSigned64(A, p);
+    div64(m, Load64(p));
+    if (IsMakingPath(m)) {
+      Jitter(A,
+             "z3B"    // res0 = GetRegOrMem[force64bit](RexbRm)
+             "r0a1="  // arg1 = res0
+             "q"      // arg0 = sav0
+             "c",     // call function
+             div64);
+    }
   } else if (!Osz(rde)) {
-    OpDivRdxRaxEvqpSigned32(A, p);
+    div32(m, Load32(p));
+    if (IsMakingPath(m)) {
+      Jitter(A,
+             "z2B"    // res0 = GetRegOrMem[force32bit](RexbRm)
+             "r0a1="  // arg1 = res0
+             "q"      // arg0 = sav0
+             "c",     // call function
+             div32);
+    }
   } else {
-    OpDivRdxRaxEvqpSigned16(A, p);
+    div16(A, p);
   }
 }
 
+void OpDivRdxRaxEvqpSigned(P) {
+  OpDivRdxRaxEvqp(A, OpDivRdxRaxEvqpSigned64, OpDivRdxRaxEvqpSigned32,
+                  OpDivRdxRaxEvqpSigned16);
+}
+
 void OpDivRdxRaxEvqpUnsigned(P) {
-  u8 *p = GetModrmRegisterWordPointerReadOszRexw(A);
-  if (Rexw(rde)) {
-    OpDivRdxRaxEvqpUnsigned64(A, p);
-  } else if (!Osz(rde)) {
-    OpDivRdxRaxEvqpUnsigned32(A, p);
-  } else {
-    OpDivRdxRaxEvqpUnsigned16(A, p);
-  }
+  OpDivRdxRaxEvqp(A, OpDivRdxRaxEvqpUnsigned64, OpDivRdxRaxEvqpUnsigned32,
+                  OpDivRdxRaxEvqpUnsigned16);
 }
 
 void OpMulAxAlEbSigned(P) {
@@ -327,12 +308,21 @@ void OpMulRdxRaxEvqpSigned(P) {
   if (Rexw(rde)) {
     OpMulRdxRaxEvqpSigned64(m, Load64(p));
     if (IsMakingPath(m)) {
+#ifdef HAVE_INT128
+      Jitter(A,
+             "z3B"    // res0 = GetRegOrMem[force64bit](RexbRm)
+             "s0a1="  // arg1 = machine
+             "t"      // arg0 = res0
+             "m",     // call micro-op
+             ImulAxDx);
+#else
       Jitter(A,
              "B"      // res0 = GetRegOrMem(RexbRm)
              "r0a1="  // arg1 = res0
              "q"      // arg0 = sav0
              "c",     // call function
              OpMulRdxRaxEvqpSigned64);
+#endif
     }
   } else if (!Osz(rde)) {
     i64 edxeax = (i64)(i32)Get32(m->ax) * (i32)Load32(p);
@@ -341,6 +331,14 @@ void OpMulRdxRaxEvqpSigned(P) {
     Put64(m->dx, edxeax >> 32);
     m->flags = SetFlag(m->flags, FLAGS_CF, of);
     m->flags = SetFlag(m->flags, FLAGS_OF, of);
+    if (IsMakingPath(m)) {
+      Jitter(A,
+             "z2B"    // res0 = GetRegOrMem[force32bit](RexbRm)
+             "s0a1="  // arg1 = machine
+             "t"      // arg0 = res0
+             "m",     // call micro-op
+             ImulEaxEdx);
+    }
   } else {
     i32 dxax = (i32)(i16)Get16(m->ax) * (i16)Load16(p);
     unsigned of = dxax != (i16)dxax;
@@ -407,11 +405,11 @@ void OpMulRdxRaxEvqpUnsigned(P) {
     OpMulRdxRaxEvqpUnsigned32(m, Load32(p));
     if (IsMakingPath(m)) {
       Jitter(A,
-             "B"      // res0 = GetRegOrMem(RexbRm)
-             "r0a1="  // arg1 = res0
-             "q"      // arg0 = sav0
-             "c",     // call function
-             OpMulRdxRaxEvqpUnsigned32);
+             "z2B"    // res0 = GetRegOrMem[force32bit](RexbRm)
+             "s0a1="  // arg1 = machine
+             "t"      // arg0 = res0
+             "m",     // call micro-op
+             MulEaxEdx);
     }
   } else {
     dxax = (u32)(u16)Get16(m->ax) * (u16)Load16(p);
@@ -124,6 +124,26 @@ long exdev(void) {
   return ReturnErrno(EXDEV);
 }
 
+long espipe(void) {
+  return ReturnErrno(ESPIPE);
+}
+
+long ebusy(void) {
+  return ReturnErrno(EBUSY);
+}
+
+long enotty(void) {
+  return ReturnErrno(ENOTTY);
+}
+
 long enametoolong(void) {
   return ReturnErrno(ENAMETOOLONG);
 }
+
+long edeadlk(void) {
+  return ReturnErrno(EDEADLK);
+}
+
+long erofs(void) {
+  return ReturnErrno(EROFS);
+}
@@ -25,6 +25,11 @@ long eisdir(void);
 long eexist(void);
 long eloop(void);
 long exdev(void);
+long espipe(void);
+long ebusy(void);
+long enotty(void);
 long enametoolong(void);
+long edeadlk(void);
+long erofs(void);
 
 #endif /* BLINK_ERRNO_H_ */
@@ -0,0 +1,158 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/etrace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/endian.h"
+#include "blink/flag.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/map.h"
+#include "blink/tunables.h"
+#include "blink/util.h"
+
+/**
+ * @fileoverview Binary execution tracing.
+ *
+ * When BLINK_ETRACE is set, each jit path calls EtracePath() where it
+ * begins, and EtraceEdge() after each direct branch it follows, which
+ * put a 16-byte record in a ring belonging to the thread that ran it.
+ * The ring is a file which is mapped shared, so records reach the disk
+ * without any system calls, and the oldest ones are overwritten once it
+ * fills up, which keeps both the space and time spent on tracing within
+ * bounds for long runs, unlike LogCpu() which needs a special build and
+ * formats every instruction as text.
+ *
+ * When BLINK_ETRACE_REGS is also set, the general registers which have
+ * changed since the thread's previous record are written after it, so
+ * that the run may be compared against real hardware, block by block.
+ * Code that's only run by the interpreter isn't traced, so this needs
+ * the JIT. Forked children write files of their own, under their tid.
+ */
+
+struct EtraceRing {
+  struct EtraceHeader *map;   // thread's file, which begins with header
+  struct EtraceRecord *recs;  // ring of records which follows the header
+  u64 regs[16];               // registers as of previous record
+};
+
+static u64 ReadTick(void) {
+#if defined(__GNUC__) && defined(__aarch64__)
+  u64 c;
+  asm volatile("mrs %0, cntvct_el0" : "=r"(c));
+  return c;
+#elif defined(__GNUC__) && defined(__x86_64__)
+  u32 ax, dx;
+  asm volatile("rdtsc" : "=a"(ax), "=d"(dx));
+  return (u64)dx << 32 | ax;
+#else
+  return 0;
+#endif
+}
+
+static size_t GetEtraceSize(void) {
+  return sizeof(struct EtraceHeader) +
+         (size_t)kEtraceRecords * sizeof(struct EtraceRecord);
+}
+
+// maps thread's ring file, or anonymous memory if that can't be done,
+// so the guest can keep running while the problem is logged just once
+static struct EtraceRing *OpenEtrace(struct Machine *m) {
+  int fd;
+  void *map;
+  size_t size;
+  struct EtraceRing *r;
+  char path[PATH_MAX];
+  if (!(r = (struct EtraceRing *)calloc(1, sizeof(*r)))) return 0;
+  size = GetEtraceSize();
+  snprintf(path, sizeof(path), "%s.%d", FLAG_etrace, m->tid);
+  if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) != -1 &&
+      ftruncate(fd, size) != -1) {
+    map = Mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0, "etrace");
+  } else {
+    map = MAP_FAILED;
+  }
+  if (map == MAP_FAILED) {
+    LOGF("%s: failed to map execution trace: %s", path,
+         DescribeHostErrno(errno));
+    map = Mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS_,
+               -1, 0, "etrace");
+  }
+  if (fd != -1) close(fd);
+  if (map == MAP_FAILED) {
+    free(r);
+    return 0;
+  }
+  r->map = (struct EtraceHeader *)map;
+  r->recs = (struct EtraceRecord *)(r->map + 1);
+  r->map->recsize = sizeof(struct EtraceRecord);
+  r->map->records = kEtraceRecords;
+  r->map->pid = m->system->pid;
+  r->map->tid = m->tid;
+  r->map->magic = kEtraceMagic;
+  return r;
+}
+
+static void PutEtrace(struct EtraceRing *r, int kind, i64 pc, u64 value) {
+  struct EtraceRecord *e;
+  e = r->recs + (r->map->head++ & (kEtraceRecords - 1));
+  e->what = (u64)kind << 56 | (pc & 0x00ffffffffffffff);
+  e->value = value;
+}
+
+static void RecordEtrace(struct Machine *m, int kind, i64 pc, u64 value) {
+  int i;
+  u64 x;
+  struct EtraceRing *r;
+  if (!(r = m->etrace) && !(r = m->etrace = OpenEtrace(m))) return;
+  PutEtrace(r, kind, pc, value);
+  if (FLAG_etraceregs) {
+    for (i = 0; i < 16; ++i) {
+      if ((x = Read64(m->weg[i])) != r->regs[i]) {
+        PutEtrace(r, kEtraceReg, i, x);
+        r->regs[i] = x;
+      }
+    }
+  }
+}
+
+// records that the thread is entering the jit path which begins at pc
+void EtracePath(struct Machine *m, i64 pc) {
+  RecordEtrace(m, kEtracePath, pc, ReadTick());
+}
+
+// records that a path kept going through the direct branch at `from`
+void EtraceEdge(struct Machine *m, i64 from, i64 pc) {
+  RecordEtrace(m, kEtraceEdge, pc, from);
+}
+
+void ForgetEtrace(struct Machine *m) {
+  if (!m->etrace) return;
+  unassert(!Munmap(m->etrace->map, GetEtraceSize()));
+  free(m->etrace);
+  m->etrace = 0;
+}
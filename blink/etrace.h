@@ -0,0 +1,35 @@
+#ifndef BLINK_ETRACE_H_
+#define BLINK_ETRACE_H_
+#include "blink/types.h"
+
+// BLINK_ETRACE files are named after the variable with the guest thread
+// id appended, and hold a 64-byte header followed by a ring of 16-byte
+// records, in host byte order, which are decoded by tool/etrace. Since
+// the files are shared mappings, nothing is lost if blink gets killed.
+#define kEtraceMagic 0x3145434152544500ull  // "\0ETRACE1" if little endian
+#define kEtracePath  1  // jit path was entered at pc; value is host tick
+#define kEtraceEdge  2  // path followed branch at value to pc
+#define kEtraceReg   3  // general register pc was changed to value
+
+struct EtraceHeader {
+  u64 magic;      // kEtraceMagic
+  u32 recsize;    // sizeof(struct EtraceRecord)
+  u32 records;    // capacity of ring, which is a power of two
+  i32 pid;        // process blink launched
+  i32 tid;        // guest thread that owns the file
+  u64 head;       // number of records ever written
+  u64 unused[4];  //
+};
+
+struct EtraceRecord {
+  u64 what;   // kind << 56 | pc & 0x00ffffffffffffff
+  u64 value;  // depends on kind
+};
+
+struct Machine;
+
+void EtracePath(struct Machine *, i64);
+void EtraceEdge(struct Machine *, i64, i64);
+void ForgetEtrace(struct Machine *);
+
+#endif /* BLINK_ETRACE_H_ */
@@ -0,0 +1,204 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/endian.h"
+#include "blink/errno.h"
+#include "blink/fds.h"
+#include "blink/linux.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/ndelay.h"
+#include "blink/syscall.h"
+#include "blink/thread.h"
+#include "blink/vfs.h"
+#include "blink/xlat.h"
+
+#ifdef HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+#ifdef HAVE_TIMERFD
+#include <sys/timerfd.h>
+#endif
+
+// eventfd() and timerfd_create() are handed straight to the host, so
+// guest event loops can read them and poll or epoll them natively. the
+// vfs wraps them like any other host file
+
+#if defined(HAVE_EVENTFD) || defined(HAVE_TIMERFD)
+static int AddEventFd(struct Machine *m, int fildes, int oflags, int lim) {
+  if (fildes != -1) {
+#ifndef DISABLE_VFS
+    if ((fildes = VfsAddHostFd(fildes)) == -1) return -1;
+#endif
+    if (fildes >= lim) {
+      VfsClose(fildes);
+      fildes = emfile();
+    } else {
+      LOCK(&m->system->fds.lock);
+      unassert(AddFd(&m->system->fds, fildes, O_RDWR | oflags));
+      UNLOCK(&m->system->fds.lock);
+    }
+  }
+  return fildes;
+}
+#endif
+
+#ifdef HAVE_EVENTFD
+int SysEventfd2(struct Machine *m, u32 initval, i32 flags) {
+  int lim, oflags, sysflags, supported;
+  supported = EFD_CLOEXEC_LINUX | EFD_NONBLOCK_LINUX | EFD_SEMAPHORE_LINUX;
+  if (flags & ~supported) {
+    LOGF("%s() unsupported flags: %d", "eventfd2", flags & ~supported);
+    return einval();
+  }
+  oflags = 0;
+  sysflags = 0;
+  if (flags & EFD_CLOEXEC_LINUX) {
+    oflags |= O_CLOEXEC;
+    sysflags |= EFD_CLOEXEC;
+  }
+  if (flags & EFD_NONBLOCK_LINUX) {
+    oflags |= O_NDELAY;
+    sysflags |= EFD_NONBLOCK;
+  }
+  if (flags & EFD_SEMAPHORE_LINUX) {
+    sysflags |= EFD_SEMAPHORE;
+  }
+  if (!(lim = GetFileDescriptorLimit(m->system))) return emfile();
+  return AddEventFd(m, eventfd(initval, sysflags), oflags, lim);
+}
+
+int SysEventfd(struct Machine *m, u32 initval) {
+  return SysEventfd2(m, initval, 0);
+}
+#endif /* HAVE_EVENTFD */
+
+#ifdef HAVE_TIMERFD
+
+int SysTimerfdCreate(struct Machine *m, i32 clock, i32 flags) {
+  clock_t sysclock;
+  int lim, oflags, sysflags, supported;
+  supported = TFD_CLOEXEC_LINUX | TFD_NONBLOCK_LINUX;
+  if (flags & ~supported) {
+    LOGF("%s() unsupported flags: %d", "timerfd_create", flags & ~supported);
+    return einval();
+  }
+  if (XlatClock(clock, &sysclock) == -1) return -1;
+  oflags = 0;
+  sysflags = 0;
+  if (flags & TFD_CLOEXEC_LINUX) {
+    oflags |= O_CLOEXEC;
+    sysflags |= TFD_CLOEXEC;
+  }
+  if (flags & TFD_NONBLOCK_LINUX) {
+    oflags |= O_NDELAY;
+    sysflags |= TFD_NONBLOCK;
+  }
+  if (!(lim = GetFileDescriptorLimit(m->system))) return emfile();
+  return AddEventFd(m, timerfd_create(sysclock, sysflags), oflags, lim);
+}
+
+static void XlatItimerspecToLinux(struct itimerspec_linux *dst,
+                                  const struct itimerspec *src) {
+  Write64(dst->interval.sec, src->it_interval.tv_sec);
+  Write64(dst->interval.nsec, src->it_interval.tv_nsec);
+  Write64(dst->value.sec, src->it_value.tv_sec);
+  Write64(dst->value.nsec, src->it_value.tv_nsec);
+}
+
+int SysTimerfdSettime(struct Machine *m, i32 fildes, i32 flags, i64 valueaddr,
+                      i64 oldvalueaddr) {
+  int rc, hostfd, sysflags;
+  struct itimerspec_linux gits;
+  struct itimerspec value, oldvalue;
+#ifndef DISABLE_VFS
+  struct VfsInfo *info;
+#endif
+  sysflags = 0;
+  if (flags & TFD_TIMER_ABSTIME_LINUX) {
+    sysflags |= TFD_TIMER_ABSTIME;
+    flags &= ~TFD_TIMER_ABSTIME_LINUX;
+  }
+#ifdef TFD_TIMER_CANCEL_ON_SET
+  if (flags & TFD_TIMER_CANCEL_ON_SET_LINUX) {
+    sysflags |= TFD_TIMER_CANCEL_ON_SET;
+    flags &= ~TFD_TIMER_CANCEL_ON_SET_LINUX;
+  }
+#endif
+  if (flags) {
+    LOGF("%s() unsupported flags: %d", "timerfd_settime", flags);
+    return einval();
+  }
+  if (CopyFromUserRead(m, &gits, valueaddr, sizeof(gits)) == -1) return -1;
+  if (oldvalueaddr &&
+      !IsValidMemory(m, oldvalueaddr, sizeof(gits), PROT_WRITE)) {
+    return efault();
+  }
+  value.it_interval.tv_sec = Read64(gits.interval.sec);
+  value.it_interval.tv_nsec = Read64(gits.interval.nsec);
+  value.it_value.tv_sec = Read64(gits.value.sec);
+  value.it_value.tv_nsec = Read64(gits.value.nsec);
+#ifndef DISABLE_VFS
+  if ((hostfd = VfsGetHostFd(fildes, &info)) == -1) return -1;
+#else
+  hostfd = fildes;
+#endif
+  if ((rc = timerfd_settime(hostfd, sysflags, &value, &oldvalue)) != -1 &&
+      oldvalueaddr) {
+    XlatItimerspecToLinux(&gits, &oldvalue);
+    unassert(!CopyToUserWrite(m, oldvalueaddr, &gits, sizeof(gits)));
+  }
+#ifndef DISABLE_VFS
+  unassert(!VfsFreeInfo(info));
+#endif
+  return rc;
+}
+
+int SysTimerfdGettime(struct Machine *m, i32 fildes, i64 valueaddr) {
+  int rc, hostfd;
+  struct itimerspec value;
+  struct itimerspec_linux gits;
+#ifndef DISABLE_VFS
+  struct VfsInfo *info;
+#endif
+  if (!IsValidMemory(m, valueaddr, sizeof(gits), PROT_WRITE)) {
+    return efault();
+  }
+#ifndef DISABLE_VFS
+  if ((hostfd = VfsGetHostFd(fildes, &info)) == -1) return -1;
+#else
+  hostfd = fildes;
+#endif
+  if ((rc = timerfd_gettime(hostfd, &value)) != -1) {
+    XlatItimerspecToLinux(&gits, &value);
+    unassert(!CopyToUserWrite(m, valueaddr, &gits, sizeof(gits)));
+  }
+#ifndef DISABLE_VFS
+  unassert(!VfsFreeInfo(info));
+#endif
+  return rc;
+}
+
+#endif /* HAVE_TIMERFD */
@@ -38,12 +38,29 @@
 
 void InitFds(struct Fds *fds) {
   fds->list = 0;
+  fds->table = 0;
+  fds->tablesize = 0;
   unassert(!pthread_mutex_init(&fds->lock, 0));
 }
 
+// grows the fildes index so it has a slot for fildes
+static bool ReserveFdSlot(struct Fds *fds, int fildes) {
+  int n;
+  struct Fd **p;
+  if (fildes < fds->tablesize) return true;
+  n = MAX(fds->tablesize, 64);
+  while (n <= fildes) n *= 2;
+  if (!(p = (struct Fd **)realloc(fds->table, n * sizeof(*p)))) return false;
+  memset(p + fds->tablesize, 0, (n - fds->tablesize) * sizeof(*p));
+  fds->table = p;
+  fds->tablesize = n;
+  return true;
+}
+
 struct Fd *AddFd(struct Fds *fds, int fildes, int oflags) {
   struct Fd *fd;
   if (fildes >= 0) {
+    if (!ReserveFdSlot(fds, fildes)) return 0;
     if ((fd = (struct Fd *)calloc(1, sizeof(*fd)))) {
       dll_init(&fd->elem);
       fd->cb = &kFdCbHost;
@@ -51,6 +68,7 @@ struct Fd *AddFd(struct Fds *fds, int fildes, int oflags) {
       fd->oflags = oflags;
       unassert(!pthread_mutex_init(&fd->lock, 0));
       dll_make_first(&fds->list, &fd->elem);
+      fds->table[fildes] = fd;
     }
     return fd;
   } else {
@@ -63,9 +81,12 @@ struct Fd *ForkFd(struct Fds *fds, struct Fd *fd, int fildes, int oflags) {
   struct Fd *fd2;
   if ((fd2 = AddFd(fds, fildes, oflags))) {
     if (fd) {
+      fd2->cb = fd->cb;
       fd2->path = fd->path ? strdup(fd->path) : 0;
       fd2->socktype = fd->socktype;
       fd2->norestart = fd->norestart;
+      fd2->growpipe = fd->growpipe;
+      fd2->dev = fd->dev;
       memcpy(&fd2->saddr, &fd->saddr, sizeof(fd->saddr));
     }
   }
@@ -73,25 +94,33 @@ struct Fd *ForkFd(struct Fds *fds, struct Fd *fd, int fildes, int oflags) {
 }
 
 struct Fd *GetFd(struct Fds *fds, int fildes) {
-  bool lru;
-  struct Dll *e;
-  if (fildes >= 0) {
-    lru = false;
-    for (e = dll_first(fds->list); e; e = dll_next(fds->list, e)) {
-      if (FD_CONTAINER(e)->fildes == fildes) {
-        if (lru) {
-          dll_remove(&fds->list, e);
-          dll_make_first(&fds->list, e);
-        }
-        return FD_CONTAINER(e);
-      }
-      lru = true;
-    }
+  struct Fd *fd;
+  if (0 <= fildes && fildes < fds->tablesize && (fd = fds->table[fildes])) {
+    return fd;
   }
   ebadf();
   return 0;
 }
 
+// removes fd from table without freeing it
+void RemoveFd(struct Fds *fds, struct Fd *fd) {
+  dll_remove(&fds->list, &fd->elem);
+  if (fd->fildes < fds->tablesize && fds->table[fd->fildes] == fd) {
+    fds->table[fd->fildes] = 0;
+  }
+}
+
+// hands every fd of src over to dst, e.g. across execve()
+void MoveFds(struct Fds *dst, struct Fds *src) {
+  free(dst->table);
+  dst->list = src->list;
+  dst->table = src->table;
+  dst->tablesize = src->tablesize;
+  src->list = 0;
+  src->table = 0;
+  src->tablesize = 0;
+}
+
 void LockFd(struct Fd *fd) {
   LOCK(&fd->lock);
 }
@@ -121,10 +150,11 @@ void DestroyFds(struct Fds *fds) {
   struct Dll *e, *e2;
   for (e = dll_first(fds->list); e; e = e2) {
     e2 = dll_next(fds->list, e);
-    dll_remove(&fds->list, e);
+    RemoveFd(fds, FD_CONTAINER(e));
     FreeFd(FD_CONTAINER(e));
   }
   unassert(!fds->list);
+  free(fds->table);
   unassert(!pthread_mutex_destroy(&fds->lock));
 }
 
@@ -15,6 +15,10 @@
 
 #define FD_CONTAINER(e) DLL_CONTAINER(struct Fd, elem, e)
 
+#define kFdDevNull    1  // host's /dev/null
+#define kFdDevZero    2  // host's /dev/zero
+#define kFdDevUrandom 3  // host's /dev/urandom
+
 struct winsize;
 
 struct FdCb {
@@ -33,6 +37,10 @@ struct Fd {
   int oflags;      // host O_XXX constants
   int socktype;    // host SOCK_XXX constants
   bool norestart;  // is SO_RCVTIMEO in play?
+  i8 aio;          // offload i/o to workers? (1 yes, -1 no, 0 unknown)
+  i8 isfile;       // regular file or block device? (1 yes, -1 no, 0 unknown)
+  bool growpipe;   // guest pipe whose buffer hasn't been enlarged yet
+  i8 dev;          // kFdDevXxx served by blink itself (-1 no, 0 unknown)
   DIR *dirstream;  // for getdents() lazilly
   struct Dll elem;
   pthread_mutex_t_ lock;
@@ -46,7 +54,9 @@ struct Fd {
 };
 
 struct Fds {
-  struct Dll *list;
+  struct Dll *list;     // every open fd
+  struct Fd **table;    // same fds indexed by fildes
+  int tablesize;        // number of slots in table
   pthread_mutex_t_ lock;
 };
 
@@ -56,6 +66,8 @@ void InitFds(struct Fds *);
 struct Fd *AddFd(struct Fds *, int, int);
 struct Fd *ForkFd(struct Fds *, struct Fd *, int, int);
 struct Fd *GetFd(struct Fds *, int);
+void RemoveFd(struct Fds *, struct Fd *);
+void MoveFds(struct Fds *, struct Fds *);
 void LockFd(struct Fd *);
 void UnlockFd(struct Fd *);
 int CountFds(struct Fds *);
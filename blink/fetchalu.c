@@ -0,0 +1,122 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/alu.h"
+#include "blink/atomic.h"
+#include "blink/endian.h"
+
+/**
+ * @fileoverview Locked ALU ops using a single host atomic instruction.
+ *
+ * When guest code does something like `lock add %eax,(%rdi)` the usual
+ * way is to load the value, compute the result and flags, and retry a
+ * compare-and-swap until nothing else changed the value meanwhile. On
+ * contended counters and refcounts that retry loop spins, so the ops
+ * which the host can perform directly are handed to fetch-and-op, and
+ * flags are computed afterwards from the value it returned, which are
+ * the same flags the guest op would have produced.
+ *
+ * Bitwise ops work on hosts of either byte order, since the operand is
+ * converted to little endian, but arithmetic needs a little endian host
+ * because carries propagate the wrong way across swapped bytes.
+ */
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CAN_FETCH_ARITHMETIC 1
+#else
+#define CAN_FETCH_ARITHMETIC 0
+#endif
+
+// without threads or fork() nothing else can write guest memory, and
+// atomic.h doesn't polyfill the fetch-and-op of every operand width
+#if defined(HAVE_FORK) || defined(HAVE_THREADS)
+#define CAN_FETCH_ALU 1
+#else
+#define CAN_FETCH_ALU 0
+#endif
+
+#define FETCH(T, OP, p, y)                                              \
+  atomic_fetch_##OP##_explicit((_Atomic(T) *)(p), (T)(y), memory_order_acq_rel)
+
+#define FETCH_ALU(T, LITTLE, op, p, y)               \
+  switch (op) {                                      \
+    case ALU_ADD:                                    \
+      return LITTLE(FETCH(T, add, p, y));            \
+    case ALU_SUB:                                    \
+      return LITTLE(FETCH(T, sub, p, y));            \
+    case ALU_OR:                                     \
+      return LITTLE(FETCH(T, or, p, LITTLE(y)));     \
+    case ALU_AND:                                    \
+      return LITTLE(FETCH(T, and, p, LITTLE(y)));    \
+    case ALU_XOR:                                    \
+      return LITTLE(FETCH(T, xor, p, LITTLE(y)));    \
+    default:                                         \
+      __builtin_unreachable();                       \
+  }
+
+/**
+ * Returns true if FetchAlu() can perform `op` on `p` atomically.
+ *
+ * @param op is ALU_ADD, ALU_SUB, ALU_OR, ALU_AND, or ALU_XOR
+ * @param log2 is log2 of operand width in bytes, e.g. ALU_INT32
+ */
+bool CanFetchAlu(int op, int log2, const u8 *p) {
+  if (!CAN_FETCH_ALU) return false;
+  if ((uintptr_t)p & ((1 << log2) - 1)) return false;
+#if !CAN_64BIT
+  if (log2 == ALU_INT64) return false;
+#endif
+  switch (op) {
+    case ALU_ADD:
+    case ALU_SUB:
+      return CAN_FETCH_ARITHMETIC;
+    case ALU_OR:
+    case ALU_AND:
+    case ALU_XOR:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/**
+ * Atomically performs `*p = *p op y` using a host atomic instruction.
+ *
+ * @return value `*p` held beforehand
+ * @assume CanFetchAlu(op, log2, p)
+ */
+u64 FetchAlu(int op, int log2, u8 *p, u64 y) {
+#if CAN_FETCH_ALU
+  switch (log2) {
+    case ALU_INT8:
+      FETCH_ALU(u8, Little8, op, p, y);
+    case ALU_INT16:
+      FETCH_ALU(u16, Little16, op, p, y);
+    case ALU_INT32:
+      FETCH_ALU(u32, Little32, op, p, y);
+#if CAN_64BIT
+    case ALU_INT64:
+      FETCH_ALU(u64, Little64, op, p, y);
+#endif
+    default:
+      __builtin_unreachable();
+  }
+#else
+  __builtin_unreachable();
+#endif
+}
@@ -22,18 +22,29 @@
 
 bool FLAG_zero;
 bool FLAG_wantjit;
+bool FLAG_hugepages;
+bool FLAG_dedup;
+bool FLAG_jitasync;
+bool FLAG_perfmap;
+bool FLAG_flight;
+bool FLAG_etraceregs;
+bool FLAG_native;
 bool FLAG_nolinear;
+bool FLAG_shadow;
 bool FLAG_noconnect;
 bool FLAG_nologstderr;
 bool FLAG_alsologtostderr;
 
 int FLAG_strace;
+int FLAG_asyncio;
+int FLAG_reclaim;
 int FLAG_vabits;
 
 long FLAG_pagesize;
 
 u64 FLAG_skew;
 u64 FLAG_vaspace;
+u64 FLAG_shadowsize;
 u64 FLAG_aslrmask;
 u64 FLAG_stacktop;
 u64 FLAG_imagestart;
@@ -50,3 +61,13 @@ const char *FLAG_overlays;
 const char *FLAG_prefix;
 #endif
 const char *FLAG_bios;
+#ifndef DISABLE_JIT
+const char *FLAG_jitcache;
+#endif
+const char *FLAG_snapshot;
+const char *FLAG_core;
+const char *FLAG_metrics;
+const char *FLAG_profile;
+const char *FLAG_btrace;
+const char *FLAG_coverage;
+const char *FLAG_etrace;
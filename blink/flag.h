@@ -6,18 +6,29 @@
 
 extern bool FLAG_zero;
 extern bool FLAG_wantjit;
+extern bool FLAG_hugepages;
+extern bool FLAG_dedup;
+extern bool FLAG_jitasync;
+extern bool FLAG_perfmap;
+extern bool FLAG_flight;
+extern bool FLAG_etraceregs;
+extern bool FLAG_native;
 extern bool FLAG_nolinear;
+extern bool FLAG_shadow;
 extern bool FLAG_noconnect;
 extern bool FLAG_nologstderr;
 extern bool FLAG_alsologtostderr;
 
 extern int FLAG_strace;
+extern int FLAG_asyncio;
+extern int FLAG_reclaim;
 extern int FLAG_vabits;
 
 extern long FLAG_pagesize;
 
 extern u64 FLAG_skew;
 extern u64 FLAG_vaspace;
+extern u64 FLAG_shadowsize;
 extern u64 FLAG_stacktop;
 extern u64 FLAG_aslrmask;
 extern u64 FLAG_imagestart;
@@ -29,5 +40,13 @@ extern const char *FLAG_logpath;
 extern const char *FLAG_overlays;
 extern const char *FLAG_prefix;
 extern const char *FLAG_bios;
+extern const char *FLAG_jitcache;
+extern const char *FLAG_snapshot;
+extern const char *FLAG_core;
+extern const char *FLAG_metrics;
+extern const char *FLAG_profile;
+extern const char *FLAG_btrace;
+extern const char *FLAG_coverage;
+extern const char *FLAG_etrace;
 
 #endif /* BLINK_FLAG_H_ */
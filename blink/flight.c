@@ -0,0 +1,82 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/flight.h"
+
+#include <stdlib.h>
+
+#include "blink/buffer.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+
+/**
+ * @fileoverview Jit path flight recorder.
+ *
+ * When BLINK_FLIGHT is set, each jit path that gets generated begins
+ * with the RecordFlight() micro-op, which puts the guest address that
+ * the path was entered at in a small ring belonging to the thread that
+ * is running it. The host cycle counter is read once per period, since
+ * that's slower than the stores. Nothing is formatted until the guest
+ * dies of a serious signal, at which point the ring is logged with the
+ * backtrace, showing the control flow which led up to the crash. That
+ * costs a few stores per path, rather than the per-instruction logging
+ * of LogCpu().
+ */
+
+// logs jit paths the thread entered most recently, oldest first. runs
+// of entries to the same path, e.g. a loop, are printed once with the
+// number of times it was entered. records are logged in small batches,
+// since log lines are limited to PIPE_BUF bytes
+void PrintFlight(struct Machine *m) {
+  u32 i, j, n, lines;
+  struct Buffer b = {0};
+  struct FlightRing *r;
+  u64 last, *tick;
+  if (!(r = m->flight) || !r->head) return;
+  n = r->head < kFlightRecords ? r->head : kFlightRecords;
+  last = r->ticks[(r->head - 1) / kFlightTickEvery % ARRAYLEN(r->ticks)];
+  ERRF("last %u jit paths entered by tid %d "
+       "(address, ticks before the last timestamp)",
+       n, m->tid);
+  for (lines = 0, i = r->head - n; i != r->head; i = j) {
+    for (j = i + 1; j != r->head; ++j) {
+      if (!(j % kFlightTickEvery) ||
+          r->pcs[j % kFlightRecords] != r->pcs[i % kFlightRecords]) {
+        break;
+      }
+    }
+    AppendFmt(&b, "\n\t%012" PRIx64, r->pcs[i % kFlightRecords]);
+    if (!(i % kFlightTickEvery)) {
+      tick = r->ticks + i / kFlightTickEvery % ARRAYLEN(r->ticks);
+      AppendFmt(&b, " -%" PRIu64, last - *tick);
+    }
+    if (j - i > 1) AppendFmt(&b, " x%u", j - i);
+    if (++lines == 64 || j == r->head) {
+      ERRF("flight recorder%s", b.p);
+      b.i = 0;
+      lines = 0;
+    }
+  }
+  free(b.p);
+}
+
+void ForgetFlight(struct Machine *m) {
+  free(m->flight);
+  m->flight = 0;
+}
@@ -0,0 +1,19 @@
+#ifndef BLINK_FLIGHT_H_
+#define BLINK_FLIGHT_H_
+#include "blink/tunables.h"
+#include "blink/types.h"
+
+struct FlightRing {
+  u32 head;                    // number of paths ever entered
+  i64 pcs[kFlightRecords];     // guest addresses at which they were entered
+  u64 ticks[kFlightRecords /   // host cycle counter when each path whose
+            kFlightTickEvery]; // index is a multiple of the period began
+};
+
+struct Machine;
+
+void RecordFlight(struct Machine *, i64);
+void PrintFlight(struct Machine *);
+void ForgetFlight(struct Machine *);
+
+#endif /* BLINK_FLIGHT_H_ */
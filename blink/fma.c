@@ -0,0 +1,213 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <math.h>
+#include <string.h>
+
+#include "blink/avx.h"
+#include "blink/endian.h"
+#include "blink/fpu.h"
+#include "blink/machine.h"
+#include "blink/modrm.h"
+#include "blink/pun.h"
+#include "blink/rde.h"
+#include "blink/types.h"
+
+/**
+ * @fileoverview FMA3 and F16C instructions.
+ *
+ * Fused multiply-add is computed by the C library's fma() and fmaf(),
+ * which round once, as the hardware does, and which use the host's own
+ * fused multiply-add instructions when it has them. Half precision is
+ * converted by hand, since few hosts can be assumed to have it.
+ */
+
+#ifndef DISABLE_AVX
+
+// returns true if fma form negates the addend of element i
+static bool IsFmaSub(int kind, int i) {
+  switch (kind) {
+    case 0x6:  // fmaddsub
+      return !(i & 1);
+    case 0x7:  // fmsubadd
+      return i & 1;
+    case 0xA:  // fmsub
+    case 0xB:
+    case 0xE:  // fnmsub
+    case 0xF:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// computes ±(a*b)±c where abc is a permutation of xyz operand order
+static u32 FmaFloat(const union FloatPun v[3], const int o[3], bool np,
+                    bool nc) {
+  int i;
+  union FloatPun r;
+  for (i = 0; i < 3; ++i) {
+    if (isnan(v[i].f)) {
+      return v[i].i | 0x00400000;
+    }
+  }
+  r.f = fmaf(np ? -v[o[0]].f : v[o[0]].f, v[o[1]].f,
+             nc ? -v[o[2]].f : v[o[2]].f);
+  if (isnan(r.f)) r.i = 0xffc00000;  // default nan
+  return r.i;
+}
+
+static u64 FmaDouble(const union DoublePun v[3], const int o[3], bool np,
+                     bool nc) {
+  int i;
+  union DoublePun r;
+  for (i = 0; i < 3; ++i) {
+    if (isnan(v[i].f)) {
+      return v[i].i | 0x0008000000000000;
+    }
+  }
+  r.f = fma(np ? -v[o[0]].f : v[o[0]].f, v[o[1]].f,
+            nc ? -v[o[2]].f : v[o[2]].f);
+  if (isnan(r.f)) r.i = 0xfff8000000000000;
+  return r.i;
+}
+
+/**
+ * Performs fused multiply-add, e.g. `vfmadd231ps %ymm2,%ymm1,%ymm0`.
+ *
+ * The high nibble of the opcode says which operands are multiplied,
+ * e.g. 132 means `x = x * z + y` where x is the destination, y is the
+ * vvvv operand and z is the r/m operand. The low nibble says which of
+ * the products and addends are negated, and odd opcodes from 0x9 up
+ * are scalar. NaNs propagate in operand order like hardware.
+ */
+void OpVexFma(P) {
+  const int *o;
+  int i, j, k, n, kind;
+  bool np, scalar;
+  u8 v[3][32];
+  union FloatPun f[3];
+  union DoublePun d[3];
+  static const int kOrder[3][3] = {{0, 2, 1}, {1, 0, 2}, {1, 2, 0}};
+  if (!Osz(rde)) OpUdImpl(m);
+  kind = Opcode(rde) & 15;
+  scalar = kind >= 9 && (kind & 1);
+  k = 4 << Rexw(rde);
+  n = scalar ? k : 16 << Ymm(rde);
+  GetYmm(m, RexrReg(rde), v[0]);
+  GetYmm(m, Vreg(rde), v[1]);
+  GetYmmRm(A, v[2], n, false);
+  o = kOrder[(Opcode(rde) >> 4) - 9];
+  np = kind >= 0xC;
+  for (i = 0; i < n; i += k) {
+    if (k == 4) {
+      for (j = 0; j < 3; ++j) f[j].i = Read32(v[j] + i);
+      Write32(v[0] + i, FmaFloat(f, o, np, IsFmaSub(kind, i / k)));
+    } else {
+      for (j = 0; j < 3; ++j) d[j].i = Read64(v[j] + i);
+      Write64(v[0] + i, FmaDouble(d, o, np, IsFmaSub(kind, i / k)));
+    }
+  }
+  PutYmm(m, RexrReg(rde), v[0], !scalar && Ymm(rde));
+}
+
+static u32 HalfToFloat(u16 h) {
+  u32 s, e, f;
+  union FloatPun u;
+  s = (u32)(h & 0x8000) << 16;
+  e = h >> 10 & 31;
+  f = h & 1023;
+  if (e == 31) {
+    return s | 0x7f800000 | f << 13 | (f ? 0x00400000 : 0);
+  } else if (e) {
+    return s | (e - 15 + 127) << 23 | f << 13;
+  } else {
+    u.f = ldexpf(f, -24);  // subnormal halves are normal floats
+    return s | u.i;
+  }
+}
+
+static u16 FloatToHalf(u32 w, int mode) {
+  int e;
+  u16 s;
+  double q;
+  union FloatPun u;
+  u.i = w;
+  s = w >> 16 & 0x8000;
+  if (isnan(u.f)) return s | 0x7e00 | (w >> 13 & 1023);
+  if (isinf(u.f)) return s | 0x7c00;
+  if (fabsf(u.f) < 0x1p-14f) {
+    q = fabs(RoundYmm(ldexp(u.f, 24), mode));
+    return s | (u16)q;  // 1024 rounds up into the smallest normal
+  }
+  frexpf(u.f, &e);
+  e -= 1;
+  q = fabs(RoundYmm(ldexp(u.f, 10 - e), mode));
+  if (q == 2048) q = 1024, ++e;
+  if (e > 15) {
+    if (mode == 3 || (mode == 1 && !s) || (mode == 2 && s)) {
+      return s | 0x7bff;
+    } else {
+      return s | 0x7c00;
+    }
+  }
+  return s | (e + 15) << 10 | ((u16)q - 1024);
+}
+
+/**
+ * Converts half precision floats to single, i.e. `vcvtph2ps`.
+ */
+void OpVexCvtph2ps(P) {
+  int i, n;
+  u8 x[32], y[32];
+  if (!Osz(rde) || Rexw(rde) || Vreg(rde)) OpUdImpl(m);
+  n = 4 << Ymm(rde);
+  GetYmmRm(A, y, n * 2, false);
+  for (i = 0; i < n; ++i) {
+    Write32(x + i * 4, HalfToFloat(Read16(y + i * 2)));
+  }
+  PutYmm(m, RexrReg(rde), x, Ymm(rde));
+}
+
+/**
+ * Converts single precision floats to half, i.e. `vcvtps2ph`, which
+ * rounds as the immediate says, or as MXCSR says if its bit 2 is set.
+ */
+void OpVexCvtps2ph(P) {
+  u8 x[32], y[32];
+  int i, n, mode;
+  if (!Osz(rde) || Rexw(rde) || Vreg(rde)) OpUdImpl(m);
+  n = 4 << Ymm(rde);
+  if (uimm0 & 4) {
+    mode = (m->mxcsr & kMxcsrRc) >> 13;
+  } else {
+    mode = uimm0 & 3;
+  }
+  GetYmm(m, RexrReg(rde), x);
+  memset(y, 0, 32);
+  for (i = 0; i < n; ++i) {
+    Write16(y + i * 2, FloatToHalf(Read32(x + i * 4), mode));
+  }
+  if (IsModrmRegister(rde)) {
+    PutYmm(m, RexbRm(rde), y, false);
+  } else {
+    PutYmmMem(A, y, n * 2, false);
+  }
+}
+
+#endif /* DISABLE_AVX */
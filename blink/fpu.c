@@ -18,7 +18,7 @@
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include "blink/fpu.h"
 
-#include <math.h>
+#include <tgmath.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,6 +33,8 @@
 #include "blink/modrm.h"
 #include "blink/pun.h"
 #include "blink/rde.h"
+#include "blink/stats.h"
+#include "blink/x86.h"
 
 #define FPUREG 0
 #define MEMORY 1
@@ -65,26 +67,26 @@ static void OnFpuStackOverflow(struct Machine *m) {
   m->fpu.sw |= kFpuSwIe | kFpuSwC1 | kFpuSwSf;
 }
 
-static double OnFpuStackUnderflow(struct Machine *m) {
+static fpu_t OnFpuStackUnderflow(struct Machine *m) {
   m->fpu.sw |= kFpuSwIe | kFpuSwSf;
   m->fpu.sw &= ~kFpuSwC1;
   return -NAN;
 }
 
-static double St(struct Machine *m, int i) {
+static fpu_t St(struct Machine *m, int i) {
   if (FpuGetTag(m, i) == kFpuTagEmpty) OnFpuStackUnderflow(m);
   return *FpuSt(m, i);
 }
 
-static double St0(struct Machine *m) {
+static fpu_t St0(struct Machine *m) {
   return St(m, 0);
 }
 
-static double St1(struct Machine *m) {
+static fpu_t St1(struct Machine *m) {
   return St(m, 1);
 }
 
-static double StRm(struct Machine *m, u64 rde) {
+static fpu_t StRm(struct Machine *m, u64 rde) {
   return St(m, ModrmRm(rde));
 }
 
@@ -96,20 +98,20 @@ static void FpuClearOutOfRangeIndicator(struct Machine *m) {
   m->fpu.sw &= ~kFpuSwC2;
 }
 
-static void FpuSetSt0(struct Machine *m, double x) {
+static void FpuSetSt0(struct Machine *m, fpu_t x) {
   *FpuSt(m, 0) = x;
 }
 
-static void FpuSetStRm(struct Machine *m, u64 rde, double x) {
+static void FpuSetStRm(struct Machine *m, u64 rde, fpu_t x) {
   *FpuSt(m, ModrmRm(rde)) = x;
 }
 
-static void FpuSetStPop(struct Machine *m, int i, double x) {
+static void FpuSetStPop(struct Machine *m, int i, fpu_t x) {
   *FpuSt(m, i) = x;
   FpuPop(m);
 }
 
-static void FpuSetStRmPop(struct Machine *m, u64 rde, double x) {
+static void FpuSetStRmPop(struct Machine *m, u64 rde, fpu_t x) {
   FpuSetStPop(m, ModrmRm(rde), x);
 }
 
@@ -159,12 +161,12 @@ static void FpuSetMemoryDouble(struct Machine *m, double f) {
   FpuSetMemoryLong(m, u.i);
 }
 
-static double FpuGetMemoryLdbl(struct Machine *m) {
+static fpu_t FpuGetMemoryLdbl(struct Machine *m) {
   u8 b[10];
   return DeserializeLdbl(Load(m, m->fpu.dp, 10, b));
 }
 
-static void FpuSetMemoryLdbl(struct Machine *m, double f) {
+static void FpuSetMemoryLdbl(struct Machine *m, fpu_t f) {
   void *p[2];
   u8 b[10], t[10];
   SerializeLdbl(b, f);
@@ -172,31 +174,35 @@ static void FpuSetMemoryLdbl(struct Machine *m, double f) {
   EndStore(m, m->fpu.dp, 10, p, t);
 }
 
-static double f2xm1(double x) {
+static fpu_t f2xm1(fpu_t x) {
   return exp2(x) - 1;
 }
 
-static double fyl2x(double x, double y) {
+static fpu_t fyl2x(fpu_t x, fpu_t y) {
   return y * log2(x);
 }
 
-static double fyl2xp1(double x, double y) {
+static fpu_t fyl2xp1(fpu_t x, fpu_t y) {
   return y * log2(x + 1);
 }
 
-static double fscale(double significand, double exponent) {
+static fpu_t fscale(fpu_t significand, fpu_t exponent) {
   if (isunordered(significand, exponent)) return NAN;
   return ldexp(significand, exponent);
 }
 
-static double x87remainder(double x, double y, u32 *sw,
-                           double rem(double, double), double rnd(double)) {
+static fpu_t x87remainder(fpu_t x, fpu_t y, u32 *sw, bool ieee) {
   int s;
   long q;
-  double r;
+  fpu_t r;
   s = 0;
-  r = rem(x, y);
-  q = rnd(x / y);
+  if (ieee) {
+    r = remainder(x, y);
+    q = rint(x / y);
+  } else {
+    r = fmod(x, y);
+    q = trunc(x / y);
+  }
   s &= ~kFpuSwC2; /* ty libm */
   if (q & 1) s |= kFpuSwC1;
   if (q & 2) s |= kFpuSwC3;
@@ -205,15 +211,15 @@ static double x87remainder(double x, double y, u32 *sw,
   return r;
 }
 
-static double fprem(double dividend, double modulus, u32 *sw) {
-  return x87remainder(dividend, modulus, sw, fmod, trunc);
+static fpu_t fprem(fpu_t dividend, fpu_t modulus, u32 *sw) {
+  return x87remainder(dividend, modulus, sw, false);
 }
 
-static double fprem1(double dividend, double modulus, u32 *sw) {
-  return x87remainder(dividend, modulus, sw, remainder, rint);
+static fpu_t fprem1(fpu_t dividend, fpu_t modulus, u32 *sw) {
+  return x87remainder(dividend, modulus, sw, true);
 }
 
-static double FpuAdd(struct Machine *m, double x, double y) {
+static fpu_t FpuAdd(struct Machine *m, fpu_t x, fpu_t y) {
   if (!isunordered(x, y)) {
     switch (isinf(y) << 1 | isinf(x)) {
       case 0:
@@ -237,7 +243,7 @@ static double FpuAdd(struct Machine *m, double x, double y) {
   }
 }
 
-static double FpuSub(struct Machine *m, double x, double y) {
+static fpu_t FpuSub(struct Machine *m, fpu_t x, fpu_t y) {
   if (!isunordered(x, y)) {
     switch (isinf(y) << 1 | isinf(x)) {
       case 0:
@@ -261,7 +267,7 @@ static double FpuSub(struct Machine *m, double x, double y) {
   }
 }
 
-static double FpuMul(struct Machine *m, double x, double y) {
+static fpu_t FpuMul(struct Machine *m, fpu_t x, fpu_t y) {
   if (!isunordered(x, y)) {
     if (!((isinf(x) && !y) || (isinf(y) && !x))) {
       return x * y;
@@ -274,7 +280,7 @@ static double FpuMul(struct Machine *m, double x, double y) {
   }
 }
 
-static double FpuDiv(struct Machine *m, double x, double y) {
+static fpu_t FpuDiv(struct Machine *m, fpu_t x, fpu_t y) {
   if (!isunordered(x, y)) {
     if (x || y) {
       if (y) {
@@ -292,7 +298,7 @@ static double FpuDiv(struct Machine *m, double x, double y) {
   }
 }
 
-static double FpuRound(struct Machine *m, double x) {
+static fpu_t FpuRound(struct Machine *m, fpu_t x) {
   switch ((m->fpu.cw & kFpuCwRc) >> 10) {
     case 0:
       return rint(x);
@@ -307,8 +313,8 @@ static double FpuRound(struct Machine *m, double x) {
   }
 }
 
-static void FpuCompare(struct Machine *m, double y) {
-  double x = St0(m);
+static void FpuCompare(struct Machine *m, fpu_t y) {
+  fpu_t x = St0(m);
   m->fpu.sw &= ~(kFpuSwC0 | kFpuSwC1 | kFpuSwC2 | kFpuSwC3);
   if (!isunordered(x, y)) {
     if (x < y) m->fpu.sw |= kFpuSwC0;
@@ -319,7 +325,7 @@ static void FpuCompare(struct Machine *m, double y) {
 }
 
 static void OpFxam(struct Machine *m) {
-  double x;
+  fpu_t x;
   x = *FpuSt(m, 0);
   m->fpu.sw &= ~(kFpuSwC0 | kFpuSwC1 | kFpuSwC2 | kFpuSwC3);
   if (signbit(x)) m->fpu.sw |= kFpuSwC1;
@@ -437,7 +443,7 @@ static void OpFptan(struct Machine *m) {
 }
 
 static void OpFsincos(struct Machine *m) {
-  double tsin, tcos;
+  fpu_t tsin, tcos;
   FpuClearOutOfRangeIndicator(m);
   tsin = sin(St0(m));
   tcos = cos(St0(m));
@@ -699,7 +705,7 @@ static void OpFincstp(struct Machine *m) {
 }
 
 static void OpFxtract(struct Machine *m) {
-  double x = St0(m);
+  fpu_t x = St0(m);
   FpuSetSt0(m, logb(x));
   FpuPush(m, ldexp(x, -ilogb(x)));
 }
@@ -743,7 +749,7 @@ static void OpFstp(struct Machine *m, u64 rde) {
 }
 
 static void OpFxch(struct Machine *m, u64 rde) {
-  double t = StRm(m, rde);
+  fpu_t t = StRm(m, rde);
   FpuSetStRm(m, rde, St0(m));
   FpuSetSt0(m, t);
 }
@@ -756,36 +762,36 @@ static void OpFldl(struct Machine *m) {
   FpuPush(m, FpuGetMemoryDouble(m));
 }
 
-static double Fld1(void) {
+static fpu_t Fld1(void) {
   return 1;
 }
 
-static double Fldl2t(void) {
+static fpu_t Fldl2t(void) {
   return 0xd.49a784bcd1b8afep-2L; /* log₂10 */
 }
 
-static double Fldl2e(void) {
+static fpu_t Fldl2e(void) {
   return 0xb.8aa3b295c17f0bcp-3L; /* log₂𝑒 */
 }
 
-static double Fldpi(void) {
+static fpu_t Fldpi(void) {
   return 0x1.921fb54442d1846ap+1L; /* π */
 }
 
-static double Fldlg2(void) {
+static fpu_t Fldlg2(void) {
   return 0x9.a209a84fbcff799p-5L; /* log₁₀2 */
 }
 
-static double Fldln2(void) {
+static fpu_t Fldln2(void) {
   return 0xb.17217f7d1cf79acp-4L; /* logₑ2 */
 }
 
-static double Fldz(void) {
+static fpu_t Fldz(void) {
   return 0;
 }
 
 static void OpFldConstant(struct Machine *m, u64 rde) {
-  double x;
+  fpu_t x;
   switch (ModrmRm(rde)) {
     CASE(0, x = Fld1());
     CASE(1, x = Fldl2t());
@@ -852,7 +858,7 @@ static void OpFistps(struct Machine *m) {
 }
 
 static void OpFcomi(struct Machine *m, u64 rde) {
-  double x, y;
+  fpu_t x, y;
   x = St0(m);
   y = StRm(m, rde);
   if (!isunordered(x, y)) {
@@ -1007,15 +1013,15 @@ void FpuSetTag(struct Machine *m, unsigned i, unsigned t) {
   m->fpu.tw |= t << i;
 }
 
-void FpuPush(struct Machine *m, double x) {
+void FpuPush(struct Machine *m, fpu_t x) {
   if (FpuGetTag(m, -1) != kFpuTagEmpty) OnFpuStackOverflow(m);
   m->fpu.sw = (m->fpu.sw & ~kFpuSwSp) | ((m->fpu.sw - (1 << 11)) & kFpuSwSp);
   *FpuSt(m, 0) = x;
   FpuSetTag(m, 0, kFpuTagValid);
 }
 
-double FpuPop(struct Machine *m) {
-  double x;
+fpu_t FpuPop(struct Machine *m) {
+  fpu_t x;
   if (FpuGetTag(m, 0) != kFpuTagEmpty) {
     x = *FpuSt(m, 0);
     FpuSetTag(m, 0, kFpuTagEmpty);
@@ -1026,6 +1032,122 @@ double FpuPop(struct Machine *m) {
   return x;
 }
 
+#ifdef HAVE_JIT
+
+// x87 register ops which paths call directly, by (opcode&7)<<3|reg
+void *const kFpuJitReg[64] = {
+    [000] = (void *)OpFaddStEst,  [001] = (void *)OpFmulStEst,
+    [002] = (void *)OpFcom,       [003] = (void *)OpFcomp,
+    [004] = (void *)OpFsubStEst,  [005] = (void *)OpFsubrStEst,
+    [006] = (void *)OpFdivStEst,  [007] = (void *)OpFdivrStEst,
+    [010] = (void *)OpFld,        [011] = (void *)OpFxch,
+    [013] = (void *)OpFstp,       [015] = (void *)OpFldConstant,
+    [020] = (void *)OpFcmovb,     [021] = (void *)OpFcmove,
+    [022] = (void *)OpFcmovbe,    [023] = (void *)OpFcmovu,
+    [030] = (void *)OpFcmovnb,    [031] = (void *)OpFcmovne,
+    [032] = (void *)OpFcmovnbe,   [033] = (void *)OpFcmovnu,
+    [035] = (void *)OpFucomi,     [036] = (void *)OpFcomi,
+    [040] = (void *)OpFaddEstSt,  [041] = (void *)OpFmulEstSt,
+    [042] = (void *)OpFcom,       [043] = (void *)OpFcomp,
+    [044] = (void *)OpFsubEstSt,  [045] = (void *)OpFsubrEstSt,
+    [046] = (void *)OpFdivEstSt,  [047] = (void *)OpFdivrEstSt,
+    [050] = (void *)OpFfree,      [051] = (void *)OpFxch,
+    [052] = (void *)OpFst,        [053] = (void *)OpFstp,
+    [054] = (void *)OpFucom,      [055] = (void *)OpFucomp,
+    [060] = (void *)OpFaddp,      [061] = (void *)OpFmulp,
+    [062] = (void *)OpFcomp,      [063] = (void *)OpFcompp,
+    [064] = (void *)OpFsubp,      [065] = (void *)OpFsubrp,
+    [066] = (void *)OpFdivp,      [067] = (void *)OpFdivrp,
+    [070] = (void *)OpFfreep,     [071] = (void *)OpFxch,
+    [072] = (void *)OpFstp,       [073] = (void *)OpFstp,
+    [075] = (void *)OpFucomip,    [076] = (void *)OpFcomip,
+};
+
+// x87 memory ops which paths call directly, by (opcode&7)<<3|reg
+void *const kFpuJitMem[64] = {
+    [000] = (void *)OpFadds,   [001] = (void *)OpFmuls,
+    [002] = (void *)OpFcoms,   [003] = (void *)OpFcomps,
+    [004] = (void *)OpFsubs,   [005] = (void *)OpFsubrs,
+    [006] = (void *)OpFdivs,   [007] = (void *)OpFdivrs,
+    [010] = (void *)OpFlds,    [012] = (void *)OpFsts,
+    [013] = (void *)OpFstps,   [015] = (void *)OpFldcw,
+    [017] = (void *)OpFstcw,   [020] = (void *)OpFiaddl,
+    [021] = (void *)OpFimull,  [022] = (void *)OpFicoml,
+    [023] = (void *)OpFicompl, [024] = (void *)OpFisubl,
+    [025] = (void *)OpFisubrl, [026] = (void *)OpFidivl,
+    [027] = (void *)OpFidivrl, [030] = (void *)OpFildl,
+    [031] = (void *)OpFisttpl, [032] = (void *)OpFistl,
+    [033] = (void *)OpFistpl,  [035] = (void *)OpFldt,
+    [037] = (void *)OpFstpt,   [040] = (void *)OpFaddl,
+    [041] = (void *)OpFmull,   [042] = (void *)OpFcoml,
+    [043] = (void *)OpFcompl,  [044] = (void *)OpFsubl,
+    [045] = (void *)OpFsubrl,  [046] = (void *)OpFdivl,
+    [047] = (void *)OpFdivrl,  [050] = (void *)OpFldl,
+    [051] = (void *)OpFisttpll, [052] = (void *)OpFstl,
+    [053] = (void *)OpFstpl,   [057] = (void *)OpFstswMw,
+    [060] = (void *)OpFiadds,  [061] = (void *)OpFimuls,
+    [062] = (void *)OpFicoms,  [063] = (void *)OpFicomps,
+    [064] = (void *)OpFisubs,  [065] = (void *)OpFisubrs,
+    [066] = (void *)OpFidivs,  [067] = (void *)OpFidivrs,
+    [070] = (void *)OpFilds,   [071] = (void *)OpFisttps,
+    [072] = (void *)OpFists,   [073] = (void *)OpFistps,
+    [075] = (void *)OpFildll,  [077] = (void *)OpFistpll,
+};
+
+MICRO_OP void SetFpuIp(struct Machine *m, i64 ip, u64 op) {
+  m->fpu.ip = ip;
+  m->fpu.op = op;
+  m->fpu.dp = 0;
+}
+
+MICRO_OP void SetFpuIpDp(struct Machine *m, i64 dp, i64 ip, u64 op) {
+  m->fpu.ip = ip;
+  m->fpu.op = op;
+  m->fpu.dp = dp;
+}
+
+/**
+ * Compiles x87 operation into path as a direct call to its kernel.
+ *
+ * The op is decoded once when the path is built, rather than each time
+ * it runs, so what gets emitted is a few inline stores establishing the
+ * last instruction and data pointers followed by the call. The stack is
+ * left in struct MachineFpu, since the kernels are what give us the
+ * tags, stack faults, and the nan and infinity semantics of real x87.
+ */
+static void JitFpu(P) {
+  void *kernel;
+  unsigned k = (Opcode(rde) & 7) << 3 | ModrmReg(rde);
+  if (IsModrmRegister(rde)) {
+    if (!(kernel = kFpuJitReg[k])) return;
+    Jitter(A,
+           "a2i"  // arg2 = last opcode
+           "a1i"  // arg1 = last instruction pointer
+           "q"    // arg0 = machine
+           "m",   // call micro-op
+           (u64)m->fpu.op, m->fpu.ip, SetFpuIp);
+  } else {
+    if (!(kernel = kFpuJitMem[k])) return;
+    if (Eamode(rde) == XED_MODE_REAL) return;
+    Jitter(A,
+           "L"      // load effective address
+           "r0a1="  // arg1 = res0
+           "a3i"    // arg3 = last opcode
+           "a2i"    // arg2 = last instruction pointer
+           "q"      // arg0 = machine
+           "m",     // call micro-op
+           (u64)m->fpu.op, m->fpu.ip, SetFpuIpDp);
+  }
+  Jitter(A,
+         "a1i"  // arg1 = rde
+         "q"    // arg0 = machine
+         "c",   // call function
+         rde, kernel);
+  STATISTIC(++fpu_path_ops);
+}
+
+#endif /* HAVE_JIT */
+
 void OpFpu(P) {
   unsigned op;
   bool ismemory;
@@ -1194,6 +1316,9 @@ void OpFpu(P) {
     default:
       OpUdImpl(m);
   }
+#ifdef HAVE_JIT
+  if (IsMakingPath(m)) JitFpu(A);
+#endif
 }
 
 #else /* DISABLE_X87 */
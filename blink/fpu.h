@@ -49,12 +49,17 @@
 
 #define FpuSt(m, i) ((m)->fpu.st + (((i) + ((m->fpu.sw & kFpuSwSp) >> 11)) & 7))
 
-double FpuPop(struct Machine *);
+extern void *const kFpuJitReg[64];
+extern void *const kFpuJitMem[64];
+
+fpu_t FpuPop(struct Machine *);
 int FpuGetTag(struct Machine *, unsigned);
-void FpuPush(struct Machine *, double);
+void FpuPush(struct Machine *, fpu_t);
 void FpuSetTag(struct Machine *, unsigned, unsigned);
 void OpFinit(struct Machine *);
 void OpFpu(P);
 void OpFwait(P);
+void SetFpuIp(struct Machine *, i64, u64);
+void SetFpuIpDp(struct Machine *, i64, i64, u64);
 
 #endif /* BLINK_FPU_H_ */
@@ -20,15 +20,20 @@
 #include "blink/builtin.h"
 #include "blink/debug.h"
 #include "blink/endian.h"
+#include "blink/flag.h"
 #include "blink/flags.h"
+#include "blink/jit.h"
 #include "blink/machine.h"
+#include "blink/modrm.h"
 #include "blink/rde.h"
 #include "blink/stats.h"
 
 /**
- * @fileoverview Branch Micro-Op Fusion.
+ * @fileoverview Branch and Stack Micro-Op Fusion.
  */
 
+#define kMaxFusedStackOps 8
+
 bool FuseBranchTest(P) {
 #ifdef HAVE_JIT
   i64 bdisp;
@@ -98,6 +103,7 @@ bool FuseBranchTest(P) {
          "m",   // call micro-op
          m->path.skew + jlen, AdvanceIp);
   m->path.skew = 0;
+  FlushJitRegs(m);
 #ifdef __x86_64__
   Jitter(A, "A"    // res0 = GetReg(RexrReg)
             "q");  // arg0 = machine
@@ -236,6 +242,7 @@ bool FuseBranchCmp(P, bool imm) {
            m->path.skew + jlen, Oplength(rde) + jlen, SkewIp);
   }
   m->path.skew = 0;
+  FlushJitRegs(m);
   if (imm) {
     Jitter(A, "s1i", uimm0);
   } else {
@@ -340,3 +347,79 @@ bool FuseBranchCmp(P, bool imm) {
   return false;
 #endif
 }
+
+/**
+ * Fuses run of push or pop register ops, e.g. in function prologues.
+ *
+ * This is called by the first op of the run after it's executed. The
+ * ops which follow it get executed here too. Generated code addresses
+ * each stack slot relative to the old stack pointer and updates %rsp
+ * once at the end. Pushes store to their lowest slot first, so if the
+ * stack overflows, the fault happens before anything is observable.
+ *
+ * @return true if code was generated for the whole run, or false if
+ *     there's nothing to fuse and the caller should generate its op
+ */
+bool FuseStackOps(P, bool ispop) {
+#ifdef HAVE_JIT
+  u8 *p;
+  long i, n, len, limit;
+  u8 rex, op, regs[kMaxFusedStackOps], lens[kMaxFusedStackOps];
+  if (Mode(rde) != XED_MODE_LONG) return false;
+  if ((regs[0] = RexbSrm(rde)) == 4) return false;  // rsp
+  if (FLAG_coverage || IsAtBreakpoint_Hook) return false;
+  if (!(p = GetAddress(m, m->ip))) return false;
+  limit = 4096 - (m->ip & 4095);
+  for (len = 0, n = 1; n < kMaxFusedStackOps; ++n) {
+    if (len < limit && (p[len] & 0xf0) == 0x40) {
+      rex = p[len];
+      lens[n] = 2;
+    } else {
+      rex = 0;
+      lens[n] = 1;
+    }
+    if (len + lens[n] > limit) break;
+    op = p[len + lens[n] - 1];
+    if ((op & 0xf8) != (ispop ? 0x58 : 0x50)) break;
+    if ((regs[n] = (rex & 1) << 3 | (op & 7)) == 4) break;
+    len += lens[n];
+  }
+  if (n < 2) return false;
+  CoverPathBytes(m, m->ip, len);
+  for (i = 1; i < n; ++i) {
+    m->oplen = lens[i];
+    m->ip += lens[i];
+    if (ispop) {
+      Put64(m->weg[regs[i]], Pop(A, 0));
+    } else {
+      Push(A, Get64(m->weg[regs[i]]));
+    }
+  }
+  FlushCod(m->path.jb);
+  WriteCod("/\tfusing %ld %s ops\n", n, ispop ? "pop" : "push");
+  for (i = 0; i < n; ++i) {
+    Jitter(A,
+           "a2i"  // arg2 = offset from old rsp
+           "a1i"  // arg1 = register index
+           "q"    // arg0 = machine
+           "m",   // call micro-op
+           (u64)(ispop ? i * 8 : (i - n) * 8),
+           (u64)(ispop ? regs[i] : regs[n - 1 - i]),
+           ispop ? (void *)FastPopAt : (void *)FastPushAt);
+  }
+  Jitter(A,
+         "a1i"  // arg1 = delta
+         "q"    // arg0 = machine
+         "m",   // call micro-op
+         (u64)(ispop ? n * 8 : -n * 8), FastAddSp);
+  m->path.skew += len;
+  if (GetJitHook(&m->system->jit, m->ip)) {
+    FlushSkew(A);
+  }
+  m->path.elements += n - 1;
+  STATISTIC(++fused_stack_ops);
+  return true;
+#else
+  return false;
+#endif
+}
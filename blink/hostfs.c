@@ -29,17 +29,25 @@
 #include <sys/types.h>
 
 #include "blink/assert.h"
+#include "blink/atomic.h"
 #include "blink/errno.h"
 #include "blink/log.h"
 #include "blink/macros.h"
+#include "blink/stats.h"
 #include "blink/syscall.h"
+#include "blink/thread.h"
+#include "blink/timespec.h"
+#include "blink/tunables.h"
 #include "blink/vfs.h"
 
 #ifndef DISABLE_VFS
 
+#define HOSTFS_DENTRIES 1024
+
 struct HostfsDevice {
   const char *source;
   size_t sourcelen;
+  int rootfd;  // source directory, so lookups needn't rebuild its path
 };
 
 static u64 HostfsHash(u64 parent, const char *data, size_t size) {
@@ -55,6 +63,19 @@ static u64 HostfsHash(u64 parent, const char *data, size_t size) {
   return hash;
 }
 
+// opens mount source once, so paths beneath it can be resolved by the
+// host relative to it. the guest's lowest fd numbers are left for it.
+static int HostfsOpenRoot(const char *source) {
+  int fd, rootfd;
+  if ((fd = open(source, O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0)) == -1) {
+    VFS_LOGF("HostfsOpenRoot: open(\"%s\") failed (%d)", source, errno);
+    return -1;
+  }
+  rootfd = fcntl(fd, F_DUPFD_CLOEXEC, kMinBlinkFd);
+  unassert(!close(fd));
+  return rootfd;
+}
+
 int HostfsInit(const char *source, u64 flags, const void *data,
                struct VfsDevice **device, struct VfsMount **mount) {
   struct HostfsDevice *hostdevice;
@@ -77,6 +98,7 @@ int HostfsInit(const char *source, u64 flags, const void *data,
   if (hostdevice == NULL) {
     return enomem();
   }
+  hostdevice->rootfd = -1;
   hostdevice->source = realpath(source, NULL);
   if (hostdevice->source == NULL) {
     goto cleananddie;
@@ -85,6 +107,7 @@ int HostfsInit(const char *source, u64 flags, const void *data,
   if (hostdevice->source[hostdevice->sourcelen - 1] == '/') {
     hostdevice->sourcelen--;
   }
+  hostdevice->rootfd = HostfsOpenRoot(hostdevice->source);
   if (VfsCreateDevice(device) == -1) {
     goto cleananddie;
   }
@@ -115,6 +138,9 @@ cleananddie:
     unassert(!VfsFreeDevice(*device));
   } else {
     if (hostdevice) {
+      if (hostdevice->rootfd != -1) {
+        unassert(!close(hostdevice->rootfd));
+      }
       free((void *)hostdevice->source);
       free(hostdevice);
     }
@@ -179,6 +205,9 @@ int HostfsFreeDevice(void *device) {
     return 0;
   }
   VFS_LOGF("HostfsFreeDevice(%p)", device);
+  if (hostfsdevice->rootfd != -1) {
+    unassert(!close(hostfsdevice->rootfd));
+  }
   free((void *)hostfsdevice->source);
   free(hostfsdevice);
   return 0;
@@ -229,82 +258,69 @@ static ssize_t HostfsGetHostPath(struct VfsInfo *info,
   return ret;
 }
 
+// Resolves name in dir to a host path relative to *hostfd. The nearest
+// ancestor with an open host fd is used as the anchor, or else the root
+// of the mount, so only the suffix below it needs to be built. The path
+// is only made absolute if the mount's source couldn't be opened.
 static ssize_t HostfsGetOptimalDirFdName(struct VfsInfo *dir, const char *name,
                                          int *hostfd,
                                          char hostpath[VFS_PATH_MAX]) {
-  struct VfsInfo *currentdir;
+  struct VfsInfo *anchor;
   struct HostfsDevice *hostdevice;
-  int ret = -1;
-  ssize_t len1, len2;
+  ssize_t ret, len1, len2;
+  size_t prefixlen;
+  bool absolute, slash;
   VFS_LOGF("HostfsGetOptimalDirFdName(%p, \"%s\", %p, %p)", dir, name, hostfd,
            hostpath);
   if (!S_ISDIR(dir->mode)) {
     enotdir();
     return -1;
   }
-  currentdir = dir;
   if (!strcmp(name, "/")) {
     name = ".";
   }
-  while (currentdir && currentdir->dev == dir->dev) {
-    if (currentdir->data &&
-        ((struct HostfsInfo *)currentdir->data)->filefd != -1) {
-      *hostfd = ((struct HostfsInfo *)currentdir->data)->filefd;
-      if (dir != currentdir) {
-        if ((len1 = VfsPathBuild(dir, currentdir, false, hostpath)) == -1) {
-          ret = -1;
-        }
-        len2 = strlen(name);
-        if (hostpath[len1 - 1] == '/') {
-          --len1;
-        }
-        if (len1 + 1 + len2 >= VFS_PATH_MAX) {
-          ret = enametoolong();
-        } else {
-          hostpath[len1] = '/';
-          memcpy(hostpath + len1 + 1, name, len2);
-          hostpath[len1 + 1 + len2] = '\0';
-          ret = len1 + 1 + len2;
-        }
-        break;
-      } else {
-        len1 = strlen(name);
-        if (len1 >= VFS_PATH_MAX) {
-          ret = enametoolong();
-        } else {
-          memcpy(hostpath, name, len1 + 1);
-          ret = len1;
-        }
-        break;
-      }
+  hostdevice = (struct HostfsDevice *)dir->device->data;
+  for (anchor = dir; anchor && anchor->dev == dir->dev;
+       anchor = anchor->parent) {
+    if (anchor->data && ((struct HostfsInfo *)anchor->data)->filefd != -1) {
+      break;
     }
-    currentdir = currentdir->parent;
   }
-  if (ret == -1 && (!currentdir || currentdir->dev != dir->dev)) {
+  absolute = false;
+  if (anchor && anchor->dev == dir->dev) {
+    *hostfd = ((struct HostfsInfo *)anchor->data)->filefd;
+  } else if (hostdevice->rootfd != -1) {
+    *hostfd = hostdevice->rootfd;
+    anchor = dir->device->root;
+  } else {
     *hostfd = AT_FDCWD;
-    if ((len1 = VfsPathBuild(dir, dir->device->root, true, hostpath)) == -1) {
-      ret = -1;
-    } else {
-      len2 = strlen(name);
-      hostdevice = (struct HostfsDevice *)dir->device->data;
-      ret = hostdevice->sourcelen + len1 +
-            // add a slash if the host path doesn't end with one
-            ((len2 == 0) ? 0 : len2 + (hostpath[len1 - 1] != '/'));
-      if (ret + 1 >= VFS_PATH_MAX) {
-        ret = enametoolong();
-      } else {
-        memmove(hostpath + hostdevice->sourcelen, hostpath, len1);
-        memcpy(hostpath, hostdevice->source, hostdevice->sourcelen);
-        if (len2 != 0) {
-          if (hostpath[hostdevice->sourcelen + len1 - 1] != '/') {
-            hostpath[hostdevice->sourcelen + len1] = '/';
-            ++len1;
-          }
-          memcpy(hostpath + hostdevice->sourcelen + len1, name, len2 + 1);
-        }
-        hostpath[ret] = '\0';
-      }
-    }
+    anchor = dir->device->root;
+    absolute = true;
+  }
+  if ((len1 = VfsPathBuild(dir, anchor, absolute, hostpath)) == -1) {
+    return -1;
+  }
+  prefixlen = absolute ? hostdevice->sourcelen : 0;
+  len2 = strlen(name);
+  slash = len1 && len2 && hostpath[len1 - 1] != '/';
+  ret = prefixlen + len1 + slash + len2;
+  if (ret + 1 >= VFS_PATH_MAX) {
+    return enametoolong();
+  }
+  if (prefixlen) {
+    memmove(hostpath + prefixlen, hostpath, len1);
+    memcpy(hostpath, hostdevice->source, prefixlen);
+    len1 += prefixlen;
+  }
+  if (slash) {
+    hostpath[len1++] = '/';
+  }
+  memcpy(hostpath + len1, name, len2);
+  hostpath[ret] = '\0';
+  if (!ret) {
+    // the anchor directory itself was asked for
+    memcpy(hostpath, ".", 2);
+    ret = 1;
   }
   VFS_LOGF("HostfsGetOptimalDirFdName: output=\"%s\"", hostpath);
   return ret;
@@ -368,8 +384,248 @@ cleananddie:
   return -1;
 }
 
-int HostfsTraverse(struct VfsInfo **dir, const char **path,
-                   struct VfsInfo *root) {
+// Hostfs dentry cache.
+//
+// Resolving a path on the host costs one fstatat() per component, each
+// of which has the host kernel walk the path from the dirfd again, and
+// one VfsInfo allocation per component. This direct-mapped table maps
+// (parent VfsInfo, name) to the child VfsInfo a previous traversal has
+// built, which makes chains of parents stable objects that can be hit
+// again. Since other processes may change the host filesystem, a walk
+// over cached components is confirmed by statting the host path it led
+// to once, and the whole table is flushed if that doesn't match.
+
+static struct HostfsDentries {
+  pthread_mutex_t_ lock;
+  struct VfsInfo *entry[HOSTFS_DENTRIES];
+} g_hostfsdentries = {
+    .lock = PTHREAD_MUTEX_INITIALIZER_,
+};
+
+static struct VfsInfo **HostfsDentrySlot(struct VfsInfo *parent,
+                                         const char *name, size_t namelen) {
+  return g_hostfsdentries.entry +
+         HostfsHash((uintptr_t)parent, name, namelen) % HOSTFS_DENTRIES;
+}
+
+static bool HostfsDentryMatches(struct VfsInfo *info, struct VfsInfo *parent,
+                                const char *name, size_t namelen) {
+  return info && info->parent == parent && info->namelen == namelen &&
+         !memcmp(info->name, name, namelen);
+}
+
+// returns new reference to cached child of parent, or null
+static struct VfsInfo *HostfsLookupDentry(struct VfsInfo *parent,
+                                          const char *name, size_t namelen) {
+  struct VfsInfo *info, **slot;
+  LOCK(&g_hostfsdentries.lock);
+  slot = HostfsDentrySlot(parent, name, namelen);
+  if (HostfsDentryMatches(*slot, parent, name, namelen)) {
+    unassert(!VfsAcquireInfo(*slot, &info));
+  } else {
+    info = NULL;
+  }
+  UNLOCK(&g_hostfsdentries.lock);
+  return info;
+}
+
+static void HostfsInsertDentry(struct VfsInfo *info) {
+  struct VfsInfo *old, **slot;
+  LOCK(&g_hostfsdentries.lock);
+  slot = HostfsDentrySlot(info->parent, info->name, info->namelen);
+  old = *slot;
+  unassert(!VfsAcquireInfo(info, slot));
+  UNLOCK(&g_hostfsdentries.lock);
+  unassert(!VfsFreeInfo(old));
+}
+
+static void HostfsForgetDentry(struct VfsInfo *parent, const char *name) {
+  size_t namelen;
+  struct VfsInfo *old, **slot;
+  namelen = strlen(name);
+  LOCK(&g_hostfsdentries.lock);
+  slot = HostfsDentrySlot(parent, name, namelen);
+  if (HostfsDentryMatches(*slot, parent, name, namelen)) {
+    old = *slot;
+    *slot = NULL;
+  } else {
+    old = NULL;
+  }
+  UNLOCK(&g_hostfsdentries.lock);
+  unassert(!VfsFreeInfo(old));
+}
+
+static void HostfsFlushDentries(void) {
+  int i;
+  LOCK(&g_hostfsdentries.lock);
+  for (i = 0; i < HOSTFS_DENTRIES; ++i) {
+    unassert(!VfsFreeInfo(g_hostfsdentries.entry[i]));
+    g_hostfsdentries.entry[i] = NULL;
+  }
+  UNLOCK(&g_hostfsdentries.lock);
+}
+
+// checks that hostpath, which ends with a slash, still leads to info
+static bool HostfsDentryIsValid(int hostfd, char *hostpath, size_t hostpathlen,
+                                struct VfsInfo *info) {
+  bool res;
+  struct stat st;
+  unassert(hostpathlen && hostpath[hostpathlen - 1] == '/');
+  hostpath[hostpathlen - 1] = '\0';
+  res = fstatat(hostfd, hostpath, &st, AT_SYMLINK_NOFOLLOW) != -1 &&
+        st.st_mode == info->mode &&
+        HostfsHash(st.st_dev, (const char *)&st.st_ino, sizeof(st.st_ino)) ==
+            info->ino;
+  hostpath[hostpathlen - 1] = '/';
+  return res;
+}
+
+// Directory walkers like find, du, ls -l and git status stat every name
+// that getdents() just returned. Linux has no readdirplus system call,
+// so we remember the names a HostfsReaddir() listed; once the guest is
+// seen statting what it lists, the stat is performed right away while
+// the listing is being read, relative to the open directory descriptor
+// so no path needs to be built, and a HostfsStat() that follows can be
+// answered from this table. Entries are dropped after kHostfsStatCacheMs
+// or as soon as this process changes anything through hostfs, by way of
+// a generation counter. Changes made by other processes are only seen
+// once the entry expires, which is the same window of staleness that an
+// NFS client with attribute caching would have.
+
+#define HOSTFS_STATS        2048  // power of two
+#define HOSTFS_STAT_PROBE   8
+#define HOSTFS_STAT_NAME    56
+#define HOSTFS_PREFETCH     4
+#define HOSTFS_PREFETCH_MAX 64
+
+struct HostfsStatEntry {
+  bool hasstat;
+  bool wasused;
+  u8 namelen;
+  char name[HOSTFS_STAT_NAME];
+  u64 dir;
+  u64 gen;
+  struct timespec expires;
+  struct stat st;
+};
+
+static struct HostfsStats {
+  pthread_mutex_t_ lock;
+  int score;
+  _Atomic(u64) gen;
+  struct HostfsStatEntry entry[HOSTFS_STATS];
+} g_hostfsstats = {
+    .lock = PTHREAD_MUTEX_INITIALIZER_,
+};
+
+static void HostfsInvalidateStats(void) {
+  atomic_fetch_add_explicit(&g_hostfsstats.gen, 1, memory_order_release);
+}
+
+static bool HostfsStatIsLive(struct HostfsStatEntry *e, struct timespec now) {
+  return e->namelen &&
+         e->gen == atomic_load_explicit(&g_hostfsstats.gen,
+                                        memory_order_acquire) &&
+         CompareTime(now, e->expires) < 0;
+}
+
+static bool HostfsStatMatches(struct HostfsStatEntry *e, u64 dir,
+                              const char *name, size_t namelen) {
+  return e->namelen == namelen && e->dir == dir &&
+         !memcmp(e->name, name, namelen);
+}
+
+// returns live entry for name, or the best slot to replace if absent
+static struct HostfsStatEntry *HostfsStatSlot(u64 dir, const char *name,
+                                              size_t namelen,
+                                              struct timespec now) {
+  int i;
+  u64 hash;
+  struct HostfsStatEntry *e, *victim;
+  hash = HostfsHash(dir, name, namelen);
+  for (victim = NULL, i = 0; i < HOSTFS_STAT_PROBE; ++i) {
+    e = g_hostfsstats.entry + ((hash + i) & (HOSTFS_STATS - 1));
+    if (!HostfsStatIsLive(e, now)) {
+      if (!victim || HostfsStatIsLive(victim, now)) victim = e;
+    } else if (HostfsStatMatches(e, dir, name, namelen)) {
+      return e;
+    } else if (!victim || (HostfsStatIsLive(victim, now) &&
+                           CompareTime(e->expires, victim->expires) < 0)) {
+      victim = e;
+    }
+  }
+  return victim;
+}
+
+// records that dirfd listed name, prefetching its stat when it pays off
+static void HostfsListedEntry(struct VfsInfo *dir, int dirfd,
+                              const char *name) {
+  bool prefetch;
+  size_t namelen;
+  struct stat st;
+  struct timespec now;
+  struct HostfsStatEntry *e;
+  if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) return;
+  if ((namelen = strlen(name)) > HOSTFS_STAT_NAME) return;
+  prefetch = g_hostfsstats.score >= HOSTFS_PREFETCH &&
+             fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != -1;
+  now = GetMonotonic();
+  LOCK(&g_hostfsstats.lock);
+  e = HostfsStatSlot(dir->ino, name, namelen, now);
+  if (HostfsStatIsLive(e, now) && e->hasstat && !e->wasused &&
+      !HostfsStatMatches(e, dir->ino, name, namelen) &&
+      g_hostfsstats.score > 0) {
+    --g_hostfsstats.score;  // evicting a prefetch nobody asked for
+  }
+  e->hasstat = prefetch;
+  e->wasused = false;
+  e->namelen = namelen;
+  memcpy(e->name, name, namelen);
+  e->dir = dir->ino;
+  e->gen = atomic_load_explicit(&g_hostfsstats.gen, memory_order_acquire);
+  e->expires = AddTime(now, FromMilliseconds(kHostfsStatCacheMs));
+  if (prefetch) e->st = st;
+  UNLOCK(&g_hostfsstats.lock);
+}
+
+// answers stat of a recently listed name without a host system call
+static bool HostfsLookupStat(struct VfsInfo *parent, const char *name,
+                             struct stat *st, int flags) {
+  bool hit;
+  size_t namelen;
+  struct timespec now;
+  struct HostfsStatEntry *e;
+  if (flags & ~AT_SYMLINK_NOFOLLOW) return false;
+  if ((namelen = strlen(name)) > HOSTFS_STAT_NAME) return false;
+  hit = false;
+  now = GetMonotonic();
+  LOCK(&g_hostfsstats.lock);
+  e = HostfsStatSlot(parent->ino, name, namelen, now);
+  if (HostfsStatIsLive(e, now) &&
+      HostfsStatMatches(e, parent->ino, name, namelen)) {
+    if (!e->hasstat) {
+      // the guest stats what it lists, so start prefetching
+      g_hostfsstats.score = MIN(g_hostfsstats.score + 2, HOSTFS_PREFETCH_MAX);
+      e->namelen = 0;
+    } else if (!S_ISLNK(e->st.st_mode) || (flags & AT_SYMLINK_NOFOLLOW)) {
+      if (!e->wasused) {
+        g_hostfsstats.score = MIN(g_hostfsstats.score + 1, HOSTFS_PREFETCH_MAX);
+      }
+      e->wasused = true;
+      *st = e->st;
+      hit = true;
+    }
+  }
+  UNLOCK(&g_hostfsstats.lock);
+  if (hit) {
+    STATISTIC(++hostfs_stat_hits);
+  }
+  return hit;
+}
+
+static int HostfsTraverseImpl(struct VfsInfo **dir, const char **path,
+                              struct VfsInfo *root, bool usecache,
+                              bool *stale) {
   char hostpath[VFS_PATH_MAX];
   struct VfsInfo *next, *original;
   struct HostfsInfo *nexthost;
@@ -378,6 +634,7 @@ int HostfsTraverse(struct VfsInfo **dir, const char **path,
   ssize_t hostpathlen, currentnamelen;
   u32 currentdev;
   int hostfd;
+  bool unverified;
   VFS_LOGF("HostfsTraverse(%s, \"%s\", %p)", (*dir)->name, *path, root);
   if ((hostpathlen = HostfsGetOptimalDirFdName(*dir, "", &hostfd, hostpath)) ==
       -1) {
@@ -395,6 +652,7 @@ int HostfsTraverse(struct VfsInfo **dir, const char **path,
   next = NULL;
   nexthost = NULL;
   currentdev = (*dir)->dev;
+  unverified = false;
   while (*currentpath) {
     while (*currentpath == '/') {
       ++currentpath;
@@ -410,10 +668,11 @@ int HostfsTraverse(struct VfsInfo **dir, const char **path,
       currentpath = nextpath;
       continue;
     } else if (!strcmp(currentpath, "..")) {
-      currentpath = nextpath;
       if (*dir == root || (*dir)->parent == NULL) {
+        currentpath = nextpath;
         continue;
       }
+      currentpath = nextpath;
       unassert(!VfsAcquireInfo((*dir)->parent, &next));
       unassert(!VfsFreeInfo(*dir));
       *dir = next;
@@ -428,6 +687,9 @@ int HostfsTraverse(struct VfsInfo **dir, const char **path,
         }
         hostpath[hostpathlen] = '\0';
       }
+      if (*dir == original) {
+        unverified = false;
+      }
       continue;
     }
     currentnamelen = nextpath - currentpath;
@@ -441,9 +703,29 @@ int HostfsTraverse(struct VfsInfo **dir, const char **path,
     }
     memcpy(hostpath + hostpathlen, currentpath, currentnamelen);
     hostpath[hostpathlen + currentnamelen] = '\0';
+    if (usecache &&
+        (next = HostfsLookupDentry(*dir, currentpath, currentnamelen))) {
+      STATISTIC(++hostfs_dentry_hits);
+      hostpath[hostpathlen + currentnamelen] = '/';
+      hostpath[hostpathlen + currentnamelen + 1] = '\0';
+      hostpathlen += currentnamelen + 1;
+      // the cached child holds its own reference to the parent
+      unassert(!VfsFreeInfo(*dir));
+      *dir = next;
+      currentpath = nextpath;
+      unverified = true;
+      if (!S_ISDIR(next->mode)) {
+        break;
+      }
+      continue;
+    }
     VFS_LOGF("HostfsTraverse: fstatat(%d, \"%s\", %p, AT_SYMLINK_NOFOLLOW)",
              hostfd, hostpath, &st);
     if (fstatat(hostfd, hostpath, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+      if (unverified &&
+          !HostfsDentryIsValid(hostfd, hostpath, hostpathlen, *dir)) {
+        goto stale;
+      }
       if (original != *dir) {
         *path = currentpath;
         return 0;
@@ -451,6 +733,8 @@ int HostfsTraverse(struct VfsInfo **dir, const char **path,
         return enoent();
       }
     }
+    // the host just resolved every component that came from the cache
+    unverified = false;
     hostpath[hostpathlen + currentnamelen] = '/';
     hostpath[hostpathlen + currentnamelen + 1] = '\0';
     hostpathlen += currentnamelen + 1;
@@ -480,14 +764,28 @@ int HostfsTraverse(struct VfsInfo **dir, const char **path,
     next->refcount = 1;
     next->parent = *dir;
     *dir = next;
+    if (usecache) {
+      STATISTIC(++hostfs_dentry_misses);
+      HostfsInsertDentry(next);
+    }
     currentpath = nextpath;
     VFS_LOGF("HostfsTraverse: Changed current path to \"%s\"", currentpath);
     if (!S_ISDIR(st.st_mode)) {
       break;
     }
   }
+  if (unverified && !HostfsDentryIsValid(hostfd, hostpath, hostpathlen, *dir)) {
+    goto stale;
+  }
   *path = currentpath;
   return 0;
+stale:
+  // walking back might not lead to original if there were ".." parts
+  STATISTIC(++hostfs_dentry_flushes);
+  unassert(!VfsFreeInfo(*dir));
+  unassert(!VfsAcquireInfo(original, dir));
+  *stale = true;
+  return -1;
 cleananddie:
   while (original != *dir) {
     unassert(!VfsAcquireInfo((*dir)->parent, &next));
@@ -497,6 +795,23 @@ cleananddie:
   return -1;
 }
 
+int HostfsTraverse(struct VfsInfo **dir, const char **path,
+                   struct VfsInfo *root) {
+  int rc;
+  bool stale = false;
+  struct VfsInfo *original;
+  // the cache may be holding the only other reference to *dir, so keep
+  // it alive in case we need to go back to it after a stale lookup
+  unassert(!VfsAcquireInfo(*dir, &original));
+  if ((rc = HostfsTraverseImpl(dir, path, root, true, &stale)) == -1 &&
+      stale) {
+    HostfsFlushDentries();
+    rc = HostfsTraverseImpl(dir, path, root, false, &stale);
+  }
+  unassert(!VfsFreeInfo(original));
+  return rc;
+}
+
 ssize_t HostfsReadlink(struct VfsInfo *info, char **output) {
   struct HostfsInfo *hostinfo;
   char *buf;
@@ -564,6 +879,7 @@ int HostfsMkdir(struct VfsInfo *parent, const char *name, mode_t mode) {
   if (HostfsGetOptimalDirFdName(parent, name, &hostfd, hostname) == -1) {
     return -1;
   }
+  HostfsInvalidateStats();
   return mkdirat(hostfd, hostname, mode);
 }
 
@@ -574,6 +890,7 @@ int HostfsMkfifo(struct VfsInfo *parent, const char *name, mode_t mode) {
   if (HostfsGetOptimalDirFdName(parent, name, &hostfd, hostname) == -1) {
     return -1;
   }
+  HostfsInvalidateStats();
   return mkfifoat(hostfd, hostname, mode);
 }
 
@@ -599,6 +916,9 @@ int HostfsOpen(struct VfsInfo *parent, const char *name, int flags, int mode,
   if (HostfsCreateInfo(&outputinfo) == -1) {
     goto cleananddie;
   }
+  if (flags & (O_CREAT | O_TRUNC)) {
+    HostfsInvalidateStats();
+  }
   outputinfo->filefd = openat(hostfd, hostname, flags, mode);
   VFS_LOGF("HostfsOpen: openat(%d, \"%s\", %d, %d) -> %d, %s", hostfd, hostname,
            flags, mode, outputinfo->filefd, strerror(errno));
@@ -647,19 +967,21 @@ int HostfsAccess(struct VfsInfo *parent, const char *name, mode_t mode,
 
 int HostfsStat(struct VfsInfo *parent, const char *name, struct stat *st,
                int flags) {
-  int hostfd, ret;
+  int hostfd;
   char hostname[VFS_PATH_MAX];
   VFS_LOGF("HostfsStat(%p, \"%s\", %p, %d)", parent, name, st, flags);
-  if (HostfsGetOptimalDirFdName(parent, name, &hostfd, hostname) == -1) {
-    return -1;
-  }
-  ret = fstatat(hostfd, hostname, st, flags);
-  if (ret != -1) {
-    st->st_ino =
-        HostfsHash(st->st_dev, (const char *)&st->st_ino, sizeof(st->st_ino));
-    st->st_dev = parent->dev;
+  if (!HostfsLookupStat(parent, name, st, flags)) {
+    if (HostfsGetOptimalDirFdName(parent, name, &hostfd, hostname) == -1) {
+      return -1;
+    }
+    if (fstatat(hostfd, hostname, st, flags) == -1) {
+      return -1;
+    }
   }
-  return ret;
+  st->st_ino =
+      HostfsHash(st->st_dev, (const char *)&st->st_ino, sizeof(st->st_ino));
+  st->st_dev = parent->dev;
+  return 0;
 }
 
 int HostfsFstat(struct VfsInfo *info, struct stat *st) {
@@ -687,6 +1009,7 @@ int HostfsChmod(struct VfsInfo *parent, const char *name, mode_t mode,
   if (HostfsGetOptimalDirFdName(parent, name, &hostfd, hostname) == -1) {
     return -1;
   }
+  HostfsInvalidateStats();
   return fchmodat(hostfd, hostname, mode, flags);
 }
 
@@ -697,6 +1020,7 @@ int HostfsFchmod(struct VfsInfo *info, mode_t mode) {
     return efault();
   }
   hostinfo = (struct HostfsInfo *)info->data;
+  HostfsInvalidateStats();
   return fchmod(hostinfo->filefd, mode);
 }
 
@@ -708,6 +1032,7 @@ int HostfsChown(struct VfsInfo *parent, const char *name, uid_t uid, gid_t gid,
   if (HostfsGetOptimalDirFdName(parent, name, &hostfd, hostname) == -1) {
     return -1;
   }
+  HostfsInvalidateStats();
   return fchownat(hostfd, hostname, uid, gid, flags);
 }
 
@@ -718,6 +1043,7 @@ int HostfsFchown(struct VfsInfo *info, uid_t uid, gid_t gid) {
     return efault();
   }
   hostinfo = (struct HostfsInfo *)info->data;
+  HostfsInvalidateStats();
   return fchown(hostinfo->filefd, uid, gid);
 }
 
@@ -728,6 +1054,7 @@ int HostfsFtruncate(struct VfsInfo *info, off_t length) {
     return efault();
   }
   hostinfo = (struct HostfsInfo *)info->data;
+  HostfsInvalidateStats();
   return ftruncate(hostinfo->filefd, length);
 }
 
@@ -758,6 +1085,7 @@ int HostfsLink(struct VfsInfo *oldparent, const char *oldname,
       -1) {
     return -1;
   }
+  HostfsInvalidateStats();
   return linkat(oldhostfd, oldhostname, newhostfd, newhostname, flags);
 }
 
@@ -768,6 +1096,8 @@ int HostfsUnlink(struct VfsInfo *parent, const char *name, int flags) {
   if (HostfsGetOptimalDirFdName(parent, name, &hostfd, hostname) == -1) {
     return -1;
   }
+  HostfsForgetDentry(parent, name);
+  HostfsInvalidateStats();
   return unlinkat(hostfd, hostname, flags);
 }
 
@@ -788,6 +1118,7 @@ ssize_t HostfsWrite(struct VfsInfo *info, const void *buf, size_t size) {
     return efault();
   }
   hostinfo = (struct HostfsInfo *)info->data;
+  HostfsInvalidateStats();
   return write(hostinfo->filefd, buf, size);
 }
 
@@ -810,6 +1141,7 @@ ssize_t HostfsPwrite(struct VfsInfo *info, const void *buf, size_t size,
     return efault();
   }
   hostinfo = (struct HostfsInfo *)info->data;
+  HostfsInvalidateStats();
   return pwrite(hostinfo->filefd, buf, size, offset);
 }
 
@@ -831,6 +1163,7 @@ ssize_t HostfsWritev(struct VfsInfo *info, const struct iovec *iov,
     return efault();
   }
   hostinfo = (struct HostfsInfo *)info->data;
+  HostfsInvalidateStats();
   return writev(hostinfo->filefd, iov, iovcnt);
 }
 
@@ -853,6 +1186,7 @@ ssize_t HostfsPwritev(struct VfsInfo *info, const struct iovec *iov, int iovcnt,
     return efault();
   }
   hostinfo = (struct HostfsInfo *)info->data;
+  HostfsInvalidateStats();
   return pwritev(hostinfo->filefd, iov, iovcnt, offset);
 }
 
@@ -1142,13 +1476,17 @@ long HostfsTelldir(struct VfsInfo *info) {
 
 struct dirent *HostfsReaddir(struct VfsInfo *info) {
   struct HostfsInfo *hostinfo;
+  struct dirent *ent;
   VFS_LOGF("HostfsReaddir(%p)", info);
   if (info == NULL) {
     efault();
     return NULL;
   }
   hostinfo = (struct HostfsInfo *)info->data;
-  return readdir(hostinfo->dirstream);
+  if ((ent = readdir(hostinfo->dirstream))) {
+    HostfsListedEntry(info, dirfd(hostinfo->dirstream), ent->d_name);
+  }
+  return ent;
 }
 
 void HostfsRewinddir(struct VfsInfo *info) {
@@ -1556,6 +1894,9 @@ int HostfsRename(struct VfsInfo *oldinfo, const char *oldname,
     unassert(!close(oldhostfd));
     return -1;
   }
+  HostfsForgetDentry(oldinfo, oldname);
+  HostfsForgetDentry(newinfo, newname);
+  HostfsInvalidateStats();
   return renameat(oldhostfd, oldhostname, newhostfd, newhostname);
 }
 
@@ -1567,6 +1908,7 @@ int HostfsUtime(struct VfsInfo *info, const char *name,
   if (HostfsGetOptimalDirFdName(info, name, &hostfd, hostname) == -1) {
     return -1;
   }
+  HostfsInvalidateStats();
   return utimensat(hostfd, hostname, times, flags);
 }
 
@@ -1577,6 +1919,7 @@ int HostfsFutime(struct VfsInfo *info, const struct timespec times[2]) {
     return efault();
   }
   hostinfo = (struct HostfsInfo *)info->data;
+  HostfsInvalidateStats();
   if (futimens(hostinfo->filefd, times) == -1) {
     return -1;
   }
@@ -1590,6 +1933,7 @@ int HostfsSymlink(const char *target, struct VfsInfo *info, const char *name) {
   if (HostfsGetOptimalDirFdName(info, name, &hostfd, hostname) == -1) {
     return -1;
   }
+  HostfsInvalidateStats();
   return symlinkat(target, hostfd, hostname);
 }
 
@@ -1617,6 +1961,9 @@ void *HostfsMmap(struct VfsInfo *info, void *addr, size_t len, int prot,
     }
   }
 #endif
+  if ((prot & PROT_WRITE) && (flags & MAP_SHARED)) {
+    HostfsInvalidateStats();
+  }
   ret = mmap(addr, len, prot, flags, fd, offset);
   VFS_LOGF("mmap(%p, %zu, %d, %d, %d, %zd) -> %p", addr, len, prot, flags, fd,
            offset, ret);
@@ -1637,6 +1984,7 @@ int HostfsMprotect(struct VfsInfo *info, void *addr, size_t len, int prot) {
 
 int HostfsMsync(struct VfsInfo *info, void *addr, size_t len, int flags) {
   VFS_LOGF("HostfsMsync(%p, %p, %zu, %d)", info, addr, len, flags);
+  HostfsInvalidateStats();
   // Do nothing, as the host should handle the syncing.
   return 0;
 }
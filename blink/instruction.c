@@ -24,19 +24,22 @@
 #include "blink/linux.h"
 #include "blink/machine.h"
 #include "blink/macros.h"
+#include "blink/native.h"
+#include "blink/rde.h"
 #include "blink/stats.h"
 #include "blink/x86.h"
 
-static bool IsOpcodeEqual(struct XedDecodedInst *xedd, u8 *a) {
+bool IsOpcodeEqual(struct XedDecodedInst *xedd, u8 *a) {
   int n;
   u64 w;
   if ((n = xedd->length)) {
     unassert(n <= 15);
+    w = Read64(a) ^ Read64(xedd->bytes);
     if (n <= 7) {
-      w = Read64(a) ^ Read64(xedd->bytes);
       return !w || (bsf(w) >> 3) >= n;
     } else {
-      return !memcmp(a, xedd->bytes, n);
+      // the last eight opcode bytes overlap the first eight bytes
+      return !w && Read64(a + n - 8) == Read64(xedd->bytes + n - 8);
     }
   } else {
     return false;
@@ -61,7 +64,9 @@ static int LoadInstructionSlow(struct Machine *m, u64 ip) {
   i = 4096 - (ip & 4095);
   STATISTIC(++page_overlaps);
   if ((addr = LookupAddress2(m, ip, PAGE_XD, 0))) {
-    if ((toil = LookupAddress2(m, ip + i, PAGE_XD, 0))) {
+    if (m->system->natives && LoadNative(m, ip, addr)) {
+      return 0;
+    } else if ((toil = LookupAddress2(m, ip + i, PAGE_XD, 0))) {
       memcpy(copy, addr, i);
       memcpy(copy + i, toil, 15 - i);
       return ReadInstruction(m, copy, 15);
@@ -73,22 +78,60 @@ static int LoadInstructionSlow(struct Machine *m, u64 ip) {
   }
 }
 
-int LoadInstruction2(struct Machine *m, u64 pc) {
-  unsigned key;
-  u8 *addr, *page;
+// picks the decoded instruction cache slot for pc. the sets are tagged
+// with the full address, so hot code that's 4096 bytes apart won't keep
+// evicting itself. a miss evicts the oldest way of the set.
+static struct XedDecodedInst *GetIcacheSlot(struct Machine *m, u64 pc) {
+  int way;
+  unsigned set;
+  struct XedDecodedInst *xedd;
+  set = (pc ^ (pc >> 12)) & (kIcacheSets - 1);
+  for (way = 0; way < kIcacheWays; ++way) {
+    if (m->opcache->icachepc[set][way] == pc) {
+      return (struct XedDecodedInst *)m->opcache->icache[set][way];
+    }
+  }
+  memmove(m->opcache->icachepc[set] + 1, m->opcache->icachepc[set],
+          (kIcacheWays - 1) * sizeof(m->opcache->icachepc[set][0]));
+  memmove(m->opcache->icache[set] + 1, m->opcache->icache[set],
+          (kIcacheWays - 1) * sizeof(m->opcache->icache[set][0]));
+  m->opcache->icachepc[set][0] = pc;
+  xedd = (struct XedDecodedInst *)m->opcache->icache[set][0];
+  xedd->length = 0;
+  return xedd;
+}
+
+static void CheckInstructionCache(struct Machine *m) {
   if (atomic_load_explicit(&m->opcache->invalidated, memory_order_acquire)) {
     ResetInstructionCache(m);
     atomic_store_explicit(&m->opcache->invalidated, false,
                           memory_order_relaxed);
+  } else if (atomic_load_explicit(&m->invalidated, memory_order_acquire)) {
+    // the tlb shootdowns get applied when the code page is looked up
+    m->opcache->codevirt = 0;
+    m->opcache->codehost = 0;
+  }
+}
+
+static u8 *GetCodePage(struct Machine *m, u64 virt) {
+  u8 *page;
+  if (virt == m->opcache->codevirt && m->opcache->codehost) {
+    return m->opcache->codehost;
+  } else if ((page = LookupAddress2(m, virt, PAGE_XD, 0))) {
+    m->opcache->codevirt = virt;
+    m->opcache->codehost = page;
+    return page;
+  } else {
+    return 0;
   }
-  key = pc & (ARRAYLEN(m->opcache->icache) - 1);
-  m->xedd = (struct XedDecodedInst *)m->opcache->icache[key];
+}
+
+int LoadInstruction2(struct Machine *m, u64 pc) {
+  u8 *addr, *page;
+  CheckInstructionCache(m);
+  m->xedd = GetIcacheSlot(m, pc);
   if ((pc & 4095) + 15 <= 4096) {
-    if (pc - (pc & 4095) == m->opcache->codevirt && m->opcache->codehost) {
-      addr = m->opcache->codehost + (pc & 4095);
-    } else if ((page = LookupAddress2(m, pc - (pc & 4095), PAGE_XD, 0))) {
-      m->opcache->codevirt = pc - (pc & 4095);
-      m->opcache->codehost = page;
+    if ((page = GetCodePage(m, pc - (pc & 4095)))) {
       addr = page + (pc & 4095);
     } else {
       return kMachineSegmentationFault;
@@ -96,6 +139,8 @@ int LoadInstruction2(struct Machine *m, u64 pc) {
     if (IsOpcodeEqual(m->xedd, addr)) {
       STATISTIC(++instructions_cached);
       return 0;
+    } else if (m->system->natives && LoadNative(m, pc, addr)) {
+      return 0;
     } else {
       return ReadInstruction(m, addr, 15);
     }
@@ -104,6 +149,51 @@ int LoadInstruction2(struct Machine *m, u64 pc) {
   }
 }
 
+// decodes instructions at pc until a branch, or the end of its page.
+// ops that aren't normal, e.g. syscalls, are kept as the last in the
+// block, since the interpreter needs to look at things once they run
+static void DecodeBlock(struct Machine *m, struct DecodedBlock *b, u64 pc,
+                        u8 *page) {
+  unsigned off;
+  struct XedDecodedInst *x;
+  STATISTIC(++blocks_decoded);
+  for (off = pc & 4095, b->n = 0; b->n < kBlockOps && off + 15 <= 4096;) {
+    x = b->xedd + b->n;
+    STATISTIC(++instructions_decoded);
+    if (DecodeInstruction(x, page + off, 15, m->mode.omode)) break;
+    b->ops[b->n++] = GetOpForRde(x->op.rde);
+    if (ClassifyOp(x->op.rde) != kOpNormal) break;
+    off += x->length;
+  }
+  b->pc = b->n ? pc : 0;
+}
+
+/**
+ * Returns pre-decoded basic block of instructions starting at pc.
+ *
+ * Only the first instruction is checked against the bytes at pc, so
+ * the caller needs to do the same for each one that follows, using
+ * the host address of its code page, which is stored to `*page`.
+ *
+ * @return block, or null if pc needs to be loaded the normal way, e.g.
+ *     it's near the end of page, faulted, or failed to decode
+ */
+struct DecodedBlock *LoadDecodedBlock(struct Machine *m, u64 pc, u8 **page) {
+  struct DecodedBlock *b;
+  CheckInstructionCache(m);
+  if ((pc & 4095) + 15 > 4096) return 0;
+  if (m->system->natives) return 0;
+  if (!(*page = GetCodePage(m, pc - (pc & 4095)))) return 0;
+  b = m->opcache->blocks + ((pc ^ (pc >> 12)) & (kBlockSets - 1));
+  if (b->pc == pc && IsOpcodeEqual(b->xedd, *page + (pc & 4095))) {
+    STATISTIC(++blocks_cached);
+  } else {
+    DecodeBlock(m, b, pc, *page);
+    if (!b->n) return 0;
+  }
+  return b;
+}
+
 void LoadInstruction(struct Machine *m, u64 pc) {
   int rc;
   switch ((rc = LoadInstruction2(m, pc))) {
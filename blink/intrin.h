@@ -1,5 +1,6 @@
 #ifndef BLINK_INTRIN_H_
 #define BLINK_INTRIN_H_
+#include "blink/types.h"
 
 #if defined(__x86_64__) && defined(__GNUC__) && __GNUC__ >= 6
 #define X86_INTRINSICS 1
@@ -10,4 +11,22 @@ typedef char char_xmma_t
 #define X86_INTRINSICS 0
 #endif
 
+// gcc/clang vector extensions let portable code use host simd (e.g.
+// neon on aarch64) so long as lanes are laid out in guest byte order
+#if defined(__GNUC__) && (__GNUC__ >= 6 || defined(__clang__)) && \
+    defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define VECTOR_EXTENSIONS 1
+typedef i8 i8x16_t __attribute__((__vector_size__(16)));
+typedef i16 i16x8_t __attribute__((__vector_size__(16)));
+typedef i32 i32x4_t __attribute__((__vector_size__(16)));
+typedef i64 i64x2_t __attribute__((__vector_size__(16)));
+typedef u16 u16x8_t __attribute__((__vector_size__(16)));
+typedef u32 u32x4_t __attribute__((__vector_size__(16)));
+typedef u64 u64x2_t __attribute__((__vector_size__(16)));
+typedef float f32x4_t __attribute__((__vector_size__(16)));
+typedef double f64x2_t __attribute__((__vector_size__(16)));
+#else
+#define VECTOR_EXTENSIONS 0
+#endif
+
 #endif /* BLINK_INTRIN_H_ */
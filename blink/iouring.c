@@ -0,0 +1,871 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/bitscan.h"
+#include "blink/dll.h"
+#include "blink/endian.h"
+#include "blink/errno.h"
+#include "blink/fds.h"
+#include "blink/linux.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/syscall.h"
+#include "blink/thread.h"
+#include "blink/timespec.h"
+#include "blink/vfs.h"
+#include "blink/xlat.h"
+
+/**
+ * @fileoverview io_uring emulation
+ *
+ * Guests map the submission and completion rings by calling mmap() on
+ * the ring file descriptor, which is an unlinked sparse host file that
+ * has been sized so the kernel's magic region offsets are meaningful.
+ * Blink keeps its own host mapping of the same file, so both sides see
+ * the same ring memory regardless of whether linear mode is in use.
+ *
+ * Operations are executed by io_uring_enter() on the submitting thread.
+ * Anything that could block on a pipe or socket is first put on a list
+ * of pending ops, whose readiness is checked for all at once using one
+ * host poll() system call. Ops on regular files are always ready, so a
+ * batch of reads and writes completes within a single guest syscall.
+ */
+
+#ifdef DISABLE_VFS
+
+#define IOURING_CONTAINER(e) DLL_CONTAINER(struct IoUring, elem, e)
+
+#define kIoUringMaxEntries 32768
+
+// our layout of the submission ring region
+#define kSqHead    0
+#define kSqTail    64
+#define kSqMask    128
+#define kSqEntries 132
+#define kSqFlags   136
+#define kSqDropped 140
+#define kSqArray   192
+
+// our layout of the completion ring region
+#define kCqHead     0
+#define kCqTail     64
+#define kCqMask     128
+#define kCqEntries  132
+#define kCqOverflow 136
+#define kCqFlags    140
+#define kCqCqes     192
+
+struct IoUringOp {
+  struct io_uring_sqe_linux sqe;
+  struct timespec deadline;  // when a timeout op expires
+  u32 mark;                  // completions when a timeout op began
+  bool waits;                // linked to the op submitted before it
+  bool done;                 // result is already known
+  i32 res;                   // result if done
+};
+
+struct IoUring {
+  struct Dll elem;
+  dev_t dev;
+  ino_t ino;
+  int users;
+  bool closed;
+  u8 *sq;
+  u8 *cq;
+  u8 *sqes;
+  size_t sqsize;
+  size_t cqsize;
+  size_t sqessize;
+  u32 sqentries;
+  u32 cqentries;
+  u32 completions;
+  int nops;
+  int mops;
+  struct IoUringOp *ops;
+  pthread_mutex_t_ lock;
+};
+
+static struct IoUrings {
+  pthread_mutex_t_ lock;
+  struct Dll *list;
+} g_iourings = {
+    PTHREAD_MUTEX_INITIALIZER_,
+};
+
+static int CloseIoUring(int);
+
+static ssize_t ReadvIoUring(int fildes, const struct iovec *iov, int iovcnt) {
+  return einval();
+}
+
+static ssize_t WritevIoUring(int fildes, const struct iovec *iov, int iovcnt) {
+  return einval();
+}
+
+static int TcgetwinsizeIoUring(int fildes, struct winsize *ws) {
+  return enotty();
+}
+
+static int TcsetwinsizeIoUring(int fildes, const struct winsize *ws) {
+  return enotty();
+}
+
+static const struct FdCb kFdCbIoUring = {
+    .close = CloseIoUring,
+    .readv = ReadvIoUring,
+    .writev = WritevIoUring,
+    .poll = VfsPoll,
+    .tcgetattr = VfsTcgetattr,
+    .tcsetattr = VfsTcsetattr,
+    .tcgetwinsize = TcgetwinsizeIoUring,
+    .tcsetwinsize = TcsetwinsizeIoUring,
+};
+
+static u32 RoundUpTwoPow(u32 x) {
+  return x > 1 ? 2u << bsr(x - 1) : 1;
+}
+
+static void FreeIoUring(struct IoUring *r) {
+  if (r->sq) unassert(!munmap(r->sq, r->sqsize));
+  if (r->cq) unassert(!munmap(r->cq, r->cqsize));
+  if (r->sqes) unassert(!munmap(r->sqes, r->sqessize));
+  unassert(!pthread_mutex_destroy(&r->lock));
+  free(r->ops);
+  free(r);
+}
+
+static struct IoUring *AcquireIoUring(struct Machine *m, i32 fildes) {
+  struct Fd *fd;
+  struct Dll *e;
+  struct stat st;
+  struct IoUring *r;
+  LOCK(&m->system->fds.lock);
+  fd = GetFd(&m->system->fds, fildes);
+  UNLOCK(&m->system->fds.lock);
+  if (!fd) return 0;
+  if (fstat(fildes, &st)) return 0;
+  LOCK(&g_iourings.lock);
+  for (r = 0, e = dll_first(g_iourings.list); e;
+       e = dll_next(g_iourings.list, e)) {
+    if (IOURING_CONTAINER(e)->dev == st.st_dev &&
+        IOURING_CONTAINER(e)->ino == st.st_ino) {
+      r = IOURING_CONTAINER(e);
+      ++r->users;
+      break;
+    }
+  }
+  UNLOCK(&g_iourings.lock);
+  if (!r) eopnotsupp();
+  return r;
+}
+
+static void ReleaseIoUring(struct IoUring *r) {
+  bool gone;
+  LOCK(&g_iourings.lock);
+  gone = !--r->users && r->closed;
+  UNLOCK(&g_iourings.lock);
+  if (gone) FreeIoUring(r);
+}
+
+// returns true if some other guest fd still refers to the ring file
+static bool IsIoUringStillOpen(dev_t dev, ino_t ino) {
+  struct Fd *fd;
+  struct Dll *e;
+  struct stat st;
+  bool res = false;
+  if (!g_machine) return false;
+  LOCK(&g_machine->system->fds.lock);
+  for (e = dll_first(g_machine->system->fds.list); e;
+       e = dll_next(g_machine->system->fds.list, e)) {
+    fd = FD_CONTAINER(e);
+    if (fd->cb == &kFdCbIoUring && !fstat(fd->fildes, &st) &&
+        st.st_dev == dev && st.st_ino == ino) {
+      res = true;
+      break;
+    }
+  }
+  UNLOCK(&g_machine->system->fds.lock);
+  return res;
+}
+
+static int CloseIoUring(int fildes) {
+  int rc;
+  bool ok;
+  bool gone;
+  struct Dll *e;
+  struct stat st;
+  struct IoUring *r;
+  ok = !fstat(fildes, &st);
+  rc = VfsClose(fildes);
+  if (!ok || IsIoUringStillOpen(st.st_dev, st.st_ino)) return rc;
+  LOCK(&g_iourings.lock);
+  for (r = 0, e = dll_first(g_iourings.list); e;
+       e = dll_next(g_iourings.list, e)) {
+    if (IOURING_CONTAINER(e)->dev == st.st_dev &&
+        IOURING_CONTAINER(e)->ino == st.st_ino) {
+      r = IOURING_CONTAINER(e);
+      dll_remove(&g_iourings.list, e);
+      r->closed = true;
+      break;
+    }
+  }
+  gone = r && !r->users;
+  UNLOCK(&g_iourings.lock);
+  if (gone) FreeIoUring(r);
+  return rc;
+}
+
+static void *MapIoUring(int fildes, size_t size, off_t offset) {
+  void *p;
+  p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fildes, offset);
+  return p != MAP_FAILED ? p : 0;
+}
+
+static struct IoUring *NewIoUring(int fildes, u32 sqentries, u32 cqentries) {
+  struct stat st;
+  struct IoUring *r;
+  if (!(r = (struct IoUring *)calloc(1, sizeof(*r)))) return 0;
+  unassert(!pthread_mutex_init(&r->lock, 0));
+  dll_init(&r->elem);
+  r->sqentries = sqentries;
+  r->cqentries = cqentries;
+  r->sqsize = kSqArray + sqentries * 4;
+  r->cqsize = kCqCqes + cqentries * sizeof(struct io_uring_cqe_linux);
+  r->sqessize = sqentries * sizeof(struct io_uring_sqe_linux);
+  if (fstat(fildes, &st) ||
+      ftruncate(fildes, IORING_OFF_SQES_LINUX + r->sqessize) ||
+      !(r->sq = (u8 *)MapIoUring(fildes, r->sqsize,  //
+                                 IORING_OFF_SQ_RING_LINUX)) ||
+      !(r->cq = (u8 *)MapIoUring(fildes, r->cqsize,  //
+                                 IORING_OFF_CQ_RING_LINUX)) ||
+      !(r->sqes = (u8 *)MapIoUring(fildes, r->sqessize,  //
+                                   IORING_OFF_SQES_LINUX))) {
+    FreeIoUring(r);
+    return 0;
+  }
+  r->dev = st.st_dev;
+  r->ino = st.st_ino;
+  Write32(r->sq + kSqMask, sqentries - 1);
+  Write32(r->sq + kSqEntries, sqentries);
+  Write32(r->cq + kCqMask, cqentries - 1);
+  Write32(r->cq + kCqEntries, cqentries);
+  return r;
+}
+
+int SysIoUringSetup(struct Machine *m, u32 entries, i64 paramsaddr) {
+  int lim;
+  int fildes;
+  struct Fd *fd;
+  struct IoUring *r;
+  u32 flags, supported, cqentries;
+  struct io_uring_params_linux p;
+  char path[] = "/tmp/blink.uring.XXXXXX";
+  if (CopyFromUserRead(m, &p, paramsaddr, sizeof(p)) == -1) return -1;
+  flags = Read32(p.flags);
+  supported = IORING_SETUP_CQSIZE_LINUX |        //
+              IORING_SETUP_CLAMP_LINUX |         //
+              IORING_SETUP_SUBMIT_ALL_LINUX |    //
+              IORING_SETUP_COOP_TASKRUN_LINUX |  //
+              IORING_SETUP_SINGLE_ISSUER_LINUX;
+  if (flags & ~supported) {
+    LOGF("%s() unsupported flags: %#" PRIx32, "io_uring_setup",
+         flags & ~supported);
+    return einval();
+  }
+  if (!entries) return einval();
+  if (entries > kIoUringMaxEntries) {
+    if (!(flags & IORING_SETUP_CLAMP_LINUX)) return einval();
+    entries = kIoUringMaxEntries;
+  }
+  entries = RoundUpTwoPow(entries);
+  if (flags & IORING_SETUP_CQSIZE_LINUX) {
+    if (!(cqentries = Read32(p.cq_entries))) return einval();
+    if (cqentries > kIoUringMaxEntries * 2) {
+      if (!(flags & IORING_SETUP_CLAMP_LINUX)) return einval();
+      cqentries = kIoUringMaxEntries * 2;
+    }
+    cqentries = RoundUpTwoPow(cqentries);
+    if (cqentries < entries) return einval();
+  } else {
+    cqentries = entries * 2;
+  }
+  if (!(lim = GetFileDescriptorLimit(m->system))) return emfile();
+  if ((fildes = mkstemp(path)) == -1) return -1;
+  unassert(!unlink(path));
+  unassert(!fcntl(fildes, F_SETFD, FD_CLOEXEC));
+  if (fildes >= lim) {
+    close(fildes);
+    return emfile();
+  }
+  if (!(r = NewIoUring(fildes, entries, cqentries))) {
+    close(fildes);
+    return -1;
+  }
+  memset(&p.sq_off, 0, sizeof(p.sq_off));
+  memset(&p.cq_off, 0, sizeof(p.cq_off));
+  Write32(p.sq_entries, entries);
+  Write32(p.cq_entries, cqentries);
+  Write32(p.features, IORING_FEAT_NODROP_LINUX |         //
+                          IORING_FEAT_SUBMIT_STABLE_LINUX |  //
+                          IORING_FEAT_RW_CUR_POS_LINUX |     //
+                          IORING_FEAT_POLL_32BITS_LINUX |    //
+                          IORING_FEAT_EXT_ARG_LINUX);
+  Write32(p.sq_off.head, kSqHead);
+  Write32(p.sq_off.tail, kSqTail);
+  Write32(p.sq_off.ring_mask, kSqMask);
+  Write32(p.sq_off.ring_entries, kSqEntries);
+  Write32(p.sq_off.flags, kSqFlags);
+  Write32(p.sq_off.dropped, kSqDropped);
+  Write32(p.sq_off.array, kSqArray);
+  Write32(p.cq_off.head, kCqHead);
+  Write32(p.cq_off.tail, kCqTail);
+  Write32(p.cq_off.ring_mask, kCqMask);
+  Write32(p.cq_off.ring_entries, kCqEntries);
+  Write32(p.cq_off.overflow, kCqOverflow);
+  Write32(p.cq_off.cqes, kCqCqes);
+  Write32(p.cq_off.flags, kCqFlags);
+  if (CopyToUserWrite(m, paramsaddr, &p, sizeof(p)) == -1) {
+    FreeIoUring(r);
+    close(fildes);
+    return -1;
+  }
+  LOCK(&g_iourings.lock);
+  dll_make_last(&g_iourings.list, &r->elem);
+  UNLOCK(&g_iourings.lock);
+  LOCK(&m->system->fds.lock);
+  unassert(fd = AddFd(&m->system->fds, fildes, O_RDWR | O_CLOEXEC));
+  fd->cb = &kFdCbIoUring;
+  fd->path = strdup("anon_inode:[io_uring]");
+  UNLOCK(&m->system->fds.lock);
+  return fildes;
+}
+
+static int XlatIoUringPollEvents(u32 ev) {
+  return ((ev & POLLIN_LINUX) ? POLLIN : 0) |    //
+         ((ev & POLLPRI_LINUX) ? POLLPRI : 0) |  //
+         ((ev & POLLOUT_LINUX) ? POLLOUT : 0);
+}
+
+static u32 UnXlatIoUringPollEvents(int ev) {
+  return ((ev & POLLIN) ? POLLIN_LINUX : 0) |    //
+         ((ev & POLLPRI) ? POLLPRI_LINUX : 0) |  //
+         ((ev & POLLOUT) ? POLLOUT_LINUX : 0) |  //
+         ((ev & POLLERR) ? POLLERR_LINUX : 0) |  //
+         ((ev & POLLHUP) ? POLLHUP_LINUX : 0) |  //
+         ((ev & POLLNVAL) ? POLLNVAL_LINUX : 0);
+}
+
+static bool IsIoUringOpSupported(int opcode) {
+  switch (opcode) {
+    case IORING_OP_NOP_LINUX:
+    case IORING_OP_READV_LINUX:
+    case IORING_OP_WRITEV_LINUX:
+    case IORING_OP_FSYNC_LINUX:
+    case IORING_OP_POLL_ADD_LINUX:
+    case IORING_OP_POLL_REMOVE_LINUX:
+    case IORING_OP_SENDMSG_LINUX:
+    case IORING_OP_RECVMSG_LINUX:
+    case IORING_OP_TIMEOUT_LINUX:
+    case IORING_OP_TIMEOUT_REMOVE_LINUX:
+    case IORING_OP_ACCEPT_LINUX:
+    case IORING_OP_ASYNC_CANCEL_LINUX:
+    case IORING_OP_CONNECT_LINUX:
+    case IORING_OP_CLOSE_LINUX:
+    case IORING_OP_READ_LINUX:
+    case IORING_OP_WRITE_LINUX:
+    case IORING_OP_SEND_LINUX:
+    case IORING_OP_RECV_LINUX:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// returns true if fd can't be used for reading or writing, in which
+// case polling would never succeed, and linux fails the op with ebadf
+static bool IsIoUringOpFdUnusable(struct IoUringOp *op, int unwanted) {
+  int fl;
+  if ((fl = fcntl(Read32(op->sqe.fd), F_GETFL)) == -1) return true;
+  return (fl & O_ACCMODE) == unwanted;
+}
+
+// returns host poll() events an op needs before it won't block
+static int GetIoUringOpEvents(struct IoUringOp *op) {
+  switch (op->sqe.opcode) {
+    case IORING_OP_READV_LINUX:
+    case IORING_OP_READ_LINUX:
+    case IORING_OP_RECV_LINUX:
+    case IORING_OP_RECVMSG_LINUX:
+    case IORING_OP_ACCEPT_LINUX:
+      if (IsIoUringOpFdUnusable(op, O_WRONLY)) return 0;
+      return POLLIN;
+    case IORING_OP_WRITEV_LINUX:
+    case IORING_OP_WRITE_LINUX:
+    case IORING_OP_SEND_LINUX:
+    case IORING_OP_SENDMSG_LINUX:
+      if (IsIoUringOpFdUnusable(op, O_RDONLY)) return 0;
+      return POLLOUT;
+    case IORING_OP_POLL_ADD_LINUX:
+      return XlatIoUringPollEvents(Read32(op->sqe.op_flags));
+    default:
+      return 0;
+  }
+}
+
+static bool IsIoUringCqFull(struct IoUring *r) {
+  u32 head, tail;
+  tail = Read32(r->cq + kCqTail);
+  head = Read32(r->cq + kCqHead);
+  atomic_thread_fence(memory_order_acquire);
+  return tail - head >= r->cqentries;
+}
+
+static u32 CountIoUringCqes(struct IoUring *r) {
+  u32 head, tail;
+  tail = Read32(r->cq + kCqTail);
+  head = Read32(r->cq + kCqHead);
+  atomic_thread_fence(memory_order_acquire);
+  return tail - head;
+}
+
+static void PostIoUringCqe(struct IoUring *r, struct IoUringOp *op, i32 res) {
+  u32 tail;
+  struct io_uring_cqe_linux *cqe;
+  ++r->completions;
+  if (res >= 0 && (op->sqe.flags & IOSQE_CQE_SKIP_SUCCESS_LINUX)) return;
+  tail = Read32(r->cq + kCqTail);
+  cqe = (struct io_uring_cqe_linux *)(r->cq + kCqCqes) +
+        (tail & (r->cqentries - 1));
+  memcpy(cqe->user_data, op->sqe.user_data, sizeof(cqe->user_data));
+  Write32(cqe->res, res);
+  Write32(cqe->flags, 0);
+  atomic_thread_fence(memory_order_release);
+  Write32(r->cq + kCqTail, tail + 1);
+}
+
+static i32 CancelIoUringOps(struct IoUring *r, struct IoUringOp *self,
+                            u64 user_data, int opcode) {
+  int i;
+  struct IoUringOp *op;
+  for (i = 0; i < r->nops; ++i) {
+    op = r->ops + i;
+    if (op != self && !op->done && Read64(op->sqe.user_data) == user_data &&
+        (opcode == -1 || op->sqe.opcode == opcode)) {
+      op->done = true;
+      op->res = -ECANCELED_LINUX;
+      return 0;
+    }
+  }
+  return -ENOENT_LINUX;
+}
+
+static i64 ExecuteIoUringOp(struct Machine *m, struct IoUring *r,
+                            struct IoUringOp *op, int revents) {
+  i64 rc;
+  i32 fildes = Read32(op->sqe.fd);
+  u64 off = Read64(op->sqe.off);
+  u64 addr = Read64(op->sqe.addr);
+  u32 len = Read32(op->sqe.len);
+  u32 opflags = Read32(op->sqe.op_flags);
+  switch (op->sqe.opcode) {
+    case IORING_OP_NOP_LINUX:
+      rc = 0;
+      break;
+    // linux ignores the offset when the file is a pipe, socket or tty
+    case IORING_OP_READV_LINUX:
+      if ((rc = SysPreadv2(m, fildes, addr, len, off, opflags)) == -1 &&
+          errno == ESPIPE) {
+        rc = SysPreadv2(m, fildes, addr, len, -1, opflags);
+      }
+      break;
+    case IORING_OP_WRITEV_LINUX:
+      if ((rc = SysPwritev2(m, fildes, addr, len, off, opflags)) == -1 &&
+          errno == ESPIPE) {
+        rc = SysPwritev2(m, fildes, addr, len, -1, opflags);
+      }
+      break;
+    case IORING_OP_READ_LINUX:
+      if ((i64)off == -1 ||
+          ((rc = SysPread(m, fildes, addr, len, off)) == -1 &&
+           errno == ESPIPE)) {
+        rc = SysRead(m, fildes, addr, len);
+      }
+      break;
+    case IORING_OP_WRITE_LINUX:
+      if ((i64)off == -1 ||
+          ((rc = SysPwrite(m, fildes, addr, len, off)) == -1 &&
+           errno == ESPIPE)) {
+        rc = SysWrite(m, fildes, addr, len);
+      }
+      break;
+    case IORING_OP_FSYNC_LINUX:
+      if (opflags & IORING_FSYNC_DATASYNC_LINUX) {
+        rc = SysFdatasync(m, fildes);
+      } else {
+        rc = SysFsync(m, fildes);
+      }
+      break;
+    case IORING_OP_SEND_LINUX:
+      rc = SysSendto(m, fildes, addr, len, opflags, 0, 0);
+      break;
+    case IORING_OP_RECV_LINUX:
+      rc = SysRecvfrom(m, fildes, addr, len, opflags, 0, 0);
+      break;
+    case IORING_OP_SENDMSG_LINUX:
+#ifndef DISABLE_SOCKETS
+      rc = SysSendmsg(m, fildes, addr, opflags);
+      break;
+#else
+      return -EOPNOTSUPP_LINUX;
+#endif
+    case IORING_OP_RECVMSG_LINUX:
+#ifndef DISABLE_SOCKETS
+      rc = SysRecvmsg(m, fildes, addr, opflags);
+      break;
+#else
+      return -EOPNOTSUPP_LINUX;
+#endif
+    case IORING_OP_ACCEPT_LINUX:
+      rc = SysAccept4(m, fildes, addr, off, opflags);
+      break;
+    case IORING_OP_CONNECT_LINUX:
+      rc = SysConnect(m, fildes, addr, off);
+      break;
+    case IORING_OP_CLOSE_LINUX:
+      rc = SysClose(m, fildes);
+      break;
+    case IORING_OP_POLL_ADD_LINUX:
+      return UnXlatIoUringPollEvents(revents) &
+             (opflags | POLLERR_LINUX | POLLHUP_LINUX | POLLNVAL_LINUX);
+    case IORING_OP_POLL_REMOVE_LINUX:
+      return CancelIoUringOps(r, op, addr, IORING_OP_POLL_ADD_LINUX);
+    case IORING_OP_TIMEOUT_REMOVE_LINUX:
+      return CancelIoUringOps(r, op, addr, IORING_OP_TIMEOUT_LINUX);
+    case IORING_OP_ASYNC_CANCEL_LINUX:
+      return CancelIoUringOps(r, op, addr, -1);
+    default:
+      return -EINVAL_LINUX;
+  }
+  return rc != -1 ? rc : -(XlatErrno(errno) & 0xfff);
+}
+
+// reads what an op needs from guest memory at submission time
+static void PrepareIoUringOp(struct Machine *m, struct IoUring *r,
+                             struct IoUringOp *op) {
+  struct timespec ts;
+  struct timespec_linux gt;
+  op->done = false;
+  if (!IsIoUringOpSupported(op->sqe.opcode) ||
+      (op->sqe.flags & IOSQE_BUFFER_SELECT_LINUX)) {
+    op->done = true;
+    op->res = -EINVAL_LINUX;
+  } else if (op->sqe.flags & IOSQE_FIXED_FILE_LINUX) {
+    // no files are ever registered
+    op->done = true;
+    op->res = -EBADF_LINUX;
+  } else if (op->sqe.opcode == IORING_OP_TIMEOUT_LINUX) {
+    if (Read32(op->sqe.len) != 1 ||
+        CopyFromUserRead(m, &gt, Read64(op->sqe.addr), sizeof(gt)) == -1 ||
+        (i64)Read64(gt.sec) < 0 || Read64(gt.nsec) >= 1000000000) {
+      op->done = true;
+      op->res = -EINVAL_LINUX;
+      return;
+    }
+    ts.tv_sec = MIN(Read64(gt.sec), NUMERIC_MAX(time_t));
+    ts.tv_nsec = Read64(gt.nsec);
+    if (Read32(op->sqe.op_flags) & IORING_TIMEOUT_ABS_LINUX) {
+      ts = SubtractTime(ts, GetMonotonic());
+    }
+    op->deadline = AddTime(GetTime(), ts);
+    op->mark = r->completions;
+  }
+}
+
+// returns true if a timeout op should complete, and sets its result
+static bool IsIoUringTimeoutDue(struct IoUring *r, struct IoUringOp *op,
+                                struct timespec now, i32 *res) {
+  u64 count = Read64(op->sqe.off);
+  if (count && r->completions - op->mark >= count) {
+    *res = 0;
+    return true;
+  } else if (CompareTime(now, op->deadline) >= 0) {
+    *res = -ETIME_LINUX;
+    return true;
+  } else {
+    return false;
+  }
+}
+
+// runs every pending op that's able to make progress before deadline
+// returns -1 w/ eintr if a signal for the guest was delivered instead
+static int RunIoUring(struct Machine *m, struct IoUring *r,
+                      struct timespec deadline) {
+  int i, k;
+  i32 res;
+  struct pollfd *hfds;
+  struct IoUringOp *op;
+  struct timespec now;
+  bool failed, pending, draining;
+  if (!r->nops) return 0;
+  if (!(hfds = (struct pollfd *)AddToFreeList(
+            m, malloc(r->nops * sizeof(*hfds))))) {
+    return enomem();
+  }
+  now = GetTime();
+  for (i = 0; i < r->nops; ++i) {
+    op = r->ops + i;
+    hfds[i].fd = -1;
+    hfds[i].events = 0;
+    hfds[i].revents = 0;
+    if (op->waits) continue;
+    if (op->done) {
+      deadline = GetZeroTime();
+    } else if (op->sqe.opcode == IORING_OP_TIMEOUT_LINUX) {
+      if (IsIoUringTimeoutDue(r, op, now, &res)) {
+        deadline = GetZeroTime();
+      } else if (CompareTime(op->deadline, deadline) < 0) {
+        deadline = op->deadline;
+      }
+    } else if ((hfds[i].events = GetIoUringOpEvents(op))) {
+      hfds[i].fd = Read32(op->sqe.fd);
+    } else {
+      deadline = GetZeroTime();
+    }
+  }
+  if (PollHost(m, hfds, r->nops, deadline) == -1) return -1;
+  now = GetTime();
+  failed = pending = draining = false;
+  for (k = i = 0; i < r->nops; ++i) {
+    op = r->ops + i;
+    if (op->waits) {
+      if (pending) goto KeepIt;
+      op->waits = false;
+      if (failed && !op->done) {
+        op->done = true;
+        op->res = -ECANCELED_LINUX;
+      }
+    }
+    if (draining || ((op->sqe.flags & IOSQE_IO_DRAIN_LINUX) && k)) {
+      draining = true;
+      goto KeepIt;
+    }
+    if (IsIoUringCqFull(r)) goto KeepIt;
+    if (op->done) {
+      res = op->res;
+    } else if (op->sqe.opcode == IORING_OP_TIMEOUT_LINUX) {
+      if (!IsIoUringTimeoutDue(r, op, now, &res)) goto KeepIt;
+    } else if (GetIoUringOpEvents(op)) {
+      if (!hfds[i].revents) goto KeepIt;
+      res = ExecuteIoUringOp(m, r, op, hfds[i].revents);
+      if (res == -EAGAIN_LINUX) goto KeepIt;
+    } else {
+      res = ExecuteIoUringOp(m, r, op, 0);
+    }
+    PostIoUringCqe(r, op, res);
+    failed = res < 0 && !(op->sqe.flags & IOSQE_IO_HARDLINK_LINUX);
+    pending = false;
+    continue;
+  KeepIt:
+    if (k != i) r->ops[k] = *op;
+    failed = false;
+    pending = true;
+    ++k;
+  }
+  r->nops = k;
+  return 0;
+}
+
+// moves submission queue entries onto our list of pending ops
+static u32 SubmitIoUring(struct Machine *m, struct IoUring *r, u32 count) {
+  int n;
+  u32 i, head, tail, index;
+  struct IoUringOp *op, *ops;
+  bool linked = false;
+  head = Read32(r->sq + kSqHead);
+  tail = Read32(r->sq + kSqTail);
+  atomic_thread_fence(memory_order_acquire);
+  count = MIN(count, tail - head);
+  for (i = 0; i < count; ++i, ++head) {
+    if (r->nops == r->mops) {
+      if (r->nops >= r->cqentries) break;
+      n = MIN(MAX(r->mops * 2, 64), r->cqentries);
+      if (!(ops = (struct IoUringOp *)realloc(r->ops, n * sizeof(*ops)))) {
+        break;
+      }
+      r->ops = ops;
+      r->mops = n;
+    }
+    index = Read32(r->sq + kSqArray + (head & (r->sqentries - 1)) * 4);
+    if (index >= r->sqentries) {
+      Write32(r->sq + kSqDropped, Read32(r->sq + kSqDropped) + 1);
+      continue;
+    }
+    op = r->ops + r->nops++;
+    memcpy(&op->sqe, r->sqes + index * sizeof(op->sqe), sizeof(op->sqe));
+    op->waits = linked;
+    linked =
+        !!(op->sqe.flags & (IOSQE_IO_LINK_LINUX | IOSQE_IO_HARDLINK_LINUX));
+    PrepareIoUringOp(m, r, op);
+  }
+  atomic_thread_fence(memory_order_release);
+  Write32(r->sq + kSqHead, head);
+  return i;
+}
+
+static int WaitIoUring(struct Machine *m, struct IoUring *r, u32 min_complete,
+                       struct timespec deadline) {
+  while (r->nops && CountIoUringCqes(r) < min_complete &&
+         !IsIoUringCqFull(r)) {
+    if (CompareTime(GetTime(), deadline) >= 0) {
+#ifdef ETIME
+      errno = ETIME;
+#else
+      errno = ETIMEDOUT;
+#endif
+      return -1;
+    }
+    if (RunIoUring(m, r, deadline) == -1) return -1;
+  }
+  return 0;
+}
+
+int SysIoUringEnter(struct Machine *m, i32 fildes, u32 to_submit,
+                    u32 min_complete, u32 flags, i64 argaddr, u64 argsz) {
+  int rc;
+  u64 tsaddr;
+  struct IoUring *r;
+  struct timespec ts, deadline;
+  struct timespec_linux gt;
+  struct io_uring_getevents_arg_linux arg;
+  if (flags & ~(IORING_ENTER_GETEVENTS_LINUX | IORING_ENTER_SQ_WAKEUP_LINUX |
+                IORING_ENTER_SQ_WAIT_LINUX | IORING_ENTER_EXT_ARG_LINUX)) {
+    return einval();
+  }
+  deadline = GetMaxTime();
+  if (flags & IORING_ENTER_EXT_ARG_LINUX) {
+    if (argsz != sizeof(arg)) return einval();
+    if (CopyFromUserRead(m, &arg, argaddr, sizeof(arg)) == -1) return -1;
+    if (Read64(arg.sigmask)) {
+      LOG_ONCE(LOGF("%s() sigmask not supported yet", "io_uring_enter"));
+    }
+    if ((tsaddr = Read64(arg.ts))) {
+      if (CopyFromUserRead(m, &gt, tsaddr, sizeof(gt)) == -1) return -1;
+      if ((i64)Read64(gt.sec) < 0 || Read64(gt.nsec) >= 1000000000) {
+        return einval();
+      }
+      ts.tv_sec = MIN(Read64(gt.sec), NUMERIC_MAX(time_t));
+      ts.tv_nsec = Read64(gt.nsec);
+      deadline = AddTime(GetTime(), ts);
+    }
+  } else if (argaddr) {
+    LOG_ONCE(LOGF("%s() sigmask not supported yet", "io_uring_enter"));
+  }
+  if (!(r = AcquireIoUring(m, fildes))) return -1;
+  LOCK(&r->lock);
+  if (!(rc = SubmitIoUring(m, r, to_submit)) && to_submit &&
+      Read32(r->sq + kSqTail) != Read32(r->sq + kSqHead)) {
+    // too many ops are already in flight
+    rc = ebusy();
+  } else {
+    RunIoUring(m, r, GetZeroTime());
+    if ((flags & IORING_ENTER_GETEVENTS_LINUX) &&
+        WaitIoUring(m, r, MIN(min_complete, r->cqentries), deadline) == -1 &&
+        !rc) {
+      rc = -1;
+    }
+  }
+  UNLOCK(&r->lock);
+  ReleaseIoUring(r);
+  return rc;
+}
+
+static int ProbeIoUring(struct Machine *m, i64 addr, u32 nargs) {
+  u32 i;
+  u8 *buf;
+  size_t size;
+  struct io_uring_probe_linux *probe;
+  struct io_uring_probe_op_linux *ops;
+  nargs = MIN(nargs, IORING_OP_LAST_LINUX + 1);
+  size = sizeof(*probe) + nargs * sizeof(*ops);
+  if (!(buf = (u8 *)AddToFreeList(m, malloc(size)))) return -1;
+  if (CopyFromUserRead(m, buf, addr, size) == -1) return -1;
+  for (i = 0; i < size; ++i) {
+    if (buf[i]) return einval();
+  }
+  probe = (struct io_uring_probe_linux *)buf;
+  ops = (struct io_uring_probe_op_linux *)(probe + 1);
+  probe->last_op = IORING_OP_LAST_LINUX;
+  probe->ops_len = nargs;
+  for (i = 0; i < nargs; ++i) {
+    ops[i].op = i;
+    if (IsIoUringOpSupported(i)) {
+      Write16(ops[i].flags, IO_URING_OP_SUPPORTED_LINUX);
+    }
+  }
+  return CopyToUserWrite(m, addr, buf, size);
+}
+
+int SysIoUringRegister(struct Machine *m, i32 fildes, u32 opcode, i64 argaddr,
+                       u32 nargs) {
+  struct IoUring *r;
+  if (!(r = AcquireIoUring(m, fildes))) return -1;
+  ReleaseIoUring(r);
+  switch (opcode) {
+    case IORING_REGISTER_PROBE_LINUX:
+      return ProbeIoUring(m, argaddr, nargs);
+    default:
+      LOG_ONCE(LOGF("%s() opcode %" PRIu32 " not supported yet",
+                    "io_uring_register", opcode));
+      return einval();
+  }
+}
+
+#else /* DISABLE_VFS */
+
+// ring memory is shared with the guest by mapping a host file, which is
+// only possible when guest file descriptors are host file descriptors.
+
+int SysIoUringSetup(struct Machine *m, u32 entries, i64 paramsaddr) {
+  return enosys();
+}
+
+int SysIoUringEnter(struct Machine *m, i32 fildes, u32 to_submit,
+                    u32 min_complete, u32 flags, i64 argaddr, u64 argsz) {
+  return enosys();
+}
+
+int SysIoUringRegister(struct Machine *m, i32 fildes, u32 opcode, i64 argaddr,
+                       u32 nargs) {
+  return enosys();
+}
+
+#endif /* DISABLE_VFS */
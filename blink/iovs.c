@@ -45,10 +45,22 @@ void FreeIovs(struct Iovs *ib) {
   }
 }
 
+u64 GetIovsSize(const struct Iovs *ib) {
+  u64 n;
+  unsigned i;
+  for (n = i = 0; i < ib->i; ++i) {
+    n += ib->p[i].iov_len;
+  }
+  return n;
+}
+
 /**
  * Appends memory region to i/o vector builder.
+ *
+ * @param more is how many further regions the caller expects to append
+ *     which is used to size the array in one step if it must be grown
  */
-static int AppendIovs(struct Iovs *ib, void *base, size_t len) {
+static int AppendIovs(struct Iovs *ib, void *base, size_t len, size_t more) {
   unsigned i, n;
   struct iovec *p;
   if (len) {
@@ -69,7 +81,7 @@ static int AppendIovs(struct Iovs *ib, void *base, size_t len) {
         }
       } else {
         STATISTIC(++iov_reallocs);
-        n += n >> 1;
+        n = MAX(n + (n >> 1), MIN(i + 1 + more, GetIovMax()));
         if (p == ib->init) {
           if (!(p = (struct iovec *)malloc(sizeof(*p) * n))) return -1;
           memcpy(p, ib->init, sizeof(ib->init));
@@ -87,8 +99,8 @@ static int AppendIovs(struct Iovs *ib, void *base, size_t len) {
   return 0;
 }
 
-int AppendIovsReal(struct Machine *m, struct Iovs *ib, i64 addr, u64 size,
-                   int prot) {
+static int AppendIovsRealUntimed(struct Machine *m, struct Iovs *ib, i64 addr,
+                                 u64 size, int prot) {
   void *real;
   unsigned got;
   u64 have, mask, need;
@@ -107,19 +119,31 @@ int AppendIovsReal(struct Machine *m, struct Iovs *ib, i64 addr, u64 size,
     if (!(real = LookupAddress2(m, addr, mask, need))) return efault();
     have = 4096 - (addr & 4095);
     got = MIN(size, have);
-    if (AppendIovs(ib, real, got) == -1) return -1;
+    if (AppendIovs(ib, real, got, (size - got + 4095) / 4096) == -1) {
+      return -1;
+    }
     addr += got;
     size -= got;
   }
   return 0;
 }
 
+int AppendIovsReal(struct Machine *m, struct Iovs *ib, i64 addr, u64 size,
+                   int prot) {
+  int rc;
+  u64 t = BeginSyscallOverhead();
+  rc = AppendIovsRealUntimed(m, ib, addr, size, prot);
+  EndSyscallOverhead(t);
+  return rc;
+}
+
 int AppendIovsGuest(struct Machine *m, struct Iovs *iv, i64 iovaddr, int iovlen,
                     int prot) {
   int rc;
   size_t i, iovsize;
   const struct iovec_linux *guestiovs;
   if (iovlen > IOV_MAX_LINUX) return einval();
+  if (!iovlen) return 0;  // e.g. reading MSG_ERRQUEUE control data only
   iovsize = iovlen * sizeof(struct iovec_linux);
   if ((guestiovs = (const struct iovec_linux *)SchlepR(m, iovaddr, iovsize))) {
     for (rc = i = 0; i < iovlen && iv->i < GetIovMax(); ++i) {
@@ -15,6 +15,7 @@ struct Iovs {
 
 void FreeIovs(struct Iovs *);
 void InitIovs(struct Iovs *);
+u64 GetIovsSize(const struct Iovs *);
 int AppendIovsReal(struct Machine *, struct Iovs *, i64, u64, int);
 int AppendIovsGuest(struct Machine *, struct Iovs *, i64, int, int);
 
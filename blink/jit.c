@@ -20,6 +20,7 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
@@ -131,7 +132,9 @@ static struct JitGlobals {
   pthread_mutex_t_ lock;
   _Atomic(long) prot;
   int freecount;
+  long brk;
   struct Dll *freeblocks;
+  _Atomic(unsigned) heat[kJitBlocks];
 } g_jit = {
     PTHREAD_MUTEX_INITIALIZER_,
     PROT_READ | PROT_WRITE | PROT_EXEC,
@@ -166,6 +169,38 @@ static inline unsigned ShallNotPass(unsigned gen1, _Atomic(unsigned) *genptr) {
   return is_being_actively_changed | we_lost_race_with_writers;
 }
 
+// returns generation of the pages hashing to the same slot as `page`
+static _Atomic(unsigned) *GetJitPageGen(struct Jit *jit, i64 page) {
+  return jit->pagegens + (((u64)page >> 12) & (kJitPageGens - 1));
+}
+
+static _Atomic(struct JitPageHooks *) *GetJitPageHooks(struct Jit *jit,
+                                                       i64 page) {
+  return jit->pagehooks + (((u64)page >> 12) & (kJitPageHooks - 1));
+}
+
+// remembers what a path starting at virt will need to stay valid. it
+// may read guest code from its first page and the page after it, and
+// jumps into other paths are tracked as edges, so resets elsewhere in
+// guest memory won't make the path go stale.
+static void GetJitGens(struct Jit *jit, struct JitGens *g, i64 virt) {
+  i64 page = virt & -4096;
+  g->path = atomic_load_explicit(&jit->pathgen, memory_order_acquire);
+  g->page[0] =
+      atomic_load_explicit(GetJitPageGen(jit, page), memory_order_acquire);
+  g->page[1] = atomic_load_explicit(GetJitPageGen(jit, page + 4096),
+                                    memory_order_acquire);
+}
+
+// determines if path starting at virt lost a race with a reset
+static unsigned IsJitStale(struct Jit *jit, const struct JitGens *g,
+                           i64 virt) {
+  i64 page = virt & -4096;
+  return ShallNotPass(g->path, &jit->pathgen) |
+         ShallNotPass(g->page[0], GetJitPageGen(jit, page)) |
+         ShallNotPass(g->page[1], GetJitPageGen(jit, page + 4096));
+}
+
 // apple forbids rwx memory on their new m1 macbooks and requires that
 // we use a non-posix api in order to have jit. the problem is the api
 // frequently flakes with "Trace/BPT trap: 5" errors. this fixes that.
@@ -309,6 +344,16 @@ static void FreeJitJump(struct JitJump *jj) {
   Free(jj);
 }
 
+// discards every code fixup that's still waiting for its destination
+// @assume jit->lock
+static void DropJitJumps(struct Jit *jit) {
+  int i;
+  for (i = 0; i < kJitJumpBuckets; ++i) {
+    dll_make_first(&jit->freejumps, jit->jumps[i]);
+    jit->jumps[i] = 0;
+  }
+}
+
 static void FreeJitPage(struct JitPage *jp) {
   Free(jp);
 }
@@ -462,12 +507,14 @@ static void InitEdges(struct JitEdges *e) {
   memset(e, 0, sizeof(*e));
   e->n = RoundupTwoPow(kJitInitialEdges);
   unassert(e->src = (i64 *)Calloc(e->n, sizeof(*e->src)));
+  unassert(e->ord = (unsigned *)Calloc(e->n, sizeof(*e->ord)));
   unassert(e->dst = (struct JitInts **)Calloc(e->n, sizeof(*e->dst)));
 }
 
 static void DestroyEdges(struct JitEdges *edges) {
   DestroyIntsAllocator(&edges->jia);
   Free(edges->dst);
+  Free(edges->ord);
   Free(edges->src);
 }
 
@@ -484,17 +531,22 @@ static nosideeffect int GetEdge(const struct JitEdges *edges, i64 src) {
 
 static unsigned GrowEdges(struct JitEdges *edges) {
   i64 *src, *src2;
+  unsigned *ord, *ord2;
   struct JitInts **dst, **dst2;
   unsigned i, i1, i2, n1, n2, used, hash, spot, step;
   i1 = edges->i;
   n1 = edges->n;
   src = edges->src;
+  ord = edges->ord;
   dst = edges->dst;
   unassert(n1 > 1 && IS2POW(n1));
   for (used = i = 0; i < n1; ++i) used += !!dst[i];
   n2 = n1 << (used > (n1 >> 2));
+  ord2 = 0;
   if (!(src2 = (i64 *)Calloc(n2, sizeof(*src2))) ||
+      !(ord2 = (unsigned *)Calloc(n2, sizeof(*ord2))) ||
       !(dst2 = (struct JitInts **)Calloc(n2, sizeof(*dst2)))) {
+    Free(ord2);
     Free(src2);
     return 0;
   }
@@ -505,6 +557,8 @@ static unsigned GrowEdges(struct JitEdges *edges) {
     }
     --i1;
     if (!dst[i]) {
+      // nodes without outgoing edges may forget their order, since
+      // they'll be assigned a new one greater than any of their preds
       continue;
     }
     ++i2;
@@ -517,14 +571,17 @@ static unsigned GrowEdges(struct JitEdges *edges) {
       ++step;
     } while (src2[spot]);
     src2[spot] = src[i];
+    ord2[spot] = ord[i];
     dst2[spot] = dst[i];
   }
   unassert(!i1);
   edges->i = i2;
   edges->n = n2;
   edges->src = src2;
+  edges->ord = ord2;
   edges->dst = dst2;
   Free(src);
+  Free(ord);
   Free(dst);
   return n2;
 }
@@ -572,26 +629,102 @@ static void ClearEdges(struct JitEdges *edges) {
     RemoveEdgesByIndex(edges, i);
   }
   edges->i = 0;
+  edges->ords = 0;
 }
 
-static bool IsCyclic(struct JitEdges *edges, i64 V[kJitDepth], int d, i64 dst) {
-  int i, s;
-  if (d == kJitDepth) {
-    return true;
+// returns slot of node in edge table, inserting it with a new order
+static int GetEdgeNode(struct JitEdges *edges, i64 src) {
+  int s;
+  if (!edges->src[(s = GetEdge(edges, src))]) {
+    edges->src[s] = src;
+    edges->ord[s] = edges->ords++;
+    ++edges->i;
   }
-  for (i = 0; i < d; ++i) {
-    if (dst == V[i]) {
+  return s;
+}
+
+static bool HasVisited(const int *V, int n, int s) {
+  int i;
+  for (i = 0; i < n; ++i) {
+    if (V[i] == s) {
       return true;
     }
   }
-  V[d++] = dst;
-  if (edges->dst[(s = GetEdge(edges, dst))]) {
-    for (i = 0; i < edges->dst[s]->i; ++i) {
-      if (IsCyclic(edges, V, d, edges->dst[s]->p[i])) {
-        return true;
-      }
+  return false;
+}
+
+static void SortByOrder(const struct JitEdges *edges, int *V, int n) {
+  int i, j, x;
+  for (i = 1; i < n; ++i) {
+    x = V[i];
+    for (j = i; j && edges->ord[V[j - 1]] > edges->ord[x]; --j) {
+      V[j] = V[j - 1];
+    }
+    V[j] = x;
+  }
+}
+
+// checks that adding edge src→dst keeps the graph acyclic
+//
+// Every node is given an order such that each edge points from a lower
+// order to a higher one. That makes the common case O(1), since an edge
+// already agreeing with the order can't close a cycle. Otherwise we use
+// the Pearce-Kelly algorithm, which only searches the nodes whose order
+// lies between dst and src, and then shuffles their orders around. The
+// search gives up after kJitVisits nodes, in which case we pretend it's
+// cyclic, since a long chain of direct jumps wouldn't be worth it. The
+// removal of edges never invalidates the order, so it's free to do so.
+static bool IsCyclic(struct JitEdges *edges, struct JitEdges *redges,
+                     i64 src, i64 dst) {
+  struct JitInts *ji;
+  unsigned lo, hi, ord[kJitVisits * 2];
+  int i, j, k, s, x, fn, bn, F[kJitVisits], B[kJitVisits];
+  if (edges->i + 2 > (edges->n >> 1) && !GrowEdges(edges)) return true;
+  x = GetEdgeNode(edges, src);
+  s = GetEdgeNode(edges, dst);
+  if ((hi = edges->ord[x]) < (lo = edges->ord[s])) return false;
+  // find nodes reachable from dst that must come after src
+  fn = 0;
+  F[fn++] = s;
+  for (k = 0; k < fn; ++k) {
+    if (!(ji = edges->dst[F[k]])) continue;
+    for (i = 0; i < ji->i; ++i) {
+      s = GetEdge(edges, ji->p[i]);
+      if (edges->src[s] != ji->p[i]) continue;  // forgotten sink
+      if (s == x) return true;
+      if (edges->ord[s] > hi) continue;
+      if (HasVisited(F, fn, s)) continue;
+      if (fn == kJitVisits) return true;
+      F[fn++] = s;
+    }
+  }
+  // find nodes reaching src that must come before dst
+  bn = 0;
+  B[bn++] = x;
+  for (k = 0; k < bn; ++k) {
+    if (!(ji = redges->dst[GetEdge(redges, edges->src[B[k]])])) continue;
+    for (i = 0; i < ji->i; ++i) {
+      s = GetEdge(edges, ji->p[i]);
+      if (edges->src[s] != ji->p[i]) continue;
+      if (edges->ord[s] < lo) continue;
+      if (HasVisited(B, bn, s)) continue;
+      if (bn == kJitVisits) return true;
+      B[bn++] = s;
+    }
+  }
+  // reassign the orders these nodes had so B comes before F
+  SortByOrder(edges, B, bn);
+  SortByOrder(edges, F, fn);
+  for (i = j = k = 0; i < bn || j < fn;) {
+    if (j == fn || (i < bn && edges->ord[B[i]] < edges->ord[F[j]])) {
+      ord[k++] = edges->ord[B[i++]];
+    } else {
+      ord[k++] = edges->ord[F[j++]];
     }
   }
+  for (k = i = 0; i < bn; ++i) edges->ord[B[i]] = ord[k++];
+  for (i = 0; i < fn; ++i) edges->ord[F[i]] = ord[k++];
+  STATISTIC(++jit_edges_reordered);
   return false;
 }
 
@@ -618,6 +751,14 @@ bool CanJitForImmediateEffect(void) {
   return atomic_load_explicit(&g_jit.prot, memory_order_relaxed) & PROT_EXEC;
 }
 
+// returns index of jit block containing address or -1 if not jit code
+static long GetJitBlockIndex(uintptr_t addr) {
+  uintptr_t base, off;
+  base = ROUNDUP((uintptr_t)g_code, FLAG_pagesize);
+  if ((off = addr - base) >= kJitMemorySize) return -1;
+  return off / kJitBlockSize;
+}
+
 static u8 *AllocateJitMemory(long *state) {
   long i, brk;
   uintptr_t p;
@@ -634,13 +775,17 @@ static u8 *AllocateJitMemory(long *state) {
 static int MakeJitJump(u8 buf[5], uintptr_t pc, uintptr_t addr) {
   int n;
   intptr_t disp;
+  // jit memory is a single static array that's sized so any fixup can
+  // jump directly from one path into another without needing veneers
 #if defined(__x86_64__)
+  _Static_assert(kJitMemorySize < kAmdDispMax, "jit memory exceeds jmp");
   disp = addr - (pc + 5);
   unassert(kAmdDispMin <= disp && disp <= kAmdDispMax);
   buf[0] = kAmdJmp;
   Write32(buf + 1, disp & kAmdDispMask);
   n = 5;
 #elif defined(__aarch64__)
+  _Static_assert(kJitMemorySize / 4 < kArmDispMax, "jit memory exceeds b");
   disp = addr - pc;
   disp >>= 2;
   unassert(kArmDispMin <= disp && disp <= kArmDispMax);
@@ -650,21 +795,52 @@ static int MakeJitJump(u8 buf[5], uintptr_t pc, uintptr_t addr) {
   return n;
 }
 
-// Obtains JitBlock from global pool or creates one if none exist.
+// creates new jit block and sets up its jit memory
+// @assume g_jit.lock
+static struct JitBlock *InitJitBlock(void) {
+  struct JitBlock *jb;
+  if ((jb = NewJitBlock())) {
+    if (!(jb->addr = AllocateJitMemory(&g_jit.brk))) {
+      FreeJitBlock(jb);
+      jb = 0;
+    }
+  }
+  return jb;
+}
+
+// returns number of blocks that could be acquired without retiring any
+static int CountAvailableJitBlocks(void) {
+  int n;
+  LOCK(&g_jit.lock);
+  n = g_jit.freecount + (kJitMemorySize - g_jit.brk) / kJitBlockSize;
+  UNLOCK(&g_jit.lock);
+  return n;
+}
+
+// Obtains JitBlock from global pool or creates one if none exist. The
+// code heap is grown before recycling retired blocks, since those sit
+// at the end of the free list for as long as possible in case another
+// thread is still executing their code.
 static struct JitBlock *AcquireJitBlock(struct Jit *jit) {
   struct Dll *e;
-  struct JitBlock *jb;
+  struct JitBlock *jb = 0;
   LOCK(&g_jit.lock);
-  if ((e = dll_first(g_jit.freeblocks))) {
+  e = dll_first(g_jit.freeblocks);
+  if (!e || JITBLOCK_CONTAINER(e)->wasretired) {
+    jb = InitJitBlock();
+  }
+  if (!jb && e) {
     dll_remove(&g_jit.freeblocks, e);
     jb = JITBLOCK_CONTAINER(e);
     unassert(g_jit.freecount > 0);
     --g_jit.freecount;
-  } else {
-    jb = 0;
   }
   UNLOCK(&g_jit.lock);
-  if (jb) dll_make_last(&jit->agedblocks, &jb->aged);
+  if (jb) {
+    atomic_store_explicit(g_jit.heat + GetJitBlockIndex((uintptr_t)jb->addr), 0,
+                          memory_order_relaxed);
+    dll_make_last(&jit->agedblocks, &jb->aged);
+  }
   JIT_LOGF("acquired jit block %p (freecount=%d)", jb, g_jit.freecount);
   return jb;
 }
@@ -704,6 +880,7 @@ static void RetireJitBlock(struct Jit *jit, struct JitBlock *jb) {
   unassert(dll_is_empty(jb->jumps));
   unassert(dll_is_empty(jb->staged));
   STATISTIC(++jit_blocks_retired);
+  STATISTIC(jit_bytes_retired += jb->index);
   dll_remove(&jit->blocks, &jb->elem);
   dll_remove(&jit->agedblocks, &jb->aged);
   jb->start = 0;
@@ -716,16 +893,72 @@ static void RetireJitBlock(struct Jit *jit, struct JitBlock *jb) {
   UNLOCK(&g_jit.lock);
 }
 
-// creates new jit block and sets up its jit memory
-static struct JitBlock *InitJitBlock(struct Jit *jit, long *state) {
-  struct JitBlock *jb;
-  if ((jb = NewJitBlock())) {
-    if (!(jb->addr = AllocateJitMemory(state))) {
-      FreeJitBlock(jb);
-      jb = 0;
+// adds heap memory to freelist
+// this is intended for synchronization cooloff
+// @assume jit->lock
+static void RetireJitHeap(struct Jit *jit, void *data, size_t size) {
+  struct Dll *e;
+  struct JitFreed *jf = 0;
+  if (!data) return;
+  if (!jit->threaded) {
+    Free(data);
+    return;
+  }
+  if ((e = dll_first(jit->freeds.f))) {
+    dll_remove(&jit->freeds.f, e);
+    jf = JITFREED_CONTAINER(e);
+  } else if (!(jf = NewJitFreed())) {
+    return;  // we can't free data so just leak it
+  }
+  jf->data = data;
+  jf->size = size;
+  dll_make_last(&jit->freeds.p, &jf->elem);
+  ++jit->freeds.n;
+}
+
+// same as calloc, but pilfers old retired heap memory from freelist
+// @assume jit->lock
+static void *GetJitHeap(struct Jit *jit, size_t count, size_t elsize) {
+  u64 size;
+  void *res = 0;
+  struct Dll *e;
+  struct JitFreed *jf;
+  if (CheckedMul(count, elsize, &size)) return 0;
+  if (jit->freeds.n > kJitRetireQueue) {
+    for (e = dll_first(jit->freeds.p); e; e = dll_next(jit->freeds.p, e)) {
+      jf = JITFREED_CONTAINER(e);
+      if (jf->size >= size) {
+        dll_remove(&jit->freeds.p, e);
+        dll_make_first(&jit->freeds.f, e);
+        --jit->freeds.n;
+        res = jf->data;
+        break;
+      }
     }
   }
-  return jb;
+  if (res) {
+    memset(res, 0, size);
+  } else {
+    res = Calloc(1, size);
+  }
+  return res;
+}
+
+static size_t GetJitHooksSize(unsigned n) {
+  return sizeof(struct JitHooks) +
+         n * (sizeof(_Atomic(uintptr_t)) + sizeof(_Atomic(int)));
+}
+
+// allocates empty hash table of jit hooks, with both arrays after it
+// @assume jit->lock
+static struct JitHooks *NewJitHooks(struct Jit *jit, unsigned n) {
+  struct JitHooks *hooks;
+  if ((hooks = (struct JitHooks *)GetJitHeap(jit, 1, GetJitHooksSize(n)))) {
+    hooks->n = n;
+    hooks->virts = (_Atomic(uintptr_t) *)(hooks + 1);
+    hooks->funcs = (_Atomic(int) *)(hooks->virts + n);
+  }
+  return hooks;
 }
 
 static void LockJit(struct Jit *jit) {
@@ -750,11 +983,7 @@ static void UnlockJit(struct Jit *jit) {
  * @return 0 on success
  */
 int InitJit(struct Jit *jit, uintptr_t opt_staging_function) {
-  long brk;
-  unsigned n;
-  struct JitBlock *jb;
-  _Atomic(int) *funcs;
-  _Atomic(uintptr_t) *virts;
+  struct JitHooks *hooks;
   _Static_assert(kJitAlign >= 1, "");
   _Static_assert(kJitBlockSize >= 4096, "");
   _Static_assert(kJitInitialHooks >= 2, "");
@@ -766,19 +995,33 @@ int InitJit(struct Jit *jit, uintptr_t opt_staging_function) {
   InitEdges(&jit->redges);
   jit->staging = EncodeJitFunc(opt_staging_function);
   unassert(!pthread_mutex_init(&jit->lock, 0));
-  jit->hooks.n = n = RoundupTwoPow(kJitInitialHooks);
-  unassert(virts = (_Atomic(uintptr_t) *)Calloc(n, sizeof(*virts)));
-  unassert(funcs = (_Atomic(int) *)Calloc(n, sizeof(*funcs)));
-  atomic_store_explicit(&jit->hooks.virts, virts, memory_order_relaxed);
-  atomic_store_explicit(&jit->hooks.funcs, funcs, memory_order_relaxed);
-  for (brk = 0; (jb = InitJitBlock(jit, &brk));) {
-    dll_make_last(&g_jit.freeblocks, &jb->elem);
-    ++g_jit.freecount;
-  }
+  unassert(hooks = NewJitHooks(jit, RoundupTwoPow(kJitInitialHooks)));
+  atomic_store_explicit(&jit->hooks, hooks, memory_order_relaxed);
   JIT_LOGF("initialized jit %p", jit);
   return 0;
 }
 
+static void FreeJitCache(struct JitCache *jc) {
+  if (!jc) return;
+  Free(jc->dead);
+  Free(jc->page);
+  Free(jc->edge);
+  Free(jc->path);
+  Free(jc);
+}
+
+static void StopJitWorker(struct Jit *jit) {
+  if (!jit->working) return;
+  LOCK(&jit->lock);
+  jit->quitting = true;
+  pthread_cond_signal(&jit->pended);
+  UNLOCK(&jit->lock);
+  unassert(!pthread_join(jit->worker, 0));
+  unassert(!pthread_cond_destroy(&jit->pended));
+  jit->working = false;
+  jit->quitting = false;
+}
+
 /**
  * Destroys initialized JIT object.
  *
@@ -788,8 +1031,14 @@ int InitJit(struct Jit *jit, uintptr_t opt_staging_function) {
  */
 int DestroyJit(struct Jit *jit) {
   struct Dll *e, *e2;
+  StopJitWorker(jit);
   LockJit(jit);
   JIT_LOGF("destroying jit %p", jit);
+  while ((e = dll_first(jit->pending))) {
+    dll_remove(&jit->pending, e);
+    dll_make_first(&jit->freejumps, JITSTAGE_CONTAINER(e)->jumps);
+    FreeJitStage(JITSTAGE_CONTAINER(e));
+  }
   for (e = dll_first(jit->freeds.p); e; e = e2) {
     e2 = dll_next(jit->freeds.p, e);
     FreeJitFreed(JITFREED_CONTAINER(e));
@@ -798,21 +1047,22 @@ int DestroyJit(struct Jit *jit) {
     dll_remove(&jit->blocks, e);
     ReleaseJitBlock(JITBLOCK_CONTAINER(e));
   }
-  dll_make_first(&jit->freejumps, jit->jumps);
+  DropJitJumps(jit);
   for (e = dll_first(jit->freejumps); e; e = e2) {
     e2 = dll_next(jit->freejumps, e);
     FreeJitJump(JITJUMP_CONTAINER(e));
   }
   for (e = dll_first(jit->pages); e; e = e2) {
     e2 = dll_next(jit->pages, e);
+    Free(JITPAGE_CONTAINER(e)->hooks);
     FreeJitPage(JITPAGE_CONTAINER(e));
   }
+  FreeJitCache(jit->cache);
   UnlockJit(jit);
   unassert(!pthread_mutex_destroy(&jit->lock));
   DestroyEdges(&jit->redges);
   DestroyEdges(&jit->edges);
-  Free(jit->hooks.funcs);
-  Free(jit->hooks.virts);
+  Free(atomic_load_explicit(&jit->hooks, memory_order_relaxed));
   return 0;
 }
 
@@ -828,9 +1078,29 @@ int ShutdownJit(void) {
     --g_jit.freecount;
   }
   unassert(!g_jit.freecount);
+  g_jit.brk = 0;
   return 0;
 }
 
+/**
+ * Reports how much of the code heap is held by this jit.
+ *
+ * @param used receives number of bytes of generated code
+ * @param owned receives number of bytes of the blocks that hold it
+ */
+void GetJitUsage(struct Jit *jit, long *used, long *owned) {
+  struct Dll *e;
+  struct JitBlock *jb;
+  *used = *owned = 0;
+  LockJit(jit);
+  for (e = dll_first(jit->agedblocks); e; e = dll_next(jit->agedblocks, e)) {
+    jb = AGEDBLOCK_CONTAINER(e);
+    *used += jb->index;
+    *owned += kJitBlockSize;
+  }
+  UnlockJit(jit);
+}
+
 /**
  * Disables Just-In-Time threader.
  */
@@ -888,6 +1158,43 @@ static struct JitPage *GetJitPage(struct Jit *jit, i64 addr) {
   return 0;
 }
 
+// gives page a direct map of its hooks, if its slot isn't taken, so
+// GetJitHook() can resolve addresses on it without probing the hash
+// table. a page that's created with no free slot just goes without
+// @assume jit->lock
+static void AttachJitPageHooks(struct Jit *jit, struct JitPage *jp) {
+  _Atomic(struct JitPageHooks *) *slot;
+  slot = GetJitPageHooks(jit, jp->page);
+  if (atomic_load_explicit(slot, memory_order_relaxed)) return;
+  if (!(jp->hooks = (struct JitPageHooks *)GetJitHeap(
+            jit, 1, sizeof(struct JitPageHooks)))) {
+    return;
+  }
+  jp->hooks->page = jp->page;
+  atomic_store_explicit(slot, jp->hooks, memory_order_release);
+}
+
+// @assume jit->lock
+static void DetachJitPageHooks(struct Jit *jit, struct JitPage *jp) {
+  if (!jp->hooks) return;
+  atomic_store_explicit(GetJitPageHooks(jit, jp->page), 0,
+                        memory_order_release);
+  RetireJitHeap(jit, jp->hooks, sizeof(struct JitPageHooks));
+  jp->hooks = 0;
+}
+
+// keeps direct map in sync with hash table, for the page owning slot
+// @assume jit->lock
+static void SetJitPageHook(struct Jit *jit, u64 virt, int func) {
+  struct JitPageHooks *ph;
+  ph = atomic_load_explicit(GetJitPageHooks(jit, virt & -4096),
+                            memory_order_relaxed);
+  if (ph && ph->page == (i64)(virt & -4096)) {
+    atomic_store_explicit(ph->funcs + (virt & 4095), func,
+                          memory_order_release);
+  }
+}
+
 // @assume jit->lock
 static struct JitPage *GetOrCreateJitPage(struct Jit *jit, i64 addr) {
   i64 page;
@@ -897,147 +1204,99 @@ static struct JitPage *GetOrCreateJitPage(struct Jit *jit, i64 addr) {
     if ((jp = NewJitPage())) {
       dll_make_first(&jit->pages, &jp->elem);
       jp->page = page;
+      AttachJitPageHooks(jit, jp);
     }
   }
   return jp;
 }
 
-// adds heap memory to freelist
-// this is intended for synchronization cooloff
-// @assume jit->lock
-static void RetireJitHeap(struct Jit *jit, void *data, size_t size) {
-  struct Dll *e;
-  struct JitFreed *jf = 0;
-  if (!data) return;
-  if (!jit->threaded) {
-    Free(data);
-    return;
-  }
-  if ((e = dll_first(jit->freeds.f))) {
-    dll_remove(&jit->freeds.f, e);
-    jf = JITFREED_CONTAINER(e);
-  } else if (!(jf = NewJitFreed())) {
-    return;  // we can't free data so just leak it
-  }
-  jf->data = data;
-  jf->size = size;
-  dll_make_last(&jit->freeds.p, &jf->elem);
-  ++jit->freeds.n;
-}
-
-// same as calloc, but pilfers old retired heap memory from freelist
-// @assume jit->lock
-static void *GetJitHeap(struct Jit *jit, size_t count, size_t elsize) {
-  u64 size;
-  void *res = 0;
-  struct Dll *e;
-  struct JitFreed *jf;
-  if (CheckedMul(count, elsize, &size)) return 0;
-  if (jit->freeds.n > kJitRetireQueue) {
-    for (e = dll_first(jit->freeds.p); e; e = dll_next(jit->freeds.p, e)) {
-      dll_remove(&jit->freeds.p, e);
-      jf = JITFREED_CONTAINER(e);
-      if (jf->size >= size) {
-        res = jf->data;
-        dll_make_first(&jit->freeds.f, e);
-        break;
-      }
-    }
-  }
-  if (res) {
-    memset(res, 0, size);
-  } else {
-    res = Calloc(1, size);
-  }
-  return res;
-}
-
 // @assume jit->lock
-static unsigned RehashJitHooks(struct Jit *jit) {
+static struct JitHooks *RehashJitHooks(struct Jit *jit,
+                                       struct JitHooks *hooks) {
   int func;
   uintptr_t key, virt;
-  unsigned i, i2, n1, n2, used, hash, spot, step, kgen;
-  _Atomic(int) *funcs, *funcs2;
-  _Atomic(uintptr_t) *virts, *virts2;
-  virts = atomic_load_explicit(&jit->hooks.virts, memory_order_relaxed);
-  funcs = atomic_load_explicit(&jit->hooks.funcs, memory_order_relaxed);
+  struct JitHooks *hooks2;
+  unsigned i, i2, n1, n2, used, hash, spot, step;
   // grow allocation unless this rehash is due to many deleted values
-  n1 = atomic_load_explicit(&jit->hooks.n, memory_order_relaxed);
+  n1 = hooks->n;
   unassert(n1 > 1 && IS2POW(n1));
   for (used = i = 0; i < n1; ++i) {
-    used += !!atomic_load_explicit(funcs + i, memory_order_relaxed);
+    used += !!atomic_load_explicit(hooks->funcs + i, memory_order_relaxed);
   }
   n2 = n1 << (used > (n1 >> 2));
   JIT_LOGF("rehashing jit hooks %u -> %u", n1, n2);
   // allocate an entirely new hash table
-  if (!(virts2 = (_Atomic(uintptr_t) *)GetJitHeap(jit, n2, sizeof(*virts2))) ||
-      !(funcs2 = (_Atomic(int) *)GetJitHeap(jit, n2, sizeof(*funcs2)))) {
-    RetireJitHeap(jit, virts2, n2 * sizeof(*virts2));
+  if (!(hooks2 = NewJitHooks(jit, n2))) {
     return 0;
   }
   // copy entries over to new hash table, removing deleted entries
   for (i2 = i = 0; i < n1; ++i) {
-    virt = atomic_load_explicit(virts + i, memory_order_relaxed);
-    func = atomic_load_explicit(funcs + i, memory_order_relaxed);
+    virt = atomic_load_explicit(hooks->virts + i, memory_order_relaxed);
+    func = atomic_load_explicit(hooks->funcs + i, memory_order_relaxed);
     if (virt && func) {
       spot = 0;
       step = 0;
       hash = HASH(virt);
       do {
         spot = (hash + step * ((step + 1) >> 1)) & (n2 - 1);
-        key = atomic_load_explicit(virts2 + spot, memory_order_relaxed);
+        key = atomic_load_explicit(hooks2->virts + spot, memory_order_relaxed);
         unassert(key != virt);
         ++step;
       } while (key);
-      atomic_store_explicit(virts2 + spot, virt, memory_order_relaxed);
-      atomic_store_explicit(funcs2 + spot, func, memory_order_relaxed);
+      atomic_store_explicit(hooks2->virts + spot, virt, memory_order_relaxed);
+      atomic_store_explicit(hooks2->funcs + spot, func, memory_order_relaxed);
       ++i2;
     }
   }
-  // update the hash table pointers for the lockless reader
-  kgen = BeginUpdate(&jit->keygen);
-  atomic_store_explicit(&jit->hooks.virts, virts2, memory_order_release);
-  atomic_store_explicit(&jit->hooks.funcs, funcs2, memory_order_relaxed);
-  atomic_store_explicit(&jit->hooks.n, n2, memory_order_release);
-  EndUpdate(&jit->keygen, kgen);
-  // leak old table so failed reads won't segfault from free munmap
-  RetireJitHeap(jit, virts, n1 * sizeof(*virts));
-  RetireJitHeap(jit, funcs, n1 * sizeof(*funcs));
-  jit->hooks.i = i2;
-  return n2;
+  // publish the new table to lockless readers all at once, who'll use
+  // the old table for as long as they're holding onto it, which is why
+  // it's leaked for a while rather than freed, so reads can't segfault
+  atomic_store_explicit(&jit->hooks, hooks2, memory_order_release);
+  RetireJitHeap(jit, hooks, GetJitHooksSize(n1));
+  jit->hooked = i2;
+  return hooks2;
+}
+
+// probes for spot in hash table. this is guaranteed to halt since we
+// never place more than hooks->n/2 items within this hash table
+static unsigned ProbeJitHooks(struct JitHooks *hooks, u64 virt) {
+  uintptr_t key;
+  unsigned hash, spot, step;
+  spot = 0;
+  step = 0;
+  hash = HASH(virt);
+  do {
+    spot = (hash + step * ((step + 1) >> 1)) & (hooks->n - 1);
+    key = atomic_load_explicit(hooks->virts + spot, memory_order_relaxed);
+    ++step;
+  } while (key && key != virt);
+  return spot;
 }
 
 // @assume jit->lock
 static bool SetJitHookUnlocked(struct Jit *jit, u64 virt, int cas,
                                intptr_t funcaddr) {
   uintptr_t key;
+  unsigned spot;
   int func, oldfunc;
   struct JitPage *jp;
-  _Atomic(int) *funcs;
-  _Atomic(uintptr_t) *virts;
-  unsigned n, kgen, hash, spot, step;
+  struct JitHooks *hooks;
   unassert(virt);
-  // ensure there's room to add this hook
-  unassert(jit->hooks.i <= jit->hooks.n / 2);
-  n = atomic_load_explicit(&jit->hooks.n, memory_order_relaxed);
-  if (jit->hooks.i == n / 2 && !(n = RehashJitHooks(jit))) {
-    DisableJit(jit);
-    return false;
+  hooks = atomic_load_explicit(&jit->hooks, memory_order_relaxed);
+  unassert(jit->hooked <= hooks->n / 2);
+  spot = ProbeJitHooks(hooks, virt);
+  key = atomic_load_explicit(hooks->virts + spot, memory_order_relaxed);
+  // ensure there's room to add this hook, if it's a new one. updating
+  // an existing hook never allocates memory, which the worker relies on
+  if (!key && jit->hooked == hooks->n / 2) {
+    if (!(hooks = RehashJitHooks(jit, hooks))) {
+      DisableJit(jit);
+      return false;
+    }
+    spot = ProbeJitHooks(hooks, virt);
   }
-  // probe for spot in hash table. this is guaranteed to halt since we
-  // never place more than jit->hooks.n/2 items within this hash table
-  spot = 0;
-  step = 0;
-  hash = HASH(virt);
-  virts = atomic_load_explicit(&jit->hooks.virts, memory_order_relaxed);
-  funcs = atomic_load_explicit(&jit->hooks.funcs, memory_order_relaxed);
-  do {
-    spot = (hash + step * ((step + 1) >> 1)) & (n - 1);
-    key = atomic_load_explicit(virts + spot, memory_order_relaxed);
-    ++step;
-  } while (key && key != virt);
   func = EncodeJitFunc(funcaddr);
-  oldfunc = atomic_load_explicit(funcs + spot, memory_order_relaxed);
+  oldfunc = atomic_load_explicit(hooks->funcs + spot, memory_order_relaxed);
   if (jit->staging) {
     if (func == jit->staging) {
       STATISTIC(++jit_hooks_staged);
@@ -1063,17 +1322,19 @@ static bool SetJitHookUnlocked(struct Jit *jit, u64 virt, int cas,
       STATISTIC(++jit_hooks_installed);
     }
   }
-  if (!key) {
-    ++jit->hooks.i;
-    STATISTIC(jit_hash_elements = MAX(jit_hash_elements, jit->hooks.i));
-  }
   if (func && (jp = GetOrCreateJitPage(jit, virt))) {
     jp->bitset |= (u64)1 << ((virt & 4095) >> 6);
   }
-  kgen = BeginUpdate(&jit->keygen);
-  atomic_store_explicit(virts + spot, virt, memory_order_release);
-  atomic_store_explicit(funcs + spot, func, memory_order_relaxed);
-  EndUpdate(&jit->keygen, kgen);
+  // readers don't take the lock, so the func must be stored before the
+  // key that'll lead them to it. slots are never reused for other keys
+  // while the table is live, so no reader can see the wrong key's func
+  atomic_store_explicit(hooks->funcs + spot, func, memory_order_release);
+  SetJitPageHook(jit, virt, func);
+  if (!key) {
+    ++jit->hooked;
+    STATISTIC(jit_hash_elements = MAX(jit_hash_elements, jit->hooked));
+    atomic_store_explicit(hooks->virts + spot, virt, memory_order_release);
+  }
   return true;
 }
 
@@ -1094,32 +1355,34 @@ static bool SetJitHook(struct Jit *jit, u64 virt, int cas, intptr_t funcaddr) {
  */
 uintptr_t GetJitHook(struct Jit *jit, u64 virt) {
   int off;
-  uintptr_t key, res;
-  _Atomic(int) *funcs;
-  _Atomic(uintptr_t) *virts;
-  unsigned n, kgen, hash, spot, step;
+  uintptr_t key;
+  struct JitHooks *hooks;
+  struct JitPageHooks *ph;
+  unsigned n, hash, spot, step;
+  // hot pages have a direct map that's kept in sync with the hash table
+  ph = atomic_load_explicit(GetJitPageHooks(jit, virt & -4096),
+                            memory_order_acquire);
+  if (ph && ph->page == (i64)(virt & -4096)) {
+    COSTLY_STATISTIC(++jit_page_hook_lookups);
+    off = atomic_load_explicit(ph->funcs + (virt & 4095), memory_order_acquire);
+    return off ? DecodeJitFunc(off) : 0;
+  }
   COSTLY_STATISTIC(++jit_hash_lookups);
   hash = HASH(virt);
-  do {
-    kgen = atomic_load_explicit(&jit->keygen, memory_order_relaxed);
-    n = atomic_load_explicit(&jit->hooks.n, memory_order_relaxed);
-    virts = atomic_load_explicit(&jit->hooks.virts, memory_order_acquire);
-    for (spot = step = 0;; ++step) {
-      spot = (hash + step * ((step + 1) >> 1)) & (n - 1);
-      key = atomic_load_explicit(virts + spot, memory_order_acquire);
-      if (key == virt) {
-        funcs = atomic_load_explicit(&jit->hooks.funcs, memory_order_relaxed);
-        off = atomic_load_explicit(funcs + spot, memory_order_relaxed);
-        res = off ? DecodeJitFunc(off) : 0;
-        break;
-      }
-      if (!key) {
-        return 0;
-      }
-      COSTLY_STATISTIC(++jit_hash_collisions);
+  hooks = atomic_load_explicit(&jit->hooks, memory_order_acquire);
+  n = hooks->n;
+  for (spot = step = 0;; ++step) {
+    spot = (hash + step * ((step + 1) >> 1)) & (n - 1);
+    key = atomic_load_explicit(hooks->virts + spot, memory_order_acquire);
+    if (key == virt) {
+      off = atomic_load_explicit(hooks->funcs + spot, memory_order_acquire);
+      return off ? DecodeJitFunc(off) : 0;
     }
-  } while (ShallNotPass(kgen, &jit->keygen));
-  return res;
+    if (!key) {
+      return 0;
+    }
+    COSTLY_STATISTIC(++jit_hash_collisions);
+  }
 }
 
 // removes hook and edges for jit path and all paths that depend on it
@@ -1128,28 +1391,29 @@ static void DeleteJitPath(struct Jit *jit, i64 virt) {
   i64 dep;
   uintptr_t key;
   int i, s, old;
-  _Atomic(int) *funcs;
-  _Atomic(uintptr_t) *virts;
-  unsigned n, hash, spot, step;
+  struct JitHooks *hooks;
+  unsigned hash, spot, step;
   // delete hook for this path from hash table
   hash = HASH(virt);
+  hooks = atomic_load_explicit(&jit->hooks, memory_order_relaxed);
   for (spot = step = 0;; ++step) {
-    n = atomic_load_explicit(&jit->hooks.n, memory_order_relaxed);
-    spot = (hash + step * ((step + 1) >> 1)) & (n - 1);
-    virts = atomic_load_explicit(&jit->hooks.virts, memory_order_relaxed);
-    key = atomic_load_explicit(virts + spot, memory_order_relaxed);
-    if (!key) return;
+    spot = (hash + step * ((step + 1) >> 1)) & (hooks->n - 1);
+    key = atomic_load_explicit(hooks->virts + spot, memory_order_relaxed);
+    // the hook may have been dropped by a rehash after being abandoned,
+    // but its edges still need removing or the loop below won't halt
+    if (!key) break;
     if ((i64)key == virt) {
       JIT_LOGF("deleting jit hook for path starting at %#" PRIx64, virt);
-      funcs = atomic_load_explicit(&jit->hooks.funcs, memory_order_relaxed);
-      old = atomic_load_explicit(funcs + spot, memory_order_relaxed);
+      old = atomic_load_explicit(hooks->funcs + spot, memory_order_relaxed);
       if (old) {
-        atomic_store_explicit(funcs + spot, 0, memory_order_release);
+        atomic_store_explicit(hooks->funcs + spot, 0, memory_order_release);
+        SetJitPageHook(jit, virt, 0);
         if (old == jit->staging) {
           STATISTIC(--jit_hooks_staged);
         } else {
           STATISTIC(--jit_hooks_installed);
           STATISTIC(++jit_hooks_deleted);
+          ++jit->deleted;
         }
       }
       break;
@@ -1171,36 +1435,102 @@ static void DeleteJitPath(struct Jit *jit, i64 virt) {
   }
 }
 
+// returns index of first cached path at or after virt
+static u32 SearchJitCache(const struct JitCache *jc, i64 virt) {
+  u32 l, r, m;
+  for (l = 0, r = jc->paths; l < r;) {
+    m = l + (r - l) / 2;
+    if (jc->path[m].virt < virt) {
+      l = m + 1;
+    } else {
+      r = m;
+    }
+  }
+  return l;
+}
+
+// returns index of live cached path starting at virt, or -1
+static long FindJitCachePath(const struct JitCache *jc, i64 virt) {
+  u32 i;
+  i = SearchJitCache(jc, virt);
+  if (i < jc->paths && jc->path[i].virt == virt && !jc->dead[i]) {
+    return i;
+  }
+  return -1;
+}
+
+// guest page changed, so cached paths starting on it can't be restored
+// @assume jit->lock
+static void ForgetJitCachePage(struct Jit *jit, i64 page) {
+  u32 i;
+  struct JitCache *jc;
+  if (!(jc = jit->cache)) return;
+  for (i = SearchJitCache(jc, page);
+       i < jc->paths && jc->path[i].virt < page + 4096; ++i) {
+    jc->dead[i] = true;
+  }
+}
+
+// deletes paths starting within 64-byte line
+// @assume jit->lock
+static void DeleteJitPaths(struct Jit *jit, i64 line) {
+  unsigned i;
+  for (i = 0; i < 64; ++i) {
+    DeleteJitPath(jit, line + i);
+  }
+}
+
 // @assume jit->lock
 static void ResetJitPageHooks(struct Jit *jit, i64 page) {
-  i64 virt;
-  unsigned i, boff;
+  unsigned boff;
   struct JitPage *jp;
   if (!(jp = GetJitPage(jit, page))) return;
   STATISTIC(AVERAGE(jit_page_average_bits, popcount(jp->bitset)));
   while (jp->bitset) {
     boff = bsr(jp->bitset);
-    virt = page + boff * (4096 / 64);
     jp->bitset &= ~((u64)1 << boff);
-    for (i = 0; i < 64; ++i) {
-      DeleteJitPath(jit, virt + i);
-    }
+    DeleteJitPaths(jit, page + boff * (4096 / 64));
   }
   dll_remove(&jit->pages, &jp->elem);
+  DetachJitPageHooks(jit, jp);
   FreeJitPage(jp);
 }
 
+// returns true if cached paths starting on page run into the next one
+static bool IsJitCachePageSpanning(const struct JitCache *jc, i64 page) {
+  u32 l, r, m;
+  for (l = 0, r = jc->pages; l < r;) {
+    m = l + (r - l) / 2;
+    if (jc->page[m].page < page) {
+      l = m + 1;
+    } else {
+      r = m;
+    }
+  }
+  return l < jc->pages && jc->page[l].page == page && jc->page[l].spans;
+}
+
 // @assume jit->lock
 static int ResetJitPageUnlocked(struct Jit *jit, i64 virt) {
   i64 page;
-  unsigned gen;
+  unsigned gen, pgen;
+  struct JitPage *jp;
   page = virt & -4096;
   STATISTIC(++jit_page_resets);
   JIT_LOGF("resetting jit page %#" PRIx64, page);
   gen = BeginUpdate(&jit->pagegen);
+  pgen = BeginUpdate(GetJitPageGen(jit, page));
   ResetJitPageHooks(jit, page);
-  dll_make_first(&jit->freejumps, jit->jumps);
-  jit->jumps = 0;
+  ForgetJitCachePage(jit, page);
+  // paths which started on the previous page may have run into this one
+  if ((jp = GetJitPage(jit, page - 4096)) && jp->spans) {
+    ResetJitPageHooks(jit, page - 4096);
+  }
+  if (jit->cache && IsJitCachePageSpanning(jit->cache, page - 4096)) {
+    ForgetJitCachePage(jit, page - 4096);
+  }
+  DropJitJumps(jit);
+  EndUpdate(GetJitPageGen(jit, page), pgen);
   EndUpdate(&jit->pagegen, gen);
   return 0;
 }
@@ -1219,42 +1549,331 @@ int ResetJitPage(struct Jit *jit, i64 virt) {
   int res;
   if (IsJitDisabled(jit)) return einval();
   LockJit(jit);
+  jit->deleted = 0;
   res = ResetJitPageUnlocked(jit, virt);
+  STATISTIC(jit_evicted_by_reset += jit->deleted);
   UnlockJit(jit);
   return res;
 }
 
-// @assume jit->lock
-static void ForceJitBlocksToRetire(struct Jit *jit) {
+/**
+ * Clears all JIT paths.
+ *
+ * This is intended to be called when the way guest code is decoded or
+ * addressed changes, e.g. when a metal mode guest switches modes.
+ *
+ * @return 0 on success, or -1 w/ errno
+ */
+int ResetJitPages(struct Jit *jit) {
+  struct Dll *e;
+  if (IsJitDisabled(jit)) return einval();
+  LockJit(jit);
+  jit->deleted = 0;
+  while ((e = dll_first(jit->pages))) {
+    ResetJitPageUnlocked(jit, JITPAGE_CONTAINER(e)->page);
+  }
+  STATISTIC(jit_evicted_by_reset += jit->deleted);
+  UnlockJit(jit);
+  return 0;
+}
+
+/**
+ * Deletes path starting at virt, along with paths that jump into it.
+ *
+ * This is intended to be called when a path is going to be generated
+ * again, e.g. because it became hot. Code of the old path stays until
+ * its block retires, since threads may still be running it. Paths the
+ * other threads are generating at the moment will be abandoned, since
+ * they could have jumped into the old path directly.
+ *
+ * @param virt is the hash table key, or virtual address of path start
+ * @return 0 on success, or -1 w/ errno
+ */
+int ResetJitPath(struct Jit *jit, i64 virt) {
+  unsigned gen, pgen;
+  if (IsJitDisabled(jit)) return einval();
+  LockJit(jit);
+  gen = BeginUpdate(&jit->pagegen);
+  pgen = BeginUpdate(&jit->pathgen);
+  DeleteJitPath(jit, virt);
+  EndUpdate(&jit->pathgen, pgen);
+  EndUpdate(&jit->pagegen, gen);
+  UnlockJit(jit);
+  return 0;
+}
+
+/**
+ * Hashes 64-byte line of guest memory that jit code was generated from.
+ */
+u64 HashJitLine(const u8 *p) {
   int i;
+  u64 h;
+  for (h = 0, i = 0; i < 64; i += 8) {
+    h = (h ^ Read64(p + i)) * 0x9e3779b97f4a7c15;
+  }
+  return h ^ h >> 32;
+}
+
+/**
+ * Clears JIT paths whose guest code changed within memory page.
+ *
+ * This is intended to be called after writes to an executable page
+ * were detected, once further writes to the page have been prevented.
+ * Lines of the page that generated paths were read from are hashed to
+ * find out which ones changed, and only the paths which read them are
+ * deleted. That way, data which lives on the same page as code can be
+ * written without throwing away code that runs nearby.
+ *
+ * @param virt is virtual address of 4096-byte page (needn't be aligned)
+ * @param host is host address of the page's memory, after the write
+ * @return 0 on success, or -1 w/ errno
+ */
+int ResetJitPageLines(struct Jit *jit, i64 virt, const u8 *host) {
+  i64 page;
+  u64 dirty;
+  unsigned i, gen, pgen;
+  struct JitPage *jp, *prev;
+  if (IsJitDisabled(jit)) return einval();
+  page = virt & -4096;
+  LockJit(jit);
+  jit->deleted = 0;
+  // paths being generated right now haven't had their lines recorded,
+  // so they need to check their lines again before they're published
+  atomic_fetch_add_explicit(&jit->smcgen, 1, memory_order_release);
+  jp = GetJitPage(jit, page);
+  prev = GetJitPage(jit, page - 4096);
+  if ((jp && jp->whole) || (prev && prev->spans && prev->whole)) {
+    ResetJitPageUnlocked(jit, page);
+    STATISTIC(jit_evicted_by_smc += jit->deleted);
+    UnlockJit(jit);
+    return 0;
+  }
+  for (dirty = 0, i = 0; jp && i < 64; ++i) {
+    if (((jp->lines >> i) & 1) && HashJitLine(host + i * 64) != jp->sums[i]) {
+      dirty |= (u64)1 << i;
+    }
+  }
+  if (!dirty) {
+    STATISTIC(++smc_spared);
+    UnlockJit(jit);
+    return 0;
+  }
+  STATISTIC(++jit_page_line_resets);
+  JIT_LOGF("resetting jit page %#" PRIx64 " lines %#" PRIx64, page, dirty);
+  gen = BeginUpdate(&jit->pagegen);
+  pgen = BeginUpdate(GetJitPageGen(jit, page));
+  if (dirty & jp->spanned) {
+    ResetJitPageHooks(jit, page - 4096);
+    ForgetJitCachePage(jit, page - 4096);
+    jp->spanned = 0;
+  }
+  for (jp->lines = jp->spanned, i = 0; i < 64; ++i) {
+    if (jp->reach[i] & dirty) {
+      DeleteJitPaths(jit, page + i * 64);
+      jp->bitset &= ~((u64)1 << i);
+      jp->reach[i] = 0;
+    }
+    jp->lines |= jp->reach[i];
+  }
+  ForgetJitCachePage(jit, page);
+  DropJitJumps(jit);
+  EndUpdate(GetJitPageGen(jit, page), pgen);
+  EndUpdate(&jit->pagegen, gen);
+  STATISTIC(jit_evicted_by_smc += jit->deleted);
+  UnlockJit(jit);
+  return 0;
+}
+
+/**
+ * Records which lines of guest memory a path was generated from.
+ *
+ * This must be called before the path is finished, so that changes to
+ * those lines reset the path. The caller must have checked the hashes
+ * are still the same. If the lines could have changed since `smcgen`
+ * was loaded, then false is returned, and the path should be abandoned.
+ *
+ * @param virt is address at which path starts
+ * @param lines has bitsets of 64-byte lines read on the page of virt
+ *     and the page after it
+ * @param sums has the hash of each line, indexed by its bit number
+ * @param smcgen is value of `jit->smcgen` before the sums were checked
+ */
+bool CoverJitPath(struct Jit *jit, i64 virt, const u64 lines[2],
+                  const u64 sums[128], unsigned smcgen) {
+  int k;
+  i64 page;
+  bool res;
+  u64 fresh;
+  unsigned i;
+  struct JitPage *jp;
+  if (IsJitDisabled(jit)) return false;
+  page = virt & -4096;
+  LockJit(jit);
+  res = atomic_load_explicit(&jit->smcgen, memory_order_relaxed) == smcgen;
+  for (k = 0; res && k < 2; ++k) {
+    if (!lines[k]) continue;
+    if (!(jp = GetOrCreateJitPage(jit, page + k * 4096))) {
+      res = false;
+      break;
+    }
+    for (fresh = lines[k] & ~jp->lines, i = 0; i < 64; ++i) {
+      if ((fresh >> i) & 1) {
+        jp->sums[i] = sums[k * 64 + i];
+      }
+    }
+    jp->lines |= lines[k];
+    if (!k) {
+      jp->reach[(virt & 4095) >> 6] |= lines[k];
+    } else {
+      jp->spanned |= lines[k];
+    }
+  }
+  UnlockJit(jit);
+  return res;
+}
+
+/**
+ * Records that a path starting on page runs into the page after it.
+ *
+ * This must be called before the path is finished, so that changes to
+ * the subsequent page also reset the jit hooks of the spanning path.
+ *
+ * @param virt is virtual address of 4096-byte page (needn't be aligned)
+ * @return 0 on success, or -1 w/ errno
+ */
+int SpanJitPage(struct Jit *jit, i64 virt) {
+  int res;
+  struct JitPage *jp;
+  if (IsJitDisabled(jit)) return einval();
+  LockJit(jit);
+  if ((jp = GetOrCreateJitPage(jit, virt))) {
+    jp->spans = true;
+    res = 0;
+  } else {
+    res = -1;
+  }
+  UnlockJit(jit);
+  return res;
+}
+
+/**
+ * Records that generated function is being entered by the interpreter.
+ *
+ * Blocks of jit code whose functions get entered the least are the ones
+ * evicted first once jit memory runs low.
+ *
+ * @param func is address returned by GetJitHook()
+ */
+void TouchJitPath(uintptr_t func) {
+  long i;
+  unsigned heat;
+  if ((i = GetJitBlockIndex(func)) == -1) return;
+  // this doesn't need to be exact, so avoid a locked instruction, and
+  // stop writing once saturated so hot blocks stay shared among cores
+  heat = atomic_load_explicit(g_jit.heat + i, memory_order_relaxed);
+  if (heat < kJitHeatMax) {
+    atomic_store_explicit(g_jit.heat + i, heat + 1, memory_order_relaxed);
+  }
+}
+
+static int CompareJitBlockHeat(const void *a, const void *b) {
+  unsigned x, y;
+  x = atomic_load_explicit(
+      g_jit.heat + GetJitBlockIndex((uintptr_t)(*(struct JitBlock **)a)->addr),
+      memory_order_relaxed);
+  y = atomic_load_explicit(
+      g_jit.heat + GetJitBlockIndex((uintptr_t)(*(struct JitBlock **)b)->addr),
+      memory_order_relaxed);
+  return x < y ? -1 : x > y;
+}
+
+// evicts the coldest generation of jit blocks to avoid oom
+// @assume jit->lock
+static void RetireColdJitBlocks(struct Jit *jit) {
+  int func;
+  long i, j, n;
+  uintptr_t virt;
+  unsigned pgen, agen, heat;
+  struct JitJump *jj;
   struct Dll *e, *e2;
   struct JitBlock *jb;
-  unsigned n, pgen, kgen;
-  JIT_LOGF("retiring jit blocks to avoid oom");
-  dll_make_first(&jit->freejumps, jit->jumps);
-  jit->jumps = 0;
-  pgen = BeginUpdate(&jit->pagegen);
-  for (e = dll_first(jit->agedblocks); e; e = e2) {
-    e2 = dll_next(jit->agedblocks, e);
+  struct JitCache *jc;
+  struct JitStage *js;
+  struct JitHooks *hooks;
+  bool doomed[kJitBlocks] = {0};
+  struct JitBlock *victims[kJitBlocks];
+  JIT_LOGF("retiring cold jit blocks to avoid oom");
+  jit->deleted = 0;
+  // blocks that aren't full are where new code is being written
+  for (n = 0, e = dll_first(jit->agedblocks); e;
+       e = dll_next(jit->agedblocks, e)) {
     jb = AGEDBLOCK_CONTAINER(e);
-    if (!jb->isprotected) {
-      JIT_LOGF("forcing jit block %p to retire", jb);
-      RetireJitBlock(jit, jb);
+    if (!jb->isprotected && !jb->isleased && jb->index >= kJitBlockSize &&
+        dll_is_empty(jb->staged)) {
+      victims[n++] = jb;
     }
   }
-  n = atomic_load_explicit(&jit->hooks.n, memory_order_relaxed);
+  qsort(victims, n, sizeof(*victims), CompareJitBlockHeat);
+  n = MIN(n, kJitEvictBatch);
   for (i = 0; i < n; ++i) {
-    if (atomic_load_explicit(jit->hooks.virts + i, memory_order_relaxed)) {
-      kgen = BeginUpdate(&jit->keygen);
-      atomic_store_explicit(jit->hooks.virts + i, 0, memory_order_release);
-      atomic_store_explicit(jit->hooks.funcs + i, 0, memory_order_relaxed);
-      EndUpdate(&jit->keygen, kgen);
+    doomed[GetJitBlockIndex((uintptr_t)victims[i]->addr)] = true;
+  }
+  pgen = BeginUpdate(&jit->pagegen);
+  agen = BeginUpdate(&jit->pathgen);
+  // remove paths whose code is in those blocks, along with any paths
+  // that jump into them directly, which are tracked as edges
+  hooks = atomic_load_explicit(&jit->hooks, memory_order_relaxed);
+  for (i = 0; n && i < hooks->n; ++i) {
+    virt = atomic_load_explicit(hooks->virts + i, memory_order_relaxed);
+    func = atomic_load_explicit(hooks->funcs + i, memory_order_relaxed);
+    if (virt && func && func != jit->staging &&
+        (j = GetJitBlockIndex(DecodeJitFunc(func))) != -1 && doomed[j]) {
+      DeleteJitPath(jit, virt);
+    }
+  }
+  // forget about paths the worker was going to publish in those blocks
+  for (e = dll_first(jit->pending); e; e = e2) {
+    e2 = dll_next(jit->pending, e);
+    js = JITSTAGE_CONTAINER(e);
+    if (doomed[GetJitBlockIndex((uintptr_t)js->addr)]) {
+      SetJitHookUnlocked(jit, js->virt, 0, 0);
+      dll_remove(&jit->pending, e);
+      dll_make_first(&jit->freejumps, js->jumps);
+      FreeJitStage(js);
     }
   }
-  jit->hooks.i = 0;
-  ClearEdges(&jit->redges);
-  ClearEdges(&jit->edges);
+  // forget about code fixups that would write to those blocks
+  for (i = 0; i < kJitJumpBuckets; ++i) {
+    for (e = dll_first(jit->jumps[i]); e; e = e2) {
+      e2 = dll_next(jit->jumps[i], e);
+      jj = JITJUMP_CONTAINER(e);
+      if ((j = GetJitBlockIndex((uintptr_t)jj->code)) != -1 && doomed[j]) {
+        dll_remove(&jit->jumps[i], e);
+        dll_make_first(&jit->freejumps, e);
+      }
+    }
+  }
+  if ((jc = jit->cache)) {
+    for (i = 0; i < jc->paths; ++i) {
+      if (doomed[GetJitBlockIndex((uintptr_t)g_code + jc->path[i].func)]) {
+        jc->dead[i] = true;
+      }
+    }
+  }
+  for (i = 0; i < n; ++i) {
+    JIT_LOGF("forcing jit block %p to retire", victims[i]);
+    RetireJitBlock(jit, victims[i]);
+  }
+  STATISTIC(jit_evicted_by_heap += jit->deleted);
+  EndUpdate(&jit->pathgen, agen);
   EndUpdate(&jit->pagegen, pgen);
+  // the blocks that survived begin a new generation, so what they did
+  // a long time ago counts for less than what happens from here on out
+  for (e = dll_first(jit->agedblocks); e; e = dll_next(jit->agedblocks, e)) {
+    i = GetJitBlockIndex((uintptr_t)AGEDBLOCK_CONTAINER(e)->addr);
+    heat = atomic_load_explicit(g_jit.heat + i, memory_order_relaxed);
+    atomic_store_explicit(g_jit.heat + i, heat >> 1, memory_order_relaxed);
+  }
 }
 
 static bool CheckMmapResult(void *want, void *got) {
@@ -1326,8 +1945,8 @@ struct JitBlock *StartJit(struct Jit *jit, i64 opt_virt) {
       // we found a block with adequate free space owned by jit
       dll_remove(&jit->blocks, &jb->elem);
     } else {
-      if (g_jit.freecount <= kJitRetireQueue) {
-        ForceJitBlocksToRetire(jit);
+      if (CountAvailableJitBlocks() <= kJitRetireQueue) {
+        RetireColdJitBlocks(jit);
       }
       if (!(jb = AcquireJitBlock(jit))) {
         LOG_ONCE(LOGF("ran out of jit memory"));
@@ -1340,6 +1959,7 @@ struct JitBlock *StartJit(struct Jit *jit, i64 opt_virt) {
       }
     }
     if (jb) {
+      jb->isleased = true;
       dll_make_first(&jb->freejumps, jit->freejumps);
       jit->freejumps = 0;
     }
@@ -1352,6 +1972,7 @@ struct JitBlock *StartJit(struct Jit *jit, i64 opt_virt) {
     unassert(!(jb->start & (kJitAlign - 1)));
     unassert(jb->start == jb->index);
     jb->pagegen = atomic_load_explicit(&jit->pagegen, memory_order_acquire);
+    GetJitGens(jit, &jb->gens, jb->virt);
     if (jb->virt && jit->staging) {
       unassert(SetJitHook(jit, jb->virt, 0, DecodeJitFunc(jit->staging)));
     } else {
@@ -1389,28 +2010,44 @@ inline bool AppendJit(struct JitBlock *jb, const void *data, long size) {
   }
 }
 
-static struct Dll *GetJitJumps(struct Jit *jit, struct JitBlock *jb, u64 virt) {
-  struct JitJump *jj;
-  struct Dll *res, *rem, *e, *e2;
-  LockJit(jit);
-  for (rem = res = 0, e = dll_first(jit->jumps); e; e = e2) {
-    e2 = dll_next(jit->jumps, e);
-    jj = JITJUMP_CONTAINER(e);
-    if (jj->virt == virt) {
-      dll_remove(&jit->jumps, e);
+static struct Dll **GetJitJumpBucket(struct Jit *jit, u64 virt) {
+  return jit->jumps + (HASH(virt) & (kJitJumpBuckets - 1));
+}
+
+// files code fixups under the destinations they're waiting for
+// @assume jit->lock
+static void AddJitJumps(struct Jit *jit, struct Dll *list) {
+  struct Dll *e;
+  while ((e = dll_first(list))) {
+    dll_remove(&list, e);
+    dll_make_first(GetJitJumpBucket(jit, JITJUMP_CONTAINER(e)->virt), e);
+  }
+}
+
+// removes fixups wanting virt from the list
+// @assume jit->lock
+static struct Dll *TakeJitJumps(struct Jit *jit, u64 virt) {
+  struct Dll *res, *e, *e2, **bucket;
+  bucket = GetJitJumpBucket(jit, virt);
+  for (res = 0, e = dll_first(*bucket); e; e = e2) {
+    e2 = dll_next(*bucket, e);
+    if (JITJUMP_CONTAINER(e)->virt == virt) {
+      dll_remove(bucket, e);
       dll_make_first(&res, e);
-    } else if (++jj->tries == kJitJumpTries) {
-      dll_remove(&jit->jumps, e);
-      dll_make_first(&rem, e);
     }
   }
+  return res;
+}
+
+static struct Dll *GetJitJumps(struct Jit *jit, u64 virt) {
+  struct Dll *res;
+  LockJit(jit);
+  res = TakeJitJumps(jit, virt);
   UnlockJit(jit);
-  dll_make_first(&jb->freejumps, rem);
   return res;
 }
 
-static void FixupJitJumps(struct JitBlock *jb, struct Dll *list,
-                          uintptr_t addr) {
+static void FixupJitJumps(struct Dll *list, uintptr_t addr) {
   int n;
   union {
     u32 i;
@@ -1441,16 +2078,16 @@ static void FixupJitJumps(struct JitBlock *jb, struct Dll *list,
 #endif
     sys_icache_invalidate(jj->code, n);
   }
-  dll_make_first(&jb->freejumps, list);
 }
 
 static bool UpdateJitHook(struct Jit *jit, struct JitBlock *jb, u64 virt,
                           uintptr_t funcaddr) {
   struct Dll *jumps;
   unassert(funcaddr);
-  jumps = GetJitJumps(jit, jb, virt);
+  jumps = GetJitJumps(jit, virt);
   if (SetJitHook(jit, virt, jit->staging, funcaddr)) {
-    FixupJitJumps(jb, jumps, funcaddr);
+    FixupJitJumps(jumps, funcaddr);
+    dll_make_first(&jb->freejumps, jumps);
     return true;
   } else {
     dll_make_first(&jb->freejumps, jumps);
@@ -1464,9 +2101,101 @@ static void AbandonJitHook(struct Jit *jit, u64 virt) {
   }
 }
 
+// installs hooks for paths that guest threads finished generating
+// @assume jit->lock
+static void PublishJitStages(struct Jit *jit) {
+  struct Dll *e;
+  struct JitStage *js;
+  struct Dll *jumps;
+  uintptr_t staging = DecodeJitFunc(jit->staging);
+  while ((e = dll_first(jit->pending))) {
+    dll_remove(&jit->pending, e);
+    js = JITSTAGE_CONTAINER(e);
+    // only touch hooks that are still staged and thus already in the
+    // hash table, so this thread never allocates memory. doing so would
+    // create a malloc() arena, which claims address space the guest may
+    // want under linear memory mapping.
+    if (GetJitHook(jit, js->virt) != staging) {
+      dll_make_first(&jit->freejumps, js->jumps);
+    } else if (!IsJitStale(jit, &js->gens, js->virt)) {
+      jumps = TakeJitJumps(jit, js->virt);
+      if (SetJitHookUnlocked(jit, js->virt, jit->staging,
+                             (uintptr_t)js->addr)) {
+        STATISTIC(++jit_hooks_published);
+        FixupJitJumps(jumps, (uintptr_t)js->addr);
+        // the path's own fixups are only committed now, since applying
+        // them above could otherwise turn a loop onto itself into code
+        // that never returns to the interpreter to check for attention
+        AddJitJumps(jit, js->jumps);
+      } else {
+        dll_make_first(&jit->freejumps, js->jumps);
+      }
+      dll_make_first(&jit->freejumps, jumps);
+    } else {
+      SetJitHookUnlocked(jit, js->virt, 0, 0);
+      dll_make_first(&jit->freejumps, js->jumps);
+    }
+    FreeJitStage(js);
+  }
+}
+
+static void *JitWorker(void *arg) {
+  struct Jit *jit = (struct Jit *)arg;
+  if (pthread_jit_write_protect_supported_np()) {
+    pthread_jit_write_protect_np_workaround(false);
+  }
+  LOCK(&jit->lock);
+  while (!jit->quitting) {
+    if (!dll_is_empty(jit->pending)) {
+      PublishJitStages(jit);
+    } else {
+      pthread_cond_wait(&jit->pended, &jit->lock);
+    }
+  }
+  UNLOCK(&jit->lock);
+  return 0;
+}
+
+/**
+ * Starts thread that installs finished jit paths in the background.
+ *
+ * Guest threads still generate code, since that happens as their ops
+ * get executed, but then they hand it off to this thread, rather than
+ * stalling on the hook table and on applying the jump fixups. Address
+ * of the path remains in staging until then, so it's interpreted for a
+ * little longer. This only has an effect if rwx memory is available.
+ *
+ * This should be called again in the child process after fork().
+ *
+ * @return 0 on success, or -1 w/ errno
+ */
+int StartJitWorker(struct Jit *jit) {
+#ifdef HAVE_THREADS
+  int err;
+  sigset_t ss, oldss;
+  jit->threaded = true;
+  jit->working = false;
+  jit->quitting = false;
+  unassert(!pthread_cond_init(&jit->pended, 0));
+  sigfillset(&ss);
+  unassert(!pthread_sigmask(SIG_SETMASK, &ss, &oldss));
+  err = pthread_create(&jit->worker, 0, JitWorker, jit);
+  unassert(!pthread_sigmask(SIG_SETMASK, &oldss, 0));
+  if (err) {
+    errno = err;
+    return -1;
+  }
+  jit->working = true;
+  return 0;
+#else
+  return enosys();
+#endif
+}
+
 // mprotects jit memory if a system page worth of code was generated
 // @assume jit->lock
 int CommitJit_(struct Jit *jit, struct JitBlock *jb) {
+  int i;
   u8 *addr;
   size_t size;
   int count = 0;
@@ -1484,12 +2213,14 @@ int CommitJit_(struct Jit *jit, struct JitBlock *jb) {
              size / 1024);
     // abandon fixups pointing into the block being protected
     LockJit(jit);
-    for (rem = 0, e = dll_first(jit->jumps); e; e = e2) {
-      e2 = dll_next(jit->jumps, e);
-      jj = JITJUMP_CONTAINER(e);
-      if (MAX(jj->code, addr) < MIN(jj->code + 5, addr + size)) {
-        dll_remove(&jit->jumps, e);
-        dll_make_first(&rem, e);
+    for (rem = 0, i = 0; i < kJitJumpBuckets; ++i) {
+      for (e = dll_first(jit->jumps[i]); e; e = e2) {
+        e2 = dll_next(jit->jumps[i], e);
+        jj = JITJUMP_CONTAINER(e);
+        if (MAX(jj->code, addr) < MIN(jj->code + 5, addr + size)) {
+          dll_remove(&jit->jumps[i], e);
+          dll_make_first(&rem, e);
+        }
       }
     }
     UnlockJit(jit);
@@ -1504,7 +2235,7 @@ int CommitJit_(struct Jit *jit, struct JitBlock *jb) {
       js = JITSTAGE_CONTAINER(e);
       unassert(js->index >= jb->committed);
       if (js->index <= blockoff) {
-        if (!ShallNotPass(js->pagegen, &jit->pagegen)) {
+        if (!IsJitStale(jit, &js->gens, js->virt)) {
           UpdateJitHook(jit, jb, js->virt, (uintptr_t)jb->addr + js->start);
         } else {
           AbandonJitHook(jit, js->virt);
@@ -1526,6 +2257,7 @@ int CommitJit_(struct Jit *jit, struct JitBlock *jb) {
 void ReinsertJitBlock_(struct Jit *jit, struct JitBlock *jb) {
   unassert(jb->start == jb->index);
   unassert(dll_is_empty(jb->jumps));
+  jb->isleased = false;
   if (jb->index < kJitBlockSize) {
     // there's still memory remaining; reinsert for immediate reuse.
     dll_make_first(&jit->blocks, &jb->elem);
@@ -1544,7 +2276,7 @@ void ReinsertJitBlock_(struct Jit *jit, struct JitBlock *jb) {
 static void CommitJitJumps(struct Jit *jit, struct JitBlock *jb) {
   if (!dll_is_empty(jb->jumps)) {
     LockJit(jit);
-    dll_make_first(&jit->jumps, jb->jumps);
+    AddJitJumps(jit, jb->jumps);
     jb->jumps = 0;
     UnlockJit(jit);
   }
@@ -1580,7 +2312,6 @@ bool RecordJitJump(struct JitBlock *jb, u64 virt, int addend) {
 #endif
   if (!CanJitForImmediateEffect()) return false;
   if (!(jj = NewJitJump(&jb->freejumps))) return false;
-  jj->tries = 0;
   jj->virt = virt;
   jj->code = (u8 *)GetJitPc(jb);
   jj->addend = addend;
@@ -1591,10 +2322,8 @@ bool RecordJitJump(struct JitBlock *jb, u64 virt, int addend) {
 
 // @assume jit->lock
 static bool RecordJitEdgeImpl(struct Jit *jit, i64 src, i64 dst) {
-  i64 visits[kJitDepth];
   if (src == dst) return false;
-  visits[0] = src;
-  if (IsCyclic(&jit->edges, visits, 1, dst)) {
+  if (IsCyclic(&jit->edges, &jit->redges, src, dst)) {
     STATISTIC(++jit_cycles_avoided);
     return false;
   }
@@ -1644,7 +2373,7 @@ bool FinishJit(struct Jit *jit, struct JitBlock *jb) {
   unassert(jb->index > jb->start);
   unassert(jb->start >= jb->committed);
   // check if we lost race with page reset
-  if (ShallNotPass(jb->pagegen, &jit->pagegen)) {
+  if (IsJitStale(jit, &jb->gens, jb->virt)) {
     return AbandonJit(jit, jb);
   }
   // align generated functions using breakpoint opcodes
@@ -1661,7 +2390,18 @@ bool FinishJit(struct Jit *jit, struct JitBlock *jb) {
         // operating system permits us to use rwx memory
         addr = jb->addr + jb->start;
         sys_icache_invalidate(addr, jb->index - jb->start);
-        if (!UpdateJitHook(jit, jb, jb->virt, (uintptr_t)addr)) {
+        if (jit->working && (js = NewJitStage())) {
+          // let the worker thread install the hook and apply fixups
+          js->virt = jb->virt;
+          js->addr = addr;
+          js->gens = jb->gens;
+          js->jumps = jb->jumps;
+          jb->jumps = 0;
+          LockJit(jit);
+          dll_make_last(&jit->pending, &js->elem);
+          pthread_cond_signal(&jit->pended);
+          UnlockJit(jit);
+        } else if (!UpdateJitHook(jit, jb, jb->virt, (uintptr_t)addr)) {
           // we lost race with another thread creating path at same addr
           return AbandonJit(jit, jb);
         }
@@ -1671,7 +2411,7 @@ bool FinishJit(struct Jit *jit, struct JitBlock *jb) {
         js->virt = jb->virt;
         js->start = jb->start;
         js->index = jb->index;
-        js->pagegen = jb->pagegen;
+        js->gens = jb->gens;
         dll_make_last(&jb->staged, &js->elem);
       }
     } else {
@@ -1838,6 +2578,263 @@ bool AppendJitMovReg(struct JitBlock *jb, int dst, int src) {
   return true;
 }
 
+/**
+ * Moves low 32 bits of one register into another, zeroing the rest.
+ *
+ * @param dst is the index of the destination register
+ * @param src is the index of the source register
+ */
+bool AppendJitMovReg32(struct JitBlock *jb, int dst, int src) {
+  if (GetJitRemaining(jb) < 4) return OomJit(jb);
+#if defined(__x86_64__)
+  u8 rex = 0;
+  unassert(!(dst & ~15));
+  unassert(!(src & ~15));
+  if (src & 8) rex |= kAmdRexr;
+  if (dst & 8) rex |= kAmdRexb;
+  if (rex) jb->addr[jb->index++] = rex;
+  jb->addr[jb->index++] = 0x89;
+  jb->addr[jb->index++] = 0300 | (src & 7) << 3 | (dst & 7);
+#elif defined(__aarch64__)
+  unassert(!(dst & ~31));
+  unassert(!(src & ~31));
+  Put32(jb->addr + jb->index, 0x2a0003e0 | src << 16 | dst);  // mov wD, wS
+  jb->index += 4;
+#endif
+  jb->lastaction = 0;
+  return true;
+}
+
+static bool AppendJitMemOp(struct JitBlock *jb, int store, int reg, int base,
+                           u32 off) {
+  if (GetJitRemaining(jb) < 8) return OomJit(jb);
+#if defined(__x86_64__)
+  unassert(!(reg & ~15));
+  unassert(!(base & ~15));
+  jb->addr[jb->index++] = kAmdRexw | (reg & 8 ? kAmdRexr : 0) |  //
+                          (base & 8 ? kAmdRexb : 0);
+  jb->addr[jb->index++] = store ? 0x89 : 0x8b;
+  if (off < 128) {
+    jb->addr[jb->index++] = 0100 | (reg & 7) << 3 | (base & 7);
+    if ((base & 7) == 4) jb->addr[jb->index++] = 0x24;  // sib
+    jb->addr[jb->index++] = off;
+  } else {
+    jb->addr[jb->index++] = 0200 | (reg & 7) << 3 | (base & 7);
+    if ((base & 7) == 4) jb->addr[jb->index++] = 0x24;  // sib
+    Write32(jb->addr + jb->index, off);
+    jb->index += 4;
+  }
+#elif defined(__aarch64__)
+  unassert(!(reg & ~31));
+  unassert(!(base & ~31));
+  unassert(!(off & 7) && off < 32768);
+  Put32(jb->addr + jb->index,
+        (store ? 0xf9000000 : 0xf9400000) | (off / 8) << 10 | base << 5 | reg);
+  jb->index += 4;
+#endif
+  jb->lastaction = 0;
+  return true;
+}
+
+/**
+ * Loads 64-bit word from memory at `base` plus `off` into register.
+ *
+ * @param dst is the index of the destination register
+ * @param base is the index of the register holding the address
+ * @param off is a small unsigned displacement, a multiple of eight
+ */
+bool AppendJitLoad(struct JitBlock *jb, int dst, int base, u32 off) {
+  return AppendJitMemOp(jb, 0, dst, base, off);
+}
+
+/**
+ * Stores register as 64-bit word to memory at `base` plus `off`.
+ *
+ * @param base is the index of the register holding the address
+ * @param off is a small unsigned displacement, a multiple of eight
+ * @param src is the index of the source register
+ */
+bool AppendJitStore(struct JitBlock *jb, int base, u32 off, int src) {
+  return AppendJitMemOp(jb, 1, src, base, off);
+}
+
+/**
+ * Computes `base + (index << scale) + disp` into register.
+ *
+ * @param dst is the index of the destination register, which mustn't
+ *     be the same as `base` or `index` if `disp` is large on aarch64
+ * @param base is the index of the base register, or -1 if none
+ * @param index is the index of the index register, or -1 if none
+ * @param scale is log2 of the index multiplier, from 0 to 3
+ * @param disp is the signed displacement
+ */
+bool AppendJitLea(struct JitBlock *jb, int dst, int base, int index,
+                  int scale, i32 disp) {
+  if (GetJitRemaining(jb) < 32) return OomJit(jb);
+  unassert(!(scale & ~3));
+#if defined(__x86_64__)
+  unassert(!(dst & ~15));
+  unassert(base == -1 || !(base & ~15));
+  unassert(index == -1 || (!(index & ~15) && index != kAmdSp));
+  jb->addr[jb->index++] = kAmdRexw | (dst & 8 ? kAmdRexr : 0) |
+                          (index != -1 && (index & 8) ? kAmdRexx : 0) |
+                          (base != -1 && (base & 8) ? kAmdRexb : 0);
+  jb->addr[jb->index++] = 0x8d;
+  if (base != -1 && !disp && (base & 7) != 5) {
+    jb->addr[jb->index++] = 0004 | (dst & 7) << 3;  // sib
+  } else if (base != -1 && -128 <= disp && disp <= 127) {
+    jb->addr[jb->index++] = 0104 | (dst & 7) << 3;  // sib + disp8
+  } else {
+    // without a base this is the disp32 form, i.e. sib base is rbp
+    jb->addr[jb->index++] = (base != -1 ? 0204 : 0004) | (dst & 7) << 3;
+  }
+  jb->addr[jb->index++] = scale << 6 |                          //
+                          (index != -1 ? index & 7 : 4) << 3 |  //
+                          (base != -1 ? base & 7 : 5);
+  if (base != -1 && !disp && (base & 7) != 5) {
+    // no displacement
+  } else if (base != -1 && -128 <= disp && disp <= 127) {
+    jb->addr[jb->index++] = disp;
+  } else {
+    Write32(jb->addr + jb->index, disp);
+    jb->index += 4;
+  }
+#elif defined(__aarch64__)
+  int src;
+  unassert(!(dst & ~31));
+  unassert(base == -1 || !(base & ~31));
+  unassert(index == -1 || !(index & ~31));
+  if (-4095 <= disp && disp <= 4095) {
+    if (index != -1) {
+      // add xD, xB, xI, lsl #S (where register 31 means xzr)
+      Put32(jb->addr + jb->index, 0x8b000000 | index << 16 | scale << 10 |
+                                      (base != -1 ? base : 31) << 5 | dst);
+      jb->index += 4;
+      src = dst;
+    } else if (base != -1) {
+      src = base;
+    } else {
+      jb->lastaction = 0;
+      return AppendJitSetReg(jb, dst, (i64)disp);
+    }
+    if (disp || src != dst) {
+      // add xD, xS, #disp or sub xD, xS, #-disp
+      Put32(jb->addr + jb->index, (disp >= 0 ? 0x91000000 : 0xd1000000) |
+                                      (disp >= 0 ? disp : -disp) << 10 |
+                                      src << 5 | dst);
+      jb->index += 4;
+    }
+  } else {
+    unassert(dst != base && dst != index);
+    AppendJitSetReg(jb, dst, (i64)disp);
+    if (base != -1) {
+      // add xD, xD, xB
+      Put32(jb->addr + jb->index, 0x8b000000 | base << 16 | dst << 5 | dst);
+      jb->index += 4;
+    }
+    if (index != -1) {
+      // add xD, xD, xI, lsl #S
+      Put32(jb->addr + jb->index,
+            0x8b000000 | index << 16 | scale << 10 | dst << 5 | dst);
+      jb->index += 4;
+    }
+  }
+#endif
+  jb->lastaction = 0;
+  return true;
+}
+
+#if defined(__aarch64__)
+// shifted register forms of add, orr, and, sub, and eor, by x86 op
+static const u32 kArmAlu[8] = {
+    0x0b000000, 0x2a000000, 0, 0, 0x0a000000, 0x4b000000, 0x4a000000, 0,
+};
+#endif
+
+/**
+ * Performs integer arithmetic on register, without caring about flags.
+ *
+ * The 32-bit operation zeroes the high half of `dst` like x86 does.
+ *
+ * @param op is the x86 alu op number, i.e. 0=add 1=or 4=and 5=sub 6=xor
+ * @param log2 is 2 for a 32-bit operation, or 3 for a 64-bit operation
+ * @param dst is the index of the register, which is also an operand
+ * @param src is the index of the other operand register
+ */
+bool AppendJitAlu(struct JitBlock *jb, int op, int log2, int dst, int src) {
+  if (GetJitRemaining(jb) < 4) return OomJit(jb);
+  unassert(op == 0 || op == 1 || op == 4 || op == 5 || op == 6);
+  unassert(log2 == 2 || log2 == 3);
+#if defined(__x86_64__)
+  unassert(!(dst & ~15));
+  unassert(!(src & ~15));
+  Write32(jb->addr + jb->index,
+          ((log2 == 3 ? kAmdRexw : kAmdRex) | (src & 8 ? kAmdRexr : 0) |
+           (dst & 8 ? kAmdRexb : 0)) |
+              (op << 3 | 1) << 010 | (0300 | (src & 7) << 3 | (dst & 7)) << 020);
+  jb->index += 3;
+#elif defined(__aarch64__)
+  unassert(!(dst & ~31));
+  unassert(!(src & ~31));
+  Put32(jb->addr + jb->index, kArmAlu[op] | (log2 == 3) << 31 | src << 16 |
+                                  dst << 5 | dst);
+  jb->index += 4;
+#endif
+  jb->lastaction = 0;
+  return true;
+}
+
+/**
+ * Performs integer arithmetic on register with immediate.
+ *
+ * @param op is the x86 alu op number, i.e. 0=add 1=or 4=and 5=sub 6=xor
+ * @param log2 is 2 for a 32-bit operation, or 3 for a 64-bit operation
+ * @param dst is the index of the register, which is also an operand
+ * @param imm is sign extended to the operation size
+ * @note aarch64 clobbers `kJitRes0` unless it's add or sub of 12 bits
+ */
+bool AppendJitAluImm(struct JitBlock *jb, int op, int log2, int dst, i32 imm) {
+  if (GetJitRemaining(jb) < 24) return OomJit(jb);
+  unassert(op == 0 || op == 1 || op == 4 || op == 5 || op == 6);
+  unassert(log2 == 2 || log2 == 3);
+#if defined(__x86_64__)
+  unassert(!(dst & ~15));
+  if (log2 == 3 || (dst & 8)) {
+    jb->addr[jb->index++] =
+        (log2 == 3 ? kAmdRexw : kAmdRex) | (dst & 8 ? kAmdRexb : 0);
+  }
+  if (-128 <= imm && imm <= 127) {
+    jb->addr[jb->index++] = 0x83;
+    jb->addr[jb->index++] = 0300 | op << 3 | (dst & 7);
+    jb->addr[jb->index++] = imm;
+  } else {
+    jb->addr[jb->index++] = 0x81;
+    jb->addr[jb->index++] = 0300 | op << 3 | (dst & 7);
+    Write32(jb->addr + jb->index, imm);
+    jb->index += 4;
+  }
+#elif defined(__aarch64__)
+  unassert(!(dst & ~31));
+  unassert(dst != kJitRes0);
+  if ((op == 0 || op == 5) && -4095 <= imm && imm <= 4095) {
+    // add wD, wD, #imm or sub wD, wD, #imm (or the xD forms)
+    if (imm < 0) {
+      op = op == 0 ? 5 : 0;
+      imm = -imm;
+    }
+    Put32(jb->addr + jb->index, (op == 0 ? 0x11000000 : 0x51000000) |
+                                    (log2 == 3) << 31 | imm << 10 | dst << 5 |
+                                    dst);
+    jb->index += 4;
+  } else {
+    AppendJitSetReg(jb, kJitRes0, (i64)imm);
+    return AppendJitAlu(jb, op, log2, dst, kJitRes0);
+  }
+#endif
+  jb->lastaction = 0;
+  return true;
+}
+
 /**
  * Appends function call instruction to JIT memory.
  *
@@ -1915,6 +2912,21 @@ bool AppendJitJump(struct JitBlock *jb, void *code) {
   return AppendJit(jb, buf, n);
 }
 
+/**
+ * Changes destination of jump appended earlier to function being built.
+ *
+ * @param jb is function builder object returned by StartJit()
+ * @param off is the offset within the block at which the jump begun
+ * @param code is the new destination of the jump
+ */
+void SetJitJump(struct JitBlock *jb, long off, void *code) {
+  int n;
+  u8 buf[5];
+  if (jb->index > kJitBlockSize) return;
+  n = MakeJitJump(buf, (uintptr_t)jb->addr + off, (uintptr_t)code);
+  memcpy(jb->addr + off, buf, n);
+}
+
 /**
  * Sets register to immediate value.
  *
@@ -2000,6 +3012,8 @@ bool AppendJitSetReg(struct JitBlock *jb, int reg, u64 value) {
       MOVE_DST(lastaction) != reg &&        //
       MOVE_SRC(lastaction) != reg) {
     jb->lastaction = lastaction;
+  } else {
+    jb->lastaction = 0;
   }
   return true;
 }
@@ -2052,4 +3066,632 @@ bool AppendJitTrap(struct JitBlock *jb) {
   return AppendJit(jb, buf, sizeof(buf));
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// PERSISTENT CODE CACHE
+//
+// Once a guest program exits, the jit blocks it filled can be written to
+// disk along with the hook table and the edges between paths, so a later
+// run of the same program can adopt the generated code as-is instead of
+// building it all over again. Paths are restored lazily, the first time
+// the interpreter would otherwise start building them. At that point we
+// rehash the guest pages of the path and of every path it jumps into, to
+// make sure the memory it was generated from still has the same content.
+//
+// Generated code contains absolute addresses of functions and variables
+// in our own image, so a cache is only ever loaded at the same address it
+// was saved from, by the same blink executable, in a fresh jit system.
+//
+// The code of each block is stored at a page aligned offset in the file,
+// so it may be mapped privately into place rather than copied. That way
+// the many processes of a build, which run the same programs again and
+// again, share the physical memory of their cached code with the host's
+// page cache, and only get copies of the pages they patch or append to.
+
+#define kJitCacheMagic   0x334a434b4e494c42  // "BLINKJC3"
+#define kJitCacheClosure 64                  // max paths adopted at once
+
+struct JitCacheHeader {
+  u64 magic;
+  u64 key;
+  u64 base;
+  u64 ender;
+  u32 blocks;
+  u32 paths;
+  u32 edges;
+  u32 pages;
+};
+
+struct JitCacheBlock {
+  u32 offset;
+  u32 size;
+  u32 isprotected;
+};
+
+static int CompareJitCachePaths(const void *a, const void *b) {
+  const struct JitCachePath *x = (const struct JitCachePath *)a;
+  const struct JitCachePath *y = (const struct JitCachePath *)b;
+  return x->virt < y->virt ? -1 : x->virt > y->virt;
+}
+
+static bool WriteJitCacheBytes(int fd, const void *data, size_t size) {
+  ssize_t rc;
+  const u8 *p = (const u8 *)data;
+  while (size) {
+    if ((rc = write(fd, p, size)) == -1) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    p += rc;
+    size -= rc;
+  }
+  return true;
+}
+
+// pads file with zeroes until the offset is a multiple of page size
+static bool WriteJitCachePadding(int fd, u64 *pos) {
+  size_t n;
+  static const u8 kZeroes[512];
+  while (*pos & (FLAG_pagesize - 1)) {
+    n = MIN(sizeof(kZeroes), ROUNDUP(*pos, FLAG_pagesize) - *pos);
+    if (!WriteJitCacheBytes(fd, kZeroes, n)) return false;
+    *pos += n;
+  }
+  return true;
+}
+
+// returns offset in cache file at which the code of its blocks begins
+static u64 GetJitCacheCodeOffset(const struct JitCacheHeader *h) {
+  return ROUNDUP(sizeof(*h) + h->blocks * sizeof(struct JitCacheBlock) +
+                     h->paths * sizeof(struct JitCachePath) +
+                     h->edges * sizeof(i64) +
+                     h->pages * sizeof(struct JitCachePage),
+                 FLAG_pagesize);
+}
+
+static bool IsInJitCacheBlock(const struct JitCacheBlock *blocks, u32 n,
+                              u64 offset) {
+  u32 i;
+  for (i = 0; i < n; ++i) {
+    if (blocks[i].offset <= offset && offset < blocks[i].offset + blocks[i].size) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// checks guest memory of a cached path still has the same content
+static bool IsJitCachePathIntact(const struct JitCache *jc, u32 i,
+                                 bool hashpage(void *, i64, u64 *),
+                                 void *ctx) {
+  u64 hash;
+  const struct JitCachePage *pg = jc->page + jc->path[i].page;
+  return hashpage(ctx, pg->page, &hash) && hash == pg->hash &&
+         (!pg->spans ||
+          (hashpage(ctx, pg->page + 4096, &hash) && hash == pg->nexthash));
+}
+
+// returns index of cached path in old cache that's being carried over
+// into the new one, or -1 if path was generated or restored by us
+static long GetCarriedJitCachePath(struct Jit *jit, i64 virt) {
+  if (!jit->cache || GetJitHook(jit, virt)) return -1;
+  return FindJitCachePath(jit->cache, virt);
+}
+
+/**
+ * Writes generated code of JIT to file so later runs may adopt it.
+ *
+ * Cached paths which this run didn't get around to restoring are saved
+ * too, so long as their code and the code they jump into is still here
+ * and their guest memory hasn't changed. That way the cache grows over
+ * many runs to cover all the code the program has ever executed.
+ *
+ * This should only be called while the calling thread is the only one
+ * left, e.g. at exit, since it needs every leased block to be returned.
+ *
+ * @param key identifies the guest program and the blink configuration
+ * @param ender is the function that jit paths return through
+ * @param hashpage computes the hash of executable guest memory page
+ * @return 0 on success, or -1 w/ errno
+ */
+int SaveJitCache(struct Jit *jit, int fd, u64 key, uintptr_t ender,
+                 bool hashpage(void *, i64, u64 *), void *ctx) {
+  int func;
+  bool changed;
+  long s, d, *from = 0;
+  struct Dll *e;
+  struct JitBlock *jb;
+  struct JitPage *jp;
+  struct JitCache *old;
+  struct JitCachePage *pg;
+  struct JitCachePath *p;
+  uintptr_t virt, addr;
+  struct JitHooks *hooks;
+  struct JitCacheHeader h;
+  struct JitCache jc = {0};
+  u64 pos;
+  u32 i, j, k, n, nb, edges;
+  struct JitCacheBlock *blocks = 0;
+  int rc = -1;
+  LockJit(jit);
+  old = jit->cache;
+  for (nb = 0, e = dll_first(jit->agedblocks); e;
+       e = dll_next(jit->agedblocks, e)) {
+    ++nb;
+  }
+  hooks = atomic_load_explicit(&jit->hooks, memory_order_relaxed);
+  n = hooks->n + (old ? old->paths : 0);
+  if (!(blocks = (struct JitCacheBlock *)Calloc(nb + 1, sizeof(*blocks))) ||
+      !(jc.path = (struct JitCachePath *)Calloc(n, sizeof(*jc.path))) ||
+      !(jc.page = (struct JitCachePage *)Calloc(n, sizeof(*jc.page))) ||
+      !(from = (long *)Calloc(n, sizeof(*from)))) {
+    goto Finished;
+  }
+  // gather the jit blocks that contain our generated code
+  for (nb = 0, e = dll_first(jit->agedblocks); e;
+       e = dll_next(jit->agedblocks, e)) {
+    jb = AGEDBLOCK_CONTAINER(e);
+    if (jb->start != jb->index || !dll_is_empty(jb->staged)) {
+      errno = EBUSY;  // block is leased or its code isn't live yet
+      goto Finished;
+    }
+    blocks[nb].offset = jb->addr - g_code;
+    blocks[nb].size = MIN(ROUNDUP(jb->index, kJitAlign), kJitBlockSize);
+    blocks[nb].isprotected = jb->isprotected;
+    ++nb;
+  }
+  if (!IsInJitCacheBlock(blocks, nb, ender - (uintptr_t)g_code)) {
+    errno = EINVAL;
+    goto Finished;
+  }
+  // gather the paths which are currently installed
+  for (i = 0; i < hooks->n; ++i) {
+    virt = atomic_load_explicit(hooks->virts + i, memory_order_relaxed);
+    func = atomic_load_explicit(hooks->funcs + i, memory_order_relaxed);
+    if (!virt || !func || func == jit->staging) continue;
+    addr = DecodeJitFunc(func) - (uintptr_t)g_code;
+    if (!IsInJitCacheBlock(blocks, nb, addr)) {
+      errno = EINVAL;
+      goto Finished;
+    }
+    jc.path[jc.paths].virt = virt;
+    jc.path[jc.paths].func = addr;
+    ++jc.paths;
+  }
+  // gather the cached paths we loaded that never ended up being used
+  for (i = 0; old && i < old->paths; ++i) {
+    if (!old->dead[i] && !GetJitHook(jit, old->path[i].virt) &&
+        IsJitCachePathIntact(old, i, hashpage, ctx)) {
+      jc.path[jc.paths].virt = old->path[i].virt;
+      jc.path[jc.paths].func = old->path[i].func;
+      ++jc.paths;
+    }
+  }
+  if (!jc.paths) {
+    errno = ENOENT;
+    goto Finished;
+  }
+  qsort(jc.path, jc.paths, sizeof(*jc.path), CompareJitCachePaths);
+  for (i = 0; i < jc.paths; ++i) {
+    from[i] = GetCarriedJitCachePath(jit, jc.path[i].virt);
+  }
+  // carried paths jump directly into code of the paths they link to, so
+  // each of those needs to be saved too, as the very same function. the
+  // ones that can't be saved are dropped by setting their origin to -2
+  do {
+    changed = false;
+    for (i = 0; i < jc.paths; ++i) {
+      if (from[i] < 0) continue;
+      p = old->path + from[i];
+      for (j = 0; j < p->edges; ++j) {
+        virt = old->edge[p->edge + j];
+        d = SearchJitCache(&jc, virt);
+        k = SearchJitCache(old, virt);
+        if (d == jc.paths || jc.path[d].virt != virt || from[d] == -2 ||
+            k == old->paths || old->path[k].virt != virt ||
+            jc.path[d].func != old->path[k].func) {
+          from[i] = -2;
+          changed = true;
+          break;
+        }
+      }
+    }
+  } while (changed);
+  for (j = i = 0; i < jc.paths; ++i) {
+    if (from[i] != -2) {
+      from[j] = from[i];
+      jc.path[j++] = jc.path[i];
+    }
+  }
+  jc.paths = j;
+  // fingerprint the guest memory those paths were generated from
+  for (i = 0; i < jc.paths; ++i) {
+    if (!jc.pages || jc.page[jc.pages - 1].page != (jc.path[i].virt & -4096)) {
+      jc.page[jc.pages].page = jc.path[i].virt & -4096;
+      if (!hashpage(ctx, jc.page[jc.pages].page, &jc.page[jc.pages].hash)) {
+        errno = EFAULT;
+        goto Finished;
+      }
+      ++jc.pages;
+    }
+    pg = jc.page + jc.pages - 1;
+    if (!pg->spans && (((jp = GetJitPage(jit, pg->page)) && jp->spans) ||
+                       (from[i] != -1 &&
+                        old->page[old->path[from[i]].page].spans))) {
+      pg->spans = true;
+      if (!hashpage(ctx, pg->page + 4096, &pg->nexthash)) {
+        errno = EFAULT;
+        goto Finished;
+      }
+    }
+    jc.path[i].page = jc.pages - 1;
+  }
+  // gather edges, ignoring ones to paths that never got generated since
+  // those are still jumps back into the interpreter in generated code
+  for (edges = i = 0; i < jc.paths; ++i) {
+    if (from[i] != -1) {
+      edges += old->path[from[i]].edges;
+      continue;
+    }
+    s = GetEdge(&jit->edges, jc.path[i].virt);
+    if (jit->edges.dst[s]) edges += jit->edges.dst[s]->i;
+  }
+  if (!(jc.edge = (i64 *)Calloc(edges + 1, sizeof(*jc.edge)))) {
+    goto Finished;
+  }
+  for (i = 0; i < jc.paths; ++i) {
+    jc.path[i].edge = jc.edges;
+    if (from[i] != -1) {
+      p = old->path + from[i];
+      for (j = 0; j < p->edges; ++j) {
+        jc.edge[jc.edges++] = old->edge[p->edge + j];
+      }
+      jc.path[i].edges = p->edges;
+      continue;
+    }
+    s = GetEdge(&jit->edges, jc.path[i].virt);
+    if (!jit->edges.dst[s]) continue;
+    for (j = 0; j < jit->edges.dst[s]->i; ++j) {
+      d = SearchJitCache(&jc, jit->edges.dst[s]->p[j]);
+      if (d < jc.paths && jc.path[d].virt == jit->edges.dst[s]->p[j]) {
+        jc.edge[jc.edges++] = jit->edges.dst[s]->p[j];
+      }
+    }
+    jc.path[i].edges = jc.edges - jc.path[i].edge;
+  }
+  // write it all out
+  memset(&h, 0, sizeof(h));
+  h.magic = kJitCacheMagic;
+  h.key = key;
+  h.base = (uintptr_t)g_code;
+  h.ender = ender - (uintptr_t)g_code;
+  h.blocks = nb;
+  h.paths = jc.paths;
+  h.edges = jc.edges;
+  h.pages = jc.pages;
+  pos = sizeof(h) + nb * sizeof(*blocks) + jc.paths * sizeof(*jc.path) +
+        jc.edges * sizeof(*jc.edge) + jc.pages * sizeof(*jc.page);
+  if (!WriteJitCacheBytes(fd, &h, sizeof(h)) ||
+      !WriteJitCacheBytes(fd, blocks, nb * sizeof(*blocks)) ||
+      !WriteJitCacheBytes(fd, jc.path, jc.paths * sizeof(*jc.path)) ||
+      !WriteJitCacheBytes(fd, jc.edge, jc.edges * sizeof(*jc.edge)) ||
+      !WriteJitCacheBytes(fd, jc.page, jc.pages * sizeof(*jc.page)) ||
+      !WriteJitCachePadding(fd, &pos)) {
+    goto Finished;
+  }
+  unassert(pos == GetJitCacheCodeOffset(&h));
+  for (i = 0; i < nb; ++i) {
+    if (!WriteJitCacheBytes(fd, g_code + blocks[i].offset, blocks[i].size)) {
+      goto Finished;
+    }
+    pos += blocks[i].size;
+    if (!WriteJitCachePadding(fd, &pos)) {
+      goto Finished;
+    }
+  }
+  JIT_LOGF("saved %" PRIu32 " jit paths to cache", jc.paths);
+  rc = 0;
+Finished:
+  UnlockJit(jit);
+  Free(jc.page);
+  Free(jc.edge);
+  Free(jc.path);
+  Free(blocks);
+  Free(from);
+  return rc;
+}
+
+// takes specific block from the global pool
+// @assume jit->lock
+static struct JitBlock *ClaimJitBlock(struct Jit *jit, u8 *addr) {
+  struct Dll *e;
+  struct JitBlock *jb = 0;
+  LOCK(&g_jit.lock);
+  while (g_jit.brk <= addr - g_code && (jb = InitJitBlock())) {
+    dll_make_first(&g_jit.freeblocks, &jb->elem);
+    ++g_jit.freecount;
+  }
+  for (jb = 0, e = dll_first(g_jit.freeblocks); e; e = dll_next(g_jit.freeblocks, e)) {
+    if (JITBLOCK_CONTAINER(e)->addr == addr) {
+      dll_remove(&g_jit.freeblocks, e);
+      jb = JITBLOCK_CONTAINER(e);
+      --g_jit.freecount;
+      break;
+    }
+  }
+  UNLOCK(&g_jit.lock);
+  if (jb) dll_make_last(&jit->agedblocks, &jb->aged);
+  return jb;
+}
+
+static bool ReadJitCacheBytes(int fd, void *data, size_t size) {
+  ssize_t rc;
+  u8 *p = (u8 *)data;
+  while (size) {
+    if ((rc = read(fd, p, size)) == -1) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    if (!rc) {
+      errno = EIO;
+      return false;
+    }
+    p += rc;
+    size -= rc;
+  }
+  return true;
+}
+
+// puts cached code of block into place, preferably by mapping the file
+static bool PutJitCacheBlock(int fd, u64 off, u8 *addr, u32 size) {
+  u32 got;
+  ssize_t rc;
+  if (!size) return true;
+#ifndef MAP_JIT
+  if (Mmap(addr, ROUNDUP(size, FLAG_pagesize),
+           atomic_load_explicit(&g_jit.prot, memory_order_relaxed),
+           MAP_PRIVATE | MAP_FIXED, fd, off, "jitcache") == addr) {
+    STATISTIC(jit_cache_bytes_mapped += size);
+    return true;
+  }
+#endif
+  for (got = 0; got < size; got += rc) {
+    if ((rc = pread(fd, addr + got, size - got, off + got)) <= 0) {
+      if (rc == -1 && errno == EINTR) {
+        rc = 0;
+        continue;
+      }
+      if (!rc) errno = EIO;
+      return false;
+    }
+  }
+  return true;
+}
+
+// checks that the cache file is internally consistent
+static bool IsJitCacheSane(const struct JitCacheHeader *h,
+                           const struct JitCacheBlock *blocks,
+                           const struct JitCache *jc) {
+  u32 i;
+  for (i = 0; i < h->blocks; ++i) {
+    if (blocks[i].offset > kJitMemorySize - kJitBlockSize ||
+        blocks[i].size > kJitBlockSize || (blocks[i].size & (kJitAlign - 1))) {
+      return false;
+    }
+  }
+  if (!IsInJitCacheBlock(blocks, h->blocks, h->ender)) {
+    return false;
+  }
+  for (i = 0; i < jc->paths; ++i) {
+    if ((i && jc->path[i - 1].virt >= jc->path[i].virt) ||
+        !IsInJitCacheBlock(blocks, h->blocks, jc->path[i].func) ||
+        jc->path[i].page >= jc->pages ||
+        jc->page[jc->path[i].page].page != (jc->path[i].virt & -4096) ||
+        jc->path[i].edge > jc->edges ||
+        jc->path[i].edges > jc->edges - jc->path[i].edge) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Loads code generated by an earlier run into a brand new JIT.
+ *
+ * Nothing becomes live here. Paths are installed by RestoreJitPath()
+ * once the guest pages they were generated from have been validated.
+ *
+ * @param key must be the same value that was passed to SaveJitCache()
+ * @param ender receives address of function jit paths return through
+ * @return 0 on success, or -1 w/ errno
+ */
+int LoadJitCache(struct Jit *jit, int fd, u64 key, uintptr_t *ender) {
+  u64 off;
+  u32 i, c;
+  struct JitCacheHeader h;
+  struct JitCache *jc = 0;
+  struct JitCacheBlock *blocks = 0;
+  struct JitBlock **claimed = 0;
+  int rc = -1;
+  if (!CanJitForImmediateEffect() || pthread_jit_write_protect_supported_np()) {
+    return enotsup();  // we'd need to mprotect() or toggle thread state
+  }
+  if (!ReadJitCacheBytes(fd, &h, sizeof(h))) return -1;
+  if (h.magic != kJitCacheMagic || h.key != key ||
+      h.base != (uintptr_t)g_code || !h.paths ||
+      h.blocks > kJitMemorySize / kJitBlockSize) {
+    return einval();
+  }
+  if (!(jc = (struct JitCache *)Calloc(1, sizeof(*jc))) ||
+      !(blocks = (struct JitCacheBlock *)Calloc(h.blocks, sizeof(*blocks))) ||
+      !(claimed = (struct JitBlock **)Calloc(h.blocks, sizeof(*claimed))) ||
+      !(jc->path = (struct JitCachePath *)Calloc(h.paths, sizeof(*jc->path))) ||
+      !(jc->edge = (i64 *)Calloc(h.edges + 1, sizeof(*jc->edge))) ||
+      !(jc->page = (struct JitCachePage *)Calloc(h.pages, sizeof(*jc->page))) ||
+      !(jc->dead = (bool *)Calloc(h.paths, sizeof(*jc->dead)))) {
+    goto Finished;
+  }
+  jc->paths = h.paths;
+  jc->edges = h.edges;
+  jc->pages = h.pages;
+  if (!ReadJitCacheBytes(fd, blocks, h.blocks * sizeof(*blocks)) ||
+      !ReadJitCacheBytes(fd, jc->path, h.paths * sizeof(*jc->path)) ||
+      !ReadJitCacheBytes(fd, jc->edge, h.edges * sizeof(*jc->edge)) ||
+      !ReadJitCacheBytes(fd, jc->page, h.pages * sizeof(*jc->page))) {
+    goto Finished;
+  }
+  if (!IsJitCacheSane(&h, blocks, jc)) {
+    einval();
+    goto Finished;
+  }
+  LockJit(jit);
+  if (jit->cache || !dll_is_empty(jit->agedblocks)) {
+    UnlockJit(jit);
+    errno = EBUSY;
+    goto Finished;
+  }
+  for (c = 0; c < h.blocks; ++c) {
+    if (!(claimed[c] = ClaimJitBlock(jit, g_code + blocks[c].offset)) ||
+        !PrepareJitMemory(claimed[c]->addr, kJitBlockSize)) {
+      break;
+    }
+  }
+  if (c < h.blocks) {
+    for (i = 0; i <= c && i < h.blocks; ++i) {
+      if (claimed[i]) {
+        dll_remove(&jit->agedblocks, &claimed[i]->aged);
+        ReleaseJitBlock(claimed[i]);
+      }
+    }
+    UnlockJit(jit);
+    errno = EBUSY;
+    goto Finished;
+  }
+  for (off = GetJitCacheCodeOffset(&h), i = 0; i < h.blocks;
+       off += ROUNDUP(blocks[i].size, FLAG_pagesize), ++i) {
+    if (!PutJitCacheBlock(fd, off, claimed[i]->addr, blocks[i].size)) {
+      // our jit memory is now garbage, so keep it from being used
+      UnlockJit(jit);
+      DisableJit(jit);
+      goto Finished;
+    }
+    sys_icache_invalidate(claimed[i]->addr, blocks[i].size);
+    claimed[i]->start = blocks[i].size;
+    claimed[i]->index = blocks[i].size;
+    claimed[i]->committed = ROUNDDOWN(blocks[i].size, FLAG_pagesize);
+    claimed[i]->isprotected = blocks[i].isprotected;
+    ReinsertJitBlock_(jit, claimed[i]);
+  }
+  jit->cache = jc;
+  jc = 0;
+  UnlockJit(jit);
+  *ender = (uintptr_t)g_code + h.ender;
+  JIT_LOGF("loaded %" PRIu32 " jit paths from cache", h.paths);
+  rc = 0;
+Finished:
+  FreeJitCache(jc);
+  Free(claimed);
+  Free(blocks);
+  return rc;
+}
+
+/**
+ * Installs path from code cache, if it exists and is still valid.
+ *
+ * This also installs all the other cached paths which the path jumps
+ * into directly, since generated code doesn't go through hooks then.
+ *
+ * @param virt is the address of the instruction that's about to run
+ * @param hashpage computes the hash of executable guest memory page
+ * @return native function address, or 0 if it doesn't exist
+ */
+uintptr_t RestoreJitPath(struct Jit *jit, i64 virt,
+                         bool hashpage(void *, i64, u64 *), void *ctx) {
+  long d, i;
+  unsigned pgen;
+  struct JitPage *jp;
+  struct JitCache *jc;
+  struct JitCachePath *p;
+  u32 j, k, n, todo[kJitCacheClosure];
+  uintptr_t res = 0;
+  LockJit(jit);
+  if (!(jc = jit->cache) || (i = FindJitCachePath(jc, virt)) == -1) {
+    UnlockJit(jit);
+    return 0;
+  }
+  // find the paths reachable from this one that must become live too
+  todo[0] = i;
+  for (n = 1, k = 0; k < n; ++k) {
+    p = jc->path + todo[k];
+    for (j = 0; j < p->edges; ++j) {
+      virt = jc->edge[p->edge + j];
+      if ((d = FindJitCachePath(jc, virt)) != -1) {
+        for (i = 0; i < n; ++i) {
+          if (todo[i] == d) break;
+        }
+        if (i < n) continue;
+        if (n == kJitCacheClosure) goto GiveUp;
+        todo[n++] = d;
+      } else if (GetJitHook(jit, virt) !=
+                 (uintptr_t)g_code + jc->path[SearchJitCache(jc, virt)].func) {
+        goto GiveUp;  // we jump into a path that was restored then deleted
+      }
+    }
+  }
+  pgen = atomic_load_explicit(&jit->pagegen, memory_order_acquire);
+  UnlockJit(jit);
+  // make sure the guest memory hasn't changed since the cache was made
+  for (k = 0; k < n; ++k) {
+    if (!IsJitCachePathIntact(jc, todo[k], hashpage, ctx)) {
+      LockJit(jit);
+      STATISTIC(++jit_cache_paths_rejected);
+      goto GiveUp;
+    }
+  }
+  LockJit(jit);
+  if (ShallNotPass(pgen, &jit->pagegen)) goto TryAgainLater;
+  for (k = 0; k < n; ++k) {
+    if (jc->dead[todo[k]] || GetJitHook(jit, jc->path[todo[k]].virt)) {
+      goto TryAgainLater;  // another thread got here first
+    }
+  }
+  for (k = 0; k < n; ++k) {
+    p = jc->path + todo[k];
+    for (j = 0; j < p->edges; ++j) {
+      if (!AddEdge(&jit->edges, p->virt, jc->edge[p->edge + j]) ||
+          !AddEdge(&jit->redges, jc->edge[p->edge + j], p->virt)) {
+        UnlockJit(jit);
+        DisableJit(jit);
+        return 0;
+      }
+    }
+  }
+  // install dependencies first, so no path runs before its jump targets
+  for (k = n; k--;) {
+    p = jc->path + todo[k];
+    jc->dead[todo[k]] = true;
+    if (!SetJitHookUnlocked(jit, p->virt, 0, (uintptr_t)g_code + p->func)) {
+      UnlockJit(jit);
+      DisableJit(jit);
+      return 0;
+    }
+    if ((jp = GetJitPage(jit, p->virt))) {
+      // cached paths don't know which lines of the page they were built
+      // from, so any change to the page will have to reset all of them
+      jp->whole = true;
+      jp->spans |= jc->page[p->page].spans;
+    }
+    STATISTIC(++jit_cache_paths_restored);
+  }
+  res = (uintptr_t)g_code + jc->path[todo[0]].func;
+  JIT_LOGF("restored %" PRIu32 " jit paths from cache at %#" PRIx64, n,
+           jc->path[todo[0]].virt);
+TryAgainLater:
+  UnlockJit(jit);
+  return res;
+GiveUp:
+  jc->dead[todo[0]] = true;
+  UnlockJit(jit);
+  return 0;
+}
+
 #endif /* HAVE_JIT */
@@ -10,17 +10,36 @@
 #include "blink/tunables.h"
 #include "blink/types.h"
 
+// maximum size of jit code heap. it's reserved in our own image, since
+// generated code must be able to reach our functions with a relative
+// branch, but it's carved into blocks only as the guest needs them.
+#ifndef kJitMemorySize
+#ifdef __x86_64__
+#define kJitMemorySize 130023424
+#else
+#define kJitMemorySize 32505856  // arm64 branches only reach +/-128mb
+#endif
+#endif
+
 #define kJitFit          1000
-#define kJitDepth        16
+#define kJitVisits       64
 #define kJitAlign        16
-#define kJitJumpTries    16
+#define kJitJumpBuckets  256
 #define kJitBlockSize    262144
-#define kJitMemorySize   32505856
-#define kJitRetireQueue  (int)(kJitMemorySize / kJitBlockSize * .10)
+#define kJitBlocks       (kJitMemorySize / kJitBlockSize)
+#define kJitRetireQueue  (int)(kJitBlocks * .10)
+#define kJitEvictBatch   (int)(kJitBlocks * .25)
+#define kJitHeatMax      65535
 #define kJitSlabInts     (65536 / sizeof(struct JitInts))
 #define kJitInitialHooks 16384
-#define kJitInitialEdges 4096
+#define kJitInitialEdges 512
+#define kJitPageGens     256
+#define kJitPageHooks    128
 
+// only x86-64 and arm64 hosts can jit, since besides these register
+// maps, each host needs its own AppendJit*() encoders in jit.c, path
+// prologue and epilogue in path.c, and micro-op glue in uop.c. other
+// hosts get HAVE_JIT undefined by builtin.h, and they just interpret
 #ifdef __x86_64__
 #define kJitRes0 kAmdAx
 #define kJitRes1 kAmdDx
@@ -67,6 +86,7 @@
 #define kAmdRex           0x40  // turns ah/ch/dh/bh into spl/bpl/sil/dil
 #define kAmdRexb          0x41  // turns 0007 (r/m) of modrm into r8..r15
 #define kAmdRexr          0x44  // turns 0070 (reg) of modrm into r8..r15
+#define kAmdRexx          0x42  // turns 0070 (index) of sib into r8..r15
 #define kAmdRexw          0x48  // makes register 64-bit
 #define kAmdAx            0     // first function result
 #define kAmdCx            1     // third function parameter
@@ -130,6 +150,8 @@ struct JitIntsAllocator {
 struct JitEdges {
   int i, n;
   i64 *src;
+  unsigned *ord;  // topological order of src, maintained in jit->edges
+  unsigned ords;  // next order handed out to a newly seen node
   struct JitInts **dst;
   struct JitIntsAllocator jia;
 };
@@ -137,16 +159,22 @@ struct JitEdges {
 struct JitJump {
   u8 *code;
   u64 virt;
-  int tries;
   int addend;
   struct Dll elem;
 };
 
+struct JitGens {
+  unsigned path;     // jit->pathgen when the path was started
+  unsigned page[2];  // jit->pagegens[] of its first page and the next
+};
+
 struct JitStage {
   long start;
   long index;
   u64 virt;
-  unsigned pagegen;
+  u8 *addr;           // code address, if the worker is publishing it
+  struct Dll *jumps;  // fixups of the path, committed once it's published
+  struct JitGens gens;
   struct Dll elem;
 };
 
@@ -162,9 +190,21 @@ struct JitFreeds {
   struct Dll *f;
 };
 
+struct JitPageHooks {
+  i64 page;
+  _Atomic(int) funcs[4096];  // encoded path function for each offset
+};
+
 struct JitPage {
   i64 page;
   u64 bitset;
+  u64 lines;      // 64-byte lines of page read by paths on or into it
+  u64 spanned;    // lines read by paths starting on the previous page
+  bool spans;     // paths starting on this page run into the next one
+  bool whole;     // paths here don't know their lines, e.g. cached ones
+  u64 reach[64];  // lines read by paths starting in each bitset line
+  u64 sums[64];   // hash of each line in `lines` when it was read
+  struct JitPageHooks *hooks;  // direct map of page, if it won a slot
   struct Dll elem;
 };
 
@@ -175,9 +215,11 @@ struct JitBlock {
   long index;
   long committed;
   long lastaction;
+  bool isleased;
   bool wasretired;
   bool isprotected;
   unsigned pagegen;
+  struct JitGens gens;
   struct Dll elem;
   struct Dll aged;
   struct Dll *jumps;
@@ -185,29 +227,62 @@ struct JitBlock {
   struct Dll *freejumps;
 };
 
+struct JitCachePath {
+  i64 virt;   // guest address at which path starts
+  u32 func;   // offset of path function within jit memory
+  u32 page;   // index of hash of guest page which path was built from
+  u32 edge;   // index of first path this path jumps directly into
+  u32 edges;  // number of paths this path jumps directly into
+};
+
+struct JitCachePage {
+  i64 page;
+  u64 hash;
+  u64 nexthash;  // hash of the following page, if paths here span it
+  bool spans;    // whether paths starting on this page run into the next
+};
+
+struct JitCache {
+  u32 paths, edges, pages;
+  bool *dead;
+  i64 *edge;
+  struct JitCachePath *path;
+  struct JitCachePage *page;
+};
+
 struct JitHooks {
-  unsigned i;
-  _Atomic(unsigned) n;
-  _Atomic(_Atomic(int) *) funcs;
-  _Atomic(_Atomic(uintptr_t) *) virts;
+  unsigned n;                  // number of slots, which is a power of two
+  _Atomic(uintptr_t) *virts;   // keys, which stay behind once deleted
+  _Atomic(int) *funcs;         // encoded path functions, or zero
 };
 
 struct Jit {
   int staging;
   bool threaded;
   _Atomic(bool) disabled;
-  struct JitHooks hooks;
+  unsigned hooked;
+  long deleted;  // paths deleted, for attributing evictions to causes
+  _Atomic(struct JitHooks *) hooks;
   struct JitEdges edges;
   struct JitEdges redges;
   struct JitFreeds freeds;
   struct Dll *agedblocks;
   struct Dll *blocks;
-  struct Dll *jumps;
+  struct Dll *jumps[kJitJumpBuckets];  // pending fixups hashed by virt
   struct Dll *freejumps;
   struct Dll *pages;
+  struct JitCache *cache;
+  struct Dll *pending;      // paths left for the worker to publish
+  bool working;             // worker thread has been started
+  bool quitting;            // worker thread should exit
+  pthread_t worker;
+  pthread_cond_t_ pended;
   pthread_mutex_t_ lock;
-  _Alignas(kSemSize) _Atomic(unsigned) keygen;
-  _Alignas(kSemSize) _Atomic(unsigned) pagegen;
+  _Atomic(unsigned) smcgen;  // bumped whenever guest code may have changed
+  _Alignas(kSemSize) _Atomic(unsigned) pagegen;  // bumped when code is deleted
+  _Atomic(unsigned) pathgen;  // bumped when paths anywhere are deleted
+  _Atomic(unsigned) pagegens[kJitPageGens];  // bumped when page is reset
+  _Atomic(struct JitPageHooks *) pagehooks[kJitPageHooks];  // hot pages
 };
 
 extern const u8 kJitRes[2];
@@ -219,8 +294,10 @@ int EnableJit(struct Jit *);
 int DisableJit(struct Jit *);
 int DestroyJit(struct Jit *);
 int FixJitProtection(struct Jit *);
+int StartJitWorker(struct Jit *);
 int InitJit(struct Jit *, uintptr_t);
 bool CanJitForImmediateEffect(void) nosideeffect;
+void GetJitUsage(struct Jit *, long *, long *);
 bool AppendJit(struct JitBlock *, const void *, long);
 bool AbandonJit(struct Jit *, struct JitBlock *);
 int FlushJit(struct Jit *);
@@ -232,13 +309,32 @@ bool AppendJitPause(struct JitBlock *);
 bool AppendJitTrap(struct JitBlock *);
 bool AppendJitJump(struct JitBlock *, void *);
 bool AppendJitCall(struct JitBlock *, void *);
+void SetJitJump(struct JitBlock *, long, void *);
 bool AppendJitSetReg(struct JitBlock *, int, u64);
 bool AppendJitMovReg(struct JitBlock *, int, int);
+bool AppendJitMovReg32(struct JitBlock *, int, int);
+bool AppendJitLoad(struct JitBlock *, int, int, u32);
+bool AppendJitStore(struct JitBlock *, int, u32, int);
+bool AppendJitLea(struct JitBlock *, int, int, int, int, i32);
+bool AppendJitAlu(struct JitBlock *, int, int, int, int);
+bool AppendJitAluImm(struct JitBlock *, int, int, int, i32);
 bool FinishJit(struct Jit *, struct JitBlock *);
 bool RecordJitJump(struct JitBlock *, u64, int);
 bool RecordJitEdge(struct Jit *, i64, i64);
 uintptr_t GetJitHook(struct Jit *, u64);
+void TouchJitPath(uintptr_t);
 int ResetJitPage(struct Jit *, i64);
+int ResetJitPages(struct Jit *);
+int ResetJitPageLines(struct Jit *, i64, const u8 *);
+int SpanJitPage(struct Jit *, i64);
+bool CoverJitPath(struct Jit *, i64, const u64[2], const u64[128], unsigned);
+u64 HashJitLine(const u8 *);
+int ResetJitPath(struct Jit *, i64);
+int SaveJitCache(struct Jit *, int, u64, uintptr_t,
+                 bool (*)(void *, i64, u64 *), void *);
+int LoadJitCache(struct Jit *, int, u64, uintptr_t *);
+uintptr_t RestoreJitPath(struct Jit *, i64, bool (*)(void *, i64, u64 *),
+                         void *);
 
 int CommitJit_(struct Jit *, struct JitBlock *);
 void ReinsertJitBlock_(struct Jit *, struct JitBlock *);
@@ -0,0 +1,166 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "blink/builtin.h"
+#include "blink/end.h"
+#include "blink/flag.h"
+#include "blink/jit.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/stats.h"
+#include "blink/syscall.h"
+#include "blink/util.h"
+#include "blink/vfs.h"
+
+#ifdef HAVE_JIT
+
+static u64 HashStat(u64 h, const struct stat *st) {
+  h = Fnv64(h, &st->st_dev, sizeof(st->st_dev));
+  h = Fnv64(h, &st->st_ino, sizeof(st->st_ino));
+  h = Fnv64(h, &st->st_size, sizeof(st->st_size));
+  h = Fnv64(h, &st->st_mtime, sizeof(st->st_mtime));
+  return h;
+}
+
+// computes hash of the guest memory page a cached jit path came from
+static bool HashJitPage(void *ctx, i64 page, u64 *hash) {
+  u8 *host;
+  int segvcode;
+  struct Machine *m = (struct Machine *)ctx;
+  segvcode = m->segvcode;
+  host = LookupAddress2(m, page, PAGE_XD, 0);
+  m->segvcode = segvcode;
+  if (!host) return false;
+  *hash = Fnv64(0xcbf29ce484222325, host, 4096);
+  return true;
+}
+
+// identifies the guest program along with everything that influences
+// the native code we generate for it, which includes our own binary
+static bool GetJitCacheKey(struct Machine *m, u64 *key) {
+  u64 h;
+  struct stat st;
+  if (!m->system->elf.prog) return false;
+  h = 0xcbf29ce484222325;
+  if (stat("/proc/self/exe", &st) && (!g_blink_path || stat(g_blink_path, &st))) {
+    return false;
+  }
+  h = HashStat(h, &st);
+  if (VfsStat(AT_FDCWD, m->system->elf.prog, &st, 0)) return false;
+  h = HashStat(h, &st);
+  h = Fnv64(h, m->system->elf.prog, strlen(m->system->elf.prog));
+  h = Fnv64(h, (u64[]){(uintptr_t)IMAGE_END, FLAG_nolinear, FLAG_noconnect,
+                       FLAG_statistics, FLAG_pagesize, FLAG_skew, FLAG_vabits,
+                       sizeof(struct Machine)},
+            8 * sizeof(u64));
+  *key = h;
+  return true;
+}
+
+static bool GetJitCachePath(u64 key, char path[PATH_MAX]) {
+  int n;
+  n = snprintf(path, PATH_MAX, "%s/%016llx.jit", FLAG_jitcache,
+               (unsigned long long)key);
+  return 0 < n && n < PATH_MAX;
+}
+
+/**
+ * Adopts native code that an earlier run of this program generated.
+ *
+ * This should be called after a program is loaded, before it executes
+ * and after the jit memory of any previous program has been released.
+ * Failures are logged and otherwise ignored.
+ */
+void ReadJitCacheFile(struct Machine *m) {
+  int fd;
+  u64 key;
+  uintptr_t ender;
+  char path[PATH_MAX];
+  if (!FLAG_jitcache || IsJitDisabled(&m->system->jit)) return;
+  if (!GetJitCacheKey(m, &key) || !GetJitCachePath(key, path)) return;
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+    if (errno != ENOENT) LOGF("%s: open failed: %s", path, DescribeHostErrno(errno));
+    return;
+  }
+  if (!LoadJitCache(&m->system->jit, fd, key, &ender)) {
+    m->system->ender = ender;
+  } else {
+    JIT_LOGF("%s: couldn't load jit cache: %s", path, DescribeHostErrno(errno));
+  }
+  close(fd);
+}
+
+/**
+ * Saves native code generated for this program so later runs reuse it.
+ *
+ * This must be called while the calling thread is the only one left,
+ * which is to say after KillOtherThreads() in exit_group().
+ */
+void WriteJitCacheFile(struct Machine *m) {
+  int fd, rc;
+  u64 key;
+  bool nofault;
+  char path[PATH_MAX];
+  char temp[PATH_MAX];
+  if (!FLAG_jitcache || IsJitDisabled(&m->system->jit) || !m->system->ender) {
+    return;
+  }
+  if (!GetJitCacheKey(m, &key) || !GetJitCachePath(key, path)) return;
+  if (snprintf(temp, sizeof(temp), "%s.%d.tmp", path, getpid()) >=
+      sizeof(temp)) {
+    return;
+  }
+  if ((fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) ==
+      -1) {
+    LOGF("%s: open failed: %s", temp, DescribeHostErrno(errno));
+    return;
+  }
+  nofault = m->nofault;
+  m->nofault = true;
+  rc = SaveJitCache(&m->system->jit, fd, key, m->system->ender, HashJitPage, m);
+  m->nofault = nofault;
+  if (close(fd)) rc = -1;
+  if (rc) {
+    JIT_LOGF("%s: couldn't save jit cache: %s", path, DescribeHostErrno(errno));
+    unlink(temp);
+  } else if (rename(temp, path)) {
+    // rename() is atomic so concurrent runs never see partial files
+    LOGF("%s: rename failed: %s", path, DescribeHostErrno(errno));
+    unlink(temp);
+  }
+}
+
+/**
+ * Installs cached native code for the instruction that's about to run.
+ *
+ * @return native function, or 0 if the address wasn't cached or if the
+ *     guest memory it came from no longer has the same content
+ */
+uintptr_t RestoreCachedJitPath(struct Machine *m) {
+  if (!m->system->jit.cache) return 0;
+  return RestoreJitPath(&m->system->jit, m->ip, HashJitPage, m);
+}
+
+#endif /* HAVE_JIT */
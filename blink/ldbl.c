@@ -18,11 +18,27 @@
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include "blink/ldbl.h"
 
+#include <string.h>
+
 #include "blink/endian.h"
 #include "blink/macros.h"
 #include "blink/pun.h"
 
-u8 *SerializeLdbl(u8 b[10], double f) {
+#ifdef HAVE_LDBL
+
+u8 *SerializeLdbl(u8 b[10], fpu_t f) {
+  return memcpy(b, &f, 10);
+}
+
+fpu_t DeserializeLdbl(const u8 b[10]) {
+  fpu_t f = 0;
+  memcpy(&f, b, 10);
+  return f;
+}
+
+#else
+
+u8 *SerializeLdbl(u8 b[10], fpu_t f) {
   int e;
   union DoublePun u = {f};
   e = (u.i >> 52) & 0x7ff;
@@ -39,7 +55,7 @@ u8 *SerializeLdbl(u8 b[10], double f) {
   return b;
 }
 
-double DeserializeLdbl(const u8 b[10]) {
+fpu_t DeserializeLdbl(const u8 b[10]) {
   union DoublePun u;
   u.i = (u64)(MAX(-1023, MIN(1024, ((Read16(b + 8) & 0x7fff) - 0x3fff))) + 1023)
             << 52 |
@@ -47,3 +63,5 @@ double DeserializeLdbl(const u8 b[10]) {
         (u64)(b[9] >> 7) << 63;
   return u.f;
 }
+
+#endif /* HAVE_LDBL */
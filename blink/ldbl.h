@@ -1,8 +1,15 @@
 #ifndef BLINK_LDBL_H_
 #define BLINK_LDBL_H_
+#include "blink/builtin.h"
 #include "blink/types.h"
 
-double DeserializeLdbl(const u8[10]);
-u8 *SerializeLdbl(u8[10], double);
+#ifdef HAVE_LDBL
+typedef long double fpu_t;
+#else
+typedef double fpu_t;
+#endif
+
+fpu_t DeserializeLdbl(const u8[10]);
+u8 *SerializeLdbl(u8[10], fpu_t);
 
 #endif /* BLINK_LDBL_H_ */
@@ -0,0 +1,480 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/libblink.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/bus.h"
+#include "blink/coverage.h"
+#include "blink/dll.h"
+#include "blink/errno.h"
+#include "blink/flag.h"
+#include "blink/jit.h"
+#include "blink/loader.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/map.h"
+#include "blink/overlays.h"
+#include "blink/signal.h"
+#include "blink/syscall.h"
+#include "blink/thread.h"
+#include "blink/timespec.h"
+#include "blink/tunables.h"
+#include "blink/util.h"
+#include "blink/vfs.h"
+#include "blink/xlat.h"
+
+#ifdef __linux
+#include <sys/syscall.h>
+#endif
+
+/**
+ * @fileoverview Embeddable interface for running many guests at once.
+ *
+ * The blink command gives the process it's running to a single guest,
+ * and ends it with the guest. Here, each guest's main thread instead
+ * runs on a host thread of its own, so exit_group() and fatal signals
+ * only need to free that guest's System and end its threads, after a
+ * wait() style status is left for RunGuest() to return.
+ *
+ * When the budget of milliseconds given to RunGuest() runs out, it
+ * pauses the guest and returns, so the host can run others in turn.
+ * This raises the attention flag of every thread in the guest, which
+ * jit paths check at their ends and back-edges, and the interpreter
+ * checks between instructions, so each thread soon parks itself, with
+ * all of its state left where it was, until RunGuest() is called on
+ * the guest once more. Guests are thus time sliced by their embedder,
+ * without costing any cpu time when they're not inside RunGuest(),
+ * although their threads still have host threads waiting on them.
+ *
+ * Guests that execve() are replaced in place like the blink command
+ * does it. Guests that fork() fork the whole host process, although
+ * the child only keeps the guest's thread, and exits once it's done.
+ */
+
+#ifdef HAVE_THREADS
+
+#define GUEST_CONTAINER(e) DLL_CONTAINER(struct Guest, elem, e)
+
+struct Guest {
+  bool loaded;              // LoadGuest() succeeded
+  bool started;             // RunGuest() created our host thread
+  bool killed;              // FreeGuest() is killing the guest
+  bool done;                // guest exited and its System was freed
+  bool joined;              // host thread of main thread was joined
+  int status;               // wait() status of guest once it's done
+  pthread_t thread;         // host thread running guest main thread
+  struct System *system;    // system currently running this guest
+  struct Machine *machine;  // main thread of guest as it was loaded
+  struct Dll elem;          // guests list membership
+  char path[PATH_MAX];      // program, which the loader points into
+};
+
+static struct Guests {
+  pthread_once_t once;
+  int rc;                // result of InitGuests()
+  pthread_mutex_t lock;  // guards list and all Guest fields above
+  pthread_cond_t cond;   // signaled whenever a guest becomes done
+  struct Dll *list;
+} g_guests = {
+    .once = PTHREAD_ONCE_INIT,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void OnSigSys(int sig) {
+  // do nothing
+}
+
+static void OnFatalSystemSignal(int sig, siginfo_t *si, void *ptr) {
+  struct Machine *m = g_machine;
+  if (!m || !m->canhalt) {
+    // this fault belongs to the host program rather than a guest
+    signal(sig, SIG_DFL);
+    return;
+  }
+  SIG_LOGF("OnFatalSystemSignal(%s, %p)", DescribeSignal(UnXlatSignal(sig)),
+           si->si_addr);
+#ifndef DISABLE_JIT
+  if (IsSelfModifyingCodeSegfault(m, si)) return;
+#endif
+  g_siginfo = *si;
+  siglongjmp(m->onhalt, kMachineFatalSystemSignal);
+}
+
+// @assume g_guests.lock
+static struct Guest *GetGuest(struct System *s) {
+  struct Dll *e;
+  struct Guest *g;
+  for (e = dll_first(g_guests.list); e; e = dll_next(g_guests.list, e)) {
+    if ((g = GUEST_CONTAINER(e))->system == s) {
+      return g;
+    }
+  }
+  return 0;
+}
+
+// @assume g_guests.lock
+static void KillGuest(struct Guest *g) {
+  struct Dll *e;
+  struct Machine *m;
+  if (!g->system) return;
+  LOCK(&g->system->machines_lock);
+  for (e = dll_first(g->system->machines); e;
+       e = dll_next(g->system->machines, e)) {
+    m = MACHINE_CONTAINER(e);
+    atomic_store_explicit(&m->killed, true, memory_order_release);
+    atomic_store_explicit(&m->attention, true, memory_order_release);
+    InterruptFutex(atomic_load_explicit(&m->futex, memory_order_seq_cst));
+    pthread_kill(m->thread, SIGSYS);
+  }
+  unassert(!pthread_cond_broadcast(&g->system->paused_cond));
+  UNLOCK(&g->system->machines_lock);
+}
+
+// @assume g_guests.lock
+static void PauseGuest(struct Guest *g) {
+  struct Dll *e;
+  if (!g->system) return;
+  LOCK(&g->system->machines_lock);
+  atomic_store_explicit(&g->system->paused, true, memory_order_seq_cst);
+  for (e = dll_first(g->system->machines); e;
+       e = dll_next(g->system->machines, e)) {
+    atomic_store_explicit(&MACHINE_CONTAINER(e)->attention, true,
+                          memory_order_seq_cst);
+  }
+  UNLOCK(&g->system->machines_lock);
+}
+
+// @assume g_guests.lock
+static void ResumeGuest(struct Guest *g) {
+  if (!g->system) return;
+  LOCK(&g->system->machines_lock);
+  atomic_store_explicit(&g->system->paused, false, memory_order_release);
+  unassert(!pthread_cond_broadcast(&g->system->paused_cond));
+  UNLOCK(&g->system->machines_lock);
+}
+
+// @assume g_guests.lock
+static void JoinGuest(struct Guest *g) {
+  if (!g->joined) {
+    UNLOCK(&g_guests.lock);
+    unassert(!pthread_join(g->thread, 0));
+    LOCK(&g_guests.lock);
+    g->joined = true;
+  }
+}
+
+// called by the last thread of a guest, which is never the host's own
+static void ExitGuest(struct Machine *m, int status) {
+  struct Guest *g;
+  LOCK(&g_guests.lock);
+  unassert((g = GetGuest(m->system)));
+  g->system = 0;
+  g->status = g->killed ? SIGKILL_LINUX : status;
+  UNLOCK(&g_guests.lock);
+  FreeMachine(m);
+  LOCK(&g_guests.lock);
+  g->done = true;
+  unassert(!pthread_cond_broadcast(&g_guests.cond));
+  UNLOCK(&g_guests.lock);
+  pthread_exit(0);
+}
+
+static int ExecGuest(char *execfn, char *prog, char **argv, char **envp) {
+  int i;
+  sigset_t oldmask;
+  struct Guest *g;
+  struct Machine *m, *old = g_machine;
+  KillOtherThreads(old->system);
+  unassert((g_machine = m = NewMachine(NewSystem(XED_MACHINE_MODE_LONG), 0)));
+  m->system->exec = ExecGuest;
+  m->system->onexit = ExitGuest;
+#ifdef HAVE_JIT
+  DisableJit(&old->system->jit);  // unmapping exec pages is slow
+  // the old program's files are about to be unmapped
+  FlushCoverage(old->system);
+#endif
+  unassert(!m->sysdepth);
+  unassert(!m->pagelocks.i);
+  unassert(!FreeVirtual(old->system, -0x800000000000, 0x1000000000000));
+  for (i = 1; i <= 64; ++i) {
+    if (Read64(old->system->hands[i - 1].handler) == SIG_IGN_LINUX) {
+      Write64(m->system->hands[i - 1].handler, SIG_IGN_LINUX);
+    }
+  }
+  memcpy(m->system->rlim, old->system->rlim, sizeof(old->system->rlim));
+  LoadProgram(m, execfn, prog, argv, envp, NULL);
+  MoveFds(&m->system->fds, &old->system->fds);
+  memcpy(&oldmask, &old->system->exec_sigmask, sizeof(oldmask));
+  UNLOCK(&old->system->exec_lock);
+  LOCK(&g_guests.lock);
+  unassert((g = GetGuest(old->system)));
+  g->system = m->system;
+  UNLOCK(&g_guests.lock);
+  FreeMachine(old);
+  unassert(!pthread_sigmask(SIG_SETMASK, &oldmask, 0));
+  Blink(m);
+}
+
+static void *OnGuest(void *arg) {
+  sigset_t mask;
+  struct Guest *g = (struct Guest *)arg;
+  struct Machine *m = g->machine;
+  // wait for RunGuest() to finish telling the machine who we are
+  LOCK(&g_guests.lock);
+  UNLOCK(&g_guests.lock);
+#ifdef HAVE_SYS_GETTID
+  m->hosttid = syscall(SYS_gettid);
+#endif
+  sigemptyset(&mask);
+  unassert(!pthread_sigmask(SIG_SETMASK, &mask, 0));
+  g_machine = m;
+  Blink(m);
+}
+
+void TerminateSignal(struct Machine *m, int sig, int code) {
+  int syssig;
+  struct sigaction sa;
+  unassert(!IsSignalIgnoredByDefault(sig));
+  if (IsSignalSerious(sig)) {
+    ERRF("terminating due to %s ("
+         "rip=%#" PRIx64 " "
+         "code=%d "
+         "faultaddr=%#" PRIx64 ")",
+         DescribeSignal(sig), m->ip, code, m->faultaddr);
+  }
+  if (m->system->isfork) {
+    // a fork() child is a host process of its own, so it dies for real
+    if ((syssig = XlatSignal(sig)) == -1) syssig = SIGKILL;
+    sa.sa_flags = 0;
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    if (syssig != SIGKILL && syssig != SIGSTOP) {
+      unassert(!sigaction(syssig, &sa, 0));
+    }
+    unassert(!kill(getpid(), syssig));
+    Abort();
+  }
+  KillOtherThreads(m->system);
+#ifdef HAVE_JIT
+  DisableJit(&m->system->jit);  // unmapping exec pages is slow
+#endif
+  ExitGuest(m, sig & 127);
+}
+
+static void InitGuestsOnce(void) {
+  struct sigaction sa;
+  GetStartDir();
+  WriteErrorInit();
+  InitMap();
+  FLAG_nolinear = true;
+#if LOG_ENABLED
+  LogInit(FLAG_logpath);
+#endif
+#ifndef DISABLE_OVERLAYS
+  if (!FLAG_overlays) FLAG_overlays = DEFAULT_OVERLAYS;
+  if (SetOverlays(FLAG_overlays, true)) {
+    g_guests.rc = -1;
+    return;
+  }
+#endif
+#ifndef DISABLE_VFS
+  if (VfsInit(FLAG_prefix)) {
+    g_guests.rc = -1;
+    return;
+  }
+#endif
+  signal(SIGPIPE, SIG_IGN);
+  sigfillset(&sa.sa_mask);
+  sa.sa_flags = 0;
+  sa.sa_handler = OnSigSys;
+  unassert(!sigaction(SIGSYS, &sa, 0));
+#if !defined(__SANITIZE_THREAD__) && !defined(__SANITIZE_ADDRESS__)
+  sa.sa_sigaction = OnFatalSystemSignal;
+  sa.sa_flags = SA_SIGINFO;
+  unassert(!sigaction(SIGBUS, &sa, 0));
+  unassert(!sigaction(SIGILL, &sa, 0));
+  unassert(!sigaction(SIGTRAP, &sa, 0));
+  unassert(!sigaction(SIGSEGV, &sa, 0));
+#endif
+  InitBus();
+}
+
+/**
+ * Prepares the host process for running guests.
+ *
+ * This must be called once FLAG_* options have their final values and
+ * before any other function here. It takes over the SIGSYS, SIGSEGV,
+ * SIGBUS, SIGILL and SIGTRAP handlers, and ignores SIGPIPE.
+ *
+ * @return 0 on success, or -1 if the file system couldn't be set up
+ */
+int InitGuests(void) {
+  unassert(!pthread_once(&g_guests.once, InitGuestsOnce));
+  return g_guests.rc;
+}
+
+/**
+ * Creates guest, with a System of its own and a main thread.
+ *
+ * @return new guest, or null w/ errno
+ */
+struct Guest *NewGuest(void) {
+  struct Guest *g;
+  struct System *s;
+  if (!(g = (struct Guest *)calloc(1, sizeof(*g)))) return 0;
+  if (!(s = NewSystem(XED_MACHINE_MODE_LONG))) {
+    free(g);
+    return 0;
+  }
+  if (!(g->machine = NewMachine(s, 0))) {
+    FreeSystem(s);
+    free(g);
+    return 0;
+  }
+  s->exec = ExecGuest;
+  s->onexit = ExitGuest;
+  g->system = s;
+  dll_init(&g->elem);
+  LOCK(&g_guests.lock);
+  dll_make_last(&g_guests.list, &g->elem);
+  UNLOCK(&g_guests.lock);
+  return g;
+}
+
+/**
+ * Loads program into guest memory.
+ *
+ * The program is searched for on $PATH if it doesn't have a slash. The
+ * guest gets the host's standard file descriptors as its own.
+ *
+ * @param prog is program to load
+ * @param argv is its arguments, including argv[0]
+ * @param envp is its environment variables
+ * @return 0 on success, or -1 w/ errno
+ */
+int LoadGuest(struct Guest *g, const char *prog, char **argv, char **envp) {
+  int i;
+  char *p, **v;
+  struct Machine *m, *old;
+  if (g->loaded) return einval();
+  if (!Commandv(prog, g->path, sizeof(g->path))) return -1;
+  m = g->machine;
+  old = g_machine;
+  g_machine = m;
+  p = g->path;
+  v = argv;
+  if (!CanEmulateExecutable(m, &p, &v)) {
+    g_machine = old;
+    errno = ENOEXEC;
+    return -1;
+  }
+  LoadProgram(m, g->path, g->path, argv, envp, NULL);
+  for (i = 0; i < 3; ++i) {
+    if (!GetFd(&m->system->fds, i)) {
+      AddStdFd(&m->system->fds, i);
+    }
+  }
+  g_machine = old;
+  g->loaded = true;
+  return 0;
+}
+
+/**
+ * Runs loaded guest until it exits, or its time slice runs out.
+ *
+ * Guests whose time slice ran out are paused, so they don't use any
+ * cpu time, and they're resumed by calling this function once again.
+ *
+ * @param ms is how many milliseconds the guest may run for, before it
+ *     is paused, or zero to let it run for as long as it likes
+ * @return wait() status of guest once it exited, or -1 w/ errno, where
+ *     ETIMEDOUT means the guest was paused
+ */
+int RunGuest(struct Guest *g, long ms) {
+  int rc;
+  struct timespec deadline;
+  if (!g->loaded) return einval();
+  deadline = AddTime(GetTime(), FromMilliseconds(ms));
+  LOCK(&g_guests.lock);
+  if (!g->started) {
+    if ((rc = pthread_create(&g->thread, 0, OnGuest, g))) {
+      UNLOCK(&g_guests.lock);
+      errno = rc;
+      return -1;
+    }
+    g->machine->thread = g->thread;
+    g->started = true;
+  } else {
+    ResumeGuest(g);
+  }
+  while (!g->done) {
+    if (ms > 0) {
+      rc = pthread_cond_timedwait(&g_guests.cond, &g_guests.lock, &deadline);
+      unassert(rc == 0 || rc == ETIMEDOUT);
+      if (rc == ETIMEDOUT && !g->done) {
+        PauseGuest(g);
+        UNLOCK(&g_guests.lock);
+        errno = ETIMEDOUT;
+        return -1;
+      }
+    } else {
+      unassert(!pthread_cond_wait(&g_guests.cond, &g_guests.lock));
+    }
+  }
+  JoinGuest(g);
+  UNLOCK(&g_guests.lock);
+  return g->status;
+}
+
+/**
+ * Frees guest, killing it if it's paused.
+ */
+void FreeGuest(struct Guest *g) {
+  struct timespec deadline;
+  if (g) {
+    LOCK(&g_guests.lock);
+    if (g->started) {
+      g->killed = true;
+      while (!g->done) {
+        // keep trying, since a thread could be spawned or exec'd meanwhile
+        KillGuest(g);
+        deadline = AddTime(GetTime(), FromMilliseconds(kPollingMs));
+        pthread_cond_timedwait(&g_guests.cond, &g_guests.lock, &deadline);
+      }
+      JoinGuest(g);
+    }
+    dll_remove(&g_guests.list, &g->elem);
+    UNLOCK(&g_guests.lock);
+    if (!g->started) {
+      FreeMachine(g->machine);
+    }
+    free(g);
+  }
+}
+
+#endif /* HAVE_THREADS */
@@ -0,0 +1,30 @@
+#ifndef BLINK_LIBBLINK_H_
+#define BLINK_LIBBLINK_H_
+
+// libblink runs x86-64 linux programs inside a host process that links
+// o/$(MODE)/blink/libblink.a, where many guests may be live at a time.
+//
+//     struct Guest *g;
+//     if (InitGuests()) abort();
+//     if (!(g = NewGuest())) abort();
+//     if (LoadGuest(g, "hello", argv, environ)) abort();
+//     while ((ws = RunGuest(g, 10)) == -1 && errno == ETIMEDOUT) {
+//       // guest is paused, so other guests may take their turn
+//     }
+//     FreeGuest(g);  // e.g. WEXITSTATUS(ws) == 0
+//
+// Each guest is a System of its own, whose threads run on host threads
+// libblink creates, so the caller's thread is never taken over. Guests
+// share the jit code heap, the bus, and the FLAG_* options, which must
+// be set before InitGuests(). Linear memory is always turned off since
+// guests would otherwise need the same host addresses.
+
+struct Guest;
+
+int InitGuests(void);
+struct Guest *NewGuest(void);
+int LoadGuest(struct Guest *, const char *, char **, char **);
+int RunGuest(struct Guest *, long);
+void FreeGuest(struct Guest *);
+
+#endif /* BLINK_LIBBLINK_H_ */
@@ -201,6 +201,14 @@
 #define MAP_FIXED_NOREPLACE_LINUX 0x00100000
 #define MAP_UNINITIALIZED_LINUX   0x04000000
 
+#define MADV_NORMAL_LINUX     0
+#define MADV_RANDOM_LINUX     1
+#define MADV_SEQUENTIAL_LINUX 2
+#define MADV_WILLNEED_LINUX   3
+#define MADV_DONTNEED_LINUX   4
+#define MADV_FREE_LINUX       8
+#define MADV_REMOVE_LINUX     9
+
 #define PROT_NONE_LINUX      0
 #define PROT_READ_LINUX      1
 #define PROT_WRITE_LINUX     2
@@ -231,6 +239,10 @@
 
 #define FUTEX_WAIT_LINUX           0
 #define FUTEX_WAKE_LINUX           1
+#define FUTEX_LOCK_PI_LINUX        6
+#define FUTEX_UNLOCK_PI_LINUX      7
+#define FUTEX_TRYLOCK_PI_LINUX     8
+#define FUTEX_LOCK_PI2_LINUX       13
 #define FUTEX_WAIT_BITSET_LINUX    9
 #define FUTEX_PRIVATE_FLAG_LINUX   128
 #define FUTEX_CLOCK_REALTIME_LINUX 256
@@ -324,6 +336,7 @@
 #define AT_RANDOM_LINUX        25
 #define AT_HWCAP2_LINUX        26
 #define AT_EXECFN_LINUX        31
+#define AT_SYSINFO_EHDR_LINUX  33
 #define AT_MINSIGSTKSZ_LINUX   51
 
 #define IFNAMSIZ_LINUX 16
@@ -393,6 +406,7 @@
 #define MSG_CONFIRM_LINUX      0x00000800  // send
 #define MSG_ERRQUEUE_LINUX     0x00002000  // recv
 #define MSG_MORE_LINUX         0x00008000  // send
+#define MSG_ZEROCOPY_LINUX     0x04000000  // send
 
 #define MSG_FASTOPEN_LINUX     0x20000000
 #define MSG_CTRUNC_LINUX       8
@@ -689,6 +703,7 @@
 #define SO_RCVLOWAT_LINUX          18
 #define SO_SNDLOWAT_LINUX          19
 #define SO_BROADCAST_LINUX         6
+#define SO_ZEROCOPY_LINUX          60
 #define IP_TOS_LINUX               1
 #define IP_TTL_LINUX               2
 #define IP_HDRINCL_LINUX           3
@@ -717,6 +732,69 @@
 #define CLOSE_RANGE_UNSHARE_LINUX 2
 #define CLOSE_RANGE_CLOEXEC_LINUX 4
 
+#define SPLICE_F_MOVE_LINUX     1
+#define SPLICE_F_NONBLOCK_LINUX 2
+#define SPLICE_F_MORE_LINUX     4
+#define SPLICE_F_GIFT_LINUX     8
+
+#define IORING_SETUP_IOPOLL_LINUX        0x0001
+#define IORING_SETUP_SQPOLL_LINUX        0x0002
+#define IORING_SETUP_SQ_AFF_LINUX        0x0004
+#define IORING_SETUP_CQSIZE_LINUX        0x0008
+#define IORING_SETUP_CLAMP_LINUX         0x0010
+#define IORING_SETUP_SUBMIT_ALL_LINUX    0x0080
+#define IORING_SETUP_COOP_TASKRUN_LINUX  0x0100
+#define IORING_SETUP_SINGLE_ISSUER_LINUX 0x1000
+
+#define IORING_FEAT_NODROP_LINUX        0x0002
+#define IORING_FEAT_SUBMIT_STABLE_LINUX 0x0004
+#define IORING_FEAT_RW_CUR_POS_LINUX    0x0008
+#define IORING_FEAT_POLL_32BITS_LINUX   0x0040
+#define IORING_FEAT_EXT_ARG_LINUX       0x0100
+
+#define IORING_ENTER_GETEVENTS_LINUX 1
+#define IORING_ENTER_SQ_WAKEUP_LINUX 2
+#define IORING_ENTER_SQ_WAIT_LINUX   4
+#define IORING_ENTER_EXT_ARG_LINUX   8
+
+#define IORING_OFF_SQ_RING_LINUX 0x00000000
+#define IORING_OFF_CQ_RING_LINUX 0x08000000
+#define IORING_OFF_SQES_LINUX    0x10000000
+
+#define IOSQE_FIXED_FILE_LINUX       0x01
+#define IOSQE_IO_DRAIN_LINUX         0x02
+#define IOSQE_IO_LINK_LINUX          0x04
+#define IOSQE_IO_HARDLINK_LINUX      0x08
+#define IOSQE_ASYNC_LINUX            0x10
+#define IOSQE_BUFFER_SELECT_LINUX    0x20
+#define IOSQE_CQE_SKIP_SUCCESS_LINUX 0x40
+
+#define IORING_OP_NOP_LINUX            0
+#define IORING_OP_READV_LINUX          1
+#define IORING_OP_WRITEV_LINUX         2
+#define IORING_OP_FSYNC_LINUX          3
+#define IORING_OP_POLL_ADD_LINUX       6
+#define IORING_OP_POLL_REMOVE_LINUX    7
+#define IORING_OP_SENDMSG_LINUX        9
+#define IORING_OP_RECVMSG_LINUX        10
+#define IORING_OP_TIMEOUT_LINUX        11
+#define IORING_OP_TIMEOUT_REMOVE_LINUX 12
+#define IORING_OP_ACCEPT_LINUX         13
+#define IORING_OP_ASYNC_CANCEL_LINUX   14
+#define IORING_OP_CONNECT_LINUX        16
+#define IORING_OP_CLOSE_LINUX          19
+#define IORING_OP_READ_LINUX           22
+#define IORING_OP_WRITE_LINUX          23
+#define IORING_OP_SEND_LINUX           26
+#define IORING_OP_RECV_LINUX           27
+#define IORING_OP_LAST_LINUX           27
+
+#define IORING_FSYNC_DATASYNC_LINUX 1
+#define IORING_TIMEOUT_ABS_LINUX    1
+
+#define IORING_REGISTER_PROBE_LINUX 8
+#define IO_URING_OP_SUPPORTED_LINUX 1
+
 #define SOCK_STREAM_LINUX 1
 #define SOCK_DGRAM_LINUX  2
 #define SOCK_RAW_LINUX    3
@@ -731,11 +809,23 @@
 #define __WNOTHREAD_LINUX 0x20000000
 #define __WALL_LINUX      0x40000000
 #define __WCLONE_LINUX    0x80000000
+#define WSTOPPED_LINUX    WUNTRACED_LINUX
+
+#define P_ALL_LINUX   0
+#define P_PID_LINUX   1
+#define P_PGID_LINUX  2
+#define P_PIDFD_LINUX 3
+
+#define PIDFD_NONBLOCK_LINUX O_NDELAY_LINUX
 
 #define MS_SYNC_LINUX       4
 #define MS_ASYNC_LINUX      1
 #define MS_INVALIDATE_LINUX 2
 
+#define MREMAP_MAYMOVE_LINUX   1
+#define MREMAP_FIXED_LINUX     2
+#define MREMAP_DONTUNMAP_LINUX 4
+
 #define LOCK_SH_LINUX 1
 #define LOCK_EX_LINUX 2
 #define LOCK_NB_LINUX 4
@@ -838,6 +928,18 @@
 
 #define EPOLL_CLOEXEC_LINUX O_CLOEXEC_LINUX
 
+#define EFD_SEMAPHORE_LINUX 1
+#define EFD_CLOEXEC_LINUX   O_CLOEXEC_LINUX
+#define EFD_NONBLOCK_LINUX  O_NDELAY_LINUX
+
+#define TFD_CLOEXEC_LINUX             O_CLOEXEC_LINUX
+#define TFD_NONBLOCK_LINUX            O_NDELAY_LINUX
+#define TFD_TIMER_ABSTIME_LINUX       1
+#define TFD_TIMER_CANCEL_ON_SET_LINUX 2
+
+#define SFD_CLOEXEC_LINUX  O_CLOEXEC_LINUX
+#define SFD_NONBLOCK_LINUX O_NDELAY_LINUX
+
 #define EPOLL_CTL_ADD_LINUX 1
 #define EPOLL_CTL_DEL_LINUX 2
 #define EPOLL_CTL_MOD_LINUX 3
@@ -992,6 +1094,32 @@ struct itimerval_linux {
   struct timeval_linux value;
 };
 
+struct itimerspec_linux {
+  struct timespec_linux interval;
+  struct timespec_linux value;
+};
+
+struct signalfd_siginfo_linux {
+  u8 signo[4];
+  u8 errno_[4];
+  u8 code[4];
+  u8 pid[4];
+  u8 uid[4];
+  u8 fd[4];
+  u8 tid[4];
+  u8 band[4];
+  u8 overrun[4];
+  u8 trapno[4];
+  u8 status[4];
+  u8 int_[4];
+  u8 ptr[8];
+  u8 utime[8];
+  u8 stime[8];
+  u8 addr[8];
+  u8 addr_lsb[2];
+  u8 pad_[46];
+};
+
 struct rusage_linux {
   struct timeval_linux utime;
   struct timeval_linux stime;
@@ -1278,6 +1406,87 @@ struct epoll_event_linux {
   u8 data[8];
 };
 
+struct io_sqring_offsets_linux {
+  u8 head[4];
+  u8 tail[4];
+  u8 ring_mask[4];
+  u8 ring_entries[4];
+  u8 flags[4];
+  u8 dropped[4];
+  u8 array[4];
+  u8 resv1[4];
+  u8 user_addr[8];
+};
+
+struct io_cqring_offsets_linux {
+  u8 head[4];
+  u8 tail[4];
+  u8 ring_mask[4];
+  u8 ring_entries[4];
+  u8 overflow[4];
+  u8 cqes[4];
+  u8 flags[4];
+  u8 resv1[4];
+  u8 user_addr[8];
+};
+
+struct io_uring_params_linux {
+  u8 sq_entries[4];
+  u8 cq_entries[4];
+  u8 flags[4];
+  u8 sq_thread_cpu[4];
+  u8 sq_thread_idle[4];
+  u8 features[4];
+  u8 wq_fd[4];
+  u8 resv[3][4];
+  struct io_sqring_offsets_linux sq_off;
+  struct io_cqring_offsets_linux cq_off;
+};
+
+struct io_uring_sqe_linux {
+  u8 opcode;          // IORING_OP_XXX
+  u8 flags;           // IOSQE_XXX
+  u8 ioprio[2];       // u16
+  u8 fd[4];           // i32
+  u8 off[8];          // u64 file offset or addr2
+  u8 addr[8];         // u64 buffer, iovec, or sockaddr pointer
+  u8 len[4];          // u32 buffer size or iovec count
+  u8 op_flags[4];     // rw_flags, poll32_events, msg_flags, etc.
+  u8 user_data[8];    // u64 passed back in cqe
+  u8 buf_index[2];    // u16
+  u8 personality[2];  // u16
+  u8 file_index[4];   // i32
+  u8 addr3[8];
+  u8 pad[8];
+};
+
+struct io_uring_cqe_linux {
+  u8 user_data[8];  // u64 copied from sqe
+  u8 res[4];        // i32 result or negative linux errno
+  u8 flags[4];      // u32
+};
+
+struct io_uring_getevents_arg_linux {
+  u8 sigmask[8];
+  u8 sigmask_sz[4];
+  u8 pad[4];
+  u8 ts[8];
+};
+
+struct io_uring_probe_op_linux {
+  u8 op;
+  u8 resv;
+  u8 flags[2];
+  u8 resv2[4];
+};
+
+struct io_uring_probe_linux {
+  u8 last_op;
+  u8 ops_len;
+  u8 resv[2];
+  u8 resv2[3][4];
+};
+
 int sysinfo_linux(struct sysinfo_linux *);
 
 #endif /* BLINK_LINUX_H_ */
@@ -42,6 +42,7 @@
 #include "blink/overlays.h"
 #include "blink/procfs.h"
 #include "blink/random.h"
+#include "blink/stats.h"
 #include "blink/tunables.h"
 #include "blink/util.h"
 #include "blink/vfs.h"
@@ -52,6 +53,48 @@
 
 static bool CanEmulateImpl(struct Machine *, char **, char ***, bool);
 
+// execve() happens in-process, so this table of executables that have
+// already been vetted by CanEmulateImpl() outlives each program and is
+// inherited by its forked children, which lets the common case of one
+// program being run again and again skip mapping and parsing it twice;
+// actually portable executables also keep the elf header that had to
+// be decoded from their printf statement, so it's only decoded once
+static struct ExecCache {
+  struct ExecCacheEntry {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    time_t ctime;
+    bool isape;
+    char ehdr[64];
+  } entry[kExecCacheSize];
+} g_execcache;
+
+static struct ExecCacheEntry *GetExecCacheEntry(const struct stat *st) {
+  return g_execcache.entry + ((u64)st->st_ino * 0x9e3779b97f4a7c15 >> 32) %
+                                 kExecCacheSize;
+}
+
+static bool IsVettedExecutable(const struct stat *st) {
+  struct ExecCacheEntry *e = GetExecCacheEntry(st);
+  return e->ino == st->st_ino &&      //
+         e->dev == st->st_dev &&      //
+         e->size == st->st_size &&    //
+         e->mtime == st->st_mtime &&  //
+         e->ctime == st->st_ctime;
+}
+
+static void AddVettedExecutable(const struct stat *st) {
+  struct ExecCacheEntry *e = GetExecCacheEntry(st);
+  e->dev = st->st_dev;
+  e->ino = st->st_ino;
+  e->size = st->st_size;
+  e->mtime = st->st_mtime;
+  e->ctime = st->st_ctime;
+  e->isape = false;
+}
+
 static void LoaderCopy(struct Machine *m, i64 vaddr, size_t amt, void *image,
                        i64 offset, int prot) {
   i64 base;
@@ -73,6 +116,23 @@ static void LoaderCopy(struct Machine *m, i64 vaddr, size_t amt, void *image,
   }
 }
 
+// returns true if file bytes [off,off+len) would already read as zero
+// once mapped, which is always the case past the end of the file. for
+// the common case where the page tail is the section padding the link
+// editor inserted, this saves us from dirtying a private copy of what
+// would otherwise stay a clean page shared with the host page cache.
+static bool IsFileZeroed(const void *image, size_t imagesize, i64 off,
+                         size_t len) {
+  size_t i;
+  const u8 *p = (const u8 *)image;
+  for (i = 0; i < len && off + i < imagesize; ++i) {
+    if (p[off + i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
 static i64 LoadElfLoadSegment(struct Machine *m, const char *path, void *image,
                               size_t imagesize, const Elf64_Phdr_ *phdr,
                               i64 last_end, int *last_prot, u64 aslr, int fd) {
@@ -208,7 +268,8 @@ static i64 LoadElfLoadSegment(struct Machine *m, const char *path, void *image,
         ERRF("failed to map elf program header file data");
         exit(127);
       }
-      if ((amt = bulk - filesz)) {
+      if ((amt = bulk - filesz) &&
+          !IsFileZeroed(image, imagesize, offset + filesz, amt)) {
         ELF_LOGF("note: next copy is actually bzero() kludge");
         unassert(blank = calloc(1, amt));
         LoaderCopy(m, start + filesz, amt, blank, 0, prot);
@@ -292,6 +353,11 @@ static bool IsShebangExecutable(void *image, size_t size) {
   return size >= 2 && ((char *)image)[0] == '#' && ((char *)image)[1] == '!';
 }
 
+static bool IsApeExecutable(const void *image, size_t size) {
+  return size >= 4096 && (READ64(image) == READ64("MZqFpD='") ||
+                          READ64(image) == READ64("jartsr='"));
+}
+
 static void ExplainWhyItCantBeEmulated(const char *path, const char *reason) {
   LOGF("%s: can't emulate: %s", path, reason);
 }
@@ -342,8 +408,7 @@ bool IsSupportedExecutable(const char *path, void *image, size_t size) {
 #endif
     return true;
   }
-  if (size >= 4096 && (READ64(image) == READ64("MZqFpD='") ||
-                       READ64(image) == READ64("jartsr='"))) {
+  if (IsApeExecutable(image, size)) {
     return true;
   }
   if (!IsShebangExecutable(image, size)) {
@@ -390,6 +455,34 @@ static i64 ChooseAslr(const Elf64_Ehdr_ *ehdr, size_t size, i64 dflt,
   return aslr;
 }
 
+// asks the host to start reading the file data of the program headers
+// into its page cache, so the disk i/o overlaps with mapping them, and
+// the image isn't later faulted in from slow storage a page at a time
+static void PrefetchElfSegments(const char *path, Elf64_Ehdr_ *ehdr,
+                                size_t esize) {
+#ifdef MADV_WILLNEED
+  int i;
+  i64 offset, filesz;
+  uintptr_t a, b;
+  Elf64_Phdr_ *phdr;
+  for (i = 0; i < Read16(ehdr->phnum); ++i) {
+    phdr = GetElfSegmentHeaderAddress(ehdr, esize, i);
+    if (Read32(phdr->type) != PT_LOAD_) continue;
+    offset = Read64(phdr->offset);
+    filesz = Read64(phdr->filesz);
+    if (offset < 0 || filesz <= 0 || offset >= esize) continue;
+    filesz = MIN(filesz, esize - offset);
+    a = ROUNDDOWN((uintptr_t)ehdr + offset, FLAG_pagesize);
+    b = (uintptr_t)ehdr + offset + filesz;
+    if (madvise((void *)a, b - a, MADV_WILLNEED)) {
+      ELF_LOGF("madvise(%s, %#" PRIx64 ", %#" PRIx64
+               ", MADV_WILLNEED) failed: %s",
+               path, offset, filesz, DescribeHostErrno(errno));
+    }
+  }
+#endif
+}
+
 static bool LoadElf(struct Machine *m,  //
                     struct Elf *elf,    //
                     Elf64_Ehdr_ *ehdr,  //
@@ -399,6 +492,7 @@ static bool LoadElf(struct Machine *m,  //
   Elf64_Phdr_ *phdr;
   i64 end = INT64_MIN;
   bool execstack = true;
+  PrefetchElfSegments(elf->execfn, ehdr, esize);
   elf->aslr = ChooseAslr(ehdr, esize, m->system->brk, &elf->base);
   m->ip = elf->at_entry = elf->aslr + Read64(ehdr->entry);
   m->cs.sel = USER_CS_LINUX;
@@ -452,6 +546,7 @@ static bool LoadElf(struct Machine *m,  //
       WriteErrorString(")\n");
       exit(127);
     }
+    PrefetchElfSegments(elf->interpreter, ehdri, st.st_size);
     aslr = ChooseAslr(
         ehdri, st.st_size,
         elf->aslr ? elf->aslr - (16 * 1024 * 1024) : FLAG_dyninterpaddr,
@@ -545,6 +640,22 @@ static int GetElfHeader(char ehdr[64], const char *prog, const char *image) {
   return -1;
 }
 
+static int GetApeElfHeader(char ehdr[64], const char *prog, const char *image,
+                           const struct stat *st) {
+  struct ExecCacheEntry *e;
+  e = GetExecCacheEntry(st);
+  if (IsVettedExecutable(st) && e->isape) {
+    STATISTIC(++exec_cache_hits);
+    memcpy(ehdr, e->ehdr, 64);
+    return 0;
+  }
+  if (GetElfHeader(ehdr, prog, image) == -1) return -1;
+  AddVettedExecutable(st);
+  memcpy(e->ehdr, ehdr, 64);
+  e->isape = true;
+  return 0;
+}
+
 static void FreeProgName(void) {
   free(g_progname);
 }
@@ -748,7 +859,13 @@ error: unsupported executable; we need:\n\
   m->system->codestart = 0;
   m->system->brk = FLAG_imagestart;
   m->system->automap = FLAG_automapstart;
-  if (HasLinearMapping()) {
+  // jit code cache is only useful if executable addresses are the same
+  // each time the program runs, since they are embedded in native code
+  if (HasLinearMapping()
+#ifndef DISABLE_JIT
+      && !FLAG_jitcache
+#endif
+  ) {
     m->system->brk ^= Read64(elf->rng) & FLAG_aslrmask;
     m->system->automap ^= (Read64(elf->rng) & FLAG_aslrmask);
   }
@@ -772,18 +889,20 @@ error: unsupported executable; we need:\n\
       execstack = true;
     } else if (READ32(map) == READ32("\177ELF")) {
       execstack = LoadElf(m, elf, (Elf64_Ehdr_ *)map, mapsize, fd);
-    } else if (READ64(map) == READ64("MZqFpD='") ||
-               READ64(map) == READ64("jartsr='")) {
+    } else if (IsApeExecutable(map, mapsize)) {
       m->system->iscosmo = true;
-      if (GetElfHeader(tmp, prog, (const char *)map) == -1) exit(127);
+      if (GetApeElfHeader(tmp, prog, (const char *)map, &st) == -1) {
+        exit(127);
+      }
       memcpy(map, tmp, 64);
       execstack = LoadElf(m, elf, (Elf64_Ehdr_ *)map, mapsize, fd);
     } else {
       unassert(!"impossible condition");
     }
-    stack = HasLinearMapping() && FLAG_vabits <= 47 && !kSkew
+    stack = HasLinearMapping() && FLAG_vabits <= 47 && !kSkew &&
+                    !HasShadowMapping()
                 ? 0
-                : kStackTop - kStackSize;
+                : FLAG_stacktop - kStackSize;
     if ((stack = ReserveVirtual(
              m->system, stack, kStackSize,
              PAGE_FILE | PAGE_U | PAGE_RW | (execstack ? 0 : PAGE_XD), -1, 0, 0,
@@ -795,6 +914,7 @@ error: unsupported executable; we need:\n\
       exit(127);
     }
     m->system->loaded = true;  // in case rwx stack is smc write-protected :'(
+    LoadVdso(m);
     LoadArgv(m, execfn, prog, args, vars, elf->rng);
   }
   pagesize = FLAG_pagesize;
@@ -818,6 +938,7 @@ static bool CanEmulateImpl(struct Machine *m, char **prog, char ***argv,
   int fd;
   bool res;
   void *img;
+  char ehdr[64];
   struct stat st;
   if ((fd = VfsOpen(AT_FDCWD, *prog, O_RDONLY | O_CLOEXEC, 0)) == -1) {
   CantEmulate:
@@ -829,10 +950,32 @@ static bool CanEmulateImpl(struct Machine *m, char **prog, char ***argv,
     VfsClose(fd);
     return false;
   }
+  if (IsVettedExecutable(&st)) {
+    STATISTIC(++exec_cache_hits);
+    VfsClose(fd);
+    return true;
+  }
   img = VfsMmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
   VfsClose(fd);
   if (img == MAP_FAILED) goto CantEmulate;
-  res = !!CanEmulateData(m, prog, argv, isfirst, (char *)img, st.st_size);
+  switch (CanEmulateData(m, prog, argv, isfirst, (char *)img, st.st_size)) {
+    case 1:
+      // decoding the ape header now means execve() fails with ENOEXEC
+      // rather than the program dying once its old image is destroyed
+      if (!IsBinFile(*prog) && IsApeExecutable(img, st.st_size)) {
+        res = GetApeElfHeader(ehdr, *prog, (const char *)img, &st) != -1;
+      } else {
+        AddVettedExecutable(&st);
+        res = true;
+      }
+      break;
+    case 2:
+      res = true;
+      break;
+    default:
+      res = false;
+      break;
+  }
   unassert(!VfsMunmap(img, st.st_size));
   return res;
 }
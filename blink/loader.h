@@ -8,6 +8,7 @@ void BootProgram(struct Machine *, struct Elf *, u8);
 void LoadProgram(struct Machine *, char *, char *, char **, char **,
                  const char *);
 void LoadDebugSymbols(struct System *);
+void LoadVdso(struct Machine *);
 void LoadFileSymbols(struct System *, const char *, i64);
 bool IsSupportedExecutable(const char *, void *, size_t);
 
@@ -29,14 +29,34 @@
 #include <unistd.h>
 
 #include "blink/assert.h"
+#include "blink/atomic.h"
 #include "blink/fspath.h"
 #include "blink/machine.h"
 #include "blink/macros.h"
 #include "blink/thread.h"
+#include "blink/timespec.h"
 #include "blink/tsan.h"
+#include "blink/tunables.h"
 #include "blink/types.h"
 #include "blink/util.h"
 
+/**
+ * @fileoverview Logging.
+ *
+ * When the log is a file, rather than standard error or output, then
+ * records other than errors are put in a ring that belongs to the host
+ * thread which logged them, and a writer thread drains them to disk in
+ * kLogMs intervals, so guest threads that log, e.g. the -s flag, don't
+ * have to wait on the file system. Rings have one producer and one
+ * consumer, so no locks are taken, except the first time a thread logs
+ * something. A ring that becomes half full wakes the writer early, and
+ * if it fills up anyway then records are dropped, and the count of them
+ * is logged instead. Errors are written right away, after the records
+ * that are in the rings, as are any records that remain when we exit.
+ * The order in which records of different threads are written may not
+ * match their timestamps.
+ */
+
 #define LOG_ERR  0
 #define LOG_INFO 1
 
@@ -44,16 +64,40 @@
 
 #define APPEND(F, ...) n += F(b + n, PIPE_BUF - n, __VA_ARGS__)
 
+struct LogRing {
+  _Atomic(u32) head;      // next byte the owning thread will write
+  _Atomic(u32) tail;      // next byte the writer thread will drain
+  _Atomic(u32) lost;      // records dropped since the last drain
+  _Atomic(i32) tid;       // guest thread that last used the ring
+  _Atomic(bool) dead;     // thread is gone, so free once drained
+  _Atomic(bool) busy;     // owner is appending, unless a signal came
+  struct LogRing *next;   // guarded by g_log.lock
+  char buf[kLogBytes];
+};
+
 static struct Log {
   pthread_once_t_ once;
   int level;
   int fd;
+  bool async;               // records besides errors go through rings
   char *path;
+  struct LogRing *rings;    // rings of every thread that has logged
+  pthread_cond_t_ filling;  // some ring is half full
+  pthread_mutex_t_ lock;    // guards rings and the writing of the file
+#ifdef HAVE_THREADS
+  pthread_key_t key;        // marks a thread's ring dead when it exits
+#endif
 } g_log = {
-    PTHREAD_ONCE_INIT_,
-    LOG_ERR,
+    .once = PTHREAD_ONCE_INIT_,
+    .level = LOG_ERR,
+    .filling = PTHREAD_COND_INITIALIZER_,
+    .lock = PTHREAD_MUTEX_INITIALIZER_,
 };
 
+#ifdef HAVE_THREADS
+static _Thread_local struct LogRing *g_logring;
+#endif
+
 static char *GetTimestamp(void) {
   int x;
   struct timespec ts;
@@ -61,7 +105,12 @@ static char *GetTimestamp(void) {
   _Thread_local static char s[27];
   _Thread_local static struct tm tm;
   IGNORE_RACES_START();
+#ifdef CLOCK_REALTIME_COARSE
+  // reading the clock shouldn't be most of what it costs to log
+  clock_gettime(g_log.async ? CLOCK_REALTIME_COARSE : CLOCK_REALTIME, &ts);
+#else
   clock_gettime(CLOCK_REALTIME, &ts);
+#endif
   if (ts.tv_sec != last) {
     localtime_r(&ts.tv_sec, &tm);
     x = tm.tm_year + 1900;
@@ -104,6 +153,142 @@ static char *GetTimestamp(void) {
   return s;
 }
 
+#ifdef HAVE_THREADS
+
+// @assume g_log.lock
+static void WriteLogRing(struct LogRing *r, u32 tail, u32 head) {
+  u32 i, n;
+  for (; tail != head; tail += n) {
+    i = tail & (kLogBytes - 1);
+    n = MIN(head - tail, kLogBytes - i);
+    WriteError(g_log.fd, r->buf + i, n);
+  }
+}
+
+// returns the most bytes any one ring had in it
+// @assume g_log.lock
+static u32 DrainLog(void) {
+  int n;
+  bool dead;
+  char b[128];
+  u32 head, tail, lost, most = 0;
+  struct LogRing *r, **rp;
+  for (rp = &g_log.rings; (r = *rp);) {
+    // reading dead before head ensures a dead ring's last records are
+    // drained, since the thread had published them before it had died
+    dead = atomic_load_explicit(&r->dead, memory_order_acquire);
+    head = atomic_load_explicit(&r->head, memory_order_acquire);
+    tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    most = MAX(most, head - tail);
+    WriteLogRing(r, tail, head);
+    atomic_store_explicit(&r->tail, head, memory_order_release);
+    if ((lost = atomic_exchange_explicit(&r->lost, 0, memory_order_relaxed))) {
+      n = snprintf(b, sizeof(b), "E%s:%s:%d:%d %u log records were dropped\n",
+                   GetTimestamp(), __FILE__, __LINE__,
+                   atomic_load_explicit(&r->tid, memory_order_relaxed), lost);
+      WriteError(g_log.fd, b, MIN(n, sizeof(b) - 1));
+    }
+    if (dead) {
+      *rp = r->next;
+      free(r);
+    } else {
+      rp = &r->next;
+    }
+  }
+  return most;
+}
+
+static void *LogWorker(void *arg) {
+  struct timespec deadline;
+  LOCK(&g_log.lock);
+  for (;;) {
+    // wakeups could be missed while we're draining, so go again right
+    // away if a ring was busy enough that it might have wanted one
+    if (DrainLog() < kLogBytes / 4) {
+      deadline = AddTime(GetTime(), FromMilliseconds(kLogMs));
+      pthread_cond_timedwait(&g_log.filling, &g_log.lock, &deadline);
+    }
+  }
+  UNLOCK(&g_log.lock);
+  return 0;
+}
+
+static bool SpawnLogWorker(void) {
+  pthread_t th;
+  sigset_t ss, oldss;
+  bool ok;
+  sigfillset(&ss);
+  unassert(!pthread_sigmask(SIG_SETMASK, &ss, &oldss));
+  ok = !pthread_create(&th, 0, LogWorker, 0);
+  unassert(!pthread_sigmask(SIG_SETMASK, &oldss, 0));
+  if (ok) unassert(!pthread_detach(th));
+  return ok;
+}
+
+static void ForgetLogRing(void *arg) {
+  struct LogRing *r = (struct LogRing *)arg;
+  atomic_store_explicit(&r->dead, true, memory_order_release);
+  g_logring = 0;
+}
+
+static struct LogRing *NewLogRing(void) {
+  struct LogRing *r;
+  if (!(r = (struct LogRing *)calloc(1, sizeof(*r)))) return 0;
+  LOCK(&g_log.lock);
+  r->next = g_log.rings;
+  g_log.rings = r;
+  UNLOCK(&g_log.lock);
+  unassert(!pthread_setspecific(g_log.key, r));
+  return r;
+}
+
+// puts record in the calling thread's ring, if it can be done safely
+static bool PushLog(const char *b, u32 n) {
+  u32 i, k, head, used;
+  struct LogRing *r;
+  if (!g_log.async) return false;
+  if (!(r = g_logring) && !(r = g_logring = NewLogRing())) return false;
+  // a signal handler could be logging while we're in the middle of it
+  if (atomic_exchange_explicit(&r->busy, true, memory_order_relaxed)) {
+    return false;
+  }
+  atomic_signal_fence(memory_order_seq_cst);
+  atomic_store_explicit(&r->tid, g_machine ? g_machine->tid : 0,
+                        memory_order_relaxed);
+  head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  used = head - atomic_load_explicit(&r->tail, memory_order_acquire);
+  if (kLogBytes - used < n) {
+    atomic_fetch_add_explicit(&r->lost, 1, memory_order_relaxed);
+  } else {
+    if (used < kLogBytes / 2 && used + n >= kLogBytes / 2) {
+      pthread_cond_signal(&g_log.filling);
+    }
+    i = head & (kLogBytes - 1);
+    k = MIN(n, kLogBytes - i);
+    memcpy(r->buf + i, b, k);
+    memcpy(r->buf, b + k, n - k);
+    atomic_store_explicit(&r->head, head + n, memory_order_release);
+  }
+  atomic_signal_fence(memory_order_seq_cst);
+  atomic_store_explicit(&r->busy, false, memory_order_relaxed);
+  return true;
+}
+
+static void StartLogWorker(void) {
+  if (pthread_key_create(&g_log.key, ForgetLogRing)) return;
+  if (!SpawnLogWorker()) return;
+  g_log.async = true;
+  atexit(FlushLog);
+}
+
+#else
+
+static bool PushLog(const char *b, u32 n) {
+  return false;
+}
+
+#endif /* HAVE_THREADS */
+
 static void OpenLog(void) {
   int fd;
   if (!g_log.path) return;
@@ -122,6 +307,25 @@ static void OpenLog(void) {
   }
   unassert((g_log.fd = fcntl(fd, F_DUPFD_CLOEXEC, kMinBlinkFd)) != -1);
   unassert(!close(fd));
+#ifdef HAVE_THREADS
+  // standard error and output are shared with the guest so their order
+  // relative to what the guest writes has to be kept
+  if (fd > 2) StartLogWorker();
+#endif
+}
+
+// writes record to log file, after the records rings are still holding
+static void WriteLog(const char *b, int n) {
+#ifdef HAVE_THREADS
+  if (g_log.async) {
+    LOCK(&g_log.lock);
+    DrainLog();
+    WriteError(g_log.fd, b, n);
+    UNLOCK(&g_log.lock);
+    return;
+  }
+#endif
+  WriteError(g_log.fd, b, n);
 }
 
 static void Log(const char *file, int line, const char *fmt, va_list va,
@@ -141,8 +345,8 @@ static void Log(const char *file, int line, const char *fmt, va_list va,
     b[--n] = '.';
     b[--n] = '.';
   }
-  if (g_log.fd != -1) {
-    WriteError(g_log.fd, b, n);
+  if (g_log.fd != -1 && (level == LOG_ERR || !PushLog(b, n))) {
+    WriteLog(b, n);
   }
   if (FLAG_alsologtostderr || (!FLAG_nologstderr && level <= g_log.level)) {
     WriteError(2, b, n);
@@ -171,6 +375,48 @@ void LogSys(const char *file, int line, const char *fmt, ...) {
   va_end(va);
 }
 
+// writes records that are still in rings, e.g. because we're exiting
+void FlushLog(void) {
+#ifdef HAVE_THREADS
+  if (!g_log.async) return;
+  LOCK(&g_log.lock);
+  DrainLog();
+  UNLOCK(&g_log.lock);
+#endif
+}
+
+// locks the log writer before fork()
+void LockLog(void) {
+  LOCK(&g_log.lock);
+}
+
+// unlocks the log writer in the parent after fork()
+void UnlockLog(void) {
+  UNLOCK(&g_log.lock);
+}
+
+// resets the log writer in the child after fork()
+// records already in rings are the parent's to write
+void ResetLog(void) {
+#ifdef HAVE_THREADS
+  struct LogRing *r;
+  for (r = g_log.rings; r; r = r->next) {
+    atomic_store_explicit(&r->tail,
+                          atomic_load_explicit(&r->head, memory_order_relaxed),
+                          memory_order_relaxed);
+    atomic_store_explicit(&r->lost, 0, memory_order_relaxed);
+    if (r != g_logring) {
+      atomic_store_explicit(&r->dead, true, memory_order_relaxed);
+    }
+  }
+  unassert(!pthread_mutex_init(&g_log.lock, 0));
+  unassert(!pthread_cond_init(&g_log.filling, 0));
+  if (g_log.async && !SpawnLogWorker()) {
+    g_log.async = false;
+  }
+#endif
+}
+
 static void FreeLogPath(void) {
   free(g_log.path);
   g_log.path = 0;
@@ -122,6 +122,10 @@ void LogInit(const char *);
 void LogSys(const char *, int, const char *, ...) printf_attr(3);
 void LogErr(const char *, int, const char *, ...) printf_attr(3);
 void LogInfo(const char *, int, const char *, ...) printf_attr(3);
+void FlushLog(void);
+void LockLog(void);
+void UnlockLog(void);
+void ResetLog(void);
 int WriteError(int, const char *, int);
 void WriteErrorInit(void);
 int WriteErrorString(const char *);
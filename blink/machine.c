@@ -19,6 +19,7 @@
 #include "blink/machine.h"
 
 #include <errno.h>
+#include <fenv.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,6 +28,7 @@
 #include "blink/alu.h"
 #include "blink/assert.h"
 #include "blink/atomic.h"
+#include "blink/avx.h"
 #include "blink/biosrom.h"
 #include "blink/bitscan.h"
 #include "blink/builtin.h"
@@ -37,12 +39,15 @@
 #include "blink/flag.h"
 #include "blink/flags.h"
 #include "blink/fpu.h"
+#include "blink/intrin.h"
 #include "blink/jit.h"
+#include "blink/ldbl.h"
 #include "blink/likely.h"
 #include "blink/log.h"
 #include "blink/macros.h"
 #include "blink/map.h"
 #include "blink/modrm.h"
+#include "blink/native.h"
 #include "blink/random.h"
 #include "blink/signal.h"
 #include "blink/sse.h"
@@ -241,6 +246,25 @@ static void OpCmpxchg8b(P) {
   uint8_t *p;
   uint32_t d, a;
   p = GetModrmRegisterXmmPointerRead8(A);
+#if CAN_64BIT
+  if (Lock(rde) && !((uintptr_t)p & 7)) {
+    uint64_t x, y;
+    memcpy((u8 *)&x + 0, m->ax, 4);
+    memcpy((u8 *)&x + 4, m->dx, 4);
+    memcpy((u8 *)&y + 0, m->bx, 4);
+    memcpy((u8 *)&y + 4, m->cx, 4);
+    if (atomic_compare_exchange_strong_explicit(
+            (_Atomic(uint64_t) *)p, &x, y, memory_order_acq_rel,
+            memory_order_acquire)) {
+      m->flags = SetFlag(m->flags, FLAGS_ZF, true);
+    } else {
+      m->flags = SetFlag(m->flags, FLAGS_ZF, false);
+      Write32(m->ax, Read32((u8 *)&x + 0));
+      Write32(m->dx, Read32((u8 *)&x + 4));
+    }
+    return;
+  }
+#endif
   if (Lock(rde)) LockBus(p);
   a = Read32(p + 0);
   d = Read32(p + 4);
@@ -260,6 +284,24 @@ static void OpCmpxchg16b(P) {
   uint8_t *p;
   uint64_t d, a;
   p = GetModrmRegisterXmmPointerRead16(A);
+#if defined(__SIZEOF_INT128__) && defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16)
+  if (Lock(rde) && !((uintptr_t)p & 15)) {
+    unsigned __int128 x, y, z;
+    memcpy((u8 *)&x + 0, m->ax, 8);
+    memcpy((u8 *)&x + 8, m->dx, 8);
+    memcpy((u8 *)&y + 0, m->bx, 8);
+    memcpy((u8 *)&y + 8, m->cx, 8);
+    z = __sync_val_compare_and_swap((unsigned __int128 *)p, x, y);
+    if (z == x) {
+      m->flags = SetFlag(m->flags, FLAGS_ZF, true);
+    } else {
+      m->flags = SetFlag(m->flags, FLAGS_ZF, false);
+      Write64(m->ax, Read64((u8 *)&z + 0));
+      Write64(m->dx, Read64((u8 *)&z + 8));
+    }
+    return;
+  }
+#endif
   if (Lock(rde)) LockBus(p);
   a = Read64(p + 0);
   d = Read64(p + 8);
@@ -275,6 +317,8 @@ static void OpCmpxchg16b(P) {
   if (Lock(rde)) UnlockBus(p);
 }
 
+static void OpXsavec(P);
+
 static void Op1c7(P) {
   bool ismem;
   ismem = !IsModrmRegister(rde);
@@ -290,6 +334,13 @@ static void Op1c7(P) {
         OpUdImpl(m);
       }
       break;
+    case 4:
+      if (ismem) {
+        OpXsavec(A);
+      } else {
+        OpUdImpl(m);
+      }
+      break;
     case 6:
       if (!ismem) {
         OpRdrand(A);
@@ -343,13 +394,13 @@ static void OpBswapZvqp(P) {
 
 static void OpMovAlOb(P) {
   i64 addr = AddressOb(A);
-  SetWriteAddr(m, addr, 1);
+  SetReadAddr(m, addr, 1);
   Put8(m->ax, Load8(ResolveAddress(m, addr)));
 }
 
 static void OpMovObAl(P) {
   i64 addr = AddressOb(A);
-  SetReadAddr(m, addr, 1);
+  SetWriteAddr(m, addr, 1);
   Store8(ResolveAddress(m, addr), Get8(m->ax));
 }
 
@@ -432,9 +483,24 @@ static void OpMovImm(P) {
 // to avoid having control flow drop back to the main interpreter loop.
 void Connect(P, u64 pc, bool avoid_cycles) {
 #ifdef HAVE_JIT
+  long skip;
   void *jump;
   uintptr_t f;
   STATISTIC(++path_connected_total);
+  unassert(!m->path.dirty);
+  if (!avoid_cycles && m->path.start == pc && !FLAG_noconnect) {
+    // a path that branches back to where it started is a loop, which
+    // may run its next iteration without leaving generated code, so
+    // long as it's checked that nothing is asking for our attention
+    STATISTIC(++path_connected_loops);
+    Jitter(A, "a1i", (u64)m->path.jb->pagegen);  // arg1 = jit generation
+    skip = BeginJitSkip(A, (void *)CanLoop);
+    AppendJitJump(m->path.jb,
+                  m->path.jb->addr + m->path.jb->start + GetPrologueSize());
+    EndJitSkip(A, skip);
+    AppendJitJump(m->path.jb, (void *)m->system->ender);
+    return;
+  }
   // 1. cyclic paths can block asynchronous sigs & deadlock exit
   // 2. we don't want to stitch together paths on separate pages
   if ((!avoid_cycles && m->path.start == pc) ||
@@ -512,6 +578,7 @@ static void OpAluCmp(P) {
 }
 
 static void OpAluFlip(P) {
+  int flags;
   aluop_f op = kAlu[(Opcode(rde) & 070) >> 3][RegLog2(rde)];
   u8 *q = RegLog2(rde) ? RegRexrReg(m, rde) : ByteRexrReg(m, rde);
   WriteRegisterBW(rde, q,
@@ -519,8 +586,15 @@ static void OpAluFlip(P) {
                      ReadRegisterOrMemoryBW(rde, GetModrmReadBW(A))));
   if (IsMakingPath(m)) {
     STATISTIC(++alu_ops);
+    flags = GetNeededFlags(m, m->ip, CF | ZF | SF | OF | AF | PF);
+    if (!flags && IsModrmRegister(rde) &&
+        JitAluRegs(A, (Opcode(rde) & 070) >> 3, RexrReg(rde), RexbRm(rde),
+                   0)) {
+      STATISTIC(++alu_unflagged);
+      return;
+    }
     LoadAluFlipArgs(A);
-    switch (GetNeededFlags(m, m->ip, CF | ZF | SF | OF | AF | PF)) {
+    switch (flags) {
       case 0:
         STATISTIC(++alu_unflagged);
         if (GetFlagDeps(rde)) Jitter(A, "q");  // arg0 = sav0 (machine)
@@ -575,11 +649,17 @@ static void OpAluFlipCmp(P) {
 }
 
 static void OpAluAxImm(P) {
+  int flags;
   aluop_f op;
   op = kAlu[(Opcode(rde) & 070) >> 3][RegLog2(rde)];
   WriteRegisterBW(rde, m->ax, op(m, ReadRegisterBW(rde, m->ax), uimm0));
   if (IsMakingPath(m)) {
-    switch (GetNeededFlags(m, m->ip, CF | ZF | SF | OF | AF | PF)) {
+    flags = GetNeededFlags(m, m->ip, CF | ZF | SF | OF | AF | PF);
+    if (!flags && JitAluRegs(A, (Opcode(rde) & 070) >> 3, 0, -1, uimm0)) {
+      STATISTIC(++alu_unflagged);
+      return;
+    }
+    switch (flags) {
       case 0:
       CASE_ALU_FAST:
         STATISTIC(++alu_simplified);
@@ -900,12 +980,21 @@ void Terminate(P, void uop(struct Machine *, u64)) {
            "q",   // arg0 = sav0 (machine)
            disp, uop);
     AlignJit(m->path.jb, 8, 0);
-    Connect(A, m->ip, true);
+    Connect(A, m->ip, false);
     FinishPath(m);
   }
 }
 
 static void OpJmp(P) {
+  if (IsMakingPath(m) && FollowPath(A, m->ip + disp)) {
+    Jitter(A,
+           "a1i"  // arg1 = disp
+           "m"    // call micro-op
+           "q",   // arg0 = sav0 (machine)
+           disp, FastJmp);
+    m->ip += disp;
+    return;
+  }
   m->ip += disp;
   Terminate(A, FastJmp);
 }
@@ -918,11 +1007,32 @@ static cc_f GetCc(P) {
   return kConditionCode[code];
 }
 
+// generates conditional exit to the destination of a branch which is
+// not being taken, so that the path may keep going through fallthrough
+static void JccTakenExit(P, cc_f cc) {
+  long skip;
+  skip = BeginJitSkip(A, (void *)cc);
+  Jitter(A,
+         "a1i"  // arg1 = disp
+         "m"    // call micro-op
+         "q",   // arg0 = machine
+         disp, FastJmp);
+  AlignJit(m->path.jb, 8, 0);
+  Connect(A, m->ip + disp, false);
+  EndJitSkip(A, skip);
+}
+
 static void OpJcc(P) {
   cc_f cc;
   cc = GetCc(A);
   if (IsMakingPath(m)) {
     FlushSkew(A);
+    // keep the path going in whichever direction the branch is headed
+    // right now, leaving a side exit for the direction it isn't taking
+    if (!cc(m) && FollowPath(A, m->ip)) {
+      JccTakenExit(A, cc);
+      goto Execute;
+    }
 #ifdef __x86_64__
     Jitter(A, "mq", cc);
     AlignJit(m->path.jb, 8, 4);
@@ -947,10 +1057,13 @@ static void OpJcc(P) {
            "m"    // call micro-op
            "q",   // arg0 = machine
            disp, FastJmp);
-    AlignJit(m->path.jb, 8, 0);
-    Connect(A, m->ip + disp, false);
-    FinishPath(m);
+    if (!cc(m) || !FollowPath(A, m->ip + disp)) {
+      AlignJit(m->path.jb, 8, 0);
+      Connect(A, m->ip + disp, false);
+      FinishPath(m);
+    }
   }
+Execute:
   if (cc(m)) {
     m->ip += disp;
   }
@@ -1086,18 +1199,35 @@ static u64 AluBsr(u64 x, struct Machine *m) {
   return x ? bsr(x) : 0;
 }
 
-static void Bitscan(P, u64 op(u64, struct Machine *)) {
+#if X86_INTRINSICS
+#define FAST_BITSCAN(x) (void *)(x)
+#else
+#define FAST_BITSCAN(x) 0
+#endif
+
+static void Bitscan(P, u64 op(u64, struct Machine *), void *fast, int bits) {
   WriteRegister(
       rde, RegRexrReg(m, rde),
       op(ReadMemory(rde, GetModrmRegisterWordPointerReadOszRexw(A)), m));
   if (IsMakingPath(m)) {
-    Jitter(A,
-           "wB"     // res0 = GetRegOrMem[force16+bit](RexbRm)
-           "s0a1="  // arg1 = sav0
-           "t"      // arg0 = res0
-           "c"      // call function (op)
-           "r0wC",  // PutReg[force16+bit](RexrReg, res0)
-           op);
+    if (fast) {
+      Jitter(A,
+             "wB"     // res0 = GetRegOrMem[force16+bit](RexbRm)
+             "a2i"    // arg2 = operand bits
+             "s0a1="  // arg1 = sav0
+             "t"      // arg0 = res0
+             "m"      // call micro-op (host bitscan instruction)
+             "r0wC",  // PutReg[force16+bit](RexrReg, res0)
+             bits, fast);
+    } else {
+      Jitter(A,
+             "wB"     // res0 = GetRegOrMem[force16+bit](RexbRm)
+             "s0a1="  // arg1 = sav0
+             "t"      // arg0 = res0
+             "c"      // call function (op)
+             "r0wC",  // PutReg[force16+bit](RexrReg, res0)
+             op);
+    }
   }
 }
 
@@ -1111,10 +1241,10 @@ static void OpBsf(P) {
     } else {
       op = AluLzcnt16;
     }
+    Bitscan(A, op, FAST_BITSCAN(FastLzcnt), 8 << WordLog2(rde));
   } else {
-    op = AluBsf;
+    Bitscan(A, AluBsf, FAST_BITSCAN(FastBsf), 0);
   }
-  Bitscan(A, op);
 }
 
 static void OpBsr(P) {
@@ -1127,15 +1257,15 @@ static void OpBsr(P) {
     } else {
       op = AluTzcnt16;
     }
+    Bitscan(A, op, FAST_BITSCAN(FastTzcnt), 8 << WordLog2(rde));
   } else {
-    op = AluBsr;
+    Bitscan(A, AluBsr, FAST_BITSCAN(FastBsr), 0);
   }
-  Bitscan(A, op);
 }
 
 static void Op1b8(P) {
   if (Rep(rde) == 3) {
-    Bitscan(A, AluPopcnt);
+    Bitscan(A, AluPopcnt, FAST_BITSCAN(FastPopcnt), 0);
   } else {
     OpUdImpl(m);
   }
@@ -1231,52 +1361,209 @@ static void OpDoubleShift(P) {
                      Opcode(rde) & 1 ? m->cl : uimm0, Opcode(rde) & 8));
 }
 
-static void OpFxsave(P) {
-  i64 v;
-  u8 buf[32];
-  memset(buf, 0, 32);
-  Write16(buf + 0, m->fpu.cw);
-#ifndef DISABLE_X87
-  Write16(buf + 2, m->fpu.sw);
-  Write8(buf + 4, m->fpu.tw);
-  Write16(buf + 6, m->fpu.op);
-  Write32(buf + 8, m->fpu.ip);
-#endif
-  Write32(buf + 24, m->mxcsr);
-  v = ComputeAddress(A);
-  CopyToUser(m, v + 0, buf, 32);
+// writes components in rfbm to legacy region of fxsave or xsave image
+static void SaveLegacyRegion(struct Machine *m, u8 *p, u64 rfbm) {
+  if (rfbm & kXcr0X87) {
+    memset(p, 0, 24);
+    Write16(p + 0, m->fpu.cw);
 #ifndef DISABLE_X87
-  CopyToUser(m, v + 32, m->fpu.st, 128);
+    Write16(p + 2, m->fpu.sw);
+    Write8(p + 4, m->fpu.tw);
+    Write16(p + 6, m->fpu.op);
+    Write32(p + 8, m->fpu.ip);
+    {
+      int i;
+      for (i = 0; i < 8; ++i) {
+        memset(p + 32 + i * 16, 0, 16);
+        SerializeLdbl(p + 32 + i * 16, m->fpu.st[i]);
+      }
+    }
 #endif
-  CopyToUser(m, v + 160, m->xmm, 256);
-  SetWriteAddr(m, v, 416);
+  }
+  if (rfbm & (kXcr0Sse | kXcr0Avx)) {
+    Write32(p + 24, m->mxcsr);
+    Write32(p + 28, 0);
+  }
+  if (rfbm & kXcr0Sse) {
+    memcpy(p + 160, m->xmm, 256);
+  }
 }
 
-static void OpFxrstor(P) {
-  i64 v;
-  u8 buf[32];
-  v = ComputeAddress(A);
-  SetReadAddr(m, v, 416);
-  CopyFromUser(m, buf, v + 0, 32);
+// reads components in rfbm from legacy region of fxsave or xsave image
+// where components absent from the image, per bv, are initialized
+static void LoadLegacyRegion(struct Machine *m, const u8 *p, u64 rfbm,
+                             u64 bv) {
+  if (rfbm & kXcr0X87) {
+    if (bv & kXcr0X87) {
+      m->fpu.cw = Load16(p + 0);
 #ifndef DISABLE_X87
-  CopyFromUser(m, m->fpu.st, v + 32, 128);
+      m->fpu.sw = Load16(p + 2);
+      m->fpu.tw = Load8(p + 4);
+      m->fpu.op = Load16(p + 6);
+      m->fpu.ip = Load32(p + 8);
+      {
+        int i;
+        for (i = 0; i < 8; ++i) {
+          m->fpu.st[i] = DeserializeLdbl(p + 32 + i * 16);
+        }
+      }
 #endif
-  CopyFromUser(m, m->xmm, v + 160, 256);
-  m->fpu.cw = Load16(buf + 0);
+    } else {
+      m->fpu.cw = 0x037f;
 #ifndef DISABLE_X87
-  m->fpu.sw = Load16(buf + 2);
-  m->fpu.tw = Load8(buf + 4);
-  m->fpu.op = Load16(buf + 6);
-  m->fpu.ip = Load32(buf + 8);
+      m->fpu.sw = 0;
+      m->fpu.tw = -1;
+      m->fpu.op = 0;
+      m->fpu.ip = 0;
+      memset(m->fpu.st, 0, sizeof(m->fpu.st));
 #endif
-  m->mxcsr = Load32(buf + 24);
+    }
+  }
+  if (rfbm & (kXcr0Sse | kXcr0Avx)) {
+    if (bv & (kXcr0Sse | kXcr0Avx)) {
+      m->mxcsr = Load32(p + 24);
+    } else {
+      m->mxcsr = 0x1f80;
+    }
+    SyncRounding(m);
+  }
+  if (rfbm & kXcr0Sse) {
+    if (bv & kXcr0Sse) {
+      memcpy(m->xmm, p + 160, 256);
+    } else {
+      memset(m->xmm, 0, 256);
+    }
+  }
+}
+
+static i64 GetStateAddress(P, int align) {
+  i64 v;
+  v = ComputeAddress(A);
+  if (v & (align - 1)) ThrowSegmentationFault(m, v);
+  return v;
+}
+
+static void ReadState(struct Machine *m, u8 *p, i64 v, u64 n) {
+  if (CopyFromUserRead(m, p, v, n) == -1) ThrowSegmentationFault(m, v);
+}
+
+static void WriteState(struct Machine *m, i64 v, u8 *p, u64 n) {
+  if (CopyToUserWrite(m, v, p, n) == -1) ThrowSegmentationFault(m, v);
+}
+
+static void OpFxsave(P) {
+  i64 v;
+  u8 buf[416];
+  v = GetStateAddress(A, 16);
+  ReadState(m, buf, v, 416);
+  SaveLegacyRegion(m, buf, kXcr0X87 | kXcr0Sse);
+  WriteState(m, v, buf, 416);
+}
+
+static void OpFxrstor(P) {
+  i64 v;
+  u8 buf[416];
+  v = GetStateAddress(A, 16);
+  ReadState(m, buf, v, 416);
+  LoadLegacyRegion(m, buf, kXcr0X87 | kXcr0Sse, -1);
+}
+
+// returns requested-feature bitmap of xsave instruction family
+static u64 GetRfbm(struct Machine *m) {
+  return ((u64)Read32(m->dx) << 32 | Read32(m->ax)) & m->xcr0;
+}
+
+static u64 GetXsaveSize(u64 rfbm) {
+  return rfbm & kXcr0Avx ? kXsaveSize : kXsaveAvxOffset;
+}
+
+// saves processor extended state, i.e. xsave, xsaveopt and xsavec
+static void XsaveImpl(P, bool compact) {
+  i64 v;
+  u64 rfbm, n;
+  u8 buf[kXsaveSize];
+  rfbm = GetRfbm(m);
+  n = GetXsaveSize(rfbm);
+  v = GetStateAddress(A, 64);
+  ReadState(m, buf, v, n);
+  SaveLegacyRegion(m, buf, rfbm);
+  if (rfbm & kXcr0Avx) {
+    memcpy(buf + kXsaveAvxOffset, m->ymmh, kXsaveAvxSize);
+  }
+  if (compact) {
+    Write64(buf + kXsaveHeader + 0, rfbm);
+    Write64(buf + kXsaveHeader + 8, 0x8000000000000000 | rfbm);
+    memset(buf + kXsaveHeader + 16, 0, 48);
+  } else {
+    Write64(buf + kXsaveHeader, Read64(buf + kXsaveHeader) | rfbm);
+  }
+  WriteState(m, v, buf, n);
 }
 
 static void OpXsave(P) {
+  XsaveImpl(A, false);
+}
+
+static void OpXsavec(P) {
+  XsaveImpl(A, true);
+}
+
+// restores processor extended state saved by xsave or xsavec
+static void OpXrstor(P) {
+  i64 v;
+  u64 rfbm, bv, n;
+  u8 buf[kXsaveSize];
+  rfbm = GetRfbm(m);
+  v = GetStateAddress(A, 64);
+  ReadState(m, buf + kXsaveHeader, v + kXsaveHeader, 64);
+  bv = Read64(buf + kXsaveHeader);
+  if (bv & ~m->xcr0) ThrowProtectionFault(m);
+  n = GetXsaveSize(rfbm & bv);
+  ReadState(m, buf, v, kXsaveHeader);
+  if (n > kXsaveAvxOffset) {
+    ReadState(m, buf + kXsaveAvxOffset, v + kXsaveAvxOffset,
+              n - kXsaveAvxOffset);
+  }
+  LoadLegacyRegion(m, buf, rfbm, bv);
+  if (rfbm & kXcr0Avx) {
+    if (bv & kXcr0Avx) {
+      memcpy(m->ymmh, buf + kXsaveAvxOffset, kXsaveAvxSize);
+    } else {
+      memset(m->ymmh, 0, kXsaveAvxSize);
+    }
+  }
+}
+
+// mxcsr rounding control bits that this host thread is running with
+static _Thread_local int g_hostround;
+
+/**
+ * Makes the host thread round floating point the way the guest asked.
+ *
+ * Conversions and scalar math compiled into native sse instructions by
+ * the jit round according to the host's own mode, as does the C code
+ * that implements them in the interpreter. So rather than switching on
+ * the mode each time an op runs, the host is changed once, whenever the
+ * guest mxcsr changes, which is rare. The x87 control word of the host
+ * isn't touched, since the guest's own one is emulated separately.
+ */
+void SyncRounding(struct Machine *m) {
+  int rc = m->mxcsr & kMxcsrRc;
+  if (rc == g_hostround) return;
+#if defined(__x86_64__) && defined(__SSE__)
+  __builtin_ia32_ldmxcsr((__builtin_ia32_stmxcsr() & ~kMxcsrRc) | rc);
+#elif defined(FE_TONEAREST) && defined(FE_DOWNWARD) && \
+    defined(FE_UPWARD) && defined(FE_TOWARDZERO)
+  static const int kRound[] = {FE_TONEAREST, FE_DOWNWARD,  //
+                               FE_UPWARD, FE_TOWARDZERO};
+  fesetround(kRound[rc >> 13]);
+#endif
+  g_hostround = rc;
 }
 
 static void OpLdmxcsr(P) {
   m->mxcsr = Load32(ComputeReserveAddressRead4(A));
+  SyncRounding(m);
 }
 
 static void OpStmxcsr(P) {
@@ -1299,12 +1586,24 @@ static void OpWrgsbase(P) {
   m->gs.base = ReadRegister(rde, RegRexbRm(m, rde));
 }
 
+// puts host memory barrier in jit path, so fences don't have to end it
+static void JitFence(P, bool isload) {
+#ifdef __x86_64__
+  u8 code[] = {0x0f, 0xae, isload ? 0xe8 : 0xf0};  // lfence or mfence
+#else
+  u32 code[] = {isload ? 0xd50339bf : 0xd5033bbf};  // dmb ishld or ish
+#endif
+  AppendJit(m->path.jb, code, sizeof(code));
+}
+
 static void OpMfence(P) {
+  if (IsMakingPath(m)) JitFence(A, false);
   atomic_thread_fence(memory_order_seq_cst);
 }
 
 static void OpLfence(P) {
-  OpMfence(A);
+  if (IsMakingPath(m)) JitFence(A, true);
+  atomic_thread_fence(memory_order_seq_cst);
 }
 
 static void OpSfence(P) {
@@ -1359,10 +1658,18 @@ static void Op1ae(P) {
       }
       break;
     case 5:
-      OpLfence(A);
+      if (ismem) {
+        OpXrstor(A);
+      } else {
+        OpLfence(A);
+      }
       break;
     case 6:
-      OpMfence(A);
+      if (ismem) {
+        OpXsave(A);  // xsaveopt
+      } else {
+        OpMfence(A);
+      }
       break;
     case 7:
       if (ismem) {
@@ -1433,7 +1740,7 @@ static void OpHvtailcall(P) {
 
 static void OpUd0GvqpEvqp(P) {
   if (Cpl(m) == 3) {
-    OpUd(A);
+    OpVdsoCall(A);
   } else {
     // define `hvcall` & `hvtailcall` instructions which trap to our Blink
     // hypervisor; these are encoded as x86 "invalid opcodes" in 16-bit mode:
@@ -1516,7 +1823,7 @@ static void OpEmms(P) {
 #define OpInto        OpUd
 #define OpIret        OpUd
 #define OpWrmsr       OpUd
-#define OpUd0GvqpEvqp OpUd
+#define OpUd0GvqpEvqp OpVdsoCall
 #endif
 
 #ifdef DISABLE_X87
@@ -2076,20 +2383,43 @@ nexgen32e_f GetOp(long op) {
       XLAT(0x21e, OpSsePabsd);
       XLAT(0x22a, OpMovntdqaVdqMdq);
       XLAT(0x240, OpSsePmulld);
+      XLAT(0x2c8, OpSha38);
+      XLAT(0x2c9, OpSha38);
+      XLAT(0x2ca, OpSha38);
+      XLAT(0x2cb, OpSha38);
+      XLAT(0x2cc, OpSha38);
+      XLAT(0x2cd, OpSha38);
+      XLAT(0x2db, OpAes);
+      XLAT(0x2dc, OpAes);
+      XLAT(0x2dd, OpAes);
+      XLAT(0x2de, OpAes);
+      XLAT(0x2df, OpAes);
       XLAT(0x2f0, Op2f01);
       XLAT(0x2f1, Op2f01);
-      XLAT(0x2f5, Op2f5);
       XLAT(0x2f6, Op2f6);
-      XLAT(0x2f7, OpShx);
       XLAT(0x30f, OpSsePalignr);
       XLAT(0x344, OpSsePclmulqdq);
-      XLAT(0x3f0, OpRorx);
+      XLAT(0x3cc, OpSha1rnds4);
+      XLAT(0x3df, OpAeskeygenassist);
+      XLAT(0x700, OpNative);
       default:
         return OpUd;
     }
   }
 }
 
+// returns implementation of vex encoded op
+nexgen32e_f GetVexOp(long op) {
+  switch (op) {
+    XLAT(0x2f5, Op2f5);
+    XLAT(0x2f6, Op2f6);
+    XLAT(0x2f7, OpShx);
+    XLAT(0x3f0, OpRorx);
+    default:
+      return GetAvxOp(op);
+  }
+}
+
 static bool CanJit(struct Machine *m) {
   return !IsJitDisabled(&m->system->jit);
 }
@@ -2102,19 +2432,62 @@ void JitlessDispatch(P) {
   rde = m->xedd->op.rde;
   disp = m->xedd->op.disp;
   uimm0 = m->xedd->op.uimm0;
+  STATISTIC(++opcode_interps[Mopcode(rde)]);
   m->oplen = Oplength(rde);
   m->ip += Oplength(rde);
-  GetOp(Mopcode(rde))(A);
+  GetOpForRde(rde)(A);
   if (m->stashaddr) CommitStash(m);
   m->oplen = 0;
 }
 
+// runs a pre-decoded basic block of instructions, for when there's no
+// jit. each op is checked against the bytes at rip before it executes,
+// so self-modifying code still works the same as in JitlessDispatch()
+static void ThreadedDispatch(P) {
+  int i;
+  u64 ip;
+  unsigned off;
+  u8 *page = 0;
+  struct DecodedBlock *b;
+  if (!(b = LoadDecodedBlock(m, GetPc(m), &page))) {
+    JitlessDispatch(A);
+    return;
+  }
+  for (off = b->pc & 4095, i = 0;;) {
+    m->xedd = b->xedd + i;
+    rde = m->xedd->op.rde;
+    disp = m->xedd->op.disp;
+    uimm0 = m->xedd->op.uimm0;
+    COSTLY_STATISTIC(++instructions_dispatched);
+    STATISTIC(++opcode_interps[Mopcode(rde)]);
+    m->oplen = Oplength(rde);
+    ip = m->ip += Oplength(rde);
+    b->ops[i](A);
+    if (m->stashaddr) CommitStash(m);
+    m->oplen = 0;
+    if (++i == b->n || m->ip != ip ||
+        atomic_load_explicit(&m->attention, memory_order_acquire) ||
+        atomic_load_explicit(&m->invalidated, memory_order_acquire) ||
+        atomic_load_explicit(&m->opcache->invalidated,
+                             memory_order_acquire)) {
+      return;
+    }
+    if (!IsOpcodeEqual(b->xedd + i, page + (off += Oplength(rde)))) {
+      b->pc = 0;
+      return;
+    }
+  }
+}
+
 static void GeneralDispatch(P) {
 #ifdef HAVE_JIT
   int opclass;
   uintptr_t jitpc = 0;
+  bool op_is_breakpoint;
   bool op_overlaps_page_boundary;
   bool path_would_overlap_page_boundary;
+  bool path_would_enter_volatile_page;
+  bool op_halted_path;
   ASM_LOGF("decoding [%s] at address %" PRIx64, DescribeOp(m, GetPc(m)),
            GetPc(m));
   LoadInstruction(m, GetPc(m));
@@ -2122,22 +2495,42 @@ static void GeneralDispatch(P) {
   disp = m->xedd->op.disp;
   uimm0 = m->xedd->op.uimm0;
   opclass = ClassifyOp(rde);
+  STATISTIC(++opcode_interps[Mopcode(rde)]);
   // try to fast-track precious ops, since they hit this every time
-  // each jit path should be fully contained within a single page
+  // each jit path should be contained within its first page and the
+  // page after it, although only existing paths may cross into it
   op_overlaps_page_boundary =
       (m->ip & -4096) != ((m->ip + Oplength(rde) - 1) & -4096);
   path_would_overlap_page_boundary =
-      IsMakingPath(m) && (m->ip & -4096) != (m->path.start & -4096);
+      IsMakingPath(m) && (((m->ip + Oplength(rde) - 1) & -4096) -
+                          (m->path.start & -4096)) > 4096;
+  // writes to pages whose code is run by the interpreter aren't noticed
+  path_would_enter_volatile_page =
+      IsMakingPath(m) &&
+      ((m->ip + Oplength(rde) - 1) & -4096) != (m->path.start & -4096) &&
+      IsSmcPageUnwatched(m->system, m->ip + Oplength(rde) - 1);
+  // ops that halted the last path to include them are interpreted until
+  // they run once without halting, like a gc's safepoint poll wouldn't
+  op_halted_path = m->ip == m->faultpc;
+  // debuggers check for breakpoints between calls to this function, so
+  // paths must end before reaching them, and can't include them either
+  op_is_breakpoint = IsAtBreakpoint_Hook && IsAtBreakpoint_Hook(m->ip);
   if (IsMakingPath(m) &&
       (opclass == kOpPrecious || opclass == kOpSerializing ||
-       op_overlaps_page_boundary || path_would_overlap_page_boundary)) {
+       path_would_overlap_page_boundary || path_would_enter_volatile_page ||
+       op_is_breakpoint || op_halted_path)) {
     // complete path where last instruction in path is previously run op
     CompletePath(A);
   }
+  if (IsMakingPath(m) &&
+      ((m->ip + Oplength(rde) - 1) & -4096) != (m->path.start & -4096)) {
+    m->path.spans = true;
+  }
   // if we're in a jit path, or we're able to create a new path
   if (IsMakingPath(m) ||
       (opclass != kOpPrecious && opclass != kOpSerializing &&
-       !op_overlaps_page_boundary && CanJit(m) && CreatePath(A))) {
+       !op_overlaps_page_boundary && !op_is_breakpoint && !op_halted_path &&
+       CanJit(m) && CreatePath(A))) {
     // begin adding this op to the jit path
     unassert(opclass == kOpNormal || opclass == kOpBranching);
     ++m->path.elements;
@@ -2153,11 +2546,14 @@ static void GeneralDispatch(P) {
   m->oplen = Oplength(rde);
   m->ip += Oplength(rde);
   // call the c implementation of the opcode
-  GetOp(Mopcode(rde))(A);
+  GetOpForRde(rde)(A);
   // cleanup after ReserveAddress() if a memory access overlapped a page
   if (m->stashaddr) {
     CommitStash(m);
   }
+  if (op_halted_path) {
+    m->faultpc = 0;
+  }
   if (IsMakingPath(m)) {
     // finish adding new element to jit path
     unassert(opclass == kOpNormal || opclass == kOpBranching);
@@ -2172,26 +2568,61 @@ static void GeneralDispatch(P) {
       STATISTIC(++path_elements_auto);
     }
     if (opclass == kOpBranching) {
-      // branches, calls, and jumps always force end of path
-      // unlike precious ops the branching op can be in path
-      CompletePath(A);
+      if (!m->path.follow) {
+        // branches, calls, and jumps force end of path unless they're
+        // direct branches being followed; unlike precious ops the
+        // branching op can be in path
+        CompletePath(A);
+      } else {
+        // guest registers were stored before the branch's side exit so
+        // register caching may resume for the ops which come after it
+        m->path.nocache = false;
+      }
     }
   }
   m->oplen = 0;
 #endif
 }
 
+#ifdef HAVE_JIT
+// remembers the jit path that an indirect branch whose jit code didn't
+// know where it'd go ended up at, so the next time it can jump into it
+// directly. gen must have been loaded before the hook, since it changes
+// whenever paths get deleted, which is how stale entries are rejected.
+static void FillBranchTarget(struct Machine *m, nexgen32e_f func,
+                             unsigned gen) {
+  struct BranchTarget *b;
+  m->mispredicted = false;
+  if (func != JitlessDispatch && !(gen & 1)) {
+    STATISTIC(++path_branch_targets);
+    b = GetBranchTarget(m, m->ip);
+    b->pc = m->ip;
+    b->code = (uintptr_t)func + GetPrologueSize();
+    b->gen = gen;
+  }
+}
+#endif
+
 void ExecuteInstruction(struct Machine *m) {
 #if LOG_CPU
   LogCpu(m);
 #endif
 #ifdef HAVE_JIT
   u8 *dst;
+  unsigned gen;
   nexgen32e_f func;
   unassert(m->canhalt);
   if (CanJit(m)) {
-    if ((func = (nexgen32e_f)GetJitHook(&m->system->jit, m->ip))) {
+    gen = atomic_load_explicit(&m->system->jit.pagegen, memory_order_acquire);
+    if ((func = (nexgen32e_f)GetJitHook(&m->system->jit, m->ip)) ||
+        (!IsMakingPath(m) &&
+         (func = (nexgen32e_f)RestoreCachedJitPath(m)))) {
       if (!IsMakingPath(m)) {
+        STATISTIC(++jit_dispatch_hits);
+        if (m->mispredicted) {
+          FillBranchTarget(m, func, gen);
+        }
+        TouchJitPath((uintptr_t)func);
         func(DISPATCH_NOTHING);
         return;
       } else if (func == JitlessDispatch) {
@@ -2206,6 +2637,7 @@ void ExecuteInstruction(struct Machine *m) {
                  " into previously created function %p at %#" PRIx64,
                  m->path.start, func, m->ip);
         FlushSkew(DISPATCH_NOTHING);
+        FlushJitRegs(m);
         AppendJitSetReg(m->path.jb, kJitArg0, kJitSav0);
         STATISTIC(++path_spliced);
         if (RecordJitEdge(&m->system->jit, m->path.start, m->ip)) {
@@ -2221,6 +2653,7 @@ void ExecuteInstruction(struct Machine *m) {
         return;
       }
     }
+    STATISTIC(++jit_dispatch_misses);
     GeneralDispatch(DISPATCH_NOTHING);
   } else {
     JitlessDispatch(DISPATCH_NOTHING);
@@ -2241,21 +2674,39 @@ void Actor(struct Machine *mm) {
 #ifndef __CYGWIN__
     STATISTIC(++interps);
 #endif
-    if (!atomic_load_explicit(&m->attention, memory_order_acquire)) {
-      ExecuteInstruction(m);
-    } else {
+    if (atomic_load_explicit(&m->attention, memory_order_acquire)) {
       CheckForSignals(m);
+#if !LOG_CPU
+    } else if (!CanJit(m)) {
+      ThreadedDispatch(DISPATCH_NOTHING);
+#endif
+    } else {
+      ExecuteInstruction(m);
     }
   }
 }
 
 void Blink(struct Machine *m) {
   int rc;
+  // sigsetjmp() isn't asked to save the host signal mask, since that'd
+  // cost two system calls each time a guest faults, e.g. a gc barrier.
+  // it only needs restoring if a host signal handler or a system call
+  // that changed it is being unwound, so it's remembered here instead
+  unassert(!pthread_sigmask(SIG_SETMASK, 0, &m->runmask));
   for (;;) {
-    if (!(rc = sigsetjmp(m->onhalt, 1))) {
+    // host threads don't necessarily start out rounding like the guest,
+    // and signal handlers run with the default mxcsr, so longjmp()'ing
+    // out of them loses whatever rounding mode the guest had asked for
+    g_hostround = -1;
+    SyncRounding(m);
+    if (!(rc = sigsetjmp(m->onhalt, 0))) {
       m->canhalt = true;
       Actor(m);
     }
+    if (!m->softhalt || m->sysdepth || m->sigdepth) {
+      unassert(!pthread_sigmask(SIG_SETMASK, &m->runmask, 0));
+    }
+    m->softhalt = false;
     m->sysdepth = 0;
     m->sigdepth = 0;
     m->canhalt = false;
@@ -2264,10 +2715,17 @@ void Blink(struct Machine *m) {
     CollectPageLocks(m);
     CollectGarbage(m, 0);
     if (IsMakingPath(m)) {
+      // paths will end before the op that halted, since they would just
+      // be made and thrown away again, e.g. when guests fault on purpose
+      m->faultpc = m->ip - m->oplen;
       AbandonPath(m);
     }
     if (rc == kMachineFatalSystemSignal) {
       HandleFatalSystemSignal(m, &g_siginfo);
+#ifdef HAVE_THREADS
+    } else if (rc == kMachineRecycle && !RecycleMachine(m)) {
+      pthread_exit(0);
+#endif
     }
   }
 }
@@ -10,7 +10,9 @@
 #include "blink/dll.h"
 #include "blink/elf.h"
 #include "blink/fds.h"
+#include "blink/flag.h"
 #include "blink/jit.h"
+#include "blink/ldbl.h"
 #include "blink/linux.h"
 #include "blink/log.h"
 #include "blink/thread.h"
@@ -33,6 +35,9 @@
 
 #define kInstructionBytes 40
 
+#define kScratchChunk 65536  // bytes per chunk of syscall scratch arena
+#define kScratchLarge 16384  // bigger copies are malloc'd to the free list
+
 #define kMachineExit                 256
 #define kMachineHalt                 -1
 #define kMachineDecodeError          -2
@@ -45,6 +50,7 @@
 #define kMachineSimdException        -9
 #define kMachineExitTrap             -10
 #define kMachineFatalSystemSignal    -11
+#define kMachineRecycle              -12
 
 #define CR0_PE 0x01        // protected mode enabled
 #define CR0_MP 0x02        // monitor coprocessor
@@ -84,18 +90,29 @@
 #define PAGE_V     0x0000000000000001  // valid
 #define PAGE_RW    0x0000000000000002  // writeable
 #define PAGE_U     0x0000000000000004  // permit ring3 access or read protect
+#define PAGE_A     0x0000000000000020  // walked to since the reclaimer looked
+#define PAGE_D     0x0000000000000040  // written since clear_refs soft dirty
 #define PAGE_PS    0x0000000000000080  // IsPage (PDPTE/PDE) or PAT (PT)
 #define PAGE_G     0x0000000000000100  // global
 #define PAGE_RSRV  0x0000000000000200  // PAGE_TA bits havent been chosen yet
 #define PAGE_HOST  0x0000000000000400  // PAGE_TA bits point to system memory
 #define PAGE_MAP   0x0000000000000800  // PAGE_TA bits are a linear host mmap
 #define PAGE_TA    0x0000fffffffff000  // bits used for host, or real address
+#define PAGE_ZIP   0x0001000000000000  // PAGE_TA bits index a compressed page
+#define PAGE_SHARE 0x0008000000000000  // page was mapped using MAP_SHARED
 #define PAGE_GROW  0x0010000000000000  // for future support of MAP_GROWSDOWN
 #define PAGE_MUG   0x0020000000000000  // host page magic mapped individually
 #define PAGE_FILE  0x0040000000000000  // page has tracking bit in s->filemap
 #define PAGE_LOCK  0x0080000000000000  // a bit used to increment lock counts
 #define PAGE_LOCKS 0x7f80000000000000  // a page can be locked by 255 threads
 #define PAGE_XD    0x8000000000000000  // disable executing memory if bit set
+#define PAGE_REF   0x0010000000000000  // a bit used to count table entries
+#define PAGE_REFS  0x3ff0000000000000  // PML4E/PDPTE/PDE: entries table uses
+
+// in linux mode, a pde with PAGE_PS set is a lazily reserved 2mb chunk,
+// whose page table hasn't been created, because its 512 entries would
+// be the same, except for PAGE_TA advancing if it's linear memory.
+#define IsLazyChunk(pde) (((pde) & (PAGE_V | PAGE_PS)) == (PAGE_V | PAGE_PS))
 
 #define SREG_ES 0
 #define SREG_CS 1
@@ -110,7 +127,6 @@
 
 #define MACHINE_CONTAINER(e)  DLL_CONTAINER(struct Machine, elem, e)
 #define FILEMAP_CONTAINER(e)  DLL_CONTAINER(struct FileMap, elem, e)
-#define HOSTPAGE_CONTAINER(e) DLL_CONTAINER(struct HostPage, elem, e)
 
 #if defined(NOLINEAR) || defined(__SANITIZE_THREAD__) || \
     defined(__CYGWIN__) || defined(__NetBSD__) || defined(__COSMOPOLITAN__)
@@ -125,7 +141,19 @@
 #define IsMakingPath(m) 0
 #endif
 
-#define HasLinearMapping() (CanHaveLinearMemory() && !FLAG_nolinear)
+// shadow memory is linear memory that lives in a window blink reserved
+#if defined(NOLINEAR) || defined(__COSMOPOLITAN__)
+#define CanHaveShadowMemory() false
+#else
+#define CanHaveShadowMemory() CAN_64BIT
+#endif
+
+#define HasShadowMapping() (CanHaveShadowMemory() && FLAG_shadow)
+#define HasLinearMapping() \
+  ((CanHaveLinearMemory() && !FLAG_nolinear) || HasShadowMapping())
+
+// returns implementation of decoded op, which is vex encoded or not
+#define GetOpForRde(rde) (Vex(rde) ? GetVexOp : GetOp)(Mopcode(rde))
 
 #if CAN_64BIT
 #define _Atomicish(t) _Atomic(t)
@@ -133,26 +161,63 @@
 #define _Atomicish(t) t
 #endif
 
-MICRO_OP_SAFE u8 *ToHost(i64 v) {
+// translates address in linear memory that isn't inside a shadow window
+MICRO_OP_SAFE u8 *ToSkewedHost(i64 v) {
   return (u8 *)(uintptr_t)(v + kSkew);
 }
 
+// translates address in shadow window, where addresses that are out of
+// bounds get clamped onto the guard pages at the end of the reservation
+MICRO_OP_SAFE u8 *ToShadowHost(i64 v, u64 size, u64 base) {
+  return (u8 *)(uintptr_t)(base + ((u64)v < size ? (u64)v : size));
+}
+
+static inline u8 *ToHost(i64 v) {
+  if (HasShadowMapping()) return ToShadowHost(v, FLAG_shadowsize, FLAG_skew);
+  return ToSkewedHost(v);
+}
+
 static inline i64 ToGuest(void *r) {
-  i64 v = (uintptr_t)r - kSkew;
+  i64 v = (uintptr_t)r - (HasShadowMapping() ? FLAG_skew : kSkew);
   return v;
 }
 
+// returns what the page table entry of virt inside a lazy chunk would be
+static inline u64 GetLazyEntry(u64 pde, i64 virt) {
+  pde &= ~(u64)PAGE_PS;
+  if (pde & PAGE_MAP) pde += virt & 0x1ff000;
+  return pde;
+}
+
+struct BtraceRing;
+struct FlightRing;
+struct EtraceRing;
+struct Coverage;
+struct CoverageBlock;
 struct Dis;
+struct Futex;
 struct Machine;
 typedef void (*nexgen32e_f)(P);
 
+struct Scratch {
+  struct Scratch *prev;  // older chunk still holding live allocations
+  size_t base;           // value of FreeList::used when chunk was begun
+};
+
 struct FreeList {
-  int n;
+  int n, c;
   void **p;
+  size_t used;              // logical bytes of scratch arena handed out
+  struct Scratch *scratch;  // chunk being bump allocated, if any
+  struct Scratch *spare;    // chunks held for reuse by later syscalls
+};
+
+struct GarbageMark {
+  int n;
+  size_t used;
 };
 
 struct HostPage {
-  u8 *page;
   struct HostPage *next;
 };
 
@@ -166,8 +231,18 @@ struct SmcQueue {
   i64 p[kSmcQueueSize];
 };
 
+// tracks how often writes to a code page are intercepted (see smc.c)
+struct SmcPage {
+  _Atomic(i64) unwatched;  // page if its writes aren't intercepted, or 0
+  i64 page;                // page whose flushes are counted, or zero
+  int flushes;             // flushes of page since the window started
+  u64 sum;                 // content hash of unwatched page at last check
+  struct timespec since;   // when window started, or content was checked
+};
+
 struct PageLocks {
   int i, n;
+  i64 lo, hi;  // bounds on pages locked since i was last zero
   struct PageLock *p;
 };
 
@@ -183,7 +258,7 @@ struct FileMap {
 
 struct MachineFpu {
 #ifndef DISABLE_X87
-  double st[8];
+  fpu_t st[8];
   u32 sw;
   int tw;
   int op;
@@ -218,7 +293,9 @@ struct MachineState {
   struct DescriptorCache gs;
   u8 weg[16][8];
   u8 xmm[16][16];
+  u8 ymmh[16][16];
   u32 mxcsr;
+  u64 xcr0;
   struct MachineFpu fpu;
   struct MachineMemstat memstat;
 };
@@ -237,6 +314,13 @@ struct Elf {
   i64 at_phnum;
 };
 
+struct DecodedBlock {
+  u64 pc;                 // guest address of first instruction, or zero
+  int n;                  // number of instructions that were decoded
+  nexgen32e_f ops[kBlockOps];
+  struct XedDecodedInst xedd[kBlockOps];
+};
+
 struct OpCache {
   u8 stash[16];   // for memory ops that overlap page
   u64 codevirt;   // current rip page in guest memory
@@ -244,7 +328,17 @@ struct OpCache {
   u32 stashsize;  // for writes that overlap page
   bool writable;
   _Atomic(bool) invalidated;
-  u64 icache[512][kInstructionBytes / 8];
+  u64 icachepc[kIcacheSets][kIcacheWays];
+  u64 icache[kIcacheSets][kIcacheWays][kInstructionBytes / 8];
+  struct DecodedBlock blocks[kBlockSets];  // for when jit isn't available
+};
+
+struct SignalFd {
+  _Atomic(u64) mask;   // signals reported by this signalfd()
+  _Atomic(int) wake;   // blink owned write end of its pipe, or zero
+  _Atomic(int) users;  // signal handlers currently writing to wake
+  int fildes;          // guest owned read end of its pipe
+  u64 dev, ino;        // identifies the read end after it's dup()'d
 };
 
 struct System {
@@ -256,12 +350,16 @@ struct System {
   bool iscosmo;
   bool trapexit;
   bool brkchanged;
+  bool trapsrdtsc;  // some thread used prctl() to make rdtsc fault
   _Atomic(bool) killer;
+  _Atomic(bool) singlethreaded;
+  _Atomic(bool) paused;  // [attention] threads should park until cleared
   u16 gdt_limit;
   u16 idt_limit;
   int exitcode;
   u32 efer;
   int pid;
+  int vforkfd;  // held by vfork() child until it execs, or zero
   unsigned next_tid;
   u8 *real;
   u64 gdt_base;
@@ -272,12 +370,14 @@ struct System {
   u64 cr4;
   i64 brk;
   i64 automap;
-  i64 memchurn;
+  i64 vdso;
   i64 codestart;
   long codesize;
   _Atomic(long) rss;
   _Atomic(long) vss;
   struct Dis *dis;
+  struct Coverage *coverage;
+  struct Natives *natives;
   struct Dll *filemaps;
   struct MachineMemstat memstat;
   struct Dll *machines;
@@ -288,12 +388,21 @@ struct System {
   sigset_t exec_sigmask;
   struct sigaction_linux hands[64];
   u64 blinksigs;  // signals blink itself handles
+  _Atomic(u64) heldsigs;  // signals some guest thread has blocked
+  struct SignalFd sigfds[kSignalFds];  // see signalfd.c
+  struct SmcPage smcpages[kSmcPages];  // guarded by jit.lock
   struct rlimit_linux rlim[RLIM_NLIMITS_LINUX];
 #ifdef HAVE_THREADS
   pthread_cond_t machines_cond;
+  pthread_cond_t paused_cond;  // broadcast when paused clears or killing
+  pthread_cond_t idle_cond;    // broadcast when idle machines are handed out
   pthread_mutex_t machines_lock;
+  struct Dll *idle;            // [machines_lock] pooled threads that exited
+  int idles;                   // [machines_lock] length of idle list
+  bool draining;               // [machines_lock] idle threads should quit
   pthread_cond_t pagelocks_cond;
   pthread_mutex_t pagelocks_lock;
+  _Atomic(int) pagelocks_waiters;  // threads waiting for a page unlock
   pthread_mutex_t exec_lock;
   pthread_mutex_t sig_lock;
   pthread_mutex_t mmap_lock;
@@ -304,6 +413,7 @@ struct System {
   void (*onlongbranch)(struct Machine *);
   void (*onromwriteattempt)(struct Machine *, u8 *);
   int (*exec)(char *, char *, char **, char **);
+  void (*onexit)(struct Machine *, int);
   void (*redraw)(bool);
 };
 
@@ -311,12 +421,52 @@ struct System {
 #define USER_DS_LINUX 0x2b  // default selector for ss (N.B.)
 #define USER_CS_LINUX 0x33  // default selector for cs
 
+struct JitCold {
+  u32 skip;       // offset of code after the branch into the slow path
+  u16 size;       // bytes accessed by memory operand
+  bool writable;  // memory operand is a store
+};
+
 struct JitPath {
   int skip;
   int elements;
   u64 skew;
   i64 start;
   struct JitBlock *jb;
+  struct JitBlock *held;  // jb while an avx op runs sse ops on scratch regs
+  u8 cached;    // mask of sav registers holding a guest register
+  u8 dirty;     // mask of sav registers that need writing back
+  u8 scratch;   // mask of sav registers borrowed by current op
+  bool nocache; // disables guest register caching for this path
+  bool spans;   // path has run into the page after its first page
+  bool follow;  // current branching op kept the path going
+  i64 branch;   // address of the branching op that was followed
+  bool hot;     // path is being rebuilt because its code ran often
+  bool retier;  // cold path would be longer if it were rebuilt hot
+  bool stale;   // guest code changed while path was being generated
+  struct CoverageBlock *block;  // guest code block for BLINK_COVERAGE
+  long entry;   // offset of jump over hit counter at start of path
+  long body;    // offset of code that comes after that jump
+  u64 began;    // when generating the path began, for statistics
+  u8 branches;  // number of direct branches the path has run through
+  u8 colds;     // number of slow paths deferred to the end of the path
+  u8 regs[5];   // guest register index held by each sav register
+  u32 tick;     // for picking least recently used sav register
+  u32 used[5];  // tick when each sav register was last accessed
+  u64 lines[2];     // 64-byte lines of code read on first and next page
+  u64 sums[128];    // hash of each one of those lines when it was read
+  struct JitCold cold[kPathColds];  // tlb misses placed after the path
+};
+
+struct ShadowStack {
+  unsigned i;              // index of next frame, wrapping around
+  u64 pc[kShadowFrames];   // guest return addresses pushed by calls
+};
+
+struct BranchTarget {
+  u64 pc;                  // guest address an indirect branch went to
+  uintptr_t code;          // jit path entry for pc, after its prologue
+  unsigned gen;            // jit page generation when code was found
 };
 
 struct MachineTlb {
@@ -324,6 +474,16 @@ struct MachineTlb {
   u64 entry;
 };
 
+struct TlbShootdowns {
+  _Atomic(u32) lock;  // spin lock held briefly by both sides
+  bool flush;         // queue overflowed so the whole tlb must go
+  int n;
+  struct TlbRange {
+    i64 virt;
+    i64 size;
+  } r[kTlbQueueSize];
+};
+
 struct Machine {                         //
   u64 ip;                                // instruction pointer
   u8 oplen;                              // length of operation
@@ -381,6 +541,7 @@ struct Machine {                         //
   };                                     //
   _Alignas(16) u8 xmm[16][16];           // 128-BIT VECTOR REGISTER FILE
   struct XedDecodedInst *xedd;           // ->opcache->icache if non-jit
+  struct OpCache *opcache;               // mapped apart so it's lazy
   i64 readaddr;                          // so tui can show memory reads
   i64 writeaddr;                         // so tui can show memory write
   i64 readsize;                          // bytes length of last read op
@@ -398,23 +559,45 @@ struct Machine {                         //
   };                                     //
   struct MachineFpu fpu;                 // FLOATING-POINT REGISTER FILE
   u32 mxcsr;                             // SIMD status control register
+  u64 xcr0;                              // xsave feature enabled mask
+  _Alignas(16) u8 ymmh[16][16];          // UPPER HALVES OF YMM REGISTERS
   pthread_t thread;                      // POSIX thread of this machine
+  int hosttid;                           // its host tid, or 0 if main
   struct FreeList freelist;              // to make system calls simpler
   struct PageLocks pagelocks;            // track page table entry locks
   struct JitPath path;                   // under construction jit route
+  i64 faultpc;                           // op that halted a path being made
+  struct ShadowStack shadow;             // predicts where jit rets go
+  bool mispredicted;                     // btc entry wanted for m->ip
   _Atomicish(u64) signals;               // [attention] pending delivery
   _Atomicish(u64) sigmask;               // signals that've been blocked
+  u64 hostjobsigs;                       // sigmask bits blocked on host too
   i64 bofram[2];                         // helps debug bootloading code
   i64 faultaddr;                         // used for tui error reporting
   struct System *system;                 //
   int sigdepth;                          //
   int sysdepth;                          //
   _Atomic(bool) killed;                  // [attention] slay this thread
-  _Atomic(bool) invalidated;             // the tlb must be flushed
+  _Atomic(bool) publish;                 // [attention] flush stats to totals
+  _Atomic(bool) profile;                 // [attention] take profile sample
+  _Atomic(long) instructions;            // reported by BLINK_METRICS
+  struct BtraceRing *btrace;             // system calls for BLINK_BTRACE
+  struct FlightRing *flight;             // paths entered for BLINK_FLIGHT
+  struct EtraceRing *etrace;             // paths entered for BLINK_ETRACE
+  struct CoverageBlock *coverblock;      // last block BLINK_COVERAGE saw
+  i64 nativeret;                         // caller of hooked ifunc resolver
+  u64 spinstamp;                         // when SpinPause() last yielded
+  u32 spins;                             // pauses since last yield
+  u32 spinyields;                        // yields in current spin burst
+  _Atomic(struct Futex *) futex;         // non-null if blocked in futex
+  _Atomic(bool) invalidated;             // tlb has pending shootdowns
   bool restored;                         // [attention] rt_sigreturn()'d
   bool selfmodifying;                    // [attention] need usmc restore
   bool reserving;                        //
-  bool insyscall;                        //
+  _Atomic(bool) insyscall;               // read by the BLINK_RECLAIM thread
+  bool parked;                           // [machines_lock] in ParkMachine()
+  bool idle;                             // [machines_lock] in thread pool
+  bool pooled;                           // host thread may be recycled
   bool nofault;                          //
   bool canhalt;                          //
   bool metal;                            //
@@ -425,8 +608,12 @@ struct Machine {                         //
   bool boop;                             //
   i8 trapno;                             //
   i8 segvcode;                           //
-  struct MachineTlb tlb[32];             //
-  sigjmp_buf onhalt;                     //
+  struct MachineTlb tlb[kTlbSets][kTlbWays];  // way 0 is mru
+  struct MachineTlb pde;                 // last 2mb page table walked
+  struct TlbShootdowns shootdowns;       //
+  sigjmp_buf onhalt;                     // doesn't save the signal mask
+  sigset_t runmask;                      // host signal mask of guest code
+  bool softhalt;                         // HaltMachine() outside handler
   struct sigaltstack_linux sigaltstack;  //
   i64 robust_list;                       //
   i64 ctid;                              //
@@ -434,7 +621,7 @@ struct Machine {                         //
   sigset_t spawn_sigmask;                //
   struct Dll elem;                       //
   struct SmcQueue smcqueue;              //
-  struct OpCache opcache[1];             //
+  struct BranchTarget btc[kBranchCache]; // jit indirect branch targets
 };                                       //
 
 extern _Thread_local siginfo_t g_siginfo;
@@ -450,30 +637,48 @@ struct Machine *NewMachine(struct System *, struct Machine *);
 i64 AreAllPagesUnlocked(struct System *) nosideeffect;
 bool IsOrphan(struct Machine *) nosideeffect;
 _Noreturn void Blink(struct Machine *);
+void SyncRounding(struct Machine *);
 _Noreturn void Actor(struct Machine *);
 void Jitter(P, const char *, ...);
+bool JitAluRegs(P, int, int, int, i64);
+void ResetJitRegs(struct Machine *);
+void FlushJitRegs(struct Machine *);
+void ForgetJitRegs(struct Machine *);
 void FreeMachine(struct Machine *);
+bool RecycleMachine(struct Machine *);
+struct Machine *ReuseMachine(struct System *, struct Machine *);
+void WakeMachine(struct Machine *);
 void InvalidateSystem(struct System *, bool, bool);
+void InvalidateSystemRange(struct System *, i64, i64, bool);
 void RemoveOtherThreads(struct System *);
 void KillOtherThreads(struct System *);
+void ParkMachine(struct Machine *);
 void ResetCpu(struct Machine *);
 void ResetTlb(struct Machine *);
-void CollectGarbage(struct Machine *, size_t);
+void CollectGarbage(struct Machine *, const struct GarbageMark *);
+void MarkGarbage(struct Machine *, struct GarbageMark *);
 void ResetInstructionCache(struct Machine *);
 nexgen32e_f GetOp(long);
+nexgen32e_f GetVexOp(long);
 void LoadInstruction(struct Machine *, u64);
 int LoadInstruction2(struct Machine *, u64);
+bool IsOpcodeEqual(struct XedDecodedInst *, u8 *);
+struct DecodedBlock *LoadDecodedBlock(struct Machine *, u64, u8 **);
 void ExecuteInstruction(struct Machine *);
 u64 AllocatePageTable(struct System *);
 u64 AllocateAnonymousPage(struct System *);
+u64 CommitReservedPage(struct System *, u8 *, u64);
+u64 MaterializeLazyChunk(struct System *, u8 *, u64);
 void FreeAnonymousPage(struct System *, u8 *);
+void FlushPageCache(void);
+long CompressColdPages(struct System *);
 u64 FindPageTableEntry(struct Machine *, u64);
 bool CheckMemoryInvariants(struct System *) nosideeffect dontdiscard;
 i64 ReserveVirtual(struct System *, i64, i64, u64, int, i64, bool, bool);
 char *FormatPml4t(struct Machine *);
 i64 FindVirtual(struct System *, i64, i64);
 int FreeVirtual(struct System *, i64, i64);
-void CleanseMemory(struct System *, size_t);
+i64 RemapVirtual(struct System *, i64, i64, i64, i64, bool);
 void LoadArgv(struct Machine *, char *, char *, char **, char **, u8[16]);
 _Noreturn void HaltMachine(struct Machine *, int);
 _Noreturn void RaiseDivideError(struct Machine *);
@@ -481,12 +686,14 @@ _Noreturn void ThrowSegmentationFault(struct Machine *, i64);
 _Noreturn void ThrowProtectionFault(struct Machine *);
 _Noreturn void OpUdImpl(struct Machine *);
 _Noreturn void OpUd(P);
+void OpVdsoCall(P);
 void OpHlt(P);
 void JitlessDispatch(P);
 void RestoreIp(struct Machine *);
 void CheckForSignals(struct Machine *);
 void UnlockRobustFutexes(struct Machine *);
 void *AddToFreeList(struct Machine *, void *);
+void *AllocateScratch(struct Machine *, size_t);
 
 bool IsValidAddrSize(i64, i64) pureconst;
 char **CopyStrList(struct Machine *, i64);
@@ -528,35 +735,62 @@ void ResetRam(struct Machine *);
 void SetReadAddr(struct Machine *, i64, u32);
 void SetWriteAddr(struct Machine *, i64, u32);
 int SyncVirtual(struct System *, i64, i64, int);
+int DiscardVirtual(struct System *, i64, i64);
 int ProtectVirtual(struct System *, i64, i64, int, bool);
 bool IsFullyMapped(struct System *, i64, i64);
+void GetPageTableEntries(struct System *, i64, long, u64 *);
+void GetResidentPages(struct System *, i64, long, const u64 *, u8 *);
+#ifndef DISABLE_VFS
+bool MarkPageDirty(struct System *, i64);
+void ClearSoftDirty(struct System *);
+bool IsSoftDirtySegfault(struct Machine *, const siginfo_t *);
+#endif
+void PopulateVirtual(struct System *, i64, i64, bool);
 bool IsFullyUnmapped(struct System *, i64, i64);
+bool IsSharedMemory(struct System *, i64);
 int GetProtection(u64);
 u64 SetProtection(int);
 int ClassifyOp(u64) pureconst;
 void Terminate(P, void (*)(struct Machine *, u64));
+long GetRss(struct System *);
 long GetMaxRss(struct System *);
 long GetMaxVss(struct System *);
 
 void FlushSmcQueue(struct Machine *);
 bool IsPageInSmcQueue(struct Machine *, i64);
+bool IsSmcPageUnwatched(struct System *, i64);
+bool IsVolatileCodePage(struct Machine *, i64);
 void AddPageToSmcQueue(struct Machine *, i64);
 i64 ProtectRwxMemory(struct System *, i64, i64, i64, long, int);
 void HandleFatalSystemSignal(struct Machine *, const siginfo_t *);
 bool IsSelfModifyingCodeSegfault(struct Machine *, const siginfo_t *);
+void ReadJitCacheFile(struct Machine *);
+void WriteJitCacheFile(struct Machine *);
+uintptr_t RestoreCachedJitPath(struct Machine *);
 
 int FixXnuSignal(struct Machine *, int, siginfo_t *);
 int FixPpcSignal(struct Machine *, int, siginfo_t *);
 
-void CountOp(long *);
+void CountOp(long);
+void CountHelperOp(long);
+u32 CountPath(u32 *);
 void FastPush(struct Machine *, long);
 void FastPop(struct Machine *, long);
+void FastPushAt(struct Machine *, long, long);
+void FastPopAt(struct Machine *, long, long);
+void FastAddSp(struct Machine *, long);
 void FastCall(struct Machine *, u64);
 void FastCallAbs(u64, struct Machine *);
 void FastJmp(struct Machine *, u64);
 void FastJmpAbs(u64, struct Machine *);
+u64 FastLoadGot(struct Machine *, i64);
+u32 CanLoop(struct Machine *, u64);
+u32 CanResume(struct Machine *, u64, u64);
 void FastLeave(struct Machine *);
 i64 PredictRet(struct Machine *, i64);
+i64 PredictJmp(struct Machine *, i64);
+uintptr_t LookupJmp(struct Machine *);
+uintptr_t LookupRet(struct Machine *);
 
 typedef void (*putreg64_f)(u64, struct Machine *);
 extern const putreg64_f kPutReg64[16];
@@ -592,6 +826,7 @@ void OpCallfEq(P);
 void OpCmpxchgEbAlGb(P);
 void OpCmpxchgEvqpRaxGvqp(P);
 void OpCpuid(P);
+bool SetCpuProfile(const char *);
 void OpCvt0f2a(P);
 void OpCvt0f2d(P);
 void OpCvt0f5a(P);
@@ -631,6 +866,10 @@ void OpRet(P);
 void OpRetf(P);
 void OpRetIw(P);
 void OpSsePclmulqdq(P);
+void OpAes(P);
+void OpAeskeygenassist(P);
+void OpSha38(P);
+void OpSha1rnds4(P);
 void OpXaddEbGb(P);
 void OpXaddEvqpGvqp(P);
 void OpXchgGbEb(P);
@@ -730,15 +969,27 @@ void OpPushSeg(P);
 void OpPopSeg(P);
 
 extern void (*AddPath_StartOp_Hook)(P);
+extern bool (*IsAtBreakpoint_Hook)(i64);
+extern void (*SetWriteAddr_Hook)(struct Machine *, i64, u32);
 
 bool AddPath(P);
+bool JitSseOp(P);
+bool JitSseCvt(P);
+bool HasHostClmul(void);
 void FlushSkew(P);
 bool CreatePath(P);
 void CompletePath(P);
+void CompleteSyscallPath(P);
+void AppendColdPaths(struct Machine *);
 void AddPath_EndOp(P);
 bool FuseBranchTest(P);
+bool FuseStackOps(P, bool);
+void CoverPathBytes(struct Machine *, i64, long);
 void AddPath_StartOp(P);
+bool FollowPath(P, u64);
+void EndJitSkip(P, long);
 void Connect(P, u64, bool);
+long BeginJitSkip(P, void *);
 long GetPrologueSize(void);
 bool FuseBranchCmp(P, bool);
 i64 GetIp(struct Machine *);
@@ -764,6 +1015,9 @@ u32 JustMul32(u32, u32, struct Machine *);
 u64 JustMul64(u64, u64, struct Machine *);
 void MulAxDx(u64, struct Machine *);
 void JustMulAxDx(u64, struct Machine *);
+void ImulAxDx(u64, struct Machine *);
+void MulEaxEdx(u64, struct Machine *);
+void ImulEaxEdx(u64, struct Machine *);
 
 void OpPsdMuls1(u8 *, struct Machine *, long);
 void OpPsdAdds1(u8 *, struct Machine *, long);
@@ -809,6 +1063,14 @@ MICRO_OP_SAFE u8 Cpl(struct Machine *m) {
   return m->mode.genmode != XED_GEN_MODE_REAL ? (m->cs.sel & 3u) : 0u;
 }
 
+MICRO_OP_SAFE void PushShadow(struct Machine *m, u64 pc) {
+  m->shadow.pc[m->shadow.i++ & (kShadowFrames - 1)] = pc;
+}
+
+MICRO_OP_SAFE struct BranchTarget *GetBranchTarget(struct Machine *m, u64 pc) {
+  return m->btc + ((pc ^ pc >> 9) & (kBranchCache - 1));
+}
+
 #define BEGIN_NO_PAGE_FAULTS \
   {                          \
     bool nofault_;           \
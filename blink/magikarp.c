@@ -16,9 +16,9 @@
 │ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
 │ PERFORMANCE OF THIS SOFTWARE.                                                │
 ╚─────────────────────────────────────────────────────────────────────────────*/
-#include <stdlib.h>
 #include <string.h>
 
+#include "blink/intrin.h"
 #include "blink/macros.h"
 #include "blink/types.h"
 #include "blink/util.h"
@@ -55,49 +55,59 @@
  * @return new length of array
  */
 long Magikarp(u8 *p, long n) {
-  u8 *q;
-  long h, i;
+  long h, i, j, k, b;
+  short e[256 + 4], o[256 + 4];
   if (n < 2) return n;
-  q = (u8 *)malloc(3 + n + 4);
-  q[0] = p[0];
-  q[1] = p[0];
-  q[2] = p[0];
-  memcpy(q + 3, p, n);
-  q[3 + n + 0] = p[n - 1];
-  q[3 + n + 1] = p[n - 1];
-  q[3 + n + 2] = p[n - 1];
-  q[3 + n + 3] = p[n - 1];
-  q += 3;
   h = (n + 1) >> 1;
-  for (i = 0; i < h; ++i) {
-    short x0, x1, x2, x3, x4, x5, x6, x7;
-    x0 = q[i * 2 - 3];
-    x1 = q[i * 2 - 2];
-    x2 = q[i * 2 - 1];
-    x3 = q[i * 2 + 0];
-    x4 = q[i * 2 + 1];
-    x5 = q[i * 2 + 2];
-    x6 = q[i * 2 + 3];
-    x7 = q[i * 2 + 4];
-    x0 *= -1;
-    x1 *= -3;
-    x2 *= +3;
-    x3 *= 17;
-    x4 *= 17;
-    x5 *= +3;
-    x6 *= -3;
-    x7 *= -1;
-    x0 += x1;
-    x2 += x3;
-    x4 += x5;
-    x6 += x7;
-    x0 += x2;
-    x4 += x6;
-    x0 += x4;
-    x0 += 1 << 4;
-    x0 >>= 5;
-    p[i] = MIN(255, MAX(0, x0));
+  // we work on blocks of outputs, splitting the bytes they need into
+  // even and odd lanes, so that the eight kernel taps become shifted
+  // streams of shorts that can be multiplied lane by lane. output i of
+  // a block reads e[i+1..i+4] and o[i..i+3] so both get padded by four
+  // and since it only reads bytes at 2i-3 or later, writing outputs in
+  // place won't clobber anything the next block needs to read
+  for (b = 0; b < h; b += 256) {
+    k = MIN(256, h - b);
+    if (2 * b - 4 >= 0 && 2 * (b + k + 3) - 3 < n) {
+      for (i = 0; i < k + 4; ++i) {
+        e[i] = p[(b + i) * 2 - 4];
+        o[i] = p[(b + i) * 2 - 3];
+      }
+    } else {
+      for (i = 0; i < k + 4; ++i) {
+        e[i] = p[MIN(n - 1, MAX(0, (b + i) * 2 - 4))];
+        o[i] = p[MIN(n - 1, MAX(0, (b + i) * 2 - 3))];
+      }
+    }
+    i = 0;
+#if VECTOR_EXTENSIONS
+    for (; i + 8 <= k; i += 8) {
+      i16x8_t x0, x1, x2, x3, x4, x5, x6, x7;
+      memcpy(&x0, o + i + 0, 16);
+      memcpy(&x1, e + i + 1, 16);
+      memcpy(&x2, o + i + 1, 16);
+      memcpy(&x3, e + i + 2, 16);
+      memcpy(&x4, o + i + 2, 16);
+      memcpy(&x5, e + i + 3, 16);
+      memcpy(&x6, o + i + 3, 16);
+      memcpy(&x7, e + i + 4, 16);
+      x0 = -x0 - x1 * 3 + x2 * 3 + x3 * 17 + x4 * 17 + x5 * 3 - x6 * 3 - x7;
+      x0 = (x0 + (1 << 4)) >> 5;
+      x0 &= ~(x0 >> 15);      // clamp negative lanes to zero
+      x1 = (255 - x0) >> 15;  // lanes above 255 become all ones
+      x0 = (x0 & ~x1) | (x1 & 255);
+      for (j = 0; j < 8; ++j) {
+        p[b + i + j] = x0[j];
+      }
+    }
+#endif
+    for (; i < k; ++i) {
+      short x0;
+      x0 = -o[i] - 3 * e[i + 1] + 3 * o[i + 1] + 17 * e[i + 2] +
+           17 * o[i + 2] + 3 * e[i + 3] - 3 * o[i + 3] - e[i + 4];
+      x0 += 1 << 4;
+      x0 >>= 5;
+      p[b + i] = MIN(255, MAX(0, x0));
+    }
   }
-  free(q - 3);
   return h;
 }
@@ -119,15 +119,28 @@ static u64 GetVirtualAddressSpace(int vabits, long pagesize) {
   return vaspace;
 }
 
-static u64 ScaleAddress(u64 address) {
-  long pagesize;
-  u64 result, vaspace;
-  vaspace = FLAG_vaspace;
-  pagesize = FLAG_pagesize;
-  result = address;
-  do result &= ~(pagesize - 1);
-  while ((result & ~vaspace) && (result >>= 1));
-  return result;
+static u64 ScaleAddress(u64 address, int shift) {
+  return (address >> shift) & ~(FLAG_pagesize - 1);
+}
+
+// shrinks the guest memory layout to fit the virtual address space. the
+// whole layout is scaled by the same power of two so that regions keep
+// their order and don't overlap, e.g. aarch64 with 39-bit addresses has
+// everything shifted right by eight. in linear mode the top of the stack
+// plus the skew, and some room for the vdso, must fit in the host space
+static void InitLayout(void) {
+  int shift;
+  u64 skew = FLAG_shadow ? 0 : kSkew;
+  for (shift = 0;
+       (kStackTop >> shift) + skew + kHugeSize > FLAG_vaspace && shift < 16;
+       ++shift) {
+  }
+  FLAG_aslrmask = ScaleAddress(kAslrMask, shift);
+  FLAG_imagestart = ScaleAddress(kImageStart, shift);
+  FLAG_automapstart = ScaleAddress(kAutomapStart, shift);
+  FLAG_automapend = ScaleAddress(kAutomapEnd, shift);
+  FLAG_dyninterpaddr = ScaleAddress(kDynInterpAddr, shift);
+  FLAG_stacktop = ScaleAddress(kStackTop, shift);
 }
 
 // if the guest used mmap(0, ...) to let blink decide the address,
@@ -138,12 +151,29 @@ void InitMap(void) {
   FLAG_pagesize = GetSystemPageSize();
   FLAG_vabits = GetBitsInAddressSpace();
   FLAG_vaspace = GetVirtualAddressSpace(FLAG_vabits, FLAG_pagesize);
-  FLAG_aslrmask = ScaleAddress(kAslrMask);
-  FLAG_imagestart = ScaleAddress(kImageStart);
-  FLAG_automapstart = ScaleAddress(kAutomapStart);
-  FLAG_automapend = ScaleAddress(kAutomapEnd);
-  FLAG_dyninterpaddr = ScaleAddress(kDynInterpAddr);
-  FLAG_stacktop = ScaleAddress(kStackTop);
+  InitLayout();
+}
+
+// reserves the host interval holding guest memory in shadow mode. the
+// guest address space shrinks to whatever power of two we could get,
+// and we ask for it at a predictable address, so jit cache files work
+bool InitShadow(void) {
+  int bits;
+  u64 size;
+  void *want, *got;
+  for (bits = MIN(kShadowMax, FLAG_vabits - 1); bits >= kShadowMin; --bits) {
+    size = (u64)1 << bits;
+    want = (void *)(uintptr_t)(size >> 2);
+    got = PortableMmap(want, size + kShadowPad, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS_ | MAP_NORESERVE, -1, 0);
+    if (got == MAP_FAILED) continue;
+    FLAG_skew = (uintptr_t)got;
+    FLAG_shadowsize = size;
+    FLAG_vaspace = GetVirtualAddressSpace(bits, FLAG_pagesize);
+    InitLayout();
+    return true;
+  }
+  return false;
 }
 
 void *Mmap(void *addr,     //
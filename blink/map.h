@@ -1,6 +1,7 @@
 #ifndef BLINK_MAP_H_
 #define BLINK_MAP_H_
 #include <errno.h>
+#include <stdbool.h>
 #include <sys/mman.h>
 
 #include "blink/builtin.h"
@@ -52,6 +53,7 @@
 #define _COMM_PAGE_APRR_WRITE_DISABLE (_COMM_PAGE_START_ADDRESS + 0x118)
 
 void InitMap(void);
+bool InitShadow(void);
 int Munmap(void *, size_t);
 int Msync(void *, size_t, int, const char *);
 void *Mmap(void *, size_t, int, int, int, off_t, const char *);
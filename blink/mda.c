@@ -49,11 +49,19 @@ static u8 DecodeMdaAttributes(i8 a) {
 }
 
 void DrawMda(struct Panel *p, u8 v[25][80][2], int curx, int cury) {
+  static struct PanelRowCache cache[25];
   wint_t wch = 0;
-  unsigned y, x, n, a, b, ch, attr;
+  unsigned y, x, n, a, b, ch, attr, start;
+  int cx;
   n = MIN(25, p->bottom - p->top);
   for (y = 0; y < n; ++y) {
     a = -1;
+    cx = !BdaCurhidden && (int)y == cury ? curx : -1;
+    if (AppendCachedPanelRow(cache + y, &p->lines[y], cx, v[y],
+                             sizeof(v[y]))) {
+      continue;
+    }
+    start = p->lines[y].i;
     for (x = 0; x < 80; ++x) {
       ch = v[y][x][0];
       attr = v[y][x][1];
@@ -81,5 +89,6 @@ void DrawMda(struct Panel *p, u8 v[25][80][2], int curx, int cury) {
       }
       AppendWide(&p->lines[y], wch);
     }
+    CachePanelRow(cache + y, &p->lines[y], start, cx, v[y], sizeof(v[y]));
   }
 }
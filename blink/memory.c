@@ -29,11 +29,13 @@
 #include "blink/debug.h"
 #include "blink/endian.h"
 #include "blink/errno.h"
+#include "blink/flag.h"
 #include "blink/linux.h"
 #include "blink/log.h"
 #include "blink/machine.h"
 #include "blink/macros.h"
 #include "blink/pml4t.h"
+#include "blink/spin.h"
 #include "blink/stats.h"
 #include "blink/thread.h"
 #include "blink/util.h"
@@ -46,8 +48,13 @@ void SetReadAddr(struct Machine *m, i64 addr, u32 size) {
   }
 }
 
+void (*SetWriteAddr_Hook)(struct Machine *, i64, u32);
+
 void SetWriteAddr(struct Machine *m, i64 addr, u32 size) {
   if (size) {
+    if (SetWriteAddr_Hook) {
+      SetWriteAddr_Hook(m, addr, size);
+    }
     m->writeaddr = addr;
     m->writesize = size;
   }
@@ -68,8 +75,30 @@ u8 *GetPageAddress(struct System *s, u64 entry, bool is_cr3) {
   }
 }
 
+// commits the other reserved pages near a faulting page, up to the
+// fault around window, since programs usually touch memory in order
+static void FaultAround(struct System *s, u8 *pslot) {
+  u8 *pt, *mi;
+  u64 entry;
+  long i, n, ti;
+  n = kFaultAround / 4096;
+  ti = (((uintptr_t)pslot & 4095) / 8) & -n;
+  pt = (u8 *)((uintptr_t)pslot & -4096);
+  for (i = 0; i < n; ++i) {
+    mi = pt + (ti + i) * 8;
+    if (mi == pslot) continue;
+    entry = LoadPte(mi);
+    if ((entry & (PAGE_V | PAGE_U | PAGE_RSRV | PAGE_ZIP | PAGE_LOCKS)) !=
+        (PAGE_V | PAGE_U | PAGE_RSRV)) {
+      continue;
+    }
+    if (GetRss(s) >= GetMaxRss(s)) break;
+    if (!CommitReservedPage(s, mi, entry)) break;
+    STATISTIC(++page_faults_around);
+  }
+}
+
 u64 HandlePageFault(struct Machine *m, u8 *pslot, u64 entry) {
-  u64 x, page;
   unassert(entry & PAGE_RSRV);
   unassert(!HasLinearMapping());
   if (m->nofault) {
@@ -77,44 +106,22 @@ u64 HandlePageFault(struct Machine *m, u8 *pslot, u64 entry) {
     errno = ENOBUFS;
     return 0;
   }
-  do {
-    if (entry & (PAGE_HOST | PAGE_MAP | PAGE_MUG)) {
-      // a file-mapped page is being accessed for the first time
-      unassert((entry & (PAGE_HOST | PAGE_MAP)) == (PAGE_HOST | PAGE_MAP));
-      x = entry & ~PAGE_RSRV;
-      if (CasPte(pslot, entry, x)) {
-        m->system->memstat.committed += 1;
-        m->system->memstat.reserved -= 1;
-        m->system->rss += 1;
-        entry = x;
-      } else {
-        entry = LoadPte(pslot);
-      }
-    } else {
-      // an anonymous page is being accessed for the first time
-      if ((page = AllocateAnonymousPage(m->system)) == -1) {
-        m->segvcode = SEGV_MAPERR_LINUX;
-        entry = 0;
-        break;
-      }
-      x = (page & (PAGE_TA | PAGE_HOST)) | (entry & ~(PAGE_TA | PAGE_RSRV));
-      if (CasPte(pslot, entry, x)) {
-        m->system->memstat.committed += 1;
-        m->system->memstat.reserved -= 1;
-        entry = x;
-      } else {
-        FreeAnonymousPage(m->system, (u8 *)(uintptr_t)(page & PAGE_TA));
-        entry = LoadPte(pslot);
-        m->system->rss -= 1;
-      }
-    }
-  } while (entry & PAGE_RSRV);
+  if (!(entry = CommitReservedPage(m->system, pslot, entry))) {
+    m->segvcode = SEGV_MAPERR_LINUX;
+    return 0;
+  }
+  FaultAround(m->system, pslot);
   return entry;
 }
 
 bool HasPageLock(const struct Machine *m, i64 page) {
   int i;
   unassert(!(page & 4095));
+  // buffers are usually locked from the lowest page to the highest one
+  // so checking the bounds first avoids scanning locks quadratic times
+  if (!m->pagelocks.i || page < m->pagelocks.lo || page > m->pagelocks.hi) {
+    return false;
+  }
   for (i = m->pagelocks.i; i--;) {
     if (m->pagelocks.p[i].page == page) {
       return true;
@@ -141,6 +148,13 @@ static bool RecordPageLock(struct Machine *m, i64 page, u8 *pslot) {
       return false;
     }
   }
+  if (!m->pagelocks.i) {
+    m->pagelocks.lo = page;
+    m->pagelocks.hi = page;
+  } else {
+    m->pagelocks.lo = MIN(m->pagelocks.lo, page);
+    m->pagelocks.hi = MAX(m->pagelocks.hi, page);
+  }
   m->pagelocks.p[m->pagelocks.i].page = page;
   m->pagelocks.p[m->pagelocks.i].pslot = pslot;
   m->pagelocks.p[m->pagelocks.i].sysdepth = m->sysdepth;
@@ -163,13 +177,109 @@ static bool HasOutdatedPageLocks(struct Machine *m) {
          m->pagelocks.p[m->pagelocks.i - 1].sysdepth > m->sysdepth;
 }
 
+// releases page locks taken by system calls that've since returned.
+// this happens after nearly every system call of a threaded guest, so
+// the system-wide pagelocks_lock is only taken if some thread (e.g. a
+// munmap() in progress) is actually waiting for one of them to unlock
 void CollectPageLocks(struct Machine *m) {
+  struct System *s;
   if (HasOutdatedPageLocks(m)) {
-    LOCK(&m->system->pagelocks_lock);
+    s = m->system;
     do ReleasePageLock(m->pagelocks.p[--m->pagelocks.i].pslot);
     while (HasOutdatedPageLocks(m));
-    unassert(!pthread_cond_broadcast(&m->system->pagelocks_cond));
-    UNLOCK(&m->system->pagelocks_lock);
+#ifdef HAVE_THREADS
+    // pairs with WaitForPageToNotBeLocked(): either we see its waiter
+    // count, or it sees the page table entries we've just released
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&s->pagelocks_waiters, memory_order_relaxed)) {
+      LOCK(&s->pagelocks_lock);
+      unassert(!pthread_cond_broadcast(&s->pagelocks_cond));
+      UNLOCK(&s->pagelocks_lock);
+    }
+#else
+    (void)s;
+#endif
+  }
+}
+
+// when there's only one thread, nothing can munmap() memory out from
+// under a system call, so its pages needn't be locked, and the tlb may
+// be used. clone() updates this before a new thread is able to run. the
+// reclaimer is like another thread, that doesn't touch locked pages.
+static bool ShouldLockPages(struct Machine *m) {
+  return m->insyscall && !m->nofault &&
+         (FLAG_reclaim || !atomic_load_explicit(&m->system->singlethreaded,
+                                                memory_order_acquire));
+}
+
+static struct MachineTlb *GetTlbSet(struct Machine *m, u64 page) {
+  return m->tlb[(page >> 12) & (kTlbSets - 1)];
+}
+
+static void EvictTlbEntry(struct MachineTlb *set, int way) {
+  memmove(set + way, set + way + 1, (kTlbWays - 1 - way) * sizeof(*set));
+  memset(set + kTlbWays - 1, 0, sizeof(*set));
+}
+
+static void ShootdownTlbRange(struct Machine *m, i64 virt, i64 size) {
+  int i, way;
+  i64 page, end;
+  struct MachineTlb *set;
+  STATISTIC(++tlb_shootdowns);
+  end = virt + size;
+  if (m->pde.page >= (virt & -0x200000) && m->pde.page < end) {
+    memset(&m->pde, 0, sizeof(m->pde));
+  }
+  if (m->opcache->codevirt >= (u64)virt && m->opcache->codevirt < (u64)end) {
+    m->opcache->codevirt = 0;
+    m->opcache->codehost = 0;
+  }
+  if (size / 4096 <= kTlbSets) {
+    // small ranges probe the one set each page could live in
+    for (page = virt; page < end; page += 4096) {
+      set = GetTlbSet(m, page);
+      for (way = 0; way < kTlbWays; ++way) {
+        if (set[way].page == page && (set[way].entry & PAGE_V)) {
+          EvictTlbEntry(set, way);
+          break;
+        }
+      }
+    }
+  } else {
+    // big ranges are cheaper to check against each entry we hold
+    for (i = 0; i < kTlbSets; ++i) {
+      set = m->tlb[i];
+      for (way = 0; way < kTlbWays;) {
+        if ((set[way].entry & PAGE_V) &&  //
+            virt <= set[way].page && set[way].page < end) {
+          EvictTlbEntry(set, way);
+        } else {
+          ++way;
+        }
+      }
+    }
+  }
+}
+
+// applies the shootdowns other threads have queued for this machine
+static void ApplyTlbShootdowns(struct Machine *m) {
+  int i, n;
+  bool flush;
+  struct TlbRange r[kTlbQueueSize];
+  SpinLock(&m->shootdowns.lock);
+  flush = m->shootdowns.flush;
+  n = m->shootdowns.n;
+  memcpy(r, m->shootdowns.r, n * sizeof(*r));
+  m->shootdowns.flush = false;
+  m->shootdowns.n = 0;
+  atomic_store_explicit(&m->invalidated, false, memory_order_relaxed);
+  SpinUnlock(&m->shootdowns.lock);
+  if (flush) {
+    ResetTlb(m);
+  } else {
+    for (i = 0; i < n; ++i) {
+      ShootdownTlbRange(m, r[i].virt, r[i].size);
+    }
   }
 }
 
@@ -179,20 +289,30 @@ void CollectPageLocks(struct Machine *m) {
 // @raise ENOMEM if memory couldn't be allocated internally
 // @raise EAGAIN if too many locks are held on a page
 u64 FindPageTableEntry(struct Machine *m, u64 page) {
+  int way;
   u8 *pslot;
   i64 table;
   u64 entry;
-  long tlbkey;
   unsigned level, index;
+  struct MachineTlb *set, hit;
   if (atomic_load_explicit(&m->invalidated, memory_order_acquire)) {
-    ResetTlb(m);
-    atomic_store_explicit(&m->invalidated, false, memory_order_relaxed);
-  }
-  tlbkey = (page >> 12) & (ARRAYLEN(m->tlb) - 1);
-  if (m->tlb[tlbkey].page == page &&
-      ((entry = m->tlb[tlbkey].entry) & PAGE_V)) {
-    STATISTIC(++tlb_hits);
-    return entry;
+    ApplyTlbShootdowns(m);
+  }
+  set = GetTlbSet(m, page);
+  // system calls lock the pages they access, so they can't be allowed
+  // to take the tlb shortcut, since cached entries weren't locked yet
+  if (!ShouldLockPages(m)) {
+    for (way = 0; way < kTlbWays; ++way) {
+      if (set[way].page == page && ((entry = set[way].entry) & PAGE_V)) {
+        if (way) {
+          hit = set[way];
+          memmove(set + 1, set, way * sizeof(*set));
+          set[0] = hit;
+        }
+        STATISTIC(++tlb_hits);
+        return entry;
+      }
+    }
   }
   STATISTIC(++tlb_misses);
   unassert(!(page & 4095));
@@ -202,36 +322,64 @@ u64 FindPageTableEntry(struct Machine *m, u64 page) {
   }
 TryAgain:
   unassert((entry = m->system->cr3));
+  if (m->pde.entry && m->pde.page == (i64)(page & -0x200000)) {
+    // the page table for this 2mb region was found by an earlier walk,
+    // so it's only necessary to look at the last level. the linux mode
+    // mappers shoot down the region before freeing its page table
+    STATISTIC(++tlb_walks_shortened);
+    pslot = (u8 *)(uintptr_t)m->pde.entry + ((page >> 12) & 511) * 8;
+    entry = LoadPte(pslot);
+    if (!(entry & PAGE_V)) goto MapError;
+    goto FoundEntry;
+  }
   level = 39;
   do {
     table = entry;
     index = (page >> level) & 511;
     pslot = GetPageAddress(m->system, table, level == 39) + index * 8;
     if (!pslot) goto MapError;
+    if (level == 12 && !m->metal) {
+      m->pde.page = page & -0x200000;
+      m->pde.entry = (uintptr_t)(pslot - index * 8);
+    }
     entry = LoadPte(pslot);
     if (!(entry & PAGE_V)) goto MapError;
+    if (level == 21 && !m->metal && IsLazyChunk(entry)) {
+      // lazily reserved memory is being touched for the first time
+      if (MaterializeLazyChunk(m->system, pslot, entry) == -1) {
+        m->segvcode = SEGV_MAPERR_LINUX;
+        return 0;
+      }
+      goto TryAgain;
+    }
     if (m->metal) {
       entry &= ~(u64)(PAGE_RSRV | PAGE_HOST | PAGE_MAP | PAGE_GROW | PAGE_MUG |
-                      PAGE_FILE);
+                      PAGE_FILE | PAGE_SHARE);
     }
     if ((entry & PAGE_PS) && level > 12) {
       // huge (1 GiB or 2 MiB) page; "rewrite" the TLB copy of the page table
       // entry, to point to the 4 KiB subpage being accessed
-      // TODO: if partial TLB flushes are implemented in the future, we will
-      // also need to somehow record the original huge page size in the TLB,
-      // so we can correctly invalidate all TLB entries for the huge page
+      // partial tlb shootdowns are only issued by the linux mode mappers,
+      // which never create huge pages, whereas invlpg flushes everything
       u64 submask = ((u64)1 << level) - 4096;
       entry &= ~submask;
       entry |= page & submask;
       break;
     }
   } while ((level -= 9) >= 12);
+FoundEntry:
   if ((entry & PAGE_RSRV) && !(entry = HandlePageFault(m, pslot, entry))) {
     return 0;
   }
+  // the reclaimer compresses pages that no thread has walked to since
+  // it last looked, so the page is marked before it's able to be used
+  if (FLAG_reclaim && !(entry & PAGE_A) && !m->metal) {
+    if (!CasPte(pslot, entry, entry | PAGE_A)) goto TryAgain;
+    entry |= PAGE_A;
+  }
   // system calls lock the pages they access
   // this prevents race conditions w/ munmap
-  if (m->insyscall && !m->nofault && !HasPageLock(m, page)) {
+  if (ShouldLockPages(m) && !HasPageLock(m, page)) {
     if ((entry & PAGE_LOCKS) < PAGE_LOCKS) {
       if (CasPte(pslot, entry, entry + PAGE_LOCK)) {
         unassert(LoadPte(pslot) & PAGE_LOCKS);
@@ -252,15 +400,34 @@ TryAgain:
       return 0;
     }
   }
-  m->tlb[tlbkey].page = page;
-  m->tlb[tlbkey].entry = entry;
+  for (way = 0; way < kTlbWays - 1; ++way) {
+    if (set[way].page == page) break;
+  }
+  memmove(set + 1, set, way * sizeof(*set));
+  set[0].page = page;
+  set[0].entry = entry;
   return entry;
 MapError:
   m->segvcode = SEGV_MAPERR_LINUX;
   return (uintptr_t)efault0();
 }
 
-u8 *LookupAddress2(struct Machine *m, i64 virt, u64 mask, u64 need) {
+#ifndef DISABLE_VFS
+static void SetTlbDirty(struct Machine *m, i64 page) {
+  int way;
+  struct MachineTlb *set = GetTlbSet(m, page);
+  for (way = 0; way < kTlbWays; ++way) {
+    if (set[way].page == page) {
+      set[way].entry |= PAGE_D;
+    }
+  }
+}
+#endif
+
+// supervisor writes don't ask for PAGE_RW, so callers that are about
+// to write say so explicitly, to let changes to guest code be noticed
+static u8 *LookupAddress3(struct Machine *m, i64 virt, u64 mask, u64 need,
+                          bool writing) {
   u8 *host;
   u64 entry;
   if (m->mode.omode == XED_MODE_LONG ||
@@ -280,10 +447,19 @@ u8 *LookupAddress2(struct Machine *m, i64 virt, u64 mask, u64 need) {
     m->segvcode = SEGV_ACCERR_LINUX;
     return (u8 *)efault0();
   }
+#ifndef DISABLE_VFS
+  if (writing && !(entry & PAGE_D) && !m->metal &&
+      MarkPageDirty(m->system, virt)) {
+    // the first write since soft dirty bits were cleared is noted in
+    // the page table, and the tlb then lets later writes skip this
+    SetTlbDirty(m, virt & -4096);
+  }
+#endif
 #ifndef DISABLE_JIT
-  if ((need & PAGE_RW) &&
-      (entry & (PAGE_U | PAGE_RW | PAGE_XD)) == (PAGE_U | PAGE_RW) &&
-      !IsJitDisabled(&m->system->jit) && !IsPageInSmcQueue(m, virt)) {
+  if (writing && (entry & (PAGE_RW | PAGE_XD)) == PAGE_RW &&
+      ((entry & PAGE_U) || m->metal) &&
+      !IsJitDisabled(&m->system->jit) && !IsPageInSmcQueue(m, virt) &&
+      !IsSmcPageUnwatched(m->system, virt)) {
     AddPageToSmcQueue(m, virt);
   }
 #endif
@@ -295,6 +471,10 @@ u8 *LookupAddress2(struct Machine *m, i64 virt, u64 mask, u64 need) {
   }
 }
 
+u8 *LookupAddress2(struct Machine *m, i64 virt, u64 mask, u64 need) {
+  return LookupAddress3(m, virt, mask, need, !!(need & PAGE_RW));
+}
+
 u8 *LookupAddress(struct Machine *m, i64 virt) {
   u64 need = 0;
   if (Cpl(m) == 3) need = PAGE_U;
@@ -346,11 +526,12 @@ bool IsValidMemory(struct Machine *m, i64 virt, i64 size, int prot) {
 
 int VirtualCopy(struct Machine *m, i64 v, char *r, u64 n, bool d) {
   u8 *p;
-  u64 k;
+  u64 k, need;
+  need = Cpl(m) == 3 ? PAGE_U : 0;
   k = 4096 - (v & 4095);
   while (n) {
     k = MIN(k, n);
-    if (!(p = LookupAddress(m, v))) return -1;
+    if (!(p = LookupAddress3(m, v, need, need, !d))) return -1;
     if (d) {
       memcpy(r, p, k);
     } else if (!IsRomAddress(m, p)) {
@@ -365,7 +546,11 @@ int VirtualCopy(struct Machine *m, i64 v, char *r, u64 n, bool d) {
 }
 
 int CopyFromUser(struct Machine *m, void *dst, i64 src, u64 n) {
-  return VirtualCopy(m, src, (char *)dst, n, true);
+  int rc;
+  u64 t = BeginSyscallOverhead();
+  rc = VirtualCopy(m, src, (char *)dst, n, true);
+  EndSyscallOverhead(t);
+  return rc;
 }
 
 int CopyFromUserRead(struct Machine *m, void *dst, i64 addr, u64 n) {
@@ -375,7 +560,11 @@ int CopyFromUserRead(struct Machine *m, void *dst, i64 addr, u64 n) {
 }
 
 int CopyToUser(struct Machine *m, i64 dst, void *src, u64 n) {
-  return VirtualCopy(m, dst, (char *)src, n, false);
+  int rc;
+  u64 t = BeginSyscallOverhead();
+  rc = VirtualCopy(m, dst, (char *)src, n, false);
+  EndSyscallOverhead(t);
+  return rc;
 }
 
 int CopyToUserWrite(struct Machine *m, i64 addr, void *src, u64 n) {
@@ -392,6 +581,15 @@ void CommitStash(struct Machine *m) {
   m->stashaddr = 0;
 }
 
+// returns true if page straddling access can use host memory directly
+// because the host memory backing the two guest pages is adjacent too,
+// which is usually the case, since memory is allocated in big batches
+static bool IsContiguousRam(struct Machine *m, u8 *a, u8 *b, unsigned k,
+                            bool protect_rom) {
+  return a + k == b &&
+         (!protect_rom || (!IsRomAddress(m, a) && !IsRomAddress(m, b)));
+}
+
 u8 *ReserveAddress(struct Machine *m, i64 v, size_t n, bool writable) {
   long k;
   u64 mask, need;
@@ -418,7 +616,7 @@ u8 *ReserveAddress(struct Machine *m, i64 v, size_t n, bool writable) {
     need = 0;
   }
   if ((v & 4095) + n <= 4096) {
-    if ((res = LookupAddress2(m, v, mask, need))) {
+    if ((res = LookupAddress3(m, v, mask, need, writable))) {
       if (!IsRomAddress(m, res)) return res;
       p1 = res;
       m->stashaddr = v;
@@ -435,13 +633,17 @@ u8 *ReserveAddress(struct Machine *m, i64 v, size_t n, bool writable) {
   }
   STATISTIC(++page_overlaps);
   unassert(n <= 4096);
-  m->stashaddr = v;
-  m->opcache->stashsize = n;
-  m->opcache->writable = writable;
-  res = m->opcache->stash;
   k = 4096 - (v & 4095);
-  if ((p1 = LookupAddress2(m, v, mask, need))) {
-    if ((p2 = LookupAddress2(m, v + k, mask, need))) {
+  if ((p1 = LookupAddress3(m, v, mask, need, writable))) {
+    if ((p2 = LookupAddress3(m, v + k, mask, need, writable))) {
+      if (IsContiguousRam(m, p1, p2, k, writable)) {
+        STATISTIC(++page_overlaps_contiguous);
+        return p1;
+      }
+      m->stashaddr = v;
+      m->opcache->stashsize = n;
+      m->opcache->writable = writable;
+      res = m->opcache->stash;
       IGNORE_RACES_START();
       memcpy(res, p1, k);
       memcpy(res + k, p2, n - k);
@@ -472,6 +674,12 @@ static u8 *AccessRam2(struct Machine *m, i64 v, size_t n, void *p[2], u8 *tmp,
   unassert(k <= 4096);
   a = ResolveAddress(m, v);
   b = ResolveAddress(m, v + k);
+  if (IsContiguousRam(m, a, b, k, protect_rom)) {
+    STATISTIC(++page_overlaps_contiguous);
+    p[0] = 0;
+    p[1] = 0;
+    return a;
+  }
   if (copy) {
     memcpy(tmp, a, k);
     memcpy(tmp + k, b, n - k);
@@ -520,15 +728,10 @@ void EndStore(struct Machine *m, i64 v, size_t n, void *p[2], u8 *b) {
   k = 4096;
   k -= v & 4095;
   unassert(n > k);
-#ifdef DISABLE_ROM
-  unassert(p[0]);
-  unassert(p[1]);
-  memcpy(p[0], b, k);
-  memcpy(p[1], b + k, n - k);
-#else
+  // pointers are null for rom, or if AccessRam() returned host memory
+  // directly because both pages were backed contiguously
   if (p[0]) memcpy(p[0], b, k);
   if (p[1]) memcpy(p[1], b + k, n - k);
-#endif
 }
 
 void EndStoreNp(struct Machine *m, i64 v, size_t n, void *p[2], u8 *b) {
@@ -536,26 +739,54 @@ void EndStoreNp(struct Machine *m, i64 v, size_t n, void *p[2], u8 *b) {
 }
 
 void *AddToFreeList(struct Machine *m, void *mem) {
-  int n;
-  void *p;
-  p = m->freelist.p;
-  n = m->freelist.n + 1;
-  if ((p = realloc(p, n * sizeof(*m->freelist.p)))) {
-    STATISTIC(++freelisted);
-    m->freelist.p = (void **)p;
-    m->freelist.n = n;
-    m->freelist.p[n - 1] = mem;
-    return mem;
-  } else {
-    free(mem);
-    return 0;
+  int c;
+  void **p;
+  if (m->freelist.n == m->freelist.c) {
+    c = m->freelist.c ? m->freelist.c * 2 : 16;
+    if (!(p = (void **)realloc(m->freelist.p, c * sizeof(*p)))) {
+      free(mem);
+      return 0;
+    }
+    m->freelist.p = p;
+    m->freelist.c = c;
+  }
+  STATISTIC(++freelisted);
+  m->freelist.p[m->freelist.n++] = mem;
+  return mem;
+}
+
+// Allocates temporary memory that lives until the system call returns.
+// Small requests are bump allocated from chunks the machine holds onto
+// between system calls, so marshalling usually doesn't touch the heap.
+void *AllocateScratch(struct Machine *m, size_t n) {
+  size_t i;
+  struct Scratch *c;
+  struct FreeList *f = &m->freelist;
+  n = ROUNDUP(n, 16);
+  if (n > kScratchLarge) {
+    return AddToFreeList(m, malloc(n));
+  }
+  i = (c = f->scratch) ? f->used - c->base : kScratchChunk;
+  if (i + n > kScratchChunk) {
+    if ((c = f->spare)) {
+      f->spare = c->prev;
+    } else if ((c = (struct Scratch *)malloc(ROUNDUP(sizeof(*c), 16) +
+                                             kScratchChunk))) {
+      STATISTIC(++scratch_chunks);
+    } else {
+      return 0;
+    }
+    c->prev = f->scratch;
+    c->base = f->used;
+    f->scratch = c;
+    i = 0;
   }
+  f->used += n;
+  return (u8 *)c + ROUNDUP(sizeof(*c), 16) + i;
 }
 
-// Returns pointer to memory in guest memory. If the memory overlaps a
-// page boundary, then it's copied, and the temporary memory is pushed
-// to the free list. Returns NULL w/ EFAULT or ENOMEM on error.
-void *Schlep(struct Machine *m, i64 addr, size_t size, u64 mask, u64 need) {
+static void *SchlepUntimed(struct Machine *m, i64 addr, size_t size, u64 mask,
+                           u64 need) {
   char *copy;
   size_t have;
   void *res, *page;
@@ -565,20 +796,27 @@ void *Schlep(struct Machine *m, i64 addr, size_t size, u64 mask, u64 need) {
   if (size <= have) {
     res = page;
   } else {
-    if (!(copy = (char *)malloc(size))) return 0;
+    if (!(copy = (char *)AllocateScratch(m, size))) return 0;
     memcpy(copy, page, have);
     for (; have < size; have += 4096) {
-      if (!(page = LookupAddress2(m, addr + have, mask, need))) {
-        free(copy);
-        return 0;
-      }
+      if (!(page = LookupAddress2(m, addr + have, mask, need))) return 0;
       memcpy(copy + have, page, MIN(4096, size - have));
     }
-    res = AddToFreeList(m, copy);
+    res = copy;
   }
   return res;
 }
 
+// Returns pointer to memory in guest memory. If the memory overlaps a
+// page boundary, then it's copied into the syscall scratch arena. Returns NULL w/ EFAULT or ENOMEM on error.
+void *Schlep(struct Machine *m, i64 addr, size_t size, u64 mask, u64 need) {
+  void *res;
+  u64 t = BeginSyscallOverhead();
+  res = SchlepUntimed(m, addr, size, mask, need);
+  EndSyscallOverhead(t);
+  return res;
+}
+
 void *SchlepR(struct Machine *m, i64 addr, size_t size) {
   SetReadAddr(m, addr, size);
   return Schlep(m, addr, size, PAGE_U, PAGE_U);
@@ -595,12 +833,9 @@ void *SchlepRW(struct Machine *m, i64 addr, size_t size) {
   return Schlep(m, addr, size, PAGE_U | PAGE_RW, PAGE_U | PAGE_RW);
 }
 
-// Returns pointer to string in guest memory. If the string overlaps a
-// page boundary, then it's copied, and the temporary memory is pushed
-// to the free list. Returns NULL w/ EFAULT or ENOMEM on error.
-char *LoadStr(struct Machine *m, i64 addr) {
-  size_t have;
+static char *LoadStrUntimed(struct Machine *m, i64 addr) {
   char *copy, *page, *p;
+  size_t i, have, size;
   have = 4096 - (addr & 4095);
   if (!addr) return 0;
   if (!(page = (char *)LookupAddress2(m, addr, PAGE_U, PAGE_U))) return 0;
@@ -608,56 +843,67 @@ char *LoadStr(struct Machine *m, i64 addr) {
     SetReadAddr(m, addr, p - page + 1);
     return page;
   }
-  if (!(copy = (char *)malloc(have + 4096))) return 0;
-  memcpy(copy, page, have);
-  for (;;) {
-    if (!(page = (char *)LookupAddress2(m, addr + have, PAGE_U, PAGE_U))) break;
-    if ((p = (char *)memccpy(copy + have, page, '\0', 4096))) {
-      SetReadAddr(m, addr, have + (p - (copy + have)) + 1);
-      return (char *)AddToFreeList(m, copy);
+  // measure the string first, so it can be copied into one allocation
+  for (size = have;; size += 4096) {
+    if (!(page = (char *)LookupAddress2(m, addr + size, PAGE_U, PAGE_U))) {
+      return 0;
+    }
+    if ((p = (char *)memchr(page, '\0', 4096))) {
+      size += p - page + 1;
+      break;
     }
-    have += 4096;
-    if (!(p = (char *)realloc(copy, have + 4096))) break;
-    copy = p;
   }
-  free(copy);
-  return 0;
+  if (!(copy = (char *)AllocateScratch(m, size))) return 0;
+  for (i = 0; i < size; i += have, have = 4096) {
+    if (!(page = (char *)LookupAddress2(m, addr + i, PAGE_U, PAGE_U))) {
+      return 0;
+    }
+    memcpy(copy + i, page, MIN(have, size - i));
+  }
+  copy[size - 1] = 0;
+  SetReadAddr(m, addr, size);
+  return copy;
 }
 
-// Copies string from guest memory. The returned memory is pushed to the
-// machine free list. NULL w/ ENOMEM is returned if we're out of memory.
+// Returns pointer to string in guest memory. If the string overlaps a
+// page boundary, then it's copied into the syscall scratch arena. Returns NULL w/ EFAULT or ENOMEM on error.
+char *LoadStr(struct Machine *m, i64 addr) {
+  char *res;
+  u64 t = BeginSyscallOverhead();
+  res = LoadStrUntimed(m, addr);
+  EndSyscallOverhead(t);
+  return res;
+}
+
+// Copies string from guest memory. The returned memory is allocated in
+// the syscall scratch arena. NULL w/ ENOMEM is returned if out of memory.
 char *CopyStr(struct Machine *m, i64 addr) {
-  char *s;
+  char *s, *c;
+  size_t n;
   if (!(s = LoadStr(m, addr))) return 0;
-  return (char *)AddToFreeList(m, strdup(s));
+  n = strlen(s) + 1;
+  if (!(c = (char *)AllocateScratch(m, n))) return 0;
+  return (char *)memcpy(c, s, n);
 }
 
 // Returns fully copied NULL-terminated NUL-terminated string list. All
-// memory allocated by this routine is pushed to the machine free list.
+// memory allocated by this routine is in the syscall scratch arena.
 char **CopyStrList(struct Machine *m, i64 addr) {
-  int n;
   u8 b[8];
-  char *s;
-  void *mem;
+  long i, n;
   char **list;
-  for (list = 0, n = 0;;) {
-    if ((mem = realloc(list, ++n * sizeof(*list)))) {
-      list = (char **)mem;
-    } else {
-      free(list);
-      return 0;
-    }
-    CopyFromUserRead(m, b, addr + n * 8 - 8, 8);
-    if (Read64(b)) {
-      if ((s = CopyStr(m, Read64(b)))) {
-        list[n - 1] = s;
-      } else {
-        free(list);
-        return 0;
-      }
-    } else {
-      list[n - 1] = 0;
-      return (char **)AddToFreeList(m, list);
-    }
+  for (n = 0;; ++n) {
+    if (CopyFromUserRead(m, b, addr + n * 8, 8) == -1) return 0;
+    if (!Read64(b)) break;
+  }
+  if (!(list = (char **)AllocateScratch(m, (n + 1) * sizeof(*list)))) {
+    return 0;
+  }
+  for (i = 0; i < n; ++i) {
+    if (CopyFromUserRead(m, b, addr + i * 8, 8) == -1) return 0;
+    if (!Read64(b)) break;
+    if (!(list[i] = CopyStr(m, Read64(b)))) return 0;
   }
+  list[i] = 0;
+  return list;
 }
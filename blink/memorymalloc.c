@@ -24,32 +24,78 @@
 #include "blink/assert.h"
 #include "blink/atomic.h"
 #include "blink/bitscan.h"
+#include "blink/btrace.h"
+#include "blink/etrace.h"
+#include "blink/flight.h"
 #include "blink/builtin.h"
 #include "blink/bus.h"
+#include "blink/coverage.h"
 #include "blink/debug.h"
 #include "blink/errno.h"
 #include "blink/fds.h"
+#include "blink/flag.h"
 #include "blink/jit.h"
 #include "blink/linux.h"
 #include "blink/log.h"
 #include "blink/machine.h"
 #include "blink/macros.h"
 #include "blink/map.h"
+#include "blink/metrics.h"
+#include "blink/native.h"
+#include "blink/perfmap.h"
 #include "blink/pml4t.h"
+#include "blink/profile.h"
 #include "blink/random.h"
+#include "blink/reclaim.h"
+#include "blink/spin.h"
+#include "blink/stats.h"
 #include "blink/thread.h"
 #include "blink/timespec.h"
 #include "blink/types.h"
 #include "blink/util.h"
 #include "blink/x86.h"
 
+// runs of free pages the host was told to discard, which are kept out
+// of the free list, since linking them would make the host fault them
+// back in. they cost no memory until they're touched again, and reads
+// of them are served by the host's zero page.
+struct PageRun {
+  u8 *a, *b;
+};
+
 struct Allocator {
   pthread_mutex_t_ lock;
   struct HostPage *pages GUARDED_BY(lock);
+  long runs_i GUARDED_BY(lock);
+  long runs_n GUARDED_BY(lock);
+  struct PageRun *runs GUARDED_BY(lock);
 } g_allocator = {
     PTHREAD_MUTEX_INITIALIZER_,
 };
 
+// each host thread hands out pages from its own cache, so that guest
+// threads don't contend on the allocator lock as they fault. the tail
+// of the chunk a thread allocated is handed out without touching it so
+// the host kernel places it on the numa node of the faulting thread.
+struct PageCache {
+  long n;
+  u8 *bump;
+  u8 *bumpend;
+  struct HostPage *pages;
+};
+
+static _Thread_local struct PageCache g_pagecache;
+
+// each host thread also tallies the pages it commits and frees itself,
+// so guest threads faulting in parallel don't bounce the cache line of
+// their system's rss counter between cores. it's updated in batches
+struct RssCache {
+  long delta;
+  struct System *s;
+};
+
+static _Thread_local struct RssCache g_rsscache;
+
 struct Machine g_bssmachine;
 
 static void FillPage(void *p, int c) {
@@ -60,22 +106,113 @@ static void ClearPage(void *p) {
   FillPage(p, 0);
 }
 
-static struct HostPage *NewHostPage(void) {
-  return (struct HostPage *)malloc(sizeof(struct HostPage));
-}
-
-static void FreeHostPage(struct HostPage *hp) {
-  free(hp);
+// returns pages from the current thread's cache to the central pool
+static void ReleasePageCache(struct HostPage *h, long n) {
+  long i;
+  struct HostPage *t;
+  unassert(n > 0);
+  for (t = h, i = 1; i < n; ++i) t = t->next;
+  g_pagecache.pages = t->next;
+  g_pagecache.n -= n;
+  LOCK(&g_allocator.lock);
+  t->next = g_allocator.pages;
+  g_allocator.pages = h;
+  UNLOCK(&g_allocator.lock);
 }
 
+// the page must be zero'd. the free list is stored inside free pages,
+// which is still safe for readers crawling a freed page table, since a
+// page aligned next pointer never has the PAGE_V bit set
 void FreeAnonymousPage(struct System *s, u8 *page) {
   struct HostPage *h;
-  unassert((h = NewHostPage()));
+  h = (struct HostPage *)page;
+  h->next = g_pagecache.pages;
+  g_pagecache.pages = h;
+  if (++g_pagecache.n >= kPageBatch * 2) {
+    ReleasePageCache(g_pagecache.pages, kPageBatch);
+  }
+}
+
+// puts zero filled pages which haven't been touched in the central pool
+static void ReleasePageRun(u8 *a, u8 *b) {
+  long n;
+  struct PageRun *p;
   LOCK(&g_allocator.lock);
-  h->page = page;
-  h->next = g_allocator.pages;
-  g_allocator.pages = h;
+  if (g_allocator.runs_i == g_allocator.runs_n) {
+    n = g_allocator.runs_n + 8;
+    n += n >> 1;
+    if ((p = (struct PageRun *)realloc(g_allocator.runs, n * sizeof(*p)))) {
+      g_allocator.runs = p;
+      g_allocator.runs_n = n;
+    }
+  }
+  if (g_allocator.runs_i < g_allocator.runs_n) {
+    g_allocator.runs[g_allocator.runs_i].a = a;
+    g_allocator.runs[g_allocator.runs_i].b = b;
+    ++g_allocator.runs_i;
+    a = b;
+  }
+  UNLOCK(&g_allocator.lock);
+  for (; a < b; a += 4096) {
+    FreeAnonymousPage(0, a);
+  }
+}
+
+// hands this thread untouched pages from the central pool, if it has
+// any, which are given out the same way as fresh memory from the host
+static bool TakePageRun(void) {
+  struct PageRun *r;
+  bool res = false;
+  LOCK(&g_allocator.lock);
+  if (g_allocator.runs_i) {
+    r = g_allocator.runs + g_allocator.runs_i - 1;
+    g_pagecache.bump = r->a;
+    g_pagecache.bumpend = r->a + MIN(r->b - r->a, 64 * 4096);
+    if ((r->a = g_pagecache.bumpend) == r->b) {
+      --g_allocator.runs_i;
+    }
+    res = true;
+  }
   UNLOCK(&g_allocator.lock);
+  return res;
+}
+
+static void FlushRss(void) {
+  if (g_rsscache.delta) {
+    g_rsscache.s->rss += g_rsscache.delta;
+    g_rsscache.delta = 0;
+  }
+}
+
+static void AddRss(struct System *s, long n) {
+  if (s != g_rsscache.s) {
+    FlushRss();
+    g_rsscache.s = s;
+  }
+  g_rsscache.delta += n;
+  if (g_rsscache.delta >= kRssBatch || g_rsscache.delta <= -kRssBatch) {
+    FlushRss();
+  }
+}
+
+// returns resident pages of system, counting the current thread's own
+// unflushed delta. other threads may each be off by under kRssBatch
+long GetRss(struct System *s) {
+  long n = s->rss;
+  if (s == g_rsscache.s) n += g_rsscache.delta;
+  return n;
+}
+
+// gives the current thread's cached pages to other threads
+void FlushPageCache(void) {
+  FlushRss();
+  if (g_pagecache.bump < g_pagecache.bumpend) {
+    ReleasePageRun(g_pagecache.bump, g_pagecache.bumpend);
+    g_pagecache.bump = g_pagecache.bumpend = 0;
+  }
+  if (g_pagecache.n) {
+    ReleasePageCache(g_pagecache.pages, g_pagecache.n);
+  }
 }
 
 static size_t GetBigSize(size_t n) {
@@ -102,10 +239,52 @@ void *AllocateBig(size_t n, int prot, int flags, int fd, off_t off) {
   return p != MAP_FAILED ? p : 0;
 }
 
+// asks host to back the aligned interior of [p,p+n) with huge pages
+static void AdviseHugePages(void *p, size_t n) {
+#ifdef MADV_HUGEPAGE
+  uintptr_t a, b;
+  a = ROUNDUP((uintptr_t)p, kHugeSize);
+  b = ROUNDDOWN((uintptr_t)p + n, kHugeSize);
+  if (a < b && madvise((void *)a, b - a, MADV_HUGEPAGE)) {
+    MEM_LOGF("madvise(%#" PRIxPTR ", %#" PRIxPTR ", MADV_HUGEPAGE) failed: %s",
+             a, b - a, DescribeHostErrno(errno));
+  }
+#endif
+}
+
+// asks host to merge pages of [p,p+n) with identical pages of any other
+// process, which is what lets a fleet of blink processes running the
+// same program share the copies of data each one of them decompressed
+static void AdviseMergeable(void *p, size_t n) {
+#ifdef MADV_MERGEABLE
+  if (!FLAG_dedup) return;
+  if (madvise(p, n, MADV_MERGEABLE)) {
+    MEM_LOGF("madvise(%p, %#zx, MADV_MERGEABLE) failed: %s", p, n,
+             DescribeHostErrno(errno));
+    return;
+  }
+  STATISTIC(dedup_advised_pages += n / 4096);
+#endif
+}
+
+// allocates a huge page sized chunk of memory that's aligned to it
+static u8 *AllocateHugeChunk(void) {
+  u8 *p, *a;
+  if (!(p = (u8 *)AllocateBig(kHugeSize * 2, PROT_READ | PROT_WRITE,
+                              MAP_ANONYMOUS_ | MAP_PRIVATE, -1, 0))) {
+    return 0;
+  }
+  a = (u8 *)ROUNDUP((uintptr_t)p, kHugeSize);
+  if (a > p) Munmap(p, a - p);
+  Munmap(a + kHugeSize, p + kHugeSize * 2 - (a + kHugeSize));
+  AdviseHugePages(a, kHugeSize);
+  return a;
+}
+
 static void FreePageTable(struct System *s, u8 *page) {
   FreeAnonymousPage(s, page);
   s->memstat.tables -= 1;
-  s->rss -= 1;
+  AddRss(s, -1);
 }
 
 static bool FreeEmptyPageTables(struct System *s, u64 pt, long level) {
@@ -137,6 +316,43 @@ static bool FreeEmptyPageTables(struct System *s, u64 pt, long level) {
   return isempty;
 }
 
+// page tables count their valid entries, in bits of the entry pointing
+// to them which aren't otherwise used, so a table can be freed as soon
+// as its last entry goes away. mmap_lock must be held to change counts
+static void AddPageTableRef(u8 *parent) {
+  u64 pt = LoadPte(parent);
+  unassert((pt & PAGE_REFS) < PAGE_REFS);
+  StorePte(parent, pt + PAGE_REF);
+}
+
+// drops the reference to a cleared entry, held by the table it's in. a
+// table that becomes empty is freed, which drops its own reference too
+// @param slots are the pml4, pdpt, and pd entries that lead to virt
+// @param level is 2 for a page table entry, or 1 for a lazy chunk's pde
+// @return true if the page table which held the entry was freed
+static bool DropPageTableRef(struct System *s, u8 *slots[3], int level,
+                             i64 virt) {
+  int start;
+  u64 pt;
+  for (start = level; level >= 0; --level) {
+    pt = LoadPte(slots[level]);
+    unassert(pt & PAGE_REFS);
+    if ((pt -= PAGE_REF) & PAGE_REFS) {
+      StorePte(slots[level], pt);
+      break;
+    }
+    // readers like FindPageTableEntry() may still crawl an old pointer
+    // to a freed page table, which is safe since it was zero'd, and the
+    // machines that remembered the last level table get shot down here
+    StorePte(slots[level], 0);
+    FreePageTable(s, GetPageAddress(s, pt, false));
+    if (level == 2) {
+      InvalidateSystemRange(s, virt & -0x200000, 0x200000, false);
+    }
+  }
+  return level < start;
+}
+
 static void FreeHostPages(struct System *s) {
   if (!s->real && s->cr3) {
     unassert(!FreeVirtual(s, -0x800000000000, 0x1000000000000));
@@ -163,16 +379,6 @@ static void FreeFileMaps(struct System *s) {
   }
 }
 
-void CleanseMemory(struct System *s, size_t size) {
-  i64 oldrss;
-  if (s->memchurn >= (s->rss >> 1)) {
-    (void)(oldrss = s->rss);
-    FreeEmptyPageTables(s, s->cr3, 1);
-    MEM_LOGF("freed %" PRId64 " page tables", oldrss - s->rss);
-    s->memchurn = 0;
-  }
-}
-
 int GetFileDescriptorLimit(struct System *s) {
   u64 lim;
   LOCK(&s->mmap_lock);
@@ -225,6 +431,8 @@ struct System *NewSystem(struct XedMachineMode mode) {
   unassert(!pthread_mutex_init(&s->mmap_lock, 0));
   unassert(!pthread_mutex_init(&s->exec_lock, 0));
   unassert(!pthread_cond_init(&s->machines_cond, 0));
+  unassert(!pthread_cond_init(&s->paused_cond, 0));
+  unassert(!pthread_cond_init(&s->idle_cond, 0));
   unassert(!pthread_mutex_init(&s->machines_lock, 0));
   unassert(!pthread_cond_init(&s->pagelocks_cond, 0));
   unassert(!pthread_mutex_init(&s->pagelocks_lock, 0));
@@ -235,6 +443,10 @@ struct System *NewSystem(struct XedMachineMode mode) {
                  (u64)1 << (SIGBUS_LINUX - 1) |   //
                  (u64)1 << (SIGPIPE_LINUX - 1) |  //
                  (u64)1 << (SIGTRAP_LINUX - 1);
+  if (FLAG_profile) {
+    // BLINK_PROFILE owns the host's SIGPROF
+    s->blinksigs |= (u64)1 << (SIGPROF_LINUX - 1);
+  }
   for (i = 0; i < RLIM_NLIMITS_LINUX; ++i) {
     Write64(s->rlim[i].cur, RLIM_INFINITY_LINUX);
     Write64(s->rlim[i].max, RLIM_INFINITY_LINUX);
@@ -243,9 +455,19 @@ struct System *NewSystem(struct XedMachineMode mode) {
   return s;
 }
 
+static void FreeScratch(struct Scratch *c) {
+  struct Scratch *prev;
+  for (; c; c = prev) {
+    prev = c->prev;
+    free(c);
+  }
+}
+
 static void FreeMachineUnlocked(struct Machine *m) {
   THR_LOGF("pid=%d tid=%d FreeMachine", m->system->pid, m->tid);
-  UnlockRobustFutexes(m);
+  ForgetBtrace(m);
+  ForgetFlight(m);
+  ForgetEtrace(m);
   if (IsMakingPath(m)) {
     AbandonJit(&m->system->jit, m->path.jb);
   }
@@ -254,12 +476,22 @@ static void FreeMachineUnlocked(struct Machine *m) {
   CollectGarbage(m, 0);
   free(m->pagelocks.p);
   free(m->freelist.p);
+  FreeScratch(m->freelist.scratch);
+  FreeScratch(m->freelist.spare);
+  FreeBig(m->opcache, sizeof(*m->opcache));
   free(m);
   if (g_machine == m) {
     g_machine = 0;
   }
 }
 
+// caller must hold machines_lock
+static void UpdateSinglethreaded(struct System *s) {
+  atomic_store_explicit(&s->singlethreaded,
+                        s->machines && s->machines->next == s->machines,
+                        memory_order_release);
+}
+
 bool IsOrphan(struct Machine *m) {
   bool res;
   LOCK(&m->system->machines_lock);
@@ -295,17 +527,20 @@ StartOver:
                  m->tid);
         atomic_store_explicit(&m->killed, true, memory_order_release);
         atomic_store_explicit(&m->attention, true, memory_order_release);
+        InterruptFutex(atomic_load_explicit(&m->futex, memory_order_seq_cst));
         if (t < 10) {
           pthread_kill(m->thread, SIGSYS);
         } else {
           LOGF("kill9'd thread after 10 tries");
           pthread_kill(m->thread, SIGKILL);
           dll_remove(&s->machines, e);
+          UpdateSinglethreaded(s);
           UNLOCK(&s->machines_lock);
           goto StartOver;
         }
       }
     }
+    unassert(!pthread_cond_broadcast(&s->paused_cond));
     deadline = AddTime(GetTime(), FromMilliseconds(kPollingMs));
     r = pthread_cond_timedwait(&s->machines_cond, &s->machines_lock, &deadline);
     unassert(r == 0 || r == ETIMEDOUT);
@@ -314,6 +549,22 @@ StartOver:
 #endif
 }
 
+// blocks thread while its system is paused, e.g. since an embedder's
+// time slice ran out, or until the thread is killed, e.g. by exit_group
+void ParkMachine(struct Machine *m) {
+#ifdef HAVE_THREADS
+  struct System *s = m->system;
+  LOCK(&s->machines_lock);
+  m->parked = true;
+  while (atomic_load_explicit(&s->paused, memory_order_acquire) &&
+         !atomic_load_explicit(&m->killed, memory_order_acquire)) {
+    unassert(!pthread_cond_wait(&s->paused_cond, &s->machines_lock));
+  }
+  m->parked = false;
+  UNLOCK(&s->machines_lock);
+#endif
+}
+
 void RemoveOtherThreads(struct System *s) {
 #ifdef HAVE_THREADS
   struct Dll *e, *g;
@@ -327,16 +578,47 @@ void RemoveOtherThreads(struct System *s) {
       FreeMachineUnlocked(m);
     }
   }
+  // the host threads of pooled machines didn't survive fork() either
+  while ((e = dll_first(s->idle))) {
+    dll_remove(&s->idle, e);
+    FreeMachineUnlocked(MACHINE_CONTAINER(e));
+  }
+  s->idles = 0;
+  UpdateSinglethreaded(s);
   UNLOCK(&s->machines_lock);
+  // but the condition they waited on and the mutex they released into
+  // it still count them as users, which would make destroying fail on
+  // execve(), so both get recreated now that we are the only thread
+  unassert(!pthread_mutex_init(&s->machines_lock, 0));
+  unassert(!pthread_cond_init(&s->idle_cond, 0));
 #endif
 }
 
 void FreeSystem(struct System *s) {
   THR_LOGF("pid=%d FreeSystem", s->pid);
   unassert(dll_is_empty(s->machines));  // Use KillOtherThreads & FreeMachine
+#ifdef HAVE_THREADS
+  // pooled threads are waiting on this system, so they must quit first
+  LOCK(&s->machines_lock);
+  s->draining = true;
+  unassert(!pthread_cond_broadcast(&s->idle_cond));
+  while (s->idles) {
+    unassert(!pthread_cond_wait(&s->machines_cond, &s->machines_lock));
+  }
+  UNLOCK(&s->machines_lock);
+#endif
+  ForgetMetrics(s);
+  ForgetReclaim(s);
+  FlushProfile(s);
+  FlushBtrace();
+  FlushCoverage(s);
+  ForgetPerfMap(s);
+  ForgetNatives(s);
   FreeHostPages(s);
   unassert(!pthread_mutex_destroy(&s->machines_lock));
   unassert(!pthread_cond_destroy(&s->machines_cond));
+  unassert(!pthread_cond_destroy(&s->paused_cond));
+  unassert(!pthread_cond_destroy(&s->idle_cond));
   unassert(!pthread_mutex_destroy(&s->pagelocks_lock));
   unassert(!pthread_cond_destroy(&s->pagelocks_cond));
   unassert(!pthread_mutex_destroy(&s->exec_lock));
@@ -351,61 +633,128 @@ void FreeSystem(struct System *s) {
 #ifdef HAVE_JIT
   DestroyJit(&s->jit);
 #endif
+  ForgetCoverage(s);
   free(s);
 }
 
+// initializes a new thread's machine with the state of its parent, not
+// including the resources it owns, which the caller must fill in
+static void CopyMachine(struct Machine *m, struct Machine *parent) {
+  memcpy(m, parent, sizeof(*m));
+  memset(&m->path, 0, sizeof(m->path));
+  memset(&m->freelist, 0, sizeof(m->freelist));
+  memset(&m->pagelocks, 0, sizeof(m->pagelocks));
+  m->insyscall = false;
+  m->parked = false;
+  m->pooled = false;
+  m->nofault = false;
+  m->sysdepth = 0;
+  m->sigdepth = 0;
+  m->signals = 0;
+  m->btrace = 0;
+  m->etrace = 0;
+  m->coverblock = 0;
+}
+
+// caller must hold machines_lock
+static void AddMachine(struct System *system, struct Machine *m,
+                       struct Machine *parent) {
+  m->ctid = 0;
+  m->oplen = 0;
+  m->system = system;
+  m->mode = system->mode;
+  Write32(m->sigaltstack.flags, SS_DISABLE_LINUX);
+  if (parent) {
+    m->tid = (system->next_tid++ & (kMaxThreadIds - 1)) + kMinThreadId;
+  } else {
+    // TODO(jart): We shouldn't be doing system calls in an allocator.
+    m->tid = m->system->pid;
+  }
+  dll_init(&m->elem);
+  // TODO(jart): Child thread should add itself to system.
+  dll_make_first(&system->machines, &m->elem);
+  // a thread clone()'d while the system is paused mustn't run until it
+  // resumes, since whoever paused it may be counting on nothing running
+  if (atomic_load_explicit(&system->paused, memory_order_relaxed)) {
+    atomic_store_explicit(&m->attention, true, memory_order_release);
+  }
+  UpdateSinglethreaded(system);
+}
+
 struct Machine *NewMachine(struct System *system, struct Machine *parent) {
   _Static_assert(IS2POW(kMaxThreadIds), "");
   struct Machine *m;
+  struct OpCache *opcache;
+  struct FlightRing *flight = 0;
   unassert(system);
   unassert(!parent || system == parent->system);
   if (posix_memalign((void **)&m, _Alignof(struct Machine), sizeof(*m))) {
     enomem();
     return 0;
   }
+  // the instruction cache is most of a machine's memory, so it's given
+  // its own anonymous mapping. it starts off zero, i.e. reset, and the
+  // host won't commit its pages until they get used, which they mostly
+  // won't be, for threads that are idle or running jit code
+  if (!(opcache = (struct OpCache *)AllocateBig(
+            sizeof(*opcache), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS_, -1, 0))) {
+    free(m);
+    enomem();
+    return 0;
+  }
+  // jit paths record themselves in the ring of whichever thread runs
+  // them, so every thread needs one before it may enter any path
+  if (FLAG_flight &&
+      !(flight = (struct FlightRing *)calloc(1, sizeof(*flight)))) {
+    FreeBig(opcache, sizeof(*opcache));
+    free(m);
+    enomem();
+    return 0;
+  }
   // TODO(jart): We shouldn't be doing expensive ops in an allocator.
   LOCK(&system->machines_lock);
   if (parent) {
-    memcpy(m, parent, sizeof(*m));
-    memset(&m->path, 0, sizeof(m->path));
-    memset(&m->freelist, 0, sizeof(m->freelist));
-    memset(&m->pagelocks, 0, sizeof(m->pagelocks));
-    ResetInstructionCache(m);
-    m->insyscall = false;
-    m->nofault = false;
-    m->sysdepth = 0;
-    m->sigdepth = 0;
-    m->signals = 0;
+    CopyMachine(m, parent);
+    m->opcache = opcache;
+    m->flight = flight;
   } else {
     memset(m, 0, sizeof(*m));
+    m->opcache = opcache;
+    m->flight = flight;
     ResetCpu(m);
   }
-  m->ctid = 0;
-  m->oplen = 0;
-  m->system = system;
-  m->mode = system->mode;
   m->thread = pthread_self();
-  Write32(m->sigaltstack.flags, SS_DISABLE_LINUX);
-  if (parent) {
-    m->tid = (system->next_tid++ & (kMaxThreadIds - 1)) + kMinThreadId;
-  } else {
-    // TODO(jart): We shouldn't be doing system calls in an allocator.
-    m->tid = m->system->pid;
-  }
-  dll_init(&m->elem);
-  // TODO(jart): Child thread should add itself to system.
-  dll_make_first(&system->machines, &m->elem);
+  AddMachine(system, m, parent);
   UNLOCK(&system->machines_lock);
   THR_LOGF("new machine thread pid=%d tid=%d", m->system->pid, m->tid);
   return m;
 }
 
-void CollectGarbage(struct Machine *m, size_t mark) {
-  long i;
-  for (i = mark; i < m->freelist.n; ++i) {
-    free(m->freelist.p[i]);
+void MarkGarbage(struct Machine *m, struct GarbageMark *mark) {
+  mark->n = m->freelist.n;
+  mark->used = m->freelist.used;
+}
+
+// frees temporary memory allocated since mark, or all of it if null.
+// scratch chunks that become empty are kept around for the next call
+void CollectGarbage(struct Machine *m, const struct GarbageMark *mark) {
+  long i, n;
+  size_t used;
+  struct Scratch *c;
+  struct FreeList *f = &m->freelist;
+  n = mark ? mark->n : 0;
+  used = mark ? mark->used : 0;
+  for (i = n; i < f->n; ++i) {
+    free(f->p[i]);
+  }
+  f->n = n;
+  while ((c = f->scratch) && c->base > used) {
+    f->scratch = c->prev;
+    c->prev = f->spare;
+    f->spare = c;
   }
-  m->freelist.n = mark;
+  f->used = used;
 }
 
 void FreeMachine(struct Machine *m) {
@@ -415,8 +764,11 @@ void FreeMachine(struct Machine *m) {
     unassert((s = m->system));
     m->sysdepth = 0;
     CollectPageLocks(m);
+    FlushPageCache();
+    FlushStats();
     LOCK(&s->machines_lock);
     dll_remove(&s->machines, &m->elem);
+    UpdateSinglethreaded(s);
     if (!(orphan = dll_is_empty(s->machines))) {
       unassert(!pthread_cond_signal(&s->machines_cond));
     }
@@ -430,40 +782,225 @@ void FreeMachine(struct Machine *m) {
   }
 }
 
+// parks the host thread of a guest thread that's exited in the system's
+// pool, so a later clone() can hand it a new guest thread, rather than
+// create a host thread. returns true once that happens, otherwise false
+// after freeing the machine, in which case its host thread should exit
+bool RecycleMachine(struct Machine *m) {
+#ifdef HAVE_THREADS
+  sigset_t ss;
+  struct System *s = m->system;
+  // signals sent to the process mustn't get picked up by a host thread
+  // that has no guest thread to deliver them to
+  sigfillset(&ss);
+  unassert(!pthread_sigmask(SIG_SETMASK, &ss, 0));
+  ForgetBtrace(m);
+  ForgetEtrace(m);
+  FlushPageCache();
+  FlushStats();
+  LOCK(&s->machines_lock);
+  if (s->idles < kThreadPool && !s->draining &&
+      !atomic_load_explicit(&s->killer, memory_order_relaxed) &&
+      dll_first(s->machines) != dll_last(s->machines)) {
+    dll_remove(&s->machines, &m->elem);
+    UpdateSinglethreaded(s);
+    unassert(!pthread_cond_signal(&s->machines_cond));
+    dll_make_first(&s->idle, &m->elem);
+    ++s->idles;
+    m->idle = true;
+    THR_LOGF("pid=%d tid=%d is idle", s->pid, m->tid);
+    do {
+      unassert(!pthread_cond_wait(&s->idle_cond, &s->machines_lock));
+    } while (m->idle && !s->draining);
+    if (!m->idle) {
+      UNLOCK(&s->machines_lock);
+      unassert(!pthread_sigmask(SIG_SETMASK, &m->spawn_sigmask, 0));
+      m->runmask = m->spawn_sigmask;
+      return true;
+    }
+    dll_remove(&s->idle, &m->elem);
+    FreeMachineUnlocked(m);
+    --s->idles;
+    unassert(!pthread_cond_signal(&s->machines_cond));
+    UNLOCK(&s->machines_lock);
+    return false;
+  }
+  UNLOCK(&s->machines_lock);
+#endif
+  FreeMachine(m);
+  return false;
+}
+
+// takes the most recently idled machine from the pool, and sets it up
+// as a new thread of parent, like NewMachine(). returns null if there
+// aren't any. the thread won't run until WakeMachine() is called
+struct Machine *ReuseMachine(struct System *system, struct Machine *parent) {
+#ifdef HAVE_THREADS
+  int hosttid;
+  pthread_t thread;
+  struct Machine *m;
+  struct OpCache *opcache;
+  struct FreeList freelist;
+  struct PageLocks pagelocks;
+  struct FlightRing *flight;
+  LOCK(&system->machines_lock);
+  if (dll_is_empty(system->idle)) {
+    UNLOCK(&system->machines_lock);
+    return 0;
+  }
+  m = MACHINE_CONTAINER(dll_first(system->idle));
+  dll_remove(&system->idle, &m->elem);
+  --system->idles;
+  thread = m->thread;
+  hosttid = m->hosttid;
+  opcache = m->opcache;
+  flight = m->flight;
+  freelist = m->freelist;
+  pagelocks = m->pagelocks;
+  CopyMachine(m, parent);
+  m->thread = thread;
+  m->hosttid = hosttid;
+  m->opcache = opcache;
+  m->flight = flight;
+  m->freelist = freelist;
+  m->pagelocks = pagelocks;
+  m->idle = true;
+  m->pooled = true;
+  if (flight) memset(flight, 0, sizeof(*flight));
+  // its decoded instructions may be stale, since code that changed once
+  // its last guest thread exited wasn't invalidated in its cache
+  atomic_store_explicit(&opcache->invalidated, true, memory_order_relaxed);
+  AddMachine(system, m, parent);
+  UNLOCK(&system->machines_lock);
+  STATISTIC(++thread_reuses);
+  THR_LOGF("reused machine thread pid=%d tid=%d", m->system->pid, m->tid);
+  return m;
+#else
+  return 0;
+#endif
+}
+
+// lets a thread that was obtained from ReuseMachine() start running
+void WakeMachine(struct Machine *m) {
+#ifdef HAVE_THREADS
+  struct System *s = m->system;
+  LOCK(&s->machines_lock);
+  m->idle = false;
+  unassert(!pthread_cond_broadcast(&s->idle_cond));
+  UNLOCK(&s->machines_lock);
+#endif
+}
+
+// moves a batch of recycled pages from the central pool to this thread
+static void RefillPageCache(void) {
+  long n;
+  struct HostPage *h, *t;
+  LOCK(&g_allocator.lock);
+  if ((h = g_allocator.pages)) {
+    for (t = h, n = 1; n < kPageBatch && t->next; ++n) t = t->next;
+    g_allocator.pages = t->next;
+    UNLOCK(&g_allocator.lock);
+    t->next = g_pagecache.pages;
+    g_pagecache.pages = h;
+    g_pagecache.n += n;
+  } else {
+    UNLOCK(&g_allocator.lock);
+  }
+}
+
 u64 AllocateAnonymousPage(struct System *s) {
   u8 *page;
-  size_t i, n;
+  size_t n;
   uintptr_t real;
   struct HostPage *h;
-  LOCK(&g_allocator.lock);
-  if ((h = g_allocator.pages)) {
-    g_allocator.pages = h->next;
-    UNLOCK(&g_allocator.lock);
-    page = h->page;
-    FreeHostPage(h);
+  if (!g_pagecache.pages) {
+    RefillPageCache();
+  }
+  if ((h = g_pagecache.pages)) {
+    g_pagecache.pages = h->next;
+    g_pagecache.n -= 1;
+    h->next = 0;
+    page = (u8 *)h;
     goto Finished;
+  }
+  if (g_pagecache.bump < g_pagecache.bumpend || TakePageRun()) {
+    page = g_pagecache.bump;
+    g_pagecache.bump += 4096;
+    goto Finished;
+  }
+  if (FLAG_hugepages) {
+    n = kHugeSize / 4096;
+    page = AllocateHugeChunk();
   } else {
-    UNLOCK(&g_allocator.lock);
+    n = 64;
+    page = (u8 *)AllocateBig(n * 4096, PROT_READ | PROT_WRITE,
+                             MAP_ANONYMOUS_ | MAP_PRIVATE, -1, 0);
   }
-  n = 64;
-  page = (u8 *)AllocateBig(n * 4096, PROT_READ | PROT_WRITE,
-                           MAP_ANONYMOUS_ | MAP_PRIVATE, -1, 0);
   if (!page) return -1;
-  LOCK(&g_allocator.lock);
-  for (i = n; i-- > 1;) {
-    unassert((h = NewHostPage()));
-    h->page = page + i * 4096;
-    h->next = g_allocator.pages;
-    g_allocator.pages = h;
-  }
-  UNLOCK(&g_allocator.lock);
+  AdviseMergeable(page, n * 4096);
+  g_pagecache.bump = page + 4096;
+  g_pagecache.bumpend = page + n * 4096;
 Finished:
-  s->rss += 1;
+  AddRss(s, 1);
   real = (uintptr_t)page;
   unassert(!(real & ~PAGE_TA));
   return real | PAGE_HOST | PAGE_U | PAGE_RW | PAGE_V;
 }
 
+// assigns memory to a page table entry that was reserved by mmap()
+// returns the committed entry, or zero if it couldn't be allocated
+u64 CommitReservedPage(struct System *s, u8 *pslot, u64 entry) {
+  u64 x, page;
+  do {
+    if (entry & (PAGE_HOST | PAGE_MAP | PAGE_MUG)) {
+      // a file-mapped page is being accessed for the first time
+      unassert((entry & (PAGE_HOST | PAGE_MAP)) == (PAGE_HOST | PAGE_MAP));
+      x = entry & ~PAGE_RSRV;
+      if (CasPte(pslot, entry, x)) {
+        s->memstat.committed += 1;
+        s->memstat.reserved -= 1;
+        AddRss(s, 1);
+        entry = x;
+      } else {
+        entry = LoadPte(pslot);
+      }
+    } else if (entry & PAGE_ZIP) {
+      // an anonymous page that BLINK_RECLAIM compressed is being used
+      if ((page = AllocateAnonymousPage(s)) == -1) {
+        return 0;
+      }
+      x = (page & (PAGE_TA | PAGE_HOST)) |
+          (entry & ~(PAGE_TA | PAGE_RSRV | PAGE_ZIP));
+      if (UnzipPage(pslot, entry, x)) {
+        s->memstat.committed += 1;
+        s->memstat.reserved -= 1;
+        entry = x;
+      } else {
+        ClearPage((u8 *)(uintptr_t)(page & PAGE_TA));
+        FreeAnonymousPage(s, (u8 *)(uintptr_t)(page & PAGE_TA));
+        entry = LoadPte(pslot);
+        AddRss(s, -1);
+      }
+    } else {
+      // an anonymous page is being accessed for the first time
+      if ((page = AllocateAnonymousPage(s)) == -1) {
+        return 0;
+      }
+      x = (page & (PAGE_TA | PAGE_HOST)) | (entry & ~(PAGE_TA | PAGE_RSRV));
+      if (CasPte(pslot, entry, x)) {
+        s->memstat.committed += 1;
+        s->memstat.reserved -= 1;
+        entry = x;
+      } else {
+        FreeAnonymousPage(s, (u8 *)(uintptr_t)(page & PAGE_TA));
+        entry = LoadPte(pslot);
+        AddRss(s, -1);
+      }
+    }
+  } while (entry & PAGE_RSRV);
+  return entry;
+}
+
 u64 AllocatePageTable(struct System *s) {
   u64 res;
   if ((res = AllocateAnonymousPage(s)) != -1) {
@@ -473,6 +1010,28 @@ u64 AllocatePageTable(struct System *s) {
   return res;
 }
 
+// creates the page table of a lazy chunk, which happens when one of its
+// pages is touched for the first time, or when only part of it changes.
+// page faults may race to do this without holding mmap_lock, therefore
+// this returns the pde that won, or -1 if we ran out of memory.
+u64 MaterializeLazyChunk(struct System *s, u8 *pde_slot, u64 pde) {
+  u8 *table;
+  u64 entry;
+  unsigned i;
+  if ((entry = AllocatePageTable(s)) == -1) return -1;
+  table = GetPageAddress(s, entry, false);
+  for (i = 0; i < 512; ++i) {
+    StorePte(table + i * 8, GetLazyEntry(pde, (i64)i << 12));
+  }
+  entry += 512 * PAGE_REF;
+  if (CasPte(pde_slot, pde, entry)) {
+    STATISTIC(++lazy_chunks_materialized);
+    return entry;
+  }
+  FreePageTable(s, table);
+  return LoadPte(pde_slot);
+}
+
 bool IsValidAddrSize(i64 virt, i64 size) {
   virt = (i64)((u64)virt << 16) >> 16;
   return size > 0 &&                 //
@@ -483,8 +1042,21 @@ bool IsValidAddrSize(i64 virt, i64 size) {
          virt + size <= 0x800000000000;
 }
 
-void InvalidateSystem(struct System *s, bool tlb, bool icache) {
-#ifdef HAVE_THREADS
+static void ShootdownMachineTlb(struct Machine *m, i64 virt, i64 size) {
+  SpinLock(&m->shootdowns.lock);
+  if (size <= 0 || m->shootdowns.n == kTlbQueueSize) {
+    m->shootdowns.flush = true;
+  } else if (!m->shootdowns.flush) {
+    m->shootdowns.r[m->shootdowns.n].virt = virt;
+    m->shootdowns.r[m->shootdowns.n].size = size;
+    ++m->shootdowns.n;
+  }
+  atomic_store_explicit(&m->invalidated, true, memory_order_release);
+  SpinUnlock(&m->shootdowns.lock);
+}
+
+static void InvalidateMachines(struct System *s, i64 virt, i64 size, bool tlb,
+                               bool icache) {
   struct Dll *e;
   struct Machine *m;
   if (tlb || icache) {
@@ -492,16 +1064,30 @@ void InvalidateSystem(struct System *s, bool tlb, bool icache) {
     for (e = dll_first(s->machines); e; e = dll_next(s->machines, e)) {
       m = MACHINE_CONTAINER(e);
       if (tlb) {
-        atomic_store_explicit(&m->invalidated, true, memory_order_release);
+        ShootdownMachineTlb(m, virt, size);
       }
-      if (icache) {
+      // decoded instructions are checked against the bytes at rip each
+      // time they're used, so a range shootdown only needs to drop the
+      // cached code page, which LoadInstruction2() does when it sees a
+      // shootdown pending. flushing all of them is for mode changes.
+      if (icache && size <= 0) {
         atomic_store_explicit(&m->opcache->invalidated, true,
                               memory_order_release);
       }
     }
     UNLOCK(&s->machines_lock);
   }
-#endif
+}
+
+// flushes the entire tlb of every thread
+void InvalidateSystem(struct System *s, bool tlb, bool icache) {
+  InvalidateMachines(s, 0, 0, tlb, icache);
+}
+
+// removes the pages in [virt,virt+size) from the tlb of every thread
+void InvalidateSystemRange(struct System *s, i64 virt, i64 size,
+                           bool icache) {
+  InvalidateMachines(s, virt, size, true, icache);
 }
 
 struct FileMap *AddFileMap(struct System *s, i64 virt, i64 size,
@@ -599,16 +1185,132 @@ static void WaitForPageToNotBeLocked(struct System *s, i64 virt, u8 *pte) {
   unassert(!IsOrphan(g_machine));
   unassert(!HasPageLock(g_machine, virt & -4096));
 #endif
+#ifdef HAVE_THREADS
   LOCK(&s->pagelocks_lock);
+  atomic_fetch_add_explicit(&s->pagelocks_waiters, 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);  // see CollectPageLocks()
   while (LoadPte(pte) & PAGE_LOCKS) {
     unassert(!pthread_cond_wait(&s->pagelocks_cond, &s->pagelocks_lock));
   }
+  atomic_fetch_sub_explicit(&s->pagelocks_waiters, 1, memory_order_relaxed);
   UNLOCK(&s->pagelocks_lock);
+#endif
+}
+
+struct PageZap {
+  u8 *a, *b;
+  bool always;  // discard runs of any length
+};
+
+// rather than clearing each page that's freed, we ask linux to discard
+// big runs of them, which zero fills them the next time they're used,
+// and gives back the memory in the meantime. a forked process shares
+// anonymous pages with its parent until the host copies them on write
+// so it always does this, because clearing them would copy them. huge
+// pages are left alone otherwise, since discarding would split them.
+static bool CanZapPages(struct System *s) {
+#if defined(__linux) && defined(MADV_DONTNEED)
+  return FLAG_pagesize == 4096 && (s->isfork || !FLAG_hugepages);
+#else
+  return false;
+#endif
+}
+
+static void FlushPageZap(struct System *s, struct PageZap *z) {
+  u8 *p;
+  if (z->a < z->b) {
+#ifdef MADV_DONTNEED
+    if (s->isfork || z->always || z->b - z->a >= kPageZapMin * 4096) {
+      if (!madvise(z->a, z->b - z->a, MADV_DONTNEED)) {
+        ReleasePageRun(z->a, z->b);
+        z->a = z->b = 0;
+        return;
+      }
+      MEM_LOGF("madvise(%p, %#tx, MADV_DONTNEED) failed: %s", z->a,
+               z->b - z->a, DescribeHostErrno(errno));
+    }
+#endif
+    for (p = z->a; p < z->b; p += 4096) {
+      ClearPage(p);
+      FreeAnonymousPage(s, p);
+    }
+    z->a = z->b = 0;
+  }
+}
+
+static void ReleaseAnonymousPage(struct System *s, struct PageZap *z,
+                                 u8 *page) {
+  if (z && CanZapPages(s)) {
+    if (page != z->b) {
+      FlushPageZap(s, z);
+      z->a = page;
+    }
+    z->b = page + 4096;
+  } else {
+    ClearPage(page);
+    FreeAnonymousPage(s, page);
+  }
+}
+
+static long CompressColdTable(struct System *s, u64 table, unsigned level,
+                              struct PageZap *zap) {
+  u8 *mi;
+  long i, n;
+  u64 pt, z;
+  for (n = i = 0; i < 512; ++i) {
+    mi = GetPageAddress(s, table, level == 39) + i * 8;
+    pt = LoadPte(mi);
+    if (!(pt & PAGE_V)) continue;
+    if (level > 12) {
+      // nothing has been committed to a lazy chunk
+      if (!IsLazyChunk(pt)) {
+        n += CompressColdTable(s, pt, level - 9, zap);
+      }
+      continue;
+    }
+    if ((pt & (PAGE_U | PAGE_RSRV | PAGE_HOST | PAGE_MAP | PAGE_MUG |
+               PAGE_SHARE | PAGE_FILE | PAGE_LOCKS | PAGE_XD)) !=
+        (PAGE_U | PAGE_HOST | PAGE_XD)) {
+      continue;
+    }
+    if (pt & PAGE_A) {
+      // if this fails, then the page got walked to again, which is fine
+      CasPte(mi, pt, pt & ~PAGE_A);
+      continue;
+    }
+    if ((z = ZipPage((u8 *)(uintptr_t)(pt & PAGE_TA))) == -1) continue;
+    if (!CasPte(mi, pt, (pt & ~(PAGE_TA | PAGE_HOST)) | PAGE_RSRV | z)) {
+      if (z) FreeZip(z);
+      continue;
+    }
+    s->memstat.committed -= 1;
+    s->memstat.reserved += 1;
+    ReleaseAnonymousPage(s, zap, (u8 *)(uintptr_t)(pt & PAGE_TA));
+    ++n;
+  }
+  return n;
+}
+
+// turns anonymous pages that weren't accessed since the last call back
+// into reservations, which hold on to a compressed copy of the content
+// and clears the accessed bit of the others. guest threads mustn't be
+// able to use a page without walking to it or locking it, which means
+// they're all either parked or inside system calls. returns the number
+// of pages that were taken away from the guest
+long CompressColdPages(struct System *s) {
+  long n;
+  struct PageZap zap = {0, 0, true};
+  if (s->real || !s->cr3) return 0;
+  n = CompressColdTable(s, s->cr3, 39, &zap);
+  FlushPageZap(s, &zap);
+  s->rss -= n;
+  STATISTIC(pages_reclaimed += n);
+  return n;
 }
 
 static bool FreePage(struct System *s, i64 virt, u64 entry, u64 size,
                      bool *executable_code_was_made_non_executable,
-                     long *rss_delta) {
+                     struct PageZap *zap, long *rss_delta) {
   u8 *page;
   long pagesize;
   uintptr_t real, mug;
@@ -616,6 +1318,7 @@ static bool FreePage(struct System *s, i64 virt, u64 entry, u64 size,
   if (entry & PAGE_FILE) UnmarkFilePage(s, virt);
   if (!(entry & PAGE_XD) && !(entry & PAGE_RSRV)) {
     *executable_code_was_made_non_executable = true;
+    if (s->natives) UnmapNatives(s, virt);
 #ifndef DISABLE_JIT
     if (!IsJitDisabled(&s->jit)) {
       ResetJitPage(&s->jit, virt);
@@ -625,8 +1328,8 @@ static bool FreePage(struct System *s, i64 virt, u64 entry, u64 size,
   if ((entry & (PAGE_HOST | PAGE_MAP | PAGE_MUG)) == PAGE_HOST) {
     unassert(~entry & PAGE_RSRV);
     s->memstat.committed -= 1;
-    ClearPage((page = (u8 *)(uintptr_t)(entry & PAGE_TA)));
-    FreeAnonymousPage(s, page);
+    page = (u8 *)(uintptr_t)(entry & PAGE_TA);
+    ReleaseAnonymousPage(s, zap, page);
     --*rss_delta;
     return false;
   } else if ((entry & (PAGE_HOST | PAGE_MAP | PAGE_MUG)) ==
@@ -649,6 +1352,7 @@ static bool FreePage(struct System *s, i64 virt, u64 entry, u64 size,
     --*rss_delta;
     return true;  // call is responsible for freeing
   } else if (entry & PAGE_RSRV) {
+    if (entry & PAGE_ZIP) FreeZip(entry);
     s->memstat.reserved -= 1;
     return false;
   } else {
@@ -657,9 +1361,22 @@ static bool FreePage(struct System *s, i64 virt, u64 entry, u64 size,
   }
 }
 
-static void AddPageToRanges(struct ContiguousMemoryRanges *ranges, i64 virt,
-                            i64 end) {
-  if (!(ranges->i && ranges->p[ranges->i - 1].b == virt)) {
+// frees the pages of a lazy chunk, without creating its page table
+static bool FreeLazyChunk(struct System *s, i64 virt, u64 pde,
+                          bool *executable_code_was_made_non_executable,
+                          struct PageZap *zap, long *rss_delta) {
+  unsigned i;
+  bool res = false;
+  for (i = 0; i < 512; ++i, virt += 4096) {
+    res |= FreePage(s, virt, GetLazyEntry(pde, virt), 4096,
+                    executable_code_was_made_non_executable, zap, rss_delta);
+  }
+  return res;
+}
+
+static void AddIntervalToRanges(struct ContiguousMemoryRanges *ranges, i64 a,
+                                i64 b) {
+  if (!(ranges->i && ranges->p[ranges->i - 1].b == a)) {
     if (ranges->i == ranges->n) {
       if (ranges->n) {
         ranges->n += ranges->n >> 1;
@@ -669,14 +1386,33 @@ static void AddPageToRanges(struct ContiguousMemoryRanges *ranges, i64 virt,
       unassert(ranges->p = (struct ContiguousMemoryRange *)realloc(
                    ranges->p, ranges->n * sizeof(*ranges->p)));
     }
-    ranges->p[ranges->i++].a = virt;
+    ranges->p[ranges->i++].a = a;
   }
-  ranges->p[ranges->i - 1].b = virt + MIN(4096, end - virt);
+  ranges->p[ranges->i - 1].b = b;
 }
 
-// removes page table entries. anonymous pages will be added to the
-// system's free list. mug pages will be freed one by one. linear pages
-// won't be freed, and will instead have their intervals pooled in the
+static void AddPageToRanges(struct ContiguousMemoryRanges *ranges, i64 virt,
+                            i64 end) {
+  AddIntervalToRanges(ranges, virt, virt + MIN(4096, end - virt));
+}
+
+// releases linear memory. in shadow mode the interval gets reserved
+// again, so the host can't put its own mappings inside our window
+static int UnmapLinear(i64 virt, i64 size) {
+  if (HasShadowMapping()) {
+    if (Mmap(ToHost(virt), size, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS_ | MAP_NORESERVE | MAP_FIXED, -1, 0,
+             "shadow") == MAP_FAILED) {
+      return -1;
+    }
+    return 0;
+  }
+  return Munmap(ToHost(virt), size);
+}
+
+// removes page table entries. anonymous pages will be added to the
+// system's free list. mug pages will be freed one by one. linear pages
+// won't be freed, and will instead have their intervals pooled in the
 // ranges data structure; the caller is responsible for freeing those.
 static void RemoveVirtual(struct System *s, i64 virt, i64 size,
                           struct ContiguousMemoryRanges *ranges,
@@ -685,18 +1421,41 @@ static void RemoveVirtual(struct System *s, i64 virt, i64 size,
                           long *vss_delta, long *rss_delta) {
   i64 end;
   u64 i, pt;
-  u8 *pp, *pde;
-  unsigned pi, p1;
+  unsigned pi;
+  u8 *pp, *slots[3];
+  struct PageZap zap = {0};
   unassert(!(virt & 4095));
   MEM_LOGF("RemoveVirtual(%#" PRIx64 ", %#" PRIx64 ")", virt, size);
-  for (pde = 0, end = virt + size; virt < end; virt += (u64)1 << i) {
+  for (end = virt + size; virt < end;
+       virt = (virt | (((u64)1 << i) - 1)) + 1) {
     for (pt = s->cr3, i = 39;; i -= 9) {
-      pi = p1 = (virt >> i) & 511;
+      pi = (virt >> i) & 511;
       pp = GetPageAddress(s, pt, i == 39) + pi * 8;
-      if (i == 12 + 9) pde = pp;
       pt = LoadPte(pp);
       if (i > 12 && !(pt & PAGE_V)) break;
-      if (i > 12) continue;
+      if (i == 21 && IsLazyChunk(pt)) {
+        if (!(virt & 0x1fffff) && end - virt >= 0x200000 &&
+            CasPte(pp, pt, 0)) {
+          if (FreeLazyChunk(s, virt, pt,
+                            executable_code_was_made_non_executable, &zap,
+                            rss_delta) &&
+              HasLinearMapping()) {
+            AddIntervalToRanges(ranges, virt, virt + 0x200000);
+          }
+          *address_space_was_mutated = true;
+          *vss_delta -= 512;
+          DropPageTableRef(s, slots, 1, virt);
+          break;
+        }
+        if ((pt = MaterializeLazyChunk(s, pp, pt)) == -1) {
+          WriteErrorString("munmap() crisis: ran out of page table memory\n");
+          exit(250);
+        }
+      }
+      if (i > 12) {
+        slots[(39 - i) / 9] = pp;
+        continue;
+      }
     LastLevel:
       if (pt & PAGE_V) {
         for (;;) {
@@ -709,12 +1468,18 @@ static void RemoveVirtual(struct System *s, i64 virt, i64 size,
           unassert(pt & PAGE_V);
         }
         if (FreePage(s, virt, pt, MIN(4096, end - virt),
-                     executable_code_was_made_non_executable, rss_delta) &&
+                     executable_code_was_made_non_executable, &zap,
+                     rss_delta) &&
             HasLinearMapping()) {
           AddPageToRanges(ranges, virt, end);
         }
         *address_space_was_mutated = true;
         --*vss_delta;
+        if (DropPageTableRef(s, slots, 2, virt)) {
+          // the page table was freed, since its other entries are zero
+          i = 21;
+          break;
+        }
       }
       if (virt + 4096 < end && pi < 511) {
         pi += 1;
@@ -722,24 +1487,11 @@ static void RemoveVirtual(struct System *s, i64 virt, i64 size,
         pt = LoadPte(pp);
         virt += 4096;
         goto LastLevel;
-      } else if (!p1 && pi == 511) {
-        // when more than 512*4096 bytes are being unmapped, we
-        // opportunistically unmap page directories too, if the
-        // requested interval overlaps an entire page table. we
-        // guarantee safety because mmap_lock is held, which is
-        // required to create/remove (but not edit) the entries
-        // therefore if we observed all entries are zero we can
-        // say for certain it's safe to free. the only question
-        // becomes readers like FindPageTableEntry() that still
-        // crawl an old pointer to a free page table. free page
-        // tables may be crawled because they always get zero'd
-        // before being put into a freelist fifo that cools off
-        FreePageTable(s, GetPageAddress(s, LoadPte(pde), i == 39));
-        StorePte(pde, 0);
       }
       break;
     }
   }
+  FlushPageZap(s, &zap);
 }
 
 _Noreturn static void PanicDueToMmap(void) {
@@ -777,12 +1529,13 @@ static int DetermineHostProtection(int prot) {
 
 i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
                    i64 offset, bool shared, bool fixedmap) {
-  u8 *mi;
+  u8 *mi, *up;
   int demand;
   int method;
   i64 result;
   bool mutated;
   void *got, *want;
+  u8 *bulk = 0;
   long i, pagesize;
   int prot, sysprot;
   long vss_delta, rss_delta;
@@ -795,12 +1548,21 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
   unassert(!(flags & PAGE_MAP));
   unassert(!(flags & PAGE_HOST));
   unassert(!(flags & PAGE_RSRV));
+  unassert(!(flags & PAGE_SHARE));
   unassert(s->mode.omode == XED_MODE_LONG);
 
   // determine memory protection
   prot = GetProtection(flags);
   sysprot = DetermineHostProtection(prot);
 
+  // forked processes see these pages at the same address as we do
+  if (shared) flags |= PAGE_SHARE;
+
+#ifndef DISABLE_VFS
+  // linux considers pages of new mappings to be soft dirty
+  flags |= PAGE_D;
+#endif
+
   MEM_LOGF("ReserveVirtual(%#" PRIx64 ", %#" PRIx64 ", %s)", virt, size,
            DescribeProt(prot));
 
@@ -815,6 +1577,13 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
     return einval();
   }
 
+  if (HasShadowMapping() && (virt < 0 || virt + size > FLAG_shadowsize)) {
+    LOGF("mmap(addr=%#" PRIx64 ", size=%#" PRIx64 ") doesn't fit inside "
+         "the shadow memory window (try using `blink -m`)",
+         virt, size);
+    return enomem();
+  }
+
   pagesize = FLAG_pagesize;
 
   if (HasLinearMapping()) {
@@ -832,8 +1601,9 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
   mutated = false;
   executable_code_was_made_non_executable = false;
   pages = ROUNDUP(size, 4096) / 4096;
-  if (HasLinearMapping() && FLAG_vabits <= 47) {
-    if (fixedmap) {
+  if (HasLinearMapping() && (FLAG_vabits <= 47 || HasShadowMapping())) {
+    if (fixedmap || HasShadowMapping()) {
+      // the shadow window belongs to us, so it's always safe to clobber
       method = MAP_FIXED;
     } else if (virt) {
       method = MAP_DEMAND;
@@ -860,7 +1630,7 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
       } else {
         // holes exist; try to create a greenfield
         for (i = 0; i < ranges.i; ++i) {
-          Munmap(ToHost(ranges.p[i].a), ranges.p[i].b - ranges.p[i].a);
+          UnmapLinear(ranges.p[i].a, ranges.p[i].b - ranges.p[i].a);
           mutated = true;
         }
         // errors in Munmap() should propagate to Mmap() below
@@ -881,7 +1651,7 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
     // the solution is most likely to rebuild with -Wl,-Ttext-segment=
     // please note we need to take off the seatbelt after an execve().
     errno = 0;
-    want = virt ? ToHost(virt) : 0;
+    want = virt || HasShadowMapping() ? ToHost(virt) : 0;
     if ((got = Mmap(want, size, sysprot,                    //
                     (method |                               //
                      (fd == -1 ? MAP_ANONYMOUS_ : 0) |      //
@@ -906,6 +1676,12 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
         PanicDueToMmap();
       }
     }
+    if (FLAG_hugepages && fd == -1 && !shared) {
+      AdviseHugePages(ToHost(virt), size);
+    }
+    if (fd == -1 && !shared) {
+      AdviseMergeable(ToHost(virt), size);
+    }
     s->memstat.committed += pages;
     flags |= PAGE_HOST | PAGE_MAP;
     vss_delta += pages;
@@ -914,6 +1690,27 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
     vss_delta += pages;
     s->memstat.reserved += pages;
     flags |= PAGE_HOST | PAGE_MAP | PAGE_MUG | PAGE_RSRV;
+    // when host pages are the same size as guest pages, the interval is
+    // backed by a single host mapping of the file, which page table
+    // entries then point into. since each mug is still freed, protected
+    // and synced as its own 4096 byte piece, that works the same way as
+    // giving every page its own mapping, except it doesn't need a system
+    // call per page, nor exhaust the host's limit on number of mappings.
+    if (pagesize == 4096) {
+      int bulkflags = (shared ? MAP_SHARED : MAP_PRIVATE) |
+                      (fd == -1 ? MAP_ANONYMOUS_ : 0);
+      if (!(bulk = (u8 *)AllocateBig(size, sysprot, bulkflags, fd, offset))) {
+        if (errno == ENOMEM && !mutated) {
+          s->memstat.reserved -= pages;
+          LOGF("host system returned ENOMEM");
+          return -1;
+        }
+        ERRF("mmap(virt=%" PRIx64 ", size=%" PRId64
+             ", flags=%#x, fd=%d, offset=%#" PRIx64 ") crisis: %s",
+             virt, size, bulkflags, fd, (u64)offset, DescribeHostErrno(errno));
+        PanicDueToMmap();
+      }
+    }
   } else {
     flags |= PAGE_RSRV;
     vss_delta += pages;
@@ -931,24 +1728,54 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
 
   // add pml4t entries ensuring intermediary tables exist
   for (result = virt, end = virt + size;;) {
-    for (pt = s->cr3, level = 39; level >= 12; level -= 9) {
+    for (up = 0, pt = s->cr3, level = 39; level >= 12; level -= 9) {
       ti = (virt >> level) & 511;
       mi = GetPageAddress(s, pt, level == 39) + ti * 8;
       if (level > 12) {
         pt = LoadPte(mi);
+        if (level == 21 && !(flags & PAGE_MUG) && !(virt & 0x1fffff) &&
+            end - virt >= 0x200000) {
+          // reserve a whole 2mb chunk without creating its page table
+          if (flags & PAGE_MAP) {
+            entry = (uintptr_t)ToHost(virt) | flags | PAGE_PS | PAGE_V;
+          } else {
+            entry = flags | PAGE_PS | PAGE_V;
+          }
+          if (!(pt & PAGE_V)) {
+            StorePte(mi, entry);
+            AddPageTableRef(up);
+            goto NextChunk;
+          }
+          if (IsLazyChunk(pt) && CasPte(mi, pt, entry)) {
+            FreeLazyChunk(s, virt, pt, &executable_code_was_made_non_executable,
+                          0, &rss_delta);
+            goto NextChunk;
+          }
+          pt = LoadPte(mi);
+        }
+        if (level == 21 && IsLazyChunk(pt)) {
+          pt = MaterializeLazyChunk(s, mi, pt);
+        }
         if (!(pt & PAGE_V)) {
-          if ((pt = AllocatePageTable(s)) == -1) {
-            WriteErrorString("mmap() crisis: ran out of page table memory\n");
-            exit(250);
+          pt = AllocatePageTable(s);
+          if (pt != -1) {
+            StorePte(mi, pt);
+            if (up) AddPageTableRef(up);
           }
-          StorePte(mi, pt);
         }
+        if (pt == -1) {
+          WriteErrorString("mmap() crisis: ran out of page table memory\n");
+          exit(250);
+        }
+        up = mi;
         continue;
       }
       for (;;) {
         uintptr_t real;
         if (flags & PAGE_MAP) {
-          if (flags & PAGE_MUG) {
+          if (bulk) {
+            real = (uintptr_t)bulk + (virt - result);
+          } else if (flags & PAGE_MUG) {
             void *mug;
             off_t mugoff;
             int mugflags;
@@ -995,32 +1822,41 @@ i64 ReserveVirtual(struct System *s, i64 virt, i64 size, u64 flags, int fd,
         }
         if (pt & PAGE_V) {
           FreePage(s, virt, pt, 4096, &executable_code_was_made_non_executable,
-                   &rss_delta);
-        }
-        if ((virt += 4096) >= end) {
-          s->rss += rss_delta;
-          s->vss += vss_delta;
-#ifndef DISABLE_JIT
-          if (HasLinearMapping() && !IsJitDisabled(&s->jit)) {
-            result = ProtectRwxMemory(s, result, result, size, pagesize, prot);
-          }
-#endif
-          InvalidateSystem(s, !!rss_delta,
-                           executable_code_was_made_non_executable);
-          return result;
+                   0, &rss_delta);
+        } else {
+          AddPageTableRef(up);
         }
+        if ((virt += 4096) >= end) goto Finished;
         if (++ti == 512) break;
         mi += 8;
       }
     }
+    continue;
+  NextChunk:
+    STATISTIC(++lazy_chunks_reserved);
+    if ((virt += 0x200000) >= end) break;
   }
+Finished:
+  s->rss += rss_delta;
+  s->vss += vss_delta;
+#ifndef DISABLE_JIT
+  if (HasLinearMapping() && !IsJitDisabled(&s->jit)) {
+    result = ProtectRwxMemory(s, result, result, size, pagesize, prot);
+  }
+#endif
+  if (rss_delta || executable_code_was_made_non_executable) {
+    InvalidateSystemRange(s, result, size,
+                          executable_code_was_made_non_executable);
+  }
+  return result;
 }
 
 i64 FindVirtual(struct System *s, i64 virt, i64 size) {
   u64 i, pt, got, orig_virt = virt;
   (void)orig_virt;
 StartOver:
-  if (!IsValidAddrSize(virt, size)) {
+  if (!IsValidAddrSize(virt, size) ||
+      (HasShadowMapping() && virt + size > FLAG_shadowsize)) {
     LOGF("FindVirtual [%#" PRIx64 ",%#" PRIx64 ") -> "
          "[%#" PRIx64 ",%#" PRIx64 ") not possible",
          orig_virt, orig_virt + size, virt, virt + size);
@@ -1031,7 +1867,7 @@ StartOver:
     for (i = 39, pt = s->cr3;; i -= 9) {
       pt = LoadPte(GetPageAddress(s, pt, i == 39) +
                    (((virt + got) >> i) & 511) * 8);
-      if (i == 12 || !(pt & PAGE_V)) break;
+      if (i == 12 || !(pt & PAGE_V) || IsLazyChunk(pt)) break;
     }
     got += (u64)1 << i;
     if ((pt & PAGE_V)) {
@@ -1042,7 +1878,8 @@ StartOver:
   return virt;
 }
 
-int FreeVirtual(struct System *s, i64 virt, i64 size) {
+static int FreeVirtualImpl(struct System *s, i64 virt, i64 size,
+                           bool unmap_linear_memory) {
   int rc;
   long i;
   bool mutated;
@@ -1062,8 +1899,8 @@ int FreeVirtual(struct System *s, i64 virt, i64 size) {
   RemoveVirtual(s, virt, size, &ranges,
                 &executable_code_was_made_non_executable, &mutated, &vss_delta,
                 &rss_delta);
-  for (rc = i = 0; i < ranges.i; ++i) {
-    if (Munmap(ToHost(ranges.p[i].a), ranges.p[i].b - ranges.p[i].a)) {
+  for (rc = i = 0; unmap_linear_memory && i < ranges.i; ++i) {
+    if (UnmapLinear(ranges.p[i].a, ranges.p[i].b - ranges.p[i].a)) {
       LOGF("failed to %s subrange"
            " [%" PRIx64 ",%" PRIx64 ") within requested range"
            " [%" PRIx64 ",%" PRIx64 "): %s",
@@ -1075,11 +1912,176 @@ int FreeVirtual(struct System *s, i64 virt, i64 size) {
   free(ranges.p);
   s->vss += vss_delta;
   s->rss += rss_delta;
-  s->memchurn -= vss_delta;
-  InvalidateSystem(s, !!rss_delta, executable_code_was_made_non_executable);
+  if (rss_delta || executable_code_was_made_non_executable) {
+    InvalidateSystemRange(s, virt, size,
+                          executable_code_was_made_non_executable);
+  }
   return rc;
 }
 
+int FreeVirtual(struct System *s, i64 virt, i64 size) {
+  return FreeVirtualImpl(s, virt, size, true);
+}
+
+// returns last level entry of virt, and optionally the ones before it
+static u8 *GetPteSlot(struct System *s, i64 virt, u8 *slots[3]) {
+  u8 *mi;
+  u64 pt;
+  long level;
+  for (pt = s->cr3, level = 39;; level -= 9) {
+    mi = GetPageAddress(s, pt, level == 39) + ((virt >> level) & 511) * 8;
+    if (level == 12) return mi;
+    if (slots) slots[(39 - level) / 9] = mi;
+    pt = LoadPte(mi);
+    if (IsLazyChunk(pt) && (pt = MaterializeLazyChunk(s, mi, pt)) == -1) {
+      return 0;
+    }
+    if (!(pt & PAGE_V)) return 0;
+  }
+}
+
+// returns true if virt is in a MAP_SHARED mapping
+bool IsSharedMemory(struct System *s, i64 virt) {
+  u8 *mi;
+  bool res;
+  LOCK(&s->mmap_lock);
+  res = (mi = GetPteSlot(s, virt, 0)) &&
+        (LoadPte(mi) & (PAGE_V | PAGE_SHARE)) == (PAGE_V | PAGE_SHARE);
+  UNLOCK(&s->mmap_lock);
+  return res;
+}
+
+// checks an interval only holds memory mremap() knows how to move and
+// returns the protection of its last page, which a grown mapping gets
+static int CheckRemappable(struct System *s, i64 virt, i64 size, u64 *key) {
+  u8 *mi;
+  u64 pt;
+  i64 end;
+  for (end = virt + size; virt < end; virt += 4096) {
+    if (!(mi = GetPteSlot(s, virt, 0)) || !((pt = LoadPte(mi)) & PAGE_V)) {
+      return efault();
+    }
+    if (pt & (PAGE_FILE | PAGE_MUG | PAGE_SHARE)) {
+      LOG_ONCE(MEM_LOGF("mremap() of file or shared memory not supported"));
+      return enomem();
+    }
+    *key = pt & (PAGE_U | PAGE_RW | PAGE_XD);
+  }
+  return 0;
+}
+
+// moves page table entries to a range that ReserveVirtual() just made
+static void MoveVirtual(struct System *s, i64 virt, i64 size, i64 dest) {
+  i64 i;
+  u64 pt;
+  u8 *src, *dst, *slots[3];
+  bool executable_code_was_made_non_executable = false;
+  for (i = 0; i < size; i += 4096) {
+    unassert((src = GetPteSlot(s, virt + i, slots)));
+    unassert((dst = GetPteSlot(s, dest + i, 0)));
+    for (;;) {
+      pt = LoadPte(src);
+      if (pt & PAGE_LOCKS) {
+        WaitForPageToNotBeLocked(s, virt + i, src);
+      } else if (CasPte(src, pt, 0)) {
+        break;
+      }
+    }
+    unassert(pt & PAGE_V);
+    if (!(pt & PAGE_XD) && !(pt & PAGE_RSRV)) {
+      executable_code_was_made_non_executable = true;
+#ifndef DISABLE_JIT
+      if (!IsJitDisabled(&s->jit)) {
+        ResetJitPage(&s->jit, virt + i);
+      }
+#endif
+    }
+    unassert(LoadPte(dst) & PAGE_RSRV);
+    StorePte(dst, pt);
+    DropPageTableRef(s, slots, 2, virt + i);
+    s->memstat.reserved -= 1;
+    s->vss -= 1;
+  }
+  InvalidateSystemRange(s, virt, size, executable_code_was_made_non_executable);
+}
+
+// resizes a mapping, moving it to dest if dest isn't virt. page table
+// entries are moved rather than the memory they point to. with linear
+// memory, the host's mremap() moves the memory without copying it, and
+// a dest of 0 lets the host choose the address.
+i64 RemapVirtual(struct System *s, i64 virt, i64 size, i64 newsize, i64 dest,
+                 bool fixedmap) {
+  u64 key = 0;
+  i64 tail, got;
+  MEM_LOGF("RemapVirtual(%#" PRIx64 ", %#" PRIx64 ", %#" PRIx64
+           ", %#" PRIx64 ")",
+           virt, size, newsize, dest);
+  if (!IsValidAddrSize(virt, size) || !IsValidAddrSize(virt, newsize)) {
+    return einval();
+  }
+  if (dest == virt && newsize <= size) {
+    if (!IsFullyMapped(s, virt, size)) return efault();
+    if (newsize < size && FreeVirtual(s, virt + newsize, size - newsize)) {
+      return -1;
+    }
+    return virt;
+  }
+  if (CheckRemappable(s, virt, size, &key) == -1) return -1;
+  if (HasLinearMapping()) {
+#if !defined(__linux) || !defined(MREMAP_FIXED)
+    LOG_ONCE(MEM_LOGF("mremap() of linear memory needs a linux host"));
+    return enomem();
+#endif
+  }
+  if (dest == virt) {
+    // grow the mapping in place if nothing is in the way. we can't know
+    // what the host has put after a linear mapping, unless it's in the
+    // shadow window where blink owns everything, so the host's mremap()
+    // is asked to grow it first, which fails if something's in the way
+    tail = virt + size;
+    if (!IsFullyUnmapped(s, tail, newsize - size)) return enomem();
+    if (HasLinearMapping() && !HasShadowMapping()) {
+#if defined(__linux) && defined(MREMAP_FIXED)
+      if ((tail & (FLAG_pagesize - 1)) ||
+          mremap(ToHost(virt), size, newsize, 0) == MAP_FAILED) {
+        return enomem();
+      }
+#else
+      return enomem();
+#endif
+    }
+    if (ReserveVirtual(s, tail, newsize - size, key, -1, 0, false,
+                       HasLinearMapping()) == -1) {
+      return -1;
+    }
+    return virt;
+  }
+  if (newsize < size) {
+    if (FreeVirtual(s, virt + newsize, size - newsize)) return -1;
+    size = newsize;
+  }
+  if ((got = ReserveVirtual(s, dest, newsize, key, -1, 0, false, fixedmap)) ==
+      -1) {
+    return -1;
+  }
+#if defined(__linux) && defined(MREMAP_FIXED)
+  if (HasLinearMapping()) {
+    if (mremap(ToHost(virt), size, newsize, MREMAP_MAYMOVE | MREMAP_FIXED,
+               ToHost(got)) == MAP_FAILED) {
+      MEM_LOGF("mremap(%#" PRIx64 ") to %#" PRIx64 " failed: %s", virt, got,
+               DescribeHostErrno(errno));
+      FreeVirtual(s, got, newsize);
+      return enomem();
+    }
+    // mremap() leaves a hole in the shadow window that must be plugged
+    FreeVirtualImpl(s, virt, size, HasShadowMapping());
+    return got;
+  }
+#endif
+  MoveVirtual(s, virt, size, got);
+  return got;
+}
+
 int GetProtection(u64 key) {
   int prot = 0;
   if (key & PAGE_U) prot |= PROT_READ;
@@ -1109,6 +2111,12 @@ bool IsFullyMapped(struct System *s, i64 virt, i64 size) {
         if (!(pt & PAGE_V)) {
           return false;
         }
+        if (IsLazyChunk(pt)) {
+          if ((virt = (virt | 0x1fffff) + 1) >= end) {
+            return true;
+          }
+          break;
+        }
         continue;
       }
       for (;;) {
@@ -1125,17 +2133,253 @@ bool IsFullyMapped(struct System *s, i64 virt, i64 size) {
   }
 }
 
+// copies the page table entries of `pages` pages starting at `virt` to
+// `out`, skipping over unmapped subtrees whole. unmapped pages are zero
+// and pages of lazy chunks get the entries that materializing would make
+void GetPageTableEntries(struct System *s, i64 virt, long pages, u64 *out) {
+  u8 *mi;
+  u64 pt;
+  long i, n;
+  i64 ti, level;
+  for (i = 0; i < pages;) {
+    for (pt = s->cr3, level = 39; level >= 12; level -= 9) {
+      ti = (virt >> level) & 511;
+      mi = GetPageAddress(s, pt, level == 39) + ti * 8;
+      pt = LoadPte(mi);
+      if (level > 12) {
+        if (!(pt & PAGE_V) || IsLazyChunk(pt)) {
+          n = ((virt | (((i64)1 << level) - 1)) + 1 - virt) / 4096;
+          for (n = MIN(n, pages - i); n--; virt += 4096) {
+            out[i++] = (pt & PAGE_V) ? GetLazyEntry(pt, virt) : 0;
+          }
+          break;
+        }
+        continue;
+      }
+      for (;;) {
+        out[i++] = pt;
+        virt += 4096;
+        if (i == pages || ++ti == 512) break;
+        pt = LoadPte((mi += 8));
+      }
+    }
+  }
+}
+
+// sets vec[i] to 1 if page `i` of the interval at `virt`, whose entries
+// are `pt`, is resident in memory, and to 0 otherwise. linear memory is
+// committed when it's mapped, so the host is asked which of it is paged
+// in. hosts without mincore() get all of it reported as resident, which
+// includes the lazy chunks that linear memory never materializes
+void GetResidentPages(struct System *s, i64 virt, long pages, const u64 *pt,
+                      u8 *vec) {
+  long i;
+#if defined(__linux) && defined(HAVE_MINCORE)
+  long j, n;
+  unsigned char hvec[512];
+#endif
+  for (i = 0; i < pages; ++i) {
+    vec[i] = (pt[i] & (PAGE_V | PAGE_RSRV)) == PAGE_V;
+  }
+#if defined(__linux) && defined(HAVE_MINCORE)
+  if (!HasLinearMapping() || FLAG_pagesize != 4096) return;
+  for (i = 0; i < pages; i += n) {
+    for (n = 0; n < ARRAYLEN(hvec) && i + n < pages && vec[i + n] &&
+                (pt[i + n] & (PAGE_MAP | PAGE_MUG)) == PAGE_MAP;
+         ++n) {
+    }
+    if (!n) {
+      n = 1;
+    } else if (!mincore(ToHost(virt + i * 4096), n * 4096, hvec)) {
+      for (j = 0; j < n; ++j) {
+        vec[i + j] = hvec[j] & 1;
+      }
+    }
+  }
+#endif
+}
+
+#ifndef DISABLE_VFS
+// soft dirty bits are only reported by /proc/self/pagemap, so they're
+// only tracked when blink is built with its virtual filesystem
+
+// returns slot of page table entry for virt, or null if its table
+// doesn't exist, e.g. because the page is unmapped or in a lazy chunk
+// @asyncsignalsafe
+static u8 *GetPageTableSlot(struct System *s, i64 virt) {
+  u8 *mi;
+  u64 pt;
+  i64 level;
+  for (pt = s->cr3, level = 39;; level -= 9) {
+    mi = GetPageAddress(s, pt, level == 39) + ((virt >> level) & 511) * 8;
+    if (level == 12) return mi;
+    pt = LoadPte(mi);
+    if (!(pt & PAGE_V) || IsLazyChunk(pt)) return 0;
+  }
+}
+
+// returns true if writes to page of linear memory can be intercepted by
+// write protecting it on the host, which is how soft dirty bits get set
+// in linear mode, since its memory is accessed without the page tables
+// executable pages are skipped, since they're the smc detector's job
+static bool IsSoftDirtyTrackable(u64 pt) {
+  return FLAG_pagesize == 4096 &&
+         (pt & (PAGE_V | PAGE_U | PAGE_RW | PAGE_XD | PAGE_HOST | PAGE_MAP |
+                PAGE_MUG | PAGE_RSRV)) ==
+             (PAGE_V | PAGE_U | PAGE_RW | PAGE_XD | PAGE_HOST | PAGE_MAP);
+}
+
+// records that a page is being written, so it'll be reported as soft
+// dirty, and lets its host page be written again if it was protected
+// @return false if page isn't mapped writable
+// @asyncsignalsafe
+bool MarkPageDirty(struct System *s, i64 virt) {
+  u8 *mi;
+  u64 pt;
+  virt &= -4096;
+  if (!(mi = GetPageTableSlot(s, virt))) return false;
+  do {
+    pt = LoadPte(mi);
+    if ((pt & (PAGE_V | PAGE_RW)) != (PAGE_V | PAGE_RW)) return false;
+  } while (!(pt & PAGE_D) && !CasPte(mi, pt, pt | PAGE_D));
+  if (HasLinearMapping() && IsSoftDirtyTrackable(pt) &&
+      mprotect(ToHost(virt), 4096, PROT_READ | PROT_WRITE)) {
+    return false;
+  }
+  return true;
+}
+
+// clears soft dirty bit of every page, for writes of 4 to clear_refs.
+// pages of linear memory are write protected on the host, so that the
+// first write to each one faults, unless their writes can't be caught
+// in which case they're left dirty, since false positives are allowed
+void ClearSoftDirty(struct System *s) {
+  u8 *mi;
+  u64 pt;
+  long i;
+  i64 ti, virt, level;
+  struct ContiguousMemoryRanges ranges;
+  STATISTIC(++softdirty_clears);
+  memset(&ranges, 0, sizeof(ranges));
+  for (virt = 0; virt < 0x800000000000;) {
+    for (pt = s->cr3, level = 39; level >= 12; level -= 9) {
+      ti = (virt >> level) & 511;
+      mi = GetPageAddress(s, pt, level == 39) + ti * 8;
+      pt = LoadPte(mi);
+      if (level > 12) {
+        if (!(pt & PAGE_V) || IsLazyChunk(pt)) {
+          virt = (virt | (((i64)1 << level) - 1)) + 1;
+          break;
+        }
+        continue;
+      }
+      for (;;) {
+        while ((pt & (PAGE_V | PAGE_D)) == (PAGE_V | PAGE_D)) {
+          if (HasLinearMapping() && !IsSoftDirtyTrackable(pt)) break;
+          if (CasPte(mi, pt, pt & ~PAGE_D)) {
+            if (HasLinearMapping()) {
+              AddPageToRanges(&ranges, virt, 0x800000000000);
+            }
+            break;
+          }
+          pt = LoadPte(mi);
+        }
+        virt += 4096;
+        if (++ti == 512) break;
+        pt = LoadPte((mi += 8));
+      }
+    }
+  }
+  for (i = 0; i < ranges.i; ++i) {
+    if (Mprotect(ToHost(ranges.p[i].a), ranges.p[i].b - ranges.p[i].a,
+                 PROT_READ, "softdirty")) {
+      LOGF("failed to write protect [%" PRIx64 ",%" PRIx64 "): %s",
+           ranges.p[i].a, ranges.p[i].b, DescribeHostErrno(errno));
+    }
+  }
+  free(ranges.p);
+  // tlb entries remember that pages were dirty, so writes skip the check
+  InvalidateSystem(s, true, false);
+}
+
+// returns true if host segfault was a write to a page of linear memory
+// whose soft dirty bit was cleared, in which case it's set again
+// @asyncsignalsafe
+bool IsSoftDirtySegfault(struct Machine *m, const siginfo_t *si) {
+  u8 *mi;
+  i64 virt;
+  if (!HasLinearMapping()) return false;
+  if (si->si_signo != SIGSEGV) return false;
+  if (si->si_code != SEGV_ACCERR) return false;
+  virt = ToGuest(si->si_addr);
+  if (!(0 <= virt && virt < 0x800000000000)) return false;
+  if (!(mi = GetPageTableSlot(m->system, virt & -4096))) return false;
+  if (!IsSoftDirtyTrackable(LoadPte(mi))) return false;
+  STATISTIC(++softdirty_segfaults);
+  return MarkPageDirty(m->system, virt);
+}
+
+#endif /* DISABLE_VFS */
+
+// commits memory for a reserved interval ahead of time, for MAP_POPULATE
+// this is advisory, so it stops quietly once we run out of resident memory
+void PopulateVirtual(struct System *s, i64 virt, i64 size, bool write) {
+  u8 *mi;
+  u64 pt;
+  i64 ti, end, level;
+  if (HasLinearMapping()) {
+#if defined(MADV_POPULATE_WRITE) && defined(MADV_POPULATE_READ)
+    if (madvise(ToHost(virt), size,
+                write ? MADV_POPULATE_WRITE : MADV_POPULATE_READ)) {
+      MEM_LOGF("madvise(%#" PRIx64 ", %#" PRIx64 ", MADV_POPULATE) failed: %s",
+               virt, size, DescribeHostErrno(errno));
+    }
+#endif
+    return;
+  }
+  for (end = virt + size;;) {
+    for (pt = s->cr3, level = 39; level >= 12; level -= 9) {
+      ti = (virt >> level) & 511;
+      mi = GetPageAddress(s, pt, level == 39) + ti * 8;
+      pt = LoadPte(mi);
+      if (level > 12) {
+        if (IsLazyChunk(pt) && (pt = MaterializeLazyChunk(s, mi, pt)) == -1) {
+          return;
+        }
+        if (!(pt & PAGE_V)) {
+          return;
+        }
+        continue;
+      }
+      for (;;) {
+        if ((pt & (PAGE_V | PAGE_U | PAGE_RSRV | PAGE_LOCKS)) ==
+            (PAGE_V | PAGE_U | PAGE_RSRV)) {
+          if (GetRss(s) >= GetMaxRss(s) || !CommitReservedPage(s, mi, pt)) {
+            return;
+          }
+        }
+        if ((virt += 4096) >= end) {
+          return;
+        }
+        if (++ti == 512) break;
+        pt = LoadPte((mi += 8));
+      }
+    }
+  }
+}
+
 bool IsFullyUnmapped(struct System *s, i64 virt, i64 size) {
   u8 *mi;
   i64 end;
   u64 i, pt;
-  for (end = virt + size; virt < end; virt += (u64)1 << i) {
+  for (end = virt + size; virt < end;
+       virt = (virt | (((u64)1 << i) - 1)) + 1) {
     for (pt = s->cr3, i = 39;; i -= 9) {
       mi = GetPageAddress(s, pt, i == 39) + ((virt >> i) & 511) * 8;
       pt = LoadPte(mi);
       if (!(pt & PAGE_V)) {
         break;
-      } else if (i == 12) {
+      } else if (i == 12 || IsLazyChunk(pt)) {
         return false;
       }
     }
@@ -1190,6 +2434,31 @@ int ProtectVirtual(struct System *s, i64 virt, i64 size, int prot,
         if (!(pt & PAGE_V)) {
           goto MemoryDisappeared;
         }
+        if (IsLazyChunk(pt) && !hostonly && !(virt & 0x1fffff) &&
+            end - virt >= 0x200000 &&
+            CasPte(mi, pt, (pt & ~(PAGE_U | PAGE_RW | PAGE_XD)) | key)) {
+          // the whole chunk changes, so it can stay lazy
+          if (HasLinearMapping() && (pt & PAGE_MAP)) {
+            AddIntervalToRanges(&ranges, virt, virt + 0x200000);
+          }
+          if (!(pt & PAGE_XD) && (key & PAGE_XD) && !(pt & PAGE_RSRV)) {
+            executable_code_was_made_non_executable = true;
+#ifdef HAVE_JIT
+            if (!IsJitDisabled(&s->jit)) {
+              for (i = 0; i < 512; ++i) {
+                ResetJitPage(&s->jit, virt + i * 4096);
+              }
+            }
+#endif
+          }
+          if ((virt += 0x200000) >= end) {
+            goto FinishedCrawling;
+          }
+          break;
+        }
+        if (IsLazyChunk(pt) && (pt = MaterializeLazyChunk(s, mi, pt)) == -1) {
+          goto MemoryDisappeared;
+        }
         continue;
       }
       for (;;) {
@@ -1212,6 +2481,10 @@ int ProtectVirtual(struct System *s, i64 virt, i64 size, int prot,
         if (!hostonly) {
           for (;;) {
             pt2 = (pt & ~(PAGE_U | PAGE_RW | PAGE_XD)) | key;
+#ifndef DISABLE_VFS
+            // its host page is reprotected, so writes aren't caught
+            if (HasLinearMapping()) pt2 |= PAGE_D;
+#endif
             if (CasPte(mi, pt, pt2)) break;
             pt = LoadPte(mi);
             if (!(pt & PAGE_V)) {
@@ -1258,7 +2531,8 @@ FinishedCrawling:
       ProtectRwxMemory(s, rc, orig_virt, size, pagesize, prot);
     }
 #endif
-    InvalidateSystem(s, true, executable_code_was_made_non_executable);
+    InvalidateSystemRange(s, orig_virt, size,
+                          executable_code_was_made_non_executable);
   }
   return rc;
 MemoryDisappeared:
@@ -1279,7 +2553,7 @@ int SyncVirtual(struct System *s, i64 virt, i64 size, int sysflags) {
   u8 *mi;
   u64 pt;
   i64 orig_virt;
-  i64 ti, end, level;
+  i64 ti, end, next, level;
   long i, skew, pagesize;
   struct ContiguousMemoryRanges ranges;
   if (!IsValidAddrSize(virt, size)) {
@@ -1307,6 +2581,17 @@ int SyncVirtual(struct System *s, i64 virt, i64 size, int sysflags) {
         if (!(pt & PAGE_V)) {
           goto MemoryDisappeared;
         }
+        if (IsLazyChunk(pt)) {
+          // lazy chunks are never mugged, so only linear memory syncs
+          next = MIN((virt | 0x1fffff) + 1, end);
+          if (HasLinearMapping() && (pt & PAGE_MAP)) {
+            AddIntervalToRanges(&ranges, virt, next);
+          }
+          if ((virt = next) >= end) {
+            goto FinishedCrawling;
+          }
+          break;
+        }
         continue;
       }
       for (;;) {
@@ -1360,6 +2645,111 @@ MemoryDisappeared:
   return enomem();
 }
 
+// returns the memory behind an interval to the host, for MADV_DONTNEED
+// anonymous pages go back to being reserved, so they'll read as zero.
+// file pages are dropped by the host so they get read from the file.
+int DiscardVirtual(struct System *s, i64 virt, i64 size) {
+  u8 *mi;
+  u64 pt;
+  uintptr_t a, b;
+  long pagesize, rss_delta;
+  i64 ti, end, level, orig_virt;
+  struct PageZap zap = {0};
+  if (!IsValidAddrSize(virt, size)) {
+    return einval();
+  }
+  if (!IsFullyMapped(s, virt, size)) {
+    return enomem();
+  }
+  pagesize = FLAG_pagesize;
+  if (HasLinearMapping()) {
+    // only linux promises that discarded anonymous pages read as zero
+#if defined(__linux) && defined(MADV_DONTNEED)
+    a = ROUNDUP((uintptr_t)ToHost(virt), pagesize);
+    b = ROUNDDOWN((uintptr_t)ToHost(virt + size), pagesize);
+    if (a < b && madvise((void *)a, b - a, MADV_DONTNEED)) {
+      LOGF("madvise(%#" PRIxPTR ", %#" PRIxPTR ", MADV_DONTNEED) failed: %s",
+           a, b - a, DescribeHostErrno(errno));
+      return -1;
+    }
+#endif
+    return 0;
+  }
+  rss_delta = 0;
+  orig_virt = virt;
+  for (end = virt + size;;) {
+    for (pt = s->cr3, level = 39; level >= 12; level -= 9) {
+      ti = (virt >> level) & 511;
+      mi = GetPageAddress(s, pt, level == 39) + ti * 8;
+      pt = LoadPte(mi);
+      if (level > 12) {
+        if (!(pt & PAGE_V)) {
+          goto FinishedCrawling;
+        }
+        if (IsLazyChunk(pt)) {
+          // nothing was committed to a lazy chunk, so there's no memory
+          if ((virt = (virt | 0x1fffff) + 1) >= end) {
+            goto FinishedCrawling;
+          }
+          break;
+        }
+        continue;
+      }
+      for (;;) {
+        if ((pt & (PAGE_V | PAGE_HOST | PAGE_MAP | PAGE_MUG | PAGE_RSRV)) ==
+            (PAGE_V | PAGE_HOST)) {
+          for (;;) {
+            if (pt & PAGE_LOCKS) {
+              WaitForPageToNotBeLocked(s, virt, mi);
+            } else if (CasPte(mi, pt,
+                              (pt & ~(PAGE_TA | PAGE_HOST)) | PAGE_RSRV)) {
+              break;
+            }
+            pt = LoadPte(mi);
+          }
+          s->memstat.committed -= 1;
+          s->memstat.reserved += 1;
+          ReleaseAnonymousPage(s, &zap, (u8 *)(uintptr_t)(pt & PAGE_TA));
+          --rss_delta;
+        } else if ((pt & (PAGE_V | PAGE_RSRV | PAGE_ZIP)) ==
+                   (PAGE_V | PAGE_RSRV | PAGE_ZIP)) {
+          // the compressed copy of a reclaimed page is thrown away too
+          do {
+            if (CasPte(mi, pt, pt & ~(PAGE_TA | PAGE_ZIP))) {
+              FreeZip(pt);
+              break;
+            }
+            pt = LoadPte(mi);
+          } while ((pt & (PAGE_V | PAGE_RSRV | PAGE_ZIP)) ==
+                   (PAGE_V | PAGE_RSRV | PAGE_ZIP));
+#ifdef MADV_DONTNEED
+        } else if (pagesize == 4096 &&
+                   (pt & (PAGE_V | PAGE_HOST | PAGE_MAP | PAGE_MUG |
+                          PAGE_RSRV)) ==
+                       (PAGE_V | PAGE_HOST | PAGE_MAP | PAGE_MUG)) {
+          if (madvise((void *)(uintptr_t)(pt & PAGE_TA), 4096, MADV_DONTNEED)) {
+            LOGF("madvise(%#" PRIx64 ", 4096, MADV_DONTNEED) failed: %s",
+                 pt & PAGE_TA, DescribeHostErrno(errno));
+          }
+#endif
+        }
+        if ((virt += 4096) >= end) {
+          goto FinishedCrawling;
+        }
+        if (++ti == 512) break;
+        pt = LoadPte((mi += 8));
+      }
+    }
+  }
+FinishedCrawling:
+  FlushPageZap(s, &zap);
+  if (rss_delta) {
+    s->rss += rss_delta;
+    InvalidateSystemRange(s, orig_virt, size, false);
+  }
+  return 0;
+}
+
 // @asyncsignalsafe
 static i64 FindGuestAddr(struct System *s, uintptr_t hp, u64 pt, long lvl,
                          u64 *out_pte) {
@@ -1376,6 +2766,13 @@ static i64 FindGuestAddr(struct System *s, uintptr_t hp, u64 pt, long lvl,
             }
             return i << 39;
           }
+        } else if (lvl == 3 && IsLazyChunk(pte)) {
+          if ((pte & PAGE_MAP) && hp - (pte & PAGE_TA) < 0x200000) {
+            if (out_pte) {
+              *out_pte = GetLazyEntry(pte, hp - (pte & PAGE_TA));
+            }
+            return i << 39 | (hp - (pte & PAGE_TA)) << 18;
+          }
         } else if ((res = FindGuestAddr(s, hp, pte, lvl + 1, out_pte)) != -1) {
           return i << 39 | res >> 9;
         }
@@ -55,21 +55,42 @@ static relegated bool IsNullSelector(u16 sel) {
   return (sel & -4u) == 0;
 }
 
+// jit paths are keyed by instruction pointer, and writes to guest code
+// are only noticed through page table entries, so the jit can only run
+// metal guests that use paging with a code segment whose base is zero.
+// this must be called whenever the mode, paging, or cs base may change
+static relegated void UpdateMetalJit(struct Machine *m) {
+#ifdef HAVE_JIT
+  struct Jit *jit = &m->system->jit;
+  if (!FLAG_wantjit) return;
+  if (!IsJitDisabled(jit)) {
+    // paths were generated for the old mode, so none of them are valid
+    if (IsMakingPath(m)) m->path.stale = true;
+    ResetJitPages(jit);
+  }
+  if ((m->mode.omode == XED_MODE_LONG ||
+       (m->mode.genmode != XED_GEN_MODE_REAL &&
+        (m->system->cr0 & CR0_PG))) &&
+      !m->seg[SREG_CS].base) {
+    EnableJit(jit);
+  } else {
+    DisableJit(jit);
+  }
+#endif
+}
+
 static relegated void ChangeMachineMode(struct Machine *m,
                                         struct XedMachineMode mode) {
   if (memcmp(&mode, &m->mode, sizeof(mode)) == 0) return;
   ResetInstructionCache(m);
   SetMachineMode(m, mode);
-#ifdef HAVE_JIT
-  if (mode.omode == XED_MODE_LONG && FLAG_wantjit) {
-    EnableJit(&m->system->jit);
-  }
-#endif
+  UpdateMetalJit(m);
 }
 
 static relegated void SetSegment(P, unsigned sr, u16 sel, bool jumping) {
-  u64 descriptor;
+  u64 base, descriptor;
   if (sr == SREG_CS && !jumping) OpUdImpl(m);
+  base = m->seg[SREG_CS].base;
   if (!IsProtectedMode(m)) {
     m->seg[sr].sel = sel;
     m->seg[sr].base = sel << 4;
@@ -91,6 +112,9 @@ static relegated void SetSegment(P, unsigned sr, u16 sel, bool jumping) {
   } else {
     ThrowProtectionFault(m);
   }
+  if (m->seg[SREG_CS].base != base) {
+    UpdateMetalJit(m);
+  }
 }
 
 relegated void SetCs(P, u16 sel) {
@@ -311,10 +335,11 @@ relegated void OpMovRqCq(P) {
 }
 
 relegated void OpMovCqRq(P) {
-  u64 cr0;
+  u64 cr0, old;
   struct XedMachineMode mode;
   switch (ModrmReg(rde)) {
     case 0:
+      old = m->system->cr0;
       m->system->cr0 = cr0 = Get64(RegRexbRm(m, rde));
       mode = m->system->mode;
       if ((cr0 & CR0_PE)) {
@@ -322,7 +347,11 @@ relegated void OpMovCqRq(P) {
       } else {
         mode.genmode = XED_GEN_MODE_REAL;
       }
-      ChangeMachineMode(m, mode);
+      if (memcmp(&mode, &m->mode, sizeof(mode))) {
+        ChangeMachineMode(m, mode);
+      } else if ((cr0 ^ old) & CR0_PG) {
+        UpdateMetalJit(m);
+      }
       break;
     case 2:
       m->system->cr2 = Get64(RegRexbRm(m, rde));
@@ -0,0 +1,228 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/metrics.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/buffer.h"
+#include "blink/bus.h"
+#include "blink/dll.h"
+#include "blink/flag.h"
+#include "blink/jit.h"
+#include "blink/log.h"
+#include "blink/stats.h"
+#include "blink/thread.h"
+#include "blink/timespec.h"
+#include "blink/tunables.h"
+#include "blink/util.h"
+
+/**
+ * @fileoverview Live metrics for long running guests.
+ *
+ * When BLINK_METRICS names a file, a host thread rewrites it every
+ * kMetricsMs with the statistics counters, plus gauges that describe
+ * memory, the jit code heap, and threads, using the Prometheus text
+ * exposition format so it can be picked up by a textfile collector.
+ *
+ * Since counters live in thread local storage, the writer can't read
+ * them directly. It instead asks each guest thread, through the same
+ * attention flag signals use, to fold its counters into the totals of
+ * the process, which means each refresh shows what the threads last
+ * published, and a thread that's blocked publishes once it wakes up.
+ * Only the process blink launched is reported on, which includes the
+ * programs it execve()'s, but not the children it fork()'s.
+ */
+
+static struct Metrics {
+  bool started;                 // worker thread has been created
+  bool disabled;                // we're a fork() child, which is silent
+  int fd;                       // metrics file, at or above kMinBlinkFd
+  struct System *system;        // program that's being reported on
+  _Atomic(long) jitused;        // published by guest threads
+  _Atomic(long) jitowned;       // published by guest threads
+  pthread_mutex_t_ lock;        // guards everything but the jit gauges
+} g_metrics = {
+    .fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER_,
+};
+
+#ifdef HAVE_THREADS
+
+// @assume g_metrics.lock
+static void AppendSystemMetrics(struct Buffer *b, struct System *s) {
+  long threads;
+  struct Dll *e;
+  struct Machine *m;
+  threads = 0;
+  AppendStr(b, "# TYPE blink_thread_instructions counter\n");
+  LOCK(&s->machines_lock);
+  for (e = dll_first(s->machines); e; e = dll_next(s->machines, e)) {
+    m = MACHINE_CONTAINER(e);
+    AppendFmt(b, "blink_thread_instructions{tid=\"%d\"} %ld\n", m->tid,
+              atomic_load_explicit(&m->instructions, memory_order_relaxed));
+    // have the thread fold its counters in time for the next refresh
+    atomic_store_explicit(&m->publish, true, memory_order_release);
+    atomic_store_explicit(&m->attention, true, memory_order_release);
+    ++threads;
+  }
+  UNLOCK(&s->machines_lock);
+  AppendFmt(b, "# TYPE blink_threads gauge\nblink_threads %ld\n", threads);
+  AppendFmt(b, "# TYPE blink_rss_bytes gauge\nblink_rss_bytes %ld\n",
+            s->rss * 4096L);
+  AppendFmt(b, "# TYPE blink_vss_bytes gauge\nblink_vss_bytes %ld\n",
+            s->vss * 4096L);
+  AppendFmt(b,
+            "# TYPE blink_rss_limit_bytes gauge\n"
+            "blink_rss_limit_bytes %ld\n",
+            GetMaxRss(s) * 4096L);
+#ifdef HAVE_JIT
+  AppendFmt(b,
+            "# TYPE blink_jit_used_bytes gauge\nblink_jit_used_bytes %ld\n"
+            "# TYPE blink_jit_owned_bytes gauge\nblink_jit_owned_bytes %ld\n"
+            "# TYPE blink_jit_heap_bytes gauge\nblink_jit_heap_bytes %ld\n",
+            atomic_load_explicit(&g_metrics.jitused, memory_order_relaxed),
+            atomic_load_explicit(&g_metrics.jitowned, memory_order_relaxed),
+            (long)kJitMemorySize);
+#endif
+}
+
+static void WriteMetrics(void) {
+  struct Buffer b = {0};
+  LOCK(&g_metrics.lock);
+  if (g_metrics.system) {
+    AppendSystemMetrics(&b, g_metrics.system);
+  }
+  UNLOCK(&g_metrics.lock);
+  AppendFmt(&b, "# TYPE blink_futex_waiters gauge\nblink_futex_waiters %ld\n",
+            CountFutexWaiters());
+  AppendStatsMetrics(&b);
+  // readers see the file rewritten in place, since renaming a new one
+  // over it would require opening descriptors the guest could clobber
+  if (pwrite(g_metrics.fd, b.p, b.i, 0) != b.i ||
+      ftruncate(g_metrics.fd, b.i)) {
+    LOG_ONCE(LOGF("failed to write %s: %s", FLAG_metrics,
+                  DescribeHostErrno(errno)));
+  }
+  free(b.p);
+}
+
+static void *MetricsWorker(void *arg) {
+  for (;;) {
+    SleepTime(FromMilliseconds(kMetricsMs));
+    WriteMetrics();
+  }
+  return 0;
+}
+
+// @assume g_metrics.lock
+static void SpawnMetricsWorker(void) {
+  int fd, err;
+  pthread_t th;
+  sigset_t ss, oldss;
+  if ((fd = open(FLAG_metrics, O_WRONLY | O_CREAT | O_CLOEXEC, 0644)) == -1) {
+    LOGF("failed to open %s: %s", FLAG_metrics, DescribeHostErrno(errno));
+    return;
+  }
+  unassert((g_metrics.fd = fcntl(fd, F_DUPFD_CLOEXEC, kMinBlinkFd)) != -1);
+  unassert(!close(fd));
+  sigfillset(&ss);
+  unassert(!pthread_sigmask(SIG_SETMASK, &ss, &oldss));
+  err = pthread_create(&th, 0, MetricsWorker, 0);
+  unassert(!pthread_sigmask(SIG_SETMASK, &oldss, 0));
+  if (err) {
+    LOGF("failed to create metrics worker: %s", DescribeHostErrno(err));
+    return;
+  }
+  unassert(!pthread_detach(th));
+}
+
+#endif /* HAVE_THREADS */
+
+// starts reporting on s, which replaces any program reported on before
+void StartMetrics(struct System *s) {
+#ifdef HAVE_THREADS
+  LOCK(&g_metrics.lock);
+  if (!g_metrics.disabled) {
+    g_metrics.system = s;
+    if (!g_metrics.started) {
+      g_metrics.started = true;
+      SpawnMetricsWorker();
+    }
+  }
+  UNLOCK(&g_metrics.lock);
+#else
+  LOG_ONCE(LOGF("BLINK_METRICS requires a build with threads"));
+#endif
+}
+
+// stops reporting on s, which is about to be freed
+void ForgetMetrics(struct System *s) {
+  if (!FLAG_metrics) return;
+  LOCK(&g_metrics.lock);
+  if (g_metrics.system == s) {
+    g_metrics.system = 0;
+  }
+  UNLOCK(&g_metrics.lock);
+}
+
+// folds the calling guest thread's counters into the process totals
+void PublishMetrics(struct Machine *m) {
+#ifndef TINY
+  atomic_store_explicit(&m->instructions,
+                        m->instructions + interps + instructions_jitted,
+                        memory_order_relaxed);
+  FlushStats();
+#endif
+#ifdef HAVE_JIT
+  long used, owned;
+  GetJitUsage(&m->system->jit, &used, &owned);
+  atomic_store_explicit(&g_metrics.jitused, used, memory_order_relaxed);
+  atomic_store_explicit(&g_metrics.jitowned, owned, memory_order_relaxed);
+#endif
+}
+
+// locks the metrics writer before fork()
+void LockMetrics(void) {
+  LOCK(&g_metrics.lock);
+}
+
+// unlocks the metrics writer in the parent after fork()
+void UnlockMetrics(void) {
+  UNLOCK(&g_metrics.lock);
+}
+
+// resets the metrics writer in the child after fork()
+// the worker doesn't survive fork() and children aren't reported on
+void ResetMetrics(void) {
+#ifdef HAVE_THREADS
+  g_metrics.disabled = true;
+  g_metrics.system = 0;
+  if (g_metrics.fd != -1) {
+    unassert(!close(g_metrics.fd));
+    g_metrics.fd = -1;
+  }
+  unassert(!pthread_mutex_init(&g_metrics.lock, 0));
+#endif
+}
@@ -0,0 +1,12 @@
+#ifndef BLINK_METRICS_H_
+#define BLINK_METRICS_H_
+#include "blink/machine.h"
+
+void StartMetrics(struct System *);
+void ForgetMetrics(struct System *);
+void PublishMetrics(struct Machine *);
+void LockMetrics(void);
+void UnlockMetrics(void);
+void ResetMetrics(void);
+
+#endif /* BLINK_METRICS_H_ */
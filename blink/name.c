@@ -553,6 +553,7 @@ const char *DescribeMopcode(int code) {
     XLAT(0x240, "OpSsePmulld");
     XLAT(0x30f, "OpSsePalignr");
     XLAT(0x344, "OpSsePclmulqdq");
+    XLAT(0x700, "OpNative");
     default:
       return "UNKNOWN";
   }
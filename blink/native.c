@@ -0,0 +1,358 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/native.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "blink/atomic.h"
+#include "blink/checked.h"
+#include "blink/dis.h"
+#include "blink/endian.h"
+#include "blink/log.h"
+#include "blink/loader.h"
+#include "blink/macros.h"
+#include "blink/rde.h"
+#include "blink/stats.h"
+#include "blink/x86.h"
+
+/**
+ * @fileoverview Host implementations of guest string functions.
+ *
+ * When BLINK_NATIVE is set, the memcpy(), memmove(), memset(), strlen()
+ * and memcmp() functions of the guest are found by name in the symbols
+ * of files it maps, and a pseudo-op gets decoded at their entry points,
+ * which calls the host's C library and returns to the guest's caller,
+ * instead of emulating the loop the guest would have used. It only does
+ * so when each byte touched is in pages that'd let the guest do it too,
+ * and, if a length was passed, they're contiguous in host memory, since
+ * otherwise the guest's own first instruction is run, and its code will
+ * take it from there, so faults happen exactly where they would've.
+ *
+ * Glibc exports these functions as ifuncs, whose symbol is a resolver
+ * that returns the variant to use. Resolvers are hooked to return into
+ * the byte after their entry point, where the variant they picked gets
+ * intercepted too, before control goes back to their real caller.
+ *
+ * Functions are assumed to do what their names say. Entry points stop
+ * being intercepted once the executable page they're on gets unmapped.
+ */
+
+#define kNatives        512    // max entry points, as a power of two
+#define kNativeResolver 0x100  // ifunc resolver whose result gets kind
+#define kNativeResolved 0x200  // address hooked resolvers return to
+
+// decoded as pseudo-op one byte long, which is only used in long mode
+#define kNativeRde \
+  ((u64)kNativeMopcode << 050 | (u64)1 << 065 | (u64)XED_MODE_LONG << 032)
+
+enum {
+  kNativeMemmove = 1,
+  kNativeMemset,
+  kNativeStrlen,
+  kNativeMemcmp,
+};
+
+struct Native {
+  _Atomic(i64) pc;    // guest entry point, whose slot is never reused
+  _Atomic(int) kind;  // zero if pending, or -1 if it got unmapped
+};
+
+struct Natives {
+  bool owndis;  // if s->dis was created for us
+  struct Native p[kNatives];
+};
+
+static const struct NativeName {
+  char name[8];
+  int kind;
+} kNativeNames[] = {
+    {"memcpy", kNativeMemmove},   //
+    {"memmove", kNativeMemmove},  //
+    {"memset", kNativeMemset},    //
+    {"strlen", kNativeStrlen},    //
+    {"memcmp", kNativeMemcmp},    //
+    {"bcmp", kNativeMemcmp},      //
+};
+
+static unsigned HashNative(i64 pc) {
+  return ((u64)pc * 0x9e3779b97f4a7c15) >> 55;
+}
+
+// intercepts calls to pc, unless it was unmapped and we're not sure
+// something's still there, which is the case for stale debug symbols
+static void AddNative(struct Natives *ns, i64 pc, int kind, bool revive) {
+  i64 x;
+  unsigned i, j;
+  if (!pc) return;
+  for (i = HashNative(pc), j = 0; j < kNatives;
+       ++j, i = (i + 1) & (kNatives - 1)) {
+    x = atomic_load_explicit(&ns->p[i].pc, memory_order_acquire);
+    if (!x && atomic_compare_exchange_strong_explicit(
+                  &ns->p[i].pc, &x, pc, memory_order_acq_rel,
+                  memory_order_acquire)) {
+      x = pc;
+    }
+    if (x == pc) {
+      if (revive ||
+          atomic_load_explicit(&ns->p[i].kind, memory_order_relaxed) != -1) {
+        atomic_store_explicit(&ns->p[i].kind, kind, memory_order_release);
+      }
+      return;
+    }
+  }
+  LOGF("too many native functions to intercept %#" PRIx64, pc);
+}
+
+static int GetNative(struct Natives *ns, i64 pc) {
+  i64 x;
+  int kind;
+  unsigned i, j;
+  for (i = HashNative(pc), j = 0; j < kNatives;
+       ++j, i = (i + 1) & (kNatives - 1)) {
+    x = atomic_load_explicit(&ns->p[i].pc, memory_order_acquire);
+    if (x == pc) {
+      kind = atomic_load_explicit(&ns->p[i].kind, memory_order_acquire);
+      return MAX(0, kind);
+    } else if (!x) {
+      break;
+    }
+  }
+  return 0;
+}
+
+// called by the debug symbol loader each time a file is mapped, with
+// the symbols of every file that's been mapped so far
+static void OnNativeSymbols(struct System *s) {
+  int i, j;
+  struct DisSym *sym;
+  for (i = 0; i < s->dis->syms.i; ++i) {
+    sym = s->dis->syms.p + i;
+    if (!sym->iscode || sym->isabs) continue;
+    for (j = 0; j < ARRAYLEN(kNativeNames); ++j) {
+      if (!strcmp(sym->name, kNativeNames[j].name)) {
+        if (sym->isifunc) {
+          AddNative(s->natives, sym->addr,
+                    kNativeResolver | kNativeNames[j].kind, false);
+          AddNative(s->natives, sym->addr + 1,
+                    kNativeResolved | kNativeNames[j].kind, false);
+        } else {
+          AddNative(s->natives, sym->addr, kNativeNames[j].kind, false);
+        }
+        break;
+      }
+    }
+  }
+}
+
+// starts intercepting string functions of s, once its program's loaded
+// @assume other guest threads don't exist
+void StartNatives(struct System *s) {
+  struct Dis *dis;
+  if (!(s->natives = (struct Natives *)calloc(1, sizeof(*s->natives)))) {
+    return;
+  }
+  s->onsymbols = OnNativeSymbols;
+  if (s->dis) {
+    OnNativeSymbols(s);
+  } else if ((dis = (struct Dis *)calloc(1, sizeof(*dis)))) {
+    s->dis = dis;
+    s->natives->owndis = true;
+    LoadDebugSymbols(s);
+  }
+}
+
+// unloads natives of s, which is about to be freed
+void ForgetNatives(struct System *s) {
+  if (!s->natives) return;
+  if (s->natives->owndis) {
+    DisFree(s->dis);
+    free(s->dis);
+    s->dis = 0;
+    s->onfilemap = 0;
+  }
+  s->onsymbols = 0;
+  free(s->natives);
+  s->natives = 0;
+}
+
+// stops intercepting entry points on executable page being unmapped
+void UnmapNatives(struct System *s, i64 virt) {
+  int i;
+  for (i = 0; i < kNatives; ++i) {
+    if ((atomic_load_explicit(&s->natives->p[i].pc, memory_order_relaxed) &
+         -4096) == (virt & -4096)) {
+      atomic_store_explicit(&s->natives->p[i].kind, -1, memory_order_release);
+    }
+  }
+}
+
+// decodes pseudo-op if pc is an intercepted function, upon cache miss
+bool LoadNative(struct Machine *m, i64 pc, u8 *addr) {
+  int kind;
+  if (m->metal || m->mode.omode != XED_MODE_LONG ||
+      !(kind = GetNative(m->system->natives, pc))) {
+    return false;
+  }
+  m->xedd->length = 1;
+  m->xedd->bytes[0] = *addr;
+  m->xedd->op.rde = kNativeRde;
+  m->xedd->op.disp = 0;
+  m->xedd->op.uimm0 = kind;
+  return true;
+}
+
+// returns host address of guest memory [v,v+n) if it's all accessible
+// and contiguous in host memory, which is always the case when linear
+static u8 *GetNativeRange(struct Machine *m, i64 v, u64 n, u64 need) {
+  u8 *p;
+  i64 page, last;
+  need |= PAGE_U;
+  if (!n || n > 0x7fffffffffff || CheckedAdd(v, n - 1, &last) == -1 ||
+      !(p = LookupAddress2(m, v, need, need))) {
+    return 0;
+  }
+  for (page = (v & -4096) + 4096; page <= last; page += 4096) {
+    if (LookupAddress2(m, page, need, need) != p + (page - v)) {
+      return 0;
+    }
+  }
+  return p;
+}
+
+static bool GetNativeLength(struct Machine *m, i64 v, u64 *len) {
+  u8 *p, *e;
+  u64 n, k;
+  for (n = 0;; n += k, v += k) {
+    k = 4096 - (v & 4095);
+    if (!(p = LookupAddress2(m, v, PAGE_U, PAGE_U))) return false;
+    if ((e = (u8 *)memchr(p, 0, k))) {
+      *len = n + (e - p);
+      return true;
+    }
+  }
+}
+
+// returns byte difference of first mismatch, like glibc does
+static int CompareNative(const u8 *p, const u8 *q, u64 n) {
+  u64 i;
+  for (i = 0; i + 8 <= n; i += 8) {
+    if (Read64(p + i) != Read64(q + i)) break;
+  }
+  for (; i < n; ++i) {
+    if (p[i] != q[i]) return p[i] - q[i];
+  }
+  return 0;
+}
+
+static bool CallNative(struct Machine *m, int kind) {
+  u8 *p, *q;
+  u64 n = Get64(m->dx);
+  i64 di = Get64(m->di);
+  i64 si = Get64(m->si);
+  switch (kind) {
+    case kNativeMemmove:
+      if (n) {
+        if (!(p = GetNativeRange(m, di, n, PAGE_RW)) ||
+            !(q = GetNativeRange(m, si, n, 0))) {
+          return false;
+        }
+        memmove(p, q, n);
+      }
+      Put64(m->ax, di);
+      return true;
+    case kNativeMemset:
+      if (n) {
+        if (!(p = GetNativeRange(m, di, n, PAGE_RW))) return false;
+        memset(p, m->si[0], n);
+      }
+      Put64(m->ax, di);
+      return true;
+    case kNativeStrlen:
+      if (!GetNativeLength(m, di, &n)) return false;
+      Put64(m->ax, n);
+      return true;
+    case kNativeMemcmp:
+      if (n) {
+        if (!(p = GetNativeRange(m, di, n, 0)) ||
+            !(q = GetNativeRange(m, si, n, 0))) {
+          return false;
+        }
+        Put64(m->ax, (u32)CompareNative(p, q, n));
+      } else {
+        Put64(m->ax, 0);
+      }
+      return true;
+    default:
+      __builtin_unreachable();
+  }
+}
+
+// makes ifunc resolver return to hook, so we learn what it picked
+static void HookResolver(struct Machine *m, i64 hook) {
+  u8 *p;
+  i64 sp = Get64(m->sp);
+  if (!m->nativeret && !(sp & 7) &&
+      (p = LookupAddress2(m, sp, PAGE_U | PAGE_RW, PAGE_U | PAGE_RW))) {
+    m->nativeret = Read64(p);
+    Write64(p, hook);
+  }
+}
+
+// runs the guest's real instruction at pc, which the pseudo-op hides
+static void RunGuestInstruction(struct Machine *m, i64 pc) {
+  int rc;
+  u64 rde;
+  struct XedDecodedInst x;
+#ifdef HAVE_JIT
+  if (IsMakingPath(m)) AbandonPath(m);
+#endif
+  if ((rc = GetInstruction(m, pc, &x))) {
+    m->ip = pc;
+    m->oplen = 0;
+    if (rc == kMachineSegmentationFault) m->faultaddr = pc;
+    HaltMachine(m, rc);
+  }
+  rde = x.op.rde;
+  m->oplen = Oplength(rde);
+  m->ip = pc + Oplength(rde);
+  GetOpForRde(rde)(m, rde, x.op.disp, x.op.uimm0);
+}
+
+void OpNative(P) {
+  i64 pc = m->ip - Oplength(rde);
+  if (uimm0 & kNativeResolved) {
+    if (m->nativeret) {
+      AddNative(m->system->natives, Get64(m->ax), uimm0 & 255, true);
+      m->ip = m->nativeret;
+      m->nativeret = 0;
+      return;
+    }
+  } else if (uimm0 & kNativeResolver) {
+    HookResolver(m, pc + 1);
+  } else if (CallNative(m, uimm0)) {
+    STATISTIC(++native_calls);
+    m->ip = Pop(A, 0);
+    --m->shadow.i;
+    return;
+  } else {
+    STATISTIC(++native_fallbacks);
+  }
+  RunGuestInstruction(m, pc);
+}
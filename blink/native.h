@@ -0,0 +1,14 @@
+#ifndef BLINK_NATIVE_H_
+#define BLINK_NATIVE_H_
+#include "blink/machine.h"
+#include "blink/types.h"
+
+#define kNativeMopcode 0x700  // pseudo-op decoded at intercepted functions
+
+void StartNatives(struct System *);
+void ForgetNatives(struct System *);
+void UnmapNatives(struct System *, i64);
+bool LoadNative(struct Machine *, i64, u8 *);
+void OpNative(P);
+
+#endif /* BLINK_NATIVE_H_ */
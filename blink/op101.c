@@ -18,6 +18,7 @@
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include <stdio.h>
 
+#include "blink/avx.h"
 #include "blink/builtin.h"
 #include "blink/bus.h"
 #include "blink/endian.h"
@@ -130,6 +131,32 @@ static void InvlpgM(P) {
   InvalidateSystem(m->system, true, true);
 }
 
+static void Xgetbv(P) {
+  u64 x;
+  switch (Read32(m->cx)) {
+    case 0:  // enabled components
+    case 1:  // components which might not be in their initial state
+      x = m->xcr0;
+      break;
+    default:
+      ThrowProtectionFault(m);
+  }
+  Put64(m->ax, (u32)x);
+  Put64(m->dx, x >> 32);
+}
+
+static void Xsetbv(P) {
+  u64 x;
+  x = (u64)Read32(m->dx) << 32 | Read32(m->ax);
+  if (Cpl(m) || Read32(m->cx) ||          //
+      !(x & kXcr0X87) ||                  //
+      (x & ~(u64)kXcr0Supported) ||       //
+      ((x & kXcr0Avx) && !(x & kXcr0Sse))) {
+    ThrowProtectionFault(m);
+  }
+  m->xcr0 = x;
+}
+
 static void Smsw(P, bool ismem) {
   if (ismem) {
     Store16(GetModrmRegisterWordPointerWrite2(A), m->system->cr0);
@@ -194,13 +221,6 @@ void Op101(P) {
         }
       }
       break;
-    case 2:
-      if (ismem) {
-        LgdtMs(A);
-      } else {
-        OpUdImpl(m);
-      }
-      break;
     case 3:
       if (ismem) {
         LidtMs(A);
@@ -215,6 +235,26 @@ void Op101(P) {
       Lmsw(A);
       break;
 #endif
+    case 2:
+      if (ismem) {
+#ifndef DISABLE_METAL
+        LgdtMs(A);
+#else
+        OpUdImpl(m);
+#endif
+      } else {
+        switch (ModrmRm(rde)) {
+          case 0:
+            Xgetbv(A);
+            break;
+          case 1:
+            Xsetbv(A);
+            break;
+          default:
+            OpUdImpl(m);
+        }
+      }
+      break;
     case 7:
       if (ismem) {
 #ifndef DISABLE_METAL
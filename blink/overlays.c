@@ -34,6 +34,7 @@
 #include "blink/log.h"
 #include "blink/syscall.h"
 #include "blink/thompike.h"
+#include "blink/tunables.h"
 #include "blink/util.h"
 
 #ifndef DISABLE_OVERLAYS
@@ -41,6 +42,7 @@
 #define UNREACHABLE "(unreachable)"
 
 static char **g_overlays;
+static int *g_overlayfds;  // dirfd of each g_overlays[i] that isn't root
 
 static void FreeStrings(char **ss) {
   size_t i;
@@ -75,10 +77,57 @@ static char **SplitString(const char *s, int c) {
 }
 
 static void FreeOverlays(void) {
+  size_t i;
+  if (g_overlayfds) {
+    for (i = 0; g_overlays[i]; ++i) {
+      if (g_overlayfds[i] != -1) {
+        close(g_overlayfds[i]);
+      }
+    }
+    free(g_overlayfds);
+    g_overlayfds = 0;
+  }
   FreeStrings(g_overlays);
   g_overlays = 0;
 }
 
+// if we get these failures when opening the dirfd of a user
+// supplied overlay path, then it's definitely not a user error, and
+// therefore not safe to continue.
+static bool IsUnrecoverableErrno(void) {
+  return errno == EINTR || errno == EMFILE || errno == ENFILE;
+}
+
+// opens directories of overlays once, rather than on every lookup
+static int *OpenOverlays(char **paths) {
+  int fd, *fds;
+  size_t i, n;
+  for (n = 0; paths[n]; ++n) {
+  }
+  if (!(fds = (int *)malloc(n * sizeof(*fds)))) return 0;
+  for (i = 0; i < n; ++i) {
+    fds[i] = -1;
+    if (!*paths[i]) continue;
+    if ((fd = open(paths[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0)) == -1) {
+      if (IsUnrecoverableErrno()) break;
+      LOGF("bad overlay %s: %s", paths[i], DescribeHostErrno(errno));
+      continue;
+    }
+    // keep the guest's lowest file descriptor numbers for the guest
+    fds[i] = fcntl(fd, F_DUPFD_CLOEXEC, kMinBlinkFd);
+    unassert(!close(fd));
+    if (fds[i] == -1) break;
+  }
+  if (i < n) {
+    while (i--) {
+      if (fds[i] != -1) close(fds[i]);
+    }
+    free(fds);
+    return 0;
+  }
+  return fds;
+}
+
 // if the user only specified a single overlay, then we treat it as
 // chroot would unless of course the specified root is the real one
 static bool IsRestrictedRoot(char **paths) {
@@ -86,6 +135,7 @@ static bool IsRestrictedRoot(char **paths) {
 }
 
 int SetOverlays(const char *config, bool cd_into_chroot) {
+  int *fds;
   size_t i, j;
   static int once;
   bool has_real_root;
@@ -137,22 +187,20 @@ int SetOverlays(const char *config, bool cd_into_chroot) {
       return -1;
     }
   }
+  if (!(fds = OpenOverlays(paths))) {
+    FreeStrings(paths);
+    return -1;
+  }
   if (!once) {
     atexit(FreeOverlays);
     once = 1;
   }
   FreeOverlays();
   g_overlays = paths;
+  g_overlayfds = fds;
   return 0;
 }
 
-// if we get these failures when opening a temporary dirfd of a user
-// supplied overlay path, then it's definitely not a user error, and
-// therefore not safe to continue.
-static bool IsUnrecoverableErrno(void) {
-  return errno == EINTR || errno == EMFILE || errno == ENFILE;
-}
-
 char *OverlaysGetcwd(char *output, size_t size) {
   size_t n, m;
   char *cwd, buf[PATH_MAX];
@@ -226,28 +274,14 @@ int OverlaysOpen(int dirfd, const char *path, int flags, int mode) {
       if (err == -1) {
         err = errno;
       }
-    } else {
-      dirfd = open(g_overlays[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
-      if (dirfd == -1) {
-        if (IsUnrecoverableErrno()) {
-          return -1;
-        } else {
-          LOGF("bad overlay %s: %s", g_overlays[i], DescribeHostErrno(errno));
-          continue;
-        }
-      }
-      if ((fd = openat(dirfd, !path[1] ? "." : path + 1, flags, mode)) != -1) {
-        unassert(dup2(fd, dirfd) == dirfd);
-        if (flags & O_CLOEXEC) {
-          unassert(!fcntl(dirfd, F_SETFD, FD_CLOEXEC));
-        }
-        unassert(!close(fd));
-        return dirfd;
+    } else if (g_overlayfds[i] != -1) {
+      if ((fd = openat(g_overlayfds[i], !path[1] ? "." : path + 1, flags,
+                       mode)) != -1) {
+        return fd;
       }
       if (err == -1) {
         err = errno;
       }
-      unassert(!close(dirfd));
       if (errno != ENOENT && errno != ENOTDIR) {
         return -1;
       }
@@ -280,24 +314,14 @@ static ssize_t OverlaysGeneric(int dirfd, const char *path, void *args,
       if (err != ENOENT && err != ENOTDIR) {
         return -1;
       }
-    } else {
-      dirfd = open(g_overlays[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
-      if (dirfd == -1) {
-        if (IsUnrecoverableErrno()) {
-          return -1;
-        } else {
-          LOGF("bad overlay %s: %s", g_overlays[i], DescribeHostErrno(errno));
-          continue;
-        }
-      }
-      if ((rc = fgenericat(dirfd, !path[1] ? "." : path + 1, args)) != -1) {
-        unassert(!close(dirfd));
+    } else if (g_overlayfds[i] != -1) {
+      if ((rc = fgenericat(g_overlayfds[i], !path[1] ? "." : path + 1,
+                           args)) != -1) {
         return rc;
       }
       if (err == -1) {
         err = errno;
       }
-      unassert(!close(dirfd));
       if (errno != ENOENT && errno != ENOTDIR) {
         return -1;
       }
@@ -487,69 +511,44 @@ static ssize_t OverlaysGeneric2(int srcdirfd, const char *srcpath, int dstdirfd,
   int err = -1;
   ssize_t i, j;
   const char *sp, *dp;
-  int srccloseme, dstcloseme;
   if (!srcpath || !dstpath) return efault();
   if (!*srcpath || !*dstpath) return enoent();
   for (j = 0; j >= 0 && g_overlays[j]; ++j) {
     if (srcpath[0] != '/' && srcpath[0]) {
       j = -2;
       sp = srcpath;
-      srccloseme = -1;
     } else if (!*g_overlays[j]) {
       srcdirfd = AT_FDCWD;
-      srccloseme = -1;
       sp = srcpath;
-    } else {
+    } else if (g_overlayfds[j] != -1) {
+      srcdirfd = g_overlayfds[j];
       sp = !srcpath[1] ? "." : srcpath + 1;
-      srccloseme = srcdirfd =
-          open(g_overlays[j], O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
-      if (srcdirfd == -1) {
-        if (IsUnrecoverableErrno()) {
-          return -1;
-        } else {
-          LOGF("bad overlay %s: %s", g_overlays[j], DescribeHostErrno(errno));
-          continue;
-        }
-      }
+    } else {
+      continue;
     }
     for (i = 0; i >= 0 && g_overlays[i]; ++i) {
       if (dstpath[0] != '/' && dstpath[0]) {
         i = -2;
         dp = dstpath;
-        dstcloseme = -1;
       } else if (!*g_overlays[i]) {
         dstdirfd = AT_FDCWD;
-        dstcloseme = -1;
         dp = dstpath;
-      } else {
+      } else if (g_overlayfds[i] != -1) {
+        dstdirfd = g_overlayfds[i];
         dp = !dstpath[1] ? "." : dstpath + 1;
-        dstcloseme = dstdirfd =
-            open(g_overlays[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
-        if (dstdirfd == -1) {
-          if (IsUnrecoverableErrno()) {
-            if (srccloseme != -1) close(srccloseme);
-            return -1;
-          } else {
-            LOGF("bad overlay %s: %s", g_overlays[i], DescribeHostErrno(errno));
-            continue;
-          }
-        }
+      } else {
+        continue;
       }
       if ((rc = fgenericat(srcdirfd, sp, dstdirfd, dp, args)) != -1) {
-        if (dstcloseme != -1) close(dstcloseme);
-        if (srccloseme != -1) close(srccloseme);
         return rc;
       }
       if (err == -1) {
         err = errno;
       }
-      if (dstcloseme != -1) close(dstcloseme);
       if (errno != ENOENT && errno != ENOTDIR) {
-        if (srccloseme != -1) close(srccloseme);
         return -1;
       }
     }
-    if (srccloseme != -1) close(srccloseme);
   }
   unassert(err != -1);
   errno = err;
@@ -54,6 +54,204 @@ static int tpdecode(const char *s, wint_t *out) {
   return i;
 }
 
+// renders row y of the panels, which are in logically sorted order
+static void RenderPanelRow(struct Buffer *b, long pn, struct Panel *p, int y) {
+  wint_t wc;
+  struct Buffer *l;
+  int x, i, j, width;
+  enum { kUtf8, kAnsi, kAnsiCsi } s;
+  for (x = i = 0; i < pn; ++i) {
+    if (p[i].top <= y && y < p[i].bottom) {
+      j = 0;
+      s = kUtf8;
+      l = &p[i].lines[y - p[i].top];
+      while (x + 8 <= p[i].left) {
+        char t[8] = {' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '};
+        AppendData(b, t, 8);
+        x += 8;
+      }
+      while (x < p[i].left) {
+        AppendChar(b, ' ');
+        x += 1;
+      }
+      while (x < p[i].right || j < l->i) {
+        wc = '\0';
+        width = 0;
+        if (j < l->i) {
+          wc = l->p[j];
+          switch (s) {
+            case kUtf8:
+              switch (wc & 255) {
+                case 033:
+                  s = kAnsi;
+                  ++j;
+                  break;
+                default:
+                  j += abs(tpdecode(l->p + j, &wc));
+                  if (x < p[i].right) {
+                    width = wcwidth(wc);
+                    width = MAX(1, width);
+                  } else {
+                    wc = 0;
+                  }
+                  break;
+              }
+              break;
+            case kAnsi:
+              switch (wc & 255) {
+                case '[':
+                  s = kAnsiCsi;
+                  ++j;
+                  break;
+                case '@':
+                case ']':
+                case '^':
+                case '_':
+                case '\\':
+                case 'A':
+                case 'B':
+                case 'C':
+                case 'D':
+                case 'E':
+                case 'F':
+                case 'G':
+                case 'H':
+                case 'I':
+                case 'J':
+                case 'K':
+                case 'L':
+                case 'M':
+                case 'N':
+                case 'O':
+                case 'P':
+                case 'Q':
+                case 'R':
+                case 'S':
+                case 'T':
+                case 'U':
+                case 'V':
+                case 'W':
+                case 'X':
+                case 'Y':
+                case 'Z':
+                  s = kUtf8;
+                  ++j;
+                  break;
+                default:
+                  s = kUtf8;
+                  continue;
+              }
+              break;
+            case kAnsiCsi:
+              switch (wc & 255) {
+                case ':':
+                case ';':
+                case '<':
+                case '=':
+                case '>':
+                case '?':
+                case '0':
+                case '1':
+                case '2':
+                case '3':
+                case '4':
+                case '5':
+                case '6':
+                case '7':
+                case '8':
+                case '9':
+                  ++j;
+                  break;
+                case '`':
+                case '~':
+                case '^':
+                case '@':
+                case '[':
+                case ']':
+                case '{':
+                case '}':
+                case '_':
+                case '|':
+                case '\\':
+                case 'A':
+                case 'B':
+                case 'C':
+                case 'D':
+                case 'E':
+                case 'F':
+                case 'G':
+                case 'H':
+                case 'I':
+                case 'J':
+                case 'K':
+                case 'L':
+                case 'M':
+                case 'N':
+                case 'O':
+                case 'P':
+                case 'Q':
+                case 'R':
+                case 'S':
+                case 'T':
+                case 'U':
+                case 'V':
+                case 'W':
+                case 'X':
+                case 'Y':
+                case 'Z':
+                case 'a':
+                case 'b':
+                case 'c':
+                case 'd':
+                case 'e':
+                case 'f':
+                case 'g':
+                case 'h':
+                case 'i':
+                case 'j':
+                case 'k':
+                case 'l':
+                case 'm':
+                case 'n':
+                case 'o':
+                case 'p':
+                case 'q':
+                case 'r':
+                case 's':
+                case 't':
+                case 'u':
+                case 'v':
+                case 'w':
+                case 'x':
+                case 'y':
+                case 'z':
+                  s = kUtf8;
+                  ++j;
+                  break;
+                default:
+                  s = kUtf8;
+                  continue;
+              }
+              break;
+            default:
+              __builtin_unreachable();
+          }
+          if (x > p[i].right) {
+            break;
+          }
+        } else if (x < p[i].right) {
+          wc = ' ';
+          width = 1;
+        }
+        if (wc) {
+          x += width;
+          AppendWide(b, wc);
+        }
+      }
+    }
+  }
+}
+
 /**
  * Renders panel div flex boxen inside terminal display for tui.
  *
@@ -67,206 +265,127 @@ static int tpdecode(const char *s, wint_t *out) {
  * @return ANSI codes, or null w/ errno
  */
 char *RenderPanels(long pn, struct Panel *p, long tyn, long txn, size_t *size) {
-  wint_t wc;
-  struct Buffer b, *l;
-  int x, y, i, j, width;
-  enum { kUtf8, kAnsi, kAnsiCsi } s;
+  int y;
+  struct Buffer b;
   memset(&b, 0, sizeof(b));
   AppendStr(&b, "\033[H");
   for (y = 0; y < tyn; ++y) {
     if (y) AppendFmt(&b, "\033[%dH", y + 1);
-    for (x = i = 0; i < pn; ++i) {
-      if (p[i].top <= y && y < p[i].bottom) {
-        j = 0;
-        s = kUtf8;
-        l = &p[i].lines[y - p[i].top];
-        while (x + 8 <= p[i].left) {
-          char t[8] = {' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '};
-          AppendData(&b, t, 8);
-          x += 8;
-        }
-        while (x < p[i].left) {
-          AppendChar(&b, ' ');
-          x += 1;
-        }
-        while (x < p[i].right || j < l->i) {
-          wc = '\0';
-          width = 0;
-          if (j < l->i) {
-            wc = l->p[j];
-            switch (s) {
-              case kUtf8:
-                switch (wc & 255) {
-                  case 033:
-                    s = kAnsi;
-                    ++j;
-                    break;
-                  default:
-                    j += abs(tpdecode(l->p + j, &wc));
-                    if (x < p[i].right) {
-                      width = wcwidth(wc);
-                      width = MAX(1, width);
-                    } else {
-                      wc = 0;
-                    }
-                    break;
-                }
-                break;
-              case kAnsi:
-                switch (wc & 255) {
-                  case '[':
-                    s = kAnsiCsi;
-                    ++j;
-                    break;
-                  case '@':
-                  case ']':
-                  case '^':
-                  case '_':
-                  case '\\':
-                  case 'A':
-                  case 'B':
-                  case 'C':
-                  case 'D':
-                  case 'E':
-                  case 'F':
-                  case 'G':
-                  case 'H':
-                  case 'I':
-                  case 'J':
-                  case 'K':
-                  case 'L':
-                  case 'M':
-                  case 'N':
-                  case 'O':
-                  case 'P':
-                  case 'Q':
-                  case 'R':
-                  case 'S':
-                  case 'T':
-                  case 'U':
-                  case 'V':
-                  case 'W':
-                  case 'X':
-                  case 'Y':
-                  case 'Z':
-                    s = kUtf8;
-                    ++j;
-                    break;
-                  default:
-                    s = kUtf8;
-                    continue;
-                }
-                break;
-              case kAnsiCsi:
-                switch (wc & 255) {
-                  case ':':
-                  case ';':
-                  case '<':
-                  case '=':
-                  case '>':
-                  case '?':
-                  case '0':
-                  case '1':
-                  case '2':
-                  case '3':
-                  case '4':
-                  case '5':
-                  case '6':
-                  case '7':
-                  case '8':
-                  case '9':
-                    ++j;
-                    break;
-                  case '`':
-                  case '~':
-                  case '^':
-                  case '@':
-                  case '[':
-                  case ']':
-                  case '{':
-                  case '}':
-                  case '_':
-                  case '|':
-                  case '\\':
-                  case 'A':
-                  case 'B':
-                  case 'C':
-                  case 'D':
-                  case 'E':
-                  case 'F':
-                  case 'G':
-                  case 'H':
-                  case 'I':
-                  case 'J':
-                  case 'K':
-                  case 'L':
-                  case 'M':
-                  case 'N':
-                  case 'O':
-                  case 'P':
-                  case 'Q':
-                  case 'R':
-                  case 'S':
-                  case 'T':
-                  case 'U':
-                  case 'V':
-                  case 'W':
-                  case 'X':
-                  case 'Y':
-                  case 'Z':
-                  case 'a':
-                  case 'b':
-                  case 'c':
-                  case 'd':
-                  case 'e':
-                  case 'f':
-                  case 'g':
-                  case 'h':
-                  case 'i':
-                  case 'j':
-                  case 'k':
-                  case 'l':
-                  case 'm':
-                  case 'n':
-                  case 'o':
-                  case 'p':
-                  case 'q':
-                  case 'r':
-                  case 's':
-                  case 't':
-                  case 'u':
-                  case 'v':
-                  case 'w':
-                  case 'x':
-                  case 'y':
-                  case 'z':
-                    s = kUtf8;
-                    ++j;
-                    break;
-                  default:
-                    s = kUtf8;
-                    continue;
-                }
-                break;
-              default:
-                __builtin_unreachable();
-            }
-            if (x > p[i].right) {
-              break;
-            }
-          } else if (x < p[i].right) {
-            wc = ' ';
-            width = 1;
-          }
-          if (wc) {
-            x += width;
-            AppendWide(&b, wc);
-          }
-        }
-      }
+    RenderPanelRow(&b, pn, p, y);
+  }
+  unassert(b.p = (char *)realloc(b.p, b.i + 1));
+  if (size) *size = b.i;
+  return b.p;
+}
+
+/**
+ * Renders panels, but only the rows that changed since the last frame.
+ *
+ * Terminals are slow to receive and parse a full screen of escape codes
+ * so most of it is skipped when only a few registers or lines changed.
+ * The frame is wiped by FreePanelFrame(), which must be done whenever
+ * something else gets written to the terminal, since rows are assumed
+ * to still be displayed as they were last rendered. Rows should reset
+ * any ANSI attributes they change, as the ones before them may not be
+ * printed again.
+ *
+ * @param frame has rows last written, which are updated to this frame
+ * @return ANSI codes, or null w/ errno
+ */
+char *RenderPanelsDiff(long pn, struct Panel *p, long tyn, long txn,
+                       struct PanelFrame *frame, size_t *size) {
+  int y;
+  struct Buffer b, row, *last;
+  if (frame->tyn != tyn || frame->txn != txn) {
+    FreePanelFrame(frame);
+    unassert(frame->rows = (struct Buffer *)calloc(tyn, sizeof(*frame->rows)));
+    frame->tyn = tyn;
+    frame->txn = txn;
+    frame->full = true;
+  }
+  memset(&b, 0, sizeof(b));
+  memset(&row, 0, sizeof(row));
+  if (frame->full) AppendStr(&b, "\033[H");
+  for (y = 0; y < tyn; ++y) {
+    row.i = 0;
+    RenderPanelRow(&row, pn, p, y);
+    last = frame->rows + y;
+    if (!frame->full && row.i == last->i &&
+        !memcmp(row.p, last->p, row.i)) {
+      continue;
     }
+    if (y || !frame->full) AppendFmt(&b, "\033[%dH", y + 1);
+    AppendData(&b, row.p, row.i);
+    last->i = 0;
+    AppendData(last, row.p, row.i);
+  }
+  free(row.p);
+  frame->full = false;
+  if (!b.p) AppendStr(&b, "");
+  unassert(b.p = (char *)realloc(b.p, b.i + 1));
+  if (size) *size = b.i;
+  return b.p;
+}
+
+/**
+ * Returns ANSI codes drawing the whole frame last passed to the diff.
+ */
+char *RenderPanelFrame(struct PanelFrame *frame, size_t *size) {
+  int y;
+  struct Buffer b;
+  memset(&b, 0, sizeof(b));
+  AppendStr(&b, "\033[H");
+  for (y = 0; y < frame->tyn; ++y) {
+    if (y) AppendFmt(&b, "\033[%dH", y + 1);
+    AppendData(&b, frame->rows[y].p, frame->rows[y].i);
   }
   unassert(b.p = (char *)realloc(b.p, b.i + 1));
   if (size) *size = b.i;
   return b.p;
 }
+
+/**
+ * Forgets frame, so the next diff redraws the whole terminal display.
+ */
+void FreePanelFrame(struct PanelFrame *frame) {
+  long y;
+  for (y = 0; y < frame->tyn; ++y) {
+    free(frame->rows[y].p);
+  }
+  free(frame->rows);
+  frame->rows = 0;
+  frame->tyn = 0;
+  frame->txn = 0;
+}
+
+/**
+ * Appends row drawn earlier from the same memory, if it's unchanged.
+ *
+ * Video adapter panels use this to skip encoding rows the guest didn't
+ * write since the last frame. Comparing a row of video ram is cheaper
+ * than noticing writes to it, which the jit can make without telling.
+ *
+ * @param aux is other state the row depends on, e.g. cursor column
+ * @return true if row was appended to line
+ */
+bool AppendCachedPanelRow(struct PanelRowCache *c, struct Buffer *line,
+                          int aux, const void *key, size_t n) {
+  if (c->aux != aux || (size_t)c->key.i != n || !c->text.p ||
+      memcmp(c->key.p, key, n)) {
+    return false;
+  }
+  AppendData(line, c->text.p, c->text.i);
+  return true;
+}
+
+/**
+ * Remembers what was appended to line since `start` for reuse.
+ */
+void CachePanelRow(struct PanelRowCache *c, const struct Buffer *line,
+                   int start, int aux, const void *key, size_t n) {
+  c->aux = aux;
+  c->key.i = 0;
+  AppendData(&c->key, (const char *)key, n);
+  c->text.i = 0;
+  AppendData(&c->text, line->p + start, line->i - start);
+}
@@ -1,5 +1,6 @@
 #ifndef BLINK_PANEL_H_
 #define BLINK_PANEL_H_
+#include <stdbool.h>
 #include <stddef.h>
 #include <sys/types.h>
 
@@ -14,7 +15,27 @@ struct Panel {
   int n;
 };
 
+struct PanelFrame {
+  long tyn, txn;
+  bool full;            // next diff must redraw everything
+  struct Buffer *rows;  // ansi codes of each row, as last written
+};
+
+struct PanelRowCache {
+  int aux;             // other state the row was drawn from, e.g. cursor
+  struct Buffer key;   // memory the row was drawn from, e.g. video ram
+  struct Buffer text;  // ansi codes the row was drawn as
+};
+
 char *RenderPanels(long, struct Panel *, long, long, size_t *);
+char *RenderPanelsDiff(long, struct Panel *, long, long, struct PanelFrame *,
+                       size_t *);
+char *RenderPanelFrame(struct PanelFrame *, size_t *);
+void FreePanelFrame(struct PanelFrame *);
+bool AppendCachedPanelRow(struct PanelRowCache *, struct Buffer *, int,
+                          const void *, size_t);
+void CachePanelRow(struct PanelRowCache *, const struct Buffer *, int, int,
+                   const void *, size_t);
 void PrintMessageBox(int, const char *, long, long);
 
 #endif /* BLINK_PANEL_H_ */
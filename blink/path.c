@@ -23,9 +23,16 @@
 #include <unistd.h>
 
 #include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/bitscan.h"
 #include "blink/builtin.h"
+#include "blink/coverage.h"
 #include "blink/debug.h"
 #include "blink/dis.h"
+#include "blink/endian.h"
+#include "blink/etrace.h"
+#include "blink/flag.h"
+#include "blink/flight.h"
 #include "blink/high.h"
 #include "blink/jit.h"
 #include "blink/log.h"
@@ -33,8 +40,10 @@
 #include "blink/macros.h"
 #include "blink/modrm.h"
 #include "blink/overlays.h"
+#include "blink/perfmap.h"
 #include "blink/rde.h"
 #include "blink/stats.h"
+#include "blink/tunables.h"
 #include "blink/vfs.h"
 
 #define APPEND(...) o += snprintf(b + o, n - o, __VA_ARGS__)
@@ -42,6 +51,9 @@
 #ifdef HAVE_JIT
 
 void (*AddPath_StartOp_Hook)(P);
+bool (*IsAtBreakpoint_Hook)(i64);
+
+static u32 g_hits[kHotSlots];
 
 #if LOG_COD
 static int g_cod;
@@ -141,9 +153,12 @@ static const u32 kLeave[] = {
 #endif /* __x86_64__ */
 #endif /* HAVE_JIT */
 
+// paths are entered through their prologue only from the interpreter,
+// whereas jumps between paths go to the code that follows it, which is
+// therefore padded to start on a boundary that instruction fetch likes
 long GetPrologueSize(void) {
 #ifdef HAVE_JIT
-  return sizeof(kEnter);
+  return ROUNDUP(sizeof(kEnter), kJitAlign);
 #else
   return 0;
 #endif
@@ -225,6 +240,7 @@ void FlushCod(struct JitBlock *jb) {
 }
 
 static bool IsPure(u64 rde) {
+  if (Vex(rde) && Mopcode(rde) < 0x2F0) return false;  // avx may #UD
   switch (Mopcode(rde)) {
     case 0x004:  // OpAluAlIbAdd
     case 0x005:  // OpAluRaxIvds
@@ -538,11 +554,49 @@ static void InitPaths(struct System *s) {
     AppendJit(jb, kLeave, sizeof(kLeave));
     AppendJitRet(jb);
     FlushCod(jb);
+    if (FLAG_perfmap) {
+      AddPerfMap(s, s->ender, jb->index - jb->start, 0);
+    }
     unassert(FinishJit(&s->jit, jb));
   }
 #endif
 }
 
+// returns execution counter shared by paths that hash to same slot
+static u32 *GetPathHits(i64 pc) {
+  return g_hits + ((pc ^ pc >> 7 ^ pc >> 17) & (kHotSlots - 1));
+}
+
+// called by cold path once it's run enough times to be worth redoing
+static void RetierPath(struct Machine *m, i64 pc) {
+  JIP_LOGF("path starting at %" PRIx64 " became hot", pc);
+  STATISTIC(++path_retiered);
+  ResetJitPath(&m->system->jit, pc);
+}
+
+// generates code after the end of a path that counts its executions,
+// which drops back to the interpreter once it's hot so it's generated
+// again, and then points the jump at the beginning of the path to it
+static void CountPathHits(struct Machine *m) {
+  long skip;
+  uintptr_t counter;
+  ResetJitRegs(m);
+  counter = GetJitPc(m->path.jb);
+  Jitter(DISPATCH_NOTHING,
+         "a0i",  // arg0 = &hits
+         GetPathHits(m->path.start));
+  skip = BeginJitSkip(DISPATCH_NOTHING, CountPath);
+  Jitter(DISPATCH_NOTHING,
+         "a1i"  // arg1 = pc
+         "q"    // arg0 = machine
+         "c",   // call function (RetierPath)
+         m->path.start, RetierPath);
+  AppendJitJump(m->path.jb, (void *)m->system->ender);
+  EndJitSkip(DISPATCH_NOTHING, skip);
+  AppendJitJump(m->path.jb, m->path.jb->addr + m->path.body);
+  SetJitJump(m->path.jb, m->path.entry, (void *)counter);
+}
+
 bool CreatePath(P) {
 #ifdef HAVE_JIT
   bool res;
@@ -553,7 +607,11 @@ bool CreatePath(P) {
     --m->path.skip;
     return false;
   }
-  if ((pc = GetPc(m))) {
+  if ((pc = GetPc(m)) && IsVolatileCodePage(m, pc)) {
+    m->path.skip = kSmcSkip;
+    return false;
+  }
+  if (pc) {
     if ((m->path.jb = StartJit(&m->system->jit, pc))) {
       JIP_LOGF("starting new path jit_pc:%" PRIxPTR " at pc:%" PRIx64,
                GetJitPc(m->path.jb), pc);
@@ -561,6 +619,7 @@ bool CreatePath(P) {
       jpc = (uintptr_t)m->path.jb->addr + m->path.jb->index;
       (void)jpc;
       AppendJit(m->path.jb, kEnter, sizeof(kEnter));
+      AlignJit(m->path.jb, kJitAlign, 0);
 #if LOG_JIX
       Jitter(A,
              "a1i"  // arg1 = ip
@@ -569,10 +628,52 @@ bool CreatePath(P) {
              "q",   // arg0 = machine
              GetPc(m), StartPath);
 #endif
+      if (FLAG_flight) {
+        // the interpreter runs the path while it's being generated
+        RecordFlight(m, pc);
+        Jitter(A,
+               "a1i"  // arg1 = pc
+               "q"    // arg0 = machine
+               "m",   // call micro-op (RecordFlight)
+               pc, RecordFlight);
+      }
+      if (FLAG_etrace) {
+        EtracePath(m, pc);
+        Jitter(A,
+               "a1i"  // arg1 = pc
+               "q"    // arg0 = machine
+               "c",   // call function (EtracePath)
+               pc, EtracePath);
+      }
       WriteCod("\nJit_%" PRIx64 "_%" PRIx64 ":\n", pc, jpc);
       FlushCod(m->path.jb);
       m->path.start = pc;
+      m->path.began = StartStatsTimer();
       m->path.elements = 0;
+      m->path.branches = 0;
+      m->path.spans = false;
+      m->path.retier = false;
+      m->path.stale = false;
+      m->path.block = 0;
+      m->path.lines[0] = 0;
+      m->path.lines[1] = 0;
+      m->path.colds = 0;
+      ResetJitRegs(m);
+      // paths are generated quickly the first time their code runs and
+      // then generated again as traces once they've proven to be hot,
+      // if there's a branch they could have followed; so cold ones get
+      // a jump which will have to be pointed at their hit counter code
+      if (*GetPathHits(pc) >= kHotPath) {
+        STATISTIC(++path_hot);
+        m->path.hot = true;
+      } else {
+        m->path.hot = false;
+        m->path.entry = m->path.jb->index;
+        AppendJitJump(m->path.jb, (void *)GetJitPc(m->path.jb));
+        m->path.body = m->path.jb->index;
+        SetJitJump(m->path.jb, m->path.entry,
+                   m->path.jb->addr + m->path.body);
+      }
       res = true;
     } else {
       res = false;
@@ -589,25 +690,217 @@ bool CreatePath(P) {
 void CompletePath(P) {
   unassert(IsMakingPath(m));
   FlushSkew(A);
+  FlushJitRegs(m);
+  AppendJitJump(m->path.jb, (void *)m->system->ender);
+  FinishPath(m);
+}
+
+/**
+ * Completes path whose last op is a system call before it's performed.
+ *
+ * System calls like clone(), fork(), and execve() mustn't happen while
+ * a path is under construction, so it's published first. The generated
+ * code goes directly into the path for the op after the system call if
+ * it returns there; otherwise, e.g. for rt_sigreturn(), signals, or if
+ * munmap() deleted jit code, it drops back into the main interpreter.
+ */
+void CompleteSyscallPath(P) {
+  long skip;
+  unassert(IsMakingPath(m));
+  AddPath(A);
+  AddPath_EndOp(A);
+  FlushSkew(A);
+  FlushJitRegs(m);
+  Jitter(A,
+         "a2i"  // arg2 = ip
+         "a1i"  // arg1 = jit generation
+         "q",   // arg0 = machine
+         m->ip, (u64)m->path.jb->pagegen);
+  skip = BeginJitSkip(A, (void *)CanResume);
+  AlignJit(m->path.jb, 8, 0);
+  Connect(A, m->ip, true);
+  EndJitSkip(A, skip);
   AppendJitJump(m->path.jb, (void *)m->system->ender);
   FinishPath(m);
 }
 
+/**
+ * Calls micro-op and skips the code which follows if it returns zero.
+ *
+ * @return offset of jump, which must be passed to EndJitSkip()
+ */
+long BeginJitSkip(P, void *uop) {
+#ifdef __x86_64__
+  Jitter(A,
+         "m"   // call micro-op
+         "q",  // arg0 = machine
+         uop);
+  u8 code[] = {
+      0x85, 0300 | kJitRes0 << 3 | kJitRes0,  // test %eax,%eax
+      0x0f, 0x84, 0, 0, 0, 0,                 // jz   skip
+  };
+#else
+  Jitter(A,
+         "m"      // res0 = call micro-op
+         "r0a2="  // arg2 = res0
+         "q",     // arg0 = machine
+         uop);
+  u32 code[] = {
+      0x34000000 | kJitArg2,  // cbz w2,skip
+  };
+#endif
+  AppendJit(m->path.jb, code, sizeof(code));
+  return m->path.jb->index;
+}
+
+/**
+ * Makes jump emitted by BeginJitSkip() land on the current position.
+ */
+void EndJitSkip(P, long skip) {
+  u8 *insn;
+  if (m->path.jb->index > kJitBlockSize) return;
+  insn = m->path.jb->addr + skip - 4;
+#ifdef __x86_64__
+  Write32(insn, m->path.jb->index - skip);
+#else
+  Write32(insn, Read32(insn) | ((m->path.jb->index - (skip - 4)) / 4) << 5);
+#endif
+}
+
+/**
+ * Returns true if path may keep going through direct branch to `pc`.
+ *
+ * Hot paths are allowed to run through a limited number of branches
+ * whose forward destination `pc` hasn't been generated yet, provided
+ * they don't leave the first page of the path or the page after that.
+ * When true is returned, the branching op must emit a side exit for
+ * its other direction, and leave the path so `pc` may be appended.
+ */
+bool FollowPath(P, u64 pc) {
+  u64 page;
+  unassert(IsMakingPath(m));
+  if (pc < m->ip) return false;
+  if (m->path.branches >= kPathFollows) return false;
+  page = m->path.start & -4096;
+  if ((pc & -4096) != page && (pc & -4096) != page + 4096) return false;
+  if (GetJitHook(&m->system->jit, pc)) return false;
+  if (!m->path.hot) {
+    m->path.retier = true;
+    return false;
+  }
+  STATISTIC(++path_followed);
+  ++m->path.branches;
+  m->path.follow = true;
+  m->path.branch = GetPc(m) - Oplength(rde);
+  return true;
+}
+
+// remembers each 64-byte line of guest memory the op is read from, and
+// its hash, so changes to those lines can be noticed, whether they are
+// made while the path is being generated, or some time after it's done
+/**
+ * Hashes cache lines of guest code that's been compiled into the path,
+ * so it gets invalidated if they're modified before it's installed.
+ */
+void CoverPathBytes(struct Machine *m, i64 pc, long len) {
+  u8 *host;
+  long i;
+  i64 page, line;
+  page = m->path.start & -4096;
+  for (line = pc & -64; line < pc + len; line += 64) {
+    i = (line - page) >> 6;
+    if ((m->path.lines[i >> 6] >> (i & 63)) & 1) continue;
+    if (!(host = LookupAddress2(m, line, PAGE_XD, 0))) {
+      m->path.stale = true;
+      return;
+    }
+    m->path.sums[i] = HashJitLine(host);
+    m->path.lines[i >> 6] |= (u64)1 << (i & 63);
+  }
+}
+
+static void CoverPathOp(P) {
+  u8 *host;
+  long i, k, n;
+  i64 pc;
+  pc = GetPc(m);
+  CoverPathBytes(m, pc, Oplength(rde));
+  if (m->path.stale) return;
+  // the op must have been decoded from the bytes which were hashed
+  for (n = Oplength(rde), k = 0; k < n; k += i) {
+    i = MIN(n - k, 4096 - ((pc + k) & 4095));
+    if (!(host = LookupAddress2(m, pc + k, PAGE_XD, 0)) ||
+        memcmp(host, m->xedd->bytes + k, i)) {
+      m->path.stale = true;
+      return;
+    }
+  }
+}
+
+// checks the lines of guest memory the path was generated from haven't
+// changed, and then records them in the jit, so it'll reset the path if
+// they change later on
+static bool CoverPath(struct Machine *m) {
+  int k;
+  i64 page;
+  u8 *host;
+  u64 lines;
+  unsigned i, gen;
+  if (m->path.stale) return false;
+  page = m->path.start & -4096;
+  gen = atomic_load_explicit(&m->system->jit.smcgen, memory_order_acquire);
+  for (k = 0; k < 2; ++k) {
+    if (!(lines = m->path.lines[k])) continue;
+    if (!(host = LookupAddress2(m, page + k * 4096, PAGE_XD, 0))) {
+      return false;
+    }
+    for (; lines; lines &= lines - 1) {
+      i = bsf(lines);
+      if (HashJitLine(host + i * 64) != m->path.sums[k * 64 + i]) {
+        return false;
+      }
+    }
+  }
+  return CoverJitPath(&m->system->jit, m->path.start, m->path.lines,
+                      m->path.sums, gen);
+}
+
 void FinishPath(struct Machine *m) {
+  size_t size;
+  uintptr_t addr;
   unassert(IsMakingPath(m));
+  if (m->path.retier) {
+    CountPathHits(m);
+  }
+  if (!CoverPath(m)) {
+    STATISTIC(++path_stale);
+    AbandonPath(m);
+    return;
+  }
+  AppendColdPaths(m);
+  if (m->path.spans) {
+    STATISTIC(++path_spanned);
+    SpanJitPage(&m->system->jit, m->path.start);
+  }
   FlushCod(m->path.jb);
   STATISTIC(path_longest_bytes =
                 MAX(path_longest_bytes, m->path.jb->index - m->path.jb->start));
   STATISTIC(path_longest = MAX(path_longest, m->path.elements));
   STATISTIC(AVERAGE(path_average_elements, m->path.elements));
   STATISTIC(AVERAGE(path_average_bytes, m->path.jb->index - m->path.jb->start));
+  addr = (uintptr_t)m->path.jb->addr + m->path.jb->start;
+  size = m->path.jb->index - m->path.jb->start;
   if (FinishJit(&m->system->jit, m->path.jb)) {
     STATISTIC(++path_count);
+    RecordPathStats(size, m->path.began);
+    if (FLAG_perfmap) AddPerfMap(m->system, addr, size, m->path.start);
     JIP_LOGF("staged path to %" PRIx64, m->path.start);
   } else {
     JIP_LOGF("path starting at %" PRIx64 " couldn't be installed",
              m->path.start);
+    RecordPathStats(0, m->path.began);
   }
+  ResetJitRegs(m);
   m->path.jb = 0;
 }
 
@@ -617,6 +910,9 @@ void AbandonPath(struct Machine *m) {
   JIP_LOGF("abandoning path jit_pc:%" PRIxPTR " which started at pc:%" PRIx64,
            GetJitPc(m->path.jb), m->path.start);
   AbandonJit(&m->system->jit, m->path.jb);
+  RecordPathStats(0, m->path.began);
+  ResetJitRegs(m);
+  m->path.colds = 0;
   m->path.skew = 0;
   m->path.jb = 0;
 }
@@ -634,17 +930,55 @@ void FlushSkew(P) {
   }
 }
 
+// counts block of guest code if op begins one, which is the case for
+// the first op of a path, and the target of a branch the path followed
+static void CountPathBlock(P) {
+  if (!m->path.block || m->path.follow) {
+    if (!(m->path.block = GetCoverageBlock(m->system, GetPc(m)))) return;
+    CountCoverage(m, m->path.block);
+    Jitter(A,
+           "a1i"  // arg1 = block
+           "q"    // arg0 = machine
+           "c",   // call function (CountCoverage)
+           m->path.block, CountCoverage);
+  }
+  ExtendCoverageBlock(m->path.block, GetPc(m) + Oplength(rde));
+}
+
 void AddPath_StartOp(P) {
+  CoverPathOp(A);
+  if (FLAG_coverage) {
+    CountPathBlock(A);
+  }
+  if (FLAG_etrace && m->path.follow) {
+    EtraceEdge(m, m->path.branch, GetPc(m));
+    Jitter(A,
+           "a2i"  // arg2 = pc
+           "a1i"  // arg1 = address of branch
+           "q"    // arg0 = machine
+           "c",   // call function (EtraceEdge)
+           GetPc(m), m->path.branch, EtraceEdge);
+  }
+  m->path.scratch = 0;
+  m->path.follow = false;
+  if (ClassifyOp(rde) != kOpNormal) {
+    // branching ops emit conditional exits with fixed-size skips, so
+    // guest registers must live in memory before such an op is begun
+    ForgetJitRegs(m);
+    m->path.nocache = true;
+  }
 #if LOG_CPU
   Jitter(A, "qmq", LogCpu);
 #endif
   BeginCod(m, GetPc(m));
-#ifndef NDEBUG
+#ifndef TINY
   if (FLAG_statistics) {
+    // a real call is made, since the thread local counters can't be
+    // addressed by a micro-op that's been copied into shared memory
     Jitter(A,
-           "a0i"  // arg0 = &instructions_jitted
-           "m",   // call micro-op (CountOp)
-           &instructions_jitted, CountOp);
+           "a0i"  // arg0 = opcode
+           "c",   // call function (CountOp)
+           Mopcode(rde), CountOp);
   }
 #endif
   if (AddPath_StartOp_Hook) {
@@ -736,12 +1070,21 @@ void AddPath_EndOp(P) {
 
 bool AddPath(P) {
   unassert(IsMakingPath(m));
+#ifndef TINY
+  if (FLAG_statistics) {
+    Jitter(A,
+           "a0i"  // arg0 = opcode
+           "c"    // call function (CountHelperOp)
+           "q",   // arg0 = machine
+           Mopcode(rde), CountHelperOp);
+  }
+#endif
   Jitter(A,
          "a3i"  // arg2 = uimm0
          "a2i"  // arg2 = disp
          "a1i"  // arg1 = rde
          "c",   // call function
-         uimm0, disp, rde, GetOp(Mopcode(rde)));
+         uimm0, disp, rde, GetOpForRde(rde));
   return true;
 }
 
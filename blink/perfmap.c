@@ -0,0 +1,163 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/perfmap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/dis.h"
+#include "blink/flag.h"
+#include "blink/loader.h"
+#include "blink/log.h"
+#include "blink/macros.h"
+#include "blink/thread.h"
+#include "blink/util.h"
+
+/**
+ * @fileoverview Linux perf map file for jit generated code.
+ *
+ * When BLINK_PERFMAP is set, each jit path is described by a line of
+ * /tmp/perf-PID.map, which host tools like `perf top` use to name code
+ * in anonymous executable memory. Paths are named after the guest's
+ * symbol and offset at which they begin, so that time spent in jitted
+ * guest functions can be told apart from time spent in the emulator.
+ * Symbols are loaded as files get mapped, using the same code as the
+ * debugger, which comes at the cost of slowing down mmap() and exec.
+ *
+ * The format has no way to say code went away, so retired jit blocks
+ * aren't noted, and paths later generated at the same host addresses
+ * are simply appended. Perf uses whichever line it reads last.
+ */
+
+static struct PerfMap {
+  int fd;                 // perf map file, at or above kMinBlinkFd
+  void (*onfilemap)(struct System *, struct FileMap *);
+  pthread_mutex_t_ lock;  // guards everything above and our Dis objects
+} g_perfmap = {
+    .fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER_,
+};
+
+static void OpenPerfMap(void) {
+  int fd;
+  char path[32];
+  snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                 0644)) == -1) {
+    LOGF("failed to open %s: %s", path, DescribeHostErrno(errno));
+    return;
+  }
+  unassert((g_perfmap.fd = fcntl(fd, F_DUPFD_CLOEXEC, kMinBlinkFd)) != -1);
+  unassert(!close(fd));
+}
+
+// loads symbols of files mmap()'d by guest, which races paths being made
+static void OnPerfMapFileMap(struct System *s, struct FileMap *fm) {
+  LOCK(&g_perfmap.lock);
+  g_perfmap.onfilemap(s, fm);
+  UNLOCK(&g_perfmap.lock);
+}
+
+static bool HasPerfMapSymbols(struct System *s) {
+  return s->onfilemap == OnPerfMapFileMap;
+}
+
+// starts naming paths after the symbols of s, once its program is loaded
+// @assume other guest threads don't exist
+void StartPerfMap(struct System *s) {
+  struct Dis *dis;
+  LOCK(&g_perfmap.lock);
+  if (g_perfmap.fd == -1) OpenPerfMap();
+  if (!s->dis && (dis = (struct Dis *)calloc(1, sizeof(*dis)))) {
+    s->dis = dis;
+    LoadDebugSymbols(s);
+    g_perfmap.onfilemap = s->onfilemap;
+    s->onfilemap = OnPerfMapFileMap;
+  }
+  UNLOCK(&g_perfmap.lock);
+}
+
+// unloads symbols of s, which is about to be freed
+void ForgetPerfMap(struct System *s) {
+  if (!FLAG_perfmap) return;
+  LOCK(&g_perfmap.lock);
+  if (HasPerfMapSymbols(s)) {
+    DisFree(s->dis);
+    free(s->dis);
+    s->dis = 0;
+    s->onfilemap = 0;
+  }
+  UNLOCK(&g_perfmap.lock);
+}
+
+// describes generated code at [addr,addr+size) which begins at guest pc
+void AddPerfMap(struct System *s, uintptr_t addr, size_t size, i64 pc) {
+  long sym;
+  int n = 0;
+  char line[256];
+  LOCK(&g_perfmap.lock);
+  if (g_perfmap.fd != -1) {
+    if (HasPerfMapSymbols(s) && (sym = DisFindSym(s->dis, pc)) != -1) {
+      n = snprintf(line, sizeof(line), "%" PRIxPTR " %zx %s", addr, size,
+                   s->dis->syms.p[sym].name);
+      if (pc != s->dis->syms.p[sym].addr) {
+        n += snprintf(line + n, sizeof(line) - n, "+%#" PRIx64,
+                      pc - s->dis->syms.p[sym].addr);
+      }
+    } else if (pc) {
+      n = snprintf(line, sizeof(line), "%" PRIxPTR " %zx %#" PRIx64, addr, size,
+                   pc);
+    } else {
+      n = snprintf(line, sizeof(line), "%" PRIxPTR " %zx blink_jit_ender",
+                   addr, size);
+    }
+    n = MIN(n, (int)sizeof(line) - 2);
+    line[n++] = '\n';
+    if (write(g_perfmap.fd, line, n) != n) {
+      LOG_ONCE(LOGF("failed to write perf map: %s", DescribeHostErrno(errno)));
+    }
+  }
+  UNLOCK(&g_perfmap.lock);
+}
+
+// locks the perf map before fork()
+void LockPerfMap(void) {
+  LOCK(&g_perfmap.lock);
+}
+
+// unlocks the perf map in the parent after fork()
+void UnlockPerfMap(void) {
+  UNLOCK(&g_perfmap.lock);
+}
+
+// resets the perf map in the child after fork()
+// the child gets a map of its own for the paths it goes on to create
+void ResetPerfMap(void) {
+  if (g_perfmap.fd != -1) {
+    unassert(!close(g_perfmap.fd));
+    g_perfmap.fd = -1;
+    OpenPerfMap();
+  }
+  unassert(!pthread_mutex_init(&g_perfmap.lock, 0));
+}
@@ -0,0 +1,15 @@
+#ifndef BLINK_PERFMAP_H_
+#define BLINK_PERFMAP_H_
+#include <stddef.h>
+#include <stdint.h>
+
+#include "blink/machine.h"
+
+void StartPerfMap(struct System *);
+void ForgetPerfMap(struct System *);
+void AddPerfMap(struct System *, uintptr_t, size_t, i64);
+void LockPerfMap(void);
+void UnlockPerfMap(void);
+void ResetPerfMap(void);
+
+#endif /* BLINK_PERFMAP_H_ */
@@ -0,0 +1,96 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/errno.h"
+#include "blink/fds.h"
+#include "blink/linux.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/syscall.h"
+#include "blink/thread.h"
+#include "blink/vfs.h"
+#include "blink/xlat.h"
+
+#ifdef HAVE_PIDFD
+#include <sys/syscall.h>
+
+// pidfds are handed straight to the host, which is possible because the
+// guest's children are host processes with the same pids. they can thus
+// be polled and passed to waitid(P_PIDFD) by the guest like any other fd.
+// the vfs wraps them like any other host file
+
+int SysPidfdOpen(struct Machine *m, i32 pid, u32 flags) {
+  int lim, fildes, oflags;
+  if (flags & ~PIDFD_NONBLOCK_LINUX) {
+    LOGF("%s() unsupported flags: %d", "pidfd_open",
+         flags & ~PIDFD_NONBLOCK_LINUX);
+    return einval();
+  }
+  oflags = flags & PIDFD_NONBLOCK_LINUX ? O_NONBLOCK : 0;
+  if (!(lim = GetFileDescriptorLimit(m->system))) return emfile();
+  if ((fildes = syscall(SYS_pidfd_open, pid, oflags)) != -1) {
+#ifndef DISABLE_VFS
+    if ((fildes = VfsAddHostFd(fildes)) == -1) return -1;
+#endif
+    if (fildes >= lim) {
+      VfsClose(fildes);
+      fildes = emfile();
+    } else {
+      // pidfds are always close-on-exec
+      LOCK(&m->system->fds.lock);
+      unassert(AddFd(&m->system->fds, fildes,
+                     O_RDWR | O_CLOEXEC | (oflags ? O_NDELAY : 0)));
+      UNLOCK(&m->system->fds.lock);
+    }
+  }
+  return fildes;
+}
+
+int SysPidfdSendSignal(struct Machine *m, i32 fildes, i32 sig, i64 infoaddr,
+                       u32 flags) {
+  int rc, syssig;
+#ifndef DISABLE_VFS
+  struct VfsInfo *info;
+#endif
+  if (infoaddr) {
+    LOGF("%s() with siginfo not supported yet", "pidfd_send_signal");
+    return einval();
+  }
+  if (flags) return einval();
+  if (!sig) {
+    syssig = 0;
+  } else if (!(1 <= sig && sig <= 64) || (syssig = XlatSignal(sig)) == -1) {
+    return einval();
+  }
+#ifndef DISABLE_VFS
+  if ((fildes = VfsGetHostFd(fildes, &info)) == -1) return -1;
+#endif
+  rc = syscall(SYS_pidfd_send_signal, fildes, syssig, 0, 0);
+#ifndef DISABLE_VFS
+  unassert(!VfsFreeInfo(info));
+#endif
+  return rc;
+}
+
+#endif /* HAVE_PIDFD */
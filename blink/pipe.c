@@ -41,6 +41,7 @@ int SysPipe2(struct Machine *m, i64 pipefds_addr, i32 flags) {
   int fds[2];
   int oflags;
   int supported;
+  struct Fd *fd;
   u8 fds_linux[2][4];
   supported = O_CLOEXEC_LINUX | O_NDELAY_LINUX;
   if (flags & ~supported) {
@@ -74,8 +75,10 @@ int SysPipe2(struct Machine *m, i64 pipefds_addr, i32 flags) {
       rc = emfile();
     } else {
       LOCK(&m->system->fds.lock);
-      unassert(AddFd(&m->system->fds, fds[0], O_RDONLY | oflags));
-      unassert(AddFd(&m->system->fds, fds[1], O_WRONLY | oflags));
+      unassert(fd = AddFd(&m->system->fds, fds[0], O_RDONLY | oflags));
+      fd->growpipe = true;
+      unassert(fd = AddFd(&m->system->fds, fds[1], O_WRONLY | oflags));
+      fd->growpipe = true;
       UNLOCK(&m->system->fds.lock);
       Write32(fds_linux[0], fds[0]);
       Write32(fds_linux[1], fds[1]);
@@ -90,3 +93,16 @@ int SysPipe2(struct Machine *m, i64 pipefds_addr, i32 flags) {
 #endif
   return rc;
 }
+
+// Enlarges the host buffer of a pipe the guest created, once the guest
+// has been seen pushing bulk data through it, so that pipelines such as
+// `cat | grep | sort` context switch less often. This isn't done when
+// the pipe is created, because the kernel limits how many pages a user
+// may have sitting in pipe buffers, and most pipes never carry much.
+void GrowPipe(int fildes) {
+#ifdef F_SETPIPE_SZ
+  int e = errno;
+  VfsFcntl(fildes, F_SETPIPE_SZ, kPipeGrowSize);  // best effort
+  errno = e;
+#endif
+}
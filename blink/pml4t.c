@@ -42,11 +42,11 @@ static void FindContiguousMemoryRangesImpl(
     entry = Load64(GetPageAddress(m->system, pt, level == 39) + i * 8);
     if (!(entry & PAGE_V)) continue;
     page = (addr | i << level) << 16 >> 16;
-    if (level == 12) {
+    if (level == 12 || (level == 21 && IsLazyChunk(entry))) {
       if (ranges->i && page == ranges->p[ranges->i - 1].b) {
-        ranges->p[ranges->i - 1].b += 4096;
+        ranges->p[ranges->i - 1].b += (i64)1 << level;
       } else {
-        AppendContiguousMemoryRange(ranges, page, page + 4096);
+        AppendContiguousMemoryRange(ranges, page, page + ((i64)1 << level));
       }
     } else {
       FindContiguousMemoryRangesImpl(m, ranges, page, level - 9, entry, 0, 512);
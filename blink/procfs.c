@@ -21,12 +21,17 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "blink/atomic.h"
+#include "blink/bus.h"
 #include "blink/errno.h"
 #include "blink/log.h"
 #include "blink/machine.h"
+#include "blink/thread.h"
 #include "blink/timespec.h"
+#include "blink/tunables.h"
+#include "blink/util.h"
 #include "blink/vfs.h"
 
 #ifdef __EMSCRIPTEN__
@@ -49,6 +54,12 @@
 #define PROCFS_NAME_MAX 16
 #define PROCFS_READ_LEN 4096
 #define PROCFS_DELETED  " (deleted)"
+#define PROCFS_MAPS_END 0x800000000000  // end of the lower half address space
+
+#define PROCFS_PAGEMAP_PRESENT    0x8000000000000000
+#define PROCFS_PAGEMAP_SWAPPED    0x4000000000000000
+#define PROCFS_PAGEMAP_SHARED     0x2000000000000000
+#define PROCFS_PAGEMAP_SOFT_DIRTY 0x0080000000000000
 
 struct ProcfsInfo {
   u64 ino;
@@ -67,11 +78,12 @@ struct ProcfsInfo {
     ssize_t (*readlink)(struct VfsInfo *, char **);
     int (*read)(struct VfsInfo *, struct ProcfsOpenFile *);
   };
+  ssize_t (*write)(struct VfsInfo *, const char *, size_t);
 };
 
 struct ProcfsOpenFile {
   pthread_mutex_t_ lock;
-  size_t index;
+  u64 index;  // generator cursor, e.g. next guest address for maps
   off_t offset;
   int openflags;
   size_t readbufstart;
@@ -84,6 +96,18 @@ struct ProcfsOpenDir {
   size_t index;
 };
 
+// files generated from host state poll the host each time, which is
+// costly when guest monitoring tools sample them in a tight loop, so
+// their first chunk gets reused for a short while by all open files
+struct ProcfsCache {
+  pthread_mutex_t_ lock;
+  struct timespec expires;
+  u64 index;
+  size_t readbufstart;
+  size_t readbufend;
+  char readbuf[PROCFS_READ_LEN];
+};
+
 struct ProcfsDevice {
   struct timespec mounttime;
 };
@@ -91,6 +115,7 @@ struct ProcfsDevice {
 enum {
   PROCFS_NULL_INO,
   PROCFS_ROOT_INO,
+  PROCFS_CPUINFO_INO,
   PROCFS_FILESYSTEMS_INO,
   PROCFS_MEMINFO_INO,
   PROCFS_MOUNTS_INO,
@@ -103,6 +128,7 @@ enum {
 
 enum {
   PROCFS_ROOT_TYPE,
+  PROCFS_CPUINFO_TYPE,
   PROCFS_MEMINFO_TYPE,
   PROCFS_FILESYSTEMS_TYPE,
   PROCFS_MOUNTS_TYPE,
@@ -115,13 +141,22 @@ enum {
   PROCFS_PIDDIR_CWD_TYPE,
   PROCFS_PIDDIR_ROOT_TYPE,
   PROCFS_PIDDIR_MOUNTS_TYPE,
+  PROCFS_PIDDIR_MAPS_TYPE,
+  PROCFS_PIDDIR_PAGEMAP_TYPE,
+  PROCFS_PIDDIR_CLEAR_REFS_TYPE,
   PROCFS_PIDDIR_FDDIR_TYPE,
   PROCFS_PIDDIR_LAST_TYPE = PROCFS_PIDDIR_FDDIR_TYPE
 };
 
+static struct ProcfsCache g_procfscache[] = {
+    {PTHREAD_MUTEX_INITIALIZER_},  // PROCFS_MEMINFO_TYPE
+    {PTHREAD_MUTEX_INITIALIZER_},  // PROCFS_UPTIME_TYPE
+};
+
 static int ProcfsRootReaddir(struct VfsInfo *, struct dirent *);
 static ssize_t ProcfsSelfReadlink(struct VfsInfo *, char **);
 static ssize_t ProcfsToSelfReadlink(struct VfsInfo *, char **);
+static int ProcfsCpuinfoRead(struct VfsInfo *, struct ProcfsOpenFile *);
 static int ProcfsMeminfoRead(struct VfsInfo *, struct ProcfsOpenFile *);
 static int ProcfsUptimeRead(struct VfsInfo *, struct ProcfsOpenFile *);
 static int ProcfsFilesystemsRead(struct VfsInfo *, struct ProcfsOpenFile *);
@@ -131,10 +166,17 @@ static ssize_t ProcfsPiddirExeReadlink(struct VfsInfo *, char **);
 static ssize_t ProcfsPiddirCwdReadlink(struct VfsInfo *, char **);
 static ssize_t ProcfsPiddirRootReadlink(struct VfsInfo *, char **);
 static int ProcfsPiddirMountsRead(struct VfsInfo *, struct ProcfsOpenFile *);
+static int ProcfsPiddirMapsRead(struct VfsInfo *, struct ProcfsOpenFile *);
+static int ProcfsPiddirPagemapRead(struct VfsInfo *, struct ProcfsOpenFile *);
+static ssize_t ProcfsPiddirClearRefsWrite(struct VfsInfo *, const char *,
+                                          size_t);
 
 static struct ProcfsInfo g_defaultinfos[] = {
     [PROCFS_ROOT_INO] = {PROCFS_ROOT_INO, S_IFDIR | 0555, 0, 0,
                          PROCFS_ROOT_TYPE, "", .readdir = ProcfsRootReaddir},
+    [PROCFS_CPUINFO_INO] = {PROCFS_CPUINFO_INO, S_IFREG | 0444, 0, 0,
+                            PROCFS_CPUINFO_TYPE, "cpuinfo",
+                            .read = ProcfsCpuinfoRead},
     [PROCFS_FILESYSTEMS_INO] = {PROCFS_FILESYSTEMS_INO, S_IFREG | 0444, 0, 0,
                                 PROCFS_FILESYSTEMS_TYPE, "filesystems",
                                 .read = ProcfsFilesystemsRead},
@@ -171,6 +213,18 @@ static struct ProcfsInfo g_piddirinfos[] = {
         PROCFS_PIDDIR_TYPE] = {0, S_IFREG | 0444, 0, 0,
                                PROCFS_PIDDIR_MOUNTS_TYPE, "mounts",
                                .read = ProcfsPiddirMountsRead},
+    [PROCFS_PIDDIR_MAPS_TYPE -
+        PROCFS_PIDDIR_TYPE] = {0, S_IFREG | 0444, 0, 0,
+                               PROCFS_PIDDIR_MAPS_TYPE, "maps",
+                               .read = ProcfsPiddirMapsRead},
+    [PROCFS_PIDDIR_PAGEMAP_TYPE -
+        PROCFS_PIDDIR_TYPE] = {0, S_IFREG | 0444, 0, 0,
+                               PROCFS_PIDDIR_PAGEMAP_TYPE, "pagemap",
+                               .read = ProcfsPiddirPagemapRead},
+    [PROCFS_PIDDIR_CLEAR_REFS_TYPE -
+        PROCFS_PIDDIR_TYPE] = {0, S_IFREG | 0200, 0, 0,
+                               PROCFS_PIDDIR_CLEAR_REFS_TYPE, "clear_refs",
+                               .write = ProcfsPiddirClearRefsWrite},
     [PROCFS_PIDDIR_FDDIR_TYPE - PROCFS_PIDDIR_TYPE] = {0, S_IFDIR | 0555, 0, 0,
                                                        PROCFS_PIDDIR_FDDIR_TYPE,
                                                        "fd"},
@@ -188,6 +242,7 @@ static int ProcfsCreateInfo(struct ProcfsInfo **info) {
   (*info)->type = 0;
   (*info)->name[0] = '\0';
   (*info)->openfile = NULL;
+  (*info)->write = NULL;
   return 0;
 }
 
@@ -671,16 +726,81 @@ static int ProcfsChown(struct VfsInfo *parent, const char *name, uid_t uid,
 
 ////////////////////////////////////////////////////////////////////////////////
 
+static struct ProcfsCache *ProcfsGetCache(struct ProcfsInfo *procinfo) {
+  switch (procinfo->type) {
+    case PROCFS_MEMINFO_TYPE:
+      return g_procfscache + 0;
+    case PROCFS_UPTIME_TYPE:
+      return g_procfscache + 1;
+    default:
+      return NULL;
+  }
+}
+
+// files that are indexed by offset, rather than formatted from start
+// to finish, generate whichever chunk is read, and their open file's
+// index is the offset of the chunk
+static bool ProcfsIsIndexed(struct ProcfsInfo *procinfo) {
+  return procinfo->type == PROCFS_PIDDIR_PAGEMAP_TYPE;
+}
+
+static int ProcfsGenerate(struct VfsInfo *info,
+                          struct ProcfsOpenFile *openfile) {
+  struct ProcfsInfo *procinfo = (struct ProcfsInfo *)info->data;
+  struct ProcfsCache *cache;
+  struct timespec now;
+  int ret;
+  if (openfile->index || !(cache = ProcfsGetCache(procinfo))) {
+    return procinfo->read(info, openfile);
+  }
+  now = GetMonotonic();
+  LOCK(&cache->lock);
+  if (CompareTime(now, cache->expires) < 0) {
+    openfile->index = cache->index;
+    openfile->readbufstart = cache->readbufstart;
+    openfile->readbufend = cache->readbufend;
+    memcpy(openfile->readbuf, cache->readbuf, sizeof(openfile->readbuf));
+    ret = 0;
+  } else if ((ret = procinfo->read(info, openfile)) != -1) {
+    cache->expires = AddTime(now, FromMilliseconds(kProcfsCacheMs));
+    cache->index = openfile->index;
+    cache->readbufstart = openfile->readbufstart;
+    cache->readbufend = openfile->readbufend;
+    memcpy(cache->readbuf, openfile->readbuf, sizeof(cache->readbuf));
+  }
+  UNLOCK(&cache->lock);
+  return ret;
+}
+
+// reads `len` bytes at file offset `off`, or at the current offset if
+// `off` is -1. content is generated one chunk at a time, resuming from
+// the chunk the open file is on if it isn't past `off`, so reading or
+// seeking forward never formats what came before it all over again.
 static ssize_t ProcfsReadImpl(struct VfsInfo *info, void *buf, size_t len,
                               off_t off, bool copy) {
   struct ProcfsInfo *procinfo = (struct ProcfsInfo *)info->data;
   struct ProcfsOpenFile tmpopenfile = *(procinfo->openfile);
   ssize_t ret = 0;
   size_t bytestoread = 0;
-  if (off != -1) {
-    tmpopenfile.readbufstart = tmpopenfile.readbufend = 0;
-    tmpopenfile.index = 0;
-    tmpopenfile.offset = 0;
+  bool setoffset = off != -1;
+  off_t base;
+  if (setoffset) {
+    base = tmpopenfile.offset - tmpopenfile.readbufstart;
+    if (ProcfsIsIndexed(procinfo)) {
+      tmpopenfile.readbufstart = tmpopenfile.readbufend = 0;
+      tmpopenfile.index = ROUNDDOWN(off, sizeof(tmpopenfile.readbuf));
+      tmpopenfile.offset = tmpopenfile.index;
+      off -= tmpopenfile.index;
+    } else if (tmpopenfile.readbufend <= sizeof(tmpopenfile.readbuf) &&
+               base <= off) {
+      tmpopenfile.readbufstart = 0;
+      tmpopenfile.offset = base;
+      off -= base;
+    } else {
+      tmpopenfile.readbufstart = tmpopenfile.readbufend = 0;
+      tmpopenfile.index = 0;
+      tmpopenfile.offset = 0;
+    }
   }
   while ((off > 0 || len > 0) &&
          tmpopenfile.readbufend <= sizeof(tmpopenfile.readbuf)) {
@@ -690,7 +810,7 @@ static ssize_t ProcfsReadImpl(struct VfsInfo *info, void *buf, size_t len,
         ret = eperm();
         break;
       }
-      if (procinfo->read(info, &tmpopenfile) == -1) {
+      if (ProcfsGenerate(info, &tmpopenfile) == -1) {
         ret = -1;
         break;
       }
@@ -710,7 +830,7 @@ static ssize_t ProcfsReadImpl(struct VfsInfo *info, void *buf, size_t len,
       ret += bytestoread;
     }
   }
-  if (copy || (off == -1 && ret != -1)) {
+  if (copy || (!setoffset && ret != -1)) {
     *(procinfo->openfile) = tmpopenfile;
   }
   return ret;
@@ -739,7 +859,6 @@ static ssize_t ProcfsPreadv(struct VfsInfo *info, const struct iovec *iov,
     }
     len += ret;
     off += ret;
-    procinfo->openfile->offset += ret;
     if (ret < iov[i].iov_len) {
       break;
     }
@@ -803,9 +922,39 @@ static ssize_t ProcfsRead(struct VfsInfo *info, void *buf, size_t len) {
   return ret;
 }
 
-static ssize_t ProcfsWrite(struct VfsInfo *, const void *, size_t);
+// files are written one whole message at a time, like linux, since
+// none of the files we let be written are interested in the offset
+static ssize_t ProcfsWrite(struct VfsInfo *info, const void *buf, size_t len) {
+  struct ProcfsInfo *procinfo = (struct ProcfsInfo *)info->data;
+  ssize_t ret;
+  if (!S_ISREG(procinfo->mode) || procinfo->openfile == NULL ||
+      !(procinfo->openfile->openflags & (O_WRONLY | O_RDWR))) {
+    return ebadf();
+  }
+  if (!procinfo->write) {
+    return einval();
+  }
+  LOCK(&procinfo->openfile->lock);
+  ret = procinfo->write(info, (const char *)buf, len);
+  UNLOCK(&procinfo->openfile->lock);
+  return ret;
+}
+
+static ssize_t ProcfsWritev(struct VfsInfo *info, const struct iovec *iov,
+                            int iovcnt) {
+  int i;
+  ssize_t ret, len = 0;
+  for (i = 0; i < iovcnt; ++i) {
+    if (!iov[i].iov_len) continue;
+    if ((ret = ProcfsWrite(info, iov[i].iov_base, iov[i].iov_len)) == -1) {
+      return len ? len : -1;
+    }
+    len += ret;
+  }
+  return len;
+}
+
 static ssize_t ProcfsPwrite(struct VfsInfo *, const void *, size_t, off_t);
-static ssize_t ProcfsWritev(struct VfsInfo *, const struct iovec *, int);
 static ssize_t ProcfsPwritev(struct VfsInfo *, const struct iovec *, int,
                              off_t);
 
@@ -848,26 +997,8 @@ static off_t ProcfsSeekImpl(struct VfsInfo *info, off_t off, int whence) {
     if (newoff < 0) {
       return einval();
     }
-    if (procinfo->openfile->readbufend <= sizeof(procinfo->openfile->readbuf) &&
-        procinfo->openfile->offset / PROCFS_READ_LEN ==
-            newoff / PROCFS_READ_LEN) {
-      // We're still in the cached region.
-      procinfo->openfile->readbufstart += newoff - procinfo->openfile->offset;
-      procinfo->openfile->offset = newoff;
-    } else {
-      if ((procinfo->openfile->offset / PROCFS_READ_LEN >
-           newoff / PROCFS_READ_LEN) ||
-          (procinfo->openfile->readbufend >
-           sizeof(procinfo->openfile->readbuf))) {
-        // Reset the file if it has already ended or we're going back before the
-        // buffer.
-        procinfo->openfile->index = 0;
-        procinfo->openfile->offset = 0;
-        procinfo->openfile->readbufstart = procinfo->openfile->readbufend = 0;
-      }
-      ProcfsReadImpl(info, NULL, 0, newoff - procinfo->openfile->offset, true);
-      procinfo->openfile->offset = newoff;
-    }
+    ProcfsReadImpl(info, NULL, 0, newoff, true);
+    procinfo->openfile->offset = newoff;
     return procinfo->openfile->offset;
   } else {
     return einval();
@@ -1151,6 +1282,75 @@ static ssize_t ProcfsPiddirRootReadlink(struct VfsInfo *info, char **buf) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// returns topology attribute of host cpu, e.g. its core_id, or -1
+static int ProcfsCpuTopology(int cpu, const char *attr) {
+#ifdef __linux__
+  int fd;
+  ssize_t rc;
+  char path[80], buf[16];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s",
+           cpu, attr);
+  if ((fd = open(path, O_RDONLY)) == -1) return -1;
+  rc = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (rc <= 0) return -1;
+  buf[rc] = 0;
+  return atoi(buf);
+#else
+  return -1;
+#endif
+}
+
+// lists the host's processors with the identity blink's cpuid reports,
+// and the host's package / core numbering, so thread pools inside the
+// guest can tell hyperthreads and sockets apart when sizing themselves
+static int ProcfsCpuinfoRead(struct VfsInfo *info,
+                             struct ProcfsOpenFile *openfile) {
+  size_t byteswritten = 0;
+  size_t bytesleft = sizeof(openfile->readbuf);
+  size_t ret;
+  int cpu, count, package, core;
+  if (openfile->readbufend > sizeof(openfile->readbuf)) {
+    return 0;
+  }
+#ifdef _SC_NPROCESSORS_ONLN
+  if ((count = sysconf(_SC_NPROCESSORS_ONLN)) < 1) count = GetCpuCount();
+#else
+  count = GetCpuCount();
+#endif
+  for (cpu = openfile->index; cpu < count; ++cpu) {
+    if ((package = ProcfsCpuTopology(cpu, "physical_package_id")) == -1) {
+      package = 0;
+    }
+    if ((core = ProcfsCpuTopology(cpu, "core_id")) == -1) {
+      core = cpu;
+    }
+    ret = snprintf(openfile->readbuf + byteswritten, bytesleft,
+                   "processor\t: %d\n"
+                   "vendor_id\t: GenuineIntel\n"
+                   "model name\t: Blink Virtual Machine\n"
+                   "physical id\t: %d\n"
+                   "core id\t\t: %d\n"
+                   "apicid\t\t: %d\n"
+                   "\n",
+                   cpu, package, core, cpu);
+    if (ret >= bytesleft) {
+      break;
+    }
+    byteswritten += ret;
+    bytesleft -= ret;
+  }
+  openfile->index = cpu;
+  if (!byteswritten) {
+    openfile->readbufstart = sizeof(openfile->readbuf) + 1;
+    openfile->readbufend = sizeof(openfile->readbuf) + 1;
+  } else {
+    openfile->readbufstart = 0;
+    openfile->readbufend = byteswritten;
+  }
+  return 0;
+}
+
 static int ProcfsMeminfoRead(struct VfsInfo *info,
                              struct ProcfsOpenFile *openfile) {
 #ifdef __linux__
@@ -1410,6 +1610,175 @@ static int ProcfsPiddirMountsRead(struct VfsInfo *info,
   return 0;
 }
 
+// finds the first interval at or after `virt` of pages that have the
+// same protection and backing file, skipping over unmapped page table
+// subtrees whole, so that the walk costs what's mapped, not the space
+static bool ProcfsFindMapping(struct System *s, i64 *virt, i64 *end,
+                              u64 *key, struct FileMap **fm) {
+  u64 pt, i;
+  i64 limit;
+  struct Dll *e;
+  for (;;) {
+    if (*virt >= PROCFS_MAPS_END) return false;
+    for (pt = s->cr3, i = 39;; i -= 9) {
+      pt = Load64(GetPageAddress(s, pt, i == 39) + ((*virt >> i) & 511) * 8);
+      if (i == 12 || !(pt & PAGE_V) || IsLazyChunk(pt)) break;
+    }
+    if (pt & PAGE_V) break;
+    *virt = (*virt | (((u64)1 << i) - 1)) + 1;
+  }
+  *key = pt & (PAGE_U | PAGE_RW | PAGE_XD | PAGE_FILE);
+  *fm = (pt & PAGE_FILE) ? GetFileMap(s, *virt) : 0;
+  if (*fm) {
+    limit = (*fm)->virt + ROUNDUP((*fm)->size, 4096);
+  } else {
+    // anonymous memory ends where the next file mapping starts
+    limit = PROCFS_MAPS_END;
+    for (e = dll_first(s->filemaps); e; e = dll_next(s->filemaps, e)) {
+      if (FILEMAP_CONTAINER(e)->virt > *virt) {
+        limit = MIN(limit, FILEMAP_CONTAINER(e)->virt);
+      }
+    }
+  }
+  for (*end = *virt + 4096; *end < limit; *end += 4096) {
+    for (pt = s->cr3, i = 39;; i -= 9) {
+      pt = Load64(GetPageAddress(s, pt, i == 39) + ((*end >> i) & 511) * 8);
+      if (i == 12 || !(pt & PAGE_V) || IsLazyChunk(pt)) break;
+    }
+    if (!(pt & PAGE_V) ||
+        (pt & (PAGE_U | PAGE_RW | PAGE_XD | PAGE_FILE)) != *key ||
+        (*fm && !(((*fm)->present[((*end - (*fm)->virt) / 4096) / 64] >>
+                   (((*end - (*fm)->virt) / 4096) % 64)) &
+                  1))) {
+      break;
+    }
+  }
+  return true;
+}
+
+static int ProcfsPiddirMapsRead(struct VfsInfo *info,
+                                struct ProcfsOpenFile *openfile) {
+  size_t byteswritten = 0;
+  size_t bytesleft = sizeof(openfile->readbuf);
+  size_t ret;
+  struct System *s;
+  struct FileMap *fm;
+  const char *name;
+  char prefix[80];
+  i64 virt, end;
+  u64 key, offset;
+  int len;
+  if (openfile->readbufend > sizeof(openfile->readbuf)) {
+    return 0;
+  }
+  unassert(g_machine);
+  s = g_machine->system;
+  LOCK(&s->mmap_lock);
+  for (virt = openfile->index; ProcfsFindMapping(s, &virt, &end, &key, &fm);
+       virt = end) {
+    offset = 0;
+    name = "";
+    if (fm) {
+      name = fm->path;
+      if (fm->offset != -1) offset = fm->offset + (virt - fm->virt);
+    } else if (s->vdso && virt == s->vdso) {
+      name = "[vdso]";
+    }
+    // linux pads names out to the 74th column of the line
+    len = snprintf(prefix, sizeof(prefix),
+                   "%08" PRIx64 "-%08" PRIx64 " %c%c%cp %08" PRIx64
+                   " 00:00 0 ",
+                   virt, end, (key & PAGE_U) ? 'r' : '-',
+                   (key & PAGE_RW) ? 'w' : '-', (key & PAGE_XD) ? '-' : 'x',
+                   offset);
+    ret = snprintf(openfile->readbuf + byteswritten, bytesleft, "%s%*s%s\n",
+                   prefix, *name ? MAX(0, 73 - len) : 0, "", name);
+    if (ret >= bytesleft) {
+      break;
+    }
+    byteswritten += ret;
+    bytesleft -= ret;
+  }
+  openfile->index = virt;
+  UNLOCK(&s->mmap_lock);
+  if (!byteswritten) {
+    openfile->readbufstart = sizeof(openfile->readbuf) + 1;
+    openfile->readbufend = sizeof(openfile->readbuf) + 1;
+  } else {
+    openfile->readbufstart = 0;
+    openfile->readbufend = byteswritten;
+  }
+  return 0;
+}
+
+// linux gives unprivileged processes the present, swapped, shared and
+// soft dirty bits of each page, and zero for page frame numbers. pages
+// the reclaimer compressed are what blink has instead of swapped pages
+static int ProcfsPiddirPagemapRead(struct VfsInfo *info,
+                                   struct ProcfsOpenFile *openfile) {
+  u64 pt[PROCFS_READ_LEN / 8], entry;
+  u8 resident[ARRAYLEN(pt)];
+  struct System *s;
+  size_t i;
+  i64 virt;
+  if (openfile->index >= PROCFS_MAPS_END / 4096 * 8) {
+    openfile->readbufstart = sizeof(openfile->readbuf) + 1;
+    openfile->readbufend = sizeof(openfile->readbuf) + 1;
+    return 0;
+  }
+  unassert(g_machine);
+  s = g_machine->system;
+  virt = openfile->index / 8 * 4096;
+  LOCK(&s->mmap_lock);
+  GetPageTableEntries(s, virt, ARRAYLEN(pt), pt);
+  GetResidentPages(s, virt, ARRAYLEN(pt), pt, resident);
+  UNLOCK(&s->mmap_lock);
+  for (i = 0; i < ARRAYLEN(pt); ++i) {
+    if (resident[i]) {
+      entry = PROCFS_PAGEMAP_PRESENT;
+      if (pt[i] & PAGE_SHARE) entry |= PROCFS_PAGEMAP_SHARED;
+    } else if ((pt[i] & (PAGE_V | PAGE_ZIP)) == (PAGE_V | PAGE_ZIP)) {
+      entry = PROCFS_PAGEMAP_SWAPPED;
+    } else {
+      entry = 0;
+    }
+    if ((pt[i] & (PAGE_V | PAGE_D)) == (PAGE_V | PAGE_D)) {
+      entry |= PROCFS_PAGEMAP_SOFT_DIRTY;
+    }
+    Write64((u8 *)openfile->readbuf + i * 8, entry);
+  }
+  openfile->index += sizeof(openfile->readbuf);
+  openfile->readbufstart = 0;
+  openfile->readbufend = sizeof(openfile->readbuf);
+  return 0;
+}
+
+// writing 4 clears the soft dirty bits reported by pagemap, and the
+// other commands linux has are accepted, since there's nothing to do
+static ssize_t ProcfsPiddirClearRefsWrite(struct VfsInfo *info,
+                                          const char *buf, size_t len) {
+  char tmp[12];
+  size_t i, n;
+  int cmd = 0;
+  struct System *s;
+  n = MIN(len, sizeof(tmp) - 1);
+  memcpy(tmp, buf, n);
+  while (n && (tmp[n - 1] == '\n' || tmp[n - 1] == ' ')) --n;
+  for (i = 0; i < n; ++i) {
+    if (!('0' <= tmp[i] && tmp[i] <= '9')) return einval();
+    if ((cmd = cmd * 10 + (tmp[i] - '0')) > 5) return einval();
+  }
+  if (!n || cmd < 1) return einval();
+  if (cmd == 4) {
+    unassert(g_machine);
+    s = g_machine->system;
+    LOCK(&s->mmap_lock);
+    ClearSoftDirty(s);
+    UNLOCK(&s->mmap_lock);
+  }
+  return len;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 struct VfsSystem g_procfs = {.name = "proc",
@@ -1436,11 +1805,11 @@ struct VfsSystem g_procfs = {.name = "proc",
                                  .Link = NULL,
                                  .Unlink = NULL,
                                  .Read = ProcfsRead,
-                                 //.Write = ProcfsWrite,
+                                 .Write = ProcfsWrite,
                                  .Pread = ProcfsPread,
                                  //.Pwrite = ProcfsPwrite,
                                  .Readv = ProcfsReadv,
-                                 //.Writev = ProcfsWritev,
+                                 .Writev = ProcfsWritev,
                                  .Preadv = ProcfsPreadv,
                                  //.Pwritev = ProcfsPwritev,
                                  .Seek = ProcfsSeek,
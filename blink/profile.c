@@ -0,0 +1,287 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/profile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/buffer.h"
+#include "blink/debug.h"
+#include "blink/dis.h"
+#include "blink/endian.h"
+#include "blink/flag.h"
+#include "blink/loader.h"
+#include "blink/log.h"
+#include "blink/macros.h"
+#include "blink/thread.h"
+#include "blink/tunables.h"
+#include "blink/util.h"
+#include "blink/x86.h"
+
+/**
+ * @fileoverview Sampling profiler for guest programs.
+ *
+ * When BLINK_PROFILE names a file, the host's ITIMER_PROF timer is set
+ * to raise SIGPROF kProfileHz times per second of cpu time consumed by
+ * the process. Its handler just asks the guest thread it interrupted,
+ * through the attention flag, to take a sample, which is the guest's
+ * instruction pointer plus the return addresses found by following its
+ * frame pointers. Identical stacks are tallied together in a table so
+ * long running programs never need to drop any of their samples.
+ *
+ * When the program exits, or execve() replaces it, the stacks are then
+ * symbolized and written in the folded format that flamegraph.pl and
+ * speedscope accept, where each line is the program name followed by
+ * the stack from outermost to innermost frame, and the sample count.
+ * Frames without a symbol are written as hexadecimal addresses. Only
+ * the process blink launched is profiled, which includes the programs
+ * it execve()'s, but not the children it fork()'s.
+ */
+
+#define kProfileProbes 16  // collisions tolerated before a sample is dropped
+
+struct ProfileStack {
+  long count;              // samples that were taken on this stack
+  int depth;               // number of frames in pcs
+  i64 pcs[kProfileDepth];  // guest code addresses, innermost first
+};
+
+static struct Profile {
+  bool started;                 // timer and handler have been installed
+  bool disabled;                // we're a fork() child, which is silent
+  int fd;                       // profile file, at or above kMinBlinkFd
+  long samples;                 // samples tallied since the last flush
+  long dropped;                 // samples that didn't fit in the table
+  struct ProfileStack *stacks;  // open addressed table of unique stacks
+  pthread_mutex_t_ lock;        // guards everything above
+} g_profile = {
+    .fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER_,
+};
+
+static void OnSigProf(int sig) {
+  struct Machine *m;
+  if ((m = g_machine)) {
+    atomic_store_explicit(&m->profile, true, memory_order_release);
+    atomic_store_explicit(&m->attention, true, memory_order_release);
+  }
+}
+
+static int UnwindGuestStack(struct Machine *m, i64 pcs[kProfileDepth]) {
+  u8 *r;
+  int n = 0;
+  i64 sp, bp, rp;
+  rp = m->ip;
+  bp = Get64(m->bp);
+  sp = Get64(m->sp);
+  BEGIN_NO_PAGE_FAULTS;
+  for (;;) {
+    pcs[n++] = rp;
+    if (n == kProfileDepth) break;
+    if (m->mode.omode != XED_MODE_LONG) break;
+    if (!bp || bp < sp || (bp & 7)) break;
+    if (((m->ss.base + bp) & 0xfff) > 0xff0) break;
+    if (!(r = LookupAddress(m, m->ss.base + bp))) break;
+    sp = bp;
+    bp = ReadWordSafely(m->mode.omode, r + 0);
+    if (!(rp = ReadWordSafely(m->mode.omode, r + 8))) break;
+  }
+  END_NO_PAGE_FAULTS;
+  return n;
+}
+
+static u64 HashGuestStack(const i64 *pcs, int n) {
+  int i;
+  u64 h = n;
+  for (i = 0; i < n; ++i) {
+    h = (h ^ pcs[i]) * 0x9e3779b97f4a7c15;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+// called by a guest thread after its SIGPROF handler asked for a sample
+void SampleProfile(struct Machine *m) {
+  u64 h;
+  int i, n;
+  struct ProfileStack *ps;
+  i64 pcs[kProfileDepth];
+  _Static_assert(IS2POW(kProfileStacks), "");
+  n = UnwindGuestStack(m, pcs);
+  h = HashGuestStack(pcs, n);
+  LOCK(&g_profile.lock);
+  if (!g_profile.disabled && g_profile.stacks) {
+    ++g_profile.samples;
+    for (i = 0;; ++i) {
+      if (i == kProfileProbes) {
+        ++g_profile.dropped;
+        break;
+      }
+      ps = g_profile.stacks + ((h + i) & (kProfileStacks - 1));
+      if (!ps->count) {
+        ps->count = 1;
+        ps->depth = n;
+        memcpy(ps->pcs, pcs, n * sizeof(*pcs));
+        break;
+      }
+      if (ps->depth == n && !memcmp(ps->pcs, pcs, n * sizeof(*pcs))) {
+        ++ps->count;
+        break;
+      }
+    }
+  }
+  UNLOCK(&g_profile.lock);
+}
+
+static void AppendFrame(struct Buffer *b, struct System *s, i64 pc,
+                        bool iscaller) {
+#ifndef DISABLE_BACKTRACE
+  long sym;
+  // return addresses may point just past the end of their caller
+  if ((sym = DisFindSym(s->dis, pc - iscaller)) != -1) {
+    AppendStr(b, s->dis->syms.p[sym].name);
+    return;
+  }
+#endif
+  AppendFmt(b, "%#" PRIx64, pc);
+}
+
+static void WriteProfile(const char *p, size_t n) {
+  ssize_t rc;
+  while (n) {
+    if ((rc = write(g_profile.fd, p, n)) == -1) {
+      if (errno == EINTR) continue;
+      LOG_ONCE(LOGF("failed to write %s: %s", FLAG_profile,
+                    DescribeHostErrno(errno)));
+      return;
+    }
+    p += rc;
+    n -= rc;
+  }
+}
+
+// writes the stacks sampled while s was running, since it's being freed
+void FlushProfile(struct System *s) {
+  int i, j;
+  const char *prog;
+  struct Buffer b = {0};
+  struct ProfileStack *ps;
+#ifndef DISABLE_BACKTRACE
+  struct Dis dis = {true};
+#endif
+  if (!FLAG_profile) return;
+  LOCK(&g_profile.lock);
+  if (!g_profile.disabled && g_profile.samples) {
+#ifndef DISABLE_BACKTRACE
+    if (!s->dis) {
+      s->dis = &dis;
+      LoadDebugSymbols(s);
+    }
+#endif
+    if ((prog = s->elf.prog)) {
+      if (strrchr(prog, '/')) prog = strrchr(prog, '/') + 1;
+    } else {
+      prog = "blink";
+    }
+    for (i = 0; i < kProfileStacks; ++i) {
+      ps = g_profile.stacks + i;
+      if (!ps->count) continue;
+      AppendStr(&b, prog);
+      for (j = ps->depth; j--;) {
+        AppendChar(&b, ';');
+        AppendFrame(&b, s, ps->pcs[j], j > 0);
+      }
+      AppendFmt(&b, " %ld\n", ps->count);
+    }
+    WriteProfile(b.p, b.i);
+    if (g_profile.dropped) {
+      LOGF("%s: dropped %ld of %ld samples (increase kProfileStacks)",
+           FLAG_profile, g_profile.dropped, g_profile.samples);
+    }
+    memset(g_profile.stacks, 0, kProfileStacks * sizeof(*g_profile.stacks));
+    g_profile.samples = 0;
+    g_profile.dropped = 0;
+#ifndef DISABLE_BACKTRACE
+    if (s->dis == &dis) {
+      DisFree(&dis);
+      s->dis = 0;
+    }
+#endif
+  }
+  UNLOCK(&g_profile.lock);
+  free(b.p);
+}
+
+// starts sampling, which carries on across execve()
+// @assume other guest threads don't exist
+void StartProfile(void) {
+  int fd;
+  struct sigaction sa;
+  struct itimerval it;
+  if (g_profile.started || g_profile.disabled) return;
+  g_profile.started = true;
+  if ((fd = open(FLAG_profile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                 0644)) == -1) {
+    LOGF("failed to open %s: %s", FLAG_profile, DescribeHostErrno(errno));
+    return;
+  }
+  unassert((g_profile.fd = fcntl(fd, F_DUPFD_CLOEXEC, kMinBlinkFd)) != -1);
+  unassert(!close(fd));
+  if (!(g_profile.stacks = (struct ProfileStack *)calloc(
+            kProfileStacks, sizeof(*g_profile.stacks)))) {
+    LOGF("failed to allocate profile");
+    return;
+  }
+  sa.sa_flags = SA_RESTART;
+  sa.sa_handler = OnSigProf;
+  sigemptyset(&sa.sa_mask);
+  unassert(!sigaction(SIGPROF, &sa, 0));
+  it.it_interval.tv_sec = 0;
+  it.it_interval.tv_usec = 1000000 / kProfileHz;
+  it.it_value = it.it_interval;
+  unassert(!setitimer(ITIMER_PROF, &it, 0));
+}
+
+// locks the profiler before fork()
+void LockProfile(void) {
+  LOCK(&g_profile.lock);
+}
+
+// unlocks the profiler in the parent after fork()
+void UnlockProfile(void) {
+  UNLOCK(&g_profile.lock);
+}
+
+// resets the profiler in the child after fork()
+// itimers aren't inherited by fork() and children aren't profiled
+void ResetProfile(void) {
+  g_profile.disabled = true;
+  if (g_profile.fd != -1) {
+    unassert(!close(g_profile.fd));
+    g_profile.fd = -1;
+  }
+  unassert(!pthread_mutex_init(&g_profile.lock, 0));
+}
@@ -0,0 +1,12 @@
+#ifndef BLINK_PROFILE_H_
+#define BLINK_PROFILE_H_
+#include "blink/machine.h"
+
+void StartProfile(void);
+void SampleProfile(struct Machine *);
+void FlushProfile(struct System *);
+void LockProfile(void);
+void UnlockProfile(void);
+void ResetProfile(void);
+
+#endif /* BLINK_PROFILE_H_ */
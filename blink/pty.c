@@ -499,6 +499,35 @@ static void PtyWriteGlyph(struct Pty *pty, wint_t wc, int w) {
   }
 }
 
+// writes as many printable ascii characters as fit on the current line
+// in one go, since that's most of what programs print. returns number
+// of bytes consumed, which is zero if the first one needs slow path.
+static size_t PtyWriteAsciiRun(struct Pty *pty, const u8 *p, size_t n) {
+  wchar_t wc;
+  size_t i, k;
+  if (!n || !(0x20 <= p[0] && p[0] <= 0x7E) || pty->xlat[p[0]] < 0) return 0;
+  if ((pty->conf & kPtyRedzone) || pty->x + 1 > pty->xn) {
+    PtyAdvance(pty);
+  }
+  i = pty->y * pty->xn + pty->x;
+  n = MIN(n, pty->xn - pty->x);
+  for (k = 0; k < n; ++k) {
+    if (!(0x20 <= p[k] && p[k] <= 0x7E)) break;
+    if ((wc = pty->xlat[p[k]]) < 0) break;
+    pty->wcs[i + k] = wc;
+  }
+  u32set(pty->prs + i, pty->pr, k);
+  if (pty->pr & (kPtyFg | kPtyBg)) {
+    u32set(pty->fgs + i, pty->fg, k);
+    u32set(pty->bgs + i, pty->bg, k);
+  }
+  if ((pty->x += k) >= pty->xn) {
+    pty->x = pty->xn - 1;
+    pty->conf |= kPtyRedzone;
+  }
+  return k;
+}
+
 static void PtyWriteTab(struct Pty *pty) {
   unsigned x, x2;
   if (pty->conf & kPtyRedzone) {
@@ -1146,13 +1175,15 @@ static void PtyEscAppend(struct Pty *pty, char c) {
 }
 
 ssize_t PtyWrite(struct Pty *pty, const void *data, size_t n) {
-  int i;
+  size_t i, k;
   wchar_t wc;
   const u8 *p;
   for (p = (const u8 *)data, i = 0; i < n; ++i) {
     switch (pty->state) {
       case kPtyAscii:
-        if (0x00 <= p[i] && p[i] <= 0x7F) {
+        if ((k = PtyWriteAsciiRun(pty, p + i, n - i))) {
+          i += k - 1;
+        } else if (0x00 <= p[i] && p[i] <= 0x7F) {
           if (0x20 <= p[i] && p[i] <= 0x7E) {
             if ((wc = pty->xlat[p[i]]) >= 0) {
               PtyWriteGlyph(pty, wc, 1);
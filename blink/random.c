@@ -21,6 +21,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <string.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
@@ -30,6 +31,7 @@
 #include "blink/linux.h"
 #include "blink/log.h"
 #include "blink/macros.h"
+#include "blink/tunables.h"
 #include "blink/types.h"
 #include "blink/util.h"
 
@@ -132,3 +134,98 @@ ssize_t GetRandom(void *p, size_t n, int flags) {
   return GetWeakRandom((char *)p, n);
 #endif
 }
+
+/*
+ * Random numbers are wanted far more often by guests than the host is
+ * able to produce them cheaply, e.g. rdrand seeding every hash table
+ * or getrandom() for each uuid. So each thread gets a ChaCha20 stream
+ * keyed by the host, which it serves small requests from, like Linux's
+ * vDSO getrandom() does. Whenever the buffer is refilled, the key gets
+ * replaced by the first bytes of the new keystream, and bytes are wiped
+ * as they're handed out, so nothing already served can be recovered.
+ */
+
+#define CHACHA_QR(a, b, c, d) \
+  a += b, d = ROL32(d ^ a, 16), c += d, b = ROL32(b ^ c, 12), \
+  a += b, d = ROL32(d ^ a, 8), c += d, b = ROL32(b ^ c, 7)
+#define ROL32(x, k) ((x) << (k) | (x) >> (32 - (k)))
+
+struct RandomPool {
+  bool seeded;            // key came from the host
+  u32 left;               // unread bytes at the end of buf
+  u32 made;               // bytes made since the host keyed us
+  u32 key[8];             // replaced each refill for forward secrecy
+  u8 buf[64 * 8 - 32];  // eight chacha20 blocks, minus the next key
+};
+
+static _Thread_local struct RandomPool g_randompool;
+
+static void ChaCha20(u32 out[16], const u32 key[8], u32 counter) {
+  int i;
+  u32 x[16], s[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+                      key[0],     key[1],     key[2],     key[3],
+                      key[4],     key[5],     key[6],     key[7],
+                      counter,    0,          0,          0};
+  memcpy(x, s, sizeof(x));
+  for (i = 0; i < 10; ++i) {
+    CHACHA_QR(x[0], x[4], x[8], x[12]);
+    CHACHA_QR(x[1], x[5], x[9], x[13]);
+    CHACHA_QR(x[2], x[6], x[10], x[14]);
+    CHACHA_QR(x[3], x[7], x[11], x[15]);
+    CHACHA_QR(x[0], x[5], x[10], x[15]);
+    CHACHA_QR(x[1], x[6], x[11], x[12]);
+    CHACHA_QR(x[2], x[7], x[8], x[13]);
+    CHACHA_QR(x[3], x[4], x[9], x[14]);
+  }
+  for (i = 0; i < 16; ++i) {
+    out[i] = x[i] + s[i];
+  }
+}
+
+static void RefillRandom(struct RandomPool *r) {
+  u32 i, ks[16 * 8];
+  if (!r->seeded || r->made >= kRandomReseed) {
+    unassert(GetRandom(r->key, sizeof(r->key), 0) == sizeof(r->key));
+    r->seeded = true;
+    r->made = 0;
+  }
+  for (i = 0; i < 8; ++i) {
+    ChaCha20(ks + i * 16, r->key, i);
+  }
+  memcpy(r->key, ks, sizeof(r->key));
+  memcpy(r->buf, (u8 *)ks + sizeof(r->key), sizeof(r->buf));
+  r->left = sizeof(r->buf);
+  r->made += sizeof(r->buf);
+}
+
+/**
+ * Generates random bytes without calling the host most of the time.
+ *
+ * This is intended for rdrand and getrandom() calls that are small and
+ * don't ask for GRND_RANDOM. Each thread rekeys from the host once it's
+ * generated kRandomReseed bytes.
+ */
+void FillRandom(void *p, size_t n) {
+  u8 *b;
+  size_t k;
+  u8 *q = (u8 *)p;
+  struct RandomPool *r = &g_randompool;
+  while (n) {
+    if (!r->left) RefillRandom(r);
+    k = MIN(n, r->left);
+    b = r->buf + sizeof(r->buf) - r->left;
+    memcpy(q, b, k);
+    memset(b, 0, k);
+    r->left -= k;
+    q += k;
+    n -= k;
+  }
+}
+
+/**
+ * Forgets state of random pool, which fork() children must call, since
+ * otherwise they'd produce the same numbers as their parent.
+ */
+void ReseedRandom(void) {
+  memset(&g_randompool, 0, sizeof(g_randompool));
+}
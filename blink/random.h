@@ -3,5 +3,7 @@
 #include <sys/types.h>
 
 ssize_t GetRandom(void *, size_t, int);
+void FillRandom(void *, size_t);
+void ReseedRandom(void);
 
 #endif /* BLINK_RANDOM_H_ */
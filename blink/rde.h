@@ -41,6 +41,7 @@
 #define Mopcode(x)  ((x & 00000077760000000000000) >> 050)
 #define Rep(x)      ((x & 00000300000000000000000) >> 063)
 #define WordLog2(x) ((x & 00030000000000000000000) >> 071)
+#define Vex(x)      ((x & 00040000000000000000000) >> 073)
 #define Vreg(x)     ((x & 01700000000000000000000) >> 074)
 
 #define Bite(x)     (~ModrmSrm(x) & 1)
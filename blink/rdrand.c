@@ -26,28 +26,15 @@
 #include "blink/thread.h"
 #include "blink/util.h"
 
-#define RESEED_INTERVAL 16
-
-static struct Rdrand {
-  pthread_mutex_t_ lock;
-  u64 state;
-  unsigned count;
-} g_rdrand = {
-    .lock = PTHREAD_MUTEX_INITIALIZER_,
-};
-
 static void OpRand(P, u64 x) {
   WriteRegister(rde, RegRexbRm(m, rde), x);
   m->flags = SetFlag(m->flags, FLAGS_CF, true);
 }
 
 void OpRdrand(P) {
-  LOCK(&g_rdrand.lock);
-  if (!(g_rdrand.count++ % RESEED_INTERVAL)) {
-    unassert(GetRandom(&g_rdrand.state, 8, 0) == 8);
-  }
-  OpRand(A, Vigna(&g_rdrand.state));
-  UNLOCK(&g_rdrand.lock);
+  u64 x;
+  FillRandom(&x, 8);
+  OpRand(A, x);
 }
 
 void OpRdseed(P) {
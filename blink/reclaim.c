@@ -0,0 +1,423 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/reclaim.h"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/bus.h"
+#include "blink/dll.h"
+#include "blink/endian.h"
+#include "blink/flag.h"
+#include "blink/log.h"
+#include "blink/stats.h"
+#include "blink/thread.h"
+#include "blink/timespec.h"
+#include "blink/tunables.h"
+#include "blink/util.h"
+
+/**
+ * @fileoverview Compression of idle guest memory.
+ *
+ * When BLINK_RECLAIM is set to a number of seconds, a host thread wakes
+ * up that often and compresses the anonymous pages the guest hasn't
+ * touched since the last time it looked. Their page table entries are
+ * turned back into reservations, whose PAGE_TA bits remember where the
+ * compressed copy is kept, so the next access faults the page back in
+ * the same way the first access to memory mmap() reserved does. Pages
+ * that turn out to be all zeroes are dropped without keeping anything.
+ *
+ * Walking the page table sets an accessed bit, which scans clear, and
+ * since every thread's tlb is flushed once a scan is done, a page that
+ * is still being used gets walked to again before the next scan looks.
+ * No thread may hold a pointer to a page while it's being compressed,
+ * so guest threads are parked during a scan, the same way libblink's
+ * embedders pause them. A thread blocked in a system call is left be,
+ * since system calls lock the pages they touch, and locked pages, or
+ * pages that got walked to during the scan, are skipped. This is only
+ * possible with -m, since linear memory is mapped by the host itself.
+ *
+ * Pages are compressed a 64-bit word at a time, with a variation of
+ * the WKdm algorithm, which suits the pointers and small integers of
+ * program heaps better than byte oriented compressors, and is quick
+ * enough for a page to be restored on the fault path. A word is either
+ * zero, the same as a recently seen word, the same as one except for
+ * its low 16 bits, or a miss. Recent words are kept in a direct mapped
+ * dictionary indexed by a hash of the upper 48 bits. The output is:
+ *
+ *     u16 hits;          // words that matched a dictionary entry
+ *     u16 partials;      // words that only matched the upper bits
+ *     u8 tags[128];      // 2-bit kind of each of the 512 words
+ *     u8 indexes[];      // 4-bit dictionary index of each hit
+ *     u16 lows[];        // low 16 bits of each partial match
+ *     u64 misses[];      // words that weren't in the dictionary
+ */
+
+#define kZipWords 512
+
+enum { kZipZero, kZipHit, kZipPartial, kZipMiss };
+
+static struct Reclaim {
+  bool started;            // worker thread has been created
+  struct System *system;   // program whose memory is being reclaimed
+  pthread_mutex_t_ lock;   // held by the worker while it's scanning
+  pthread_mutex_t_ pool;   // guards the compressed pages below
+  long zips_i;             // slots that have been handed out
+  long zips_n;             // slots that have been allocated
+  long zips_free;          // first free slot plus one, or zero
+  u8 **zips;               // compressed pages, or free slot links
+} g_reclaim = {
+    .lock = PTHREAD_MUTEX_INITIALIZER_,
+    .pool = PTHREAD_MUTEX_INITIALIZER_,
+};
+
+static unsigned HashZipWord(u64 w) {
+  return ((w >> 16) * 0x9e3779b97f4a7c15) >> 60;
+}
+
+// compresses page into buf, returning its size, or zero if the page is
+// all zeroes, or a size greater than kReclaimZipMax if it didn't fit
+static size_t PackPage(u8 buf[kReclaimZipMax], const u8 *page) {
+  size_t n;
+  u64 w, dict[16];
+  unsigned i, h, tag, hits, partials, misses;
+  u8 tags[kZipWords / 4], indexes[kZipWords / 2];
+  u8 lows[kZipWords * 2], words[kReclaimZipMax];
+  memset(dict, 0, sizeof(dict));
+  memset(tags, 0, sizeof(tags));
+  memset(indexes, 0, sizeof(indexes));
+  hits = partials = misses = 0;
+  for (n = 4 + sizeof(tags), i = 0; i < kZipWords; ++i) {
+    if (!(w = Read64(page + i * 8))) continue;
+    h = HashZipWord(w);
+    if (dict[h] == w) {
+      tag = kZipHit;
+      n += !(hits & 1);
+    } else if ((dict[h] ^ w) < 0x10000) {
+      tag = kZipPartial;
+      n += 2 + !(hits & 1);
+      Write16(lows + partials++ * 2, w);
+      dict[h] = w;
+    } else {
+      tag = kZipMiss;
+      n += 8;
+      if (n > kReclaimZipMax) return n;
+      Write64(words + misses++ * 8, w);
+      dict[h] = w;
+    }
+    if (tag != kZipMiss) {
+      indexes[hits / 2] |= h << (hits & 1) * 4;
+      ++hits;
+    }
+    tags[i / 4] |= tag << (i & 3) * 2;
+  }
+  if (!hits && !misses) return 0;
+  if (n > kReclaimZipMax) return n;
+  Write16(buf, hits);
+  Write16(buf + 2, partials);
+  memcpy(buf + 4, tags, sizeof(tags));
+  buf += 4 + sizeof(tags);
+  memcpy(buf, indexes, (hits + 1) / 2);
+  buf += (hits + 1) / 2;
+  memcpy(buf, lows, partials * 2);
+  buf += partials * 2;
+  memcpy(buf, words, misses * 8);
+  return n;
+}
+
+static void UnpackPage(u8 *page, const u8 *buf) {
+  u64 w, dict[16];
+  unsigned i, h, k, hits, partials;
+  const u8 *tags, *indexes, *lows, *words;
+  memset(dict, 0, sizeof(dict));
+  hits = Read16(buf);
+  partials = Read16(buf + 2);
+  tags = buf + 4;
+  indexes = tags + kZipWords / 4;
+  lows = indexes + (hits + 1) / 2;
+  words = lows + partials * 2;
+  for (k = i = 0; i < kZipWords; ++i) {
+    switch ((tags[i / 4] >> (i & 3) * 2) & 3) {
+      case kZipZero:
+        w = 0;
+        break;
+      case kZipHit:
+        h = (indexes[k / 2] >> (k & 1) * 4) & 15;
+        ++k;
+        w = dict[h];
+        break;
+      case kZipPartial:
+        h = (indexes[k / 2] >> (k & 1) * 4) & 15;
+        ++k;
+        w = (dict[h] & ~(u64)0xffff) | Read16(lows);
+        lows += 2;
+        dict[h] = w;
+        break;
+      default:
+        w = Read64(words);
+        words += 8;
+        dict[HashZipWord(w)] = w;
+        break;
+    }
+    Write64(page + i * 8, w);
+  }
+}
+
+// @assume g_reclaim.pool
+static void ReleaseZipSlot(long i) {
+  free(g_reclaim.zips[i]);
+  g_reclaim.zips[i] = (u8 *)(uintptr_t)(g_reclaim.zips_free << 1 | 1);
+  g_reclaim.zips_free = i + 1;
+}
+
+// compresses page, returning the bits that should replace PAGE_TA and
+// PAGE_HOST in its entry, which are zero if nothing needs to be kept,
+// or -1 if the page should stay resident since it doesn't compress
+u64 ZipPage(const u8 *page) {
+  u8 *p, **p2;
+  size_t n;
+  long i, n2;
+  u8 buf[kReclaimZipMax];
+  if (!(n = PackPage(buf, page))) {
+    STATISTIC(++pages_reclaimed_zero);
+    return 0;
+  }
+  if (n > kReclaimZipMax) return -1;
+  if (!(p = (u8 *)malloc(n))) return -1;
+  memcpy(p, buf, n);
+  LOCK(&g_reclaim.pool);
+  if ((i = g_reclaim.zips_free)) {
+    g_reclaim.zips_free = (uintptr_t)g_reclaim.zips[--i] >> 1;
+  } else {
+    if (g_reclaim.zips_i == g_reclaim.zips_n) {
+      n2 = g_reclaim.zips_n + 64;
+      n2 += n2 >> 1;
+      if (!(p2 = (u8 **)realloc(g_reclaim.zips, n2 * sizeof(*p2)))) {
+        UNLOCK(&g_reclaim.pool);
+        free(p);
+        return -1;
+      }
+      g_reclaim.zips = p2;
+      g_reclaim.zips_n = n2;
+    }
+    i = g_reclaim.zips_i++;
+  }
+  g_reclaim.zips[i] = p;
+  UNLOCK(&g_reclaim.pool);
+  return (u64)i << 12 | PAGE_ZIP;
+}
+
+// restores the compressed page of entry into the page x points to and
+// puts x in its place, unless the entry changed in the meantime, e.g.
+// due to munmap() or mprotect(), in which case the page may be dirty
+bool UnzipPage(u8 *pslot, u64 entry, u64 x) {
+  long i;
+  bool ok = false;
+  unassert(entry & PAGE_ZIP);
+  i = (entry & PAGE_TA) >> 12;
+  LOCK(&g_reclaim.pool);
+  if (LoadPte(pslot) == entry) {
+    UnpackPage((u8 *)(uintptr_t)(x & PAGE_TA), g_reclaim.zips[i]);
+    if ((ok = CasPte(pslot, entry, x))) {
+      ReleaseZipSlot(i);
+      STATISTIC(++pages_unzipped);
+    }
+  }
+  UNLOCK(&g_reclaim.pool);
+  return ok;
+}
+
+// frees the compressed page of an entry that was just removed
+void FreeZip(u64 entry) {
+  unassert(entry & PAGE_ZIP);
+  LOCK(&g_reclaim.pool);
+  ReleaseZipSlot((entry & PAGE_TA) >> 12);
+  UNLOCK(&g_reclaim.pool);
+}
+
+#ifdef HAVE_THREADS
+
+// asks the guest threads to park, the way libblink pauses a guest, and
+// returns false if something else has already paused the system
+static bool PauseSystem(struct System *s) {
+  struct Dll *e;
+  bool ok = false;
+  LOCK(&s->machines_lock);
+  if (!atomic_load_explicit(&s->paused, memory_order_relaxed)) {
+    atomic_store_explicit(&s->paused, true, memory_order_seq_cst);
+    for (e = dll_first(s->machines); e; e = dll_next(s->machines, e)) {
+      atomic_store_explicit(&MACHINE_CONTAINER(e)->attention, true,
+                            memory_order_seq_cst);
+    }
+    ok = true;
+  }
+  UNLOCK(&s->machines_lock);
+  return ok;
+}
+
+static void ResumeSystem(struct System *s) {
+  LOCK(&s->machines_lock);
+  atomic_store_explicit(&s->paused, false, memory_order_release);
+  unassert(!pthread_cond_broadcast(&s->paused_cond));
+  UNLOCK(&s->machines_lock);
+}
+
+// checks that no guest thread is able to use a page without locking it
+// first. a thread in a system call needn't park, since it locks pages,
+// and once the system call returns, it'll see attention and then park
+static bool AreMachinesParked(struct System *s) {
+  bool ok = true;
+  struct Dll *e;
+  struct Machine *m;
+  LOCK(&s->machines_lock);
+  for (e = dll_first(s->machines); e; e = dll_next(s->machines, e)) {
+    m = MACHINE_CONTAINER(e);
+    if (!m->parked &&
+        !atomic_load_explicit(&m->insyscall, memory_order_seq_cst)) {
+      ok = false;
+      break;
+    }
+  }
+  UNLOCK(&s->machines_lock);
+  return ok;
+}
+
+// @assume g_reclaim.lock
+static void ReclaimSystem(struct System *s) {
+  long n;
+  struct timespec deadline;
+  if (!PauseSystem(s)) return;
+  // translations cached before this point could be to a page that the
+  // scan is going to compress, so they must be walked to again. mmap()
+  // is only waited on for so long, because a thread that's parked in a
+  // signal handler could be holding a lock that munmap() waits on
+  InvalidateSystem(s, true, false);
+  deadline = AddTime(GetTime(), FromMilliseconds(kReclaimWaitMs));
+  for (;;) {
+    if (AreMachinesParked(s) && !pthread_mutex_trylock(&s->mmap_lock)) {
+      n = CompressColdPages(s);
+      UNLOCK(&s->mmap_lock);
+      // have pages that get used before the next scan walked to again
+      InvalidateSystem(s, true, false);
+      MEM_LOGF("reclaimed %ld pages", n);
+      STATISTIC(++reclaim_scans);
+      break;
+    }
+    if (CompareTime(GetTime(), deadline) >= 0) {
+      STATISTIC(++reclaim_scans_skipped);
+      break;
+    }
+    SleepTime(FromMilliseconds(1));
+  }
+  ResumeSystem(s);
+  FlushPageCache();
+  FlushStats();
+}
+
+static void *ReclaimWorker(void *arg) {
+  for (;;) {
+    SleepTime(FromSeconds(FLAG_reclaim));
+    LOCK(&g_reclaim.lock);
+    if (g_reclaim.system) {
+      ReclaimSystem(g_reclaim.system);
+    }
+    UNLOCK(&g_reclaim.lock);
+  }
+  return 0;
+}
+
+// @assume g_reclaim.lock
+static void SpawnReclaimWorker(void) {
+  int err;
+  pthread_t th;
+  sigset_t ss, oldss;
+  sigfillset(&ss);
+  unassert(!pthread_sigmask(SIG_SETMASK, &ss, &oldss));
+  err = pthread_create(&th, 0, ReclaimWorker, 0);
+  unassert(!pthread_sigmask(SIG_SETMASK, &oldss, 0));
+  if (err) {
+    LOGF("failed to create reclaim worker: %s", DescribeHostErrno(err));
+    return;
+  }
+  unassert(!pthread_detach(th));
+  g_reclaim.started = true;
+}
+
+#endif /* HAVE_THREADS */
+
+// starts reclaiming memory of s, instead of any program before it
+void StartReclaim(struct System *s) {
+#ifdef HAVE_THREADS
+  LOCK(&g_reclaim.lock);
+  g_reclaim.system = s;
+  if (!g_reclaim.started) {
+    SpawnReclaimWorker();
+  }
+  UNLOCK(&g_reclaim.lock);
+#else
+  LOG_ONCE(LOGF("BLINK_RECLAIM requires a build with threads"));
+#endif
+}
+
+// stops reclaiming memory of s, which is about to be freed
+void ForgetReclaim(struct System *s) {
+  if (!FLAG_reclaim) return;
+  LOCK(&g_reclaim.lock);
+  if (g_reclaim.system == s) {
+    g_reclaim.system = 0;
+  }
+  UNLOCK(&g_reclaim.lock);
+}
+
+// locks the reclaimer before fork(), so a scan isn't underway
+void LockReclaim(void) {
+  LOCK(&g_reclaim.lock);
+}
+
+// unlocks the reclaimer in the parent after fork()
+void UnlockReclaim(void) {
+  UNLOCK(&g_reclaim.lock);
+}
+
+// locks the compressed pages before fork(), which must happen after
+// mmap_lock is held, since munmap() frees them while it's holding it
+void LockReclaimPool(void) {
+  LOCK(&g_reclaim.pool);
+}
+
+// unlocks the compressed pages in the parent after fork()
+void UnlockReclaimPool(void) {
+  UNLOCK(&g_reclaim.pool);
+}
+
+// resets the reclaimer in the child after fork()
+// the worker doesn't survive fork(), so the child gets one of its own
+void ResetReclaim(void) {
+#ifdef HAVE_THREADS
+  unassert(!pthread_mutex_init(&g_reclaim.lock, 0));
+  unassert(!pthread_mutex_init(&g_reclaim.pool, 0));
+  g_reclaim.started = false;
+  if (g_reclaim.system) {
+    SpawnReclaimWorker();
+  }
+#endif
+}
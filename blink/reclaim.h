@@ -0,0 +1,17 @@
+#ifndef BLINK_RECLAIM_H_
+#define BLINK_RECLAIM_H_
+#include "blink/machine.h"
+#include "blink/types.h"
+
+void StartReclaim(struct System *);
+void ForgetReclaim(struct System *);
+void LockReclaim(void);
+void UnlockReclaim(void);
+void LockReclaimPool(void);
+void UnlockReclaimPool(void);
+void ResetReclaim(void);
+u64 ZipPage(const u8 *);
+bool UnzipPage(u8 *, u64, u64);
+void FreeZip(u64);
+
+#endif /* BLINK_RECLAIM_H_ */
@@ -19,6 +19,7 @@
 #include <math.h>
 #include <string.h>
 
+#include "blink/avx.h"
 #include "blink/flags.h"
 #include "blink/machine.h"
 #include "blink/stats.h"
@@ -78,6 +79,8 @@ static void ResetSse(struct Machine *m) {
   //         0b00000000000000000001111110000000
   m->mxcsr = 0x1f80;
   memset(m->xmm, 0, sizeof(m->xmm));
+  memset(m->ymmh, 0, sizeof(m->ymmh));
+  m->xcr0 = kXcr0Supported;  // what linux enables
 }
 
 void ResetCpu(struct Machine *m) {
@@ -93,6 +96,8 @@ void ResetCpu(struct Machine *m) {
   m->flags = SetFlag(m->flags, FLAGS_IOPL, 3);
   memset(m->beg, 0, sizeof(m->beg));
   memset(m->bofram, 0, sizeof(m->bofram));
+  memset(&m->shadow, 0, sizeof(m->shadow));
+  memset(m->btc, 0, sizeof(m->btc));
   memset(&m->freelist, 0, sizeof(m->freelist));
   ResetSse(m);
   ResetFpu(m);
@@ -101,13 +106,17 @@ void ResetCpu(struct Machine *m) {
 void ResetTlb(struct Machine *m) {
   STATISTIC(++tlb_resets);
   memset(m->tlb, 0, sizeof(m->tlb));
+  memset(&m->pde, 0, sizeof(m->pde));
   m->opcache->codevirt = 0;
   m->opcache->codehost = 0;
 }
 
 void ResetInstructionCache(struct Machine *m) {
+  int i;
   STATISTIC(++icache_resets);
+  memset(m->opcache->icachepc, 0, sizeof(m->opcache->icachepc));
   memset(m->opcache->icache, 0, sizeof(m->opcache->icache));
+  for (i = 0; i < kBlockSets; ++i) m->opcache->blocks[i].pc = 0;
   m->opcache->codevirt = 0;
   m->opcache->codehost = 0;
 }
@@ -0,0 +1,258 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <string.h>
+
+#include "blink/endian.h"
+#include "blink/intrin.h"
+#include "blink/machine.h"
+#include "blink/modrm.h"
+#include "blink/rde.h"
+#include "blink/types.h"
+
+/**
+ * @fileoverview SHA-NI instructions.
+ *
+ * These are run with the host's own sha instructions on x86-64 hosts
+ * which have them, and otherwise computed in C. Guest hash functions
+ * that find sha in cpuid do four sha1 rounds or two sha256 rounds per
+ * instruction, which is far less work for the interpreter than their
+ * scalar fallbacks. Lanes are numbered from the least significant
+ * dword of the xmm register, so w[3] is bits 127:96.
+ */
+
+#define Rol32(x, k) ((u32)(x) << (k) | (u32)(x) >> (32 - (k)))
+#define Ror32(x, k) ((u32)(x) >> (k) | (u32)(x) << (32 - (k)))
+
+static void LoadLanes(u32 w[4], const u8 *p) {
+  int i;
+  for (i = 0; i < 4; ++i) {
+    w[i] = Read32(p + i * 4);
+  }
+}
+
+static void StoreLanes(u8 *p, const u32 w[4]) {
+  int i;
+  for (i = 0; i < 4; ++i) {
+    Write32(p + i * 4, w[i]);
+  }
+}
+
+static void Sha1Rnds4(u32 x[4], const u32 y[4], int imm) {
+  int i;
+  u32 a, b, c, d, e, f, t, k, w[4];
+  static const u32 kK[4] = {0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6};
+  a = x[3], b = x[2], c = x[1], d = x[0], e = 0;
+  w[0] = y[3], w[1] = y[2], w[2] = y[1], w[3] = y[0];
+  k = kK[imm & 3];
+  for (i = 0; i < 4; ++i) {
+    switch (imm & 3) {
+      case 0:
+        f = (b & c) ^ (~b & d);
+        break;
+      case 2:
+        f = (b & c) ^ (b & d) ^ (c & d);
+        break;
+      default:
+        f = b ^ c ^ d;
+        break;
+    }
+    t = f + Rol32(a, 5) + w[i] + e + k;
+    e = d, d = c, c = Rol32(b, 30), b = a, a = t;
+  }
+  x[3] = a, x[2] = b, x[1] = c, x[0] = d;
+}
+
+static void Sha1Nexte(u32 x[4], const u32 y[4]) {
+  x[3] = y[3] + Rol32(x[3], 30);
+  x[2] = y[2], x[1] = y[1], x[0] = y[0];
+}
+
+static void Sha1Msg1(u32 x[4], const u32 y[4]) {
+  x[3] ^= x[1];
+  x[2] ^= x[0];
+  x[1] ^= y[3];
+  x[0] ^= y[2];
+}
+
+static void Sha1Msg2(u32 x[4], const u32 y[4]) {
+  x[3] = Rol32(x[3] ^ y[2], 1);
+  x[2] = Rol32(x[2] ^ y[1], 1);
+  x[1] = Rol32(x[1] ^ y[0], 1);
+  x[0] = Rol32(x[0] ^ x[3], 1);
+}
+
+static void Sha256Rnds2(u32 x[4], const u32 y[4], const u32 wk[2]) {
+  int i;
+  u32 a, b, c, d, e, f, g, h, t;
+  a = y[3], b = y[2], c = x[3], d = x[2];
+  e = y[1], f = y[0], g = x[1], h = x[0];
+  for (i = 0; i < 2; ++i) {
+    t = ((e & f) ^ (~e & g)) + (Ror32(e, 6) ^ Ror32(e, 11) ^ Ror32(e, 25)) +
+        wk[i] + h;
+    h = g, g = f, f = e, e = t + d;
+    t += ((a & b) ^ (a & c) ^ (b & c)) +
+         (Ror32(a, 2) ^ Ror32(a, 13) ^ Ror32(a, 22));
+    d = c, c = b, b = a, a = t;
+  }
+  x[3] = a, x[2] = b, x[1] = e, x[0] = f;
+}
+
+static u32 Sigma0(u32 w) {
+  return Ror32(w, 7) ^ Ror32(w, 18) ^ w >> 3;
+}
+
+static u32 Sigma1(u32 w) {
+  return Ror32(w, 17) ^ Ror32(w, 19) ^ w >> 10;
+}
+
+static void Sha256Msg1(u32 x[4], const u32 y[4]) {
+  x[0] += Sigma0(x[1]);
+  x[1] += Sigma0(x[2]);
+  x[2] += Sigma0(x[3]);
+  x[3] += Sigma0(y[0]);
+}
+
+static void Sha256Msg2(u32 x[4], const u32 y[4]) {
+  x[0] += Sigma1(y[2]);
+  x[1] += Sigma1(y[3]);
+  x[2] += Sigma1(x[0]);
+  x[3] += Sigma1(x[1]);
+}
+
+#if X86_INTRINSICS
+static bool HasHostSha(void) {
+  u32 ax, bx, cx, dx;
+  static int res;  // 1 = no, 2 = yes
+  if (!res) {
+    asm("cpuid" : "=a"(ax), "=b"(bx), "=c"(cx), "=d"(dx) : "0"(0), "2"(0));
+    if (ax >= 7) {
+      asm("cpuid" : "=a"(ax), "=b"(bx), "=c"(cx), "=d"(dx) : "0"(7), "2"(0));
+      res = (bx & 1 << 29) ? 2 : 1;
+    } else {
+      res = 1;
+    }
+  }
+  return res == 2;
+}
+
+static bool ShaHost(int op, u8 x[16], const u8 y[16], const u8 z[16]) {
+  char_xmmu_t a, b, c;
+  if (!HasHostSha()) return false;
+  memcpy(&a, x, 16);
+  memcpy(&b, y, 16);
+  switch (op) {
+    case 0x000:
+      asm("sha1rnds4\t$0,%1,%0" : "+x"(a) : "x"(b));
+      break;
+    case 0x001:
+      asm("sha1rnds4\t$1,%1,%0" : "+x"(a) : "x"(b));
+      break;
+    case 0x002:
+      asm("sha1rnds4\t$2,%1,%0" : "+x"(a) : "x"(b));
+      break;
+    case 0x003:
+      asm("sha1rnds4\t$3,%1,%0" : "+x"(a) : "x"(b));
+      break;
+    case 0xC8:
+      asm("sha1nexte\t%1,%0" : "+x"(a) : "x"(b));
+      break;
+    case 0xC9:
+      asm("sha1msg1\t%1,%0" : "+x"(a) : "x"(b));
+      break;
+    case 0xCA:
+      asm("sha1msg2\t%1,%0" : "+x"(a) : "x"(b));
+      break;
+    case 0xCB:
+      memcpy(&c, z, 16);
+      asm("sha256rnds2\t%2,%1,%0" : "+x"(a) : "x"(b), "Yz"(c));
+      break;
+    case 0xCC:
+      asm("sha256msg1\t%1,%0" : "+x"(a) : "x"(b));
+      break;
+    case 0xCD:
+      asm("sha256msg2\t%1,%0" : "+x"(a) : "x"(b));
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  memcpy(x, &a, 16);
+  return true;
+}
+#else
+static bool ShaHost(int op, u8 x[16], const u8 y[16], const u8 z[16]) {
+  return false;
+}
+#endif
+
+// runs sha instruction, where op is the 0f38 opcode, or the sha1rnds4
+// immediate in the low two bits, so one switch covers both tables
+static void OpSha(P, int op) {
+  u8 x[16], y[16];
+  u32 a[4], b[4], wk[2];
+  if (Osz(rde) || Rep(rde)) {
+    OpUdImpl(m);
+    return;
+  }
+  memcpy(x, XmmRexrReg(m, rde), 16);
+  memcpy(y, GetModrmRegisterXmmPointerRead16(A), 16);
+  if (!ShaHost(op, x, y, m->xmm[0])) {
+    LoadLanes(a, x);
+    LoadLanes(b, y);
+    switch (op) {
+      case 0x000:
+      case 0x001:
+      case 0x002:
+      case 0x003:
+        Sha1Rnds4(a, b, op);
+        break;
+      case 0xC8:
+        Sha1Nexte(a, b);
+        break;
+      case 0xC9:
+        Sha1Msg1(a, b);
+        break;
+      case 0xCA:
+        Sha1Msg2(a, b);
+        break;
+      case 0xCB:
+        wk[0] = Read32(m->xmm[0] + 0);
+        wk[1] = Read32(m->xmm[0] + 4);
+        Sha256Rnds2(a, b, wk);
+        break;
+      case 0xCC:
+        Sha256Msg1(a, b);
+        break;
+      case 0xCD:
+        Sha256Msg2(a, b);
+        break;
+      default:
+        __builtin_unreachable();
+    }
+    StoreLanes(x, a);
+  }
+  memcpy(XmmRexrReg(m, rde), x, 16);
+}
+
+void OpSha38(P) {
+  OpSha(A, Opcode(rde));
+}
+
+void OpSha1rnds4(P) {
+  OpSha(A, uimm0 & 3);
+}
@@ -26,11 +26,15 @@
 #include "blink/assert.h"
 #include "blink/atomic.h"
 #include "blink/bitscan.h"
+#include "blink/bus.h"
 #include "blink/endian.h"
 #include "blink/ldbl.h"
 #include "blink/linux.h"
 #include "blink/log.h"
 #include "blink/macros.h"
+#include "blink/metrics.h"
+#include "blink/profile.h"
+#include "blink/stats.h"
 #include "blink/syscall.h"
 #include "blink/thread.h"
 #include "blink/util.h"
@@ -41,6 +45,7 @@ struct SignalFrame {
   struct siginfo_linux si;
   struct ucontext_linux uc;
   struct fpstate_linux fp;
+  u8 ymmh[16][16];
 };
 
 bool IsSignalIgnoredByDefault(int sig) {
@@ -64,6 +69,8 @@ bool IsSignalSerious(int sig) {
 void DeliverSignal(struct Machine *m, int sig, int code) {
   u64 sp;
   struct SignalFrame sf;
+  // signals raised partway through an op, e.g. by faults, can't keep
+  // the path, since the op's code was only partially generated
   if (IsMakingPath(g_machine)) AbandonPath(g_machine);
   memset(&sf, 0, sizeof(sf));
   // capture the current state of the machine
@@ -117,6 +124,7 @@ void DeliverSignal(struct Machine *m, int sig, int code) {
   }
 #endif
   memcpy(sf.fp.xmm, m->xmm, sizeof(sf.fp.xmm));
+  memcpy(sf.ymmh, m->ymmh, sizeof(sf.ymmh));
   // set the thread signal mask to the one specified by the signal
   // handler. by default, the signal being delivered will be added
   // within the mask unless the guest program specifies SA_NODEFER
@@ -214,6 +222,7 @@ void SigRestore(struct Machine *m) {
   }
 #endif
   memcpy(m->xmm, sf.fp.xmm, sizeof(sf.fp.xmm));
+  memcpy(m->ymmh, sf.ymmh, sizeof(sf.ymmh));
   m->restored = true;
   atomic_store_explicit(&m->attention, true, memory_order_release);
 }
@@ -268,6 +277,9 @@ void EnqueueSignal(struct Machine *m, int sig) {
     m->signals |= 1ul << (sig - 1);
     if ((m->signals & ~m->sigmask)) {
       atomic_store_explicit(&m->attention, true, memory_order_release);
+      InterruptFutex(atomic_load_explicit(&m->futex, memory_order_seq_cst));
+    } else {
+      NotifySignalFds(m->system, sig);
     }
   }
 }
@@ -282,10 +294,30 @@ void CheckForSignals(struct Machine *m) {
     m->selfmodifying = false;
 #endif
   } else if (m->signals & ~m->sigmask) {
+#ifdef HAVE_JIT
+    // we're between instructions, so rather than letting the signal
+    // throw away the path being generated, stage what we have so far
+    // and have it exit to the interpreter where the handler is called
+    if (IsMakingPath(m)) {
+      STATISTIC(++path_signaled);
+      CompletePath(DISPATCH_NOTHING);
+    }
+#endif
     if ((sig = ConsumeSignal(m, 0, 0))) {
       TerminateSignal(m, sig, 0);
     }
+  } else if (atomic_exchange_explicit(&m->profile, false,
+                                      memory_order_acq_rel)) {
+    SampleProfile(m);
+  } else if (atomic_exchange_explicit(&m->publish, false,
+                                      memory_order_acq_rel)) {
+    PublishMetrics(m);
   } else {
-    atomic_store_explicit(&m->attention, false, memory_order_relaxed);
+    atomic_store_explicit(&m->attention, false, memory_order_seq_cst);
+    // pausing sets this flag before raising attention, so checking it
+    // once attention was cleared ensures that no pause is ever missed
+    if (atomic_load_explicit(&m->system->paused, memory_order_seq_cst)) {
+      ParkMachine(m);
+    }
   }
 }
@@ -0,0 +1,381 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/atomic.h"
+#include "blink/bitscan.h"
+#include "blink/dll.h"
+#include "blink/endian.h"
+#include "blink/errno.h"
+#include "blink/fds.h"
+#include "blink/linux.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/ndelay.h"
+#include "blink/signal.h"
+#include "blink/syscall.h"
+#include "blink/thread.h"
+#include "blink/tunables.h"
+#include "blink/util.h"
+
+// signalfd() is emulated using a pipe whose read end is given to the
+// guest, so the host is able to poll() and epoll() it like other fds.
+// EnqueueSignal() writes a byte to the other end when a signal that's
+// being watched becomes pending while it's blocked, and reading turns
+// whatever's pending into signalfd_siginfo records. The bytes in pipe
+// only say when to look; the pending signal bitmasks are the truth.
+
+#define kSignalFdRecord sizeof(struct signalfd_siginfo_linux)
+
+// the caller must hold sig_lock
+static struct SignalFd *GetSignalFd(struct System *s, int fildes) {
+  int i;
+  struct stat st;
+  if (fstat(fildes, &st)) return 0;
+  for (i = 0; i < kSignalFds; ++i) {
+    if (atomic_load_explicit(&s->sigfds[i].wake, memory_order_relaxed) &&
+        s->sigfds[i].dev == st.st_dev && s->sigfds[i].ino == st.st_ino) {
+      return s->sigfds + i;
+    }
+  }
+  return 0;
+}
+
+static void WakeSignalFd(struct SignalFd *sfd) {
+  int wake;
+  atomic_fetch_add_explicit(&sfd->users, 1, memory_order_acq_rel);
+  if ((wake = atomic_load_explicit(&sfd->wake, memory_order_acquire))) {
+    if (write(wake, "", 1) == -1) {
+      // pipe is full, so a reader is already going to wake up
+    }
+  }
+  atomic_fetch_sub_explicit(&sfd->users, 1, memory_order_release);
+}
+
+// tells signalfd()s a blocked signal is pending, from a signal handler
+void NotifySignalFds(struct System *s, int sig) {
+  int i, e;
+  u64 bit = (u64)1 << (sig - 1);
+  e = errno;
+  for (i = 0; i < kSignalFds; ++i) {
+    if (atomic_load_explicit(&s->sigfds[i].mask, memory_order_acquire) & bit) {
+      WakeSignalFd(s->sigfds + i);
+    }
+  }
+  errno = e;
+}
+
+// returns union of signals being watched by signalfd()s
+u64 GetSignalFdMask(struct System *s) {
+  int i;
+  u64 mask;
+  for (mask = i = 0; i < kSignalFds; ++i) {
+    mask |= atomic_load_explicit(&s->sigfds[i].mask, memory_order_relaxed);
+  }
+  return mask;
+}
+
+// makes host route watched signals to EnqueueSignal(), needs sig_lock
+static void WatchSignals(struct System *s, u64 changed) {
+  int sig;
+  for (sig = 1; sig <= 64; ++sig) {
+    if (changed & ((u64)1 << (sig - 1))) {
+      InstallHostSignalHandler(s, sig);
+    }
+  }
+}
+
+static void SetSignalFdMask(struct System *s, struct SignalFd *sfd, u64 mask) {
+  u64 before = GetSignalFdMask(s);
+  atomic_store_explicit(&sfd->mask, mask, memory_order_release);
+  WatchSignals(s, before ^ GetSignalFdMask(s));
+}
+
+static void FreeSignalFd(struct System *s, struct SignalFd *sfd) {
+  int wake;
+  SetSignalFdMask(s, sfd, 0);
+  wake = atomic_exchange_explicit(&sfd->wake, 0, memory_order_acq_rel);
+  while (atomic_load_explicit(&sfd->users, memory_order_acquire)) {
+    sched_yield();
+  }
+  close(wake);
+}
+
+// returns true if another guest fd is a dup() of the same signalfd()
+static bool IsSignalFdShared(struct System *s, int fildes,
+                             struct SignalFd *sfd) {
+  bool res;
+  struct Fd *fd;
+  struct Dll *e;
+  struct stat st;
+  LOCK(&s->fds.lock);
+  for (res = false, e = dll_first(s->fds.list); e && !res;
+       e = dll_next(s->fds.list, e)) {
+    fd = FD_CONTAINER(e);
+    res = fd->cb == &kFdCbSignalfd && fd->fildes != fildes &&
+          !fstat(fd->fildes, &st) && st.st_dev == sfd->dev &&
+          st.st_ino == sfd->ino;
+  }
+  UNLOCK(&s->fds.lock);
+  return res;
+}
+
+static int SignalFdClose(int fildes) {
+  struct System *s;
+  struct SignalFd *sfd;
+  s = g_machine->system;
+  LOCK(&s->sig_lock);
+  if ((sfd = GetSignalFd(s, fildes)) && !IsSignalFdShared(s, fildes, sfd)) {
+    FreeSignalFd(s, sfd);
+  }
+  UNLOCK(&s->sig_lock);
+  return close(fildes);
+}
+
+static void DrainSignalFd(int fildes) {
+  char buf[64];
+  struct pollfd pfd = {fildes, POLLIN};
+  while (poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN) &&
+         read(fildes, buf, sizeof(buf)) > 0) {
+  }
+}
+
+// moves pending signals in mask from thread into records, needs sig_lock
+static int TakeSignals(struct Machine *m, u64 mask, u8 *buf, int i, int n) {
+  int sig;
+  u64 pending;
+  struct signalfd_siginfo_linux *si;
+  while (i < n && (pending = m->signals & mask)) {
+    sig = bsf(pending) + 1;
+    m->signals &= ~((u64)1 << (sig - 1));
+    si = (struct signalfd_siginfo_linux *)(buf + i++ * kSignalFdRecord);
+    memset(si, 0, kSignalFdRecord);
+    Write32(si->signo, sig);
+    Write32(si->code, SI_USER_LINUX);
+  }
+  return i;
+}
+
+static ssize_t ScatterRecords(const struct iovec *iov, int iovcnt,
+                              const u8 *buf, size_t size) {
+  int i;
+  size_t n, done;
+  for (done = i = 0; i < iovcnt && done < size; ++i) {
+    n = MIN(iov[i].iov_len, size - done);
+    memcpy(iov[i].iov_base, buf + done, n);
+    done += n;
+  }
+  return done;
+}
+
+static ssize_t SignalFdReadv(int fildes, const struct iovec *iov, int iovcnt) {
+  int i, n;
+  u64 mask;
+  size_t want;
+  bool pending;
+  struct System *s;
+  struct Machine *m;
+  struct SignalFd *sfd;
+  u8 buf[64 * kSignalFdRecord];
+  m = g_machine;
+  s = m->system;
+  for (want = i = 0; i < iovcnt; ++i) want += iov[i].iov_len;
+  if (!(n = MIN(want / kSignalFdRecord, 64))) return einval();
+  for (;;) {
+    // drain before looking, so a signal arriving afterwards wakes us
+    DrainSignalFd(fildes);
+    LOCK(&s->sig_lock);
+    if (!(sfd = GetSignalFd(s, fildes))) {
+      UNLOCK(&s->sig_lock);
+      return einval();
+    }
+    mask = atomic_load_explicit(&sfd->mask, memory_order_relaxed);
+    i = TakeSignals(m, mask, buf, 0, n);
+    pending = !!(m->signals & mask);
+#ifdef HAVE_THREADS
+    // the host may have delivered a process signal to any thread
+    LOCK(&s->machines_lock);
+    for (struct Dll *e = dll_first(s->machines); e; e = dll_next(s->machines, e)) {
+      i = TakeSignals(MACHINE_CONTAINER(e), mask, buf, i, n);
+      pending |= !!(MACHINE_CONTAINER(e)->signals & mask);
+    }
+    UNLOCK(&s->machines_lock);
+#endif
+    if (pending) WakeSignalFd(sfd);
+    UNLOCK(&s->sig_lock);
+    if (i) return ScatterRecords(iov, iovcnt, buf, i * kSignalFdRecord);
+    if (fcntl(fildes, F_GETFL) & O_NDELAY) return eagain();
+    if (poll(&(struct pollfd){fildes, POLLIN}, 1, -1) == -1) return -1;
+  }
+}
+
+static ssize_t SignalFdWritev(int fildes, const struct iovec *iov,
+                              int iovcnt) {
+  return einval();
+}
+
+static int SignalFdTcgetattr(int fildes, struct termios *tio) {
+  return enotty();
+}
+
+static int SignalFdTcsetattr(int fildes, int how, const struct termios *tio) {
+  return enotty();
+}
+
+static int SignalFdTcgetwinsize(int fildes, struct winsize *ws) {
+  return enotty();
+}
+
+static int SignalFdTcsetwinsize(int fildes, const struct winsize *ws) {
+  return enotty();
+}
+
+const struct FdCb kFdCbSignalfd = {
+    .close = SignalFdClose,
+    .readv = SignalFdReadv,
+    .writev = SignalFdWritev,
+    .poll = poll,
+    .tcgetattr = SignalFdTcgetattr,
+    .tcsetattr = SignalFdTcsetattr,
+    .tcgetwinsize = SignalFdTcgetwinsize,
+    .tcsetwinsize = SignalFdTcsetwinsize,
+};
+
+static int CreateSignalFd(struct Machine *m, u64 mask, int flags) {
+  int i, lim, oflags, pfds[2];
+  struct Fd *fd;
+  struct stat st;
+  struct System *s;
+  struct SignalFd *sfd;
+  s = m->system;
+  if (!(lim = GetFileDescriptorLimit(s))) return emfile();
+  for (sfd = 0, i = 0; i < kSignalFds; ++i) {
+    if (!atomic_load_explicit(&s->sigfds[i].wake, memory_order_relaxed)) {
+      sfd = s->sigfds + i;
+      break;
+    }
+  }
+  if (!sfd) return emfile();
+  if (pipe(pfds)) return -1;
+  oflags = O_RDONLY;
+  if (flags & SFD_CLOEXEC_LINUX) {
+    oflags |= O_CLOEXEC;
+    unassert(!fcntl(pfds[0], F_SETFD, FD_CLOEXEC));
+  }
+  if (flags & SFD_NONBLOCK_LINUX) {
+    oflags |= O_NDELAY;
+    unassert(!fcntl(pfds[0], F_SETFL, O_NDELAY));
+  }
+  unassert(!fcntl(pfds[1], F_SETFL, O_NDELAY));
+  if (pfds[0] >= lim || fstat(pfds[0], &st) ||
+      (sfd->wake = fcntl(pfds[1], F_DUPFD_CLOEXEC, kMinBlinkFd)) == -1) {
+    sfd->wake = 0;
+    close(pfds[0]);
+    close(pfds[1]);
+    return pfds[0] >= lim ? emfile() : -1;
+  }
+  close(pfds[1]);
+  sfd->fildes = pfds[0];
+  sfd->dev = st.st_dev;
+  sfd->ino = st.st_ino;
+  SetSignalFdMask(s, sfd, mask);
+  LOCK(&s->fds.lock);
+  unassert(fd = AddFd(&s->fds, pfds[0], oflags));
+  fd->cb = &kFdCbSignalfd;
+  UNLOCK(&s->fds.lock);
+  // signals that were already pending are reported too
+  if (m->signals & mask) WakeSignalFd(sfd);
+  return pfds[0];
+}
+
+int SysSignalfd4(struct Machine *m, i32 fildes, i64 maskaddr, u64 sigsetsize,
+                 i32 flags) {
+  u64 mask;
+  u8 word[8];
+  int rc, supported;
+  struct SignalFd *sfd;
+  supported = SFD_CLOEXEC_LINUX | SFD_NONBLOCK_LINUX;
+  if (flags & ~supported) {
+    LOGF("%s() unsupported flags: %d", "signalfd4", flags & ~supported);
+    return einval();
+  }
+  if (sigsetsize != 8) return einval();
+  if (CopyFromUserRead(m, word, maskaddr, 8) == -1) return -1;
+  // sigkill and sigstop can't be read this way
+  mask = Read64(word) & ~((u64)1 << (SIGKILL_LINUX - 1) |
+                          (u64)1 << (SIGSTOP_LINUX - 1));
+  LOCK(&m->system->sig_lock);
+  if (fildes == -1) {
+    rc = CreateSignalFd(m, mask, flags);
+  } else if ((sfd = GetSignalFd(m->system, fildes))) {
+    SetSignalFdMask(m->system, sfd, mask);
+    if (m->signals & mask) WakeSignalFd(sfd);
+    rc = fildes;
+  } else {
+    rc = einval();
+  }
+  UNLOCK(&m->system->sig_lock);
+  return rc;
+}
+
+/**
+ * Gives the child its own signalfd() pipes after fork().
+ *
+ * Otherwise the parent and child would be waking each other up, and a
+ * process draining the pipe could eat a byte the other one needed.
+ */
+void ResetSignalFds(struct System *s) {
+  int i, pfds[2];
+  struct stat st;
+  struct SignalFd *sfd;
+  for (i = 0; i < kSignalFds; ++i) {
+    sfd = s->sigfds + i;
+    if (!sfd->wake) continue;
+    if (pipe(pfds)) {
+      LOGF("failed to recreate signalfd pipe: %s", DescribeHostErrno(errno));
+      continue;
+    }
+    unassert(!fcntl(pfds[0], F_SETFL, fcntl(sfd->fildes, F_GETFL)));
+    unassert(!fcntl(pfds[0], F_SETFD, fcntl(sfd->fildes, F_GETFD)));
+    unassert(!fcntl(pfds[1], F_SETFL, O_NDELAY));
+    unassert(dup2(pfds[0], sfd->fildes) == sfd->fildes);
+    unassert(dup2(pfds[1], sfd->wake) == sfd->wake);
+    unassert(!fcntl(sfd->wake, F_SETFD, FD_CLOEXEC));
+    close(pfds[0]);
+    close(pfds[1]);
+    unassert(!fstat(sfd->fildes, &st));
+    sfd->dev = st.st_dev;
+    sfd->ino = st.st_ino;
+    if (g_machine->signals & sfd->mask) WakeSignalFd(sfd);
+  }
+}
+
+int SysSignalfd(struct Machine *m, i32 fildes, i64 maskaddr, u64 sigsetsize) {
+  return SysSignalfd4(m, fildes, maskaddr, sigsetsize, 0);
+}
@@ -24,6 +24,7 @@
 #include "blink/macros.h"
 #include "blink/map.h"
 #include "blink/stats.h"
+#include "blink/timespec.h"
 #include "blink/tunables.h"
 #include "blink/util.h"
 #include "blink/xlat.h"
@@ -86,27 +87,165 @@ void AddPageToSmcQueue(struct Machine *m, i64 page) {
   Abort();
 }
 
+static struct SmcPage *GetSmcPage(struct System *s, i64 page) {
+  return s->smcpages + (((u64)page >> 12) & (kSmcPages - 1));
+}
+
+/**
+ * Returns true if writes to guest page are no longer being intercepted.
+ *
+ * @asyncsignalsafe
+ */
+bool IsSmcPageUnwatched(struct System *s, i64 virt) {
+  virt &= -4096;
+  return atomic_load_explicit(&GetSmcPage(s, virt)->unwatched,
+                              memory_order_acquire) == virt;
+}
+
+static u64 HashSmcPage(const u8 *host) {
+  int i;
+  u64 h;
+  for (h = 0, i = 0; i < 4096; i += 64) {
+    h = (h ^ HashJitLine(host + i)) * 0x9e3779b97f4a7c15;
+  }
+  return h;
+}
+
+// counts flush of page, and stops intercepting its writes if that's
+// happening so often, e.g. due to data that's on the same page as hot
+// code, that the faults cost more than running its code without jit
+static bool ShouldUnwatchSmcPage(struct System *s, i64 page) {
+  bool res;
+  struct SmcPage *p;
+  struct timespec now;
+  now = GetMonotonic();
+  p = GetSmcPage(s, page);
+  LOCK(&s->jit.lock);
+  if ((res = atomic_load_explicit(&p->unwatched, memory_order_relaxed) ==
+             page)) {
+    // another thread intercepted a write before the page was unwatched
+  } else if (atomic_load_explicit(&p->unwatched, memory_order_relaxed)) {
+    // slot belongs to some other page that's unwatched
+  } else {
+    if (p->page != page ||
+        ToMilliseconds(SubtractTime(now, p->since)) >= kSmcWindowMs) {
+      p->page = page;
+      p->flushes = 0;
+      p->since = now;
+    }
+    if (++p->flushes >= kSmcVolatile) {
+      MEM_LOGF("unwatching self-modifying code page %#" PRIx64, page);
+      STATISTIC(++smc_unwatched);
+      p->sum = 0;
+      p->since = now;
+      atomic_store_explicit(&p->unwatched, page, memory_order_release);
+      res = true;
+    }
+  }
+  UNLOCK(&s->jit.lock);
+  return res;
+}
+
+/**
+ * Returns true if jit paths shouldn't be made from guest page.
+ *
+ * That's the case when its writes aren't intercepted anymore, because
+ * they happened too often. Its content is hashed every so often, and
+ * once it stops changing, writes to the page are intercepted again.
+ */
+bool IsVolatileCodePage(struct Machine *m, i64 virt) {
+  u8 *host;
+  u64 sum;
+  bool res = true;
+  struct SmcPage *p;
+  struct timespec now;
+  struct System *s = m->system;
+  if (!IsSmcPageUnwatched(s, virt)) return false;
+  virt &= -4096;
+  p = GetSmcPage(s, virt);
+  now = GetMonotonic();
+  if (ToMilliseconds(SubtractTime(now, p->since)) < kSmcCalmMs ||
+      !(host = LookupAddress2(m, virt, 0, 0))) {
+    return true;
+  }
+  sum = HashSmcPage(host);
+  LOCK(&s->jit.lock);
+  if (atomic_load_explicit(&p->unwatched, memory_order_relaxed) == virt) {
+    if (sum == p->sum) {
+      // the lock keeps a flush of this page from seeing it unwatched
+      // after we've protected it, which would leave it unprotected
+      MEM_LOGF("watching self-modifying code page %#" PRIx64 " again", virt);
+      STATISTIC(++smc_rewatched);
+      if (HasLinearMapping()) {
+        unassert(!ProtectSelfModifyingCode(s, virt, 1));
+      }
+      p->page = 0;
+      atomic_store_explicit(&p->unwatched, 0, memory_order_release);
+      res = false;
+    } else {
+      p->sum = sum;
+      p->since = now;
+    }
+  } else {
+    res = false;
+  }
+  UNLOCK(&s->jit.lock);
+  return res;
+}
+
+// paths being generated needn't be abandoned here, since FinishPath()
+// checks that the lines of guest memory they were read from are still
+// the same, which lets code and data share a page without thrashing
 void FlushSmcQueue(struct Machine *m) {
   int i;
+  u8 *host;
   i64 page;
   unassert(m->selfmodifying);
   STATISTIC(++smc_flushes);
+  // the path this thread is generating wrote to guest code. it mustn't
+  // be published, since its code would run the write and then go into
+  // paths it made stale without returning to the interpreter to notice
+  if (IsMakingPath(m)) m->path.stale = true;
   for (i = 0; i < kSmcQueueSize; ++i) {
     if ((page = m->smcqueue.p[i])) {
       m->smcqueue.p[i] = 0;
       if (!IsJitDisabled(&m->system->jit)) {
+        if (ShouldUnwatchSmcPage(m->system, page)) {
+          // its code runs in the interpreter until writes to it stop
+          ResetJitPage(&m->system->jit, page);
+          continue;
+        }
         if (HasLinearMapping()) {
           unassert(!ProtectSelfModifyingCode(m->system, page, 1));
         }
-        ResetJitPage(&m->system->jit, page);
-      }
-      if (IsMakingPath(m) && (m->path.start & -4096) == (page & -4096)) {
-        AbandonPath(m);
+        if ((host = LookupAddress2(m, page, PAGE_XD, 0))) {
+          ResetJitPageLines(&m->system->jit, page, host);
+        } else {
+          ResetJitPage(&m->system->jit, page);
+        }
       }
     }
   }
 }
 
+// pages that become executable again are protected, so their writes
+// need to be intercepted no matter what happened to them before
+static void ForgetSmcPages(struct System *s, i64 a, i64 b) {
+  int i;
+  i64 page;
+  LOCK(&s->jit.lock);
+  for (i = 0; i < kSmcPages; ++i) {
+    page = atomic_load_explicit(&s->smcpages[i].unwatched,
+                                memory_order_relaxed);
+    if (a <= page && page < b) {
+      s->smcpages[i].page = 0;
+      atomic_store_explicit(&s->smcpages[i].unwatched, 0,
+                            memory_order_release);
+    }
+  }
+  UNLOCK(&s->jit.lock);
+}
+
 i64 ProtectRwxMemory(struct System *s, i64 rc, i64 virt, i64 size,
                      long pagesize, int prot) {
   i64 a, b;
@@ -121,6 +260,7 @@ i64 ProtectRwxMemory(struct System *s, i64 rc, i64 virt, i64 size,
     a = ROUNDUP(a, pagesize);
     b = ROUNDDOWN(b, pagesize);
     if (b > a) {
+      ForgetSmcPages(s, a, b);
       unassert(!ProtectSelfModifyingCode(s, a, b - a));
     }
   }
@@ -0,0 +1,771 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/bus.h"
+#include "blink/dll.h"
+#include "blink/endian.h"
+#include "blink/fds.h"
+#include "blink/flag.h"
+#include "blink/flags.h"
+#include "blink/linux.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/map.h"
+#include "blink/procfs.h"
+#include "blink/stats.h"
+#include "blink/syscall.h"
+#include "blink/tunables.h"
+#include "blink/util.h"
+#include "blink/vfs.h"
+#include "blink/x86.h"
+
+/**
+ * @fileoverview Checkpoint and restore of a running guest.
+ *
+ * When BLINK_SNAPSHOT names a file, a program that stops itself with
+ * SIGSTOP, e.g. `kill -STOP $$` at the end of its warm-up, has its
+ * state written to that file instead of being stopped. Later runs of
+ * the same program with the same arguments resume from that point,
+ * without loading the executable or running the code that came before
+ * the stop. From the program's point of view, the SIGSTOP returns.
+ *
+ * The snapshot holds registers, signal dispositions, resource limits,
+ * the page table along with the content of nonzero pages, the file map
+ * list, the working directory, and any regular files or directories
+ * the program has open, which get reopened by path and seek offset.
+ * Standard input, output, and error are inherited from whoever runs
+ * the restore. Programs with more than one thread, or that have pipes
+ * or sockets open, can't be saved; in that case SIGSTOP behaves like
+ * it normally would. Shared memory mappings are restored as private,
+ * and pending timers aren't saved.
+ */
+
+#define SNAPSHOT_MAGIC "BLINKSNP"
+
+struct SnapshotHeader {
+  char magic[8];
+  u64 key;
+  u64 ip;
+  u32 flags;
+  u32 mxcsr;
+  u64 sigmask;
+  u64 signals;
+  u8 beg[128];
+  u8 xmm[16][16];
+  u8 ymmh[16][16];
+  u64 xcr0;
+  struct DescriptorCache seg[8];
+  struct MachineFpu fpu;
+  struct sigaltstack_linux sigaltstack;
+  i64 robust_list;
+  i64 ctid;
+  i64 brk;
+  i64 automap;
+  i64 vdso;
+  i64 codestart;
+  i64 codesize;
+  bool iscosmo;
+  bool brkchanged;
+  struct Elf elf;  // pointers are garbage and strings follow instead
+  struct sigaction_linux hands[64];
+  struct rlimit_linux rlim[RLIM_NLIMITS_LINUX];
+  u32 umask;
+  u32 filemaps;
+  u32 fds;
+  u32 runs;
+};
+
+struct SnapshotFileMap {
+  i64 virt;
+  i64 size;
+  i64 offset;
+  u64 pages;
+};
+
+struct SnapshotFd {
+  i32 fildes;
+  i32 oflags;
+  i64 offset;
+};
+
+// interval of pages with the same protection and content kind
+struct SnapshotRun {
+  i64 virt;
+  i64 size;
+  u64 key;   // PAGE_U, PAGE_RW, PAGE_XD, and PAGE_FILE bits
+  u64 data;  // nonzero if page content follows, otherwise zeroes
+};
+
+struct SnapshotRuns {
+  size_t i, n;
+  struct SnapshotRun *p;
+};
+
+static struct Snapshot {
+  bool armed;
+  int pid;
+  u64 key;
+  struct System *system;
+} g_snapshot;
+
+static u64 HashStat(u64 h, const struct stat *st) {
+  h = Fnv64(h, &st->st_dev, sizeof(st->st_dev));
+  h = Fnv64(h, &st->st_ino, sizeof(st->st_ino));
+  h = Fnv64(h, &st->st_size, sizeof(st->st_size));
+  h = Fnv64(h, &st->st_mtime, sizeof(st->st_mtime));
+  return h;
+}
+
+// identifies the program, its arguments, and our own binary, since
+// the snapshot holds our structs verbatim and resumes the same argv
+static bool GetSnapshotKey(const char *prog, char **argv, u64 *key) {
+  u64 h;
+  struct stat st;
+  h = 0xcbf29ce484222325;
+  if (stat("/proc/self/exe", &st) &&
+      (!g_blink_path || stat(g_blink_path, &st))) {
+    return false;
+  }
+  h = HashStat(h, &st);
+  if (VfsStat(AT_FDCWD, prog, &st, 0)) return false;
+  h = HashStat(h, &st);
+  h = Fnv64(h, prog, strlen(prog) + 1);
+  for (; *argv; ++argv) {
+    h = Fnv64(h, *argv, strlen(*argv) + 1);
+  }
+  h = Fnv64(h, (u64[]){FLAG_nolinear, FLAG_pagesize, FLAG_skew, FLAG_vabits,
+                       sizeof(struct Machine), sizeof(struct SnapshotHeader)},
+            6 * sizeof(u64));
+  *key = h;
+  return true;
+}
+
+static bool WriteSnapshot(int fd, const void *data, size_t size) {
+  ssize_t rc;
+  size_t i;
+  for (i = 0; i < size; i += rc) {
+    if ((rc = write(fd, (const u8 *)data + i, size - i)) == -1) {
+      if (errno == EINTR) {
+        rc = 0;
+        continue;
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool ReadSnapshot(int fd, void *data, size_t size) {
+  ssize_t rc;
+  size_t i;
+  for (i = 0; i < size; i += rc) {
+    if ((rc = read(fd, (u8 *)data + i, size - i)) <= 0) {
+      if (rc == -1 && errno == EINTR) {
+        rc = 0;
+        continue;
+      }
+      if (!rc) errno = EIO;
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool WriteSnapshotString(int fd, const char *s) {
+  u32 n = s ? strlen(s) : -1u;
+  return WriteSnapshot(fd, &n, sizeof(n)) && (!s || WriteSnapshot(fd, s, n));
+}
+
+static bool ReadSnapshotString(int fd, char **s) {
+  u32 n;
+  *s = 0;
+  if (!ReadSnapshot(fd, &n, sizeof(n))) return false;
+  if (n == -1u) return true;
+  if (n >= PATH_MAX * 2 || !(*s = (char *)malloc(n + 1))) return false;
+  if (!ReadSnapshot(fd, *s, n)) {
+    free(*s);
+    *s = 0;
+    return false;
+  }
+  (*s)[n] = 0;
+  return true;
+}
+
+static bool IsZeroPage(const u8 *p) {
+  u64 w;
+  long i;
+  for (i = 0; i < 4096; i += 8) {
+    memcpy(&w, p + i, 8);
+    if (w) return false;
+  }
+  return true;
+}
+
+static u64 GetSnapshotPte(struct System *s, i64 virt) {
+  u64 pt;
+  unsigned level;
+  for (pt = s->cr3, level = 39;; level -= 9) {
+    pt = Load64(GetPageAddress(s, pt, level == 39) +
+                ((virt >> level) & 511) * 8);
+    if (IsLazyChunk(pt)) return GetLazyEntry(pt, virt);
+    if (level == 12 || !(pt & PAGE_V)) return pt;
+  }
+}
+
+// pages the guest can't read in linear mode are also unreadable to us
+static bool HasSnapshotData(struct System *s, u64 entry) {
+  if (entry & PAGE_RSRV) return false;
+  if ((entry & (PAGE_U | PAGE_MAP)) == PAGE_MAP) {
+    LOG_ONCE(LOGF("snapshot doesn't save the content of PROT_NONE pages"));
+    return false;
+  }
+  return !IsZeroPage(GetPageAddress(s, entry, false));
+}
+
+static bool AppendSnapshotRun(struct SnapshotRuns *runs, i64 virt, u64 key,
+                              bool data) {
+  size_t n;
+  struct SnapshotRun *r;
+  if (runs->i) {
+    r = runs->p + runs->i - 1;
+    if (r->virt + r->size == virt && r->key == key && r->data == data) {
+      r->size += 4096;
+      return true;
+    }
+  }
+  if (runs->i == runs->n) {
+    n = runs->n ? runs->n * 2 : 64;
+    if (!(r = (struct SnapshotRun *)realloc(runs->p, n * sizeof(*r)))) {
+      return false;
+    }
+    runs->p = r;
+    runs->n = n;
+  }
+  r = runs->p + runs->i++;
+  r->virt = virt;
+  r->size = 4096;
+  r->key = key;
+  r->data = data;
+  return true;
+}
+
+static bool FindSnapshotRuns(struct System *s, struct SnapshotRuns *runs,
+                             i64 addr, unsigned level, u64 pt, i64 a, i64 b) {
+  u64 entry, pte;
+  i64 i, j, page;
+  for (i = a; i < b; ++i) {
+    entry = Load64(GetPageAddress(s, pt, level == 39) + i * 8);
+    if (!(entry & PAGE_V)) continue;
+    page = (addr | i << level) << 16 >> 16;
+    if (level == 21 && IsLazyChunk(entry)) {
+      for (j = 0; j < 0x200000; j += 4096) {
+        pte = GetLazyEntry(entry, j);
+        if (!AppendSnapshotRun(runs, page + j,
+                               pte & (PAGE_U | PAGE_RW | PAGE_XD | PAGE_FILE),
+                               HasSnapshotData(s, pte))) {
+          return false;
+        }
+      }
+    } else if (level == 12) {
+      // pages BLINK_RECLAIM compressed have content, so they come back,
+      // and so do file mapped pages the program hasn't touched yet
+      if (((entry & PAGE_ZIP) ||
+           (entry & (PAGE_RSRV | PAGE_MUG)) == (PAGE_RSRV | PAGE_MUG)) &&
+          !(entry = CommitReservedPage(
+                s, GetPageAddress(s, pt, level == 39) + i * 8, entry))) {
+        return false;
+      }
+      if (!AppendSnapshotRun(runs, page,
+                             entry & (PAGE_U | PAGE_RW | PAGE_XD | PAGE_FILE),
+                             HasSnapshotData(s, entry))) {
+        return false;
+      }
+    } else if (!FindSnapshotRuns(s, runs, page, level - 9, entry, 0, 512)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// writes content of run, coalescing pages that are adjacent on host
+static bool WriteSnapshotRun(int fd, struct System *s,
+                             const struct SnapshotRun *r) {
+  i64 virt;
+  size_t n = 0;
+  u8 *p, *q = 0;
+  for (virt = r->virt; virt < r->virt + r->size; virt += 4096) {
+    p = GetPageAddress(s, GetSnapshotPte(s, virt), false);
+    if (n && p == q + n) {
+      n += 4096;
+      continue;
+    }
+    if (n && !WriteSnapshot(fd, q, n)) return false;
+    q = p;
+    n = 4096;
+  }
+  return !n || WriteSnapshot(fd, q, n);
+}
+
+static bool WriteSnapshotFile(struct Machine *m, int fd,
+                              const struct SnapshotRuns *runs) {
+  size_t i;
+  mode_t mask;
+  struct Dll *e;
+  struct Fd *gfd;
+  struct FileMap *fm;
+  struct stat st;
+  struct SnapshotFd sfd;
+  struct SnapshotHeader h;
+  struct SnapshotFileMap sfm;
+  struct System *s = m->system;
+  char cwd[PATH_MAX];
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, SNAPSHOT_MAGIC, 8);
+  h.key = g_snapshot.key;
+  h.ip = m->ip;
+  h.flags = m->flags;
+  h.mxcsr = m->mxcsr;
+  h.sigmask = m->sigmask;
+  h.signals = m->signals;
+  memcpy(h.beg, m->beg, sizeof(h.beg));
+  Write64(h.beg, 0);  // what kill() returns once restored
+  memcpy(h.xmm, m->xmm, sizeof(h.xmm));
+  memcpy(h.ymmh, m->ymmh, sizeof(h.ymmh));
+  h.xcr0 = m->xcr0;
+  memcpy(h.seg, m->seg, sizeof(h.seg));
+  h.fpu = m->fpu;
+  h.sigaltstack = m->sigaltstack;
+  h.robust_list = m->robust_list;
+  h.ctid = m->ctid;
+  h.brk = s->brk;
+  h.automap = s->automap;
+  h.vdso = s->vdso;
+  h.codestart = s->codestart;
+  h.codesize = s->codesize;
+  h.iscosmo = s->iscosmo;
+  h.brkchanged = s->brkchanged;
+  h.elf = s->elf;
+  memcpy(h.hands, s->hands, sizeof(h.hands));
+  memcpy(h.rlim, s->rlim, sizeof(h.rlim));
+  umask((mask = umask(0)));
+  h.umask = mask;
+  for (e = dll_first(s->filemaps); e; e = dll_next(s->filemaps, e)) {
+    ++h.filemaps;
+  }
+  for (e = dll_first(s->fds.list); e; e = dll_next(s->fds.list, e)) {
+    if (FD_CONTAINER(e)->fildes > 2) ++h.fds;
+  }
+  h.runs = runs->i;
+  if (!getcwd(cwd, sizeof(cwd))) return false;
+  if (!WriteSnapshot(fd, &h, sizeof(h)) ||      //
+      !WriteSnapshotString(fd, cwd) ||          //
+      !WriteSnapshotString(fd, s->elf.prog) ||  //
+      !WriteSnapshotString(fd, s->elf.execfn) ||
+      !WriteSnapshotString(fd, s->elf.interpreter)) {
+    return false;
+  }
+  for (e = dll_first(s->filemaps); e; e = dll_next(s->filemaps, e)) {
+    fm = FILEMAP_CONTAINER(e);
+    sfm.virt = fm->virt;
+    sfm.size = fm->size;
+    sfm.offset = fm->offset;
+    sfm.pages = fm->pages;
+    if (!WriteSnapshot(fd, &sfm, sizeof(sfm)) ||
+        !WriteSnapshotString(fd, fm->path) ||
+        !WriteSnapshot(fd, fm->present,
+                       ROUNDUP(ROUNDUP(fm->size, 4096) / 4096, 64) / 8)) {
+      return false;
+    }
+  }
+  for (e = dll_first(s->fds.list); e; e = dll_next(s->fds.list, e)) {
+    gfd = FD_CONTAINER(e);
+    if (gfd->fildes <= 2) continue;
+    if (gfd->cb != &kFdCbHost || !gfd->path || gfd->path[0] != '/' ||
+        VfsFstat(gfd->fildes, &st) ||
+        !(S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))) {
+      LOGF("can't snapshot fd %d since it isn't a file or directory",
+           gfd->fildes);
+      errno = EBADF;
+      return false;
+    }
+    sfd.fildes = gfd->fildes;
+    sfd.oflags = gfd->oflags;
+    sfd.offset = S_ISREG(st.st_mode) ? VfsSeek(gfd->fildes, 0, SEEK_CUR) : 0;
+    if (!WriteSnapshot(fd, &sfd, sizeof(sfd)) ||
+        !WriteSnapshotString(fd, gfd->path)) {
+      return false;
+    }
+  }
+  if (!WriteSnapshot(fd, runs->p, runs->i * sizeof(*runs->p))) return false;
+  for (i = 0; i < runs->i; ++i) {
+    if (runs->p[i].data && !WriteSnapshotRun(fd, s, runs->p + i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Saves the state of the calling program to the BLINK_SNAPSHOT file.
+ *
+ * This is called when a guest sends SIGSTOP to itself. It only does
+ * something in the process whose startup armed the snapshot, before
+ * that process runs any other program via execve().
+ *
+ * @return 0 if the snapshot was written and the SIGSTOP is consumed,
+ *     or -1 if the signal should be raised as it normally would be
+ */
+int TakeSnapshot(struct Machine *m) {
+  int fd;
+  bool ok;
+  struct SnapshotRuns runs;
+  char temp[PATH_MAX];
+  struct System *s = m->system;
+  if (!g_snapshot.armed || s != g_snapshot.system ||
+      getpid() != g_snapshot.pid) {
+    return -1;
+  }
+  g_snapshot.armed = false;
+  if (dll_first(s->machines) != dll_last(s->machines)) {
+    LOGF("can't snapshot programs that have multiple threads");
+    return -1;
+  }
+  if (m->sigdepth) {
+    LOGF("can't snapshot programs from inside a signal handler");
+    return -1;
+  }
+  if (snprintf(temp, sizeof(temp), "%s.%d.tmp", FLAG_snapshot, getpid()) >=
+      sizeof(temp)) {
+    return -1;
+  }
+  memset(&runs, 0, sizeof(runs));
+  if ((fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+    LOGF("%s: open failed: %s", temp, DescribeHostErrno(errno));
+    return -1;
+  }
+  LOCK(&s->mmap_lock);
+  LOCK(&s->fds.lock);
+  ok = FindSnapshotRuns(s, &runs, 0, 39, s->cr3, 0, 256) &&
+       FindSnapshotRuns(s, &runs, 0, 39, s->cr3, 256, 512) &&
+       WriteSnapshotFile(m, fd, &runs);
+  UNLOCK(&s->fds.lock);
+  UNLOCK(&s->mmap_lock);
+  free(runs.p);
+  if (!ok) {
+    LOGF("%s: couldn't write snapshot: %s", temp, DescribeHostErrno(errno));
+  }
+  if (close(fd)) ok = false;
+  if (!ok) {
+    unlink(temp);
+    return -1;
+  }
+  if (rename(temp, FLAG_snapshot)) {
+    // rename() is atomic so concurrent runs never see partial files
+    LOGF("%s: rename failed: %s", FLAG_snapshot, DescribeHostErrno(errno));
+    unlink(temp);
+    return -1;
+  }
+  SYS_LOGF("wrote snapshot %s", FLAG_snapshot);
+  return 0;
+}
+
+// in linear mode the guest addresses must be free in our host process
+static bool CanRestoreSnapshotRuns(const struct SnapshotRun *runs, u32 n) {
+  u32 i;
+  void *got;
+  if (!HasLinearMapping()) return true;
+  for (i = 0; i < n; ++i) {
+    if (HasShadowMapping()) {
+      if (runs[i].virt + runs[i].size <= FLAG_shadowsize) continue;
+      LOGF("can't restore snapshot since [%#" PRIx64 ",%#" PRIx64
+           ") doesn't fit in shadow memory",
+           runs[i].virt, runs[i].virt + runs[i].size);
+      return false;
+    }
+    got = Mmap(ToHost(runs[i].virt), runs[i].size, PROT_NONE,
+               MAP_PRIVATE | MAP_ANONYMOUS_ | MAP_DEMAND, -1, 0, "snapshot");
+    if (got != MAP_FAILED) unassert(!Munmap(got, runs[i].size));
+    if (got != ToHost(runs[i].virt)) {
+      LOGF("can't restore snapshot since [%#" PRIx64 ",%#" PRIx64
+           ") is taken on the host",
+           runs[i].virt, runs[i].virt + runs[i].size);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool ReadSnapshotRun(struct Machine *m, int fd,
+                            const struct SnapshotRun *r) {
+  i64 virt;
+  size_t n = 0;
+  u8 *p, *q = 0;
+  for (virt = r->virt; virt < r->virt + r->size; virt += 4096) {
+    if (!(p = LookupAddress2(m, virt, 0, 0))) return false;
+    if (n && p == q + n) {
+      n += 4096;
+      continue;
+    }
+    if (n && !ReadSnapshot(fd, q, n)) return false;
+    q = p;
+    n = 4096;
+  }
+  return !n || ReadSnapshot(fd, q, n);
+}
+
+static void RestoreSnapshotMemory(struct Machine *m, int fd,
+                                  const struct SnapshotRun *runs, u32 n) {
+  u32 i;
+  struct System *s = m->system;
+  for (i = 0; i < n; ++i) {
+    // fill pages while they're writable, then give them their real
+    // protection, so the jit won't need to watch them for smc here
+    if (ReserveVirtual(s, runs[i].virt, runs[i].size,
+                       PAGE_U | PAGE_RW | PAGE_XD | (runs[i].key & PAGE_FILE),
+                       -1, 0, 0, 0) != runs[i].virt ||
+        (runs[i].data && !ReadSnapshotRun(m, fd, runs + i)) ||
+        ((runs[i].key & (PAGE_U | PAGE_RW | PAGE_XD)) !=
+             (PAGE_U | PAGE_RW | PAGE_XD) &&
+         ProtectVirtual(s, runs[i].virt, runs[i].size,
+                        GetProtection(runs[i].key), false))) {
+      ERRF("%s: failed to restore snapshot memory: %s", FLAG_snapshot,
+           DescribeHostErrno(errno));
+      exit(127);
+    }
+  }
+}
+
+static void RestoreSnapshotFds(struct System *s, int fd, u32 n) {
+  u32 i;
+  int fildes;
+  char *path;
+  struct Fd *gfd;
+  struct SnapshotFd sfd;
+  for (i = 0; i < n; ++i) {
+    if (!ReadSnapshot(fd, &sfd, sizeof(sfd)) ||
+        !ReadSnapshotString(fd, &path) || !path) {
+      ERRF("%s: corrupt snapshot", FLAG_snapshot);
+      exit(127);
+    }
+    if ((fildes = VfsOpen(AT_FDCWD, path,
+                          sfd.oflags & ~(O_CREAT | O_TRUNC | O_EXCL), 0)) ==
+        -1) {
+      LOGF("%s: couldn't reopen fd %d of snapshot: %s", path, sfd.fildes,
+           DescribeHostErrno(errno));
+      free(path);
+      continue;
+    }
+    if (fildes != sfd.fildes) {
+      unassert(VfsDup2(fildes, sfd.fildes) == sfd.fildes);
+      unassert(!VfsClose(fildes));
+      if (sfd.oflags & O_CLOEXEC) {
+        unassert(!VfsFcntl(sfd.fildes, F_SETFD, FD_CLOEXEC));
+      }
+    }
+    if (sfd.offset > 0) VfsSeek(sfd.fildes, sfd.offset, SEEK_SET);
+    if ((gfd = AddFd(&s->fds, sfd.fildes, sfd.oflags))) {
+      gfd->path = path;
+    } else {
+      free(path);
+    }
+  }
+}
+
+static void RestoreSnapshotFileMaps(struct System *s, int fd, u32 n) {
+  u32 i;
+  char *path;
+  struct FileMap *fm;
+  struct SnapshotFileMap sfm;
+  for (i = 0; i < n; ++i) {
+    if (!ReadSnapshot(fd, &sfm, sizeof(sfm)) ||
+        !ReadSnapshotString(fd, &path) ||
+        !(fm = AddFileMap(s, sfm.virt, sfm.size, path, sfm.offset)) ||
+        !ReadSnapshot(fd, fm->present,
+                      ROUNDUP(ROUNDUP(sfm.size, 4096) / 4096, 64) / 8)) {
+      ERRF("%s: corrupt snapshot", FLAG_snapshot);
+      exit(127);
+    }
+    fm->pages = sfm.pages;
+    free(path);
+  }
+}
+
+// the file maps and fds come before the runs in the file, so we need
+// to skip past them to learn if the address space we need is free, and
+// then seek back so they can be restored after nothing can go wrong
+static struct SnapshotRun *PeekSnapshotRuns(int fd,
+                                            const struct SnapshotHeader *h) {
+  u32 i;
+  off_t here;
+  char *skip;
+  struct SnapshotFd sfd;
+  struct SnapshotRun *runs;
+  struct SnapshotFileMap sfm;
+  if ((here = lseek(fd, 0, SEEK_CUR)) == -1) return 0;
+  for (i = 0; i < h->filemaps; ++i) {
+    if (!ReadSnapshot(fd, &sfm, sizeof(sfm)) ||
+        !ReadSnapshotString(fd, &skip)) {
+      return 0;
+    }
+    free(skip);
+    if (lseek(fd, ROUNDUP(ROUNDUP(sfm.size, 4096) / 4096, 64) / 8,
+              SEEK_CUR) == -1) {
+      return 0;
+    }
+  }
+  for (i = 0; i < h->fds; ++i) {
+    if (!ReadSnapshot(fd, &sfd, sizeof(sfd)) ||
+        !ReadSnapshotString(fd, &skip)) {
+      return 0;
+    }
+    free(skip);
+  }
+  if (!(runs = (struct SnapshotRun *)malloc(h->runs * sizeof(*runs) + 1))) {
+    return 0;
+  }
+  if (!ReadSnapshot(fd, runs, h->runs * sizeof(*runs)) ||
+      lseek(fd, here, SEEK_SET) == -1) {
+    free(runs);
+    return 0;
+  }
+  return runs;
+}
+
+/**
+ * Resumes a program from the BLINK_SNAPSHOT file, if it has one.
+ *
+ * This should be called on a fresh machine instead of LoadProgram(),
+ * when the first program is being run. If no snapshot exists for this
+ * exact program and argv, then the current run is armed to write one
+ * when it stops itself.
+ *
+ * @return true if program was restored
+ */
+bool RestoreSnapshot(struct Machine *m, const char *prog, char **argv) {
+  int fd;
+  u64 key;
+  struct Elf elf;
+  char *cwd, *p[3];
+  struct SnapshotHeader h;
+  struct SnapshotRun *runs;
+  struct System *s = m->system;
+  if (!FLAG_snapshot || !GetSnapshotKey(prog, argv, &key)) return false;
+  g_snapshot.armed = true;
+  g_snapshot.key = key;
+  g_snapshot.pid = getpid();
+  g_snapshot.system = s;
+  if ((fd = open(FLAG_snapshot, O_RDONLY | O_CLOEXEC)) == -1) {
+    if (errno != ENOENT) {
+      LOGF("%s: open failed: %s", FLAG_snapshot, DescribeHostErrno(errno));
+    }
+    return false;
+  }
+  // keep the guest's lowest file descriptor numbers for the guest
+  unassert(dup2(fd, kMinBlinkFd) == kMinBlinkFd);
+  unassert(!close(fd));
+  fd = kMinBlinkFd;
+  cwd = p[0] = p[1] = p[2] = 0;
+  if (!ReadSnapshot(fd, &h, sizeof(h)) ||
+      memcmp(h.magic, SNAPSHOT_MAGIC, 8) || h.key != key) {
+    SYS_LOGF("%s: snapshot is for another program", FLAG_snapshot);
+    close(fd);
+    return false;
+  }
+  if (!ReadSnapshotString(fd, &cwd) || !ReadSnapshotString(fd, p + 0) ||
+      !ReadSnapshotString(fd, p + 1) || !ReadSnapshotString(fd, p + 2)) {
+    goto Corrupt;
+  }
+  if (!(runs = PeekSnapshotRuns(fd, &h))) goto Corrupt;
+  if (!CanRestoreSnapshotRuns(runs, h.runs)) {
+    free(runs);
+    free(cwd);
+    free(p[0]);
+    free(p[1]);
+    free(p[2]);
+    close(fd);
+    return false;
+  }
+  g_snapshot.armed = false;
+  if (chdir(cwd)) {
+    LOGF("%s: couldn't restore working directory: %s", cwd,
+         DescribeHostErrno(errno));
+  }
+  free(cwd);
+  umask(h.umask);
+  ResetCpu(m);
+  s->cr0 = CR0_PE | CR0_MP | CR0_ET | CR0_PG;
+  s->cr3 = AllocatePageTable(s);
+  RestoreSnapshotFileMaps(s, fd, h.filemaps);
+  RestoreSnapshotFds(s, fd, h.fds);
+  lseek(fd, h.runs * sizeof(*runs), SEEK_CUR);
+  RestoreSnapshotMemory(m, fd, runs, h.runs);
+  free(runs);
+  close(fd);
+  m->ip = h.ip;
+  m->flags = h.flags;
+  m->mxcsr = h.mxcsr;
+  m->sigmask = h.sigmask;
+  m->signals = h.signals;
+  memcpy(m->beg, h.beg, sizeof(h.beg));
+  memcpy(m->xmm, h.xmm, sizeof(h.xmm));
+  memcpy(m->ymmh, h.ymmh, sizeof(h.ymmh));
+  m->xcr0 = h.xcr0;
+  memcpy(m->seg, h.seg, sizeof(h.seg));
+  m->fpu = h.fpu;
+  m->sigaltstack = h.sigaltstack;
+  m->robust_list = h.robust_list;
+  m->ctid = h.ctid;
+  s->brk = h.brk;
+  s->automap = h.automap;
+  s->vdso = h.vdso;
+  s->codestart = h.codestart;
+  s->codesize = h.codesize;
+  s->iscosmo = h.iscosmo;
+  s->brkchanged = h.brkchanged;
+  elf = h.elf;
+  elf.prog = p[0];
+  elf.execfn = p[1];
+  elf.interpreter = p[2];
+  s->elf = elf;
+  memcpy(s->hands, h.hands, sizeof(h.hands));
+  memcpy(s->rlim, h.rlim, sizeof(h.rlim));
+  RestoreSignalHandlers(s);
+  s->loaded = true;
+#ifndef DISABLE_VFS
+  unassert(!ProcfsRegisterExe(getpid(), s->elf.prog));
+#endif
+  SYS_LOGF("restored snapshot %s", FLAG_snapshot);
+  return true;
+Corrupt:
+  ERRF("%s: corrupt snapshot", FLAG_snapshot);
+  exit(127);
+}
@@ -0,0 +1,10 @@
+#ifndef BLINK_SNAPSHOT_H_
+#define BLINK_SNAPSHOT_H_
+#include <stdbool.h>
+
+#include "blink/machine.h"
+
+int TakeSnapshot(struct Machine *);
+bool RestoreSnapshot(struct Machine *, const char *, char **);
+
+#endif /* BLINK_SNAPSHOT_H_ */
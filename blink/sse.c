@@ -598,6 +598,12 @@ static void SsePalignr(u8 x[16], const u8 y[16], unsigned k) {
 static void SsePsubd(u8 x[16], const u8 y[16]) {
 #if X86_INTRINSICS
   asm("psubd\t%1,%0" : "+x"(*(char_xmma_t *)x) : "xm"(*(const char_xmma_t *)y));
+#elif VECTOR_EXTENSIONS
+  u32x4_t a, b;
+  memcpy(&a, x, 16);
+  memcpy(&b, y, 16);
+  a -= b;
+  memcpy(x, &a, 16);
 #else
   unsigned i;
   for (i = 0; i < 4; ++i) {
@@ -609,6 +615,12 @@ static void SsePsubd(u8 x[16], const u8 y[16]) {
 static void SsePaddd(u8 x[16], const u8 y[16]) {
 #if X86_INTRINSICS
   asm("paddd\t%1,%0" : "+x"(*(char_xmma_t *)x) : "xm"(*(const char_xmma_t *)y));
+#elif VECTOR_EXTENSIONS
+  u32x4_t a, b;
+  memcpy(&a, x, 16);
+  memcpy(&b, y, 16);
+  a += b;
+  memcpy(x, &a, 16);
 #else
   unsigned i;
   for (i = 0; i < 4; ++i) {
@@ -620,6 +632,12 @@ static void SsePaddd(u8 x[16], const u8 y[16]) {
 static void SsePaddq(u8 x[16], const u8 y[16]) {
 #if X86_INTRINSICS
   asm("paddq\t%1,%0" : "+x"(*(char_xmma_t *)x) : "xm"(*(const char_xmma_t *)y));
+#elif VECTOR_EXTENSIONS
+  u64x2_t a, b;
+  memcpy(&a, x, 16);
+  memcpy(&b, y, 16);
+  a += b;
+  memcpy(x, &a, 16);
 #else
   unsigned i;
   for (i = 0; i < 2; ++i) {
@@ -631,6 +649,12 @@ static void SsePaddq(u8 x[16], const u8 y[16]) {
 static void SsePsubq(u8 x[16], const u8 y[16]) {
 #if X86_INTRINSICS
   asm("psubq\t%1,%0" : "+x"(*(char_xmma_t *)x) : "xm"(*(const char_xmma_t *)y));
+#elif VECTOR_EXTENSIONS
+  u64x2_t a, b;
+  memcpy(&a, x, 16);
+  memcpy(&b, y, 16);
+  a -= b;
+  memcpy(x, &a, 16);
 #else
   unsigned i;
   for (i = 0; i < 2; ++i) {
@@ -1004,43 +1028,123 @@ static void SsePunpckhqdq(u8 x[16], const u8 y[16]) {
 }
 
 static void SsePsrlw(u8 x[16], unsigned k) {
+#if VECTOR_EXTENSIONS
+  u16x8_t v;
+  if (k < 16) {
+    memcpy(&v, x, 16);
+    v >>= k;
+    memcpy(x, &v, 16);
+  } else {
+    memset(x, 0, 16);
+  }
+#else
   MmxPsrlw(x + 0, k);
   MmxPsrlw(x + 8, k);
+#endif
 }
 
 static void SsePsraw(u8 x[16], unsigned k) {
+#if VECTOR_EXTENSIONS
+  i16x8_t v;
+  memcpy(&v, x, 16);
+  v >>= MIN(k, 15);
+  memcpy(x, &v, 16);
+#else
   MmxPsraw(x + 0, k);
   MmxPsraw(x + 8, k);
+#endif
 }
 
 static void SsePsllw(u8 x[16], unsigned k) {
+#if VECTOR_EXTENSIONS
+  u16x8_t v;
+  if (k < 16) {
+    memcpy(&v, x, 16);
+    v <<= k;
+    memcpy(x, &v, 16);
+  } else {
+    memset(x, 0, 16);
+  }
+#else
   MmxPsllw(x + 0, k);
   MmxPsllw(x + 8, k);
+#endif
 }
 
 static void SsePsrld(u8 x[16], unsigned k) {
+#if VECTOR_EXTENSIONS
+  u32x4_t v;
+  if (k < 32) {
+    memcpy(&v, x, 16);
+    v >>= k;
+    memcpy(x, &v, 16);
+  } else {
+    memset(x, 0, 16);
+  }
+#else
   MmxPsrld(x + 0, k);
   MmxPsrld(x + 8, k);
+#endif
 }
 
 static void SsePsrad(u8 x[16], unsigned k) {
+#if VECTOR_EXTENSIONS
+  i32x4_t v;
+  memcpy(&v, x, 16);
+  v >>= MIN(k, 31);
+  memcpy(x, &v, 16);
+#else
   MmxPsrad(x + 0, k);
   MmxPsrad(x + 8, k);
+#endif
 }
 
 static void SsePslld(u8 x[16], unsigned k) {
+#if VECTOR_EXTENSIONS
+  u32x4_t v;
+  if (k < 32) {
+    memcpy(&v, x, 16);
+    v <<= k;
+    memcpy(x, &v, 16);
+  } else {
+    memset(x, 0, 16);
+  }
+#else
   MmxPslld(x + 0, k);
   MmxPslld(x + 8, k);
+#endif
 }
 
 static void SsePsrlq(u8 x[16], unsigned k) {
+#if VECTOR_EXTENSIONS
+  u64x2_t v;
+  if (k < 64) {
+    memcpy(&v, x, 16);
+    v >>= k;
+    memcpy(x, &v, 16);
+  } else {
+    memset(x, 0, 16);
+  }
+#else
   MmxPsrlq(x + 0, k);
   MmxPsrlq(x + 8, k);
+#endif
 }
 
 static void SsePsllq(u8 x[16], unsigned k) {
+#if VECTOR_EXTENSIONS
+  u64x2_t v;
+  if (k < 64) {
+    memcpy(&v, x, 16);
+    v <<= k;
+    memcpy(x, &v, 16);
+  } else {
+    memset(x, 0, 16);
+  }
+#else
   MmxPsllq(x + 0, k);
   MmxPsllq(x + 8, k);
+#endif
 }
 
 static void SsePsubsb(u8 x[16], const u8 y[16]) {
@@ -1211,6 +1315,12 @@ static void SsePcmpgtd(u8 x[16], const u8 y[16]) {
   asm("pcmpgtd\t%1,%0"
       : "+x"(*(char_xmma_t *)x)
       : "xm"(*(const char_xmma_t *)y));
+#elif VECTOR_EXTENSIONS
+  i32x4_t a, b;
+  memcpy(&a, x, 16);
+  memcpy(&b, y, 16);
+  a = a > b;
+  memcpy(x, &a, 16);
 #else
   MmxPcmpgtd(x + 0, y + 0);
   MmxPcmpgtd(x + 8, y + 8);
@@ -1222,6 +1332,12 @@ static void SsePcmpeqd(u8 x[16], const u8 y[16]) {
   asm("pcmpeqd\t%1,%0"
       : "+x"(*(char_xmma_t *)x)
       : "xm"(*(const char_xmma_t *)y));
+#elif VECTOR_EXTENSIONS
+  i32x4_t a, b;
+  memcpy(&a, x, 16);
+  memcpy(&b, y, 16);
+  a = a == b;
+  memcpy(x, &a, 16);
 #else
   MmxPcmpeqd(x + 0, y + 0);
   MmxPcmpeqd(x + 8, y + 8);
@@ -1506,7 +1622,7 @@ void OpSse(P, void MmxKernel(u8[8], const u8[8]),
 #endif
   }
   IGNORE_RACES_END();
-  if (IsMakingPath(m)) {
+  if (IsMakingPath(m) && !JitSseOp(A)) {
     Jitter(A,
            "z4P"    // res0 = GetXmmOrMemPointer(RexbRm)
            "r0s1="  // sav1 = res0
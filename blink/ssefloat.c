@@ -23,6 +23,7 @@
 #include "blink/endian.h"
 #include "blink/flags.h"
 #include "blink/fpu.h"
+#include "blink/intrin.h"
 #include "blink/machine.h"
 #include "blink/macros.h"
 #include "blink/modrm.h"
@@ -107,7 +108,7 @@ void OpUnpckhpsd(P) {
   b = GetModrmRegisterXmmPointerRead16(A);
   IGNORE_RACES_START();
   if (Osz(rde)) {
-    memcpy(a + 0, b + 8, 8);
+    memcpy(a + 0, a + 8, 8);
     memcpy(a + 8, b + 8, 8);
   } else {
     memcpy(a + 4 * 0, a + 4 * 2, 4);
@@ -122,7 +123,7 @@ void OpPextrwGdqpUdqIb(P) {
   u8 i;
   i = uimm0;
   i &= Osz(rde) ? 7 : 3;
-  Put16(RegRexrReg(m, rde), Get16(XmmRexbRm(m, rde) + i * 2));
+  Put64(RegRexrReg(m, rde), Get16(XmmRexbRm(m, rde) + i * 2));
 }
 
 void OpPinsrwVdqEwIb(P) {
@@ -441,13 +442,79 @@ void OpComissVsWs(P) {
   IGNORE_RACES_END();
 }
 
+#if VECTOR_EXTENSIONS
+static void OpPsVector(u64 rde, u8 x[16], const u8 y[16]) {
+  i32x4_t k;
+  f32x4_t a, b;
+  memcpy(&a, x, 16);
+  memcpy(&b, y, 16);
+  switch (Opcode(rde)) {
+    case 0x58:
+      a += b;
+      break;
+    case 0x59:
+      a *= b;
+      break;
+    case 0x5C:
+      a -= b;
+      break;
+    case 0x5E:
+      a /= b;
+      break;
+    case 0x5D:  // yields second operand if unordered, like MIN()
+      k = a < b;
+      a = (f32x4_t)((k & (i32x4_t)a) | (~k & (i32x4_t)b));
+      break;
+    case 0x5F:  // yields second operand if unordered, like MAX()
+      k = a > b;
+      a = (f32x4_t)((k & (i32x4_t)a) | (~k & (i32x4_t)b));
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  memcpy(x, &a, 16);
+}
+
+static void OpPdVector(u64 rde, u8 x[16], const u8 y[16]) {
+  i64x2_t k;
+  f64x2_t a, b;
+  memcpy(&a, x, 16);
+  memcpy(&b, y, 16);
+  switch (Opcode(rde)) {
+    case 0x58:
+      a += b;
+      break;
+    case 0x59:
+      a *= b;
+      break;
+    case 0x5C:
+      a -= b;
+      break;
+    case 0x5E:
+      a /= b;
+      break;
+    case 0x5D:
+      k = a < b;
+      a = (f64x2_t)((k & (i64x2_t)a) | (~k & (i64x2_t)b));
+      break;
+    case 0x5F:
+      k = a > b;
+      a = (f64x2_t)((k & (i64x2_t)a) | (~k & (i64x2_t)b));
+      break;
+    default:
+      __builtin_unreachable();
+  }
+  memcpy(x, &a, 16);
+}
+#endif
+
 static void OpPsd(P, float fs(float x, float y), double fd(double x, double y),
                   void s1(u8 *, struct Machine *, long),
                   void d1(u8 *, struct Machine *, long)) {
   IGNORE_RACES_START();
   if (Rep(rde) == 2) {
     d1(GetModrmRegisterXmmPointerRead8(A), m, RexrReg(rde));
-    if (IsMakingPath(m)) {
+    if (IsMakingPath(m) && !JitSseOp(A)) {
       Jitter(A,
              "z4P"    // res0 = GetXmmOrMemPointer(RexbRm)
              "a2i"    // arg2 = RexrReg(rde)
@@ -462,7 +529,7 @@ static void OpPsd(P, float fs(float x, float y), double fd(double x, double y),
     x.i = Read32(XmmRexrReg(m, rde));
     x.f = fs(x.f, y.f);
     Write32(XmmRexrReg(m, rde), x.i);
-    if (IsMakingPath(m)) {
+    if (IsMakingPath(m) && !JitSseOp(A)) {
       Jitter(A,
              "z4P"    // res0 = GetXmmOrMemPointer(RexbRm)
              "a2i"    // arg2 = RexrReg(rde)
@@ -472,6 +539,9 @@ static void OpPsd(P, float fs(float x, float y), double fd(double x, double y),
              RexrReg(rde), s1);
     }
   } else if (Osz(rde)) {
+#if VECTOR_EXTENSIONS
+    OpPdVector(rde, XmmRexrReg(m, rde), GetModrmRegisterXmmPointerRead16(A));
+#else
     u8 *p;
     union DoublePun x[2], y[2];
     p = GetModrmRegisterXmmPointerRead16(A);
@@ -484,7 +554,12 @@ static void OpPsd(P, float fs(float x, float y), double fd(double x, double y),
     x[1].f = fd(x[1].f, y[1].f);
     Write64(p + 0 * 8, x[0].i);
     Write64(p + 1 * 8, x[1].i);
+#endif
+    if (IsMakingPath(m)) JitSseOp(A);
   } else {
+#if VECTOR_EXTENSIONS
+    OpPsVector(rde, XmmRexrReg(m, rde), GetModrmRegisterXmmPointerRead16(A));
+#else
     u8 *p;
     union FloatPun x[4], y[4];
     p = GetModrmRegisterXmmPointerRead16(A);
@@ -505,6 +580,8 @@ static void OpPsd(P, float fs(float x, float y), double fd(double x, double y),
     Write32(p + 1 * 4, x[1].i);
     Write32(p + 2 * 4, x[2].i);
     Write32(p + 3 * 4, x[3].i);
+#endif
+    if (IsMakingPath(m)) JitSseOp(A);
   }
   IGNORE_RACES_END();
 }
@@ -581,66 +658,65 @@ void OpMaxpsd(P) {
   OpPsd(A, Maxs, Maxd, OpPsdMaxs1, OpPsdMaxd1);
 }
 
-static int Cmps(int imm, float x, float y) {
-  switch (imm) {
-    case 0:
-      return x == y ? -1 : 0;
-    case 1:
-      return x < y ? -1 : 0;
-    case 2:
-      return x <= y ? -1 : 0;
-    case 3:
-      return isnan(x) || isnan(y) ? -1 : 0;
-    case 4:
-      return x != y ? -1 : 0;
-    case 5:
-      return x >= y ? -1 : 0;
-    case 6:
-      return x > y ? -1 : 0;
-    case 7:
-      return !(isnan(x) || isnan(y)) ? -1 : 0;
-    default:
-      return 0;
-  }
-}
-
-static i32 Cmpd(int imm, double x, double y) {
-  switch (imm) {
-    case 0:
-      return x == y ? -1 : 0;
-    case 1:
-      return x < y ? -1 : 0;
-    case 2:
-      return x <= y ? -1 : 0;
-    case 3:
-      return isnan(x) || isnan(y) ? -1 : 0;
-    case 4:
-      return x != y ? -1 : 0;
-    case 5:
-      return x >= y ? -1 : 0;
-    case 6:
-      return x > y ? -1 : 0;
-    case 7:
-      return !(isnan(x) || isnan(y)) ? -1 : 0;
-    default:
-      return 0;
+// evaluates comparison predicate, where avx has 32 of them, and sse
+// only has the first eight, which treat qnans as avx would ignoring
+// whether the predicate signals on qnans, since mxcsr isn't updated
+static bool IsCmpTrue(int imm, double x, double y) {
+  bool lt, eq, gt, un;
+  lt = x < y;
+  eq = x == y;
+  gt = x > y;
+  un = isunordered(x, y);
+  switch (imm & 15) {
+    case 0:  // eq_oq
+      return eq;
+    case 1:  // lt_os
+      return lt;
+    case 2:  // le_os
+      return lt || eq;
+    case 3:  // unord_q
+      return un;
+    case 4:  // neq_uq
+      return !eq;
+    case 5:  // nlt_us
+      return !lt;
+    case 6:  // nle_us
+      return !lt && !eq;
+    case 7:  // ord_q
+      return !un;
+    case 8:  // eq_uq
+      return eq || un;
+    case 9:  // nge_us
+      return !gt && !eq;
+    case 10:  // ngt_us
+      return !gt;
+    case 11:  // false_oq
+      return false;
+    case 12:  // neq_oq
+      return !eq && !un;
+    case 13:  // ge_os
+      return gt || eq;
+    case 14:  // gt_os
+      return gt;
+    default:  // true_uq
+      return true;
   }
 }
 
 void OpCmppsd(P) {
   IGNORE_RACES_START();
-  int imm = uimm0;
+  int imm = uimm0 & (Vex(rde) ? 31 : 7);
   if (Rep(rde) == 2) {
     union DoublePun x, y;
     y.i = Read64(GetModrmRegisterXmmPointerRead8(A));
     x.i = Read64(XmmRexrReg(m, rde));
-    x.f = Cmpd(imm, x.f, y.f);
+    x.i = -IsCmpTrue(imm, x.f, y.f);
     Write64(XmmRexrReg(m, rde), x.i);
   } else if (Rep(rde) == 3) {
     union FloatPun x, y;
     y.i = Read32(GetModrmRegisterXmmPointerRead4(A));
     x.i = Read32(XmmRexrReg(m, rde));
-    x.f = Cmps(imm, x.f, y.f);
+    x.i = -IsCmpTrue(imm, x.f, y.f);
     Write32(XmmRexrReg(m, rde), x.i);
   } else if (Osz(rde)) {
     u8 *p;
@@ -651,8 +727,8 @@ void OpCmppsd(P) {
     p = XmmRexrReg(m, rde);
     x[0].i = Read64(p + 0 * 8);
     x[1].i = Read64(p + 1 * 8);
-    x[0].f = Cmpd(imm, x[0].f, y[0].f);
-    x[1].f = Cmpd(imm, x[1].f, y[1].f);
+    x[0].i = -IsCmpTrue(imm, x[0].f, y[0].f);
+    x[1].i = -IsCmpTrue(imm, x[1].f, y[1].f);
     Write64(p + 0 * 8, x[0].i);
     Write64(p + 1 * 8, x[1].i);
   } else {
@@ -668,10 +744,10 @@ void OpCmppsd(P) {
     x[1].i = Read32(p + 1 * 4);
     x[2].i = Read32(p + 2 * 4);
     x[3].i = Read32(p + 3 * 4);
-    x[0].f = Cmps(imm, x[0].f, y[0].f);
-    x[1].f = Cmps(imm, x[1].f, y[1].f);
-    x[2].f = Cmps(imm, x[2].f, y[2].f);
-    x[3].f = Cmps(imm, x[3].f, y[3].f);
+    x[0].i = -IsCmpTrue(imm, x[0].f, y[0].f);
+    x[1].i = -IsCmpTrue(imm, x[1].f, y[1].f);
+    x[2].i = -IsCmpTrue(imm, x[2].f, y[2].f);
+    x[3].i = -IsCmpTrue(imm, x[3].f, y[3].f);
     Write32(p + 0 * 4, x[0].i);
     Write32(p + 1 * 4, x[1].i);
     Write32(p + 2 * 4, x[2].i);
@@ -689,6 +765,7 @@ void OpAndpsd(P) {
   x[1] &= y[1];
   memcpy(XmmRexrReg(m, rde), x, 16);
   IGNORE_RACES_END();
+  if (IsMakingPath(m)) JitSseOp(A);
 }
 
 void OpAndnpsd(P) {
@@ -700,6 +777,7 @@ void OpAndnpsd(P) {
   x[1] = ~x[1] & y[1];
   memcpy(XmmRexrReg(m, rde), x, 16);
   IGNORE_RACES_END();
+  if (IsMakingPath(m)) JitSseOp(A);
 }
 
 void OpOrpsd(P) {
@@ -711,6 +789,7 @@ void OpOrpsd(P) {
   x[1] |= y[1];
   memcpy(XmmRexrReg(m, rde), x, 16);
   IGNORE_RACES_END();
+  if (IsMakingPath(m)) JitSseOp(A);
 }
 
 void OpXorpsd(P) {
@@ -722,6 +801,7 @@ void OpXorpsd(P) {
   x[1] ^= y[1];
   memcpy(XmmRexrReg(m, rde), x, 16);
   IGNORE_RACES_END();
+  if (IsMakingPath(m)) JitSseOp(A);
 }
 
 void OpHaddpsd(P) {
@@ -0,0 +1,269 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/assert.h"
+#include "blink/builtin.h"
+#include "blink/jit.h"
+#include "blink/machine.h"
+#include "blink/modrm.h"
+#include "blink/rde.h"
+#include "blink/stats.h"
+
+/**
+ * @fileoverview Native Vector Kernels.
+ *
+ * SSE2 is part of the x86-64 baseline, so when blink runs on such a
+ * host, vector ops with identical host semantics are compiled into the
+ * very same instruction operating on %xmm0 and %xmm1, rather than being
+ * a call to a C kernel that loops over the lanes. The guest's register
+ * file stays in struct Machine, so each op loads and stores its xmm
+ * destination, which is cheap compared to the call it replaces.
+ *
+ * Conversions between floating point and integers work the same way,
+ * since the host's rounding mode is kept in sync with the guest mxcsr
+ * by SyncRounding(), which means no helper needs to consult it.
+ */
+
+#if defined(HAVE_JIT) && defined(__x86_64__)
+
+// returns true if op is an sse2 integer op taking xmm,xmm/m128
+static bool IsNativeSse2Integer(u64 rde) {
+  if (!Osz(rde) || Rep(rde)) return false;
+  switch (Mopcode(rde)) {
+    case 0x160 ... 0x16D:  // punpck, packss, packus, pcmpgt
+    case 0x174 ... 0x176:  // pcmpeq
+    case 0x1D1 ... 0x1D5:  // psrl, paddq, pmullw
+    case 0x1D8 ... 0x1DF:  // psubus, pminub, pand, paddus, pmaxub, pandn
+    case 0x1E0 ... 0x1E5:  // pavg, psra, pmulh
+    case 0x1E8 ... 0x1EF:  // psubs, pminsw, por, padds, pmaxsw, pxor
+    case 0x1F1 ... 0x1F6:  // psll, pmuludq, pmaddwd, psadbw
+    case 0x1F8 ... 0x1FE:  // psub, padd
+      return true;
+    default:
+      return false;
+  }
+}
+
+// returns true if op is an sse/sse2 floating point arithmetic op
+static bool IsNativeSseFloat(u64 rde) {
+  switch (Mopcode(rde)) {
+    case 0x158:  // add
+    case 0x159:  // mul
+    case 0x15C:  // sub
+    case 0x15D:  // min
+    case 0x15E:  // div
+    case 0x15F:  // max
+      return true;
+    case 0x154:  // and
+    case 0x155:  // andn
+    case 0x156:  // or
+    case 0x157:  // xor
+      return !Rep(rde);
+    default:
+      return false;
+  }
+}
+
+// returns true if op is pclmulqdq, which the host is able to run too
+static bool IsNativeClmul(u64 rde) {
+  return Mopcode(rde) == 0x344 && Osz(rde) && HasHostClmul();
+}
+
+static u8 *EmitSse(u8 *p, u8 prefix, u8 op, int reg, int rm, bool mem) {
+  if (prefix) *p++ = prefix;
+  *p++ = 0x0F;
+  *p++ = op;
+  *p++ = (mem ? 0000 : 0300) | reg << 3 | rm;
+  return p;
+}
+
+/**
+ * Generates native code implementing sse operation, if possible.
+ *
+ * @return true if code was generated, otherwise false in which case
+ *     nothing was appended and the caller should fall back to calling
+ *     its portable kernel
+ */
+bool JitSseOp(P) {
+  u8 code[20], *p = code, prefix;
+  if (!IsMakingPath(m)) return false;
+  if (!IsNativeSse2Integer(rde) && !IsNativeSseFloat(rde) &&
+      !IsNativeClmul(rde)) {
+    return false;
+  }
+  // reserving 16 bytes for a scalar operand could fault spuriously
+  if (Rep(rde) && !IsModrmRegister(rde) && !HasLinearMapping()) return false;
+  _Static_assert(kJitArg0 < 8 && kJitArg0 != 4 && kJitArg0 != 5, "");
+  _Static_assert(kJitArg1 < 8 && kJitArg1 != 4 && kJitArg1 != 5, "");
+  Jitter(A,
+         "z4P"    // res0 = GetXmmOrMemPointer(RexbRm)
+         "r0s1="  // sav1 = res0
+         "z4Q"    // res0 = GetXmmPointer(RexrReg)
+         "s1a1="  // arg1 = sav1
+         "t");    // arg0 = res0
+  // the host instructions below may fault on the memory operand
+  FlushJitRegs(m);
+  if (Rep(rde)) {
+    // scalar ops don't require alignment, so use the operand directly
+    prefix = Rep(rde) == 3 ? 0xF3 : 0xF2;
+    p = EmitSse(p, prefix, 0x10, 0, kJitArg0, true);         // movs (a0),%xmm0
+    p = EmitSse(p, prefix, Opcode(rde), 0, kJitArg1, true);  // op (a1),%xmm0
+    p = EmitSse(p, prefix, 0x11, 0, kJitArg0, true);         // movs %xmm0,(a0)
+  } else if (Mopcode(rde) == 0x344) {
+    p = EmitSse(p, 0xF3, 0x6F, 0, kJitArg0, true);  // movdqu (a0),%xmm0
+    p = EmitSse(p, 0xF3, 0x6F, 1, kJitArg1, true);  // movdqu (a1),%xmm1
+    *p++ = 0x66;                                    // pclmulqdq $i,%xmm1,%xmm0
+    *p++ = 0x0F;
+    *p++ = 0x3A;
+    *p++ = 0x44;
+    *p++ = 0300 | 0 << 3 | 1;
+    *p++ = uimm0;
+    p = EmitSse(p, 0xF3, 0x7F, 0, kJitArg0, true);  // movdqu %xmm0,(a0)
+  } else {
+    // packed ops want 16-byte alignment, which guests needn't honor
+    prefix = Osz(rde) ? 0x66 : 0;
+    p = EmitSse(p, 0xF3, 0x6F, 0, kJitArg0, true);     // movdqu (a0),%xmm0
+    p = EmitSse(p, 0xF3, 0x6F, 1, kJitArg1, true);     // movdqu (a1),%xmm1
+    p = EmitSse(p, prefix, Opcode(rde), 0, 1, false);  // op %xmm1,%xmm0
+    p = EmitSse(p, 0xF3, 0x7F, 0, kJitArg0, true);     // movdqu %xmm0,(a0)
+  }
+  AppendJit(m->path.jb, code, p - code);
+  STATISTIC(++sse_native_ops);
+  return true;
+}
+
+// returns bytes read by sse conversion op from its xmm/mem source, or
+// zero if it's a form which isn't supported natively, e.g. mmx ones
+static int GetNativeCvtSize(u64 rde) {
+  switch (Mopcode(rde)) {
+    case 0x12C:  // cvttss2si, cvttsd2si
+    case 0x12D:  // cvtss2si, cvtsd2si
+      return Rep(rde) == 3 ? 4 : Rep(rde) == 2 ? 8 : 0;
+    case 0x15A:  // cvtps2pd, cvtpd2ps, cvtss2sd, cvtsd2ss
+      return Rep(rde) == 3 ? 4 : Rep(rde) == 2 || !Osz(rde) ? 8 : 16;
+    case 0x15B:  // cvtdq2ps, cvtps2dq, cvttps2dq
+      return Rep(rde) == 2 ? 0 : 16;
+    case 0x1E6:  // cvttpd2dq, cvtpd2dq, cvtdq2pd
+      return Rep(rde) == 3 ? 8 : Rep(rde) || Osz(rde) ? 16 : 0;
+    default:
+      return 0;
+  }
+}
+
+// loads size bytes at (reg) into the low part of %xmm<xmm>
+static u8 *EmitSseLoad(u8 *p, int size, int xmm, int reg) {
+  switch (size) {
+    case 4:
+      return EmitSse(p, 0xF3, 0x10, xmm, reg, true);  // movss
+    case 8:
+      return EmitSse(p, 0xF3, 0x7E, xmm, reg, true);  // movq
+    default:
+      return EmitSse(p, 0xF3, 0x6F, xmm, reg, true);  // movdqu
+  }
+}
+
+/**
+ * Generates native code implementing sse conversion, if possible.
+ *
+ * @return true if code was generated, otherwise false in which case
+ *     nothing was appended and the caller should fall back
+ */
+bool JitSseCvt(P) {
+  int size;
+  u8 code[24], *p = code, prefix;
+  if (!IsMakingPath(m)) return false;
+  prefix = Rep(rde) == 3 ? 0xF3 : Rep(rde) == 2 ? 0xF2 : Osz(rde) ? 0x66 : 0;
+  if (Mopcode(rde) == 0x12A) {
+    // cvtsi2ss, cvtsi2sd
+    if (Rep(rde) < 2) return false;
+    if (Rexw(rde)) {
+      Jitter(A, "z3B");  // res0 = GetRegOrMem[force64bit](RexbRm)
+    } else {
+      Jitter(A, "z2B");  // res0 = GetRegOrMem[force32bit](RexbRm)
+    }
+    Jitter(A,
+           "r0s1="  // sav1 = res0
+           "z4Q"    // res0 = GetXmmPointer(RexrReg)
+           "s1a1="  // arg1 = sav1
+           "t");    // arg0 = res0
+    p = EmitSse(p, 0xF3, 0x6F, 0, kJitArg0, true);  // movdqu (a0),%xmm0
+    *p++ = prefix;
+    if (Rexw(rde)) *p++ = kAmdRexw;
+    *p++ = 0x0F;
+    *p++ = 0x2A;
+    *p++ = 0300 | 0 << 3 | kJitArg1;                // cvtsi2s a1,%xmm0
+    p = EmitSse(p, 0xF3, 0x7F, 0, kJitArg0, true);  // movdqu %xmm0,(a0)
+    AppendJit(m->path.jb, code, p - code);
+  } else if ((size = GetNativeCvtSize(rde))) {
+    // reserving 16 bytes for a smaller operand could fault spuriously
+    if (size < 16 && !IsModrmRegister(rde) && !HasLinearMapping()) {
+      return false;
+    }
+    if (Mopcode(rde) == 0x12C || Mopcode(rde) == 0x12D) {
+      Jitter(A,
+             "z4P"  // res0 = GetXmmOrMemPointer(RexbRm)
+             "t");  // arg0 = res0
+      // the host instructions below may fault on the memory operand
+      if (!IsModrmRegister(rde)) FlushJitRegs(m);
+      p = EmitSseLoad(p, size, 0, kJitArg0);  // movs (a0),%xmm0
+      *p++ = prefix;
+      if (Rexw(rde)) *p++ = kAmdRexw;
+      *p++ = 0x0F;
+      *p++ = Opcode(rde);
+      *p++ = 0300 | kJitRes0 << 3 | 0;  // cvts2si %xmm0,r0
+      AppendJit(m->path.jb, code, p - code);
+      if (Rexw(rde)) {
+        Jitter(A, "r0z3C");  // PutReg[force64bit](RexrReg, res0)
+      } else {
+        Jitter(A, "r0z2C");  // PutReg[force32bit](RexrReg, res0)
+      }
+    } else {
+      Jitter(A,
+             "z4P"    // res0 = GetXmmOrMemPointer(RexbRm)
+             "r0s1="  // sav1 = res0
+             "z4Q"    // res0 = GetXmmPointer(RexrReg)
+             "s1a1="  // arg1 = sav1
+             "t");    // arg0 = res0
+      // the host instructions below may fault on the memory operand
+      if (!IsModrmRegister(rde)) FlushJitRegs(m);
+      // legacy packed ops want 16-byte alignment, which guests needn't
+      // honor, and the scalar ones merge into the destination register
+      p = EmitSseLoad(p, size, 1, kJitArg1);          // mov (a1),%xmm1
+      p = EmitSse(p, 0xF3, 0x6F, 0, kJitArg0, true);  // movdqu (a0),%xmm0
+      p = EmitSse(p, prefix, Opcode(rde), 0, 1, false);  // cvt %xmm1,%xmm0
+      p = EmitSse(p, 0xF3, 0x7F, 0, kJitArg0, true);  // movdqu %xmm0,(a0)
+      AppendJit(m->path.jb, code, p - code);
+    }
+  } else {
+    return false;
+  }
+  STATISTIC(++sse_native_cvts);
+  return true;
+}
+
+#else
+
+bool JitSseOp(P) {
+  return false;
+}
+
+bool JitSseCvt(P) {
+  return false;
+}
+
+#endif /* HAVE_JIT && __x86_64__ */
@@ -26,12 +26,16 @@
 #include "blink/macros.h"
 #include "blink/modrm.h"
 #include "blink/rde.h"
+#include "blink/stats.h"
 #include "blink/tsan.h"
 #include "blink/x86.h"
 
 static const u8 kStackOsz[2][3] = {{4, 4, 8}, {2, 2, 2}};
 static const u8 kCallOsz[2][3] = {{4, 4, 8}, {2, 2, 8}};
 
+// the stack micro-ops translate addresses using the compile-time skew
+#define HasFastStack() (HasLinearMapping() && !HasShadowMapping())
+
 static void WriteStackWord(u8 *p, u64 rde, u32 osz, u64 x) {
   IGNORE_RACES_START();
   if (osz == 8) {
@@ -115,7 +119,8 @@ void Push(P, u64 x) {
 void OpPushZvq(P) {
   int osz = kStackOsz[Osz(rde)][Mode(rde)];
   PushN(A, ReadStackWord(RegRexbSrm(m, rde), osz), Mode(rde), osz);
-  if (IsMakingPath(m) && HasLinearMapping() && !Osz(rde)) {
+  if (IsMakingPath(m) && HasFastStack() && !Osz(rde) &&
+      !FuseStackOps(A, false)) {
     Jitter(A,
            "a1i"
            "m",
@@ -168,7 +173,8 @@ void OpPopZvq(P) {
     default:
       __builtin_unreachable();
   }
-  if (IsMakingPath(m) && HasLinearMapping() && !Osz(rde)) {
+  if (IsMakingPath(m) && HasFastStack() && !Osz(rde) &&
+      !FuseStackOps(A, true)) {
     Jitter(A,
            "a1i"
            "m",
@@ -178,12 +184,64 @@ void OpPopZvq(P) {
 
 static void OpCall(P, u64 func) {
   PushN(A, m->ip, Mode(rde), kCallOsz[Osz(rde)][Mode(rde)]);
+  PushShadow(m, m->ip);
   m->ip = func;
 }
 
+// generates code for the end of a path which goes to the jit path at
+// the address an indirect branch took while the path was being made,
+// provided the uop reports it went there again. when it goes anywhere
+// else, the lookup uop is consulted for the jit path it went to last
+// time, before giving up and returning through the interpreter loop.
+static void PredictBranch(P, void *uop, void *lookup) {
+  STATISTIC(++path_predicted);
+#ifdef __x86_64__
+  Jitter(A,
+         "a1i"  // arg1 = prediction
+         "m"    // call micro-op
+         "q",   // arg0 = machine
+         m->ip, uop);
+  AlignJit(m->path.jb, 8, 3);
+  u8 code[] = {
+      0x48, 0x85, 0300 | kJitRes0 << 3 | kJitRes0,  // test %rax,%rax
+      0x75, 0x05,                                   // jnz   +5
+  };
+#else
+  Jitter(A,
+         "a1i"    // arg1 = prediction
+         "m"      // call micro-op
+         "r0a2="  // arg2 = res0
+         "q",     // arg0 = machine
+         m->ip, uop);
+  u32 code[] = {
+      0xb5000000 | (8 / 4) << 5 | kJitArg2,  // cbnz x2,#8
+  };
+#endif
+  AppendJit(m->path.jb, code, sizeof(code));
+  Connect(A, m->ip, true);
+  Jitter(A,
+         "c",  // res0 = call lookup (it has branches so can't be inlined)
+         lookup);
+#ifdef __x86_64__
+  u8 jump[] = {
+      0x48, 0x85, 0300 | kJitRes0 << 3 | kJitRes0,  // test %rax,%rax
+      0x74, 0x02,                                   // jz   +2
+      0xff, 0340 | kJitRes0,                        // jmp  *%rax
+  };
+#else
+  u32 jump[] = {
+      0xb4000000 | (8 / 4) << 5 | kJitRes0,  // cbz x0,#8
+      0xd61f0000 | kJitRes0 << 5,            // br  x0
+  };
+#endif
+  AppendJit(m->path.jb, jump, sizeof(jump));
+  AppendJitJump(m->path.jb, (void *)m->system->ender);
+  FinishPath(m);
+}
+
 void OpCallJvds(P) {
   OpCall(A, m->ip + disp);
-  if (HasLinearMapping() && IsMakingPath(m)) {
+  if (HasFastStack() && IsMakingPath(m)) {
     Terminate(A, FastCall);
   }
 }
@@ -193,26 +251,58 @@ static u64 LoadAddressFromMemory(P) {
   return ReadMemWord(GetModrmRegisterWordPointerRead(A, osz), osz);
 }
 
+// returns true if branch goes through a global offset table slot, e.g.
+// `jmp *foo@GOTPCREL(%rip)` in a plt stub, whose address is constant
+static bool IsGotBranch(P) {
+  return HasFastStack() && Mode(rde) == XED_MODE_LONG &&
+         Eamode(rde) == XED_MODE_LONG && IsRipRelative(rde) && !Sego(rde);
+}
+
+// generates code that loads the target of an indirect branch into res0
+// which for got slots skips the generic operand fetch and translation,
+// so paths into dynamically linked functions reduce to one load and a
+// comparison with the address the slot held while the path was built
+static void LoadBranchTarget(P) {
+  if (IsGotBranch(A)) {
+    STATISTIC(++path_predicted_got);
+    Jitter(A,
+           "q"    // arg0 = machine
+           "a1i"  // arg1 = got slot address
+           "m",   // res0 = FastLoadGot(machine, got)
+           (u64)ComputeAddress(A), FastLoadGot);
+  } else {
+    Jitter(A, "z3B");  // res0 = GetRegOrMem[force64bit](RexbRm)
+  }
+}
+
 void OpCallEq(P) {
-  if (IsMakingPath(m) && HasLinearMapping() && !Osz(rde)) {
+  if (IsMakingPath(m) && HasFastStack() && !Osz(rde)) {
+    LoadBranchTarget(A);
     Jitter(A,
-           "z3B"    // res0 = GetRegOrMem[force64bit](RexbRm)
            "s0a1="  // arg1 = machine
            "t"      // arg0 = res0
-           "m",     // call micro-op (FastCallAbs)
+           "m"      // call micro-op (FastCallAbs)
+           "q",     // arg0 = machine
            FastCallAbs);
+    OpCall(A, LoadAddressFromMemory(A));
+    PredictBranch(A, (void *)PredictJmp, (void *)LookupJmp);
+    return;
   }
   OpCall(A, LoadAddressFromMemory(A));
 }
 
 void OpJmpEq(P) {
   if (IsMakingPath(m) && HasLinearMapping() && !Osz(rde)) {
+    LoadBranchTarget(A);
     Jitter(A,
-           "z3B"    // res0 = GetRegOrMem[force64bit](RexbRm)
            "s0a1="  // arg1 = machine
            "t"      // arg0 = res0
-           "m",     // call micro-op (FastJmpAbs)
+           "m"      // call micro-op (FastJmpAbs)
+           "q",     // arg0 = machine
            FastJmpAbs);
+    m->ip = LoadAddressFromMemory(A);
+    PredictBranch(A, (void *)PredictJmp, (void *)LookupJmp);
+    return;
   }
   m->ip = LoadAddressFromMemory(A);
 }
@@ -247,7 +337,7 @@ void OpLeave(P) {
     case 8:
       Put64(m->sp, Get64(m->bp));
       Put64(m->bp, Pop(A, 0));
-      if (HasLinearMapping() && IsMakingPath(m)) {
+      if (HasFastStack() && IsMakingPath(m)) {
         Jitter(A, "m", FastLeave);
       }
       break;
@@ -266,38 +356,15 @@ void OpLeave(P) {
 
 void OpRet(P) {
   m->ip = Pop(A, 0);
-  if (IsMakingPath(m) && HasLinearMapping() && !Osz(rde)) {
-#ifdef __x86_64__
-    Jitter(A,
-           "a1i"  // arg1 = prediction
-           "m"    // call micro-op (PredictRet)
-           "q",   // arg0 = machine
-           m->ip, PredictRet);
-    AlignJit(m->path.jb, 8, 3);
-    u8 code[] = {
-        0x48, 0x85, 0300 | kJitRes0 << 3 | kJitRes0,  // test %rax,%rax
-        0x75, 0x05,                                   // jnz   +5
-    };
-#else
-    Jitter(A,
-           "a1i"    // arg1 = prediction
-           "m"      // call micro-op (PredictRet)
-           "r0a2="  // arg2 = res0
-           "q",     // arg0 = machine
-           m->ip, PredictRet);
-    u32 code[] = {
-        0xb5000000 | (8 / 4) << 5 | kJitArg2,  // cbnz x2,#8
-    };
-#endif
-    AppendJit(m->path.jb, code, sizeof(code));
-    Connect(A, m->ip, true);
-    AppendJitJump(m->path.jb, (void *)m->system->ender);
-    FinishPath(m);
+  --m->shadow.i;
+  if (IsMakingPath(m) && HasFastStack() && !Osz(rde)) {
+    PredictBranch(A, (void *)PredictRet, (void *)LookupRet);
   }
 }
 
 relegated void OpRetIw(P) {
   m->ip = Pop(A, uimm0);
+  --m->shadow.i;
 }
 
 void OpPushEvq(P) {
@@ -18,28 +18,558 @@
 ╚─────────────────────────────────────────────────────────────────────────────*/
 #include "blink/stats.h"
 
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blink/bitscan.h"
+#include "blink/buffer.h"
+#include "blink/builtin.h"
+#include "blink/flag.h"
 #include "blink/log.h"
+#include "blink/macros.h"
+#include "blink/timespec.h"
+#include "blink/tunables.h"
 
+#define DEFINE_AVERAGE(S) _Thread_local struct Average S;
+#define DEFINE_MAXIMUM(S) _Thread_local long S;
+#define DEFINE_COUNTER(S) _Thread_local long S;
+#include "blink/stats.inc"
+#undef DEFINE_AVERAGE
+#undef DEFINE_MAXIMUM
+#undef DEFINE_COUNTER
+
+_Thread_local long syscall_counts[STATS_SYSCALLS];
+_Thread_local long opcode_interps[STATS_OPCODES];
+_Thread_local long opcode_jitted[STATS_OPCODES];
+_Thread_local long opcode_helpers[STATS_OPCODES];
+_Thread_local long path_sizes[STATS_PATHS];
+_Thread_local struct SyscallLatency *syscall_latency[STATS_SYSCALLS];
+_Thread_local u64 syscall_overhead;
+static _Thread_local int syscall_overhead_depth;
+
+static struct Stats {
+  pthread_mutex_t_ lock;
+  long syscall_counts[STATS_SYSCALLS];
+  long opcode_interps[STATS_OPCODES];
+  long opcode_jitted[STATS_OPCODES];
+  long opcode_helpers[STATS_OPCODES];
+  long path_sizes[STATS_PATHS];
+  struct SyscallLatency *syscall_latency[STATS_SYSCALLS];
 #define DEFINE_AVERAGE(S) struct Average S;
+#define DEFINE_MAXIMUM(S) long S;
 #define DEFINE_COUNTER(S) long S;
 #include "blink/stats.inc"
 #undef DEFINE_AVERAGE
+#undef DEFINE_MAXIMUM
 #undef DEFINE_COUNTER
+} g_stats = {
+    .lock = PTHREAD_MUTEX_INITIALIZER_,
+};
+
+#define kStatsTopOpcodes  24  // opcodes listed in statistics report
+#define kStatsTopSyscalls 24  // system calls listed in latency report
+#define kStatsStartups    16  // startup phases remembered by MarkStartup()
 
 #define APPEND(...) o += snprintf(b + o, n - o, __VA_ARGS__)
 
-void PrintStats(void) {
-#ifndef NDEBUG
+static void MergeAverage(struct Average *total, struct Average *part) {
+  if (part->i) {
+    total->a += (part->a - total->a) * part->i / (total->i + part->i);
+    total->i += part->i;
+    part->a = 0;
+    part->i = 0;
+  }
+}
+
+static void MergeLatency(struct SyscallLatency **total,
+                         struct SyscallLatency *part) {
+  int i;
+  if (!*total) {
+    *total = part;
+    return;
+  }
+  (*total)->name = part->name;
+  (*total)->calls += part->calls;
+  (*total)->host_nanos += part->host_nanos;
+  (*total)->overhead_nanos += part->overhead_nanos;
+  for (i = 0; i < STATS_BUCKETS; ++i) {
+    (*total)->host[i] += part->host[i];
+    (*total)->overhead[i] += part->overhead[i];
+  }
+  free(part);
+}
+
+// folds the calling thread's statistics into the process totals
+void FlushStats(void) {
+#ifndef TINY
+  int i;
+  if (!FLAG_statistics && !FLAG_metrics) return;
+  LOCK(&g_stats.lock);
+  for (i = 0; i < STATS_SYSCALLS; ++i) {
+    g_stats.syscall_counts[i] += syscall_counts[i];
+    syscall_counts[i] = 0;
+    if (syscall_latency[i]) {
+      MergeLatency(g_stats.syscall_latency + i, syscall_latency[i]);
+      syscall_latency[i] = 0;
+    }
+  }
+  for (i = 0; i < STATS_OPCODES; ++i) {
+    g_stats.opcode_interps[i] += opcode_interps[i];
+    g_stats.opcode_jitted[i] += opcode_jitted[i];
+    g_stats.opcode_helpers[i] += opcode_helpers[i];
+    opcode_interps[i] = 0;
+    opcode_jitted[i] = 0;
+    opcode_helpers[i] = 0;
+  }
+  for (i = 0; i < STATS_PATHS; ++i) {
+    g_stats.path_sizes[i] += path_sizes[i];
+    path_sizes[i] = 0;
+  }
+#define DEFINE_AVERAGE(S) MergeAverage(&g_stats.S, &S);
+#define DEFINE_MAXIMUM(S) g_stats.S = MAX(g_stats.S, S), S = 0;
+#define DEFINE_COUNTER(S) g_stats.S += S, S = 0;
+#include "blink/stats.inc"
+#undef DEFINE_AVERAGE
+#undef DEFINE_MAXIMUM
+#undef DEFINE_COUNTER
+  UNLOCK(&g_stats.lock);
+#endif
+}
+
+#ifndef TINY
+
+static u64 GetNanos(void) {
+  return ToNanoseconds(GetMonotonic());
+}
+
+// returns histogram bucket of duration, which has four buckets for each
+// power of two, so each one is within 25% of what its counts measured
+static int GetLatencyBucket(u64 x) {
+  int lg;
+  if (x < 4) return x;
+  lg = bsr(x);
+  return MIN((lg - 1) * 4 + ((x >> (lg - 2)) & 3), STATS_BUCKETS - 1);
+}
+
+// returns exclusive upper bound of durations counted by bucket
+static u64 GetLatencyBound(int i) {
+  if (i < 4) return i + 1;
+  return (u64)(5 + (i & 3)) << (i / 4 - 1);
+}
+
+// returns bucket of jit path size, for powers of two from 64 bytes up
+static int GetPathSizeBucket(long bytes) {
+  if (bytes < 64) return 0;
+  return MIN(bsr(bytes) - 5, STATS_PATHS - 1);
+}
+
+// returns exclusive upper bound of code bytes counted by bucket
+static long GetPathSizeBound(int i) {
+  return 64L << i;
+}
+
+// returns upper bound of duration that p percent of calls didn't exceed
+static u64 GetLatencyPercentile(const u32 *h, long calls, int p) {
+  int i;
+  long n, want;
+  want = (calls * p + 99) / 100;
+  for (n = i = 0; i < STATS_BUCKETS; ++i) {
+    if ((n += h[i]) >= want) {
+      return GetLatencyBound(i);
+    }
+  }
+  return GetLatencyBound(STATS_BUCKETS - 1);
+}
+
+static struct Startup {
+  int n;
+  u64 last;
+  struct {
+    const char *name;
+    u64 nanos;
+  } phase[kStatsStartups];
+} g_startup;
+
+#endif /* TINY */
+
+/**
+ * Ends phase of emulator startup, which -Z reports the duration of.
+ *
+ * The first call starts the clock, and each call after that attributes
+ * the time elapsed since the previous one to the phase named. This is
+ * only called by the main thread, before the guest starts running.
+ */
+void MarkStartup(const char *name) {
+#ifndef TINY
+  u64 now = GetNanos();
+  if (g_startup.last && g_startup.n < kStatsStartups) {
+    g_startup.phase[g_startup.n].name = name;
+    g_startup.phase[g_startup.n].nanos = now - g_startup.last;
+    ++g_startup.n;
+  }
+  g_startup.last = now;
+#endif
+}
+
+// starts measuring time that a system call spends translating data,
+// e.g. locking pages, copying memory, and building iovecs; nested or
+// disabled measurements return zero so they'll be ignored when ended
+u64 BeginSyscallOverhead(void) {
+#ifndef TINY
+  if ((FLAG_statistics || FLAG_metrics) && !syscall_overhead_depth++) {
+    return GetNanos();
+  }
+#endif
+  return 0;
+}
+
+// adds time since BeginSyscallOverhead() to syscall_overhead
+void EndSyscallOverhead(u64 start) {
+#ifndef TINY
+  if (FLAG_statistics || FLAG_metrics) {
+    --syscall_overhead_depth;
+    if (start) syscall_overhead += GetNanos() - start;
+  }
+#endif
+}
+
+// tallies a system call that took nanos, of which overhead wasn't host
+void RecordSyscallLatency(int sysno, const char *name, u64 nanos,
+                          u64 overhead) {
+#ifndef TINY
+  struct SyscallLatency *h;
+  if (sysno >= STATS_SYSCALLS) return;
+  if (!(h = syscall_latency[sysno])) {
+    if (!(h = (struct SyscallLatency *)calloc(1, sizeof(*h)))) return;
+    syscall_latency[sysno] = h;
+  }
+  overhead = MIN(overhead, nanos);
+  h->name = name;
+  h->calls += 1;
+  h->host_nanos += nanos - overhead;
+  h->overhead_nanos += overhead;
+  h->host[GetLatencyBucket(nanos - overhead)] += 1;
+  h->overhead[GetLatencyBucket(overhead)] += 1;
+#endif
+}
+
+// returns time to measure an interval from, if statistics are wanted
+u64 StartStatsTimer(void) {
+#ifndef TINY
+  if (FLAG_statistics || FLAG_metrics) {
+    return GetNanos();
+  }
+#endif
+  return 0;
+}
+
+// tallies jit path of bytes of code, which began being generated when
+// StartStatsTimer() returned start; abandoned paths pass zero bytes
+void RecordPathStats(long bytes, u64 start) {
+#ifndef TINY
+  if (start) path_build_nanos += GetNanos() - start;
+  if (bytes) {
+    path_bytes += bytes;
+    path_sizes[GetPathSizeBucket(bytes)] += 1;
+  }
+#endif
+}
+
+#ifndef TINY
+
+// returns number of executions of opcode that didn't run native jit code
+// @assume g_stats.lock
+static long GetOpcodeFallbacks(int op) {
+  return g_stats.opcode_interps[op] + g_stats.opcode_helpers[op];
+}
+
+static int CompareOpcodeFallbacks(const void *a, const void *b) {
+  long x = GetOpcodeFallbacks(*(const short *)a);
+  long y = GetOpcodeFallbacks(*(const short *)b);
+  return x < y ? +1 : x > y ? -1 : 0;
+}
+
+static dontinline void PrintOpcodeStats(void) {
+  int i, op, k;
+  char b[4096];
+  char name[16];
+  short ops[STATS_OPCODES];
+  static const char kMaps[4][7] = {"", "0f ", "0f 38 ", "0f 3a "};
+  int n = sizeof(b);
+  int o = 0;
+  // rank opcodes by how often they forced us out of native jit code
+  for (k = i = 0; i < STATS_OPCODES; ++i) {
+    if (GetOpcodeFallbacks(i)) ops[k++] = i;
+  }
+  if (!k) return;
+  qsort(ops, k, sizeof(*ops), CompareOpcodeFallbacks);
+  APPEND("%-32s   %14s %14s %14s\n", "opcodes by fallbacks", "interpreted",
+         "helper", "native");
+  for (i = 0; i < MIN(k, kStatsTopOpcodes); ++i) {
+    op = ops[i];
+    if (op < 0x400) {
+      snprintf(name, sizeof(name), "%s%02x", kMaps[op >> 8], op & 255);
+    } else {
+      snprintf(name, sizeof(name), "%#x", op);
+    }
+    APPEND("%-32s = %14ld %14ld %14ld\n", name, g_stats.opcode_interps[op],
+           g_stats.opcode_helpers[op],
+           MAX(0, g_stats.opcode_jitted[op] - g_stats.opcode_helpers[op]));
+  }
+  WriteErrorString(b);
+}
+
+// reports how well the jit code heap is being used
+// @assume g_stats.lock
+static dontinline void PrintJitStats(void) {
+  int i;
+  long paths;
+  char b[2048];
+  int n = sizeof(b);
+  int o = 0;
+  for (paths = i = 0; i < STATS_PATHS; ++i) {
+    paths += g_stats.path_sizes[i];
+  }
+  if (!paths) return;
+  APPEND("%-32s = %.1f%%\n", "jit dispatch hit ratio",
+         g_stats.jit_dispatch_hits * 100. /
+             MAX(1, g_stats.jit_dispatch_hits + g_stats.jit_dispatch_misses));
+  APPEND("%-32s = %.1f us\n", "jit path build time",
+         g_stats.path_build_nanos / 1e3);
+  APPEND("%-32s = %.1f us\n", "jit path build time average",
+         g_stats.path_build_nanos / 1e3 / paths);
+  for (i = 0; i < STATS_PATHS; ++i) {
+    if (!g_stats.path_sizes[i]) continue;
+    APPEND("jit paths under %-16ld = %ld\n", GetPathSizeBound(i),
+           g_stats.path_sizes[i]);
+  }
+  WriteErrorString(b);
+}
+
+static u64 GetLatencyNanos(int sysno) {
+  struct SyscallLatency *h;
+  if (!(h = g_stats.syscall_latency[sysno])) return 0;
+  return h->host_nanos + h->overhead_nanos;
+}
+
+static int CompareLatencies(const void *a, const void *b) {
+  u64 x = GetLatencyNanos(*(const short *)a);
+  u64 y = GetLatencyNanos(*(const short *)b);
+  return x < y ? +1 : x > y ? -1 : 0;
+}
+
+static dontinline void PrintLatencyStats(void) {
+  int i, k;
   char b[4096];
+  char name[16];
+  short nrs[STATS_SYSCALLS];
+  struct SyscallLatency *h;
+  int n = sizeof(b);
+  int o = 0;
+  // rank system calls by the total time their handlers took
+  for (k = i = 0; i < STATS_SYSCALLS; ++i) {
+    if (g_stats.syscall_latency[i]) nrs[k++] = i;
+  }
+  if (!k) return;
+  qsort(nrs, k, sizeof(*nrs), CompareLatencies);
+  APPEND("%-20s %9s %10s %9s %9s %9s %9s %6s\n", "syscalls by time",
+         "calls", "total us", "host p50", "host p99", "xlat p50", "xlat p99",
+         "xlat%");
+  for (i = 0; i < MIN(k, kStatsTopSyscalls); ++i) {
+    h = g_stats.syscall_latency[nrs[i]];
+    if (!h->name) snprintf(name, sizeof(name), "%#x", nrs[i]);
+    APPEND("%-20s %9ld %10.1f %9.1f %9.1f %9.1f %9.1f %5.1f%%\n",
+           h->name ? h->name : name, h->calls,
+           (h->host_nanos + h->overhead_nanos) / 1e3,
+           GetLatencyPercentile(h->host, h->calls, 50) / 1e3,
+           GetLatencyPercentile(h->host, h->calls, 99) / 1e3,
+           GetLatencyPercentile(h->overhead, h->calls, 50) / 1e3,
+           GetLatencyPercentile(h->overhead, h->calls, 99) / 1e3,
+           h->overhead_nanos * 100. /
+               MAX(1, h->host_nanos + h->overhead_nanos));
+  }
+  WriteErrorString(b);
+}
+
+static void AppendLatencyMetrics(struct Buffer *b, const char *kind,
+                                 int sysno, const u32 *h, long calls,
+                                 u64 nanos) {
+  int i;
+  long n;
+  for (n = i = 0; i < STATS_BUCKETS; ++i) {
+    if (!h[i]) continue;
+    n += h[i];
+    AppendFmt(b, "blink_syscall_%s_seconds_bucket{nr=\"%d\",le=\"%.9g\"} %ld\n",
+              kind, sysno, GetLatencyBound(i) / 1e9, n);
+  }
+  AppendFmt(b, "blink_syscall_%s_seconds_bucket{nr=\"%d\",le=\"+Inf\"} %ld\n",
+            kind, sysno, calls);
+  AppendFmt(b, "blink_syscall_%s_seconds_sum{nr=\"%d\"} %.9f\n", kind, sysno,
+            nanos / 1e9);
+  AppendFmt(b, "blink_syscall_%s_seconds_count{nr=\"%d\"} %ld\n", kind,
+            sysno, calls);
+}
+
+// reports how the guest address space was laid out for this host
+static dontinline void PrintLayoutStats(void) {
+  char b[1024];
+  int n = sizeof(b);
+  int o = 0;
+  bool linear = !FLAG_nolinear;
+  u64 skew = FLAG_shadow ? FLAG_skew : linear ? kSkew : 0;
+  APPEND("%-32s = %s\n", "memory mode",
+         FLAG_shadow ? "shadow" : linear ? "linear" : "virtual");
+  APPEND("%-32s = %d\n", "host address bits", FLAG_vabits);
+  APPEND("%-32s = %#" PRIx64 "\n", "guest address space", FLAG_vaspace);
+  APPEND("%-32s = %#" PRIx64 "\n", "host address skew", skew);
+  APPEND("%-32s = %#" PRIx64 "\n", "image start", FLAG_imagestart);
+  APPEND("%-32s = %#" PRIx64 "\n", "interpreter start", FLAG_dyninterpaddr);
+  if (linear && !FLAG_shadow && FLAG_vabits <= 47 && !kSkew) {
+    APPEND("%-32s = %s\n", "automap", "host");
+  } else {
+    APPEND("%-32s = %#" PRIx64 "-%#" PRIx64 "\n", "automap",
+           (u64)FLAG_automapstart, (u64)FLAG_automapend);
+  }
+  APPEND("%-32s = %#" PRIx64 "\n", "stack top", FLAG_stacktop);
+  WriteErrorString(b);
+}
+
+// reports how many of our pages the host kernel merged with others
+static dontinline void PrintDedupStats(void) {
+  int fd;
+  ssize_t rc;
+  char *p, b[1024];
+  long merging = -1, profit = -1;
+  int n = sizeof(b);
+  int o = 0;
+  if (!FLAG_dedup) return;
+  if ((fd = open("/proc/self/ksm_stat", O_RDONLY | O_CLOEXEC)) != -1) {
+    if ((rc = read(fd, b, sizeof(b) - 1)) > 0) {
+      b[rc] = 0;
+      if ((p = strstr(b, "ksm_merging_pages "))) {
+        merging = strtol(p + 18, 0, 10);
+      }
+      if ((p = strstr(b, "ksm_process_profit "))) {
+        profit = strtol(p + 19, 0, 10);
+      }
+    }
+    close(fd);
+  }
+  if (merging == -1) {
+    APPEND("%-32s = %s\n", "dedup", "unavailable");
+  } else {
+    APPEND("%-32s = %ld\n", "dedup merged pages", merging);
+    APPEND("%-32s = %ld\n", "dedup bytes saved", merging * 4096);
+    if (profit != -1) {
+      APPEND("%-32s = %ld\n", "dedup process profit", profit);
+    }
+  }
+  WriteErrorString(b);
+}
+
+// reports where time went before the guest executed its first opcode
+static dontinline void PrintStartupStats(void) {
+  int i;
+  u64 total;
+  char b[2048];
+  int n = sizeof(b);
+  int o = 0;
+  if (!g_startup.n) return;
+  for (total = i = 0; i < g_startup.n; ++i) {
+    APPEND("startup %-24s = %10.1f us\n", g_startup.phase[i].name,
+           g_startup.phase[i].nanos / 1e3);
+    total += g_startup.phase[i].nanos;
+  }
+  APPEND("startup %-24s = %10.1f us\n", "total", total / 1e3);
+  WriteErrorString(b);
+}
+
+#endif /* TINY */
+
+void PrintStats(void) {
+#ifndef TINY
+  char b[8192];
   int n = sizeof(b);
   int o = 0;
   b[0] = 0;
+  FlushStats();
+  PrintLayoutStats();
+  PrintStartupStats();
+  PrintDedupStats();
+  LOCK(&g_stats.lock);
 #define DEFINE_COUNTER(S) \
-  if (S) APPEND("%-32s = %ld\n", #S, S);
+  if (g_stats.S) APPEND("%-32s = %ld\n", #S, g_stats.S);
+#define DEFINE_MAXIMUM(S) DEFINE_COUNTER(S)
 #define DEFINE_AVERAGE(S) \
-  if (S.a) APPEND("%-32s = %.6g\n", #S, S.a);
+  if (g_stats.S.a) APPEND("%-32s = %.6g\n", #S, g_stats.S.a);
 #include "blink/stats.inc"
-#undef S
+#undef DEFINE_COUNTER
+#undef DEFINE_MAXIMUM
+#undef DEFINE_AVERAGE
   WriteErrorString(b);
+  PrintOpcodeStats();
+  PrintJitStats();
+  PrintLatencyStats();
+  UNLOCK(&g_stats.lock);
+#endif
+}
+
+// appends process totals in the prometheus text exposition format
+void AppendStatsMetrics(struct Buffer *b) {
+#ifndef TINY
+  int i;
+  long n;
+  struct SyscallLatency *h;
+  LOCK(&g_stats.lock);
+#define DEFINE_COUNTER(S)                                   \
+  AppendFmt(b, "# TYPE blink_%s counter\nblink_%s %ld\n", #S, #S, \
+            g_stats.S);
+#define DEFINE_MAXIMUM(S)                                 \
+  AppendFmt(b, "# TYPE blink_%s gauge\nblink_%s %ld\n", #S, #S, \
+            g_stats.S);
+#define DEFINE_AVERAGE(S)                                  \
+  AppendFmt(b, "# TYPE blink_%s gauge\nblink_%s %.6g\n", #S, #S, \
+            g_stats.S.a);
+#include "blink/stats.inc"
+#undef DEFINE_COUNTER
+#undef DEFINE_MAXIMUM
+#undef DEFINE_AVERAGE
+  AppendStr(b, "# TYPE blink_path_size_bytes histogram\n");
+  for (n = i = 0; i < STATS_PATHS; ++i) {
+    if (!g_stats.path_sizes[i]) continue;
+    n += g_stats.path_sizes[i];
+    AppendFmt(b, "blink_path_size_bytes_bucket{le=\"%ld\"} %ld\n",
+              GetPathSizeBound(i), n);
+  }
+  AppendFmt(b, "blink_path_size_bytes_bucket{le=\"+Inf\"} %ld\n", n);
+  AppendFmt(b,
+            "blink_path_size_bytes_sum %ld\n"
+            "blink_path_size_bytes_count %ld\n",
+            g_stats.path_bytes, n);
+  AppendStr(b, "# TYPE blink_syscalls_by_number counter\n");
+  for (i = 0; i < STATS_SYSCALLS; ++i) {
+    if (g_stats.syscall_counts[i]) {
+      AppendFmt(b, "blink_syscalls_by_number{nr=\"%d\"} %ld\n", i,
+                g_stats.syscall_counts[i]);
+    }
+  }
+  AppendStr(b, "# TYPE blink_syscall_host_seconds histogram\n");
+  for (i = 0; i < STATS_SYSCALLS; ++i) {
+    if ((h = g_stats.syscall_latency[i])) {
+      AppendLatencyMetrics(b, "host", i, h->host, h->calls, h->host_nanos);
+    }
+  }
+  AppendStr(b, "# TYPE blink_syscall_overhead_seconds histogram\n");
+  for (i = 0; i < STATS_SYSCALLS; ++i) {
+    if ((h = g_stats.syscall_latency[i])) {
+      AppendLatencyMetrics(b, "overhead", i, h->overhead, h->calls,
+                           h->overhead_nanos);
+    }
+  }
+  UNLOCK(&g_stats.lock);
 #endif
 }
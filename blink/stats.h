@@ -3,16 +3,18 @@
 #include <stdbool.h>
 
 #include "blink/builtin.h"
+#include "blink/thread.h"
 #include "blink/tsan.h"
+#include "blink/types.h"
 
-#ifndef NDEBUG
-// we don't care about the accuracy of statistics across threads. some
-// hardware architectures don't even seem to have atomic addition ops.
-#define STATISTIC(x)      \
-  do {                    \
-    IGNORE_RACES_START(); \
-    x;                    \
-    IGNORE_RACES_END();   \
+#ifndef TINY
+// counters are thread local, so bumping one is a single increment that
+// needs neither atomics nor race annotations. each thread's numbers are
+// folded into the process wide totals by FlushStats() when its machine
+// is freed, and PrintStats() reports those totals.
+#define STATISTIC(x) \
+  do {               \
+    x;               \
   } while (0)
 #else
 #define STATISTIC(x) (void)0
@@ -26,26 +28,23 @@
 
 #define AVERAGE(S, x) S.a += ((x)-S.a) / ++S.i
 
-#ifndef NDEBUG
-#ifdef __GNUC__
-#define GET_COUNTER(S)    \
-  __extension__({         \
-    IGNORE_RACES_START(); \
-    long S_ = S;          \
-    IGNORE_RACES_END();   \
-    S_;                   \
-  })
-#else
+#ifndef TINY
 #define GET_COUNTER(S) (S)
-#endif
 #else
 #define GET_COUNTER(S) 0L
 #endif
 
-#define DEFINE_COUNTER(S) extern long S;
-#define DEFINE_AVERAGE(S) extern struct Average S;
+#define STATS_SYSCALLS 512   // system call numbers counted by syscall_counts
+#define STATS_OPCODES  2048  // Mopcode() values counted by opcode_interps etc.
+#define STATS_BUCKETS  160   // log-linear nanosecond buckets per histogram
+#define STATS_PATHS    16    // power of two buckets of jit path code bytes
+
+#define DEFINE_COUNTER(S) extern _Thread_local long S;
+#define DEFINE_MAXIMUM(S) extern _Thread_local long S;
+#define DEFINE_AVERAGE(S) extern _Thread_local struct Average S;
 #include "blink/stats.inc"
 #undef DEFINE_COUNTER
+#undef DEFINE_MAXIMUM
 #undef DEFINE_AVERAGE
 
 struct Average {
@@ -53,8 +52,37 @@ struct Average {
   long i;
 };
 
+// time spent in the handler of one system call number, where overhead
+// is what blink spent translating memory and iovecs, and host is the rest
+struct SyscallLatency {
+  const char *name;
+  long calls;
+  u64 host_nanos;
+  u64 overhead_nanos;
+  u32 host[STATS_BUCKETS];
+  u32 overhead[STATS_BUCKETS];
+};
+
+struct Buffer;
+
+extern _Thread_local long syscall_counts[STATS_SYSCALLS];
+extern _Thread_local long opcode_interps[STATS_OPCODES];  // by interpreter
+extern _Thread_local long opcode_jitted[STATS_OPCODES];   // in jit paths
+extern _Thread_local long opcode_helpers[STATS_OPCODES];  // via AddPath()
+extern _Thread_local long path_sizes[STATS_PATHS];        // by code bytes
+extern _Thread_local struct SyscallLatency *syscall_latency[STATS_SYSCALLS];
+extern _Thread_local u64 syscall_overhead;  // see BeginSyscallOverhead()
+
 extern bool FLAG_statistics;
 
+void FlushStats(void);
 void PrintStats(void);
+void AppendStatsMetrics(struct Buffer *);
+void MarkStartup(const char *);
+u64 BeginSyscallOverhead(void);
+void EndSyscallOverhead(u64);
+void RecordSyscallLatency(int, const char *, u64, u64);
+u64 StartStatsTimer(void);
+void RecordPathStats(long, u64);
 
 #endif /* BLINK_STATS_H_ */
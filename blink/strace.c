@@ -304,7 +304,7 @@ static const char *DescribeSockaddr(const struct sockaddr_storage_linux *ss) {
 static const char *DescribeBuf(struct Machine *m, i64 arg, u64 len, u64 ax,
                                bool isentry, bool isout) {
   _Thread_local static char bp[1 + kStraceBufMax * 3 + 1 + 3 + 2 + 21 + 1];
-  u64 have;
+  u64 w, have;
   const u8 *data;
   int j, bi, bn, preview;
   bi = 0;
@@ -322,7 +322,10 @@ static const char *DescribeBuf(struct Machine *m, i64 arg, u64 len, u64 ax,
   if (preview > 0 && (data = (const u8 *)SchlepR(m, arg, preview))) {
     APPEND("\"");
     for (j = 0; j < preview; ++j) {
-      APPEND("%lc", (wint_t)kCp437[data[j]]);
+      // %lc fails for non-ascii in the c locale, which makes bi go back
+      w = tpenc(kCp437[data[j]]);
+      do bp[bi++] = w;
+      while ((w >>= 8));
     }
     APPEND("\"");
     if (j < have) {
@@ -129,6 +129,49 @@ static u64 SubtractCx(P, u64 x) {
   return cx;
 }
 
+static void MovsElement(P, unsigned n, i64 sgn) {
+  u64 v;
+  void *p[2];
+  u8 s[2][8];
+  memmove(BeginStore(m, (v = AddressDi(A)), n, p, s[0]),
+          Load(m, AddressSi(A), n, s[1]), n);
+  AddDi(A, sgn * n);
+  AddSi(A, sgn * n);
+  EndStore(m, v, n, p, s[0]);
+}
+
+static void StosElement(P, unsigned n, i64 sgn) {
+  u64 v;
+  void *p[2];
+  u8 s[8];
+  memmove(BeginStore(m, (v = AddressDi(A)), n, p, s), m->ax, n);
+  AddDi(A, sgn * n);
+  EndStore(m, v, n, p, s);
+}
+
+static void CmpsElement(P, unsigned n, i64 sgn) {
+  u8 s[2][8];
+  kAlu[ALU_SUB][RegLog2(rde)](
+      m, ReadInt(Load(m, AddressSi(A), n, s[1]), RegLog2(rde)),
+      ReadInt(Load(m, AddressDi(A), n, s[0]), RegLog2(rde)));
+  AddDi(A, sgn * n);
+  AddSi(A, sgn * n);
+}
+
+static void ScasElement(P, unsigned n, i64 sgn) {
+  u8 s[8];
+  kAlu[ALU_SUB][RegLog2(rde)](
+      m, ReadInt(m->ax, RegLog2(rde)),
+      ReadInt(Load(m, AddressDi(A), n, s), RegLog2(rde)));
+  AddDi(A, sgn * n);
+}
+
+// returns true if repne found an equal element or repe found unequal
+static bool IsRepStopped(P) {
+  return (Rep(rde) == 2 && GetFlag(m->flags, FLAGS_ZF)) ||
+         (Rep(rde) == 3 && !GetFlag(m->flags, FLAGS_ZF));
+}
+
 static void StringOp(P, int op) {
   bool stop;
   unsigned n;
@@ -144,37 +187,22 @@ static void StringOp(P, int op) {
     if (Rep(rde) && !ReadCx(A)) break;
     switch (op) {
       case STRING_CMPS:
-        kAlu[ALU_SUB][RegLog2(rde)](
-            m, ReadInt(Load(m, AddressSi(A), n, s[2]), RegLog2(rde)),
-            ReadInt(Load(m, AddressDi(A), n, s[1]), RegLog2(rde)));
-        AddDi(A, sgn * n);
-        AddSi(A, sgn * n);
-        stop = (Rep(rde) == 2 && GetFlag(m->flags, FLAGS_ZF)) ||
-               (Rep(rde) == 3 && !GetFlag(m->flags, FLAGS_ZF));
+        CmpsElement(A, n, sgn);
+        stop = IsRepStopped(A);
         break;
       case STRING_MOVS:
-        memmove(BeginStore(m, (v = AddressDi(A)), n, p, s[0]),
-                Load(m, AddressSi(A), n, s[1]), n);
-        AddDi(A, sgn * n);
-        AddSi(A, sgn * n);
-        EndStore(m, v, n, p, s[0]);
+        MovsElement(A, n, sgn);
         break;
       case STRING_STOS:
-        memmove(BeginStore(m, (v = AddressDi(A)), n, p, s[0]), m->ax, n);
-        AddDi(A, sgn * n);
-        EndStore(m, v, n, p, s[0]);
+        StosElement(A, n, sgn);
         break;
       case STRING_LODS:
         memmove(m->ax, Load(m, AddressSi(A), n, s[1]), n);
         AddSi(A, sgn * n);
         break;
       case STRING_SCAS:
-        kAlu[ALU_SUB][RegLog2(rde)](
-            m, ReadInt(Load(m, AddressDi(A), n, s[1]), RegLog2(rde)),
-            ReadInt(m->ax, RegLog2(rde)));
-        AddDi(A, sgn * n);
-        stop = (Rep(rde) == 2 && GetFlag(m->flags, FLAGS_ZF)) ||
-               (Rep(rde) == 3 && !GetFlag(m->flags, FLAGS_ZF));
+        ScasElement(A, n, sgn);
+        stop = IsRepStopped(A);
         break;
 #ifndef DISABLE_METAL
       case STRING_OUTS:
@@ -202,86 +230,130 @@ static void StringOp(P, int op) {
   IGNORE_RACES_END();
 }
 
-static void RepMovsbEnhanced(P) {
+// returns how many whole n-byte elements a string op stepping in the
+// direction of sgn can access starting at v, without leaving the page
+// or wrapping the low 16 bits of its index register
+static long GetStringSpan(u64 v, u16 low, unsigned n, i64 sgn) {
+  long avail;
+  if (sgn > 0) {
+    avail = MIN(4096 - (long)(v & 4095), 65536 - (long)low);
+  } else if ((v & 4095) + n <= 4096 && low + n <= 65536) {
+    avail = MIN((long)(v & 4095), (long)low) + n;
+  } else {
+    avail = 0;
+  }
+  return avail / n;
+}
+
+// copies size bytes at the lowest addresses d and s with the result a
+// rep movs loop would have, even if the destination overlaps source it
+// hasn't read yet, which is how guests replicate patterns. that can be
+// done by memcpy() in chunks of the overlap distance, but only if each
+// chunk holds at least one element, otherwise this returns false
+static bool CopyString(u8 *d, const u8 *s, long size, unsigned n, i64 sgn) {
+  long i, k;
+  if (sgn > 0 && s < d && d < s + size) {
+    if ((k = d - s) < n) return false;
+    for (i = 0; i < size; i += k) {
+      memcpy(d + i, s + i, MIN(k, size - i));
+    }
+  } else if (sgn < 0 && d < s && s < d + size) {
+    if ((k = s - d) < n) return false;
+    for (i = size; i > 0; i -= k) {
+      memcpy(d + MAX(0, i - k), s + MAX(0, i - k), MIN(k, i));
+    }
+  } else {
+    memmove(d, s, size);
+  }
+  return true;
+}
+
+static void FillString(u8 *d, const u8 *x, long size, unsigned n) {
+  long i;
+  if (n == 1) {
+    memset(d, *x, size);
+  } else {
+    memcpy(d, x, n);
+    for (i = n; i < size; i += i) {
+      memcpy(d + i, d, MIN(i, size - i));
+    }
+  }
+}
+
+static void RepMovsEnhanced(P) {
+  i64 sgn;
+  unsigned n;
   u8 *direal, *sireal;
+  long count, size, skew;
   u64 diactual, siactual, cx;
-  u16 dilow, silow;
-  long diremain, siremain, i, n;
   if ((cx = ReadCx(A))) {
+    n = 1 << RegLog2(rde);
+    sgn = GetFlag(m->flags, FLAGS_DF) ? -1 : 1;
     diactual = AddressDi(A);
     siactual = AddressSi(A);
-    if (diactual != siactual) {
-      if (!GetFlag(m->flags, FLAGS_DF)) {
-        SetWriteAddr(m, diactual, cx);
-        SetReadAddr(m, siactual, cx);
+    skew = sgn > 0 ? 0 : (cx - 1) << RegLog2(rde);
+    SetWriteAddr(m, diactual - skew, cx << RegLog2(rde));
+    SetReadAddr(m, siactual - skew, cx << RegLog2(rde));
+    IGNORE_RACES_START();
+    atomic_thread_fence(memory_order_acquire);
+    do {
+      count = MIN(GetStringSpan(diactual, Get16(m->di), n, sgn),
+                  GetStringSpan(siactual, Get16(m->si), n, sgn));
+      if ((count = MIN(cx, count))) {
+        size = count * n;
+        skew = sgn > 0 ? 0 : size - n;
+        direal = ResolveAddress(m, diactual) - skew;
+        sireal = ResolveAddress(m, siactual) - skew;
+        if (!IsRomAddress(m, direal) &&
+            !CopyString(direal, sireal, size, n, sgn)) {
+          count = 0;
+        }
+      }
+      if (count) {
+        AddDi(A, sgn * size);
+        AddSi(A, sgn * size);
+        cx = SubtractCx(A, count);
       } else {
-        SetWriteAddr(m, diactual - cx + 1, cx);
-        SetReadAddr(m, siactual - cx + 1, cx);
+        // element crosses a page or overlaps itself
+        MovsElement(A, n, sgn);
+        cx = SubtractCx(A, 1);
       }
-      IGNORE_RACES_START();
-      atomic_thread_fence(memory_order_acquire);
-      do {
-        direal = ResolveAddress(m, diactual);
-        sireal = ResolveAddress(m, siactual);
-        dilow = Get16(m->di);
-        silow = Get16(m->si);
-        if (!GetFlag(m->flags, FLAGS_DF)) {
-          diremain = 4096 - (diactual & 4095);
-          diremain = MIN(diremain, 65536 - dilow);
-          siremain = 4096 - (siactual & 4095);
-          siremain = MIN(siremain, 65536 - silow);
-          n = MIN(cx, MIN(diremain, siremain));
-          if (!IsRomAddress(m, direal)) {
-            for (i = 0; i < n; ++i) {
-              direal[i] = sireal[i];
-            }
-          }
-          AddDi(A, n);
-          AddSi(A, n);
-        } else {
-          diremain = (diactual & 4095) + 1;
-          diremain = MIN(diremain, (long)dilow + 1);
-          siremain = (siactual & 4095) + 1;
-          siremain = MIN(siremain, (long)silow + 1);
-          n = MIN(cx, MIN(diremain, siremain));
-          if (!IsRomAddress(m, direal)) {
-            for (i = 0; i < n; ++i) {
-              direal[-i] = sireal[-i];
-            }
-          }
-          AddDi(A, -n);
-          AddSi(A, -n);
-        }
-        cx = SubtractCx(A, n);
-        if (cx) {
-          diactual = AddressDi(A);
-          siactual = AddressSi(A);
-        }
-      } while (cx);
-      atomic_thread_fence(memory_order_release);
-      IGNORE_RACES_END();
-    }
+      if (cx) {
+        diactual = AddressDi(A);
+        siactual = AddressSi(A);
+      }
+    } while (cx);
+    atomic_thread_fence(memory_order_release);
+    IGNORE_RACES_END();
   }
 }
 
-static void RepStosbEnhanced(P) {
+static void RepStosEnhanced(P) {
+  i64 sgn;
   u8 *direal;
+  unsigned n;
+  long count, size, skew;
   u64 diactual, cx;
-  u16 dilow;
-  unsigned diremain, n;
   if ((cx = ReadCx(A))) {
+    n = 1 << RegLog2(rde);
+    sgn = GetFlag(m->flags, FLAGS_DF) ? -1 : 1;
     diactual = AddressDi(A);
-    SetWriteAddr(m, diactual, cx);
+    skew = sgn > 0 ? 0 : (cx - 1) << RegLog2(rde);
+    SetWriteAddr(m, diactual - skew, cx << RegLog2(rde));
     IGNORE_RACES_START();
     do {
-      direal = ResolveAddress(m, diactual);
-      dilow = Get16(m->di);
-      diremain = 4096 - (diactual & 4095);
-      diremain = MIN(diremain, 65536 - dilow);
-      n = MIN(cx, diremain);
-      if (!IsRomAddress(m, direal)) memset(direal, m->al, n);
-      AddDi(A, n);
-      cx = SubtractCx(A, n);
+      count = MIN(cx, GetStringSpan(diactual, Get16(m->di), n, sgn));
+      if (count) {
+        size = count * n;
+        skew = sgn > 0 ? 0 : size - n;
+        direal = ResolveAddress(m, diactual) - skew;
+        if (!IsRomAddress(m, direal)) FillString(direal, m->ax, size, n);
+        AddDi(A, sgn * size);
+        cx = SubtractCx(A, count);
+      } else {
+        StosElement(A, n, sgn);
+        cx = SubtractCx(A, 1);
+      }
       if (cx) diactual = AddressDi(A);
     } while (cx);
     atomic_thread_fence(memory_order_release);
@@ -289,16 +361,95 @@ static void RepStosbEnhanced(P) {
   }
 }
 
+// returns index of first element where rep cmps/scas stops, or count
+static long FindStringElement(const u8 *d, const u8 *s, long sstep,
+                              long count, unsigned n, i64 sgn, bool equal) {
+  long i;
+  const u8 *p;
+  if (n == 1 && sgn > 0 && !sstep && equal) {
+    p = (const u8 *)memchr(d, *s, count);
+    return p ? p - d : count;
+  }
+  if (sgn > 0 && sstep && !equal && !memcmp(d, s, count * n)) {
+    return count;
+  }
+  for (i = 0; i < count; ++i) {
+    if (!memcmp(d + sgn * i * n, s + sstep * i, n) == equal) break;
+  }
+  return i;
+}
+
+static void RepCompareEnhanced(P, int op) {
+  i64 sgn;
+  bool equal;
+  unsigned n;
+  u8 *direal, *sireal;
+  long count, sstep, i, k;
+  n = 1 << RegLog2(rde);
+  sgn = GetFlag(m->flags, FLAGS_DF) ? -1 : 1;
+  sstep = op == STRING_CMPS ? sgn * n : 0;
+  equal = Rep(rde) == 2;
+  IGNORE_RACES_START();
+  atomic_thread_fence(memory_order_acquire);
+  while (ReadCx(A)) {
+    count = GetStringSpan(AddressDi(A), Get16(m->di), n, sgn);
+    if (op == STRING_CMPS) {
+      count = MIN(count, GetStringSpan(AddressSi(A), Get16(m->si), n, sgn));
+    }
+    if (!(count = MIN(ReadCx(A), count))) {
+      // element crosses a page
+      if (op == STRING_CMPS) {
+        CmpsElement(A, n, sgn);
+      } else {
+        ScasElement(A, n, sgn);
+      }
+      SubtractCx(A, 1);
+      if (IsRepStopped(A)) break;
+      continue;
+    }
+    SetReadAddr(m, AddressDi(A) - (sgn > 0 ? 0 : (count - 1) * n), count * n);
+    direal = ResolveAddress(m, AddressDi(A));
+    if (op == STRING_CMPS) {
+      sireal = ResolveAddress(m, AddressSi(A));
+    } else {
+      sireal = m->ax;
+    }
+    i = FindStringElement(direal, sireal, sstep, count, n, sgn, equal);
+    k = MIN(i, count - 1);
+    // only the final comparison decides the flags
+    kAlu[ALU_SUB][RegLog2(rde)](m, ReadInt(sireal + sstep * k, RegLog2(rde)),
+                                ReadInt(direal + sgn * k * n, RegLog2(rde)));
+    AddDi(A, sgn * (k + 1) * n);
+    if (op == STRING_CMPS) AddSi(A, sgn * (k + 1) * n);
+    SubtractCx(A, k + 1);
+    if (i < count) break;
+  }
+  atomic_thread_fence(memory_order_release);
+  IGNORE_RACES_END();
+}
+
 void OpMovs(P) {
-  StringOp(A, STRING_MOVS);
+  if (Rep(rde)) {
+    RepMovsEnhanced(A);
+  } else {
+    StringOp(A, STRING_MOVS);
+  }
 }
 
 void OpCmps(P) {
-  StringOp(A, STRING_CMPS);
+  if (Rep(rde)) {
+    RepCompareEnhanced(A, STRING_CMPS);
+  } else {
+    StringOp(A, STRING_CMPS);
+  }
 }
 
 void OpStos(P) {
-  StringOp(A, STRING_STOS);
+  if (Rep(rde)) {
+    RepStosEnhanced(A);
+  } else {
+    StringOp(A, STRING_STOS);
+  }
 }
 
 void OpLods(P) {
@@ -306,7 +457,11 @@ void OpLods(P) {
 }
 
 void OpScas(P) {
-  StringOp(A, STRING_SCAS);
+  if (Rep(rde)) {
+    RepCompareEnhanced(A, STRING_SCAS);
+  } else {
+    StringOp(A, STRING_SCAS);
+  }
 }
 
 void OpIns(P) {
@@ -318,17 +473,9 @@ void OpOuts(P) {
 }
 
 void OpMovsb(P) {
-  if (Rep(rde)) {
-    RepMovsbEnhanced(A);
-  } else {
-    OpMovs(A);
-  }
+  OpMovs(A);
 }
 
 void OpStosb(P) {
-  if (Rep(rde) && !GetFlag(m->flags, FLAGS_DF)) {
-    RepStosbEnhanced(A);
-  } else {
-    OpStos(A);
-  }
+  OpStos(A);
 }
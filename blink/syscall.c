@@ -49,16 +49,20 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "blink/aio.h"
 #include "blink/ancillary.h"
 #include "blink/assert.h"
 #include "blink/atomic.h"
 #include "blink/bitscan.h"
+#include "blink/btrace.h"
 #include "blink/bus.h"
 #include "blink/case.h"
 #include "blink/checked.h"
+#include "blink/coverage.h"
 #include "blink/debug.h"
 #include "blink/endian.h"
 #include "blink/errno.h"
+#include "blink/etrace.h"
 #include "blink/flag.h"
 #include "blink/iovs.h"
 #include "blink/limits.h"
@@ -68,23 +72,30 @@
 #include "blink/machine.h"
 #include "blink/macros.h"
 #include "blink/map.h"
+#include "blink/metrics.h"
+#include "blink/perfmap.h"
+#include "blink/profile.h"
 #include "blink/ndelay.h"
 #include "blink/overlays.h"
 #include "blink/pml4t.h"
 #include "blink/preadv.h"
 #include "blink/random.h"
+#include "blink/reclaim.h"
 #include "blink/signal.h"
+#include "blink/snapshot.h"
 #include "blink/stats.h"
 #include "blink/strace.h"
 #include "blink/swap.h"
 #include "blink/thread.h"
 #include "blink/timespec.h"
+#include "blink/tunables.h"
 #include "blink/util.h"
 #include "blink/vfs.h"
 #include "blink/xlat.h"
 
 #ifdef __linux
 #include <sys/prctl.h>
+#include <sys/syscall.h>
 #endif
 
 #ifdef __EMSCRIPTEN__
@@ -108,6 +119,10 @@
 #include <sys/mount.h>
 #endif
 
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+#endif
+
 #ifdef SO_LINGER_SEC
 #define SO_LINGER_ SO_LINGER_SEC
 #else
@@ -131,8 +146,13 @@
     if (STRACE && FLAG_strace) {                                  \
       Strace(m, name, false, &(signature)[1], ax SYSARGS##arity); \
     }                                                             \
+    sysname = name;                                               \
+    sysarity = arity;                                             \
     break
 
+// system calls that skip the general dispatcher can't be traced
+#define TRACING ((STRACE && FLAG_strace) || (BTRACE && FLAG_btrace))
+
 char *g_blink_path;
 bool FLAG_statistics;
 
@@ -294,43 +314,95 @@ HandleSomeMoreInterrupts:
   return res;
 }
 
-static struct Futex *FindFutex(struct Machine *m, i64 addr) {
-  struct Dll *e;
-  for (e = dll_first(g_bus->futexes.active); e;
-       e = dll_next(g_bus->futexes.active, e)) {
-    if (FUTEX_CONTAINER(e)->addr == addr) {
-      return FUTEX_CONTAINER(e);
+static struct FutexBucket *GetFutexBucket(i64 addr) {
+  _Static_assert(IS2POW(kFutexBuckets), "futex buckets must be two-power");
+  return g_bus->futexes.bucket +
+         ((((u64)addr >> 2) * 0x9e3779b97f4a7c15) >> 32) % kFutexBuckets;
+}
+
+// returns process a futex word is private to, or zero if it's shared.
+// the futex table is shared by all the processes forked from the first
+// one, which see MAP_SHARED memory at the same address; other memory's
+// futexes must only be woken by the process owning them. like linux we
+// trust FUTEX_PRIVATE_FLAG rather than consulting the page table.
+static int GetFutexOwner(struct Machine *m, i64 uaddr, i32 op) {
+  if (!(op & FUTEX_PRIVATE_FLAG_LINUX) && IsSharedMemory(m->system, uaddr)) {
+    return 0;
+  }
+  return m->system->pid;
+}
+
+// returns longest waiting FUTEX_LOCK_PI caller at uaddr after e or 0
+// the caller must hold the lock of bucket b
+static struct Futex *FindPiWaiter(struct FutexBucket *b, i64 uaddr, int pid,
+                                  struct Dll *e) {
+  struct Futex *f;
+  for (e = e ? dll_next(b->active, e) : dll_first(b->active); e;
+       e = dll_next(b->active, e)) {
+    f = FUTEX_CONTAINER(e);
+    if (f->addr == uaddr && f->pid == pid && f->tid) return f;
+  }
+  return 0;
+}
+
+// releases pi futex owned by the calling thread. ownership is handed
+// directly to the longest waiter, so that it wakes up owning the lock
+// rather than racing other threads for it; `died` may be passed the
+// FUTEX_OWNER_DIED flag, for robust futexes whose owner has exited
+static int ReleasePiFutex(struct Machine *m, i64 uaddr, int pid, u32 died) {
+  u32 value, replace;
+  _Atomic(u32) *word;
+  struct FutexBucket *b;
+  struct Futex *f, *next;
+  if (!(word = (_Atomic(u32) *)LookupAddress(m, uaddr))) return -1;
+  b = GetFutexBucket(uaddr);
+  LOCK(&b->lock);
+  if ((f = FindPiWaiter(b, uaddr, pid, 0))) {
+    next = FindPiWaiter(b, uaddr, pid, &f->elem);
+    replace = f->tid | died | (next ? FUTEX_WAITERS_LINUX : 0);
+  } else {
+    replace = died;
+  }
+  value = atomic_load_explicit(word, memory_order_relaxed);
+  do {
+    if ((Little32(value) & FUTEX_TID_MASK_LINUX) != m->tid) {
+      UNLOCK(&b->lock);
+      return eperm();
     }
+  } while (!atomic_compare_exchange_weak_explicit(
+      word, &value, Little32(replace), memory_order_release,
+      memory_order_relaxed));
+  if (f) {
+    dll_remove(&b->active, &f->elem);
+    UnparkFutex(f);
   }
+  UNLOCK(&b->lock);
+  THR_LOGF("pid=%d tid=%d handed pi futex %#" PRIx64 " to tid=%d",
+           m->system->pid, m->tid, uaddr, f ? f->tid : 0);
   return 0;
 }
 
-static int SysFutexWake(struct Machine *m, i64 uaddr, u32 count) {
+static int SysFutexWake(struct Machine *m, i64 uaddr, int pid, u32 count) {
   int rc;
   struct Futex *f;
+  struct Dll *e, *e2;
+  struct FutexBucket *b;
   if (!count) return 0;
-  LOCK(&g_bus->futexes.lock);
-  if ((f = FindFutex(m, uaddr))) {
-    LOCK(&f->lock);
-  }
-  UNLOCK(&g_bus->futexes.lock);
-  if (f && f->waiters) {
-    THR_LOGF("pid=%d tid=%d is waking %d waiters at address %#" PRIx64,
-             m->system->pid, m->tid, f->waiters, uaddr);
-    if (count == 1) {
-      unassert(!pthread_cond_signal(&f->cond));
-      rc = 1;
-    } else {
-      unassert(!pthread_cond_broadcast(&f->cond));
-      rc = f->waiters;
-    }
-    UNLOCK(&f->lock);
-  } else {
-    if (f) UNLOCK(&f->lock);
-    THR_LOGF("pid=%d tid=%d is waking no one at address %#" PRIx64,
-             m->system->pid, m->tid, uaddr);
-    rc = 0;
-  }
+  rc = 0;
+  b = GetFutexBucket(uaddr);
+  LOCK(&b->lock);
+  for (e = dll_first(b->active); e && rc < count; e = e2) {
+    e2 = dll_next(b->active, e);
+    f = FUTEX_CONTAINER(e);
+    if (f->addr == uaddr && f->pid == pid && !f->tid) {
+      dll_remove(&b->active, e);
+      UnparkFutex(f);
+      ++rc;
+    }
+  }
+  UNLOCK(&b->lock);
+  THR_LOGF("pid=%d tid=%d woke %d waiters at address %#" PRIx64,
+           m->system->pid, m->tid, rc, uaddr);
   return rc;
 }
 
@@ -345,27 +417,34 @@ static void ClearChildTid(struct Machine *m) {
       THR_LOGF("invalid clear child tid address %#" PRIx64, m->ctid);
     }
   }
-  SysFutexWake(m, m->ctid, INT_MAX);
+  SysFutexWake(m, m->ctid, GetFutexOwner(m, m->ctid, 0), INT_MAX);
 #endif
 }
 
 _Noreturn void SysExitGroup(struct Machine *m, int rc) {
   THR_LOGF("pid=%d tid=%d SysExitGroup", m->system->pid, m->tid);
+  UnlockRobustFutexes(m);
   ClearChildTid(m);
   if (m->system->isfork) {
-#ifndef NDEBUG
     if (FLAG_statistics) {
       PrintStats();
     }
-#endif
+    if (FLAG_btrace) {
+      FlushBtrace();
+    }
     THR_LOGF("calling _Exit(%d)", rc);
+    FlushLog();
     _Exit(rc);
   } else {
     THR_LOGF("calling exit(%d)", rc);
     KillOtherThreads(m->system);
 #ifdef HAVE_JIT
+    WriteJitCacheFile(m);
     DisableJit(&m->system->jit);  // unmapping exec pages is slow
 #endif
+    if (m->system->onexit) {
+      m->system->onexit(m, (rc & 255) << 8);
+    }
     if (m->system->trapexit && !m->system->exited) {
       m->system->exited = true;
       m->system->exitcode = rc;
@@ -375,11 +454,9 @@ _Noreturn void SysExitGroup(struct Machine *m, int rc) {
 #ifdef HAVE_JIT
     ShutdownJit();
 #endif
-#ifndef NDEBUG
     if (FLAG_statistics) {
       PrintStats();
     }
-#endif
     exit(rc);
   }
 }
@@ -390,7 +467,12 @@ _Noreturn void SysExit(struct Machine *m, int rc) {
   if (IsOrphan(m)) {
     SysExitGroup(m, rc);
   } else {
+    UnlockRobustFutexes(m);
     ClearChildTid(m);
+    if (m->pooled) {
+      // unwinds to Blink(), which hands the host thread to the pool
+      HaltMachine(m, kMachineRecycle);
+    }
     FreeMachine(m);
     pthread_exit(0);
   }
@@ -399,16 +481,53 @@ _Noreturn void SysExit(struct Machine *m, int rc) {
 #endif
 }
 
+// creates pipe whose write end a vfork() child holds until it execs or
+// exits, so the parent can wait for the end of file
+static bool OpenVforkPipe(int fds[2]) {
+  int i, p[2];
+  if (pipe(p)) return false;
+  for (i = 0; i < 2; ++i) {
+    fds[i] = fcntl(p[i], F_DUPFD_CLOEXEC, kMinBlinkFd);
+    close(p[i]);
+  }
+  if (fds[0] != -1 && fds[1] != -1) return true;
+  if (fds[0] != -1) close(fds[0]);
+  if (fds[1] != -1) close(fds[1]);
+  return false;
+}
+
+static void CloseVforkPipe(struct System *s) {
+  if (s->vforkfd) {
+    close(s->vforkfd);
+    s->vforkfd = 0;
+  }
+}
+
 static int Fork(struct Machine *m, u64 flags, u64 stack, u64 ctid) {
+  char b;
   int pid, newpid = 0;
+  int vfds[2] = {-1, -1};
   _Atomic(int) *ctid_ptr;
   unassert(!m->path.jb);
+  // vfork() suspends the calling thread until the child execs or exits.
+  // the child still gets a copy-on-write copy of the address space, so
+  // a parent that kept running would keep faulting in copies of pages
+  // it writes, for a child that's about to throw its copy away anyway
+  if (flags & CLONE_VFORK_LINUX) {
+    OpenVforkPipe(vfds);
+  }
   // NOTES ON THE LOCKING TOPOLOGY
   // exec_lock must come before sig_lock (see dup3)
   // exec_lock must come before fds.lock (see dup3)
   // exec_lock must come before fds.lock (see execve)
   // mmap_lock must come before fds.lock (see GetOflags)
   // mmap_lock must come before pagelocks_lock (see FreePage)
+  // metrics lock must come before all of the above (see WriteMetrics)
+  // reclaim lock must come before all of the above (see ReclaimSystem)
+  if (FLAG_reclaim) LockReclaim();
+  if (FLAG_metrics) LockMetrics();
+  if (FLAG_profile) LockProfile();
+  if (FLAG_btrace) LockBtrace();
   if (m->threaded) {
     LOCK(&m->system->exec_lock);
     LOCK(&m->system->sig_lock);
@@ -417,24 +536,97 @@ static int Fork(struct Machine *m, u64 flags, u64 stack, u64 ctid) {
     LOCK(&m->system->fds.lock);
     LOCK(&m->system->machines_lock);
 #ifndef HAVE_PTHREAD_PROCESS_SHARED
-    LOCK(&g_bus->futexes.lock);
+    LockFutexes();
 #endif
+  }
 #ifdef HAVE_JIT
+  // the jit worker thread may hold this lock even if the guest doesn't
+  if (m->system->jit.threaded) {
     LOCK(&m->system->jit.lock);
-#endif
   }
+#endif
+  // perf map lock must come after mmap_lock (see OnPerfMapFileMap)
+  if (FLAG_perfmap) LockPerfMap();
+  if (FLAG_coverage) LockCoverage();
+  // reclaim pool lock must come after mmap_lock (see FreeZip)
+  if (FLAG_reclaim) LockReclaimPool();
+  // as may the aio worker threads
+  if (FLAG_asyncio) LockAio();
+  // log lock must come last, since it's taken by threads holding others
+  LockLog();
   pid = fork();
 #ifdef __HAIKU__
   // haiku wipes tls after fork() in child
   // https://dev.haiku-os.org/ticket/17896
   if (!pid) g_machine = m;
 #endif
-  if (m->threaded) {
+  if (pid) {
+    UnlockLog();
+  } else {
+    ResetLog();
+    ReseedRandom();  // child mustn't repeat the parent's numbers
+  }
+  if (FLAG_asyncio) {
+    if (pid) {
+      UnlockAio();
+    } else {
+      ResetAio();
+    }
+  }
+  if (FLAG_perfmap) {
+    if (pid) {
+      UnlockPerfMap();
+    } else {
+      ResetPerfMap();
+    }
+  }
+  if (FLAG_coverage) {
+    if (pid) {
+      UnlockCoverage();
+    } else {
+      ResetCoverage();
+    }
+  }
+  if (FLAG_metrics) {
+    if (pid) {
+      UnlockMetrics();
+    } else {
+      ResetMetrics();
+    }
+  }
+  if (FLAG_profile) {
+    if (pid) {
+      UnlockProfile();
+    } else {
+      ResetProfile();
+    }
+  }
+  if (FLAG_btrace) {
+    if (pid) {
+      UnlockBtrace();
+    } else {
+      ResetBtrace();
+    }
+  }
+  if (FLAG_reclaim) {
+    if (pid) {
+      UnlockReclaimPool();
+      UnlockReclaim();
+    } else {
+      ResetReclaim();
+    }
+  }
+  if (FLAG_etrace && !pid) {
+    ForgetEtrace(m);  // child mustn't write into its parent's file
+  }
 #ifdef HAVE_JIT
+  if (m->system->jit.threaded) {
     UNLOCK(&m->system->jit.lock);
+  }
 #endif
+  if (m->threaded) {
 #ifndef HAVE_PTHREAD_PROCESS_SHARED
-    UNLOCK(&g_bus->futexes.lock);
+    UnlockFutexes();
 #endif
     UNLOCK(&m->system->machines_lock);
     UNLOCK(&m->system->fds.lock);
@@ -443,8 +635,22 @@ static int Fork(struct Machine *m, u64 flags, u64 stack, u64 ctid) {
     UNLOCK(&m->system->sig_lock);
     UNLOCK(&m->system->exec_lock);
   }
+  if (pid > 0 && vfds[0] != -1) {
+    close(vfds[1]);
+    while (read(vfds[0], &b, 1) == -1 && errno == EINTR) {
+    }
+    close(vfds[0]);
+  } else if (pid == -1 && vfds[0] != -1) {
+    close(vfds[0]);
+    close(vfds[1]);
+  }
   if (!pid) {
     newpid = getpid();
+    CloseVforkPipe(m->system);
+    if (vfds[0] != -1) {
+      close(vfds[0]);
+      m->system->vforkfd = vfds[1];
+    }
     if (stack) {
       Put64(m->sp, stack);
     }
@@ -454,8 +660,16 @@ static int Fork(struct Machine *m, u64 flags, u64 stack, u64 ctid) {
     THR_LOGF("pid=%d tid=%d SysFork -> pid=%d tid=%d",  //
              m->system->pid, m->tid, newpid, newpid);
     m->tid = m->system->pid = newpid;
+    m->hosttid = 0;
     m->system->isfork = true;
     RemoveOtherThreads(m->system);
+    ResetSignalFds(m->system);
+#ifdef HAVE_JIT
+    // threads don't survive fork() so a new jit worker is needed
+    if (m->system->jit.working) {
+      StartJitWorker(&m->system->jit);
+    }
+#endif
 #ifdef __CYGWIN__
     // Cygwin doesn't seem to properly set the PROT_EXEC
     // protection for JIT blocks after forking.
@@ -480,8 +694,7 @@ static int SysFork(struct Machine *m) {
 }
 
 static int SysVfork(struct Machine *m) {
-  // TODO: Parent should be stopped while child is running.
-  return SysFork(m);
+  return Fork(m, CLONE_VM_LINUX | CLONE_VFORK_LINUX, 0, 0);
 }
 
 static void *OnSpawn(void *arg) {
@@ -489,6 +702,9 @@ static void *OnSpawn(void *arg) {
   struct Machine *m = (struct Machine *)arg;
   THR_LOGF("pid=%d tid=%d OnSpawn", m->system->pid, m->tid);
   m->thread = pthread_self();
+#ifdef HAVE_SYS_GETTID
+  m->hosttid = syscall(SYS_gettid);
+#endif
   if (!(rc = sigsetjmp(m->onhalt, 1))) {
     m->canhalt = true;
     unassert(!pthread_sigmask(SIG_SETMASK, &m->spawn_sigmask, 0));
@@ -499,16 +715,37 @@ static void *OnSpawn(void *arg) {
 }
 
 #ifdef HAVE_THREADS
+static int StartHostThread(struct Machine *m) {
+  int err;
+  pthread_t thread;
+  pthread_attr_t attr;
+  m->pooled = true;
+  unassert(!pthread_attr_init(&attr));
+  unassert(!pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED));
+  // guest threads run on the stack the guest gave clone(), so the host
+  // thread only needs enough for blink itself. by default the host may
+  // reserve as much as RLIMIT_STACK, which is costly for guests having
+  // thousands of threads that are mostly sleeping
+#ifdef PTHREAD_STACK_MIN
+  unassert(
+      !pthread_attr_setstacksize(&attr, MAX(kHostStack, PTHREAD_STACK_MIN)));
+#else
+  unassert(!pthread_attr_setstacksize(&attr, kHostStack));
+#endif
+  err = pthread_create(&thread, &attr, OnSpawn, m);
+  unassert(!pthread_attr_destroy(&attr));
+  STATISTIC(++thread_creates);
+  return err;
+}
+
 static int SysSpawn(struct Machine *m, u64 flags, u64 stack, u64 ptid, u64 ctid,
                     u64 tls, u64 func) {
   int tid;
-  int err;
   int ignored;
-  pthread_t thread;
+  bool reused;
   unsigned supported;
   unsigned mandatory;
   sigset_t ss, oldss;
-  pthread_attr_t attr;
   _Atomic(int) *ptid_ptr;
   _Atomic(int) *ctid_ptr;
   struct Machine *m2 = 0;
@@ -547,7 +784,13 @@ static int SysSpawn(struct Machine *m, u64 flags, u64 stack, u64 ptid, u64 ctid,
   }
   m->threaded = true;
   m->system->jit.threaded = true;
-  if (!(m2 = NewMachine(m->system, m))) {
+  // a host thread left over by an exited guest thread is much cheaper
+  // to hand off than creating one, whose stack the host must map, etc.
+  if ((m2 = ReuseMachine(m->system, m))) {
+    reused = true;
+  } else if ((m2 = NewMachine(m->system, m))) {
+    reused = false;
+  } else {
     return eagain();
   }
   sigfillset(&ss);
@@ -565,18 +808,19 @@ static int SysSpawn(struct Machine *m, u64 flags, u64 stack, u64 ptid, u64 ctid,
   Put64(m2->ax, 0);
   Put64(m2->sp, stack);
   m2->spawn_sigmask = oldss;
-  unassert(!pthread_attr_init(&attr));
-  unassert(!pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED));
-  err = pthread_create(&thread, &attr, OnSpawn, m2);
-  unassert(!pthread_attr_destroy(&attr));
-  if (err) {
+  // this must happen before the child runs, since libc usually passes
+  // the same address for ctid, and a child that quickly exits would
+  // have its cleared tid overwritten, causing pthread_join() to hang
+  if (flags & CLONE_PARENT_SETTID_LINUX) {
+    atomic_store_explicit(ptid_ptr, Little32(tid), memory_order_release);
+  }
+  if (reused) {
+    WakeMachine(m2);
+  } else if (StartHostThread(m2)) {
     FreeMachine(m2);
     unassert(!pthread_sigmask(SIG_SETMASK, &oldss, 0));
     return eagain();
   }
-  if (flags & CLONE_PARENT_SETTID_LINUX) {
-    atomic_store_explicit(ptid_ptr, Little32(tid), memory_order_release);
-  }
   unassert(!pthread_sigmask(SIG_SETMASK, &oldss, 0));
   return tid;
 }
@@ -607,25 +851,6 @@ static int SysClone(struct Machine *m, u64 flags, u64 stack, u64 ptid, u64 ctid,
 #endif
 }
 
-static struct Futex *NewFutex(i64 addr) {
-  struct Dll *e;
-  struct Futex *f;
-  if (!(e = dll_first(g_bus->futexes.free))) {
-    LOG_ONCE(LOGF("ran out of futexes"));
-    enomem();
-    return 0;
-  }
-  dll_remove(&g_bus->futexes.free, e);
-  f = FUTEX_CONTAINER(e);
-  f->waiters = 1;
-  f->addr = addr;
-  return f;
-}
-
-static void FreeFutex(struct Futex *f) {
-  dll_make_first(&g_bus->futexes.free, &f->elem);
-}
-
 static int LoadTimespec(struct Machine *m, i64 addr, struct timespec *ts,
                         u64 mask, u64 need) {
   const struct timespec_linux *gt;
@@ -653,15 +878,16 @@ static int LoadTimespecRW(struct Machine *m, i64 addr, struct timespec *ts) {
 
 static int SysFutexWait(struct Machine *m,  //
                         i64 uaddr,          //
+                        int pid,            //
                         i32 op,             //
                         u32 expect,         //
                         i64 timeout_addr) {
   int rc;
   u8 *mem;
   struct Futex *f;
+  struct FutexBucket *b;
   const struct timespec_linux *gtimeout;
-  struct timespec now, tick, timeout, deadline;
-  now = tick = GetTime();
+  struct timespec timeout, deadline;
   if (timeout_addr) {
     if (!(gtimeout = (const struct timespec_linux *)SchlepR(
               m, timeout_addr, sizeof(*gtimeout)))) {
@@ -672,34 +898,34 @@ static int SysFutexWait(struct Machine *m,  //
     if (!(0 <= timeout.tv_nsec && timeout.tv_nsec < 1000000000)) {
       return einval();
     }
-    deadline = AddTime(now, timeout);
+    deadline = AddTime(GetTime(), timeout);
   } else {
     deadline = GetMaxTime();
   }
   if (!(mem = LookupAddress(m, uaddr))) return -1;
-  LOCK(&g_bus->futexes.lock);
+  b = GetFutexBucket(uaddr);
+  LOCK(&b->lock);
   if (Load32(mem) != expect) {
-    UNLOCK(&g_bus->futexes.lock);
+    UNLOCK(&b->lock);
     return eagain();
   }
-  if ((f = FindFutex(m, uaddr))) {
-    LOCK(&f->lock);
-    ++f->waiters;
-    UNLOCK(&f->lock);
-  }
-  if (!f) {
-    if ((f = NewFutex(uaddr))) {
-      dll_make_first(&g_bus->futexes.active, &f->elem);
-    } else {
-      UNLOCK(&g_bus->futexes.lock);
-      return -1;
-    }
+  if (!(f = AllocateFutex(b))) {
+    UNLOCK(&b->lock);
+    LOG_ONCE(LOGF("ran out of futexes"));
+    return enomem();
   }
-  UNLOCK(&g_bus->futexes.lock);
+  f->addr = uaddr;
+  f->pid = pid;
+  f->tid = 0;
+  dll_make_last(&b->active, &f->elem);
+  UNLOCK(&b->lock);
   THR_LOGF("pid=%d tid=%d is waiting at address %#" PRIx64, m->system->pid,
            m->tid, uaddr);
-  do {
-    if (m->killed) {
+  // publish our entry so that signals and thread kills can interrupt
+  // us; this must happen before we check for them, to avoid a race.
+  atomic_store_explicit(&m->futex, f, memory_order_seq_cst);
+  for (;;) {
+    if (atomic_load_explicit(&m->killed, memory_order_acquire)) {
       rc = EAGAIN;
       break;
     }
@@ -707,36 +933,134 @@ static int SysFutexWait(struct Machine *m,  //
       rc = EINTR;
       break;
     }
-    if (!(mem = LookupAddress(m, uaddr))) {
-      rc = errno;
+    if (atomic_load_explicit(&f->woken, memory_order_acquire)) {
+      rc = 0;
       break;
     }
-    LOCK(&f->lock);
-    if (Load32(mem) != expect) {
-      rc = 0;
-    } else {
-      tick = AddTime(tick, FromMilliseconds(kPollingMs));
-      if (CompareTime(tick, deadline) > 0) tick = deadline;
-      rc = pthread_cond_timedwait(&f->cond, &f->lock, &tick);
-      if (rc == ETIMEDOUT) {
-        THR_LOGF("futex wait timed out");
-      } else {
-        THR_LOGF("futex wait returned %s", DescribeHostErrno(rc));
+    if ((rc = ParkFutex(f, deadline))) {
+      THR_LOGF("futex wait timed out");
+      break;
+    }
+  }
+  atomic_store_explicit(&m->futex, 0, memory_order_release);
+  LOCK(&b->lock);
+  if (!atomic_load_explicit(&f->woken, memory_order_relaxed)) {
+    dll_remove(&b->active, &f->elem);
+  } else {
+    // we were woken, even if we also got a signal or timed out
+    rc = 0;
+  }
+  ReleaseFutex(b, f);
+  UNLOCK(&b->lock);
+  if (rc) {
+    errno = rc;
+    rc = -1;
+  }
+  return rc;
+}
+
+static int SysFutexLockPi(struct Machine *m,  //
+                          i64 uaddr,          //
+                          int pid,            //
+                          i32 op,             //
+                          i64 timeout_addr) {
+  int rc, owner;
+  u32 value, replace;
+  struct Futex *f;
+  _Atomic(u32) *word;
+  struct FutexBucket *b;
+  struct timespec deadline;
+  const struct timespec_linux *gtimeout;
+  bool trylock = op == FUTEX_TRYLOCK_PI_LINUX;
+  if (timeout_addr && !trylock) {
+    // unlike FUTEX_WAIT the timeout is absolute, and it's measured by
+    // CLOCK_REALTIME, which ParkFutex() uses, except for FUTEX_LOCK_PI2
+    // which defaults to CLOCK_MONOTONIC
+    if (!(gtimeout = (const struct timespec_linux *)SchlepR(
+              m, timeout_addr, sizeof(*gtimeout)))) {
+      return -1;
+    }
+    deadline.tv_sec = Read64(gtimeout->sec);
+    deadline.tv_nsec = Read64(gtimeout->nsec);
+    if (!(0 <= deadline.tv_nsec && deadline.tv_nsec < 1000000000)) {
+      return einval();
+    }
+    if (op == FUTEX_LOCK_PI2_LINUX) {
+      deadline = AddTime(GetTime(), SubtractTime(deadline, GetMonotonic()));
+    }
+  } else {
+    deadline = GetMaxTime();
+  }
+  if (!(word = (_Atomic(u32) *)LookupAddress(m, uaddr))) return -1;
+  b = GetFutexBucket(uaddr);
+  LOCK(&b->lock);
+  for (value = atomic_load_explicit(word, memory_order_acquire);;) {
+    owner = Little32(value) & FUTEX_TID_MASK_LINUX;
+    if (!owner) {
+      // the lock is free, or its owner died, so we take it over
+      replace = m->tid | (Little32(value) & FUTEX_OWNER_DIED_LINUX);
+      if (FindPiWaiter(b, uaddr, pid, 0)) replace |= FUTEX_WAITERS_LINUX;
+      if (atomic_compare_exchange_weak_explicit(
+              word, &value, Little32(replace), memory_order_acquire,
+              memory_order_acquire)) {
+        UNLOCK(&b->lock);
+        return 0;
       }
+    } else if (owner == m->tid) {
+      UNLOCK(&b->lock);
+      return edeadlk();
+    } else if (trylock) {
+      UNLOCK(&b->lock);
+      return eagain();
+    } else if ((Little32(value) & FUTEX_WAITERS_LINUX) ||
+               atomic_compare_exchange_weak_explicit(
+                   word, &value, value | Little32(FUTEX_WAITERS_LINUX),
+                   memory_order_acquire, memory_order_acquire)) {
+      // the owner must now call FUTEX_UNLOCK_PI, which hands it to us
+      break;
+    }
+  }
+  if (!(f = AllocateFutex(b))) {
+    UNLOCK(&b->lock);
+    LOG_ONCE(LOGF("ran out of futexes"));
+    return enomem();
+  }
+  f->addr = uaddr;
+  f->pid = pid;
+  f->tid = m->tid;
+  dll_make_last(&b->active, &f->elem);
+  UNLOCK(&b->lock);
+  THR_LOGF("pid=%d tid=%d is waiting for pi futex %#" PRIx64 " owned by %d",
+           m->system->pid, m->tid, uaddr, owner);
+  atomic_store_explicit(&m->futex, f, memory_order_seq_cst);
+  for (;;) {
+    if (atomic_load_explicit(&m->killed, memory_order_acquire)) {
+      rc = EAGAIN;
+      break;
+    }
+    if (CheckInterrupt(m, true)) {
+      // linux restarts this operation once signal handlers return, as
+      // libc treats anything but a timeout as having gotten the lock
+      m->interrupted = false;
+    }
+    if (atomic_load_explicit(&f->woken, memory_order_acquire)) {
+      rc = 0;
+      break;
     }
-    UNLOCK(&f->lock);
-  } while (rc == ETIMEDOUT && CompareTime(tick, deadline) < 0);
-  LOCK(&g_bus->futexes.lock);
-  LOCK(&f->lock);
-  if (!--f->waiters) {
-    dll_remove(&g_bus->futexes.active, &f->elem);
-    UNLOCK(&f->lock);
-    FreeFutex(f);
-    UNLOCK(&g_bus->futexes.lock);
+    if ((rc = ParkFutex(f, deadline))) {
+      break;
+    }
+  }
+  atomic_store_explicit(&m->futex, 0, memory_order_release);
+  LOCK(&b->lock);
+  if (!atomic_load_explicit(&f->woken, memory_order_relaxed)) {
+    dll_remove(&b->active, &f->elem);
   } else {
-    UNLOCK(&f->lock);
-    UNLOCK(&g_bus->futexes.lock);
+    // the lock was handed to us, even if we also timed out
+    rc = 0;
   }
+  ReleaseFutex(b, f);
+  UNLOCK(&b->lock);
   if (rc) {
     errno = rc;
     rc = -1;
@@ -751,13 +1075,22 @@ static int SysFutex(struct Machine *m,  //
                     i64 timeout_addr,   //
                     i64 uaddr2,         //
                     u32 val3) {
+  int pid;
   if (uaddr & 3) return efault();
+  pid = GetFutexOwner(m, uaddr, op);
   op &= ~FUTEX_PRIVATE_FLAG_LINUX;
   switch (op) {
     case FUTEX_WAIT_LINUX:
-      return SysFutexWait(m, uaddr, op, val, timeout_addr);
+      return SysFutexWait(m, uaddr, pid, op, val, timeout_addr);
     case FUTEX_WAKE_LINUX:
-      return SysFutexWake(m, uaddr, val);
+      return SysFutexWake(m, uaddr, pid, val);
+    case FUTEX_LOCK_PI_LINUX:
+    case FUTEX_LOCK_PI2_LINUX:
+    case FUTEX_TRYLOCK_PI_LINUX:
+    case FUTEX_LOCK_PI2_LINUX | FUTEX_CLOCK_REALTIME_LINUX:
+      return SysFutexLockPi(m, uaddr, pid, op, timeout_addr);
+    case FUTEX_UNLOCK_PI_LINUX:
+      return ReleasePiFutex(m, uaddr, pid, 0);
     case FUTEX_WAIT_BITSET_LINUX:
     case FUTEX_WAIT_BITSET_LINUX | FUTEX_CLOCK_REALTIME_LINUX:
       // will be supported soon
@@ -771,40 +1104,46 @@ static int SysFutex(struct Machine *m,  //
   }
 }
 
-static void UnlockRobustFutex(struct Machine *m, u64 futex_addr,
+static void UnlockRobustFutex(struct Machine *m, u64 futex_addr, bool ispi,
                               bool ispending) {
-  int owner;
+  int pid, owner;
   u32 value, replace;
   _Atomic(u32) *futex;
   if (futex_addr & 3) {
     LOGF("robust futex isn't aligned");
     return;
   }
-  if (!(futex = (_Atomic(u32) *)SchlepR(m, futex_addr, 4))) {
+  if (!(futex = (_Atomic(u32) *)LookupAddress(m, futex_addr))) {
     LOGF("encountered efault in robust futex list");
     return;
   }
+  pid = GetFutexOwner(m, futex_addr, 0);
   for (value = atomic_load_explicit(futex, memory_order_acquire);;) {
-    owner = value & FUTEX_TID_MASK_LINUX;
-    if (ispending && !owner) {
+    owner = Little32(value) & FUTEX_TID_MASK_LINUX;
+    if (ispending && !owner && !ispi) {
       THR_LOGF("unlocking pending ownerless futex");
-      SysFutexWake(m, futex_addr, 1);
+      SysFutexWake(m, futex_addr, pid, 1);
       return;
     }
-    if (owner && owner != m->tid) {
+    if (owner != m->tid) {
       THR_LOGF("robust futex 0x%08" PRIx32
                " was owned by %d but we're tid=%d pid=%d",
                value, owner, m->tid, m->system->pid);
       return;
     }
-    replace = FUTEX_OWNER_DIED_LINUX | (value & FUTEX_WAITERS_LINUX);
-    if (atomic_compare_exchange_weak_explicit(futex, &value, replace,
+    if (ispi) {
+      // the next waiter is handed the lock and learns its owner died
+      ReleasePiFutex(m, futex_addr, pid, FUTEX_OWNER_DIED_LINUX);
+      return;
+    }
+    replace = FUTEX_OWNER_DIED_LINUX | (Little32(value) & FUTEX_WAITERS_LINUX);
+    if (atomic_compare_exchange_weak_explicit(futex, &value, Little32(replace),
                                               memory_order_release,
                                               memory_order_acquire)) {
       THR_LOGF("successfully unlocked robust futex");
-      if (value & FUTEX_WAITERS_LINUX) {
+      if (replace & FUTEX_WAITERS_LINUX) {
         THR_LOGF("waking robust futex waiters");
-        SysFutexWake(m, futex_addr, 1);
+        SysFutexWake(m, futex_addr, pid, 1);
       }
       return;
     } else {
@@ -813,48 +1152,45 @@ static void UnlockRobustFutex(struct Machine *m, u64 futex_addr,
   }
 }
 
+// marks futexes the exiting thread still holds as having a dead owner
+// the guest's robust list head is {next, futex_offset, list_op_pending}
+// and it links the lock words of held mutexes, where pointers with the
+// low bit set indicate priority inheritance futexes.
 void UnlockRobustFutexes(struct Machine *m) {
-  if (1) return;  // TODO: Figure out how these work.
-  int limit = 1000;
-  bool once = false;
-  u64 list, item, pending;
+  int limit = 2048;
+  u64 head, item, next, pending;
+  i64 offset;
   struct robust_list_linux *data;
-  if (!(item = list = m->robust_list)) return;
+  if (!(head = m->robust_list)) return;
   m->robust_list = 0;
-  pending = 0;
-  do {
-    if (!(data = (struct robust_list_linux *)SchlepR(m, item, sizeof(*data)))) {
-      LOGF("encountered efault in robust futex list");
-      break;
-    }
-    THR_LOGF("unlocking robust futex %#" PRIx64 " {.next=%#" PRIx64
-             " .offset=%" PRId64 " .pending=%#" PRIx64 "}",
-             item, Read64(data->next), Read64(data->offset),
-             Read64(data->pending));
-    if (!once) {
-      pending = Read64(data->pending);
-      once = true;
-    }
+  if (!(data = (struct robust_list_linux *)SchlepR(m, head, sizeof(*data)))) {
+    LOGF("encountered efault in robust futex list");
+    return;
+  }
+  item = Read64(data->next);
+  offset = Read64(data->offset);
+  pending = Read64(data->pending);
+  while (item != head) {
     if (!--limit) {
       LOGF("encountered cycle or limit in robust futex list");
       break;
     }
+    if (!(data = (struct robust_list_linux *)SchlepR(m, item & -2,
+                                                     sizeof(data->next)))) {
+      LOGF("encountered efault in robust futex list");
+      break;
+    }
+    next = Read64(data->next);
+    THR_LOGF("unlocking robust futex %#" PRIx64, item);
     if (item != pending) {
-      UnlockRobustFutex(m, item + Read64(data->offset), false);
+      UnlockRobustFutex(m, (item & -2) + offset, item & 1, false);
     }
-    item = Read64(data->next);
-  } while (item != list);
-  if (!pending) return;
-  if (!(data =
-            (struct robust_list_linux *)SchlepR(m, pending, sizeof(*data)))) {
-    LOGF("encountered efault in robust futex list");
-    return;
+    item = next;
+  }
+  if (pending) {
+    THR_LOGF("unlocking pending robust futex %#" PRIx64, pending);
+    UnlockRobustFutex(m, (pending & -2) + offset, pending & 1, true);
   }
-  THR_LOGF("unlocking pending robust futex %#" PRIx64 " {.next=%#" PRIx64
-           " .offset=%" PRId64 " .pending=%#" PRIx64 "}",
-           item, Read64(data->next), Read64(data->offset),
-           Read64(data->pending));
-  UnlockRobustFutex(m, pending + Read64(data->offset), true);
 }
 
 static i32 ReturnRobustList(struct Machine *m, i64 head_ptr_addr,
@@ -898,17 +1234,33 @@ static i32 SysSetRobustList(struct Machine *m, i64 head_addr, u64 len) {
   return 0;
 }
 
-static int ValidateAffinityPid(struct Machine *m, int pid) {
+// turns guest tid into the host tid of the thread that backs it, since
+// guest tids are made up by blink and can't be passed to the host as is
+static int GetAffinityTid(struct Machine *m, int pid) {
+  int rc;
+  struct Dll *e;
+  struct Machine *m2;
   if (pid < 0) return esrch();
-  if (pid && pid != m->tid && pid != m->system->pid) return eperm();
-  return 0;
+  if (!pid || pid == m->tid) return 0;
+  rc = esrch();
+  LOCK(&m->system->machines_lock);
+  for (e = dll_first(m->system->machines); e;
+       e = dll_next(m->system->machines, e)) {
+    m2 = MACHINE_CONTAINER(e);
+    if (m2->tid == pid) {
+      rc = m2->hosttid ? m2->hosttid : m->system->pid;
+      break;
+    }
+  }
+  UNLOCK(&m->system->machines_lock);
+  return rc;
 }
 
 static int SysSchedSetaffinity(struct Machine *m,  //
                                i32 pid,            //
                                u64 cpusetsize,     //
                                i64 maskaddr) {
-  if (ValidateAffinityPid(m, pid) == -1) return -1;
+  if ((pid = GetAffinityTid(m, pid)) == -1) return -1;
 #ifdef HAVE_SCHED_GETAFFINITY
   u8 *mask;
   size_t i, n;
@@ -933,7 +1285,7 @@ static int SysSchedGetaffinity(struct Machine *m,  //
                                i32 pid,            //
                                u64 cpusetsize,     //
                                i64 maskaddr) {
-  if (ValidateAffinityPid(m, pid) == -1) return -1;
+  if ((pid = GetAffinityTid(m, pid)) == -1) return -1;
 #ifdef HAVE_SCHED_GETAFFINITY
   int rc;
   u8 *mask;
@@ -983,6 +1335,13 @@ static int SysPrctlSetTsc(struct Machine *m, i64 arg2) {
       return 0;
     case PR_TSC_SIGSEGV_LINUX:
       m->traprdtsc = true;
+      if (!m->system->trapsrdtsc) {
+        // jit paths read the counter inline without checking for traps
+        m->system->trapsrdtsc = true;
+#ifdef HAVE_JIT
+        ResetJitPages(&m->system->jit);
+#endif
+      }
       return 0;
     default:
       return einval();
@@ -1083,6 +1442,51 @@ static int SysMprotect(struct Machine *m, i64 addr, u64 size, int prot) {
 }
 
 static int SysMadvise(struct Machine *m, i64 addr, u64 len, int advice) {
+  int rc;
+  if (addr & 4095) return einval();
+  if (!len) return 0;
+  switch (advice) {
+    case MADV_DONTNEED_LINUX:
+    case MADV_FREE_LINUX:
+    case MADV_REMOVE_LINUX:
+      len = ROUNDUP(len, 4096);
+      BEGIN_NO_PAGE_FAULTS;
+      LOCK(&m->system->mmap_lock);
+      rc = DiscardVirtual(m->system, addr, len);
+      unassert(CheckMemoryInvariants(m->system));
+      UNLOCK(&m->system->mmap_lock);
+      END_NO_PAGE_FAULTS;
+      return rc;
+    default:
+      return 0;
+  }
+}
+
+static int SysMincore(struct Machine *m, i64 addr, u64 len, i64 vecaddr) {
+  long n;
+  bool mapped;
+  u8 vec[512];
+  u64 pt[512];
+  if (addr & 4095) return einval();
+  if (!len) return 0;
+  if (len > 0x800000000000) return enomem();
+  len = ROUNDUP(len, 4096);
+  if (!IsValidAddrSize(addr, len)) return enomem();
+  // residency is read out of the page table a batch at a time, and the
+  // lock isn't held while copying, since the vector might need faulting
+  for (; len; len -= n * 4096, addr += n * 4096, vecaddr += n) {
+    n = MIN(len / 4096, ARRAYLEN(pt));
+    BEGIN_NO_PAGE_FAULTS;
+    LOCK(&m->system->mmap_lock);
+    if ((mapped = IsFullyMapped(m->system, addr, n * 4096))) {
+      GetPageTableEntries(m->system, addr, n, pt);
+      GetResidentPages(m->system, addr, n, pt, vec);
+    }
+    UNLOCK(&m->system->mmap_lock);
+    END_NO_PAGE_FAULTS;
+    if (!mapped) return enomem();
+    if (CopyToUserWrite(m, vecaddr, vec, n) == -1) return -1;
+  }
   return 0;
 }
 
@@ -1097,8 +1501,7 @@ static i64 SysBrk(struct Machine *m, i64 addr) {
   if (addr >= kNullSize) {
     if (addr > m->system->brk) {
       size = addr - m->system->brk;
-      CleanseMemory(m->system, size);
-      if (m->system->rss < GetMaxRss(m->system)) {
+      if (GetRss(m->system) < GetMaxRss(m->system)) {
         if (size / 4096 + m->system->vss < GetMaxVss(m->system)) {
           if (ReserveVirtual(m->system, m->system->brk, addr - m->system->brk,
                              PAGE_FILE | PAGE_RW | PAGE_U | PAGE_XD, -1, 0, 0,
@@ -1118,7 +1521,7 @@ static i64 SysBrk(struct Machine *m, i64 addr) {
                m->system->vss, GetMaxVss(m->system), size);
         }
       } else {
-        LOGF("ran out of resident memory (%#lx / %#lx pages)", m->system->rss,
+        LOGF("ran out of resident memory (%#lx / %#lx pages)", GetRss(m->system),
              GetMaxRss(m->system));
       }
     } else if (addr < m->system->brk) {
@@ -1167,9 +1570,8 @@ static i64 SysMmapImpl(struct Machine *m, i64 virt, i64 size, int prot,
   if (!IsValidAddrSize(virt, size)) return einval();
   if (flags & MAP_GROWSDOWN_LINUX) return enotsup();
   if ((key = Prot2Page(prot)) == (u64)-1) return einval();
-  CleanseMemory(m->system, size);
-  if (m->system->rss >= GetMaxRss(m->system)) {
-    LOGF("ran out of resident memory (%lx / %lx pages)", m->system->rss,
+  if (GetRss(m->system) >= GetMaxRss(m->system)) {
+    LOGF("ran out of resident memory (%lx / %lx pages)", GetRss(m->system),
          GetMaxRss(m->system));
     return enomem();
   }
@@ -1219,7 +1621,8 @@ static i64 SysMmapImpl(struct Machine *m, i64 virt, i64 size, int prot,
       goto Finished;
     }
   }
-  if (HasLinearMapping() && FLAG_vabits <= 47 && !kSkew && !virt) {
+  if (HasLinearMapping() && FLAG_vabits <= 47 && !kSkew &&
+      !HasShadowMapping() && !virt) {
     goto CreateTheMap;
   }
   if ((!virt || !IsFullyUnmapped(m->system, virt, size))) {
@@ -1237,6 +1640,11 @@ CreateTheMap:
   if (virt != -1 && newautomap != -1) {
     m->system->automap = newautomap;
   }
+  if (virt != -1 && (flags & MAP_POPULATE_LINUX)) {
+    PopulateVirtual(m->system, virt, size,
+                    fildes == -1 && (prot & PROT_WRITE) &&
+                        !(flags & MAP_SHARED_LINUX));
+  }
 Finished:
   return virt;
 }
@@ -1253,13 +1661,73 @@ static i64 SysMmap(struct Machine *m, i64 virt, u64 size, int prot, int flags,
   return res;
 }
 
+static i64 SysMremapImpl(struct Machine *m, i64 old_address, u64 old_size,
+                         u64 new_size, int flags, i64 new_address) {
+  i64 rc, newautomap;
+  if (flags & ~(MREMAP_MAYMOVE_LINUX | MREMAP_FIXED_LINUX)) {
+    // avoid being noisy in the logs
+    // hope program has fallback for failure
+    LOG_ONCE(MEM_LOGF("unsupported mremap() flags %#x", flags));
+    return einval();
+  }
+  if ((flags & MREMAP_FIXED_LINUX) && !(flags & MREMAP_MAYMOVE_LINUX)) {
+    return einval();
+  }
+  if ((old_address & 4095) || !old_size || !new_size) return einval();
+  old_size = ROUNDUP(old_size, 4096);
+  new_size = ROUNDUP(new_size, 4096);
+  if (new_size > old_size &&
+      (new_size - old_size) / 4096 + m->system->vss > GetMaxVss(m->system)) {
+    LOGF("not enough virtual memory (%lx / %lx pages) to remap size %" PRIx64,
+         m->system->vss, GetMaxVss(m->system), new_size);
+    return enomem();
+  }
+  if (flags & MREMAP_FIXED_LINUX) {
+    if (!IsValidAddrSize(new_address, new_size)) return einval();
+    if (new_address < old_address + (i64)old_size &&
+        old_address < new_address + (i64)new_size) {
+      return einval();
+    }
+    return RemapVirtual(m->system, old_address, old_size, new_size,
+                        new_address, true);
+  }
+  rc = RemapVirtual(m->system, old_address, old_size, new_size, old_address,
+                    false);
+  if (rc != -1 || errno != ENOMEM || !(flags & MREMAP_MAYMOVE_LINUX)) {
+    return rc;
+  }
+  newautomap = -1;
+  if (HasLinearMapping() && FLAG_vabits <= 47 && !kSkew &&
+      !HasShadowMapping()) {
+    new_address = 0;
+  } else {
+    if ((new_address = FindVirtual(m->system, m->system->automap,
+                                   new_size)) == -1) {
+      return -1;
+    }
+    newautomap = ROUNDUP(new_address + new_size, FLAG_pagesize);
+    if (newautomap >= FLAG_automapend) {
+      newautomap = FLAG_automapstart;
+    }
+  }
+  rc = RemapVirtual(m->system, old_address, old_size, new_size, new_address,
+                    false);
+  if (rc != -1 && newautomap != -1) {
+    m->system->automap = newautomap;
+  }
+  return rc;
+}
+
 static i64 SysMremap(struct Machine *m, i64 old_address, u64 old_size,
                      u64 new_size, int flags, i64 new_address) {
-  // would be nice to have
-  // avoid being noisy in the logs
-  // hope program has fallback for failure
-  LOG_ONCE(MEM_LOGF("mremap() not supported yet"));
-  return enomem();
+  i64 rc;
+  BEGIN_NO_PAGE_FAULTS;
+  LOCK(&m->system->mmap_lock);
+  rc = SysMremapImpl(m, old_address, old_size, new_size, flags, new_address);
+  unassert(CheckMemoryInvariants(m->system));
+  UNLOCK(&m->system->mmap_lock);
+  END_NO_PAGE_FAULTS;
+  return rc;
 }
 
 static int XlatMsyncFlags(int flags) {
@@ -1361,7 +1829,7 @@ static int SysDup2(struct Machine *m, i32 fildes, i32 newfildes) {
   } else if ((rc = Dup2(m, fildes, newfildes)) != -1) {
     LOCK(&m->system->fds.lock);
     if ((fd = GetFd(&m->system->fds, newfildes))) {
-      dll_remove(&m->system->fds.list, &fd->elem);
+      RemoveFd(&m->system->fds, fd);
       FreeFd(fd);
     }
     unassert(fd = GetFd(&m->system->fds, fildes));
@@ -1390,7 +1858,7 @@ static int SysDup3(struct Machine *m, i32 fildes, i32 newfildes, i32 flags) {
 #endif
     LOCK(&m->system->fds.lock);
     if ((fd = GetFd(&m->system->fds, newfildes))) {
-      dll_remove(&m->system->fds.list, &fd->elem);
+      RemoveFd(&m->system->fds, fd);
       FreeFd(fd);
     }
     unassert(fd = GetFd(&m->system->fds, fildes));
@@ -1634,8 +2102,8 @@ static int GetNoRestart(struct Machine *m, int fildes, bool *norestart) {
   return 0;
 }
 
-static int SysAccept4(struct Machine *m, i32 fildes, i64 sockaddr_addr,
-                      i64 sockaddr_size_addr, i32 flags) {
+int SysAccept4(struct Machine *m, i32 fildes, i64 sockaddr_addr,
+               i64 sockaddr_size_addr, i32 flags) {
   struct Fd *fd;
   socklen_t addrlen;
   bool restartable = false;
@@ -1663,14 +2131,26 @@ static int SysAccept4(struct Machine *m, i32 fildes, i64 sockaddr_addr,
   }
   if (!(lim = GetFileDescriptorLimit(m->system))) return emfile();
   addrlen = sizeof(addr);
+#if defined(HAVE_ACCEPT4) && defined(DISABLE_VFS)
+  // have the host apply the flags too, which saves the fcntl() calls
+  // and doesn't leave a window where a concurrent exec could leak it
+  INTERRUPTIBLE(restartable,
+                newfd = accept4(fildes, (struct sockaddr *)&addr, &addrlen,
+                                (flags & SOCK_CLOEXEC_LINUX ? SOCK_CLOEXEC : 0) |
+                                    (flags & SOCK_NONBLOCK_LINUX ? SOCK_NONBLOCK
+                                                                 : 0)));
+#else
   INTERRUPTIBLE(restartable,
                 newfd = VfsAccept(fildes, (struct sockaddr *)&addr, &addrlen));
+#endif
   if (newfd != -1) {
     if (newfd >= lim) {
       VfsClose(newfd);
       newfd = emfile();
     } else {
+#if !defined(HAVE_ACCEPT4) || !defined(DISABLE_VFS)
       FixupSock(newfd, flags);
+#endif
       LOCK(&m->system->fds.lock);
       if (!(fd = GetFd(&m->system->fds, fildes)) ||
           !ForkFd(&m->system->fds, fd, newfd,
@@ -1696,6 +2176,9 @@ static int XlatSendFlags(int flags, int socktype) {
               MSG_NOSIGNAL_LINUX |   //
 #ifdef MSG_EOR
               MSG_EOR_LINUX |
+#endif
+#ifdef MSG_ZEROCOPY
+              MSG_ZEROCOPY_LINUX |
 #endif
               MSG_DONTWAIT_LINUX;
   if (flags & ~supported) {
@@ -1713,6 +2196,11 @@ static int XlatSendFlags(int flags, int socktype) {
   if (flags & MSG_DONTWAIT_LINUX) hostflags |= MSG_DONTWAIT;
 #ifdef MSG_EOR
   if (flags & MSG_EOR_LINUX) hostflags |= MSG_EOR;
+#endif
+#ifdef MSG_ZEROCOPY
+  // guest memory is host memory, so the kernel can pin it in place and
+  // the completion is reported through the error queue like on linux
+  if (flags & MSG_ZEROCOPY_LINUX) hostflags |= MSG_ZEROCOPY;
 #endif
   return hostflags;
 }
@@ -1725,6 +2213,9 @@ static int XlatRecvFlags(int flags) {
 #ifndef DISABLE_NONPOSIX
               MSG_DONTWAIT_LINUX |      //
               MSG_CMSG_CLOEXEC_LINUX |  //
+#ifdef MSG_ERRQUEUE
+              MSG_ERRQUEUE_LINUX |  //
+#endif
 #endif
               MSG_WAITALL_LINUX;
   if (flags & ~supported) {
@@ -1739,6 +2230,9 @@ static int XlatRecvFlags(int flags) {
   if (flags & MSG_DONTWAIT_LINUX) hostflags |= MSG_DONTWAIT;
 #ifdef MSG_CMSG_CLOEXEC
   if (flags & MSG_CMSG_CLOEXEC_LINUX) hostflags |= MSG_CMSG_CLOEXEC;
+#endif
+#ifdef MSG_ERRQUEUE
+  if (flags & MSG_ERRQUEUE_LINUX) hostflags |= MSG_ERRQUEUE;
 #endif
   return hostflags;
 }
@@ -1782,6 +2276,12 @@ static int UnXlatMsgFlags(int flags) {
     flags &= ~MSG_CMSG_CLOEXEC;
   }
 #endif
+#endif
+#ifdef MSG_ERRQUEUE
+  if (flags & MSG_ERRQUEUE) {
+    guestflags |= MSG_ERRQUEUE_LINUX;
+    flags &= ~MSG_ERRQUEUE;
+  }
 #endif
   if (flags) {
     LOGF("unsupported %s flags %#x", "msg", flags);
@@ -1859,13 +2359,13 @@ static void EnsureSockAddrHasDestination(struct Machine *m, int fildes,
 #endif
 }
 
-static i64 SysSendto(struct Machine *m,  //
-                     i32 fildes,         //
-                     i64 bufaddr,        //
-                     u64 buflen,         //
-                     i32 flags,          //
-                     i64 sockaddr_addr,  //
-                     i32 sockaddr_size) {
+i64 SysSendto(struct Machine *m,  //
+              i32 fildes,         //
+              i64 bufaddr,        //
+              u64 buflen,         //
+              i32 flags,          //
+              i64 sockaddr_addr,  //
+              i32 sockaddr_size) {
   ssize_t rc;
   int socktype;
   struct Fd *fd;
@@ -1909,13 +2409,13 @@ static i64 SysSendto(struct Machine *m,  //
   return HandleSigpipe(m, rc, flags);
 }
 
-static i64 SysRecvfrom(struct Machine *m,  //
-                       i32 fildes,         //
-                       i64 bufaddr,        //
-                       u64 buflen,         //
-                       i32 flags,          //
-                       i64 sockaddr_addr,  //
-                       i64 sockaddr_size_addr) {
+i64 SysRecvfrom(struct Machine *m,  //
+                i32 fildes,         //
+                i64 bufaddr,        //
+                u64 buflen,         //
+                i32 flags,          //
+                i64 sockaddr_addr,  //
+                i64 sockaddr_size_addr) {
   ssize_t rc;
   int hostflags;
   struct Iovs iv;
@@ -1944,7 +2444,8 @@ static i64 SysRecvfrom(struct Machine *m,  //
   return rc;
 }
 
-static i64 SysSendmsg(struct Machine *m, i32 fildes, i64 msgaddr, i32 flags) {
+#ifndef DISABLE_SOCKETS
+i64 SysSendmsg(struct Machine *m, i32 fildes, i64 msgaddr, i32 flags) {
   i32 len;
   u64 iovlen;
   ssize_t rc;
@@ -1991,7 +2492,7 @@ static i64 SysSendmsg(struct Machine *m, i32 fildes, i64 msgaddr, i32 flags) {
 #endif
   iovaddr = Read64(gm->iov);
   iovlen = Read64(gm->iovlen);
-  if (!iovlen || iovlen > IOV_MAX_LINUX) {
+  if (iovlen > IOV_MAX_LINUX) {
     errno = EMSGSIZE;
     return -1;
   }
@@ -2005,7 +2506,7 @@ static i64 SysSendmsg(struct Machine *m, i32 fildes, i64 msgaddr, i32 flags) {
   return HandleSigpipe(m, rc, flags);
 }
 
-static i64 SysRecvmsg(struct Machine *m, i32 fildes, i64 msgaddr, i32 flags) {
+i64 SysRecvmsg(struct Machine *m, i32 fildes, i64 msgaddr, i32 flags) {
   ssize_t rc;
   u64 iovlen;
   i64 iovaddr;
@@ -2020,13 +2521,13 @@ static i64 SysRecvmsg(struct Machine *m, i32 fildes, i64 msgaddr, i32 flags) {
   memset(&msg, 0, sizeof(msg));
   iovaddr = Read64(gm.iov);
   iovlen = Read64(gm.iovlen);
-  if (!iovlen || iovlen > IOV_MAX_LINUX) {
+  if (iovlen > IOV_MAX_LINUX) {
     errno = EMSGSIZE;
     return -1;
   }
   if (Read64(gm.controllen)) {
 #ifndef DISABLE_ANCILLARY
-    msg.msg_control = AddToFreeList(m, calloc(1, kMaxAncillary));
+    if (!(msg.msg_control = AllocateScratch(m, kMaxAncillary))) return -1;
     msg.msg_controllen = kMaxAncillary;
 #else
     LOGF("ancillary support disabled");
@@ -2062,19 +2563,176 @@ static i64 SysRecvmsg(struct Machine *m, i32 fildes, i64 msgaddr, i32 flags) {
   return rc;
 }
 
-static i64 SysSendmmsg(struct Machine *m, i32 fildes, i64 msgsaddr, u32 msgcnt,
-                       i32 flags) {
+#if defined(HAVE_MMSG) && defined(DISABLE_VFS)
+// messages may only be handed to the host in a single batch if none of
+// them carry any ancillary data, whose translation could fail midway
+static bool CanBatchMmsgs(const struct mmsghdr_linux *msgs, u32 msgcnt) {
   u32 i;
-  i64 rc;
-  u8 word[4];
-  const struct mmsghdr_linux *msgs;
-  if (!(msgs = (const struct mmsghdr_linux *)SchlepRW(
-            m, msgsaddr, msgcnt * sizeof(*msgs)))) {
-    return -1;
-  }
   for (i = 0; i < msgcnt; ++i) {
-    if ((rc = SysSendmsg(m, fildes, msgsaddr + i * sizeof(*msgs), flags)) !=
-        -1) {
+    if (Read64(msgs[i].hdr.controllen)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// translates guest message headers to host ones, whose iovecs point
+// straight into guest memory. returns how many messages were loaded
+// before the first one that couldn't be, or -1 if that was the first
+static i64 LoadMmsgs(struct Machine *m, i32 fildes, int socktype, int prot,
+                     const struct mmsghdr_linux *msgs, u32 msgcnt,
+                     struct mmsghdr *hm, struct Iovs *iv,
+                     struct sockaddr_storage *ss) {
+  u32 i;
+  int len;
+  u64 iovlen;
+  const struct msghdr_linux *gm;
+  for (i = 0; i < msgcnt; ++i) {
+    gm = &msgs[i].hdr;
+    memset(hm + i, 0, sizeof(*hm));
+    if (prot == PROT_READ) {
+      if (socktype != SOCK_STREAM && (len = Read32(gm->namelen)) > 0) {
+        if ((len = LoadSockaddr(m, Read64(gm->name), len, ss + i)) == -1) {
+          break;
+        }
+        EnsureSockAddrHasDestination(m, fildes, ss + i);
+        hm[i].msg_hdr.msg_name = ss + i;
+        hm[i].msg_hdr.msg_namelen = len;
+      }
+    } else if (Read64(gm->name)) {
+      memset(ss + i, 0, sizeof(*ss));
+      hm[i].msg_hdr.msg_name = ss + i;
+      hm[i].msg_hdr.msg_namelen = sizeof(*ss);
+    }
+    iovlen = Read64(gm->iovlen);
+    if (iovlen > IOV_MAX_LINUX) {
+      errno = EMSGSIZE;
+      break;
+    }
+    if (AppendIovsGuest(m, iv + i, Read64(gm->iov), iovlen, prot) == -1) {
+      break;
+    }
+    hm[i].msg_hdr.msg_iov = iv[i].p;
+    hm[i].msg_hdr.msg_iovlen = iv[i].i;
+  }
+  return i ? i : -1;
+}
+
+// performs sendmmsg() or recvmmsg() with one host system call
+static i64 TransferMmsgs(struct Machine *m, i32 fildes, i64 msgsaddr,
+                         const struct mmsghdr_linux *msgs, u32 msgcnt,
+                         int prot, int flags, struct timespec *timeout) {
+  u32 i;
+  i64 rc;
+  u8 word[4];
+  int socktype;
+  int hostflags;
+  struct Fd *fd;
+  struct Iovs *iv;
+  bool norestart;
+  struct mmsghdr *hm;
+  struct sockaddr_storage *ss;
+  const struct msghdr_linux *gm;
+  LOCK(&m->system->fds.lock);
+  if ((fd = GetFd(&m->system->fds, fildes))) {
+    socktype = fd->socktype;
+    norestart = fd->norestart;
+  } else {
+    socktype = 0;
+    norestart = false;
+  }
+  UNLOCK(&m->system->fds.lock);
+  if (!fd) return ebadf();
+  if (prot == PROT_READ) {
+    hostflags = XlatSendFlags(flags, socktype);
+  } else {
+    hostflags = XlatRecvFlags(flags & ~MSG_WAITFORONE_LINUX);
+    if (hostflags != -1 && (flags & MSG_WAITFORONE_LINUX)) {
+      hostflags |= MSG_WAITFORONE;
+    }
+  }
+  if (hostflags == -1) return -1;
+  msgcnt = MIN(msgcnt, kMaxMmsgs);
+  if (!(hm = (struct mmsghdr *)AddToFreeList(
+            m, malloc(msgcnt * sizeof(*hm)))) ||
+      !(iv = (struct Iovs *)AddToFreeList(m, malloc(msgcnt * sizeof(*iv)))) ||
+      !(ss = (struct sockaddr_storage *)AddToFreeList(
+            m, malloc(msgcnt * sizeof(*ss))))) {
+    return -1;
+  }
+  for (i = 0; i < msgcnt; ++i) InitIovs(iv + i);
+  if ((rc = LoadMmsgs(m, fildes, socktype, prot, msgs, msgcnt, hm, iv, ss)) !=
+      -1) {
+    if (prot == PROT_READ) {
+      INTERRUPTIBLE(!norestart, rc = sendmmsg(fildes, hm, rc, hostflags));
+    } else {
+      INTERRUPTIBLE(!norestart,
+                    rc = recvmmsg(fildes, hm, rc, hostflags, timeout));
+    }
+  }
+  for (i = 0; i < msgcnt; ++i) FreeIovs(iv + i);
+  for (i = 0; rc != -1 && i < rc; ++i) {
+    gm = &msgs[i].hdr;
+    Write32(word, hm[i].msg_len);
+    unassert(CopyToUserWrite(m,
+                             msgsaddr + i * sizeof(*msgs) +
+                                 offsetof(struct mmsghdr_linux, len),
+                             word, 4) != -1);
+    if (prot == PROT_WRITE) {
+      Write32(word, UnXlatMsgFlags(hm[i].msg_hdr.msg_flags));
+      unassert(CopyToUserWrite(m,
+                               msgsaddr + i * sizeof(*msgs) +
+                                   offsetof(struct mmsghdr_linux, hdr.flags),
+                               word, 4) != -1);
+      if (Read64(gm->name)) {
+        StoreSockaddr(m, Read64(gm->name),
+                      msgsaddr + i * sizeof(*msgs) +
+                          offsetof(struct mmsghdr_linux, hdr.namelen),
+                      (struct sockaddr *)hm[i].msg_hdr.msg_name,
+                      hm[i].msg_hdr.msg_namelen);
+      }
+    }
+  }
+  return rc;
+}
+#endif /* HAVE_MMSG && DISABLE_VFS */
+
+static void StoreRemainingTime(struct Machine *m, i64 timeoutaddr,
+                               struct timespec deadline) {
+  struct timespec now, remain;
+  struct timespec_linux gt;
+  now = GetTime();
+  if (CompareTime(now, deadline) >= 0) {
+    remain = GetZeroTime();
+  } else {
+    remain = SubtractTime(deadline, now);
+  }
+  Write64(gt.sec, remain.tv_sec);
+  Write64(gt.nsec, remain.tv_nsec);
+  CopyToUserWrite(m, timeoutaddr, &gt, sizeof(gt));
+}
+
+static i64 SysSendmmsg(struct Machine *m, i32 fildes, i64 msgsaddr, u32 msgcnt,
+                       i32 flags) {
+  u32 i;
+  i64 rc;
+  u8 word[4];
+  const struct mmsghdr_linux *msgs;
+  if (!(msgs = (const struct mmsghdr_linux *)SchlepRW(
+            m, msgsaddr, msgcnt * sizeof(*msgs)))) {
+    return -1;
+  }
+#if defined(HAVE_MMSG) && defined(DISABLE_VFS)
+  if (CanBatchMmsgs(msgs, msgcnt)) {
+    return HandleSigpipe(m,
+                         TransferMmsgs(m, fildes, msgsaddr, msgs, msgcnt,
+                                       PROT_READ, flags, 0),
+                         flags);
+  }
+#endif
+  for (i = 0; i < msgcnt; ++i) {
+    if ((rc = SysSendmsg(m, fildes, msgsaddr + i * sizeof(*msgs), flags)) !=
+        -1) {
       Write32(word, rc);
       unassert(CopyToUserWrite(m,
                                msgsaddr + i * sizeof(*msgs) +
@@ -2097,9 +2755,8 @@ static i64 SysRecvmmsg(struct Machine *m, i32 fildes, i64 msgsaddr, u32 msgcnt,
   i64 rc;
   u8 word[4];
   i32 flags2;
-  struct timespec_linux gt;
   const struct mmsghdr_linux *msgs;
-  struct timespec ts, now, remain, deadline = {0};
+  struct timespec ts, deadline = {0};
   if (!(msgs = (const struct mmsghdr_linux *)SchlepRW(
             m, msgsaddr, msgcnt * sizeof(*msgs)))) {
     return -1;
@@ -2108,6 +2765,16 @@ static i64 SysRecvmmsg(struct Machine *m, i32 fildes, i64 msgsaddr, u32 msgcnt,
     if (LoadTimespecR(m, timeoutaddr, &ts) == -1) return -1;
     deadline = AddTime(GetTime(), ts);
   }
+#if defined(HAVE_MMSG) && defined(DISABLE_VFS)
+  if (CanBatchMmsgs(msgs, msgcnt)) {
+    rc = TransferMmsgs(m, fildes, msgsaddr, msgs, msgcnt, PROT_WRITE, flags,
+                       timeoutaddr ? &ts : 0);
+    if (rc != -1 && timeoutaddr) {
+      StoreRemainingTime(m, timeoutaddr, deadline);
+    }
+    return rc;
+  }
+#endif
   for (i = 0; i < msgcnt; ++i) {
     flags2 = flags & ~MSG_WAITFORONE_LINUX;
     if ((flags & MSG_WAITFORONE_LINUX) && i) {
@@ -2144,18 +2811,11 @@ static i64 SysRecvmmsg(struct Machine *m, i32 fildes, i64 msgsaddr, u32 msgcnt,
     }
   }
   if (timeoutaddr) {
-    now = GetTime();
-    if (CompareTime(now, deadline) >= 0) {
-      remain = GetZeroTime();
-    } else {
-      remain = SubtractTime(deadline, now);
-    }
-    Write64(gt.sec, remain.tv_sec);
-    Write64(gt.nsec, remain.tv_nsec);
-    CopyToUserWrite(m, timeoutaddr, &gt, sizeof(gt));
+    StoreRemainingTime(m, timeoutaddr, deadline);
   }
   return i;
 }
+#endif /* DISABLE_SOCKETS */
 
 static int SysConnectBind(struct Machine *m, i32 fildes, i64 sockaddr_addr,
                           u32 sockaddr_size,
@@ -2190,7 +2850,7 @@ static int SysBind(struct Machine *m, int fd, i64 aa, u32 as) {
   return SysConnectBind(m, fd, aa, as, VfsBind);
 }
 
-static int SysConnect(struct Machine *m, int fd, i64 aa, u32 as) {
+int SysConnect(struct Machine *m, int fd, i64 aa, u32 as) {
   return SysConnectBind(m, fd, aa, as, VfsConnect);
 }
 
@@ -2335,8 +2995,74 @@ static int SysGetsockopt(struct Machine *m, i32 fildes, i32 level, i32 optname,
   return rc;
 }
 
-static i64 SysRead(struct Machine *m, i32 fildes, i64 addr, u64 size) {
+// character devices that are read and written so often, by the likes
+// of `dd if=/dev/zero` and `>/dev/null`, that blink serves them itself
+// rather than translate guest memory into iovecs for a host system call
+static struct HostDevices {
+  pthread_once_t_ once;
+  dev_t rdev[3];
+} g_hostdevs = {
+    PTHREAD_ONCE_INIT_,
+};
+
+static void InitHostDevices(void) {
+  int i;
+  struct stat st;
+  static const char kPaths[3][13] = {"/dev/null", "/dev/zero", "/dev/urandom"};
+  for (i = 0; i < ARRAYLEN(kPaths); ++i) {
+    if (!stat(kPaths[i], &st) && S_ISCHR(st.st_mode)) {
+      g_hostdevs.rdev[i] = st.st_rdev;
+    } else {
+      g_hostdevs.rdev[i] = (dev_t)-1;
+    }
+  }
+}
+
+// returns kFdDevXxx if fd is a device that blink serves itself, or -1
+// if it isn't. this is figured out once per fd. caller holds fds.lock
+static int GetFdDevice(struct Fd *fd) {
+  int i;
+  struct stat st;
+  if (!fd->dev) {
+    fd->dev = -1;
+    if (fd->cb == &kFdCbHost && !VfsFstat(fd->fildes, &st) &&
+        S_ISCHR(st.st_mode)) {
+      unassert(!pthread_once_(&g_hostdevs.once, InitHostDevices));
+      for (i = 0; i < ARRAYLEN(g_hostdevs.rdev); ++i) {
+        if (st.st_rdev == g_hostdevs.rdev[i]) {
+          fd->dev = kFdDevNull + i;
+          break;
+        }
+      }
+    }
+  }
+  return fd->dev;
+}
+
+static i64 ReadDevice(struct Machine *m, int dev, i64 addr, u64 size) {
+  int i;
   i64 rc;
+  struct Iovs iv;
+  if (dev == kFdDevNull || !size) return 0;
+  InitIovs(&iv);
+  if ((rc = AppendIovsReal(m, &iv, addr, size, PROT_WRITE)) != -1) {
+    for (i = 0; i < iv.i; ++i) {
+      if (dev == kFdDevZero) {
+        memset(iv.p[i].iov_base, 0, iv.p[i].iov_len);
+      } else {
+        FillRandom(iv.p[i].iov_base, iv.p[i].iov_len);
+      }
+      rc += iv.p[i].iov_len;
+    }
+    SetWriteAddr(m, addr, rc);
+  }
+  FreeIovs(&iv);
+  return rc;
+}
+
+i64 SysRead(struct Machine *m, i32 fildes, i64 addr, u64 size) {
+  i64 rc;
+  int dev;
   int oflags;
   struct Fd *fd;
   struct Iovs iv;
@@ -2347,17 +3073,25 @@ static i64 SysRead(struct Machine *m, i32 fildes, i64 addr, u64 size) {
     unassert(fd->cb);
     unassert(readv_impl = fd->cb->readv);
     oflags = fd->oflags;
+    dev = GetFdDevice(fd);
   } else {
     readv_impl = 0;
     oflags = 0;
+    dev = -1;
   }
   UNLOCK(&m->system->fds.lock);
   if (!fd) return -1;
   if ((oflags & O_ACCMODE) == O_WRONLY) return ebadf();
-  if (size) {
+  if (dev > 0) {
+    rc = ReadDevice(m, dev, addr, MIN(size, 0x7ffff000));
+  } else if (size) {
     InitIovs(&iv);
     if ((rc = AppendIovsReal(m, &iv, addr, size, PROT_WRITE)) != -1) {
-      RESTARTABLE(rc = readv_impl(fildes, iv.p, iv.i));
+      if (ShouldOffloadIo(m, fildes)) {
+        rc = OffloadIo(m, fildes, iv.p, iv.i, -1, false);
+      } else {
+        RESTARTABLE(rc = readv_impl(fildes, iv.p, iv.i));
+      }
       if (rc != -1) SetWriteAddr(m, addr, rc);
     }
     FreeIovs(&iv);
@@ -2367,9 +3101,25 @@ static i64 SysRead(struct Machine *m, i32 fildes, i64 addr, u64 size) {
   return rc;
 }
 
-static i64 SysWrite(struct Machine *m, i32 fildes, i64 addr, u64 size) {
+// guest pipes are given a bigger host buffer once bulk data flows
+static bool ShouldGrowPipe(struct Machine *m, i32 fildes, u64 size) {
+  bool res = false;
+  struct Fd *fd;
+  if (size < kPipeBulkWrite) return false;
+  LOCK(&m->system->fds.lock);
+  if ((fd = GetFd(&m->system->fds, fildes)) && fd->growpipe) {
+    fd->growpipe = false;
+    res = true;
+  }
+  UNLOCK(&m->system->fds.lock);
+  return res;
+}
+
+i64 SysWrite(struct Machine *m, i32 fildes, i64 addr, u64 size) {
   i64 rc;
+  int dev;
   int oflags;
+  bool growpipe;
   struct Fd *fd;
   struct Iovs iv;
   ssize_t (*writev_impl)(int, const struct iovec *, int);
@@ -2379,17 +3129,28 @@ static i64 SysWrite(struct Machine *m, i32 fildes, i64 addr, u64 size) {
     unassert(fd->cb);
     unassert(writev_impl = fd->cb->writev);
     oflags = fd->oflags;
+    growpipe = fd->growpipe;
+    dev = GetFdDevice(fd);
   } else {
     writev_impl = 0;
     oflags = 0;
+    growpipe = false;
+    dev = -1;
   }
   UNLOCK(&m->system->fds.lock);
   if (!fd) return -1;
   if ((oflags & O_ACCMODE) == O_RDONLY) return ebadf();
+  // like linux, the data written to these isn't even looked at
+  if (dev == kFdDevNull || dev == kFdDevZero) return MIN(size, 0x7ffff000);
+  if (growpipe && ShouldGrowPipe(m, fildes, size)) GrowPipe(fildes);
   if (size) {
     InitIovs(&iv);
     if ((rc = AppendIovsReal(m, &iv, addr, size, PROT_READ)) != -1) {
-      RESTARTABLE(rc = writev_impl(fildes, iv.p, iv.i));
+      if (ShouldOffloadIo(m, fildes)) {
+        rc = OffloadIo(m, fildes, iv.p, iv.i, -1, true);
+      } else {
+        RESTARTABLE(rc = writev_impl(fildes, iv.p, iv.i));
+      }
       if (rc != -1) SetReadAddr(m, addr, rc);
     }
     FreeIovs(&iv);
@@ -2421,8 +3182,7 @@ static long CheckFdAccess(struct Machine *m, i32 fildes, bool writable,
   return 0;
 }
 
-static i64 SysPread(struct Machine *m, i32 fildes, i64 addr, u64 size,
-                    u64 offset) {
+i64 SysPread(struct Machine *m, i32 fildes, i64 addr, u64 size, u64 offset) {
   ssize_t rc;
   struct Iovs iv;
   if (size > NUMERIC_MAX(size_t)) return eoverflow();
@@ -2430,7 +3190,11 @@ static i64 SysPread(struct Machine *m, i32 fildes, i64 addr, u64 size,
   if (size) {
     InitIovs(&iv);
     if ((rc = AppendIovsReal(m, &iv, addr, size, PROT_WRITE)) != -1) {
-      RESTARTABLE(rc = VfsPreadv(fildes, iv.p, iv.i, offset));
+      if (ShouldOffloadIo(m, fildes)) {
+        rc = OffloadIo(m, fildes, iv.p, iv.i, offset, false);
+      } else {
+        RESTARTABLE(rc = VfsPreadv(fildes, iv.p, iv.i, offset));
+      }
       if (rc != -1) SetWriteAddr(m, addr, rc);
     }
     FreeIovs(&iv);
@@ -2440,8 +3204,7 @@ static i64 SysPread(struct Machine *m, i32 fildes, i64 addr, u64 size,
   return rc;
 }
 
-static i64 SysPwrite(struct Machine *m, i32 fildes, i64 addr, u64 size,
-                     u64 offset) {
+i64 SysPwrite(struct Machine *m, i32 fildes, i64 addr, u64 size, u64 offset) {
   ssize_t rc;
   struct Iovs iv;
   if (size > NUMERIC_MAX(size_t)) return eoverflow();
@@ -2449,7 +3212,11 @@ static i64 SysPwrite(struct Machine *m, i32 fildes, i64 addr, u64 size,
   if (size) {
     InitIovs(&iv);
     if ((rc = AppendIovsReal(m, &iv, addr, size, PROT_READ)) != -1) {
-      RESTARTABLE(rc = VfsPwritev(fildes, iv.p, iv.i, offset));
+      if (ShouldOffloadIo(m, fildes)) {
+        rc = OffloadIo(m, fildes, iv.p, iv.i, offset, true);
+      } else {
+        RESTARTABLE(rc = VfsPwritev(fildes, iv.p, iv.i, offset));
+      }
       if (rc != -1) SetReadAddr(m, addr, rc);
     }
     FreeIovs(&iv);
@@ -2459,8 +3226,8 @@ static i64 SysPwrite(struct Machine *m, i32 fildes, i64 addr, u64 size,
   return rc;
 }
 
-static i64 SysPreadv2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
-                      i64 offset, i32 flags) {
+i64 SysPreadv2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
+               i64 offset, i32 flags) {
   i64 rc;
   int oflags;
   struct Fd *fd;
@@ -2488,13 +3255,21 @@ static i64 SysPreadv2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
     if ((rc = AppendIovsGuest(m, &iv, iovaddr, iovlen, PROT_WRITE)) != -1) {
       if (iv.i) {
         if (offset == -1) {
-          RESTARTABLE(rc = readv_impl(fildes, iv.p, iv.i));
+          if (ShouldOffloadIo(m, fildes)) {
+            rc = OffloadIo(m, fildes, iv.p, iv.i, -1, false);
+          } else {
+            RESTARTABLE(rc = readv_impl(fildes, iv.p, iv.i));
+          }
         } else if (offset < 0) {
           return einval();
         } else if (offset > NUMERIC_MAX(off_t)) {
           return eoverflow();
         } else {
-          RESTARTABLE(rc = VfsPreadv(fildes, iv.p, iv.i, offset));
+          if (ShouldOffloadIo(m, fildes)) {
+            rc = OffloadIo(m, fildes, iv.p, iv.i, offset, false);
+          } else {
+            RESTARTABLE(rc = VfsPreadv(fildes, iv.p, iv.i, offset));
+          }
         }
       } else {
         rc = 0;
@@ -2507,10 +3282,11 @@ static i64 SysPreadv2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
   return rc;
 }
 
-static i64 SysPwritev2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
-                       i64 offset, i32 flags) {
+i64 SysPwritev2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
+                i64 offset, i32 flags) {
   i64 rc;
   int oflags;
+  bool growpipe;
   struct Fd *fd;
   struct Iovs iv;
   ssize_t (*writev_impl)(int, const struct iovec *, int);
@@ -2524,9 +3300,11 @@ static i64 SysPwritev2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
     unassert(fd->cb);
     unassert(writev_impl = fd->cb->writev);
     oflags = fd->oflags;
+    growpipe = fd->growpipe;
   } else {
     writev_impl = 0;
     oflags = 0;
+    growpipe = false;
   }
   UNLOCK(&m->system->fds.lock);
   if (!fd) return -1;
@@ -2536,14 +3314,25 @@ static i64 SysPwritev2(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
     if ((rc = AppendIovsGuest(m, &iv, iovaddr, iovlen, PROT_READ)) != -1) {
       if (iv.i) {
         if (offset == -1) {
-          RESTARTABLE(rc = writev_impl(fildes, iv.p, iv.i));
+          if (growpipe && ShouldGrowPipe(m, fildes, GetIovsSize(&iv))) {
+            GrowPipe(fildes);
+          }
+          if (ShouldOffloadIo(m, fildes)) {
+            rc = OffloadIo(m, fildes, iv.p, iv.i, -1, true);
+          } else {
+            RESTARTABLE(rc = writev_impl(fildes, iv.p, iv.i));
+          }
           rc = HandleSigpipe(m, rc, 0);
         } else if (offset < 0) {
           return einval();
         } else if (offset > NUMERIC_MAX(off_t)) {
           return eoverflow();
         } else {
-          RESTARTABLE(rc = VfsPwritev(fildes, iv.p, iv.i, offset));
+          if (ShouldOffloadIo(m, fildes)) {
+            rc = OffloadIo(m, fildes, iv.p, iv.i, offset, true);
+          } else {
+            RESTARTABLE(rc = VfsPwritev(fildes, iv.p, iv.i, offset));
+          }
         }
       } else {
         rc = 0;
@@ -2576,48 +3365,212 @@ static i64 SysPwritev(struct Machine *m, i32 fildes, i64 iovaddr, u32 iovlen,
   return SysPwritev2(m, fildes, iovaddr, iovlen, offset, 0);
 }
 
-static i64 SysSendfile(struct Machine *m, i32 out_fd, i32 in_fd, i64 offsetaddr,
-                       u64 count) {
-  u64 toto, offset;
-  ssize_t got, wrote;
-  u8 *buf, *offsetp = 0;
-  size_t chunk, maxchunk = 16384;
-  if (CheckFdAccess(m, out_fd, true, EBADF) == -1) return -1;
-  if (CheckFdAccess(m, in_fd, false, EBADF) == -1) return -1;
-  if (offsetaddr && !(offsetp = (u8 *)SchlepRW(m, offsetaddr, 8))) return -1;
-  if (!(buf = (u8 *)AddToFreeList(m, malloc(maxchunk)))) return -1;
-  if (offsetp) {
-    offset = Read64(offsetp);
-    if ((i64)offset < 0) return einval();
-    if (Read64(offsetp) + count < count ||
-        Read64(offsetp) + count > NUMERIC_MAX(off_t)) {
-      return eoverflow();
-    }
+// returns true if guest fd may be handed directly to host system calls
+static bool IsHostFd(struct Machine *m, i32 fildes) {
+#ifdef DISABLE_VFS
+  bool res;
+  struct Fd *fd;
+  LOCK(&m->system->fds.lock);
+  res = (fd = GetFd(&m->system->fds, fildes)) && fd->cb == &kFdCbHost &&
+        !fd->dirstream;
+  UNLOCK(&m->system->fds.lock);
+  return res;
+#else
+  return false;
+#endif
+}
+
+// fetches optional guest loff_t pointer argument
+static int GetOffsetArg(struct Machine *m, i64 addr, u8 **out_p, u64 count) {
+  u64 offset;
+  *out_p = 0;
+  if (!addr) return 0;
+  if (!(*out_p = (u8 *)SchlepRW(m, addr, 8))) return -1;
+  offset = Read64(*out_p);
+  if ((i64)offset < 0) return einval();
+  if (offset + count < count || offset + count > NUMERIC_MAX(off_t)) {
+    return eoverflow();
   }
+  return 0;
+}
+
+// copies bytes between fds through a host buffer, so guest memory isn't
+// touched. this is how sendfile(), splice() and copy_file_range() work
+// when the host doesn't have them, or won't do them for a pair of fds.
+// it stops after a short read, since pipes and sockets shouldn't block
+// waiting for the rest of the count once some data has been moved.
+static i64 CopyFdRange(struct Machine *m, i32 out_fd, u8 *out_offp, i32 in_fd,
+                       u8 *in_offp, u64 count) {
+  u64 toto;
+  u8 *buf;
+  size_t chunk, maxchunk = 65536;
+  ssize_t got, wrote, done;
+  if (!(buf = (u8 *)AddToFreeList(m, malloc(maxchunk)))) return -1;
   for (toto = 0; toto < count;) {
     chunk = MIN(count - toto, maxchunk);
-    if (offsetp) {
-      got = VfsPread(in_fd, buf, chunk, offset + toto);
+    if (in_offp) {
+      got = VfsPread(in_fd, buf, chunk, Read64(in_offp));
     } else {
       got = VfsRead(in_fd, buf, chunk);
     }
     if (got == -1) goto OnFailure;
-    if (offsetp) Write64(offsetp, offset + toto + got);
     if (got == 0) break;
-    while (got > 0) {
-      if ((wrote = VfsWrite(out_fd, buf, got)) == -1) goto OnFailure;
+    if (in_offp) Write64(in_offp, Read64(in_offp) + got);
+    for (done = 0; done < got; done += wrote) {
+      if (out_offp) {
+        wrote = VfsPwrite(out_fd, buf + done, got - done, Read64(out_offp));
+      } else {
+        wrote = VfsWrite(out_fd, buf + done, got - done);
+      }
+      if (wrote == -1) goto OnFailure;
+      if (out_offp) Write64(out_offp, Read64(out_offp) + wrote);
       toto += wrote;
-      got -= wrote;
     }
+    if (got < chunk) break;
   }
   return toto;
 OnFailure:
   if (toto) {
-    LOGF("sendfile() partial failure: %s", DescribeHostErrno(errno));
+    LOGF("fd copy partial failure: %s", DescribeHostErrno(errno));
     return toto;
   } else {
-    return -1;
+    return HandleSigpipe(m, -1, 0);
+  }
+}
+
+static i64 SysSendfile(struct Machine *m, i32 out_fd, i32 in_fd, i64 offsetaddr,
+                       u64 count) {
+  u8 *offsetp;
+  if (CheckFdAccess(m, out_fd, true, EBADF) == -1) return -1;
+  if (CheckFdAccess(m, in_fd, false, EBADF) == -1) return -1;
+  if (GetOffsetArg(m, offsetaddr, &offsetp, count) == -1) return -1;
+#ifdef HAVE_SENDFILE
+  if (IsHostFd(m, out_fd) && IsHostFd(m, in_fd)) {
+    off_t off;
+    ssize_t rc;
+    if (offsetp) off = Read64(offsetp);
+    rc = sendfile(out_fd, in_fd, offsetp ? &off : 0, MIN(count, 0x7ffff000));
+    if (rc != -1) {
+      if (offsetp) Write64(offsetp, off);
+      return rc;
+    }
+    if (errno != EINVAL && errno != ENOSYS) return HandleSigpipe(m, -1, 0);
+  }
+#endif
+  return CopyFdRange(m, out_fd, 0, in_fd, offsetp, count);
+}
+
+static bool IsPipe(i32 fildes) {
+  struct stat st;
+  return !VfsFstat(fildes, &st) && S_ISFIFO(st.st_mode);
+}
+
+static i64 SysSplice(struct Machine *m, i32 in_fd, i64 in_offaddr, i32 out_fd,
+                     i64 out_offaddr, u64 count, u32 flags) {
+  u8 *in_offp, *out_offp;
+  if (flags & ~(SPLICE_F_MOVE_LINUX | SPLICE_F_NONBLOCK_LINUX |
+                SPLICE_F_MORE_LINUX | SPLICE_F_GIFT_LINUX)) {
+    return einval();
+  }
+  if (CheckFdAccess(m, out_fd, true, EBADF) == -1) return -1;
+  if (CheckFdAccess(m, in_fd, false, EBADF) == -1) return -1;
+  if (!IsPipe(in_fd) && !IsPipe(out_fd)) return einval();
+  if ((in_offaddr && IsPipe(in_fd)) || (out_offaddr && IsPipe(out_fd))) {
+    return espipe();
+  }
+  if (GetOffsetArg(m, in_offaddr, &in_offp, count) == -1) return -1;
+  if (GetOffsetArg(m, out_offaddr, &out_offp, count) == -1) return -1;
+#ifdef HAVE_SPLICE
+  if (IsHostFd(m, out_fd) && IsHostFd(m, in_fd)) {
+    ssize_t rc;
+    loff_t in_off, out_off;
+    if (in_offp) in_off = Read64(in_offp);
+    if (out_offp) out_off = Read64(out_offp);
+    RESTARTABLE(rc = splice(in_fd, in_offp ? &in_off : 0, out_fd,
+                            out_offp ? &out_off : 0, MIN(count, 0x7ffff000),
+                            flags));
+    if (rc != -1) {
+      if (in_offp) Write64(in_offp, in_off);
+      if (out_offp) Write64(out_offp, out_off);
+      return rc;
+    }
+    if (errno != EINVAL && errno != ENOSYS) return HandleSigpipe(m, -1, 0);
+  }
+#endif
+  return CopyFdRange(m, out_fd, out_offp, in_fd, in_offp, count);
+}
+
+static i64 SysTee(struct Machine *m, i32 in_fd, i32 out_fd, u64 count,
+                  u32 flags) {
+  if (flags & ~(SPLICE_F_MOVE_LINUX | SPLICE_F_NONBLOCK_LINUX |
+                SPLICE_F_MORE_LINUX | SPLICE_F_GIFT_LINUX)) {
+    return einval();
+  }
+  if (CheckFdAccess(m, out_fd, true, EBADF) == -1) return -1;
+  if (CheckFdAccess(m, in_fd, false, EBADF) == -1) return -1;
+  if (!IsPipe(in_fd) || !IsPipe(out_fd)) return einval();
+#ifdef HAVE_SPLICE
+  if (IsHostFd(m, out_fd) && IsHostFd(m, in_fd)) {
+    ssize_t rc;
+    RESTARTABLE(rc = tee(in_fd, out_fd, MIN(count, 0x7ffff000), flags));
+    return HandleSigpipe(m, rc, 0);
+  }
+#endif
+  // pipe data can't be duplicated without consuming it otherwise
+  return enosys();
+}
+
+// vmsplice() is about guest memory by definition, so it's the same as
+// writev() into a pipe write end, or readv() from a pipe read end
+static i64 SysVmsplice(struct Machine *m, i32 fildes, i64 iovaddr, u64 iovlen,
+                       u32 flags) {
+  int oflags;
+  struct Fd *fd;
+  if (flags & ~(SPLICE_F_MOVE_LINUX | SPLICE_F_NONBLOCK_LINUX |
+                SPLICE_F_MORE_LINUX | SPLICE_F_GIFT_LINUX)) {
+    return einval();
+  }
+  if (iovlen > IOV_MAX_LINUX) return einval();
+  LOCK(&m->system->fds.lock);
+  oflags = (fd = GetFd(&m->system->fds, fildes)) ? fd->oflags : 0;
+  UNLOCK(&m->system->fds.lock);
+  if (!fd) return -1;
+  if (!IsPipe(fildes)) return ebadf();
+  if ((oflags & O_ACCMODE) == O_RDONLY) {
+    return SysPreadv2(m, fildes, iovaddr, iovlen, -1, 0);
+  } else {
+    return SysPwritev2(m, fildes, iovaddr, iovlen, -1, 0);
+  }
+}
+
+static i64 SysCopyFileRange(struct Machine *m, i32 in_fd, i64 in_offaddr,
+                            i32 out_fd, i64 out_offaddr, u64 count,
+                            u32 flags) {
+  u8 *in_offp, *out_offp;
+  if (flags) return einval();
+  if (CheckFdAccess(m, out_fd, true, EBADF) == -1) return -1;
+  if (CheckFdAccess(m, in_fd, false, EBADF) == -1) return -1;
+  if (GetOffsetArg(m, in_offaddr, &in_offp, count) == -1) return -1;
+  if (GetOffsetArg(m, out_offaddr, &out_offp, count) == -1) return -1;
+#ifdef HAVE_COPY_FILE_RANGE
+  if (IsHostFd(m, out_fd) && IsHostFd(m, in_fd)) {
+    ssize_t rc;
+    off_t in_off, out_off;
+    if (in_offp) in_off = Read64(in_offp);
+    if (out_offp) out_off = Read64(out_offp);
+    RESTARTABLE(rc = copy_file_range(in_fd, in_offp ? &in_off : 0, out_fd,
+                                     out_offp ? &out_off : 0,
+                                     MIN(count, 0x7ffff000), 0));
+    if (rc != -1) {
+      if (in_offp) Write64(in_offp, in_off);
+      if (out_offp) Write64(out_offp, out_off);
+      return rc;
+    }
+    // e.g. older kernels refuse to copy between filesystems
+    if (errno != EXDEV && errno != ENOSYS && errno != EOPNOTSUPP) return -1;
   }
+#endif
+  return CopyFdRange(m, out_fd, out_offp, in_fd, in_offp, count);
 }
 
 static int UnXlatDt(int x) {
@@ -2642,6 +3595,7 @@ static int UnXlatDt(int x) {
 static i64 Getdents(struct Machine *m, i32 fildes, i64 addr, i64 size,
                     struct Fd *fd) {
   i64 i;
+  u8 *buf;
   int type;
   off_t off;
   int reclen;
@@ -2656,6 +3610,10 @@ static i64 Getdents(struct Machine *m, i32 fildes, i64 addr, i64 size,
   if (!fd->dirstream && !(fd->dirstream = VfsOpendir(fd->fildes))) {
     return -1;
   }
+  // records are assembled on the host side and then copied into guest
+  // memory in one go, rather than paying a page walk for every entry.
+  size = MIN(size, kGetdentsMax);
+  if (!(buf = (u8 *)malloc(size))) return enomem();
   for (i = 0; i + sizeof(rec) <= size; i += reclen) {
     // telldir() can actually return negative on ARM/MIPS/i386
 #ifdef HAVE_SEEKDIR
@@ -2710,8 +3668,10 @@ static i64 Getdents(struct Machine *m, i32 fildes, i64 addr, i64 size,
     Write16(rec.reclen, reclen);
     Write8(rec.type, type);
     strcpy(rec.name, ent->d_name);
-    CopyToUserWrite(m, addr + i, &rec, reclen);
+    memcpy(buf + i, &rec, reclen);
   }
+  if (i) CopyToUserWrite(m, addr, buf, i);
+  free(buf);
   return i;
 }
 
@@ -2988,7 +3948,7 @@ static int CheckSyncable(int fildes) {
   return 0;
 }
 
-static int SysFsync(struct Machine *m, i32 fildes) {
+int SysFsync(struct Machine *m, i32 fildes) {
   if (CheckSyncable(fildes) == -1) return -1;
 #ifdef F_FULLSYNC
   int rc;
@@ -3012,7 +3972,7 @@ static int SysFsync(struct Machine *m, i32 fildes) {
 #endif
 }
 
-static int SysFdatasync(struct Machine *m, i32 fildes) {
+int SysFdatasync(struct Machine *m, i32 fildes) {
   if (CheckSyncable(fildes) == -1) return -1;
 #ifdef F_FULLSYNC
   int rc;
@@ -3543,6 +4503,7 @@ static void ExecveBlink(struct Machine *m, char *prog, char **argv,
       // TODO(jart): Prevent possibility of stack overflow.
       SYS_LOGF("m->system->exec(%s)", prog);
       SysCloseExec(m->system);
+      CloseVforkPipe(m->system);
       ResetTimerDispositions(m->system);
       ResetSignalDispositions(m->system);
       _Exit(m->system->exec(execfn, prog, argv, envp));
@@ -3559,6 +4520,7 @@ static int SysExecve(struct Machine *m, i64 pa, i64 aa, i64 ea) {
   LOCK(&m->system->exec_lock);
   ExecveBlink(m, prog, argv, envp);
   SYS_LOGF("execve(%s)", prog);
+  FlushLog();
   VfsExecve(prog, argv, envp);
   UNLOCK(&m->system->exec_lock);
   return -1;
@@ -3626,6 +4588,129 @@ static int SysWait4(struct Machine *m, int pid, i64 opt_out_wstatus_addr,
   return rc;
 }
 
+static int SysWaitid(struct Machine *m, int idtype, int id, i64 infoaddr,
+                     int options, i64 rusageaddr) {
+  int rc;
+  idtype_t type;
+  siginfo_t si;
+  i32 code, status;
+  struct rusage hrusage;
+  struct siginfo_linux gsi;
+  struct rusage_linux grusage;
+#if defined(HAVE_PIDFD) && !defined(DISABLE_VFS)
+  struct VfsInfo *pidfd = 0;
+#endif
+  switch (idtype) {
+    case P_ALL_LINUX:
+      type = P_ALL;
+      break;
+    case P_PID_LINUX:
+      type = P_PID;
+      break;
+    case P_PGID_LINUX:
+      type = P_PGID;
+      break;
+#ifdef HAVE_PIDFD
+    case P_PIDFD_LINUX:
+      // pidfds are host fds and the c library passes idtype along as is
+      type = (idtype_t)P_PIDFD_LINUX;
+      break;
+#endif
+    default:
+      LOGF("%s idtype %d not supported yet", "waitid", idtype);
+      return einval();
+  }
+  if ((options = XlatWaitid(options)) == -1) return -1;
+  if ((infoaddr && !IsValidMemory(m, infoaddr, sizeof(gsi), PROT_WRITE)) ||
+      (rusageaddr &&
+       !IsValidMemory(m, rusageaddr, sizeof(grusage), PROT_WRITE))) {
+    return -1;
+  }
+  memset(&si, 0, sizeof(si));
+  memset(&hrusage, 0, sizeof(hrusage));
+#if defined(HAVE_PIDFD) && !defined(DISABLE_VFS)
+  if (idtype == P_PIDFD_LINUX && (id = VfsGetHostFd(id, &pidfd)) == -1) {
+    return -1;
+  }
+#endif
+#if defined(HAVE_WAIT4) && defined(WNOWAIT)
+  if (rusageaddr && !(options & WNOWAIT)) {
+    // the host waitid() can't report resource usage, so we peek at the
+    // child's state change and then consume it with wait4() which can
+    RESTARTABLE(rc = waitid(type, id, &si, options | WNOWAIT));
+    if (rc != -1 && si.si_pid) {
+      int wstatus, reap = WNOHANG;
+      if (si.si_code == CLD_STOPPED || si.si_code == CLD_TRAPPED) {
+        reap |= WUNTRACED;
+#ifdef WCONTINUED
+      } else if (si.si_code == CLD_CONTINUED) {
+        reap |= WCONTINUED;
+#endif
+      }
+      wait4(si.si_pid, &wstatus, reap, &hrusage);
+    }
+  } else {
+    RESTARTABLE(rc = waitid(type, id, &si, options));
+  }
+#else
+  RESTARTABLE(rc = waitid(type, id, &si, options));
+#endif
+#if defined(HAVE_PIDFD) && !defined(DISABLE_VFS)
+  if (pidfd) unassert(!VfsFreeInfo(pidfd));
+#endif
+  if (rc != -1) {
+    if (infoaddr) {
+      // linux clears the siginfo if WNOHANG found no waitable children
+      memset(&gsi, 0, sizeof(gsi));
+      if (si.si_pid) {
+        switch (si.si_code) {
+          case CLD_EXITED:
+            code = CLD_EXITED_LINUX;
+            status = si.si_status & 255;
+            break;
+          case CLD_KILLED:
+            code = CLD_KILLED_LINUX;
+            status = UnXlatSignal(si.si_status);
+            break;
+          case CLD_DUMPED:
+            code = CLD_DUMPED_LINUX;
+            status = UnXlatSignal(si.si_status);
+            break;
+          case CLD_TRAPPED:
+            code = CLD_TRAPPED_LINUX;
+            status = UnXlatSignal(si.si_status);
+            break;
+          case CLD_STOPPED:
+            code = CLD_STOPPED_LINUX;
+            status = UnXlatSignal(si.si_status);
+            break;
+          case CLD_CONTINUED:
+            code = CLD_CONTINUED_LINUX;
+            status = UnXlatSignal(si.si_status);
+            break;
+          default:
+            LOGF("unexpected waitid() si_code %d", si.si_code);
+            code = si.si_code;
+            status = si.si_status;
+            break;
+        }
+        SYS_LOGF("waitid() pid %d code %d status %d", si.si_pid, code, status);
+        Write32(gsi.signo, SIGCHLD_LINUX);
+        Write32(gsi.code, code);
+        Write32(gsi.pid, si.si_pid);
+        Write32(gsi.uid, si.si_uid);
+        Write32(gsi.status, status);
+      }
+      CopyToUserWrite(m, infoaddr, &gsi, sizeof(gsi));
+    }
+    if (rusageaddr) {
+      XlatRusageToLinux(&grusage, &hrusage);
+      CopyToUserWrite(m, rusageaddr, &grusage, sizeof(grusage));
+    }
+  }
+  return rc;
+}
+
 static int SysGetrusage(struct Machine *m, i32 resource, i64 rusageaddr) {
   int rc;
   struct rusage hrusage;
@@ -3758,7 +4843,12 @@ static ssize_t SysGetrandom(struct Machine *m, i64 a, size_t n, int f) {
   }
   if (n) {
     if (!(p = (char *)AddToFreeList(m, malloc(n)))) return -1;
-    RESTARTABLE(rc = GetRandom(p, n, f));
+    if (n <= kRandomSmall && !(f & GRND_RANDOM_LINUX)) {
+      FillRandom(p, n);
+      rc = n;
+    } else {
+      RESTARTABLE(rc = GetRandom(p, n, f));
+    }
     if (rc != -1) {
       if (CopyToUserWrite(m, a, p, rc) == -1) {
         rc = -1;
@@ -3775,13 +4865,51 @@ void OnSignal(int sig, siginfo_t *si, void *uc) {
   EnqueueSignal(g_machine, UnXlatSignal(sig));
 }
 
+// mirrors s->hands[sig - 1] onto the host, which needs s->sig_lock
+void InstallHostSignalHandler(struct System *s, int sig) {
+  int syssig;
+  u64 flags, handler;
+  struct sigaction syshand;
+  if ((syssig = XlatSignal(sig)) == -1 || IsBlinkSig(s, sig)) return;
+  flags = Read64(s->hands[sig - 1].flags);
+  handler = Read64(s->hands[sig - 1].handler);
+  if (handler == SIG_IGN_LINUX) flags &= ~SA_NOCLDWAIT_LINUX;
+  sigfillset(&syshand.sa_mask);
+  syshand.sa_flags = SA_SIGINFO;
+  if (flags & SA_NOCLDSTOP_LINUX) syshand.sa_flags |= SA_NOCLDSTOP;
+#ifdef SA_NOCLDWAIT
+  if (flags & SA_NOCLDWAIT_LINUX) syshand.sa_flags |= SA_NOCLDWAIT;
+#endif
+  switch (handler) {
+    case SIG_DFL_LINUX:
+      // signalfd() needs to hear about signals the guest has blocked,
+      // and linux keeps them pending rather than taking default action
+      if ((GetSignalFdMask(s) |
+           atomic_load_explicit(&s->heldsigs, memory_order_relaxed)) &
+          ((u64)1 << (sig - 1))) {
+        syshand.sa_sigaction = OnSignal;
+      } else {
+        syshand.sa_handler = SIG_DFL;
+      }
+      break;
+    case SIG_IGN_LINUX:
+      syshand.sa_handler = SIG_IGN;
+      break;
+    default:
+      syshand.sa_sigaction = OnSignal;
+      break;
+  }
+  if (sigaction(syssig, &syshand, 0)) {
+    LOGF("system sigaction(%s) returned %s", DescribeSignal(sig),
+         DescribeHostErrno(errno));
+  }
+}
+
 static int SysSigaction(struct Machine *m, int sig, i64 act, i64 old,
                         u64 sigsetsize) {
-  int syssig;
   u64 flags = 0;
   i64 handler = 0;
   bool isignored = false;
-  struct sigaction syshand;
   struct sigaction_linux hand;
   u32 supported = SA_SIGINFO_LINUX |    //
                   SA_RESTART_LINUX |    //
@@ -3838,39 +4966,41 @@ static int SysSigaction(struct Machine *m, int sig, i64 act, i64 old,
     if (isignored) {
       m->signals &= ~((u64)1 << (sig - 1));
     }
-    if ((syssig = XlatSignal(sig)) != -1 && !IsBlinkSig(m->system, sig)) {
-      sigfillset(&syshand.sa_mask);
-      syshand.sa_flags = SA_SIGINFO;
-      if (flags & SA_NOCLDSTOP_LINUX) syshand.sa_flags |= SA_NOCLDSTOP;
-#ifdef SA_NOCLDWAIT
-      if (flags & SA_NOCLDWAIT_LINUX) syshand.sa_flags |= SA_NOCLDWAIT;
-#endif
-      switch (handler) {
-        case SIG_DFL_LINUX:
-          syshand.sa_handler = SIG_DFL;
-          break;
-        case SIG_IGN_LINUX:
-          syshand.sa_handler = SIG_IGN;
-          break;
-        default:
-          syshand.sa_sigaction = OnSignal;
-          break;
-      }
-      if (sigaction(syssig, &syshand, 0)) {
-        LOGF("system sigaction(%s) returned %s", DescribeSignal(sig),
-             DescribeHostErrno(errno));
-      }
-    }
+    InstallHostSignalHandler(m->system, sig);
   }
   UNLOCK(&m->system->sig_lock);
   return 0;
 }
 
+/**
+ * Makes the host deliver signals the way the guest asked for them.
+ *
+ * This is needed when guest dispositions are put in place by something
+ * besides rt_sigaction(), e.g. when restoring a snapshot.
+ */
+void RestoreSignalHandlers(struct System *s) {
+  int sig;
+  LOCK(&s->sig_lock);
+  for (sig = 1; sig <= 64; ++sig) {
+    if (Read64(s->hands[sig - 1].handler) != SIG_DFL_LINUX) {
+      InstallHostSignalHandler(s, sig);
+    }
+  }
+  UNLOCK(&s->sig_lock);
+}
+
 static int SysGetitimer(struct Machine *m, int which, i64 curvaladdr) {
   int rc;
   struct itimerval it;
   struct itimerval_linux git;
-  if ((rc = getitimer(UnXlatItimer(which), &it)) != -1) {
+  if (FLAG_profile && which == ITIMER_PROF_LINUX) {
+    // BLINK_PROFILE owns the host's profiling timer
+    memset(&it, 0, sizeof(it));
+    rc = 0;
+  } else {
+    rc = getitimer(UnXlatItimer(which), &it);
+  }
+  if (rc != -1) {
     XlatItimervalToLinux(&git, &it);
     CopyToUserWrite(m, curvaladdr, &git, sizeof(git));
   }
@@ -3894,7 +5024,14 @@ static int SysSetitimer(struct Machine *m, int which, i64 neuaddr,
   } else {
     neup = 0;
   }
-  if ((rc = setitimer(UnXlatItimer(which), neup, &old)) != -1) {
+  if (FLAG_profile && which == ITIMER_PROF_LINUX) {
+    LOG_ONCE(LOGF("ignoring guest ITIMER_PROF since BLINK_PROFILE is set"));
+    memset(&old, 0, sizeof(old));
+    rc = 0;
+  } else {
+    rc = setitimer(UnXlatItimer(which), neup, &old);
+  }
+  if (rc != -1) {
     if (oldaddr) {
       XlatItimervalToLinux(&gold, &old);
       CopyToUserWrite(m, oldaddr, &gold, sizeof(gold));
@@ -3903,11 +5040,51 @@ static int SysSetitimer(struct Machine *m, int which, i64 neuaddr,
   return rc;
 }
 
+#ifdef HAVE_PPOLL
+// sleeps until the clock reaches the deadline, or a guest signal needs
+// to be delivered. host signals are blocked between checking for guest
+// signals and sleeping, and ppoll() unblocks them atomically, so there
+// isn't a window in which a signal could arrive and then go unnoticed
+// until the deadline. the sleep is a single host wait, so it's precise
+static int SleepUntil(struct Machine *m, clock_t clock,
+                      struct timespec deadline) {
+  int rc;
+  sigset_t block, oldmask;
+  struct timespec now, wait;
+  unassert(!sigfillset(&block));
+  for (;;) {
+    // this may run a guest signal handler before returning
+    if (CheckInterrupt(m, false)) return -1;
+    unassert(!pthread_sigmask(SIG_BLOCK, &block, &oldmask));
+    if (atomic_load_explicit(&m->killed, memory_order_acquire)) {
+      rc = eintr();  // don't hold up exit_group() until the deadline
+    } else if (m->signals & ~m->sigmask) {
+      rc = 1;  // arrived after the check
+    } else {
+      unassert(!clock_gettime(clock, &now));
+      if (CompareTime(now, deadline) < 0) {
+        wait = SubtractTime(deadline, now);
+        ppoll(0, 0, &wait, &oldmask);
+        rc = 1;
+      } else {
+        rc = 0;
+      }
+    }
+    unassert(!pthread_sigmask(SIG_SETMASK, &oldmask, 0));
+    if (rc <= 0) return rc;
+  }
+}
+#endif
+
 static int SysNanosleep(struct Machine *m, i64 req, i64 rem) {
   struct timespec_linux gt;
   const struct timespec_linux *gtp;
   struct timespec ts, now, deadline;
+#ifdef HAVE_PPOLL
+  now = GetMonotonic();
+#else
   now = GetTime();
+#endif
   if ((rem && !IsValidMemory(m, rem, sizeof(gtp), PROT_WRITE)) ||
       !(gtp = (const struct timespec_linux *)SchlepR(m, req, sizeof(*gtp)))) {
     return -1;
@@ -3917,6 +5094,22 @@ static int SysNanosleep(struct Machine *m, i64 req, i64 rem) {
   if (ts.tv_sec < 0) return einval();
   if (!(0 <= ts.tv_nsec && ts.tv_nsec < 1000000000)) return einval();
   deadline = AddTime(now, ts);
+#ifdef HAVE_PPOLL
+  if (!SleepUntil(m, CLOCK_MONOTONIC, deadline)) return 0;
+  if (rem) {
+    // rem is only updated when -1 w/ eintr is returned
+    now = GetMonotonic();
+    if (CompareTime(now, deadline) < 0) {
+      ts = SubtractTime(deadline, now);
+    } else {
+      ts = GetZeroTime();
+    }
+    Write64(gt.sec, ts.tv_sec);
+    Write64(gt.nsec, ts.tv_nsec);
+    CopyToUserWrite(m, rem, &gt, sizeof(gt));
+  }
+  return -1;
+#else
   for (;;) {
     if (CompareTime(now, deadline) >= 0) return 0;
     ts = SubtractTime(deadline, now);
@@ -3944,6 +5137,7 @@ static int SysNanosleep(struct Machine *m, i64 req, i64 rem) {
     // even if nanosleep() claims it slept the full time we check
     now = GetTime();
   }
+#endif
 }
 
 static int SysClockNanosleep(struct Machine *m, int clock, int flags,
@@ -3951,6 +5145,9 @@ static int SysClockNanosleep(struct Machine *m, int clock, int flags,
   int rc;
   clock_t sysclock;
   struct timespec req, rem;
+#ifdef HAVE_PPOLL
+  struct timespec now, deadline;
+#endif
   struct timespec_linux gtimespec;
   if (XlatClock(clock, &sysclock) == -1) return -1;
   if (flags & ~TIMER_ABSTIME_LINUX) return einval();
@@ -3959,6 +5156,32 @@ static int SysClockNanosleep(struct Machine *m, int clock, int flags,
   }
   req.tv_sec = Read64(gtimespec.sec);
   req.tv_nsec = Read64(gtimespec.nsec);
+#ifdef HAVE_PPOLL
+  // cpu time clocks are left to the host, since they don't advance
+  // while we're asleep and ppoll() can't wait on them
+  if (sysclock == CLOCK_REALTIME || sysclock == CLOCK_MONOTONIC) {
+    if (req.tv_sec < 0) return einval();
+    if (!(0 <= req.tv_nsec && req.tv_nsec < 1000000000)) return einval();
+    if (flags) {
+      return SleepUntil(m, sysclock, req);
+    }
+    // relative sleeps aren't affected by changes to the realtime clock
+    deadline = AddTime(GetMonotonic(), req);
+    if (!(rc = SleepUntil(m, CLOCK_MONOTONIC, deadline)) || !remaddr) {
+      return rc;
+    }
+    now = GetMonotonic();
+    if (CompareTime(now, deadline) < 0) {
+      rem = SubtractTime(deadline, now);
+    } else {
+      rem = GetZeroTime();
+    }
+    Write64(gtimespec.sec, rem.tv_sec);
+    Write64(gtimespec.nsec, rem.tv_nsec);
+    CopyToUserWrite(m, remaddr, &gtimespec, sizeof(gtimespec));
+    return rc;
+  }
+#endif
 TryAgain:
 #if defined(TIMER_ABSTIME) && !defined(__OpenBSD__)
   flags = flags & TIMER_ABSTIME_LINUX ? TIMER_ABSTIME : 0;
@@ -4163,6 +5386,18 @@ static int SysClockGetres(struct Machine *m, int clock, i64 ts) {
   return rc;
 }
 
+static int SysGetcpu(struct Machine *m, i64 cpu, i64 node, i64 cache) {
+  u8 buf[4];
+  // the host may migrate our thread at any moment, so there's little
+  // value in asking it; the first cpu and numa node are always valid
+  Write32(buf, 0);
+  if ((cpu && CopyToUserWrite(m, cpu, buf, 4) == -1) ||
+      (node && CopyToUserWrite(m, node, buf, 4) == -1)) {
+    return -1;
+  }
+  return 0;
+}
+
 static int SysGettimeofday(struct Machine *m, i64 tv, i64 tz) {
   int rc;
   void *htimezonep;
@@ -4410,6 +5645,175 @@ static int SaveFdSet(struct Machine *m, int nfds, const fd_set *fds, i64 addr) {
   return CopyToUserWrite(m, addr, p, FD_SETSIZE_LINUX / 8);
 }
 
+// waits for events on host file descriptors using a single system call
+// which blocks until an event, a signal, or the deadline, happen first.
+// returns -1 w/ eintr if a signal for the guest was delivered instead.
+int PollHost(struct Machine *m, struct pollfd *hfds, nfds_t nfds,
+             struct timespec deadline) {
+  int rc;
+  sigset_t block, oldmask;
+  struct timespec now, waitfor;
+  // block signals so the host can't deliver one after we've checked
+  // for interrupts, but before we've started waiting; if ppoll() is
+  // not available, then wake up periodically to check, since there's
+  // no other way to close that race
+  unassert(!sigfillset(&block));
+  unassert(!pthread_sigmask(SIG_BLOCK, &block, &oldmask));
+  if (!CheckInterrupt(m, false)) {
+    do {
+      now = GetTime();
+      if (CompareTime(now, deadline) < 0) {
+        waitfor = SubtractTime(deadline, now);
+      } else {
+        waitfor = GetZeroTime();
+      }
+#ifdef HAVE_PPOLL
+      rc = ppoll(hfds, nfds, &waitfor, &oldmask);
+#else
+      if (CompareTime(waitfor, FromMilliseconds(kPollingMs)) > 0) {
+        waitfor = FromMilliseconds(kPollingMs);
+      }
+      unassert(!pthread_sigmask(SIG_SETMASK, &oldmask, 0));
+      rc = poll(hfds, nfds, ToMilliseconds(waitfor));
+      unassert(!pthread_sigmask(SIG_BLOCK, &block, 0));
+      if (!rc && CompareTime(GetTime(), deadline) < 0) {
+        rc = -1;
+        errno = EINTR;
+      }
+#endif
+      if (rc == -1 && errno == EINTR) {
+        if (CheckInterrupt(m, false)) {
+          break;
+        }
+      } else {
+        break;
+      }
+    } while (1);
+  } else {
+    rc = -1;
+  }
+  unassert(!pthread_sigmask(SIG_SETMASK, &oldmask, 0));
+  return rc;
+}
+
+// returns true if i/o readiness of guest fd can be polled by host
+// the caller must hold the fds lock
+static bool IsHostPollable(struct Fd *fd) {
+#ifdef DISABLE_VFS
+  return fd->cb == &kFdCbHost || fd->cb == &kFdCbSignalfd;
+#else
+  return false;
+#endif
+}
+
+// polls set of guest fds by asking the host kernel to do it all at once
+// returns -2 if some fd isn't backed by the host, and needs emulation
+static int PollHostFds(struct Machine *m, struct pollfd_linux *gfds, u64 nfds,
+                       struct timespec deadline) {
+  u64 i;
+  struct Fd *fd;
+  int fildes, rc, ev;
+  struct pollfd *hfds;
+  bool isnval = false;
+  if (!(hfds = (struct pollfd *)AddToFreeList(
+            m, malloc(MAX(nfds, 1) * sizeof(*hfds))))) {
+    return enomem();
+  }
+  LOCK(&m->system->fds.lock);
+  for (i = 0; i < nfds; ++i) {
+    hfds[i].fd = -1;
+    hfds[i].events = 0;
+    hfds[i].revents = 0;
+    if ((fildes = Read32(gfds[i].fd)) < 0) continue;
+    if ((fd = GetFd(&m->system->fds, fildes))) {
+      if (!IsHostPollable(fd)) {
+        UNLOCK(&m->system->fds.lock);
+        return -2;
+      }
+      ev = Read16(gfds[i].events);
+      hfds[i].fd = fildes;
+      hfds[i].events = (((ev & POLLIN_LINUX) ? POLLIN : 0) |
+                        ((ev & POLLOUT_LINUX) ? POLLOUT : 0) |
+                        ((ev & POLLPRI_LINUX) ? POLLPRI : 0));
+    } else {
+      isnval = true;
+    }
+  }
+  UNLOCK(&m->system->fds.lock);
+  if (isnval) deadline = GetZeroTime();
+  if (PollHost(m, hfds, nfds, deadline) == -1) return -1;
+  for (rc = i = 0; i < nfds; ++i) {
+    if (hfds[i].fd == -1) {
+      ev = Read32(gfds[i].fd) >= 0 ? POLLNVAL_LINUX : 0;
+    } else {
+      ev = 0;
+      if (hfds[i].revents & POLLIN) ev |= POLLIN_LINUX;
+      if (hfds[i].revents & POLLPRI) ev |= POLLPRI_LINUX;
+      if (hfds[i].revents & POLLOUT) ev |= POLLOUT_LINUX;
+      if (hfds[i].revents & POLLERR) ev |= POLLERR_LINUX;
+      if (hfds[i].revents & POLLHUP) ev |= POLLHUP_LINUX;
+      if (hfds[i].revents & POLLNVAL) ev |= POLLNVAL_LINUX;
+      if (!ev && hfds[i].revents) ev |= POLLERR_LINUX;
+    }
+    Write16(gfds[i].revents, ev);
+    if (ev) ++rc;
+  }
+  return rc;
+}
+
+// performs select() by asking the host kernel to poll all fds at once
+// returns -2 if some fd isn't backed by the host, and needs emulation
+static int SelectHostFds(struct Machine *m, int nfds, fd_set *readfds,
+                         fd_set *writefds, fd_set *exceptfds,
+                         struct timespec deadline) {
+  struct Fd *fd;
+  int fildes, rc, n;
+  struct pollfd hfds[FD_SETSIZE];
+  LOCK(&m->system->fds.lock);
+  for (n = fildes = 0; fildes < nfds; ++fildes) {
+    if (!FD_ISSET(fildes, readfds) && !FD_ISSET(fildes, writefds) &&
+        !FD_ISSET(fildes, exceptfds)) {
+      continue;
+    }
+    if (!(fd = GetFd(&m->system->fds, fildes))) {
+      UNLOCK(&m->system->fds.lock);
+      return ebadf();
+    }
+    if (!IsHostPollable(fd)) {
+      UNLOCK(&m->system->fds.lock);
+      return -2;
+    }
+    hfds[n].fd = fildes;
+    hfds[n].events = ((FD_ISSET(fildes, readfds) ? POLLIN : 0) |
+                      (FD_ISSET(fildes, writefds) ? POLLOUT : 0) |
+                      (FD_ISSET(fildes, exceptfds) ? POLLPRI : 0));
+    ++n;
+  }
+  UNLOCK(&m->system->fds.lock);
+  if (PollHost(m, hfds, n, deadline) == -1) return -1;
+  FD_ZERO(readfds);
+  FD_ZERO(writefds);
+  FD_ZERO(exceptfds);
+  for (rc = 0; n--;) {
+    if (hfds[n].revents & POLLNVAL) return ebadf();
+    if ((hfds[n].events & POLLIN) &&
+        (hfds[n].revents & (POLLIN | POLLHUP | POLLERR))) {
+      FD_SET(hfds[n].fd, readfds);
+      ++rc;
+    }
+    if ((hfds[n].events & POLLOUT) &&
+        (hfds[n].revents & (POLLOUT | POLLERR))) {
+      FD_SET(hfds[n].fd, writefds);
+      ++rc;
+    }
+    if ((hfds[n].events & POLLPRI) && (hfds[n].revents & POLLPRI)) {
+      FD_SET(hfds[n].fd, exceptfds);
+      ++rc;
+    }
+  }
+  return rc;
+}
+
 static i32 Select(struct Machine *m,          //
                   i32 nfds,                   //
                   i64 readfds_addr,           //
@@ -4463,6 +5867,13 @@ static i32 Select(struct Machine *m,          //
     m->sigmask = *sigmaskp_guest;
     SIG_LOGF("sigmask push %" PRIx64, m->sigmask);
   }
+  if ((rc = SelectHostFds(m, nfds, &readfds, &writefds, &exceptfds,
+                          timeoutp ? deadline : GetMaxTime())) != -2) {
+    readyreadfds = readfds;
+    readywritefds = writefds;
+    readyexceptfds = exceptfds;
+    goto Finished;
+  }
   for (;;) {
     if (CheckInterrupt(m, false)) {
       rc = eintr();
@@ -4539,6 +5950,7 @@ static i32 Select(struct Machine *m,          //
     }
     nanosleep(&wait, 0);
   }
+Finished:
   if (sigmaskp_guest) {
     m->sigmask = oldmask_guest;
     SIG_LOGF("sigmask pop %" PRIx64, m->sigmask);
@@ -4674,6 +6086,13 @@ static int Poll(struct Machine *m, i64 fdsaddr, u64 nfds,
     if ((gfds = (struct pollfd_linux *)AddToFreeList(m, malloc(gfdssize)))) {
       rc = 0;
       CopyFromUserRead(m, gfds, fdsaddr, gfdssize);
+      if ((rc = PollHostFds(m, gfds, nfds, deadline)) != -2) {
+        if (rc != -1) {
+          CopyToUserWrite(m, fdsaddr, gfds, nfds * sizeof(*gfds));
+        }
+        return rc;
+      }
+      rc = 0;
       for (;;) {
         for (i = 0; i < nfds; ++i) {
         TryAgain:
@@ -4803,11 +6222,116 @@ static int SysPpoll(struct Machine *m, i64 fdsaddr, u64 nfds, i64 timeoutaddr,
   return rc;
 }
 
+#define kJobControlSigs                                   \
+  ((u64)1 << (SIGTSTP_LINUX - 1) | (u64)1 << (SIGTTIN_LINUX - 1) | \
+   (u64)1 << (SIGTTOU_LINUX - 1))
+
+// the guest signal mask is virtual, except that job control signals the
+// guest blocks are also blocked on the host, so the kernel won't ever
+// stop us on its behalf. since those are never unblocked on the host,
+// we only need to ask the host when a new one appears in the mask
+static void BlockHostJobControlSignals(struct Machine *m) {
+  u64 block;
+  sigset_t ss;
+  if ((block = m->sigmask & kJobControlSigs & ~m->hostjobsigs)) {
+    XlatLinuxToSigset(&ss, block);
+    sigprocmask(SIG_BLOCK, &ss, 0);
+    m->hostjobsigs |= block;
+    // so they stay blocked when Blink() restores the mask after a halt
+    if (block & ((u64)1 << (SIGTSTP_LINUX - 1))) sigaddset(&m->runmask, SIGTSTP);
+    if (block & ((u64)1 << (SIGTTIN_LINUX - 1))) sigaddset(&m->runmask, SIGTTIN);
+    if (block & ((u64)1 << (SIGTTOU_LINUX - 1))) sigaddset(&m->runmask, SIGTTOU);
+  }
+}
+
+// the host would kill us if a signal whose disposition is SIG_DFL got
+// sent while the guest has it blocked, so once the guest blocks such a
+// signal, we route it to EnqueueSignal() where it may remain pending
+static void HoldHostBlockedSignals(struct Machine *m) {
+  int sig;
+  u64 hold;
+  struct System *s = m->system;
+  hold = m->sigmask & ~kJobControlSigs &
+         ~((u64)1 << (SIGKILL_LINUX - 1) | (u64)1 << (SIGSTOP_LINUX - 1));
+  if (!(hold & ~atomic_load_explicit(&s->heldsigs, memory_order_relaxed))) {
+    return;
+  }
+  LOCK(&s->sig_lock);
+  hold &= ~atomic_fetch_or_explicit(&s->heldsigs, hold, memory_order_relaxed);
+  for (sig = 1; sig <= 64; ++sig) {
+    if ((hold & ((u64)1 << (sig - 1))) &&
+        Read64(s->hands[sig - 1].handler) == SIG_DFL_LINUX) {
+      InstallHostSignalHandler(s, sig);
+    }
+  }
+  UNLOCK(&s->sig_lock);
+}
+
+static u64 GetNewSigmask(u64 mask, int how, u64 set) {
+  if (how == SIG_BLOCK_LINUX) {
+    return mask | set;
+  } else if (how == SIG_UNBLOCK_LINUX) {
+    return mask & ~set;
+  } else if (how == SIG_SETMASK_LINUX) {
+    return set;
+  } else {
+    __builtin_unreachable();
+  }
+}
+
+// changes the signal mask of a lone thread without the dispatcher. this
+// is only possible when no signal may become deliverable, i.e. nothing
+// pending is currently unmasked and nothing masked becomes unmasked. a
+// racing EnqueueSignal() can't be missed then, since any signal it may
+// raise would've been deliverable under the old mask too
+static bool OpSigprocmaskFast(struct Machine *m, u64 *ax) {
+  u8 *p;
+  u64 old, neu, set;
+  int how;
+  i64 setaddr, oldsetaddr;
+  how = Get64(m->di);
+  setaddr = Get64(m->si);
+  oldsetaddr = Get64(m->dx);
+  if (Get64(m->r10) != 8) return false;
+  if (how != SIG_BLOCK_LINUX &&    //
+      how != SIG_UNBLOCK_LINUX &&  //
+      how != SIG_SETMASK_LINUX) {
+    return false;
+  }
+  if (!atomic_load_explicit(&m->system->singlethreaded, memory_order_acquire)) {
+    return false;
+  }
+  old = m->sigmask;
+  if (setaddr) {
+    if ((setaddr & 4095) > 4096 - 8 ||
+        !(p = LookupAddress2(m, setaddr, PAGE_U, PAGE_U))) {
+      return false;
+    }
+    set = Read64(p);
+    neu = GetNewSigmask(old, how, set);
+  } else {
+    neu = old;
+  }
+  if ((m->signals & ~old) || (old & ~neu)) return false;
+  if (oldsetaddr) {
+    if ((oldsetaddr & 4095) > 4096 - 8 ||
+        !(p = LookupAddress2(m, oldsetaddr, PAGE_U | PAGE_RW,
+                             PAGE_U | PAGE_RW))) {
+      return false;
+    }
+    Write64(p, old);
+    SetWriteAddr(m, oldsetaddr, 8);
+  }
+  m->sigmask = neu;
+  BlockHostJobControlSignals(m);
+  HoldHostBlockedSignals(m);
+  *ax = 0;
+  return true;
+}
+
 static int SysSigprocmask(struct Machine *m, int how, i64 setaddr,
                           i64 oldsetaddr, u64 sigsetsize) {
-  u64 set;
   u8 word[8];
-  sigset_t ss;
   const u8 *neu;
   int sig, delivered;
   if (sigsetsize != 8) {
@@ -4833,20 +6357,9 @@ static int SysSigprocmask(struct Machine *m, int how, i64 setaddr,
     }
   }
   if (setaddr) {
-    set = Read64(neu);
-    if (how == SIG_BLOCK_LINUX) {
-      m->sigmask |= set;
-    } else if (how == SIG_UNBLOCK_LINUX) {
-      m->sigmask &= ~set;
-    } else if (how == SIG_SETMASK_LINUX) {
-      m->sigmask = set;
-    } else {
-      __builtin_unreachable();
-    }
-    XlatLinuxToSigset(&ss, m->sigmask & ((u64)1 << (SIGTSTP_LINUX - 1) |
-                                         (u64)1 << (SIGTTIN_LINUX - 1) |
-                                         (u64)1 << (SIGTTOU_LINUX - 1)));
-    sigprocmask(SIG_BLOCK, &ss, 0);
+    m->sigmask = GetNewSigmask(m->sigmask, how, Read64(neu));
+    BlockHostJobControlSignals(m);
+    HoldHostBlockedSignals(m);
   }
   Put64(m->ax, 0);
   do {
@@ -4864,6 +6377,9 @@ static int SysSigpending(struct Machine *m, i64 setaddr) {
 }
 
 static int SysKill(struct Machine *m, int pid, int sig) {
+  if (sig == SIGSTOP_LINUX && pid == m->system->pid && !TakeSnapshot(m)) {
+    return 0;
+  }
   return kill(pid, sig ? XlatSignal(sig) : 0);
 }
 
@@ -4883,7 +6399,9 @@ static int SysTkill(struct Machine *m, int tid, int sig) {
   }
   // trigger signal immediately if possible
   if (tid == m->tid) {
-    if (sig == SIGSTOP_LINUX || sig == SIGKILL_LINUX) {
+    if (sig == SIGSTOP_LINUX && !TakeSnapshot(m)) {
+      return 0;
+    } else if (sig == SIGSTOP_LINUX || sig == SIGKILL_LINUX) {
       return raise(XlatSignal(sig));
     } else if (~m->sigmask & ((u64)1 << (sig - 1))) {
       LOCK(&m->system->sig_lock);
@@ -4908,7 +6426,7 @@ static int SysTkill(struct Machine *m, int tid, int sig) {
       UNLOCK(&m->system->sig_lock);
       return rc;
     } else {
-      m->signals |= (u64)1 << (sig - 1);
+      EnqueueSignal(m, sig);
       return 0;
     }
   }
@@ -5331,15 +6849,38 @@ static i32 SysEpollCtl(struct Machine *m, i32 epfd, i32 op, i32 fd,
   return epoll_ctl(epfd, op, fd, pepe);
 }
 
+// converts host epoll events to the linux abi in place. the host will
+// need to be x86-64 linux, for the structure to be packed the same way
+static void *ConvertEpollEvents(struct epoll_event *events, int n) {
+#if defined(__x86_64__) && defined(__linux)
+  _Static_assert(sizeof(struct epoll_event) == sizeof(struct epoll_event_linux),
+                 "");
+  return events;
+#else
+  int i;
+  u64 data;
+  u32 flags;
+  struct epoll_event_linux *gevents;
+  // the linux structure is never larger, so this works going forward
+  gevents = (struct epoll_event_linux *)events;
+  for (i = 0; i < n; ++i) {
+    flags = events[i].events;
+    data = events[i].data.u64;
+    Write32(gevents[i].events, flags);
+    Write64(gevents[i].data, data);
+  }
+  return gevents;
+#endif
+}
+
 static i32 EpollPwait(struct Machine *m, i32 epfd, i64 eventsaddr,
                       i32 maxevents, struct timespec deadline, i64 sigmaskaddr,
                       u64 sigsetsize) {
-  i32 i, rc;
+  i32 rc;
   u64 oldmask_guest = 0;
   sigset_t block, oldmask;
   struct epoll_event *events;
   struct timespec now, waitfor;
-  struct epoll_event_linux *gevents;
   const struct sigset_linux *sigmaskp_guest = 0;
   if (maxevents <= 0) return einval();
   if (sigmaskaddr) {
@@ -5353,9 +6894,7 @@ static i32 EpollPwait(struct Machine *m, i32 epfd, i64 eventsaddr,
                      maxevents * sizeof(struct epoll_event_linux),
                      PROT_WRITE) ||
       !(events = (struct epoll_event *)AddToFreeList(
-            m, calloc(maxevents, sizeof(struct epoll_event)))) ||
-      !(gevents = (struct epoll_event_linux *)AddToFreeList(
-            m, calloc(maxevents, sizeof(struct epoll_event_linux))))) {
+            m, malloc(maxevents * sizeof(struct epoll_event))))) {
     return -1;
   }
   unassert(!sigfillset(&block));
@@ -5395,12 +6934,8 @@ static i32 EpollPwait(struct Machine *m, i32 epfd, i64 eventsaddr,
     SIG_LOGF("sigmask pop %" PRIx64, m->sigmask);
   }
   unassert(!pthread_sigmask(SIG_SETMASK, &oldmask, 0));
-  if (rc != -1) {
-    for (i = 0; i < rc; ++i) {
-      Write32(gevents[i].events, events[i].events);
-      Write64(gevents[i].data, events[i].data.u64);
-    }
-    unassert(!CopyToUserWrite(m, eventsaddr, gevents,
+  if (rc > 0) {
+    unassert(!CopyToUserWrite(m, eventsaddr, ConvertEpollEvents(events, rc),
                               rc * sizeof(struct epoll_event_linux)));
   }
   return rc;
@@ -5440,20 +6975,218 @@ static int SysEpollWait(struct Machine *m, i32 epfd, i64 eventsaddr,
 
 #endif /* HAVE_EPOLL_PWAIT1 */
 
+// whether fildes is a host regular file or block device that may be
+// accessed directly. i/o on those doesn't wait indefinitely, so it can
+// not be interrupted by signals. the caller must be the only thread
+static bool IsDirectIoFd(struct Machine *m, i32 fildes, bool iswrite) {
+  struct Fd *fd;
+  struct stat st;
+  if (!(fd = GetFd(&m->system->fds, fildes))) return false;
+  if (fd->cb != &kFdCbHost) return false;
+  if ((fd->oflags & O_ACCMODE) == (iswrite ? O_RDONLY : O_WRONLY)) {
+    return false;
+  }
+  if (!fd->isfile) {
+    if (!VfsFstat(fildes, &st) && (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode))) {
+      fd->isfile = 1;
+    } else {
+      fd->isfile = -1;
+    }
+  }
+  return fd->isfile > 0;
+}
+
+// performs read(), write(), pread(), or pwrite() of a regular file on
+// a buffer within a single page, with no iovecs or fd locks. returns
+// false if the general dispatcher needs to handle it instead, e.g. so
+// that faults and oddities get reported the way they normally would
+static bool OpIoFast(struct Machine *m, bool iswrite, bool positioned,
+                     u64 *ax) {
+  u8 *p;
+  i64 addr, offset;
+  u64 size, need;
+  i32 fildes;
+  fildes = Get64(m->di);
+  addr = Get64(m->si);
+  size = Get64(m->dx);
+  offset = Get64(m->r10);
+  if (!size || size > 4096 - (addr & 4095)) return false;
+  if (positioned && offset < 0) return false;
+  if (!atomic_load_explicit(&m->system->singlethreaded, memory_order_acquire) ||
+      ShouldOffloadIo(m, fildes) || !IsDirectIoFd(m, fildes, iswrite)) {
+    return false;
+  }
+  need = iswrite ? PAGE_U : PAGE_RW;
+  if (!(p = LookupAddress2(m, addr, need, need))) return false;
+  if (iswrite) {
+    if (positioned) {
+      *ax = VfsPwrite(fildes, p, size, offset);
+    } else {
+      *ax = VfsWrite(fildes, p, size);
+    }
+    if (*ax != -1) SetReadAddr(m, addr, *ax);
+  } else {
+    if (positioned) {
+      *ax = VfsPread(fildes, p, size, offset);
+    } else {
+      *ax = VfsRead(fildes, p, size);
+    }
+    if (*ax != -1) SetWriteAddr(m, addr, *ax);
+  }
+  return true;
+}
+
+// answers system calls that don't block, without the page locking and
+// garbage collection the general dispatcher needs. calls taking only
+// integers are forwarded to the host as is, and calls that also write
+// guest memory are only answered here while there's a single thread,
+// since nothing can unmap that memory from under us in the meantime
+static bool OpSyscallFast(struct Machine *m) {
+  u64 ax;
+  switch (Get64(m->ax)) {
+    case 0x0E4:
+      // clock_gettime() is
+      //   1) called frequently,
+      //   2) latency sensitive, and
+      //   3) usually implemented as a VDSO.
+      // Therefore we exempt it from system call tracing.
+      ax = SysClockGettime(m, Get64(m->di), Get64(m->si));
+      break;
+    case 0x027:
+      if (TRACING) return false;
+      ax = m->system->pid;
+      break;
+    case 0x0BA:
+      if (TRACING) return false;
+      ax = m->tid;
+      break;
+    case 0x018:
+      if (TRACING) return false;
+      ax = SysSchedYield(m);
+      break;
+    case 0x000:
+    case 0x001:
+    case 0x011:
+    case 0x012:
+      if (TRACING) return false;
+      if (!OpIoFast(m, Get64(m->ax) == 0x001 || Get64(m->ax) == 0x012,
+                    Get64(m->ax) >= 0x011, &ax)) {
+        return false;
+      }
+      break;
+    case 0x066:
+      if (TRACING) return false;
+      ax = SysGetuid(m);
+      break;
+    case 0x068:
+      if (TRACING) return false;
+      ax = SysGetgid(m);
+      break;
+    case 0x06B:
+      if (TRACING) return false;
+      ax = SysGeteuid(m);
+      break;
+    case 0x06C:
+      if (TRACING) return false;
+      ax = SysGetegid(m);
+      break;
+    case 0x06E:
+      if (TRACING) return false;
+      ax = SysGetppid(m);
+      break;
+    case 0x06F:
+      if (TRACING) return false;
+      ax = SysGetpgrp(m);
+      break;
+    case 0x05F:
+      if (TRACING) return false;
+      ax = SysUmask(m, Get64(m->di));
+      break;
+    case 0x008:
+      if (TRACING) return false;
+      ax = SysLseek(m, Get64(m->di), Get64(m->si), Get64(m->dx));
+      break;
+    case 0x00E:
+      if (TRACING) return false;
+      if (!OpSigprocmaskFast(m, &ax)) return false;
+      break;
+    case 0x005:
+      if (TRACING) return false;
+      if (!atomic_load_explicit(&m->system->singlethreaded,
+                                memory_order_acquire)) {
+        return false;
+      }
+      ax = SysFstat(m, Get64(m->di), Get64(m->si));
+      break;
+    default:
+      return false;
+  }
+  STATISTIC(++fast_syscalls);
+  Put64(m->ax, ax != -1 ? ax : -(XlatErrno(errno) & 0xfff));
+  return true;
+}
+
+/**
+ * Performs system call on behalf of a function in our vdso.
+ *
+ * Only calls that can't block or longjmp are supported, since this is
+ * run from inside jit paths. Like on a real kernel, they aren't traced.
+ */
+void VdsoSyscall(struct Machine *m, int nr) {
+  u64 ax, di, si, dx;
+  di = Get64(m->di);
+  si = Get64(m->si);
+  dx = Get64(m->dx);
+  switch (nr) {
+    case 0x0E4:
+      ax = SysClockGettime(m, di, si);
+      break;
+    case 0x0E5:
+      ax = SysClockGetres(m, di, si);
+      break;
+    case 0x060:
+      ax = SysGettimeofday(m, di, si);
+      break;
+    case 0x0C9:
+      ax = SysTime(m, di);
+      break;
+    case 0x135:
+      ax = SysGetcpu(m, di, si, dx);
+      break;
+    default:
+      ax = enosys();
+      break;
+  }
+  STATISTIC(++vdso_syscalls);
+  Put64(m->ax, ax != -1 ? ax : -(XlatErrno(errno) & 0xfff));
+}
+
+// records exit system calls before they happen, since they don't return
+static void BtraceExit(struct Machine *m, const char *name, int sysno,
+                       u64 start, u64 rc) {
+  if (BTRACE && FLAG_btrace) {
+    u64 args[6] = {rc};
+    RecordBtrace(m, name, 1, sysno, start, 0, args);
+  }
+}
+
 void OpSyscall(P) {
-  size_t mark;
+  struct GarbageMark mark;
+  int sysno, sysarity;
+  u64 start, rc;
+  const char *sysname;
   u64 ax, di, si, dx, r0, r8, r9;
+  u64 timed, overhead;
   unassert(!m->nofault);
-  if (Get64(m->ax) == 0xE4) {
-    // clock_gettime() is
-    //   1) called frequently,
-    //   2) latency sensitive, and
-    //   3) usually implemented as a VDSO.
-    // Therefore we exempt it from system call tracing.
-    ax = SysClockGettime(m, Get64(m->di), Get64(m->si));
-    Put64(m->ax, ax != -1 ? ax : -(XlatErrno(errno) & 0xfff));
-    return;
+#ifdef HAVE_JIT
+  if (IsMakingPath(m)) CompleteSyscallPath(A);
+#endif
+#ifndef TINY
+  if ((ax = Get64(m->ax) & 0xfff) < STATS_SYSCALLS) {
+    STATISTIC(++syscall_counts[ax]);
   }
+#endif
+  if (OpSyscallFast(m)) return;
   STATISTIC(++syscalls);
   // make sure blinkenlights display is up to date before performing any
   // potentially blocking operations which would otherwise freeze things
@@ -5466,17 +7199,16 @@ void OpSyscall(P) {
   // circumstances. in order to do ensure that we need to lock any pages
   // the system call accesses, so the user can't munmap() them away from
   // some other thread. since we don't want to slow down instructions by
-  // adding locking logic to the tranlation lookaside buffer, we need to
-  // ensure any memory references the system call performs will tlb miss
+  // adding locking logic to the tranlation lookaside buffer, the lookups
+  // a system call performs will go around it, which leaves the guest's
+  // cached translations intact for when the system call returns.
   m->insyscall = true;
-  if (!m->sysdepth++) {
-    atomic_store_explicit(&m->invalidated, true, memory_order_relaxed);
-  }
+  ++m->sysdepth;
   // to make system calls simpler and safer, any temporary memory that's
   // allocated will be added to a free list to be collected later. since
   // OpSyscall() is potentially recursive when SA_RESTART signals happen
   // we need to save the current mark, so we don't collect parent's data
-  mark = m->freelist.n;
+  MarkGarbage(m, &mark);
   m->interrupted = false;
   ax = Get64(m->ax);
   di = Get64(m->di);
@@ -5485,6 +7217,20 @@ void OpSyscall(P) {
   r0 = Get64(m->r10);
   r8 = Get64(m->r8);
   r9 = Get64(m->r9);
+  sysno = ax & 0xfff;
+  sysname = 0;
+  sysarity = 6;
+  start = BTRACE && FLAG_btrace ? BtraceNow() : 0;
+  // time spent translating data is tallied by BeginSyscallOverhead(),
+  // and anything else the handler does is counted as host system time
+  timed = 0;
+  overhead = 0;
+#ifndef TINY
+  if (FLAG_statistics || FLAG_metrics) {
+    timed = ToNanoseconds(GetMonotonic());
+    overhead = syscall_overhead;
+  }
+#endif
   switch (ax & 0xfff) {
     SYSCALL(3, 0x000, "read", SysRead, STRACE_READ);
     SYSCALL(3, 0x001, "write", SysWrite, STRACE_WRITE);
@@ -5514,6 +7260,7 @@ void OpSyscall(P) {
     SYSCALL(4, 0x1b7, "faccessat2", SysFaccessat2, STRACE_FACCESSAT2);
     SYSCALL(0, 0x018, "sched_yield", SysSchedYield, STRACE_0);
     SYSCALL(3, 0x01C, "madvise", SysMadvise, STRACE_3);
+    SYSCALL(3, 0x01B, "mincore", SysMincore, STRACE_3);
     SYSCALL(1, 0x020, "dup", SysDup1, STRACE_DUP);
     SYSCALL(2, 0x021, "dup2", SysDup2, STRACE_DUP2);
     SYSCALL(0, 0x022, "pause", SysPause, STRACE_PAUSE);
@@ -5583,6 +7330,7 @@ void OpSyscall(P) {
     SYSCALL(2, 0x0E3, "clock_settime", SysClockSettime, STRACE_2);
 #endif
     SYSCALL(2, 0x0E5, "clock_getres", SysClockGetres, STRACE_2);
+    SYSCALL(3, 0x135, "getcpu", SysGetcpu, STRACE_3);
     SYSCALL(4, 0x0E6, "clock_nanosleep", SysClockNanosleep, STRACE_CLOCK_SLEEP);
     SYSCALL(2, 0x084, "utime", SysUtime, STRACE_2);
     SYSCALL(2, 0x0EB, "utimes", SysUtimes, STRACE_2);
@@ -5625,6 +7373,7 @@ void OpSyscall(P) {
 #endif
     SYSCALL(4, 0x03D, "wait4", SysWait4, STRACE_WAIT4);
     SYSCALL(2, 0x03E, "kill", SysKill, STRACE_KILL);
+    SYSCALL(5, 0x0F7, "waitid", SysWaitid, STRACE_5);
 #endif /* HAVE_FORK */
 #ifdef HAVE_THREADS
     SYSCALL(6, 0x0CA, "futex", SysFutex, STRACE_FUTEX);
@@ -5657,6 +7406,13 @@ void OpSyscall(P) {
 #endif /* defined(HAVE_FORK) || defined(HAVE_THREADS) */
 #ifndef DISABLE_NONPOSIX
     SYSCALL(4, 0x028, "sendfile", SysSendfile, STRACE_4);
+    SYSCALL(6, 0x113, "splice", SysSplice, STRACE_6);
+    SYSCALL(4, 0x114, "tee", SysTee, STRACE_4);
+    SYSCALL(4, 0x116, "vmsplice", SysVmsplice, STRACE_4);
+    SYSCALL(6, 0x146, "copy_file_range", SysCopyFileRange, STRACE_6);
+    SYSCALL(2, 0x1A9, "io_uring_setup", SysIoUringSetup, STRACE_2);
+    SYSCALL(6, 0x1AA, "io_uring_enter", SysIoUringEnter, STRACE_6);
+    SYSCALL(4, 0x1AB, "io_uring_register", SysIoUringRegister, STRACE_4);
     SYSCALL(3, 0x0CC, "sched_get_affinity", SysSchedGetaffinity, STRACE_3);
     SYSCALL(1, 0x00C, "brk", SysBrk, STRACE_1);
     SYSCALL(1, 0x063, "sysinfo", SysSysinfo, STRACE_1);
@@ -5683,6 +7439,21 @@ void OpSyscall(P) {
     SYSCALL(5, 0x147, "preadv2", SysPreadv2, STRACE_PREADV2);
     SYSCALL(5, 0x148, "pwritev2", SysPwritev2, STRACE_PWRITEV2);
     SYSCALL(3, 0x1B4, "close_range", SysCloseRange, STRACE_3);
+    SYSCALL(3, 0x11A, "signalfd", SysSignalfd, STRACE_3);
+    SYSCALL(4, 0x121, "signalfd4", SysSignalfd4, STRACE_4);
+#ifdef HAVE_EVENTFD
+    SYSCALL(1, 0x11C, "eventfd", SysEventfd, STRACE_1);
+    SYSCALL(2, 0x122, "eventfd2", SysEventfd2, STRACE_2);
+#endif
+#ifdef HAVE_PIDFD
+    SYSCALL(2, 0x1B2, "pidfd_open", SysPidfdOpen, STRACE_2);
+    SYSCALL(4, 0x1A8, "pidfd_send_signal", SysPidfdSendSignal, STRACE_4);
+#endif
+#ifdef HAVE_TIMERFD
+    SYSCALL(2, 0x11B, "timerfd_create", SysTimerfdCreate, STRACE_2);
+    SYSCALL(4, 0x11E, "timerfd_settime", SysTimerfdSettime, STRACE_4);
+    SYSCALL(2, 0x11F, "timerfd_gettime", SysTimerfdGettime, STRACE_2);
+#endif
 #ifdef HAVE_EPOLL_PWAIT1
     SYSCALL(1, 0x0D5, "epoll_create", SysEpollCreate, STRACE_1);
     SYSCALL(1, 0x123, "epoll_create1", SysEpollCreate1, STRACE_1);
@@ -5694,16 +7465,18 @@ void OpSyscall(P) {
 #endif /* DISABLE_NONPOSIX */
     case 0x3C:
       SYS_LOGF("%s(%#" PRIx64 ")", "exit", di);
+      BtraceExit(m, "exit", sysno, start, di);
       SysExit(m, di);
     case 0xE7:
       SYS_LOGF("%s(%#" PRIx64 ")", "exit_group", di);
+      BtraceExit(m, "exit_group", sysno, start, di);
       SysExitGroup(m, di);
     case 0x00F:
       SigRestore(m);
       m->interrupted = true;  // preevnt ax clobber
+      sysname = "rt_sigreturn";
+      sysarity = 0;
       break;
-    case 0x146:
-      // avoid noisy copy_file_range() feature check in cosmo
     case 0x1BC:
       // avoid noisy landlock_create_ruleset() feature check in cosmo
     case 0x500:
@@ -5714,6 +7487,8 @@ void OpSyscall(P) {
     case 0x0C9:
       // time() is also noisy in some environments.
       ax = SysTime(m, di);
+      sysname = "time";
+      sysarity = 1;
       break;
     default:
     DefaultCase:
@@ -5722,11 +7497,21 @@ void OpSyscall(P) {
       break;
   }
   if (!m->interrupted) {
-    Put64(m->ax, ax != -1 ? ax : -(XlatErrno(errno) & 0xfff));
+    Put64(m->ax, (rc = ax != -1 ? ax : -(XlatErrno(errno) & 0xfff)));
+  } else {
+    rc = 0;
+  }
+  if (BTRACE && FLAG_btrace) {
+    u64 args[6] = {di, si, dx, r0, r8, r9};
+    RecordBtrace(m, sysname, sysarity, sysno, start, rc, args);
+  }
+  if (timed) {
+    RecordSyscallLatency(sysno, sysname, ToNanoseconds(GetMonotonic()) - timed,
+                         syscall_overhead - overhead);
   }
   unassert(--m->sysdepth >= 0);
   CollectPageLocks(m);
   unassert(!m->pagelocks.i || m->sysdepth);
-  CollectGarbage(m, mark);
+  CollectGarbage(m, &mark);
   m->insyscall = false;
 }
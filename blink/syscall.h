@@ -1,8 +1,10 @@
 #ifndef BLINK_SYSCALL_H_
 #define BLINK_SYSCALL_H_
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include "blink/builtin.h"
 #include "blink/fds.h"
@@ -54,16 +56,52 @@
   } while (0)
 
 extern char *g_blink_path;
+extern const struct FdCb kFdCbSignalfd;
 
 void OpSyscall(P);
+void VdsoSyscall(struct Machine *, int);
 
 void SysCloseExec(struct System *);
+void RestoreSignalHandlers(struct System *);
 int SysClose(struct Machine *, i32);
 int SysCloseRange(struct Machine *, u32, u32, u32);
 int SysDup(struct Machine *, i32, i32, i32, i32);
 int SysOpenat(struct Machine *, i32, i64, i32, i32);
 int SysPipe2(struct Machine *, i64, i32);
+void GrowPipe(int);
+int SysEventfd(struct Machine *, u32);
+int SysEventfd2(struct Machine *, u32, i32);
+int SysTimerfdCreate(struct Machine *, i32, i32);
+int SysTimerfdSettime(struct Machine *, i32, i32, i64, i64);
+int SysTimerfdGettime(struct Machine *, i32, i64);
+int SysSignalfd(struct Machine *, i32, i64, u64);
+int SysSignalfd4(struct Machine *, i32, i64, u64, i32);
+void ResetSignalFds(struct System *);
+int SysPidfdOpen(struct Machine *, i32, u32);
+int SysPidfdSendSignal(struct Machine *, i32, i32, i64, u32);
+u64 GetSignalFdMask(struct System *);
+void NotifySignalFds(struct System *, int);
+void InstallHostSignalHandler(struct System *, int);
 int SysIoctl(struct Machine *, int, u64, i64);
+i64 SysRead(struct Machine *, i32, i64, u64);
+i64 SysWrite(struct Machine *, i32, i64, u64);
+i64 SysPread(struct Machine *, i32, i64, u64, u64);
+i64 SysPwrite(struct Machine *, i32, i64, u64, u64);
+i64 SysPreadv2(struct Machine *, i32, i64, u32, i64, i32);
+i64 SysPwritev2(struct Machine *, i32, i64, u32, i64, i32);
+i64 SysSendto(struct Machine *, i32, i64, u64, i32, i64, i32);
+i64 SysRecvfrom(struct Machine *, i32, i64, u64, i32, i64, i64);
+#ifndef DISABLE_SOCKETS
+i64 SysSendmsg(struct Machine *, i32, i64, i32);
+i64 SysRecvmsg(struct Machine *, i32, i64, i32);
+#endif
+int SysAccept4(struct Machine *, i32, i64, i64, i32);
+int SysConnect(struct Machine *, int, i64, u32);
+int SysFsync(struct Machine *, i32);
+int SysFdatasync(struct Machine *, i32);
+int SysIoUringSetup(struct Machine *, u32, i64);
+int SysIoUringEnter(struct Machine *, i32, u32, u32, u32, i64, u64);
+int SysIoUringRegister(struct Machine *, i32, u32, i64, u32);
 _Noreturn void SysExitGroup(struct Machine *, int);
 _Noreturn void SysExit(struct Machine *, int);
 
@@ -73,6 +111,7 @@ int GetOflags(struct Machine *, int);
 int GetFildes(struct Machine *, int);
 struct Fd *GetAndLockFd(struct Machine *, int);
 bool CheckInterrupt(struct Machine *, bool);
+int PollHost(struct Machine *, struct pollfd *, nfds_t, struct timespec);
 int SysStatfs(struct Machine *, i64, i64);
 int SysFstatfs(struct Machine *, i32, i64);
 int mkfifoat_(int, const char *, mode_t);
@@ -23,6 +23,7 @@
 
 #define PTHREAD_ONCE_INIT_         PTHREAD_ONCE_INIT
 #define PTHREAD_MUTEX_INITIALIZER_ PTHREAD_MUTEX_INITIALIZER
+#define PTHREAD_COND_INITIALIZER_  PTHREAD_COND_INITIALIZER
 
 #define pthread_once_        pthread_once
 #define pthread_once_t_      pthread_once_t
@@ -44,6 +45,7 @@
 
 #define PTHREAD_ONCE_INIT_         0
 #define PTHREAD_MUTEX_INITIALIZER_ 0
+#define PTHREAD_COND_INITIALIZER_  0
 
 #define pthread_once_t_      char
 #define pthread_cond_t_      char
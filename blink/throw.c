@@ -62,6 +62,12 @@ void DeliverSignalToUser(struct Machine *m, int sig, int code) {
 
 void HaltMachine(struct Machine *m, int code) {
   SIG_LOGF("HaltMachine(%d) at %#" PRIx64, code, m->ip);
+#ifdef HAVE_JIT
+  if (m->path.held) {
+    m->path.jb = m->path.held;  // so the faulting avx op abandons its path
+    m->path.held = 0;
+  }
+#endif
   switch ((m->trapno = code)) {
     case kMachineDivideError:
       RestoreIp(m);
@@ -103,6 +109,8 @@ void HaltMachine(struct Machine *m, int code) {
     case kMachineExitTrap:
       RestoreIp(m);
       break;
+    case kMachineRecycle:
+      break;
     default:
       if (code >= 0) {
         if (!m->metal) {
@@ -115,6 +123,7 @@ void HaltMachine(struct Machine *m, int code) {
       }
   }
   unassert(m->canhalt);
+  m->softhalt = true;
   siglongjmp(m->onhalt, code);
 }
 
@@ -25,50 +25,162 @@
 #include "blink/builtin.h"
 #include "blink/endian.h"
 #include "blink/jit.h"
+#include "blink/macros.h"
 #include "blink/machine.h"
 #include "blink/modrm.h"
+#include "blink/stats.h"
+#include "blink/thread.h"
+#include "blink/timespec.h"
+#include "blink/tunables.h"
 
 #ifdef HAVE_SCHED_H
 #include <sched.h>
 #endif
 
-void OpPause(P) {
+#define kTscTargetHz     3000000000  // what guests see if host counter is slow
+#define kTscCalibrateMs  10
+
+static struct Tsc {
+  pthread_once_t_ once;
+  u64 hz;   // guest time stamp counter ticks per second
+  u64 mul;  // guest ticks per host counter tick
+} g_tsc = {
+    .once = PTHREAD_ONCE_INIT_,
+};
+
+static u64 GetSpinNanos(void) {
+  struct timespec ts = GetMonotonic();
+  return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Performs guest PAUSE instruction.
+ *
+ * Guest spin locks loop on PAUSE while another thread holds the lock.
+ * Since each iteration costs far more under emulation, we hand the cpu
+ * back to the host scheduler once a thread has paused kSpinPauses times
+ * and, if the spinning persists past kSpinYields yields, we sleep for a
+ * moment so an oversubscribed lock owner gets to run. A burst of pauses
+ * that comes more than kSpinWindowUs after the previous one starts over.
+ */
+void SpinPause(struct Machine *m) {
 #if defined(__GNUC__) && defined(__aarch64__)
   asm volatile("yield");
 #elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
   asm volatile("pause");
-#elif defined(HAVE_SCHED_YIELD)
-  sched_yield();
 #endif
-  if (IsMakingPath(m)) {
-    AppendJitPause(m->path.jb);
+  u64 now;
+  if (++m->spins < kSpinPauses) return;
+  m->spins = 0;
+  now = GetSpinNanos();
+  if (now - m->spinstamp > kSpinWindowUs * 1000) {
+    m->spinyields = 0;
   }
+  if (m->spinyields < kSpinYields) {
+    ++m->spinyields;
+#ifdef HAVE_SCHED_YIELD
+    sched_yield();
+#endif
+    STATISTIC(++spin_yields);
+  } else {
+    SleepTime(FromMicroseconds(kSpinParkUs));
+    STATISTIC(++spin_parks);
+  }
+  m->spinstamp = GetSpinNanos();
 }
 
-void OpRdtsc(P) {
-  u64 c;
-  if (m->traprdtsc) {
-    ThrowSegmentationFault(m, 0);
+void OpPause(P) {
+  SpinPause(m);
+  if (IsMakingPath(m)) {
+    Jitter(A,
+           "q"   // arg0 = machine
+           "c",  // call function
+           SpinPause);
   }
+}
+
+// reads the host's invariant counter, or nanoseconds if there's none
+static inline u64 ReadHostTsc(void) {
 #if defined(__GNUC__) && defined(__aarch64__)
+  u64 c;
   asm volatile("mrs %0, cntvct_el0" : "=r"(c));
-  c *= 48;  // the fudge factor
+  return c;
 #elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
   u32 ax, dx;
   asm volatile("rdtsc" : "=a"(ax), "=d"(dx));
-  c = (u64)dx << 32 | ax;
+  return (u64)dx << 32 | ax;
 #else
-  struct timespec ts;
-  unassert(!clock_gettime(CLOCK_MONOTONIC, &ts));
-  c = ts.tv_sec;
-  c *= 1000000000;
-  c += ts.tv_nsec;
-  c *= 3;  // the fudge factor
+  return GetSpinNanos();
 #endif
+}
+
+static void InitTsc(void) {
+#if defined(__GNUC__) && defined(__aarch64__)
+  u64 hz;
+  asm("mrs %0, cntfrq_el0" : "=r"(hz));
+  if (!hz) hz = 24000000;
+  g_tsc.mul = MAX(1, (kTscTargetHz + hz / 2) / hz);
+  g_tsc.hz = hz * g_tsc.mul;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  u64 t0, t1, n0, n1;
+  g_tsc.mul = 1;
+  n0 = GetSpinNanos();
+  t0 = ReadHostTsc();
+  SleepTime(FromMilliseconds(kTscCalibrateMs));
+  n1 = GetSpinNanos();
+  t1 = ReadHostTsc();
+  g_tsc.hz = (t1 - t0) * 1000000000 / (n1 - n0);
+  g_tsc.hz = (g_tsc.hz + 500000) / 1000000 * 1000000;  // round to mhz
+#else
+  g_tsc.mul = kTscTargetHz / 1000000000;
+  g_tsc.hz = kTscTargetHz;
+#endif
+}
+
+/**
+ * Returns frequency of the guest time stamp counter.
+ *
+ * On x86 hosts the guest reads the host counter as is, and the rate is
+ * measured against the monotonic clock the first time it's requested.
+ * Elsewhere the host counter is multiplied by a whole number, so that
+ * the guest sees a counter that ticks at roughly kTscTargetHz.
+ */
+u64 GetTscFrequency(void) {
+  unassert(!pthread_once_(&g_tsc.once, InitTsc));
+  return g_tsc.hz;
+}
+
+static u64 GetTscMultiplier(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return 1;  // don't calibrate unless cpuid asks
+#else
+  unassert(!pthread_once_(&g_tsc.once, InitTsc));
+  return g_tsc.mul;
+#endif
+}
+
+MICRO_OP static void Rdtsc(struct Machine *m, u64 mul) {
+  u64 c = ReadHostTsc() * mul;
   Put64(m->ax, (c & 0x00000000ffffffff) >> 000);
   Put64(m->dx, (c & 0xffffffff00000000) >> 040);
 }
 
+void OpRdtsc(P) {
+  u64 mul;
+  if (m->traprdtsc) {
+    ThrowSegmentationFault(m, 0);
+  }
+  mul = GetTscMultiplier();
+  Rdtsc(m, mul);
+  if (IsMakingPath(m) && !m->system->trapsrdtsc) {
+    Jitter(A,
+           "a1i"  // arg1 = multiplier
+           "q"    // arg0 = machine
+           "m",   // call micro-op
+           mul, Rdtsc);
+  }
+}
+
 static i64 GetTscAux(struct Machine *m) {
   u32 core, node;
   core = 0;
@@ -77,7 +189,10 @@ static i64 GetTscAux(struct Machine *m) {
 }
 
 void OpRdtscp(P) {
-  OpRdtsc(A);
+  if (m->traprdtsc) {
+    ThrowSegmentationFault(m, 0);
+  }
+  Rdtsc(m, GetTscMultiplier());
   Put64(m->cx, GetTscAux(m));
 }
 
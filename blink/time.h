@@ -3,8 +3,10 @@
 #include "blink/machine.h"
 
 void OpPause(P);
+void SpinPause(struct Machine *);
 void OpRdtsc(P);
 void OpRdtscp(P);
 void OpRdpid(P);
+u64 GetTscFrequency(void);
 
 #endif /* BLINK_TIME_H_ */
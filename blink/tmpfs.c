@@ -0,0 +1,1570 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/tmpfs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "blink/assert.h"
+#include "blink/errno.h"
+#include "blink/log.h"
+#include "blink/macros.h"
+#include "blink/thread.h"
+#include "blink/timespec.h"
+#include "blink/util.h"
+
+#if defined(__APPLE__) || defined(__NetBSD__)
+#define st_atim st_atimespec
+#define st_ctim st_ctimespec
+#define st_mtim st_mtimespec
+#endif
+
+#ifndef DISABLE_VFS
+
+// tmpfs keeps everything in the memory of the blink process that does
+// the mount, so i/o on it is a hash lookup and a memcpy() rather than a
+// host system call. its contents aren't shared with forked processes.
+
+#define TMPFS_PAGE_SIZE 4096
+#define TMPFS_OPEN_FLAGS(x) \
+  ((x) & ~(O_CREAT | O_EXCL | O_NOCTTY | O_TRUNC | O_CLOEXEC))
+
+struct TmpfsDirent {
+  struct TmpfsDirent *next;  // hash chain
+  struct Dll elem;           // readdir order
+  struct TmpfsNode *node;
+  u64 hash;
+  u64 cookie;
+  char name[];
+};
+
+struct TmpfsNode {
+  u64 ino;
+  u32 mode;
+  u32 uid;
+  u32 gid;
+  u32 nlink;  // directory entries naming this node
+  u32 refs;   // vfs infos and shared maps using this node
+  struct timespec atim;
+  struct timespec mtim;
+  struct timespec ctim;
+  union {
+    struct {         // S_IFREG
+      u8 **pages;    // null entries are holes that read as zeroes
+      u64 npages;    // capacity of pages
+      u64 resident;  // non-null entries of pages
+      u64 size;
+    };
+    struct {  // S_IFDIR
+      struct TmpfsDirent **table;
+      u64 buckets;
+      u64 count;
+      u64 subdirs;
+      u64 cookies;
+      struct Dll *entries;
+      struct TmpfsNode *parent;
+    };
+    char *target;  // S_IFLNK
+  };
+};
+
+// an open file description, which dup() shares
+struct TmpfsOpen {
+  u32 refs;
+  int flags;
+  u64 offset;  // file position, or readdir cookie for directories
+};
+
+struct TmpfsInfo {
+  struct TmpfsDevice *device;
+  struct TmpfsNode *node;
+  struct TmpfsOpen *open;  // null if the info came from a lookup
+};
+
+// writable MAP_SHARED mappings are copies of the file which are written
+// back into it by msync() and munmap(), since host memory can't alias
+struct TmpfsMap {
+  struct Dll elem;
+  struct TmpfsNode *node;
+  u8 *addr;
+  size_t len;
+  u64 offset;
+};
+
+struct TmpfsDevice {
+  pthread_mutex_t_ lock;  // guards everything on the device
+  u64 inos;
+  struct TmpfsNode *root;
+  struct Dll *maps;
+};
+
+#define TMPFS_DIRENT_CONTAINER(e) DLL_CONTAINER(struct TmpfsDirent, elem, e)
+#define TMPFS_MAP_CONTAINER(e)    DLL_CONTAINER(struct TmpfsMap, elem, e)
+#define TMPFS_INFO(info)          ((struct TmpfsInfo *)(info)->data)
+#define TMPFS_DEVICE(info)        (TMPFS_INFO(info)->device)
+#define TMPFS_NODE(info)          (TMPFS_INFO(info)->node)
+
+////////////////////////////////////////////////////////////////////////////////
+
+static mode_t TmpfsUmask(void) {
+  mode_t mask;
+  umask((mask = umask(0)));
+  return mask;
+}
+
+static struct TmpfsNode *TmpfsCreateNode(struct TmpfsDevice *device,
+                                         u32 mode) {
+  struct TmpfsNode *node;
+  if (!(node = (struct TmpfsNode *)calloc(1, sizeof(*node)))) {
+    enomem();
+    return NULL;
+  }
+  node->ino = ++device->inos;
+  node->mode = mode;
+  node->uid = getuid();
+  node->gid = getgid();
+  node->atim = node->mtim = node->ctim = GetTime();
+  return node;
+}
+
+static void TmpfsFreeNode(struct TmpfsNode *node) {
+  u64 i;
+  struct Dll *e, *e2;
+  if (S_ISREG(node->mode)) {
+    for (i = 0; i < node->npages; ++i) {
+      free(node->pages[i]);
+    }
+    free(node->pages);
+  } else if (S_ISDIR(node->mode)) {
+    for (e = dll_first(node->entries); e; e = e2) {
+      e2 = dll_next(node->entries, e);
+      free(TMPFS_DIRENT_CONTAINER(e));
+    }
+    free(node->table);
+  } else if (S_ISLNK(node->mode)) {
+    free(node->target);
+  }
+  free(node);
+}
+
+static void TmpfsPutNode(struct TmpfsNode *node) {
+  if (!node->refs && !node->nlink) {
+    TmpfsFreeNode(node);
+  }
+}
+
+// frees a whole tree once nothing on the device can be referenced
+static void TmpfsFreeTree(struct TmpfsNode *node) {
+  struct Dll *e;
+  struct TmpfsNode *child;
+  if (S_ISDIR(node->mode)) {
+    for (e = dll_first(node->entries); e; e = dll_next(node->entries, e)) {
+      child = TMPFS_DIRENT_CONTAINER(e)->node;
+      if (S_ISDIR(child->mode)) {
+        TmpfsFreeTree(child);
+      } else if (!--child->nlink) {
+        TmpfsFreeNode(child);
+      }
+    }
+  }
+  TmpfsFreeNode(node);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static u64 TmpfsHash(const char *name) {
+  return Fnv64(0xcbf29ce484222325, name, strlen(name));
+}
+
+static struct TmpfsDirent *TmpfsLookup(struct TmpfsNode *dir,
+                                       const char *name) {
+  u64 hash;
+  struct TmpfsDirent *de;
+  if (!dir->buckets) return NULL;
+  hash = TmpfsHash(name);
+  for (de = dir->table[hash & (dir->buckets - 1)]; de; de = de->next) {
+    if (de->hash == hash && !strcmp(de->name, name)) {
+      return de;
+    }
+  }
+  return NULL;
+}
+
+static int TmpfsGrowTable(struct TmpfsNode *dir) {
+  u64 i, n;
+  struct Dll *e;
+  struct TmpfsDirent *de, **table;
+  n = MAX(8, dir->buckets * 2);
+  if (!(table = (struct TmpfsDirent **)calloc(n, sizeof(*table)))) {
+    return enomem();
+  }
+  for (e = dll_first(dir->entries); e; e = dll_next(dir->entries, e)) {
+    de = TMPFS_DIRENT_CONTAINER(e);
+    i = de->hash & (n - 1);
+    de->next = table[i];
+    table[i] = de;
+  }
+  free(dir->table);
+  dir->table = table;
+  dir->buckets = n;
+  return 0;
+}
+
+static int TmpfsLink(struct TmpfsNode *dir, const char *name,
+                     struct TmpfsNode *node) {
+  u64 i;
+  size_t n;
+  struct TmpfsDirent *de;
+  if ((n = strlen(name)) >= VFS_NAME_MAX) {
+    return enametoolong();
+  }
+  if (dir->count >= dir->buckets && TmpfsGrowTable(dir) == -1) {
+    return -1;
+  }
+  if (!(de = (struct TmpfsDirent *)malloc(sizeof(*de) + n + 1))) {
+    return enomem();
+  }
+  memcpy(de->name, name, n + 1);
+  de->node = node;
+  de->hash = TmpfsHash(name);
+  de->cookie = 2 + dir->cookies++;  // 0 and 1 are . and ..
+  i = de->hash & (dir->buckets - 1);
+  de->next = dir->table[i];
+  dir->table[i] = de;
+  dll_init(&de->elem);
+  dll_make_last(&dir->entries, &de->elem);
+  ++dir->count;
+  ++node->nlink;
+  if (S_ISDIR(node->mode)) {
+    ++dir->subdirs;
+    node->parent = dir;
+  }
+  dir->mtim = dir->ctim = node->ctim = GetTime();
+  return 0;
+}
+
+static struct TmpfsNode *TmpfsUnlinkDirent(struct TmpfsNode *dir,
+                                           struct TmpfsDirent *de) {
+  struct TmpfsNode *node;
+  struct TmpfsDirent **p;
+  for (p = dir->table + (de->hash & (dir->buckets - 1)); *p != de;
+       p = &(*p)->next) {
+  }
+  *p = de->next;
+  dll_remove(&dir->entries, &de->elem);
+  node = de->node;
+  free(de);
+  --dir->count;
+  --node->nlink;
+  if (S_ISDIR(node->mode)) {
+    --dir->subdirs;
+  }
+  dir->mtim = dir->ctim = node->ctim = GetTime();
+  return node;
+}
+
+// returns node named by `name` in `parent`, which must be locked
+static struct TmpfsNode *TmpfsFind(struct VfsInfo *parent, const char *name) {
+  struct TmpfsNode *dir;
+  struct TmpfsDirent *de;
+  dir = TMPFS_NODE(parent);
+  if (!S_ISDIR(dir->mode)) {
+    enotdir();
+    return NULL;
+  }
+  if (!strcmp(name, ".")) {
+    return dir;
+  }
+  if (!(de = TmpfsLookup(dir, name))) {
+    enoent();
+    return NULL;
+  }
+  return de->node;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int TmpfsAccessImpl(struct TmpfsNode *node, int mode) {
+  u32 bits;
+  uid_t uid;
+  if (mode == F_OK) return 0;
+  // like procfs, this ignores supplementary groups
+  if (!(uid = getuid())) {
+    if ((mode & X_OK) && !S_ISDIR(node->mode) &&
+        !(node->mode & (S_IXUSR | S_IXGRP | S_IXOTH))) {
+      return eacces();
+    }
+    return 0;
+  }
+  if (uid == node->uid) {
+    bits = node->mode >> 6;
+  } else if (getgid() == node->gid) {
+    bits = node->mode >> 3;
+  } else {
+    bits = node->mode;
+  }
+  if (((mode & R_OK) && !(bits & 4)) ||  //
+      ((mode & W_OK) && !(bits & 2)) ||  //
+      ((mode & X_OK) && !(bits & 1))) {
+    return eacces();
+  }
+  return 0;
+}
+
+static int TmpfsOwns(struct TmpfsNode *node) {
+  uid_t uid;
+  if ((uid = getuid()) && uid != node->uid) {
+    return eperm();
+  }
+  return 0;
+}
+
+static void TmpfsStatImpl(struct VfsDevice *device, struct TmpfsNode *node,
+                          struct stat *st) {
+  memset(st, 0, sizeof(*st));
+  st->st_dev = device->dev;
+  st->st_ino = node->ino;
+  st->st_mode = node->mode;
+  st->st_uid = node->uid;
+  st->st_gid = node->gid;
+  st->st_blksize = TMPFS_PAGE_SIZE;
+  if (S_ISDIR(node->mode)) {
+    st->st_nlink = node->nlink ? 2 + node->subdirs : 0;
+    st->st_size = (node->count + 2) * 20;
+  } else if (S_ISREG(node->mode)) {
+    st->st_nlink = node->nlink;
+    st->st_size = node->size;
+    st->st_blocks = node->resident * (TMPFS_PAGE_SIZE / 512);
+  } else {
+    st->st_nlink = node->nlink;
+    st->st_size = strlen(node->target);
+  }
+  st->st_atim = node->atim;
+  st->st_mtim = node->mtim;
+  st->st_ctim = node->ctim;
+}
+
+static void TmpfsUtimeImpl(struct TmpfsNode *node,
+                           const struct timespec times[2]) {
+  struct timespec now = GetTime();
+  if (!times) {
+    node->atim = node->mtim = now;
+  } else {
+    if (times[0].tv_nsec == UTIME_NOW) {
+      node->atim = now;
+    } else if (times[0].tv_nsec != UTIME_OMIT) {
+      node->atim = times[0];
+    }
+    if (times[1].tv_nsec == UTIME_NOW) {
+      node->mtim = now;
+    } else if (times[1].tv_nsec != UTIME_OMIT) {
+      node->mtim = times[1];
+    }
+  }
+  node->ctim = now;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static size_t TmpfsCopyOut(struct TmpfsNode *node, u8 *buf, size_t len,
+                           u64 off) {
+  u64 i;
+  size_t got, chunk;
+  if (off >= node->size) return 0;
+  len = MIN(len, node->size - off);
+  for (got = 0; got < len; got += chunk, off += chunk) {
+    i = off / TMPFS_PAGE_SIZE;
+    chunk = MIN(len - got, TMPFS_PAGE_SIZE - off % TMPFS_PAGE_SIZE);
+    if (i < node->npages && node->pages[i]) {
+      memcpy(buf + got, node->pages[i] + off % TMPFS_PAGE_SIZE, chunk);
+    } else {
+      memset(buf + got, 0, chunk);
+    }
+  }
+  return got;
+}
+
+static ssize_t TmpfsCopyIn(struct TmpfsNode *node, const u8 *buf, size_t len,
+                           u64 off) {
+  u8 **pages;
+  u64 i, n, end;
+  size_t got, chunk;
+  if (!len) return 0;
+  if (off + len < off || off + len > NUMERIC_MAX(off_t)) {
+    errno = EFBIG;
+    return -1;
+  }
+  end = off + len;
+  if ((n = ROUNDUP(end, TMPFS_PAGE_SIZE) / TMPFS_PAGE_SIZE) > node->npages) {
+    n = MAX(n, node->npages * 2);
+    if (!(pages = (u8 **)realloc(node->pages, n * sizeof(*pages)))) {
+      return enomem();
+    }
+    memset(pages + node->npages, 0, (n - node->npages) * sizeof(*pages));
+    node->pages = pages;
+    node->npages = n;
+  }
+  for (got = 0; got < len; got += chunk, off += chunk) {
+    i = off / TMPFS_PAGE_SIZE;
+    chunk = MIN(len - got, TMPFS_PAGE_SIZE - off % TMPFS_PAGE_SIZE);
+    if (!node->pages[i]) {
+      if (!(node->pages[i] = (u8 *)calloc(1, TMPFS_PAGE_SIZE))) {
+        if (got) break;
+        return enomem();
+      }
+      ++node->resident;
+    }
+    memcpy(node->pages[i] + off % TMPFS_PAGE_SIZE, buf + got, chunk);
+  }
+  node->size = MAX(node->size, off);
+  node->mtim = node->ctim = GetTime();
+  return got;
+}
+
+static void TmpfsTruncateImpl(struct TmpfsNode *node, u64 size) {
+  u64 i;
+  if (size < node->size) {
+    for (i = ROUNDUP(size, TMPFS_PAGE_SIZE) / TMPFS_PAGE_SIZE;
+         i < node->npages; ++i) {
+      if (node->pages[i]) {
+        free(node->pages[i]);
+        node->pages[i] = NULL;
+        --node->resident;
+      }
+    }
+    // bytes past the end must read as zeroes if the file grows again
+    if ((i = size / TMPFS_PAGE_SIZE) < node->npages && node->pages[i]) {
+      memset(node->pages[i] + size % TMPFS_PAGE_SIZE, 0,
+             TMPFS_PAGE_SIZE - size % TMPFS_PAGE_SIZE);
+    }
+  }
+  node->size = size;
+  node->mtim = node->ctim = GetTime();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int TmpfsCreateInfo(struct TmpfsDevice *device, struct TmpfsNode *node,
+                           struct TmpfsOpen *open, struct TmpfsInfo **output) {
+  if (!(*output = (struct TmpfsInfo *)malloc(sizeof(**output)))) {
+    return enomem();
+  }
+  (*output)->device = device;
+  (*output)->node = node;
+  (*output)->open = open;
+  ++node->refs;
+  if (open) ++open->refs;
+  return 0;
+}
+
+// creates info for `node` named `name` in `parent`, which must be locked
+static int TmpfsCreateVfsInfo(struct VfsInfo *parent, const char *name,
+                              struct TmpfsNode *node, struct TmpfsOpen *open,
+                              struct VfsInfo **output) {
+  struct VfsDevice *device;
+  struct TmpfsInfo *tmpinfo;
+  device = parent->device;
+  if (!strcmp(name, ".")) {
+    name = parent->name ? parent->name : "";
+    parent = parent->parent;
+  }
+  if (VfsCreateInfo(output) == -1) {
+    return -1;
+  }
+  unassert(!VfsAcquireDevice(device, &(*output)->device));
+  if (parent) {
+    unassert(!VfsAcquireInfo(parent, &(*output)->parent));
+  }
+  if (!((*output)->name = strdup(name)) ||
+      TmpfsCreateInfo((struct TmpfsDevice *)device->data, node, open,
+                      &tmpinfo) == -1) {
+    // safe while locked, since nothing here reaches TmpfsFreeInfo()
+    unassert(!VfsFreeInfo(*output));
+    return enomem();
+  }
+  (*output)->namelen = strlen(name);
+  (*output)->data = tmpinfo;
+  (*output)->ino = node->ino;
+  (*output)->mode = node->mode;
+  return 0;
+}
+
+static int TmpfsFreeInfo(void *info) {
+  struct TmpfsInfo *tmpinfo = (struct TmpfsInfo *)info;
+  if (info == NULL) {
+    return 0;
+  }
+  LOCK(&tmpinfo->device->lock);
+  if (tmpinfo->open && !--tmpinfo->open->refs) {
+    free(tmpinfo->open);
+  }
+  --tmpinfo->node->refs;
+  TmpfsPutNode(tmpinfo->node);
+  UNLOCK(&tmpinfo->device->lock);
+  free(info);
+  return 0;
+}
+
+static int TmpfsFreeDevice(void *device) {
+  struct Dll *e, *e2;
+  struct TmpfsDevice *tmpdevice = (struct TmpfsDevice *)device;
+  if (device == NULL) {
+    return 0;
+  }
+  for (e = dll_first(tmpdevice->maps); e; e = e2) {
+    e2 = dll_next(tmpdevice->maps, e);
+    free(TMPFS_MAP_CONTAINER(e));
+  }
+  TmpfsFreeTree(tmpdevice->root);
+  unassert(!pthread_mutex_destroy(&tmpdevice->lock));
+  free(device);
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int TmpfsInit(const char *source, u64 flags, const void *data,
+                     struct VfsDevice **device, struct VfsMount **mount) {
+  struct TmpfsDevice *tmpdevice;
+  struct TmpfsInfo *tmpinfo = NULL;
+  if (!(tmpdevice = (struct TmpfsDevice *)calloc(1, sizeof(*tmpdevice)))) {
+    return enomem();
+  }
+  unassert(!pthread_mutex_init(&tmpdevice->lock, NULL));
+  if (!(tmpdevice->root = TmpfsCreateNode(tmpdevice, S_IFDIR | 01777))) {
+    unassert(!pthread_mutex_destroy(&tmpdevice->lock));
+    free(tmpdevice);
+    return -1;
+  }
+  tmpdevice->root->nlink = 1;  // named by the mount
+  *device = NULL;
+  *mount = NULL;
+  if (VfsCreateDevice(device) == -1) {
+    goto cleananddie;
+  }
+  (*device)->data = tmpdevice;
+  (*device)->ops = &g_tmpfs.ops;
+  if (!(*mount = (struct VfsMount *)calloc(1, sizeof(struct VfsMount)))) {
+    enomem();
+    goto cleananddie;
+  }
+  if (TmpfsCreateInfo(tmpdevice, tmpdevice->root, NULL, &tmpinfo) == -1) {
+    goto cleananddie;
+  }
+  if (VfsCreateInfo(&(*mount)->root) == -1) {
+    goto cleananddie;
+  }
+  unassert(!VfsAcquireDevice(*device, &(*mount)->root->device));
+  (*mount)->root->data = tmpinfo;
+  (*mount)->root->mode = tmpdevice->root->mode;
+  (*mount)->root->ino = tmpdevice->root->ino;
+  // Weak reference.
+  (*device)->root = (*mount)->root;
+  VFS_LOGF("Mounted a tmpfs device");
+  return 0;
+cleananddie:
+  if (*mount) {
+    if ((*mount)->root) {
+      unassert(!VfsFreeInfo((*mount)->root));
+    } else {
+      unassert(!TmpfsFreeInfo(tmpinfo));
+    }
+    free(*mount);
+  }
+  if (*device) {
+    unassert(!VfsFreeDevice(*device));
+  } else {
+    TmpfsFreeDevice(tmpdevice);
+  }
+  return -1;
+}
+
+static int TmpfsReadmountentry(struct VfsDevice *device, char **spec,
+                               char **type, char **mntops) {
+  *spec = strdup("tmpfs");
+  if (*spec == NULL) {
+    return enomem();
+  }
+  *type = strdup("tmpfs");
+  if (*type == NULL) {
+    free(*spec);
+    return enomem();
+  }
+  *mntops = NULL;
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int TmpfsFinddir(struct VfsInfo *parent, const char *name,
+                        struct VfsInfo **output) {
+  int ret;
+  struct TmpfsNode *node;
+  struct TmpfsDevice *device;
+  VFS_LOGF("TmpfsFinddir(parent=%p (%s), name=\"%s\", output=%p)", parent,
+           parent->name, name, output);
+  if (!strcmp(name, ".")) {
+    unassert(!VfsAcquireInfo(parent, output));
+    return 0;
+  }
+  device = TMPFS_DEVICE(parent);
+  LOCK(&device->lock);
+  if ((node = TmpfsFind(parent, name))) {
+    ret = TmpfsCreateVfsInfo(parent, name, node, NULL, output);
+  } else {
+    ret = -1;
+  }
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static ssize_t TmpfsReadlink(struct VfsInfo *info, char **output) {
+  struct TmpfsNode *node = TMPFS_NODE(info);
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  ssize_t ret;
+  LOCK(&device->lock);
+  if (!S_ISLNK(node->mode)) {
+    ret = einval();
+  } else if (!(*output = strdup(node->target))) {
+    ret = enomem();
+  } else {
+    ret = strlen(*output);
+  }
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+// adds a new node to `parent`, whose device must be locked
+static struct TmpfsNode *TmpfsCreate(struct VfsInfo *parent, const char *name,
+                                     u32 mode) {
+  struct TmpfsNode *dir, *node;
+  dir = TMPFS_NODE(parent);
+  if (!S_ISDIR(dir->mode)) {
+    enotdir();
+    return NULL;
+  }
+  if (!strcmp(name, ".") || TmpfsLookup(dir, name)) {
+    eexist();
+    return NULL;
+  }
+  if (!dir->nlink) {
+    enoent();  // directory was removed
+    return NULL;
+  }
+  if (TmpfsAccessImpl(dir, W_OK | X_OK) == -1) {
+    return NULL;
+  }
+  if (!(node = TmpfsCreateNode(TMPFS_DEVICE(parent), mode))) {
+    return NULL;
+  }
+  if (TmpfsLink(dir, name, node) == -1) {
+    TmpfsFreeNode(node);
+    return NULL;
+  }
+  return node;
+}
+
+static int TmpfsMkdir(struct VfsInfo *parent, const char *name, mode_t mode) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(parent);
+  int ret;
+  VFS_LOGF("TmpfsMkdir(%p, \"%s\", %o)", parent, name, mode);
+  LOCK(&device->lock);
+  ret = TmpfsCreate(parent, name,
+                    S_IFDIR | (mode & 07777 & ~TmpfsUmask()))
+            ? 0
+            : -1;
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static int TmpfsSymlink(const char *target, struct VfsInfo *parent,
+                        const char *name) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(parent);
+  struct TmpfsNode *node;
+  char *copy;
+  int ret;
+  VFS_LOGF("TmpfsSymlink(\"%s\", %p, \"%s\")", target, parent, name);
+  if (!(copy = strdup(target))) {
+    return enomem();
+  }
+  LOCK(&device->lock);
+  if ((node = TmpfsCreate(parent, name, S_IFLNK | 0777))) {
+    node->target = copy;
+    ret = 0;
+  } else {
+    free(copy);
+    ret = -1;
+  }
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static int TmpfsOpen(struct VfsInfo *parent, const char *name, int flags,
+                     int mode, struct VfsInfo **output) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(parent);
+  struct TmpfsNode *node;
+  struct TmpfsOpen *open;
+  int accmode, want;
+  bool created;
+  VFS_LOGF("TmpfsOpen(%p, \"%s\", %d, %o)", parent, name, flags, mode);
+  if (!(open = (struct TmpfsOpen *)calloc(1, sizeof(*open)))) {
+    return enomem();
+  }
+  open->flags = TMPFS_OPEN_FLAGS(flags);
+  accmode = flags & O_ACCMODE;
+  created = false;
+  LOCK(&device->lock);
+  if (!(node = TmpfsFind(parent, name))) {
+    if (errno != ENOENT || !(flags & O_CREAT)) {
+      goto cleananddie;
+    }
+    if (!(node = TmpfsCreate(parent, name,
+                             S_IFREG | (mode & 07777 & ~TmpfsUmask())))) {
+      goto cleananddie;
+    }
+    created = true;
+  } else if ((flags & O_CREAT) && (flags & O_EXCL)) {
+    eexist();
+    goto cleananddie;
+  }
+  if (S_ISLNK(node->mode)) {
+    eloop();  // only reachable with O_NOFOLLOW
+    goto cleananddie;
+  }
+  if ((flags & O_DIRECTORY) && !S_ISDIR(node->mode)) {
+    enotdir();
+    goto cleananddie;
+  }
+  if (S_ISDIR(node->mode) && (accmode != O_RDONLY || (flags & O_CREAT))) {
+    eisdir();
+    goto cleananddie;
+  }
+  if (!created) {
+    want = 0;
+    if (accmode == O_RDONLY || accmode == O_RDWR) want |= R_OK;
+    if (accmode == O_WRONLY || accmode == O_RDWR) want |= W_OK;
+    if (TmpfsAccessImpl(node, want) == -1) {
+      goto cleananddie;
+    }
+    if ((flags & O_TRUNC) && S_ISREG(node->mode) && accmode != O_RDONLY) {
+      TmpfsTruncateImpl(node, 0);
+    }
+  }
+  if (TmpfsCreateVfsInfo(parent, name, node, open, output) == -1) {
+    goto cleananddie;
+  }
+  UNLOCK(&device->lock);
+  return 0;
+cleananddie:
+  UNLOCK(&device->lock);
+  free(open);
+  return -1;
+}
+
+static int TmpfsClose(struct VfsInfo *info) {
+  // the open file description is freed with the last info sharing it
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int TmpfsAccess(struct VfsInfo *parent, const char *name, mode_t mode,
+                       int flags) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(parent);
+  struct TmpfsNode *node;
+  int ret;
+  LOCK(&device->lock);
+  if ((node = TmpfsFind(parent, name))) {
+    ret = TmpfsAccessImpl(node, mode);
+  } else {
+    ret = -1;
+  }
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static int TmpfsStat(struct VfsInfo *parent, const char *name, struct stat *st,
+                     int flags) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(parent);
+  struct TmpfsNode *node;
+  int ret = 0;
+  LOCK(&device->lock);
+  if ((node = TmpfsFind(parent, name))) {
+    TmpfsStatImpl(parent->device, node, st);
+  } else {
+    ret = -1;
+  }
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static int TmpfsFstat(struct VfsInfo *info, struct stat *st) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  LOCK(&device->lock);
+  TmpfsStatImpl(info->device, TMPFS_NODE(info), st);
+  UNLOCK(&device->lock);
+  return 0;
+}
+
+static int TmpfsChmodImpl(struct TmpfsNode *node, mode_t mode) {
+  if (TmpfsOwns(node) == -1) {
+    return -1;
+  }
+  node->mode = (node->mode & ~07777) | (mode & 07777);
+  node->ctim = GetTime();
+  return 0;
+}
+
+static int TmpfsChmod(struct VfsInfo *parent, const char *name, mode_t mode,
+                      int flags) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(parent);
+  struct TmpfsNode *node;
+  int ret;
+  LOCK(&device->lock);
+  if ((node = TmpfsFind(parent, name))) {
+    ret = TmpfsChmodImpl(node, mode);
+  } else {
+    ret = -1;
+  }
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static int TmpfsFchmod(struct VfsInfo *info, mode_t mode) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  int ret;
+  LOCK(&device->lock);
+  ret = TmpfsChmodImpl(TMPFS_NODE(info), mode);
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static int TmpfsChownImpl(struct TmpfsNode *node, uid_t uid, gid_t gid) {
+  // only root may give files away
+  if (uid != (uid_t)-1 && uid != node->uid && getuid()) {
+    return eperm();
+  }
+  if (TmpfsOwns(node) == -1) {
+    return -1;
+  }
+  if (uid != (uid_t)-1) node->uid = uid;
+  if (gid != (gid_t)-1) node->gid = gid;
+  node->ctim = GetTime();
+  return 0;
+}
+
+static int TmpfsChown(struct VfsInfo *parent, const char *name, uid_t uid,
+                      gid_t gid, int flags) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(parent);
+  struct TmpfsNode *node;
+  int ret;
+  LOCK(&device->lock);
+  if ((node = TmpfsFind(parent, name))) {
+    ret = TmpfsChownImpl(node, uid, gid);
+  } else {
+    ret = -1;
+  }
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static int TmpfsFchown(struct VfsInfo *info, uid_t uid, gid_t gid) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  int ret;
+  LOCK(&device->lock);
+  ret = TmpfsChownImpl(TMPFS_NODE(info), uid, gid);
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static int TmpfsUtime(struct VfsInfo *parent, const char *name,
+                      const struct timespec times[2], int flags) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(parent);
+  struct TmpfsNode *node;
+  int ret = 0;
+  LOCK(&device->lock);
+  if ((node = TmpfsFind(parent, name))) {
+    TmpfsUtimeImpl(node, times);
+  } else {
+    ret = -1;
+  }
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static int TmpfsFutime(struct VfsInfo *info, const struct timespec times[2]) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  LOCK(&device->lock);
+  TmpfsUtimeImpl(TMPFS_NODE(info), times);
+  UNLOCK(&device->lock);
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int TmpfsLinkat(struct VfsInfo *olddir, const char *oldname,
+                       struct VfsInfo *newdir, const char *newname,
+                       int flags) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(olddir);
+  struct TmpfsNode *node, *dir;
+  int ret = -1;
+  VFS_LOGF("TmpfsLink(%p, \"%s\", %p, \"%s\", %d)", olddir, oldname, newdir,
+           newname, flags);
+  LOCK(&device->lock);
+  dir = TMPFS_NODE(newdir);
+  if (!(node = TmpfsFind(olddir, oldname))) {
+    // fallthrough
+  } else if (S_ISDIR(node->mode)) {
+    eperm();
+  } else if (!S_ISDIR(dir->mode)) {
+    enotdir();
+  } else if (!strcmp(newname, ".") || TmpfsLookup(dir, newname)) {
+    eexist();
+  } else if (TmpfsAccessImpl(dir, W_OK | X_OK) != -1) {
+    ret = TmpfsLink(dir, newname, node);
+  }
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static int TmpfsUnlink(struct VfsInfo *parent, const char *name, int flags) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(parent);
+  struct TmpfsNode *node, *dir;
+  struct TmpfsDirent *de;
+  int ret = -1;
+  VFS_LOGF("TmpfsUnlink(%p, \"%s\", %d)", parent, name, flags);
+  LOCK(&device->lock);
+  dir = TMPFS_NODE(parent);
+  if (!S_ISDIR(dir->mode)) {
+    enotdir();
+  } else if (!strcmp(name, ".")) {
+    if (flags & AT_REMOVEDIR) {
+      einval();
+    } else {
+      eisdir();
+    }
+  } else if (!(de = TmpfsLookup(dir, name))) {
+    enoent();
+  } else if ((flags & AT_REMOVEDIR) && !S_ISDIR(de->node->mode)) {
+    enotdir();
+  } else if (!(flags & AT_REMOVEDIR) && S_ISDIR(de->node->mode)) {
+    eisdir();
+  } else if (S_ISDIR(de->node->mode) && de->node->count) {
+    errno = ENOTEMPTY;
+  } else if (TmpfsAccessImpl(dir, W_OK | X_OK) != -1) {
+    node = TmpfsUnlinkDirent(dir, de);
+    TmpfsPutNode(node);
+    ret = 0;
+  }
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static int TmpfsRename(struct VfsInfo *olddir, const char *oldname,
+                       struct VfsInfo *newdir, const char *newname) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(olddir);
+  struct TmpfsNode *from, *to, *node, *target, *p;
+  struct TmpfsDirent *de, *de2;
+  VFS_LOGF("TmpfsRename(%p, \"%s\", %p, \"%s\")", olddir, oldname, newdir,
+           newname);
+  if (olddir->device != newdir->device) {
+    return exdev();
+  }
+  LOCK(&device->lock);
+  from = TMPFS_NODE(olddir);
+  to = TMPFS_NODE(newdir);
+  if (!S_ISDIR(from->mode) || !S_ISDIR(to->mode)) {
+    enotdir();
+    goto cleananddie;
+  }
+  if (!strcmp(oldname, ".") || !strcmp(newname, ".")) {
+    ebusy();
+    goto cleananddie;
+  }
+  if (!(de = TmpfsLookup(from, oldname))) {
+    enoent();
+    goto cleananddie;
+  }
+  if (TmpfsAccessImpl(from, W_OK | X_OK) == -1 ||
+      TmpfsAccessImpl(to, W_OK | X_OK) == -1) {
+    goto cleananddie;
+  }
+  node = de->node;
+  target = NULL;
+  if ((de2 = TmpfsLookup(to, newname))) {
+    target = de2->node;
+    if (target == node) {
+      UNLOCK(&device->lock);
+      return 0;
+    }
+    if (S_ISDIR(node->mode) && !S_ISDIR(target->mode)) {
+      enotdir();
+      goto cleananddie;
+    }
+    if (!S_ISDIR(node->mode) && S_ISDIR(target->mode)) {
+      eisdir();
+      goto cleananddie;
+    }
+    if (S_ISDIR(target->mode) && target->count) {
+      errno = ENOTEMPTY;
+      goto cleananddie;
+    }
+  }
+  if (S_ISDIR(node->mode)) {
+    for (p = to; p; p = p->parent) {
+      if (p == node) {
+        einval();  // can't move a directory beneath itself
+        goto cleananddie;
+      }
+    }
+  }
+  if (de2) {
+    de2->node = node;
+    ++node->nlink;
+    --target->nlink;
+    if (S_ISDIR(node->mode)) {
+      node->parent = to;  // and the target was a directory, so subdirs holds
+    }
+    to->mtim = to->ctim = target->ctim = GetTime();
+  } else if (TmpfsLink(to, newname, node) == -1) {
+    goto cleananddie;
+  }
+  TmpfsUnlinkDirent(from, de);
+  if (target) {
+    TmpfsPutNode(target);
+  }
+  UNLOCK(&device->lock);
+  return 0;
+cleananddie:
+  UNLOCK(&device->lock);
+  return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static ssize_t TmpfsTransfer(struct VfsInfo *info, const struct iovec *iov,
+                             int iovcnt, off_t offset, bool write,
+                             bool positional) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  struct TmpfsNode *node = TMPFS_NODE(info);
+  struct TmpfsOpen *open = TMPFS_INFO(info)->open;
+  ssize_t ret, rc;
+  int i, accmode;
+  u64 off;
+  if (!open) {
+    return ebadf();
+  }
+  if (positional && offset < 0) {
+    return einval();
+  }
+  LOCK(&device->lock);
+  accmode = open->flags & O_ACCMODE;
+  if (S_ISDIR(node->mode)) {
+    ret = write ? ebadf() : eisdir();
+  } else if (write ? accmode == O_RDONLY : accmode == O_WRONLY) {
+    ret = ebadf();
+  } else {
+    off = positional ? offset : open->offset;
+    if (write && (open->flags & O_APPEND)) {
+      off = node->size;
+    }
+    for (ret = i = 0; i < iovcnt; ++i) {
+      if (write) {
+        rc = TmpfsCopyIn(node, (const u8 *)iov[i].iov_base, iov[i].iov_len,
+                         off);
+        if (rc == -1) {
+          if (!ret) ret = -1;
+          break;
+        }
+      } else {
+        rc = TmpfsCopyOut(node, (u8 *)iov[i].iov_base, iov[i].iov_len, off);
+      }
+      ret += rc;
+      off += rc;
+      if ((size_t)rc < iov[i].iov_len) break;
+    }
+    if (ret != -1 && !positional) {
+      open->offset = off;
+    }
+  }
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static ssize_t TmpfsRead(struct VfsInfo *info, void *buf, size_t len) {
+  struct iovec iov = {buf, len};
+  return TmpfsTransfer(info, &iov, 1, 0, false, false);
+}
+
+static ssize_t TmpfsWrite(struct VfsInfo *info, const void *buf, size_t len) {
+  struct iovec iov = {(void *)buf, len};
+  return TmpfsTransfer(info, &iov, 1, 0, true, false);
+}
+
+static ssize_t TmpfsPread(struct VfsInfo *info, void *buf, size_t len,
+                          off_t off) {
+  struct iovec iov = {buf, len};
+  return TmpfsTransfer(info, &iov, 1, off, false, true);
+}
+
+static ssize_t TmpfsPwrite(struct VfsInfo *info, const void *buf, size_t len,
+                           off_t off) {
+  struct iovec iov = {(void *)buf, len};
+  return TmpfsTransfer(info, &iov, 1, off, true, true);
+}
+
+static ssize_t TmpfsReadv(struct VfsInfo *info, const struct iovec *iov,
+                          int iovcnt) {
+  return TmpfsTransfer(info, iov, iovcnt, 0, false, false);
+}
+
+static ssize_t TmpfsWritev(struct VfsInfo *info, const struct iovec *iov,
+                           int iovcnt) {
+  return TmpfsTransfer(info, iov, iovcnt, 0, true, false);
+}
+
+static ssize_t TmpfsPreadv(struct VfsInfo *info, const struct iovec *iov,
+                           int iovcnt, off_t off) {
+  return TmpfsTransfer(info, iov, iovcnt, off, false, true);
+}
+
+static ssize_t TmpfsPwritev(struct VfsInfo *info, const struct iovec *iov,
+                            int iovcnt, off_t off) {
+  return TmpfsTransfer(info, iov, iovcnt, off, true, true);
+}
+
+static off_t TmpfsSeek(struct VfsInfo *info, off_t off, int whence) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  struct TmpfsNode *node = TMPFS_NODE(info);
+  struct TmpfsOpen *open = TMPFS_INFO(info)->open;
+  i64 pos;
+  if (!open) {
+    return ebadf();
+  }
+  LOCK(&device->lock);
+  switch (whence) {
+    case SEEK_SET:
+      pos = off;
+      break;
+    case SEEK_CUR:
+      pos = open->offset + off;
+      break;
+    case SEEK_END:
+      pos = (S_ISREG(node->mode) ? node->size : 0) + off;
+      break;
+    default:
+      pos = -1;
+      break;
+  }
+  if (pos < 0) {
+    pos = einval();
+  } else {
+    open->offset = pos;
+  }
+  UNLOCK(&device->lock);
+  return pos;
+}
+
+static int TmpfsFtruncate(struct VfsInfo *info, off_t length) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  struct TmpfsNode *node = TMPFS_NODE(info);
+  struct TmpfsOpen *open = TMPFS_INFO(info)->open;
+  int ret = 0;
+  if (length < 0) {
+    return einval();
+  }
+  LOCK(&device->lock);
+  if (!open || !S_ISREG(node->mode) ||
+      (open->flags & O_ACCMODE) == O_RDONLY) {
+    ret = einval();
+  } else {
+    TmpfsTruncateImpl(node, length);
+  }
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static int TmpfsFsync(struct VfsInfo *info) {
+  return 0;
+}
+
+static int TmpfsFlock(struct VfsInfo *info, int operation) {
+  // no other process can see this filesystem
+  return 0;
+}
+
+static int TmpfsFcntl(struct VfsInfo *info, int cmd, va_list args) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  struct TmpfsOpen *open = TMPFS_INFO(info)->open;
+  struct flock *lock;
+  int ret = 0;
+  if (!open) {
+    return ebadf();
+  }
+  LOCK(&device->lock);
+  if (cmd == F_GETFD || cmd == F_SETFD) {
+    // CLOEXEC is already handled by the syscall layer.
+  } else if (cmd == F_GETFL) {
+    ret = open->flags;
+  } else if (cmd == F_SETFL) {
+    open->flags = (open->flags & ~(O_APPEND | O_NONBLOCK)) |
+                  (va_arg(args, int) & (O_APPEND | O_NONBLOCK));
+  } else if (cmd == F_GETLK) {
+    // no other process can see this filesystem
+    lock = va_arg(args, struct flock *);
+    lock->l_type = F_UNLCK;
+  } else if (cmd == F_SETLK || cmd == F_SETLKW) {
+  } else {
+    ret = einval();
+  }
+  UNLOCK(&device->lock);
+  return ret;
+}
+
+static int TmpfsDup(struct VfsInfo *info, struct VfsInfo **newinfo) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  struct TmpfsInfo *tmpinfo = TMPFS_INFO(info);
+  int ret = 0;
+  if (VfsCreateInfo(newinfo) == -1) {
+    return -1;
+  }
+  unassert(!VfsAcquireDevice(info->device, &(*newinfo)->device));
+  if (info->parent) {
+    unassert(!VfsAcquireInfo(info->parent, &(*newinfo)->parent));
+  }
+  (*newinfo)->ino = info->ino;
+  (*newinfo)->mode = info->mode;
+  if (info->name && !((*newinfo)->name = strdup(info->name))) {
+    unassert(!VfsFreeInfo(*newinfo));
+    return enomem();
+  }
+  (*newinfo)->namelen = info->namelen;
+  LOCK(&device->lock);
+  if (TmpfsCreateInfo(device, tmpinfo->node, tmpinfo->open,
+                      (struct TmpfsInfo **)&(*newinfo)->data) == -1) {
+    ret = -1;
+  }
+  UNLOCK(&device->lock);
+  if (ret == -1) {
+    unassert(!VfsFreeInfo(*newinfo));
+  }
+  return ret;
+}
+
+#ifdef HAVE_DUP3
+static int TmpfsDup3(struct VfsInfo *info, struct VfsInfo **newinfo,
+                     int flags) {
+  // O_CLOEXEC is already handled by the syscall layer.
+  return TmpfsDup(info, newinfo);
+}
+#endif
+
+static int TmpfsPoll(struct VfsInfo **infos, struct pollfd *fds, nfds_t nfds,
+                     int timeout) {
+  nfds_t i;
+  int ret = 0;
+  for (i = 0; i < nfds; ++i) {
+    if ((fds[i].revents = fds[i].events & (POLLIN | POLLOUT))) {
+      ++ret;
+    }
+  }
+  return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int TmpfsOpendir(struct VfsInfo *info, struct VfsInfo **output) {
+  if (!S_ISDIR(TMPFS_NODE(info)->mode) || !TMPFS_INFO(info)->open) {
+    return enotdir();
+  }
+  unassert(!VfsAcquireInfo(info, output));
+  return 0;
+}
+
+#ifdef HAVE_SEEKDIR
+static void TmpfsSeekdir(struct VfsInfo *info, long loc) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  LOCK(&device->lock);
+  TMPFS_INFO(info)->open->offset = loc;
+  UNLOCK(&device->lock);
+}
+
+static long TmpfsTelldir(struct VfsInfo *info) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  long ret;
+  LOCK(&device->lock);
+  ret = TMPFS_INFO(info)->open->offset;
+  UNLOCK(&device->lock);
+  return ret;
+}
+#endif
+
+static struct dirent *TmpfsReaddir(struct VfsInfo *info) {
+  static _Thread_local char buf[sizeof(struct dirent) + VFS_NAME_MAX];
+  struct dirent *de = (struct dirent *)buf;
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  struct TmpfsNode *dir = TMPFS_NODE(info), *node;
+  struct TmpfsOpen *open = TMPFS_INFO(info)->open;
+  struct TmpfsDirent *ent;
+  struct Dll *e;
+  LOCK(&device->lock);
+  ent = NULL;
+  if (open->offset == 0) {
+    node = dir;
+    de->d_ino = dir->ino;
+    strcpy(de->d_name, ".");
+  } else if (open->offset == 1) {
+    // the parent of the tmpfs root lives on another device
+    node = dir->parent ? dir->parent : dir;
+    de->d_ino = dir->parent ? dir->parent->ino
+                : info->parent ? info->parent->ino
+                               : dir->ino;
+    strcpy(de->d_name, "..");
+  } else {
+    // cookies are handed out in ascending order as entries are added,
+    // so this resumes correctly even if entries were since unlinked
+    for (e = dll_first(dir->entries); e; e = dll_next(dir->entries, e)) {
+      if (TMPFS_DIRENT_CONTAINER(e)->cookie >= open->offset) {
+        ent = TMPFS_DIRENT_CONTAINER(e);
+        break;
+      }
+    }
+    if (!ent) {
+      UNLOCK(&device->lock);
+      return NULL;
+    }
+    node = ent->node;
+    de->d_ino = node->ino;
+    strcpy(de->d_name, ent->name);
+  }
+#ifdef DT_UNKNOWN
+  if (S_ISDIR(node->mode)) {
+    de->d_type = DT_DIR;
+  } else if (S_ISREG(node->mode)) {
+    de->d_type = DT_REG;
+  } else if (S_ISLNK(node->mode)) {
+    de->d_type = DT_LNK;
+  } else {
+    de->d_type = DT_UNKNOWN;
+  }
+#endif
+  open->offset = ent ? ent->cookie + 1 : open->offset + 1;
+  UNLOCK(&device->lock);
+  return de;
+}
+
+static void TmpfsRewinddir(struct VfsInfo *info) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  LOCK(&device->lock);
+  TMPFS_INFO(info)->open->offset = 0;
+  UNLOCK(&device->lock);
+}
+
+static int TmpfsClosedir(struct VfsInfo *info) {
+  unassert(!VfsFreeInfo(info));
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// copies shared mappings overlapping [addr,addr+len) back into their
+// files, and stops tracking that interval too if `forget` is true
+static void TmpfsSyncMaps(struct TmpfsDevice *device, u8 *addr, size_t len,
+                          bool forget) {
+  u8 *lo, *hi;
+  u64 fileoff;
+  struct Dll *e, *e2;
+  struct TmpfsMap *map, *rest;
+  for (e = dll_first(device->maps); e; e = e2) {
+    e2 = dll_next(device->maps, e);
+    map = TMPFS_MAP_CONTAINER(e);
+    lo = MAX(map->addr, addr);
+    hi = MIN(map->addr + map->len, addr + len);
+    if (lo >= hi) continue;
+    // shared mappings can't grow a file, so the tail past eof is dropped
+    fileoff = map->offset + (lo - map->addr);
+    if (fileoff < map->node->size &&
+        TmpfsCopyIn(map->node, lo, MIN(hi - lo, map->node->size - fileoff),
+                    fileoff) == -1) {
+      LOGF("failed to write back tmpfs mapping: %s", DescribeHostErrno(errno));
+    }
+    if (!forget) continue;
+    if (lo == map->addr && hi == map->addr + map->len) {
+      dll_remove(&device->maps, e);
+      --map->node->refs;
+      TmpfsPutNode(map->node);
+      free(map);
+    } else if (lo == map->addr) {
+      map->offset += hi - lo;
+      map->len -= hi - lo;
+      map->addr = hi;
+    } else if (hi == map->addr + map->len) {
+      map->len = lo - map->addr;
+    } else if ((rest = (struct TmpfsMap *)malloc(sizeof(*rest)))) {
+      rest->node = map->node;
+      rest->addr = hi;
+      rest->len = map->addr + map->len - hi;
+      rest->offset = map->offset + (hi - map->addr);
+      ++rest->node->refs;
+      dll_init(&rest->elem);
+      dll_splice_after(e, &rest->elem);
+      map->len = lo - map->addr;
+    } else {
+      map->len = lo - map->addr;  // the tail won't be written back
+    }
+  }
+}
+
+static void *TmpfsMmap(struct VfsInfo *info, void *addr, size_t len, int prot,
+                       int flags, off_t offset) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  struct TmpfsNode *node = TMPFS_NODE(info);
+  struct TmpfsMap *map = NULL;
+  void *ret;
+  VFS_LOGF("TmpfsMmap(%p, %p, %zu, %d, %d, %ld)", info, addr, len, prot,
+           flags, (long)offset);
+  if (!S_ISREG(node->mode)) {
+    enodev();
+    return MAP_FAILED;
+  }
+  if ((flags & MAP_SHARED) && (prot & PROT_WRITE)) {
+    if (!(map = (struct TmpfsMap *)malloc(sizeof(*map)))) {
+      enomem();
+      return MAP_FAILED;
+    }
+  }
+  if ((ret = mmap(addr, len, PROT_READ | PROT_WRITE,
+                  (flags & ~(MAP_SHARED | MAP_PRIVATE)) | MAP_PRIVATE |
+                      MAP_ANONYMOUS,
+                  -1, 0)) == MAP_FAILED) {
+    free(map);
+    return MAP_FAILED;
+  }
+  LOCK(&device->lock);
+  TmpfsCopyOut(node, (u8 *)ret, len, offset);
+  if (map) {
+    map->node = node;
+    map->addr = (u8 *)ret;
+    map->len = len;
+    map->offset = offset;
+    ++node->refs;
+    dll_init(&map->elem);
+    dll_make_last(&device->maps, &map->elem);
+  }
+  UNLOCK(&device->lock);
+  if (prot != (PROT_READ | PROT_WRITE)) {
+    unassert(!mprotect(ret, len, prot));
+  }
+  return ret;
+}
+
+// called by the vfs while the interval is still mapped
+static int TmpfsMunmap(struct VfsInfo *info, void *addr, size_t len) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  LOCK(&device->lock);
+  TmpfsSyncMaps(device, (u8 *)addr, len, true);
+  UNLOCK(&device->lock);
+  return 0;
+}
+
+static int TmpfsMprotect(struct VfsInfo *info, void *addr, size_t len,
+                         int prot) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  // pages that can't be read anymore can't be written back later
+  if (!(prot & (PROT_READ | PROT_WRITE))) {
+    LOCK(&device->lock);
+    TmpfsSyncMaps(device, (u8 *)addr, len, true);
+    UNLOCK(&device->lock);
+  }
+  return 0;
+}
+
+static int TmpfsMsync(struct VfsInfo *info, void *addr, size_t len,
+                      int flags) {
+  struct TmpfsDevice *device = TMPFS_DEVICE(info);
+  LOCK(&device->lock);
+  TmpfsSyncMaps(device, (u8 *)addr, len, false);
+  UNLOCK(&device->lock);
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+struct VfsSystem g_tmpfs = {.name = "tmpfs",
+                            .nodev = true,
+                            .ops = {
+                                .Init = TmpfsInit,
+                                .Freeinfo = TmpfsFreeInfo,
+                                .Freedevice = TmpfsFreeDevice,
+                                .Readmountentry = TmpfsReadmountentry,
+                                .Finddir = TmpfsFinddir,
+                                .Readlink = TmpfsReadlink,
+                                .Mkdir = TmpfsMkdir,
+                                .Open = TmpfsOpen,
+                                .Access = TmpfsAccess,
+                                .Stat = TmpfsStat,
+                                .Fstat = TmpfsFstat,
+                                .Chmod = TmpfsChmod,
+                                .Fchmod = TmpfsFchmod,
+                                .Chown = TmpfsChown,
+                                .Fchown = TmpfsFchown,
+                                .Ftruncate = TmpfsFtruncate,
+                                .Close = TmpfsClose,
+                                .Link = TmpfsLinkat,
+                                .Unlink = TmpfsUnlink,
+                                .Read = TmpfsRead,
+                                .Write = TmpfsWrite,
+                                .Pread = TmpfsPread,
+                                .Pwrite = TmpfsPwrite,
+                                .Readv = TmpfsReadv,
+                                .Writev = TmpfsWritev,
+                                .Preadv = TmpfsPreadv,
+                                .Pwritev = TmpfsPwritev,
+                                .Seek = TmpfsSeek,
+                                .Fsync = TmpfsFsync,
+                                .Fdatasync = TmpfsFsync,
+                                .Flock = TmpfsFlock,
+                                .Fcntl = TmpfsFcntl,
+                                .Dup = TmpfsDup,
+#ifdef HAVE_DUP3
+                                .Dup3 = TmpfsDup3,
+#endif
+                                .Poll = TmpfsPoll,
+                                .Opendir = TmpfsOpendir,
+#ifdef HAVE_SEEKDIR
+                                .Seekdir = TmpfsSeekdir,
+                                .Telldir = TmpfsTelldir,
+#endif
+                                .Readdir = TmpfsReaddir,
+                                .Rewinddir = TmpfsRewinddir,
+                                .Closedir = TmpfsClosedir,
+                                .Rename = TmpfsRename,
+                                .Utime = TmpfsUtime,
+                                .Futime = TmpfsFutime,
+                                .Symlink = TmpfsSymlink,
+                                .Mmap = TmpfsMmap,
+                                .Munmap = TmpfsMunmap,
+                                .Mprotect = TmpfsMprotect,
+                                .Msync = TmpfsMsync,
+                            }};
+
+#endif /* DISABLE_VFS */
@@ -0,0 +1,8 @@
+#ifndef BLINK_TMPFS_H_
+#define BLINK_TMPFS_H_
+
+#include "blink/vfs.h"
+
+extern struct VfsSystem g_tmpfs;
+
+#endif  // BLINK_TMPFS_H_
@@ -33,21 +33,82 @@
 #define kRealSize  (16 * 1024 * 1024)  // size of ram for real mode
 #define kStackSize (8 * 1024 * 1024)   // size of stack for user mode
 #define kNullSize  (2 * 1024 * 1024)   // minimum user mode image address
+#define kHostStack (512 * 1024)        // host stack for each guest thread
+#define kHugeSize  (2 * 1024 * 1024)   // host transparent huge page size
+#define kShadowMax 46                  // log2 of biggest shadow memory window
+#define kShadowMin 32                  // log2 of smallest shadow memory window
+#define kShadowPad (1024 * 1024)       // guard size after shadow memory window
 
 #define kMinBlinkFd   123       // fds owned by the vm start here
+#define kSignalFds    8         // signalfd()s a guest may have open at once
+#define kThreadPool   8         // exited thread hosts kept for clone() reuse
 #define kPollingMs    50        // busy loop for futex(), poll(), etc.
 #define kSemSize      128       // number of bytes used for each semaphore
 #define kBusCount     256       // # load balanced semaphores in virtual bus
 #define kBusRegion    kSemSize  // 16 is sufficient for 8-byte loads/stores
-#define kFutexMax     100
+#define kFutexMax     65536     // futex entries reserved in shared memory
+#define kFutexBuckets 256       // futex hash table size (one lock each)
 #define kRedzoneSize  128
 #define kSmcQueueSize 32
+#define kSmcPages     64        // code pages whose write rate is tracked (power of two)
+#define kSmcVolatile  128       // flushes per window that unprotect a page
+#define kSmcWindowMs  10        // window over which page flushes are counted
+#define kSmcCalmMs    100       // how often unprotected page content is checked
+#define kSmcSkip      64        // path creations skipped after hitting one
+#define kTlbSets      64        // software tlb sets (power of two)
+#define kTlbWays      4         // software tlb associativity
+#define kTlbQueueSize 8         // queued ranges before a full tlb flush
+#define kIcacheSets   512       // decoded instruction cache sets (power of two)
+#define kIcacheWays   4         // decoded instruction cache associativity
+#define kBlockSets    256       // pre-decoded basic block sets (power of two)
+#define kBlockOps     16        // most instructions in a pre-decoded block
+#define kFaultAround  65536     // bytes of reserved memory committed per fault
+#define kPageBatch    32        // pages moved between thread cache and pool
+#define kRssBatch     64        // pages a thread counts before updating rss
+#define kPageZapMin   16        // freed pages that are discarded, not cleared
+#define kPathFollows  16        // direct branches a jit path may run through
+#define kPathColds    32        // slow paths moved to the end of a jit path
+#define kHotSlots     4096      // hashed jit path execution counters
+#define kHotPath      1000      // executions before a path is rebuilt as trace
+#define kShadowFrames 16        // jit return address predictions (power of two)
+#define kBranchCache  256       // jit indirect branch target cache (power of two)
+#define kExecCacheSize 16      // executables remembered as already vetted
+#define kProcfsCacheMs 10       // host derived /proc files are reused this long
+#define kHostfsStatCacheMs 50   // readdir prefetched stats are reused this long
+#define kMetricsMs     1000     // how often the BLINK_METRICS file is rewritten
+#define kReclaimWaitMs 100      // how long BLINK_RECLAIM waits for threads to park
+#define kReclaimZipMax 3072     // compressed pages bigger than this stay resident
+#define kCoreWaitMs    100      // how long BLINK_CORE waits for threads to park
+#define kCoreIovs      64       // guest memory extents per BLINK_CORE write
+#define kProfileHz     1000     // how often BLINK_PROFILE samples guest threads
+#define kProfileDepth  32       // frames of guest stack kept per profile sample
+#define kProfileStacks 4096     // unique guest stacks BLINK_PROFILE can tally
+#define kBtraceMs      10       // how often BLINK_BTRACE rings are drained
+#define kBtraceRecords 4096     // syscalls each thread's BLINK_BTRACE ring holds
+#define kLogMs         100      // how often log records in rings are written
+#define kLogBytes      65536    // bytes of log records each thread's ring holds
+#define kFlightRecords 256      // paths each thread's BLINK_FLIGHT ring holds
+#define kFlightTickEvery 16     // paths BLINK_FLIGHT enters between timestamps
+#define kEtraceRecords 1048576  // BLINK_ETRACE ring of each thread (power of two)
+#define kCoverageSlots 4096     // BLINK_COVERAGE block hash table (power of two)
+#define kCoverageEdges 65536    // BLINK_COVERAGE edges counted (power of two)
+#define kSpinPauses    64       // guest pauses per host sched_yield()
+#define kSpinYields    16       // yields before spinning threads sleep
+#define kSpinParkUs    50       // how long a long spinning thread sleeps
+#define kSpinWindowUs  1000     // pause bursts further apart start over
 #define kMaxMapSize   (UINT64_C(8) * 1024 * 1024 * 1024)
 #define kMaxResident  (UINT64_C(8) * 1024 * 1024 * 1024)
 #define kMaxVirtual   (kMaxResident * 8)
 #define kMaxAncillary 1000
+#define kGetdentsMax  65536  // largest getdents() batch assembled on the host
+#define kPipeGrowSize 1048576  // host buffer of guest pipes carrying bulk data
+#define kPipeBulkWrite 65536  // write size that makes a guest pipe grow
+#define kMaxMmsgs     1024  // linux clamps sendmmsg() and recvmmsg() to this
+#define kMaxAioPool   256   // upper bound on BLINK_ASYNC_IO worker threads
 #define kMaxShebang   512
 #define kMaxSigDepth  8
+#define kRandomReseed 1048576  // chacha20 bytes per thread before host rekey
+#define kRandomSmall  256      // largest getrandom() served from that buffer
 
 #define kStraceArgMax 256
 #define kStraceBufMax 32
@@ -22,10 +22,13 @@
 
 #include "blink/alu.h"
 #include "blink/assert.h"
+#include "blink/biosrom.h"
 #include "blink/builtin.h"
 #include "blink/bus.h"
 #include "blink/endian.h"
 #include "blink/flags.h"
+#include "blink/flight.h"
+#include "blink/fpu.h"
 #include "blink/intrin.h"
 #include "blink/jit.h"
 #include "blink/log.h"
@@ -175,6 +178,32 @@ MICRO_OP void FastJmpAbs(u64 addr, struct Machine *m) {
   m->ip = addr;
 }
 
+// loads the branch target from a global offset table slot, whose
+// address is known when the path is made, since plt stubs and calls
+// compiled with -fno-plt address it relative to the instruction
+MICRO_OP u64 FastLoadGot(struct Machine *m, i64 got) {
+  return Read64(ToSkewedHost(got));
+}
+
+// returns true if path may jump back to its own beginning, which stops
+// being the case once the interpreter needs attention, e.g. for signals
+// and self-modifying code, or any jit path has been deleted meanwhile
+MICRO_OP u32 CanLoop(struct Machine *m, u64 pagegen) {
+  return !atomic_load_explicit(&m->attention, memory_order_relaxed) &
+         (atomic_load_explicit(&m->system->jit.pagegen,
+                               memory_order_relaxed) == pagegen);
+}
+
+// checks that a system call returned to the op which follows it, and
+// that it neither raised a signal, nor deleted any jit code, in which
+// case its path may keep going into the path of the following op
+MICRO_OP u32 CanResume(struct Machine *m, u64 pagegen, u64 ip) {
+  return (m->ip == ip) &
+         !atomic_load_explicit(&m->attention, memory_order_relaxed) &
+         (atomic_load_explicit(&m->system->jit.pagegen,
+                               memory_order_relaxed) == pagegen);
+}
+
 MICRO_OP static u32 Jb(struct Machine *m) {
   return !!(m->flags & CF);
 }
@@ -369,8 +398,17 @@ MICRO_OP void Int32ToFloat(i32 x, struct Machine *m, long reg) {
 ////////////////////////////////////////////////////////////////////////////////
 // ACCOUNTING
 
-MICRO_OP void CountOp(long *instructions_jitted_ptr) {
-  STATISTIC(++*instructions_jitted_ptr);
+void CountOp(long op) {
+  STATISTIC(++instructions_jitted);
+  STATISTIC(++opcode_jitted[op]);
+}
+
+void CountHelperOp(long op) {
+  STATISTIC(++opcode_helpers[op]);
+}
+
+MICRO_OP u32 CountPath(u32 *hits) {
+  return ++*hits == kHotPath;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -390,6 +428,26 @@ MICRO_OP void AdvanceIp(struct Machine *m, long oplen) {
   m->ip += oplen;
 }
 
+// puts jit path being entered in the thread's BLINK_FLIGHT ring, along
+// with the host cycle counter every kFlightTickEvery paths
+MICRO_OP void RecordFlight(struct Machine *m, i64 pc) {
+  u32 i;
+  u64 c = 0;
+  struct FlightRing *r = m->flight;
+  i = r->head++;
+  r->pcs[i & (kFlightRecords - 1)] = pc;
+  if (!(i & (kFlightTickEvery - 1))) {
+#if defined(__GNUC__) && defined(__aarch64__)
+    asm volatile("mrs %0, cntvct_el0" : "=r"(c));
+#elif defined(__GNUC__) && defined(__x86_64__)
+    u32 ax, dx;
+    asm volatile("rdtsc" : "=a"(ax), "=d"(dx));
+    c = (u64)dx << 32 | ax;
+#endif
+    r->ticks[i / kFlightTickEvery & (ARRAYLEN(r->ticks) - 1)] = c;
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // READING FROM REGISTER FILE
 
@@ -724,7 +782,11 @@ typedef i64 (*load_f)(const u8 *);
 typedef void (*store_f)(u8 *, u64);
 
 MICRO_OP static u8 *ResolveHost(i64 v) {
-  return ToHost(v);
+  return ToSkewedHost(v);
+}
+
+MICRO_OP static u8 *ResolveShadowHost(i64 v, u64 size, u64 base) {
+  return ToShadowHost(v, size, base);
 }
 
 MICRO_OP static u8 *GetBegPtr(struct Machine *m, long i) {
@@ -743,6 +805,50 @@ MICRO_OP void MovsdWpsVpsOp(u8 *p, struct Machine *m, long reg) {
   Write64(p, Read64(m->xmm[reg]));
 }
 
+// looks for virtual address in the most recently used way of its tlb
+// set, returning the host pointer in res0 or zero if the slow path has
+// to be taken, along with the unmodified virtual address in res1
+MICRO_OP static XMM_TYPE ProbeTlb(struct Machine *m, i64 v, u64 need, u64 n) {
+  u64 hit, entry;
+  struct MachineTlb *e = m->tlb[(v >> 12) & (kTlbSets - 1)];
+  entry = e->entry;
+  hit = (e->page == (v & -4096)) &                                  //
+        ((entry & (need | PAGE_RSRV)) == need) &                    //
+        ((v & 4095) + n <= 4096) &                                  //
+        !atomic_load_explicit(&m->invalidated, memory_order_relaxed);
+  RETURN_XMM(((entry & PAGE_TA) + (v & 4095)) & -hit, v);
+}
+
+// returns true if metal mode addresses are translated by page tables
+MICRO_OP_SAFE u64 IsMetalPaged(struct Machine *m) {
+  return (m->mode.omode == XED_MODE_LONG) |
+         ((m->mode.genmode != XED_GEN_MODE_REAL) & !!(m->system->cr0 & CR0_PG));
+}
+
+// returns true if physical page may be accessed directly, i.e. it's in
+// bounds and not part of the bios rom which the slow path write protects
+MICRO_OP_SAFE u64 IsMetalRam(u64 phys, u64 n) {
+  return (phys + 4095 < kRealSize) &                      //
+         ((phys & 4095) + n <= 4096) &                    //
+         (phys - kBiosOptBase >= kBiosEnd - kBiosOptBase);
+}
+
+// like ProbeTlb() except for metal mode guests that are using paging,
+// whose tlb entries hold physical addresses rather than host pointers
+MICRO_OP static XMM_TYPE ProbeMetalTlb(struct Machine *m, i64 v, u64 need,
+                                       u64 n) {
+  u64 hit, entry, phys;
+  struct MachineTlb *e = m->tlb[(v >> 12) & (kTlbSets - 1)];
+  entry = e->entry;
+  phys = (entry & PAGE_TA) + (v & 4095);
+  hit = IsMetalPaged(m) &                                           //
+        (e->page == (v & -4096)) &                                  //
+        ((entry & need) == need) &                                  //
+        IsMetalRam(phys, n) &                                       //
+        !atomic_load_explicit(&m->invalidated, memory_order_relaxed);
+  RETURN_XMM((u64)(uintptr_t)(m->system->real + phys) & -hit, v);
+}
+
 #if defined(__x86_64__) && defined(TRIVIALLY_RELOCATABLE)
 #define LOADSTORE "m"
 
@@ -1290,6 +1396,15 @@ MICRO_OP void MulAxDx(u64 x, struct Machine *m) {
   Put64(m->ax, z);
   Put64(m->dx, z >> 64);
 }
+MICRO_OP void ImulAxDx(u64 x, struct Machine *m) {
+  int o;
+  __int128 z;
+  z = (__int128)(i64)x * (i64)Get64(m->ax);
+  o = z != (i64)z;
+  m->flags = (m->flags & ~(CF | OF)) | o << FLAGS_CF | o << FLAGS_OF;
+  Put64(m->ax, z);
+  Put64(m->dx, z >> 64);
+}
 #ifndef DISABLE_BMI2
 MICRO_OP void Mulx64(u64 x,              //
                      struct Machine *m,  //
@@ -1302,6 +1417,24 @@ MICRO_OP void Mulx64(u64 x,              //
 }
 #endif /* !DISABLE_BMI2 */
 #endif /* HAVE_INT128 */
+MICRO_OP void MulEaxEdx(u64 x, struct Machine *m) {
+  int o;
+  u64 z;
+  z = (u64)(u32)x * Get32(m->ax);
+  o = (u32)z != z;
+  m->flags = (m->flags & ~(CF | OF)) | o << FLAGS_CF | o << FLAGS_OF;
+  Put64(m->ax, (u32)z);
+  Put64(m->dx, z >> 32);
+}
+MICRO_OP void ImulEaxEdx(u64 x, struct Machine *m) {
+  int o;
+  i64 z;
+  z = (i64)(i32)x * (i32)Get32(m->ax);
+  o = z != (i32)z;
+  m->flags = (m->flags & ~(CF | OF)) | o << FLAGS_CF | o << FLAGS_OF;
+  Put64(m->ax, (u32)z);
+  Put64(m->dx, z >> 32);
+}
 
 MICRO_OP i64 JustNeg(u64 x) {
   return -x;
@@ -1346,48 +1479,253 @@ const aluop_f kFastDec[4] = {
     (aluop_f)FastDec64,  //
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// BIT MANIPULATION
+
+#if X86_INTRINSICS
+MICRO_OP u64 FastBsf(u64 x, struct Machine *m) {
+  u64 r;
+  asm("bsf\t%1,%0\n\t"
+      "cmovz\t%2,%0"
+      : "=&r" (r) : "r" (x), "r" ((u64)0) : "cc");
+  m->flags = (m->flags & ~ZF) | !x << FLAGS_ZF;
+  return r;
+}
+MICRO_OP u64 FastBsr(u64 x, struct Machine *m) {
+  u64 r;
+  asm("bsr\t%1,%0\n\t"
+      "cmovz\t%2,%0"
+      : "=&r" (r) : "r" (x), "r" ((u64)0) : "cc");
+  m->flags = (m->flags & ~ZF) | !x << FLAGS_ZF;
+  return r;
+}
+// same as bsf, except zero becomes the operand size (see AluLzcnt)
+MICRO_OP u64 FastLzcnt(u64 x, struct Machine *m, u64 bits) {
+  u64 r;
+  asm("bsf\t%1,%0\n\t"
+      "cmovz\t%2,%0"
+      : "=&r" (r) : "r" (x), "r" (bits) : "cc");
+  m->flags = (m->flags & ~(CF | ZF)) | !x << FLAGS_CF | !r << FLAGS_ZF;
+  return r;
+}
+// same as bsr, except zero becomes the operand size (see AluTzcnt)
+MICRO_OP u64 FastTzcnt(u64 x, struct Machine *m, u64 bits) {
+  u64 r;
+  asm("bsr\t%1,%0\n\t"
+      "cmovz\t%2,%0"
+      : "=&r" (r) : "r" (x), "r" (bits) : "cc");
+  m->flags = (m->flags & ~(CF | ZF)) | !x << FLAGS_CF | !r << FLAGS_ZF;
+  return r;
+}
+MICRO_OP u64 FastPopcnt(u64 x, struct Machine *m) {
+  u64 r;
+#ifdef __POPCNT__
+  asm("popcnt\t%1,%0" : "=r" (r) : "r" (x) : "cc");
+#else
+  r = x - ((x >> 1) & 0x5555555555555555);
+  r = ((r >> 2) & 0x3333333333333333) + (r & 0x3333333333333333);
+  r = (r + (r >> 4)) & 0x0f0f0f0f0f0f0f0f;
+  r = (r * 0x0101010101010101) >> 56;
+#endif
+  m->flags = SetLazyParityByte((m->flags & ~(CF | ZF | SF | OF)) |  //
+                                    !x << FLAGS_ZF,
+                                1);  // clears pf
+  return r;
+}
+#endif /* X86_INTRINSICS */
+
+#define BIT_OPS(N, T)                                           \
+  MICRO_OP static i64 FastBt##N(u64 x, u64 y, struct Machine *m) {  \
+    T b = (T)1 << (y & (N - 1));                                \
+    m->flags = (m->flags & ~CF) | !!(x & b) << FLAGS_CF;        \
+    return x;                                                   \
+  }                                                             \
+  MICRO_OP static i64 FastBts##N(u64 x, u64 y, struct Machine *m) { \
+    T b = (T)1 << (y & (N - 1));                                \
+    m->flags = (m->flags & ~CF) | !!(x & b) << FLAGS_CF;        \
+    return x | b;                                               \
+  }                                                             \
+  MICRO_OP static i64 FastBtr##N(u64 x, u64 y, struct Machine *m) { \
+    T b = (T)1 << (y & (N - 1));                                \
+    m->flags = (m->flags & ~CF) | !!(x & b) << FLAGS_CF;        \
+    return x & ~b;                                              \
+  }                                                             \
+  MICRO_OP static i64 FastBtc##N(u64 x, u64 y, struct Machine *m) { \
+    T b = (T)1 << (y & (N - 1));                                \
+    m->flags = (m->flags & ~CF) | !!(x & b) << FLAGS_CF;        \
+    return x ^ b;                                               \
+  }
+BIT_OPS(16, u16)
+BIT_OPS(32, u32)
+BIT_OPS(64, u64)
+#undef BIT_OPS
+
+// bt, bts, btr, btc indexed by operand log2 size minus one
+const bitop_f kFastBit[4][3] = {
+    {FastBt16, FastBt32, FastBt64},     //
+    {FastBts16, FastBts32, FastBts64},  //
+    {FastBtr16, FastBtr32, FastBtr64},  //
+    {FastBtc16, FastBtc32, FastBtc64},  //
+};
+
+#ifndef DISABLE_BMI2
+MICRO_OP static i64 Shlx32(u64 x, u64 y) {
+  return (u32)x << (y & 31);
+}
+MICRO_OP static i64 Shlx64(u64 x, u64 y) {
+  return x << (y & 63);
+}
+MICRO_OP static i64 Shrx32(u64 x, u64 y) {
+  return (u32)x >> (y & 31);
+}
+MICRO_OP static i64 Shrx64(u64 x, u64 y) {
+  return x >> (y & 63);
+}
+MICRO_OP static i64 Sarx32(u64 x, u64 y) {
+  return (u32)((i32)x >> (y & 31));
+}
+MICRO_OP static i64 Sarx64(u64 x, u64 y) {
+  return (i64)x >> (y & 63);
+}
+MICRO_OP static i64 Rorx32(u64 x, u64 y) {
+  return (u32)((u32)x >> (y & 31) | (u32)x << (-y & 31));
+}
+MICRO_OP static i64 Rorx64(u64 x, u64 y) {
+  return x >> (y & 63) | x << (-y & 63);
+}
+
+// shlx, shrx, sarx, rorx indexed by rex.w
+const shxop_f kFastShx[4][2] = {
+    {Shlx32, Shlx64},  //
+    {Shrx32, Shrx64},  //
+    {Sarx32, Sarx64},  //
+    {Rorx32, Rorx64},  //
+};
+
+#if X86_INTRINSICS && defined(__BMI2__)
+MICRO_OP static i64 Pdep32(u64 x, u64 y) {
+  u32 r;
+  asm("pdep\t%2,%1,%0" : "=r" (r) : "r" ((u32)x), "r" ((u32)y));
+  return r;
+}
+MICRO_OP static i64 Pdep64(u64 x, u64 y) {
+  u64 r;
+  asm("pdep\t%2,%1,%0" : "=r" (r) : "r" (x), "r" (y));
+  return r;
+}
+MICRO_OP static i64 Pext32(u64 x, u64 y) {
+  u32 r;
+  asm("pext\t%2,%1,%0" : "=r" (r) : "r" ((u32)x), "r" ((u32)y));
+  return r;
+}
+MICRO_OP static i64 Pext64(u64 x, u64 y) {
+  u64 r;
+  asm("pext\t%2,%1,%0" : "=r" (r) : "r" (x), "r" (y));
+  return r;
+}
+// pdep, pext indexed by rex.w, if the host has them
+const shxop_f kFastPbit[2][2] = {
+    {Pdep32, Pdep64},  //
+    {Pext32, Pext64},  //
+};
+#else
+const shxop_f kFastPbit[2][2];
+#endif
+#endif /* DISABLE_BMI2 */
+
 ////////////////////////////////////////////////////////////////////////////////
 // STACK OPERATIONS
 
 MICRO_OP void FastPush(struct Machine *m, long rexbsrm) {
   u64 v, x = Get64(m->weg[rexbsrm]);
   Put64(m->sp, (v = Get64(m->sp) - 8));
-  Write64(ToHost(v), x);
+  Write64(ToSkewedHost(v), x);
 }
 
 MICRO_OP void FastPop(struct Machine *m, long rexbsrm) {
   u64 v = Get64(m->sp);
   Put64(m->sp, v + 8);
-  Put64(m->weg[rexbsrm], Read64(ToHost(v)));
+  Put64(m->weg[rexbsrm], Read64(ToSkewedHost(v)));
+}
+
+// stores register in a run of fused pushes, relative to the old rsp
+MICRO_OP void FastPushAt(struct Machine *m, long rexbsrm, long off) {
+  Write64(ToSkewedHost(Get64(m->sp) + off), Get64(m->weg[rexbsrm]));
+}
+
+// loads register in a run of fused pops, relative to the old rsp
+MICRO_OP void FastPopAt(struct Machine *m, long rexbsrm, long off) {
+  Put64(m->weg[rexbsrm], Read64(ToSkewedHost(Get64(m->sp) + off)));
+}
+
+MICRO_OP void FastAddSp(struct Machine *m, long delta) {
+  Put64(m->sp, Get64(m->sp) + delta);
 }
 
 MICRO_OP void FastCall(struct Machine *m, u64 disp) {
   u64 v, x = m->ip + disp;
   Put64(m->sp, (v = Get64(m->sp) - 8));
-  Write64(ToHost(v), m->ip);
+  Write64(ToSkewedHost(v), m->ip);
+  PushShadow(m, m->ip);
   m->ip = x;
 }
 
 MICRO_OP void FastCallAbs(u64 x, struct Machine *m) {
   u64 v;
   Put64(m->sp, (v = Get64(m->sp) - 8));
-  Write64(ToHost(v), m->ip);
+  Write64(ToSkewedHost(v), m->ip);
+  PushShadow(m, m->ip);
   m->ip = x;
 }
 
 MICRO_OP void FastLeave(struct Machine *m) {
   u64 v = Get64(m->bp);
   Put64(m->sp, v + 8);
-  Put64(m->bp, Read64(ToHost(v)));
+  Put64(m->bp, Read64(ToSkewedHost(v)));
 }
 
 MICRO_OP i64 PredictRet(struct Machine *m, i64 prediction) {
   u64 v = Get64(m->sp);
   Put64(m->sp, v + 8);
-  m->ip = Read64(ToHost(v));
+  m->ip = Read64(ToSkewedHost(v));
+  --m->shadow.i;
   return m->ip ^ prediction;
 }
 
+MICRO_OP i64 PredictJmp(struct Machine *m, i64 prediction) {
+  return m->ip ^ prediction;
+}
+
+// returns jit code for where an indirect branch went, if it went there
+// before and no jit path has been deleted since. otherwise returns zero
+// so the caller exits to the interpreter, which is also what we do when
+// signals are pending, since indirect branches can form cycles
+MICRO_OP_SAFE uintptr_t LookupBranch(struct Machine *m) {
+  struct BranchTarget *b = GetBranchTarget(m, m->ip);
+  if (b->pc == m->ip &&
+      b->gen == atomic_load_explicit(&m->system->jit.pagegen,
+                                     memory_order_acquire) &&
+      !atomic_load_explicit(&m->attention, memory_order_relaxed)) {
+    return b->code;
+  } else {
+    m->mispredicted = true;
+    return 0;
+  }
+}
+
+MICRO_OP uintptr_t LookupJmp(struct Machine *m) {
+  return LookupBranch(m);
+}
+
+// rets that don't go back to their call, e.g. longjmp(), aren't cached
+MICRO_OP uintptr_t LookupRet(struct Machine *m) {
+  if (m->shadow.pc[m->shadow.i & (kShadowFrames - 1)] == m->ip) {
+    return LookupBranch(m);
+  } else {
+    return 0;
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // SIGN EXTENDING
 
@@ -1406,12 +1744,6 @@ static const sex_f kSex[] = {Sex8, Sex16, Sex32};
 ////////////////////////////////////////////////////////////////////////////////
 // ADDRESSING
 
-MICRO_OP static u64 Truncate32(u64 x) {
-  return (u32)x;
-}
-MICRO_OP static i64 Seg(struct Machine *m, u64 d, long s) {
-  return d + m->seg[s].base;
-}
 MICRO_OP static i64 Base(struct Machine *m, u64 d, long i) {
   return d + Get64(m->weg[i]);
 }
@@ -1542,6 +1874,341 @@ long GetMicroOpLength(void *uop) {
   return res;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// GUEST REGISTER CACHING
+//
+// The 32-bit and 64-bit general registers an op touches are kept in
+// the callee-saved host registers kJitSav1..kJitSav4 for the rest of
+// the path, so a loop body which shuffles a few registers around can
+// usually avoid a round trip through struct Machine per micro-op. The
+// dirty ones get written back before anything which might look at or
+// fault with m->weg, i.e. calls, memory micro-ops, and path exits; a
+// sav register that an op borrows as scratch is evicted first.
+
+static u32 GetWegOffset(unsigned reg) {
+  return offsetof(struct Machine, weg) + reg * 8;
+}
+
+static void WritebackJitReg(struct Machine *m, unsigned k) {
+  struct JitPath *p = &m->path;
+  if (p->dirty & (1u << k)) {
+    AppendJitStore(m->path.jb, kJitSav0, GetWegOffset(p->regs[k]), kJitSav[k]);
+    p->dirty &= ~(1u << k);
+    STATISTIC(++path_reg_writebacks);
+  }
+}
+
+static void EvictJitReg(struct Machine *m, unsigned k) {
+  WritebackJitReg(m, k);
+  m->path.cached &= ~(1u << k);
+}
+
+static int FindJitReg(struct Machine *m, unsigned reg) {
+  unsigned k;
+  struct JitPath *p = &m->path;
+  for (k = 1; k < ARRAYLEN(kJitSav); ++k) {
+    if ((p->cached & (1u << k)) && p->regs[k] == reg) {
+      p->used[k] = ++p->tick;
+      return k;
+    }
+  }
+  return -1;
+}
+
+static int AllocateJitReg(struct Machine *m, unsigned reg) {
+  struct JitPath *p = &m->path;
+  unsigned j, k, best = 0;
+  // prefer registers ops seldom borrow, then the least recently used
+  static const u8 kOrder[] = {2, 4, 3, 1};
+  for (j = 0; j < ARRAYLEN(kOrder); ++j) {
+    k = kOrder[j];
+    if (p->scratch & (1u << k)) continue;
+    if (!(p->cached & (1u << k))) {
+      best = k;
+      break;
+    }
+    if (!best || p->used[k] < p->used[best]) {
+      best = k;
+    }
+  }
+  if (!best) return -1;
+  EvictJitReg(m, best);
+  p->cached |= 1u << best;
+  p->regs[best] = reg;
+  p->used[best] = ++p->tick;
+  return best;
+}
+
+static void BorrowJitReg(struct Machine *m, unsigned k) {
+  if (k) {
+    EvictJitReg(m, k);
+    m->path.scratch |= 1u << k;
+  }
+}
+
+/**
+ * Discards guest register cache state without generating any code.
+ */
+void ResetJitRegs(struct Machine *m) {
+  struct JitPath *p = &m->path;
+  p->cached = 0;
+  p->dirty = 0;
+  p->scratch = 0;
+  p->nocache = false;
+}
+
+/**
+ * Generates code that writes modified cached guest registers back to
+ * struct Machine. Registers stay cached since their values are equal.
+ */
+void FlushJitRegs(struct Machine *m) {
+  unsigned k;
+  for (k = 1; k < ARRAYLEN(kJitSav); ++k) {
+    WritebackJitReg(m, k);
+  }
+}
+
+/**
+ * Generates writeback code and then forgets all cached guest registers.
+ */
+void ForgetJitRegs(struct Machine *m) {
+  FlushJitRegs(m);
+  m->path.cached = 0;
+}
+
+static bool IsInTable(void *fun, const void *tab, size_t size) {
+  size_t i;
+  for (i = 0; i < size / sizeof(void *); ++i) {
+    if (((void *const *)tab)[i] == fun) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// returns true if function doesn't touch m->weg and can't fault
+static bool IsGprObliviousFunction(void *fun) {
+  return fun == (void *)AddIp ||                                //
+         fun == (void *)SkewIp ||                               //
+         fun == (void *)AdvanceIp ||                            //
+         fun == (void *)RecordFlight ||                         //
+         fun == (void *)CountOp ||                              //
+         fun == (void *)CountHelperOp ||                        //
+         fun == (void *)CountPath ||                            //
+         fun == (void *)CanLoop ||                              //
+         fun == (void *)CanResume ||                            //
+         fun == (void *)ResolveHost ||                          //
+         fun == (void *)ResolveShadowHost ||                    //
+         fun == (void *)ProbeTlb ||                             //
+         fun == (void *)ProbeMetalTlb ||                        //
+         fun == (void *)GetXmmPtr ||                            //
+         fun == (void *)kGetReg[4] ||                           //
+         fun == (void *)kPutReg[4] ||                           //
+#if X86_INTRINSICS
+         fun == (void *)FastBsf ||                              //
+         fun == (void *)FastBsr ||                              //
+         fun == (void *)FastLzcnt ||                            //
+         fun == (void *)FastTzcnt ||                            //
+         fun == (void *)FastPopcnt ||                           //
+#endif
+         IsInTable(fun, kFastBit, sizeof(kFastBit)) ||          //
+#ifndef DISABLE_BMI2
+         IsInTable(fun, kFastShx, sizeof(kFastShx)) ||          //
+         IsInTable(fun, kFastPbit, sizeof(kFastPbit)) ||        //
+#endif
+#ifndef DISABLE_X87
+         fun == (void *)SetFpuIp ||                             //
+         fun == (void *)SetFpuIpDp ||                           //
+         IsInTable(fun, kFpuJitReg, sizeof(kFpuJitReg)) ||      //
+#endif
+         IsInTable(fun, kSex, sizeof(kSex)) ||                  //
+         IsInTable(fun, kAlu, sizeof(kAlu)) ||                  //
+         IsInTable(fun, kBsu, sizeof(kBsu)) ||                  //
+         IsInTable(fun, kJustAlu, sizeof(kJustAlu)) ||          //
+         IsInTable(fun, kAluFast, sizeof(kAluFast)) ||          //
+         IsInTable(fun, kJustBsu, sizeof(kJustBsu)) ||          //
+         IsInTable(fun, kJustBsu32, sizeof(kJustBsu32));
+}
+
+// returns true if function might read m->weg or fault but won't write
+static bool IsGprReadingFunction(void *fun) {
+  return fun == (void *)Base ||                                 //
+         fun == (void *)Index ||                                //
+         fun == (void *)FastPushAt ||                           //
+         fun == (void *)GetCl ||                                //
+         fun == (void *)ReserveAddress ||                       //
+         IsInTable(fun, kBaseIndex, sizeof(kBaseIndex)) ||      //
+         IsInTable(fun, kJustBsuCl32, sizeof(kJustBsuCl32)) ||  //
+         IsInTable(fun, kJustBsuCl64, sizeof(kJustBsuCl64)) ||  //
+         IsInTable(fun, kGetReg, sizeof(kGetReg)) ||            //
+         IsInTable(fun, kGetReg32, sizeof(kGetReg32)) ||        //
+         IsInTable(fun, kGetReg64, sizeof(kGetReg64)) ||        //
+         IsInTable(fun, kLoad, sizeof(kLoad)) ||                //
+#ifndef DISABLE_X87
+         IsInTable(fun, kFpuJitMem, sizeof(kFpuJitMem)) ||      //
+#endif
+         IsInTable(fun, kStore, sizeof(kStore));
+}
+
+static void SyncJitRegs(struct Machine *m, void *fun) {
+  if (!m->path.cached) return;
+  if (IsGprObliviousFunction(fun)) return;
+  if (IsGprReadingFunction(fun)) {
+    FlushJitRegs(m);
+  } else {
+    ForgetJitRegs(m);
+  }
+}
+
+static bool CanCacheJitRegs(struct Machine *m) {
+  return !m->path.nocache;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// SOFTWARE TLB PROBING
+//
+// When guest memory isn't linearly mapped, each memory operand has to
+// be translated from a virtual address, which used to mean calling
+// ReserveAddress() even when its answer was sitting in the tlb. Paths
+// now probe the most recently used way of the tlb set inline and only
+// call out on a miss, like the softmmu fast path of qemu. Hits require
+// the access be within one page of host memory. Writes also need the
+// page to not be executable, so the smc queue needn't be consulted,
+// and with the vfs, to be soft dirty already, so its first write gets
+// to mark it.
+// Metal mode guests that use paging are probed the same way, except
+// their tlb entries hold guest physical addresses.
+
+// turns virtual address in res0 into host pointer in res0
+static void ReserveJitAddress(P, u64 n, bool writable) {
+  long skip;
+  u64 need;
+  if (m->metal && !IsMetalPaged(m)) {
+    Jitter(A,
+           "a3i"    // arg3 = writable
+           "a2i"    // arg2 = bytes to access
+           "r0a1="  // arg1 = virtual address
+           "q"      // arg0 = machine
+           "c",     // call function (turn virtual into pointer)
+           (u64)writable, n, ReserveAddress);
+    return;
+  }
+  // nothing may be written back inside the code we're jumping over
+  FlushJitRegs(m);
+  if (!m->metal) {
+    need = PAGE_V | PAGE_HOST | PAGE_U;
+    if (writable) {
+      need |= PAGE_RW | PAGE_XD;
+#ifndef DISABLE_VFS
+      need |= PAGE_D;
+#endif
+    }
+    Jitter(A,
+           "a3i"    // arg3 = bytes to access
+           "a2i"    // arg2 = page table entry bits needed
+           "r0a1="  // arg1 = virtual address
+           "q"      // arg0 = machine
+           "m",     // call micro-op (res0 = host or 0, res1 = virtual)
+           n, need, ProbeTlb);
+  } else {
+    // supervisor pages and ones not marked non-executable take slow path
+    need = PAGE_V | PAGE_U;
+    if (writable) need |= PAGE_RW | PAGE_XD;
+    Jitter(A,
+           "a3i"    // arg3 = bytes to access
+           "a2i"    // arg2 = page table entry bits needed
+           "r0a1="  // arg1 = virtual address
+           "q"      // arg0 = machine
+           "m",     // call micro-op (res0 = host or 0, res1 = virtual)
+           n, need, ProbeMetalTlb);
+  }
+  if (m->path.colds < kPathColds) {
+    // the miss is handled out of line by AppendColdPaths(), which puts
+    // it after the end of the path, so it doesn't take up i-cache here
+#ifdef __x86_64__
+    u8 code[] = {
+        0x48, 0x85, 0300 | kJitRes0 << 3 | kJitRes0,  // test %rax,%rax
+        0x0f, 0x84, 0, 0, 0, 0,                       // jz   miss
+    };
+#else
+    u32 code[] = {
+        0xb4000000 | kJitRes0,  // cbz x0,miss
+    };
+#endif
+    AppendJit(m->path.jb, code, sizeof(code));
+    m->path.cold[m->path.colds].skip = m->path.jb->index;
+    m->path.cold[m->path.colds].size = n;
+    m->path.cold[m->path.colds].writable = writable;
+    ++m->path.colds;
+    STATISTIC(++tlb_probe_ops);
+    return;
+  }
+#ifdef __x86_64__
+  u8 code[] = {
+      0x48, 0x85, 0300 | kJitRes0 << 3 | kJitRes0,  // test %rax,%rax
+      0x0f, 0x85, 0, 0, 0, 0,                       // jnz  hit
+  };
+#else
+  u32 code[] = {
+      0xb5000000 | kJitRes0,  // cbnz x0,hit
+  };
+#endif
+  AppendJit(m->path.jb, code, sizeof(code));
+  skip = m->path.jb->index;
+  Jitter(A,
+         "r1a1="  // arg1 = virtual address
+         "a3i"    // arg3 = writable
+         "a2i"    // arg2 = bytes to access
+         "q"      // arg0 = machine
+         "c",     // call function (turn virtual into pointer)
+         (u64)writable, n, ReserveAddress);
+  EndJitSkip(A, skip);
+  STATISTIC(++tlb_probe_ops);
+}
+
+/**
+ * Generates the tlb misses ReserveJitAddress() deferred, after the path
+ * has ended, so the code which normally runs stays contiguous in memory.
+ * Each one calls ReserveAddress() and jumps back to where it was taken.
+ */
+void AppendColdPaths(struct Machine *m) {
+  int i;
+  struct JitCold *c;
+  if (m->path.colds) {
+    WriteCod("/\tcold paths\n");
+  }
+  for (i = 0; i < m->path.colds; ++i) {
+    c = m->path.cold + i;
+    EndJitSkip(DISPATCH_NOTHING, c->skip);
+    AppendJitMovReg(m->path.jb, kJitArg1, kJitRes1);
+    AppendJitSetReg(m->path.jb, kJitArg3, c->writable);
+    AppendJitSetReg(m->path.jb, kJitArg2, c->size);
+    AppendJitMovReg(m->path.jb, kJitArg0, kJitSav0);
+    AppendJitCall(m->path.jb, (void *)ReserveAddress);
+    ClobberEverythingExceptResult(m);
+    AppendJitJump(m->path.jb, m->path.jb->addr + c->skip);
+  }
+  m->path.colds = 0;
+}
+
+// turns the virtual address in res0 into a host pointer in linear mode,
+// which takes no code at all unless there's a skew or a shadow window
+static void ResolveJitHost(P) {
+  if (HasShadowMapping()) {
+    Jitter(A,
+           "a2i"  // arg2 = shadow window base
+           "a1i"  // arg1 = shadow window size
+           "t"    // arg0 = virtual address
+           "m",   // call micro-op (turn virtual into pointer)
+           FLAG_skew, FLAG_shadowsize, ResolveShadowHost);
+  } else if (kSkew) {
+    Jitter(A,
+           "t"   // arg0 = virtual address
+           "m",  // call micro-op (turn virtual into pointer)
+           ResolveHost);
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // PRINTF-STYLE X86 MICROCODING WITH POSTFIX NOTATION
 
@@ -1556,6 +2223,7 @@ static inline unsigned CheckBelow(unsigned x, unsigned n) {
 }
 
 static void CallFunction(struct Machine *m, void *fun) {
+  SyncJitRegs(m, fun);
   AppendJitCall(m->path.jb, fun);
   ClobberEverythingExceptResult(m);
 }
@@ -1563,6 +2231,7 @@ static void CallFunction(struct Machine *m, void *fun) {
 static void CallMicroOp(struct Machine *m, void *fun) {
 #ifdef TRIVIALLY_RELOCATABLE
   long len;
+  SyncJitRegs(m, fun);
   if ((len = GetMicroOpLength(fun)) > 0) {
     AppendJit(m->path.jb, fun, len);
   } else {
@@ -1576,9 +2245,108 @@ static void CallMicroOp(struct Machine *m, void *fun) {
 #endif
 }
 
-static void GetReg_32_64(struct Machine *m, void *fun) {
+static int LoadJitReg(struct Machine *m, unsigned reg) {
+  int k;
+  if ((k = AllocateJitReg(m, reg)) != -1) {
+    AppendJitLoad(m->path.jb, kJitSav[k], kJitSav0, GetWegOffset(reg));
+    STATISTIC(++path_reg_loads);
+  }
+  return k;
+}
+
+static void GetReg_32_64(P, unsigned log2sz, unsigned reg) {
+  int k;
   AppendJitMovReg(m->path.jb, kJitArg0, kJitSav0);
-  CallMicroOp(m, fun);
+  if (CanCacheJitRegs(m) &&
+      ((k = FindJitReg(m, reg)) != -1 || (k = LoadJitReg(m, reg)) != -1)) {
+    if (log2sz == 3) {
+      AppendJitMovReg(m->path.jb, kJitRes0, kJitSav[k]);
+    } else {
+      AppendJitMovReg32(m->path.jb, kJitRes0, kJitSav[k]);
+    }
+    STATISTIC(++path_reg_hits);
+  } else {
+    CallMicroOp(m, log2sz == 3 ? (void *)kGetReg64[reg]  //
+                               : (void *)kGetReg32[reg]);
+  }
+}
+
+// computes base + (index << scale) + disp with a single host instruction
+// or two, from guest registers that are held in host registers, and it
+// returns false if they couldn't be, so a micro-op must be used instead
+// adds base of segment to res0 with a load from the machine struct,
+// instead of calling the Seg micro-op, since tls code often uses %fs
+static void AddJitSegmentBase(struct Machine *m, int sreg) {
+  AppendJitMovReg(m->path.jb, kJitArg0, kJitSav0);
+  AppendJitLoad(m->path.jb, kJitArg1, kJitSav0,
+                offsetof(struct Machine, seg) +
+                    sreg * sizeof(struct DescriptorCache) +
+                    offsetof(struct DescriptorCache, base));
+  AppendJitAlu(m->path.jb, ALU_ADD, 3, kJitRes0, kJitArg1);
+}
+
+static bool LeaJitRegs(P, int base, int index, int scale) {
+  int kb = 0, ki = 0;
+  if (!CanCacheJitRegs(m)) return false;
+  if (disp != (i32)disp) return false;
+  if (base != -1 && (kb = FindJitReg(m, base)) == -1 &&
+      (kb = LoadJitReg(m, base)) == -1) {
+    return false;
+  }
+  if (index != -1 && (ki = FindJitReg(m, index)) == -1 &&
+      (ki = LoadJitReg(m, index)) == -1) {
+    return false;
+  }
+  if (base != -1 && FindJitReg(m, base) != kb) {
+    return false;  // loading the index evicted the base
+  }
+  AppendJitMovReg(m->path.jb, kJitArg0, kJitSav0);
+  AppendJitLea(m->path.jb, kJitRes0, base != -1 ? kJitSav[kb] : -1,
+               index != -1 ? kJitSav[ki] : -1, scale, disp);
+  STATISTIC(++path_reg_hits);
+  return true;
+}
+
+/**
+ * Generates host instruction for alu op on cached guest registers.
+ *
+ * This is for 32-bit and 64-bit add, or, and, sub, and xor ops whose
+ * flags are dead, which would otherwise have their operands shuffled
+ * through the micro-op argument registers and back.
+ *
+ * @param op is alu op number, e.g. `ALU_ADD`
+ * @param dst is index of guest register that's updated
+ * @param src is index of other guest register, or -1 to use `imm`
+ * @return false if a micro-op should be used instead
+ */
+bool JitAluRegs(P, int op, int dst, int src, i64 imm) {
+  int kd, ks = 0;
+  if (!CanCacheJitRegs(m)) return false;
+  if (RegLog2(rde) < 2) return false;
+  if (op != ALU_ADD && op != ALU_OR && op != ALU_AND &&  //
+      op != ALU_SUB && op != ALU_XOR) {
+    return false;
+  }
+  if (src == -1 && RegLog2(rde) == 3 && imm != (i32)imm) return false;
+  if ((kd = FindJitReg(m, dst)) == -1 && (kd = LoadJitReg(m, dst)) == -1) {
+    return false;
+  }
+  if (src != -1 && (ks = FindJitReg(m, src)) == -1 &&
+      (ks = LoadJitReg(m, src)) == -1) {
+    return false;
+  }
+  if (FindJitReg(m, dst) != kd) {
+    return false;  // loading the source evicted the destination
+  }
+  if (src != -1) {
+    AppendJitAlu(m->path.jb, op, RegLog2(rde), kJitSav[kd], kJitSav[ks]);
+  } else {
+    AppendJitAluImm(m->path.jb, op, RegLog2(rde), kJitSav[kd], (i32)imm);
+  }
+  m->path.dirty |= 1u << kd;
+  STATISTIC(++path_reg_hits);
+  STATISTIC(++alu_selected);
+  return true;
 }
 
 static void GetReg(P, unsigned log2sz, unsigned reg, unsigned breg) {
@@ -1591,10 +2359,8 @@ static void GetReg(P, unsigned log2sz, unsigned reg, unsigned breg) {
              (u64)kByteReg[breg], kGetReg[0]);
       break;
     case 2:
-      GetReg_32_64(m, kGetReg32[reg]);
-      break;
     case 3:
-      GetReg_32_64(m, kGetReg64[reg]);
+      GetReg_32_64(A, log2sz, reg);
       break;
     default:
       Jitter(A,
@@ -1606,11 +2372,24 @@ static void GetReg(P, unsigned log2sz, unsigned reg, unsigned breg) {
   }
 }
 
-static void PutReg_32_64(struct Machine *m, void *fun) {
+static void PutReg_32_64(P, unsigned log2sz, unsigned reg) {
+  int k;
   ItemsRequired(1);
-  AppendJitMovReg(m->path.jb, kJitArg1, kJitSav0);
-  AppendJitMovReg(m->path.jb, kJitArg0, stack[i - 1]);
-  CallMicroOp(m, fun);
+  if (CanCacheJitRegs(m) &&
+      ((k = FindJitReg(m, reg)) != -1 || (k = AllocateJitReg(m, reg)) != -1)) {
+    if (log2sz == 3) {
+      AppendJitMovReg(m->path.jb, kJitSav[k], stack[i - 1]);
+    } else {
+      AppendJitMovReg32(m->path.jb, kJitSav[k], stack[i - 1]);
+    }
+    m->path.dirty |= 1u << k;
+    STATISTIC(++path_reg_hits);
+  } else {
+    AppendJitMovReg(m->path.jb, kJitArg1, kJitSav0);
+    AppendJitMovReg(m->path.jb, kJitArg0, stack[i - 1]);
+    CallMicroOp(m, log2sz == 3 ? (void *)kPutReg64[reg]  //
+                               : (void *)kPutReg32[reg]);
+  }
   --i;
 }
 
@@ -1635,10 +2414,8 @@ static void PutReg(P, unsigned log2sz, unsigned reg, unsigned breg) {
              (u64)reg, kPutReg[1]);
       break;
     case 2:
-      PutReg_32_64(m, kPutReg32[reg]);
-      break;
     case 3:
-      PutReg_32_64(m, kPutReg64[reg]);
+      PutReg_32_64(A, log2sz, reg);
       break;
     case 4:
       // note: r0 == a0 on aarch64
@@ -1713,7 +2490,9 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
         break;
 
       case 's':  // push sav reg
-        stack[i++] = kJitSav[CheckBelow(fmt[k++] - '0', ARRAYLEN(kJitSav))];
+        c = CheckBelow(fmt[k++] - '0', ARRAYLEN(kJitSav));
+        BorrowJitReg(m, c);
+        stack[i++] = kJitSav[c];
         break;
 
       case 'i':  // set reg imm, e.g. ("a1i", 123) [mov $123,%rsi]
@@ -1747,32 +2526,19 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
         if (IsModrmRegister(rde)) {
           GetReg(A, log2sz, RexbRm(rde), RexRexb(rde));
         } else if (HasLinearMapping()) {
-          if (!kSkew) {
-            Jitter(A,
-                   "L"         // load effective address
-                   "t"         // arg0 = pointer
-                   LOADSTORE,  // call function (read word shared memory)
-                   kLoad[log2sz]);
-          } else {
-            Jitter(A,
-                   "L"         // load effective address
-                   "t"         // arg0 = virtual address
-                   "m"         // call micro-op (turn virtual into pointer)
-                   "t"         // arg0 = pointer
-                   LOADSTORE,  // call function (read word shared memory)
-                   ResolveHost, kLoad[log2sz]);
-          }
+          Jitter(A, "L");  // load effective address
+          ResolveJitHost(A);
+          Jitter(A,
+                 "t"         // arg0 = pointer
+                 LOADSTORE,  // call function (read word shared memory)
+                 kLoad[log2sz]);
         } else {
+          Jitter(A, "L");  // load effective address
+          ReserveJitAddress(A, 1 << log2sz, false);
           Jitter(A,
-                 "L"         // load effective address
-                 "a3i"       // arg3 = false
-                 "a2i"       // arg2 = bytes to read
-                 "r0a1="     // arg1 = virtual address
-                 "q"         // arg0 = machine
-                 "c"         // call function (turn virtual into pointer)
                  "t"         // arg0 = pointer
                  LOADSTORE,  // call micro-op (read vector shared memory)
-                 (u64)0, (u64)(1 << log2sz), ReserveAddress, kLoad[log2sz]);
+                 kLoad[log2sz]);
         }
         break;
 
@@ -1782,38 +2548,25 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
           if (IsModrmRegister(rde)) {
             PutReg(A, log2sz, RexbRm(rde), RexRexb(rde));
           } else if (HasLinearMapping()) {
-            if (!kSkew) {
-              Jitter(A,
-                     "s3="       // sav3 = <pop>
-                     "L"         // load effective address
-                     "s3a1="     // arg1 = sav3
-                     "t"         // arg0 = res0
-                     LOADSTORE,  // call micro-op (write word to shared memory)
-                     kStore[log2sz]);
-            } else {
-              Jitter(A,
-                     "s3="       // sav3 = <pop>
-                     "L"         // load effective address
-                     "t"         // arg0 = virtual address
-                     "m"         // call micro-op
-                     "s3a1="     // arg1 = sav3
-                     "t"         // arg0 = res0
-                     LOADSTORE,  // call micro-op (write word to shared memory)
-                     ResolveHost, kStore[log2sz]);
-            }
+            Jitter(A,
+                   "s3="  // sav3 = <pop>
+                   "L");  // load effective address
+            ResolveJitHost(A);
+            Jitter(A,
+                   "s3a1="     // arg1 = sav3
+                   "t"         // arg0 = res0
+                   LOADSTORE,  // call micro-op (write word to shared memory)
+                   kStore[log2sz]);
           } else {
             Jitter(A,
-                   "s3="       // sav3 = <pop>
-                   "L"         // load effective address
-                   "a3i"       // arg3 = true
-                   "a2i"       // arg2 = byte width of write operation
-                   "r0a1="     // arg1 = res0
-                   "q"         // arg0 = machine
-                   "c"         // call function (turn virtual into pointer)
+                   "s3="  // sav3 = <pop>
+                   "L");  // load effective address
+            ReserveJitAddress(A, 1 << log2sz, true);
+            Jitter(A,
                    "s3a1="     // arg1 = sav3
                    "t"         // arg0 = res0
                    LOADSTORE,  // call function (write word to shared memory)
-                   (u64)1, (u64)(1 << log2sz), ReserveAddress, kStore[log2sz]);
+                   kStore[log2sz]);
           }
         } else {
           if (IsModrmRegister(rde)) {
@@ -1829,46 +2582,29 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
                    "m",     // call micro-op (xmm put register)
                    RexbRm(rde), kPutReg[log2sz]);
           } else if (HasLinearMapping()) {
-            if (!kSkew) {
-              Jitter(
-                  A,
-                  "r1s4="     // sav4 = res1
-                  "r0s3="     // sav3 = res0
-                  "L"         // load effective address
-                  "s4a2="     // arg2 = sav4
-                  "s3a1="     // arg1 = sav3
-                  "t"         // arg0 = res0
-                  LOADSTORE,  // call micro-op (store vector to shared memory)
-                  kStore[log2sz]);
-            } else {
-              Jitter(
-                  A,
-                  "r1s4="     // sav4 = res1
-                  "r0s3="     // sav3 = res0
-                  "L"         // load effective address
-                  "t"         // arg0 = virtual address
-                  "m"         // call micro-op
-                  "s4a2="     // arg2 = sav4
-                  "s3a1="     // arg1 = sav3
-                  "t"         // arg0 = res0
-                  LOADSTORE,  // call micro-op (store vector to shared memory)
-                  ResolveHost, kStore[log2sz]);
-            }
+            Jitter(A,
+                   "r1s4="  // sav4 = res1
+                   "r0s3="  // sav3 = res0
+                   "L");    // load effective address
+            ResolveJitHost(A);
+            Jitter(A,
+                   "s4a2="     // arg2 = sav4
+                   "s3a1="     // arg1 = sav3
+                   "t"         // arg0 = res0
+                   LOADSTORE,  // call micro-op (store vector to shared memory)
+                   kStore[log2sz]);
           } else {
             Jitter(A,
-                   "r1s4="     // sav4 = res1
-                   "r0s3="     // sav3 = res0
-                   "L"         // load effective address
-                   "a3i"       // arg3 = true
-                   "a2i"       // arg2 = bytes to write
-                   "r0a1="     // arg1 = res0
-                   "q"         // arg0 = machine
-                   "c"         // call function (turn virtual into pointer)
+                   "r1s4="  // sav4 = res1
+                   "r0s3="  // sav3 = res0
+                   "L");    // load effective address
+            ReserveJitAddress(A, 1 << log2sz, true);
+            Jitter(A,
                    "s4a2="     // arg2 = sav4
                    "s3a1="     // arg1 = sav3
                    "t"         // arg0 = res0
                    LOADSTORE,  // call micro-op (store vector to shared memory)
-                   (u64)1, (u64)(1 << log2sz), ReserveAddress, kStore[log2sz]);
+                   kStore[log2sz]);
           }
         }
         break;
@@ -1877,42 +2613,41 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
         if (!SibExists(rde) && IsRipRelative(rde)) {
           AppendJitSetReg(m->path.jb, kJitRes0, disp + m->ip);
         } else if (!SibExists(rde)) {
-          if (disp) {
+          if (disp && !LeaJitRegs(A, RexbRm(rde), -1, 0)) {
             Jitter(A,
                    "a2i"  // arg2 = address base register index
                    "a1i"  // arg1 = displacement
                    "q"    // arg0 = machine
                    "m",   // call micro-op
                    RexbRm(rde), disp, Base);
-          } else {
-            Jitter(A,
-                   "q"   // arg0 = machine
-                   "m",  // call micro-op
-                   kGetReg64[RexbRm(rde)]);
+          } else if (!disp) {
+            GetReg(A, 3, RexbRm(rde), 0);  // res0 = base
           }
         } else if (!SibHasBase(rde) && !SibHasIndex(rde)) {
           Jitter(A, "r0i", disp);  // res0 = absolute
         } else if (SibHasBase(rde) && !SibHasIndex(rde)) {
-          if (disp) {
+          if (disp && !LeaJitRegs(A, RexbBase(rde), -1, 0)) {
             AppendJitSetReg(m->path.jb, kJitArg2, RexbBase(rde));
             AppendJitSetReg(m->path.jb, kJitArg1, disp);
             AppendJitMovReg(m->path.jb, kJitArg0, kJitSav0);
             CallMicroOp(m, Base);
-          } else {
-            Jitter(A,
-                   "q"   // arg0 = machine
-                   "m",  // call micro-op
-                   kGetReg64[RexbBase(rde)]);
+          } else if (!disp) {
+            GetReg(A, 3, RexbBase(rde), 0);  // res0 = base
           }
         } else if (!SibHasBase(rde) && SibHasIndex(rde)) {
-          Jitter(A,
-                 "a3i"  // arg3 = log2(address index scale)
-                 "a2i"  // arg2 = address index register index
-                 "a1i"  // arg1 = displacement
-                 "q"    // arg0 = machine
-                 "m",   // call micro-op
-                 SibScale(rde), Rexx(rde) << 3 | SibIndex(rde), disp, Index);
-        } else {
+          if (!LeaJitRegs(A, -1, Rexx(rde) << 3 | SibIndex(rde),
+                          SibScale(rde))) {
+            Jitter(A,
+                   "a3i"  // arg3 = log2(address index scale)
+                   "a2i"  // arg2 = address index register index
+                   "a1i"  // arg1 = displacement
+                   "q"    // arg0 = machine
+                   "m",   // call micro-op
+                   SibScale(rde), Rexx(rde) << 3 | SibIndex(rde), disp,
+                   Index);
+          }
+        } else if (!LeaJitRegs(A, RexbBase(rde), Rexx(rde) << 3 | SibIndex(rde),
+                               SibScale(rde))) {
           Jitter(A,
                  "a3i"  // arg4 = address index register index
                  "a2i"  // arg2 = address base register index
@@ -1923,18 +2658,11 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
                  kBaseIndex[SibScale(rde)]);
         }
         if (Eamode(rde) == XED_MODE_LEGACY) {
-          Jitter(A,
-                 "t"   // arg0 = res0
-                 "m",  // call micro-op
-                 Truncate32);
+          // 32-bit addresses wrap, which one mov does without a call
+          AppendJitMovReg32(m->path.jb, kJitRes0, kJitRes0);
         }
         if (Sego(rde)) {
-          Jitter(A,
-                 "a2i"    // arg2 = segment register index
-                 "r0a1="  // arg1 = res0
-                 "q"      // arg0 = machine
-                 "m",     // call micro-op
-                 Sego(rde) - 1, Seg);
+          AddJitSegmentBase(m, Sego(rde) - 1);
         }
         break;
 
@@ -1960,24 +2688,11 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
                  : log2sz < 4 ? GetWegPtr
                               : GetXmmPtr);
         } else if (HasLinearMapping()) {
-          if (!kSkew) {
-            Jitter(A, "L");  // load effective address
-          } else {
-            Jitter(A,
-                   "L"   // load effective address
-                   "t"   // arg0 = virtual address
-                   "m",  // res0 = call micro-op (turn virtual into pointer)
-                   ResolveHost);
-          }
+          Jitter(A, "L");  // load effective address
+          ResolveJitHost(A);
         } else {
-          Jitter(A,
-                 "L"      // load effective address
-                 "a3i"    // arg3 = false
-                 "a2i"    // arg2 = bytes to read
-                 "r0a1="  // arg1 = virtual address
-                 "q"      // arg0 = machine
-                 "c",     // res0 = call function (turn virtual into pointer)
-                 (u64)0, (u64)(1 << log2sz), ReserveAddress);
+          Jitter(A, "L");  // load effective address
+          ReserveJitAddress(A, 1 << log2sz, false);
         }
         break;
 
@@ -1997,6 +2712,11 @@ static unsigned JitterImpl(P, const char *fmt, va_list va, unsigned k,
         PutReg(A, log2sz, 0, 0);
         break;
 
+      case 'V':  // r0 = GetReg(Vreg)
+        unassert(log2sz >= 2);
+        GetReg(A, log2sz, Vreg(rde), 0);
+        break;
+
       case 'w':  // prevents byte operation
         log2sz = WordLog2(rde);
         continue;
@@ -44,6 +44,7 @@ char *realpath_(const char *, char *);
 void *memccpy_(void *, const void *, int, size_t);
 int wcwidth_(wchar_t);
 u64 Vigna(u64[1]);
+u64 Fnv64(u64, const void *, size_t);
 
 #ifndef HAVE_STRCHRNUL
 #ifdef strchrnul
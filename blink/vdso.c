@@ -0,0 +1,205 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <string.h>
+#include <sys/mman.h>
+
+#include "blink/assert.h"
+#include "blink/elf.h"
+#include "blink/endian.h"
+#include "blink/loader.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/macros.h"
+#include "blink/map.h"
+#include "blink/rde.h"
+#include "blink/syscall.h"
+#include "blink/tunables.h"
+
+// the vdso is a tiny shared object that linux maps into every process,
+// to let libc ask for the time without entering the kernel. since every
+// system call ends a jit path in blink, we synthesize our own vdso whose
+// functions are each a single instruction that traps into blink without
+// leaving the path. it's encoded as an instruction that's invalid under
+// normal circumstances, which is only special when executed in the vdso
+//
+//     0f ff bf nr32   ud0 nr(%rdi),%edi
+//     c3              ret
+//
+// the image is laid out much like the one linux links at address zero,
+// except it only has a sysv hash table and its symbols aren't versioned
+// which is permitted by the glibc, musl, and golang runtimes.
+
+#define kVdsoSize 4096
+
+static const struct VdsoFunc {
+  const char *name;
+  int nr;
+} kVdsoFuncs[] = {
+    {"__vdso_clock_gettime", 0x0E4},  //
+    {"__vdso_gettimeofday", 0x060},   //
+    {"__vdso_time", 0x0C9},           //
+    {"__vdso_getcpu", 0x135},         //
+    {"__vdso_clock_getres", 0x0E5},   //
+};
+
+static const char kVdsoSoname[] = "linux-vdso.so.1";
+
+static void PutDyn(u8 *p, i64 tag, u64 val) {
+  Write64(((Elf64_Dyn_ *)p)->tag, tag);
+  Write64(((Elf64_Dyn_ *)p)->val, val);
+}
+
+static void BuildVdso(u8 image[kVdsoSize]) {
+  u8 *p;
+  char *str;
+  Elf64_Sym_ *sym;
+  Elf64_Ehdr_ *ehdr;
+  Elf64_Phdr_ *phdr;
+  size_t i, n, nsyms, off, hash, syms, strs, strsz, dyn, text;
+  n = ARRAYLEN(kVdsoFuncs);
+  nsyms = 1 + n;
+  off = sizeof(Elf64_Ehdr_) + 2 * sizeof(Elf64_Phdr_);
+  hash = off, off += (2 + 1 + nsyms) * 4;
+  syms = off = ROUNDUP(off, 8), off += nsyms * sizeof(Elf64_Sym_);
+  strs = off, off += 1 + sizeof(kVdsoSoname);
+  for (i = 0; i < n; ++i) off += strlen(kVdsoFuncs[i].name) + 1;
+  strsz = off - strs;
+  dyn = off = ROUNDUP(off, 8), off += 7 * sizeof(Elf64_Dyn_);
+  text = off = ROUNDUP(off, 16), off += n * 16;
+  unassert(off <= kVdsoSize);
+  memset(image, 0, kVdsoSize);
+  // elf header
+  ehdr = (Elf64_Ehdr_ *)image;
+  memcpy(ehdr->ident, "\177ELF", 4);
+  ehdr->ident[EI_CLASS_] = ELFCLASS64_;
+  ehdr->ident[EI_DATA_] = ELFDATA2LSB_;
+  ehdr->ident[EI_VERSION_] = EV_CURRENT_;
+  ehdr->ident[EI_OSABI_] = ELFOSABI_SYSV_;
+  Write16(ehdr->type, ET_DYN_);
+  Write16(ehdr->machine, EM_NEXGEN32E_);
+  Write32(ehdr->version, EV_CURRENT_);
+  Write64(ehdr->phoff, sizeof(Elf64_Ehdr_));
+  Write16(ehdr->ehsize, sizeof(Elf64_Ehdr_));
+  Write16(ehdr->phentsize, sizeof(Elf64_Phdr_));
+  Write16(ehdr->phnum, 2);
+  Write16(ehdr->shentsize, sizeof(Elf64_Shdr_));
+  // program headers
+  phdr = (Elf64_Phdr_ *)(image + sizeof(Elf64_Ehdr_));
+  Write32(phdr[0].type, PT_LOAD_);
+  Write32(phdr[0].flags, PF_R_ | PF_X_);
+  Write64(phdr[0].filesz, kVdsoSize);
+  Write64(phdr[0].memsz, kVdsoSize);
+  Write64(phdr[0].align, 4096);
+  Write32(phdr[1].type, PT_DYNAMIC_);
+  Write32(phdr[1].flags, PF_R_);
+  Write64(phdr[1].offset, dyn);
+  Write64(phdr[1].vaddr, dyn);
+  Write64(phdr[1].paddr, dyn);
+  Write64(phdr[1].filesz, 7 * sizeof(Elf64_Dyn_));
+  Write64(phdr[1].memsz, 7 * sizeof(Elf64_Dyn_));
+  Write64(phdr[1].align, 8);
+  // hash table with a single bucket chaining every symbol
+  p = image + hash;
+  Write32(p + 0, 1);
+  Write32(p + 4, nsyms);
+  Write32(p + 8, 1);
+  for (i = 1; i < n; ++i) {
+    Write32(p + 12 + i * 4, i + 1);
+  }
+  // symbols, strings, and code
+  str = (char *)image + strs + 1;
+  str = stpcpy(str, kVdsoSoname) + 1;
+  for (i = 0; i < n; ++i) {
+    sym = (Elf64_Sym_ *)(image + syms) + 1 + i;
+    Write32(sym->name, str - ((char *)image + strs));
+    sym->info = ELF64_ST_INFO_(STB_GLOBAL_, STT_FUNC_);
+    Write16(sym->shndx, 1);  // anything except SHN_UNDEF or SHN_ABS
+    Write64(sym->value, text + i * 16);
+    Write64(sym->size, 8);
+    str = stpcpy(str, kVdsoFuncs[i].name) + 1;
+    p = image + text + i * 16;
+    p[0] = 0x0f;
+    p[1] = 0xff;
+    p[2] = 0277;
+    Write32(p + 3, kVdsoFuncs[i].nr);
+    p[7] = 0xc3;
+  }
+  // dynamic section
+  p = image + dyn;
+  PutDyn(p + 0 * sizeof(Elf64_Dyn_), DT_HASH_, hash);
+  PutDyn(p + 1 * sizeof(Elf64_Dyn_), DT_STRTAB_, strs);
+  PutDyn(p + 2 * sizeof(Elf64_Dyn_), DT_SYMTAB_, syms);
+  PutDyn(p + 3 * sizeof(Elf64_Dyn_), DT_STRSZ_, strsz);
+  PutDyn(p + 4 * sizeof(Elf64_Dyn_), DT_SYMENT_, sizeof(Elf64_Sym_));
+  PutDyn(p + 5 * sizeof(Elf64_Dyn_), DT_SONAME_, 1);
+  PutDyn(p + 6 * sizeof(Elf64_Dyn_), DT_NULL_, 0);
+}
+
+/**
+ * Maps synthetic vdso into the address space of a new program.
+ *
+ * On success, `m->system->vdso` is set to its address, which should be
+ * passed to the program as `AT_SYSINFO_EHDR`. Otherwise it's zero.
+ */
+void LoadVdso(struct Machine *m) {
+  i64 virt;
+  long pagesize;
+  u8 image[kVdsoSize];
+  struct System *s = m->system;
+  s->vdso = 0;
+  pagesize = HasLinearMapping() ? MAX(kVdsoSize, FLAG_pagesize) : kVdsoSize;
+  virt = HasLinearMapping() && FLAG_vabits <= 47 && !kSkew &&
+                 !HasShadowMapping()
+             ? 0
+             : FLAG_stacktop;
+  // the page mustn't be executable while we fill it, since the jit's
+  // self-modifying code protection would write-protect it on the host
+  // and execve() runs this with signals blocked
+  if ((virt = ReserveVirtual(s, virt, pagesize, PAGE_U | PAGE_RW | PAGE_XD, -1,
+                             0, 0, 0)) == -1) {
+    LOGF("failed to reserve vdso memory");
+    return;
+  }
+  BuildVdso(image);
+  unassert(!CopyToUser(m, virt, image, sizeof(image)));
+  unassert(!ProtectVirtual(s, virt, pagesize, PROT_READ | PROT_EXEC, false));
+  unassert(AddFileMap(s, virt, pagesize, "[vdso]", -1));
+  s->vdso = virt;
+}
+
+/**
+ * Handles `ud0` instruction in user mode.
+ *
+ * This is how the functions in our vdso ask blink to perform a system
+ * call on their behalf. Anywhere else it raises an illegal instruction
+ * as usual.
+ */
+void OpVdsoCall(P) {
+  i64 pc = m->ip - Oplength(rde);
+  if (m->system->vdso &&                   //
+      pc >= m->system->vdso &&             //
+      pc < m->system->vdso + kVdsoSize &&  //
+      ModrmMod(rde) == 2 &&                //
+      ModrmReg(rde) == 7 &&                //
+      ModrmRm(rde) == 7) {
+    VdsoSyscall(m, disp);
+  } else {
+    OpUd(A);
+  }
+}
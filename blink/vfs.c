@@ -28,6 +28,7 @@
 
 #include "blink/assert.h"
 #include "blink/atomic.h"
+#include "blink/bitscan.h"
 #include "blink/devfs.h"
 #include "blink/errno.h"
 #include "blink/hostfs.h"
@@ -36,6 +37,7 @@
 #include "blink/macros.h"
 #include "blink/procfs.h"
 #include "blink/thread.h"
+#include "blink/tmpfs.h"
 #include "blink/tunables.h"
 
 #ifndef DISABLE_VFS
@@ -87,9 +89,11 @@ struct VfsInfo *g_actualrootinfo;
 struct Vfs g_vfs = {
     .devices = NULL,
     .systems = NULL,
-    .fds = NULL,
     .maps = NULL,
+    .fdbits = NULL,
+    .fdwords = 0,
     .lock = PTHREAD_MUTEX_INITIALIZER_,
+    .fdslock = PTHREAD_MUTEX_INITIALIZER_,
     .mapslock = PTHREAD_MUTEX_INITIALIZER_,
 };
 
@@ -100,10 +104,15 @@ int VfsInit(const char *prefix) {
   size_t hostcwdlen, prefixlen;
   int fd;
 
+  for (fd = 0; fd < VFS_FD_BUCKETS; ++fd) {
+    unassert(!pthread_mutex_init(&g_vfs.fds[fd].lock, NULL));
+  }
+
   // Register built-in filesystems
   unassert(!VfsRegister(&g_hostfs));
   unassert(!VfsRegister(&g_devfs));
   unassert(!VfsRegister(&g_procfs));
+  unassert(!VfsRegister(&g_tmpfs));
 
   dll_init(&g_rootdevice.elem);
   dll_make_first(&g_vfs.devices, &g_rootdevice.elem);
@@ -314,7 +323,9 @@ int VfsMount(const char *source, const char *target, const char *fstype,
   newmount->root->namelen = targetinfo->namelen;
   unassert(!VfsAcquireInfo(targetinfo->parent, &newmount->root->parent));
   dll_init(&newmount->elem);
+  LOCK(&targetdevice->lock);
   dll_make_last(&targetdevice->mounts, &newmount->elem);
+  UNLOCK(&targetdevice->lock);
   UNLOCK(&g_vfs.lock);
   unassert(!VfsFreeInfo(targetinfo));
   VFS_LOGF("Mounted a new device at %s, dev=%ld", target, nextdev);
@@ -465,6 +476,8 @@ int VfsFreeInfo(struct VfsInfo *info) {
 static int VfsTraverseMount(struct VfsInfo **info,
                             char childname[VFS_NAME_MAX]) {
   struct VfsMount *mount;
+  struct VfsDevice *device;
+  struct VfsInfo *next;
   struct Dll *e;
   if (info == NULL) {
     return efault();
@@ -472,17 +485,17 @@ static int VfsTraverseMount(struct VfsInfo **info,
   if (!S_ISDIR((*info)->mode)) {
     return 0;
   }
-  LOCK(&g_vfs.lock);
-  for (e = dll_first((*info)->device->mounts); e;
-       e = dll_next((*info)->device->mounts, e)) {
+  next = NULL;
+  device = (*info)->device;
+  LOCK(&device->lock);
+  for (e = dll_first(device->mounts); e; e = dll_next(device->mounts, e)) {
     mount = VFS_MOUNT_CONTAINER(e);
     if (!childname) {
       // Checking info itself.
       if (mount->baseino == (*info)->ino) {
         VFS_LOGF("VfsTraverseMount: switching from dev=%d to dev=%d",
                  (*info)->dev, mount->root->dev);
-        unassert(!VfsFreeInfo(*info));
-        unassert(!VfsAcquireInfo(mount->root, info));
+        unassert(!VfsAcquireInfo(mount->root, &next));
         break;
       }
     } else {
@@ -494,13 +507,17 @@ static int VfsTraverseMount(struct VfsInfo **info,
         VFS_LOGF("VfsTraverseMount: switching from dev=%d to dev=%d",
                  (*info)->dev, mount->root->dev);
         strcpy(childname, ".");
-        unassert(!VfsFreeInfo(*info));
-        unassert(!VfsAcquireInfo(mount->root, info));
+        unassert(!VfsAcquireInfo(mount->root, &next));
         break;
       }
     }
   }
-  UNLOCK(&g_vfs.lock);
+  UNLOCK(&device->lock);
+  // freeing may drop the last reference to device, so do it unlocked
+  if (next) {
+    unassert(!VfsFreeInfo(*info));
+    *info = next;
+  }
   return 0;
 }
 
@@ -717,37 +734,87 @@ ssize_t VfsPathBuild(struct VfsInfo *info, struct VfsInfo *root, bool absolute,
 
 ////////////////////////////////////////////////////////////////////////////////
 
+static struct VfsFdBucket *VfsGetFdBucket(int fd) {
+  return g_vfs.fds + (unsigned)fd % VFS_FD_BUCKETS;
+}
+
+// @assume bucket->lock
+static struct VfsFd *VfsFindFd(struct VfsFdBucket *bucket, int fd) {
+  struct Dll *e;
+  for (e = dll_first(bucket->fds); e; e = dll_next(bucket->fds, e)) {
+    if (VFS_FD_CONTAINER(e)->fd == fd) {
+      return VFS_FD_CONTAINER(e);
+    }
+  }
+  return NULL;
+}
+
+// @assume g_vfs.fdslock
+static bool VfsIsFdTaken(int fd) {
+  return (size_t)fd / 64 < g_vfs.fdwords &&
+         ((g_vfs.fdbits[fd / 64] >> (fd % 64)) & 1);
+}
+
+// @assume g_vfs.fdslock
+static bool VfsTakeFd(int fd) {
+  u64 *p;
+  size_t n;
+  if ((size_t)fd / 64 >= g_vfs.fdwords) {
+    n = MAX(g_vfs.fdwords * 2, (size_t)fd / 64 + 1);
+    if (!(p = (u64 *)realloc(g_vfs.fdbits, n * sizeof(*p)))) {
+      return false;
+    }
+    memset(p + g_vfs.fdwords, 0, (n - g_vfs.fdwords) * sizeof(*p));
+    g_vfs.fdbits = p;
+    g_vfs.fdwords = n;
+  }
+  g_vfs.fdbits[fd / 64] |= (u64)1 << (fd % 64);
+  return true;
+}
+
+// @assume g_vfs.fdslock
+static void VfsReleaseFd(int fd) {
+  unassert(VfsIsFdTaken(fd));
+  g_vfs.fdbits[fd / 64] &= ~((u64)1 << (fd % 64));
+}
+
+// @assume g_vfs.fdslock
+static int VfsFindFreeFd(int minfd) {
+  u64 w;
+  size_t i;
+  for (i = minfd / 64; i < g_vfs.fdwords; ++i) {
+    w = ~g_vfs.fdbits[i];
+    if (i == minfd / 64) {
+      w &= -((u64)1 << (minfd % 64));
+    }
+    if (w) {
+      return i * 64 + bsf(w);
+    }
+  }
+  return MAX(minfd, g_vfs.fdwords * 64);
+}
+
 int VfsAddFdAtOrAfter(struct VfsInfo *data, int minfd) {
+  struct VfsFdBucket *bucket;
   struct VfsFd *vfsfd;
-  struct Dll *e;
   vfsfd = (struct VfsFd *)malloc(sizeof(*vfsfd));
   if (vfsfd == NULL) {
     return -1;
   }
   vfsfd->data = data;
-  LOCK(&g_vfs.lock);
-  for (e = dll_first(g_vfs.fds); e; e = dll_next(g_vfs.fds, e)) {
-    if (VFS_FD_CONTAINER(e)->fd < minfd) {
-      continue;
-    } else if (VFS_FD_CONTAINER(e)->fd == minfd) {
-      ++minfd;
-    } else {
-      break;
-    }
-  }
-  vfsfd->fd = minfd;
   dll_init(&vfsfd->elem);
-  if (e == NULL) {
-    dll_make_last(&g_vfs.fds, &vfsfd->elem);
-  } else {
-    e = dll_prev(g_vfs.fds, e);
-    if (e == NULL) {
-      dll_make_first(&g_vfs.fds, &vfsfd->elem);
-    } else {
-      dll_splice_after(e, &vfsfd->elem);
-    }
+  LOCK(&g_vfs.fdslock);
+  vfsfd->fd = VfsFindFreeFd(minfd);
+  if (!VfsTakeFd(vfsfd->fd)) {
+    UNLOCK(&g_vfs.fdslock);
+    free(vfsfd);
+    return enomem();
   }
-  UNLOCK(&g_vfs.lock);
+  bucket = VfsGetFdBucket(vfsfd->fd);
+  LOCK(&bucket->lock);
+  dll_make_first(&bucket->fds, &vfsfd->elem);
+  UNLOCK(&bucket->lock);
+  UNLOCK(&g_vfs.fdslock);
   return vfsfd->fd;
 }
 
@@ -760,69 +827,78 @@ int VfsAddFd(struct VfsInfo *data) {
  * it.
  */
 int VfsFreeFd(int fd, struct VfsInfo **data) {
-  struct Dll *e;
+  struct VfsFdBucket *bucket;
   struct VfsFd *vfsfd;
-  LOCK(&g_vfs.lock);
-  for (e = dll_first(g_vfs.fds); e;) {
-    vfsfd = VFS_FD_CONTAINER(e);
-    if (VFS_FD_CONTAINER(e)->fd == fd) {
-      *data = vfsfd->data;
-      dll_remove(&g_vfs.fds, &vfsfd->elem);
-      free(vfsfd);
-      VFS_LOGF("VfsFreeFd(%d)", fd);
-      UNLOCK(&g_vfs.lock);
-      return 0;
-    }
-    e = dll_next(g_vfs.fds, e);
+  if (fd < 0) {
+    return ebadf();
+  }
+  bucket = VfsGetFdBucket(fd);
+  LOCK(&g_vfs.fdslock);
+  LOCK(&bucket->lock);
+  if ((vfsfd = VfsFindFd(bucket, fd))) {
+    dll_remove(&bucket->fds, &vfsfd->elem);
+    VfsReleaseFd(fd);
+  }
+  UNLOCK(&bucket->lock);
+  UNLOCK(&g_vfs.fdslock);
+  if (vfsfd == NULL) {
+    return ebadf();
   }
-  UNLOCK(&g_vfs.lock);
-  return ebadf();
+  *data = vfsfd->data;
+  free(vfsfd);
+  VFS_LOGF("VfsFreeFd(%d)", fd);
+  return 0;
 }
 
 int VfsGetFd(int fd, struct VfsInfo **output) {
-  struct Dll *e;
-  LOCK(&g_vfs.lock);
-  for (e = dll_first(g_vfs.fds); e; e = dll_next(g_vfs.fds, e)) {
-    if (VFS_FD_CONTAINER(e)->fd == fd) {
-      UNLOCK(&g_vfs.lock);
-      unassert(!VfsAcquireInfo(VFS_FD_CONTAINER(e)->data, output));
-      return 0;
-    }
+  struct VfsFdBucket *bucket;
+  struct VfsFd *vfsfd;
+  if (fd < 0) {
+    return ebadf();
   }
-  UNLOCK(&g_vfs.lock);
-  return ebadf();
+  bucket = VfsGetFdBucket(fd);
+  LOCK(&bucket->lock);
+  if ((vfsfd = VfsFindFd(bucket, fd))) {
+    unassert(!VfsAcquireInfo(vfsfd->data, output));
+  }
+  UNLOCK(&bucket->lock);
+  if (vfsfd == NULL) {
+    return ebadf();
+  }
+  return 0;
 }
 
 int VfsSetFd(int fd, struct VfsInfo *data) {
-  struct Dll *e;
+  struct VfsFdBucket *bucket;
+  struct VfsInfo *old;
   struct VfsFd *vfsfd;
-  LOCK(&g_vfs.lock);
-  for (e = dll_first(g_vfs.fds); e; e = dll_next(g_vfs.fds, e)) {
-    if (VFS_FD_CONTAINER(e)->fd == fd) {
-      unassert(!VfsFreeInfo(VFS_FD_CONTAINER(e)->data));
-      VFS_FD_CONTAINER(e)->data = data;
-      UNLOCK(&g_vfs.lock);
-      return 0;
-    } else if (VFS_FD_CONTAINER(e)->fd > fd) {
-      break;
-    }
+  if (fd < 0) {
+    return ebadf();
+  }
+  bucket = VfsGetFdBucket(fd);
+  LOCK(&g_vfs.fdslock);
+  LOCK(&bucket->lock);
+  if ((vfsfd = VfsFindFd(bucket, fd))) {
+    old = vfsfd->data;
+    vfsfd->data = data;
+    UNLOCK(&bucket->lock);
+    UNLOCK(&g_vfs.fdslock);
+    unassert(!VfsFreeInfo(old));
+    return 0;
   }
-  vfsfd = (struct VfsFd *)malloc(sizeof(*vfsfd));
-  if (vfsfd == NULL) {
-    UNLOCK(&g_vfs.lock);
+  if ((vfsfd = (struct VfsFd *)malloc(sizeof(*vfsfd))) == NULL ||
+      !VfsTakeFd(fd)) {
+    UNLOCK(&bucket->lock);
+    UNLOCK(&g_vfs.fdslock);
+    free(vfsfd);
     return enomem();
   }
   vfsfd->data = data;
   vfsfd->fd = fd;
   dll_init(&vfsfd->elem);
-  if (e == NULL) {
-    dll_make_last(&g_vfs.fds, &vfsfd->elem);
-  } else if ((e = dll_prev(g_vfs.fds, e))) {
-    dll_splice_after(e, &vfsfd->elem);
-  } else {
-    dll_make_first(&g_vfs.fds, &vfsfd->elem);
-  }
-  UNLOCK(&g_vfs.lock);
+  dll_make_first(&bucket->fds, &vfsfd->elem);
+  UNLOCK(&bucket->lock);
+  UNLOCK(&g_vfs.fdslock);
   return 0;
 }
 
@@ -1951,27 +2027,36 @@ void VfsRewinddir(DIR *dir) {
 }
 
 int VfsClosedir(DIR *dir) {
+  struct VfsFdBucket *bucket;
   struct VfsInfo *info;
   struct Dll *e;
   struct VfsFd *vfsfd;
-  int ret;
+  int i, ret;
   VFS_LOGF("VfsClosedir(%p)", dir);
   info = (struct VfsInfo *)dir;
   if (info->device->ops->Closedir) {
     ret = info->device->ops->Closedir(info);
     if (ret != -1) {
-      LOCK(&g_vfs.lock);
-      for (e = dll_first(g_vfs.fds); e;) {
-        vfsfd = VFS_FD_CONTAINER(e);
-        e = dll_next(g_vfs.fds, e);
-        if (vfsfd->data == info) {
-          unassert(!VfsFreeInfo(vfsfd->data));
-          dll_remove(&g_vfs.fds, &vfsfd->elem);
-          free(vfsfd);
-          break;
+      vfsfd = NULL;
+      LOCK(&g_vfs.fdslock);
+      for (i = 0; !vfsfd && i < VFS_FD_BUCKETS; ++i) {
+        bucket = g_vfs.fds + i;
+        LOCK(&bucket->lock);
+        for (e = dll_first(bucket->fds); e; e = dll_next(bucket->fds, e)) {
+          if (VFS_FD_CONTAINER(e)->data == info) {
+            vfsfd = VFS_FD_CONTAINER(e);
+            dll_remove(&bucket->fds, &vfsfd->elem);
+            VfsReleaseFd(vfsfd->fd);
+            break;
+          }
         }
+        UNLOCK(&bucket->lock);
+      }
+      UNLOCK(&g_vfs.fdslock);
+      if (vfsfd) {
+        unassert(!VfsFreeInfo(vfsfd->data));
+        free(vfsfd);
       }
-      UNLOCK(&g_vfs.lock);
     }
   } else {
     ret = eperm();
@@ -2403,6 +2488,20 @@ static void VfsMapListFree(struct Dll **tofree) {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+// notifies filesystems of maps inside [addr,addr+len) going away. this
+// happens while the memory is still there, so they can write it back.
+static void VfsMapListUnmapOps(struct Dll *list, void *addr, size_t len) {
+  struct Dll *e;
+  struct VfsMap *map;
+  for (e = dll_first(list); e; e = dll_next(list, e)) {
+    map = VFS_MAP_CONTAINER(e);
+    if (VfsMemoryRangeContains(addr, len, map->addr, map->len) &&
+        map->data->device->ops->Munmap) {
+      unassert(!map->data->device->ops->Munmap(map->data, map->addr, map->len));
+    }
+  }
+}
+
 void *VfsMmap(void *addr, size_t len, int prot, int flags, int fd,
               off_t offset) {
   struct VfsInfo *info;
@@ -2419,6 +2518,9 @@ void *VfsMmap(void *addr, size_t len, int prot, int flags, int fd,
                                      &modified, &before) == -1) {
     goto cleananddie;
   }
+  if (flags & MAP_FIXED) {
+    VfsMapListUnmapOps(modified, addr, len);
+  }
 #ifdef MAP_ANONYMOUS
   if (flags & MAP_ANONYMOUS) {
     if ((ret = mmap(addr, len, prot, flags, -1, 0)) == MAP_FAILED) {
@@ -2461,10 +2563,6 @@ void *VfsMmap(void *addr, size_t len, int prot, int flags, int fd,
         e = dll_next(modified, e);
         continue;
       }
-      if (map->data->device->ops->Munmap) {
-        unassert(
-            !map->data->device->ops->Munmap(map->data, map->addr, map->len));
-      }
       e = dll_next(modified, e);
       dll_remove(&modified, &map->elem);
       unassert(!VfsMapFree(map));
@@ -2509,6 +2607,7 @@ int VfsMunmap(void *addr, size_t len) {
                                      &modified, &before) == -1) {
     goto cleananddie;
   }
+  VfsMapListUnmapOps(modified, addr, len);
   if (munmap(addr, len) == -1) {
     goto cleananddie;
   }
@@ -2519,9 +2618,6 @@ int VfsMunmap(void *addr, size_t len) {
       e = dll_next(modified, e);
       continue;
     }
-    if (map->data->device->ops->Munmap) {
-      unassert(!map->data->device->ops->Munmap(map->data, map->addr, map->len));
-    }
     e = dll_next(modified, e);
     dll_remove(&modified, &map->elem);
     unassert(!VfsMapFree(map));
@@ -2910,4 +3006,37 @@ int VfsSocketpair(int domain, int type, int protocol, int fds[2]) {
   return 0;
 }
 
+// gives the guest a host fd, e.g. from eventfd(), which it takes over
+int VfsAddHostFd(int hostfd) {
+  int fd;
+  struct VfsInfo *info;
+  VFS_LOGF("VfsAddHostFd(%d)", hostfd);
+  if (HostfsWrapFd(hostfd, false, &info) == -1) {
+    unassert(!close(hostfd));
+    return -1;
+  }
+  if ((fd = VfsAddFd(info)) == -1) {
+    unassert(!VfsFreeInfo(info));
+    return -1;
+  }
+  return fd;
+}
+
+// returns host fd behind fd, for system calls the vfs has no op for,
+// or fails with EBADF if fd isn't backed by one, e.g. it's in /proc.
+// the caller must VfsFreeInfo() the returned info once it's done
+int VfsGetHostFd(int fd, struct VfsInfo **output) {
+  VFS_LOGF("VfsGetHostFd(%d, %p)", fd, output);
+  if (VfsGetFd(fd, output) == -1) {
+    return -1;
+  }
+  if ((*output)->device->ops != &g_hostfs.ops ||
+      ((struct HostfsInfo *)(*output)->data)->filefd == -1) {
+    unassert(!VfsFreeInfo(*output));
+    *output = NULL;
+    return ebadf();
+  }
+  return ((struct HostfsInfo *)(*output)->data)->filefd;
+}
+
 #endif /* DISABLE_VFS */
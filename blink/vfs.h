@@ -24,6 +24,7 @@
 #define VFS_SYSTEM_ROOT_MOUNT "/SystemRoot"
 #define VFS_PATH_MAX          MAX(PATH_MAX, 4096)
 #define VFS_NAME_MAX          256
+#define VFS_FD_BUCKETS        64
 
 struct VfsDevice;
 struct VfsMount;
@@ -32,13 +33,21 @@ struct VfsSystem;
 struct VfsFd;
 struct VfsMap;
 
+struct VfsFdBucket {
+  struct Dll *fds GUARDED_BY(lock);
+  pthread_mutex_t_ lock;
+};
+
 struct Vfs {
   struct Dll *devices GUARDED_BY(lock);
   struct Dll *systems GUARDED_BY(lock);
-  struct Dll *fds GUARDED_BY(lock);
   struct Dll *maps GUARDED_BY(mapslock);
+  u64 *fdbits GUARDED_BY(fdslock);  // which fd numbers are taken
+  size_t fdwords GUARDED_BY(fdslock);
   pthread_mutex_t_ lock;
+  pthread_mutex_t_ fdslock;
   pthread_mutex_t_ mapslock;
+  struct VfsFdBucket fds[VFS_FD_BUCKETS];  // lookups only lock one bucket
 };
 
 struct VfsOps {
@@ -258,6 +267,8 @@ int VfsPipe2(int[2], int);
 #endif
 int VfsSocket(int, int, int);
 int VfsSocketpair(int, int, int, int[2]);
+int VfsAddHostFd(int);
+int VfsGetHostFd(int, struct VfsInfo **);
 
 int VfsTcgetattr(int, struct termios *);
 int VfsTcsetattr(int, int, const struct termios *);
@@ -38,18 +38,32 @@ Modifications: Removed as much code and functionality as possible";
 
 #define XED_ILD_HASMODRM_IGNORE_MOD 2
 
-static const u32 xed_prefix_table_bit[8] = {
-    0x00000000, 0x40404040, 0x0000ffff, 0x000000f0,
-    0x00000000, 0x00000000, 0x00000000, 0x000d0000,
-};
+// prefix kinds, where 1 through 6 are segment overrides
+#define XED_PREFIX_OSZ  7
+#define XED_PREFIX_ASZ  8
+#define XED_PREFIX_LOCK 9
+#define XED_PREFIX_REP  10
+#define XED_PREFIX_REX  11
+
+#define XED_IMM_NONE     1
+#define XED_DISP_MODRM   4
+#define XED_OPCODE_MAP23 (1 | XED_IMM_NONE << 2 | XED_DISP_MODRM << 6)
 
+// decoder tables
+//
+// these were precomputed from xed's interval tables, so that each step
+// of decoding is one lookup indexed by a byte of the instruction.
+//
+// - opcode[map][b] describes the one byte opcodes of maps 0 and 1. bits
+//   0-1 are has_modrm, bits 2-5 are the immediate kind, bits 6-8 are the
+//   displacement kind, and in map 0 bits 9-12 are the prefix kind, so a
+//   single lookup on the first byte is all that unprefixed code needs
+// - modrm[eamode][mod][rm] is the displacement size in bytes, OR'd with
+//   8 if a sib byte follows
 static const struct XedDenseMagnums {
   u8 eamode[2][3];
-  u8 has_sib_table[3][4][8];
-  u8 has_disp_regular[3][4][8];
-  u8 imm_bits_2d[2][256];
-  u8 has_modrm_2d[XED_ILD_MAP2][256];
-  u8 disp_bits_2d[XED_ILD_MAP2][256];
+  u8 modrm[3][4][8];
+  u16 opcode[2][256];
   u8 BRDISPz_BRDISP_WIDTH[4];
   u8 MEMDISPv_DISP_WIDTH[4];
   u8 SIMMz_IMM_WIDTH[4];
@@ -60,106 +74,85 @@ static const struct XedDenseMagnums {
 } kXed = {
     .eamode = {{XED_MODE_REAL, XED_MODE_LEGACY, XED_MODE_LONG},
                {XED_MODE_LEGACY, XED_MODE_REAL, XED_MODE_LEGACY}},
-    .has_sib_table = {{{0, 0, 0, 0, 0, 0, 0, 0},
-                       {0, 0, 0, 0, 0, 0, 0, 0},
-                       {0, 0, 0, 0, 0, 0, 0, 0},
-                       {0, 0, 0, 0, 0, 0, 0, 0}},
-                      {{0, 0, 0, 0, 1, 0, 0, 0},
-                       {0, 0, 0, 0, 1, 0, 0, 0},
-                       {0, 0, 0, 0, 1, 0, 0, 0},
-                       {0, 0, 0, 0, 0, 0, 0, 0}},
-                      {{0, 0, 0, 0, 1, 0, 0, 0},
-                       {0, 0, 0, 0, 1, 0, 0, 0},
-                       {0, 0, 0, 0, 1, 0, 0, 0},
-                       {0, 0, 0, 0, 0, 0, 0, 0}}},
-    .has_disp_regular = {{{0, 0, 0, 0, 0, 0, 2, 0},
-                          {1, 1, 1, 1, 1, 1, 1, 1},
-                          {2, 2, 2, 2, 2, 2, 2, 2},
-                          {0, 0, 0, 0, 0, 0, 0, 0}},
-                         {{0, 0, 0, 0, 0, 4, 0, 0},
-                          {1, 1, 1, 1, 1, 1, 1, 1},
-                          {4, 4, 4, 4, 4, 4, 4, 4},
-                          {0, 0, 0, 0, 0, 0, 0, 0}},
-                         {{0, 0, 0, 0, 0, 4, 0, 0},
-                          {1, 1, 1, 1, 1, 1, 1, 1},
-                          {4, 4, 4, 4, 4, 4, 4, 4},
-                          {0, 0, 0, 0, 0, 0, 0, 0}}},
-    .imm_bits_2d =
-        {{1,  1, 1, 1, 5,  7,  1,  1,  1,  1,  1,  1,  9, 7, 1, 0, 1, 1, 1, 1,
-          5,  7, 1, 1, 1,  1,  1,  1,  5,  7,  1,  1,  1, 1, 1, 1, 5, 7, 0, 1,
-          1,  1, 1, 1, 5,  7,  0,  1,  1,  1,  1,  1,  9, 7, 0, 1, 1, 1, 1, 1,
-          5,  7, 0, 1, 1,  1,  1,  1,  1,  1,  1,  1,  1, 1, 1, 1, 1, 1, 1, 1,
-          1,  1, 1, 1, 1,  1,  1,  1,  1,  1,  1,  1,  1, 1, 1, 1, 1, 1, 1, 1,
-          0,  0, 0, 0, 6,  7,  5,  5,  1,  1,  1,  1,  1, 1, 1, 1, 1, 1, 1, 1,
-          1,  1, 1, 1, 1,  1,  1,  1,  5,  7,  5,  5,  1, 1, 1, 1, 1, 1, 1, 1,
-          1,  1, 1, 1, 1,  1,  1,  1,  1,  1,  1,  1,  1, 1, 8, 1, 1, 1, 1, 1,
-          1,  1, 1, 1, 1,  1,  1,  1,  5,  7,  1,  1,  1, 1, 1, 1, 9, 9, 9, 9,
-          9,  9, 9, 9, 10, 10, 10, 10, 10, 10, 10, 10, 9, 9, 8, 1, 1, 1, 9, 2,
-          11, 1, 8, 1, 1,  9,  1,  1,  1,  1,  1,  1,  9, 9, 1, 1, 1, 1, 1, 1,
-          1,  1, 1, 1, 1,  1,  1,  1,  9,  9,  9,  9,  1, 1, 8, 1, 1, 1, 1, 1,
-          0,  1, 0, 0, 1,  1,  3,  4,  1,  1,  1,  1,  1, 1, 1, 1},
-         {1, 1, 1, 1, 0, 1, 1, 1, 1, 1, 0,  1, 0, 1, 1, 0, 1, 1, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0,  1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-          1, 1, 9, 9, 9, 9, 1, 1, 1, 1, 12, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 9,  1, 0, 0, 1, 1, 1, 1, 9, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 9,  1, 1, 1, 1, 1, 1, 1, 9, 1, 9, 9,
-          9, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  1, 1, 1}},
-    .has_modrm_2d =
-        {{1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0, 3, 1, 1, 1, 1, 0, 0,
-          0, 0, 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 3, 0, 1, 1, 1, 1,
-          0, 0, 3, 0, 1, 1, 1, 1, 0, 0, 3, 0, 1, 1, 1, 1, 0, 0, 3, 0, 0, 0,
-          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 3, 3, 3, 3, 0, 1, 0, 1, 0, 0,
-          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0, 0, 1, 1,
-          1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0, 0, 1, 1, 1, 1,
-          1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3, 0,
-          3, 3, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 1, 1},
-         {1, 1, 1, 1, 3, 0, 0, 0, 0, 0, 3, 0, 3, 1, 0, 3, 1, 1, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 1, 1, 1, 1,
-          1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 3, 0, 3, 3, 3, 3, 3, 3, 3, 3, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0,
-          0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1, 1, 3, 3, 0, 0, 0, 1, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-          1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-          1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1}},
-    .disp_bits_2d =
-        {{4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 4, 4, 4, 4, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 4, 4, 4, 4, 4,
-          4, 4, 0, 4, 4, 4, 4, 4, 4, 4, 0, 4, 4, 4, 4, 4, 4, 4, 0, 4, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 0, 0, 0, 4, 4, 4, 4, 4, 4,
-          4, 4, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 4, 4, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-          2, 4, 4, 4, 4, 4, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-          4, 6, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-          4, 4, 4, 4, 1, 1, 1, 1, 4, 4, 4, 4, 3, 3, 2, 1, 4, 4, 4, 4, 0, 4,
-          0, 0, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4},
-         {4, 4, 4, 4, 0, 4, 4, 4, 4, 4, 0, 4, 0, 4, 4, 0, 4, 4, 4, 4, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 0, 0, 0, 4, 4, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 3, 3, 3, 3,
-          3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 0, 4, 4, 4, 4, 4, 4, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
-          4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4}},
+    .modrm = {{{0, 0, 0, 0, 0, 0, 2, 0},
+               {1, 1, 1, 1, 1, 1, 1, 1},
+               {2, 2, 2, 2, 2, 2, 2, 2},
+               {0, 0, 0, 0, 0, 0, 0, 0}},
+              {{0, 0, 0, 0, 8, 4, 0, 0},
+               {1, 1, 1, 1, 9, 1, 1, 1},
+               {4, 4, 4, 4, 12, 4, 4, 4},
+               {0, 0, 0, 0, 0, 0, 0, 0}},
+              {{0, 0, 0, 0, 8, 4, 0, 0},
+               {1, 1, 1, 1, 9, 1, 1, 1},
+               {4, 4, 4, 4, 12, 4, 4, 4},
+               {0, 0, 0, 0, 0, 0, 0, 0}}},
+    .opcode = {{
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0114, 0x011c, 0x0104, 0x0104,  // 00
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0124, 0x011c, 0x0104, 0x0003,  // 08
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0114, 0x011c, 0x0104, 0x0104,  // 10
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0114, 0x011c, 0x0104, 0x0104,  // 18
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0114, 0x011c, 0x0203, 0x0104,  // 20
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0114, 0x011c, 0x0403, 0x0104,  // 28
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0124, 0x011c, 0x0603, 0x0104,  // 30
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0114, 0x011c, 0x0803, 0x0104,  // 38
+        0x1704, 0x1704, 0x1704, 0x1704, 0x1704, 0x1704, 0x1704, 0x1704,  // 40
+        0x1704, 0x1704, 0x1704, 0x1704, 0x1704, 0x1704, 0x1704, 0x1704,  // 48
+        0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104,  // 50
+        0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104,  // 58
+        0x0104, 0x0104, 0x0105, 0x0105, 0x0a03, 0x0c03, 0x0e03, 0x1003,  // 60
+        0x0118, 0x011d, 0x0114, 0x0115, 0x0104, 0x0104, 0x0104, 0x0104,  // 68
+        0x0044, 0x0044, 0x0044, 0x0044, 0x0044, 0x0044, 0x0044, 0x0044,  // 70
+        0x0044, 0x0044, 0x0044, 0x0044, 0x0044, 0x0044, 0x0044, 0x0044,  // 78
+        0x0115, 0x011d, 0x0115, 0x0115, 0x0105, 0x0105, 0x0105, 0x0105,  // 80
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // 88
+        0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104,  // 90
+        0x0104, 0x0104, 0x00a0, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104,  // 98
+        0x0144, 0x0144, 0x0144, 0x0144, 0x0104, 0x0104, 0x0104, 0x0104,  // a0
+        0x0114, 0x011c, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104,  // a8
+        0x0124, 0x0124, 0x0124, 0x0124, 0x0124, 0x0124, 0x0124, 0x0124,  // b0
+        0x0128, 0x0128, 0x0128, 0x0128, 0x0128, 0x0128, 0x0128, 0x0128,  // b8
+        0x0125, 0x0125, 0x0120, 0x0104, 0x0105, 0x0105, 0x0125, 0x0189,  // c0
+        0x012c, 0x0104, 0x0120, 0x0104, 0x0104, 0x0124, 0x0104, 0x0104,  // c8
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0124, 0x0124, 0x0104, 0x0104,  // d0
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // d8
+        0x0044, 0x0044, 0x0044, 0x0044, 0x0124, 0x0124, 0x0124, 0x0124,  // e0
+        0x00c4, 0x00c4, 0x00a0, 0x0044, 0x0104, 0x0104, 0x0104, 0x0104,  // e8
+        0x1203, 0x0104, 0x1403, 0x1403, 0x0104, 0x0104, 0x010d, 0x0111,  // f0
+        0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0105, 0x0105,  // f8
+    }, {
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0003, 0x0104, 0x0104, 0x0104,  // 00
+        0x0104, 0x0104, 0x0003, 0x0104, 0x0003, 0x0105, 0x0104, 0x0003,  // 08
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // 10
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // 18
+        0x0106, 0x0106, 0x0106, 0x0106, 0x0003, 0x0003, 0x0003, 0x0003,  // 20
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // 28
+        0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0003, 0x0104,  // 30
+        0x0003, 0x0003, 0x0003, 0x0003, 0x0003, 0x0003, 0x0003, 0x0003,  // 38
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // 40
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // 48
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // 50
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // 58
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // 60
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // 68
+        0x0125, 0x0125, 0x0125, 0x0125, 0x0105, 0x0105, 0x0105, 0x0104,  // 70
+        0x0131, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // 78
+        0x00c4, 0x00c4, 0x00c4, 0x00c4, 0x00c4, 0x00c4, 0x00c4, 0x00c4,  // 80
+        0x00c4, 0x00c4, 0x00c4, 0x00c4, 0x00c4, 0x00c4, 0x00c4, 0x00c4,  // 88
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // 90
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // 98
+        0x0104, 0x0104, 0x0104, 0x0105, 0x0125, 0x0105, 0x0003, 0x0003,  // a0
+        0x0104, 0x0104, 0x0104, 0x0105, 0x0125, 0x0105, 0x0105, 0x0105,  // a8
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // b0
+        0x0105, 0x0105, 0x0125, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // b8
+        0x0105, 0x0105, 0x0125, 0x0105, 0x0125, 0x0125, 0x0125, 0x0105,  // c0
+        0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104, 0x0104,  // c8
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // d0
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // d8
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // e0
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // e8
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // f0
+        0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105, 0x0105,  // f8
+    }},
     .BRDISPz_BRDISP_WIDTH = {0, 16, 32, 32},
     .MEMDISPv_DISP_WIDTH = {0, 16, 32, 64},
     .SIMMz_IMM_WIDTH = {0x00, 0x10, 0x20, 0x20},
@@ -169,373 +162,180 @@ static const struct XedDenseMagnums {
     .OSZ_NONTERM_EOSZ = {{{1, 2, 2}, {2, 1, 1}}, {{1, 2, 3}, {2, 1, 3}}},
 };
 
-static size_t xed_bits2bytes(unsigned bits) {
-  return bits >> 3;
-}
-
-static size_t xed_bytes2bits(unsigned bytes) {
-  return bytes << 3;
-}
-
-static u8 xed_get_prefix_table_bit(u8 a) {
-  return (xed_prefix_table_bit[a >> 5] >> (a & 0x1F)) & 1;
-}
-
-static void xed_set_mopcode(struct XedDecodedInst *x, u64 mopcode) {
-  x->op.rde |= mopcode << 40;
+static u64 xed_read_number(const u8 *p, size_t n, unsigned s) {
+  switch (s << 2 | bsr(n)) {
+    case 0:
+      return Read8(p);
+    case 1:
+      return Read16(p);
+    case 2:
+      return Read32(p);
+    case 3:
+      return Read64(p);
+    case 4:
+      return (i8)Read8(p);
+    case 5:
+      return (i16)Read16(p);
+    case 6:
+      return (i32)Read32(p);
+    case 7:
+      return (i64)Read64(p);
+    default:
+      __builtin_unreachable();
+  }
 }
 
-static int xed_too_short(struct XedDecodedInst *x) {
-  if (x->op.max_bytes >= 15) {
-    return XED_ERROR_INSTR_TOO_LONG;
-  } else {
-    return XED_ERROR_BUFFER_TOO_SHORT;
+static u64 xed_set_vex_prefix(u64 rde, unsigned prefix) {
+  switch (prefix) {
+    case 0:
+      return rde;
+    case 1:  // osz
+      return rde | 1 << 5;
+    case 2:  // rep3
+    case 3:  // rep2
+      return (rde & ~((u64)3 << 51)) | (u64)(prefix ^ 1) << 51;
+    default:
+      __builtin_unreachable();
   }
 }
 
-static void xed_set_simmz_imm_width_eosz(struct XedDecodedInst *x,
-                                         const u8 eosz[2][2][3], int *imm_width,
-                                         u8 *imm_signed) {
-  *imm_width = kXed.SIMMz_IMM_WIDTH[eosz[Rexw(x->op.rde)][Osz(x->op.rde)]
-                                        [Mode(x->op.rde)]];
-  *imm_signed = 1;
+static unsigned xed_simmz_imm_width(u64 rde, const u8 eosz[2][2][3]) {
+  return kXed.SIMMz_IMM_WIDTH[eosz[Rexw(rde)][Osz(rde)][Mode(rde)]];
 }
 
-static int xed_set_imm_bytes(struct XedDecodedInst *x, int *imm_width,
-                             u8 *imm_signed) {
-  if (!*imm_width && Opmap(x->op.rde) < XED_ILD_MAP2) {
-    switch (kXed.imm_bits_2d[Opmap(x->op.rde)][Opcode(x->op.rde)]) {
-      case 0:
-        return XED_ERROR_GENERAL_ERROR;
-      case 1:
-        *imm_width = 0;
-        return XED_ERROR_NONE;
-      case 2:
-        switch (ModrmReg(x->op.rde)) {
-          case 0:
-            xed_set_simmz_imm_width_eosz(x, kXed.OSZ_NONTERM_EOSZ, imm_width,
-                                         imm_signed);
-            return XED_ERROR_NONE;
-          case 7:
-            *imm_width = 0;
-            return XED_ERROR_NONE;
-          default:
-            return XED_ERROR_NONE;
-        }
-      case 3:
-        if (ModrmReg(x->op.rde) <= 1) {
-          *imm_width = 8;
-          *imm_signed = 1;
-        } else if (2 <= ModrmReg(x->op.rde) && ModrmReg(x->op.rde) <= 7) {
-          *imm_width = 0;
-        }
-        return XED_ERROR_NONE;
-      case 4:
-        if (ModrmReg(x->op.rde) <= 1) {
-          xed_set_simmz_imm_width_eosz(x, kXed.OSZ_NONTERM_EOSZ, imm_width,
-                                       imm_signed);
-        } else if (2 <= ModrmReg(x->op.rde) && ModrmReg(x->op.rde) <= 7) {
-          *imm_width = 0;
-        }
-        return XED_ERROR_NONE;
-      case 5:
-        *imm_width = 8;
-        *imm_signed = 1;
-        return XED_ERROR_NONE;
-      case 6:
-        xed_set_simmz_imm_width_eosz(x, kXed.OSZ_NONTERM_DF64_EOSZ, imm_width,
-                                     imm_signed);
-        return XED_ERROR_NONE;
-      case 7:
-        xed_set_simmz_imm_width_eosz(x, kXed.OSZ_NONTERM_EOSZ, imm_width,
-                                     imm_signed);
-        return XED_ERROR_NONE;
-      case 8:
-        *imm_width = 16;
-        return XED_ERROR_NONE;
-      case 9:
-        *imm_width = 8;
-        return XED_ERROR_NONE;
-      case 10:
-        *imm_width = kXed.UIMMv_IMM_WIDTH[kXed.OSZ_NONTERM_EOSZ[Rexw(
-            x->op.rde)][Osz(x->op.rde)][Mode(x->op.rde)]];
-        return XED_ERROR_NONE;
-      case 11:
-        // actually 2 bytes for uimm0 & 1 byte for uimm1
-        *imm_width = xed_bytes2bits(3);
-        return XED_ERROR_NONE;
-      case 12:
-        if (Osz(x->op.rde) || Rep(x->op.rde) == 2) {
-          *imm_width = xed_bytes2bits(1);
-        }
-        return XED_ERROR_NONE;
-      default:
-        __builtin_unreachable();
-    }
-  } else {
-    return XED_ERROR_NONE;
-  }
+static unsigned xed_brdispz_width(u64 rde) {
+  return kXed.BRDISPz_BRDISP_WIDTH[kXed.OSZ_NONTERM_EOSZ[Rexw(rde)][Osz(
+      rde)][Mode(rde)]];
 }
 
-static bool xed_is_bound_instruction(struct XedDecodedInst *x) {
-  return Mode(x->op.rde) != XED_MODE_LONG &&  //
-         x->length + 1 < x->op.max_bytes &&   //
-         (x->bytes[x->length + 1] & 0xC0) != 0xC0;
-}
-
-static int xed_prefix_scanner(struct XedDecodedInst *x) {
-  u32 rde;
-  u8 b, rep, max_bytes, length, islong;
-  u8 asz, osz, rex, rexw, rexr, rexx, rexb;
-  rex = 0;
-  rep = 0;
-  length = 0;
+// decodes the length and operands of an instruction, keeping its state
+// in registers until the end, since stores through the byte fields of
+// XedDecodedInst would make the compiler reload everything it cached.
+static int xed_decode_instruction_length(struct XedDecodedInst *x) {
+  int e;
+  u64 rde;
+  const u8 *p;
+  bool islong, imm_signed, disp_unsigned;
+  unsigned i, n, b, k, map, rex, attr, has_modrm, has_sib;
+  unsigned imm_width, imm_bytes, disp_width, disp_bytes;
+  p = x->bytes;
+  n = x->op.max_bytes;
   rde = x->op.rde;
-  max_bytes = x->op.max_bytes;
   islong = Mode(rde) == XED_MODE_LONG;
-  while (length < max_bytes) {
-    b = x->bytes[length];
-    if (xed_get_prefix_table_bit(b) == 0) goto out;
-    switch (b) {
-      case 0x66:  // osz
-        rex = 0;
-        osz = 1;
-        rde |= osz << 5;
-        break;
-      case 0x67:  // asz
-        rex = 0;
-        asz = 1;
-        rde |= asz << 21;
-        break;
-      case 0x2E:  // cs
-        if (1 || !islong) {
-          rde &= 037770777777;
-          rde |= 000002000000;
-        }
-        rex = 0;
-        break;
-      case 0x3E:  // ds
-        if (1 || !islong) {
-          rde &= 037770777777;
-          rde |= 000004000000;
-        }
-        rex = 0;
-        break;
-      case 0x26:  // es
-        if (1 || !islong) {
-          rde &= 037770777777;
-          rde |= 000001000000;
-        }
-        rex = 0;
-        break;
-      case 0x36:  // ss
-        if (1 || !islong) {
-          rde &= 037770777777;
-          rde |= 000003000000;
-        }
-        rex = 0;
-        break;
-      case 0x64:  // fs
-        rde &= 037770777777;
-        rde |= 000005000000;
-        rex = 0;
+  imm_signed = disp_unsigned = false;
+  imm_width = disp_width = 0;
+  rex = has_sib = 0;
+  attr = 0;
+
+  // legacy prefixes, and rex prefixes in long mode
+  for (i = 0; i < n; ++i) {
+    b = p[i];
+    attr = kXed.opcode[XED_ILD_MAP0][b];
+    if (!(k = attr >> 9)) break;
+    if (k == XED_PREFIX_REX) {
+      if (!islong) break;
+      rex = b;
+      continue;
+    }
+    rex = 0;
+    switch (k) {
+      case XED_PREFIX_OSZ:
+        rde |= 1 << 5;
         break;
-      case 0x65:  // gs
-        rde &= 037770777777;
-        rde |= 000006000000;
-        rex = 0;
+      case XED_PREFIX_ASZ:
+        rde |= 1 << 21;
         break;
-      case 0xF0:  // lock
+      case XED_PREFIX_LOCK:
         rde |= 020000000000;
-        rex = 0;
         break;
-      case 0xF2:  // rep
-      case 0xF3:
-        rep = b & 3;
-        rex = 0;
+      case XED_PREFIX_REP:
+        rde &= ~((u64)3 << 51);
+        rde |= (u64)(b & 3) << 51;
+        break;
+      default:  // segment override
+        rde &= ~(u64)000007000000;
+        rde |= k << 18;
         break;
-      default:
-        if (islong && (b & 0xf0) == 0x40) {
-          rex = b;
-          break;
-        } else {
-          goto out;
-        }
     }
-    length++;
   }
-out:
-  x->length = length;
   if (rex) {
-    rexw = (rex >> 3) & 1;
-    rexr = (rex >> 2) & 1;
-    rexx = (rex >> 1) & 1;
-    rexb = rex & 1;
-    rex = 1;
-    rde |= rexx << 17 | rex << 16 | rexb << 15 | rex << 11 | rexb << 10 |
-           rexw << 6 | rex << 4 | rexr << 3;
-  }
-  x->op.rde = (u64)rep << 51 | rde;
-  if (length < max_bytes) {
-    return XED_ERROR_NONE;
-  } else {
-    return xed_too_short(x);
-  }
-}
-
-static void xed_set_vex_prefix(struct XedDecodedInst *x, unsigned prefix) {
-  switch (prefix) {
-    case 0:
-      break;
-    case 1:  // osz
-      x->op.rde &= ~(1 << 5);
-      x->op.rde |= 1 << 5;
-      break;
-    case 2:  // rep3
-    case 3:  // rep2
-      x->op.rde &= ~((u64)3 << 51);
-      x->op.rde |= (u64)(prefix ^ 1) << 51;
-      break;
-    default:
-      __builtin_unreachable();
+    rde |= ((rex >> 1) & 1) << 17 | 1 << 16 | (rex & 1) << 15 | 1 << 11 |
+           (rex & 1) << 10 | ((rex >> 3) & 1) << 6 | 1 << 4 |
+           ((rex >> 2) & 1) << 3;
   }
-}
+  if (i == n) goto TooShort;
 
-static int xed_vex_opcode_scanner(struct XedDecodedInst *x, int map) {
-  xed_set_mopcode(x, map << 8 | x->bytes[x->length]);
-  x->op.pos_opcode = x->length++;
+  // opcode, which vex prefixes may only be followed by in long mode
+#if !defined(DISABLE_BMI2) || !defined(DISABLE_AVX)
+  if (islong && (p[i] & 0xFE) == 0xC4) {
+    if (p[i++] == 0xC4) {
+      // map:   5-bit
+      // rex.b: 1-bit (expands r/m or srm register operand)
+      // rex.x: 1-bit (expands sib register operands)
+      // rex.r: 1-bit (expands reg register operand)
+      // prefix:        2-bit → {none, osz, rep3, rep2}
+      // vector_length: 1-bit → {xmm, ymm} aka VEX.L
+      // vexdest210:    3-bit (second reg operand, inverted)
+      // vrex:          1-bit a.k.a. vexdest3
+      // rex.w:         1-bit (for 64-bit registers) aka VEX.W1
+      if (i + 2 >= n) goto TooShort;
+      b = p[i];
+      k = p[i + 1];
+      rde = xed_set_vex_prefix(rde, k & 3);
+      map = b & 31;
+      if (map < XED_ILD_MAP1 || map > XED_ILD_MAP3) {
+        e = XED_ERROR_BAD_MAP;
+        goto Fail;
+      }
+      if (map == XED_ILD_MAP3) {
+        imm_width = 8;
+      }
+      rde |= (u64)!(k & 64) << 63 | !(b & 64) << 17 | !(b & 32) << 15 |
+             !(b & 32) << 10 | !!(k & 128) << 6 | !(b & 128) << 3;
+      i += 2;
+    } else {
+      // prefix:        2-bit → {none, osz, rep3, rep2}
+      // vector_length: 1-bit → {xmm, ymm}
+      // vexdest210:    3-bit
+      // vrex:          1-bit
+      // rex.r:         1-bit
+      if (i + 1 >= n) goto TooShort;
+      k = p[i];
+      rde = xed_set_vex_prefix(rde, k & 3);
+      rde |= (u64)!(k & 64) << 63 | !(k & 128) << 3;
+      map = XED_ILD_MAP1;
+      i += 1;
+    }
+    rde |= (u64)((~k >> 3) & 7) << 60;  // vexdest210
+    rde |= (u64)((k >> 2) & 1) << 30;   // ymm
+    rde |= (u64)1 << 59;                // vex
+    rde |= (u64)(map << 8 | p[i]) << 40;
+    x->op.pos_opcode = i++;
 #ifndef TINY
-  if (Mode(x->op.rde) == XED_MODE_LONG && Rex(x->op.rde)) {
-    return XED_ERROR_BAD_REX_PREFIX;
-  }
-  if (Mode(x->op.rde) == XED_MODE_REAL) {
-    return XED_ERROR_INVALID_MODE;
-  }
-#endif
-  return 0;
-}
-
-static int xed_vex_c4_scanner(struct XedDecodedInst *x, int *imm_width,
-                              int *vexvalid) {
-  unsigned length, b1, b2;
-  int map, rexr, rexx, rexb, rexw, ymm, vrex, vexdest210;
-  if (xed_is_bound_instruction(x)) return 0;
-  length = x->length;
-  length++;
-  if (length + 2 < x->op.max_bytes) {
-    // map:   5-bit
-    // rex.b: 1-bit (expands r/m or srm register operand)
-    // rex.x: 1-bit (expands sib register operands)
-    // rex.r: 1-bit (expands reg register operand)
-    b1 = x->bytes[length];
-    rexr = !(b1 & 128);
-    rexx = !(b1 & 64);
-    rexb = (Mode(x->op.rde) == XED_MODE_LONG) & !(b1 & 32);
-    // prefix:        2-bit → {none, osz, rep3, rep2}
-    // vector_length: 1-bit → {xmm, ymm} aka VEX.L
-    // vexdest210:    3-bit (second reg operand, inverted)
-    // vrex:          1-bit a.k.a. vexdest3
-    // rex.w:         1-bit (for 64-bit registers) aka VEX.W1
-    b2 = x->bytes[length + 1];
-    rexw = !!(b2 & 128);
-    vrex = !(b2 & 64);
-    vexdest210 = (~b2 >> 3) & 7;
-    ymm = !!(b2 & 4);
-    xed_set_vex_prefix(x, b2 & 3);
-    map = b1 & 31;
-    if ((b1 & 3) == XED_ILD_MAP3) {
-      *imm_width = xed_bytes2bits(1);
+    if (Rex(rde)) {
+      e = XED_ERROR_BAD_REX_PREFIX;
+      goto Fail;
     }
-    x->op.rde |= (u64)vrex << 63 | rexx << 17 | rexb << 15 | rexb << 10 |
-                 rexw << 6 | rexr << 3;
-    x->op.rde |= ymm << 30;
-    x->op.rde |= (u64)vexdest210 << 60;
-    *vexvalid = 1;
-    length += 2;
-    x->length = length;
-    return xed_vex_opcode_scanner(x, map);
-  } else {
-    x->length = length;
-    return xed_too_short(x);
-  }
-}
-
-static int xed_vex_c5_scanner(struct XedDecodedInst *x, int *vexvalid) {
-  unsigned length, b;
-  int rexr, ymm, vrex, vexdest210;
-  length = x->length;
-  if (xed_is_bound_instruction(x)) return 0;
-  length++;
-  if (length + 1 < x->op.max_bytes) {
-    // prefix:        2-bit → {none, osz, rep3, rep2}
-    // vector_length: 1-bit → {xmm, ymm}
-    // vexdest210:    3-bit
-    // vrex:          1-bit
-    // rex.r:         1-bit
-    b = x->bytes[length];
-    rexr = !(b & 128);
-    vrex = !!(b & 64);
-    vexdest210 = (~b >> 3) & 7;
-    ymm = (b >> 2) & 1;
-    xed_set_vex_prefix(x, b & 3);
-    x->op.rde |= (u64)vrex << 63 | rexr << 3;
-    x->op.rde |= ymm << 30;
-    x->op.rde |= (u64)vexdest210 << 60;
-    *vexvalid = 1;
-    length++;
-    x->length = length;
-    return xed_vex_opcode_scanner(x, XED_ILD_MAP1);
-  } else {
-    x->length = length;
-    return xed_too_short(x);
-  }
-}
-
-static int xed_vex_scanner(struct XedDecodedInst *x, int *imm_width,
-                           int *vexvalid) {
-  if (Mode(x->op.rde) != XED_MODE_LONG) return 0;
-  switch (x->bytes[x->length]) {
-    case 0xC5:
-      return xed_vex_c5_scanner(x, vexvalid);
-    case 0xC4:
-      return xed_vex_c4_scanner(x, imm_width, vexvalid);
-    default:
-      return 0;
-  }
-}
-
-static int xed_get_next_as_opcode(struct XedDecodedInst *x, int map) {
-  u8 length;
-  length = x->length;
-  if (length < x->op.max_bytes) {
-    xed_set_mopcode(x, map << 8 | x->bytes[length]);
-    x->length++;
-    return XED_ERROR_NONE;
-  } else {
-    return xed_too_short(x);
-  }
-}
-
-static int xed_opcode_scanner(struct XedDecodedInst *x, int *imm_width) {
-  u8 b, length;
-  length = x->length;
-  if ((b = x->bytes[length]) != 0x0F) {
-    xed_set_mopcode(x, XED_ILD_MAP0 << 8 | b);
-    x->op.pos_opcode = length;
-    x->length++;
-    return XED_ERROR_NONE;
-  } else {
-    length++;
-    x->op.pos_opcode = length;
-    if (length < x->op.max_bytes) {
-      switch ((b = x->bytes[length])) {
+#endif
+  } else
+#endif
+  {
+    if ((b = p[i]) != 0x0F) {
+      map = XED_ILD_MAP0;
+      x->op.pos_opcode = i;
+    } else {
+      x->op.pos_opcode = i + 1;
+      if (i + 1 >= n) goto TooShort;
+      switch (p[i + 1]) {
         case 0x38:
-          x->length = ++length;
-          return xed_get_next_as_opcode(x, XED_ILD_MAP2);
+          map = XED_ILD_MAP2;
+          i += 2;
+          break;
         case 0x3A:
-          x->length = ++length;
-          *imm_width = xed_bytes2bits(1);
-          return xed_get_next_as_opcode(x, XED_ILD_MAP3);
+          map = XED_ILD_MAP3;
+          imm_width = 8;
+          i += 2;
+          break;
         case 0x3B:
         case 0x39:
         case 0x3C:
@@ -543,199 +343,167 @@ static int xed_opcode_scanner(struct XedDecodedInst *x, int *imm_width) {
         case 0x3E:
         case 0x3F:
         case 0x0F:
-          length++;
-          x->length = length;
-          xed_get_next_as_opcode(x, XED_ILD_BAD_MAP);
-          return XED_ERROR_BAD_MAP;
+          i += 2;
+          if (i < n) {
+            rde |= (u64)(XED_ILD_BAD_MAP << 8 | p[i++]) << 40;
+          }
+          e = XED_ERROR_BAD_MAP;
+          goto Fail;
         default:
-          xed_set_mopcode(x, XED_ILD_MAP1 << 8 | b);
-          x->length = ++length;
-          return XED_ERROR_NONE;
+          map = XED_ILD_MAP1;
+          i += 1;
+          break;
       }
-    } else {
-      return xed_too_short(x);
+      if (i >= n) goto TooShort;
     }
+    rde |= (u64)(map << 8 | p[i++]) << 40;
   }
-}
 
-static u64 xed_read_number(u8 *p, size_t n, unsigned s) {
-  switch (s << 2 | bsr(n)) {
-    case 0:
-      return Read8(p);
-    case 1:
-      return Read16(p);
-    case 2:
-      return Read32(p);
-    case 3:
-      return Read64(p);
-    case 4:
-      return (i8)Read8(p);
-    case 5:
-      return (i16)Read16(p);
-    case 6:
-      return (i32)Read32(p);
-    case 7:
-      return (i64)Read64(p);
-    default:
-      __builtin_unreachable();
-  }
-}
-
-static void xed_set_has_modrm(struct XedDecodedInst *x) {
-  if (Opmap(x->op.rde) < ARRAYLEN(kXed.has_modrm_2d)) {
-    x->op.has_modrm = kXed.has_modrm_2d[Opmap(x->op.rde)][Opcode(x->op.rde)];
-  } else {
-    x->op.has_modrm = 1;
+  // modrm and sib
+  if (map == XED_ILD_MAP1) {
+    attr = kXed.opcode[XED_ILD_MAP1][Opcode(rde)];
+  } else if (map != XED_ILD_MAP0) {
+    attr = XED_OPCODE_MAP23;
   }
-}
-
-static int xed_modrm_scanner(struct XedDecodedInst *x, int *disp_width,
-                             int *has_sib) {
-  u8 b, rm, reg, mod, eamode, length, has_modrm;
-  xed_set_has_modrm(x);
-  has_modrm = x->op.has_modrm;
+  x->op.has_modrm = has_modrm = attr & 3;
   if (has_modrm) {
-    length = x->length;
-    if (length < x->op.max_bytes) {
-      b = x->bytes[length];
-      x->length++;
-      rm = b & 0007;
-      reg = (b & 0070) >> 3;
-      mod = (b & 0300) >> 6;
-      x->op.rde &= ~1;
-      x->op.rde |= mod << 22 | rm << 7 | reg;
-      if (has_modrm != XED_ILD_HASMODRM_IGNORE_MOD) {
-        eamode = kXed.eamode[Asz(x->op.rde)][Mode(x->op.rde)];
-        *disp_width = xed_bytes2bits(kXed.has_disp_regular[eamode][mod][rm]);
-        *has_sib = kXed.has_sib_table[eamode][mod][rm];
-      }
-      return XED_ERROR_NONE;
-    } else {
-      return xed_too_short(x);
+    if (i >= n) goto TooShort;
+    b = p[i++];
+    k = kXed.modrm[kXed.eamode[Asz(rde)][Mode(rde)]][b >> 6][b & 7];
+    rde |= (b & 0300) << 16 | (b & 0007) << 7 | (b & 0070) >> 3;
+    if (has_modrm != XED_ILD_HASMODRM_IGNORE_MOD) {
+      disp_width = (k & 7) << 3;
+      has_sib = k >> 3;
     }
-  } else {
-    return XED_ERROR_NONE;
   }
-}
-
-static int xed_sib_scanner(struct XedDecodedInst *x, int *disp_width) {
-  u8 b, length;
-  length = x->length;
-  if (length < x->op.max_bytes) {
-    b = x->bytes[length];
-    x->op.rde |= (u64)b << 32;  // set sib byte
-    x->length++;
-    if ((b & 7) == 5) {
-      if (!ModrmMod(x->op.rde)) {
-        *disp_width = xed_bytes2bits(4);
-      }
+  if (has_sib) {
+    if (i >= n) goto TooShort;
+    b = p[i++];
+    rde |= (u64)b << 32;
+    if ((b & 7) == 5 && !ModrmMod(rde)) {
+      disp_width = 32;
     }
-    return XED_ERROR_NONE;
-  } else {
-    return xed_too_short(x);
   }
-}
 
-static u8 XED_LF_BRDISPz_BRDISP_WIDTH_OSZ_NONTERM_EOSZ_l2(
-    struct XedDecodedInst *x) {
-  return kXed.BRDISPz_BRDISP_WIDTH[kXed.OSZ_NONTERM_EOSZ[Rexw(x->op.rde)][Osz(
-      x->op.rde)][Mode(x->op.rde)]];
-}
-
-static int xed_disp_scanner(struct XedDecodedInst *x, int disp_width) {
-  u8 disp_unsigned = 0;
-  u8 length, disp_bytes;
-  length = x->length;
-  if (Opmap(x->op.rde) < XED_ILD_MAP2) {
-    switch (kXed.disp_bits_2d[Opmap(x->op.rde)][Opcode(x->op.rde)]) {
+  // displacement
+  if (((attr >> 6) & 7) != XED_DISP_MODRM) {
+    switch ((attr >> 6) & 7) {
       case 0:
-        return XED_ERROR_GENERAL_ERROR;
+        e = XED_ERROR_GENERAL_ERROR;
+        goto Fail;
       case 1:
         disp_width = 8;
         break;
       case 2:
-        disp_width = XED_LF_BRDISPz_BRDISP_WIDTH_OSZ_NONTERM_EOSZ_l2(x);
-        disp_unsigned = 1;
+        disp_width = xed_brdispz_width(rde);
+        disp_unsigned = true;
         break;
       case 3:
-        if (Mode(x->op.rde) <= XED_MODE_LEGACY) {
-          disp_width = XED_LF_BRDISPz_BRDISP_WIDTH_OSZ_NONTERM_EOSZ_l2(x);
-        } else if (Mode(x->op.rde) == XED_MODE_LONG) {
+        if (Mode(rde) <= XED_MODE_LEGACY) {
+          disp_width = xed_brdispz_width(rde);
+        } else {
           disp_width = 0x20;
         }
         break;
       case 4:
         break;
       case 5:
-        disp_width =
-            kXed.MEMDISPv_DISP_WIDTH[kXed.ASZ_NONTERM_EASZ[Asz(x->op.rde)]
-                                                          [Mode(x->op.rde)]];
-        disp_unsigned = 1;
+        disp_width = kXed.MEMDISPv_DISP_WIDTH[kXed.ASZ_NONTERM_EASZ[Asz(rde)]
+                                                                   [Mode(rde)]];
+        disp_unsigned = true;
         break;
       case 6:
-        switch (ModrmReg(x->op.rde)) {
-          case 0:
-            break;
-          case 7:
-            disp_width = XED_LF_BRDISPz_BRDISP_WIDTH_OSZ_NONTERM_EOSZ_l2(x);
-            disp_unsigned = 1;
-            break;
-          default:
-            break;
+        if (ModrmReg(rde) == 7) {
+          disp_width = xed_brdispz_width(rde);
+          disp_unsigned = true;
         }
         break;
       default:
         __builtin_unreachable();
     }
   }
-  disp_bytes = xed_bits2bytes(disp_width);
-  if (!disp_bytes) {
-    return XED_ERROR_NONE;
-  } else if (length + disp_bytes <= x->op.max_bytes) {
-    x->op.disp = xed_read_number(x->bytes + length, disp_bytes, !disp_unsigned);
-    x->length = length + disp_bytes;
-    return XED_ERROR_NONE;
-  } else {
-    return xed_too_short(x);
+  if ((disp_bytes = disp_width >> 3)) {
+    if (i + disp_bytes > n) goto TooShort;
+    x->op.disp = xed_read_number(p + i, disp_bytes, !disp_unsigned);
+    i += disp_bytes;
   }
-}
 
-static int xed_imm_scanner(struct XedDecodedInst *x, int imm_width) {
-  u8 *p;
-  int e;
-  u8 imm_signed = 0;
-  u8 i, length, imm_bytes;
-  p = x->bytes;
-  if ((e = xed_set_imm_bytes(x, &imm_width, &imm_signed))) return e;
-  i = length = x->length;
-  imm_bytes = xed_bits2bytes(imm_width);
-  if (!imm_bytes) {
-    return XED_ERROR_NONE;
-  } else if (length + imm_bytes <= x->op.max_bytes) {
-    length += imm_bytes;
-    x->length = length;
+  // immediate
+  if (!imm_width && ((attr >> 2) & 15) != XED_IMM_NONE) {
+    switch ((attr >> 2) & 15) {
+      case 0:
+        e = XED_ERROR_GENERAL_ERROR;
+        goto Fail;
+      case 1:
+        break;
+      case 2:
+        if (!ModrmReg(rde)) {
+          imm_width = xed_simmz_imm_width(rde, kXed.OSZ_NONTERM_EOSZ);
+          imm_signed = true;
+        }
+        break;
+      case 3:
+        if (ModrmReg(rde) <= 1) {
+          imm_width = 8;
+          imm_signed = true;
+        }
+        break;
+      case 4:
+        if (ModrmReg(rde) <= 1) {
+          imm_width = xed_simmz_imm_width(rde, kXed.OSZ_NONTERM_EOSZ);
+          imm_signed = true;
+        }
+        break;
+      case 5:
+        imm_width = 8;
+        imm_signed = true;
+        break;
+      case 6:
+        imm_width = xed_simmz_imm_width(rde, kXed.OSZ_NONTERM_DF64_EOSZ);
+        imm_signed = true;
+        break;
+      case 7:
+        imm_width = xed_simmz_imm_width(rde, kXed.OSZ_NONTERM_EOSZ);
+        imm_signed = true;
+        break;
+      case 8:
+        imm_width = 16;
+        break;
+      case 9:
+        imm_width = 8;
+        break;
+      case 10:
+        imm_width = kXed.UIMMv_IMM_WIDTH[kXed.OSZ_NONTERM_EOSZ[Rexw(rde)][Osz(
+            rde)][Mode(rde)]];
+        break;
+      case 11:
+        // actually 2 bytes for uimm0 & 1 byte for uimm1
+        imm_width = 24;
+        break;
+      case 12:
+        if (Osz(rde) || Rep(rde) == 2) {
+          imm_width = 8;
+        }
+        break;
+      default:
+        __builtin_unreachable();
+    }
+  }
+  if ((imm_bytes = imm_width >> 3)) {
+    if (i + imm_bytes > n) goto TooShort;
     x->op.uimm0 = xed_read_number(p + i, imm_bytes, imm_signed);
-    return XED_ERROR_NONE;
-  } else {
-    return xed_too_short(x);
+    i += imm_bytes;
   }
-}
 
-static int xed_decode_instruction_length(struct XedDecodedInst *x) {
-  int e;
-  int has_sib = 0;
-  int vexvalid = 0;
-  int imm_width = 0;
-  int disp_width = 0;
-  if ((e = xed_prefix_scanner(x))) return e;
-#ifndef DISABLE_BMI2
-  if ((e = xed_vex_scanner(x, &imm_width, &vexvalid))) return e;
-#endif
-  if (!vexvalid && (e = xed_opcode_scanner(x, &imm_width))) return e;
-  if ((e = xed_modrm_scanner(x, &disp_width, &has_sib))) return e;
-  if (has_sib && (e = xed_sib_scanner(x, &disp_width))) return e;
-  if ((e = xed_disp_scanner(x, disp_width))) return e;
-  return xed_imm_scanner(x, imm_width);
+  x->length = i;
+  x->op.rde = rde;
+  return XED_ERROR_NONE;
+TooShort:
+  e = n >= 15 ? XED_ERROR_INSTR_TOO_LONG : XED_ERROR_BUFFER_TOO_SHORT;
+Fail:
+  x->length = i;
+  x->op.rde = rde;
+  return e;
 }
 
 /**
@@ -752,7 +520,7 @@ int DecodeInstruction(struct XedDecodedInst *x, const void *itext, size_t bytes,
                       u64 mode) {
   int rc;
   u64 rde;
-  u8 kLog2[2][2][2] = {{{2, 3}, {1, 3}}};
+  static const u8 kLog2[2][2][2] = {{{2, 3}, {1, 3}}};
   unassert(mode == XED_MODE_LONG ||    //
            mode == XED_MODE_LEGACY ||  //
            mode == XED_MODE_REAL);
@@ -34,7 +34,12 @@ void OpXaddEbGb(P) {
   u8 x, y, z, *p, *q;
   p = GetModrmRegisterBytePointerWrite1(A);
   q = ByteRexrReg(m, rde);
-  if (Lock(rde)) {
+  if (Lock(rde) && CanFetchAlu(ALU_ADD, ALU_INT8, p)) {
+    y = Get8(q);
+    x = FetchAlu(ALU_ADD, ALU_INT8, p, y);
+    Add8(m, x, y);
+    Put8(q, x);
+  } else if (Lock(rde)) {
     x = atomic_load_explicit((_Atomic(u8) *)p, memory_order_acquire);
     y = atomic_load_explicit((_Atomic(u8) *)q, memory_order_relaxed);
     y = Little8(y);
@@ -58,6 +63,13 @@ void OpXaddEvqpGvqp(P) {
   p = GetModrmRegisterWordPointerWriteOszRexw(A);
   if (Rexw(rde)) {
     u64 x, y, z;
+    if (Lock(rde) && CanFetchAlu(ALU_ADD, ALU_INT64, p)) {
+      y = Get64(q);
+      x = FetchAlu(ALU_ADD, ALU_INT64, p, y);
+      Add64(m, x, y);
+      Put64(q, x);
+      return;
+    }
 #if CAN_64BIT
     if (Lock(rde) && !((uintptr_t)p & 7)) {
       x = atomic_load_explicit((_Atomic(u64) *)p, memory_order_acquire);
@@ -89,7 +101,12 @@ void OpXaddEvqpGvqp(P) {
     }
   } else if (!Osz(rde)) {
     u32 x, y, z;
-    if (Lock(rde) && !((uintptr_t)p & 3)) {
+    if (Lock(rde) && CanFetchAlu(ALU_ADD, ALU_INT32, p)) {
+      y = Get32(q);
+      x = FetchAlu(ALU_ADD, ALU_INT32, p, y);
+      Add32(m, x, y);
+      Put32(q, x);
+    } else if (Lock(rde) && !((uintptr_t)p & 3)) {
       x = atomic_load_explicit((_Atomic(u32) *)p, memory_order_acquire);
       y = atomic_load_explicit((_Atomic(u32) *)q, memory_order_relaxed);
       y = Little32(y);
@@ -114,7 +131,12 @@ void OpXaddEvqpGvqp(P) {
     }
   } else {
     u16 x, y, z;
-    if (Lock(rde) && !((uintptr_t)p & 1)) {
+    if (Lock(rde) && CanFetchAlu(ALU_ADD, ALU_INT16, p)) {
+      y = Get16(q);
+      x = FetchAlu(ALU_ADD, ALU_INT16, p, y);
+      Add16(m, x, y);
+      Put16(q, x);
+    } else if (Lock(rde) && !((uintptr_t)p & 1)) {
       x = atomic_load_explicit((_Atomic(u16) *)p, memory_order_acquire);
       y = atomic_load_explicit((_Atomic(u16) *)q, memory_order_relaxed);
       y = Little16(y);
@@ -37,6 +37,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "blink/assert.h"
 #include "blink/builtin.h"
 #include "blink/case.h"
 #include "blink/endian.h"
@@ -47,6 +48,7 @@
 #include "blink/map.h"
 #include "blink/ndelay.h"
 #include "blink/sigwinch.h"
+#include "blink/thread.h"
 #include "blink/util.h"
 
 #if defined(__APPLE__) || defined(__NetBSD__)
@@ -65,6 +67,93 @@
 #define TOPSIG 32
 #endif
 
+// whether the host's open() flags are bit for bit the same as linux's,
+// in which case they needn't be translated one flag at a time. hosts
+// that define O_LARGEFILE as zero have the kernel always set it anyway
+#if defined(__linux__) && defined(O_PATH) && defined(O_DIRECT) &&          \
+    defined(O_TMPFILE) && defined(O_NOATIME) && defined(O_ASYNC) &&        \
+    O_ACCMODE == O_ACCMODE_LINUX && O_APPEND == O_APPEND_LINUX &&          \
+    O_CREAT == O_CREAT_LINUX && O_EXCL == O_EXCL_LINUX &&                  \
+    O_TRUNC == O_TRUNC_LINUX && O_NDELAY == O_NDELAY_LINUX &&              \
+    O_DIRECT == O_DIRECT_LINUX && O_DIRECTORY == O_DIRECTORY_LINUX &&      \
+    O_TMPFILE == O_TMPFILE_LINUX && O_NOFOLLOW == O_NOFOLLOW_LINUX &&      \
+    O_CLOEXEC == O_CLOEXEC_LINUX && O_NOCTTY == O_NOCTTY_LINUX &&          \
+    O_ASYNC == O_ASYNC_LINUX && O_NOATIME == O_NOATIME_LINUX &&            \
+    O_PATH == O_PATH_LINUX && O_DSYNC == O_DSYNC_LINUX &&                  \
+    O_SYNC == O_SYNC_LINUX &&                                              \
+    (O_LARGEFILE == O_LARGEFILE_LINUX || O_LARGEFILE == 0)
+#define LINUX_OPEN_FLAGS
+#ifndef DISABLE_NONPOSIX
+#define OPEN_FLAGS_NONPOSIX_LINUX \
+  (O_TMPFILE_LINUX | O_ASYNC_LINUX | O_NOATIME_LINUX)
+#else
+#define OPEN_FLAGS_NONPOSIX_LINUX 0
+#endif
+#define OPEN_FLAGS_LINUX                                                  \
+  (O_ACCMODE_LINUX | O_APPEND_LINUX | O_CREAT_LINUX | O_EXCL_LINUX |      \
+   O_TRUNC_LINUX | O_NDELAY_LINUX | O_DIRECT_LINUX | O_DIRECTORY_LINUX | \
+   O_NOFOLLOW_LINUX | O_CLOEXEC_LINUX | O_NOCTTY_LINUX | O_PATH_LINUX |  \
+   O_LARGEFILE_LINUX | O_SYNC_LINUX | OPEN_FLAGS_NONPOSIX_LINUX)
+#endif
+
+#define SAME_FIELD(T1, F1, T2, F2)         \
+  (offsetof(T1, F1) == offsetof(T2, F2) && \
+   sizeof(((T1 *)0)->F1) == sizeof(((T2 *)0)->F2))
+
+// whether the host's struct stat begins with linux's struct stat, which
+// the compiler folds into a constant so XlatStatToLinux() can memcpy()
+#define LINUX_STAT_LAYOUT                                                   \
+  (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ &&                             \
+   SAME_FIELD(struct stat, st_dev, struct stat_linux, dev) &&               \
+   SAME_FIELD(struct stat, st_ino, struct stat_linux, ino) &&               \
+   SAME_FIELD(struct stat, st_nlink, struct stat_linux, nlink) &&           \
+   SAME_FIELD(struct stat, st_mode, struct stat_linux, mode) &&             \
+   SAME_FIELD(struct stat, st_uid, struct stat_linux, uid) &&               \
+   SAME_FIELD(struct stat, st_gid, struct stat_linux, gid) &&               \
+   SAME_FIELD(struct stat, st_rdev, struct stat_linux, rdev) &&             \
+   SAME_FIELD(struct stat, st_size, struct stat_linux, size) &&             \
+   SAME_FIELD(struct stat, st_blksize, struct stat_linux, blksize) &&       \
+   SAME_FIELD(struct stat, st_blocks, struct stat_linux, blocks) &&         \
+   SAME_FIELD(struct stat, st_atim.tv_sec, struct stat_linux, atim.sec) &&  \
+   SAME_FIELD(struct stat, st_atim.tv_nsec, struct stat_linux, atim.nsec) && \
+   SAME_FIELD(struct stat, st_mtim.tv_sec, struct stat_linux, mtim.sec) &&  \
+   SAME_FIELD(struct stat, st_mtim.tv_nsec, struct stat_linux, mtim.nsec) && \
+   SAME_FIELD(struct stat, st_ctim.tv_sec, struct stat_linux, ctim.sec) &&  \
+   SAME_FIELD(struct stat, st_ctim.tv_nsec, struct stat_linux, ctim.nsec) && \
+   sizeof(struct stat) >= sizeof(struct stat_linux))
+
+// whether the host's inet socket addresses are laid out like linux's,
+// which the compiler folds into a constant so they can be memcpy()'d
+#define LINUX_INET_LAYOUT                                                     \
+  (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && AF_INET == AF_INET_LINUX &&   \
+   AF_INET6 == AF_INET6_LINUX &&                                              \
+   sizeof(struct sockaddr_in) == sizeof(struct sockaddr_in_linux) &&          \
+   sizeof(struct sockaddr_in6) == sizeof(struct sockaddr_in6_linux) &&        \
+   SAME_FIELD(struct sockaddr_in, sin_family, struct sockaddr_in_linux,       \
+              family) &&                                                      \
+   SAME_FIELD(struct sockaddr_in, sin_port, struct sockaddr_in_linux, port) && \
+   SAME_FIELD(struct sockaddr_in, sin_addr, struct sockaddr_in_linux, addr) && \
+   SAME_FIELD(struct sockaddr_in6, sin6_family, struct sockaddr_in6_linux,    \
+              family) &&                                                      \
+   SAME_FIELD(struct sockaddr_in6, sin6_port, struct sockaddr_in6_linux,      \
+              port) &&                                                        \
+   SAME_FIELD(struct sockaddr_in6, sin6_flowinfo, struct sockaddr_in6_linux,  \
+              flowinfo) &&                                                    \
+   SAME_FIELD(struct sockaddr_in6, sin6_addr, struct sockaddr_in6_linux,      \
+              addr) &&                                                        \
+   SAME_FIELD(struct sockaddr_in6, sin6_scope_id, struct sockaddr_in6_linux,  \
+              scope_id))
+
+// signal numbers are translated through tables made on first use, since
+// SIGRTMIN is a function call on some hosts, and sigsets need 64 lookups
+static struct SignalTables {
+  pthread_once_t_ once;
+  u8 tohost[65];   // linux signal to host signal, or zero if none
+  u8 tolinux[65];  // host signal to linux signal, or zero if none
+} g_sigtabs = {
+    .once = PTHREAD_ONCE_INIT_,
+};
+
 int XlatErrno(int x) {
   if (x == EPERM) return EPERM_LINUX;
   if (x == ENOENT) return ENOENT_LINUX;
@@ -303,7 +392,7 @@ int XlatResource(int x) {
   }
 }
 
-int UnXlatSignal(int x) {
+static int UnXlatSignalImpl(int x) {
   if (x == SIGHUP) return SIGHUP_LINUX;
   if (x == SIGINT) return SIGINT_LINUX;
   if (x == SIGQUIT) return SIGQUIT_LINUX;
@@ -350,6 +439,29 @@ int UnXlatSignal(int x) {
   return einval();
 }
 
+static void InitSignalTables(void) {
+  int e, x, y;
+  e = errno;
+  for (x = 1; x <= MIN(64, TOPSIG); ++x) {
+    if ((y = UnXlatSignalImpl(x)) != -1) {
+      g_sigtabs.tolinux[x] = y;
+    }
+    if ((y = XlatSignal(x)) != -1 && y <= 64) {
+      g_sigtabs.tohost[x] = y;
+    }
+  }
+  errno = e;
+}
+
+int UnXlatSignal(int x) {
+  if (1 <= x && x <= MIN(64, TOPSIG)) {
+    unassert(!pthread_once_(&g_sigtabs.once, InitSignalTables));
+    if (g_sigtabs.tolinux[x]) return g_sigtabs.tolinux[x];
+    return einval();
+  }
+  return UnXlatSignalImpl(x);
+}
+
 int UnXlatSiCode(int sig, int code) {
 #ifdef SI_USER
   if (code == SI_USER) return SI_USER_LINUX;
@@ -613,6 +725,9 @@ int XlatSocketOptname(int level, int optname) {
 #ifdef SO_REUSEPORT
         XLAT(SO_REUSEPORT_LINUX, SO_REUSEPORT);
 #endif
+#ifdef SO_ZEROCOPY
+        XLAT(SO_ZEROCOPY_LINUX, SO_ZEROCOPY);
+#endif
 #endif
         default:
           break;
@@ -753,6 +868,39 @@ int XlatWait(int x) {
   return r;
 }
 
+int XlatWaitid(int x) {
+  int r = 0;
+  if (x & WNOHANG_LINUX) {
+    r |= WNOHANG;
+    x &= ~WNOHANG_LINUX;
+  }
+  if (x & WSTOPPED_LINUX) {
+    r |= WSTOPPED;
+    x &= ~WSTOPPED_LINUX;
+  }
+  if (x & WEXITED_LINUX) {
+    r |= WEXITED;
+    x &= ~WEXITED_LINUX;
+  }
+#ifdef WCONTINUED
+  if (x & WCONTINUED_LINUX) {
+    r |= WCONTINUED;
+    x &= ~WCONTINUED_LINUX;
+  }
+#endif
+#ifdef WNOWAIT
+  if (x & WNOWAIT_LINUX) {
+    r |= WNOWAIT;
+    x &= ~WNOWAIT_LINUX;
+  }
+#endif
+  if (x) {
+    LOGF("%s %d not supported yet", "waitid", x);
+    return einval();
+  }
+  return r;
+}
+
 int XlatClock(int x, clock_t *clock) {
   // Haiku defines CLOCK_REALTIME as -1
   clock_t res;
@@ -818,6 +966,11 @@ int UnXlatAccMode(int flags) {
 
 int XlatOpenFlags(int x) {
   int res;
+#ifdef LINUX_OPEN_FLAGS
+  if ((x & O_ACCMODE_LINUX) != O_ACCMODE_LINUX && !(x & ~OPEN_FLAGS_LINUX)) {
+    return x;
+  }
+#endif
   res = XlatAccMode(x);
   x &= ~O_ACCMODE_LINUX;
   if (x & O_APPEND_LINUX) res |= O_APPEND, x &= ~O_APPEND_LINUX;
@@ -892,6 +1045,11 @@ int XlatOpenFlags(int x) {
 
 int UnXlatOpenFlags(int x) {
   int res;
+#ifdef LINUX_OPEN_FLAGS
+  if ((x & O_ACCMODE) != O_ACCMODE) {
+    return (x & OPEN_FLAGS_LINUX) | (O_LARGEFILE ? 0 : O_LARGEFILE_LINUX);
+  }
+#endif
   res = UnXlatAccMode(x);
   if ((x & O_APPEND) == O_APPEND) {
     res |= O_APPEND_LINUX;
@@ -1050,6 +1208,10 @@ int XlatSockaddrToHost(struct sockaddr_storage *dst,
         LOGF("sockaddr size too small for %s", "sockaddr_in_linux");
         return einval();
       }
+      if (LINUX_INET_LAYOUT) {
+        memcpy(dst, src, sizeof(struct sockaddr_in));
+        return sizeof(struct sockaddr_in);
+      }
       dst_in = (struct sockaddr_in *)dst;
       src_in = (const struct sockaddr_in_linux *)src;
       memset(dst_in, 0, sizeof(*dst_in));
@@ -1067,6 +1229,10 @@ int XlatSockaddrToHost(struct sockaddr_storage *dst,
         LOGF("sockaddr size too small for %s", "sockaddr_in6_linux");
         return einval();
       }
+      if (LINUX_INET_LAYOUT) {
+        memcpy(dst, src, sizeof(struct sockaddr_in6));
+        return sizeof(struct sockaddr_in6);
+      }
       dst_in = (struct sockaddr_in6 *)dst;
       src_in = (const struct sockaddr_in6_linux *)src;
       memset(dst_in, 0, sizeof(*dst_in));
@@ -1117,6 +1283,10 @@ int XlatSockaddrToLinux(struct sockaddr_storage_linux *dst,
       LOGF("sockaddr size %d too small for %s", (int)srclen, "sockaddr_in");
       return einval();
     }
+    if (LINUX_INET_LAYOUT) {
+      memcpy(dst, src, sizeof(struct sockaddr_in_linux));
+      return sizeof(struct sockaddr_in_linux);
+    }
     dst_in = (struct sockaddr_in_linux *)dst;
     src_in = (const struct sockaddr_in *)src;
     memset(dst_in, 0, sizeof(*dst_in));
@@ -1131,6 +1301,10 @@ int XlatSockaddrToLinux(struct sockaddr_storage_linux *dst,
       LOGF("sockaddr size %d too small for %s", (int)srclen, "sockaddr_in6");
       return einval();
     }
+    if (LINUX_INET_LAYOUT) {
+      memcpy(dst, src, sizeof(struct sockaddr_in6_linux));
+      return sizeof(struct sockaddr_in6_linux);
+    }
     dst_in = (struct sockaddr_in6_linux *)dst;
     src_in = (const struct sockaddr_in6 *)src;
     memset(dst_in, 0, sizeof(*dst_in));
@@ -1146,6 +1320,11 @@ int XlatSockaddrToLinux(struct sockaddr_storage_linux *dst,
 }
 
 void XlatStatToLinux(struct stat_linux *dst, const struct stat *src) {
+  if (LINUX_STAT_LAYOUT) {
+    memcpy(dst, src, sizeof(*dst));
+    Write32(dst->pad_, 0);
+    return;
+  }
   Write64(dst->dev, src->st_dev);
   Write64(dst->ino, src->st_ino);
   Write64(dst->nlink, src->st_nlink);
@@ -1253,9 +1432,10 @@ void XlatWinsizeToHost(struct winsize *dst, const struct winsize_linux *src) {
 void XlatSigsetToLinux(u8 dst[8], const sigset_t *src) {
   u64 set = 0;
   int syssig, linuxsig;
+  unassert(!pthread_once_(&g_sigtabs.once, InitSignalTables));
   for (syssig = 1; syssig <= MIN(64, TOPSIG); ++syssig) {
-    if (sigismember(src, syssig) == 1 &&
-        (linuxsig = UnXlatSignal(syssig)) != -1) {
+    if ((linuxsig = g_sigtabs.tolinux[syssig]) &&
+        sigismember(src, syssig) == 1) {
       set |= (u64)1 << (linuxsig - 1);
     }
   }
@@ -1265,9 +1445,10 @@ void XlatSigsetToLinux(u8 dst[8], const sigset_t *src) {
 void XlatLinuxToSigset(sigset_t *dst, u64 set) {
   int syssig, linuxsig;
   sigemptyset(dst);
+  unassert(!pthread_once_(&g_sigtabs.once, InitSignalTables));
   for (linuxsig = 1; linuxsig <= MIN(64, TOPSIG); ++linuxsig) {
     if ((((u64)1 << (linuxsig - 1)) & set) &&
-        (syssig = XlatSignal(linuxsig)) != -1) {
+        (syssig = g_sigtabs.tohost[linuxsig])) {
       sigaddset(dst, syssig);
     }
   }
@@ -32,6 +32,7 @@ int XlatSocketOptname(int, int);
 int XlatSocketProtocol(int);
 int XlatSocketType(int);
 int XlatWait(int);
+int XlatWaitid(int);
 int XlatWhence(int);
 
 int XlatSockaddrToHost(struct sockaddr_storage *, const struct sockaddr_linux *,
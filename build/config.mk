@@ -113,6 +113,22 @@ CFLAGS += -pg -O0
 LDFLAGS += -pg -O0
 endif
 
+# make m=pgo
+# o/pgo/blink/blink is built using a profile of the microbenchmarks
+# which blink/blink.mk collects with o/pgo-train/blink/blink (gcc only)
+ifeq ($(MODE), pgo-train)
+PGOFLAGS = -fprofile-generate -fprofile-update=atomic
+CPPFLAGS += -DNDEBUG
+CFLAGS += -O2 $(PGOFLAGS)
+LDFLAGS += -fprofile-generate
+endif
+
+ifeq ($(MODE), pgo)
+PGOFLAGS = -fprofile-use -fprofile-partial-training -Wno-missing-profile
+CPPFLAGS += -DNDEBUG
+CFLAGS += -O2 $(PGOFLAGS)
+endif
+
 # make m=cov check
 # gcov -ukqjo o/cov/blink blink/*.c
 # less alu.c.gcov
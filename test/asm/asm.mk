@@ -49,6 +49,8 @@ o/$(MODE)/test/asm/%.com:						\
 	@echo "o/$(MODE)/blink/blink $< || exit" >>$@
 	@echo "echo [test] o/$(MODE)/blink/blink -m $< >&2" >>$@
 	@echo "o/$(MODE)/blink/blink -m $< || exit" >>$@
+	@echo "echo [test] o/$(MODE)/blink/blink -M $< >&2" >>$@
+	@echo "o/$(MODE)/blink/blink -M $< || exit" >>$@
 	@echo "echo [test] o/$(MODE)/blink/blink -jm $< >&2" >>$@
 	@echo "o/$(MODE)/blink/blink -jm $< || exit" >>$@
 	@echo "echo [test] o/third_party/qemu/4/qemu-x86_64 -cpu core2duo $< >&2" >>$@
@@ -0,0 +1,59 @@
+// integer loop microbenchmarks
+// tests the jit's handling of straight line alu code and branches
+#include "test/bench/bench.h"
+
+// 4 instructions per op: dependent add chain plus loop control
+static void AluAdd(long n) {
+  long x = 0;
+  asm volatile("1:\n\t"
+               "add\t%1,%0\n\t"
+               "add\t$3,%0\n\t"
+               "dec\t%1\n\t"
+               "jnz\t1b"
+               : "+r"(x), "+r"(n)
+               :
+               : "cc");
+}
+
+// 8 instructions per op: independent ops that share flags
+static void AluMix(long n) {
+  long a = 1, b = 2, c = 3;
+  asm volatile("1:\n\t"
+               "lea\t1(%0,%1),%0\n\t"
+               "xor\t%0,%1\n\t"
+               "imul\t%1,%2\n\t"
+               "shl\t$1,%1\n\t"
+               "cmp\t%2,%0\n\t"
+               "cmovb\t%2,%0\n\t"
+               "dec\t%3\n\t"
+               "jnz\t1b"
+               : "+r"(a), "+r"(b), "+r"(c), "+r"(n)
+               :
+               : "cc");
+}
+
+// 7 instructions per op: conditional branches that alternate directions
+static void AluBranch(long n) {
+  long x = 0;
+  asm volatile("1:\n\t"
+               "test\t$1,%1\n\t"
+               "jz\t2f\n\t"
+               "inc\t%0\n"
+               "2:\n\t"
+               "test\t$1,%1\n\t"
+               "jnz\t3f\n\t"
+               "inc\t%0\n"
+               "3:\n\t"
+               "dec\t%1\n\t"
+               "jnz\t1b"
+               : "+r"(x), "+r"(n)
+               :
+               : "cc");
+}
+
+int main(int argc, char *argv[]) {
+  Bench("alu_add", 4, AluAdd);
+  Bench("alu_mix", 8, AluMix);
+  Bench("alu_branch", 7, AluBranch);
+  return 0;
+}
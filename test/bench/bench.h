@@ -0,0 +1,51 @@
+#ifndef TEST_BENCH_BENCH_H_
+#define TEST_BENCH_BENCH_H_
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// shared harness for blink's guest microbenchmarks
+//
+// each kernel is run with a doubling number of iterations until a run
+// takes at least BENCH_MIN_NS, and then one json object is printed per
+// benchmark, so the output of many runs can simply be concatenated:
+//
+//     {"bench":"alu_add","mode":"jit","ops":8388608,"ns_per_op":1.250,
+//      "insns_per_sec":3200000000}
+//
+// insns_per_sec is only reported for kernels written in assembly, for
+// which the number of guest instructions per op is known exactly. the
+// mode field is taken from the BENCH_MODE environment variable, which
+// bench.mk sets to describe the blink flags the benchmark is run with
+
+#define BENCH_MIN_NS 100000000.  // run each kernel for at least 100ms
+#define BENCH_MAX_OPS (1L << 40)
+
+typedef void bench_f(long);
+
+static double BenchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// runs kernel(n) which performs n ops; insns is per op, or 0 if unknown
+static void Bench(const char *name, long insns, bench_f *kernel) {
+  long n;
+  double t, ns;
+  const char *mode;
+  if (!(mode = getenv("BENCH_MODE"))) mode = "unknown";
+  for (n = 1;; n <<= 1) {
+    t = BenchNow();
+    kernel(n);
+    ns = BenchNow() - t;
+    if (ns >= BENCH_MIN_NS || n >= BENCH_MAX_OPS) break;
+  }
+  printf("{\"bench\":\"%s\",\"mode\":\"%s\",\"ops\":%ld,\"ns_per_op\":%.3f",
+         name, mode, n, ns / n);
+  if (insns) printf(",\"insns_per_sec\":%.0f", insns * n / (ns / 1e9));
+  printf("}\n");
+  fflush(stdout);
+}
+
+#endif /* TEST_BENCH_BENCH_H_ */
@@ -0,0 +1,52 @@
+#-*-mode:makefile-gmake;indent-tabs-mode:t;tab-width:8;coding:utf-8-*-┐
+#───vi: set et ft=make ts=8 tw=8 fenc=utf-8 :vi───────────────────────┘
+
+PKGS += TEST_BENCH
+TEST_BENCH_FILES := $(wildcard test/bench/*)
+TEST_BENCH_SRCS = $(filter %.c,$(TEST_BENCH_FILES))
+TEST_BENCH_HDRS = $(filter %.h,$(TEST_BENCH_FILES))
+TEST_BENCH_OBJS = $(TEST_BENCH_SRCS:%.c=o/$(MODE)/x86_64/%.o)
+TEST_BENCH_BINS = $(TEST_BENCH_SRCS:%.c=o/$(MODE)/%.elf)
+
+# each benchmark is run natively, and then under these blink flags
+# which are the same combinations the functional tests are run with
+TEST_BENCH_MODES =							\
+		jit:							\
+		nojit:-j						\
+		nolinear:-m						\
+		nojit-nolinear:-jm
+
+TEST_BENCH_LINK =							\
+		$(VM)							\
+		o/third_party/gcc/x86_64/bin/x86_64-linux-musl-gcc	\
+		-static							\
+		-Wl,-z,max-page-size=65536				\
+		-Wl,-z,common-page-size=65536				\
+		$<							\
+		-o $@
+
+$(TEST_BENCH_OBJS): private CFLAGS = -O2 -g
+$(TEST_BENCH_OBJS): private CPPFLAGS = -iquote.
+
+.PRECIOUS: o/$(MODE)/test/bench/%.elf
+o/$(MODE)/test/bench/%.elf:						\
+		o/$(MODE)/x86_64/test/bench/%.o				\
+		o/third_party/gcc/x86_64/bin/x86_64-linux-musl-gcc	\
+		$(VM)
+	@mkdir -p $(@D)
+	$(TEST_BENCH_LINK)
+
+$(TEST_BENCH_OBJS): test/bench/bench.mk
+
+# make -j8 bench >bench.json
+# prints one json object per line for each benchmark and mode
+.PHONY: o/$(MODE)/test/bench
+o/$(MODE)/test/bench:							\
+		$(TEST_BENCH_BINS)					\
+		o/$(MODE)/blink/blink
+	@for b in $(TEST_BENCH_BINS); do				\
+	  BENCH_MODE=native $(VM) $$b || exit;				\
+	  for m in $(TEST_BENCH_MODES); do				\
+	    BENCH_MODE=$${m%%:*} o/$(MODE)/blink/blink $${m#*:} $$b || exit; \
+	  done;								\
+	done
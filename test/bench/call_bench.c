@@ -0,0 +1,75 @@
+// function call microbenchmarks
+// tests direct call/ret chains and indirect calls through a register
+#include "test/bench/bench.h"
+
+asm(".text\n"
+    "BenchLeaf:\n\t"
+    "ret\n"
+    "BenchDepth1:\n\t"
+    "call\tBenchLeaf\n\t"
+    "ret\n"
+    "BenchDepth2:\n\t"
+    "call\tBenchDepth1\n\t"
+    "ret\n"
+    "BenchDepth3:\n\t"
+    "call\tBenchDepth2\n\t"
+    "ret");
+
+// the calls below are made from inline assembly, so they must step over
+// the red zone in which the compiler is allowed to keep local variables
+#define SKIP_RED_ZONE    "sub\t$128,%%rsp\n"
+#define RESTORE_RED_ZONE "add\t$128,%%rsp"
+
+// 10 instructions per op: four nested calls, four returns, loop control
+static void CallChain(long n) {
+  asm volatile(SKIP_RED_ZONE
+               "1:\n\t"
+               "call\tBenchDepth3\n\t"
+               "dec\t%0\n\t"
+               "jnz\t1b\n\t"
+               RESTORE_RED_ZONE
+               : "+r"(n)
+               :
+               : "cc", "memory");
+}
+
+// 4 instructions per op: indirect call, return, loop control
+static void CallIndirect(long n) {
+  void *f;
+  asm volatile(SKIP_RED_ZONE
+               "lea\tBenchLeaf(%%rip),%1\n"
+               "1:\n\t"
+               "call\t*%1\n\t"
+               "dec\t%0\n\t"
+               "jnz\t1b\n\t"
+               RESTORE_RED_ZONE
+               : "+r"(n), "=&r"(f)
+               :
+               : "cc", "memory");
+}
+
+// 10 instructions per op: one call site whose target alternates
+static void CallPolymorphic(long n) {
+  void *f, *g;
+  asm volatile(SKIP_RED_ZONE
+               "lea\tBenchLeaf(%%rip),%1\n\t"
+               "lea\tBenchDepth1(%%rip),%2\n"
+               "1:\n\t"
+               "xchg\t%1,%2\n\t"
+               "call\t*%1\n\t"
+               "xchg\t%1,%2\n\t"
+               "call\t*%1\n\t"
+               "dec\t%0\n\t"
+               "jnz\t1b\n\t"
+               RESTORE_RED_ZONE
+               : "+r"(n), "=&r"(f), "=&r"(g)
+               :
+               : "cc", "memory");
+}
+
+int main(int argc, char *argv[]) {
+  Bench("call_chain", 10, CallChain);
+  Bench("call_indirect", 4, CallIndirect);
+  Bench("call_polymorphic", 10, CallPolymorphic);
+  return 0;
+}
@@ -0,0 +1,30 @@
+// process creation microbenchmark
+// tests fork() followed by execve() which means loading a new program
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "test/bench/bench.h"
+
+static char *g_prog;
+
+static void ForkExec(long n) {
+  int ws;
+  pid_t pid;
+  char *args[] = {g_prog, "child", 0};
+  while (n--) {
+    if ((pid = fork()) == -1) exit(1);
+    if (!pid) {
+      execv(g_prog, args);
+      _exit(127);
+    }
+    if (waitpid(pid, &ws, 0) == -1 || ws) exit(2);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1 && !strcmp(argv[1], "child")) return 0;
+  g_prog = argv[0];
+  Bench("fork_exec", 0, ForkExec);
+  return 0;
+}
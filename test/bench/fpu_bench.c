@@ -0,0 +1,73 @@
+// floating point microbenchmarks
+// tests sse kernels and the x87 floating point unit
+#include "test/bench/bench.h"
+
+static float g_a[64] __attribute__((__aligned__(16)));
+static float g_b[64] __attribute__((__aligned__(16)));
+
+// 8 instructions per op: packed single precision multiply accumulate
+static void SseMulAdd(long n) {
+  asm volatile("movaps\t%1,%%xmm0\n\t"
+               "movaps\t%2,%%xmm1\n\t"
+               "xorps\t%%xmm2,%%xmm2\n"
+               "1:\n\t"
+               "movaps\t%%xmm0,%%xmm3\n\t"
+               "mulps\t%%xmm1,%%xmm3\n\t"
+               "addps\t%%xmm3,%%xmm2\n\t"
+               "movaps\t%%xmm1,%%xmm4\n\t"
+               "addps\t%%xmm0,%%xmm4\n\t"
+               "maxps\t%%xmm4,%%xmm2\n\t"
+               "dec\t%0\n\t"
+               "jnz\t1b"
+               : "+r"(n)
+               : "m"(g_a), "m"(g_b)
+               : "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4");
+}
+
+// 7 instructions per op: packed integer ops on a 64 byte array
+static void SseInteger(long n) {
+  asm volatile("pxor\t%%xmm2,%%xmm2\n"
+               "1:\n\t"
+               "movdqa\t%1,%%xmm0\n\t"
+               "movdqa\t16+%1,%%xmm1\n\t"
+               "paddd\t%%xmm1,%%xmm0\n\t"
+               "pshufd\t$0x1b,%%xmm0,%%xmm0\n\t"
+               "pxor\t%%xmm0,%%xmm2\n\t"
+               "dec\t%0\n\t"
+               "jnz\t1b"
+               : "+r"(n)
+               : "m"(g_b)
+               : "cc", "xmm0", "xmm1", "xmm2");
+}
+
+// 5 instructions per op: x87 multiply add on the register stack
+static void X87MulAdd(long n) {
+  static const double kX = 1.0000001, kY = 0.5;
+  asm volatile("fldl\t%1\n\t"
+               "fldl\t%2\n\t"
+               "fldz\n"
+               "1:\n\t"
+               "fld\t%%st(2)\n\t"
+               "fmul\t%%st(2),%%st\n\t"
+               "faddp\n\t"
+               "dec\t%0\n\t"
+               "jnz\t1b\n\t"
+               "fstp\t%%st\n\t"
+               "fstp\t%%st\n\t"
+               "fstp\t%%st"
+               : "+r"(n)
+               : "m"(kX), "m"(kY)
+               : "cc", "st", "st(1)", "st(2)", "memory");
+}
+
+int main(int argc, char *argv[]) {
+  int i;
+  for (i = 0; i < 64; ++i) {
+    g_a[i] = i * .5f;
+    g_b[i] = i * .25f;
+  }
+  Bench("sse_muladd", 8, SseMulAdd);
+  Bench("sse_integer", 7, SseInteger);
+  Bench("x87_muladd", 5, X87MulAdd);
+  return 0;
+}
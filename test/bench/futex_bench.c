@@ -0,0 +1,52 @@
+// futex microbenchmark
+// tests waking and waiting between two threads that take turns
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "test/bench/bench.h"
+
+static _Atomic(int) g_turn;
+static _Atomic(long) g_rounds;
+
+static void Wait(int *uaddr, int val) {
+  syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, 0, 0, 0);
+}
+
+static void Wake(int *uaddr) {
+  syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+}
+
+// waits until it's our turn then hands the turn back to the other side
+static void Play(int me, int other, long n) {
+  int turn;
+  while (n--) {
+    while ((turn = atomic_load(&g_turn)) != me) {
+      Wait((int *)&g_turn, turn);
+    }
+    atomic_store(&g_turn, other);
+    Wake((int *)&g_turn);
+  }
+}
+
+static void *Partner(void *arg) {
+  Play(1, 0, g_rounds);
+  return 0;
+}
+
+// one op is a round trip where each thread wakes the other once
+static void FutexPingPong(long n) {
+  pthread_t th;
+  g_rounds = n;
+  atomic_store(&g_turn, 0);
+  if (pthread_create(&th, 0, Partner, 0)) exit(1);
+  Play(0, 1, n);
+  pthread_join(th, 0);
+}
+
+int main(int argc, char *argv[]) {
+  Bench("futex_pingpong", 0, FutexPingPong);
+  return 0;
+}
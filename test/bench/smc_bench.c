@@ -0,0 +1,45 @@
+// self-modifying code microbenchmark
+// tests rewriting an instruction immediate in between executing it
+#include <string.h>
+#include <sys/mman.h>
+
+#include "test/bench/bench.h"
+
+const unsigned char kFunc[] = {
+    0xb8, 0x00, 0x00, 0x00, 0x00,  // mov $imm,%eax
+    0xc3,                          // ret
+};
+
+typedef int func_f(void);
+
+static unsigned char *g_code;
+
+// patches the immediate and then calls the code it's part of
+static void SmcPatch(long n) {
+  int i;
+  for (i = 0; n--; ++i) {
+    memcpy(g_code + 1, &i, 4);
+    if (((func_f *)g_code)() != i) exit(1);
+  }
+}
+
+// calls code which lives in the same page as memory that gets written
+static void SmcSamePage(long n) {
+  int i;
+  for (i = 0; n--; ++i) {
+    memcpy(g_code + 2048, &i, 4);
+    if (((func_f *)g_code)() != 0x7f) exit(1);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int imm = 0x7f;
+  g_code = (unsigned char *)mmap(0, 4096, PROT_READ | PROT_WRITE | PROT_EXEC,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (g_code == MAP_FAILED) return 1;
+  memcpy(g_code, kFunc, sizeof(kFunc));
+  Bench("smc_patch", 0, SmcPatch);
+  memcpy(g_code + 1, &imm, 4);
+  Bench("smc_same_page", 0, SmcSamePage);
+  return 0;
+}
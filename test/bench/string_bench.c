@@ -0,0 +1,38 @@
+// string function microbenchmarks
+// tests the c library's memcpy() and strlen() as the guest compiled them
+#include <string.h>
+
+#include "test/bench/bench.h"
+
+static char g_src[4096];
+static char g_dst[4096];
+
+static void Memcpy64(long n) {
+  while (n--) {
+    memcpy(g_dst, g_src, 64);
+    asm volatile("" : : "r"(g_dst) : "memory");
+  }
+}
+
+static void Memcpy4k(long n) {
+  while (n--) {
+    memcpy(g_dst, g_src, 4096);
+    asm volatile("" : : "r"(g_dst) : "memory");
+  }
+}
+
+static void Strlen1k(long n) {
+  size_t len;
+  while (n--) {
+    len = strlen(g_src);
+    asm volatile("" : : "r"(len) : "memory");
+  }
+}
+
+int main(int argc, char *argv[]) {
+  memset(g_src, 'x', 1024);
+  Bench("memcpy_64", 0, Memcpy64);
+  Bench("memcpy_4096", 0, Memcpy4k);
+  Bench("strlen_1024", 0, Strlen1k);
+  return 0;
+}
@@ -0,0 +1,51 @@
+// system call microbenchmarks
+// tests the cost of entering blink's system call emulation
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "test/bench/bench.h"
+
+// 4 instructions per op: getppid() round trip with no libc wrapper
+static void SyscallGetppid(long n) {
+  long ax;
+  asm volatile("1:\n\t"
+               "mov\t$110,%%eax\n\t"
+               "syscall\n\t"
+               "dec\t%1\n\t"
+               "jnz\t1b"
+               : "=&a"(ax), "+r"(n)
+               :
+               : "cc", "rcx", "r11", "memory");
+}
+
+// maps, touches, and unmaps a page, which churns the guest page tables
+static void MmapChurn(long n) {
+  char *p;
+  while (n--) {
+    p = (char *)mmap(0, 4096, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) exit(1);
+    *p = 1;
+    munmap(p, 4096);
+  }
+}
+
+// same but with a larger mapping that's only partially touched
+static void MmapChurn1m(long n) {
+  char *p;
+  while (n--) {
+    p = (char *)mmap(0, 1048576, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) exit(1);
+    p[0] = 1;
+    p[524288] = 1;
+    munmap(p, 1048576);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  Bench("syscall_getppid", 4, SyscallGetppid);
+  Bench("mmap_munmap_4k", 0, MmapChurn);
+  Bench("mmap_munmap_1m", 0, MmapChurn1m);
+  return 0;
+}
@@ -0,0 +1,182 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/coredump.h"
+#include "blink/elf.h"
+#include "blink/endian.h"
+#include "blink/flag.h"
+#include "blink/linux.h"
+#include "blink/loader.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/map.h"
+#include "blink/overlays.h"
+#include "blink/vfs.h"
+#include "test/test.h"
+
+#define kBase 0x400000
+#define kCode 120  // after elf header and the one program header
+#define kData 0x10000000
+
+// offsets within struct elf_prstatus of the registers we check
+#define kPrstatusRbx (112 + 5 * 8)
+#define kPrstatusRip (112 + 16 * 8)
+
+// mov %rbx,0
+const u8 kCrash[] = {
+    0x48, 0x89, 0x1c, 0x25, 0x00, 0x00, 0x00, 0x00,
+};
+
+char prog[] = "/tmp/blink.test.XXXXXX";
+char core[sizeof(prog) + 5];
+char arg0[] = "guest";
+char *args[] = {arg0, 0};
+char *envs[] = {0};
+struct Machine *m;
+
+// writes the smallest static x86-64 elf executable blink will load
+static void WriteProgram(char *path, const u8 *code, size_t size) {
+  int fd;
+  u8 b[kCode + 16] = {0x7f, 'E', 'L', 'F', 2, 1, 1};
+  memcpy(b + kCode, code, size);
+  Write16(b + 16, 2);                  // e_type = ET_EXEC
+  Write16(b + 18, 62);                 // e_machine = EM_X86_64
+  Write32(b + 20, 1);                  // e_version
+  Write64(b + 24, kBase + kCode);      // e_entry
+  Write64(b + 32, 64);                 // e_phoff
+  Write16(b + 52, 64);                 // e_ehsize
+  Write16(b + 54, 56);                 // e_phentsize
+  Write16(b + 56, 1);                  // e_phnum
+  Write32(b + 64 + 0, 1);              // p_type = PT_LOAD
+  Write32(b + 64 + 4, 5);              // p_flags = PF_R|PF_X
+  Write64(b + 64 + 16, kBase);         // p_vaddr
+  Write64(b + 64 + 24, kBase);         // p_paddr
+  Write64(b + 64 + 32, kCode + size);  // p_filesz
+  Write64(b + 64 + 40, kCode + size);  // p_memsz
+  Write64(b + 64 + 48, 4096);          // p_align
+  ASSERT_NE(-1, (fd = mkstemp(path)));
+  ASSERT_EQ(kCode + size, write(fd, b, kCode + size));
+  ASSERT_EQ(0, fchmod(fd, 0755));
+  ASSERT_EQ(0, close(fd));
+}
+
+// returns contents of file, which is garbage collected
+static u8 *ReadCore(const char *path, size_t *size) {
+  int fd;
+  u8 *p;
+  struct stat st;
+  ASSERT_NE(-1, (fd = open(path, O_RDONLY)));
+  ASSERT_EQ(0, fstat(fd, &st));
+  ASSERT_TRUE((p = (u8 *)Gc(malloc(st.st_size))));
+  ASSERT_EQ(st.st_size, read(fd, p, st.st_size));
+  ASSERT_EQ(0, close(fd));
+  *size = st.st_size;
+  return p;
+}
+
+void SetUp(void) {
+  static bool once;
+  if (!once) {
+    WriteErrorInit();
+    InitMap();
+    FLAG_nolinear = true;
+#ifndef DISABLE_OVERLAYS
+    unassert(!SetOverlays(DEFAULT_OVERLAYS, true));
+#endif
+#ifndef DISABLE_VFS
+    unassert(!VfsInit(FLAG_prefix));
+#endif
+    once = true;
+  }
+  WriteProgram(prog, kCrash, sizeof(kCrash));
+  snprintf(core, sizeof(core), "%s.core", prog);
+  FLAG_core = core;
+  unassert((g_machine = m = NewMachine(NewSystem(XED_MACHINE_MODE_LONG), 0)));
+  LoadProgram(m, prog, prog, args, envs, NULL);
+}
+
+void TearDown(void) {
+  FreeMachine(m);
+  g_machine = 0;
+  FLAG_core = 0;
+  unlink(core);
+  unlink(prog);
+  strcpy(prog, "/tmp/blink.test.XXXXXX");
+}
+
+TEST(DumpCore, ignoresSignalsThatDontDumpCore) {
+  DumpCore(m, SIGTERM_LINUX);
+  ASSERT_EQ(-1, access(core, F_OK));
+}
+
+TEST(DumpCore, crashedGuestHasNotesAndMemory) {
+  size_t size;
+  i64 i, phnum;
+  u8 *p, *note, *load;
+  Elf64_Ehdr_ *eh;
+  Elf64_Phdr_ *ph;
+  Elf64_Nhdr_ *nh;
+  char data[] = "hello core";
+  ASSERT_EQ(kData, ReserveVirtual(m->system, kData, 4096,
+                                  PAGE_U | PAGE_RW | PAGE_XD, -1, 0, 0, 0));
+  ASSERT_EQ(0, CopyToUserWrite(m, kData + 100, data, sizeof(data)));
+  // this is where the guest is when its store to null faults
+  Write64(m->bx, 0x0123456789abcdef);
+  DumpCore(m, SIGSEGV_LINUX);
+  p = ReadCore(core, &size);
+  ASSERT_GE(size, sizeof(*eh));
+  eh = (Elf64_Ehdr_ *)p;
+  ASSERT_EQ(0, memcmp(eh->ident, ELFMAG_, SELFMAG_));
+  ASSERT_EQ(ET_CORE_, Read16(eh->type));
+  ASSERT_EQ(EM_NEXGEN32E_, Read16(eh->machine));
+  phnum = Read16(eh->phnum);
+  ASSERT_LE(Read64(eh->phoff) + phnum * sizeof(*ph), size);
+  note = load = 0;
+  for (i = 0; i < phnum; ++i) {
+    ph = (Elf64_Phdr_ *)(p + Read64(eh->phoff)) + i;
+    ASSERT_LE(Read64(ph->offset) + Read64(ph->filesz), size);
+    if (Read32(ph->type) == PT_NOTE_) {
+      note = p + Read64(ph->offset);
+    } else if (Read32(ph->type) == PT_LOAD_ &&
+               Read64(ph->vaddr) <= kData &&
+               kData + 4096 <= Read64(ph->vaddr) + Read64(ph->filesz)) {
+      load = p + Read64(ph->offset) + (kData - Read64(ph->vaddr));
+      EXPECT_EQ(PF_R_ | PF_W_, Read32(ph->flags));
+    }
+  }
+  // the thread that crashed goes first
+  ASSERT_TRUE(note);
+  nh = (Elf64_Nhdr_ *)note;
+  ASSERT_EQ(NT_PRSTATUS_, Read32(nh->type));
+  ASSERT_EQ(5, Read32(nh->namesz));
+  EXPECT_STREQ("CORE", (char *)(nh + 1));
+  note = (u8 *)(nh + 1) + 8;
+  EXPECT_EQ(kBase + kCode, Read64(note + kPrstatusRip));
+  EXPECT_EQ(0x0123456789abcdef, Read64(note + kPrstatusRbx));
+  // memory that the guest wrote comes back
+  ASSERT_TRUE(load);
+  EXPECT_STREQ(data, (char *)load + 100);
+}
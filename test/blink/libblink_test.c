@@ -0,0 +1,146 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TEST_LIBBLINK
+#include "blink/endian.h"
+#include "blink/libblink.h"
+#include "test/test.h"
+
+#ifdef HAVE_THREADS
+
+#define kBase 0x400000
+#define kCode 120  // after elf header and the one program header
+
+// exit_group(42)
+const u8 kExit42[] = {
+    0xbf, 0x2a, 0x00, 0x00, 0x00,  // mov $42,%edi
+    0xb8, 0xe7, 0x00, 0x00, 0x00,  // mov $231,%eax
+    0x0f, 0x05,                    // syscall
+};
+
+// for (;;)
+const u8 kForever[] = {
+    0xeb, 0xfe,  // jmp .
+};
+
+char exit42[] = "/tmp/blink.test.XXXXXX";
+char forever[] = "/tmp/blink.test.XXXXXX";
+char arg0[] = "guest";
+char *args[] = {arg0, 0};
+char *envs[] = {0};
+
+// writes the smallest static x86-64 elf executable blink will load
+static void WriteProgram(char *path, const u8 *code, size_t size) {
+  int fd;
+  u8 b[kCode + 16] = {0x7f, 'E', 'L', 'F', 2, 1, 1};
+  memcpy(b + kCode, code, size);
+  Write16(b + 16, 2);                    // e_type = ET_EXEC
+  Write16(b + 18, 62);                   // e_machine = EM_X86_64
+  Write32(b + 20, 1);                    // e_version
+  Write64(b + 24, kBase + kCode);        // e_entry
+  Write64(b + 32, 64);                   // e_phoff
+  Write16(b + 52, 64);                   // e_ehsize
+  Write16(b + 54, 56);                   // e_phentsize
+  Write16(b + 56, 1);                    // e_phnum
+  Write32(b + 64 + 0, 1);                // p_type = PT_LOAD
+  Write32(b + 64 + 4, 5);                // p_flags = PF_R|PF_X
+  Write64(b + 64 + 16, kBase);           // p_vaddr
+  Write64(b + 64 + 24, kBase);           // p_paddr
+  Write64(b + 64 + 32, kCode + size);    // p_filesz
+  Write64(b + 64 + 40, kCode + size);    // p_memsz
+  Write64(b + 64 + 48, 4096);            // p_align
+  ASSERT_NE(-1, (fd = mkstemp(path)));
+  ASSERT_EQ(kCode + size, write(fd, b, kCode + size));
+  ASSERT_EQ(0, fchmod(fd, 0755));
+  ASSERT_EQ(0, close(fd));
+}
+
+void SetUp(void) {
+  ASSERT_EQ(0, InitGuests());
+  WriteProgram(exit42, kExit42, sizeof(kExit42));
+  WriteProgram(forever, kForever, sizeof(kForever));
+}
+
+void TearDown(void) {
+  unlink(exit42);
+  unlink(forever);
+  strcpy(exit42, "/tmp/blink.test.XXXXXX");
+  strcpy(forever, "/tmp/blink.test.XXXXXX");
+}
+
+TEST(libblink, exitStatusIsReturned) {
+  int ws;
+  struct Guest *g;
+  ASSERT_NOTNULL((g = NewGuest()));
+  ASSERT_EQ(0, LoadGuest(g, exit42, args, envs));
+  ws = RunGuest(g, 0);
+  EXPECT_TRUE(WIFEXITED(ws));
+  EXPECT_EQ(42, WEXITSTATUS(ws));
+  FreeGuest(g);
+}
+
+TEST(libblink, guestIsPausedWhenTimeSliceRunsOut) {
+  struct Guest *g;
+  ASSERT_NOTNULL((g = NewGuest()));
+  ASSERT_EQ(0, LoadGuest(g, forever, args, envs));
+  ASSERT_EQ(-1, RunGuest(g, 10));
+  ASSERT_EQ(ETIMEDOUT, errno);
+  ASSERT_EQ(-1, RunGuest(g, 10));
+  ASSERT_EQ(ETIMEDOUT, errno);
+  FreeGuest(g);
+}
+
+TEST(libblink, manyGuestsAtOnce) {
+  int i, ws;
+  struct Guest *g[4];
+  for (i = 0; i < 4; ++i) {
+    ASSERT_NOTNULL((g[i] = NewGuest()));
+    ASSERT_EQ(0, LoadGuest(g[i], i & 1 ? forever : exit42, args, envs));
+  }
+  for (i = 0; i < 4; ++i) {
+    ws = RunGuest(g[i], i & 1 ? 10 : 0);
+    if (i & 1) {
+      EXPECT_EQ(-1, ws);
+    } else {
+      EXPECT_TRUE(WIFEXITED(ws));
+      EXPECT_EQ(42, WEXITSTATUS(ws));
+    }
+  }
+  for (i = 0; i < 4; ++i) {
+    FreeGuest(g[i]);
+  }
+}
+
+#else /* HAVE_THREADS */
+
+// libblink needs threads, so there's nothing to test without them
+void SetUp(void) {
+}
+
+void TearDown(void) {
+}
+
+#endif /* HAVE_THREADS */
@@ -0,0 +1,157 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blink/assert.h"
+#include "blink/endian.h"
+#include "blink/flag.h"
+#include "blink/loader.h"
+#include "blink/log.h"
+#include "blink/machine.h"
+#include "blink/map.h"
+#include "blink/overlays.h"
+#include "blink/snapshot.h"
+#include "blink/vfs.h"
+#include "test/test.h"
+
+#define kBase 0x400000
+#define kCode 120  // after elf header and the one program header
+#define kData 0x10000000
+
+// exit_group(42)
+const u8 kExit42[] = {
+    0xbf, 0x2a, 0x00, 0x00, 0x00,  // mov $42,%edi
+    0xb8, 0xe7, 0x00, 0x00, 0x00,  // mov $231,%eax
+    0x0f, 0x05,                    // syscall
+};
+
+char prog[] = "/tmp/blink.test.XXXXXX";
+char snap[sizeof(prog) + 5];
+char arg0[] = "guest";
+char *args[] = {arg0, 0};
+char *envs[] = {0};
+struct Machine *m;
+
+// writes the smallest static x86-64 elf executable blink will load
+static void WriteProgram(char *path, const u8 *code, size_t size) {
+  int fd;
+  u8 b[kCode + 16] = {0x7f, 'E', 'L', 'F', 2, 1, 1};
+  memcpy(b + kCode, code, size);
+  Write16(b + 16, 2);                  // e_type = ET_EXEC
+  Write16(b + 18, 62);                 // e_machine = EM_X86_64
+  Write32(b + 20, 1);                  // e_version
+  Write64(b + 24, kBase + kCode);      // e_entry
+  Write64(b + 32, 64);                 // e_phoff
+  Write16(b + 52, 64);                 // e_ehsize
+  Write16(b + 54, 56);                 // e_phentsize
+  Write16(b + 56, 1);                  // e_phnum
+  Write32(b + 64 + 0, 1);              // p_type = PT_LOAD
+  Write32(b + 64 + 4, 5);              // p_flags = PF_R|PF_X
+  Write64(b + 64 + 16, kBase);         // p_vaddr
+  Write64(b + 64 + 24, kBase);         // p_paddr
+  Write64(b + 64 + 32, kCode + size);  // p_filesz
+  Write64(b + 64 + 40, kCode + size);  // p_memsz
+  Write64(b + 64 + 48, 4096);          // p_align
+  ASSERT_NE(-1, (fd = mkstemp(path)));
+  ASSERT_EQ(kCode + size, write(fd, b, kCode + size));
+  ASSERT_EQ(0, fchmod(fd, 0755));
+  ASSERT_EQ(0, close(fd));
+}
+
+void SetUp(void) {
+  static bool once;
+  if (!once) {
+    WriteErrorInit();
+    InitMap();
+    FLAG_nolinear = true;
+#ifndef DISABLE_OVERLAYS
+    unassert(!SetOverlays(DEFAULT_OVERLAYS, true));
+#endif
+#ifndef DISABLE_VFS
+    unassert(!VfsInit(FLAG_prefix));
+#endif
+    once = true;
+  }
+  WriteProgram(prog, kExit42, sizeof(kExit42));
+  snprintf(snap, sizeof(snap), "%s.snap", prog);
+  FLAG_snapshot = snap;
+  unassert((g_machine = m = NewMachine(NewSystem(XED_MACHINE_MODE_LONG), 0)));
+}
+
+void TearDown(void) {
+  FreeMachine(m);
+  g_machine = 0;
+  FLAG_snapshot = 0;
+  unlink(snap);
+  unlink(prog);
+  strcpy(prog, "/tmp/blink.test.XXXXXX");
+}
+
+TEST(snapshot, restoresRegistersAndMemory) {
+  u8 code[sizeof(kExit42)];
+  char data[] = "hello snapshot";
+  char back[sizeof(data)];
+  ASSERT_FALSE(RestoreSnapshot(m, prog, args));  // arms it
+  LoadProgram(m, prog, prog, args, envs, NULL);
+  ASSERT_EQ(kData, ReserveVirtual(m->system, kData, 4096,
+                                  PAGE_U | PAGE_RW | PAGE_XD, -1, 0, 0, 0));
+  ASSERT_EQ(0, CopyToUserWrite(m, kData + 100, data, sizeof(data)));
+  m->ip = kBase + kCode + 5;
+  Write64(m->ax, 62);  // kill() that asked for the snapshot
+  Write64(m->bx, 0x0123456789abcdef);
+  Write64(m->r15, 0xfedcba9876543210);
+  Write64(m->xmm[3], 0x5555aaaa5555aaaa);
+  m->flags |= 1;  // carry
+  ASSERT_EQ(0, TakeSnapshot(m));
+  FreeMachine(m);
+  unassert((g_machine = m = NewMachine(NewSystem(XED_MACHINE_MODE_LONG), 0)));
+  ASSERT_TRUE(RestoreSnapshot(m, prog, args));
+  EXPECT_EQ(kBase + kCode + 5, m->ip);
+  EXPECT_EQ(0, Read64(m->ax));
+  EXPECT_EQ(0x0123456789abcdef, Read64(m->bx));
+  EXPECT_EQ(0xfedcba9876543210, Read64(m->r15));
+  EXPECT_EQ(0x5555aaaa5555aaaa, Read64(m->xmm[3]));
+  EXPECT_EQ(1, m->flags & 1);
+  ASSERT_EQ(0, CopyFromUserRead(m, back, kData + 100, sizeof(back)));
+  EXPECT_STREQ(data, back);
+  ASSERT_EQ(0, CopyFromUserRead(m, code, kBase + kCode, sizeof(code)));
+  EXPECT_EQ(0, memcmp(kExit42, code, sizeof(code)));
+}
+
+TEST(snapshot, isOnlyTakenOncePerRun) {
+  ASSERT_FALSE(RestoreSnapshot(m, prog, args));
+  LoadProgram(m, prog, prog, args, envs, NULL);
+  ASSERT_EQ(0, TakeSnapshot(m));
+  ASSERT_EQ(-1, TakeSnapshot(m));
+}
+
+TEST(snapshot, isIgnoredForOtherArguments) {
+  char arg1[] = "other";
+  char *args2[] = {arg0, arg1, 0};
+  ASSERT_FALSE(RestoreSnapshot(m, prog, args));
+  LoadProgram(m, prog, prog, args, envs, NULL);
+  ASSERT_EQ(0, TakeSnapshot(m));
+  FreeMachine(m);
+  unassert((g_machine = m = NewMachine(NewSystem(XED_MACHINE_MODE_LONG), 0)));
+  ASSERT_FALSE(RestoreSnapshot(m, prog, args2));
+}
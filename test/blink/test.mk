@@ -180,13 +180,25 @@ o/$(MODE)/powerpc/test/blink/disinst_test.com: o/$(MODE)/powerpc/test/blink/disi
 o/$(MODE)/powerpc64le/test/blink/disinst_test.com: o/$(MODE)/powerpc64le/test/blink/disinst_test.o o/$(MODE)/powerpc64le/blink/blink.a
 	o/third_party/gcc/powerpc64le/bin/powerpc64le-linux-musl-gcc -static $(LDFLAGS) $(TARGET_ARCH) $^ $(LOADLIBES) $(LDLIBS) -o $@
 
+o/$(MODE)/test/blink/snapshot_test.com: o/$(MODE)/test/blink/snapshot_test.o o/$(MODE)/blink/blink.a
+	$(CC) $(LDFLAGS) $(TARGET_ARCH) $^ $(LOADLIBES) $(LDLIBS) -o $@
+
+o/$(MODE)/test/blink/coredump_test.com: o/$(MODE)/test/blink/coredump_test.o o/$(MODE)/blink/blink.a
+	$(CC) $(LDFLAGS) $(TARGET_ARCH) $^ $(LOADLIBES) $(LDLIBS) -o $@
+
+o/$(MODE)/test/blink/libblink_test.com: o/$(MODE)/test/blink/libblink_test.o o/$(MODE)/blink/libblink.a
+	$(CC) $(LDFLAGS) $(TARGET_ARCH) $^ $(LOADLIBES) $(LDLIBS) -o $@
+
 o/$(MODE)/test/blink:							\
 		$(TEST_BLINK_OBJS)					\
 		o/$(MODE)/test/blink/divmul_test.com.runs		\
 		o/$(MODE)/test/blink/modrm_test.com.runs		\
 		o/$(MODE)/test/blink/x86_test.com.runs			\
 		o/$(MODE)/test/blink/ldbl_test.com.runs			\
-		o/$(MODE)/test/blink/disinst_test.com.runs
+		o/$(MODE)/test/blink/disinst_test.com.runs		\
+		o/$(MODE)/test/blink/snapshot_test.com.runs		\
+		o/$(MODE)/test/blink/coredump_test.com.runs		\
+		o/$(MODE)/test/blink/libblink_test.com.runs
 
 o/$(MODE)/test/blink/emulates:						\
 		o/$(MODE)/blink/blink					\
@@ -0,0 +1,109 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include "test/test.h"
+
+int fd;
+
+void SetUp(void) {
+}
+
+void TearDown(void) {
+  close(fd);
+}
+
+TEST(eventfd, counter) {
+  u64 x;
+  ASSERT_NE(-1, (fd = eventfd(3, EFD_CLOEXEC)));
+  x = 4;
+  ASSERT_EQ(8, write(fd, &x, 8));
+  ASSERT_EQ(8, read(fd, &x, 8));
+  ASSERT_EQ(7, x);
+  x = 1;
+  ASSERT_EQ(8, write(fd, &x, 8));
+  ASSERT_EQ(8, read(fd, &x, 8));
+  ASSERT_EQ(1, x);
+}
+
+TEST(eventfd, short_buffers) {
+  u32 x = 1;
+  ASSERT_NE(-1, (fd = eventfd(0, 0)));
+  ASSERT_EQ(-1, write(fd, &x, 4));
+  ASSERT_EQ(EINVAL, errno);
+  ASSERT_EQ(-1, read(fd, &x, 4));
+  ASSERT_EQ(EINVAL, errno);
+}
+
+TEST(eventfd, nonblock) {
+  u64 x;
+  ASSERT_NE(-1, (fd = eventfd(0, EFD_NONBLOCK)));
+  ASSERT_EQ(-1, read(fd, &x, 8));
+  ASSERT_EQ(EAGAIN, errno);
+  // the counter saturates one below the maximum
+  x = 0xfffffffffffffffe;
+  ASSERT_EQ(8, write(fd, &x, 8));
+  x = 1;
+  ASSERT_EQ(-1, write(fd, &x, 8));
+  ASSERT_EQ(EAGAIN, errno);
+  x = -1;
+  ASSERT_EQ(-1, write(fd, &x, 8));
+  ASSERT_EQ(EINVAL, errno);
+}
+
+TEST(eventfd, semaphore) {
+  u64 x;
+  ASSERT_NE(-1, (fd = eventfd(2, EFD_SEMAPHORE | EFD_NONBLOCK)));
+  ASSERT_EQ(8, read(fd, &x, 8));
+  ASSERT_EQ(1, x);
+  ASSERT_EQ(8, read(fd, &x, 8));
+  ASSERT_EQ(1, x);
+  ASSERT_EQ(-1, read(fd, &x, 8));
+  ASSERT_EQ(EAGAIN, errno);
+}
+
+TEST(eventfd, poll) {
+  u64 x;
+  struct pollfd pfd;
+  ASSERT_NE(-1, (fd = eventfd(0, EFD_NONBLOCK)));
+  pfd.fd = fd;
+  pfd.events = POLLIN | POLLOUT;
+  ASSERT_EQ(1, poll(&pfd, 1, 0));
+  ASSERT_EQ(POLLOUT, pfd.revents);
+  x = 5;
+  ASSERT_EQ(8, write(fd, &x, 8));
+  ASSERT_EQ(1, poll(&pfd, 1, 0));
+  ASSERT_EQ(POLLIN | POLLOUT, pfd.revents);
+}
+
+TEST(eventfd, fork) {
+  u64 x;
+  int ws, pid;
+  ASSERT_NE(-1, (fd = eventfd(0, 0)));
+  ASSERT_NE(-1, (pid = fork()));
+  if (!pid) {
+    x = 42;
+    _exit(write(fd, &x, 8) != 8);
+  }
+  ASSERT_EQ(8, read(fd, &x, 8));
+  ASSERT_EQ(42, x);
+  ASSERT_EQ(pid, waitpid(pid, &ws, 0));
+  ASSERT_EQ(0, ws);
+}
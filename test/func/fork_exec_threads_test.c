@@ -0,0 +1,78 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * threads that exit get pooled by blink, so this checks a forked child
+ * can still execve() after the pooled threads vanished with the fork()
+ */
+
+#define THREADS 4
+
+#define PCHECK(x)  \
+  do {             \
+    int rc_ = (x); \
+    if (rc_) {     \
+      errno = rc_; \
+      perror(#x);  \
+      exit(1);     \
+    }              \
+  } while (0)
+
+static void *Worker(void *arg) {
+  return arg;
+}
+
+int main(int argc, char *argv[]) {
+  int i, ws;
+  pid_t pid;
+  pthread_t th[THREADS];
+  if (argc > 1 && !strcmp(argv[1], "child")) {
+    exit(42);
+  }
+  for (i = 0; i < THREADS; ++i) {
+    PCHECK(pthread_create(th + i, 0, Worker, 0));
+  }
+  for (i = 0; i < THREADS; ++i) {
+    PCHECK(pthread_join(th[i], 0));
+  }
+  if ((pid = fork()) == -1) {
+    perror("fork");
+    exit(2);
+  }
+  if (!pid) {
+    execl(argv[0], argv[0], "child", (char *)0);
+    _exit(127);
+  }
+  if (waitpid(pid, &ws, 0) == -1) {
+    perror("waitpid");
+    exit(3);
+  }
+  if (!WIFEXITED(ws) || WEXITSTATUS(ws) != 42) {
+    fprintf(stderr, "child didn't execve properly (status %#x)\n", ws);
+    exit(4);
+  }
+  return 0;
+}
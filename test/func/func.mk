@@ -63,6 +63,8 @@ o/$(MODE)/test/func/%.com:						\
 	@echo "o/$(MODE)/blink/blink -jm $< || exit" >>$@
 	@echo "echo [test] o/$(MODE)/blink/blink -m $< >&2" >>$@
 	@echo "o/$(MODE)/blink/blink -m $< || exit" >>$@
+	@echo "echo [test] o/$(MODE)/blink/blink -M $< >&2" >>$@
+	@echo "o/$(MODE)/blink/blink -M $< || exit" >>$@
 	@echo "echo [test] o/$(MODE)/blink/blink -j $< >&2" >>$@
 	@echo "o/$(MODE)/blink/blink -j $< || exit" >>$@
 	@echo "echo [test] o/$(MODE)/blink/blink -L/dev/null -sss $< >&2" >>$@
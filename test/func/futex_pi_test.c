@@ -0,0 +1,247 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#include "test/test.h"
+
+struct Lock {
+  u64 next;  // robust list entry
+  u32 word;  // futex lock word, which is owned when it holds our tid
+};
+
+struct RobustHead {
+  u64 next;
+  i64 offset;
+  u64 pending;
+};
+
+u32 word;
+int ready;
+struct Lock lock;
+struct RobustHead head;
+
+long Futex(u32 *uaddr, int op, u32 val, const struct timespec *ts) {
+  return syscall(SYS_futex, uaddr, op, val, ts, 0, 0);
+}
+
+int Gettid(void) {
+  return syscall(SYS_gettid);
+}
+
+u32 LoadWord(u32 *p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+// waits for a thread blocked on a pi futex to have flagged it
+void WaitForWaiters(u32 *p) {
+  while (!(LoadWord(p) & FUTEX_WAITERS_LINUX)) sched_yield();
+}
+
+void SetUp(void) {
+  word = 0;
+  ready = 0;
+  memset(&lock, 0, sizeof(lock));
+  alarm(30);
+}
+
+void TearDown(void) {
+  alarm(0);
+}
+
+TEST(futex_pi, uncontended) {
+  ASSERT_EQ(0, Futex(&word, FUTEX_LOCK_PI_LINUX, 0, 0));
+  ASSERT_EQ(Gettid(), word);
+  ASSERT_EQ(-1, Futex(&word, FUTEX_LOCK_PI_LINUX, 0, 0));
+  ASSERT_EQ(EDEADLK, errno);
+  ASSERT_EQ(-1, Futex(&word, FUTEX_TRYLOCK_PI_LINUX, 0, 0));
+  ASSERT_EQ(EDEADLK, errno);
+  ASSERT_EQ(0, Futex(&word, FUTEX_UNLOCK_PI_LINUX, 0, 0));
+  ASSERT_EQ(0, word);
+  ASSERT_EQ(-1, Futex(&word, FUTEX_UNLOCK_PI_LINUX, 0, 0));
+  ASSERT_EQ(EPERM, errno);
+  ASSERT_EQ(0, Futex(&word, FUTEX_TRYLOCK_PI_LINUX, 0, 0));
+  ASSERT_EQ(Gettid(), word);
+  ASSERT_EQ(0, Futex(&word, FUTEX_UNLOCK_PI_LINUX, 0, 0));
+}
+
+void *Contender(void *arg) {
+  long rc;
+  if (Futex(&word, FUTEX_TRYLOCK_PI_LINUX, 0, 0) != -1 || errno != EAGAIN) {
+    return (void *)1;
+  }
+  if (Futex(&word, FUTEX_UNLOCK_PI_LINUX, 0, 0) != -1 || errno != EPERM) {
+    return (void *)2;
+  }
+  rc = Futex(&word, FUTEX_LOCK_PI_LINUX, 0, 0);
+  // the lock was handed to us, so nobody else could have grabbed it
+  if (rc || (LoadWord(&word) & FUTEX_TID_MASK_LINUX) != Gettid()) {
+    return (void *)3;
+  }
+  if (Futex(&word, FUTEX_UNLOCK_PI_LINUX, 0, 0)) return (void *)4;
+  return 0;
+}
+
+TEST(futex_pi, handoff) {
+  void *res;
+  pthread_t th;
+  ASSERT_EQ(0, Futex(&word, FUTEX_LOCK_PI_LINUX, 0, 0));
+  ASSERT_EQ(0, pthread_create(&th, 0, Contender, 0));
+  WaitForWaiters(&word);
+  ASSERT_EQ(0, Futex(&word, FUTEX_UNLOCK_PI_LINUX, 0, 0));
+  ASSERT_EQ(0, pthread_join(th, &res));
+  ASSERT_EQ(0, (intptr_t)res);
+  ASSERT_EQ(0, word);
+}
+
+void *TimedContender(void *arg) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_nsec += 20000000;
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_nsec -= 1000000000;
+    ts.tv_sec += 1;
+  }
+  if (Futex(&word, FUTEX_LOCK_PI_LINUX, 0, &ts) != -1) return (void *)1;
+  return (void *)(intptr_t)errno;
+}
+
+TEST(futex_pi, timeout) {
+  void *res;
+  pthread_t th;
+  ASSERT_EQ(0, Futex(&word, FUTEX_LOCK_PI_LINUX, 0, 0));
+  ASSERT_EQ(0, pthread_create(&th, 0, TimedContender, 0));
+  ASSERT_EQ(0, pthread_join(th, &res));
+  ASSERT_EQ(ETIMEDOUT, (intptr_t)res);
+  ASSERT_EQ(Gettid(), word & FUTEX_TID_MASK_LINUX);
+  ASSERT_EQ(0, Futex(&word, FUTEX_UNLOCK_PI_LINUX, 0, 0));
+}
+
+// locks the pi futex in `lock` and exits without unlocking it
+void *DyingOwner(void *arg) {
+  head.next = (uintptr_t)&lock | 1;  // low bit means priority inheritance
+  head.offset = offsetof(struct Lock, word) - offsetof(struct Lock, next);
+  head.pending = 0;
+  lock.next = (uintptr_t)&head;
+  if (Futex(&lock.word, FUTEX_LOCK_PI_LINUX, 0, 0)) return (void *)1;
+  if (syscall(SYS_set_robust_list, &head, sizeof(head))) return (void *)2;
+  __atomic_store_n(&ready, 1, __ATOMIC_RELEASE);
+  if (arg) WaitForWaiters(&lock.word);
+  return 0;
+}
+
+TEST(futex_pi, owner_died) {
+  void *res;
+  pthread_t th;
+  ASSERT_EQ(0, pthread_create(&th, 0, DyingOwner, 0));
+  ASSERT_EQ(0, pthread_join(th, &res));
+  ASSERT_EQ(0, (intptr_t)res);
+  ASSERT_EQ(FUTEX_OWNER_DIED_LINUX, lock.word);
+  ASSERT_EQ(0, Futex(&lock.word, FUTEX_LOCK_PI_LINUX, 0, 0));
+  ASSERT_EQ(FUTEX_OWNER_DIED_LINUX | Gettid(), lock.word);
+}
+
+TEST(futex_pi, owner_died_with_waiter) {
+  void *res;
+  pthread_t th;
+  ASSERT_EQ(0, pthread_create(&th, 0, DyingOwner, (void *)1));
+  while (!__atomic_load_n(&ready, __ATOMIC_ACQUIRE)) sched_yield();
+  ASSERT_EQ(0, Futex(&lock.word, FUTEX_LOCK_PI_LINUX, 0, 0));
+  // linux may leave a stale waiters bit behind after the handoff
+  ASSERT_EQ(FUTEX_OWNER_DIED_LINUX | Gettid(),
+            lock.word & ~FUTEX_WAITERS_LINUX);
+  ASSERT_EQ(0, pthread_join(th, &res));
+  ASSERT_EQ(0, (intptr_t)res);
+}
+
+pthread_mutex_t mtx;
+
+void *AbandonMutex(void *arg) {
+  pthread_mutex_lock(&mtx);
+  return 0;
+}
+
+TEST(robust, pi_mutex_eownerdead) {
+  pthread_t th;
+  pthread_mutexattr_t attr;
+  ASSERT_EQ(0, pthread_mutexattr_init(&attr));
+  ASSERT_EQ(0, pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST));
+  if (pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT)) {
+    return;  // libc doesn't support priority inheritance mutexes
+  }
+  ASSERT_EQ(0, pthread_mutex_init(&mtx, &attr));
+  ASSERT_EQ(0, pthread_mutexattr_destroy(&attr));
+  ASSERT_EQ(0, pthread_create(&th, 0, AbandonMutex, 0));
+  ASSERT_EQ(0, pthread_join(th, 0));
+  ASSERT_EQ(EOWNERDEAD, pthread_mutex_lock(&mtx));
+  // unlocking without calling pthread_mutex_consistent() breaks it
+  ASSERT_EQ(0, pthread_mutex_unlock(&mtx));
+  ASSERT_EQ(ENOTRECOVERABLE, pthread_mutex_lock(&mtx));
+  ASSERT_EQ(0, pthread_mutex_destroy(&mtx));
+}
+
+TEST(robust, pi_mutex_consistent) {
+  pthread_t th;
+  pthread_mutexattr_t attr;
+  ASSERT_EQ(0, pthread_mutexattr_init(&attr));
+  ASSERT_EQ(0, pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST));
+  if (pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT)) {
+    return;  // libc doesn't support priority inheritance mutexes
+  }
+  ASSERT_EQ(0, pthread_mutex_init(&mtx, &attr));
+  ASSERT_EQ(0, pthread_mutexattr_destroy(&attr));
+  ASSERT_EQ(0, pthread_create(&th, 0, AbandonMutex, 0));
+  ASSERT_EQ(0, pthread_join(th, 0));
+  ASSERT_EQ(EOWNERDEAD, pthread_mutex_lock(&mtx));
+  ASSERT_EQ(0, pthread_mutex_consistent(&mtx));
+  ASSERT_EQ(0, pthread_mutex_unlock(&mtx));
+  ASSERT_EQ(0, pthread_mutex_lock(&mtx));
+  ASSERT_EQ(0, pthread_mutex_unlock(&mtx));
+  ASSERT_EQ(0, pthread_mutex_destroy(&mtx));
+}
+
+TEST(robust, process_exit) {
+  int ws, pid;
+  pthread_mutex_t *m;
+  pthread_mutexattr_t attr;
+  ASSERT_NE((intptr_t)MAP_FAILED,
+            (intptr_t)(m = (pthread_mutex_t *)mmap(
+                           0, 65536, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_ANONYMOUS, -1, 0)));
+  ASSERT_EQ(0, pthread_mutexattr_init(&attr));
+  ASSERT_EQ(0, pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST));
+  ASSERT_EQ(0, pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED));
+  ASSERT_EQ(0, pthread_mutex_init(m, &attr));
+  ASSERT_EQ(0, pthread_mutexattr_destroy(&attr));
+  ASSERT_NE(-1, (pid = fork()));
+  if (!pid) {
+    pthread_mutex_lock(m);
+    _exit(0);
+  }
+  ASSERT_EQ(pid, waitpid(pid, &ws, 0));
+  ASSERT_EQ(0, ws);
+  ASSERT_EQ(EOWNERDEAD, pthread_mutex_lock(m));
+  ASSERT_EQ(0, pthread_mutex_consistent(m));
+  ASSERT_EQ(0, pthread_mutex_unlock(m));
+  ASSERT_EQ(0, munmap(m, 65536));
+}
@@ -0,0 +1,282 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#include "test/test.h"
+
+#ifndef SYS_io_uring_setup
+#define SYS_io_uring_setup 425
+#define SYS_io_uring_enter 426
+#endif
+
+struct Sqe {
+  u8 opcode;
+  u8 flags;
+  u16 ioprio;
+  i32 fd;
+  u64 off;
+  u64 addr;
+  u32 len;
+  u32 op_flags;
+  u64 user_data;
+  u16 buf_index;
+  u16 personality;
+  i32 file_index;
+  u64 addr3;
+  u64 pad;
+};
+
+struct Cqe {
+  u64 user_data;
+  i32 res;
+  u32 flags;
+};
+
+struct Params {
+  u32 sq_entries;
+  u32 cq_entries;
+  u32 flags;
+  u32 sq_thread_cpu;
+  u32 sq_thread_idle;
+  u32 features;
+  u32 wq_fd;
+  u32 resv[3];
+  struct {
+    u32 head, tail, ring_mask, ring_entries, flags, dropped, array, resv1;
+    u64 user_addr;
+  } sq_off;
+  struct {
+    u32 head, tail, ring_mask, ring_entries, overflow, cqes, flags, resv1;
+    u64 user_addr;
+  } cq_off;
+};
+
+struct Ts {
+  i64 sec;
+  i64 nsec;
+};
+
+int ring;
+int pfd[2];
+u32 queued;
+u8 *sq, *cq;
+size_t sqlen, cqlen;
+struct Sqe *sqes;
+struct Params p;
+
+void SetUp(void) {
+  memset(&p, 0, sizeof(p));
+  ring = syscall(SYS_io_uring_setup, 8, &p);
+  if (ring == -1 && (errno == ENOSYS || errno == EPERM)) {
+    exit(0);  // io_uring is disabled on this host
+  }
+  ASSERT_NE(-1, ring);
+  sqlen = p.sq_off.array + p.sq_entries * 4;
+  cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct Cqe);
+  ASSERT_NE((intptr_t)MAP_FAILED,
+            (intptr_t)(sq = mmap(0, sqlen, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                 ring, IORING_OFF_SQ_RING_LINUX)));
+  ASSERT_NE((intptr_t)MAP_FAILED,
+            (intptr_t)(cq = mmap(0, cqlen, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                 ring, IORING_OFF_CQ_RING_LINUX)));
+  ASSERT_NE((intptr_t)MAP_FAILED,
+            (intptr_t)(sqes = mmap(0, p.sq_entries * sizeof(struct Sqe),
+                                   PROT_READ | PROT_WRITE, MAP_SHARED, ring,
+                                   IORING_OFF_SQES_LINUX)));
+  ASSERT_EQ(0, pipe(pfd));
+  queued = 0;
+}
+
+void TearDown(void) {
+  ASSERT_EQ(0, close(pfd[1]));
+  ASSERT_EQ(0, close(pfd[0]));
+  ASSERT_EQ(0, munmap(sqes, p.sq_entries * sizeof(struct Sqe)));
+  ASSERT_EQ(0, munmap(cq, cqlen));
+  ASSERT_EQ(0, munmap(sq, sqlen));
+  ASSERT_EQ(0, close(ring));
+}
+
+struct Sqe *Prep(int op, int flags, int fd, const void *addr, u32 len, u64 off,
+                 u64 user_data) {
+  u32 i, tail;
+  struct Sqe *e;
+  tail = *(u32 *)(sq + p.sq_off.tail) + queued++;
+  i = tail & *(u32 *)(sq + p.sq_off.ring_mask);
+  ((u32 *)(sq + p.sq_off.array))[i] = i;
+  e = sqes + i;
+  memset(e, 0, sizeof(*e));
+  e->opcode = op;
+  e->flags = flags;
+  e->fd = fd;
+  e->addr = (uintptr_t)addr;
+  e->len = len;
+  e->off = off;
+  e->user_data = user_data;
+  return e;
+}
+
+int Submit(u32 wait) {
+  u32 n = queued;
+  __atomic_fetch_add((u32 *)(sq + p.sq_off.tail), n, __ATOMIC_RELEASE);
+  queued = 0;
+  return syscall(SYS_io_uring_enter, ring, n, wait,
+                 IORING_ENTER_GETEVENTS_LINUX, 0, 0);
+}
+
+bool Reap(struct Cqe *out) {
+  u32 head, tail;
+  head = *(u32 *)(cq + p.cq_off.head);
+  tail = __atomic_load_n((u32 *)(cq + p.cq_off.tail), __ATOMIC_ACQUIRE);
+  if (head == tail) return false;
+  *out = ((struct Cqe *)(cq + p.cq_off.cqes))[head & *(u32 *)(cq + p.cq_off
+                                                                   .ring_mask)];
+  __atomic_store_n((u32 *)(cq + p.cq_off.head), head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+// returns result of next completion, which must be for user_data
+i32 ReapResult(u64 user_data) {
+  struct Cqe e;
+  ASSERT_TRUE(Reap(&e));
+  ASSERT_EQ(user_data, e.user_data);
+  return e.res;
+}
+
+// reaps n completions, which may come in any order, into res[user_data]
+void ReapAll(int n, i32 res[8]) {
+  struct Cqe e;
+  bool seen[8] = {0};
+  while (n--) {
+    ASSERT_TRUE(Reap(&e));
+    ASSERT_GT(8, e.user_data);
+    ASSERT_FALSE(seen[e.user_data]);
+    seen[e.user_data] = true;
+    res[e.user_data] = e.res;
+  }
+  ASSERT_FALSE(Reap(&e));
+}
+
+i64 Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+TEST(io_uring, nop) {
+  struct Cqe e;
+  Prep(IORING_OP_NOP_LINUX, 0, -1, 0, 0, 0, 7);
+  ASSERT_EQ(1, Submit(1));
+  ASSERT_EQ(0, ReapResult(7));
+  ASSERT_FALSE(Reap(&e));
+}
+
+TEST(io_uring, link) {
+  char buf[8] = {0};
+  Prep(IORING_OP_WRITE_LINUX, IOSQE_IO_LINK_LINUX, pfd[1], "hello", 5, 0, 1);
+  Prep(IORING_OP_READ_LINUX, 0, pfd[0], buf, sizeof(buf), 0, 2);
+  ASSERT_EQ(2, Submit(2));
+  ASSERT_EQ(5, ReapResult(1));
+  ASSERT_EQ(5, ReapResult(2));
+  ASSERT_STREQ("hello", buf);
+}
+
+TEST(io_uring, failed_link_cancels_rest_of_chain) {
+  i32 res[8];
+  Prep(IORING_OP_WRITE_LINUX, IOSQE_IO_LINK_LINUX, pfd[0], "x", 1, 0, 1);
+  Prep(IORING_OP_NOP_LINUX, IOSQE_IO_LINK_LINUX, -1, 0, 0, 0, 2);
+  Prep(IORING_OP_NOP_LINUX, 0, -1, 0, 0, 0, 3);
+  Prep(IORING_OP_NOP_LINUX, 0, -1, 0, 0, 0, 4);
+  ASSERT_EQ(4, Submit(4));
+  ReapAll(4, res);
+  ASSERT_EQ(-EBADF, res[1]);
+  ASSERT_EQ(-ECANCELED, res[2]);
+  ASSERT_EQ(-ECANCELED, res[3]);
+  ASSERT_EQ(0, res[4]);
+}
+
+TEST(io_uring, hardlink_survives_failure) {
+  Prep(IORING_OP_WRITE_LINUX, IOSQE_IO_HARDLINK_LINUX, pfd[0], "x", 1, 0, 1);
+  Prep(IORING_OP_NOP_LINUX, 0, -1, 0, 0, 0, 2);
+  ASSERT_EQ(2, Submit(2));
+  ASSERT_EQ(-EBADF, ReapResult(1));
+  ASSERT_EQ(0, ReapResult(2));
+}
+
+TEST(io_uring, timeout_expires) {
+  i64 t;
+  struct Ts ts = {0, 20000000};
+  t = Now();
+  Prep(IORING_OP_TIMEOUT_LINUX, 0, -1, &ts, 1, 0, 1);
+  ASSERT_EQ(1, Submit(1));
+  ASSERT_EQ(-ETIME, ReapResult(1));
+  ASSERT_LE(15, Now() - t);
+}
+
+TEST(io_uring, timeout_completes_by_count) {
+  i32 res[8];
+  struct Ts ts = {10, 0};
+  Prep(IORING_OP_TIMEOUT_LINUX, 0, -1, &ts, 1, 1, 1);
+  Prep(IORING_OP_NOP_LINUX, 0, -1, 0, 0, 0, 2);
+  ASSERT_EQ(2, Submit(2));
+  ReapAll(2, res);
+  ASSERT_EQ(0, res[1]);
+  ASSERT_EQ(0, res[2]);
+}
+
+TEST(io_uring, timeout_remove) {
+  i32 res[8];
+  struct Ts ts = {10, 0};
+  Prep(IORING_OP_TIMEOUT_LINUX, 0, -1, &ts, 1, 0, 1);
+  ASSERT_EQ(1, Submit(0));
+  Prep(IORING_OP_TIMEOUT_REMOVE_LINUX, 0, -1, (void *)1, 0, 0, 2);
+  ASSERT_EQ(1, Submit(2));
+  ReapAll(2, res);
+  ASSERT_EQ(-ECANCELED, res[1]);
+  ASSERT_EQ(0, res[2]);
+}
+
+TEST(io_uring, pending_read_completes) {
+  char buf[8] = {0};
+  Prep(IORING_OP_READ_LINUX, 0, pfd[0], buf, sizeof(buf), 0, 1);
+  ASSERT_EQ(1, Submit(0));
+  ASSERT_EQ(3, write(pfd[1], "abc", 3));
+  ASSERT_EQ(0, Submit(1));
+  ASSERT_EQ(3, ReapResult(1));
+  ASSERT_STREQ("abc", buf);
+}
+
+TEST(io_uring, cancel) {
+  char buf[8];
+  i32 res[8];
+  Prep(IORING_OP_READ_LINUX, 0, pfd[0], buf, sizeof(buf), 0, 1);
+  ASSERT_EQ(1, Submit(0));
+  Prep(IORING_OP_ASYNC_CANCEL_LINUX, 0, -1, (void *)1, 0, 0, 2);
+  ASSERT_EQ(1, Submit(2));
+  ReapAll(2, res);
+  ASSERT_EQ(-ECANCELED, res[1]);
+  ASSERT_EQ(0, res[2]);
+}
+
+TEST(io_uring, cancel_missing) {
+  Prep(IORING_OP_ASYNC_CANCEL_LINUX, 0, -1, (void *)99, 0, 0, 1);
+  ASSERT_EQ(1, Submit(1));
+  ASSERT_EQ(-ENOENT, ReapResult(1));
+}
@@ -0,0 +1,116 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <sys/mman.h>
+
+#include "test/test.h"
+
+#define pagesize 65536
+
+long granule;
+u8 *p, vec[4096];
+
+u8 *Map(size_t size) {
+  return (u8 *)mmap(0, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+}
+
+bool IsResident(u8 *addr) {
+  u8 v = 0;
+  ASSERT_EQ(0, mincore(addr, 1, &v));
+  return v & 1;
+}
+
+void SetUp(void) {
+  granule = sysconf(_SC_PAGESIZE);
+  memset(vec, 0xfe, sizeof(vec));
+}
+
+void TearDown(void) {
+}
+
+TEST(mincore, touched) {
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(pagesize * 4)));
+  p[0] = 1;
+  p[pagesize * 2] = 1;
+  ASSERT_EQ(0, mincore(p, pagesize * 4, vec));
+  ASSERT_EQ(1, vec[0] & 1);
+  ASSERT_EQ(0, vec[pagesize / granule] & 1);
+  ASSERT_EQ(1, vec[pagesize * 2 / granule] & 1);
+  ASSERT_EQ(0, vec[pagesize * 3 / granule] & 1);
+  // only one byte per page is written
+  ASSERT_EQ(0xfe, vec[pagesize * 4 / granule]);
+  ASSERT_EQ(0, munmap(p, pagesize * 4));
+}
+
+TEST(mincore, read_faults_count) {
+  volatile u8 x;
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(pagesize)));
+  ASSERT_FALSE(IsResident(p));
+  p[1] = 2;
+  x = p[1];
+  (void)x;
+  ASSERT_TRUE(IsResident(p));
+  ASSERT_EQ(0, munmap(p, pagesize));
+}
+
+TEST(mincore, dontneed) {
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(pagesize)));
+  p[0] = 1;
+  ASSERT_TRUE(IsResident(p));
+  ASSERT_EQ(0, madvise(p, pagesize, MADV_DONTNEED));
+  ASSERT_FALSE(IsResident(p));
+  ASSERT_EQ(0, p[0]);
+  ASSERT_EQ(0, munmap(p, pagesize));
+}
+
+TEST(mincore, many_pages) {
+  u8 *v;
+  long i, n = 80 * pagesize / granule;
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(n * granule)));
+  ASSERT_NOTNULL(v = (u8 *)malloc(n));
+  for (i = 0; i < 80; i += 2) p[i * pagesize] = 1;
+  ASSERT_EQ(0, mincore(p, n * granule, v));
+  // faulting may commit neighboring pages too, but never across chunks
+  for (i = 0; i < n; ++i) {
+    if (i * granule / pagesize % 2) {
+      ASSERT_EQ(0, v[i] & 1);
+    } else if (!(i * granule % pagesize)) {
+      ASSERT_EQ(1, v[i] & 1);
+    }
+  }
+  free(v);
+  ASSERT_EQ(0, munmap(p, n * granule));
+}
+
+TEST(mincore, errors) {
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(pagesize * 3)));
+  ASSERT_EQ(0, munmap(p + pagesize, pagesize));
+  ASSERT_EQ(0, mincore(p, 0, vec));
+  ASSERT_EQ(-1, mincore(p + 1, pagesize, vec));
+  ASSERT_EQ(EINVAL, errno);
+  // holes in the interval are reported as ENOMEM
+  ASSERT_EQ(-1, mincore(p, pagesize * 3, vec));
+  ASSERT_EQ(ENOMEM, errno);
+  ASSERT_EQ(-1, mincore(p + pagesize, pagesize, vec));
+  ASSERT_EQ(ENOMEM, errno);
+  ASSERT_EQ(-1, mincore(p, pagesize, (u8 *)-4096L));
+  ASSERT_EQ(EFAULT, errno);
+  ASSERT_EQ(0, munmap(p, pagesize));
+  ASSERT_EQ(0, munmap(p + pagesize * 2, pagesize));
+}
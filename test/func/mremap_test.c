@@ -0,0 +1,155 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/mman.h>
+
+#include "test/test.h"
+
+#define pagesize 65536
+
+u8 *p, *q;
+
+u8 *Map(void *addr, size_t size, int flags) {
+  return (u8 *)mmap(addr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+}
+
+// linux reports unmapped memory as ENOMEM
+bool IsMapped(void *addr, size_t size) {
+  return !msync(addr, size, MS_ASYNC);
+}
+
+void Fill(u8 *p, size_t size) {
+  size_t i;
+  for (i = 0; i < size; i += 512) p[i] = i / 512;
+}
+
+bool Check(u8 *p, size_t size) {
+  size_t i;
+  for (i = 0; i < size; i += 512) {
+    if (p[i] != (u8)(i / 512)) return false;
+  }
+  return true;
+}
+
+void SetUp(void) {
+  p = q = 0;
+}
+
+void TearDown(void) {
+}
+
+TEST(mremap, shrink) {
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(0, pagesize * 4, 0)));
+  Fill(p, pagesize * 4);
+  ASSERT_EQ((intptr_t)p, (intptr_t)mremap(p, pagesize * 4, pagesize, 0));
+  ASSERT_TRUE(Check(p, pagesize));
+  ASSERT_TRUE(IsMapped(p, pagesize));
+  ASSERT_FALSE(IsMapped(p + pagesize, pagesize * 3));
+  ASSERT_EQ(0, munmap(p, pagesize));
+}
+
+TEST(mremap, grow_in_place) {
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(0, pagesize * 4, 0)));
+  ASSERT_EQ(0, munmap(p + pagesize, pagesize * 3));
+  Fill(p, pagesize);
+  ASSERT_EQ((intptr_t)p, (intptr_t)mremap(p, pagesize, pagesize * 4, 0));
+  ASSERT_TRUE(Check(p, pagesize));
+  ASSERT_EQ(0, p[pagesize * 4 - 1]);
+  p[pagesize * 4 - 1] = 1;
+  ASSERT_EQ(0, munmap(p, pagesize * 4));
+}
+
+TEST(mremap, grow_blocked) {
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(0, pagesize * 2, 0)));
+  Fill(p, pagesize * 2);
+  // the second page is in the way and we didn't let it move
+  ASSERT_EQ((intptr_t)MAP_FAILED,
+            (intptr_t)mremap(p, pagesize, pagesize * 2, 0));
+  ASSERT_EQ(ENOMEM, errno);
+  ASSERT_TRUE(Check(p, pagesize * 2));
+  ASSERT_NE((intptr_t)MAP_FAILED,
+            (intptr_t)(q = (u8 *)mremap(p, pagesize, pagesize * 3,
+                                        MREMAP_MAYMOVE)));
+  ASSERT_NE((intptr_t)p, (intptr_t)q);
+  ASSERT_TRUE(Check(q, pagesize));
+  ASSERT_EQ(0, q[pagesize]);
+  ASSERT_EQ(0, q[pagesize * 3 - 1]);
+  // only the first page moved away
+  ASSERT_FALSE(IsMapped(p, pagesize));
+  ASSERT_TRUE(IsMapped(p + pagesize, pagesize));
+  ASSERT_EQ((u8)(pagesize / 512), p[pagesize]);
+  ASSERT_EQ(0, munmap(p + pagesize, pagesize));
+  ASSERT_EQ(0, munmap(q, pagesize * 3));
+}
+
+TEST(mremap, fixed) {
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(0, pagesize * 2, 0)));
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(q = Map(0, pagesize * 4, 0)));
+  Fill(p, pagesize * 2);
+  memset(q, 0x55, pagesize * 4);
+  // whatever was mapped at the destination gets replaced
+  ASSERT_EQ((intptr_t)q,
+            (intptr_t)mremap(p, pagesize * 2, pagesize * 3,
+                             MREMAP_MAYMOVE | MREMAP_FIXED, q));
+  ASSERT_TRUE(Check(q, pagesize * 2));
+  ASSERT_EQ(0, q[pagesize * 2]);
+  ASSERT_EQ(0x55, q[pagesize * 3]);
+  ASSERT_FALSE(IsMapped(p, pagesize * 2));
+  ASSERT_EQ(0, munmap(q, pagesize * 4));
+}
+
+TEST(mremap, einval) {
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(0, pagesize * 2, 0)));
+  ASSERT_EQ((intptr_t)MAP_FAILED,
+            (intptr_t)mremap(p + 1, pagesize, pagesize, MREMAP_MAYMOVE));
+  ASSERT_EQ(EINVAL, errno);
+  ASSERT_EQ((intptr_t)MAP_FAILED,
+            (intptr_t)mremap(p, pagesize, pagesize * 2, MREMAP_FIXED,
+                             p + pagesize * 4));
+  ASSERT_EQ(EINVAL, errno);
+  // the source and destination may not overlap
+  ASSERT_EQ((intptr_t)MAP_FAILED,
+            (intptr_t)mremap(p, pagesize * 2, pagesize * 2,
+                             MREMAP_MAYMOVE | MREMAP_FIXED, p + pagesize));
+  ASSERT_EQ(EINVAL, errno);
+  ASSERT_EQ(0, munmap(p, pagesize * 2));
+}
+
+TEST(mremap, realloc) {
+  int i;
+  size_t n = pagesize;
+  ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(p = Map(0, n, 0)));
+  Fill(p, n);
+  for (i = 0; i < 16; ++i) {
+    // keep something after the buffer so it has to move sometimes
+    ASSERT_NE((intptr_t)MAP_FAILED, (intptr_t)(q = Map(0, pagesize, 0)));
+    ASSERT_NE((intptr_t)MAP_FAILED,
+              (intptr_t)(p = (u8 *)mremap(p, n, n * 2, MREMAP_MAYMOVE)));
+    ASSERT_TRUE(Check(p, n));
+    ASSERT_EQ(0, p[n * 2 - 1]);
+    n *= 2;
+    if (n <= 1024 * 1024) Fill(p, n);
+    ASSERT_EQ(0, munmap(q, pagesize));
+    if (n > 1024 * 1024) break;
+  }
+  ASSERT_EQ(0, munmap(p, n));
+}
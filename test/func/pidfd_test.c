@@ -0,0 +1,119 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "test/test.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+#ifndef P_PIDFD
+#define P_PIDFD 3
+#endif
+
+int pid, pfd;
+
+int PidfdOpen(int pid, unsigned flags) {
+  return syscall(SYS_pidfd_open, pid, flags);
+}
+
+int PidfdSendSignal(int pfd, int sig) {
+  return syscall(SYS_pidfd_send_signal, pfd, sig, 0, 0);
+}
+
+void SetUp(void) {
+  static bool once;
+  if (!once) {
+    // pidfds need linux 5.3+ and blink needs a host that has them too
+    if ((pfd = PidfdOpen(getpid(), 0)) == -1) {
+      ASSERT_EQ(ENOSYS, errno);
+      exit(0);
+    }
+    close(pfd);
+    once = true;
+  }
+  ASSERT_NE(-1, (pid = fork()));
+  if (!pid) {
+    for (;;) pause();
+  }
+  ASSERT_NE(-1, (pfd = PidfdOpen(pid, 0)));
+}
+
+void TearDown(void) {
+  close(pfd);
+  if (pid) {
+    kill(pid, SIGKILL);
+    waitpid(pid, 0, 0);
+  }
+}
+
+TEST(pidfd, poll_exit) {
+  struct pollfd p = {pfd, POLLIN};
+  ASSERT_EQ(0, poll(&p, 1, 0));
+  ASSERT_EQ(0, kill(pid, SIGKILL));
+  // the pidfd becomes readable once the child exits, before it's reaped
+  ASSERT_EQ(1, poll(&p, 1, 5000));
+  ASSERT_TRUE(p.revents & POLLIN);
+}
+
+TEST(pidfd, send_signal) {
+  int ws;
+  ASSERT_EQ(0, PidfdSendSignal(pfd, 0));
+  ASSERT_EQ(0, PidfdSendSignal(pfd, SIGUSR1));
+  ASSERT_EQ(pid, waitpid(pid, &ws, 0));
+  ASSERT_TRUE(WIFSIGNALED(ws));
+  ASSERT_EQ(SIGUSR1, WTERMSIG(ws));
+  // signaling a reaped process through its pidfd fails
+  ASSERT_EQ(-1, PidfdSendSignal(pfd, SIGUSR1));
+  ASSERT_EQ(ESRCH, errno);
+  pid = 0;
+}
+
+TEST(pidfd, waitid) {
+  siginfo_t si;
+  ASSERT_EQ(0, PidfdSendSignal(pfd, SIGTERM));
+  ASSERT_EQ(0, waitid(P_PIDFD, pfd, &si, WEXITED));
+  ASSERT_EQ(pid, si.si_pid);
+  ASSERT_EQ(CLD_KILLED, si.si_code);
+  ASSERT_EQ(SIGTERM, si.si_status);
+  pid = 0;
+}
+
+TEST(pidfd, cloexec) {
+  ASSERT_EQ(FD_CLOEXEC, fcntl(pfd, F_GETFD));
+}
+
+TEST(pidfd, einval) {
+  int fd;
+  ASSERT_EQ(-1, PidfdOpen(pid, -1u));
+  ASSERT_EQ(EINVAL, errno);
+  ASSERT_EQ(-1, PidfdSendSignal(pfd, 65));
+  ASSERT_EQ(EINVAL, errno);
+  ASSERT_NE(-1, (fd = open("/dev/null", O_RDONLY)));
+  ASSERT_EQ(-1, PidfdSendSignal(fd, SIGUSR1));
+  ASSERT_EQ(EBADF, errno);
+  ASSERT_EQ(0, close(fd));
+}
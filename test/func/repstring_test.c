@@ -0,0 +1,346 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include "blink/macros.h"
+#include "test/test.h"
+
+// checks the rep string fast paths against a model that does one
+// element at a time, which is what the architecture says they do
+
+#define PAGE 4096
+#define SIZE (PAGE * 4)
+
+enum { MOVS, STOS, CMPS, SCAS };
+enum { REP, REPE, REPNE };
+
+struct Regs {
+  u64 di, si, cx, ax;
+  u8 cf, zf, sf, of;
+};
+
+typedef void insn_f(struct Regs *, long);
+
+_Alignas(PAGE) u8 buf[SIZE];
+_Alignas(PAGE) u8 ref[SIZE];
+
+#define INSN(NAME, TEXT)                                                   \
+  void NAME(struct Regs *r, long df) {                                     \
+    asm volatile("test\t%8,%8\n\t"                                         \
+                 "jz\t1f\n\t"                                              \
+                 "std\n"                                                   \
+                 "1:\t" TEXT "\n\t"                                        \
+                 "cld\n\t"                                                 \
+                 "setc\t%4\n\t"                                            \
+                 "setz\t%5\n\t"                                            \
+                 "sets\t%6\n\t"                                            \
+                 "seto\t%7"                                                \
+                 : "+D"(r->di), "+S"(r->si), "+c"(r->cx), "+a"(r->ax),     \
+                   "=m"(r->cf), "=m"(r->zf), "=m"(r->sf), "=m"(r->of)      \
+                 : "r"(df)                                                 \
+                 : "memory", "cc");                                        \
+  }
+
+INSN(RepMovsb, "rep movsb")
+INSN(RepMovsw, "rep movsw")
+INSN(RepMovsl, "rep movsl")
+INSN(RepMovsq, "rep movsq")
+INSN(RepStosb, "rep stosb")
+INSN(RepStosw, "rep stosw")
+INSN(RepStosl, "rep stosl")
+INSN(RepStosq, "rep stosq")
+INSN(RepeCmpsb, "repe cmpsb")
+INSN(RepeCmpsw, "repe cmpsw")
+INSN(RepeCmpsl, "repe cmpsl")
+INSN(RepeCmpsq, "repe cmpsq")
+INSN(RepneCmpsb, "repne cmpsb")
+INSN(RepneCmpsw, "repne cmpsw")
+INSN(RepneCmpsl, "repne cmpsl")
+INSN(RepneCmpsq, "repne cmpsq")
+INSN(RepeScasb, "repe scasb")
+INSN(RepeScasw, "repe scasw")
+INSN(RepeScasl, "repe scasl")
+INSN(RepeScasq, "repe scasq")
+INSN(RepneScasb, "repne scasb")
+INSN(RepneScasw, "repne scasw")
+INSN(RepneScasl, "repne scasl")
+INSN(RepneScasq, "repne scasq")
+
+insn_f *const kInsns[4][3][4] = {
+    [MOVS][REP] = {RepMovsb, RepMovsw, RepMovsl, RepMovsq},
+    [STOS][REP] = {RepStosb, RepStosw, RepStosl, RepStosq},
+    [CMPS][REPE] = {RepeCmpsb, RepeCmpsw, RepeCmpsl, RepeCmpsq},
+    [CMPS][REPNE] = {RepneCmpsb, RepneCmpsw, RepneCmpsl, RepneCmpsq},
+    [SCAS][REPE] = {RepeScasb, RepeScasw, RepeScasl, RepeScasq},
+    [SCAS][REPNE] = {RepneScasb, RepneScasw, RepneScasl, RepneScasq},
+};
+
+u64 Get(const u8 *p, int n) {
+  u64 x = 0;
+  memcpy(&x, p, n);
+  return x;
+}
+
+// sets the flags the way sub does for a - b
+void Sub(struct Regs *r, u64 a, u64 b, int n) {
+  int bits = n * 8;
+  u64 mask = bits == 64 ? -1 : ((u64)1 << bits) - 1;
+  u64 res = (a - b) & mask;
+  a &= mask;
+  b &= mask;
+  r->cf = a < b;
+  r->zf = !res;
+  r->sf = res >> (bits - 1) & 1;
+  r->of = ((a ^ b) & (a ^ res)) >> (bits - 1) & 1;
+}
+
+// runs the instruction one element at a time on ref
+void Model(int op, int rep, int n, long df, struct Regs *r) {
+  u8 tmp[8];
+  i64 step = df ? -n : n;
+  u8 *di = ref + (r->di - (uintptr_t)buf);
+  u8 *si = ref + (r->si - (uintptr_t)buf);
+  for (; r->cx; --r->cx) {
+    switch (op) {
+      case MOVS:
+        memcpy(tmp, si, n);
+        memcpy(di, tmp, n);
+        break;
+      case STOS:
+        memcpy(di, &r->ax, n);
+        break;
+      case CMPS:
+        Sub(r, Get(si, n), Get(di, n), n);
+        break;
+      case SCAS:
+        Sub(r, r->ax, Get(di, n), n);
+        break;
+    }
+    di += step;
+    r->di += step;
+    if (op == MOVS || op == CMPS) {
+      si += step;
+      r->si += step;
+    }
+    if ((rep == REPE && !r->zf) || (rep == REPNE && r->zf)) {
+      --r->cx;
+      break;
+    }
+  }
+}
+
+// runs instruction on buf and model on ref, which must be the same
+void Check(int op, int rep, int n, long df, long dioff, long sioff, u64 cx,
+           u64 ax) {
+  struct Regs a, b;
+  memcpy(ref, buf, SIZE);
+  memset(&a, 0, sizeof(a));
+  a.di = (uintptr_t)buf + dioff;
+  a.si = (uintptr_t)buf + sioff;
+  a.cx = cx;
+  a.ax = ax;
+  b = a;
+  kInsns[op][rep][n == 1 ? 0 : n == 2 ? 1 : n == 4 ? 2 : 3](&a, df);
+  Model(op, rep, n, df, &b);
+  if (memcmp(buf, ref, SIZE) || a.di != b.di || a.si != b.si ||
+      a.cx != b.cx || a.ax != b.ax ||
+      ((op == CMPS || op == SCAS) &&
+       (a.cf != b.cf || a.zf != b.zf || a.sf != b.sf || a.of != b.of))) {
+    fprintf(stderr,
+            "error: op=%d rep=%d n=%d df=%ld di=%#lx si=%#lx cx=%#lx\n"
+            "\tgot  di=%#lx si=%#lx cx=%#lx cf=%d zf=%d sf=%d of=%d mem=%d\n"
+            "\twant di=%#lx si=%#lx cx=%#lx cf=%d zf=%d sf=%d of=%d\n",
+            op, rep, n, df, dioff, sioff, (long)cx,
+            (long)(a.di - (uintptr_t)buf), (long)(a.si - (uintptr_t)buf),
+            (long)a.cx, a.cf, a.zf, a.sf, a.of, !!memcmp(buf, ref, SIZE),
+            (long)(b.di - (uintptr_t)buf), (long)(b.si - (uintptr_t)buf),
+            (long)b.cx, b.cf, b.zf, b.sf, b.of);
+    exit(1);
+  }
+}
+
+void Randomize(void) {
+  long i;
+  u64 x = 0x9e3779b97f4a7c15;
+  for (i = 0; i < SIZE; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    buf[i] = x;
+  }
+}
+
+void SetUp(void) {
+  Randomize();
+}
+
+void TearDown(void) {
+}
+
+void CheckMovs(int n, long df, long dioff, long sioff, u64 cx) {
+  // overlapping copies leave repeating patterns behind, which would make
+  // the copies that come after them unable to notice their own mistakes
+  Randomize();
+  Check(MOVS, REP, n, df, dioff, sioff, cx, 0);
+}
+
+TEST(rep, movs) {
+  int n;
+  long df, skew;
+  for (n = 1; n <= 8; n *= 2) {
+    for (skew = 0; skew < n; ++skew) {
+      // elements straddle the page boundary unless skew is zero
+      CheckMovs(n, 0, PAGE * 2 - 8 * n - skew, 100, 700 / n);
+      CheckMovs(n, 0, 300, PAGE * 3 - 8 * n + skew, 900 / n);
+      // with df set, di and si point at the last element copied first
+      for (df = 0; df <= 1; ++df) {
+        CheckMovs(n, df, PAGE * 2 + 8 * n - skew, PAGE + 50, 1000 / n);
+      }
+      CheckMovs(n, 1, PAGE, PAGE * 3 + 8 * n + skew, 2000 / n);
+    }
+    // a whole page and then some
+    CheckMovs(n, 0, PAGE, PAGE * 2 + 3, PAGE * 3 / 2 / n);
+    CheckMovs(n, 1, PAGE * 3, PAGE * 2 + 3, PAGE * 3 / 2 / n);
+  }
+}
+
+TEST(rep, movs_overlap) {
+  int n;
+  long dist, df;
+  for (n = 1; n <= 8; n *= 2) {
+    for (df = 0; df <= 1; ++df) {
+      // the destination is ahead of the source in the direction it's
+      // copying, so bytes get copied again, which replicates patterns.
+      // this covers distances less than, equal to and above the width
+      for (dist = 1; dist <= 3 * n + 1; ++dist) {
+        if (!df) {
+          CheckMovs(n, df, PAGE * 2 - 40 + dist, PAGE * 2 - 40, 300 / n);
+        } else {
+          CheckMovs(n, df, PAGE * 2 + 40 - dist, PAGE * 2 + 40, 300 / n);
+        }
+      }
+      // the destination is behind the source, like memmove
+      for (dist = 1; dist <= 3 * n + 1; ++dist) {
+        if (!df) {
+          CheckMovs(n, df, PAGE + 5, PAGE + 5 + dist, 5000 / n);
+        } else {
+          CheckMovs(n, df, PAGE * 3 + 5, PAGE * 3 + 5 - dist, 5000 / n);
+        }
+      }
+    }
+  }
+}
+
+TEST(rep, stos) {
+  int n;
+  long df, skew;
+  for (n = 1; n <= 8; n *= 2) {
+    for (df = 0; df <= 1; ++df) {
+      for (skew = 0; skew < n; ++skew) {
+        Check(STOS, REP, n, df, PAGE * 2 - 4 * n - skew, 0, 1000 / n,
+              0x0807060504030201);
+      }
+      Check(STOS, REP, n, df, PAGE * 2, 0, PAGE * 3 / 2 / n,
+            0xfedcba9876543210);
+    }
+  }
+}
+
+TEST(rep, cmps) {
+  int n, rep;
+  long df, d, s, i, j, cx;
+  for (n = 1; n <= 8; n *= 2) {
+    for (df = 0; df <= 1; ++df) {
+      // d and s straddle page boundaries at different points
+      d = PAGE * 2 - 100 * n - 1;
+      s = PAGE + 7;
+      cx = 200;
+      if (df) {
+        d += (cx - 1) * n;
+        s += (cx - 1) * n;
+      }
+      for (j = 0; j < cx; j += 13) {
+        // repe stops at the element that differs
+        for (i = 0; i < cx; ++i) {
+          memcpy(buf + s + (df ? -i : i) * n, buf + d + (df ? -i : i) * n, n);
+        }
+        buf[s + (df ? -j : j) * n + n - 1] ^= 0x80;
+        Check(CMPS, REPE, n, df, d, s, cx, 0);
+        // repne stops at the element that matches
+        for (i = 0; i < cx; ++i) {
+          buf[s + (df ? -i : i) * n] = buf[d + (df ? -i : i) * n] ^ 1;
+        }
+        memcpy(buf + s + (df ? -j : j) * n, buf + d + (df ? -j : j) * n, n);
+        Check(CMPS, REPNE, n, df, d, s, cx, 0);
+      }
+      // nothing stops it, so flags come from the last comparison
+      for (rep = REPE; rep <= REPNE; ++rep) {
+        Randomize();
+        if (rep == REPE) {
+          memcpy(buf + s - (df ? (cx - 1) * n : 0),
+                 buf + d - (df ? (cx - 1) * n : 0), cx * n);
+        }
+        Check(CMPS, rep, n, df, d, s, cx, 0);
+      }
+    }
+  }
+}
+
+TEST(rep, scas) {
+  int n;
+  u64 ax;
+  long df, d, i, j, cx;
+  for (n = 1; n <= 8; n *= 2) {
+    for (df = 0; df <= 1; ++df) {
+      d = PAGE * 3 - 50 * n - (n > 1);
+      cx = 120;
+      if (df) d += (cx - 1) * n;
+      ax = 0x0102030405060708;
+      for (j = 0; j < cx; j += 7) {
+        for (i = 0; i < cx; ++i) memcpy(buf + d + (df ? -i : i) * n, &ax, n);
+        buf[d + (df ? -j : j) * n] ^= 0x40;
+        Check(SCAS, REPE, n, df, d, 0, cx, ax);
+        for (i = 0; i < cx; ++i) buf[d + (df ? -i : i) * n] = ~ax;
+        memcpy(buf + d + (df ? -j : j) * n, &ax, n);
+        Check(SCAS, REPNE, n, df, d, 0, cx, ax);
+      }
+    }
+  }
+}
+
+TEST(rep, scas_flags) {
+  int n;
+  u64 mem;
+  // flags are computed as ax minus memory, and these pairs give
+  // different carry, sign and overflow flags in the other order
+  static const u64 kPairs[][2] = {
+      {0x01, 0x7f}, {0x7f, 0x01}, {0x80, 0x01}, {0x01, 0x80}, {0xff, 0x00}};
+  for (n = 1; n <= 8; n *= 2) {
+    for (unsigned k = 0; k < ARRAYLEN(kPairs); ++k) {
+      u64 top = (u64)1 << (n * 8 - 8);
+      mem = kPairs[k][1] * top;
+      memcpy(buf + PAGE - 1, &mem, n);
+      Check(SCAS, REPE, n, 0, PAGE - 1, 0, 3, kPairs[k][0] * top);
+      Check(SCAS, REPNE, n, 0, PAGE - 1, 0, 1, kPairs[k][0] * top);
+      memcpy(buf + PAGE * 2 - 1, &mem, n);
+      Check(SCAS, REPE, n, 1, PAGE * 2 - 1, 0, 3, kPairs[k][0] * top);
+      mem = kPairs[k][0] * top;
+      memcpy(buf + PAGE * 2 - 1, &mem, n);
+      Check(CMPS, REPE, n, 0, PAGE * 2 - 1, PAGE - 1, 1, 0);
+    }
+  }
+}
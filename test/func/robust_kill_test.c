@@ -54,7 +54,6 @@ static struct {
 int main(int argc, char *argv[]) {
   int rc, pid;
   pthread_mutexattr_t attr;
-  if (1) return 0;  // TODO: Figure out how robust list works.
   SCHECK(shared = mmap(0, 65536, PROT_READ | PROT_WRITE,
                        MAP_SHARED | MAP_ANONYMOUS, -1, 0));
   PCHECK(pthread_mutexattr_init(&attr));
@@ -0,0 +1,99 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <poll.h>
+#include <signal.h>
+#include <sys/signalfd.h>
+
+#include "test/test.h"
+
+int fd;
+sigset_t mask, oldmask;
+
+void SetUp(void) {
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGUSR1);
+  sigaddset(&mask, SIGCHLD);
+  ASSERT_EQ(0, sigprocmask(SIG_BLOCK, &mask, &oldmask));
+  ASSERT_NE(-1, (fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)));
+}
+
+void TearDown(void) {
+  close(fd);
+  ASSERT_EQ(0, sigprocmask(SIG_SETMASK, &oldmask, 0));
+}
+
+TEST(signalfd, empty) {
+  struct signalfd_siginfo si;
+  struct pollfd pfd = {fd, POLLIN};
+  ASSERT_EQ(0, poll(&pfd, 1, 0));
+  ASSERT_EQ(-1, read(fd, &si, sizeof(si)));
+  ASSERT_EQ(EAGAIN, errno);
+}
+
+TEST(signalfd, kill) {
+  struct signalfd_siginfo si;
+  struct pollfd pfd = {fd, POLLIN};
+  ASSERT_EQ(0, kill(getpid(), SIGUSR1));
+  ASSERT_EQ(1, poll(&pfd, 1, 1000));
+  ASSERT_EQ(POLLIN, pfd.revents);
+  ASSERT_EQ(sizeof(si), read(fd, &si, sizeof(si)));
+  ASSERT_EQ(SIGUSR1, si.ssi_signo);
+  ASSERT_EQ(SI_USER, si.ssi_code);
+  // the signal was consumed rather than left pending
+  ASSERT_EQ(-1, read(fd, &si, sizeof(si)));
+  ASSERT_EQ(EAGAIN, errno);
+}
+
+TEST(signalfd, short_buffer) {
+  char buf[8];
+  struct signalfd_siginfo si;
+  ASSERT_EQ(0, kill(getpid(), SIGUSR1));
+  ASSERT_EQ(-1, read(fd, buf, sizeof(buf)));
+  ASSERT_EQ(EINVAL, errno);
+  ASSERT_EQ(sizeof(si), read(fd, &si, sizeof(si)));
+  ASSERT_EQ(SIGUSR1, si.ssi_signo);
+}
+
+TEST(signalfd, sigchld) {
+  int pid;
+  struct signalfd_siginfo si;
+  struct pollfd pfd = {fd, POLLIN};
+  ASSERT_NE(-1, (pid = fork()));
+  if (!pid) _exit(7);
+  ASSERT_EQ(1, poll(&pfd, 1, 5000));
+  ASSERT_EQ(sizeof(si), read(fd, &si, sizeof(si)));
+  ASSERT_EQ(SIGCHLD, si.ssi_signo);
+  ASSERT_EQ(pid, waitpid(pid, 0, 0));
+}
+
+TEST(signalfd, unwatched) {
+  sigset_t usr2;
+  struct signalfd_siginfo si;
+  sigemptyset(&usr2);
+  sigaddset(&usr2, SIGUSR2);
+  ASSERT_EQ(0, sigprocmask(SIG_BLOCK, &usr2, 0));
+  ASSERT_EQ(0, kill(getpid(), SIGUSR2));
+  ASSERT_EQ(-1, read(fd, &si, sizeof(si)));
+  ASSERT_EQ(EAGAIN, errno);
+  // signalfd() with an existing fd changes which signals it watches
+  ASSERT_EQ(fd, signalfd(fd, &usr2, 0));
+  ASSERT_EQ(sizeof(si), read(fd, &si, sizeof(si)));
+  ASSERT_EQ(SIGUSR2, si.ssi_signo);
+  ASSERT_EQ(0, sigprocmask(SIG_UNBLOCK, &usr2, 0));
+}
@@ -0,0 +1,169 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <fcntl.h>
+#include <sys/syscall.h>
+
+#include "test/test.h"
+
+#ifndef SYS_copy_file_range
+#define SYS_copy_file_range 326
+#endif
+
+int fd, fd2, pfd[2], pfd2[2];
+char path[] = "/tmp/blink.test.XXXXXX";
+char path2[] = "/tmp/blink.test.XXXXXX";
+
+ssize_t Splice(int in, loff_t *inoff, int out, loff_t *outoff, size_t n) {
+  return syscall(SYS_splice, in, inoff, out, outoff, n, 0);
+}
+
+ssize_t Tee(int in, int out, size_t n) {
+  return syscall(SYS_tee, in, out, n, 0);
+}
+
+ssize_t CopyFileRange(int in, loff_t *inoff, int out, loff_t *outoff,
+                      size_t n) {
+  return syscall(SYS_copy_file_range, in, inoff, out, outoff, n, 0);
+}
+
+void SetUp(void) {
+  ASSERT_NE(-1, (fd = mkstemp(path)));
+  ASSERT_NE(-1, (fd2 = mkstemp(path2)));
+  ASSERT_EQ(0, pipe(pfd));
+  ASSERT_EQ(0, pipe(pfd2));
+}
+
+void TearDown(void) {
+  close(pfd2[1]);
+  close(pfd2[0]);
+  close(pfd[1]);
+  close(pfd[0]);
+  close(fd2);
+  close(fd);
+  unlink(path2);
+  unlink(path);
+  strcpy(path, "/tmp/blink.test.XXXXXX");
+  strcpy(path2, "/tmp/blink.test.XXXXXX");
+}
+
+TEST(splice, pipeToFile) {
+  char buf[16] = {0};
+  loff_t off = 4;
+  ASSERT_EQ(11, write(pfd[1], "hello world", 11));
+  // splicing into a file at an offset leaves the file position alone
+  ASSERT_EQ(5, Splice(pfd[0], 0, fd, &off, 5));
+  ASSERT_EQ(9, off);
+  ASSERT_EQ(0, lseek(fd, 0, SEEK_CUR));
+  // and otherwise it writes at the file position
+  ASSERT_EQ(6, Splice(pfd[0], 0, fd, 0, 100));
+  ASSERT_EQ(6, lseek(fd, 0, SEEK_CUR));
+  ASSERT_EQ(9, pread(fd, buf, sizeof(buf), 0));
+  ASSERT_EQ(0, memcmp(" worldllo", buf, 9));
+}
+
+TEST(splice, fileToPipe) {
+  char buf[16] = {0};
+  loff_t off = 6;
+  ASSERT_EQ(11, write(fd, "hello world", 11));
+  ASSERT_EQ(5, Splice(fd, &off, pfd[1], 0, 100));
+  ASSERT_EQ(11, off);
+  ASSERT_EQ(5, read(pfd[0], buf, sizeof(buf)));
+  ASSERT_STREQ("world", buf);
+}
+
+TEST(splice, errors) {
+  loff_t off = 0;
+  ASSERT_EQ(-1, Splice(fd, 0, fd2, 0, 1));  // one end must be a pipe
+  ASSERT_EQ(EINVAL, errno);
+  ASSERT_EQ(-1, Splice(pfd[0], &off, fd, 0, 1));  // pipes can't seek
+  ASSERT_EQ(ESPIPE, errno);
+  ASSERT_EQ(-1, Splice(pfd[1], 0, fd, 0, 1));  // write end of pipe
+  ASSERT_EQ(EBADF, errno);
+}
+
+TEST(tee, duplicatesWithoutConsuming) {
+  ssize_t rc;
+  char buf[16] = {0};
+  ASSERT_EQ(5, write(pfd[1], "hello", 5));
+  if ((rc = Tee(pfd[0], pfd2[1], 100)) == -1) {
+    // blink can only do this when it's able to ask the host
+    ASSERT_EQ(ENOSYS, errno);
+    return;
+  }
+  ASSERT_EQ(5, rc);
+  ASSERT_EQ(5, read(pfd2[0], buf, sizeof(buf)));
+  ASSERT_STREQ("hello", buf);
+  memset(buf, 0, sizeof(buf));
+  ASSERT_EQ(5, read(pfd[0], buf, sizeof(buf)));
+  ASSERT_STREQ("hello", buf);
+}
+
+TEST(tee, mustBeTwoPipes) {
+  ASSERT_EQ(-1, Tee(pfd[0], fd, 1));
+  ASSERT_EQ(EINVAL, errno);
+}
+
+TEST(copy_file_range, offsets) {
+  char buf[16] = {0};
+  loff_t inoff = 6, outoff = 2;
+  ASSERT_EQ(11, write(fd, "hello world", 11));
+  ASSERT_EQ(3, CopyFileRange(fd, &inoff, fd2, &outoff, 3));
+  ASSERT_EQ(9, inoff);
+  ASSERT_EQ(5, outoff);
+  // explicit offsets leave both file positions where they were
+  ASSERT_EQ(11, lseek(fd, 0, SEEK_CUR));
+  ASSERT_EQ(0, lseek(fd2, 0, SEEK_CUR));
+  ASSERT_EQ(5, pread(fd2, buf, sizeof(buf), 0));
+  ASSERT_EQ(0, memcmp("\0\0wor", buf, 5));
+}
+
+TEST(copy_file_range, filePositions) {
+  char buf[16] = {0};
+  ASSERT_EQ(11, write(fd, "hello world", 11));
+  ASSERT_EQ(6, lseek(fd, 6, SEEK_SET));
+  ASSERT_EQ(5, CopyFileRange(fd, 0, fd2, 0, 5));
+  ASSERT_EQ(11, lseek(fd, 0, SEEK_CUR));
+  ASSERT_EQ(5, lseek(fd2, 0, SEEK_CUR));
+  ASSERT_EQ(5, pread(fd2, buf, sizeof(buf), 0));
+  ASSERT_STREQ("world", buf);
+}
+
+TEST(copy_file_range, endOfFile) {
+  loff_t inoff = 8, outoff = 0;
+  ASSERT_EQ(11, write(fd, "hello world", 11));
+  // asking for more than is left gets a short count
+  ASSERT_EQ(3, CopyFileRange(fd, &inoff, fd2, &outoff, 100));
+  ASSERT_EQ(11, inoff);
+  // and nothing at all once the end has been reached
+  ASSERT_EQ(0, CopyFileRange(fd, &inoff, fd2, &outoff, 100));
+  ASSERT_EQ(11, inoff);
+  ASSERT_EQ(3, outoff);
+  inoff = 1000;
+  ASSERT_EQ(0, CopyFileRange(fd, &inoff, fd2, &outoff, 100));
+  ASSERT_EQ(1000, inoff);
+}
+
+TEST(copy_file_range, errors) {
+  ASSERT_EQ(-1, syscall(SYS_copy_file_range, fd, 0, fd2, 0, 1, 1));
+  ASSERT_EQ(EINVAL, errno);
+  ASSERT_EQ(0, close(fd2));
+  ASSERT_NE(-1, (fd2 = open(path2, O_RDONLY)));
+  ASSERT_EQ(-1, CopyFileRange(fd, 0, fd2, 0, 1));
+  ASSERT_EQ(EBADF, errno);
+}
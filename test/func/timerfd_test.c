@@ -0,0 +1,103 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+
+#include "test/test.h"
+
+int fd;
+
+void SetUp(void) {
+}
+
+void TearDown(void) {
+  close(fd);
+}
+
+TEST(timerfd, oneshot) {
+  u64 x;
+  struct pollfd pfd;
+  struct itimerspec it = {{0, 0}, {0, 10000000}};
+  ASSERT_NE(-1, (fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)));
+  ASSERT_EQ(0, timerfd_settime(fd, 0, &it, 0));
+  ASSERT_EQ(8, read(fd, &x, 8));
+  ASSERT_EQ(1, x);
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  ASSERT_EQ(0, poll(&pfd, 1, 30));
+  ASSERT_EQ(0, timerfd_gettime(fd, &it));
+  ASSERT_EQ(0, it.it_value.tv_sec);
+  ASSERT_EQ(0, it.it_value.tv_nsec);
+}
+
+TEST(timerfd, interval) {
+  u64 x;
+  struct timespec ts = {0, 50000000};
+  struct itimerspec it = {{0, 5000000}, {0, 5000000}};
+  ASSERT_NE(-1, (fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)));
+  ASSERT_EQ(-1, read(fd, &x, 8));
+  ASSERT_EQ(EAGAIN, errno);
+  ASSERT_EQ(0, timerfd_settime(fd, 0, &it, 0));
+  nanosleep(&ts, 0);
+  // several intervals elapsed and are reported as a single count
+  ASSERT_EQ(8, read(fd, &x, 8));
+  ASSERT_LE(2, x);
+  ASSERT_EQ(0, timerfd_gettime(fd, &it));
+  ASSERT_EQ(0, it.it_interval.tv_sec);
+  ASSERT_EQ(5000000, it.it_interval.tv_nsec);
+  ASSERT_LE(it.it_value.tv_nsec, 5000000);
+}
+
+TEST(timerfd, disarm) {
+  u64 x;
+  struct itimerspec old, it = {{1, 0}, {100, 0}};
+  ASSERT_NE(-1, (fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK)));
+  ASSERT_EQ(0, timerfd_settime(fd, 0, &it, 0));
+  memset(&it, 0, sizeof(it));
+  ASSERT_EQ(0, timerfd_settime(fd, 0, &it, &old));
+  ASSERT_EQ(1, old.it_interval.tv_sec);
+  ASSERT_LE(old.it_value.tv_sec, 100);
+  ASSERT_LE(98, old.it_value.tv_sec);
+  ASSERT_EQ(0, timerfd_gettime(fd, &it));
+  ASSERT_EQ(0, it.it_value.tv_sec);
+  ASSERT_EQ(0, it.it_value.tv_nsec);
+  ASSERT_EQ(-1, read(fd, &x, 8));
+  ASSERT_EQ(EAGAIN, errno);
+}
+
+TEST(timerfd, abstime) {
+  u64 x;
+  struct itimerspec it = {{0, 0}, {0, 0}};
+  ASSERT_NE(-1, (fd = timerfd_create(CLOCK_MONOTONIC, 0)));
+  // an absolute time in the past expires right away
+  ASSERT_EQ(0, clock_gettime(CLOCK_MONOTONIC, &it.it_value));
+  ASSERT_EQ(0, timerfd_settime(fd, TFD_TIMER_ABSTIME, &it, 0));
+  ASSERT_EQ(8, read(fd, &x, 8));
+  ASSERT_EQ(1, x);
+}
+
+TEST(timerfd, einval) {
+  struct itimerspec it = {{0, 0}, {0, 1000000000}};
+  ASSERT_EQ(-1, timerfd_create(-1, 0));
+  ASSERT_EQ(EINVAL, errno);
+  ASSERT_NE(-1, (fd = timerfd_create(CLOCK_MONOTONIC, 0)));
+  ASSERT_EQ(-1, timerfd_settime(fd, 0, &it, 0));
+  ASSERT_EQ(EINVAL, errno);
+}
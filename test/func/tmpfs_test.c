@@ -0,0 +1,239 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <dirent.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include "test/test.h"
+
+/*
+ * tests the in-memory filesystem blink provides when it's built using
+ * --enable-vfs. it's skipped when mounting isn't possible, e.g. when
+ * blink was built without the vfs, or natively when we aren't root
+ */
+
+char root[64];
+char path[128];
+char path2[128];
+
+static void Unmount(void) {
+  umount2(root, MNT_DETACH);
+}
+
+void SetUp(void) {
+  int ws, pid;
+  if (*root) return;
+  strcpy(root, "/tmp/tmpfs_test.XXXXXX");
+  ASSERT_NOTNULL(mkdtemp(root));
+  // the mount belongs to a child, so we can remove its mount point after
+  ASSERT_NE(-1, (pid = fork()));
+  if (pid) {
+    ASSERT_EQ(pid, waitpid(pid, &ws, 0));
+    ASSERT_EQ(0, rmdir(root));
+    exit(WIFEXITED(ws) ? WEXITSTATUS(ws) : 128 + WTERMSIG(ws));
+  }
+  // keep a native run from touching the host's mount table
+  if (!unshare(CLONE_NEWNS)) {
+    mount(0, "/", 0, MS_REC | MS_PRIVATE, 0);
+  }
+  if (mount("tmpfs", root, "tmpfs", 0, 0)) {
+    exit(0);
+  }
+  atexit(Unmount);
+}
+
+void TearDown(void) {
+}
+
+char *Path(const char *name) {
+  snprintf(path, sizeof(path), "%s/%s", root, name);
+  return path;
+}
+
+char *Path2(const char *name) {
+  snprintf(path2, sizeof(path2), "%s/%s", root, name);
+  return path2;
+}
+
+TEST(tmpfs, read_write) {
+  int fd;
+  char buf[8] = {0};
+  struct stat st;
+  ASSERT_NE(-1, (fd = open(Path("rw"), O_CREAT | O_EXCL | O_RDWR, 0644)));
+  ASSERT_EQ(5, write(fd, "hello", 5));
+  ASSERT_EQ(3, pread(fd, buf, 3, 1));
+  ASSERT_STREQ("ell", buf);
+  ASSERT_EQ(0, fstat(fd, &st));
+  ASSERT_EQ(5, st.st_size);
+  ASSERT_TRUE(S_ISREG(st.st_mode));
+  ASSERT_EQ(0644, st.st_mode & 07777 & ~0022);
+  ASSERT_EQ(0, close(fd));
+  ASSERT_EQ(-1, open(Path("rw"), O_CREAT | O_EXCL | O_RDWR, 0644));
+  ASSERT_EQ(EEXIST, errno);
+  ASSERT_EQ(0, unlink(Path("rw")));
+  ASSERT_EQ(-1, open(Path("rw"), O_RDONLY));
+  ASSERT_EQ(ENOENT, errno);
+}
+
+TEST(tmpfs, sparse) {
+  int fd;
+  char buf[16];
+  struct stat st;
+  ASSERT_NE(-1, (fd = open(Path("sparse"), O_CREAT | O_RDWR, 0644)));
+  ASSERT_EQ(1, pwrite(fd, "x", 1, 100000));
+  ASSERT_EQ(0, fstat(fd, &st));
+  ASSERT_EQ(100001, st.st_size);
+  memset(buf, 1, sizeof(buf));
+  ASSERT_EQ(16, pread(fd, buf, 16, 70000));
+  ASSERT_EQ(0, memcmp(buf, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 16));
+  ASSERT_EQ(1, pread(fd, buf, 16, 100000));
+  ASSERT_EQ('x', buf[0]);
+  ASSERT_EQ(0, pread(fd, buf, 16, 100001));
+  ASSERT_EQ(100001, lseek(fd, 0, SEEK_END));
+  ASSERT_EQ(0, close(fd));
+  ASSERT_EQ(0, unlink(Path("sparse")));
+}
+
+TEST(tmpfs, truncate) {
+  int fd;
+  char buf[8];
+  ASSERT_NE(-1, (fd = open(Path("trunc"), O_CREAT | O_RDWR, 0644)));
+  ASSERT_EQ(8, write(fd, "abcdefgh", 8));
+  ASSERT_EQ(0, ftruncate(fd, 2));
+  ASSERT_EQ(0, ftruncate(fd, 6));
+  ASSERT_EQ(6, pread(fd, buf, 8, 0));
+  ASSERT_EQ(0, memcmp(buf, "ab\0\0\0\0", 6));
+  ASSERT_EQ(0, close(fd));
+  ASSERT_EQ(0, unlink(Path("trunc")));
+}
+
+TEST(tmpfs, append) {
+  int fd;
+  char buf[8] = {0};
+  ASSERT_NE(-1, (fd = open(Path("app"), O_CREAT | O_RDWR | O_APPEND, 0644)));
+  ASSERT_EQ(3, write(fd, "abc", 3));
+  ASSERT_EQ(0, lseek(fd, 0, SEEK_SET));
+  ASSERT_EQ(3, write(fd, "def", 3));
+  ASSERT_EQ(6, pread(fd, buf, 8, 0));
+  ASSERT_STREQ("abcdef", buf);
+  ASSERT_EQ(0, close(fd));
+  ASSERT_EQ(0, unlink(Path("app")));
+}
+
+TEST(tmpfs, unlink_while_open) {
+  int fd;
+  char buf[8] = {0};
+  struct stat st;
+  ASSERT_NE(-1, (fd = open(Path("gone"), O_CREAT | O_RDWR, 0644)));
+  ASSERT_EQ(4, write(fd, "data", 4));
+  ASSERT_EQ(0, unlink(Path("gone")));
+  ASSERT_EQ(-1, stat(Path("gone"), &st));
+  ASSERT_EQ(ENOENT, errno);
+  ASSERT_EQ(0, fstat(fd, &st));
+  ASSERT_EQ(0, st.st_nlink);
+  ASSERT_EQ(4, pread(fd, buf, 8, 0));
+  ASSERT_STREQ("data", buf);
+  ASSERT_EQ(0, close(fd));
+}
+
+TEST(tmpfs, directories) {
+  DIR *d;
+  int fd, n;
+  struct stat st;
+  struct dirent *e;
+  ASSERT_EQ(0, mkdir(Path("dir"), 0755));
+  ASSERT_EQ(-1, mkdir(Path("dir"), 0755));
+  ASSERT_EQ(EEXIST, errno);
+  ASSERT_NE(-1, (fd = creat(Path("dir/a"), 0644)));
+  ASSERT_EQ(0, close(fd));
+  ASSERT_NE(-1, (fd = creat(Path("dir/b"), 0644)));
+  ASSERT_EQ(0, close(fd));
+  ASSERT_EQ(-1, rmdir(Path("dir")));
+  ASSERT_EQ(ENOTEMPTY, errno);
+  ASSERT_NOTNULL((d = opendir(Path("dir"))));
+  for (n = 0; (e = readdir(d));) {
+    if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")) continue;
+    ASSERT_TRUE(!strcmp(e->d_name, "a") || !strcmp(e->d_name, "b"));
+    ++n;
+  }
+  ASSERT_EQ(2, n);
+  ASSERT_EQ(0, closedir(d));
+  // renaming over an existing file replaces it
+  ASSERT_EQ(0, rename(Path("dir/a"), Path2("dir/b")));
+  ASSERT_EQ(-1, stat(Path("dir/a"), &st));
+  ASSERT_EQ(ENOENT, errno);
+  ASSERT_EQ(0, rename(Path("dir/b"), Path2("moved")));
+  ASSERT_EQ(0, stat(Path("moved"), &st));
+  ASSERT_EQ(0, unlink(Path("moved")));
+  ASSERT_EQ(0, rmdir(Path("dir")));
+  ASSERT_EQ(-1, stat(Path("dir"), &st));
+  ASSERT_EQ(ENOENT, errno);
+}
+
+TEST(tmpfs, links) {
+  int fd;
+  char buf[64];
+  struct stat st;
+  ASSERT_NE(-1, (fd = creat(Path("orig"), 0644)));
+  ASSERT_EQ(2, write(fd, "hi", 2));
+  ASSERT_EQ(0, close(fd));
+  ASSERT_EQ(0, link(Path("orig"), Path2("hard")));
+  ASSERT_EQ(0, stat(Path("orig"), &st));
+  ASSERT_EQ(2, st.st_nlink);
+  ASSERT_EQ(0, symlink("orig", Path("soft")));
+  ASSERT_EQ(4, readlink(Path("soft"), buf, sizeof(buf)));
+  ASSERT_EQ(0, memcmp(buf, "orig", 4));
+  ASSERT_EQ(0, stat(Path("soft"), &st));
+  ASSERT_EQ(2, st.st_size);
+  ASSERT_EQ(0, lstat(Path("soft"), &st));
+  ASSERT_TRUE(S_ISLNK(st.st_mode));
+  ASSERT_EQ(0, unlink(Path("orig")));
+  ASSERT_EQ(0, stat(Path("hard"), &st));
+  ASSERT_EQ(1, st.st_nlink);
+  ASSERT_EQ(-1, stat(Path("soft"), &st));
+  ASSERT_EQ(ENOENT, errno);
+  ASSERT_EQ(0, unlink(Path("soft")));
+  ASSERT_EQ(0, unlink(Path("hard")));
+}
+
+TEST(tmpfs, mmap_shared) {
+  int fd;
+  char *p, buf[8] = {0};
+  ASSERT_NE(-1, (fd = open(Path("map"), O_CREAT | O_RDWR, 0644)));
+  ASSERT_EQ(0, ftruncate(fd, 65536));
+  ASSERT_NE((intptr_t)MAP_FAILED,
+            (intptr_t)(p = (char *)mmap(0, 65536, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED, fd, 0)));
+  memcpy(p + 4096, "mapped", 6);
+  ASSERT_EQ(0, msync(p, 65536, MS_SYNC));
+  ASSERT_EQ(6, pread(fd, buf, 6, 4096));
+  ASSERT_STREQ("mapped", buf);
+  memcpy(p + 8192, "again", 5);
+  ASSERT_EQ(0, munmap(p, 65536));
+  ASSERT_EQ(5, pread(fd, buf, 5, 8192));
+  ASSERT_EQ(0, memcmp(buf, "again", 5));
+  ASSERT_EQ(0, close(fd));
+  ASSERT_EQ(0, unlink(Path("map")));
+}
@@ -0,0 +1,100 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <elf.h>
+#include <sys/auxv.h>
+#include <sys/syscall.h>
+#include <time.h>
+
+#include "test/test.h"
+
+Elf64_Ehdr *ehdr;
+
+// looks up vdso function using its sysv hash table
+void *GetVdsoSymbol(const char *name) {
+  int i;
+  Elf64_Dyn *d;
+  Elf64_Sym *sym;
+  Elf64_Phdr *phdr;
+  const char *strs = 0;
+  const Elf32_Word *hash = 0;
+  intptr_t bias = 0, dyn = 0;
+  phdr = (Elf64_Phdr *)((char *)ehdr + ehdr->e_phoff);
+  for (i = 0; i < ehdr->e_phnum; ++i) {
+    if (phdr[i].p_type == PT_LOAD) {
+      bias = (intptr_t)ehdr + phdr[i].p_offset - phdr[i].p_vaddr;
+    } else if (phdr[i].p_type == PT_DYNAMIC) {
+      dyn = phdr[i].p_vaddr;
+    }
+  }
+  if (!dyn) return 0;
+  sym = 0;
+  for (d = (Elf64_Dyn *)(bias + dyn); d->d_tag != DT_NULL; ++d) {
+    if (d->d_tag == DT_HASH) hash = (Elf32_Word *)(bias + d->d_un.d_ptr);
+    if (d->d_tag == DT_SYMTAB) sym = (Elf64_Sym *)(bias + d->d_un.d_ptr);
+    if (d->d_tag == DT_STRTAB) strs = (char *)(bias + d->d_un.d_ptr);
+  }
+  if (!hash || !sym || !strs) return 0;
+  for (i = 0; i < hash[1]; ++i) {
+    if (ELF64_ST_TYPE(sym[i].st_info) == STT_FUNC && sym[i].st_shndx &&
+        !strcmp(strs + sym[i].st_name, name)) {
+      return (void *)(bias + sym[i].st_value);
+    }
+  }
+  return 0;
+}
+
+i64 Nanos(struct timespec ts) {
+  return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+void SetUp(void) {
+  ASSERT_TRUE((ehdr = (Elf64_Ehdr *)getauxval(AT_SYSINFO_EHDR)));
+  ASSERT_EQ(0, memcmp(ehdr->e_ident, ELFMAG, SELFMAG));
+  ASSERT_EQ(ET_DYN, ehdr->e_type);
+}
+
+void TearDown(void) {
+}
+
+TEST(vdso, clock_gettime) {
+  int i;
+  struct timespec a, b, c;
+  int (*f)(clockid_t, struct timespec *);
+  ASSERT_TRUE((f = GetVdsoSymbol("__vdso_clock_gettime")));
+  for (i = 0; i < 10; ++i) {
+    ASSERT_EQ(0, syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &a));
+    ASSERT_EQ(0, f(CLOCK_MONOTONIC, &b));
+    ASSERT_EQ(0, syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &c));
+    ASSERT_LE(Nanos(a), Nanos(b));
+    ASSERT_LE(Nanos(b), Nanos(c));
+  }
+  ASSERT_EQ(0, f(CLOCK_REALTIME, &b));
+  ASSERT_EQ(0, syscall(SYS_clock_gettime, CLOCK_REALTIME, &c));
+  ASSERT_LE(Nanos(c) - Nanos(b), 1000000000);
+  ASSERT_EQ(-EINVAL, f(-1, &b));
+}
+
+TEST(vdso, time) {
+  time_t x, y;
+  time_t (*f)(time_t *);
+  ASSERT_TRUE((f = GetVdsoSymbol("__vdso_time")));
+  x = f(&y);
+  ASSERT_EQ(x, y);
+  ASSERT_LE(x, syscall(SYS_time, 0));
+}
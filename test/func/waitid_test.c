@@ -0,0 +1,152 @@
+/*-*- mode:c;indent-tabs-mode:nil;c-basic-offset:2;tab-width:8;coding:utf-8 -*-│
+│vi: set net ft=c ts=2 sts=2 sw=2 fenc=utf-8                                :vi│
+╞══════════════════════════════════════════════════════════════════════════════╡
+│ Copyright 2023 Justine Alexandra Roberts Tunney                              │
+│                                                                              │
+│ Permission to use, copy, modify, and/or distribute this software for         │
+│ any purpose with or without fee is hereby granted, provided that the         │
+│ above copyright notice and this permission notice appear in all copies.      │
+│                                                                              │
+│ THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL                │
+│ WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED                │
+│ WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE             │
+│ AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL         │
+│ DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR        │
+│ PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER               │
+│ TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR             │
+│ PERFORMANCE OF THIS SOFTWARE.                                                │
+╚─────────────────────────────────────────────────────────────────────────────*/
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "test/test.h"
+
+int pid;
+
+void SetUp(void) {
+  pid = 0;
+}
+
+void TearDown(void) {
+  if (pid) {
+    kill(pid, SIGKILL);
+    waitpid(pid, 0, 0);
+  }
+}
+
+int Spawn(int code) {
+  int pid;
+  if (!(pid = fork())) _exit(code);
+  return pid;
+}
+
+TEST(waitid, exited) {
+  siginfo_t si;
+  ASSERT_NE(-1, (pid = Spawn(42)));
+  memset(&si, -1, sizeof(si));
+  ASSERT_EQ(0, waitid(P_PID, pid, &si, WEXITED));
+  ASSERT_EQ(SIGCHLD, si.si_signo);
+  ASSERT_EQ(CLD_EXITED, si.si_code);
+  ASSERT_EQ(pid, si.si_pid);
+  ASSERT_EQ(getuid(), si.si_uid);
+  ASSERT_EQ(42, si.si_status);
+  pid = 0;
+  ASSERT_EQ(-1, waitid(P_ALL, 0, &si, WEXITED));
+  ASSERT_EQ(ECHILD, errno);
+}
+
+TEST(waitid, killed) {
+  siginfo_t si;
+  ASSERT_NE(-1, (pid = fork()));
+  if (!pid) {
+    for (;;) pause();
+  }
+  ASSERT_EQ(0, kill(pid, SIGTERM));
+  ASSERT_EQ(0, waitid(P_PID, pid, &si, WEXITED));
+  ASSERT_EQ(CLD_KILLED, si.si_code);
+  ASSERT_EQ(SIGTERM, si.si_status);
+  pid = 0;
+}
+
+TEST(waitid, wnowait) {
+  int ws;
+  siginfo_t si;
+  ASSERT_NE(-1, (pid = Spawn(3)));
+  ASSERT_EQ(0, waitid(P_PID, pid, &si, WEXITED | WNOWAIT));
+  ASSERT_EQ(pid, si.si_pid);
+  ASSERT_EQ(3, si.si_status);
+  // the child is still a zombie, so it can be waited on again
+  ASSERT_EQ(0, waitid(P_ALL, 0, &si, WEXITED | WNOWAIT));
+  ASSERT_EQ(pid, si.si_pid);
+  ASSERT_EQ(pid, waitpid(pid, &ws, 0));
+  ASSERT_TRUE(WIFEXITED(ws));
+  ASSERT_EQ(3, WEXITSTATUS(ws));
+  pid = 0;
+}
+
+TEST(waitid, wnohang) {
+  siginfo_t si;
+  ASSERT_NE(-1, (pid = fork()));
+  if (!pid) {
+    for (;;) pause();
+  }
+  // linux clears the siginfo when nothing is waitable
+  memset(&si, -1, sizeof(si));
+  ASSERT_EQ(0, waitid(P_PID, pid, &si, WEXITED | WNOHANG));
+  ASSERT_EQ(0, si.si_pid);
+  ASSERT_EQ(0, si.si_signo);
+}
+
+TEST(waitid, stopped_continued) {
+  siginfo_t si;
+  ASSERT_NE(-1, (pid = fork()));
+  if (!pid) {
+    for (;;) pause();
+  }
+  ASSERT_EQ(0, kill(pid, SIGSTOP));
+  ASSERT_EQ(0, waitid(P_PID, pid, &si, WSTOPPED));
+  ASSERT_EQ(CLD_STOPPED, si.si_code);
+  ASSERT_EQ(SIGSTOP, si.si_status);
+  ASSERT_EQ(0, kill(pid, SIGCONT));
+  ASSERT_EQ(0, waitid(P_PID, pid, &si, WCONTINUED));
+  ASSERT_EQ(CLD_CONTINUED, si.si_code);
+  ASSERT_EQ(SIGCONT, si.si_status);
+}
+
+TEST(waitid, pgid) {
+  siginfo_t si;
+  ASSERT_NE(-1, (pid = fork()));
+  if (!pid) {
+    setpgid(0, 0);
+    _exit(5);
+  }
+  setpgid(pid, pid);
+  ASSERT_EQ(0, waitid(P_PGID, pid, &si, WEXITED));
+  ASSERT_EQ(pid, si.si_pid);
+  ASSERT_EQ(5, si.si_status);
+  pid = 0;
+}
+
+TEST(waitid, rusage) {
+  siginfo_t si;
+  struct rusage ru;
+  ASSERT_NE(-1, (pid = Spawn(9)));
+  memset(&ru, -1, sizeof(ru));
+  ASSERT_EQ(0, syscall(SYS_waitid, P_PID, pid, &si, WEXITED, &ru));
+  ASSERT_EQ(pid, si.si_pid);
+  ASSERT_EQ(9, si.si_status);
+  ASSERT_LE(0, ru.ru_utime.tv_usec);
+  ASSERT_LT(ru.ru_utime.tv_usec, 1000000);
+  // the child was reaped along with its resource usage
+  pid = 0;
+  ASSERT_EQ(-1, waitid(P_ALL, 0, &si, WEXITED | WNOHANG));
+  ASSERT_EQ(ECHILD, errno);
+}
+
+TEST(waitid, einval) {
+  siginfo_t si;
+  ASSERT_EQ(-1, waitid(P_ALL, 0, &si, 0));
+  ASSERT_EQ(EINVAL, errno);
+}
@@ -0,0 +1,43 @@
+#-*-mode:makefile-gmake;indent-tabs-mode:t;tab-width:8;coding:utf-8-*-┐
+#───vi: set et ft=make ts=8 tw=8 fenc=utf-8 :vi───────────────────────┘
+
+PKGS += TEST_MACRO
+
+MACRO_RUNS ?= 5
+MACRO_THRESHOLD ?= 5
+MACRO_FLAGS ?=
+MACRO_CORPUS ?= test/macro/corpus.txt
+MACRO_BASELINE ?= o/$(MODE)/test/macro/baseline.json
+
+o/$(MODE)/test/macro/macrobench: test/macro/macrobench.c
+	@mkdir -p $(@D)
+	$(CC) -O2 -o $@ $<
+
+# make macrobench
+# runs the corpus and compares it against the baseline from last time
+# which is created by the first run, or by `make macrobench-baseline`
+.PHONY: o/$(MODE)/test/macro
+o/$(MODE)/test/macro:							\
+		o/$(MODE)/test/macro/macrobench				\
+		o/$(MODE)/blink/blink
+	o/$(MODE)/test/macro/macrobench					\
+		-n $(MACRO_RUNS)					\
+		-t $(MACRO_THRESHOLD)					\
+		-f "$(MACRO_FLAGS)"					\
+		-o o/$(MODE)/test/macro/results.json			\
+		$(if $(wildcard $(MACRO_BASELINE)),-b $(MACRO_BASELINE))\
+		o/$(MODE)/blink/blink					\
+		$(MACRO_CORPUS)
+	@test -f $(MACRO_BASELINE) ||					\
+	  cp o/$(MODE)/test/macro/results.json $(MACRO_BASELINE)
+
+.PHONY: o/$(MODE)/test/macro/baseline
+o/$(MODE)/test/macro/baseline:						\
+		o/$(MODE)/test/macro/macrobench				\
+		o/$(MODE)/blink/blink
+	o/$(MODE)/test/macro/macrobench					\
+		-n $(MACRO_RUNS)					\
+		-f "$(MACRO_FLAGS)"					\
+		-o $(MACRO_BASELINE)					\
+		o/$(MODE)/blink/blink					\
+		$(MACRO_CORPUS)
@@ -0,0 +1,309 @@
+// macro benchmark driver for blink
+//
+// runs each program in a corpus file under blink a fixed number of
+// times, and prints one json object per line with the median wall
+// time, peak resident memory, guest instruction count, and -Z stats
+// for each one. when a baseline file of previous results is given,
+// any metric that got worse by more than the threshold is reported,
+// and the exit status becomes nonzero.
+//
+//     usage: macrobench [-n RUNS] [-t PERCENT] [-b BASELINE]
+//                       [-o OUTPUT] [-f BLINKFLAGS] BLINK CORPUS
+//
+// each corpus line is a name followed by a command, where double
+// quotes group words with spaces and `#` starts a comment. entries
+// whose program doesn't exist are skipped. commands run in the
+// current directory with stdin and stdout bound to /dev/null.
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_ARGS  128
+#define MAX_RUNS  100
+#define MAX_STATS 256
+
+struct Stat {
+  char name[64];
+  double value;
+};
+
+struct Result {
+  char name[64];
+  int runs;
+  double wall_ms;
+  double wall_min_ms;
+  long rss_kb;
+  double instructions;
+  int nstats;
+  struct Stat stats[MAX_STATS];
+};
+
+static int g_runs = 5;
+static double g_threshold = 5;
+static const char *g_blink;
+static const char *g_output;
+static const char *g_baseline;
+static int g_nflags;
+static char *g_flags[MAX_ARGS];
+static FILE *g_out;
+
+static void Die(const char *thing, const char *reason) {
+  fprintf(stderr, "macrobench: %s: %s\n", thing, reason);
+  exit(2);
+}
+
+static double Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+static int CompareDoubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+// splits line into words in place, honoring double quotes
+static int Split(char *line, char **words, int max) {
+  int n = 0;
+  char *p, *q;
+  for (p = line;;) {
+    while (*p == ' ' || *p == '\t' || *p == '\n') ++p;
+    if (!*p || *p == '#') break;
+    if (n + 1 == max) Die(line, "too many words");
+    words[n++] = q = p;
+    for (;;) {
+      if (*p == '"') {
+        for (++p; *p && *p != '"'; *q++ = *p++) {
+        }
+        if (*p) ++p;
+      } else if (*p && *p != ' ' && *p != '\t' && *p != '\n') {
+        *q++ = *p++;
+      } else {
+        break;
+      }
+    }
+    if (*p) ++p;
+    *q = 0;
+  }
+  words[n] = 0;
+  return n;
+}
+
+// runs blink on the command once, returning wall time in milliseconds
+static double Run(char **cmd, bool stats, int errfd, long *rss_kb) {
+  int ws, fd;
+  pid_t pid;
+  double t0;
+  struct rusage ru;
+  char *argv[MAX_ARGS * 2 + 2];
+  int i, argc = 0;
+  argv[argc++] = (char *)g_blink;
+  for (i = 0; i < g_nflags; ++i) argv[argc++] = g_flags[i];
+  if (stats) argv[argc++] = "-Z";
+  for (i = 0; cmd[i]; ++i) argv[argc++] = cmd[i];
+  argv[argc] = 0;
+  t0 = Now();
+  if ((pid = fork()) == -1) Die("fork", strerror(errno));
+  if (!pid) {
+    if ((fd = open("/dev/null", O_RDWR)) == -1) _exit(127);
+    dup2(fd, 0);
+    dup2(fd, 1);
+    dup2(errfd != -1 ? errfd : fd, 2);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+  if (wait4(pid, &ws, 0, &ru) == -1) Die("wait4", strerror(errno));
+  if (!WIFEXITED(ws) || WEXITSTATUS(ws)) Die(cmd[0], "command failed");
+  *rss_kb = ru.ru_maxrss;
+  return Now() - t0;
+}
+
+// reads `name = value` lines printed by blink -Z
+static void ParseStats(FILE *f, struct Result *r) {
+  char line[256];
+  struct Stat *s;
+  while (fgets(line, sizeof(line), f) && r->nstats < MAX_STATS) {
+    s = r->stats + r->nstats;
+    if (sscanf(line, "%63[a-z0-9_] = %lf \n", s->name, &s->value) == 2 &&
+        !strchr(strchr(line, '=') + 2, ' ')) {
+      if (!strcmp(s->name, "instructions_jitted") ||
+          !strcmp(s->name, "interps")) {
+        r->instructions += s->value;
+      }
+      ++r->nstats;
+    }
+  }
+}
+
+static void Measure(const char *name, char **cmd, struct Result *r) {
+  FILE *f;
+  long rss;
+  int i, fd;
+  double wall[MAX_RUNS];
+  char path[] = "/tmp/macrobench.XXXXXX";
+  memset(r, 0, sizeof(*r));
+  snprintf(r->name, sizeof(r->name), "%s", name);
+  r->runs = g_runs;
+  for (i = 0; i < g_runs; ++i) {
+    wall[i] = Run(cmd, false, -1, &rss);
+    if (rss > r->rss_kb) r->rss_kb = rss;
+  }
+  qsort(wall, g_runs, sizeof(*wall), CompareDoubles);
+  r->wall_min_ms = wall[0];
+  r->wall_ms = g_runs & 1 ? wall[g_runs / 2]
+                          : (wall[g_runs / 2 - 1] + wall[g_runs / 2]) / 2;
+  // statistics are gathered with a separate run, since -Z slows the
+  // jit down by making it count each instruction that it executes
+  if ((fd = mkstemp(path)) == -1) Die(path, strerror(errno));
+  unlink(path);
+  Run(cmd, true, fd, &rss);
+  lseek(fd, 0, SEEK_SET);
+  if (!(f = fdopen(fd, "r"))) Die(path, strerror(errno));
+  ParseStats(f, r);
+  fclose(f);
+}
+
+static void Print(FILE *f, const struct Result *r) {
+  int i;
+  fprintf(f,
+          "{\"name\":\"%s\",\"runs\":%d,\"wall_ms\":%.3f,"
+          "\"wall_min_ms\":%.3f,\"rss_kb\":%ld,\"instructions\":%.0f,"
+          "\"stats\":{",
+          r->name, r->runs, r->wall_ms, r->wall_min_ms, r->rss_kb,
+          r->instructions);
+  for (i = 0; i < r->nstats; ++i) {
+    fprintf(f, "%s\"%s\":%.15g", i ? "," : "", r->stats[i].name,
+            r->stats[i].value);
+  }
+  fprintf(f, "}}\n");
+  fflush(f);
+}
+
+static bool GetNumber(const char *line, const char *key, double *x) {
+  const char *p;
+  char needle[80];
+  snprintf(needle, sizeof(needle), "\"%s\":", key);
+  if (!(p = strstr(line, needle))) return false;
+  *x = strtod(p + strlen(needle), 0);
+  return true;
+}
+
+static bool Worse(const char *name, const char *metric, double was,
+                  double now) {
+  double delta;
+  if (was <= 0) return false;
+  delta = (now - was) / was * 100;
+  if (delta <= g_threshold) return false;
+  fprintf(stderr, "macrobench: %s: %s regressed %.1f%% (%g -> %g)\n",
+          name, metric, delta, was, now);
+  return true;
+}
+
+// compares result against matching entry in baseline file, if any
+static bool Regressed(const struct Result *r) {
+  FILE *f;
+  bool bad;
+  char line[65536], needle[80];
+  double wall, rss, insns;
+  if (!g_baseline) return false;
+  if (!(f = fopen(g_baseline, "r"))) Die(g_baseline, strerror(errno));
+  snprintf(needle, sizeof(needle), "{\"name\":\"%s\",", r->name);
+  bad = false;
+  while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, needle, strlen(needle))) continue;
+    if (GetNumber(line, "wall_ms", &wall)) {
+      bad |= Worse(r->name, "wall_ms", wall, r->wall_ms);
+    }
+    if (GetNumber(line, "rss_kb", &rss)) {
+      bad |= Worse(r->name, "rss_kb", rss, r->rss_kb);
+    }
+    if (GetNumber(line, "instructions", &insns)) {
+      bad |= Worse(r->name, "instructions", insns, r->instructions);
+    }
+    break;
+  }
+  fclose(f);
+  return bad;
+}
+
+static bool Exists(const char *prog) {
+  return strchr(prog, '/') ? !access(prog, X_OK) : false;
+}
+
+int main(int argc, char *argv[]) {
+  FILE *corpus;
+  int opt, regressions;
+  char *flags = 0;
+  char line[4096];
+  char *words[MAX_ARGS];
+  static struct Result r;
+  while ((opt = getopt(argc, argv, "n:t:b:o:f:")) != -1) {
+    switch (opt) {
+      case 'n':
+        g_runs = atoi(optarg);
+        break;
+      case 't':
+        g_threshold = strtod(optarg, 0);
+        break;
+      case 'b':
+        g_baseline = optarg;
+        break;
+      case 'o':
+        g_output = optarg;
+        break;
+      case 'f':
+        flags = optarg;
+        break;
+      default:
+        return 2;
+    }
+  }
+  if (argc - optind != 2) {
+    fprintf(stderr,
+            "usage: %s [-n RUNS] [-t PERCENT] [-b BASELINE] [-o OUTPUT] "
+            "[-f BLINKFLAGS] BLINK CORPUS\n",
+            argv[0]);
+    return 2;
+  }
+  if (g_runs < 1 || g_runs > MAX_RUNS) Die("-n", "runs out of range");
+  if (flags) g_nflags = Split(flags, g_flags, MAX_ARGS);
+  g_blink = argv[optind];
+  if (!(corpus = fopen(argv[optind + 1], "r"))) {
+    Die(argv[optind + 1], strerror(errno));
+  }
+  if (!g_output) {
+    g_out = stdout;
+  } else if (!(g_out = fopen(g_output, "w"))) {
+    Die(g_output, strerror(errno));
+  }
+  regressions = 0;
+  while (fgets(line, sizeof(line), corpus)) {
+    if (Split(line, words, MAX_ARGS) < 2) continue;
+    if (!Exists(words[1])) {
+      fprintf(stderr, "macrobench: %s: skipped because %s isn't there\n",
+              words[0], words[1]);
+      continue;
+    }
+    Measure(words[0], words + 1, &r);
+    Print(g_out, &r);
+    if (g_out != stdout) Print(stdout, &r);
+    regressions += Regressed(&r);
+  }
+  fclose(corpus);
+  if (g_out != stdout) fclose(g_out);
+  if (regressions) {
+    fprintf(stderr, "macrobench: %d workload%s regressed over %g%%\n",
+            regressions, regressions == 1 ? "" : "s", g_threshold);
+    return 1;
+  }
+  return 0;
+}
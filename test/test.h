@@ -383,9 +383,12 @@ static void WaitForTerm(const char *file, int line, const char *code, int sig,
   exit(1);
 }
 
+// tests of libblink.a get the real one from libblink.o
+#ifndef TEST_LIBBLINK
 _Noreturn void TerminateSignal(struct Machine *m, int sig) {
   abort();
 }
+#endif
 
 int main(int argc, char *argv[]) {
   struct Test *test;
@@ -394,6 +397,7 @@ int main(int argc, char *argv[]) {
     test->func();
     TearDown();
     Collect(g_garbage);
+    g_garbage = 0;
   }
   return g_testing.fails;
 }
@@ -0,0 +1,160 @@
+// decodes BLINK_BTRACE files into text
+//
+//     usage: btrace [-c] FILE
+//
+// each system call is printed on its own line, with the seconds since
+// tracing began, the guest thread id, the call and its arguments, the
+// return value, and how many seconds were spent inside the call. the
+// -c flag instead prints a summary of the count, errors, and time, of
+// each system call, sorted by the total time spent inside of it.
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blink/btrace.h"
+
+struct Summary {
+  long calls;
+  long errors;
+  u64 nanos;
+  int sysno;
+};
+
+static const char *const kErrnos[] = {
+    0,         "EPERM",        "ENOENT",  "ESRCH",   "EINTR",   "EIO",
+    "ENXIO",   "E2BIG",        "ENOEXEC", "EBADF",   "ECHILD",  "EAGAIN",
+    "ENOMEM",  "EACCES",       "EFAULT",  "ENOTBLK", "EBUSY",   "EEXIST",
+    "EXDEV",   "ENODEV",       "ENOTDIR", "EISDIR",  "EINVAL",  "ENFILE",
+    "EMFILE",  "ENOTTY",       "ETXTBSY", "EFBIG",   "ENOSPC",  "ESPIPE",
+    "EROFS",   "EMLINK",       "EPIPE",   "EDOM",    "ERANGE",  "EDEADLK",
+    "ENAMETOOLONG", "ENOLCK",  "ENOSYS",  "ENOTEMPTY", "ELOOP",
+};
+
+static bool g_summary;
+static char g_names[4096][48];
+static struct Summary g_sums[4096];
+
+static const char *GetName(int sysno) {
+  static char buf[16];
+  if (g_names[sysno][0]) return g_names[sysno];
+  snprintf(buf, sizeof(buf), "syscall_0x%03x", sysno);
+  return buf;
+}
+
+static void PrintArg(u64 x) {
+  if ((long long)x >= -4096 && (long long)x < 65536) {
+    printf("%lld", (long long)x);
+  } else {
+    printf("%#llx", (unsigned long long)x);
+  }
+}
+
+static void PrintRecord(const struct BtraceHeader *hdr,
+                        const struct BtraceRecord *rec) {
+  int i;
+  u64 t = rec->start - hdr->monotonic;
+  printf("%llu.%06llu %5d %s(", (unsigned long long)(t / 1000000000),
+         (unsigned long long)(t % 1000000000 / 1000), rec->tid,
+         GetName(rec->sysno));
+  for (i = 0; i < rec->arity && i < 6; ++i) {
+    if (i) printf(", ");
+    PrintArg(rec->args[i]);
+  }
+  printf(") = ");
+  if (rec->rc < 0 && rec->rc > -4096) {
+    if (-rec->rc < sizeof(kErrnos) / sizeof(kErrnos[0])) {
+      printf("-1 %s", kErrnos[-rec->rc]);
+    } else {
+      printf("-1 errno %lld", -(long long)rec->rc);
+    }
+  } else {
+    PrintArg(rec->rc);
+  }
+  printf(" <%llu.%06llu>\n", (unsigned long long)(rec->duration / 1000000000),
+         (unsigned long long)(rec->duration % 1000000000 / 1000));
+}
+
+static int CompareSummaries(const void *a, const void *b) {
+  const struct Summary *x = (const struct Summary *)a;
+  const struct Summary *y = (const struct Summary *)b;
+  if (x->nanos != y->nanos) return x->nanos < y->nanos ? 1 : -1;
+  return x->calls < y->calls ? 1 : x->calls > y->calls ? -1 : 0;
+}
+
+static void PrintSummary(void) {
+  int i;
+  long calls = 0, errors = 0;
+  u64 nanos = 0;
+  for (i = 0; i < 4096; ++i) {
+    g_sums[i].sysno = i;
+    calls += g_sums[i].calls;
+    errors += g_sums[i].errors;
+    nanos += g_sums[i].nanos;
+  }
+  qsort(g_sums, 4096, sizeof(g_sums[0]), CompareSummaries);
+  printf("%% time     seconds  usecs/call     calls    errors syscall\n");
+  for (i = 0; i < 4096 && g_sums[i].calls; ++i) {
+    printf("%6.2f %11.6f %11llu %9ld %9ld %s\n",
+           nanos ? g_sums[i].nanos * 100. / nanos : 0.,
+           g_sums[i].nanos / 1e9,
+           (unsigned long long)(g_sums[i].nanos / g_sums[i].calls / 1000),
+           g_sums[i].calls, g_sums[i].errors, GetName(g_sums[i].sysno));
+  }
+  printf("%6.2f %11.6f %11s %9ld %9ld total\n", 100., nanos / 1e9, "", calls,
+         errors);
+}
+
+int main(int argc, char *argv[]) {
+  FILE *f;
+  const char *path;
+  struct BtraceHeader hdr;
+  struct BtraceRecord rec;
+  if (argc == 3 && !strcmp(argv[1], "-c")) {
+    g_summary = true;
+    path = argv[2];
+  } else if (argc == 2) {
+    path = argv[1];
+  } else {
+    fprintf(stderr, "usage: %s [-c] FILE\n", argv[0]);
+    return 1;
+  }
+  if (!(f = fopen(path, "rb"))) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != kBtraceMagic ||
+      hdr.recsize != sizeof(rec)) {
+    fprintf(stderr, "%s: not a btrace file for this host\n", path);
+    return 1;
+  }
+  while (fread(&rec, sizeof(rec), 1, f) == 1) {
+    rec.sysno &= 4095;
+    switch (rec.kind) {
+      case kBtraceName:
+        memcpy(g_names[rec.sysno], rec.args, sizeof(g_names[0]));
+        g_names[rec.sysno][sizeof(g_names[0]) - 1] = 0;
+        break;
+      case kBtraceLost:
+        if (!g_summary) {
+          printf("    ? %5d <%lld records lost>\n", rec.tid, (long long)rec.rc);
+        }
+        break;
+      case kBtraceSyscall:
+        if (g_summary) {
+          ++g_sums[rec.sysno].calls;
+          g_sums[rec.sysno].errors += rec.rc < 0 && rec.rc > -4096;
+          g_sums[rec.sysno].nanos += rec.duration;
+        } else {
+          PrintRecord(&hdr, &rec);
+        }
+        break;
+      default:
+        break;
+    }
+  }
+  fclose(f);
+  if (g_summary) PrintSummary();
+  return 0;
+}
@@ -0,0 +1,9 @@
+// checks for accept4() system call
+#include <errno.h>
+#include <sys/socket.h>
+
+int main(int argc, char *argv[]) {
+  if (accept4(-1, 0, 0, SOCK_CLOEXEC | SOCK_NONBLOCK) != -1) return 1;
+  if (errno != EBADF) return 2;
+  return 0;
+}
@@ -0,0 +1,18 @@
+// checks for copy_file_range() support
+#include <stdio.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+  FILE *f, *g;
+  char x, y;
+  off_t off;
+  if (!(f = tmpfile())) return 1;
+  if (!(g = tmpfile())) return 2;
+  x = 123;
+  if (write(fileno(f), &x, 1) != 1) return 3;
+  off = 0;
+  if (copy_file_range(fileno(f), &off, fileno(g), 0, 1, 0) != 1) return 4;
+  if (pread(fileno(g), &y, 1, 0) != 1 || y != 123) return 5;
+  return 0;
+}
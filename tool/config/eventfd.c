@@ -0,0 +1,14 @@
+// checks for linux eventfd() support
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+  int fd;
+  eventfd_t x;
+  if ((fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE)) == -1) {
+    return 1;
+  }
+  if (eventfd_write(fd, 2)) return 2;
+  if (eventfd_read(fd, &x) || x != 1) return 3;
+  return close(fd);
+}
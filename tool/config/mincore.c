@@ -0,0 +1,16 @@
+// checks for mincore()
+#include <sys/mman.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+  char *p;
+  unsigned char vec[1];
+  long pagesize = sysconf(_SC_PAGESIZE);
+  p = (char *)mmap(0, pagesize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return 1;
+  *p = 1;
+  if (mincore(p, pagesize, vec)) return 2;
+  if (!(vec[0] & 1)) return 3;
+  return munmap(p, pagesize);
+}
@@ -0,0 +1,27 @@
+// checks for linux sendmmsg() and recvmmsg() support
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+int main(int argc, char *argv[]) {
+  int fds[2];
+  char x, y;
+  struct iovec iv[2];
+  struct mmsghdr mm[2];
+  if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds)) return 1;
+  x = 123;
+  y = 0;
+  memset(mm, 0, sizeof(mm));
+  iv[0].iov_base = &x;
+  iv[0].iov_len = 1;
+  mm[0].msg_hdr.msg_iov = iv + 0;
+  mm[0].msg_hdr.msg_iovlen = 1;
+  if (sendmmsg(fds[0], mm, 1, 0) != 1) return 2;
+  iv[1].iov_base = &y;
+  iv[1].iov_len = 1;
+  mm[1].msg_hdr.msg_iov = iv + 1;
+  mm[1].msg_hdr.msg_iovlen = 1;
+  if (recvmmsg(fds[1], mm + 1, 1, MSG_WAITFORONE, 0) != 1) return 3;
+  if (mm[1].msg_len != 1 || y != 123) return 4;
+  return 0;
+}
@@ -0,0 +1,16 @@
+// checks for linux pidfd_open() and pidfd_send_signal() support
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+  int fd;
+  siginfo_t si;
+  if ((fd = syscall(SYS_pidfd_open, getpid(), 0)) == -1) return 1;
+  if (syscall(SYS_pidfd_send_signal, fd, 0, 0, 0)) return 2;
+  if (waitid((idtype_t)3 /* P_PIDFD */, fd, &si, WEXITED | WNOHANG) != -1) {
+    return 3;  // we aren't our own child
+  }
+  return close(fd);
+}
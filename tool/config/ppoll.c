@@ -0,0 +1,17 @@
+// checks for ppoll() support
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+
+int main(int argc, char *argv[]) {
+  sigset_t mask;
+  struct pollfd pfd;
+  struct timespec ts;
+  pfd.fd = -1;
+  pfd.events = POLLIN;
+  ts.tv_sec = 0;
+  ts.tv_nsec = 1000;
+  sigemptyset(&mask);
+  if (ppoll(&pfd, 1, &ts, &mask)) return 1;
+  return 0;
+}
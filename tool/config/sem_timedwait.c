@@ -0,0 +1,44 @@
+// test for interprocess semaphores that can be interrupted by signals
+// clang-format off
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+static void OnAlarm(int sig) {
+}
+
+int main(int argc, char *argv[]) {
+  int ws;
+  pid_t pid;
+  sem_t *s;
+  struct sigaction sa;
+  struct timespec ts;
+  if ((s = (sem_t *)mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) return 1;
+  if (sem_init(s, 1, 0)) return 2;
+  if ((pid = fork()) == -1) return 3;
+  if (!pid) {
+    alarm(2);
+    if (sem_post(s)) _exit(4);
+    _exit(0);
+  }
+  alarm(2);
+  if (sem_wait(s)) return 5;
+  if (wait(&ws) != pid) return 6;
+  if (!WIFEXITED(ws)) return 7;
+  if (WEXITSTATUS(ws)) return 8;
+  sa.sa_flags = 0;
+  sa.sa_handler = OnAlarm;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGALRM, &sa, 0)) return 9;
+  if (clock_gettime(CLOCK_REALTIME, &ts)) return 10;
+  ts.tv_sec += 3;
+  ualarm(10000, 0);
+  if (sem_timedwait(s, &ts) != -1) return 11;
+  if (errno != EINTR) return 12;
+  if (sem_destroy(s)) return 13;
+  return 0;
+}
@@ -0,0 +1,22 @@
+// checks for linux sendfile() support
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+  FILE *f;
+  off_t off;
+  int fds[2];
+  char x, y;
+  if (!(f = tmpfile())) return 1;
+  x = 123;
+  if (write(fileno(f), &x, 1) != 1) return 2;
+  if (pipe(fds)) return 3;
+  off = 0;
+  if (sendfile(fds[1], fileno(f), &off, 1) != 1) return 4;
+  if (off != 1) return 5;
+  if (read(fds[0], &y, 1) != 1) return 6;
+  if (y != 123) return 7;
+  return 0;
+}
@@ -0,0 +1,16 @@
+// checks for linux splice() and tee() support
+#include <fcntl.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+  char x, y;
+  int a[2], b[2];
+  if (pipe(a) || pipe(b)) return 1;
+  x = 123;
+  if (write(a[1], &x, 1) != 1) return 2;
+  if (tee(a[0], b[1], 1, 0) != 1) return 3;
+  if (splice(a[0], 0, b[1], 0, 1, 0) != 1) return 4;
+  if (read(b[0], &y, 1) != 1 || y != 123) return 5;
+  if (read(b[0], &y, 1) != 1 || y != 123) return 6;
+  return 0;
+}
@@ -0,0 +1,11 @@
+// checks for syscall(SYS_gettid)
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+  long tid;
+  tid = syscall(SYS_gettid);
+  if (tid == -1) return 1;
+  if (tid != getpid()) return 2;  // we're the main thread
+  return 0;
+}
@@ -0,0 +1,16 @@
+// checks for linux timerfd_create() support
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[]) {
+  int fd;
+  struct itimerspec its = {{0, 0}, {1, 0}};
+  if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) ==
+      -1) {
+    return 1;
+  }
+  if (timerfd_settime(fd, 0, &its, 0)) return 2;
+  if (timerfd_gettime(fd, &its) || (!its.it_value.tv_sec && !its.it_value.tv_nsec)) return 3;
+  return close(fd);
+}
@@ -0,0 +1,99 @@
+// decodes BLINK_ETRACE files into text
+//
+//     usage: etrace FILE...
+//
+// each jit path the thread entered is printed on its own line with its
+// guest address and the host tick count, and each direct branch which a
+// path followed is printed with the address it was taken from. when the
+// trace has registers, those which changed are printed beneath, so two
+// runs may be compared with diff. if the ring wrapped around, then the
+// number of records which were overwritten is printed first.
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blink/etrace.h"
+
+static const char kRegs[16][4] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8",  "r9",  "r10", "r11", "r12", "r13", "r14", "r15",
+};
+
+static unsigned long long GetPc(u64 what) {
+  return what & 0x00ffffffffffffffull;
+}
+
+static int Decode(const char *path) {
+  FILE *f;
+  u64 i, n;
+  long long tick = 0;
+  struct EtraceHeader hdr;
+  struct EtraceRecord *recs;
+  if (!(f = fopen(path, "rb"))) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != kEtraceMagic ||
+      hdr.recsize != sizeof(*recs) || !hdr.records ||
+      (hdr.records & (hdr.records - 1))) {
+    fprintf(stderr, "%s: not an etrace file for this host\n", path);
+    fclose(f);
+    return 1;
+  }
+  if (!(recs = malloc(hdr.records * sizeof(*recs))) ||
+      fread(recs, sizeof(*recs), hdr.records, f) != hdr.records) {
+    fprintf(stderr, "%s: truncated\n", path);
+    fclose(f);
+    free(recs);
+    return 1;
+  }
+  fclose(f);
+  printf("# pid %d tid %d\n", hdr.pid, hdr.tid);
+  n = hdr.head < hdr.records ? hdr.head : hdr.records;
+  i = hdr.head - n;
+  if (i) {
+    printf("# %llu older records were overwritten\n", (unsigned long long)i);
+    // registers whose path record got overwritten can't be placed
+    while (i < hdr.head && recs[i & (hdr.records - 1)].what >> 56 ==
+                               kEtraceReg) {
+      ++i;
+    }
+  }
+  for (; i < hdr.head; ++i) {
+    struct EtraceRecord *e = recs + (i & (hdr.records - 1));
+    switch (e->what >> 56) {
+      case kEtracePath:
+        printf("%012llx +%lld\n", GetPc(e->what),
+               tick ? (long long)e->value - tick : 0);
+        tick = e->value;
+        break;
+      case kEtraceEdge:
+        printf("%012llx <- %012llx\n", GetPc(e->what),
+               (unsigned long long)e->value);
+        break;
+      case kEtraceReg:
+        printf("\t%s %#llx\n", kRegs[e->what & 15],
+               (unsigned long long)e->value);
+        break;
+      default:
+        printf("# unknown record %#llx %#llx\n", (unsigned long long)e->what,
+               (unsigned long long)e->value);
+        break;
+    }
+  }
+  free(recs);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  int i, rc;
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s FILE...\n", argv[0]);
+    return 1;
+  }
+  for (rc = 0, i = 1; i < argc; ++i) {
+    rc |= Decode(argv[i]);
+  }
+  return rc;
+}